@@ -215,6 +215,12 @@ LOCAL_SRC_FILES := \
     adb_client.cpp \
     bugreport.cpp \
     bugreport_test.cpp \
+    file_sync_compression.cpp \
+    file_sync_compression_test.cpp \
+    file_sync_delta.cpp \
+    file_sync_delta_test.cpp \
+    framebuffer_delta.cpp \
+    framebuffer_delta_test.cpp \
     line_printer.cpp \
     services.cpp \
     shell_service_protocol.cpp \
@@ -233,6 +239,7 @@ LOCAL_STATIC_LIBRARIES := \
     libdiagnose_usb \
     libmdnssd \
     libgmock_host \
+    libz \
 
 LOCAL_STATIC_LIBRARIES_linux := libusb
 LOCAL_STATIC_LIBRARIES_darwin := libusb
@@ -269,6 +276,8 @@ LOCAL_SRC_FILES := \
     console.cpp \
     commandline.cpp \
     file_sync_client.cpp \
+    file_sync_compression.cpp \
+    file_sync_delta.cpp \
     line_printer.cpp \
     services.cpp \
     shell_service_protocol.cpp \
@@ -301,6 +310,7 @@ LOCAL_STATIC_LIBRARIES := \
     libdiagnose_usb \
     liblog \
     libmdnssd \
+    libz \
 
 # Don't use libcutils on Windows.
 LOCAL_STATIC_LIBRARIES_darwin := libcutils
@@ -336,7 +346,10 @@ LOCAL_SRC_FILES := \
     daemon/main.cpp \
     daemon/mdns.cpp \
     services.cpp \
+    file_sync_compression.cpp \
+    file_sync_delta.cpp \
     file_sync_service.cpp \
+    framebuffer_delta.cpp \
     framebuffer_service.cpp \
     remount_service.cpp \
     set_verity_enable_state_service.cpp \
@@ -383,6 +396,7 @@ LOCAL_STATIC_LIBRARIES := \
     libminijail \
     libmdnssd \
     libdebuggerd_handler \
+    libz \
 
 include $(BUILD_EXECUTABLE)
 
@@ -21,6 +21,7 @@
 
 #include <ctype.h>
 #include <errno.h>
+#include <inttypes.h>
 #include <stdarg.h>
 #include <stddef.h>
 #include <stdint.h>
@@ -30,6 +31,7 @@
 #include <sys/time.h>
 #include <time.h>
 
+#include <algorithm>
 #include <chrono>
 #include <condition_variable>
 #include <mutex>
@@ -51,6 +53,8 @@
 #include "adb_listeners.h"
 #include "adb_unique_fd.h"
 #include "adb_utils.h"
+#include "fdevent.h"
+#include "socket.h"
 #include "sysdeps/chrono.h"
 #include "transport.h"
 
@@ -116,22 +120,95 @@ uint32_t calculate_apacket_checksum(const apacket* p) {
     return sum;
 }
 
-apacket* get_apacket(void)
+// Free packets of one payload size.  Packets are handed between threads
+// over socketpairs, so a packet is often freed by a thread other than the
+// one that allocated it and the pools are locked rather than per thread.
+struct apacket_pool {
+    const size_t capacity;
+    const size_t max_free;
+
+    std::mutex lock;
+    apacket* free_list = nullptr;
+    size_t free_count = 0;
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    uint64_t releases = 0;
+
+    apacket_pool(size_t capacity, size_t max_free) : capacity(capacity), max_free(max_free) {}
+};
+
+// Control packets (OKAY, CLSE, OPEN, CNXN, AUTH) fit the small class, bulk
+// data takes the large one.  The large pool is kept short, each is 256KiB.
+static apacket_pool& apacket_pool_for(size_t payload) {
+    static auto& small = *new apacket_pool(MAX_PAYLOAD_V1, 256);
+    static auto& large = *new apacket_pool(MAX_PAYLOAD, 8);
+    return (payload <= small.capacity) ? small : large;
+}
+
+apacket* get_apacket(size_t payload)
 {
-    apacket* p = reinterpret_cast<apacket*>(malloc(sizeof(apacket)));
+    apacket_pool& pool = apacket_pool_for(payload);
+    apacket* p = nullptr;
+    {
+        std::lock_guard<std::mutex> lock(pool.lock);
+        if (pool.free_list) {
+            p = pool.free_list;
+            pool.free_list = p->next;
+            --pool.free_count;
+            ++pool.hits;
+        } else {
+            ++pool.misses;
+        }
+    }
+
     if (p == nullptr) {
-      fatal("failed to allocate an apacket");
+        p = reinterpret_cast<apacket*>(malloc(offsetof(apacket, data) + pool.capacity));
+        if (p == nullptr) {
+          fatal("failed to allocate an apacket");
+        }
     }
 
-    memset(p, 0, sizeof(apacket) - MAX_PAYLOAD);
+    memset(p, 0, offsetof(apacket, data));
+    p->capacity = pool.capacity;
     return p;
 }
 
 void put_apacket(apacket *p)
 {
+    apacket_pool& pool = apacket_pool_for(p->capacity);
+    {
+        std::lock_guard<std::mutex> lock(pool.lock);
+        if (pool.free_count < pool.max_free) {
+            p->next = pool.free_list;
+            pool.free_list = p;
+            ++pool.free_count;
+            return;
+        }
+        ++pool.releases;
+    }
     free(p);
 }
 
+std::string apacket_pool_stats() {
+    std::string result;
+    for (size_t payload : {MAX_PAYLOAD_V1, MAX_PAYLOAD}) {
+        apacket_pool& pool = apacket_pool_for(payload);
+        std::lock_guard<std::mutex> lock(pool.lock);
+        uint64_t total = pool.hits + pool.misses;
+        result += android::base::StringPrintf(
+            "apacket %zu: %" PRIu64 " hits %" PRIu64 " misses (%" PRIu64
+            "%% hit) %" PRIu64 " freed %zu pooled\n",
+            pool.capacity, pool.hits, pool.misses, total ? (pool.hits * 100 / total) : 0,
+            pool.releases, pool.free_count);
+    }
+    return result;
+}
+
+std::string perf_report() {
+    return apacket_pool_stats() + list_transport_stats() + list_transport_perf() +
+           list_socket_stats() + fdevent_stats();
+}
+
 void handle_online(atransport *t)
 {
     D("adb: online");
@@ -195,7 +272,7 @@ void print_packet(const char *label, apacket *p)
 static void send_ready(unsigned local, unsigned remote, atransport *t)
 {
     D("Calling send_ready");
-    apacket *p = get_apacket();
+    apacket *p = get_apacket(0);
     p->msg.command = A_OKAY;
     p->msg.arg0 = local;
     p->msg.arg1 = remote;
@@ -205,7 +282,7 @@ static void send_ready(unsigned local, unsigned remote, atransport *t)
 static void send_close(unsigned local, unsigned remote, atransport *t)
 {
     D("Calling send_close");
-    apacket *p = get_apacket();
+    apacket *p = get_apacket(0);
     p->msg.command = A_CLSE;
     p->msg.arg0 = local;
     p->msg.arg1 = remote;
@@ -238,7 +315,7 @@ std::string get_connection_string() {
 
 void send_connect(atransport* t) {
     D("Calling send_connect");
-    apacket* cp = get_apacket();
+    apacket* cp = get_apacket(MAX_PAYLOAD_V1);
     cp->msg.command = A_CNXN;
     cp->msg.arg0 = t->get_protocol_version();
     cp->msg.arg1 = t->get_max_payload();
@@ -428,7 +505,18 @@ void handle_packet(apacket *p, atransport *t)
                     s->ready(s);
                 } else if (s->peer->id == p->msg.arg0) {
                     /* Other READY messages must use the same local-id */
-                    s->ready(s);
+                    asocket* rs = s->peer;
+                    bool stalled = rs->in_flight >= rs->window;
+                    uint32_t acked = 1;
+                    if (rs->window && p->msg.data_length == sizeof(acked)) {
+                        memcpy(&acked, p->data, sizeof(acked));
+                    }
+                    rs->in_flight -= std::min<unsigned>(acked, rs->in_flight);
+
+                    // The local side only stopped reading if the window was full.
+                    if (stalled) {
+                        s->ready(s);
+                    }
                 } else {
                     D("Invalid A_OKAY(%d,%d), expected A_OKAY(%d,%d) on transport %s",
                       p->msg.arg0, p->msg.arg1, s->peer->id, p->msg.arg1, t->serial);
@@ -473,8 +561,12 @@ void handle_packet(apacket *p, atransport *t)
                 unsigned rid = p->msg.arg0;
                 p->len = p->msg.data_length;
 
+                // Counted first, as s may be gone if enqueue() fails. When the
+                // WRITE is queued instead, READY follows once the queue drains.
+                s->peer->unacked++;
                 if (s->enqueue(s, p) == 0) {
                     D("Enqueue the socket");
+                    s->peer->unacked = 0;
                     send_ready(s->id, rid, t);
                 }
                 return;
@@ -1148,6 +1240,14 @@ int handle_host_request(const char* service, TransportType type, const char* ser
         return 0;
     }
 
+    if (!strcmp(service, "stats")) {
+        return SendOkay(reply_fd, apacket_pool_stats() + list_transport_stats());
+    }
+
+    if (!strcmp(service, "perf")) {
+        return SendOkay(reply_fd, perf_report());
+    }
+
     if (!strcmp(service, "host-features")) {
         FeatureSet features = supported_features();
         // Abuse features to report libusb status.
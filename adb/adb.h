@@ -54,7 +54,7 @@ constexpr size_t LINUX_MAX_SOCKET_SIZE = 4194304;
 std::string adb_version();
 
 // Increment this when we want to force users to start a new adb server.
-#define ADB_SERVER_VERSION 39
+#define ADB_SERVER_VERSION 45
 
 using TransportId = uint64_t;
 class atransport;
@@ -75,6 +75,11 @@ struct apacket
     size_t len;
     char* ptr;
 
+    // Payload actually allocated, only packets from get_apacket(MAX_PAYLOAD)
+    // have all of data.  msg and data must stay contiguous for transports
+    // that write both in one go.
+    size_t capacity;
+
     amessage msg;
     char data[MAX_PAYLOAD];
 };
@@ -136,9 +141,6 @@ int launch_server(const std::string& socket_spec);
 int adb_server_main(int is_daemon, const std::string& socket_spec, int ack_reply_fd);
 
 /* initialize a transport object's func pointers and state */
-#if ADB_HOST
-int get_available_local_transport_index();
-#endif
 int  init_socket_transport(atransport *t, int s, int port, int local);
 void init_usb_transport(atransport* t, usb_handle* usb);
 
@@ -157,6 +159,7 @@ asocket* host_service_to_socket(const char* name, const char* serial, TransportI
 int       init_jdwp(void);
 asocket*  create_jdwp_service_socket();
 asocket*  create_jdwp_tracker_service_socket();
+asocket*  create_jdwp_delta_tracker_service_socket();
 int       create_jdwp_connection_fd(int  jdwp_pid);
 #endif
 
@@ -165,12 +168,20 @@ int handle_forward_request(const char* service, TransportType type, const char*
 
 #if !ADB_HOST
 void framebuffer_service(int fd, void *cookie);
+void framebuffer_stream_service(int fd, void *cookie);
 void set_verity_enabled_state_service(int fd, void* cookie);
 #endif
 
 /* packet allocator */
-apacket *get_apacket(void);
+// Packets are recycled through per size class pools, ask for the payload
+// size needed when known to get a small packet.
+apacket* get_apacket(size_t payload = MAX_PAYLOAD);
 void put_apacket(apacket *p);
+std::string apacket_pool_stats();
+// host:perf and perf:, everything above and where the traffic waits: in the
+// transports' queues, the local sockets' and the fdevent callbacks. Main
+// thread only.
+std::string perf_report();
 
 // Define it if you want to dump packets.
 #define DEBUG_PACKETS 0
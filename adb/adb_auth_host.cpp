@@ -445,7 +445,7 @@ static void send_auth_publickey(atransport* t) {
         return;
     }
 
-    apacket* p = get_apacket();
+    apacket* p = get_apacket(key.size() + 1);
     memcpy(p->data, key.c_str(), key.size() + 1);
 
     p->msg.command = A_AUTH;
@@ -465,7 +465,7 @@ void send_auth_response(const char* token, size_t token_size, atransport* t) {
     }
 
     LOG(INFO) << "Calling send_auth_response";
-    apacket* p = get_apacket();
+    apacket* p = get_apacket(MAX_PAYLOAD_V1);
 
     int ret = adb_auth_sign(key.get(), token, token_size, p->data);
     if (!ret) {
@@ -209,7 +209,7 @@ void send_auth_request(atransport* t) {
         return;
     }
 
-    apacket* p = get_apacket();
+    apacket* p = get_apacket(sizeof(t->token));
     memcpy(p->data, t->token, sizeof(t->token));
     p->msg.command = A_AUTH;
     p->msg.arg0 = ADB_AUTH_TOKEN;
@@ -18,13 +18,19 @@
 
 #include "bugreport.h"
 
+#include <inttypes.h>
+
+#include <chrono>
 #include <string>
 #include <vector>
 
 #include <android-base/file.h>
 #include <android-base/strings.h>
+#include <openssl/md5.h>
 
 #include "sysdeps.h"
+#include "adb_io.h"
+#include "adb_unique_fd.h"
 #include "adb_utils.h"
 #include "file_sync_service.h"
 
@@ -34,6 +40,65 @@ static constexpr char BUGZ_PROGRESS_SEPARATOR[] = "/";
 static constexpr char BUGZ_OK_PREFIX[] = "OK:";
 static constexpr char BUGZ_FAIL_PREFIX[] = "FAIL:";
 
+// How often the bug report is copied while it is still being generated.
+static constexpr int BUGZ_STREAM_INTERVAL_MS = 1000;
+
+// Appends the output of a "tail" of the bug report to the local copy.
+class BugreportStreamCallback : public StandardStreamsCallbackInterface {
+  public:
+    BugreportStreamCallback(int fd, uint64_t* size) : fd_(fd), size_(size), failed_(false) {
+    }
+
+    void OnStdout(const char* buffer, int length) {
+        if (failed_) return;
+        if (!WriteFdExactly(fd_, buffer, length)) {
+            failed_ = true;
+            return;
+        }
+        *size_ += length;
+    }
+
+    void OnStderr(const char* buffer, int length) {
+    }
+
+    int Done(int status) {
+        return status;
+    }
+
+    bool failed() const {
+        return failed_;
+    }
+
+  private:
+    int fd_;
+    uint64_t* size_;
+    bool failed_;
+
+    DISALLOW_COPY_AND_ASSIGN(BugreportStreamCallback);
+};
+
+static std::string md5_file(const std::string& path) {
+    unique_fd fd(adb_open(path.c_str(), O_RDONLY));
+    if (fd == -1) return "";
+
+    MD5_CTX ctx;
+    MD5_Init(&ctx);
+    char buf[BUFSIZ];
+    int n;
+    while ((n = adb_read(fd, buf, sizeof(buf))) > 0) {
+        MD5_Update(&ctx, buf, n);
+    }
+    if (n < 0) return "";
+
+    unsigned char digest[MD5_DIGEST_LENGTH];
+    MD5_Final(digest, &ctx);
+    std::string result;
+    for (unsigned char c : digest) {
+        result += android::base::StringPrintf("%02x", c);
+    }
+    return result;
+}
+
 // Custom callback used to handle the output of zipped bugreports.
 class BugreportStandardStreamsCallback : public StandardStreamsCallbackInterface {
   public:
@@ -48,7 +113,13 @@ class BugreportStandardStreamsCallback : public StandardStreamsCallbackInterface
           show_progress_(show_progress),
           status_(0),
           line_(),
-          last_progress_percentage_(0) {
+          last_progress_percentage_(0),
+          stream_src_(),
+          stream_dest_(),
+          stream_fd_(),
+          streamed_(0),
+          stream_failed_(false),
+          last_stream_() {
         SetLineMessage("generating");
     }
 
@@ -92,12 +163,9 @@ class BugreportStandardStreamsCallback : public StandardStreamsCallbackInterface
                         BUGZ_FAIL_PREFIX);
                 return -1;
             }
-            std::string destination;
-            if (dest_dir_.empty()) {
-                destination = dest_file_;
-            } else {
-                destination = android::base::StringPrintf("%s%c%s", dest_dir_.c_str(),
-                                                          OS_PATH_SEPARATOR, dest_file_.c_str());
+            std::string destination = Destination();
+            if (FinishStream(destination)) {
+                return 0;
             }
             std::vector<const char*> srcs{src_file_.c_str()};
             SetLineMessage("pulling");
@@ -115,6 +183,83 @@ class BugreportStandardStreamsCallback : public StandardStreamsCallbackInterface
     }
 
   private:
+    std::string Destination() const {
+        if (dest_dir_.empty()) {
+            return dest_file_;
+        }
+        return android::base::StringPrintf("%s%c%s", dest_dir_.c_str(), OS_PATH_SEPARATOR,
+                                           dest_file_.c_str());
+    }
+
+    // Appends the output of |command|, a tail of the bug report from what was already copied,
+    // to the local copy.
+    void StreamFrom(const std::string& command) {
+        if (stream_fd_ == -1) {
+            stream_dest_ = Destination();
+            stream_fd_.reset(adb_creat(stream_dest_.c_str(), 0644));
+            if (stream_fd_ == -1) {
+                D("failed to create '%s' to stream the bug report to", stream_dest_.c_str());
+                stream_failed_ = true;
+                return;
+            }
+        }
+
+        BugreportStreamCallback callback(stream_fd_, &streamed_);
+        // A tail that fails before the file exists copies nothing, and that's fine.
+        br_->SendShellCommand(command, false, &callback);
+        if (callback.failed()) {
+            stream_failed_ = true;
+        }
+    }
+
+    // Copies what was added to the bug report since the last time, while bugreportz keeps
+    // writing it. The zip is written front to back, so what was copied stays valid.
+    void StreamMore() {
+        if (stream_src_.empty() || stream_failed_) return;
+
+        auto now = std::chrono::steady_clock::now();
+        if (now - last_stream_ < std::chrono::milliseconds(br_->stream_interval_ms_)) return;
+        last_stream_ = now;
+
+        // dumpstate writes the zip under a .tmp name and renames it once it's done.
+        std::string src = escape_arg(stream_src_);
+        std::string offset = std::to_string(streamed_ + 1);
+        StreamFrom("tail -c +" + offset + " " + src + ".tmp 2>/dev/null || tail -c +" + offset +
+                   " " + src);
+    }
+
+    // Copies the rest of a bug report that was streamed, and checks all of it against the
+    // device's. Returns true if that left the bug report at |destination|, false if it still
+    // needs to be pulled.
+    bool FinishStream(const std::string& destination) {
+        if (stream_fd_ == -1) return false;
+
+        bool ok = !stream_failed_ && streamed_ > 0 && stream_dest_ == destination;
+        if (ok) {
+            StreamFrom(android::base::StringPrintf("tail -c +%" PRIu64 " %s", streamed_ + 1,
+                                                   escape_arg(src_file_).c_str()));
+            ok = !stream_failed_;
+        }
+        stream_fd_.reset();
+
+        if (ok) {
+            // Whether the device's zip only ever grew at the end, or was patched in place.
+            std::string md5_stdout, md5_stderr;
+            DefaultStandardStreamsCallback md5_callback(&md5_stdout, &md5_stderr);
+            int status = br_->SendShellCommand("md5sum " + escape_arg(src_file_), false,
+                                               &md5_callback);
+            std::vector<std::string> fields = android::base::Split(md5_stdout, " ");
+            ok = status == 0 && fields[0] == md5_file(stream_dest_);
+        }
+
+        if (!ok) {
+            D("streamed %" PRIu64 " bytes of '%s' to '%s', pulling it all again", streamed_,
+              src_file_.c_str(), stream_dest_.c_str());
+            adb_unlink(stream_dest_.c_str());
+        }
+        return ok;
+    }
+
     void SetLineMessage(const std::string& action) {
         line_message_ = action + " " + android::base::Basename(dest_file_);
     }
@@ -133,6 +278,8 @@ class BugreportStandardStreamsCallback : public StandardStreamsCallbackInterface
 
         if (android::base::StartsWith(line, BUGZ_BEGIN_PREFIX)) {
             SetSrcFile(&line[strlen(BUGZ_BEGIN_PREFIX)]);
+            stream_src_ = src_file_;
+            last_stream_ = std::chrono::steady_clock::now();
         } else if (android::base::StartsWith(line, BUGZ_OK_PREFIX)) {
             SetSrcFile(&line[strlen(BUGZ_OK_PREFIX)]);
         } else if (android::base::StartsWith(line, BUGZ_FAIL_PREFIX)) {
@@ -149,6 +296,7 @@ class BugreportStandardStreamsCallback : public StandardStreamsCallbackInterface
             int progress = std::stoi(line.substr(idx1, (idx2 - idx1)));
             int total = std::stoi(line.substr(idx2 + 1));
             int progress_percentage = (progress * 100 / total);
+            StreamMore();
             if (progress_percentage != 0 && progress_percentage <= last_progress_percentage_) {
                 // Ignore.
                 return;
@@ -192,9 +340,22 @@ class BugreportStandardStreamsCallback : public StandardStreamsCallbackInterface
     // Since dumpstate progress can recede, only forward progress should be displayed
     int last_progress_percentage_;
 
+    // While bugreportz runs, the bug report it named in its BEGIN line is copied to
+    // stream_dest_ a piece at a time, as PROGRESS lines come in. What is left is copied after
+    // OK, rather than the whole file.
+    std::string stream_src_;
+    std::string stream_dest_;
+    unique_fd stream_fd_;
+    uint64_t streamed_;
+    bool stream_failed_;
+    std::chrono::steady_clock::time_point last_stream_;
+
     DISALLOW_COPY_AND_ASSIGN(BugreportStandardStreamsCallback);
 };
 
+Bugreport::Bugreport() : line_printer_(), stream_interval_ms_(BUGZ_STREAM_INTERVAL_MS) {
+}
+
 int Bugreport::DoIt(int argc, const char** argv) {
     if (argc > 2) return syntax_error("adb bugreport [PATH]");
 
@@ -27,8 +27,7 @@ class Bugreport {
     friend class BugreportStandardStreamsCallback;
 
   public:
-    Bugreport() : line_printer_() {
-    }
+    Bugreport();
     int DoIt(int argc, const char** argv);
 
   protected:
@@ -41,6 +40,9 @@ class Bugreport {
     virtual bool DoSyncPull(const std::vector<const char*>& srcs, const char* dst, bool copy_attrs,
                             const char* name);
 
+    // How long to wait between copies of the bug report while it's being generated.
+    int stream_interval_ms_;
+
   private:
     virtual void UpdateProgress(const std::string& file_name, int progress_percentage);
     LinePrinter line_printer_;
@@ -19,6 +19,7 @@
 #include <gmock/gmock.h>
 #include <gtest/gtest.h>
 
+#include <android-base/file.h>
 #include <android-base/strings.h>
 #include <android-base/test_utils.h>
 
@@ -123,6 +124,10 @@ class BugreportMock : public Bugreport {
     MOCK_METHOD4(DoSyncPull, bool(const std::vector<const char*>& srcs, const char* dst,
                                   bool copy_attrs, const char* name));
     MOCK_METHOD2(UpdateProgress, void(const std::string&, int));
+
+    void SetStreamInterval(int ms) {
+        stream_interval_ms_ = ms;
+    }
 };
 
 class BugreportTest : public ::testing::Test {
@@ -351,6 +356,77 @@ TEST_F(BugreportTest, OkDirectory) {
     ASSERT_EQ(0, br_.DoIt(2, args));
 }
 
+// Tests 'adb bugreport dir' when the bug report is copied while it's being generated.
+TEST_F(BugreportTest, OkStreamed) {
+    ExpectBugreportzVersion("1.1");
+    br_.SetStreamInterval(0);
+    TemporaryDir td;
+    std::string dest_file =
+        android::base::StringPrintf("%s%cda_bugreport.zip", td.path, OS_PATH_SEPARATOR);
+    ExpectProgress(10, "da_bugreport.zip");
+    ExpectProgress(50, "da_bugreport.zip");
+
+    EXPECT_CALL(br_, SendShellCommand("bugreportz -p", false, _))
+        .WillOnce(DoAll(WithArg<2>(WriteOnStdout("BEGIN:/device/da_bugreport.zip\n")),
+                        WithArg<2>(WriteOnStdout("PROGRESS:10/100\n")),
+                        WithArg<2>(WriteOnStdout("PROGRESS:50/100\n")),
+                        WithArg<2>(WriteOnStdout("OK:/device/da_bugreport.zip\n")),
+                        WithArg<2>(ReturnCallbackDone())));
+    EXPECT_CALL(br_, SendShellCommand("tail -c +1 '/device/da_bugreport.zip'.tmp 2>/dev/null || "
+                                      "tail -c +1 '/device/da_bugreport.zip'",
+                                      false, _))
+        .WillOnce(DoAll(WithArg<2>(WriteOnStdout("zip part 1, ")), Return(0)));
+    EXPECT_CALL(br_, SendShellCommand("tail -c +13 '/device/da_bugreport.zip'.tmp 2>/dev/null || "
+                                      "tail -c +13 '/device/da_bugreport.zip'",
+                                      false, _))
+        .WillOnce(DoAll(WithArg<2>(WriteOnStdout("part 2, ")), Return(0)));
+    EXPECT_CALL(br_, SendShellCommand("tail -c +21 '/device/da_bugreport.zip'", false, _))
+        .WillOnce(DoAll(WithArg<2>(WriteOnStdout("and the end")), Return(0)));
+    EXPECT_CALL(br_, SendShellCommand("md5sum '/device/da_bugreport.zip'", false, _))
+        .WillOnce(DoAll(WithArg<2>(WriteOnStdout("324a862318ee05f434b4c80f29bbac25  "
+                                                 "/device/da_bugreport.zip\n")),
+                        Return(0)));
+    EXPECT_CALL(br_, DoSyncPull(_, _, _, _)).Times(0);
+
+    const char* args[] = {"bugreport", td.path};
+    ASSERT_EQ(0, br_.DoIt(2, args));
+
+    std::string contents;
+    ASSERT_TRUE(android::base::ReadFileToString(dest_file, &contents));
+    ASSERT_EQ("zip part 1, part 2, and the end", contents);
+}
+
+// Tests 'adb bugreport dir' when what was copied while the bug report was being generated
+// doesn't add up to the device's, so it's pulled again.
+TEST_F(BugreportTest, StreamedMismatchPulled) {
+    ExpectBugreportzVersion("1.1");
+    br_.SetStreamInterval(0);
+    TemporaryDir td;
+    std::string dest_file =
+        android::base::StringPrintf("%s%cda_bugreport.zip", td.path, OS_PATH_SEPARATOR);
+    ExpectProgress(50, "da_bugreport.zip");
+
+    EXPECT_CALL(br_, SendShellCommand("bugreportz -p", false, _))
+        .WillOnce(DoAll(WithArg<2>(WriteOnStdout("BEGIN:/device/da_bugreport.zip\n")),
+                        WithArg<2>(WriteOnStdout("PROGRESS:50/100\n")),
+                        WithArg<2>(WriteOnStdout("OK:/device/da_bugreport.zip\n")),
+                        WithArg<2>(ReturnCallbackDone())));
+    EXPECT_CALL(br_, SendShellCommand(HasSubstr("tail -c +1 "), false, _))
+        .WillOnce(DoAll(WithArg<2>(WriteOnStdout("stale")), Return(0)));
+    EXPECT_CALL(br_, SendShellCommand("tail -c +6 '/device/da_bugreport.zip'", false, _))
+        .WillOnce(Return(0));
+    EXPECT_CALL(br_, SendShellCommand("md5sum '/device/da_bugreport.zip'", false, _))
+        .WillOnce(DoAll(WithArg<2>(WriteOnStdout("324a862318ee05f434b4c80f29bbac25  "
+                                                 "/device/da_bugreport.zip\n")),
+                        Return(0)));
+    EXPECT_CALL(br_, DoSyncPull(ElementsAre(StrEq("/device/da_bugreport.zip")), StrEq(dest_file),
+                                false, StrEq("pulling da_bugreport.zip")))
+        .WillOnce(Return(true));
+
+    const char* args[] = {"bugreport", td.path};
+    ASSERT_EQ(0, br_.DoIt(2, args));
+}
+
 // Tests 'adb bugreport file' when it succeeds
 TEST_F(BugreportTest, OkNoExtension) {
     ExpectBugreportzVersion("1.1");
@@ -20,13 +20,17 @@
 
 #include <stdint.h>
 
+#include <algorithm>
 #include <atomic>
 #include <chrono>
+#include <condition_variable>
+#include <deque>
 #include <memory>
 #include <mutex>
 #include <string>
 #include <thread>
 #include <unordered_map>
+#include <vector>
 
 #include <libusb/libusb.h>
 
@@ -62,29 +66,76 @@ struct DeviceHandleDeleter {
 
 using unique_device_handle = std::unique_ptr<libusb_device_handle, DeviceHandleDeleter>;
 
-struct transfer_info {
-    transfer_info(const char* name, uint16_t zero_mask, bool is_bulk_out)
-        : name(name),
-          transfer(libusb_alloc_transfer(0)),
-          is_bulk_out(is_bulk_out),
-          zero_mask(zero_mask) {}
+// Transfers kept queued in each direction, unless overridden by
+// ADB_LIBUSB_QUEUE_DEPTH.  A single transfer at a time leaves the link idle
+// for a round trip per packet, which hurts most behind hubs.
+static constexpr size_t kDefaultQueueDepth = 4;
+static constexpr size_t kMaxQueueDepth = 32;
+
+// Size of each queued read.  A multiple of every bulk max packet size, so the
+// device can't overflow it.
+static constexpr size_t kReadBlockSize = 64 * 1024;
+
+static size_t transfer_queue_depth() {
+    static size_t depth = []() {
+        const char* env = getenv("ADB_LIBUSB_QUEUE_DEPTH");
+        size_t value = env ? strtoul(env, nullptr, 10) : kDefaultQueueDepth;
+        return std::max<size_t>(1, std::min(value, kMaxQueueDepth));
+    }();
+    return depth;
+}
+
+struct transfer_queue;
+
+struct transfer_block {
+    explicit transfer_block(transfer_queue* queue)
+        : queue(queue), transfer(libusb_alloc_transfer(0)) {}
 
-    ~transfer_info() {
+    ~transfer_block() {
         libusb_free_transfer(transfer);
     }
 
-    const char* name;
+    transfer_queue* queue;
     libusb_transfer* transfer;
-    bool is_bulk_out;
-    bool transfer_complete;
-    std::condition_variable cv;
+    std::vector<unsigned char> buffer;
+};
+
+// The transfers of one direction.  For reads |ready| holds completed transfers
+// in completion order, which libusb guarantees matches submission order on an
+// endpoint; for writes it holds the idle transfers.
+struct transfer_queue {
+    explicit transfer_queue(const char* name) : name(name) {}
+
+    const char* name;
     std::mutex mutex;
-    uint16_t zero_mask;
+    std::condition_variable cv;
+    std::vector<std::unique_ptr<transfer_block>> blocks;
+    std::deque<transfer_block*> ready;
+    size_t in_flight = 0;
+    bool failed = false;
+
+    // Read side only: the completed transfer being consumed.
+    bool started = false;
+    transfer_block* current = nullptr;
+    size_t offset = 0;
+
+    void Cancel() {
+        std::vector<libusb_transfer*> transfers;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            for (const auto& block : blocks) {
+                transfers.push_back(block->transfer);
+            }
+        }
+        // Transfers that aren't in flight just return LIBUSB_ERROR_NOT_FOUND.
+        for (libusb_transfer* transfer : transfers) {
+            libusb_cancel_transfer(transfer);
+        }
+    }
 
-    void Notify() {
-        LOG(DEBUG) << "notifying " << name << " transfer complete";
-        transfer_complete = true;
-        cv.notify_one();
+    void WaitIdle() {
+        std::unique_lock<std::mutex> lock(mutex);
+        cv.wait(lock, [this]() { return in_flight == 0; });
     }
 };
 
@@ -97,15 +148,20 @@ struct usb_handle : public ::usb_handle {
           serial(serial),
           closing(false),
           device_handle(device_handle.release()),
-          read("read", zero_mask, false),
-          write("write", zero_mask, true),
+          read_queue("read"),
+          write_queue("write"),
           interface(interface),
           bulk_in(bulk_in),
           bulk_out(bulk_out),
+          zero_mask(zero_mask),
           max_packet_size(max_packet_size) {}
 
     ~usb_handle() {
         Close();
+
+        // Cancelled transfers still call back into their queues.
+        read_queue.WaitIdle();
+        write_queue.WaitIdle();
     }
 
     void Close() {
@@ -125,8 +181,8 @@ struct usb_handle : public ::usb_handle {
         device_handle = nullptr;
 
         // Cancel already dispatched transfers.
-        libusb_cancel_transfer(read.transfer);
-        libusb_cancel_transfer(write.transfer);
+        read_queue.Cancel();
+        write_queue.Cancel();
 
         libusb_release_interface(handle, interface);
         libusb_close(handle);
@@ -139,13 +195,14 @@ struct usb_handle : public ::usb_handle {
     std::mutex device_handle_mutex;
     libusb_device_handle* device_handle;
 
-    transfer_info read;
-    transfer_info write;
+    transfer_queue read_queue;
+    transfer_queue write_queue;
 
     uint8_t interface;
     uint8_t bulk_in;
     uint8_t bulk_out;
 
+    uint16_t zero_mask;
     size_t max_packet_size;
 };
 
@@ -493,130 +550,213 @@ void usb_cleanup() {
     libusb_hotplug_deregister_callback(nullptr, hotplug_handle);
 }
 
-// Dispatch a libusb transfer, unlock |device_lock|, and then wait for the result.
-static int perform_usb_transfer(usb_handle* h, transfer_info* info,
-                                std::unique_lock<std::mutex> device_lock) {
-    libusb_transfer* transfer = info->transfer;
-
-    transfer->user_data = info;
-    transfer->callback = [](libusb_transfer* transfer) {
-        transfer_info* info = static_cast<transfer_info*>(transfer->user_data);
-
-        LOG(DEBUG) << info->name << " transfer callback entered";
-
-        // Make sure that the original submitter has made it to the condition_variable wait.
-        std::unique_lock<std::mutex> lock(info->mutex);
+static void LIBUSB_CALL transfer_callback(libusb_transfer* transfer) {
+    transfer_block* block = static_cast<transfer_block*>(transfer->user_data);
+    transfer_queue* queue = block->queue;
 
-        LOG(DEBUG) << info->name << " callback successfully acquired lock";
-
-        if (transfer->status != LIBUSB_TRANSFER_COMPLETED) {
-            LOG(WARNING) << info->name
+    std::lock_guard<std::mutex> lock(queue->mutex);
+    --queue->in_flight;
+    if (transfer->status != LIBUSB_TRANSFER_COMPLETED) {
+        if (transfer->status != LIBUSB_TRANSFER_CANCELLED) {
+            LOG(WARNING) << queue->name
                          << " transfer failed: " << libusb_error_name(transfer->status);
-            info->Notify();
-            return;
         }
+        queue->failed = true;
+    } else if (endpoint_is_output(transfer->endpoint) &&
+               transfer->actual_length != transfer->length) {
+        // Later writes are already queued behind this one, so the rest can't be resubmitted.
+        LOG(WARNING) << queue->name << " transfer incomplete: " << transfer->actual_length
+                     << " of " << transfer->length << " bytes";
+        queue->failed = true;
+    }
+    queue->ready.push_back(block);
+    queue->cv.notify_all();
+}
 
-        // usb_read() can return when receiving some data.
-        if (info->is_bulk_out && transfer->actual_length != transfer->length) {
-            LOG(DEBUG) << info->name << " transfer incomplete, resubmitting";
-            transfer->length -= transfer->actual_length;
-            transfer->buffer += transfer->actual_length;
-            int rc = libusb_submit_transfer(transfer);
-            if (rc != 0) {
-                LOG(WARNING) << "failed to submit " << info->name
-                             << " transfer: " << libusb_error_name(rc);
-                transfer->status = LIBUSB_TRANSFER_ERROR;
-                info->Notify();
-            }
-            return;
-        }
+// Submit |block| for |length| bytes.  Called with h->device_handle_mutex held, so that
+// nothing gets submitted once Close has cancelled the queue.
+static bool submit_block(usb_handle* h, transfer_block* block, uint8_t endpoint, size_t length) {
+    transfer_queue* queue = block->queue;
+    libusb_fill_bulk_transfer(block->transfer, h->device_handle, endpoint, block->buffer.data(),
+                              length, transfer_callback, block, 0);
 
-        if (should_perform_zero_transfer(transfer->endpoint, transfer->length, info->zero_mask)) {
-            LOG(DEBUG) << "submitting zero-length write";
-            transfer->length = 0;
-            int rc = libusb_submit_transfer(transfer);
-            if (rc != 0) {
-                LOG(WARNING) << "failed to submit zero-length write: " << libusb_error_name(rc);
-                transfer->status = LIBUSB_TRANSFER_ERROR;
-                info->Notify();
-            }
-            return;
-        }
+    std::lock_guard<std::mutex> lock(queue->mutex);
+    int rc = libusb_submit_transfer(block->transfer);
+    if (rc != 0) {
+        LOG(WARNING) << "failed to submit " << queue->name
+                     << " transfer: " << libusb_error_name(rc);
+        queue->failed = true;
+        queue->cv.notify_all();
+        return false;
+    }
+    ++queue->in_flight;
+    return true;
+}
 
-        LOG(VERBOSE) << info->name << "transfer fully complete";
-        info->Notify();
-    };
+// Reads are queued on first use and each is resubmitted as soon as it has been consumed,
+// so the device always has somewhere to send to.
+static bool start_reads(usb_handle* h) {
+    std::unique_lock<std::mutex> device_lock(h->device_handle_mutex);
+    transfer_queue* queue = &h->read_queue;
+    if (queue->started) {
+        return true;
+    }
+    if (!h->device_handle) {
+        return false;
+    }
+    queue->started = true;
+
+    for (size_t i = 0; i < transfer_queue_depth(); ++i) {
+        transfer_block* block = new transfer_block(queue);
+        block->buffer.resize(kReadBlockSize);
+        {
+            std::lock_guard<std::mutex> lock(queue->mutex);
+            queue->blocks.emplace_back(block);
+        }
+        if (!submit_block(h, block, h->bulk_in, kReadBlockSize)) {
+            return false;
+        }
+    }
+    return true;
+}
 
-    LOG(DEBUG) << "locking " << info->name << " transfer_info mutex";
-    std::unique_lock<std::mutex> lock(info->mutex);
-    info->transfer_complete = false;
-    LOG(DEBUG) << "submitting " << info->name << " transfer";
-    int rc = libusb_submit_transfer(transfer);
-    if (rc != 0) {
-        LOG(WARNING) << "failed to submit " << info->name << " transfer: " << libusb_error_name(rc);
-        errno = EIO;
-        return -1;
+static void resubmit_read(usb_handle* h, transfer_block* block) {
+    std::unique_lock<std::mutex> device_lock(h->device_handle_mutex);
+    if (!h->device_handle) {
+        std::lock_guard<std::mutex> lock(block->queue->mutex);
+        block->queue->failed = true;
+        return;
     }
+    submit_block(h, block, h->bulk_in, kReadBlockSize);
+}
 
-    LOG(DEBUG) << info->name << " transfer successfully submitted";
-    device_lock.unlock();
-    info->cv.wait(lock, [info]() { return info->transfer_complete; });
-    if (transfer->status != 0) {
-        errno = EIO;
-        return -1;
+// Take an idle write transfer, waiting for one to complete if the queue is full.
+static transfer_block* get_write_block(usb_handle* h) {
+    transfer_queue* queue = &h->write_queue;
+    std::unique_lock<std::mutex> lock(queue->mutex);
+    if (queue->ready.empty() && queue->blocks.size() < transfer_queue_depth()) {
+        queue->blocks.emplace_back(new transfer_block(queue));
+        return queue->blocks.back().get();
+    }
+    queue->cv.wait(lock, [queue]() { return !queue->ready.empty() || queue->failed; });
+    if (queue->failed) {
+        return nullptr;
     }
+    transfer_block* block = queue->ready.front();
+    queue->ready.pop_front();
+    return block;
+}
 
-    return 0;
+static void put_write_block(transfer_block* block) {
+    std::lock_guard<std::mutex> lock(block->queue->mutex);
+    block->queue->ready.push_back(block);
+    block->queue->cv.notify_all();
 }
 
+// Writes are copied and queued, returning without waiting for the device.  A failure is
+// reported by the next write, which is when the transport would notice it anyway.
 int usb_write(usb_handle* h, const void* d, int len) {
     LOG(DEBUG) << "usb_write of length " << len;
 
-    std::unique_lock<std::mutex> lock(h->device_handle_mutex);
-    if (!h->device_handle) {
+    transfer_block* block = get_write_block(h);
+    if (!block) {
         errno = EIO;
         return -1;
     }
+    block->buffer.resize(std::max(block->buffer.size(), static_cast<size_t>(len)));
+    memcpy(block->buffer.data(), d, len);
+
+    transfer_block* zero_block = nullptr;
+    if (should_perform_zero_transfer(h->bulk_out, len, h->zero_mask)) {
+        zero_block = get_write_block(h);
+        if (!zero_block) {
+            put_write_block(block);
+            errno = EIO;
+            return -1;
+        }
+    }
 
-    transfer_info* info = &h->write;
-    info->transfer->dev_handle = h->device_handle;
-    info->transfer->flags = 0;
-    info->transfer->endpoint = h->bulk_out;
-    info->transfer->type = LIBUSB_TRANSFER_TYPE_BULK;
-    info->transfer->length = len;
-    info->transfer->buffer = reinterpret_cast<unsigned char*>(const_cast<void*>(d));
-    info->transfer->num_iso_packets = 0;
+    std::unique_lock<std::mutex> device_lock(h->device_handle_mutex);
+    if (!h->device_handle || !submit_block(h, block, h->bulk_out, len)) {
+        put_write_block(block);
+        if (zero_block) put_write_block(zero_block);
+        errno = EIO;
+        return -1;
+    }
+    if (zero_block) {
+        LOG(DEBUG) << "submitting zero-length write";
+        if (!submit_block(h, zero_block, h->bulk_out, 0)) {
+            put_write_block(zero_block);
+            errno = EIO;
+            return -1;
+        }
+    }
 
-    int rc = perform_usb_transfer(h, info, std::move(lock));
-    LOG(DEBUG) << "usb_write(" << len << ") = " << rc;
-    return rc;
+    LOG(DEBUG) << "usb_write(" << len << ") queued";
+    return 0;
 }
 
+// Like a single bulk read, returns once |len| bytes have been read or the device ended a
+// transfer short, but served out of the queued reads.  A payload the device sends without a
+// terminating short packet shares a read with whatever follows it, the remainder is kept for
+// the next call.
 int usb_read(usb_handle* h, void* d, int len) {
     LOG(DEBUG) << "usb_read of length " << len;
 
-    std::unique_lock<std::mutex> lock(h->device_handle_mutex);
-    if (!h->device_handle) {
+    if (!start_reads(h)) {
         errno = EIO;
         return -1;
     }
 
-    transfer_info* info = &h->read;
-    info->transfer->dev_handle = h->device_handle;
-    info->transfer->flags = 0;
-    info->transfer->endpoint = h->bulk_in;
-    info->transfer->type = LIBUSB_TRANSFER_TYPE_BULK;
-    info->transfer->length = len;
-    info->transfer->buffer = reinterpret_cast<unsigned char*>(d);
-    info->transfer->num_iso_packets = 0;
+    transfer_queue* queue = &h->read_queue;
+    unsigned char* buffer = static_cast<unsigned char*>(d);
+    int copied = 0;
+
+    std::unique_lock<std::mutex> lock(queue->mutex);
+    while (copied < len) {
+        if (!queue->current) {
+            queue->cv.wait(lock, [queue]() { return !queue->ready.empty() || queue->failed; });
+            if (queue->ready.empty()) {
+                break;
+            }
+            queue->current = queue->ready.front();
+            queue->ready.pop_front();
+            queue->offset = 0;
+            if (queue->current->transfer->status != LIBUSB_TRANSFER_COMPLETED) {
+                queue->current = nullptr;
+                break;
+            }
+        }
+
+        libusb_transfer* transfer = queue->current->transfer;
+        size_t count = std::min(static_cast<size_t>(transfer->actual_length) - queue->offset,
+                                static_cast<size_t>(len - copied));
+        memcpy(buffer + copied, transfer->buffer + queue->offset, count);
+        copied += count;
+        queue->offset += count;
+
+        if (queue->offset == static_cast<size_t>(transfer->actual_length)) {
+            bool short_transfer = transfer->actual_length < transfer->length;
+            transfer_block* block = queue->current;
+            queue->current = nullptr;
 
-    int rc = perform_usb_transfer(h, info, std::move(lock));
-    LOG(DEBUG) << "usb_read(" << len << ") = " << rc << ", actual_length "
-               << info->transfer->actual_length;
-    if (rc < 0) {
-        return rc;
+            lock.unlock();
+            resubmit_read(h, block);
+            lock.lock();
+
+            if (short_transfer) {
+                break;
+            }
+        }
+    }
+
+    if (copied == 0 && queue->failed) {
+        LOG(DEBUG) << "usb_read(" << len << ") failed";
+        errno = EIO;
+        return -1;
     }
-    return info->transfer->actual_length;
+    LOG(DEBUG) << "usb_read(" << len << ") = " << copied;
+    return copied;
 }
 
 int usb_close(usb_handle* h) {
@@ -31,6 +31,8 @@
 #include <sys/stat.h>
 #include <sys/types.h>
 
+#include <algorithm>
+#include <atomic>
 #include <memory>
 #include <string>
 #include <thread>
@@ -207,6 +209,11 @@ static void help() {
         " reconnect                kick connection from host side to force reconnect\n"
         " reconnect device         kick connection from device side to force reconnect\n"
         " reconnect offline        reset offline/unauthorized devices to force reconnect\n"
+        " perf                     show the server's and the device's transport, socket\n"
+        "                          and event loop counters\n"
+        " sync-bench push|pull MiB [REMOTE]\n"
+        "     time an uncompressed transfer of synthetic data, pushed to REMOTE\n"
+        "     (default /dev/null) or pulled from it (default /dev/zero) and discarded\n"
         "\n"
         "environment variables:\n"
         " $ADB_TRACE\n"
@@ -214,7 +221,9 @@ static void help() {
         "     all,adb,sockets,packets,rwx,usb,sync,sysdeps,transport,jdwp\n"
         " $ADB_VENDOR_KEYS         colon-separated list of keys (files or directories)\n"
         " $ANDROID_SERIAL          serial number to connect to (see -s)\n"
-        " $ANDROID_LOG_TAGS        tags to be used by logcat (see logcat --help)\n");
+        " $ANDROID_LOG_TAGS        tags to be used by logcat (see logcat --help)\n"
+        " $ADB_SYNC_COMPRESSION    zlib level 1-9 for push/pull data, 0 for none (default 1)\n"
+        " $ADB_LOCAL_TRANSPORT_MAX emulators the server looks for at startup (default 16)\n");
     // clang-format on
 }
 
@@ -1839,6 +1848,33 @@ int adb_commandline(int argc, const char** argv) {
         return 0;
     } else if (!strcmp(argv[0], "host-features")) {
         return adb_query_command("host:host-features");
+    } else if (!strcmp(argv[0], "perf")) {
+        printf("server:\n");
+        if (adb_query_command("host:perf") != 0) return 1;
+
+        FeatureSet features;
+        std::string error;
+        if (!adb_get_feature_set(&features, &error)) {
+            // No device, the server's half is all there is.
+            return 0;
+        }
+        if (!CanUseFeature(features, kFeaturePerf)) {
+            fprintf(stderr, "error: device doesn't support perf\n");
+            return 1;
+        }
+        printf("device:\n");
+        return adb_connect_command("perf:");
+    } else if (!strcmp(argv[0], "sync-bench")) {
+        if (argc < 3 || argc > 4 || (strcmp(argv[1], "push") && strcmp(argv[1], "pull"))) {
+            return syntax_error("adb sync-bench push|pull MiB [REMOTE]");
+        }
+        bool push = !strcmp(argv[1], "push");
+        uint64_t mib;
+        if (!android::base::ParseUint(argv[2], &mib, UINT64_MAX >> 20)) {
+            return syntax_error("invalid size '%s'", argv[2]);
+        }
+        const char* rpath = (argc == 4) ? argv[3] : (push ? "/dev/null" : "/dev/zero");
+        return do_sync_bench(push, mib << 20, rpath) ? 0 : 1;
     } else if (!strcmp(argv[0], "reconnect")) {
         if (argc == 1) {
             return adb_query_command(format_host_command(argv[0]));
@@ -1932,6 +1968,51 @@ static int install_app(int argc, const char** argv) {
     return 1;
 }
 
+// install-write streams sent to one session at once.
+static constexpr int kInstallWriteJobs = 4;
+
+static bool install_write_split(const std::string& install_cmd, int session_id, int index,
+                                const char* file) {
+    struct stat sb;
+    if (stat(file, &sb) == -1) {
+        fprintf(stderr, "adb: failed to stat %s: %s\n", file, strerror(errno));
+        return false;
+    }
+
+    std::string cmd = android::base::StringPrintf(
+            "%s install-write -S %" PRIu64 " %d %d_%s -",
+            install_cmd.c_str(), static_cast<uint64_t>(sb.st_size), session_id, index,
+            android::base::Basename(file).c_str());
+
+    int localFd = adb_open(file, O_RDONLY);
+    if (localFd < 0) {
+        fprintf(stderr, "adb: failed to open %s: %s\n", file, strerror(errno));
+        return false;
+    }
+
+    std::string error;
+    int remoteFd = adb_connect(cmd, &error);
+    if (remoteFd < 0) {
+        fprintf(stderr, "adb: connect error for write: %s\n", error.c_str());
+        adb_close(localFd);
+        return false;
+    }
+
+    char buf[BUFSIZ];
+    copy_to_file(localFd, remoteFd);
+    read_status_line(remoteFd, buf, sizeof(buf));
+
+    adb_close(localFd);
+    adb_close(remoteFd);
+
+    if (strncmp("Success", buf, 7)) {
+        fprintf(stderr, "adb: failed to write %s\n", file);
+        fputs(buf, stderr);
+        return false;
+    }
+    return true;
+}
+
 static int install_multiple_app(int argc, const char** argv) {
     // Find all APK arguments starting at end.
     // All other arguments passed through verbatim.
@@ -1989,53 +2070,26 @@ static int install_multiple_app(int argc, const char** argv) {
         return EXIT_FAILURE;
     }
 
-    // Valid session, now stream the APKs
-    int success = 1;
-    for (int i = first_apk; i < argc; i++) {
-        const char* file = argv[i];
-        struct stat sb;
-        if (stat(file, &sb) == -1) {
-            fprintf(stderr, "adb: failed to stat %s: %s\n", file, strerror(errno));
-            success = 0;
-            goto finalize_session;
-        }
-
-        std::string cmd = android::base::StringPrintf(
-                "%s install-write -S %" PRIu64 " %d %d_%s -",
-                install_cmd.c_str(), static_cast<uint64_t>(sb.st_size), session_id, i,
-                android::base::Basename(file).c_str());
-
-        int localFd = adb_open(file, O_RDONLY);
-        if (localFd < 0) {
-            fprintf(stderr, "adb: failed to open %s: %s\n", file, strerror(errno));
-            success = 0;
-            goto finalize_session;
-        }
-
-        std::string error;
-        int remoteFd = adb_connect(cmd, &error);
-        if (remoteFd < 0) {
-            fprintf(stderr, "adb: connect error for write: %s\n", error.c_str());
-            adb_close(localFd);
-            success = 0;
-            goto finalize_session;
-        }
-
-        copy_to_file(localFd, remoteFd);
-        read_status_line(remoteFd, buf, sizeof(buf));
-
-        adb_close(localFd);
-        adb_close(remoteFd);
-
-        if (strncmp("Success", buf, 7)) {
-            fprintf(stderr, "adb: failed to write %s\n", file);
-            fputs(buf, stderr);
-            success = 0;
-            goto finalize_session;
+    // Valid session, now stream the APKs. Each split has its own stream, so
+    // while one is still arriving the device can already be working on another.
+    std::atomic<int> next_apk(first_apk);
+    std::atomic<bool> all_written(true);
+    auto write_splits = [&]() {
+        for (int i = next_apk++; i < argc && all_written; i = next_apk++) {
+            if (!install_write_split(install_cmd, session_id, i, argv[i])) {
+                all_written = false;
+            }
         }
+    };
+    std::vector<std::thread> writers;
+    for (int i = 0; i < std::min(kInstallWriteJobs, argc - first_apk); ++i) {
+        writers.emplace_back(write_splits);
+    }
+    for (auto& writer : writers) {
+        writer.join();
     }
+    bool success = all_written;
 
-finalize_session:
     // Commit session if we streamed everything okay; otherwise abandon
     std::string service =
             android::base::StringPrintf("%s install-%s %d",
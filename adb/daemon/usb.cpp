@@ -26,6 +26,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <sys/ioctl.h>
+#include <sys/syscall.h>
 #include <sys/types.h>
 #include <unistd.h>
 
@@ -59,6 +60,10 @@ using namespace std::chrono_literals;
 // necessary.
 #define USB_FFS_BULK_SIZE 16384
 
+// Number of blocks of USB_FFS_BULK_SIZE kept in flight by the aio path, enough
+// for a whole MAX_PAYLOAD packet.
+#define USB_FFS_NUM_BUFS ((MAX_PAYLOAD / USB_FFS_BULK_SIZE) + 1)
+
 #define cpu_to_le16(x) htole16(x)
 #define cpu_to_le32(x) htole32(x)
 
@@ -68,6 +73,24 @@ static constexpr size_t ENDPOINT_ALLOC_RETRIES = 10;
 
 static int dummy_fd = -1;
 
+// bionic has no libaio, go through the raw system calls.
+static int io_setup(unsigned nr, aio_context_t* ctxp) {
+    return syscall(__NR_io_setup, nr, ctxp);
+}
+
+static int io_destroy(aio_context_t ctx) {
+    return syscall(__NR_io_destroy, ctx);
+}
+
+static int io_submit(aio_context_t ctx, long nr, struct iocb** iocbpp) {
+    return syscall(__NR_io_submit, ctx, nr, iocbpp);
+}
+
+static int io_getevents(aio_context_t ctx, long min_nr, long max_nr, struct io_event* events,
+                        struct timespec* timeout) {
+    return syscall(__NR_io_getevents, ctx, min_nr, max_nr, events, timeout);
+}
+
 struct func_desc {
     struct usb_interface_descriptor intf;
     struct usb_endpoint_descriptor_no_audio source;
@@ -234,6 +257,31 @@ static const struct {
     },
 };
 
+static bool aio_block_init(aio_block* aiob, int fd) {
+    aiob->iocb.resize(USB_FFS_NUM_BUFS);
+    aiob->iocbs.resize(USB_FFS_NUM_BUFS);
+    aiob->events.resize(USB_FFS_NUM_BUFS);
+    for (size_t i = 0; i < USB_FFS_NUM_BUFS; i++) {
+        aiob->iocbs[i] = &aiob->iocb[i];
+    }
+    aiob->fd = fd;
+    aiob->ctx = 0;
+    if (io_setup(USB_FFS_NUM_BUFS, &aiob->ctx) < 0) {
+        D("[ aio: io_setup failed: errno=%d ]", errno);
+        aiob->ctx = 0;
+        return false;
+    }
+    return true;
+}
+
+static void aio_block_destroy(aio_block* aiob) {
+    if (aiob->ctx) {
+        io_destroy(aiob->ctx);
+        aiob->ctx = 0;
+    }
+    aiob->fd = -1;
+}
+
 bool init_functionfs(struct usb_handle* h) {
     LOG(INFO) << "initializing functionfs";
 
@@ -301,6 +349,14 @@ bool init_functionfs(struct usb_handle* h) {
         goto err;
     }
 
+    h->use_aio = aio_block_init(&h->read_aiob, h->bulk_out) &&
+                 aio_block_init(&h->write_aiob, h->bulk_in);
+    if (!h->use_aio) {
+        aio_block_destroy(&h->read_aiob);
+        aio_block_destroy(&h->write_aiob);
+        D("[ aio unavailable, using synchronous io ]");
+    }
+
     h->max_rw = MAX_PAYLOAD;
     while (h->max_rw >= USB_FFS_BULK_SIZE && retries < ENDPOINT_ALLOC_RETRIES) {
         int ret_in = ioctl(h->bulk_in, FUNCTIONFS_ENDPOINT_ALLOC, static_cast<__u32>(h->max_rw));
@@ -410,6 +466,83 @@ static int usb_ffs_read(usb_handle* h, void* data, int len) {
     return 0;
 }
 
+// Reads and writes go straight from/to the caller's buffer, which for
+// the transport is the apacket payload, so there is no bounce copy.  A
+// transfer is cut into USB_FFS_BULK_SIZE blocks; the host sends a payload
+// as a single transfer so only the final block may come up short.
+static int usb_ffs_do_aio(usb_handle* h, const void* data, int len, bool read) {
+    aio_block* aiob = read ? &h->read_aiob : &h->write_aiob;
+    const char* cur_data = static_cast<const char*>(data);
+
+    int num_bufs = 0;
+    while (len > 0) {
+        int buf_len = std::min(len, USB_FFS_BULK_SIZE);
+        struct iocb* control = &aiob->iocb[num_bufs];
+        memset(control, 0, sizeof(*control));
+        control->aio_fildes = aiob->fd;
+        control->aio_lio_opcode = read ? IOCB_CMD_PREAD : IOCB_CMD_PWRITE;
+        control->aio_buf = reinterpret_cast<uintptr_t>(cur_data);
+        control->aio_nbytes = buf_len;
+        control->aio_offset = 0;
+        cur_data += buf_len;
+        len -= buf_len;
+        num_bufs++;
+        CHECK_LE(num_bufs, static_cast<int>(USB_FFS_NUM_BUFS));
+    }
+    if (num_bufs == 0) {
+        return 0;
+    }
+
+    if (TEMP_FAILURE_RETRY(io_submit(aiob->ctx, num_bufs, aiob->iocbs.data())) < num_bufs) {
+        D("[ aio: error submitting %s: errno=%d ]", read ? "read" : "write", errno);
+        return -1;
+    }
+    int completed = 0;
+    while (completed < num_bufs) {
+        int n = TEMP_FAILURE_RETRY(io_getevents(aiob->ctx, num_bufs - completed,
+                                                num_bufs - completed,
+                                                aiob->events.data() + completed, nullptr));
+        if (n <= 0) {
+            D("[ aio: error waiting for %s: errno=%d ]", read ? "read" : "write", errno);
+            return -1;
+        }
+        completed += n;
+    }
+
+    for (int i = 0; i < num_bufs; i++) {
+        const struct io_event& event = aiob->events[i];
+        if (event.res < 0) {
+            errno = -event.res;
+            D("[ aio: %s failed: errno=%d ]", read ? "read" : "write", errno);
+            return -1;
+        }
+        const struct iocb* control = reinterpret_cast<const struct iocb*>(event.obj);
+        if (static_cast<__u64>(event.res) != control->aio_nbytes) {
+            D("[ aio: short %s of %lld/%llu bytes ]", read ? "read" : "write",
+              static_cast<long long>(event.res),
+              static_cast<unsigned long long>(control->aio_nbytes));
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static int usb_ffs_aio_read(usb_handle* h, void* data, int len) {
+    if (!h->use_aio) {
+        return usb_ffs_read(h, data, len);
+    }
+    D("about to aio read (fd=%d, len=%d)", h->bulk_out, len);
+    return usb_ffs_do_aio(h, data, len, true);
+}
+
+static int usb_ffs_aio_write(usb_handle* h, const void* data, int len) {
+    if (!h->use_aio) {
+        return usb_ffs_write(h, data, len);
+    }
+    D("about to aio write (fd=%d, len=%d)", h->bulk_in, len);
+    return usb_ffs_do_aio(h, data, len, false);
+}
+
 static void usb_ffs_kick(usb_handle* h) {
     int err;
 
@@ -436,6 +569,9 @@ static void usb_ffs_close(usb_handle* h) {
     LOG(INFO) << "closing functionfs transport";
 
     h->kicked = false;
+    aio_block_destroy(&h->read_aiob);
+    aio_block_destroy(&h->write_aiob);
+    h->use_aio = false;
     adb_close(h->bulk_out);
     adb_close(h->bulk_in);
     // Notify usb_adb_open_thread to open a new connection.
@@ -450,8 +586,15 @@ static void usb_ffs_init() {
 
     usb_handle* h = new usb_handle();
 
-    h->write = usb_ffs_write;
-    h->read = usb_ffs_read;
+    if (android::base::GetBoolProperty("sys.usb.ffs.aio_compat", false)) {
+        // Devices whose FunctionFS misbehaves with aio can opt out.
+        h->write = usb_ffs_write;
+        h->read = usb_ffs_read;
+        D("[ usb_init - aio disabled by sys.usb.ffs.aio_compat ]");
+    } else {
+        h->write = usb_ffs_aio_write;
+        h->read = usb_ffs_aio_read;
+    }
     h->kick = usb_ffs_kick;
     h->close = usb_ffs_close;
 
@@ -16,9 +16,22 @@
  * limitations under the License.
  */
 
+#include <linux/aio_abi.h>
+
 #include <atomic>
 #include <condition_variable>
 #include <mutex>
+#include <vector>
+
+// Asynchronous FunctionFS io: a transfer is split into blocks that are all
+// submitted at once, keeping several URBs in flight on the endpoint.
+struct aio_block {
+    std::vector<struct iocb> iocb;
+    std::vector<struct iocb*> iocbs;
+    std::vector<struct io_event> events;
+    aio_context_t ctx = 0;
+    int fd = -1;
+};
 
 struct usb_handle {
     usb_handle() : kicked(false) {
@@ -40,6 +53,11 @@ struct usb_handle {
     int bulk_in = -1;  /* "in" from the host's perspective => sink for adbd */
 
     int max_rw;
+
+    // Only used when the kernel supports aio on FunctionFS endpoints.
+    bool use_aio = false;
+    aio_block read_aiob;
+    aio_block write_aiob;
 };
 
 bool init_functionfs(struct usb_handle* h);
@@ -21,11 +21,17 @@
 #include "fdevent.h"
 
 #include <fcntl.h>
+#include <inttypes.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 
+#if defined(__linux__)
+#include <sys/epoll.h>
+#endif
+
 #include <atomic>
+#include <chrono>
 #include <functional>
 #include <list>
 #include <mutex>
@@ -55,9 +61,22 @@ int SHELL_EXIT_NOTIFY_FD = -1;
 #define FDE_PENDING    0x0200
 #define FDE_CREATED    0x0400
 
+// Linux waits with epoll, which costs in proportion to the ready fds rather than the
+// installed ones; elsewhere the pollfd set is rebuilt for every poll().
+#if defined(__linux__)
+#define FDEVENT_EPOLL 1
+#else
+#define FDEVENT_EPOLL 0
+#endif
+
 struct PollNode {
   fdevent* fde;
   adb_pollfd pollfd;
+#if FDEVENT_EPOLL
+  // Why epoll refused the fd, if it did: EBADF, or EPERM for regular files.  Such fds
+  // get the events poll() would have reported for them on every iteration.
+  int epoll_error = 0;
+#endif
 
   explicit PollNode(fdevent* fde) : fde(fde) {
       memset(&pollfd, 0, sizeof(pollfd));
@@ -79,6 +98,22 @@ static std::atomic<bool> terminate_loop(false);
 static bool main_thread_valid;
 static unsigned long main_thread_id;
 
+#if FDEVENT_EPOLL
+static auto& g_epoll_fd = *new unique_fd();
+static size_t g_unpollable_count;
+#endif
+
+// Time spent in fdevent callbacks, for host:perf.
+struct CallbackStats {
+    uint64_t count;
+    uint64_t total_ns;
+    uint64_t max_ns;
+    int max_fd;
+    uint64_t slow;  // taking more than kSlowCallbackNs
+};
+static constexpr uint64_t kSlowCallbackNs = 10 * 1000 * 1000;
+static CallbackStats g_callback_stats;
+
 static auto& run_queue_notify_fd = *new unique_fd();
 static auto& run_queue_mutex = *new std::mutex();
 static auto& run_queue GUARDED_BY(run_queue_mutex) = *new std::vector<std::function<void()>>();
@@ -120,6 +155,36 @@ static std::string dump_fde(const fdevent* fde) {
     return android::base::StringPrintf("(fdevent %d %s)", fde->fd, state.c_str());
 }
 
+#if FDEVENT_EPOLL
+static void fdevent_epoll_ctl(int op, PollNode* node) {
+    if (g_epoll_fd == -1) {
+        g_epoll_fd.reset(epoll_create1(EPOLL_CLOEXEC));
+        if (g_epoll_fd == -1) {
+            PLOG(FATAL) << "failed to create epoll fd";
+        }
+    }
+
+    // Level triggered, like poll(): callbacks don't necessarily drain their fd.
+    epoll_event ev = {};
+    ev.events = EPOLLRDHUP;
+    if (node->pollfd.events & POLLIN) {
+        ev.events |= EPOLLIN;
+    }
+    if (node->pollfd.events & POLLOUT) {
+        ev.events |= EPOLLOUT;
+    }
+    ev.data.fd = node->pollfd.fd;
+    if (epoll_ctl(g_epoll_fd.get(), op, node->pollfd.fd, &ev) == -1) {
+        if (op != EPOLL_CTL_ADD) {
+            PLOG(FATAL) << "epoll_ctl(" << op << ") failed for fd " << node->pollfd.fd;
+        }
+        D("epoll refused fd %d: %s", node->pollfd.fd, strerror(errno));
+        node->epoll_error = errno;
+        ++g_unpollable_count;
+    }
+}
+#endif
+
 fdevent* fdevent_create(int fd, fd_func func, void* arg) {
     check_main_thread();
     fdevent *fde = (fdevent*) malloc(sizeof(fdevent));
@@ -155,6 +220,9 @@ void fdevent_install(fdevent* fde, int fd, fd_func func, void* arg) {
     }
     auto pair = g_poll_node_map.emplace(fde->fd, PollNode(fde));
     CHECK(pair.second) << "install existing fd " << fd;
+#if FDEVENT_EPOLL
+    fdevent_epoll_ctl(EPOLL_CTL_ADD, &pair.first->second);
+#endif
     D("fdevent_install %s", dump_fde(fde).c_str());
 }
 
@@ -162,6 +230,16 @@ void fdevent_remove(fdevent* fde) {
     check_main_thread();
     D("fdevent_remove %s", dump_fde(fde).c_str());
     if (fde->state & FDE_ACTIVE) {
+#if FDEVENT_EPOLL
+        auto it = g_poll_node_map.find(fde->fd);
+        CHECK(it != g_poll_node_map.end());
+        if (it->second.epoll_error) {
+            --g_unpollable_count;
+        } else if (epoll_ctl(g_epoll_fd.get(), EPOLL_CTL_DEL, fde->fd, nullptr) == -1) {
+            // The fd may be shared with a child, so closing it wouldn't remove it.
+            PLOG(ERROR) << "failed to remove fd " << fde->fd << " from epoll";
+        }
+#endif
         g_poll_node_map.erase(fde->fd);
         if (fde->state & FDE_PENDING) {
             g_pending_list.remove(fde);
@@ -190,6 +268,11 @@ static void fdevent_update(fdevent* fde, unsigned events) {
     } else {
         node.pollfd.events &= ~POLLOUT;
     }
+#if FDEVENT_EPOLL
+    if (!node.epoll_error) {
+        fdevent_epoll_ctl(EPOLL_CTL_MOD, &node);
+    }
+#endif
     fde->state = (fde->state & FDE_STATEMASK) | events;
 }
 
@@ -223,6 +306,78 @@ void fdevent_del(fdevent* fde, unsigned events) {
     fdevent_set(fde, (fde->state & FDE_EVENTMASK) & ~events);
 }
 
+static void fdevent_mark_pending(int fd, unsigned events) {
+    auto it = g_poll_node_map.find(fd);
+    CHECK(it != g_poll_node_map.end());
+    fdevent* fde = it->second.fde;
+    CHECK_EQ(fde->fd, fd);
+    fde->events |= events;
+    D("%s got events %x", dump_fde(fde).c_str(), events);
+    fde->state |= FDE_PENDING;
+    g_pending_list.push_back(fde);
+}
+
+#if FDEVENT_EPOLL
+
+static void fdevent_process() {
+    CHECK_GT(g_poll_node_map.size(), 0u);
+
+    // Anything epoll can't watch is always ready, so don't block if there is any.
+    static auto& epoll_events = *new std::vector<epoll_event>(256);
+    int timeout = g_unpollable_count ? 0 : -1;
+    D("epoll_wait(), %zu fds", g_poll_node_map.size());
+    int ret = TEMP_FAILURE_RETRY(
+        epoll_wait(g_epoll_fd.get(), &epoll_events[0], epoll_events.size(), timeout));
+    if (ret == -1) {
+        PLOG(ERROR) << "epoll_wait(), ret = " << ret;
+        return;
+    }
+    for (int i = 0; i < ret; ++i) {
+        const epoll_event& ev = epoll_events[i];
+        D("for fd %d, revents = %x", ev.data.fd, ev.events);
+        unsigned events = 0;
+        if (ev.events & EPOLLIN) {
+            events |= FDE_READ;
+        }
+        if (ev.events & EPOLLOUT) {
+            events |= FDE_WRITE;
+        }
+        if (ev.events & (EPOLLERR | EPOLLHUP | EPOLLRDHUP)) {
+            // We fake a read, as the rest of the code assumes that errors will
+            // be detected at that point.
+            events |= FDE_READ | FDE_ERROR;
+        }
+        if (events != 0) {
+            fdevent_mark_pending(ev.data.fd, events);
+        }
+    }
+
+    if (g_unpollable_count) {
+        for (const auto& pair : g_poll_node_map) {
+            const PollNode& node = pair.second;
+            if (!node.epoll_error) {
+                continue;
+            }
+            unsigned events = 0;
+            if (node.epoll_error == EPERM) {
+                if (node.pollfd.events & POLLIN) {
+                    events |= FDE_READ;
+                }
+                if (node.pollfd.events & POLLOUT) {
+                    events |= FDE_WRITE;
+                }
+            } else {
+                events = FDE_READ | FDE_ERROR;
+            }
+            if (events != 0 && !(node.fde->state & FDE_PENDING)) {
+                fdevent_mark_pending(pair.first, events);
+            }
+        }
+    }
+}
+
+#else
+
 static std::string dump_pollfds(const std::vector<adb_pollfd>& pollfds) {
     std::string result;
     for (const auto& pollfd : pollfds) {
@@ -272,25 +427,36 @@ static void fdevent_process() {
         }
 #endif
         if (events != 0) {
-            auto it = g_poll_node_map.find(pollfd.fd);
-            CHECK(it != g_poll_node_map.end());
-            fdevent* fde = it->second.fde;
-            CHECK_EQ(fde->fd, pollfd.fd);
-            fde->events |= events;
-            D("%s got events %x", dump_fde(fde).c_str(), events);
-            fde->state |= FDE_PENDING;
-            g_pending_list.push_back(fde);
+            fdevent_mark_pending(pollfd.fd, events);
         }
     }
 }
 
+#endif  // FDEVENT_EPOLL
+
 static void fdevent_call_fdfunc(fdevent* fde) {
     unsigned events = fde->events;
     fde->events = 0;
     CHECK(fde->state & FDE_PENDING);
     fde->state &= (~FDE_PENDING);
     D("fdevent_call_fdfunc %s", dump_fde(fde).c_str());
+    // The callback may remove and free fde.
+    int fd = fde->fd;
+    auto start = std::chrono::steady_clock::now();
     fde->func(fde->fd, events, fde->arg);
+    uint64_t ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                      std::chrono::steady_clock::now() - start)
+                      .count();
+
+    g_callback_stats.count++;
+    g_callback_stats.total_ns += ns;
+    if (ns > g_callback_stats.max_ns) {
+        g_callback_stats.max_ns = ns;
+        g_callback_stats.max_fd = fd;
+    }
+    if (ns > kSlowCallbackNs) {
+        g_callback_stats.slow++;
+    }
 }
 
 #if !ADB_HOST
@@ -438,6 +604,17 @@ void fdevent_terminate_loop() {
     terminate_loop = true;
 }
 
+std::string fdevent_stats() {
+    check_main_thread();
+    const CallbackStats& stats = g_callback_stats;
+    return android::base::StringPrintf(
+        "fdevent: %zu fds, %" PRIu64 " callbacks taking %" PRIu64 " ms (average %" PRIu64
+        " us, longest %" PRIu64 " us on fd %d, %" PRIu64 " over %" PRIu64 " ms)\n",
+        g_poll_node_map.size(), stats.count, stats.total_ns / 1000000,
+        stats.count ? stats.total_ns / stats.count / 1000 : 0, stats.max_ns / 1000, stats.max_fd,
+        stats.slow, kSlowCallbackNs / 1000000);
+}
+
 size_t fdevent_installed_count() {
     return g_poll_node_map.size();
 }
@@ -445,6 +622,10 @@ size_t fdevent_installed_count() {
 void fdevent_reset() {
     g_poll_node_map.clear();
     g_pending_list.clear();
+#if FDEVENT_EPOLL
+    g_epoll_fd.reset();
+    g_unpollable_count = 0;
+#endif
 
     std::lock_guard<std::mutex> lock(run_queue_mutex);
     run_queue_notify_fd.reset();
@@ -452,4 +633,5 @@ void fdevent_reset() {
 
     main_thread_valid = false;
     terminate_loop = false;
+    g_callback_stats = {};
 }
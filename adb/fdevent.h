@@ -21,6 +21,7 @@
 #include <stdint.h>  /* for int64_t */
 
 #include <functional>
+#include <string>
 
 /* events that may be observed */
 #define FDE_READ              0x0001
@@ -83,6 +84,10 @@ void check_main_thread();
 // Queue an operation to run on the main thread.
 void fdevent_run_on_main_thread(std::function<void()> fn);
 
+// The installed fds and the time spent in their callbacks, for host:perf.
+// Main thread only.
+std::string fdevent_stats();
+
 // The following functions are used only for tests.
 void fdevent_terminate_loop();
 size_t fdevent_installed_count();
@@ -18,6 +18,7 @@
 
 #include <gtest/gtest.h>
 
+#include <chrono>
 #include <limits>
 #include <queue>
 #include <string>
@@ -75,8 +76,13 @@ struct ThreadArg {
     int first_read_fd;
     int last_write_fd;
     size_t middle_pipe_count;
+    size_t idle_pipe_count = 0;
 };
 
+static void IdleFdEventCallback(int, unsigned events, void*) {
+    FAIL() << "unexpected events on idle fd: " << events;
+}
+
 TEST_F(FdeventTest, fdevent_terminate) {
     PrepareThread();
 
@@ -102,7 +108,26 @@ static void FdEventThreadFunc(ThreadArg* arg) {
         fd_handlers.push_back(std::unique_ptr<FdHandler>(new FdHandler(read_fds[i], write_fds[i])));
     }
 
+    // Sockets that never become readable, to keep around in the set being waited on.
+    std::vector<int> idle_peer_fds;
+    std::vector<std::unique_ptr<fdevent>> idle_fdes;
+    for (size_t i = 0; i < arg->idle_pipe_count; ++i) {
+        int fds[2];
+        ASSERT_EQ(0, adb_socketpair(fds));
+        idle_peer_fds.push_back(fds[1]);
+        idle_fdes.emplace_back(new fdevent);
+        fdevent_install(idle_fdes.back().get(), fds[0], IdleFdEventCallback, nullptr);
+        fdevent_add(idle_fdes.back().get(), FDE_READ);
+    }
+
     fdevent_loop();
+
+    for (auto& fde : idle_fdes) {
+        fdevent_remove(fde.get());
+    }
+    for (int fd : idle_peer_fds) {
+        adb_close(fd);
+    }
 }
 
 TEST_F(FdeventTest, smoke) {
@@ -136,6 +161,46 @@ TEST_F(FdeventTest, smoke) {
     ASSERT_EQ(0, adb_close(reader));
 }
 
+TEST_F(FdeventTest, many_idle_fds) {
+    // One busy chain among hundreds of idle sockets: with poll() every round trip pays for
+    // the whole set, with epoll only for what is ready.
+    const size_t IDLE_PIPE_COUNT = 400;
+    const size_t MESSAGE_LOOP_COUNT = 1000;
+    const std::string MESSAGE = "fdevent_test";
+    int fd_pair1[2];
+    int fd_pair2[2];
+    ASSERT_EQ(0, adb_socketpair(fd_pair1));
+    ASSERT_EQ(0, adb_socketpair(fd_pair2));
+    ThreadArg thread_arg;
+    thread_arg.first_read_fd = fd_pair1[0];
+    thread_arg.last_write_fd = fd_pair2[1];
+    thread_arg.middle_pipe_count = 0;
+    thread_arg.idle_pipe_count = IDLE_PIPE_COUNT;
+    int writer = fd_pair1[1];
+    int reader = fd_pair2[0];
+
+    PrepareThread();
+    std::thread thread(FdEventThreadFunc, &thread_arg);
+
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < MESSAGE_LOOP_COUNT; ++i) {
+        std::string read_buffer = MESSAGE;
+        std::string write_buffer(MESSAGE.size(), 'a');
+        ASSERT_TRUE(WriteFdExactly(writer, read_buffer.c_str(), read_buffer.size()));
+        ASSERT_TRUE(ReadFdExactly(reader, &write_buffer[0], write_buffer.size()));
+        ASSERT_EQ(read_buffer, write_buffer);
+    }
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    printf("%zu round trips with %zu idle fds took %lld us\n", MESSAGE_LOOP_COUNT,
+           IDLE_PIPE_COUNT,
+           static_cast<long long>(
+               std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count()));
+
+    TerminateThread(thread);
+    ASSERT_EQ(0, adb_close(writer));
+    ASSERT_EQ(0, adb_close(reader));
+}
+
 struct InvalidFdArg {
     fdevent fde;
     unsigned expected_events;
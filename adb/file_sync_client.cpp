@@ -26,6 +26,7 @@
 #include <unistd.h>
 #include <utime.h>
 
+#include <algorithm>
 #include <chrono>
 #include <functional>
 #include <memory>
@@ -39,6 +40,8 @@
 #include "adb_client.h"
 #include "adb_io.h"
 #include "adb_utils.h"
+#include "file_sync_compression.h"
+#include "file_sync_delta.h"
 #include "file_sync_service.h"
 #include "line_printer.h"
 #include "sysdeps/errno.h"
@@ -48,6 +51,20 @@
 #include <android-base/strings.h>
 #include <android-base/stringprintf.h>
 
+// Bounds on the ID_RECV requests queued ahead when pulling a directory.
+static constexpr size_t kSyncPipelineMaxRequests = 64;
+static constexpr uint64_t kSyncPipelineMaxBytes = 1024 * 1024;
+
+// Most block hashes we accept for one file, enough for 64GiB.
+static constexpr uint32_t kSyncDeltaMaxBlocks = 1024 * 1024;
+
+// ADB_SYNC_COMPRESSION selects the zlib level for sync chunks, 0 to turn it off.
+static int sync_compression_level() {
+    const char* env = getenv("ADB_SYNC_COMPRESSION");
+    if (env == nullptr) return kSyncCompressionDefaultLevel;
+    return std::max(0, std::min(atoi(env), kSyncCompressionMaxLevel));
+}
+
 struct syncsendbuf {
     unsigned id;
     unsigned size;
@@ -78,6 +95,8 @@ struct copyinfo {
     uint32_t mode;
     uint64_t size = 0;
     bool skip = false;
+    // The device has an older regular file there, worth patching.
+    bool delta = false;
 
     copyinfo(const std::string& local_path,
              const std::string& remote_path,
@@ -208,6 +227,11 @@ class SyncConnection {
             Error("failed to get feature set: %s", error.c_str());
         } else {
             have_stat_v2_ = CanUseFeature(features, kFeatureStat2);
+            have_sync_pipeline_ = CanUseFeature(features, kFeatureSyncPipeline);
+            have_sync_delta_ = CanUseFeature(features, kFeatureSyncDelta);
+            compression_level_ = CanUseFeature(features, kFeatureSyncCompression)
+                                     ? sync_compression_level()
+                                     : 0;
             fd = adb_connect("sync:", &error);
             if (fd < 0) {
                 Error("connect failed: %s", error.c_str());
@@ -234,6 +258,15 @@ class SyncConnection {
 
     bool IsValid() { return fd >= 0; }
 
+    // Whether ID_RECV requests can be queued ahead of their responses.
+    bool CanPipelineRecv() const { return have_sync_pipeline_; }
+
+    // Whether files can be patched with ID_SUMS and ID_PTCH.
+    bool CanSendDelta() const { return have_sync_delta_; }
+
+    // The request to pull a file with, asking for compressed chunks if we can.
+    uint32_t RecvRequestId() const { return compression_level_ > 0 ? ID_RECV_Z : ID_RECV; }
+
     bool ReceivedError(const char* from, const char* to) {
         adb_pollfd pfd = {.fd = fd, .events = POLLIN};
         int rc = adb_poll(&pfd, 1, 0);
@@ -394,12 +427,17 @@ class SyncConnection {
         memcpy(p, path_and_mode, path_length);
         p += path_length;
 
+        SyncCompressor compressor(compression_level_);
+        const char* chunk = data;
+        size_t chunk_length = data_length;
+        bool compressed = compressor.Compress(data, data_length, &chunk, &chunk_length);
+
         SyncRequest* req_data = reinterpret_cast<SyncRequest*>(p);
-        req_data->id = ID_DATA;
-        req_data->path_length = data_length;
+        req_data->id = compressed ? ID_ZDAT : ID_DATA;
+        req_data->path_length = chunk_length;
         p += sizeof(SyncRequest);
-        memcpy(p, data, data_length);
-        p += data_length;
+        memcpy(p, chunk, chunk_length);
+        p += chunk_length;
 
         SyncRequest* req_done = reinterpret_cast<SyncRequest*>(p);
         req_done->id = ID_DONE;
@@ -438,8 +476,8 @@ class SyncConnection {
             return false;
         }
 
+        SyncCompressor compressor(compression_level_);
         syncsendbuf sbuf;
-        sbuf.id = ID_DATA;
         while (true) {
             int bytes_read = adb_read(lfd, sbuf.data, max);
             if (bytes_read == -1) {
@@ -450,8 +488,18 @@ class SyncConnection {
                 break;
             }
 
-            sbuf.size = bytes_read;
-            WriteOrDie(lpath, rpath, &sbuf, sizeof(SyncRequest) + bytes_read);
+            const char* chunk;
+            size_t chunk_length;
+            if (compressor.Compress(sbuf.data, bytes_read, &chunk, &chunk_length)) {
+                // Always smaller than what was read, so it fits.
+                memcpy(sbuf.data, chunk, chunk_length);
+                sbuf.id = ID_ZDAT;
+                sbuf.size = chunk_length;
+            } else {
+                sbuf.id = ID_DATA;
+                sbuf.size = bytes_read;
+            }
+            WriteOrDie(lpath, rpath, &sbuf, sizeof(SyncRequest) + sbuf.size);
 
             RecordBytesTransferred(bytes_read);
             bytes_copied += bytes_read;
@@ -475,6 +523,176 @@ class SyncConnection {
         return WriteOrDie(lpath, rpath, &msg.data, sizeof(msg.data));
     }
 
+    // Pushes |size| bytes made up in memory to |rpath| for "adb sync-bench", uncompressed
+    // so that the transport rather than zlib is what's measured.
+    bool SendSyntheticFile(const char* rpath, uint64_t size) {
+        std::string path_and_mode = android::base::StringPrintf("%s,%d", rpath, S_IFREG | 0644);
+        if (!SendRequest(ID_SEND, path_and_mode.c_str())) {
+            Error("failed to send ID_SEND message '%s': %s", path_and_mode.c_str(),
+                  strerror(errno));
+            return false;
+        }
+
+        // Noise, in case anything along the way compresses.
+        syncsendbuf sbuf;
+        uint32_t x = 2463534242;
+        for (size_t i = 0; i < max; ++i) {
+            x ^= x << 13;
+            x ^= x >> 17;
+            x ^= x << 5;
+            sbuf.data[i] = x;
+        }
+
+        const char* lpath = "(synthetic)";
+        uint64_t bytes_copied = 0;
+        while (bytes_copied < size) {
+            sbuf.id = ID_DATA;
+            sbuf.size = std::min<uint64_t>(max, size - bytes_copied);
+            if (!WriteOrDie(lpath, rpath, &sbuf, sizeof(SyncRequest) + sbuf.size)) return false;
+
+            RecordBytesTransferred(sbuf.size);
+            bytes_copied += sbuf.size;
+
+            // Check to see if we've received an error from the other side.
+            if (ReceivedError(lpath, rpath)) {
+                break;
+            }
+
+            ReportProgress(rpath, bytes_copied, size);
+        }
+
+        syncmsg msg;
+        msg.data.id = ID_DONE;
+        msg.data.size = time(nullptr);
+        expect_done_ = true;
+
+        // RecordFilesTransferred gets called in CopyDone.
+        return WriteOrDie(lpath, rpath, &msg.data, sizeof(msg.data)) && CopyDone(lpath, rpath);
+    }
+
+    // Gives up on whatever the device is still sending: the connection is shut down
+    // rather than quit, so the destructor doesn't wait for the rest of it.
+    void Abandon() {
+        adb_shutdown(fd);
+    }
+
+    // Replaces the device's copy of a file with ID_PTCH, only sending the blocks whose
+    // hashes differ.  Falls back to SendLargeFile if the device can't hash its copy.
+    bool SendDeltaFile(const char* path_and_mode,
+                       const char* lpath, const char* rpath,
+                       unsigned mtime) {
+        if (!SendRequest(ID_SUMS, rpath)) {
+            Error("failed to send ID_SUMS message '%s': %s", rpath, strerror(errno));
+            return false;
+        }
+
+        syncmsg msg;
+        if (!ReadFdExactly(fd, &msg.data, sizeof(msg.data))) {
+            Error("failed to read block hashes of '%s': %s", rpath, strerror(errno));
+            return false;
+        }
+        if (msg.data.id == ID_FAIL) {
+            std::vector<char> reason(msg.data.size);
+            if (!ReadFdExactly(fd, reason.data(), reason.size())) {
+                Error("failed to read block hashes of '%s': %s", rpath, strerror(errno));
+                return false;
+            }
+            return SendLargeFile(path_and_mode, lpath, rpath, mtime);
+        }
+        if (msg.data.id != ID_SUMS || msg.data.size > kSyncDeltaMaxBlocks) {
+            Error("unexpected block hashes of '%s'", rpath);
+            return false;
+        }
+        std::vector<SyncBlockHash> remote(msg.data.size);
+        if (!ReadFdExactly(fd, remote.data(), remote.size() * sizeof(remote[0]))) {
+            Error("failed to read block hashes of '%s': %s", rpath, strerror(errno));
+            return false;
+        }
+
+        struct stat st;
+        if (stat(lpath, &st) == -1) {
+            Error("cannot stat '%s': %s", lpath, strerror(errno));
+            return false;
+        }
+        uint64_t total_size = st.st_size;
+        uint64_t bytes_copied = 0;
+
+        int lfd = adb_open(lpath, O_RDONLY);
+        if (lfd < 0) {
+            Error("opening '%s' locally failed: %s", lpath, strerror(errno));
+            return false;
+        }
+        std::vector<SyncBlockHash> local;
+        if (!SyncHashBlocks(lfd, &local) || adb_lseek(lfd, 0, SEEK_SET) != 0) {
+            Error("reading '%s' locally failed: %s", lpath, strerror(errno));
+            adb_close(lfd);
+            return false;
+        }
+
+        if (!SendRequest(ID_PTCH, path_and_mode)) {
+            Error("failed to send ID_PTCH message '%s': %s", path_and_mode, strerror(errno));
+            adb_close(lfd);
+            return false;
+        }
+
+        SyncCompressor compressor(compression_level_);
+        syncsendbuf sbuf;
+        for (size_t i = 0; i < local.size();) {
+            // A run of blocks the device already has goes as one ID_COPY.
+            size_t run = 0;
+            while (i + run < local.size() && i + run < remote.size() &&
+                   local[i + run] == remote[i + run]) {
+                ++run;
+            }
+            size_t blocks = std::max<size_t>(run, 1);
+
+            for (size_t b = 0; b < blocks; ++b) {
+                int bytes_read = ReadBlock(lfd, sbuf.data);
+                if (bytes_read <= 0) {
+                    Error("reading '%s' locally failed: %s", lpath,
+                          bytes_read == 0 ? "file shrank" : strerror(errno));
+                    adb_close(lfd);
+                    return false;
+                }
+                bytes_copied += bytes_read;
+                if (run > 0) continue;
+
+                const char* chunk;
+                size_t chunk_length;
+                if (compressor.Compress(sbuf.data, bytes_read, &chunk, &chunk_length)) {
+                    memcpy(sbuf.data, chunk, chunk_length);
+                    sbuf.id = ID_ZDAT;
+                    sbuf.size = chunk_length;
+                } else {
+                    sbuf.id = ID_DATA;
+                    sbuf.size = bytes_read;
+                }
+                WriteOrDie(lpath, rpath, &sbuf, sizeof(SyncRequest) + sbuf.size);
+                RecordBytesTransferred(bytes_read);
+            }
+            if (run > 0) {
+                msg.data.id = ID_COPY;
+                msg.data.size = run;
+                WriteOrDie(lpath, rpath, &msg.data, sizeof(msg.data));
+            }
+            i += blocks;
+
+            if (ReceivedError(lpath, rpath)) {
+                break;
+            }
+            ReportProgress(rpath, bytes_copied, total_size);
+        }
+
+        adb_close(lfd);
+
+        msg.data.id = ID_DONE;
+        msg.data.size = mtime;
+        expect_done_ = true;
+
+        // RecordFilesTransferred gets called in CopyDone.
+        return WriteOrDie(lpath, rpath, &msg.data, sizeof(msg.data));
+    }
+
     bool CopyDone(const char* from, const char* to) {
         syncmsg msg;
         if (!ReadFdExactly(fd, &msg.status, sizeof(msg.status))) {
@@ -578,6 +796,9 @@ class SyncConnection {
   private:
     bool expect_done_;
     bool have_stat_v2_;
+    bool have_sync_pipeline_;
+    bool have_sync_delta_ = false;
+    int compression_level_ = 0;
 
     TransferLedger global_ledger_;
     TransferLedger current_ledger_;
@@ -587,6 +808,18 @@ class SyncConnection {
         return SendRequest(ID_QUIT, ""); // TODO: add a SendResponse?
     }
 
+    // Reads the next kSyncDeltaBlockSize block of |lfd|, which is shorter only at the end.
+    static int ReadBlock(int lfd, char* data) {
+        size_t done = 0;
+        while (done < kSyncDeltaBlockSize) {
+            int r = adb_read(lfd, data + done, kSyncDeltaBlockSize - done);
+            if (r < 0) return -1;
+            if (r == 0) break;
+            done += r;
+        }
+        return done;
+    }
+
     bool WriteOrDie(const char* from, const char* to, const void* data, size_t data_length) {
         if (!WriteFdExactly(fd, data, data_length)) {
             if (errno == ECONNRESET) {
@@ -674,8 +907,9 @@ static bool sync_stat_fallback(SyncConnection& sc, const char* path, struct stat
     return true;
 }
 
+// |delta| says the device has an older regular file at |rpath|.
 static bool sync_send(SyncConnection& sc, const char* lpath, const char* rpath, unsigned mtime,
-                      mode_t mode, bool sync) {
+                      mode_t mode, bool sync, bool delta) {
     std::string path_and_mode = android::base::StringPrintf("%s,%d", rpath, mode);
 
     if (sync) {
@@ -687,6 +921,7 @@ static bool sync_send(SyncConnection& sc, const char* lpath, const char* rpath,
                 sc.RecordFilesSkipped(1);
                 return true;
             }
+            delta = S_ISREG(st.st_mode);
         }
     }
 
@@ -722,6 +957,10 @@ static bool sync_send(SyncConnection& sc, const char* lpath, const char* rpath,
                               data.data(), data.size())) {
             return false;
         }
+    } else if (delta && S_ISREG(mode) && sc.CanSendDelta()) {
+        if (!sc.SendDeltaFile(path_and_mode.c_str(), lpath, rpath, mtime)) {
+            return false;
+        }
     } else {
         if (!sc.SendLargeFile(path_and_mode.c_str(), lpath, rpath, mtime)) {
             return false;
@@ -730,10 +969,9 @@ static bool sync_send(SyncConnection& sc, const char* lpath, const char* rpath,
     return sc.CopyDone(lpath, rpath);
 }
 
-static bool sync_recv(SyncConnection& sc, const char* rpath, const char* lpath,
-                      const char* name, uint64_t expected_size) {
-    if (!sc.SendRequest(ID_RECV, rpath)) return false;
-
+// Reads the response to an ID_RECV request already sent for |rpath|.
+static bool sync_finish_recv(SyncConnection& sc, const char* rpath, const char* lpath,
+                             const char* name, uint64_t expected_size) {
     adb_unlink(lpath);
     int lfd = adb_creat(lpath, 0644);
     if (lfd < 0) {
@@ -742,6 +980,7 @@ static bool sync_recv(SyncConnection& sc, const char* rpath, const char* lpath,
     }
 
     uint64_t bytes_copied = 0;
+    std::vector<char> compressed;
     while (true) {
         syncmsg msg;
         if (!ReadFdExactly(sc.fd, &msg.data, sizeof(msg.data))) {
@@ -752,37 +991,56 @@ static bool sync_recv(SyncConnection& sc, const char* rpath, const char* lpath,
 
         if (msg.data.id == ID_DONE) break;
 
-        if (msg.data.id != ID_DATA) {
+        if (msg.data.id != ID_DATA && msg.data.id != ID_ZDAT) {
             adb_close(lfd);
             adb_unlink(lpath);
             sc.ReportCopyFailure(rpath, lpath, msg);
             return false;
         }
 
-        if (msg.data.size > sc.max) {
-            sc.Error("msg.data.size too large: %u (max %zu)", msg.data.size, sc.max);
+        size_t max = (msg.data.id == ID_ZDAT) ? SyncCompressedChunkMax() : sc.max;
+        if (msg.data.size > max) {
+            sc.Error("msg.data.size too large: %u (max %zu)", msg.data.size, max);
             adb_close(lfd);
             adb_unlink(lpath);
             return false;
         }
 
         char buffer[SYNC_DATA_MAX];
-        if (!ReadFdExactly(sc.fd, buffer, msg.data.size)) {
+        size_t length = msg.data.size;
+        if (msg.data.id == ID_ZDAT) {
+            compressed.resize(max);
+            ssize_t inflated = -1;
+            if (ReadFdExactly(sc.fd, &compressed[0], msg.data.size)) {
+                inflated = SyncDecompressChunk(&compressed[0], msg.data.size, buffer,
+                                               sizeof(buffer));
+                if (inflated < 0) {
+                    sc.Error("failed to copy '%s' to '%s': corrupt compressed data", rpath,
+                             lpath);
+                }
+            }
+            if (inflated < 0) {
+                adb_close(lfd);
+                adb_unlink(lpath);
+                return false;
+            }
+            length = inflated;
+        } else if (!ReadFdExactly(sc.fd, buffer, msg.data.size)) {
             adb_close(lfd);
             adb_unlink(lpath);
             return false;
         }
 
-        if (!WriteFdExactly(lfd, buffer, msg.data.size)) {
+        if (!WriteFdExactly(lfd, buffer, length)) {
             sc.Error("cannot write '%s': %s", lpath, strerror(errno));
             adb_close(lfd);
             adb_unlink(lpath);
             return false;
         }
 
-        bytes_copied += msg.data.size;
+        bytes_copied += length;
 
-        sc.RecordBytesTransferred(msg.data.size);
+        sc.RecordBytesTransferred(length);
         sc.ReportProgress(name != nullptr ? name : rpath, bytes_copied, expected_size);
     }
 
@@ -791,6 +1049,81 @@ static bool sync_recv(SyncConnection& sc, const char* rpath, const char* lpath,
     return true;
 }
 
+static bool sync_recv(SyncConnection& sc, const char* rpath, const char* lpath,
+                      const char* name, uint64_t expected_size) {
+    return sc.SendRequest(sc.RecvRequestId(), rpath) &&
+           sync_finish_recv(sc, rpath, lpath, name, expected_size);
+}
+
+// Reads and throws away the responses to |count| queued ID_RECV requests, so the
+// connection can be used again after giving up on them.
+static void sync_discard_recvs(SyncConnection& sc, size_t count) {
+    while (count > 0) {
+        syncmsg msg;
+        if (!ReadFdExactly(sc.fd, &msg.data, sizeof(msg.data))) return;
+        if (msg.data.id == ID_DONE) {
+            --count;
+            continue;
+        }
+        if (msg.data.id == ID_FAIL) {
+            --count;
+        } else if (msg.data.id != ID_DATA && msg.data.id != ID_ZDAT) {
+            return;
+        }
+        if (msg.data.size > SyncCompressedChunkMax()) return;
+        std::vector<char> buffer(msg.data.size);
+        if (!ReadFdExactly(sc.fd, buffer.data(), msg.data.size)) return;
+    }
+}
+
+// Reads |rpath| and throws the data away, stopping after |limit| bytes so that endless
+// files like /dev/zero can be pulled.
+static bool sync_recv_discard(SyncConnection& sc, const char* rpath, uint64_t limit) {
+    const char* lpath = "(discarded)";
+    if (!sc.SendRequest(ID_RECV, rpath)) {
+        sc.Error("failed to send ID_RECV message '%s': %s", rpath, strerror(errno));
+        return false;
+    }
+
+    std::vector<char> buffer(SYNC_DATA_MAX);
+    uint64_t bytes_copied = 0;
+    while (bytes_copied < limit) {
+        syncmsg msg;
+        if (!ReadFdExactly(sc.fd, &msg.data, sizeof(msg.data))) {
+            sc.Error("failed to copy '%s' to '%s': couldn't read from device", rpath, lpath);
+            return false;
+        }
+
+        if (msg.data.id == ID_DONE) {
+            sc.RecordFilesTransferred(1);
+            return true;
+        }
+
+        if (msg.data.id != ID_DATA) {
+            sc.ReportCopyFailure(rpath, lpath, msg);
+            return false;
+        }
+
+        if (msg.data.size > sc.max) {
+            sc.Error("msg.data.size too large: %u (max %zu)", msg.data.size, sc.max);
+            return false;
+        }
+
+        if (!ReadFdExactly(sc.fd, buffer.data(), msg.data.size)) {
+            sc.Error("failed to copy '%s' to '%s': couldn't read from device", rpath, lpath);
+            return false;
+        }
+
+        bytes_copied += msg.data.size;
+        sc.RecordBytesTransferred(msg.data.size);
+        sc.ReportProgress(rpath, bytes_copied, limit);
+    }
+
+    sc.RecordFilesTransferred(1);
+    sc.Abandon();
+    return true;
+}
+
 bool do_sync_ls(const char* path) {
     SyncConnection sc;
     if (!sc.IsValid()) return false;
@@ -902,6 +1235,7 @@ static bool copy_local_dir_remote(SyncConnection& sc, std::string lpath,
                         ci.skip = true;
                     }
                 }
+                ci.delta = !ci.skip && S_ISREG(st.st_mode);
             }
         }
     }
@@ -913,7 +1247,8 @@ static bool copy_local_dir_remote(SyncConnection& sc, std::string lpath,
             if (list_only) {
                 sc.Println("would push: %s -> %s", ci.lpath.c_str(), ci.rpath.c_str());
             } else {
-                if (!sync_send(sc, ci.lpath.c_str(), ci.rpath.c_str(), ci.time, ci.mode, false)) {
+                if (!sync_send(sc, ci.lpath.c_str(), ci.rpath.c_str(), ci.time, ci.mode, false,
+                               ci.delta)) {
                     return false;
                 }
             }
@@ -1013,7 +1348,7 @@ bool do_sync_push(const std::vector<const char*>& srcs, const char* dst, bool sy
 
         sc.NewTransfer();
         sc.SetExpectedTotalBytes(st.st_size);
-        success &= sync_send(sc, src_path, dst_path, st.st_mtime, st.st_mode, sync);
+        success &= sync_send(sc, src_path, dst_path, st.st_mtime, st.st_mode, sync, false);
         sc.ReportTransferRate(src_path, TransferDirection::push);
     }
 
@@ -1114,8 +1449,24 @@ static bool copy_remote_dir_local(SyncConnection& sc, std::string rpath,
 
     sc.ComputeExpectedTotalBytes(file_list);
 
+    // With a device that supports it, keep ID_RECV requests queued ahead of the file
+    // being received so small files don't each cost a round trip.  The device answers
+    // in order; the queue is bounded both in requests and in the bytes they're expected
+    // to produce, so the device never has much more queued than we're about to read.
+    size_t next_request = 0;
+    size_t queued = 0;
+    uint64_t queued_bytes = 0;
+    auto is_pulled = [&file_list](size_t i) {
+        return !file_list[i].skip && !S_ISDIR(file_list[i].mode);
+    };
+    auto fail = [&sc, &queued]() {
+        sync_discard_recvs(sc, queued);
+        return false;
+    };
+
     int skipped = 0;
-    for (const copyinfo &ci : file_list) {
+    for (size_t i = 0; i < file_list.size(); ++i) {
+        const copyinfo& ci = file_list[i];
         if (!ci.skip) {
             if (S_ISDIR(ci.mode)) {
                 // Entry is for an empty directory, create it and continue.
@@ -1123,17 +1474,40 @@ static bool copy_remote_dir_local(SyncConnection& sc, std::string rpath,
                 if (!mkdirs(ci.lpath))  {
                     sc.Error("failed to create directory '%s': %s",
                              ci.lpath.c_str(), strerror(errno));
-                    return false;
+                    return fail();
                 }
                 continue;
             }
 
-            if (!sync_recv(sc, ci.rpath.c_str(), ci.lpath.c_str(), nullptr, ci.size)) {
+            if (sc.CanPipelineRecv()) {
+                next_request = std::max(next_request, i);
+                while (next_request < file_list.size() &&
+                       (queued == 0 || (queued < kSyncPipelineMaxRequests &&
+                                        queued_bytes + file_list[next_request].size <=
+                                            kSyncPipelineMaxBytes))) {
+                    if (is_pulled(next_request)) {
+                        const copyinfo& request = file_list[next_request];
+                        if (!sc.SendRequest(sc.RecvRequestId(), request.rpath.c_str())) {
+                            return fail();
+                        }
+                        ++queued;
+                        queued_bytes += request.size;
+                    }
+                    ++next_request;
+                }
+
+                --queued;
+                queued_bytes -= ci.size;
+                if (!sync_finish_recv(sc, ci.rpath.c_str(), ci.lpath.c_str(), nullptr,
+                                      ci.size)) {
+                    return fail();
+                }
+            } else if (!sync_recv(sc, ci.rpath.c_str(), ci.lpath.c_str(), nullptr, ci.size)) {
                 return false;
             }
 
             if (copy_attrs && set_time_and_mode(ci.lpath, ci.time, ci.mode)) {
-                return false;
+                return fail();
             }
         } else {
             skipped++;
@@ -1265,3 +1639,16 @@ bool do_sync_sync(const std::string& lpath, const std::string& rpath, bool list_
     }
     return success;
 }
+
+bool do_sync_bench(bool push, uint64_t size, const char* rpath) {
+    SyncConnection sc;
+    if (!sc.IsValid()) return false;
+
+    sc.NewTransfer();
+    sc.SetExpectedTotalBytes(size);
+    bool success = push ? sc.SendSyntheticFile(rpath, size) : sync_recv_discard(sc, rpath, size);
+    if (success) {
+        sc.ReportTransferRate(rpath, push ? TransferDirection::push : TransferDirection::pull);
+    }
+    return success;
+}
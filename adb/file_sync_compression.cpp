@@ -0,0 +1,72 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define TRACE_TAG SYNC
+
+#include "sysdeps.h"
+#include "file_sync_compression.h"
+
+#include <zlib.h>
+
+#include "adb_trace.h"
+#include "file_sync_service.h"
+
+// Chunks not attempted after one that didn't compress.
+static constexpr size_t kSkipAfterIncompressible = 16;
+
+SyncCompressor::SyncCompressor(int level) : level_(level) {
+    if (level_ > 0) {
+        buffer_.resize(SyncCompressedChunkMax());
+    }
+}
+
+bool SyncCompressor::Compress(const char* data, size_t size, const char** out, size_t* out_size) {
+    if (level_ <= 0 || size == 0) {
+        return false;
+    }
+    if (skip_ > 0) {
+        --skip_;
+        return false;
+    }
+
+    uLongf compressed_size = buffer_.size();
+    int rc = compress2(reinterpret_cast<Bytef*>(&buffer_[0]), &compressed_size,
+                       reinterpret_cast<const Bytef*>(data), size, level_);
+    if (rc != Z_OK || compressed_size > size - size / 8) {
+        D("sync: chunk of %zu bytes not worth compressing", size);
+        skip_ = kSkipAfterIncompressible;
+        return false;
+    }
+
+    *out = &buffer_[0];
+    *out_size = compressed_size;
+    return true;
+}
+
+size_t SyncCompressedChunkMax() {
+    return compressBound(SYNC_DATA_MAX);
+}
+
+ssize_t SyncDecompressChunk(const char* data, size_t size, char* out, size_t out_size) {
+    uLongf inflated_size = out_size;
+    int rc = uncompress(reinterpret_cast<Bytef*>(out), &inflated_size,
+                        reinterpret_cast<const Bytef*>(data), size);
+    if (rc != Z_OK) {
+        D("sync: failed to inflate %zu byte chunk: %d", size, rc);
+        return -1;
+    }
+    return inflated_size;
+}
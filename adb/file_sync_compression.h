@@ -0,0 +1,55 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <sys/types.h>
+
+#include <vector>
+
+// Compression of sync DATA chunks, sent as ID_ZDAT when both sides have
+// kFeatureSyncCompression.  Each chunk is an independent zlib stream that
+// inflates to at most SYNC_DATA_MAX bytes.
+
+// zlib levels; 0 turns compression off.
+constexpr int kSyncCompressionDefaultLevel = 1;
+constexpr int kSyncCompressionMaxLevel = 9;
+
+// Compresses the chunks of one file.  Chunks that don't shrink by at least an
+// eighth are left alone, and after one of those the next few chunks aren't even
+// tried, so already compressed files (APKs, images of compressed filesystems)
+// cost little more than sending them raw.
+class SyncCompressor {
+  public:
+    explicit SyncCompressor(int level);
+
+    // Returns true and points |*out| at |*out_size| compressed bytes if the chunk
+    // should be sent as ID_ZDAT, false if it should go out as ID_DATA.
+    bool Compress(const char* data, size_t size, const char** out, size_t* out_size);
+
+  private:
+    int level_;
+    size_t skip_ = 0;
+    std::vector<char> buffer_;
+};
+
+// The largest ID_ZDAT payload a conforming peer sends.
+size_t SyncCompressedChunkMax();
+
+// Inflates an ID_ZDAT payload into |out|.  Returns the inflated size, or -1 if the
+// payload is corrupt or doesn't fit in |out_size| bytes.
+ssize_t SyncDecompressChunk(const char* data, size_t size, char* out, size_t out_size);
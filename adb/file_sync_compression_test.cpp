@@ -0,0 +1,74 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "file_sync_compression.h"
+
+#include <gtest/gtest.h>
+
+#include <random>
+#include <string>
+#include <vector>
+
+#include "file_sync_service.h"
+
+TEST(file_sync_compression, round_trip) {
+    std::string data;
+    while (data.size() < SYNC_DATA_MAX) {
+        data += "compressible text, compressible text. ";
+    }
+    data.resize(SYNC_DATA_MAX);
+
+    SyncCompressor compressor(kSyncCompressionDefaultLevel);
+    const char* compressed;
+    size_t compressed_size;
+    ASSERT_TRUE(compressor.Compress(data.data(), data.size(), &compressed, &compressed_size));
+    ASSERT_LT(compressed_size, data.size());
+    ASSERT_LE(compressed_size, SyncCompressedChunkMax());
+
+    std::vector<char> out(SYNC_DATA_MAX);
+    ASSERT_EQ(static_cast<ssize_t>(data.size()),
+              SyncDecompressChunk(compressed, compressed_size, out.data(), out.size()));
+    ASSERT_EQ(data, std::string(out.data(), data.size()));
+
+    // Too small a destination, or garbage, is an error rather than an overflow.
+    ASSERT_EQ(-1, SyncDecompressChunk(compressed, compressed_size, out.data(), 16));
+    ASSERT_EQ(-1, SyncDecompressChunk(data.data(), 64, out.data(), out.size()));
+}
+
+TEST(file_sync_compression, incompressible) {
+    std::mt19937 rng(42);
+    std::vector<char> data(SYNC_DATA_MAX);
+    for (char& c : data) {
+        c = static_cast<char>(rng());
+    }
+
+    SyncCompressor compressor(kSyncCompressionDefaultLevel);
+    const char* compressed;
+    size_t compressed_size;
+    ASSERT_FALSE(compressor.Compress(data.data(), data.size(), &compressed, &compressed_size));
+
+    // Having given up on random data, even very compressible chunks are sent as-is for a while.
+    std::string text(SYNC_DATA_MAX, 'x');
+    ASSERT_FALSE(compressor.Compress(text.data(), text.size(), &compressed, &compressed_size));
+}
+
+TEST(file_sync_compression, disabled) {
+    std::string text(SYNC_DATA_MAX, 'x');
+    SyncCompressor compressor(0);
+    const char* compressed;
+    size_t compressed_size;
+    ASSERT_FALSE(compressor.Compress(text.data(), text.size(), &compressed, &compressed_size));
+}
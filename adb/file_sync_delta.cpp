@@ -0,0 +1,85 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define TRACE_TAG SYNC
+
+#include "sysdeps.h"
+#include "file_sync_delta.h"
+
+#include <algorithm>
+#include <thread>
+
+#include "adb_trace.h"
+
+// Blocks each hashing thread gets per batch.
+static constexpr size_t kBlocksPerThread = 8;
+
+static size_t hash_thread_count() {
+    size_t count = std::thread::hardware_concurrency();
+    return std::max<size_t>(1, std::min<size_t>(count, 4));
+}
+
+// Fills as much of |buf| as the file has left, returning the bytes read or -1.
+static ssize_t read_batch(int fd, char* buf, size_t size) {
+    size_t done = 0;
+    while (done < size) {
+        int r = adb_read(fd, buf + done, size - done);
+        if (r < 0) return -1;
+        if (r == 0) break;
+        done += r;
+    }
+    return done;
+}
+
+bool SyncHashBlocks(int fd, std::vector<SyncBlockHash>* hashes) {
+    const size_t thread_count = hash_thread_count();
+    const size_t batch_blocks = thread_count * kBlocksPerThread;
+    std::vector<char> batch(batch_blocks * kSyncDeltaBlockSize);
+
+    hashes->clear();
+    while (true) {
+        ssize_t size = read_batch(fd, batch.data(), batch.size());
+        if (size < 0) return false;
+        if (size == 0) break;
+
+        size_t blocks = (size + kSyncDeltaBlockSize - 1) / kSyncDeltaBlockSize;
+        size_t first = hashes->size();
+        hashes->resize(first + blocks);
+
+        // Thread i takes blocks i, i + thread_count, ...
+        auto hash_some = [&](size_t start) {
+            for (size_t i = start; i < blocks; i += thread_count) {
+                size_t offset = i * kSyncDeltaBlockSize;
+                size_t length = std::min(kSyncDeltaBlockSize, static_cast<size_t>(size) - offset);
+                SHA256(reinterpret_cast<const uint8_t*>(&batch[offset]), length,
+                       (*hashes)[first + i].digest);
+            }
+        };
+        std::vector<std::thread> threads;
+        for (size_t t = 1; t < std::min(thread_count, blocks); ++t) {
+            threads.emplace_back(hash_some, t);
+        }
+        hash_some(0);
+        for (auto& thread : threads) {
+            thread.join();
+        }
+
+        if (static_cast<size_t>(size) < batch.size()) break;
+    }
+
+    D("hashed %zu blocks", hashes->size());
+    return true;
+}
@@ -0,0 +1,49 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <vector>
+
+#include <openssl/sha.h>
+
+#include "file_sync_service.h"
+
+// Block hashes for delta pushes (kFeatureSyncDelta).  The device hashes the file
+// being replaced with ID_SUMS, and the client sends it again with ID_PTCH, where
+// ID_COPY stands in for blocks whose hashes matched.
+
+// Blocks are as large as a DATA chunk, so each block is one chunk.
+constexpr size_t kSyncDeltaBlockSize = SYNC_DATA_MAX;
+
+struct SyncBlockHash {
+    uint8_t digest[SHA256_DIGEST_LENGTH];
+
+    bool operator==(const SyncBlockHash& other) const {
+        return memcmp(digest, other.digest, sizeof(digest)) == 0;
+    }
+    bool operator!=(const SyncBlockHash& other) const { return !(*this == other); }
+};
+
+// Hashes |fd| from its current offset to the end, one hash per kSyncDeltaBlockSize
+// block with only the last one possibly shorter.  Blocks are read in batches and
+// each batch is hashed by several threads.  Returns false with errno set if a read
+// fails.
+bool SyncHashBlocks(int fd, std::vector<SyncBlockHash>* hashes);
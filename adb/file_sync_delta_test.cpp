@@ -0,0 +1,68 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "file_sync_delta.h"
+
+#include <gtest/gtest.h>
+
+#include <random>
+#include <string>
+#include <vector>
+
+#include <android-base/file.h>
+#include <android-base/test_utils.h>
+
+#include "sysdeps.h"
+
+static std::vector<SyncBlockHash> HashFile(const std::string& content) {
+    TemporaryFile tf;
+    EXPECT_TRUE(android::base::WriteStringToFd(content, tf.fd));
+    EXPECT_EQ(0, adb_lseek(tf.fd, 0, SEEK_SET));
+    std::vector<SyncBlockHash> hashes;
+    EXPECT_TRUE(SyncHashBlocks(tf.fd, &hashes));
+    return hashes;
+}
+
+TEST(file_sync_delta, block_hashes) {
+    // Enough blocks for several batches, and a short one at the end.
+    std::mt19937 rng(42);
+    std::string content(100 * kSyncDeltaBlockSize + 123, '\0');
+    for (char& c : content) {
+        c = static_cast<char>(rng());
+    }
+
+    std::vector<SyncBlockHash> hashes = HashFile(content);
+    ASSERT_EQ(101u, hashes.size());
+    for (size_t i = 0; i < hashes.size(); ++i) {
+        size_t offset = i * kSyncDeltaBlockSize;
+        size_t length = std::min(kSyncDeltaBlockSize, content.size() - offset);
+        SyncBlockHash expected;
+        SHA256(reinterpret_cast<const uint8_t*>(&content[offset]), length, expected.digest);
+        ASSERT_EQ(expected, hashes[i]) << "block " << i;
+    }
+
+    // Changing one byte only changes its block.
+    content[7 * kSyncDeltaBlockSize + 5] ^= 1;
+    std::vector<SyncBlockHash> changed = HashFile(content);
+    ASSERT_EQ(hashes.size(), changed.size());
+    for (size_t i = 0; i < hashes.size(); ++i) {
+        ASSERT_EQ(i != 7, hashes[i] == changed[i]) << "block " << i;
+    }
+}
+
+TEST(file_sync_delta, empty) {
+    ASSERT_TRUE(HashFile("").empty());
+}
@@ -42,6 +42,8 @@
 #include "adb_io.h"
 #include "adb_trace.h"
 #include "adb_utils.h"
+#include "file_sync_compression.h"
+#include "file_sync_delta.h"
 #include "security_log_tags.h"
 #include "sysdeps/errno.h"
 
@@ -198,10 +200,14 @@ static bool SendSyncFailErrno(int fd, const std::string& reason) {
     return SendSyncFail(fd, StringPrintf("%s: %s", reason.c_str(), strerror(errno)));
 }
 
+// For ID_PTCH, |base_fd| is the file being replaced, which ID_COPY reads from.
 static bool handle_send_file(int s, const char* path, uid_t uid, gid_t gid, uint64_t capabilities,
-                             mode_t mode, std::vector<char>& buffer, bool do_unlink) {
+                             mode_t mode, std::vector<char>& buffer, bool do_unlink,
+                             int base_fd) {
     syncmsg msg;
     unsigned int timestamp = 0;
+    std::vector<char> compressed;
+    off64_t offset = 0;
 
     __android_log_security_bswrite(SEC_TAG_ADB_SEND_FILE, path);
 
@@ -237,6 +243,51 @@ static bool handle_send_file(int s, const char* path, uid_t uid, gid_t gid, uint
     while (true) {
         if (!ReadFdExactly(s, &msg.data, sizeof(msg.data))) goto fail;
 
+        if (msg.data.id == ID_ZDAT) {
+            if (msg.data.size > SyncCompressedChunkMax()) {
+                SendSyncFail(s, "oversize compressed data message");
+                goto abort;
+            }
+            compressed.resize(SyncCompressedChunkMax());
+            if (!ReadFdExactly(s, &compressed[0], msg.data.size)) goto abort;
+
+            ssize_t length =
+                SyncDecompressChunk(&compressed[0], msg.data.size, &buffer[0], buffer.size());
+            if (length < 0) {
+                SendSyncFail(s, "corrupt compressed data message");
+                goto abort;
+            }
+            if (!WriteFdExactly(fd, &buffer[0], length)) {
+                SendSyncFailErrno(s, "write failed");
+                goto fail;
+            }
+            offset += length;
+            continue;
+        }
+
+        if (msg.data.id == ID_COPY) {
+            if (base_fd < 0) {
+                SendSyncFail(s, "copy without a base file");
+                goto abort;
+            }
+            // Both files have the block at the same offset.
+            for (uint32_t block = 0; block < msg.data.size; ++block) {
+                ssize_t length = TEMP_FAILURE_RETRY(
+                    pread64(base_fd, &buffer[0], kSyncDeltaBlockSize, offset));
+                if (length <= 0) {
+                    if (length == 0) errno = EINVAL;
+                    SendSyncFailErrno(s, "copy from base file failed");
+                    goto fail;
+                }
+                if (!WriteFdExactly(fd, &buffer[0], length)) {
+                    SendSyncFailErrno(s, "write failed");
+                    goto fail;
+                }
+                offset += length;
+            }
+            continue;
+        }
+
         if (msg.data.id != ID_DATA) {
             if (msg.data.id == ID_DONE) {
                 timestamp = msg.data.size;
@@ -257,9 +308,11 @@ static bool handle_send_file(int s, const char* path, uid_t uid, gid_t gid, uint
             SendSyncFailErrno(s, "write failed");
             goto fail;
         }
+        offset += msg.data.size;
     }
 
     adb_close(fd);
+    if (base_fd >= 0) adb_close(base_fd);
 
     if (!update_capabilities(path, capabilities)) {
         SendSyncFailErrno(s, "update_capabilities failed");
@@ -287,7 +340,9 @@ fail:
 
         if (msg.data.id == ID_DONE) {
             break;
-        } else if (msg.data.id != ID_DATA) {
+        } else if (msg.data.id == ID_COPY) {
+            continue;
+        } else if (msg.data.id != ID_DATA && msg.data.id != ID_ZDAT) {
             char id[5];
             memcpy(id, &msg.data.id, sizeof(msg.data.id));
             id[4] = '\0';
@@ -295,17 +350,19 @@ fail:
             break;
         }
 
-        if (msg.data.size > buffer.size()) {
+        if (msg.data.size > SyncCompressedChunkMax()) {
             D("handle_send_fail received oversized packet of length '%u' during failure",
               msg.data.size);
             break;
         }
 
-        if (!ReadFdExactly(s, &buffer[0], msg.data.size)) break;
+        compressed.resize(SyncCompressedChunkMax());
+        if (!ReadFdExactly(s, &compressed[0], msg.data.size)) break;
     }
 
 abort:
     if (fd >= 0) adb_close(fd);
+    if (base_fd >= 0) adb_close(base_fd);
     if (do_unlink) adb_unlink(path);
     return false;
 }
@@ -360,7 +417,8 @@ static bool handle_send_link(int s, const std::string& path, std::vector<char>&
 }
 #endif
 
-static bool do_send(int s, const std::string& spec, std::vector<char>& buffer) {
+// ID_PTCH is ID_SEND with ID_COPY allowed, reading from the file being replaced.
+static bool do_send(int s, const std::string& spec, std::vector<char>& buffer, bool patch) {
     // 'spec' is of the form "/some/path,0755". Break it up.
     size_t comma = spec.find_last_of(',');
     if (comma == std::string::npos) {
@@ -377,6 +435,16 @@ static bool do_send(int s, const std::string& spec, std::vector<char>& buffer) {
         return false;
     }
 
+    // Opened before the unlink below, which leaves it readable until we're done.
+    int base_fd = -1;
+    if (patch) {
+        base_fd = adb_open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (base_fd < 0) {
+            SendSyncFailErrno(s, "couldn't open base file");
+            return false;
+        }
+    }
+
     // Don't delete files before copying if they are not "regular" or symlinks.
     struct stat st;
     bool do_unlink = (lstat(path.c_str(), &st) == -1) || S_ISREG(st.st_mode) || S_ISLNK(st.st_mode);
@@ -385,6 +453,7 @@ static bool do_send(int s, const std::string& spec, std::vector<char>& buffer) {
     }
 
     if (S_ISLNK(mode)) {
+        if (base_fd >= 0) adb_close(base_fd);
         return handle_send_link(s, path.c_str(), buffer);
     }
 
@@ -401,30 +470,68 @@ static bool do_send(int s, const std::string& spec, std::vector<char>& buffer) {
         fs_config(path.c_str(), 0, nullptr, &uid, &gid, &broken_api_hack, &capabilities);
         mode = broken_api_hack;
     }
-    return handle_send_file(s, path.c_str(), uid, gid, capabilities, mode, buffer, do_unlink);
+    return handle_send_file(s, path.c_str(), uid, gid, capabilities, mode, buffer, do_unlink,
+                            base_fd);
 }
 
-static bool do_recv(int s, const char* path, std::vector<char>& buffer) {
+// Like do_recv, a file that can't be hashed only fails this request.
+static bool do_sums(int s, const char* path) {
+    int fd = adb_open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return SendSyncFailErrno(s, "open failed");
+    }
+    struct stat st;
+    if (fstat(fd, &st) == -1) {
+        bool sent = SendSyncFailErrno(s, "fstat failed");
+        adb_close(fd);
+        return sent;
+    }
+    if (!S_ISREG(st.st_mode)) {
+        adb_close(fd);
+        return SendSyncFail(s, "not a regular file");
+    }
+
+    std::vector<SyncBlockHash> hashes;
+    if (!SyncHashBlocks(fd, &hashes)) {
+        bool sent = SendSyncFailErrno(s, "read failed");
+        adb_close(fd);
+        return sent;
+    }
+    adb_close(fd);
+
+    syncmsg msg;
+    msg.data.id = ID_SUMS;
+    msg.data.size = hashes.size();
+    return WriteFdExactly(s, &msg.data, sizeof(msg.data)) &&
+           WriteFdExactly(s, hashes.data(), hashes.size() * sizeof(hashes[0]));
+}
+
+// A failure to read the file ends this RECV with a FAIL but leaves the connection
+// usable, since clients may already have queued further requests (kFeatureSyncPipeline).
+static bool do_recv(int s, const char* path, std::vector<char>& buffer, bool compress) {
     __android_log_security_bswrite(SEC_TAG_ADB_RECV_FILE, path);
 
     int fd = adb_open(path, O_RDONLY | O_CLOEXEC);
     if (fd < 0) {
-        SendSyncFailErrno(s, "open failed");
-        return false;
+        return SendSyncFailErrno(s, "open failed");
     }
 
+    // Speed matters more than ratio here, the device CPU is often the bottleneck.
+    SyncCompressor compressor(compress ? kSyncCompressionDefaultLevel : 0);
     syncmsg msg;
-    msg.data.id = ID_DATA;
     while (true) {
         int r = adb_read(fd, &buffer[0], buffer.size());
         if (r <= 0) {
             if (r == 0) break;
-            SendSyncFailErrno(s, "read failed");
+            bool sent = SendSyncFailErrno(s, "read failed");
             adb_close(fd);
-            return false;
+            return sent;
         }
-        msg.data.size = r;
-        if (!WriteFdExactly(s, &msg.data, sizeof(msg.data)) || !WriteFdExactly(s, &buffer[0], r)) {
+        const char* data = &buffer[0];
+        size_t size = r;
+        msg.data.id = compressor.Compress(data, size, &data, &size) ? ID_ZDAT : ID_DATA;
+        msg.data.size = size;
+        if (!WriteFdExactly(s, &msg.data, sizeof(msg.data)) || !WriteFdExactly(s, data, size)) {
             adb_close(fd);
             return false;
         }
@@ -451,6 +558,12 @@ static const char* sync_id_to_name(uint32_t id) {
       return "send";
     case ID_RECV:
       return "recv";
+    case ID_RECV_Z:
+      return "recv_z";
+    case ID_SUMS:
+      return "sums";
+    case ID_PTCH:
+      return "ptch";
     case ID_QUIT:
         return "quit";
     default:
@@ -496,10 +609,15 @@ static bool handle_sync_command(int fd, std::vector<char>& buffer) {
             if (!do_list(fd, name)) return false;
             break;
         case ID_SEND:
-            if (!do_send(fd, name, buffer)) return false;
+        case ID_PTCH:
+            if (!do_send(fd, name, buffer, request.id == ID_PTCH)) return false;
+            break;
+        case ID_SUMS:
+            if (!do_sums(fd, name)) return false;
             break;
         case ID_RECV:
-            if (!do_recv(fd, name, buffer)) return false;
+        case ID_RECV_Z:
+            if (!do_recv(fd, name, buffer, request.id == ID_RECV_Z)) return false;
             break;
         case ID_QUIT:
             return false;
@@ -28,9 +28,14 @@
 #define ID_LIST MKID('L','I','S','T')
 #define ID_SEND MKID('S','E','N','D')
 #define ID_RECV MKID('R','E','C','V')
+#define ID_RECV_Z MKID('R','C','V','Z')
+#define ID_SUMS MKID('S','U','M','S')
+#define ID_PTCH MKID('P','T','C','H')
+#define ID_COPY MKID('C','O','P','Y')
 #define ID_DENT MKID('D','E','N','T')
 #define ID_DONE MKID('D','O','N','E')
 #define ID_DATA MKID('D','A','T','A')
+#define ID_ZDAT MKID('Z','D','A','T')
 #define ID_OKAY MKID('O','K','A','Y')
 #define ID_FAIL MKID('F','A','I','L')
 #define ID_QUIT MKID('Q','U','I','T')
@@ -86,6 +91,9 @@ bool do_sync_pull(const std::vector<const char*>& srcs, const char* dst,
                   bool copy_attrs, const char* name=nullptr);
 
 bool do_sync_sync(const std::string& lpath, const std::string& rpath, bool list_only);
+// Pushes |size| bytes of made up data to |rpath|, or pulls up to |size| bytes of it and
+// discards them, reporting the transfer rate.
+bool do_sync_bench(bool push, uint64_t size, const char* rpath);
 
 #define SYNC_DATA_MAX (64*1024)
 
@@ -0,0 +1,202 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define TRACE_TAG SERVICES
+
+#include "sysdeps.h"
+#include "framebuffer_delta.h"
+
+#include <string.h>
+
+#include <algorithm>
+
+#include <zlib.h>
+
+#include "adb_trace.h"
+
+static size_t tile_count(size_t pixels) {
+    return (pixels + kFramebufferTileSize - 1) / kFramebufferTileSize;
+}
+
+static size_t tile_extent(size_t pixels, size_t index) {
+    return std::min(kFramebufferTileSize, pixels - index * kFramebufferTileSize);
+}
+
+FramebufferDeltaEncoder::FramebufferDeltaEncoder(size_t width, size_t height,
+                                                 size_t bytes_per_pixel, int level)
+    : width_(width), height_(height), bytes_per_pixel_(bytes_per_pixel), level_(level) {
+    previous_.resize(width_ * height_ * bytes_per_pixel_);
+    tile_.resize(kFramebufferTileSize * kFramebufferTileSize * bytes_per_pixel_);
+    if (level_ > 0) {
+        compressed_.resize(compressBound(tile_.size()));
+    }
+}
+
+bool FramebufferDeltaEncoder::TileChanged(const char* frame, size_t x, size_t y) const {
+    size_t stride = width_ * bytes_per_pixel_;
+    size_t row_size = tile_extent(width_, x) * bytes_per_pixel_;
+    size_t rows = tile_extent(height_, y);
+    size_t offset = y * kFramebufferTileSize * stride + x * kFramebufferTileSize * bytes_per_pixel_;
+
+    for (size_t row = 0; row < rows; ++row, offset += stride) {
+        if (memcmp(frame + offset, &previous_[offset], row_size) != 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void FramebufferDeltaEncoder::AppendTile(const char* frame, size_t x, size_t y,
+                                         std::string* out) {
+    size_t stride = width_ * bytes_per_pixel_;
+    size_t row_size = tile_extent(width_, x) * bytes_per_pixel_;
+    size_t rows = tile_extent(height_, y);
+    size_t offset = y * kFramebufferTileSize * stride + x * kFramebufferTileSize * bytes_per_pixel_;
+
+    // Gather the rows, and remember them to compare the next frame against.
+    for (size_t row = 0; row < rows; ++row, offset += stride) {
+        memcpy(&tile_[row * row_size], frame + offset, row_size);
+        memcpy(&previous_[offset], frame + offset, row_size);
+    }
+
+    FramebufferTileHeader tile = {};
+    tile.x = x;
+    tile.y = y;
+    tile.encoding = kFramebufferTileRaw;
+    tile.size = rows * row_size;
+    const char* data = &tile_[0];
+
+    if (level_ > 0) {
+        uLongf compressed_size = compressed_.size();
+        int rc = compress2(reinterpret_cast<Bytef*>(&compressed_[0]), &compressed_size,
+                           reinterpret_cast<const Bytef*>(&tile_[0]), tile.size, level_);
+        if (rc == Z_OK && compressed_size < tile.size) {
+            tile.encoding = kFramebufferTileZlib;
+            tile.size = compressed_size;
+            data = &compressed_[0];
+        }
+    }
+
+    out->append(reinterpret_cast<const char*>(&tile), sizeof(tile));
+    out->append(data, tile.size);
+}
+
+size_t FramebufferDeltaEncoder::Encode(const char* frame, std::string* out) {
+    size_t header_offset = out->size();
+    out->append(sizeof(FramebufferFrameHeader), '\0');
+
+    size_t tiles = 0;
+    for (size_t y = 0; y < tile_count(height_); ++y) {
+        for (size_t x = 0; x < tile_count(width_); ++x) {
+            if (!primed_ || TileChanged(frame, x, y)) {
+                AppendTile(frame, x, y, out);
+                ++tiles;
+            }
+        }
+    }
+    primed_ = true;
+
+    FramebufferFrameHeader header;
+    header.id = FB_STREAM_FRAME;
+    header.sequence = sequence_++;
+    header.tiles = tiles;
+    header.size = out->size() - header_offset - sizeof(header);
+    memcpy(&(*out)[header_offset], &header, sizeof(header));
+
+    D("framebuffer: frame %u has %zu changed tiles in %u bytes", header.sequence, tiles,
+      header.size);
+    return tiles;
+}
+
+FramebufferDeltaDecoder::FramebufferDeltaDecoder(size_t width, size_t height,
+                                                 size_t bytes_per_pixel)
+    : width_(width), height_(height), bytes_per_pixel_(bytes_per_pixel) {
+    frame_.resize(width_ * height_ * bytes_per_pixel_);
+    tile_.resize(kFramebufferTileSize * kFramebufferTileSize * bytes_per_pixel_);
+}
+
+bool FramebufferDeltaDecoder::ApplyTile(const FramebufferTileHeader& tile, const char* data) {
+    if (tile.x >= tile_count(width_) || tile.y >= tile_count(height_)) {
+        return false;
+    }
+
+    size_t stride = width_ * bytes_per_pixel_;
+    size_t row_size = tile_extent(width_, tile.x) * bytes_per_pixel_;
+    size_t rows = tile_extent(height_, tile.y);
+    size_t tile_size = rows * row_size;
+
+    switch (tile.encoding) {
+        case kFramebufferTileRaw:
+            if (tile.size != tile_size) {
+                return false;
+            }
+            break;
+        case kFramebufferTileZlib: {
+            uLongf inflated_size = tile_.size();
+            int rc = uncompress(reinterpret_cast<Bytef*>(&tile_[0]), &inflated_size,
+                                reinterpret_cast<const Bytef*>(data), tile.size);
+            if (rc != Z_OK || inflated_size != tile_size) {
+                return false;
+            }
+            data = &tile_[0];
+            break;
+        }
+        default:
+            return false;
+    }
+
+    size_t offset = tile.y * kFramebufferTileSize * stride +
+                    tile.x * kFramebufferTileSize * bytes_per_pixel_;
+    for (size_t row = 0; row < rows; ++row, offset += stride) {
+        memcpy(&frame_[offset], data + row * row_size, row_size);
+    }
+    return true;
+}
+
+ssize_t FramebufferDeltaDecoder::Apply(const char* data, size_t size) {
+    FramebufferFrameHeader header;
+    if (size < sizeof(header)) {
+        return 0;
+    }
+    memcpy(&header, data, sizeof(header));
+    if (header.id != FB_STREAM_FRAME) {
+        return -1;
+    }
+    if (size - sizeof(header) < header.size) {
+        return 0;
+    }
+
+    const char* p = data + sizeof(header);
+    const char* end = p + header.size;
+    for (uint32_t i = 0; i < header.tiles; ++i) {
+        FramebufferTileHeader tile;
+        if (static_cast<size_t>(end - p) < sizeof(tile)) {
+            return -1;
+        }
+        memcpy(&tile, p, sizeof(tile));
+        p += sizeof(tile);
+        if (static_cast<size_t>(end - p) < tile.size || !ApplyTile(tile, p)) {
+            return -1;
+        }
+        p += tile.size;
+    }
+    if (p != end) {
+        return -1;
+    }
+
+    sequence_ = header.sequence;
+    return sizeof(header) + header.size;
+}
@@ -0,0 +1,109 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <string>
+#include <vector>
+
+// Frames for the framebuffer-stream: service (kFeatureFramebufferStream).  The
+// screen is cut into square tiles, and after the first frame only the tiles that
+// changed are sent, each one deflated if that makes it smaller.  See SERVICES.TXT
+// for the messages.  Everything is little-endian.
+
+#define FB_STREAM_INFO 0x4f464e49   // "INFO"
+#define FB_STREAM_FRAME 0x454d5246  // "FRME"
+
+constexpr size_t kFramebufferTileSize = 32;
+
+// zlib levels; 0 sends every tile raw.
+constexpr int kFramebufferCompressionDefaultLevel = 1;
+constexpr int kFramebufferCompressionMaxLevel = 9;
+
+enum FramebufferTileEncoding : uint16_t {
+    kFramebufferTileRaw = 0,
+    kFramebufferTileZlib = 1,
+};
+
+struct FramebufferFrameHeader {
+    uint32_t id;        // FB_STREAM_FRAME
+    uint32_t sequence;  // Counts captures, including those that changed nothing.
+    uint32_t tiles;
+    uint32_t size;      // Of the tiles that follow, headers included.
+} __attribute__((packed));
+
+// A tile's pixels are its rows back to back, narrower or shorter at the right and
+// bottom edges of the screen.
+struct FramebufferTileHeader {
+    uint16_t x;  // In tiles.
+    uint16_t y;
+    uint16_t encoding;
+    uint16_t reserved;
+    uint32_t size;
+} __attribute__((packed));
+
+class FramebufferDeltaEncoder {
+  public:
+    FramebufferDeltaEncoder(size_t width, size_t height, size_t bytes_per_pixel, int level);
+
+    // Appends a FB_STREAM_FRAME message with the tiles of |frame| that differ from
+    // the frame before to |out|, and returns how many there were.  Every tile of
+    // the first frame is sent.
+    size_t Encode(const char* frame, std::string* out);
+
+    size_t frame_size() const { return previous_.size(); }
+
+  private:
+    bool TileChanged(const char* frame, size_t x, size_t y) const;
+    void AppendTile(const char* frame, size_t x, size_t y, std::string* out);
+
+    size_t width_;
+    size_t height_;
+    size_t bytes_per_pixel_;
+    int level_;
+    uint32_t sequence_ = 0;
+    bool primed_ = false;
+    std::vector<char> previous_;
+    std::vector<char> tile_;
+    std::vector<char> compressed_;
+};
+
+// Keeps the screen up to date from a stream of FB_STREAM_FRAME messages.
+class FramebufferDeltaDecoder {
+  public:
+    FramebufferDeltaDecoder(size_t width, size_t height, size_t bytes_per_pixel);
+
+    // Applies the message at the front of |data|.  Returns how many bytes it took,
+    // 0 if |size| doesn't yet hold all of it, or -1 if it is corrupt.
+    ssize_t Apply(const char* data, size_t size);
+
+    const std::vector<char>& frame() const { return frame_; }
+    uint32_t sequence() const { return sequence_; }
+
+  private:
+    bool ApplyTile(const FramebufferTileHeader& tile, const char* data);
+
+    size_t width_;
+    size_t height_;
+    size_t bytes_per_pixel_;
+    uint32_t sequence_ = 0;
+    std::vector<char> frame_;
+    std::vector<char> tile_;
+};
@@ -0,0 +1,129 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "framebuffer_delta.h"
+
+#include <gtest/gtest.h>
+
+#include <string.h>
+
+#include <random>
+#include <string>
+#include <vector>
+
+// Not a multiple of the tile size either way, so there are partial edge tiles.
+static constexpr size_t kWidth = 100;
+static constexpr size_t kHeight = 70;
+static constexpr size_t kBytesPerPixel = 4;
+
+static void fill(std::vector<char>* frame, size_t x, size_t y, size_t w, size_t h, char c) {
+    for (size_t row = y; row < y + h; ++row) {
+        memset(&(*frame)[(row * kWidth + x) * kBytesPerPixel], c, w * kBytesPerPixel);
+    }
+}
+
+static FramebufferFrameHeader header_of(const std::string& message) {
+    FramebufferFrameHeader header;
+    memcpy(&header, message.data(), sizeof(header));
+    return header;
+}
+
+TEST(framebuffer_delta, only_changed_tiles) {
+    for (int level : {0, kFramebufferCompressionDefaultLevel}) {
+        std::vector<char> frame(kWidth * kHeight * kBytesPerPixel);
+        std::mt19937 rng(level);
+        for (char& c : frame) {
+            c = static_cast<char>(rng());
+        }
+
+        FramebufferDeltaEncoder encoder(kWidth, kHeight, kBytesPerPixel, level);
+        FramebufferDeltaDecoder decoder(kWidth, kHeight, kBytesPerPixel);
+        ASSERT_EQ(frame.size(), encoder.frame_size());
+
+        // The first frame is all of it: 4 columns of tiles by 3 rows.
+        std::string message;
+        ASSERT_EQ(12u, encoder.Encode(frame.data(), &message));
+        ASSERT_EQ(static_cast<ssize_t>(message.size()),
+                  decoder.Apply(message.data(), message.size()));
+        ASSERT_EQ(frame, decoder.frame());
+
+        // Nothing changed, nothing but the header.
+        message.clear();
+        ASSERT_EQ(0u, encoder.Encode(frame.data(), &message));
+        ASSERT_EQ(sizeof(FramebufferFrameHeader), message.size());
+        ASSERT_EQ(1u, header_of(message).sequence);
+
+        // One pixel in the bottom right corner tile, and a rectangle across four
+        // tiles in the middle.
+        fill(&frame, kWidth - 1, kHeight - 1, 1, 1, 1);
+        fill(&frame, 30, 30, 4, 4, 2);
+        message.clear();
+        ASSERT_EQ(5u, encoder.Encode(frame.data(), &message));
+        ASSERT_EQ(static_cast<ssize_t>(message.size()),
+                  decoder.Apply(message.data(), message.size()));
+        ASSERT_EQ(frame, decoder.frame());
+        ASSERT_EQ(2u, decoder.sequence());
+    }
+}
+
+TEST(framebuffer_delta, compresses_flat_tiles) {
+    std::vector<char> frame(kWidth * kHeight * kBytesPerPixel, 7);
+
+    FramebufferDeltaEncoder raw(kWidth, kHeight, kBytesPerPixel, 0);
+    FramebufferDeltaEncoder zlib(kWidth, kHeight, kBytesPerPixel,
+                                 kFramebufferCompressionDefaultLevel);
+    std::string raw_message, zlib_message;
+    raw.Encode(frame.data(), &raw_message);
+    zlib.Encode(frame.data(), &zlib_message);
+    ASSERT_LT(zlib_message.size() * 10, raw_message.size());
+
+    FramebufferDeltaDecoder decoder(kWidth, kHeight, kBytesPerPixel);
+    ASSERT_EQ(static_cast<ssize_t>(zlib_message.size()),
+              decoder.Apply(zlib_message.data(), zlib_message.size()));
+    ASSERT_EQ(frame, decoder.frame());
+}
+
+TEST(framebuffer_delta, partial_and_corrupt) {
+    std::vector<char> frame(kWidth * kHeight * kBytesPerPixel, 3);
+    FramebufferDeltaEncoder encoder(kWidth, kHeight, kBytesPerPixel,
+                                    kFramebufferCompressionDefaultLevel);
+    std::string message;
+    encoder.Encode(frame.data(), &message);
+
+    // Until all of it arrives there is nothing to apply.
+    FramebufferDeltaDecoder decoder(kWidth, kHeight, kBytesPerPixel);
+    for (size_t size : {size_t(0), sizeof(FramebufferFrameHeader) - 1, message.size() - 1}) {
+        ASSERT_EQ(0, decoder.Apply(message.data(), size));
+    }
+
+    // A tile off the screen.
+    std::string corrupt = message;
+    FramebufferTileHeader tile;
+    memcpy(&tile, &corrupt[sizeof(FramebufferFrameHeader)], sizeof(tile));
+    tile.x = 4;
+    memcpy(&corrupt[sizeof(FramebufferFrameHeader)], &tile, sizeof(tile));
+    ASSERT_EQ(-1, decoder.Apply(corrupt.data(), corrupt.size()));
+
+    // Not a frame at all.
+    corrupt = message;
+    corrupt[0] ^= 1;
+    ASSERT_EQ(-1, decoder.Apply(corrupt.data(), corrupt.size()));
+
+    // The whole thing is fine.
+    ASSERT_EQ(static_cast<ssize_t>(message.size()),
+              decoder.Apply(message.data(), message.size()));
+    ASSERT_EQ(frame, decoder.frame());
+}
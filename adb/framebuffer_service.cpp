@@ -26,11 +26,21 @@
 #include <sys/wait.h>
 #include <unistd.h>
 
+#include <chrono>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <android-base/parseint.h>
+#include <android-base/strings.h>
+
 #include "sysdeps.h"
 
 #include "adb.h"
 #include "adb_io.h"
 #include "fdevent.h"
+#include "framebuffer_delta.h"
 
 /* TODO:
 ** - sync with vsync to avoid tearing
@@ -55,20 +65,19 @@ struct fbinfo {
     unsigned int alpha_length;
 } __attribute__((packed));
 
-void framebuffer_service(int fd, void *cookie)
+static pid_t start_screencap(int* fd_screencap)
 {
-    struct fbinfo fbinfo;
-    unsigned int i, bsize;
-    char buf[640];
-    int fd_screencap;
-    int w, h, f, c;
     int fds[2];
     pid_t pid;
 
-    if (pipe2(fds, O_CLOEXEC) < 0) goto pipefail;
+    if (pipe2(fds, O_CLOEXEC) < 0) return -1;
 
     pid = fork();
-    if (pid < 0) goto done;
+    if (pid < 0) {
+        adb_close(fds[0]);
+        adb_close(fds[1]);
+        return -1;
+    }
 
     if (pid == 0) {
         dup2(fds[1], STDOUT_FILENO);
@@ -81,91 +90,112 @@ void framebuffer_service(int fd, void *cookie)
     }
 
     adb_close(fds[1]);
-    fd_screencap = fds[0];
+    *fd_screencap = fds[0];
+    return pid;
+}
+
+static bool read_screencap_info(int fd_screencap, struct fbinfo* fbinfo)
+{
+    int w, h, f, c;
 
     /* read w, h, format & color space */
-    if(!ReadFdExactly(fd_screencap, &w, 4)) goto done;
-    if(!ReadFdExactly(fd_screencap, &h, 4)) goto done;
-    if(!ReadFdExactly(fd_screencap, &f, 4)) goto done;
-    if(!ReadFdExactly(fd_screencap, &c, 4)) goto done;
+    if(!ReadFdExactly(fd_screencap, &w, 4)) return false;
+    if(!ReadFdExactly(fd_screencap, &h, 4)) return false;
+    if(!ReadFdExactly(fd_screencap, &f, 4)) return false;
+    if(!ReadFdExactly(fd_screencap, &c, 4)) return false;
 
-    fbinfo.version = DDMS_RAWIMAGE_VERSION;
-    fbinfo.colorSpace = c;
+    fbinfo->version = DDMS_RAWIMAGE_VERSION;
+    fbinfo->colorSpace = c;
     /* see hardware/hardware.h */
     switch (f) {
         case 1: /* RGBA_8888 */
-            fbinfo.bpp = 32;
-            fbinfo.size = w * h * 4;
-            fbinfo.width = w;
-            fbinfo.height = h;
-            fbinfo.red_offset = 0;
-            fbinfo.red_length = 8;
-            fbinfo.green_offset = 8;
-            fbinfo.green_length = 8;
-            fbinfo.blue_offset = 16;
-            fbinfo.blue_length = 8;
-            fbinfo.alpha_offset = 24;
-            fbinfo.alpha_length = 8;
+            fbinfo->bpp = 32;
+            fbinfo->size = w * h * 4;
+            fbinfo->width = w;
+            fbinfo->height = h;
+            fbinfo->red_offset = 0;
+            fbinfo->red_length = 8;
+            fbinfo->green_offset = 8;
+            fbinfo->green_length = 8;
+            fbinfo->blue_offset = 16;
+            fbinfo->blue_length = 8;
+            fbinfo->alpha_offset = 24;
+            fbinfo->alpha_length = 8;
             break;
         case 2: /* RGBX_8888 */
-            fbinfo.bpp = 32;
-            fbinfo.size = w * h * 4;
-            fbinfo.width = w;
-            fbinfo.height = h;
-            fbinfo.red_offset = 0;
-            fbinfo.red_length = 8;
-            fbinfo.green_offset = 8;
-            fbinfo.green_length = 8;
-            fbinfo.blue_offset = 16;
-            fbinfo.blue_length = 8;
-            fbinfo.alpha_offset = 24;
-            fbinfo.alpha_length = 0;
+            fbinfo->bpp = 32;
+            fbinfo->size = w * h * 4;
+            fbinfo->width = w;
+            fbinfo->height = h;
+            fbinfo->red_offset = 0;
+            fbinfo->red_length = 8;
+            fbinfo->green_offset = 8;
+            fbinfo->green_length = 8;
+            fbinfo->blue_offset = 16;
+            fbinfo->blue_length = 8;
+            fbinfo->alpha_offset = 24;
+            fbinfo->alpha_length = 0;
             break;
         case 3: /* RGB_888 */
-            fbinfo.bpp = 24;
-            fbinfo.size = w * h * 3;
-            fbinfo.width = w;
-            fbinfo.height = h;
-            fbinfo.red_offset = 0;
-            fbinfo.red_length = 8;
-            fbinfo.green_offset = 8;
-            fbinfo.green_length = 8;
-            fbinfo.blue_offset = 16;
-            fbinfo.blue_length = 8;
-            fbinfo.alpha_offset = 24;
-            fbinfo.alpha_length = 0;
+            fbinfo->bpp = 24;
+            fbinfo->size = w * h * 3;
+            fbinfo->width = w;
+            fbinfo->height = h;
+            fbinfo->red_offset = 0;
+            fbinfo->red_length = 8;
+            fbinfo->green_offset = 8;
+            fbinfo->green_length = 8;
+            fbinfo->blue_offset = 16;
+            fbinfo->blue_length = 8;
+            fbinfo->alpha_offset = 24;
+            fbinfo->alpha_length = 0;
             break;
         case 4: /* RGB_565 */
-            fbinfo.bpp = 16;
-            fbinfo.size = w * h * 2;
-            fbinfo.width = w;
-            fbinfo.height = h;
-            fbinfo.red_offset = 11;
-            fbinfo.red_length = 5;
-            fbinfo.green_offset = 5;
-            fbinfo.green_length = 6;
-            fbinfo.blue_offset = 0;
-            fbinfo.blue_length = 5;
-            fbinfo.alpha_offset = 0;
-            fbinfo.alpha_length = 0;
+            fbinfo->bpp = 16;
+            fbinfo->size = w * h * 2;
+            fbinfo->width = w;
+            fbinfo->height = h;
+            fbinfo->red_offset = 11;
+            fbinfo->red_length = 5;
+            fbinfo->green_offset = 5;
+            fbinfo->green_length = 6;
+            fbinfo->blue_offset = 0;
+            fbinfo->blue_length = 5;
+            fbinfo->alpha_offset = 0;
+            fbinfo->alpha_length = 0;
             break;
         case 5: /* BGRA_8888 */
-            fbinfo.bpp = 32;
-            fbinfo.size = w * h * 4;
-            fbinfo.width = w;
-            fbinfo.height = h;
-            fbinfo.red_offset = 16;
-            fbinfo.red_length = 8;
-            fbinfo.green_offset = 8;
-            fbinfo.green_length = 8;
-            fbinfo.blue_offset = 0;
-            fbinfo.blue_length = 8;
-            fbinfo.alpha_offset = 24;
-            fbinfo.alpha_length = 8;
+            fbinfo->bpp = 32;
+            fbinfo->size = w * h * 4;
+            fbinfo->width = w;
+            fbinfo->height = h;
+            fbinfo->red_offset = 16;
+            fbinfo->red_length = 8;
+            fbinfo->green_offset = 8;
+            fbinfo->green_length = 8;
+            fbinfo->blue_offset = 0;
+            fbinfo->blue_length = 8;
+            fbinfo->alpha_offset = 24;
+            fbinfo->alpha_length = 8;
            break;
         default:
-            goto done;
+            return false;
     }
+    return true;
+}
+
+void framebuffer_service(int fd, void *cookie)
+{
+    struct fbinfo fbinfo;
+    unsigned int i, bsize;
+    char buf[640];
+    int fd_screencap;
+    pid_t pid;
+
+    pid = start_screencap(&fd_screencap);
+    if (pid < 0) goto pipefail;
+
+    if (!read_screencap_info(fd_screencap, &fbinfo)) goto done;
 
     /* write header */
     if(!WriteFdExactly(fd, &fbinfo, sizeof(fbinfo))) goto done;
@@ -180,9 +210,71 @@ void framebuffer_service(int fd, void *cookie)
     }
 
 done:
-    adb_close(fds[0]);
+    adb_close(fd_screencap);
 
     TEMP_FAILURE_RETRY(waitpid(pid, NULL, 0));
 pipefail:
     adb_close(fd);
 }
+
+/* Sent before the first frame, and again whenever the screen changes shape. */
+struct fbstream_info {
+    unsigned int id;
+    struct fbinfo fbinfo;
+    unsigned int tile_size;
+} __attribute__((packed));
+
+void framebuffer_stream_service(int fd, void *cookie)
+{
+    char* options = reinterpret_cast<char*>(cookie);
+    int interval_ms = 0;
+    int level = kFramebufferCompressionDefaultLevel;
+
+    for (const std::string& option : android::base::Split(options, ",")) {
+        if (android::base::StartsWith(option, "interval=")) {
+            android::base::ParseInt(option.c_str() + 9, &interval_ms, 0);
+        } else if (android::base::StartsWith(option, "zlib=")) {
+            android::base::ParseInt(option.c_str() + 5, &level, 0,
+                                    kFramebufferCompressionMaxLevel);
+        }
+    }
+    free(options);
+
+    std::unique_ptr<FramebufferDeltaEncoder> encoder;
+    struct fbinfo current = {};
+    std::vector<char> frame;
+    std::string out;
+
+    while (true) {
+        auto start = std::chrono::steady_clock::now();
+        int fd_screencap;
+        pid_t pid = start_screencap(&fd_screencap);
+        if (pid < 0) break;
+
+        struct fbinfo fbinfo;
+        bool ok = read_screencap_info(fd_screencap, &fbinfo);
+        if (ok && (!encoder || memcmp(&fbinfo, &current, sizeof(fbinfo)) != 0)) {
+            /* start over with every tile, a rotated screen has nothing in common */
+            struct fbstream_info info = {FB_STREAM_INFO, fbinfo, kFramebufferTileSize};
+            out.append(reinterpret_cast<const char*>(&info), sizeof(info));
+            encoder.reset(new FramebufferDeltaEncoder(fbinfo.width, fbinfo.height,
+                                                      fbinfo.bpp / 8, level));
+            frame.resize(fbinfo.size);
+            current = fbinfo;
+        }
+        if (ok) ok = ReadFdExactly(fd_screencap, frame.data(), frame.size());
+
+        adb_close(fd_screencap);
+        TEMP_FAILURE_RETRY(waitpid(pid, NULL, 0));
+        if (!ok) break;
+
+        /* a client that reads slowly gets fewer frames rather than stale ones */
+        encoder->Encode(frame.data(), &out);
+        if (!WriteFdExactly(fd, out.data(), out.size())) break;
+        out.clear();
+
+        std::this_thread::sleep_until(start + std::chrono::milliseconds(interval_ms));
+    }
+
+    adb_close(fd);
+}
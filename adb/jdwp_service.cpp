@@ -28,10 +28,15 @@
 #include <sys/un.h>
 #include <unistd.h>
 
+#include <algorithm>
 #include <list>
 #include <memory>
+#include <string>
+#include <unordered_map>
 #include <vector>
 
+#include <android-base/stringprintf.h>
+
 #include "adb.h"
 #include "adb_io.h"
 #include "adb_unique_fd.h"
@@ -59,8 +64,8 @@
     processes).
 
     adbd thus maintains a list of "active" JDWP processes. it can send
-    its content to clients through the "device:debug-ports" service,
-    or even updates through the "device:track-debug-ports" service.
+    its content to clients through the "jdwp" service, or even updates
+    through the "track-jdwp" and "track-jdwp-delta" services.
 
     when a debugger wants to connect, it simply runs the command
     equivalent to  "adb forward tcp:<hostport> jdwp:<pid>"
@@ -128,11 +133,14 @@
 static constexpr size_t PID_LEN = 4;
 
 static void jdwp_process_event(int socket, unsigned events, void* _proc);
-static void jdwp_process_list_updated(void);
+static void jdwp_process_list_updated(int pid, bool was_listed);
 
 struct JdwpProcess;
 static std::list<std::unique_ptr<JdwpProcess>> _jdwp_list;
 
+// The first process in the list with each pid, so that lookups don't walk it.
+static std::unordered_map<int, JdwpProcess*> _jdwp_pids;
+
 struct JdwpProcess {
     explicit JdwpProcess(int socket) {
         this->socket = socket;
@@ -149,34 +157,57 @@ struct JdwpProcess {
     }
 
     ~JdwpProcess() {
+        // Stop watching the socket before closing it, or epoll has nothing to remove.
+        if (this->fde) {
+            fdevent_destroy(this->fde);
+            this->fde = nullptr;
+        }
+
         if (this->socket >= 0) {
             adb_shutdown(this->socket);
             adb_close(this->socket);
             this->socket = -1;
         }
 
-        if (this->fde) {
-            fdevent_destroy(this->fde);
-            this->fde = nullptr;
-        }
-
         out_fds.clear();
     }
 
+    void SetPid(int pid) {
+        this->pid = pid;
+        bool was_listed = !_jdwp_pids.emplace(pid, this).second;
+        jdwp_process_list_updated(pid, was_listed);
+    }
+
+    // Deletes this.
     void RemoveFromList() {
-        if (this->pid >= 0) {
-            D("removing pid %d from jdwp process list", this->pid);
+        int pid = this->pid;
+        if (pid >= 0) {
+            D("removing pid %d from jdwp process list", pid);
         } else {
             D("removing transient JdwpProcess from list");
         }
 
-        auto pred = [this](const auto& proc) { return proc.get() == this; };
-        _jdwp_list.remove_if(pred);
+        auto it = _jdwp_pids.find(pid);
+        bool indexed = it != _jdwp_pids.end() && it->second == this;
+        _jdwp_list.erase(this->list_position);
+
+        if (indexed) {
+            // Another connection from the same pid takes over, if there is one.
+            auto pred = [pid](const auto& proc) { return proc->pid == pid; };
+            auto next = std::find_if(_jdwp_list.begin(), _jdwp_list.end(), pred);
+            if (next != _jdwp_list.end()) {
+                it->second = next->get();
+            } else {
+                _jdwp_pids.erase(it);
+            }
+            jdwp_process_list_updated(pid, true);
+        }
     }
 
     int pid = -1;
     int socket = -1;
     fdevent* fde = nullptr;
+    std::list<std::unique_ptr<JdwpProcess>>::iterator list_position;
 
     std::vector<unique_fd> out_fds;
 };
@@ -185,8 +216,8 @@ static size_t jdwp_process_list(char* buffer, size_t bufferlen) {
     std::string temp;
 
     for (auto& proc : _jdwp_list) {
-        /* skip transient connections */
-        if (proc->pid < 0) {
+        /* skip transient connections, and pids already listed */
+        if (proc->pid < 0 || _jdwp_pids.find(proc->pid)->second != proc.get()) {
             continue;
         }
 
@@ -202,18 +233,30 @@ static size_t jdwp_process_list(char* buffer, size_t bufferlen) {
     return temp.length();
 }
 
-static size_t jdwp_process_list_msg(char* buffer, size_t bufferlen) {
-    // Message is length-prefixed with 4 hex digits in ASCII.
-    static constexpr size_t header_len = 4;
-    if (bufferlen < header_len) {
-        fatal("invalid JDWP process list buffer size: %zu", bufferlen);
-    }
+// Messages are length-prefixed with 4 hex digits in ASCII.
+static constexpr size_t JDWP_MSG_HEADER_LEN = 4;
+static constexpr size_t JDWP_MSG_MAX = 0xffff;
 
-    char head[header_len + 1];
-    size_t len = jdwp_process_list(buffer + header_len, bufferlen - header_len);
+static std::string jdwp_process_list_msg() {
+    std::string msg(JDWP_MSG_HEADER_LEN + JDWP_MSG_MAX, '\0');
+    size_t len = jdwp_process_list(&msg[JDWP_MSG_HEADER_LEN], JDWP_MSG_MAX);
+
+    char head[JDWP_MSG_HEADER_LEN + 1];
     snprintf(head, sizeof head, "%04zx", len);
-    memcpy(buffer, head, header_len);
-    return len + header_len;
+    memcpy(&msg[0], head, JDWP_MSG_HEADER_LEN);
+    msg.resize(JDWP_MSG_HEADER_LEN + len);
+    return msg;
+}
+
+// Sends |data| to |s|'s peer, in as many packets as it takes.
+static void jdwp_send(asocket* s, const std::string& data) {
+    size_t max_payload = s->get_max_payload();
+    for (size_t offset = 0; offset < data.size(); offset += max_payload) {
+        apacket* p = get_apacket();
+        p->len = std::min(max_payload, data.size() - offset);
+        memcpy(p->data, data.data() + offset, p->len);
+        s->peer->enqueue(s->peer, p);
+    }
 }
 
 static void jdwp_process_event(int socket, unsigned events, void* _proc) {
@@ -230,14 +273,15 @@ static void jdwp_process_event(int socket, unsigned events, void* _proc) {
             }
             buf[PID_LEN] = '\0';
 
-            if (sscanf(buf, "%04x", &proc->pid) != 1) {
+            int pid;
+            if (sscanf(buf, "%04x", &pid) != 1) {
                 D("could not decode JDWP %p PID number: '%s'", proc, buf);
                 goto CloseProcess;
             }
 
             /* all is well, keep reading to detect connection closure */
-            D("Adding pid %d to jdwp process list", proc->pid);
-            jdwp_process_list_updated();
+            D("Adding pid %d to jdwp process list", pid);
+            proc->SetPid(pid);
         } else {
             /* the pid was read, if we get there it's probably because the connection
              * was closed (e.g. the JDWP process exited or crashed) */
@@ -324,32 +368,31 @@ static void jdwp_process_event(int socket, unsigned events, void* _proc) {
 
 CloseProcess:
     proc->RemoveFromList();
-    jdwp_process_list_updated();
 }
 
 int create_jdwp_connection_fd(int pid) {
     D("looking for pid %d in JDWP process list", pid);
 
-    for (auto& proc : _jdwp_list) {
-        if (proc->pid == pid) {
-            int fds[2];
-
-            if (adb_socketpair(fds) < 0) {
-                D("%s: socket pair creation failed: %s", __FUNCTION__, strerror(errno));
-                return -1;
-            }
-            D("socketpair: (%d,%d)", fds[0], fds[1]);
+    auto it = _jdwp_pids.find(pid);
+    if (it == _jdwp_pids.end()) {
+        D("search failed !!");
+        return -1;
+    }
+    JdwpProcess* proc = it->second;
 
-            proc->out_fds.emplace_back(fds[1]);
-            if (proc->out_fds.size() == 1) {
-                fdevent_add(proc->fde, FDE_WRITE);
-            }
+    int fds[2];
+    if (adb_socketpair(fds) < 0) {
+        D("%s: socket pair creation failed: %s", __FUNCTION__, strerror(errno));
+        return -1;
+    }
+    D("socketpair: (%d,%d)", fds[0], fds[1]);
 
-            return fds[0];
-        }
+    proc->out_fds.emplace_back(fds[1]);
+    if (proc->out_fds.size() == 1) {
+        fdevent_add(proc->fde, FDE_WRITE);
     }
-    D("search failed !!");
-    return -1;
+
+    return fds[0];
 }
 
 /**  VM DEBUG CONTROL SOCKET
@@ -444,7 +487,8 @@ static void jdwp_control_event(int s, unsigned events, void* _control) {
             fatal("failed to allocate JdwpProcess");
         }
 
-        _jdwp_list.emplace_back(std::move(proc));
+        JdwpProcess* p = proc.get();
+        p->list_position = _jdwp_list.insert(_jdwp_list.end(), std::move(proc));
     }
 }
 
@@ -512,30 +556,74 @@ asocket* create_jdwp_service_socket(void) {
     return s;
 }
 
-/** "track-jdwp" local service implementation
- ** this periodically sends the list of known JDWP process pids
- ** to the client...
+/** "track-jdwp" and "track-jdwp-delta" local service implementation
+ ** this sends the list of known JDWP process pids to the client, and then
+ ** the whole list again or just what changed whenever it does...
  **/
 
 struct JdwpTracker : public asocket {
     bool need_initial;
+    bool delta;
 };
 
 static std::vector<std::unique_ptr<JdwpTracker>> _jdwp_trackers;
 
-static void jdwp_process_list_updated(void) {
-    char buffer[1024];
-    int len = jdwp_process_list_msg(buffer, sizeof(buffer));
+// The pids that came or went since the trackers were last told, with whether
+// each was listed then.  Changes in one pass of the fdevent loop go out together,
+// and a process that comes and goes in the meantime isn't mentioned at all.
+static std::unordered_map<int, bool> _jdwp_changes;
+static std::vector<int> _jdwp_changes_order;
+
+static void jdwp_send_updates(void) {
+    std::string deltas;
+    for (int pid : _jdwp_changes_order) {
+        bool listed = _jdwp_pids.count(pid) != 0;
+        if (listed != _jdwp_changes[pid]) {
+            deltas += android::base::StringPrintf("%c%d\n", listed ? '+' : '-', pid);
+        }
+    }
+    _jdwp_changes.clear();
+    _jdwp_changes_order.clear();
+    if (deltas.empty()) {
+        return;
+    }
 
-    for (auto& t : _jdwp_trackers) {
-        apacket* p = get_apacket();
-        memcpy(p->data, buffer, len);
-        p->len = len;
+    // Deltas are cut at line boundaries into messages of at most JDWP_MSG_MAX.
+    std::string delta_msgs;
+    for (size_t offset = 0; offset < deltas.size();) {
+        size_t len = deltas.size() - offset;
+        if (len > JDWP_MSG_MAX) {
+            len = deltas.rfind('\n', offset + JDWP_MSG_MAX - 1) + 1 - offset;
+        }
+        delta_msgs += android::base::StringPrintf("%04zx", len);
+        delta_msgs.append(deltas, offset, len);
+        offset += len;
+    }
 
-        if (t->peer) {
-            // The tracker might not have been connected yet.
-            t->peer->enqueue(t->peer, p);
+    std::string list_msg;
+    for (auto& t : _jdwp_trackers) {
+        // The tracker might not have been connected yet, and will get
+        // the whole list when it is.
+        if (!t->peer || t->need_initial) {
+            continue;
         }
+        if (t->delta) {
+            jdwp_send(t.get(), delta_msgs);
+        } else {
+            if (list_msg.empty()) {
+                list_msg = jdwp_process_list_msg();
+            }
+            jdwp_send(t.get(), list_msg);
+        }
+    }
+}
+
+static void jdwp_process_list_updated(int pid, bool was_listed) {
+    if (_jdwp_changes.empty()) {
+        fdevent_run_on_main_thread(jdwp_send_updates);
+    }
+    if (_jdwp_changes.emplace(pid, was_listed).second) {
+        _jdwp_changes_order.push_back(pid);
     }
 }
 
@@ -560,10 +648,11 @@ static void jdwp_tracker_ready(asocket* s) {
     JdwpTracker* t = (JdwpTracker*)s;
 
     if (t->need_initial) {
-        apacket* p = get_apacket();
+        // Tell the others what changed first, so none of that is sent to this one
+        // on top of the list that already has it.
+        jdwp_send_updates();
         t->need_initial = false;
-        p->len = jdwp_process_list_msg((char*)p->data, s->get_max_payload());
-        s->peer->enqueue(s->peer, p);
+        jdwp_send(s, jdwp_process_list_msg());
     }
 }
 
@@ -575,7 +664,7 @@ static int jdwp_tracker_enqueue(asocket* s, apacket* p) {
     return -1;
 }
 
-asocket* create_jdwp_tracker_service_socket(void) {
+static asocket* create_jdwp_tracker(bool delta) {
     auto t = std::make_unique<JdwpTracker>();
     if (!t) {
         fatal("failed to allocate JdwpTracker");
@@ -584,12 +673,13 @@ asocket* create_jdwp_tracker_service_socket(void) {
     memset(t.get(), 0, sizeof(asocket));
 
     install_local_socket(t.get());
-    D("LS(%d): created new jdwp tracker service", t->id);
+    D("LS(%d): created new jdwp %stracker service", t->id, delta ? "delta " : "");
 
     t->ready = jdwp_tracker_ready;
     t->enqueue = jdwp_tracker_enqueue;
     t->close = jdwp_tracker_close;
     t->need_initial = true;
+    t->delta = delta;
 
     asocket* result = t.get();
 
@@ -598,6 +688,14 @@ asocket* create_jdwp_tracker_service_socket(void) {
     return result;
 }
 
+asocket* create_jdwp_tracker_service_socket(void) {
+    return create_jdwp_tracker(false);
+}
+
+asocket* create_jdwp_delta_tracker_service_socket(void) {
+    return create_jdwp_tracker(true);
+}
+
 int init_jdwp(void) {
     return jdwp_control_init(&_jdwp_control, JDWP_CONTROL_NAME, JDWP_CONTROL_NAME_LEN);
 }
@@ -173,6 +173,13 @@ void reboot_service(int fd, void* arg) {
     adb_close(fd);
 }
 
+static void perf_service(int fd, void* arg) {
+    std::string* report = static_cast<std::string*>(arg);
+    WriteFdExactly(fd, *report);
+    delete report;
+    adb_close(fd);
+}
+
 static void reconnect_service(int fd, void* arg) {
     WriteFdExactly(fd, "done");
     adb_close(fd);
@@ -281,6 +288,10 @@ int service_to_fd(const char* name, const atransport* transport) {
         ret = unix_open(name + 4, O_RDWR | O_CLOEXEC);
     } else if(!strncmp(name, "framebuffer:", 12)) {
         ret = create_service_thread("fb", framebuffer_service, nullptr);
+    } else if (!strncmp(name, "framebuffer-stream:", 19)) {
+        void* arg = strdup(name + 19);
+        if (arg == NULL) return -1;
+        ret = create_service_thread("fb-stream", framebuffer_stream_service, arg);
     } else if (!strncmp(name, "jdwp:", 5)) {
         ret = create_jdwp_connection_fd(atoi(name+5));
     } else if(!strncmp(name, "shell", 5)) {
@@ -325,6 +336,9 @@ int service_to_fd(const char* name, const atransport* transport) {
     } else if (!strcmp(name, "reconnect")) {
         ret = create_service_thread("reconnect", reconnect_service,
                                     const_cast<atransport*>(transport));
+    } else if (!strcmp(name, "perf:")) {
+        // Gathered here, on the main thread that owns the sockets and fdevents.
+        ret = create_service_thread("perf", perf_service, new std::string(perf_report()));
 #endif
     }
     if (ret >= 0) {
@@ -406,14 +420,6 @@ void connect_emulator(const std::string& port_spec, std::string* response) {
         return;
     }
 
-    // Check if more emulators can be registered. Similar unproblematic
-    // race condition as above.
-    int candidate_slot = get_available_local_transport_index();
-    if (candidate_slot < 0) {
-        *response = "Cannot accept more emulators";
-        return;
-    }
-
     // Preconditions met, try to connect to the emulator.
     std::string error;
     if (!local_connect_arbitrary_ports(console_port, adb_port, &error)) {
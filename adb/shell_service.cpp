@@ -34,11 +34,12 @@
 // a single pipe which is registered with a local socket in adbd. The local
 // socket uses the fdevent loop to pass raw data between this pipe and the
 // transport, which then passes data back to the adb client. Cleanup is done by
-// waiting in a separate thread for the subprocesses to exit and then signaling
-// a separate fdevent to close out the local socket from the main loop.
+// waiting in a reaper thread, shared by all subprocesses, for the subprocess to
+// exit and then signaling a separate fdevent to close out the local socket from
+// the main loop.
 //
 // ------------------+-------------------------+------------------------------
-//   Subprocess      |  adbd subprocess thread |   adbd main fdevent loop
+//   Subprocess      |    adbd shell threads   |   adbd main fdevent loop
 // ------------------+-------------------------+------------------------------
 //                   |                         |
 //   stdin/out/err <----------------------------->       LocalSocket
@@ -52,11 +53,12 @@
 //                   |   Notify shell exit FD --->    Close LocalSocket
 // ------------------+-------------------------+------------------------------
 //
-// The protocol requires the thread to intercept stdin/out/err in order to
-// wrap/unwrap data with shell protocol packets.
+// The protocol requires the shell thread to intercept stdin/out/err in order to
+// wrap/unwrap data with shell protocol packets. One thread does this for every
+// subprocess, with non-blocking I/O, see ShellLoop.
 //
 // ------------------+-------------------------+------------------------------
-//   Subprocess      |  adbd subprocess thread |   adbd main fdevent loop
+//   Subprocess      |    adbd shell threads   |   adbd main fdevent loop
 // ------------------+-------------------------+------------------------------
 //                   |                         |
 //     stdin/out   <--->      Protocol       <--->       LocalSocket
@@ -71,8 +73,8 @@
 //
 // An alternate approach is to put the protocol wrapping/unwrapping in the main
 // fdevent loop, which has the advantage of being able to re-use the existing
-// select() code for handling data streams. However, implementation turned out
-// to be more complex due to partial reads and non-blocking I/O so this model
+// select() code for handling data streams. However, the shell thread keeps a
+// flood of subprocess output from competing with the transports, so this model
 // was chosen instead.
 
 #define TRACE_TAG SHELL
@@ -85,17 +87,24 @@
 #include <paths.h>
 #include <pty.h>
 #include <pwd.h>
-#include <sys/select.h>
+#include <sys/epoll.h>
+#include <sys/wait.h>
 #include <termios.h>
 
+#include <chrono>
+#include <condition_variable>
 #include <memory>
+#include <mutex>
 #include <string>
 #include <thread>
 #include <unordered_map>
+#include <unordered_set>
+#include <utility>
 #include <vector>
 
 #include <android-base/logging.h>
 #include <android-base/stringprintf.h>
+#include <android-base/thread_annotations.h>
 #include <private/android_logger.h>
 
 #include "adb.h"
@@ -135,6 +144,8 @@ bool CreateSocketpair(unique_fd* fd1, unique_fd* fd2) {
     return true;
 }
 
+class ShellLoop;
+
 class Subprocess {
   public:
     Subprocess(const std::string& command, const char* terminal_type,
@@ -147,30 +158,51 @@ class Subprocess {
 
     pid_t pid() const { return pid_; }
 
-    // Sets up FDs, forks a subprocess, starts the subprocess manager thread,
-    // and exec's the child. Returns false and sets error on failure.
+    // Sets up FDs, forks a subprocess, and exec's the child. Returns false and
+    // sets error on failure.
     bool ForkAndExec(std::string* _Nonnull error);
 
-    // Start the subprocess manager thread. Consumes the subprocess, regardless of success.
+    // Hands the subprocess to the shell thread, which passes its data and
+    // reaps it. Consumes the subprocess, regardless of success.
     // Returns false and sets error on failure.
-    static bool StartThread(std::unique_ptr<Subprocess> subprocess,
-                            std::string* _Nonnull error);
+    static bool Start(std::unique_ptr<Subprocess> subprocess,
+                      std::string* _Nonnull error);
 
   private:
+    friend class ShellLoop;
+
+    // An FD registered with the shell thread's epoll set.
+    struct Watch {
+        Subprocess* subprocess;
+        unique_fd* sfd;
+        uint32_t events;
+    };
+
     // Opens the file at |pts_name|.
     int OpenPtyChildFd(const char* pts_name, unique_fd* error_sfd);
 
-    static void ThreadHandler(void* userdata);
-    void PassDataStreams();
-    void WaitForExit();
-
-    unique_fd* SelectLoop(fd_set* master_read_set_ptr,
-                          fd_set* master_write_set_ptr);
+    // Called on the shell thread. Attach() registers the data streams,
+    // HandleEvents() passes data when one of them is ready, and Exited()
+    // is told the status waitpid() returned. Each returns true once the
+    // subprocess is finished with and can be deleted.
+    bool Attach(ShellLoop* loop);
+    bool HandleEvents(Watch* watch, uint32_t events);
+    bool Exited(int status);
 
     // Input/output stream handlers. Success returns nullptr, failure returns
     // a pointer to the failed FD.
     unique_fd* PassInput();
     unique_fd* PassOutput(unique_fd* sfd, ShellProtocol::Id id);
+    unique_fd* ContinueOutput();
+
+    void CloseDeadFd(unique_fd* dead_sfd);
+    // Brings the epoll set in line with what the streams are waiting for.
+    void UpdateWatches();
+    void SetWatch(Watch* watch, uint32_t events);
+    // Sends the exit code once the streams are done and the subprocess has
+    // exited. Returns true when nothing is left to do.
+    bool MaybeFinish();
+    void NotifyExit();
 
     const std::string command_;
     const std::string terminal_type_;
@@ -184,10 +216,65 @@ class Subprocess {
     unique_fd stdinout_sfd_, stderr_sfd_, protocol_sfd_;
     std::unique_ptr<ShellProtocol> input_, output_;
     size_t input_bytes_left_ = 0;
+    // A packet in output_ is waiting for the protocol FD to take the rest.
+    bool output_pending_ = false;
+
+    ShellLoop* loop_ = nullptr;
+    Watch stdinout_watch_ = {this, &stdinout_sfd_, 0};
+    Watch stderr_watch_ = {this, &stderr_sfd_, 0};
+    Watch protocol_watch_ = {this, &protocol_sfd_, 0};
+    // -1 until the subprocess has exited.
+    int exit_code_ = -1;
+    bool exit_sent_ = false;
 
     DISALLOW_COPY_AND_ASSIGN(Subprocess);
 };
 
+// One thread passes the data of every shell protocol subprocess, waiting on
+// all of their FDs with epoll, rather than each having a thread of its own
+// blocked in select(); a second reaps them all. Test harnesses run hundreds of
+// concurrent shells, and each thread cost a stack on top of its buffers.
+//
+// FDs are non-blocking and packet reads and writes are resumable, so one
+// stalled client only holds up its own subprocess.
+class ShellLoop {
+  public:
+    static ShellLoop* Instance();
+
+    // Takes ownership of |subprocess|.
+    void Add(Subprocess* subprocess);
+
+    // Adds, changes or removes |sfd| in the epoll set.
+    void Watch(Subprocess::Watch* watch, uint32_t old_events, uint32_t new_events);
+
+  private:
+    ShellLoop() = default;
+    bool Init();
+
+    void Run();
+    void Reap();
+    void Wake();
+
+    // Deletes |subprocess| if |finished|.
+    void Finished(Subprocess* subprocess, bool finished);
+
+    unique_fd epoll_fd_;
+    unique_fd wake_sfd_, wake_receiver_sfd_;
+
+    std::mutex mutex_;
+    std::condition_variable reap_cv_;
+    // Subprocesses to Attach(), and those reaped along with their status.
+    std::vector<Subprocess*> added_ GUARDED_BY(mutex_);
+    std::vector<std::pair<Subprocess*, int>> exited_ GUARDED_BY(mutex_);
+    // Subprocesses not yet reaped, by pid.
+    std::unordered_map<pid_t, Subprocess*> running_ GUARDED_BY(mutex_);
+
+    // Subprocesses deleted while handling the current batch of events.
+    std::unordered_set<Subprocess*> deleted_;
+
+    DISALLOW_COPY_AND_ASSIGN(ShellLoop);
+};
+
 Subprocess::Subprocess(const std::string& command, const char* terminal_type,
                        SubprocessType type, SubprocessProtocol protocol)
     : command_(command),
@@ -199,7 +286,7 @@ Subprocess::Subprocess(const std::string& command, const char* terminal_type,
     // of the PTY closes, which we rely on. If we use a raw pipe, processes that don't read/write,
     // e.g. screenrecord, will never notice the broken pipe and terminate.
     // The shell protocol doesn't require a PTY because it's always monitoring the local socket FD
-    // with select() and will send SIGHUP manually to the child process.
+    // with epoll and will send SIGHUP manually to the child process.
     if (protocol_ == SubprocessProtocol::kNone && type_ == SubprocessType::kRaw) {
         // Disable PTY input/output processing since the client is expecting raw data.
         D("Can't create raw subprocess without shell protocol, using PTY in raw mode instead");
@@ -209,7 +296,11 @@ Subprocess::Subprocess(const std::string& command, const char* terminal_type,
 }
 
 Subprocess::~Subprocess() {
-    WaitForExit();
+    // Reaping and the exit notification are done by the time the shell
+    // thread deletes a subprocess; here only FDs are left to close.
+    for (Watch* watch : {&stdinout_watch_, &stderr_watch_, &protocol_watch_}) {
+        SetWatch(watch, 0);
+    }
 }
 
 bool Subprocess::ForkAndExec(std::string* error) {
@@ -371,11 +462,11 @@ bool Subprocess::ForkAndExec(std::string* error) {
             return false;
         }
 
-        // Don't let reads/writes to the subprocess block our thread. This isn't
-        // likely but could happen under unusual circumstances, such as if we
-        // write a ton of data to stdin but the subprocess never reads it and
-        // the pipe fills up.
-        for (int fd : {stdinout_sfd_.get(), stderr_sfd_.get()}) {
+        // Don't let reads/writes to the subprocess or the client block the
+        // thread that every session shares, such as if we write a ton of
+        // data to stdin but the subprocess never reads it and the pipe fills
+        // up, or the client stops reading its output.
+        for (int fd : {stdinout_sfd_.get(), stderr_sfd_.get(), protocol_sfd_.get()}) {
             if (fd >= 0) {
                 if (!set_file_block_mode(fd, false)) {
                     *error = android::base::StringPrintf(
@@ -391,10 +482,13 @@ bool Subprocess::ForkAndExec(std::string* error) {
     return true;
 }
 
-bool Subprocess::StartThread(std::unique_ptr<Subprocess> subprocess, std::string* error) {
-    Subprocess* raw = subprocess.release();
-    std::thread(ThreadHandler, raw).detach();
-
+bool Subprocess::Start(std::unique_ptr<Subprocess> subprocess, std::string* error) {
+    ShellLoop* loop = ShellLoop::Instance();
+    if (!loop) {
+        *error = "failed to start shell thread";
+        return false;
+    }
+    loop->Add(subprocess.release());
     return true;
 }
 
@@ -432,132 +526,191 @@ int Subprocess::OpenPtyChildFd(const char* pts_name, unique_fd* error_sfd) {
     return child_fd;
 }
 
-void Subprocess::ThreadHandler(void* userdata) {
-    Subprocess* subprocess = reinterpret_cast<Subprocess*>(userdata);
+bool Subprocess::Attach(ShellLoop* loop) {
+    loop_ = loop;
+    if (protocol_sfd_ != -1) {
+        // Start by trying to read from the protocol FD, stdout, and stderr.
+        UpdateWatches();
+    }
+    return MaybeFinish();
+}
 
-    adb_thread_setname(android::base::StringPrintf("shell svc %d", subprocess->pid()));
+bool Subprocess::HandleEvents(Watch* watch, uint32_t events) {
+    // Errors and hangups are found by the read or write they make fail.
+    bool readable = (watch->events & EPOLLIN) && (events & (EPOLLIN | EPOLLHUP | EPOLLERR));
+    bool writable = (watch->events & EPOLLOUT) && (events & (EPOLLOUT | EPOLLHUP | EPOLLERR));
+    unique_fd* dead_sfd = nullptr;
 
-    D("passing data streams for PID %d", subprocess->pid());
-    subprocess->PassDataStreams();
+    if (watch == &stdinout_watch_) {
+        // Read stdout, write to protocol FD.
+        if (readable) {
+            dead_sfd = PassOutput(&stdinout_sfd_, ShellProtocol::kIdStdout);
+        }
+        // Continue writing to stdin; only happens if a previous write blocked.
+        if (!dead_sfd && writable && stdinout_sfd_ != -1) {
+            dead_sfd = PassInput();
+        }
+    } else if (watch == &stderr_watch_) {
+        // Read stderr, write to protocol FD.
+        if (readable) {
+            dead_sfd = PassOutput(&stderr_sfd_, ShellProtocol::kIdStderr);
+        }
+    } else {
+        // Finish writing the last packet from stdout/stderr or the exit code.
+        if (writable) {
+            dead_sfd = ContinueOutput();
+        }
+        // Read protocol FD, write to stdin.
+        if (!dead_sfd && readable && protocol_sfd_ != -1) {
+            dead_sfd = PassInput();
+        }
+    }
 
-    D("deleting Subprocess for PID %d", subprocess->pid());
-    delete subprocess;
+    if (dead_sfd) {
+        CloseDeadFd(dead_sfd);
+    }
+    UpdateWatches();
+    return MaybeFinish();
 }
 
-void Subprocess::PassDataStreams() {
-    if (protocol_sfd_ == -1) {
-        return;
+bool Subprocess::Exited(int status) {
+    exit_code_ = 1;
+    D("post waitpid (pid=%d) status=%04x", pid_, status);
+    if (WIFSIGNALED(status)) {
+        exit_code_ = 0x80 | WTERMSIG(status);
+        D("subprocess killed by signal %d", WTERMSIG(status));
+    } else if (!WIFEXITED(status)) {
+        D("subprocess didn't exit");
+    } else {
+        exit_code_ = WEXITSTATUS(status);
+        D("subprocess exit code = %d", WEXITSTATUS(status));
     }
+    return MaybeFinish();
+}
 
-    // Start by trying to read from the protocol FD, stdout, and stderr.
-    fd_set master_read_set, master_write_set;
-    FD_ZERO(&master_read_set);
-    FD_ZERO(&master_write_set);
-    for (unique_fd* sfd : {&protocol_sfd_, &stdinout_sfd_, &stderr_sfd_}) {
-        if (*sfd != -1) {
-            FD_SET(*sfd, &master_read_set);
-        }
+void Subprocess::CloseDeadFd(unique_fd* dead_sfd) {
+    D("closing FD %d", dead_sfd->get());
+    if (dead_sfd == &protocol_sfd_) {
+        // Using SIGHUP is a decent general way to indicate that the
+        // controlling process is going away. If specific signals are
+        // needed (e.g. SIGINT), pass those through the shell protocol
+        // and only fall back on this for unexpected closures.
+        D("protocol FD died, sending SIGHUP to pid %d", pid_);
+        kill(pid_, SIGHUP);
+
+        // We also need to close the pipes connected to the child process
+        // so that if it ignores SIGHUP and continues to write data it
+        // won't fill up the pipe and block.
+        CloseDeadFd(&stdinout_sfd_);
+        CloseDeadFd(&stderr_sfd_);
+        output_pending_ = false;
+    } else if (dead_sfd == &stdinout_sfd_) {
+        // Whatever stdin had left to write has nowhere to go.
+        input_bytes_left_ = 0;
     }
 
-    // Pass data until the protocol FD or both the subprocess pipes die, at
-    // which point we can't pass any more data.
-    while (protocol_sfd_ != -1 && (stdinout_sfd_ != -1 || stderr_sfd_ != -1)) {
-        unique_fd* dead_sfd = SelectLoop(&master_read_set, &master_write_set);
-        if (dead_sfd) {
-            D("closing FD %d", dead_sfd->get());
-            FD_CLR(*dead_sfd, &master_read_set);
-            FD_CLR(*dead_sfd, &master_write_set);
-            if (dead_sfd == &protocol_sfd_) {
-                // Using SIGHUP is a decent general way to indicate that the
-                // controlling process is going away. If specific signals are
-                // needed (e.g. SIGINT), pass those through the shell protocol
-                // and only fall back on this for unexpected closures.
-                D("protocol FD died, sending SIGHUP to pid %d", pid_);
-                kill(pid_, SIGHUP);
-
-                // We also need to close the pipes connected to the child process
-                // so that if it ignores SIGHUP and continues to write data it
-                // won't fill up the pipe and block.
-                stdinout_sfd_.reset();
-                stderr_sfd_.reset();
-            }
-            dead_sfd->reset();
+    for (Watch* watch : {&stdinout_watch_, &stderr_watch_, &protocol_watch_}) {
+        if (watch->sfd == dead_sfd) {
+            SetWatch(watch, 0);
         }
     }
+    dead_sfd->reset();
 }
 
-namespace {
-
-inline bool ValidAndInSet(const unique_fd& sfd, fd_set* set) {
-    return sfd != -1 && FD_ISSET(sfd, set);
+void Subprocess::UpdateWatches() {
+    // Pass data until the protocol FD or both the subprocess pipes die, at
+    // which point we can't pass any more data; then only the exit code is
+    // left to write.
+    bool streaming = protocol_sfd_ != -1 && (stdinout_sfd_ != -1 || stderr_sfd_ != -1);
+    uint32_t output_read = streaming && !output_pending_ ? EPOLLIN : 0;
+    uint32_t input_write = streaming && input_bytes_left_ ? EPOLLOUT : 0;
+
+    if (stdinout_sfd_ != -1) {
+        SetWatch(&stdinout_watch_, output_read | input_write);
+    }
+    if (stderr_sfd_ != -1) {
+        SetWatch(&stderr_watch_, output_read);
+    }
+    if (protocol_sfd_ != -1) {
+        // If we didn't finish writing to stdin, block on that rather than
+        // read more from the protocol FD.
+        SetWatch(&protocol_watch_, (streaming && !input_bytes_left_ ? EPOLLIN : 0) |
+                                   (output_pending_ ? EPOLLOUT : 0));
+    }
 }
 
-}   // namespace
+void Subprocess::SetWatch(Watch* watch, uint32_t events) {
+    if (watch->events != events && loop_ && *watch->sfd != -1) {
+        loop_->Watch(watch, watch->events, events);
+    }
+    watch->events = events;
+}
 
-unique_fd* Subprocess::SelectLoop(fd_set* master_read_set_ptr,
-                                  fd_set* master_write_set_ptr) {
-    fd_set read_set, write_set;
-    int select_n = std::max(std::max(protocol_sfd_, stdinout_sfd_), stderr_sfd_) + 1;
-    unique_fd* dead_sfd = nullptr;
+bool Subprocess::MaybeFinish() {
+    if (exit_code_ == -1 || output_pending_) {
+        return false;
+    }
+    if (protocol_sfd_ != -1) {
+        if (stdinout_sfd_ != -1 || stderr_sfd_ != -1) {
+            // There may be output still to pass from something the subprocess left running.
+            return false;
+        }
 
-    // Keep calling select() and passing data until an FD closes/errors.
-    while (!dead_sfd) {
-        memcpy(&read_set, master_read_set_ptr, sizeof(read_set));
-        memcpy(&write_set, master_write_set_ptr, sizeof(write_set));
-        if (select(select_n, &read_set, &write_set, nullptr, nullptr) < 0) {
-            if (errno == EINTR) {
-                continue;
+        // If we have an open protocol FD send an exit packet.
+        if (!exit_sent_) {
+            exit_sent_ = true;
+            output_->data()[0] = exit_code_;
+            ShellProtocol::Status status = output_->StartWrite(ShellProtocol::kIdExit, 1);
+            if (status == ShellProtocol::kPending) {
+                output_pending_ = true;
+                UpdateWatches();
+                return false;
+            }
+            if (status == ShellProtocol::kComplete) {
+                D("wrote the exit code packet: %d", exit_code_);
             } else {
-                PLOG(ERROR) << "select failed, closing subprocess pipes";
-                stdinout_sfd_.reset(-1);
-                stderr_sfd_.reset(-1);
-                return nullptr;
+                PLOG(ERROR) << "failed to write the exit code packet";
             }
         }
+        CloseDeadFd(&protocol_sfd_);
+    }
 
-        // Read stdout, write to protocol FD.
-        if (ValidAndInSet(stdinout_sfd_, &read_set)) {
-            dead_sfd = PassOutput(&stdinout_sfd_, ShellProtocol::kIdStdout);
-        }
-
-        // Read stderr, write to protocol FD.
-        if (!dead_sfd && ValidAndInSet(stderr_sfd_, &read_set)) {
-            dead_sfd = PassOutput(&stderr_sfd_, ShellProtocol::kIdStderr);
-        }
-
-        // Read protocol FD, write to stdin.
-        if (!dead_sfd && ValidAndInSet(protocol_sfd_, &read_set)) {
-            dead_sfd = PassInput();
-            // If we didn't finish writing, block on stdin write.
-            if (input_bytes_left_) {
-                FD_CLR(protocol_sfd_, master_read_set_ptr);
-                FD_SET(stdinout_sfd_, master_write_set_ptr);
-            }
-        }
+    NotifyExit();
+    return true;
+}
 
-        // Continue writing to stdin; only happens if a previous write blocked.
-        if (!dead_sfd && ValidAndInSet(stdinout_sfd_, &write_set)) {
-            dead_sfd = PassInput();
-            // If we finished writing, go back to blocking on protocol read.
-            if (!input_bytes_left_) {
-                FD_SET(protocol_sfd_, master_read_set_ptr);
-                FD_CLR(stdinout_sfd_, master_write_set_ptr);
-            }
+void Subprocess::NotifyExit() {
+    // Pass the local socket FD to the shell cleanup fdevent.
+    if (SHELL_EXIT_NOTIFY_FD >= 0) {
+        int fd = local_socket_sfd_;
+        if (WriteFdExactly(SHELL_EXIT_NOTIFY_FD, &fd, sizeof(fd))) {
+            D("passed fd %d to SHELL_EXIT_NOTIFY_FD (%d) for pid %d",
+              fd, SHELL_EXIT_NOTIFY_FD, pid_);
+            // The shell exit fdevent now owns the FD and will close it once
+            // the last bit of data flushes through.
+            static_cast<void>(local_socket_sfd_.release());
+        } else {
+            PLOG(ERROR) << "failed to write fd " << fd
+                        << " to SHELL_EXIT_NOTIFY_FD (" << SHELL_EXIT_NOTIFY_FD
+                        << ") for pid " << pid_;
         }
-    }  // while (!dead_sfd)
-
-    return dead_sfd;
+    }
 }
 
 unique_fd* Subprocess::PassInput() {
     // Only read a new packet if we've finished writing the last one.
     if (!input_bytes_left_) {
-        if (!input_->Read()) {
-            // Read() uses ReadFdExactly() which sets errno to 0 on EOF.
-            if (errno != 0) {
-                PLOG(ERROR) << "error reading protocol FD " << protocol_sfd_;
-            }
-            return &protocol_sfd_;
+        switch (input_->ReadSome()) {
+            case ShellProtocol::kPending:
+                return nullptr;
+            case ShellProtocol::kClosed:
+                // errno is 0 on EOF.
+                if (errno != 0) {
+                    PLOG(ERROR) << "error reading protocol FD " << protocol_sfd_;
+                }
+                return &protocol_sfd_;
+            case ShellProtocol::kComplete:
+                break;
         }
 
         if (stdinout_sfd_ != -1) {
@@ -629,64 +782,208 @@ unique_fd* Subprocess::PassOutput(unique_fd* sfd, ShellProtocol::Id id) {
         return sfd;
     }
 
-    if (bytes > 0 && !output_->Write(id, bytes)) {
-        if (errno != 0) {
-            PLOG(ERROR) << "error reading protocol FD " << protocol_sfd_;
+    if (bytes > 0) {
+        switch (output_->StartWrite(id, bytes)) {
+            case ShellProtocol::kComplete:
+                break;
+            case ShellProtocol::kPending:
+                // Stop reading stdout/stderr until the client catches up.
+                output_pending_ = true;
+                break;
+            case ShellProtocol::kClosed:
+                if (errno != 0) {
+                    PLOG(ERROR) << "error reading protocol FD " << protocol_sfd_;
+                }
+                return &protocol_sfd_;
         }
-        return &protocol_sfd_;
     }
 
     return nullptr;
 }
 
-void Subprocess::WaitForExit() {
-    int exit_code = 1;
+unique_fd* Subprocess::ContinueOutput() {
+    switch (output_->ContinueWrite()) {
+        case ShellProtocol::kComplete:
+            output_pending_ = false;
+            break;
+        case ShellProtocol::kPending:
+            break;
+        case ShellProtocol::kClosed:
+            if (errno != 0) {
+                PLOG(ERROR) << "error writing protocol FD " << protocol_sfd_;
+            }
+            output_pending_ = false;
+            return &protocol_sfd_;
+    }
+    return nullptr;
+}
 
-    D("waiting for pid %d", pid_);
+ShellLoop* ShellLoop::Instance() {
+    static ShellLoop* loop = [] {
+        ShellLoop* loop = new ShellLoop();
+        if (!loop->Init()) {
+            delete loop;
+            return static_cast<ShellLoop*>(nullptr);
+        }
+        return loop;
+    }();
+    return loop;
+}
+
+bool ShellLoop::Init() {
+    epoll_fd_.reset(epoll_create1(EPOLL_CLOEXEC));
+    if (epoll_fd_ == -1) {
+        PLOG(ERROR) << "epoll_create1 failed";
+        return false;
+    }
+    if (!CreateSocketpair(&wake_sfd_, &wake_receiver_sfd_) ||
+            !set_file_block_mode(wake_sfd_, false) ||
+            !set_file_block_mode(wake_receiver_sfd_, false)) {
+        return false;
+    }
+    epoll_event event = {};
+    event.events = EPOLLIN;
+    event.data.ptr = nullptr;
+    if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, wake_receiver_sfd_, &event) == -1) {
+        PLOG(ERROR) << "failed to watch shell thread wakeup FD";
+        return false;
+    }
+
+    std::thread([this]() { Run(); }).detach();
+    std::thread([this]() { Reap(); }).detach();
+    return true;
+}
+
+void ShellLoop::Add(Subprocess* subprocess) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        added_.push_back(subprocess);
+        running_[subprocess->pid()] = subprocess;
+    }
+    reap_cv_.notify_one();
+    Wake();
+}
+
+void ShellLoop::Wake() {
+    char c = 0;
+    // If the socket is full the shell thread has wakeups enough to come.
+    adb_write(wake_sfd_, &c, 1);
+}
+
+void ShellLoop::Watch(Subprocess::Watch* watch, uint32_t old_events, uint32_t new_events) {
+    // Hangups and errors are reported whatever is asked for, so an FD that
+    // isn't waited on for anything comes out of the set altogether.
+    epoll_event event = {};
+    event.events = new_events;
+    event.data.ptr = watch;
+    int op = !new_events ? EPOLL_CTL_DEL : !old_events ? EPOLL_CTL_ADD : EPOLL_CTL_MOD;
+    if (epoll_ctl(epoll_fd_, op, *watch->sfd, &event) == -1) {
+        PLOG(ERROR) << "epoll_ctl on FD " << watch->sfd->get() << " failed";
+    }
+}
+
+void ShellLoop::Finished(Subprocess* subprocess, bool finished) {
+    if (finished) {
+        D("deleting Subprocess for PID %d", subprocess->pid());
+        deleted_.insert(subprocess);
+        delete subprocess;
+    }
+}
+
+void ShellLoop::Run() {
+    adb_thread_setname("shell svc");
+
+    epoll_event events[64];
     while (true) {
-        int status;
-        if (pid_ == waitpid(pid_, &status, 0)) {
-            D("post waitpid (pid=%d) status=%04x", pid_, status);
-            if (WIFSIGNALED(status)) {
-                exit_code = 0x80 | WTERMSIG(status);
-                D("subprocess killed by signal %d", WTERMSIG(status));
-                break;
-            } else if (!WIFEXITED(status)) {
-                D("subprocess didn't exit");
-                break;
-            } else if (WEXITSTATUS(status) >= 0) {
-                exit_code = WEXITSTATUS(status);
-                D("subprocess exit code = %d", WEXITSTATUS(status));
-                break;
+        int count = epoll_wait(epoll_fd_, events, arraysize(events), -1);
+        if (count == -1) {
+            if (errno != EINTR) {
+                PLOG(FATAL) << "epoll_wait failed";
             }
+            continue;
         }
-    }
 
-    // If we have an open protocol FD send an exit packet.
-    if (protocol_sfd_ != -1) {
-        output_->data()[0] = exit_code;
-        if (output_->Write(ShellProtocol::kIdExit, 1)) {
-            D("wrote the exit code packet: %d", exit_code);
-        } else {
-            PLOG(ERROR) << "failed to write the exit code packet";
+        deleted_.clear();
+        for (int i = 0; i < count; ++i) {
+            if (!events[i].data.ptr) {
+                char buf[64];
+                while (adb_read(wake_receiver_sfd_, buf, sizeof(buf)) > 0) {
+                }
+                continue;
+            }
+
+            // Skip subprocesses deleted earlier in this batch, whose events are stale.
+            auto watch = reinterpret_cast<Subprocess::Watch*>(events[i].data.ptr);
+            Subprocess* subprocess = watch->subprocess;
+            if (deleted_.count(subprocess)) {
+                continue;
+            }
+            Finished(subprocess, subprocess->HandleEvents(watch, events[i].events));
+        }
+
+        std::vector<Subprocess*> added;
+        std::vector<std::pair<Subprocess*, int>> exited;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            added.swap(added_);
+            exited.swap(exited_);
+        }
+        for (Subprocess* subprocess : added) {
+            D("passing data streams for PID %d", subprocess->pid());
+            Finished(subprocess, subprocess->Attach(this));
+        }
+        for (auto& it : exited) {
+            Finished(it.first, it.first->Exited(it.second));
         }
-        protocol_sfd_.reset(-1);
     }
+}
 
-    // Pass the local socket FD to the shell cleanup fdevent.
-    if (SHELL_EXIT_NOTIFY_FD >= 0) {
-        int fd = local_socket_sfd_;
-        if (WriteFdExactly(SHELL_EXIT_NOTIFY_FD, &fd, sizeof(fd))) {
-            D("passed fd %d to SHELL_EXIT_NOTIFY_FD (%d) for pid %d",
-              fd, SHELL_EXIT_NOTIFY_FD, pid_);
-            // The shell exit fdevent now owns the FD and will close it once
-            // the last bit of data flushes through.
-            static_cast<void>(local_socket_sfd_.release());
-        } else {
-            PLOG(ERROR) << "failed to write fd " << fd
-                        << " to SHELL_EXIT_NOTIFY_FD (" << SHELL_EXIT_NOTIFY_FD
-                        << ") for pid " << pid_;
+void ShellLoop::Reap() {
+    adb_thread_setname("shell reaper");
+
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            reap_cv_.wait(lock, [this]() REQUIRES(mutex_) { return !running_.empty(); });
+        }
+
+        // Wait for any child to exit without reaping it: adbd has children
+        // other than shells, that are waited for by whoever forked them.
+        siginfo_t info = {};
+        if (waitid(P_ALL, 0, &info, WEXITED | WNOWAIT) == -1) {
+            if (errno != EINTR) {
+                PLOG(ERROR) << "waitid failed";
+                std::this_thread::sleep_for(std::chrono::milliseconds(100));
+            }
+            continue;
+        }
+
+        Subprocess* subprocess = nullptr;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            auto it = running_.find(info.si_pid);
+            if (it != running_.end()) {
+                subprocess = it->second;
+                running_.erase(it);
+            }
+        }
+        if (!subprocess) {
+            // Not a shell, or one not yet added; give its owner time to reap it.
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            continue;
+        }
+
+        D("waiting for pid %d", info.si_pid);
+        int status;
+        if (TEMP_FAILURE_RETRY(waitpid(info.si_pid, &status, 0)) != info.si_pid) {
+            PLOG(ERROR) << "waitpid for pid " << info.si_pid << " failed";
+            status = 0;
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            exited_.emplace_back(subprocess, status);
         }
+        Wake();
     }
 }
 
@@ -746,8 +1043,8 @@ int StartSubprocess(const char* name, const char* terminal_type,
     D("subprocess creation successful: local_socket_fd=%d, pid=%d", local_socket.get(),
       subprocess->pid());
 
-    if (!Subprocess::StartThread(std::move(subprocess), &error)) {
-        LOG(ERROR) << "failed to start subprocess management thread: " << error;
+    if (!Subprocess::Start(std::move(subprocess), &error)) {
+        LOG(ERROR) << "failed to start subprocess management: " << error;
         return ReportError(protocol, error);
     }
 
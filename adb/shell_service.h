@@ -34,7 +34,8 @@
 // Class to send and receive shell protocol packets.
 //
 // To keep things simple and predictable, reads and writes block until an entire
-// packet is complete.
+// packet is complete. ReadSome() and StartWrite() are the non-blocking
+// equivalents for an FD in non-blocking mode.
 //
 // Example: read raw data from |fd| and send it in a packet.
 //   ShellProtocol* p = new ShellProtocol(protocol_fd);
@@ -99,6 +100,27 @@ class ShellProtocol {
     // Returns false if the FD closed or errored.
     bool Write(Id id, size_t length);
 
+    // Results of the non-blocking calls below.
+    enum Status {
+        // The packet (or piece of one) is all read or written.
+        kComplete,
+        // The FD would block; call again once it is readable/writable.
+        kPending,
+        // The FD closed (errno is 0) or errored.
+        kClosed,
+    };
+
+    // Reads what the FD has of a packet without blocking, splitting packets
+    // the way Read() does. On kComplete the buffer holds the next piece of the
+    // packet, exactly as after Read(). Don't mix with Read() mid-packet.
+    Status ReadSome();
+
+    // Writes what the FD will take of the packet in the buffer without
+    // blocking. On kPending the rest must be written with ContinueWrite()
+    // before the buffer is reused.
+    Status StartWrite(Id id, size_t length);
+    Status ContinueWrite();
+
   private:
     // Packets support 4-byte lengths.
     typedef uint32_t length_t;
@@ -116,6 +138,14 @@ class ShellProtocol {
     char buffer_[kBufferSize];
     size_t data_length_ = 0, bytes_left_ = 0;
 
+    // ReadSome() progress: header bytes read, and the length of the piece
+    // being read into the data buffer if one is under way.
+    size_t header_read_ = 0, read_length_ = 0;
+    bool reading_data_ = false;
+
+    // StartWrite() progress through the packet.
+    size_t write_offset_ = 0, write_length_ = 0;
+
     // We need to be able to modify this value for testing purposes, but it
     // will stay constant during actual program use.
     char* buffer_end_ = buffer_ + sizeof(buffer_);
@@ -16,11 +16,13 @@
 
 #include "shell_service.h"
 
+#include <errno.h>
 #include <string.h>
 
 #include <algorithm>
 
 #include "adb_io.h"
+#include "sysdeps.h"
 
 ShellProtocol::ShellProtocol(int fd) : fd_(fd) {
     buffer_[0] = kIdInvalid;
@@ -60,3 +62,73 @@ bool ShellProtocol::Write(Id id, size_t length) {
 
     return WriteFdExactly(fd_, buffer_, kHeaderSize + length);
 }
+
+namespace {
+
+// Maps the result of a read or write that did not complete to a Status.
+ShellProtocol::Status Incomplete(int result) {
+    if (result == 0) {
+        errno = 0;
+        return ShellProtocol::kClosed;
+    }
+    return errno == EAGAIN ? ShellProtocol::kPending : ShellProtocol::kClosed;
+}
+
+}  // namespace
+
+ShellProtocol::Status ShellProtocol::ReadSome() {
+    if (!reading_data_) {
+        // Only read a new header if we've finished the last packet.
+        if (!bytes_left_) {
+            while (header_read_ < kHeaderSize) {
+                int bytes = adb_read(fd_, buffer_ + header_read_, kHeaderSize - header_read_);
+                if (bytes <= 0) {
+                    return Incomplete(bytes);
+                }
+                header_read_ += bytes;
+            }
+            header_read_ = 0;
+
+            length_t packet_length;
+            memcpy(&packet_length, &buffer_[1], sizeof(packet_length));
+            bytes_left_ = packet_length;
+        }
+
+        read_length_ = std::min(bytes_left_, data_capacity());
+        data_length_ = 0;
+        reading_data_ = true;
+    }
+
+    while (data_length_ < read_length_) {
+        int bytes = adb_read(fd_, data() + data_length_, read_length_ - data_length_);
+        if (bytes <= 0) {
+            return Incomplete(bytes);
+        }
+        data_length_ += bytes;
+    }
+
+    bytes_left_ -= read_length_;
+    reading_data_ = false;
+    return kComplete;
+}
+
+ShellProtocol::Status ShellProtocol::StartWrite(Id id, size_t length) {
+    buffer_[0] = id;
+    length_t typed_length = length;
+    memcpy(&buffer_[1], &typed_length, sizeof(typed_length));
+
+    write_offset_ = 0;
+    write_length_ = kHeaderSize + length;
+    return ContinueWrite();
+}
+
+ShellProtocol::Status ShellProtocol::ContinueWrite() {
+    while (write_offset_ < write_length_) {
+        int bytes = adb_write(fd_, buffer_ + write_offset_, write_length_ - write_offset_);
+        if (bytes <= 0) {
+            return Incomplete(bytes);
+        }
+        write_offset_ += bytes;
+    }
+    return kComplete;
+}
@@ -18,9 +18,12 @@
 
 #include <gtest/gtest.h>
 
+#include <errno.h>
 #include <signal.h>
 #include <string.h>
 
+#include "adb_io.h"
+#include "adb_utils.h"
 #include "sysdeps.h"
 
 class ShellProtocolTest : public ::testing::Test {
@@ -196,3 +199,70 @@ TEST_F(ShellProtocolTest, ReadPacketFromClosedPipe) {
     // Second read should fail.
     ASSERT_FALSE(read_protocol_->Read());
 }
+
+// Tests non-blocking reads of a packet that arrives a few bytes at a time.
+TEST_F(ShellProtocolTest, ReadSomePartialPacket) {
+    ShellProtocol::Id id = ShellProtocol::kIdStdin;
+    // 1 byte ID + 4 byte length + 10 bytes of data.
+    const char packet[] = "\x00\x0a\x00\x00\x00" "1234567890";
+
+    ASSERT_TRUE(set_file_block_mode(read_fd_, false));
+    SetReadDataCapacity(4);
+    ASSERT_EQ(ShellProtocol::kPending, read_protocol_->ReadSome());
+
+    size_t written = 0;
+    for (size_t length : {3, 4, 1, 7}) {
+        ASSERT_TRUE(WriteFdExactly(write_fd_, packet + written, length));
+        written += length;
+        if (written < 9) {
+            ASSERT_EQ(ShellProtocol::kPending, read_protocol_->ReadSome());
+        }
+    }
+    ASSERT_EQ(ShellProtocol::kComplete, read_protocol_->ReadSome());
+    ASSERT_TRUE(PacketEquals(read_protocol_, id, "1234", 4));
+    ASSERT_EQ(ShellProtocol::kComplete, read_protocol_->ReadSome());
+    ASSERT_TRUE(PacketEquals(read_protocol_, id, "5678", 4));
+    ASSERT_EQ(ShellProtocol::kComplete, read_protocol_->ReadSome());
+    ASSERT_TRUE(PacketEquals(read_protocol_, id, "90", 2));
+    ASSERT_EQ(ShellProtocol::kPending, read_protocol_->ReadSome());
+
+    adb_close(write_fd_);
+    write_fd_ = -1;
+    ASSERT_EQ(ShellProtocol::kClosed, read_protocol_->ReadSome());
+    ASSERT_EQ(0, errno);
+}
+
+// Tests a non-blocking write that fills the socket and is finished later.
+TEST_F(ShellProtocolTest, StartWriteFullSocket) {
+    ShellProtocol::Id id = ShellProtocol::kIdStdout;
+    size_t length = write_protocol_->data_capacity();
+    memset(write_protocol_->data(), 'x', length);
+
+    // Read in small pieces, so that a read never waits on the write.
+    ASSERT_TRUE(set_file_block_mode(write_fd_, false));
+    SetReadDataCapacity(1024);
+    ShellProtocol::Status status = write_protocol_->StartWrite(id, length);
+    size_t received = 0;
+    while (status == ShellProtocol::kPending) {
+        ASSERT_TRUE(read_protocol_->Read());
+        ASSERT_EQ(id, read_protocol_->id());
+        received += read_protocol_->data_length();
+        status = write_protocol_->ContinueWrite();
+    }
+    ASSERT_EQ(ShellProtocol::kComplete, status);
+    while (received < length) {
+        ASSERT_TRUE(read_protocol_->Read());
+        received += read_protocol_->data_length();
+    }
+    ASSERT_EQ(length, received);
+}
+
+// Tests a non-blocking write to a closed pipe.
+TEST_F(ShellProtocolTest, StartWriteToClosedPipeFail) {
+    adb_close(read_fd_);
+    read_fd_ = -1;
+
+    ASSERT_TRUE(set_file_block_mode(write_fd_, false));
+    ASSERT_EQ(ShellProtocol::kClosed,
+              write_protocol_->StartWrite(ShellProtocol::kIdStdout, 0));
+}
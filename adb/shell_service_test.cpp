@@ -23,6 +23,7 @@
 #include <string>
 #include <vector>
 
+#include <android-base/file.h>
 #include <android-base/strings.h>
 
 #include "adb.h"
@@ -288,3 +289,50 @@ TEST_F(ShellServiceTest, CloseStderrSubprocess) {
     ExpectLinesEqual(stdout, {"foo"});
     ExpectLinesEqual(stderr, {});
 }
+
+// Tests many subprocesses at once, none of which holds up the others, without
+// a thread for each.
+TEST_F(ShellServiceTest, ConcurrentSubprocesses) {
+    const int kCount = 32;
+
+    // One subprocess whose client doesn't read its flood of output.
+    int flood_fd = StartSubprocess("yes | head -c 10000000", nullptr,
+                                   SubprocessType::kRaw, SubprocessProtocol::kShell);
+    ASSERT_GE(flood_fd, 0);
+
+    // The rest wait for input.
+    std::vector<int> fds;
+    for (int i = 0; i < kCount; ++i) {
+        int fd = StartSubprocess("read line; echo $line; echo err >&2; exit $line", nullptr,
+                                 SubprocessType::kRaw, SubprocessProtocol::kShell);
+        ASSERT_GE(fd, 0);
+        fds.push_back(fd);
+    }
+
+    std::string threads;
+    ASSERT_TRUE(android::base::ReadFileToString("/proc/self/status", &threads));
+    size_t pos = threads.find("Threads:");
+    ASSERT_NE(std::string::npos, pos);
+    EXPECT_GT(kCount / 2, atoi(threads.c_str() + pos + strlen("Threads:")));
+
+    for (int i = 0; i < kCount; ++i) {
+        std::string input = std::to_string(i) + "\n";
+        ShellProtocol* protocol = new ShellProtocol(fds[i]);
+        memcpy(protocol->data(), input.data(), input.length());
+        ASSERT_TRUE(protocol->Write(ShellProtocol::kIdStdin, input.length()));
+        delete protocol;
+    }
+    for (int i = 0; i < kCount; ++i) {
+        std::string stdout, stderr;
+        EXPECT_EQ(i, ReadShellProtocol(fds[i], &stdout, &stderr));
+        ExpectLinesEqual(stdout, {std::to_string(i)});
+        ExpectLinesEqual(stderr, {"err"});
+        adb_close(fds[i]);
+    }
+
+    // The flood, read at last, is all there.
+    std::string stdout, stderr;
+    EXPECT_EQ(0, ReadShellProtocol(flood_fd, &stdout, &stderr));
+    EXPECT_EQ(10000000u, stdout.size());
+    adb_close(flood_fd);
+}
@@ -20,6 +20,7 @@
 #include <stddef.h>
 
 #include <memory>
+#include <string>
 
 #include "fdevent.h"
 
@@ -97,6 +98,26 @@ struct asocket {
     /* A socket is bound to atransport */
     atransport* transport;
 
+    // For remote sockets: how many WRITEs may be outstanding before waiting for
+    // READY (0 for the classic one at a time), how many are, and how many WRITEs
+    // received from the other side haven't been acknowledged yet.
+    unsigned window;
+    unsigned in_flight;
+    unsigned unacked;
+
+    // For local sockets, for host:perf: what was read from the fd and passed to
+    // the peer, and what the peer enqueued to be written to the fd; how many of
+    // those packets are waiting for the fd to become writable, and the most
+    // there have been. |service| is what a local service socket was opened for,
+    // up to the first ':'.
+    uint64_t packets_from_fd;
+    uint64_t bytes_from_fd;
+    uint64_t packets_to_fd;
+    uint64_t bytes_to_fd;
+    unsigned queued;
+    unsigned max_queued;
+    char service[32];
+
     size_t get_max_payload() const;
 };
 
@@ -104,6 +125,8 @@ asocket *find_local_socket(unsigned local_id, unsigned remote_id);
 void install_local_socket(asocket *s);
 void remove_socket(asocket *s);
 void close_all_sockets(atransport *t);
+// A line of traffic and queue counters for each local socket.
+std::string list_socket_stats();
 
 asocket *create_local_socket(int fd);
 asocket *create_local_service_socket(const char* destination,
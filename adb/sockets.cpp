@@ -20,6 +20,7 @@
 
 #include <ctype.h>
 #include <errno.h>
+#include <inttypes.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -30,6 +31,8 @@
 #include <string>
 #include <vector>
 
+#include <android-base/stringprintf.h>
+
 #if !ADB_HOST
 #include <android-base/properties.h>
 #include <log/log_properties.h>
@@ -122,10 +125,40 @@ restart:
     }
 }
 
+std::string list_socket_stats() {
+    std::string result;
+
+    std::lock_guard<std::recursive_mutex> lock(local_socket_list_lock);
+    for (asocket* list : {&local_socket_list, &local_socket_closing_list}) {
+        for (asocket* s = list->next; s != list; s = s->next) {
+            android::base::StringAppendF(
+                &result,
+                "LS(%u) fd %d %s%s: from fd %" PRIu64 " packets %" PRIu64
+                " bytes, to fd %" PRIu64 " packets %" PRIu64 " bytes, queued %u (max %u)",
+                s->id, s->fd, s->service[0] ? s->service : "-",
+                (list == &local_socket_closing_list) ? " closing" : "", s->packets_from_fd,
+                s->bytes_from_fd, s->packets_to_fd, s->bytes_to_fd, s->queued, s->max_queued);
+            asocket* peer = s->peer;
+            if (peer && peer->transport) {
+                android::base::StringAppendF(&result, ", peer %u on %s", peer->id,
+                                             peer->transport->serial_name().c_str());
+                if (peer->window) {
+                    android::base::StringAppendF(&result, " (%u/%u in flight)",
+                                                 peer->in_flight, peer->window);
+                }
+            }
+            result += '\n';
+        }
+    }
+    return result;
+}
+
 static int local_socket_enqueue(asocket* s, apacket* p) {
     D("LS(%d): enqueue %zu", s->id, p->len);
 
     p->ptr = p->data;
+    s->packets_to_fd++;
+    s->bytes_to_fd += p->len;
 
     /* if there is already data queue'd, we will receive
     ** events when it's time to write.  just add this to
@@ -169,6 +202,7 @@ enqueue:
         s->pkt_first = p;
     }
     s->pkt_last = p;
+    s->max_queued = std::max(s->max_queued, ++s->queued);
 
     /* make sure we are notified when we can drain the queue */
     fdevent_add(&s->fde, FDE_WRITE);
@@ -283,6 +317,7 @@ static void local_socket_event_func(int fd, unsigned ev, void* _s) {
                 if (s->pkt_first == 0) {
                     s->pkt_last = 0;
                 }
+                s->queued--;
                 put_apacket(p);
             }
         }
@@ -336,6 +371,8 @@ static void local_socket_event_func(int fd, unsigned ev, void* _s) {
             put_apacket(p);
         } else {
             p->len = max_payload - avail;
+            s->packets_from_fd++;
+            s->bytes_from_fd += p->len;
 
             // s->peer->enqueue() may call s->close() and free s,
             // so save variables for debug printing below.
@@ -407,6 +444,9 @@ asocket* create_local_service_socket(const char* name, const atransport* transpo
     if (!strcmp(name, "track-jdwp")) {
         return create_jdwp_tracker_service_socket();
     }
+    if (!strcmp(name, "track-jdwp-delta")) {
+        return create_jdwp_delta_tracker_service_socket();
+    }
 #endif
     int fd = service_to_fd(name, transport);
     if (fd < 0) {
@@ -415,6 +455,8 @@ asocket* create_local_service_socket(const char* name, const atransport* transpo
 
     asocket* s = create_local_socket(fd);
     D("LS(%d): bound to '%s' via %d", s->id, name, fd);
+    snprintf(s->service, sizeof(s->service), "%.*s", static_cast<int>(strcspn(name, ":") + 1),
+             name);
 
 #if !ADB_HOST
     if ((!strncmp(name, "root:", 5) && getuid() != 0 && __android_log_is_debuggable()) ||
@@ -445,6 +487,10 @@ static asocket* create_host_service_socket(const char* name, const char* serial,
 }
 #endif /* ADB_HOST */
 
+// WRITEs a stream may have outstanding when the other side supports kFeatureStreamWindow.
+// Throughput on a high latency link is about this many payloads per round trip.
+static constexpr unsigned kStreamWindowPackets = 8;
+
 static int remote_socket_enqueue(asocket* s, apacket* p) {
     D("entered remote_socket_enqueue RS(%d) WRITE fd=%d peer.fd=%d", s->id, s->fd, s->peer->fd);
     p->msg.command = A_WRTE;
@@ -452,22 +498,32 @@ static int remote_socket_enqueue(asocket* s, apacket* p) {
     p->msg.arg1 = s->id;
     p->msg.data_length = p->len;
     send_packet(p, s->transport);
-    return 1;
+
+    // Without a window, every WRITE waits for READY.
+    return (++s->in_flight < s->window) ? 0 : 1;
 }
 
 static void remote_socket_ready(asocket* s) {
     D("entered remote_socket_ready RS(%d) OKAY fd=%d peer.fd=%d", s->id, s->fd, s->peer->fd);
-    apacket* p = get_apacket();
+    apacket* p = get_apacket(sizeof(uint32_t));
     p->msg.command = A_OKAY;
     p->msg.arg0 = s->peer->id;
     p->msg.arg1 = s->id;
+
+    // A windowed READY carries the number of WRITEs it acknowledges, if not just one.
+    if (s->window && s->unacked > 1) {
+        uint32_t count = s->unacked;
+        memcpy(p->data, &count, sizeof(count));
+        p->msg.data_length = sizeof(count);
+    }
+    s->unacked = 0;
     send_packet(p, s->transport);
 }
 
 static void remote_socket_shutdown(asocket* s) {
     D("entered remote_socket_shutdown RS(%d) CLOSE fd=%d peer->fd=%d", s->id, s->fd,
       s->peer ? s->peer->fd : -1);
-    apacket* p = get_apacket();
+    apacket* p = get_apacket(0);
     p->msg.command = A_CLSE;
     if (s->peer) {
         p->msg.arg0 = s->peer->id;
@@ -507,6 +563,9 @@ asocket* create_remote_socket(unsigned id, atransport* t) {
     s->shutdown = remote_socket_shutdown;
     s->close = remote_socket_close;
     s->transport = t;
+    if (t->has_feature(kFeatureStreamWindow)) {
+        s->window = kStreamWindowPackets;
+    }
 
     D("RS(%d): created", s->id);
     return s;
@@ -514,12 +573,12 @@ asocket* create_remote_socket(unsigned id, atransport* t) {
 
 void connect_to_remote(asocket* s, const char* destination) {
     D("Connect_to_remote call RS(%d) fd=%d", s->id, s->fd);
-    apacket* p = get_apacket();
     size_t len = strlen(destination) + 1;
 
     if (len > (s->get_max_payload() - 1)) {
         fatal("destination oversized");
     }
+    apacket* p = get_apacket(len);
 
     D("LS(%d): connect('%s')", s->id, destination);
     p->msg.command = A_OPEN;
@@ -666,6 +725,15 @@ static int smart_socket_enqueue(asocket* s, apacket* p) {
     D("SS(%d): enqueue %zu", s->id, p->len);
 
     if (s->pkt_first == 0) {
+        // The request accumulates in here and gets NUL terminated in place,
+        // so it needs the full payload whatever size it came in.
+        if (p->capacity < MAX_PAYLOAD) {
+            apacket* full = get_apacket();
+            memcpy(full->data, p->data, p->len);
+            full->len = p->len;
+            put_apacket(p);
+            p = full;
+        }
         s->pkt_first = p;
         s->pkt_last = p;
     } else {
@@ -59,6 +59,13 @@ const char* const kFeatureCmd = "cmd";
 const char* const kFeatureStat2 = "stat_v2";
 const char* const kFeatureLibusb = "libusb";
 const char* const kFeaturePushSync = "push_sync";
+const char* const kFeatureSyncPipeline = "sync_pipeline";
+const char* const kFeatureSyncCompression = "sync_zlib";
+const char* const kFeatureStreamWindow = "stream_window";
+const char* const kFeatureSyncDelta = "sync_delta";
+const char* const kFeatureFramebufferStream = "framebuffer_stream";
+const char* const kFeatureTrackJdwpDelta = "track_jdwp_delta";
+const char* const kFeaturePerf = "perf";
 
 TransportId NextTransportId() {
     static std::atomic<TransportId> next(1);
@@ -148,6 +155,15 @@ static int write_packet(int fd, const char* name, apacket** ppacket) {
     return 0;
 }
 
+// Raises |max| to |value| if that is more, for counters several threads update.
+template <typename T>
+static void update_max(std::atomic<T>* max, T value) {
+    T current = max->load(std::memory_order_relaxed);
+    while (value > current &&
+           !max->compare_exchange_weak(current, value, std::memory_order_relaxed)) {
+    }
+}
+
 static void transport_socket_events(int fd, unsigned events, void* _t) {
     atransport* t = reinterpret_cast<atransport*>(_t);
     D("transport_socket_events(fd=%d, events=%04x,...)", fd, events);
@@ -156,14 +172,26 @@ static void transport_socket_events(int fd, unsigned events, void* _t) {
         if (read_packet(fd, t->serial, &p)) {
             D("%s: failed to read packet from transport socket on fd %d", t->serial, fd);
         } else {
+            t->read_queue--;
             handle_packet(p, (atransport*)_t);
         }
     }
 }
 
+// Hands a packet from the read thread to the main thread.
+static int queue_read_packet(atransport* t, apacket** p) {
+    update_max(&t->max_read_queue, ++t->read_queue);
+    if (write_packet(t->fd, t->serial, p)) {
+        t->read_queue--;
+        return -1;
+    }
+    return 0;
+}
+
+// Called on the main thread for every outgoing packet, so anything that costs in
+// proportion to the payload (the checksum) is left to the transport's write thread.
 void send_packet(apacket* p, atransport* t) {
     p->msg.magic = p->msg.command ^ 0xffffffff;
-    p->msg.data_check = calculate_apacket_checksum(p);
 
     print_packet("send", p);
 
@@ -171,6 +199,7 @@ void send_packet(apacket* p, atransport* t) {
         fatal("Transport is null");
     }
 
+    update_max(&t->max_write_queue, ++t->write_queue);
     if (write_packet(t->transport_socket, t->serial, &p)) {
         fatal_errno("cannot enqueue packet on transport socket");
     }
@@ -197,12 +226,12 @@ static void read_transport_thread(void* _t) {
         android::base::StringPrintf("<-%s", (t->serial != nullptr ? t->serial : "transport")));
     D("%s: starting read_transport thread on fd %d, SYNC online (%d)", t->serial, t->fd,
       t->sync_token + 1);
-    p = get_apacket();
+    p = get_apacket(0);
     p->msg.command = A_SYNC;
     p->msg.arg0 = 1;
     p->msg.arg1 = ++(t->sync_token);
     p->msg.magic = A_SYNC ^ 0xffffffff;
-    if (write_packet(t->fd, t->serial, &p)) {
+    if (queue_read_packet(t, &p)) {
         put_apacket(p);
         D("%s: failed to write SYNC packet", t->serial);
         goto oops;
@@ -227,8 +256,22 @@ static void read_transport_thread(void* _t) {
 #endif
         }
 
+        // Most packets are control messages or short writes, move those into a
+        // small packet so the large one goes straight back to the pool rather
+        // than sitting in a socket queue.
+        if (p->capacity > MAX_PAYLOAD_V1 && p->msg.data_length <= MAX_PAYLOAD_V1) {
+            apacket* small = get_apacket(p->msg.data_length);
+            small->msg = p->msg;
+            memcpy(small->data, p->data, p->msg.data_length);
+            put_apacket(p);
+            p = small;
+        }
+
+        t->packets_in++;
+        t->bytes_in += sizeof(p->msg) + p->msg.data_length;
+
         D("%s: received remote packet, sending to transport", t->serial);
-        if (write_packet(t->fd, t->serial, &p)) {
+        if (queue_read_packet(t, &p)) {
             put_apacket(p);
             D("%s: failed to write apacket to transport", t->serial);
             goto oops;
@@ -236,12 +279,12 @@ static void read_transport_thread(void* _t) {
     }
 
     D("%s: SYNC offline for transport", t->serial);
-    p = get_apacket();
+    p = get_apacket(0);
     p->msg.command = A_SYNC;
     p->msg.arg0 = 0;
     p->msg.arg1 = 0;
     p->msg.magic = A_SYNC ^ 0xffffffff;
-    if (write_packet(t->fd, t->serial, &p)) {
+    if (queue_read_packet(t, &p)) {
         put_apacket(p);
         D("%s: failed to write SYNC apacket to transport", t->serial);
     }
@@ -253,7 +296,7 @@ oops:
 }
 
 // write_transport thread gets packets sent by the main thread (through send_packet()),
-// and writes to a transport (representing a usb/tcp connection).
+// checksums them and writes to a transport (representing a usb/tcp connection).
 static void write_transport_thread(void* _t) {
     atransport* t = reinterpret_cast<atransport*>(_t);
     apacket* p;
@@ -269,6 +312,7 @@ static void write_transport_thread(void* _t) {
             D("%s: failed to read apacket from transport on fd %d", t->serial, t->fd);
             break;
         }
+        t->write_queue--;
 
         if (p->msg.command == A_SYNC) {
             if (p->msg.arg0 == 0) {
@@ -287,11 +331,21 @@ static void write_transport_thread(void* _t) {
             if (active) {
                 D("%s: transport got packet, sending to remote", t->serial);
                 ATRACE_NAME("write_transport write_remote");
-                if (t->Write(p) != 0) {
+                p->msg.data_check = calculate_apacket_checksum(p);
+                auto start = std::chrono::steady_clock::now();
+                int rc = t->Write(p);
+                uint64_t ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                  std::chrono::steady_clock::now() - start)
+                                  .count();
+                t->write_ns += ns;
+                update_max(&t->max_write_ns, ns);
+                if (rc != 0) {
                     D("%s: remote write failed for transport", t->serial);
                     put_apacket(p);
                     break;
                 }
+                t->packets_out++;
+                t->bytes_out += sizeof(p->msg) + p->msg.data_length;
             } else {
                 D("%s: transport ignoring packet while offline", t->serial);
             }
@@ -372,7 +426,7 @@ static int device_tracker_enqueue(asocket* socket, apacket* p) {
 }
 
 static int device_tracker_send(device_tracker* tracker, const std::string& string) {
-    apacket* p = get_apacket();
+    apacket* p = get_apacket(4 + string.size());
     asocket* peer = tracker->socket.peer;
 
     snprintf(reinterpret_cast<char*>(p->data), 5, "%04x", static_cast<int>(string.size()));
@@ -812,7 +866,9 @@ constexpr char kFeatureStringDelimiter = ',';
 const FeatureSet& supported_features() {
     // Local static allocation to avoid global non-POD variables.
     static const FeatureSet* features = new FeatureSet{
-        kFeatureShell2, kFeatureCmd, kFeatureStat2,
+        kFeatureShell2, kFeatureCmd, kFeatureStat2, kFeatureSyncPipeline, kFeatureSyncCompression,
+        kFeatureStreamWindow, kFeatureSyncDelta, kFeatureFramebufferStream,
+        kFeatureTrackJdwpDelta, kFeaturePerf,
         // Increment ADB_SERVER_VERSION whenever the feature list changes to
         // make sure that the adb client and server features stay in sync
         // (http://b/24370690).
@@ -954,6 +1010,42 @@ std::string list_transports(bool long_listing) {
     return result;
 }
 
+std::string list_transport_stats() {
+    std::string result;
+
+    std::lock_guard<std::recursive_mutex> lock(transport_lock);
+    for (const auto& t : transport_list) {
+        auto elapsed = std::chrono::steady_clock::now() - t->created;
+        uint64_t ms = std::max<uint64_t>(
+            1, std::chrono::duration_cast<std::chrono::milliseconds>(elapsed).count());
+        uint64_t bytes_in = t->bytes_in;
+        uint64_t bytes_out = t->bytes_out;
+        android::base::StringAppendF(
+            &result,
+            "%s: in %" PRIu64 " packets %" PRIu64 " bytes (%" PRIu64 " KiB/s)"
+            " out %" PRIu64 " packets %" PRIu64 " bytes (%" PRIu64 " KiB/s)\n",
+            t->serial_name().c_str(), t->packets_in.load(), bytes_in, bytes_in * 1000 / ms / 1024,
+            t->packets_out.load(), bytes_out, bytes_out * 1000 / ms / 1024);
+    }
+    return result;
+}
+
+std::string list_transport_perf() {
+    std::string result;
+
+    std::lock_guard<std::recursive_mutex> lock(transport_lock);
+    for (const auto& t : transport_list) {
+        android::base::StringAppendF(
+            &result,
+            "%s: write queue %" PRId64 " (max %" PRId64 ") read queue %" PRId64 " (max %" PRId64
+            ") blocked in writes %" PRIu64 " ms (longest %" PRIu64 " us)\n",
+            t->serial_name().c_str(), t->write_queue.load(), t->max_write_queue.load(),
+            t->read_queue.load(), t->max_read_queue.load(), t->write_ns.load() / 1000000,
+            t->max_write_ns.load() / 1000);
+    }
+    return result;
+}
+
 void close_usb_devices(std::function<bool(const atransport*)> predicate) {
     std::lock_guard<std::recursive_mutex> lock(transport_lock);
     for (auto& t : transport_list) {
@@ -20,6 +20,7 @@
 #include <sys/types.h>
 
 #include <atomic>
+#include <chrono>
 #include <deque>
 #include <functional>
 #include <list>
@@ -53,6 +54,20 @@ extern const char* const kFeatureStat2;
 extern const char* const kFeatureLibusb;
 // The server supports `push --sync`.
 extern const char* const kFeaturePushSync;
+// The sync service keeps going after a failed RECV, so requests can be queued ahead.
+extern const char* const kFeatureSyncPipeline;
+// The sync service accepts ID_ZDAT chunks and ID_RECV_Z requests.
+extern const char* const kFeatureSyncCompression;
+// Streams may have several WRITEs outstanding, and READY may acknowledge several.
+extern const char* const kFeatureStreamWindow;
+// The sync service hashes file blocks with ID_SUMS and patches files with ID_PTCH.
+extern const char* const kFeatureSyncDelta;
+// The framebuffer-stream: service sends the tiles of the screen that changed.
+extern const char* const kFeatureFramebufferStream;
+// The track-jdwp-delta service is available.
+extern const char* const kFeatureTrackJdwpDelta;
+// The perf: service reports adbd's transport, stream and fdevent counters.
+extern const char* const kFeaturePerf;
 
 TransportId NextTransportId();
 
@@ -97,6 +112,25 @@ class atransport {
     usb_handle* usb = nullptr;
     int sfd = -1;
 
+    // Traffic with the remote end, updated by the transport's read and write threads.
+    std::atomic<uint64_t> packets_in{0};
+    std::atomic<uint64_t> bytes_in{0};
+    std::atomic<uint64_t> packets_out{0};
+    std::atomic<uint64_t> bytes_out{0};
+    const std::chrono::steady_clock::time_point created = std::chrono::steady_clock::now();
+
+    // Where the traffic waits, for host:perf. Packets queued for the write
+    // thread and not yet written, and those the read thread passed on that the
+    // main thread hasn't handled, with the most there have been of each. Time
+    // the write thread spent blocked in the remote (USB or TCP) write, and the
+    // longest single write.
+    std::atomic<int64_t> write_queue{0};
+    std::atomic<int64_t> max_write_queue{0};
+    std::atomic<int64_t> read_queue{0};
+    std::atomic<int64_t> max_read_queue{0};
+    std::atomic<uint64_t> write_ns{0};
+    std::atomic<uint64_t> max_write_ns{0};
+
     // Used to identify transports for clients.
     char* serial = nullptr;
     char* product = nullptr;
@@ -206,6 +240,9 @@ bool iterate_transports(std::function<bool(const atransport*)> fn);
 void init_transport_registration(void);
 void init_mdns_transport_discovery(void);
 std::string list_transports(bool long_listing);
+std::string list_transport_stats();
+// For each transport, its queue depths and the time spent blocked writing to it.
+std::string list_transport_perf();
 atransport* find_transport(const char* serial);
 void kick_all_tcp_devices();
 void kick_all_transports();
@@ -25,9 +25,11 @@
 #include <string.h>
 #include <sys/types.h>
 
+#include <algorithm>
 #include <condition_variable>
 #include <mutex>
 #include <thread>
+#include <unordered_map>
 #include <vector>
 
 #include <android-base/parsenetaddress.h>
@@ -47,17 +49,23 @@
 
 // Android Wear has been using port 5601 in all of its documentation/tooling,
 // but we search for emulators on ports [5554, 5555 + ADB_LOCAL_TRANSPORT_MAX].
-// Avoid stomping on their port by limiting the number of emulators that can be
-// connected.
+// Avoid stomping on their port by limiting the number of emulators that are
+// searched for by default.  $ADB_LOCAL_TRANSPORT_MAX searches for more, and
+// emulators that announce themselves with host:emulator: or are connected
+// with emu: are not limited at all.
 #define ADB_LOCAL_TRANSPORT_MAX 16
 
+// How many ports are tried at the same time.
+constexpr size_t LOCAL_PORT_CONNECT_PARALLELISM = 32;
+
 static std::mutex& local_transports_lock = *new std::mutex();
 
-/* we keep a list of opened transports. The atransport struct knows to which
- * local transport it is connected. The list is used to detect when we're
- * trying to connect twice to a given local transport.
+/* we keep a table of opened transports, by adb port. The atransport struct
+ * knows to which local transport it is connected. The table is used to detect
+ * when we're trying to connect twice to a given local transport.
  */
-static atransport*  local_transports[ ADB_LOCAL_TRANSPORT_MAX ];
+static std::unordered_map<int, atransport*>& local_transports =
+    *new std::unordered_map<int, atransport*>();
 #endif /* ADB_HOST */
 
 static int remote_read(apacket *p, atransport *t)
@@ -175,14 +183,38 @@ int local_connect_arbitrary_ports(int console_port, int adb_port, std::string* e
 
 #if ADB_HOST
 
+// Tries to connect to each of the adb |ports|, several at a time, and returns
+// whether each one did.
+static std::vector<bool> LocalConnectInParallel(const std::vector<int>& ports) {
+    std::vector<char> connected(ports.size());
+    for (size_t start = 0; start < ports.size(); start += LOCAL_PORT_CONNECT_PARALLELISM) {
+        size_t end = std::min(ports.size(), start + LOCAL_PORT_CONNECT_PARALLELISM);
+        std::vector<std::thread> threads;
+        for (size_t i = start; i < end; ++i) {
+            threads.emplace_back([&ports, &connected, i]() {
+                connected[i] = local_connect(ports[i]);
+            });
+        }
+        for (auto& thread : threads) {
+            thread.join();
+        }
+    }
+    return std::vector<bool>(connected.begin(), connected.end());
+}
+
 static void PollAllLocalPortsForEmulator() {
-    int port = DEFAULT_ADB_LOCAL_TRANSPORT_PORT;
     int count = ADB_LOCAL_TRANSPORT_MAX;
+    const char* env = getenv("ADB_LOCAL_TRANSPORT_MAX");
+    if (env != nullptr && atoi(env) > 0) {
+        count = atoi(env);
+    }
 
     // Try to connect to any number of running emulator instances.
-    for ( ; count > 0; count--, port += 2 ) {
-        local_connect(port);
+    std::vector<int> ports;
+    for (int port = DEFAULT_ADB_LOCAL_TRANSPORT_PORT; count > 0; count--, port += 2) {
+        ports.push_back(port);
     }
+    LocalConnectInParallel(ports);
 }
 
 // Retry the disconnected local port for 60 times, and sleep 1 second between two retries.
@@ -219,11 +251,18 @@ static void client_socket_thread(int) {
         std::this_thread::sleep_for(LOCAL_PORT_RETRY_INTERVAL);
 
         // Try connecting retry ports.
-        std::vector<RetryPort> next_ports;
-        for (auto& port : ports) {
+        std::vector<int> port_numbers;
+        for (const auto& port : ports) {
             VLOG(TRANSPORT) << "retry port " << port.port << ", last retry_count "
                 << port.retry_count;
-            if (local_connect(port.port)) {
+            port_numbers.push_back(port.port);
+        }
+        std::vector<bool> connected = LocalConnectInParallel(port_numbers);
+
+        std::vector<RetryPort> next_ports;
+        for (size_t i = 0; i < ports.size(); ++i) {
+            RetryPort& port = ports[i];
+            if (connected[i]) {
                 VLOG(TRANSPORT) << "retry port " << port.port << " successfully";
                 continue;
             }
@@ -436,12 +475,12 @@ static void remote_kick(atransport *t)
     adb_close(fd);
 
 #if ADB_HOST
-    int  nn;
-    std::lock_guard<std::mutex> lock(local_transports_lock);
-    for (nn = 0; nn < ADB_LOCAL_TRANSPORT_MAX; nn++) {
-        if (local_transports[nn] == t) {
-            local_transports[nn] = NULL;
-            break;
+    int local_port;
+    if (t->GetLocalPortForEmulator(&local_port)) {
+        std::lock_guard<std::mutex> lock(local_transports_lock);
+        auto it = local_transports.find(local_port);
+        if (it != local_transports.end() && it->second == t) {
+            local_transports.erase(it);
         }
     }
 #endif
@@ -473,16 +512,8 @@ static void remote_close(atransport *t)
 /* Only call this function if you already hold local_transports_lock. */
 static atransport* find_emulator_transport_by_adb_port_locked(int adb_port)
 {
-    int i;
-    for (i = 0; i < ADB_LOCAL_TRANSPORT_MAX; i++) {
-        int local_port;
-        if (local_transports[i] && local_transports[i]->GetLocalPortForEmulator(&local_port)) {
-            if (local_port == adb_port) {
-                return local_transports[i];
-            }
-        }
-    }
-    return NULL;
+    auto it = local_transports.find(adb_port);
+    return it != local_transports.end() ? it->second : NULL;
 }
 
 std::string getEmulatorSerialString(int console_port)
@@ -502,25 +533,6 @@ atransport* find_emulator_transport_by_console_port(int console_port)
     return find_transport(getEmulatorSerialString(console_port).c_str());
 }
 
-
-/* Only call this function if you already hold local_transports_lock. */
-int get_available_local_transport_index_locked()
-{
-    int i;
-    for (i = 0; i < ADB_LOCAL_TRANSPORT_MAX; i++) {
-        if (local_transports[i] == NULL) {
-            return i;
-        }
-    }
-    return -1;
-}
-
-int get_available_local_transport_index()
-{
-    std::lock_guard<std::mutex> lock(local_transports_lock);
-    int result = get_available_local_transport_index_locked();
-    return result;
-}
 #endif
 
 int init_socket_transport(atransport *t, int s, int adb_port, int local)
@@ -539,17 +551,11 @@ int init_socket_transport(atransport *t, int s, int adb_port, int local)
     if (local) {
         std::lock_guard<std::mutex> lock(local_transports_lock);
         t->SetLocalPortForEmulator(adb_port);
-        atransport* existing_transport = find_emulator_transport_by_adb_port_locked(adb_port);
-        int index = get_available_local_transport_index_locked();
-        if (existing_transport != NULL) {
-            D("local transport for port %d already registered (%p)?", adb_port, existing_transport);
+        auto result = local_transports.emplace(adb_port, t);
+        if (!result.second) {
+            D("local transport for port %d already registered (%p)?", adb_port,
+              result.first->second);
             fail = -1;
-        } else if (index < 0) {
-            // Too many emulators.
-            D("cannot register more emulators. Maximum is %d", ADB_LOCAL_TRANSPORT_MAX);
-            fail = -1;
-        } else {
-            local_transports[index] = t;
         }
     }
 #endif
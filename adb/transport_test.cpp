@@ -198,3 +198,19 @@ TEST(transport, test_matches_target_local) {
         EXPECT_FALSE(t.MatchesTarget("abc:100.100.100.100"));
     }
 }
+
+TEST(transport, apacket_pool) {
+    apacket* small = get_apacket(0);
+    ASSERT_EQ(static_cast<size_t>(MAX_PAYLOAD_V1), small->capacity);
+    apacket* large = get_apacket();
+    ASSERT_EQ(static_cast<size_t>(MAX_PAYLOAD), large->capacity);
+
+    // A freed packet comes straight back, with its header cleared.
+    small->msg.command = A_OKAY;
+    put_apacket(small);
+    apacket* reused = get_apacket(MAX_PAYLOAD_V1);
+    ASSERT_EQ(small, reused);
+    ASSERT_EQ(0u, reused->msg.command);
+    put_apacket(reused);
+    put_apacket(large);
+}
@@ -19,10 +19,12 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <libgen.h>
+#include <string.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <unistd.h>
 
+#include <algorithm>
 #include <memory>
 #include <mutex>
 #include <string>
@@ -49,22 +51,53 @@ namespace base {
 using namespace android::base::utf8;
 
 bool ReadFdToString(int fd, std::string* content) {
+  return ReadFdToString(fd, content, 0);
+}
+
+bool ReadFdToString(int fd, std::string* content, size_t size_hint) {
   content->clear();
 
   // Although original we had small files in mind, this code gets used for
   // very large files too, where the std::string growth heuristics might not
   // be suitable. https://code.google.com/p/android/issues/detail?id=258500.
+  // Files that claim to be empty, like those in /proc, get the caller's hint.
+  size_t size = size_hint;
   struct stat sb;
   if (fstat(fd, &sb) != -1 && sb.st_size > 0) {
-    content->reserve(sb.st_size);
+    size = sb.st_size;
   }
+  if (size > 0) {
+    content->reserve(size);
+  }
+  content->resize(size);
 
-  char buf[BUFSIZ];
-  ssize_t n;
-  while ((n = TEMP_FAILURE_RETRY(read(fd, &buf[0], sizeof(buf)))) > 0) {
-    content->append(buf, n);
+  // Read straight into the string while it has room. Once it's full, which
+  // is at EOF if the size was right, look for more through a small buffer
+  // first, so as not to grow the string just to find out there's nothing.
+  size_t used = 0;
+  while (true) {
+    ssize_t n;
+    if (used < content->size()) {
+      n = TEMP_FAILURE_RETRY(read(fd, &(*content)[used], content->size() - used));
+      if (n > 0) {
+        used += n;
+        continue;
+      }
+    } else {
+      char buf[BUFSIZ];
+      n = TEMP_FAILURE_RETRY(read(fd, &buf[0], sizeof(buf)));
+      if (n > 0) {
+        // Exactly what was read, the first time, which is all there is to
+        // most files without a size; after that, at least double.
+        content->resize((used == 0) ? n : std::max(used * 2, used + n));
+        memcpy(&(*content)[used], buf, n);
+        used += n;
+        continue;
+      }
+    }
+    content->resize(used);
+    return (n == 0) ? true : false;
   }
-  return (n == 0) ? true : false;
 }
 
 bool ReadFileToString(const std::string& path, std::string* content, bool follow_symlinks) {
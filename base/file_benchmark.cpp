@@ -0,0 +1,86 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <string>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+#include "android-base/file.h"
+#include "android-base/mapped_file.h"
+#include "android-base/strings.h"
+#include "android-base/test_utils.h"
+#include "android-base/unique_fd.h"
+
+static void BM_ReadFileToString(benchmark::State& state) {
+  TemporaryFile tf;
+  android::base::WriteStringToFd(std::string(state.range(0), 'x'), tf.fd);
+  std::string s;
+  while (state.KeepRunning()) {
+    android::base::ReadFileToString(tf.path, &s);
+    benchmark::DoNotOptimize(s.data());
+  }
+  state.SetBytesProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_ReadFileToString)->Arg(4096)->Arg(1024 * 1024);
+
+static void BM_ReadFdToString_proc(benchmark::State& state) {
+  std::string s;
+  while (state.KeepRunning()) {
+    android::base::unique_fd fd(open("/proc/self/smaps", O_RDONLY | O_CLOEXEC));
+    android::base::ReadFdToString(fd, &s, state.range(0));
+    benchmark::DoNotOptimize(s.data());
+  }
+}
+BENCHMARK(BM_ReadFdToString_proc)->Arg(0)->Arg(32 * 1024);
+
+static std::string LinesFile() {
+  std::string content;
+  for (int i = 0; i < 10000; ++i) {
+    content += "7f0000000000-7f0000001000 r-xp 00000000 fd:00 123456 /system/lib64/libc.so\n";
+  }
+  return content;
+}
+
+static void BM_lines_ReadFileToString_Split(benchmark::State& state) {
+  TemporaryFile tf;
+  android::base::WriteStringToFd(LinesFile(), tf.fd);
+  while (state.KeepRunning()) {
+    std::string content;
+    android::base::ReadFileToString(tf.path, &content);
+    benchmark::DoNotOptimize(android::base::Split(content, "\n").size());
+  }
+}
+BENCHMARK(BM_lines_ReadFileToString_Split);
+
+#if __cplusplus > 201402L
+static void BM_lines_MappedFile_Lines(benchmark::State& state) {
+  TemporaryFile tf;
+  android::base::WriteStringToFd(LinesFile(), tf.fd);
+  while (state.KeepRunning()) {
+    auto file = android::base::MappedFile::FromPath(tf.path);
+    size_t count = 0;
+    for (std::string_view line : android::base::Lines({file->data(), file->size()})) {
+      count += !line.empty();
+    }
+    benchmark::DoNotOptimize(count);
+  }
+}
+BENCHMARK(BM_lines_MappedFile_Lines);
+#endif
@@ -25,6 +25,7 @@
 #include <string>
 
 #include "android-base/test_utils.h"
+#include "android-base/unique_fd.h"
 
 TEST(file, ReadFileToString_ENOENT) {
   std::string s("hello");
@@ -257,3 +258,37 @@ TEST(file, ReadFileToString_capacity_0) {
   EXPECT_EQ(0U, s.size());
   EXPECT_EQ(initial_capacity, s.capacity());
 }
+
+TEST(file, ReadFdToString_proc) {
+  // /proc files claim to be empty, but we should read all of them anyway.
+  std::string maps;
+  android::base::unique_fd fd(open("/proc/self/maps", O_RDONLY | O_CLOEXEC));
+  ASSERT_NE(-1, fd);
+  ASSERT_TRUE(android::base::ReadFdToString(fd, &maps));
+  ASSERT_FALSE(maps.empty());
+  EXPECT_EQ('\n', maps.back());
+
+  std::string hinted;
+  fd.reset(open("/proc/self/maps", O_RDONLY | O_CLOEXEC));
+  ASSERT_NE(-1, fd);
+  ASSERT_TRUE(android::base::ReadFdToString(fd, &hinted, 64 * 1024));
+  EXPECT_EQ('\n', hinted.back());
+}
+
+TEST(file, ReadFdToString_size_hint) {
+  // A pipe has no size either. Write more than the hint, in several pieces.
+  int fds[2];
+  ASSERT_EQ(0, pipe(fds));
+  android::base::unique_fd read_fd(fds[0]);
+  android::base::unique_fd write_fd(fds[1]);
+  std::string expected;
+  for (size_t i = 0; i < 3000; ++i) {
+    expected += static_cast<char>('a' + i % 26);
+  }
+  ASSERT_TRUE(android::base::WriteStringToFd(expected, write_fd));
+  write_fd.reset();
+
+  std::string s("will be replaced");
+  ASSERT_TRUE(android::base::ReadFdToString(read_fd, &s, 100));
+  EXPECT_EQ(expected, s);
+}
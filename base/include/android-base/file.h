@@ -17,6 +17,7 @@
 #ifndef ANDROID_BASE_FILE_H
 #define ANDROID_BASE_FILE_H
 
+#include <stddef.h>
 #include <sys/stat.h>
 #include <string>
 
@@ -28,6 +29,9 @@ namespace android {
 namespace base {
 
 bool ReadFdToString(int fd, std::string* content);
+// As above, but reads |size_hint| bytes before first growing |content| if
+// fstat doesn't know the file's size, as is the case in /proc.
+bool ReadFdToString(int fd, std::string* content, size_t size_hint);
 bool ReadFileToString(const std::string& path, std::string* content,
                       bool follow_symlinks = false);
 
@@ -106,6 +106,39 @@ class LogdLogger {
 };
 #endif
 
+#if !defined(_WIN32)
+// Wraps another logger, queuing lines for a background thread to hand to it,
+// so that logging doesn't wait on the wrapped logger's I/O:
+//
+//   SetLogger(AsyncLogger(LogdLogger()));
+//
+// FATAL and FATAL_WITHOUT_ABORT lines are written synchronously, after
+// everything queued before them, so nothing is lost to the abort that follows.
+// A line that finds the queue full is likewise written synchronously. Lines
+// still queued are written at exit(), and when the last copy of the logger is
+// destroyed, e.g. by a later SetLogger. A child created by fork() has no
+// background thread, and logs synchronously.
+//
+// Timestamps and thread ids added by the wrapped logger are those of the
+// background thread, not of the thread that logged.
+class AsyncLogger {
+ public:
+  // |capacity| is the number of lines that can be queued, rounded up to a
+  // power of two.
+  explicit AsyncLogger(LogFunction&& logger, size_t capacity = 1024);
+
+  void operator()(LogId, LogSeverity, const char* tag, const char* file,
+                  unsigned int line, const char* message);
+
+  // Blocks until every line queued so far has been written.
+  void Flush();
+
+ private:
+  struct State;
+  std::shared_ptr<State> state_;
+};
+#endif
+
 // Configure logging based on ANDROID_LOG_TAGS environment variable.
 // We need to parse a string that looks like
 //
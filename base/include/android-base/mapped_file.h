@@ -0,0 +1,73 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_BASE_MAPPED_FILE_H
+#define ANDROID_BASE_MAPPED_FILE_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+#include <memory>
+#include <string>
+
+#include "android-base/macros.h"
+
+#if defined(__APPLE__)
+// Darwin's off_t is always 64 bits.
+typedef off_t off64_t;
+#endif
+
+namespace android {
+namespace base {
+
+// A read-only view of (part of) a file, mapped into memory rather than read,
+// so that large files aren't copied at all and are only paged in as they are
+// looked at. Files in /proc and /sys can't be mapped: use ReadFileToString.
+//
+// The mapping is private, so later writes to the file may or may not show.
+class MappedFile {
+ public:
+  // Maps |length| bytes of |fd| starting at |offset|, which needn't be page
+  // aligned. |fd| can be closed afterwards. Returns nullptr, with errno set,
+  // on failure.
+  static std::unique_ptr<MappedFile> FromFd(int fd, off64_t offset, size_t length);
+
+  // Maps the whole of the regular file at |path|.
+  static std::unique_ptr<MappedFile> FromPath(const std::string& path,
+                                              bool follow_symlinks = false);
+
+  ~MappedFile();
+
+  const char* data() const { return base_ + offset_; }
+  size_t size() const { return size_; }
+
+ private:
+  MappedFile(char* base, size_t offset, size_t size)
+      : base_(base), offset_(offset), size_(size) {}
+
+  // The mapping starts at base_, which is nullptr for an empty view, and is
+  // offset_ + size_ long.
+  char* base_;
+  size_t offset_;
+  size_t size_;
+
+  DISALLOW_COPY_AND_ASSIGN(MappedFile);
+};
+
+}  // namespace base
+}  // namespace android
+
+#endif  // ANDROID_BASE_MAPPED_FILE_H
@@ -17,7 +17,9 @@
 #ifndef ANDROID_BASE_PROPERTIES_H
 #define ANDROID_BASE_PROPERTIES_H
 
+#include <stdint.h>
 #include <sys/cdefs.h>
+#include <sys/system_properties.h>
 
 #if !defined(__BIONIC__)
 #error Only bionic supports system properties.
@@ -71,6 +73,39 @@ bool WaitForProperty(const std::string& key, const std::string& expected_value,
 bool WaitForPropertyCreation(const std::string& key, std::chrono::milliseconds relative_timeout =
                                                          std::chrono::milliseconds::max());
 
+// Holds the value of the system property `property_name`, read again only when
+// the property's serial number shows it has changed, so that polling a
+// property costs an atomic load rather than a lookup and a copy.
+//
+// Not thread safe: use one instance per thread, or guard it with a lock.
+class CachedProperty {
+ public:
+  explicit CachedProperty(const std::string& property_name);
+
+  // Returns the current value, or nullptr if the property doesn't exist.
+  // The pointer is good until the next call. If `changed` isn't null, sets it
+  // to whether the value may differ from that returned by the previous call.
+  const char* Get(bool* changed = nullptr);
+
+  const std::string& Name() const { return property_name_; }
+
+ private:
+  static void Callback(void* cookie, const char* name, const char* value, unsigned serial);
+
+  const std::string property_name_;
+  const prop_info* prop_info_;
+  // While prop_info_ is null, the global serial number of the last lookup.
+  bool looked_up_;
+  uint32_t area_serial_;
+  // The property's serial number when cached_value_ was read.
+  bool read_;
+  uint32_t serial_;
+  std::string cached_value_;
+
+  CachedProperty(const CachedProperty&) = delete;
+  void operator=(const CachedProperty&) = delete;
+};
+
 } // namespace base
 } // namespace android
 
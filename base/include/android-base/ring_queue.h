@@ -0,0 +1,189 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_BASE_RING_QUEUE_H
+#define ANDROID_BASE_RING_QUEUE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <atomic>
+#include <memory>
+#include <utility>
+
+#include "android-base/macros.h"
+
+namespace android {
+namespace base {
+
+// Keeps the indices written by different threads on different cache lines.
+static constexpr size_t kRingQueueCacheLineSize = 64;
+
+static inline size_t RingQueueCapacity(size_t capacity) {
+  size_t result = 1;
+  while (result < capacity) result <<= 1;
+  return result;
+}
+
+// A bounded, lock-free queue for exactly one producer thread and one consumer
+// thread. The capacity is rounded up to a power of two.
+//
+// T must be default constructible and move assignable; popped slots are left
+// holding moved-from values until they are reused.
+template <typename T>
+class SpscQueue {
+ public:
+  explicit SpscQueue(size_t capacity)
+      : capacity_(RingQueueCapacity(capacity)),
+        mask_(capacity_ - 1),
+        slots_(new T[capacity_]),
+        head_(0),
+        tail_cache_(0),
+        tail_(0),
+        head_cache_(0) {}
+
+  // Producer only. Returns false, leaving |value| untouched, if the queue is full.
+  template <typename U>
+  bool TryPush(U&& value) {
+    size_t tail = tail_.load(std::memory_order_relaxed);
+    if (tail - head_cache_ == capacity_) {
+      head_cache_ = head_.load(std::memory_order_acquire);
+      if (tail - head_cache_ == capacity_) return false;
+    }
+    slots_[tail & mask_] = std::forward<U>(value);
+    tail_.store(tail + 1, std::memory_order_release);
+    return true;
+  }
+
+  // Consumer only. Returns false if the queue is empty.
+  bool TryPop(T* value) {
+    size_t head = head_.load(std::memory_order_relaxed);
+    if (head == tail_cache_) {
+      tail_cache_ = tail_.load(std::memory_order_acquire);
+      if (head == tail_cache_) return false;
+    }
+    *value = std::move(slots_[head & mask_]);
+    head_.store(head + 1, std::memory_order_release);
+    return true;
+  }
+
+  // Only exact when called by the producer or the consumer while the other
+  // side is idle.
+  size_t size() const {
+    return tail_.load(std::memory_order_acquire) - head_.load(std::memory_order_acquire);
+  }
+
+  size_t capacity() const { return capacity_; }
+
+ private:
+  const size_t capacity_;
+  const size_t mask_;
+  const std::unique_ptr<T[]> slots_;
+
+  // Written by the consumer. tail_cache_ is its last view of tail_, so that
+  // it only reads the producer's cache line when the queue looks empty.
+  alignas(kRingQueueCacheLineSize) std::atomic<size_t> head_;
+  size_t tail_cache_;
+
+  // Written by the producer, which likewise caches head_.
+  alignas(kRingQueueCacheLineSize) std::atomic<size_t> tail_;
+  size_t head_cache_;
+
+  DISALLOW_COPY_AND_ASSIGN(SpscQueue);
+};
+
+// A bounded, lock-free queue for any number of producer threads and exactly
+// one consumer thread. The capacity is rounded up to a power of two.
+//
+// Each slot carries a sequence number saying whose turn it is: producers
+// claim a position with a compare-and-swap on tail_ and publish the value by
+// advancing the slot's sequence, which the consumer waits for. A producer
+// preempted between the two stalls the consumer at that slot, but never any
+// other producer.
+template <typename T>
+class MpscQueue {
+ public:
+  explicit MpscQueue(size_t capacity)
+      : capacity_(RingQueueCapacity(capacity)),
+        mask_(capacity_ - 1),
+        slots_(new Slot[capacity_]),
+        head_(0),
+        tail_(0) {
+    for (size_t i = 0; i < capacity_; ++i) {
+      slots_[i].sequence.store(i, std::memory_order_relaxed);
+    }
+  }
+
+  // Any thread. Returns false, leaving |value| untouched, if the queue is full.
+  template <typename U>
+  bool TryPush(U&& value) {
+    size_t pos = tail_.load(std::memory_order_relaxed);
+    Slot* slot;
+    while (true) {
+      slot = &slots_[pos & mask_];
+      size_t sequence = slot->sequence.load(std::memory_order_acquire);
+      intptr_t diff = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(pos);
+      if (diff == 0) {
+        // The slot is free; try to claim it. On failure pos is reloaded.
+        if (tail_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) break;
+      } else if (diff < 0) {
+        // The slot still holds the value from a lap ago: full.
+        return false;
+      } else {
+        // Another producer claimed pos.
+        pos = tail_.load(std::memory_order_relaxed);
+      }
+    }
+    slot->value = std::forward<U>(value);
+    slot->sequence.store(pos + 1, std::memory_order_release);
+    return true;
+  }
+
+  // Consumer only. Returns false if the queue is empty, or if the producer of
+  // the oldest value hasn't finished writing it yet.
+  bool TryPop(T* value) {
+    Slot* slot = &slots_[head_ & mask_];
+    if (slot->sequence.load(std::memory_order_acquire) != head_ + 1) return false;
+    *value = std::move(slot->value);
+    slot->sequence.store(head_ + capacity_, std::memory_order_release);
+    ++head_;
+    return true;
+  }
+
+  size_t capacity() const { return capacity_; }
+
+ private:
+  struct Slot {
+    std::atomic<size_t> sequence;
+    T value;
+  };
+
+  const size_t capacity_;
+  const size_t mask_;
+  const std::unique_ptr<Slot[]> slots_;
+
+  // Only touched by the consumer.
+  alignas(kRingQueueCacheLineSize) size_t head_;
+
+  alignas(kRingQueueCacheLineSize) std::atomic<size_t> tail_;
+
+  DISALLOW_COPY_AND_ASSIGN(MpscQueue);
+};
+
+}  // namespace base
+}  // namespace android
+
+#endif  // ANDROID_BASE_RING_QUEUE_H
@@ -17,10 +17,17 @@
 #ifndef ANDROID_BASE_STRINGS_H
 #define ANDROID_BASE_STRINGS_H
 
+#include <stdlib.h>
+
+#include <iterator>
 #include <sstream>
 #include <string>
 #include <vector>
 
+#if __cplusplus > 201402L
+#include <string_view>
+#endif
+
 namespace android {
 namespace base {
 
@@ -32,6 +39,137 @@ namespace base {
 std::vector<std::string> Split(const std::string& s,
                                const std::string& delimiters);
 
+#if __cplusplus > 201402L
+// Iterates over the same pieces as Split, but as views into s, without
+// allocating anything:
+//
+//   for (std::string_view field : SplitPieces(line, " ")) { ... }
+//
+// s must outlive the iteration. The empty string is not a valid delimiter list.
+class SplitPieces {
+ public:
+  class iterator {
+   public:
+    typedef std::forward_iterator_tag iterator_category;
+    typedef std::string_view value_type;
+    typedef ptrdiff_t difference_type;
+    typedef const std::string_view* pointer;
+    typedef std::string_view reference;
+
+    iterator() : start_(std::string_view::npos), end_(std::string_view::npos) {}
+
+    std::string_view operator*() const {
+      return s_.substr(start_, end_ == std::string_view::npos ? end_ : end_ - start_);
+    }
+
+    iterator& operator++() {
+      if (end_ == std::string_view::npos) {
+        start_ = std::string_view::npos;
+      } else {
+        start_ = end_ + 1;
+        end_ = s_.find_first_of(delimiters_, start_);
+      }
+      return *this;
+    }
+
+    iterator operator++(int) {
+      iterator result = *this;
+      ++*this;
+      return result;
+    }
+
+    bool operator==(const iterator& other) const { return start_ == other.start_; }
+    bool operator!=(const iterator& other) const { return start_ != other.start_; }
+
+   private:
+    friend class SplitPieces;
+    iterator(std::string_view s, std::string_view delimiters, size_t start)
+        : s_(s), delimiters_(delimiters), start_(start),
+          end_(start == std::string_view::npos ? start : s.find_first_of(delimiters)) {}
+
+    std::string_view s_;
+    std::string_view delimiters_;
+    // The current piece is [start_, end_); start_ is npos once past the last.
+    size_t start_;
+    size_t end_;
+  };
+
+  SplitPieces(std::string_view s, std::string_view delimiters)
+      : s_(s), delimiters_(delimiters) {
+    if (delimiters.empty()) abort();
+  }
+
+  iterator begin() const { return iterator(s_, delimiters_, 0); }
+  iterator end() const { return iterator(s_, delimiters_, std::string_view::npos); }
+
+ private:
+  std::string_view s_;
+  std::string_view delimiters_;
+};
+
+// Iterates over the lines of s, as views into it, without the '\n's. Unlike
+// SplitPieces(s, "\n"), a final '\n' doesn't start an empty last line, so
+// this suits file contents, e.g. from ReadFileToString or a MappedFile:
+//
+//   for (std::string_view line : Lines(content)) { ... }
+//
+// s must outlive the iteration.
+class Lines {
+ public:
+  class iterator {
+   public:
+    typedef std::forward_iterator_tag iterator_category;
+    typedef std::string_view value_type;
+    typedef ptrdiff_t difference_type;
+    typedef const std::string_view* pointer;
+    typedef std::string_view reference;
+
+    iterator() : start_(std::string_view::npos), end_(std::string_view::npos) {}
+
+    std::string_view operator*() const { return s_.substr(start_, end_ - start_); }
+
+    iterator& operator++() {
+      start_ = (end_ + 1 < s_.size()) ? end_ + 1 : std::string_view::npos;
+      end_ = FindEnd();
+      return *this;
+    }
+
+    iterator operator++(int) {
+      iterator result = *this;
+      ++*this;
+      return result;
+    }
+
+    bool operator==(const iterator& other) const { return start_ == other.start_; }
+    bool operator!=(const iterator& other) const { return start_ != other.start_; }
+
+   private:
+    friend class Lines;
+    iterator(std::string_view s, size_t start) : s_(s), start_(start), end_(FindEnd()) {}
+
+    // The end of the line starting at start_: its '\n', or the end of s_.
+    size_t FindEnd() const {
+      if (start_ == std::string_view::npos) return std::string_view::npos;
+      size_t nl = s_.find('\n', start_);
+      return (nl == std::string_view::npos) ? s_.size() : nl;
+    }
+
+    std::string_view s_;
+    // The current line is [start_, end_); start_ is npos once past the last.
+    size_t start_;
+    size_t end_;
+  };
+
+  explicit Lines(std::string_view s) : s_(s) {}
+
+  iterator begin() const { return iterator(s_, s_.empty() ? std::string_view::npos : 0); }
+  iterator end() const { return iterator(s_, std::string_view::npos); }
+
+ private:
+  std::string_view s_;
+};
+#endif
+
 // Trims whitespace off both ends of the given string.
 std::string Trim(const std::string& s);
 
@@ -50,11 +188,27 @@ std::string Join(const ContainerT& things, SeparatorT separator) {
   return result.str();
 }
 
-// We instantiate the common cases in strings.cpp.
-extern template std::string Join(const std::vector<std::string>&, char);
-extern template std::string Join(const std::vector<const char*>&, char);
-extern template std::string Join(const std::vector<std::string>&, const std::string&);
-extern template std::string Join(const std::vector<const char*>&, const std::string&);
+// The common cases are implemented in strings.cpp without a stringstream,
+// sizing the result up front so that it's only allocated once.
+template <>
+std::string Join(const std::vector<std::string>&, char);
+template <>
+std::string Join(const std::vector<const char*>&, char);
+template <>
+std::string Join(const std::vector<std::string>&, const char*);
+template <>
+std::string Join(const std::vector<const char*>&, const char*);
+template <>
+std::string Join(const std::vector<std::string>&, std::string);
+template <>
+std::string Join(const std::vector<const char*>&, std::string);
+// Kept for binary compatibility: only reachable with explicit template arguments.
+template <>
+std::string Join<std::vector<std::string>, const std::string&>(const std::vector<std::string>&,
+                                                               const std::string&);
+template <>
+std::string Join<std::vector<const char*>, const std::string&>(const std::vector<const char*>&,
+                                                               const std::string&);
 
 // Tests whether 's' starts with 'prefix'.
 bool StartsWith(const std::string& s, const char* prefix);
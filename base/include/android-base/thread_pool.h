@@ -0,0 +1,93 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_BASE_THREAD_POOL_H
+#define ANDROID_BASE_THREAD_POOL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "android-base/macros.h"
+
+namespace android {
+namespace base {
+
+// A fixed set of worker threads running submitted tasks.
+//
+// Every worker has its own queue. Tasks submitted from a worker go to the
+// front of that worker's queue and are run by it most recently submitted
+// first, which keeps recursive fan-out on warm caches; other tasks are spread
+// over the workers round-robin, to the back of their queues. An idle worker
+// takes a task from the back of another worker's queue, where its owner gets
+// to last, before going to sleep.
+class ThreadPool {
+ public:
+  // Starts |threads| workers, at least one. If |cpus| isn't empty, worker i
+  // asks to run only on cpus[i % cpus.size()]. That is a hint: it is ignored
+  // where thread affinity isn't supported or the cpu isn't available.
+  explicit ThreadPool(size_t threads, const std::vector<int>& cpus = {});
+
+  // Waits for all submitted tasks, including those they submit, to finish.
+  ~ThreadPool();
+
+  void Submit(std::function<void()> task);
+
+  // Blocks until every task submitted so far, and every task those submit,
+  // has finished. Must not be called from a task.
+  void Wait();
+
+  size_t size() const { return workers_.size(); }
+
+ private:
+  struct Worker {
+    std::mutex lock;
+    std::deque<std::function<void()>> tasks;
+    std::thread thread;
+  };
+
+  void Run(size_t index, int cpu);
+  bool PopLocal(size_t index, std::function<void()>* task);
+  bool Steal(size_t index, std::function<void()>* task);
+
+  std::vector<std::unique_ptr<Worker>> workers_;
+  std::atomic<size_t> next_worker_;
+
+  // Tasks sitting in a queue, and tasks submitted but not yet finished.
+  std::atomic<int64_t> queued_;
+  std::atomic<int64_t> outstanding_;
+
+  // Guards sleeping and waking up on either condition.
+  std::mutex idle_lock_;
+  std::condition_variable work_available_;
+  std::condition_variable all_done_;
+  bool stopping_;
+
+  DISALLOW_COPY_AND_ASSIGN(ThreadPool);
+};
+
+}  // namespace base
+}  // namespace android
+
+#endif  // ANDROID_BASE_THREAD_POOL_H
@@ -35,11 +35,21 @@
 #include <sys/uio.h>
 #endif
 
+#if !defined(_WIN32)
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#endif
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
 #include <iostream>
 #include <limits>
 #include <mutex>
 #include <sstream>
 #include <string>
+#include <thread>
 #include <utility>
 #include <vector>
 
@@ -53,6 +63,7 @@
 #endif
 
 #include <android-base/macros.h>
+#include <android-base/ring_queue.h>
 #include <android-base/strings.h>
 
 // For gettid.
@@ -253,6 +264,213 @@ void LogdLogger::operator()(LogId id, LogSeverity severity, const char* tag,
 }
 #endif
 
+#if !defined(_WIN32)
+struct AsyncLogger::State {
+  // A queued line. The tag, file and message are kept in one string, each
+  // followed by its \0, to allocate only once.
+  struct Record {
+    LogId id;
+    LogSeverity severity;
+    unsigned int line;
+    bool has_tag;
+    bool has_file;
+    size_t file_offset;
+    size_t message_offset;
+    std::string text;
+  };
+
+  State(LogFunction&& logger, size_t capacity);
+  ~State();
+
+  bool Enqueue(LogId id, LogSeverity severity, const char* tag, const char* file,
+               unsigned int line, const char* message);
+  // Writes out everything queued. Called with drain_lock held.
+  void DrainLocked();
+  void Run();
+
+  static std::mutex& RegistryLock();
+  static std::vector<State*>& Registry();
+
+  LogFunction logger;
+
+  MpscQueue<Record> queue;
+  // Records pushed and not yet popped, for the background thread to decide
+  // whether it can sleep.
+  std::atomic<size_t> queued;
+
+  // Held by whoever is taking records off the queue, which must be only one
+  // thread at a time: the background thread, or one flushing the queue.
+  std::mutex drain_lock;
+
+  // Guards the background thread going to sleep and waking up.
+  std::mutex wake_lock;
+  std::condition_variable wake;
+  // Set while the background thread is, or is about to be, asleep, so that
+  // loggers only take wake_lock when they need to.
+  std::atomic<bool> waiting;
+  bool stopping;
+
+  // Set in a child process, which doesn't inherit the background thread.
+  std::atomic<bool> forked;
+  std::unique_ptr<std::thread> thread;
+};
+
+std::mutex& AsyncLogger::State::RegistryLock() {
+  static auto& registry_lock = *new std::mutex();
+  return registry_lock;
+}
+
+std::vector<AsyncLogger::State*>& AsyncLogger::State::Registry() {
+  static auto& registry = *new std::vector<State*>();
+  return registry;
+}
+
+AsyncLogger::State::State(LogFunction&& logger, size_t capacity)
+    : logger(std::move(logger)), queue(capacity), queued(0), waiting(false),
+      stopping(false), forked(false) {
+  {
+    std::lock_guard<std::mutex> lock(RegistryLock());
+    static bool registered = false;
+    if (!registered) {
+      registered = true;
+      // Write whatever is still queued when the process exits.
+      atexit([]() {
+        std::lock_guard<std::mutex> lock(RegistryLock());
+        for (State* state : Registry()) {
+          std::lock_guard<std::mutex> drain(state->drain_lock);
+          state->DrainLocked();
+        }
+      });
+      // Keep every queue consistent across fork(), and have the child log
+      // synchronously, since the background threads don't survive the fork.
+      pthread_atfork(
+          []() {
+            RegistryLock().lock();
+            for (State* state : Registry()) state->drain_lock.lock();
+          },
+          []() {
+            for (State* state : Registry()) state->drain_lock.unlock();
+            RegistryLock().unlock();
+          },
+          []() {
+            for (State* state : Registry()) {
+              state->forked.store(true, std::memory_order_relaxed);
+              state->drain_lock.unlock();
+            }
+            RegistryLock().unlock();
+          });
+    }
+    Registry().push_back(this);
+  }
+  thread.reset(new std::thread(&State::Run, this));
+}
+
+AsyncLogger::State::~State() {
+  {
+    std::lock_guard<std::mutex> lock(RegistryLock());
+    auto& registry = Registry();
+    registry.erase(std::find(registry.begin(), registry.end(), this));
+  }
+  if (forked.load(std::memory_order_relaxed)) {
+    // The thread belongs to the parent: there is nothing to stop or join.
+    // wake_lock may have been held by it at the fork, so don't touch that.
+    thread.release();
+  } else {
+    {
+      std::lock_guard<std::mutex> lock(wake_lock);
+      stopping = true;
+    }
+    wake.notify_one();
+    thread->join();
+  }
+  std::lock_guard<std::mutex> lock(drain_lock);
+  DrainLocked();
+}
+
+bool AsyncLogger::State::Enqueue(LogId id, LogSeverity severity, const char* tag,
+                                 const char* file, unsigned int line, const char* message) {
+  Record record;
+  record.id = id;
+  record.severity = severity;
+  record.line = line;
+  record.has_tag = (tag != nullptr);
+  record.has_file = (file != nullptr);
+  size_t tag_length = (tag != nullptr) ? strlen(tag) : 0;
+  size_t file_length = (file != nullptr) ? strlen(file) : 0;
+  size_t message_length = strlen(message);
+  record.text.reserve(tag_length + file_length + message_length + 2);
+  record.text.append(tag != nullptr ? tag : "", tag_length);
+  record.text.push_back('\0');
+  record.file_offset = record.text.size();
+  record.text.append(file != nullptr ? file : "", file_length);
+  record.text.push_back('\0');
+  record.message_offset = record.text.size();
+  record.text.append(message, message_length);
+
+  if (!queue.TryPush(std::move(record))) return false;
+
+  // Both sides use sequentially consistent operations on queued and waiting:
+  // either the background thread sees this record before going to sleep, or
+  // this sees that it has to wake it up.
+  queued.fetch_add(1);
+  if (waiting.load()) {
+    {
+      std::lock_guard<std::mutex> lock(wake_lock);
+    }
+    wake.notify_one();
+  }
+  return true;
+}
+
+void AsyncLogger::State::DrainLocked() {
+  Record record;
+  while (queue.TryPop(&record)) {
+    queued.fetch_sub(1, std::memory_order_relaxed);
+    const char* text = record.text.c_str();
+    logger(record.id, record.severity, record.has_tag ? text : nullptr,
+           record.has_file ? text + record.file_offset : nullptr, record.line,
+           text + record.message_offset);
+  }
+}
+
+void AsyncLogger::State::Run() {
+  while (true) {
+    {
+      std::lock_guard<std::mutex> lock(drain_lock);
+      DrainLocked();
+    }
+    std::unique_lock<std::mutex> lock(wake_lock);
+    waiting.store(true);
+    wake.wait(lock, [this]() { return stopping || queued.load() != 0; });
+    waiting.store(false, std::memory_order_relaxed);
+    if (stopping) return;
+  }
+}
+
+AsyncLogger::AsyncLogger(LogFunction&& logger, size_t capacity)
+    : state_(std::make_shared<State>(std::move(logger), capacity)) {
+}
+
+void AsyncLogger::operator()(LogId id, LogSeverity severity, const char* tag,
+                             const char* file, unsigned int line,
+                             const char* message) {
+  State* state = state_.get();
+  if (severity < FATAL_WITHOUT_ABORT && !state->forked.load(std::memory_order_relaxed) &&
+      state->Enqueue(id, severity, tag, file, line, message)) {
+    return;
+  }
+  // Write everything before this line first, to keep them in order.
+  std::lock_guard<std::mutex> lock(state->drain_lock);
+  state->DrainLocked();
+  state->logger(id, severity, tag, file, line, message);
+}
+
+void AsyncLogger::Flush() {
+  std::lock_guard<std::mutex> lock(state_->drain_lock);
+  state_->DrainLocked();
+}
+#endif
+
 void InitLogging(char* argv[], LogFunction&& logger, AbortFunction&& aborter) {
   SetLogger(std::forward<LogFunction>(logger));
   SetAborter(std::forward<AbortFunction>(aborter));
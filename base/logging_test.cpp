@@ -20,13 +20,21 @@
 
 #if defined(_WIN32)
 #include <signal.h>
+#else
+#include <sys/wait.h>
+#include <unistd.h>
 #endif
 
+#include <atomic>
+#include <memory>
+#include <mutex>
 #include <regex>
 #include <string>
+#include <vector>
 
 #include "android-base/file.h"
 #include "android-base/stringprintf.h"
+#include "android-base/strings.h"
 #include "android-base/test_utils.h"
 
 #include <gtest/gtest.h>
@@ -595,6 +603,109 @@ TEST(logging, LOG_FATAL_ABORTER_MESSAGE) {
   EXPECT_EQ(CountLineAborter::newline_count, 1U + 1U);  // +1 for final '\n'.
 }
 
+#if !defined(_WIN32)
+struct RecordingLogger {
+  void operator()(android::base::LogId, android::base::LogSeverity, const char* tag,
+                  const char* file, unsigned int line, const char* message) {
+    std::lock_guard<std::mutex> lock(lines->lock);
+    lines->lines.push_back(android::base::StringPrintf("%s %s:%u %s", tag, file, line, message));
+  }
+
+  struct Lines {
+    std::mutex lock;
+    std::vector<std::string> lines;
+  };
+  std::shared_ptr<Lines> lines = std::make_shared<Lines>();
+};
+
+TEST(logging, AsyncLogger_writes_in_order) {
+  RecordingLogger recorder;
+  android::base::AsyncLogger logger(recorder, 4);
+  for (unsigned int i = 0; i < 100; ++i) {
+    logger(android::base::DEFAULT, android::base::INFO, "tag", "file.cpp", i, "message");
+  }
+  logger.Flush();
+
+  ASSERT_EQ(100U, recorder.lines->lines.size());
+  for (unsigned int i = 0; i < 100; ++i) {
+    EXPECT_EQ(android::base::StringPrintf("tag file.cpp:%u message", i), recorder.lines->lines[i]);
+  }
+}
+
+TEST(logging, AsyncLogger_fatal_flushes) {
+  RecordingLogger recorder;
+  android::base::AsyncLogger logger(recorder);
+  logger(android::base::DEFAULT, android::base::INFO, "tag", "file.cpp", 1, "first");
+  logger(android::base::DEFAULT, android::base::INFO, "tag", "file.cpp", 2, "second");
+  logger(android::base::DEFAULT, android::base::FATAL_WITHOUT_ABORT, "tag", "file.cpp", 3,
+         "fatal");
+
+  // Written by the time the fatal line returns, without a Flush.
+  std::lock_guard<std::mutex> lock(recorder.lines->lock);
+  ASSERT_EQ(3U, recorder.lines->lines.size());
+  EXPECT_EQ("tag file.cpp:1 first", recorder.lines->lines[0]);
+  EXPECT_EQ("tag file.cpp:2 second", recorder.lines->lines[1]);
+  EXPECT_EQ("tag file.cpp:3 fatal", recorder.lines->lines[2]);
+}
+
+TEST(logging, AsyncLogger_null_tag_and_file) {
+  struct NullChecker {
+    void operator()(android::base::LogId, android::base::LogSeverity, const char* tag,
+                    const char* file, unsigned int, const char* message) {
+      EXPECT_EQ(nullptr, tag);
+      EXPECT_EQ(nullptr, file);
+      EXPECT_STREQ("message", message);
+      ++*count;
+    }
+    std::shared_ptr<std::atomic<int>> count = std::make_shared<std::atomic<int>>(0);
+  } checker;
+  android::base::AsyncLogger logger(checker);
+  logger(android::base::DEFAULT, android::base::INFO, nullptr, nullptr, 0, "message");
+  logger.Flush();
+  EXPECT_EQ(1, checker.count->load());
+}
+
+TEST(logging, AsyncLogger_SetLogger) {
+  RecordingLogger recorder;
+  android::base::SetLogger(android::base::AsyncLogger(recorder));
+  LOG(INFO) << "async";
+  LOG(ERROR) << "two\nlines";
+
+  // Replacing the logger destroys the last copy of it, which flushes.
+#ifdef __ANDROID__
+  android::base::SetLogger(android::base::LogdLogger());
+#else
+  android::base::SetLogger(android::base::StderrLogger);
+#endif
+
+  ASSERT_EQ(3U, recorder.lines->lines.size());
+  EXPECT_TRUE(android::base::EndsWith(recorder.lines->lines[0], " async"));
+  EXPECT_TRUE(android::base::EndsWith(recorder.lines->lines[1], " two"));
+  EXPECT_TRUE(android::base::EndsWith(recorder.lines->lines[2], " lines"));
+}
+
+TEST(logging, AsyncLogger_fork) {
+  RecordingLogger recorder;
+  android::base::AsyncLogger logger(recorder);
+  logger(android::base::DEFAULT, android::base::INFO, "tag", "file.cpp", 1, "parent");
+  logger.Flush();
+
+  pid_t pid = fork();
+  ASSERT_NE(-1, pid);
+  if (pid == 0) {
+    // The child has no background thread, so this must be written right away.
+    logger(android::base::DEFAULT, android::base::INFO, "tag", "file.cpp", 2, "child");
+    bool ok = recorder.lines->lines.size() == 2 &&
+              recorder.lines->lines[1] == "tag file.cpp:2 child";
+    _exit(ok ? 0 : 1);
+  }
+  int status;
+  ASSERT_EQ(pid, TEMP_FAILURE_RETRY(waitpid(pid, &status, 0)));
+  ASSERT_TRUE(WIFEXITED(status));
+  EXPECT_EQ(0, WEXITSTATUS(status));
+}
+#endif
+
 __attribute__((constructor)) void TestLoggingInConstructor() {
   LOG(ERROR) << "foobar";
 }
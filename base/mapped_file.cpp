@@ -0,0 +1,78 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "android-base/mapped_file.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "android-base/unique_fd.h"
+
+#if defined(__APPLE__)
+#define mmap64 mmap
+#endif
+
+namespace android {
+namespace base {
+
+std::unique_ptr<MappedFile> MappedFile::FromFd(int fd, off64_t offset, size_t length) {
+  if (offset < 0) {
+    errno = EINVAL;
+    return nullptr;
+  }
+  if (length == 0) {
+    // mmap refuses empty mappings, but an empty file is a file.
+    return std::unique_ptr<MappedFile>(new MappedFile(nullptr, 0, 0));
+  }
+
+  static const off64_t page_size = sysconf(_SC_PAGE_SIZE);
+  size_t slop = offset % page_size;
+  off64_t file_offset = offset - slop;
+  void* base = mmap64(nullptr, slop + length, PROT_READ, MAP_PRIVATE, fd, file_offset);
+  if (base == MAP_FAILED) {
+    return nullptr;
+  }
+  return std::unique_ptr<MappedFile>(new MappedFile(static_cast<char*>(base), slop, length));
+}
+
+std::unique_ptr<MappedFile> MappedFile::FromPath(const std::string& path, bool follow_symlinks) {
+  int flags = O_RDONLY | O_CLOEXEC | (follow_symlinks ? 0 : O_NOFOLLOW);
+  unique_fd fd(TEMP_FAILURE_RETRY(open(path.c_str(), flags)));
+  if (fd == -1) {
+    return nullptr;
+  }
+  struct stat sb;
+  if (fstat(fd, &sb) == -1) {
+    return nullptr;
+  }
+  if (!S_ISREG(sb.st_mode)) {
+    errno = EINVAL;
+    return nullptr;
+  }
+  return FromFd(fd, 0, sb.st_size);
+}
+
+MappedFile::~MappedFile() {
+  if (base_ != nullptr) {
+    munmap(base_, offset_ + size_);
+  }
+}
+
+}  // namespace base
+}  // namespace android
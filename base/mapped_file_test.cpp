@@ -0,0 +1,80 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "android-base/mapped_file.h"
+
+#include <gtest/gtest.h>
+
+#include <errno.h>
+#include <unistd.h>
+
+#include <string>
+
+#include "android-base/file.h"
+#include "android-base/test_utils.h"
+
+TEST(mapped_file, FromPath) {
+  TemporaryFile tf;
+  ASSERT_TRUE(tf.fd != -1);
+  std::string content(3 * getpagesize() + 123, 'x');
+  content[0] = 'a';
+  content[content.size() - 1] = 'z';
+  ASSERT_TRUE(android::base::WriteStringToFile(content, tf.path));
+
+  auto m = android::base::MappedFile::FromPath(tf.path);
+  ASSERT_TRUE(m != nullptr);
+  ASSERT_EQ(content.size(), m->size());
+  EXPECT_EQ(content, std::string(m->data(), m->size()));
+}
+
+TEST(mapped_file, FromFd_unaligned_offset) {
+  TemporaryFile tf;
+  ASSERT_TRUE(tf.fd != -1);
+  std::string content;
+  for (size_t i = 0; i < 2 * static_cast<size_t>(getpagesize()); ++i) {
+    content += static_cast<char>('a' + i % 26);
+  }
+  ASSERT_TRUE(android::base::WriteStringToFd(content, tf.fd));
+
+  off64_t offset = getpagesize() - 3;
+  auto m = android::base::MappedFile::FromFd(tf.fd, offset, 10);
+  ASSERT_TRUE(m != nullptr);
+  ASSERT_EQ(10U, m->size());
+  EXPECT_EQ(content.substr(offset, 10), std::string(m->data(), m->size()));
+}
+
+TEST(mapped_file, empty) {
+  TemporaryFile tf;
+  ASSERT_TRUE(tf.fd != -1);
+
+  auto m = android::base::MappedFile::FromPath(tf.path);
+  ASSERT_TRUE(m != nullptr);
+  EXPECT_EQ(0U, m->size());
+}
+
+TEST(mapped_file, errors) {
+  errno = 0;
+  EXPECT_TRUE(android::base::MappedFile::FromPath("/proc/does-not-exist") == nullptr);
+  EXPECT_EQ(ENOENT, errno);
+
+  errno = 0;
+  EXPECT_TRUE(android::base::MappedFile::FromPath("/") == nullptr);
+  EXPECT_EQ(EINVAL, errno);
+
+  errno = 0;
+  EXPECT_TRUE(android::base::MappedFile::FromFd(-1, 0, 10) == nullptr);
+  EXPECT_EQ(EBADF, errno);
+}
@@ -171,5 +171,44 @@ bool WaitForPropertyCreation(const std::string& key,
   return (WaitForPropertyCreation(key, relative_timeout, start_time) != nullptr);
 }
 
+CachedProperty::CachedProperty(const std::string& property_name)
+    : property_name_(property_name),
+      prop_info_(nullptr),
+      looked_up_(false),
+      area_serial_(0),
+      read_(false),
+      serial_(0) {}
+
+void CachedProperty::Callback(void* cookie, const char*, const char* value, unsigned serial) {
+  CachedProperty* instance = reinterpret_cast<CachedProperty*>(cookie);
+  instance->cached_value_ = value;
+  instance->serial_ = serial;
+}
+
+const char* CachedProperty::Get(bool* changed) {
+  if (changed != nullptr) *changed = false;
+
+  if (prop_info_ == nullptr) {
+    // Properties can't be removed, so a property that can't be found stays
+    // missing until some property is added, which moves the area serial.
+    // Read it before looking, so that a property added meanwhile isn't missed.
+    uint32_t area_serial = __system_property_area_serial();
+    if (looked_up_ && area_serial == area_serial_) return nullptr;
+    looked_up_ = true;
+    area_serial_ = area_serial;
+    prop_info_ = __system_property_find(property_name_.c_str());
+    if (prop_info_ == nullptr) return nullptr;
+  }
+
+  if (!read_ || __system_property_serial(prop_info_) != serial_) {
+    std::string old_value;
+    if (changed != nullptr) old_value.swap(cached_value_);
+    __system_property_read_callback(prop_info_, Callback, this);
+    if (changed != nullptr) *changed = !read_ || old_value != cached_value_;
+    read_ = true;
+  }
+  return cached_value_.c_str();
+}
+
 }  // namespace base
 }  // namespace android
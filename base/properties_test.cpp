@@ -204,3 +204,38 @@ TEST(properties, WaitForPropertyCreation_timeout) {
   // Upper bounds on timing are inherently flaky, but let's try...
   ASSERT_LT(std::chrono::duration_cast<std::chrono::milliseconds>(t1 - t0), 600ms);
 }
+
+TEST(properties, CachedProperty) {
+  android::base::SetProperty("debug.libbase.property_test", "one");
+  android::base::CachedProperty cached("debug.libbase.property_test");
+  ASSERT_EQ("debug.libbase.property_test", cached.Name());
+
+  bool changed;
+  ASSERT_STREQ("one", cached.Get(&changed));
+  ASSERT_TRUE(changed);
+  ASSERT_STREQ("one", cached.Get(&changed));
+  ASSERT_FALSE(changed);
+
+  android::base::SetProperty("debug.libbase.property_test", "two");
+  ASSERT_STREQ("two", cached.Get(&changed));
+  ASSERT_TRUE(changed);
+  ASSERT_STREQ("two", cached.Get());
+
+  // Rewriting the same value moves the serial but isn't a change.
+  android::base::SetProperty("debug.libbase.property_test", "two");
+  ASSERT_STREQ("two", cached.Get(&changed));
+  ASSERT_FALSE(changed);
+
+  android::base::SetProperty("debug.libbase.property_test", "");
+  ASSERT_STREQ("", cached.Get(&changed));
+  ASSERT_TRUE(changed);
+}
+
+TEST(properties, CachedProperty_missing) {
+  android::base::CachedProperty cached("this.property.does.not.exist");
+  bool changed = true;
+  ASSERT_EQ(nullptr, cached.Get(&changed));
+  ASSERT_FALSE(changed);
+  ASSERT_EQ(nullptr, cached.Get(&changed));
+  ASSERT_FALSE(changed);
+}
@@ -0,0 +1,121 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "android-base/ring_queue.h"
+
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+namespace android {
+namespace base {
+
+TEST(RingQueueTest, SpscPushPop) {
+  SpscQueue<int> queue(3);
+  ASSERT_EQ(4U, queue.capacity());
+  int value;
+  ASSERT_FALSE(queue.TryPop(&value));
+  // Go around the ring a few times.
+  for (int i = 0; i < 10; ++i) {
+    for (int j = 0; j < 4; ++j) {
+      ASSERT_TRUE(queue.TryPush(i * 4 + j));
+    }
+    ASSERT_FALSE(queue.TryPush(-1));
+    ASSERT_EQ(4U, queue.size());
+    for (int j = 0; j < 4; ++j) {
+      ASSERT_TRUE(queue.TryPop(&value));
+      ASSERT_EQ(i * 4 + j, value);
+    }
+    ASSERT_FALSE(queue.TryPop(&value));
+  }
+}
+
+TEST(RingQueueTest, SpscFullPushKeepsValue) {
+  SpscQueue<std::unique_ptr<int>> queue(1);
+  ASSERT_TRUE(queue.TryPush(std::make_unique<int>(1)));
+  auto second = std::make_unique<int>(2);
+  ASSERT_FALSE(queue.TryPush(std::move(second)));
+  ASSERT_NE(nullptr, second) << "a failed push moved from its argument";
+  std::unique_ptr<int> popped;
+  ASSERT_TRUE(queue.TryPop(&popped));
+  ASSERT_EQ(1, *popped);
+}
+
+TEST(RingQueueTest, SpscThreads) {
+  static constexpr int kCount = 1000000;
+  SpscQueue<int> queue(64);
+  std::thread producer([&queue]() {
+    for (int i = 0; i < kCount; ++i) {
+      while (!queue.TryPush(i)) std::this_thread::yield();
+    }
+  });
+  for (int i = 0; i < kCount; ++i) {
+    int value;
+    while (!queue.TryPop(&value)) std::this_thread::yield();
+    ASSERT_EQ(i, value);
+  }
+  producer.join();
+}
+
+TEST(RingQueueTest, MpscPushPop) {
+  MpscQueue<int> queue(4);
+  int value;
+  ASSERT_FALSE(queue.TryPop(&value));
+  for (int i = 0; i < 10; ++i) {
+    for (int j = 0; j < 4; ++j) {
+      ASSERT_TRUE(queue.TryPush(i * 4 + j));
+    }
+    ASSERT_FALSE(queue.TryPush(-1));
+    for (int j = 0; j < 4; ++j) {
+      ASSERT_TRUE(queue.TryPop(&value));
+      ASSERT_EQ(i * 4 + j, value);
+    }
+    ASSERT_FALSE(queue.TryPop(&value));
+  }
+}
+
+TEST(RingQueueTest, MpscThreads) {
+  static constexpr int kProducers = 4;
+  static constexpr int kCount = 200000;
+  MpscQueue<int> queue(64);
+  std::vector<std::thread> producers;
+  for (int p = 0; p < kProducers; ++p) {
+    producers.emplace_back([&queue, p]() {
+      for (int i = 0; i < kCount; ++i) {
+        while (!queue.TryPush(p * kCount + i)) std::this_thread::yield();
+      }
+    });
+  }
+  // Every producer's values must come out in its own order.
+  std::vector<int> next(kProducers, 0);
+  for (int received = 0; received < kProducers * kCount; ++received) {
+    int value;
+    while (!queue.TryPop(&value)) std::this_thread::yield();
+    int p = value / kCount;
+    ASSERT_EQ(next[p], value % kCount) << "producer " << p;
+    ++next[p];
+  }
+  for (auto& producer : producers) {
+    producer.join();
+  }
+  int value;
+  ASSERT_FALSE(queue.TryPop(&value));
+}
+
+}  // namespace base
+}  // namespace android
@@ -18,51 +18,72 @@
 
 #include <stdio.h>
 
+#include <algorithm>
 #include <string>
 
 namespace android {
 namespace base {
 
+// Spare capacity worth formatting into directly rather than into a stack
+// buffer, and the most of it to use for a first attempt: the string has to be
+// resized, i.e. zero filled, up to that before vsnprintf can write there.
+static constexpr size_t kMinInPlace = 128;
+static constexpr size_t kMaxInPlace = 256;
+
 void StringAppendV(std::string* dst, const char* format, va_list ap) {
-  // First try with a small fixed size buffer
-  char space[1024];
+  size_t old_size = dst->size();
+  size_t spare = dst->capacity() - old_size;
 
   // It's possible for methods that use a va_list to invalidate
   // the data in it upon use.  The fix is to make a copy
   // of the structure before using it and use that copy instead.
   va_list backup_ap;
-  va_copy(backup_ap, ap);
-  int result = vsnprintf(space, sizeof(space), format, backup_ap);
-  va_end(backup_ap);
-
-  if (result < static_cast<int>(sizeof(space))) {
-    if (result >= 0) {
+  int result;
+  if (spare >= kMinInPlace) {
+    // Format straight into the string's capacity, saving a copy. vsnprintf
+    // writes its terminating \0 over the string's own.
+    size_t available = std::min(spare, kMaxInPlace);
+    dst->resize(old_size + available);
+    va_copy(backup_ap, ap);
+    result = vsnprintf(&(*dst)[old_size], available + 1, format, backup_ap);
+    va_end(backup_ap);
+    if (result < 0) {
+      // Just an error.
+      dst->resize(old_size);
+      return;
+    }
+    dst->resize(old_size + result);
+    if (static_cast<size_t>(result) <= available) {
       // Normal case -- everything fit.
-      dst->append(space, result);
       return;
     }
-
+  } else {
+    // Try with a small fixed size buffer first, rather than growing the
+    // string for output that may well fit in its small string storage.
+    char space[1024];
+    va_copy(backup_ap, ap);
+    result = vsnprintf(space, sizeof(space), format, backup_ap);
+    va_end(backup_ap);
     if (result < 0) {
       // Just an error.
       return;
     }
+    if (result < static_cast<int>(sizeof(space))) {
+      // Normal case -- everything fit.
+      dst->append(space, result);
+      return;
+    }
+    dst->resize(old_size + result);
   }
 
-  // Increase the buffer size to the size requested by vsnprintf,
-  // plus one for the closing \0.
-  int length = result + 1;
-  char* buf = new char[length];
-
-  // Restore the va_list before we use it again
+  // dst now has room for the result vsnprintf asked for; format it again,
+  // directly in place. The \0 goes where the string's own does.
   va_copy(backup_ap, ap);
-  result = vsnprintf(buf, length, format, backup_ap);
+  int second = vsnprintf(&(*dst)[old_size], result + 1, format, backup_ap);
   va_end(backup_ap);
-
-  if (result >= 0 && result < length) {
-    // It fit
-    dst->append(buf, result);
+  if (second != result) {
+    dst->resize(old_size);
   }
-  delete[] buf;
 }
 
 std::string StringPrintf(const char* fmt, ...) {
@@ -58,3 +58,22 @@ TEST(StringPrintfTest, At1024) {
 TEST(StringPrintfTest, At1025) {
   TestN(1025);
 }
+
+TEST(StringPrintfTest, StringAppendFInPlace) {
+  // Enough spare capacity to format straight into the string.
+  std::string s("a");
+  s.reserve(4096);
+  android::base::StringAppendF(&s, "%s-%d", "b", 42);
+  EXPECT_EQ("ab-42", s);
+
+  std::string big(3000, 'x');
+  android::base::StringAppendF(&s, "%s!", big.c_str());
+  EXPECT_EQ("ab-42" + big + "!", s);
+}
+
+TEST(StringPrintfTest, StringAppendFLong) {
+  std::string s("prefix");
+  std::string big(5000, 'y');
+  android::base::StringAppendF(&s, "[%s]", big.c_str());
+  EXPECT_EQ("prefix[" + big + "]", s);
+}
@@ -38,7 +38,7 @@ std::vector<std::string> Split(const std::string& s,
   size_t found;
   while (true) {
     found = s.find_first_of(delimiters, base);
-    result.push_back(s.substr(base, found - base));
+    result.emplace_back(s, base, found - base);
     if (found == s.npos) break;
     base = found + 1;
   }
@@ -80,12 +80,76 @@ std::string Trim(const std::string& s) {
   return s.substr(start_index, end_index - start_index + 1);
 }
 
-// These cases are probably the norm, so we mark them extern in the header to
-// aid compile time and binary size.
-template std::string Join(const std::vector<std::string>&, char);
-template std::string Join(const std::vector<const char*>&, char);
-template std::string Join(const std::vector<std::string>&, const std::string&);
-template std::string Join(const std::vector<const char*>&, const std::string&);
+static size_t JoinLength(const std::string& s) {
+  return s.size();
+}
+
+static size_t JoinLength(const char* s) {
+  return strlen(s);
+}
+
+template <typename T>
+static std::string JoinStrings(const std::vector<T>& things, const char* separator,
+                               size_t separator_length) {
+  if (things.empty()) {
+    return "";
+  }
+
+  size_t length = separator_length * (things.size() - 1);
+  for (const auto& thing : things) {
+    length += JoinLength(thing);
+  }
+  std::string result;
+  result.reserve(length);
+  result.append(things[0]);
+  for (size_t i = 1; i < things.size(); ++i) {
+    result.append(separator, separator_length);
+    result.append(things[i]);
+  }
+  return result;
+}
+
+template <>
+std::string Join(const std::vector<std::string>& things, char separator) {
+  return JoinStrings(things, &separator, 1);
+}
+
+template <>
+std::string Join(const std::vector<const char*>& things, char separator) {
+  return JoinStrings(things, &separator, 1);
+}
+
+template <>
+std::string Join(const std::vector<std::string>& things, const char* separator) {
+  return JoinStrings(things, separator, strlen(separator));
+}
+
+template <>
+std::string Join(const std::vector<const char*>& things, const char* separator) {
+  return JoinStrings(things, separator, strlen(separator));
+}
+
+template <>
+std::string Join(const std::vector<std::string>& things, std::string separator) {
+  return JoinStrings(things, separator.data(), separator.size());
+}
+
+template <>
+std::string Join(const std::vector<const char*>& things, std::string separator) {
+  return JoinStrings(things, separator.data(), separator.size());
+}
+
+template <>
+std::string Join<std::vector<std::string>, const std::string&>(
+    const std::vector<std::string>& things, const std::string& separator) {
+  return JoinStrings(things, separator.data(), separator.size());
+}
+
+template <>
+std::string Join<std::vector<const char*>, const std::string&>(
+    const std::vector<const char*>& things, const std::string& separator) {
+  return JoinStrings(things, separator.data(), separator.size());
+}
 
 bool StartsWith(const std::string& s, const char* prefix) {
   return strncmp(s.c_str(), prefix, strlen(prefix)) == 0;
@@ -0,0 +1,97 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <string>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+#include "android-base/stringprintf.h"
+#include "android-base/strings.h"
+
+// A typical /proc/<pid>/stat style line.
+static const char kLine[] =
+    "1234 (surfaceflinger) S 1 1234 0 0 -1 1077936384 45683 0 12 0 2345 1876 0 0 "
+    "-2 0 21 0 1640 2154397696 5917 18446744073709551615 1 1 0 0 0 0 0 4096 17663";
+
+static void BM_StringPrintf_short(benchmark::State& state) {
+  while (state.KeepRunning()) {
+    benchmark::DoNotOptimize(android::base::StringPrintf("%d:%s", 42, "value"));
+  }
+}
+BENCHMARK(BM_StringPrintf_short);
+
+static void BM_StringPrintf_long(benchmark::State& state) {
+  std::string arg(state.range(0), 'x');
+  while (state.KeepRunning()) {
+    benchmark::DoNotOptimize(android::base::StringPrintf("[%s]", arg.c_str()));
+  }
+}
+BENCHMARK(BM_StringPrintf_long)->Arg(256)->Arg(2048);
+
+// Appending to a string that already has room, as when building up a dump.
+static void BM_StringAppendF_reserved(benchmark::State& state) {
+  std::string s;
+  s.reserve(4096);
+  while (state.KeepRunning()) {
+    s.clear();
+    for (int i = 0; i < 16; ++i) {
+      android::base::StringAppendF(&s, "  entry %d: %s\n", i, "some value");
+    }
+    benchmark::DoNotOptimize(s.data());
+  }
+}
+BENCHMARK(BM_StringAppendF_reserved);
+
+static void BM_Split(benchmark::State& state) {
+  std::string line(kLine);
+  while (state.KeepRunning()) {
+    benchmark::DoNotOptimize(android::base::Split(line, " "));
+  }
+}
+BENCHMARK(BM_Split);
+
+#if __cplusplus > 201402L
+static void BM_SplitPieces(benchmark::State& state) {
+  std::string line(kLine);
+  while (state.KeepRunning()) {
+    size_t total = 0;
+    for (std::string_view piece : android::base::SplitPieces(line, " ")) {
+      total += piece.size();
+    }
+    benchmark::DoNotOptimize(total);
+  }
+}
+BENCHMARK(BM_SplitPieces);
+#endif
+
+static void BM_Join_char(benchmark::State& state) {
+  std::vector<std::string> pieces = android::base::Split(kLine, " ");
+  while (state.KeepRunning()) {
+    benchmark::DoNotOptimize(android::base::Join(pieces, ' '));
+  }
+}
+BENCHMARK(BM_Join_char);
+
+static void BM_Join_string(benchmark::State& state) {
+  std::vector<std::string> pieces = android::base::Split(kLine, " ");
+  while (state.KeepRunning()) {
+    benchmark::DoNotOptimize(android::base::Join(pieces, ", "));
+  }
+}
+BENCHMARK(BM_Join_string);
+
+BENCHMARK_MAIN();
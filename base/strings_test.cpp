@@ -22,6 +22,7 @@
 #include <vector>
 #include <set>
 #include <unordered_set>
+#include <utility>
 
 TEST(strings, split_empty) {
   std::vector<std::string> parts = android::base::Split("", ",");
@@ -75,6 +76,66 @@ TEST(strings, split_any_with_empty_part) {
   ASSERT_EQ("bar", parts[2]);
 }
 
+#if __cplusplus > 201402L
+static std::vector<std::string> SplitPiecesToVector(std::string_view s,
+                                                    std::string_view delimiters) {
+  std::vector<std::string> result;
+  for (std::string_view piece : android::base::SplitPieces(s, delimiters)) {
+    result.emplace_back(piece);
+  }
+  return result;
+}
+
+TEST(strings, split_pieces_matches_split) {
+  const std::pair<std::string, std::string> cases[] = {
+    {"", ","},
+    {"foo", ","},
+    {"foo,bar,baz", ","},
+    {"foo,,bar", ","},
+    {"foo,bar,", ","},
+    {",", ","},
+    {"foo:bar,baz", ",:"},
+    {"foo:,bar", ",:"},
+    {std::string("foo\0bar", 7), std::string("\0", 1)},
+  };
+  for (const auto& c : cases) {
+    EXPECT_EQ(android::base::Split(c.first, c.second), SplitPiecesToVector(c.first, c.second))
+        << "splitting \"" << c.first << "\" on \"" << c.second << "\"";
+  }
+}
+
+TEST(strings, split_pieces_views_into_input) {
+  std::string s("foo,bar");
+  auto pieces = android::base::SplitPieces(s, ",");
+  auto it = pieces.begin();
+  ASSERT_EQ(s.data(), (*it).data());
+  ++it;
+  ASSERT_EQ(s.data() + 4, (*it).data());
+  ++it;
+  ASSERT_TRUE(it == pieces.end());
+}
+
+static std::vector<std::string> LinesToVector(std::string_view s) {
+  std::vector<std::string> result;
+  for (std::string_view line : android::base::Lines(s)) {
+    result.emplace_back(line);
+  }
+  return result;
+}
+
+TEST(strings, lines) {
+  EXPECT_EQ(std::vector<std::string>(), LinesToVector(""));
+  EXPECT_EQ(std::vector<std::string>({""}), LinesToVector("\n"));
+  EXPECT_EQ(std::vector<std::string>({"foo"}), LinesToVector("foo"));
+  EXPECT_EQ(std::vector<std::string>({"foo"}), LinesToVector("foo\n"));
+  EXPECT_EQ(std::vector<std::string>({"foo", "bar"}), LinesToVector("foo\nbar"));
+  EXPECT_EQ(std::vector<std::string>({"foo", "bar"}), LinesToVector("foo\nbar\n"));
+  EXPECT_EQ(std::vector<std::string>({"foo", "", "bar", ""}), LinesToVector("foo\n\nbar\n\n"));
+  EXPECT_EQ(std::vector<std::string>({std::string("a\0b", 3)}),
+            LinesToVector(std::string_view("a\0b\n", 4)));
+}
+#endif
+
 TEST(strings, trim_empty) {
   ASSERT_EQ("", android::base::Trim(""));
 }
@@ -123,6 +184,20 @@ TEST(strings, join_separator_in_vector) {
   ASSERT_EQ(",,,", android::base::Join(list, ','));
 }
 
+TEST(strings, join_string_separator) {
+  std::vector<std::string> list = {"foo", "bar", "baz"};
+  ASSERT_EQ("foo, bar, baz", android::base::Join(list, ", "));
+  ASSERT_EQ("foo, bar, baz", android::base::Join(list, std::string(", ")));
+  ASSERT_EQ("foobarbaz", android::base::Join(list, ""));
+}
+
+TEST(strings, join_c_strings) {
+  std::vector<const char*> list = {"foo", "", "bar"};
+  ASSERT_EQ("foo,,bar", android::base::Join(list, ','));
+  ASSERT_EQ("foo::::bar", android::base::Join(list, "::"));
+  ASSERT_EQ("foo--bar", android::base::Join(list, std::string("-")));
+}
+
 TEST(strings, join_simple_ints) {
   std::set<int> list = {1, 2, 3};
   ASSERT_EQ("1,2,3", android::base::Join(list, ','));
@@ -0,0 +1,148 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "android-base/thread_pool.h"
+
+#if defined(__linux__)
+#include <sched.h>
+#endif
+
+#include <utility>
+
+namespace android {
+namespace base {
+
+// The pool and index of the worker running on this thread, if any.
+static thread_local ThreadPool* current_pool = nullptr;
+static thread_local size_t current_index = 0;
+
+static void SetAffinity(int cpu) {
+#if defined(__linux__)
+  if (cpu < 0 || cpu >= CPU_SETSIZE) return;
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  CPU_SET(cpu, &set);
+  // Only a hint, so failure (e.g. an offline cpu) is fine.
+  sched_setaffinity(0, sizeof(set), &set);
+#else
+  (void)cpu;
+#endif
+}
+
+ThreadPool::ThreadPool(size_t threads, const std::vector<int>& cpus)
+    : next_worker_(0), queued_(0), outstanding_(0), stopping_(false) {
+  if (threads == 0) threads = 1;
+  workers_.reserve(threads);
+  for (size_t i = 0; i < threads; ++i) {
+    workers_.emplace_back(new Worker);
+  }
+  // Start the threads only once workers_ is complete, since they steal from
+  // each other.
+  for (size_t i = 0; i < threads; ++i) {
+    int cpu = cpus.empty() ? -1 : cpus[i % cpus.size()];
+    workers_[i]->thread = std::thread(&ThreadPool::Run, this, i, cpu);
+  }
+}
+
+ThreadPool::~ThreadPool() {
+  Wait();
+  {
+    std::lock_guard<std::mutex> lock(idle_lock_);
+    stopping_ = true;
+  }
+  work_available_.notify_all();
+  for (auto& worker : workers_) {
+    worker->thread.join();
+  }
+}
+
+void ThreadPool::Submit(std::function<void()> task) {
+  outstanding_.fetch_add(1, std::memory_order_relaxed);
+  if (current_pool == this) {
+    Worker* worker = workers_[current_index].get();
+    std::lock_guard<std::mutex> lock(worker->lock);
+    worker->tasks.push_front(std::move(task));
+  } else {
+    size_t index = next_worker_.fetch_add(1, std::memory_order_relaxed) % workers_.size();
+    Worker* worker = workers_[index].get();
+    std::lock_guard<std::mutex> lock(worker->lock);
+    worker->tasks.push_back(std::move(task));
+  }
+  {
+    // Under the lock, so that a worker can't check queued_ and go to sleep
+    // between our increment and our notification.
+    std::lock_guard<std::mutex> lock(idle_lock_);
+    queued_.fetch_add(1, std::memory_order_relaxed);
+  }
+  work_available_.notify_one();
+}
+
+void ThreadPool::Wait() {
+  std::unique_lock<std::mutex> lock(idle_lock_);
+  all_done_.wait(lock, [this]() { return outstanding_.load(std::memory_order_acquire) == 0; });
+}
+
+bool ThreadPool::PopLocal(size_t index, std::function<void()>* task) {
+  Worker* worker = workers_[index].get();
+  std::lock_guard<std::mutex> lock(worker->lock);
+  if (worker->tasks.empty()) return false;
+  *task = std::move(worker->tasks.front());
+  worker->tasks.pop_front();
+  return true;
+}
+
+bool ThreadPool::Steal(size_t index, std::function<void()>* task) {
+  for (size_t i = 1; i < workers_.size(); ++i) {
+    Worker* victim = workers_[(index + i) % workers_.size()].get();
+    std::lock_guard<std::mutex> lock(victim->lock);
+    if (victim->tasks.empty()) continue;
+    *task = std::move(victim->tasks.back());
+    victim->tasks.pop_back();
+    return true;
+  }
+  return false;
+}
+
+void ThreadPool::Run(size_t index, int cpu) {
+  current_pool = this;
+  current_index = index;
+  SetAffinity(cpu);
+
+  while (true) {
+    std::function<void()> task;
+    if (PopLocal(index, &task) || Steal(index, &task)) {
+      // queued_ may briefly go negative, when a task is taken before Submit
+      // has counted it.
+      queued_.fetch_sub(1, std::memory_order_relaxed);
+      task();
+      task = nullptr;
+      if (outstanding_.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+        std::lock_guard<std::mutex> lock(idle_lock_);
+        all_done_.notify_all();
+      }
+      continue;
+    }
+
+    std::unique_lock<std::mutex> lock(idle_lock_);
+    work_available_.wait(lock, [this]() {
+      return stopping_ || queued_.load(std::memory_order_relaxed) > 0;
+    });
+    if (stopping_ && queued_.load(std::memory_order_relaxed) <= 0) return;
+  }
+}
+
+}  // namespace base
+}  // namespace android
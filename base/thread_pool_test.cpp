@@ -0,0 +1,92 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "android-base/thread_pool.h"
+
+#include <atomic>
+#include <functional>
+
+#include <gtest/gtest.h>
+
+namespace android {
+namespace base {
+
+TEST(ThreadPoolTest, RunsEveryTask) {
+  std::atomic<int> sum(0);
+  ThreadPool pool(4);
+  ASSERT_EQ(4U, pool.size());
+  for (int i = 1; i <= 1000; ++i) {
+    pool.Submit([&sum, i]() { sum += i; });
+  }
+  pool.Wait();
+  ASSERT_EQ(500500, sum);
+
+  // The pool keeps working after a Wait().
+  pool.Submit([&sum]() { sum = 0; });
+  pool.Wait();
+  ASSERT_EQ(0, sum);
+}
+
+TEST(ThreadPoolTest, WaitIncludesNestedTasks) {
+  std::atomic<int> leaves(0);
+  ThreadPool pool(3);
+  // A binary tree of depth 10, each node submitting its children.
+  std::function<void(int)> node = [&](int depth) {
+    if (depth == 0) {
+      ++leaves;
+      return;
+    }
+    pool.Submit([&node, depth]() { node(depth - 1); });
+    pool.Submit([&node, depth]() { node(depth - 1); });
+  };
+  pool.Submit([&node]() { node(10); });
+  pool.Wait();
+  ASSERT_EQ(1024, leaves);
+}
+
+TEST(ThreadPoolTest, DestructorFinishesTasks) {
+  std::atomic<int> count(0);
+  {
+    ThreadPool pool(2);
+    for (int i = 0; i < 100; ++i) {
+      pool.Submit([&count]() { ++count; });
+    }
+  }
+  ASSERT_EQ(100, count);
+}
+
+TEST(ThreadPoolTest, AffinityHints) {
+  std::atomic<int> count(0);
+  // Cpus that don't exist are ignored.
+  ThreadPool pool(3, {0, 100000, -1});
+  for (int i = 0; i < 30; ++i) {
+    pool.Submit([&count]() { ++count; });
+  }
+  pool.Wait();
+  ASSERT_EQ(30, count);
+}
+
+TEST(ThreadPoolTest, ZeroThreads) {
+  ThreadPool pool(0);
+  ASSERT_EQ(1U, pool.size());
+  bool ran = false;
+  pool.Submit([&ran]() { ran = true; });
+  pool.Wait();
+  ASSERT_TRUE(ran);
+}
+
+}  // namespace base
+}  // namespace android
@@ -18,8 +18,9 @@
 
 #include <dirent.h>
 #include <fcntl.h>
+#include <string.h>
 #include <sys/stat.h>
-#include <utime.h>
+#include <unistd.h>
 
 #include <chrono>
 #include <cstdlib>
@@ -35,6 +36,15 @@ namespace {
 
 const char BOOTSTAT_DATA_DIR[] = "/data/misc/bootstat/";
 
+// The file every event is appended to.  Hidden, so that no event recorded by
+// an older version, as a file of its own, can have its name.
+const char EVENTS_FILE[] = ".events";
+
+// Past this size, the events file is rewritten with only the latest value of
+// each event.  A boot appends a few hundred events, most of them again with
+// the values of that boot.
+const off_t EVENTS_FILE_COMPACT_SIZE = 64 * 1024;
+
 // Given a boot even record file at |path|, extracts the event's relative time
 // from the record into |uptime|.
 bool ParseRecordEventTime(const std::string& path, int32_t* uptime) {
@@ -51,6 +61,11 @@ bool ParseRecordEventTime(const std::string& path, int32_t* uptime) {
   return true;
 }
 
+// Formats the events file line recording |value| for |event|.
+std::string FormatEvent(const std::string& event, int32_t value) {
+  return event + " " + std::to_string(value) + "\n";
+}
+
 }  // namespace
 
 BootEventRecordStore::BootEventRecordStore() {
@@ -63,37 +78,33 @@ void BootEventRecordStore::AddBootEvent(const std::string& event) {
     AddBootEventWithValue(event, uptime.count());
 }
 
-// The implementation of AddBootEventValue makes use of the mtime file
-// attribute to store the value associated with a boot event in order to
-// optimize on-disk size requirements and small-file thrashing.
+// Appending a line to the one events file, rather than creating a file per
+// event, keeps what a boot writes to the data partition down to a few blocks.
 void BootEventRecordStore::AddBootEventWithValue(
     const std::string& event, int32_t value) {
-  std::string record_path = GetBootEventPath(event);
-  int record_fd = creat(record_path.c_str(), S_IRUSR | S_IWUSR);
-  if (record_fd == -1) {
-    PLOG(ERROR) << "Failed to create " << record_path;
+  if (event.empty() || event.find_first_of(" \n") != std::string::npos) {
+    LOG(ERROR) << "Invalid boot event name '" << event << "'";
     return;
   }
 
-  // Fill out the stat structure for |record_path| in order to get the atime to
-  // set in the utime() call.
-  struct stat file_stat;
-  if (stat(record_path.c_str(), &file_stat) == -1) {
-    PLOG(ERROR) << "Failed to read " << record_path;
-    close(record_fd);
-    return;
+  const std::string events_path = GetEventsPath();
+  if (events_fd_ == -1) {
+    struct stat file_stat;
+    if (stat(events_path.c_str(), &file_stat) == 0 &&
+        file_stat.st_size > EVENTS_FILE_COMPACT_SIZE) {
+      Compact();
+    }
+    events_fd_.reset(TEMP_FAILURE_RETRY(
+        open(events_path.c_str(), O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, S_IRUSR | S_IWUSR)));
+    if (events_fd_ == -1) {
+      PLOG(ERROR) << "Failed to open " << events_path;
+      return;
+    }
   }
 
-  // Set the |modtime| of the file to store the value of the boot event while
-  // preserving the |actime| (as read by stat).
-  struct utimbuf times = {/* actime */ file_stat.st_atime, /* modtime */ value};
-  if (utime(record_path.c_str(), &times) == -1) {
-    PLOG(ERROR) << "Failed to set mtime for " << record_path;
-    close(record_fd);
-    return;
+  if (!android::base::WriteStringToFd(FormatEvent(event, value), events_fd_)) {
+    PLOG(ERROR) << "Failed to write " << events_path;
   }
-
-  close(record_fd);
 }
 
 bool BootEventRecordStore::GetBootEvent(
@@ -101,7 +112,18 @@ bool BootEventRecordStore::GetBootEvent(
   CHECK_NE(static_cast<BootEventRecord*>(nullptr), record);
   CHECK(!event.empty());
 
+  const std::map<std::string, int32_t> events = ReadEvents();
+  auto it = events.find(event);
+  if (it != events.end()) {
+    *record = *it;
+    return true;
+  }
+
+  // Recorded by an older version.
   const std::string record_path = GetBootEventPath(event);
+  if (access(record_path.c_str(), F_OK) == -1) {
+    return false;
+  }
   int32_t uptime;
   if (!ParseRecordEventTime(record_path, &uptime)) {
     LOG(ERROR) << "Failed to parse boot time record: " << record_path;
@@ -114,7 +136,7 @@ bool BootEventRecordStore::GetBootEvent(
 
 std::vector<BootEventRecordStore::BootEventRecord> BootEventRecordStore::
     GetAllBootEvents() const {
-  std::vector<BootEventRecord> events;
+  std::map<std::string, int32_t> latest;
 
   std::unique_ptr<DIR, decltype(&closedir)> dir(opendir(store_path_.c_str()), closedir);
 
@@ -122,29 +144,35 @@ std::vector<BootEventRecordStore::BootEventRecord> BootEventRecordStore::
   // so crash out if the record store doesn't exist.
   CHECK_NE(static_cast<DIR*>(nullptr), dir.get());
 
+  // The events recorded by older versions, one file each.
   struct dirent* entry;
   while ((entry = readdir(dir.get())) != NULL) {
     // Only parse regular files.
-    if (entry->d_type != DT_REG) {
+    if (entry->d_type != DT_REG || !strcmp(entry->d_name, EVENTS_FILE)) {
       continue;
     }
 
     const std::string event = entry->d_name;
-    BootEventRecord record;
-    if (!GetBootEvent(event, &record)) {
+    int32_t uptime;
+    if (!ParseRecordEventTime(GetBootEventPath(event), &uptime)) {
       LOG(ERROR) << "Failed to parse boot time event: " << event;
       continue;
     }
 
-    events.push_back(record);
+    latest[event] = uptime;
   }
 
-  return events;
+  for (const auto& event : ReadEvents()) {
+    latest[event.first] = event.second;
+  }
+
+  return std::vector<BootEventRecord>(latest.begin(), latest.end());
 }
 
 void BootEventRecordStore::SetStorePath(const std::string& path) {
   DCHECK_EQ('/', path.back());
   store_path_ = path;
+  events_fd_.reset();
 }
 
 std::string BootEventRecordStore::GetBootEventPath(
@@ -152,3 +180,46 @@ std::string BootEventRecordStore::GetBootEventPath(
   DCHECK_EQ('/', store_path_.back());
   return store_path_ + event;
 }
+
+std::string BootEventRecordStore::GetEventsPath() const {
+  return GetBootEventPath(EVENTS_FILE);
+}
+
+std::map<std::string, int32_t> BootEventRecordStore::ReadEvents() const {
+  std::map<std::string, int32_t> events;
+
+  std::string content;
+  if (!android::base::ReadFileToString(GetEventsPath(), &content)) {
+    return events;
+  }
+
+  size_t start = 0;
+  size_t end;
+  // A line cut short by a crash while appending has no newline, and is left out.
+  while ((end = content.find('\n', start)) != std::string::npos) {
+    size_t space = content.rfind(' ', end);
+    int32_t value;
+    if (space != std::string::npos && space > start &&
+        android::base::ParseInt(content.substr(space + 1, end - space - 1), &value)) {
+      events[content.substr(start, space - start)] = value;
+    }
+    start = end + 1;
+  }
+  return events;
+}
+
+void BootEventRecordStore::Compact() {
+  std::string content;
+  for (const auto& event : ReadEvents()) {
+    content += FormatEvent(event.first, event.second);
+  }
+
+  const std::string events_path = GetEventsPath();
+  const std::string temp_path = events_path + ".tmp";
+  if (!android::base::WriteStringToFile(content, temp_path, S_IRUSR | S_IWUSR, getuid(),
+                                        getgid()) ||
+      rename(temp_path.c_str(), events_path.c_str()) == -1) {
+    PLOG(ERROR) << "Failed to compact " << events_path;
+    unlink(temp_path.c_str());
+  }
+}
@@ -18,14 +18,22 @@
 #define BOOT_EVENT_RECORD_STORE_H_
 
 #include <cstdint>
+#include <map>
 #include <string>
 #include <utility>
 #include <vector>
 #include <android-base/macros.h>
+#include <android-base/unique_fd.h>
 #include <gtest/gtest_prod.h>
 
 // BootEventRecordStore manages the persistence of boot events to the record
 // store and the retrieval of all boot event records from the store.
+//
+// Events are appended to a single file in the store, as "<event> <value>"
+// lines, the last line for an event being its value.  The file is rewritten
+// with only the latest values once it grows past a limit.  Events recorded by
+// older versions, as one file each with the value as its mtime, are still
+// read, and are overridden by what is in the single file.
 class BootEventRecordStore {
  public:
   // A BootEventRecord consists of the event name and the timestamp the event
@@ -56,16 +64,32 @@ class BootEventRecordStore {
   FRIEND_TEST(BootEventRecordStoreTest, AddBootEventWithValue);
   FRIEND_TEST(BootEventRecordStoreTest, GetBootEvent);
   FRIEND_TEST(BootEventRecordStoreTest, GetBootEventNoFileContent);
+  FRIEND_TEST(BootEventRecordStoreTest, ReplaceBootEvent);
+  FRIEND_TEST(BootEventRecordStoreTest, Compact);
+  FRIEND_TEST(BootEventRecordStoreTest, NoFilePerEvent);
 
   // Sets the filesystem path of the record store.
   void SetStorePath(const std::string& path);
 
-  // Constructs the full path of the given boot |event|.
+  // Constructs the full path of the given boot |event|, as older versions
+  // recorded it.
   std::string GetBootEventPath(const std::string& event) const;
 
+  // The path of the file all the events are appended to.
+  std::string GetEventsPath() const;
+
+  // Reads the latest value of every event in the events file.
+  std::map<std::string, int32_t> ReadEvents() const;
+
+  // Rewrites the events file with only the latest value of each event.
+  void Compact();
+
   // The filesystem path of the record store.
   std::string store_path_;
 
+  // The events file, once something was added.
+  android::base::unique_fd events_fd_;
+
   DISALLOW_COPY_AND_ASSIGN(BootEventRecordStore);
 };
 
@@ -230,3 +230,76 @@ TEST_F(BootEventRecordStoreTest, GetBootEventNoFileContent) {
   EXPECT_EQ("devonian", record.first);
   EXPECT_EQ(2718, record.second);
 }
+
+TEST_F(BootEventRecordStoreTest, ReplaceBootEvent) {
+  BootEventRecordStore store;
+  store.SetStorePath(GetStorePathForTesting());
+
+  // Recorded by an older version, and again since.
+  EXPECT_TRUE(CreateEmptyBootEventRecord(store.GetBootEventPath("silurian"), 1));
+  store.AddBootEventWithValue("silurian", 2);
+  store.AddBootEventWithValue("ordovician", 3);
+  store.AddBootEventWithValue("silurian", 4);
+
+  BootEventRecordStore::BootEventRecord record;
+  EXPECT_TRUE(store.GetBootEvent("silurian", &record));
+  EXPECT_EQ(4, record.second);
+
+  auto events = store.GetAllBootEvents();
+  ASSERT_EQ(2U, events.size());
+  EXPECT_EQ(std::make_pair(std::string("ordovician"), 3), events[0]);
+  EXPECT_EQ(std::make_pair(std::string("silurian"), 4), events[1]);
+
+  // Another store, as the next boot would have.
+  BootEventRecordStore next;
+  next.SetStorePath(GetStorePathForTesting());
+  EXPECT_TRUE(next.GetBootEvent("ordovician", &record));
+  EXPECT_EQ(3, record.second);
+}
+
+TEST_F(BootEventRecordStoreTest, Compact) {
+  BootEventRecordStore store;
+  store.SetStorePath(GetStorePathForTesting());
+
+  // Many boots' worth of the same few events.
+  for (int32_t i = 0; i < 10000; ++i) {
+    store.AddBootEventWithValue("cambrian" + std::to_string(i % 10), i);
+  }
+  struct stat file_stat;
+  ASSERT_EQ(0, stat(store.GetEventsPath().c_str(), &file_stat));
+  const off_t before = file_stat.st_size;
+
+  BootEventRecordStore next;
+  next.SetStorePath(GetStorePathForTesting());
+  next.AddBootEventWithValue("cambrian0", -1);
+  ASSERT_EQ(0, stat(store.GetEventsPath().c_str(), &file_stat));
+  EXPECT_LT(file_stat.st_size, before / 100);
+
+  auto events = next.GetAllBootEvents();
+  ASSERT_EQ(10U, events.size());
+  EXPECT_EQ(-1, events[0].second);
+  EXPECT_EQ(9999, events[9].second);
+}
+
+TEST_F(BootEventRecordStoreTest, NoFilePerEvent) {
+  BootEventRecordStore store;
+  store.SetStorePath(GetStorePathForTesting());
+
+  for (int32_t i = 0; i < 100; ++i) {
+    store.AddBootEventWithValue("boottime.init.action.event" + std::to_string(i), i);
+  }
+  // Names that would not survive a line of their own.
+  store.AddBootEventWithValue("two words", 1);
+  store.AddBootEventWithValue("", 1);
+
+  typedef std::unique_ptr<DIR, decltype(&closedir)> ScopedDIR;
+  ScopedDIR dir(opendir(GetStorePathForTesting().c_str()), closedir);
+  ASSERT_NE(nullptr, dir.get());
+  size_t files = 0;
+  struct dirent* entry;
+  while ((entry = readdir(dir.get())) != NULL) {
+    if (entry->d_type == DT_REG) ++files;
+  }
+  EXPECT_EQ(1U, files);
+  EXPECT_EQ(100U, store.GetAllBootEvents().size());
+}
@@ -32,6 +32,7 @@
 #include <vector>
 
 #include <android-base/chrono_utils.h>
+#include <android-base/file.h>
 #include <android-base/logging.h>
 #include <android-base/parseint.h>
 #include <android-base/strings.h>
@@ -231,6 +232,41 @@ void RecordInitBootTimeProp(
   }
 }
 
+// Records the value of every ro.boottime.init property whose name starts with
+// |prefix|, for the properties that there is one of per partition or service.
+void RecordInitBootTimePropsWithPrefix(
+    BootEventRecordStore* boot_event_store, const std::string& prefix) {
+  std::vector<std::string> properties;
+  property_list([](const char* key, const char*, void* cookie) {
+    static_cast<std::vector<std::string>*>(cookie)->emplace_back(key);
+  }, &properties);
+
+  for (const auto& property : properties) {
+    if (android::base::StartsWith(property, prefix.c_str())) {
+      RecordInitBootTimeProp(boot_event_store, property.c_str());
+    }
+  }
+}
+
+// Records what init left in /dev/.boot_timeline when the boot completed, as
+// boottime.init.<name> events: action.<trigger> for the ms its commands ran,
+// service.<name>.start for the ms since boot it was first started, and
+// exec.<name> for the ms init waited for an exec service.
+void RecordInitBootTimeline(BootEventRecordStore* boot_event_store) {
+  std::string timeline;
+  if (!android::base::ReadFileToString("/dev/.boot_timeline", &timeline)) {
+    return;
+  }
+
+  for (const auto& line : android::base::Split(timeline, "\n")) {
+    auto fields = android::base::Split(line, " ");
+    int32_t time_ms;
+    if (fields.size() == 2 && android::base::ParseInt(fields[1], &time_ms)) {
+      boot_event_store->AddBootEventWithValue("boottime.init." + fields[0], time_ms);
+    }
+  }
+}
+
 // A map from bootloader timing stage to the time that stage took during boot.
 typedef std::map<std::string, int32_t> BootloaderTimingMap;
 
@@ -295,6 +331,35 @@ void RecordAbsoluteBootTime(BootEventRecordStore* boot_event_store,
   boot_event_store->AddBootEventWithValue("absolute_boot_time", absolute_total.count());
 }
 
+// Records the steps of the shutdown before this boot, from the last
+// powerctl_shutdown_timeline line init wrote to the kernel log, as
+// shutdown.<step> events of the ms since the shutdown started.  The line only
+// survives the reboot on devices with a console ramoops.
+void RecordShutdownTimeline(BootEventRecordStore* boot_event_store) {
+  static const char kTimelinePrefix[] = "powerctl_shutdown_timeline:";
+
+  std::string console;
+  if (!android::base::ReadFileToString("/sys/fs/pstore/console-ramoops-0", &console) &&
+      !android::base::ReadFileToString("/sys/fs/pstore/console-ramoops", &console)) {
+    return;
+  }
+  size_t start = console.rfind(kTimelinePrefix);
+  if (start == std::string::npos) {
+    return;
+  }
+  start += sizeof(kTimelinePrefix) - 1;
+  std::string timeline = console.substr(start, console.find('\n', start) - start);
+
+  for (const auto& step : android::base::Split(timeline, ",")) {
+    // |step| is of the form 'step=ms'.
+    auto fields = android::base::Split(step, "=");
+    int32_t time_ms;
+    if (fields.size() == 2 && android::base::ParseInt(fields[1], &time_ms)) {
+      boot_event_store->AddBootEventWithValue("shutdown." + fields[0], time_ms);
+    }
+  }
+}
+
 // Records several metrics related to the time it takes to boot the device,
 // including disambiguating boot time on encrypted or non-encrypted devices.
 void RecordBootComplete() {
@@ -347,12 +412,20 @@ void RecordBootComplete() {
   RecordInitBootTimeProp(&boot_event_store, "ro.boottime.init");
   RecordInitBootTimeProp(&boot_event_store, "ro.boottime.init.selinux");
   RecordInitBootTimeProp(&boot_event_store, "ro.boottime.init.cold_boot_wait");
+  // mount_all, and each mount point when they are mounted in parallel.
+  RecordInitBootTimePropsWithPrefix(&boot_event_store, "ro.boottime.init.mount");
+  // The regenerate, handle and restorecon steps of ueventd's cold boot.
+  RecordInitBootTimePropsWithPrefix(&boot_event_store, "ro.boottime.init.coldboot.");
+  // Each action, service start and exec service wait.
+  RecordInitBootTimeline(&boot_event_store);
 
   const BootloaderTimingMap bootloader_timings = GetBootLoaderTimings();
   RecordBootloaderTimings(&boot_event_store, bootloader_timings);
 
   auto uptime_ms = std::chrono::duration_cast<std::chrono::milliseconds>(time_since_epoch);
   RecordAbsoluteBootTime(&boot_event_store, bootloader_timings, uptime_ms);
+
+  RecordShutdownTimeline(&boot_event_store);
 }
 
 // Records the boot_reason metric by querying the ro.boot.bootreason system
@@ -11,6 +11,9 @@
 
 #include <stdarg.h>
 #include <fcntl.h>
+#include <pthread.h>
+
+#include <zlib.h>
 
 #include <private/android_filesystem_config.h>
 
@@ -21,6 +24,14 @@
 ** - dotfiles are ignored
 ** - directories named 'root' are ignored
 ** - device notes, pipes, etc are not supported (error)
+** - the tree is walked first, then -j threads read the small files ahead
+**   of the output while it's written in order; large files are copied in
+**   pieces as they're written
+** - with -l, names with the same source inode (and resulting mode) are
+**   written as hard links: the first has the data, the rest have none, which
+**   is what the kernel's initramfs unpacker expects
+** - with -z, the output is gzipped at that level, the same as piping it
+**   through minigzip
 */
 
 void die(const char *why, ...)
@@ -53,8 +64,34 @@ static char *target_out_path = NULL;
 
 #define TRAILER "TRAILER!!!"
 
+/* Regular files bigger than this are streamed rather than read ahead. */
+#define STREAM_THRESHOLD    (1024 * 1024)
+#define STREAM_CHUNK        (64 * 1024)
+/* How much file data the reader threads may hold ahead of the output. */
+#define READ_AHEAD_LIMIT    (64 * 1024 * 1024)
+#define MAX_THREADS         16
+
 static int verbose = 0;
 static int total_size = 0;
+static int hard_links = 0;
+static gzFile gz_out = NULL;
+
+static void out_write(const void *data, size_t size)
+{
+    if (gz_out) {
+        if (size && gzwrite(gz_out, data, size) != (int) size) die("cannot write output");
+    } else if (size && fwrite(data, size, 1, stdout) != 1) {
+        die("cannot write output");
+    }
+}
+
+static void out_pad(int alignment)
+{
+    static const char zeros[256];
+    int pad = (alignment - (total_size & (alignment - 1))) & (alignment - 1);
+    out_write(zeros, pad);
+    total_size += pad;
+}
 
 static void fix_stat(const char *path, struct stat *s)
 {
@@ -88,29 +125,31 @@ static void fix_stat(const char *path, struct stat *s)
     }
 }
 
-static void _eject(struct stat *s, char *out, int olen, char *data, unsigned datasize)
+// Nothing is special about this value, just picked something in the
+// approximate range that was being used already, and avoiding small
+// values which may be special.
+static unsigned next_inode = 300000;
+
+// Writes the header for |out| with the already fixed up |s|, leaving the
+// output where |datasize| bytes of data are to go.
+static void _eject_header(struct stat *s, const char *out, int olen, unsigned ino,
+                          unsigned nlink, unsigned datasize)
 {
-    // Nothing is special about this value, just picked something in the
-    // approximate range that was being used already, and avoiding small
-    // values which may be special.
-    static unsigned next_inode = 300000;
-
-    while(total_size & 3) {
-        total_size++;
-        putchar(0);
-    }
+    char header[6 + 8*13 + 1];
+
+    out_pad(4);
 
-    fix_stat(out, s);
 //    fprintf(stderr, "_eject %s: mode=0%o\n", out, s->st_mode);
 
-    printf("%06x%08x%08x%08x%08x%08x%08x"
-           "%08x%08x%08x%08x%08x%08x%08x%s%c",
+    snprintf(header, sizeof(header),
+           "%06x%08x%08x%08x%08x%08x%08x"
+           "%08x%08x%08x%08x%08x%08x%08x",
            0x070701,
-           next_inode++,  //  s.st_ino,
+           ino,  //  s.st_ino,
            s->st_mode,
            0, // s.st_uid,
            0, // s.st_gid,
-           1, // s.st_nlink,
+           nlink, // s.st_nlink,
            0, // s.st_mtime,
            datasize,
            0, // volmajor
@@ -118,22 +157,25 @@ static void _eject(struct stat *s, char *out, int olen, char *data, unsigned dat
            0, // devmajor
            0, // devminor,
            olen + 1,
-           0,
-           out,
            0
            );
+    out_write(header, sizeof(header) - 1);
+    out_write(out, olen + 1);
 
     total_size += 6 + 8*13 + olen + 1;
 
     if(strlen(out) != (unsigned int)olen) die("ACK!");
 
-    while(total_size & 3) {
-        total_size++;
-        putchar(0);
-    }
+    out_pad(4);
+}
+
+static void _eject(struct stat *s, const char *out, int olen, const char *data,
+                   unsigned datasize)
+{
+    _eject_header(s, out, olen, next_inode++, 1, datasize);
 
     if(datasize) {
-        fwrite(data, datasize, 1, stdout);
+        out_write(data, datasize);
         total_size += datasize;
     }
 }
@@ -142,12 +184,207 @@ static void _eject_trailer()
 {
     struct stat s;
     memset(&s, 0, sizeof(s));
+    fix_stat(TRAILER, &s);
     _eject(&s, TRAILER, 10, 0, 0);
 
-    while(total_size & 0xff) {
-        total_size++;
-        putchar(0);
+    out_pad(0x100);
+}
+
+/* Everything to be archived, in output order. */
+struct entry {
+    char *in;
+    char *out;
+    struct stat s;      /* fixed up by fix_stat */
+    char *data;         /* symlink target, or a read ahead file */
+    unsigned size;
+    int loaded;
+    int link_to;        /* -1, or the entry with the data */
+    unsigned nlink;
+    unsigned ino;
+};
+
+static struct entry *entries = NULL;
+static int entry_count = 0;
+static int entries_allocated = 0;
+
+static void add_entry(const char *in, const char *out, struct stat *s)
+{
+    struct entry *e;
+
+    if (entry_count == entries_allocated) {
+        entries_allocated = entries_allocated ? entries_allocated * 2 : 256;
+        entries = realloc(entries, entries_allocated * sizeof(*entries));
+        if (entries == NULL) die("failed to reallocate entries (size %d)", entries_allocated);
     }
+    e = &entries[entry_count++];
+    memset(e, 0, sizeof(*e));
+    e->in = strdup(in);
+    e->out = strdup(out);
+    if (e->in == NULL || e->out == NULL) die("failed to strdup \"%s\"", in);
+    e->s = *s;
+    e->link_to = -1;
+    e->nlink = 1;
+
+    fix_stat(out, &e->s);
+}
+
+/* Shared between the writing thread and the readers. */
+static pthread_mutex_t read_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t read_cond = PTHREAD_COND_INITIALIZER;
+static int next_read = 0;
+static int next_write = 0;
+static size_t read_ahead = 0;
+
+static int read_ahead_wanted(const struct entry *e)
+{
+    return S_ISREG(e->s.st_mode) && e->link_to < 0 && e->s.st_size > 0 &&
+           e->s.st_size <= STREAM_THRESHOLD;
+}
+
+static void read_file(struct entry *e)
+{
+    int fd = open(e->in, O_RDONLY);
+    if(fd < 0) die("cannot open '%s' for read", e->in);
+
+    e->data = (char*) malloc(e->size);
+    if(e->data == 0) die("cannot allocate %d bytes", e->size);
+
+    if(read(fd, e->data, e->size) != (ssize_t) e->size) {
+        die("cannot read %d bytes", e->size);
+    }
+    close(fd);
+}
+
+static void *reader_thread(void *unused)
+{
+    (void) unused;
+
+    pthread_mutex_lock(&read_lock);
+    while (1) {
+        int i;
+        struct entry *e;
+
+        while (next_read < entry_count && !read_ahead_wanted(&entries[next_read])) {
+            ++next_read;
+        }
+        if (next_read == entry_count) break;
+        i = next_read++;
+        e = &entries[i];
+
+        // The entry the output is waiting for is always read, so it can't be
+        // held up by the ones behind it.
+        while (read_ahead + e->size > READ_AHEAD_LIMIT && i != next_write) {
+            pthread_cond_wait(&read_cond, &read_lock);
+        }
+        read_ahead += e->size;
+        pthread_mutex_unlock(&read_lock);
+
+        read_file(e);
+
+        pthread_mutex_lock(&read_lock);
+        e->loaded = 1;
+        pthread_cond_broadcast(&read_cond);
+    }
+    pthread_mutex_unlock(&read_lock);
+    return NULL;
+}
+
+static void stream_file(struct entry *e)
+{
+    char buf[STREAM_CHUNK];
+    unsigned left = e->size;
+    int fd = open(e->in, O_RDONLY);
+    if(fd < 0) die("cannot open '%s' for read", e->in);
+
+    while (left > 0) {
+        ssize_t n = read(fd, buf, left < sizeof(buf) ? left : sizeof(buf));
+        if (n <= 0) die("cannot read %d bytes", e->size);
+        out_write(buf, n);
+        left -= n;
+    }
+    close(fd);
+    total_size += e->size;
+}
+
+static void write_entry(struct entry *e, int threads)
+{
+    if (e->link_to >= 0) {
+        e->ino = entries[e->link_to].ino;
+        _eject_header(&e->s, e->out, strlen(e->out), e->ino, e->nlink, 0);
+        return;
+    }
+    e->ino = next_inode++;
+    _eject_header(&e->s, e->out, strlen(e->out), e->ino, e->nlink, e->size);
+
+    if (read_ahead_wanted(e)) {
+        if (threads > 1) {
+            pthread_mutex_lock(&read_lock);
+            while (!e->loaded) {
+                pthread_cond_wait(&read_cond, &read_lock);
+            }
+            pthread_mutex_unlock(&read_lock);
+        } else {
+            read_file(e);
+        }
+        out_write(e->data, e->size);
+        total_size += e->size;
+    } else if (S_ISREG(e->s.st_mode)) {
+        stream_file(e);
+    } else if (e->size) {
+        out_write(e->data, e->size);
+        total_size += e->size;
+    }
+
+    free(e->data);
+    e->data = NULL;
+    if (threads > 1 && read_ahead_wanted(e)) {
+        pthread_mutex_lock(&read_lock);
+        read_ahead -= e->size;
+        pthread_cond_broadcast(&read_cond);
+        pthread_mutex_unlock(&read_lock);
+    }
+}
+
+static int compare_inode_keys(const struct entry* ea, const struct entry* eb) {
+    if (ea->s.st_dev != eb->s.st_dev) return ea->s.st_dev < eb->s.st_dev ? -1 : 1;
+    if (ea->s.st_ino != eb->s.st_ino) return ea->s.st_ino < eb->s.st_ino ? -1 : 1;
+    if (ea->s.st_mode != eb->s.st_mode) return ea->s.st_mode < eb->s.st_mode ? -1 : 1;
+    return 0;
+}
+
+static int compare_inodes(const void* a, const void* b) {
+    int ia = *(const int*)a;
+    int ib = *(const int*)b;
+    int r = compare_inode_keys(&entries[ia], &entries[ib]);
+    return r ? r : ia - ib;
+}
+
+// Groups the regular files sharing a source inode and mode, so that only the
+// first of each group in the output is written with data.
+static void find_hard_links()
+{
+    int i, j, k, count = 0;
+    int *linked = malloc((entry_count + 1) * sizeof(int));
+    if (linked == NULL) die("failed to allocate hard link array");
+
+    for (i = 0; i < entry_count; ++i) {
+        if (S_ISREG(entries[i].s.st_mode) && entries[i].s.st_nlink > 1) {
+            linked[count++] = i;
+        }
+    }
+    qsort(linked, count, sizeof(int), compare_inodes);
+
+    for (i = 0; i < count; i = j) {
+        struct entry *first = &entries[linked[i]];
+        for (j = i + 1; j < count &&
+             compare_inode_keys(first, &entries[linked[j]]) == 0; ++j) {
+        }
+        for (k = i; k < j; ++k) {
+            entries[linked[k]].nlink = j - i;
+            if (k > i) entries[linked[k]].link_to = linked[i];
+        }
+    }
+    free(linked);
 }
 
 static void _archive(char *in, char *out, int ilen, int olen);
@@ -241,32 +478,23 @@ static void _archive(char *in, char *out, int ilen, int olen)
     if(lstat(in, &s)) die("could not stat '%s'\n", in);
 
     if(S_ISREG(s.st_mode)){
-        char *tmp;
-        int fd;
-
-        fd = open(in, O_RDONLY);
-        if(fd < 0) die("cannot open '%s' for read", in);
-
-        tmp = (char*) malloc(s.st_size);
-        if(tmp == 0) die("cannot allocate %d bytes", s.st_size);
-
-        if(read(fd, tmp, s.st_size) != s.st_size) {
-            die("cannot read %d bytes", s.st_size);
-        }
-
-        _eject(&s, out, olen, tmp, s.st_size);
-
-        free(tmp);
-        close(fd);
+        add_entry(in, out, &s);
+        entries[entry_count - 1].size = s.st_size;
     } else if(S_ISDIR(s.st_mode)) {
-        _eject(&s, out, olen, 0, 0);
+        add_entry(in, out, &s);
         _archive_dir(in, out, ilen, olen);
     } else if(S_ISLNK(s.st_mode)) {
         char buf[1024];
         int size;
+        struct entry *e;
         size = readlink(in, buf, 1024);
         if(size < 0) die("cannot read symlink '%s'", in);
-        _eject(&s, out, olen, buf, size);
+        add_entry(in, out, &s);
+        e = &entries[entry_count - 1];
+        e->data = malloc(size);
+        if(e->data == 0) die("cannot allocate %d bytes", size);
+        memcpy(e->data, buf, size);
+        e->size = size;
     } else {
         die("Unknown '%s' (mode %d)?\n", in, s.st_mode);
     }
@@ -329,8 +557,46 @@ static void read_canned_config(char* filename)
 }
 
 
+// Writes everything archive() found, with |threads| - 1 threads reading ahead.
+static void write_entries(int threads)
+{
+    pthread_t readers[MAX_THREADS];
+    int i;
+
+    if (hard_links) find_hard_links();
+
+    for (i = 0; i < threads - 1; ++i) {
+        if (pthread_create(&readers[i], NULL, reader_thread, NULL)) {
+            die("cannot create reader thread");
+        }
+    }
+
+    for (i = 0; i < entry_count; ++i) {
+        if (threads > 1) {
+            pthread_mutex_lock(&read_lock);
+            next_write = i;
+            pthread_cond_broadcast(&read_cond);
+            pthread_mutex_unlock(&read_lock);
+        }
+        write_entry(&entries[i], threads);
+        free(entries[i].in);
+        free(entries[i].out);
+    }
+
+    for (i = 0; i < threads - 1; ++i) {
+        pthread_join(readers[i], NULL);
+    }
+    free(entries);
+    entries = NULL;
+    entry_count = entries_allocated = 0;
+}
+
 int main(int argc, char *argv[])
 {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    int threads = cpus < 1 ? 1 : cpus > MAX_THREADS ? MAX_THREADS : cpus;
+    int level = -1;
+
     argc--;
     argv++;
 
@@ -346,8 +612,35 @@ int main(int argc, char *argv[])
         argv += 2;
     }
 
+    while (argc > 0 && argv[0][0] == '-') {
+        if (argc > 1 && strcmp(argv[0], "-j") == 0) {
+            threads = atoi(argv[1]);
+            if (threads < 1 || threads > MAX_THREADS) {
+                die("-j must be between 1 and %d", MAX_THREADS);
+            }
+        } else if (argc > 1 && strcmp(argv[0], "-z") == 0) {
+            level = atoi(argv[1]);
+            if (level < 1 || level > 9) die("-z must be between 1 and 9");
+        } else if (strcmp(argv[0], "-l") == 0) {
+            hard_links = 1;
+            argc--;
+            argv++;
+            continue;
+        } else {
+            die("unknown option '%s'", argv[0]);
+        }
+        argc -= 2;
+        argv += 2;
+    }
+
     if(argc == 0) die("no directories to process?!");
 
+    if (level > 0) {
+        char mode[4] = { 'w', 'b', (char) ('0' + level), 0 };
+        gz_out = gzdopen(fileno(stdout), mode);
+        if (gz_out == NULL) die("cannot compress output");
+    }
+
     while(argc-- > 0){
         char *x = strchr(*argv, '=');
         if(x != 0) {
@@ -361,7 +654,10 @@ int main(int argc, char *argv[])
         argv++;
     }
 
+    write_entries(threads);
     _eject_trailer();
 
+    if (gz_out && gzclose(gz_out) != Z_OK) die("cannot write output");
+
     return 0;
 }
@@ -26,10 +26,14 @@
 #include <syscall.h>
 #include <unistd.h>
 
+#include <condition_variable>
+#include <functional>
 #include <limits>
 #include <map>
 #include <memory>
+#include <mutex>
 #include <set>
+#include <thread>
 #include <vector>
 
 #include <android-base/file.h>
@@ -198,6 +202,124 @@ static void drop_capabilities() {
   }
 }
 
+// Attaches to the sibling threads, and later dumps them, on a pool of workers so
+// that processes with many threads can be resumed sooner. Only the thread that
+// attached to a tracee can make ptrace requests for it, so each worker keeps the
+// threads it attached to until the dumper is destroyed.
+class SiblingDumper {
+ public:
+  using ThreadFunction = std::function<void(pid_t tid, const std::string& thread_name)>;
+  using DumpFunction =
+      std::function<void(pid_t tid, const std::string& thread_name, std::string* output)>;
+
+  SiblingDumper(int target_proc_fd, const std::set<pid_t>& tids) : target_proc_fd_(target_proc_fd) {
+    size_t worker_count = std::min<size_t>(tids.size(), std::thread::hardware_concurrency());
+    worker_count = std::max<size_t>(worker_count, 1);
+    std::vector<std::vector<pid_t>> shares(worker_count);
+    size_t i = 0;
+    for (pid_t tid : tids) {
+      shares[i++ % worker_count].push_back(tid);
+    }
+    pending_ = worker_count;
+    for (auto& share : shares) {
+      workers_.emplace_back(&SiblingDumper::Worker, this, std::move(share));
+    }
+  }
+
+  ~SiblingDumper() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      exiting_ = true;
+    }
+    cv_.notify_all();
+    for (auto& worker : workers_) {
+      worker.join();
+    }
+  }
+
+  // Waits for the workers to attach, and returns the names of the threads they attached to.
+  std::map<pid_t, std::string> WaitForAttach() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    cv_.wait(lock, [this]() { return pending_ == 0; });
+    return threads_;
+  }
+
+  // Runs |function| for every attached thread on the worker that attached to it,
+  // and waits for all of them to finish.
+  void Run(const ThreadFunction& function) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    pending_ = workers_.size();
+    function_ = &function;
+    ++generation_;
+    cv_.notify_all();
+    cv_.wait(lock, [this]() { return pending_ == 0; });
+    function_ = nullptr;
+  }
+
+  // Runs |dump| for every attached thread, and returns the output of each thread.
+  std::map<pid_t, std::string> Dump(const DumpFunction& dump) {
+    // Every entry exists before the workers start, so each only touches its own.
+    std::map<pid_t, std::string> dumps;
+    for (const auto& it : threads_) {
+      dumps[it.first];
+    }
+    Run([&](pid_t tid, const std::string& thread_name) {
+      dump(tid, thread_name, &dumps.find(tid)->second);
+    });
+    return dumps;
+  }
+
+ private:
+  void Worker(std::vector<pid_t> tids) {
+    std::map<pid_t, std::string> attached;
+    std::string attach_error;
+    for (pid_t tid : tids) {
+      if (!ptrace_seize_thread(target_proc_fd_, tid, &attach_error)) {
+        LOG(WARNING) << attach_error;
+      } else {
+        attached.emplace(tid, get_thread_name(tid));
+      }
+    }
+
+    // Capabilities are per thread, so every worker drops its own.
+    drop_capabilities();
+
+    std::unique_lock<std::mutex> lock(mutex_);
+    threads_.insert(attached.begin(), attached.end());
+    --pending_;
+    cv_.notify_all();
+
+    // Exiting detaches from the threads, so keep them until crash_dump is done.
+    uint64_t generation = 0;
+    while (true) {
+      cv_.wait(lock, [&]() { return exiting_ || generation_ != generation; });
+      if (exiting_) {
+        return;
+      }
+      generation = generation_;
+      const ThreadFunction& function = *function_;
+      lock.unlock();
+      for (const auto& it : attached) {
+        function(it.first, it.second);
+      }
+      lock.lock();
+      --pending_;
+      cv_.notify_all();
+    }
+  }
+
+  int target_proc_fd_;
+  std::vector<std::thread> workers_;
+
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  size_t pending_ = 0;
+  const ThreadFunction* function_ = nullptr;
+  uint64_t generation_ = 0;
+  bool exiting_ = false;
+  std::map<pid_t, std::string> threads_;
+};
+
 int main(int argc, char** argv) {
   atrace_begin(ATRACE_TAG, "before reparent");
 
@@ -290,6 +412,7 @@ int main(int argc, char** argv) {
   std::string attach_error;
 
   std::map<pid_t, std::string> threads;
+  std::unique_ptr<SiblingDumper> sibling_dumper;
 
   {
     ATRACE_NAME("ptrace");
@@ -310,13 +433,8 @@ int main(int argc, char** argv) {
       // or the handler pseudothread.
       siblings.erase(pseudothread_tid);
 
-      for (pid_t sibling_tid : siblings) {
-        if (!ptrace_seize_thread(target_proc_fd, sibling_tid, &attach_error)) {
-          LOG(WARNING) << attach_error;
-        } else {
-          threads.emplace(sibling_tid, get_thread_name(sibling_tid));
-        }
-      }
+      sibling_dumper.reset(new SiblingDumper(target_proc_fd, siblings));
+      threads = sibling_dumper->WaitForAttach();
     }
   }
 
@@ -402,14 +520,74 @@ int main(int argc, char** argv) {
 
   // TODO: Use seccomp to lock ourselves down.
 
+  // The siblings are unwound concurrently and share the backtrace map, only the
+  // output is written in tid order.
   std::string amfd_data;
-  if (backtrace) {
+  if (backtrace && !fatal_signal) {
     ATRACE_NAME("dump_backtrace");
-    dump_backtrace(output_fd.get(), backtrace_map.get(), target, main_tid, process_name, threads, 0);
+    // Copy the registers and stack of every thread and let the process go before
+    // unwinding, so that it is only stopped for as long as the copies take. A
+    // thread that couldn't be copied stays attached and is unwound in place.
+    std::map<pid_t, ThreadSnapshot> snapshots;
+    for (const auto& it : threads) {
+      snapshots[it.first];
+    }
+    auto take_snapshot = [&](pid_t tid, const std::string&) {
+      if (snapshot_thread(target, tid, &snapshots.find(tid)->second) &&
+          ptrace(PTRACE_DETACH, tid, 0, 0) != 0) {
+        PLOG(ERROR) << "failed to detach from thread " << tid;
+      }
+    };
+    auto dump_thread = [&](pid_t tid, const std::string& thread_name, std::string* output) {
+      ThreadSnapshot* snapshot = &snapshots.find(tid)->second;
+      if (snapshot->stack.empty()) {
+        dump_backtrace_thread(output, backtrace_map.get(), target, tid, thread_name);
+      } else {
+        dump_backtrace_thread(output, backtrace_map.get(), target, tid, thread_name, snapshot);
+      }
+    };
+
+    {
+      ATRACE_NAME("snapshot");
+      take_snapshot(main_tid, threads[main_tid]);
+      sibling_dumper->Run(take_snapshot);
+    }
+    std::map<pid_t, std::string> thread_dumps = sibling_dumper->Dump(dump_thread);
+    dump_thread(main_tid, threads[main_tid], &thread_dumps[main_tid]);
+    dump_backtrace(output_fd.get(), backtrace_map.get(), target, main_tid, process_name, threads, 0,
+                   &thread_dumps);
+  } else if (backtrace) {
+    ATRACE_NAME("dump_backtrace");
+    std::map<pid_t, std::string> thread_dumps = sibling_dumper->Dump(
+        [&](pid_t tid, const std::string& thread_name, std::string* output) {
+          dump_backtrace_thread(output, backtrace_map.get(), target, tid, thread_name);
+        });
+    dump_backtrace(output_fd.get(), backtrace_map.get(), target, main_tid, process_name, threads, 0,
+                   &thread_dumps);
+  } else if (android::base::GetBoolProperty("debug.debuggerd.binary_tombstone", false)) {
+    ATRACE_NAME("engrave_tombstone_binary");
+    std::map<pid_t, BinaryTombstone::Thread> sibling_threads;
+    for (const auto& it : threads) {
+      if (it.first != main_tid) {
+        sibling_threads[it.first];
+      }
+    }
+    sibling_dumper->Run([&](pid_t tid, const std::string& thread_name) {
+      collect_binary_tombstone_thread(&sibling_threads.find(tid)->second, backtrace_map.get(),
+                                      target, tid, thread_name);
+    });
+    engrave_tombstone_binary(output_fd.get(), backtrace_map.get(), target, main_tid, process_name,
+                             threads, abort_address, sibling_threads);
   } else {
     ATRACE_NAME("engrave_tombstone");
+    std::map<pid_t, std::string> thread_dumps = sibling_dumper->Dump(
+        [&](pid_t tid, const std::string& thread_name, std::string* output) {
+          dump_tombstone_thread(output, backtrace_map.get(), target, tid, process_name,
+                                thread_name);
+        });
     engrave_tombstone(output_fd.get(), backtrace_map.get(), &open_files, target, main_tid,
-                      process_name, threads, abort_address, fatal_signal ? &amfd_data : nullptr);
+                      process_name, threads, abort_address, fatal_signal ? &amfd_data : nullptr,
+                      &thread_dumps);
   }
 
   // We don't actually need to PTRACE_DETACH, as long as our tracees aren't in
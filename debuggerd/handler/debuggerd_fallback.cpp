@@ -46,6 +46,7 @@
 #include "util.h"
 
 #include "backtrace.h"
+#include "local_unwinder.h"
 #include "tombstone.h"
 
 using android::base::unique_fd;
@@ -59,9 +60,40 @@ extern "C" void __linker_disable_fallback_allocator();
 //
 // This isn't the default method of dumping because it can fail in cases such as address space
 // exhaustion.
+//
+// Traces share one LocalUnwinder, created by the thread that received the request, so the maps
+// and elf files are only read once for the whole process. A thread takes it while it unwinds, so
+// the requesting thread never frees it out from under a sibling that is still running after
+// forward_output gave up on it; the next trace frees the unwinder in that case.
+static std::atomic<LocalUnwinder*> fallback_unwinder(nullptr);
+
 static void debuggerd_fallback_trace(int output_fd, ucontext_t* ucontext) {
   __linker_enable_fallback_allocator();
-  dump_backtrace_ucontext(output_fd, ucontext);
+  LocalUnwinder* unwinder = fallback_unwinder.exchange(nullptr);
+  if (unwinder != nullptr) {
+    unwinder->DumpThread(output_fd, ucontext);
+    fallback_unwinder.store(unwinder);
+  } else {
+    dump_backtrace_ucontext(output_fd, ucontext);
+  }
+  __linker_disable_fallback_allocator();
+}
+
+static void create_fallback_unwinder() {
+  __linker_enable_fallback_allocator();
+  LocalUnwinder* unwinder = new LocalUnwinder();
+  if (!unwinder->Init()) {
+    delete unwinder;
+    unwinder = nullptr;
+  }
+  // A sibling that finished after the last trace gave up on it may have put its unwinder back.
+  delete fallback_unwinder.exchange(unwinder);
+  __linker_disable_fallback_allocator();
+}
+
+static void destroy_fallback_unwinder() {
+  __linker_enable_fallback_allocator();
+  delete fallback_unwinder.exchange(nullptr);
   __linker_disable_fallback_allocator();
 }
 
@@ -156,6 +188,7 @@ static void trace_handler(siginfo_t* info, ucontext_t* ucontext) {
   }
 
   dump_backtrace_header(output_fd.get());
+  create_fallback_unwinder();
 
   // Dump our own stack.
   debuggerd_fallback_trace(output_fd.get(), ucontext);
@@ -198,6 +231,7 @@ static void trace_handler(siginfo_t* info, ucontext_t* ucontext) {
     },
     output_fd.get());
 
+  destroy_fallback_unwinder();
   dump_backtrace_footer(output_fd.get());
   tombstoned_notify_completion(tombstone_socket.get());
 
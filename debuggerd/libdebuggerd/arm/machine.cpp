@@ -88,3 +88,33 @@ void dump_registers(log_t* log, pid_t tid) {
 void dump_registers(log_t* log, const ucontext_t* uc) {
   DUMP_GP_REGISTERS(log, uc->uc_mcontext.arm_);
 }
+
+bool get_thread_context(pid_t tid, ucontext_t* uc, uintptr_t* sp) {
+  pt_regs r;
+  if (ptrace(PTRACE_GETREGS, tid, 0, &r)) {
+    ALOGE("cannot get registers: %s\n", strerror(errno));
+    return false;
+  }
+
+  memset(uc, 0, sizeof(*uc));
+  mcontext_t& mc = uc->uc_mcontext;
+  mc.arm_r0 = r.ARM_r0;
+  mc.arm_r1 = r.ARM_r1;
+  mc.arm_r2 = r.ARM_r2;
+  mc.arm_r3 = r.ARM_r3;
+  mc.arm_r4 = r.ARM_r4;
+  mc.arm_r5 = r.ARM_r5;
+  mc.arm_r6 = r.ARM_r6;
+  mc.arm_r7 = r.ARM_r7;
+  mc.arm_r8 = r.ARM_r8;
+  mc.arm_r9 = r.ARM_r9;
+  mc.arm_r10 = r.ARM_r10;
+  mc.arm_fp = r.ARM_fp;
+  mc.arm_ip = r.ARM_ip;
+  mc.arm_sp = r.ARM_sp;
+  mc.arm_lr = r.ARM_lr;
+  mc.arm_pc = r.ARM_pc;
+  mc.arm_cpsr = r.ARM_cpsr;
+  *sp = r.ARM_sp;
+  return true;
+}
@@ -102,3 +102,26 @@ void dump_registers(log_t* log, const ucontext_t* ucontext) {
   const mcontext_t& r = ucontext->uc_mcontext;
   DUMP_GP_REGISTERS(log);
 }
+
+bool get_thread_context(pid_t tid, ucontext_t* ucontext, uintptr_t* sp) {
+  struct user_pt_regs r;
+  struct iovec io;
+  io.iov_base = &r;
+  io.iov_len = sizeof(r);
+
+  if (ptrace(PTRACE_GETREGSET, tid, (void*) NT_PRSTATUS, (void*) &io) == -1) {
+    ALOGE("ptrace error: %s\n", strerror(errno));
+    return false;
+  }
+
+  memset(ucontext, 0, sizeof(*ucontext));
+  mcontext_t& mc = ucontext->uc_mcontext;
+  for (size_t i = 0; i < 31; i++) {
+    mc.regs[i] = r.regs[i];
+  }
+  mc.sp = r.sp;
+  mc.pc = r.pc;
+  mc.pstate = r.pstate;
+  *sp = r.sp;
+  return true;
+}
@@ -25,19 +25,25 @@
 #include <string.h>
 #include <sys/ptrace.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <time.h>
 #include <unistd.h>
 
 #include <memory>
 #include <string>
 
+#include <android-base/file.h>
 #include <backtrace/Backtrace.h>
 #include <log/log.h>
 
 #include "backtrace.h"
 
+#include "machine.h"
 #include "utility.h"
 
+// Enough for the native frames of a typical thread.
+static constexpr size_t kSnapshotStackSize = 32 * 1024;
+
 static void dump_process_header(log_t* log, pid_t pid, const char* process_name) {
   time_t t = time(NULL);
   struct tm tm;
@@ -60,39 +66,99 @@ static void log_thread_name(log_t* log, pid_t tid, const char* thread_name) {
   _LOG(log, logtype::BACKTRACE, "\n\"%s\" sysTid=%d\n", thread_name, tid);
 }
 
-static void dump_thread(log_t* log, BacktraceMap* map, pid_t pid, pid_t tid,
-                        const std::string& thread_name) {
-  log_thread_name(log, tid, thread_name.c_str());
+static void dump_thread(log_t* log, Backtrace* backtrace, const std::string& thread_name,
+                        ucontext_t* ucontext) {
+  log_thread_name(log, backtrace->Tid(), thread_name.c_str());
 
-  std::unique_ptr<Backtrace> backtrace(Backtrace::Create(pid, tid, map));
-  if (backtrace->Unwind(0)) {
-    dump_backtrace_to_log(backtrace.get(), log, "  ");
+  if (backtrace->Unwind(0, ucontext)) {
+    dump_backtrace_to_log(backtrace, log, "  ");
   } else {
-    ALOGE("Unwind failed: tid = %d: %s", tid,
+    ALOGE("Unwind failed: tid = %d: %s", backtrace->Tid(),
           backtrace->GetErrorString(backtrace->GetError()).c_str());
   }
 }
 
+static void dump_thread(log_t* log, BacktraceMap* map, pid_t pid, pid_t tid,
+                        const std::string& thread_name) {
+  std::unique_ptr<Backtrace> backtrace(Backtrace::Create(pid, tid, map));
+  dump_thread(log, backtrace.get(), thread_name, nullptr);
+}
+
 void dump_backtrace(int fd, BacktraceMap* map, pid_t pid, pid_t tid, const std::string& process_name,
-                    const std::map<pid_t, std::string>& threads, std::string* amfd_data) {
+                    const std::map<pid_t, std::string>& threads, std::string* amfd_data,
+                    const std::map<pid_t, std::string>* thread_dumps) {
   log_t log;
   log.tfd = fd;
   log.amfd_data = amfd_data;
 
+  auto dump = [&](pid_t thread_tid, const std::string& thread_name) {
+    if (thread_dumps != nullptr && thread_dumps->count(thread_tid) != 0) {
+      android::base::WriteStringToFd(thread_dumps->at(thread_tid), fd);
+    } else {
+      dump_thread(&log, map, pid, thread_tid, thread_name.c_str());
+    }
+  };
+
   dump_process_header(&log, pid, process_name.c_str());
-  dump_thread(&log, map, pid, tid, threads.find(tid)->second.c_str());
+  dump(tid, threads.find(tid)->second);
 
   for (const auto& it : threads) {
-    pid_t thread_tid = it.first;
-    const std::string& thread_name = it.second;
-    if (thread_tid != tid) {
-      dump_thread(&log, map, pid, thread_tid, thread_name.c_str());
+    if (it.first != tid) {
+      dump(it.first, it.second);
     }
   }
 
   dump_process_footer(&log, pid);
 }
 
+void dump_backtrace_thread(std::string* output, BacktraceMap* map, pid_t pid, pid_t tid,
+                           const std::string& thread_name) {
+  log_t log;
+  log.output_buffer = output;
+  dump_thread(&log, map, pid, tid, thread_name);
+}
+
+// Weak implementation for architectures without snapshot support, real
+// implementations are in <arch>/machine.cpp.
+__attribute__((weak)) bool get_thread_context(pid_t, ucontext_t*, uintptr_t*) {
+  return false;
+}
+
+bool snapshot_thread(pid_t pid, pid_t tid, ThreadSnapshot* snapshot) {
+  uintptr_t sp;
+  if (!get_thread_context(tid, &snapshot->ucontext, &sp)) {
+    return false;
+  }
+
+  // Reads stop at the first unmapped page, so a stack shallower than this is
+  // copied up to its end.
+  snapshot->stack.resize(kSnapshotStackSize);
+  struct iovec local_io = {snapshot->stack.data(), snapshot->stack.size()};
+  struct iovec remote_io = {reinterpret_cast<void*>(sp), snapshot->stack.size()};
+  ssize_t bytes = process_vm_readv(pid, &local_io, 1, &remote_io, 1, 0);
+  if (bytes <= 0) {
+    ALOGE("failed to read the stack of tid %d: %s", tid, strerror(errno));
+    snapshot->stack.clear();
+    return false;
+  }
+  snapshot->stack.resize(bytes);
+  snapshot->stack_start = sp;
+  return true;
+}
+
+void dump_backtrace_thread(std::string* output, BacktraceMap* map, pid_t pid, pid_t tid,
+                           const std::string& thread_name, ThreadSnapshot* snapshot) {
+  log_t log;
+  log.output_buffer = output;
+
+  backtrace_stackinfo_t stack;
+  stack.start = snapshot->stack_start;
+  stack.end = snapshot->stack_start + snapshot->stack.size();
+  stack.data = snapshot->stack.data();
+  std::unique_ptr<Backtrace> backtrace(Backtrace::CreateOffline(pid, tid, map, stack, true));
+  dump_thread(&log, backtrace.get(), thread_name, &snapshot->ucontext);
+}
+
 void dump_backtrace_ucontext(int output_fd, ucontext_t* ucontext) {
   pid_t pid = getpid();
   pid_t tid = gettid();
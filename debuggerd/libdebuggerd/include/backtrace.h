@@ -17,11 +17,13 @@
 #ifndef _DEBUGGERD_BACKTRACE_H
 #define _DEBUGGERD_BACKTRACE_H
 
+#include <stdint.h>
 #include <sys/types.h>
 #include <sys/ucontext.h>
 
 #include <map>
 #include <string>
+#include <vector>
 
 #include "utility.h"
 
@@ -31,7 +33,30 @@ class BacktraceMap;
 // Dumps a backtrace using a format similar to what Dalvik uses so that the result
 // can be intermixed in a bug report.
 void dump_backtrace(int fd, BacktraceMap* map, pid_t pid, pid_t tid, const std::string& process_name,
-                    const std::map<pid_t, std::string>& threads, std::string* amfd_data);
+                    const std::map<pid_t, std::string>& threads, std::string* amfd_data,
+                    const std::map<pid_t, std::string>* thread_dumps = nullptr);
+
+// Dumps the backtrace of one thread the way dump_backtrace does, into |output|.
+// Like dump_tombstone_thread, this has to run on the thread that attached to |tid|.
+void dump_backtrace_thread(std::string* output, BacktraceMap* map, pid_t pid, pid_t tid,
+                           const std::string& thread_name);
+
+// The registers and the top of the stack of a thread, copied while it is stopped
+// so that it can be unwound after the process has been resumed.
+struct ThreadSnapshot {
+  ucontext_t ucontext;
+  uintptr_t stack_start = 0;
+  std::vector<uint8_t> stack;
+};
+
+// Takes a snapshot of the ptrace-stopped |tid|, copying at most 32KiB of its
+// stack. Has to run on the thread that attached to |tid|.
+bool snapshot_thread(pid_t pid, pid_t tid, ThreadSnapshot* snapshot);
+
+// Like dump_backtrace_thread, but unwinds from |snapshot| using the mapped files,
+// so the thread doesn't have to be stopped or attached any more.
+void dump_backtrace_thread(std::string* output, BacktraceMap* map, pid_t pid, pid_t tid,
+                           const std::string& thread_name, ThreadSnapshot* snapshot);
 
 /* Dumps the backtrace in the backtrace data structure to the log. */
 void dump_backtrace_to_log(Backtrace* backtrace, log_t* log, const char* prefix);
@@ -0,0 +1,76 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _DEBUGGERD_LOCAL_UNWINDER_H
+#define _DEBUGGERD_LOCAL_UNWINDER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/ucontext.h>
+
+#include <string>
+
+#include <unwindstack/Maps.h>
+#include <unwindstack/Memory.h>
+
+// Unwinds threads of the current process from inside their signal handlers,
+// for the in-process fallback that is used when crash_dump can't ptrace us.
+//
+// Everything that scales with the size of the process is set up once, by Init
+// and the first unwinds that touch each library, and is then shared by every
+// thread that is dumped: the maps, the elf objects and their caches. Frames
+// go in a fixed size array and are formatted on the stack, so once every
+// library on a thread's stack has been seen, the only allocation left for
+// that thread is its register set.
+class LocalUnwinder {
+ public:
+  static constexpr size_t kMaxFrames = 64;
+
+  LocalUnwinder() = default;
+
+  // Reads the maps of the current process.
+  bool Init();
+
+  // Unwinds from |ucontext| and writes the thread the way dump_backtrace
+  // does. Has to run on the thread that |ucontext| belongs to.
+  void DumpThread(int output_fd, ucontext_t* ucontext);
+
+  size_t NumFrames() const { return num_frames_; }
+
+ private:
+  struct Frame {
+    uint64_t rel_pc;
+    const unwindstack::MapInfo* map_info;
+    // Empty if the pc isn't in a known function.
+    char function_name[128];
+    uint64_t function_offset;
+  };
+
+  void Unwind(ucontext_t* ucontext);
+  void WriteFrame(int output_fd, size_t frame_num);
+
+  unwindstack::LocalMaps maps_;
+  unwindstack::MemoryLocal memory_;
+
+  Frame frames_[kMaxFrames];
+  size_t num_frames_ = 0;
+
+  // Reused for every function name lookup, so that only names longer than any
+  // seen before need to grow it.
+  std::string name_buffer_;
+};
+
+#endif // _DEBUGGERD_LOCAL_UNWINDER_H
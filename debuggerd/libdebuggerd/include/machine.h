@@ -17,6 +17,7 @@
 #ifndef _DEBUGGERD_MACHINE_H
 #define _DEBUGGERD_MACHINE_H
 
+#include <stdint.h>
 #include <sys/types.h>
 
 #include <backtrace/Backtrace.h>
@@ -27,4 +28,8 @@ void dump_memory_and_code(log_t* log, Backtrace* backtrace);
 void dump_registers(log_t* log, pid_t tid);
 void dump_registers(log_t* log, const ucontext_t* uc);
 
+// Reads the registers of the ptrace-stopped |tid| into |uc| the way a signal
+// handler would see them, and its stack pointer into |sp|.
+bool get_thread_context(pid_t tid, ucontext_t* uc, uintptr_t* sp);
+
 #endif // _DEBUGGERD_MACHINE_H
@@ -25,6 +25,7 @@
 #include <string>
 
 #include "open_files_list.h"
+#include "tombstone_binary.h"
 
 class BacktraceMap;
 
@@ -38,7 +39,29 @@ int open_tombstone(std::string* path);
 void engrave_tombstone(int tombstone_fd, BacktraceMap* map, const OpenFilesList* open_files,
                        pid_t pid, pid_t tid, const std::string& process_name,
                        const std::map<pid_t, std::string>& threads, uintptr_t abort_msg_address,
-                       std::string* amfd_data);
+                       std::string* amfd_data,
+                       const std::map<pid_t, std::string>* thread_dumps = nullptr);
+
+// Dumps a thread other than the crashing one the way engrave_tombstone does,
+// into |output|. The dumps can be passed to engrave_tombstone as thread_dumps,
+// which lets the threads be dumped concurrently. All of the ptrace requests for
+// |tid| are made here, so this has to run on the thread that attached to it.
+void dump_tombstone_thread(std::string* output, BacktraceMap* map, pid_t pid, pid_t tid,
+                           const std::string& process_name, const std::string& thread_name);
+
+// Collects the registers and pcs of a thread other than the crashing one for
+// engrave_tombstone_binary. Has to run on the thread that attached to |tid|.
+void collect_binary_tombstone_thread(BinaryTombstone::Thread* thread, BacktraceMap* map, pid_t pid,
+                                     pid_t tid, const std::string& thread_name);
+
+// Writes a BinaryTombstone instead of text. Nothing is symbolized and logs,
+// open files and register contents aren't rendered, which makes it much
+// cheaper to write.
+void engrave_tombstone_binary(int tombstone_fd, BacktraceMap* map, pid_t pid, pid_t tid,
+                              const std::string& process_name,
+                              const std::map<pid_t, std::string>& threads,
+                              uintptr_t abort_msg_address,
+                              const std::map<pid_t, BinaryTombstone::Thread>& sibling_threads);
 
 void engrave_tombstone_ucontext(int tombstone_fd, uintptr_t abort_msg_address, siginfo_t* siginfo,
                                 ucontext_t* ucontext);
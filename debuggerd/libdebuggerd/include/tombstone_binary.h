@@ -0,0 +1,84 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _DEBUGGERD_TOMBSTONE_BINARY_H
+#define _DEBUGGERD_TOMBSTONE_BINARY_H
+
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+// A compact tombstone. It holds the raw registers, pcs and memory of the
+// crash, plus the build ids needed to symbolize them later, instead of the
+// text that engrave_tombstone writes. tombstone_symbolize turns one into
+// text.
+//
+// The file starts with kBinaryTombstoneMagic and a u32 version. After that
+// come records, each a u32 type, a u32 payload size and then the payload.
+// Integers use the byte order of the device. Readers skip record types they
+// don't know.
+struct BinaryTombstone {
+  struct Map {
+    uint64_t start = 0;
+    uint64_t end = 0;
+    uint64_t offset = 0;
+    uint64_t load_bias = 0;
+    uint32_t flags = 0;
+    std::string name;
+    // Only filled in for maps that a frame points into.
+    std::string build_id;
+  };
+
+  struct Thread {
+    int32_t tid = 0;
+    std::string name;
+    // The NT_PRSTATUS register set, as ptrace returns it.
+    std::vector<uint8_t> registers;
+    std::vector<uint64_t> pcs;
+  };
+
+  struct Memory {
+    uint64_t address = 0;
+    std::vector<uint8_t> data;
+  };
+
+  std::string abi;
+  std::string build_fingerprint;
+  std::string process_name;
+  int32_t pid = 0;
+  int32_t tid = 0;
+  int32_t signo = 0;
+  int32_t code = 0;
+  uint64_t fault_address = 0;
+  std::string abort_message;
+
+  std::vector<Map> maps;
+  // The crashing thread comes first.
+  std::vector<Thread> threads;
+  std::vector<Memory> memory;
+};
+
+constexpr char kBinaryTombstoneMagic[4] = {'D', 'T', 'M', 'B'};
+constexpr uint32_t kBinaryTombstoneVersion = 1;
+
+// Memory segments are compressed when doing so makes them smaller.
+bool write_binary_tombstone(int fd, const BinaryTombstone& tombstone);
+
+// Returns false if |fd| does not hold a binary tombstone or it is truncated.
+bool read_binary_tombstone(int fd, BinaryTombstone* tombstone);
+
+#endif // _DEBUGGERD_TOMBSTONE_BINARY_H
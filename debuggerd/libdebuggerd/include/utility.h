@@ -47,6 +47,8 @@
 struct log_t{
     // Tombstone file descriptor.
     int tfd;
+    // If set, tombstone output is appended here instead of being written to tfd.
+    std::string* output_buffer;
     // Data to be sent to the Activity Manager.
     std::string* amfd_data;
     // The tid of the thread that crashed.
@@ -57,7 +59,7 @@ struct log_t{
     bool should_retrieve_logcat;
 
     log_t()
-        : tfd(-1), amfd_data(nullptr), crashed_tid(-1), current_tid(-1),
+        : tfd(-1), output_buffer(nullptr), amfd_data(nullptr), crashed_tid(-1), current_tid(-1),
           should_retrieve_logcat(true) {}
 };
 
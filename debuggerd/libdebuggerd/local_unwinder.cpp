@@ -0,0 +1,134 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "DEBUG"
+
+#include "local_unwinder.h"
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <memory>
+
+#include <android-base/file.h>
+#include <log/log.h>
+#include <unwindstack/Elf.h>
+#include <unwindstack/MapInfo.h>
+#include <unwindstack/Regs.h>
+
+#include "utility.h"
+
+bool LocalUnwinder::Init() {
+  if (!maps_.Parse()) {
+    ALOGE("failed to parse the maps of the current process");
+    return false;
+  }
+  name_buffer_.reserve(sizeof(Frame::function_name));
+  return true;
+}
+
+void LocalUnwinder::Unwind(ucontext_t* ucontext) {
+  num_frames_ = 0;
+  std::unique_ptr<unwindstack::Regs> regs(
+      unwindstack::Regs::CreateFromUcontext(unwindstack::Regs::GetMachineType(), ucontext));
+  if (regs == nullptr) {
+    return;
+  }
+
+  while (num_frames_ < kMaxFrames && regs->pc() != 0) {
+    unwindstack::MapInfo* map_info = maps_.Find(regs->pc());
+    Frame* frame = &frames_[num_frames_++];
+    frame->rel_pc = regs->pc();
+    frame->map_info = map_info;
+    frame->function_name[0] = '\0';
+    frame->function_offset = 0;
+    if (map_info == nullptr) {
+      break;
+    }
+
+    unwindstack::Elf* elf = map_info->GetElf(getpid(), true);
+    uint64_t rel_pc = elf->GetRelPc(regs->pc(), map_info);
+    // The first frame is where the thread was interrupted, every other pc is
+    // a return address.
+    frame->rel_pc = num_frames_ == 1 ? rel_pc : regs->GetAdjustedPc(rel_pc, elf);
+    if (elf->GetFunctionName(frame->rel_pc, &name_buffer_, &frame->function_offset)) {
+      snprintf(frame->function_name, sizeof(frame->function_name), "%s", name_buffer_.c_str());
+    }
+
+    // GetRelPc already accounts for elf_offset.
+    if (!elf->Step(rel_pc, regs.get(), &memory_) &&
+        !regs->StepIfSignalHandler(rel_pc, elf, &memory_)) {
+      break;
+    }
+  }
+}
+
+void LocalUnwinder::WriteFrame(int output_fd, size_t frame_num) {
+  const Frame& frame = frames_[frame_num];
+  int pc_width = sizeof(void*) * 2;
+  char line[512];
+  int length;
+  if (frame.map_info == nullptr) {
+    length = snprintf(line, sizeof(line), "  #%02zu pc %0*" PRIx64 "  <unknown>", frame_num,
+                      pc_width, frame.rel_pc);
+  } else {
+    const std::string& name = frame.map_info->name;
+    if (name.empty()) {
+      length = snprintf(line, sizeof(line), "  #%02zu pc %0*" PRIx64 "  <anonymous:%0*" PRIx64 ">",
+                        frame_num, pc_width, frame.rel_pc, pc_width, frame.map_info->start);
+    } else if (name[0] == '[' && name.back() == ']') {
+      length = snprintf(line, sizeof(line), "  #%02zu pc %0*" PRIx64 "  %.*s:%0*" PRIx64 "]",
+                        frame_num, pc_width, frame.rel_pc, static_cast<int>(name.size() - 1),
+                        name.c_str(), pc_width, frame.map_info->start);
+    } else {
+      length = snprintf(line, sizeof(line), "  #%02zu pc %0*" PRIx64 "  %s", frame_num, pc_width,
+                        frame.rel_pc, name.c_str());
+    }
+    if (frame.map_info->offset != 0 && length < static_cast<int>(sizeof(line))) {
+      length += snprintf(line + length, sizeof(line) - length, " (offset 0x%" PRIx64 ")",
+                         frame.map_info->offset);
+    }
+  }
+  if (frame.function_name[0] != '\0' && length < static_cast<int>(sizeof(line))) {
+    if (frame.function_offset != 0) {
+      length += snprintf(line + length, sizeof(line) - length, " (%s+%" PRIu64 ")",
+                         frame.function_name, frame.function_offset);
+    } else {
+      length += snprintf(line + length, sizeof(line) - length, " (%s)", frame.function_name);
+    }
+  }
+  // Leave room for the newline, truncating the line if it doesn't fit.
+  if (length > static_cast<int>(sizeof(line)) - 2) {
+    length = sizeof(line) - 2;
+  }
+  line[length++] = '\n';
+  android::base::WriteFully(output_fd, line, length);
+}
+
+void LocalUnwinder::DumpThread(int output_fd, ucontext_t* ucontext) {
+  char thread_name[16];
+  read_with_default("/proc/self/comm", thread_name, sizeof(thread_name), "<unknown>");
+  char header[64];
+  int length = snprintf(header, sizeof(header), "\n\"%s\" sysTid=%d\n", thread_name, gettid());
+  android::base::WriteFully(output_fd, header, length);
+
+  Unwind(ucontext);
+  for (size_t i = 0; i < num_frames_; i++) {
+    WriteFrame(output_fd, i);
+  }
+}
@@ -0,0 +1,88 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <signal.h>
+#include <unistd.h>
+
+#include <string>
+
+#include <android-base/file.h>
+#include <android-base/stringprintf.h>
+#include <android-base/test_utils.h>
+#include <gtest/gtest.h>
+
+#include "local_unwinder.h"
+
+static LocalUnwinder* g_unwinder;
+static int g_output_fd;
+
+static void DumpHandler(int, siginfo_t*, void* ucontext) {
+  g_unwinder->DumpThread(g_output_fd, static_cast<ucontext_t*>(ucontext));
+}
+
+extern "C" __attribute__((noinline)) void local_unwinder_test_raise() {
+  raise(SIGUSR1);
+  // Keep this from being a tail call.
+  asm volatile("" ::: "memory");
+}
+
+class LocalUnwinderTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    ASSERT_TRUE(unwinder_.Init());
+    g_unwinder = &unwinder_;
+
+    struct sigaction action = {};
+    action.sa_sigaction = DumpHandler;
+    action.sa_flags = SA_SIGINFO;
+    ASSERT_EQ(0, sigaction(SIGUSR1, &action, &old_action_));
+  }
+
+  void TearDown() override {
+    sigaction(SIGUSR1, &old_action_, nullptr);
+    g_unwinder = nullptr;
+  }
+
+  std::string Dump() {
+    TemporaryFile tf;
+    g_output_fd = tf.fd;
+    local_unwinder_test_raise();
+    std::string content;
+    EXPECT_TRUE(android::base::ReadFileToString(tf.path, &content));
+    return content;
+  }
+
+  LocalUnwinder unwinder_;
+  struct sigaction old_action_;
+};
+
+TEST_F(LocalUnwinderTest, dump_thread) {
+  std::string content = Dump();
+  ASSERT_NE(std::string::npos, content.find(android::base::StringPrintf("sysTid=%d\n", gettid())))
+      << content;
+  ASSERT_NE(std::string::npos, content.find("  #00 pc ")) << content;
+  ASSERT_NE(std::string::npos, content.find("(local_unwinder_test_raise")) << content;
+  ASSERT_GT(unwinder_.NumFrames(), 1U);
+  ASSERT_LE(unwinder_.NumFrames(), LocalUnwinder::kMaxFrames);
+}
+
+TEST_F(LocalUnwinderTest, reused) {
+  std::string dumps[2];
+  for (auto& dump : dumps) {
+    dump = Dump();
+  }
+  ASSERT_EQ(dumps[0], dumps[1]);
+}
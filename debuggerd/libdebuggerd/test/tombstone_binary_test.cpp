@@ -0,0 +1,159 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <string>
+
+#include <android-base/file.h>
+#include <android-base/test_utils.h>
+#include <gtest/gtest.h>
+
+#include "tombstone_binary.h"
+
+static BinaryTombstone MakeTombstone() {
+  BinaryTombstone tombstone;
+  tombstone.abi = "arm64";
+  tombstone.build_fingerprint = "fingerprint";
+  tombstone.process_name = "crasher";
+  tombstone.pid = 100;
+  tombstone.tid = 101;
+  tombstone.signo = 11;
+  tombstone.code = 1;
+  tombstone.fault_address = 0xdead;
+  tombstone.abort_message = "aborted";
+
+  BinaryTombstone::Map map;
+  map.start = 0x1000;
+  map.end = 0x3000;
+  map.offset = 0x1000;
+  map.load_bias = 0x200;
+  map.flags = 5;
+  map.name = "/system/lib64/libc.so";
+  map.build_id = "0123456789abcdef";
+  tombstone.maps.push_back(map);
+
+  BinaryTombstone::Thread thread;
+  thread.tid = 101;
+  thread.name = "main";
+  thread.registers = {1, 2, 3, 4, 5, 6, 7, 8};
+  thread.pcs = {0x1100, 0x1200};
+  tombstone.threads.push_back(thread);
+  thread.tid = 102;
+  thread.name = "worker";
+  thread.registers.clear();
+  thread.pcs.clear();
+  tombstone.threads.push_back(thread);
+
+  BinaryTombstone::Memory memory;
+  memory.address = 0x8000;
+  // Compressible, so this is stored compressed.
+  memory.data.assign(4096, 0xaa);
+  tombstone.memory.push_back(memory);
+  memory.address = 0x9000;
+  memory.data = {1, 9, 2, 8};
+  tombstone.memory.push_back(memory);
+  return tombstone;
+}
+
+TEST(TombstoneBinaryTest, round_trip) {
+  TemporaryFile tf;
+  BinaryTombstone tombstone = MakeTombstone();
+  ASSERT_TRUE(write_binary_tombstone(tf.fd, tombstone));
+  ASSERT_EQ(0, lseek(tf.fd, 0, SEEK_SET));
+
+  BinaryTombstone read;
+  ASSERT_TRUE(read_binary_tombstone(tf.fd, &read));
+  EXPECT_EQ("arm64", read.abi);
+  EXPECT_EQ("fingerprint", read.build_fingerprint);
+  EXPECT_EQ("crasher", read.process_name);
+  EXPECT_EQ(100, read.pid);
+  EXPECT_EQ(101, read.tid);
+  EXPECT_EQ(11, read.signo);
+  EXPECT_EQ(1, read.code);
+  EXPECT_EQ(0xdeadU, read.fault_address);
+  EXPECT_EQ("aborted", read.abort_message);
+
+  ASSERT_EQ(1U, read.maps.size());
+  EXPECT_EQ(0x1000U, read.maps[0].start);
+  EXPECT_EQ(0x3000U, read.maps[0].end);
+  EXPECT_EQ(0x1000U, read.maps[0].offset);
+  EXPECT_EQ(0x200U, read.maps[0].load_bias);
+  EXPECT_EQ(5U, read.maps[0].flags);
+  EXPECT_EQ("/system/lib64/libc.so", read.maps[0].name);
+  EXPECT_EQ("0123456789abcdef", read.maps[0].build_id);
+
+  ASSERT_EQ(2U, read.threads.size());
+  EXPECT_EQ(101, read.threads[0].tid);
+  EXPECT_EQ("main", read.threads[0].name);
+  EXPECT_EQ(tombstone.threads[0].registers, read.threads[0].registers);
+  EXPECT_EQ(tombstone.threads[0].pcs, read.threads[0].pcs);
+  EXPECT_EQ(102, read.threads[1].tid);
+  EXPECT_EQ("worker", read.threads[1].name);
+  EXPECT_TRUE(read.threads[1].registers.empty());
+  EXPECT_TRUE(read.threads[1].pcs.empty());
+
+  ASSERT_EQ(2U, read.memory.size());
+  EXPECT_EQ(0x8000U, read.memory[0].address);
+  EXPECT_EQ(tombstone.memory[0].data, read.memory[0].data);
+  EXPECT_EQ(0x9000U, read.memory[1].address);
+  EXPECT_EQ(tombstone.memory[1].data, read.memory[1].data);
+}
+
+TEST(TombstoneBinaryTest, compressed) {
+  TemporaryFile tf;
+  BinaryTombstone tombstone = MakeTombstone();
+  ASSERT_TRUE(write_binary_tombstone(tf.fd, tombstone));
+
+  std::string content;
+  ASSERT_TRUE(android::base::ReadFileToString(tf.path, &content));
+  ASSERT_LT(content.size(), 4096U);
+}
+
+TEST(TombstoneBinaryTest, not_a_tombstone) {
+  TemporaryFile tf;
+  ASSERT_TRUE(android::base::WriteStringToFd("*** *** *** text tombstone", tf.fd));
+  ASSERT_EQ(0, lseek(tf.fd, 0, SEEK_SET));
+
+  BinaryTombstone read;
+  ASSERT_FALSE(read_binary_tombstone(tf.fd, &read));
+}
+
+TEST(TombstoneBinaryTest, truncated) {
+  TemporaryFile tf;
+  ASSERT_TRUE(write_binary_tombstone(tf.fd, MakeTombstone()));
+  off_t size = lseek(tf.fd, 0, SEEK_CUR);
+  ASSERT_EQ(0, ftruncate(tf.fd, size - 3));
+  ASSERT_EQ(0, lseek(tf.fd, 0, SEEK_SET));
+
+  BinaryTombstone read;
+  ASSERT_FALSE(read_binary_tombstone(tf.fd, &read));
+}
+
+TEST(TombstoneBinaryTest, unknown_record_skipped) {
+  TemporaryFile tf;
+  BinaryTombstone tombstone;
+  tombstone.process_name = "crasher";
+  ASSERT_TRUE(write_binary_tombstone(tf.fd, tombstone));
+  uint32_t record[3] = {0x1234, 4, 0};
+  ASSERT_TRUE(android::base::WriteFully(tf.fd, record, sizeof(record)));
+  ASSERT_EQ(0, lseek(tf.fd, 0, SEEK_SET));
+
+  BinaryTombstone read;
+  ASSERT_TRUE(read_binary_tombstone(tf.fd, &read));
+  EXPECT_EQ("crasher", read.process_name);
+}
@@ -17,6 +17,7 @@
 #define LOG_TAG "DEBUG"
 
 #include <dirent.h>
+#include <elf.h>
 #include <errno.h>
 #include <fcntl.h>
 #include <inttypes.h>
@@ -27,6 +28,7 @@
 #include <string.h>
 #include <sys/ptrace.h>
 #include <sys/stat.h>
+#include <sys/uio.h>
 #include <time.h>
 
 #include <memory>
@@ -55,6 +57,10 @@ using android::base::StringPrintf;
 
 #define STACK_WORDS 16
 
+// Bytes of code and stack of the crashing thread kept in a binary tombstone.
+#define BINARY_CODE_BYTES 256
+#define BINARY_STACK_BYTES 4096
+
 #define MAX_TOMBSTONES  10
 #define TOMBSTONE_DIR   "/data/tombstones"
 #define TOMBSTONE_TEMPLATE (TOMBSTONE_DIR"/tombstone_%02d")
@@ -375,11 +381,7 @@ static std::string get_addr_string(uintptr_t addr) {
   return addr_str;
 }
 
-static void dump_abort_message(Backtrace* backtrace, log_t* log, uintptr_t address) {
-  if (address == 0) {
-    return;
-  }
-
+static std::string get_abort_message(Backtrace* backtrace, uintptr_t address) {
   address += sizeof(size_t);  // Skip the buffer length.
 
   char msg[512];
@@ -398,8 +400,16 @@ static void dump_abort_message(Backtrace* backtrace, log_t* log, uintptr_t addre
     }
   }
   msg[sizeof(msg) - 1] = '\0';
+  return msg;
+}
+
+static void dump_abort_message(Backtrace* backtrace, log_t* log, uintptr_t address) {
+  if (address == 0) {
+    return;
+  }
 
-  _LOG(log, logtype::HEADER, "Abort message: '%s'\n", msg);
+  _LOG(log, logtype::HEADER, "Abort message: '%s'\n",
+       get_abort_message(backtrace, address).c_str());
 }
 
 static void dump_all_maps(Backtrace* backtrace, BacktraceMap* map, log_t* log, pid_t tid) {
@@ -661,7 +671,8 @@ static void dump_logs(log_t* log, pid_t pid, unsigned int tail) {
 // Dumps all information about the specified pid to the tombstone.
 static void dump_crash(log_t* log, BacktraceMap* map, const OpenFilesList* open_files, pid_t pid,
                        pid_t tid, const std::string& process_name,
-                       const std::map<pid_t, std::string>& threads, uintptr_t abort_msg_address) {
+                       const std::map<pid_t, std::string>& threads, uintptr_t abort_msg_address,
+                       const std::map<pid_t, std::string>* thread_dumps) {
   // don't copy log messages to tombstone unless this is a dev device
   char value[PROPERTY_VALUE_MAX];
   property_get("ro.debuggable", value, "0");
@@ -679,7 +690,12 @@ static void dump_crash(log_t* log, BacktraceMap* map, const OpenFilesList* open_
     pid_t thread_tid = it.first;
     const std::string& thread_name = it.second;
 
-    if (thread_tid != tid) {
+    if (thread_tid == tid) {
+      continue;
+    }
+    if (thread_dumps != nullptr && thread_dumps->count(thread_tid) != 0) {
+      android::base::WriteStringToFd(thread_dumps->at(thread_tid), log->tfd);
+    } else {
       dump_thread(log, pid, thread_tid, process_name, thread_name, map, 0, false);
     }
   }
@@ -750,13 +766,138 @@ int open_tombstone(std::string* out_path) {
 void engrave_tombstone(int tombstone_fd, BacktraceMap* map, const OpenFilesList* open_files,
                        pid_t pid, pid_t tid, const std::string& process_name,
                        const std::map<pid_t, std::string>& threads, uintptr_t abort_msg_address,
-                       std::string* amfd_data) {
+                       std::string* amfd_data, const std::map<pid_t, std::string>* thread_dumps) {
   log_t log;
   log.current_tid = tid;
   log.crashed_tid = tid;
   log.tfd = tombstone_fd;
   log.amfd_data = amfd_data;
-  dump_crash(&log, map, open_files, pid, tid, process_name, threads, abort_msg_address);
+  dump_crash(&log, map, open_files, pid, tid, process_name, threads, abort_msg_address,
+             thread_dumps);
+}
+
+void dump_tombstone_thread(std::string* output, BacktraceMap* map, pid_t pid, pid_t tid,
+                           const std::string& process_name, const std::string& thread_name) {
+  log_t log;
+  log.output_buffer = output;
+  dump_thread(&log, pid, tid, process_name, thread_name, map, 0, false);
+}
+
+static std::unique_ptr<Backtrace> collect_binary_thread(BinaryTombstone::Thread* thread,
+                                                        BacktraceMap* map, pid_t pid, pid_t tid,
+                                                        const std::string& thread_name) {
+  thread->tid = tid;
+  thread->name = thread_name;
+
+  // NT_PRSTATUS is the general purpose register set on every architecture.
+  thread->registers.resize(1024);
+  struct iovec io;
+  io.iov_base = thread->registers.data();
+  io.iov_len = thread->registers.size();
+  if (ptrace(PTRACE_GETREGSET, tid, reinterpret_cast<void*>(NT_PRSTATUS), &io) == -1) {
+    ALOGE("cannot get registers: %s\n", strerror(errno));
+    io.iov_len = 0;
+  }
+  thread->registers.resize(io.iov_len);
+
+  std::unique_ptr<Backtrace> backtrace(Backtrace::Create(pid, tid, map));
+  if (backtrace->Unwind(0)) {
+    for (size_t i = 0; i < backtrace->NumFrames(); i++) {
+      thread->pcs.push_back(backtrace->GetFrame(i)->pc);
+    }
+  } else {
+    ALOGE("Unwind failed: pid = %d, tid = %d", pid, tid);
+  }
+  return backtrace;
+}
+
+static void add_binary_memory(BinaryTombstone* tombstone, Backtrace* backtrace, uintptr_t address,
+                              size_t size) {
+  BinaryTombstone::Memory memory;
+  memory.address = address;
+  memory.data.resize(size);
+  memory.data.resize(backtrace->Read(address, memory.data.data(), size));
+  if (!memory.data.empty()) {
+    tombstone->memory.push_back(std::move(memory));
+  }
+}
+
+void collect_binary_tombstone_thread(BinaryTombstone::Thread* thread, BacktraceMap* map, pid_t pid,
+                                     pid_t tid, const std::string& thread_name) {
+  collect_binary_thread(thread, map, pid, tid, thread_name);
+}
+
+void engrave_tombstone_binary(int tombstone_fd, BacktraceMap* map, pid_t pid, pid_t tid,
+                              const std::string& process_name,
+                              const std::map<pid_t, std::string>& threads,
+                              uintptr_t abort_msg_address,
+                              const std::map<pid_t, BinaryTombstone::Thread>& sibling_threads) {
+  BinaryTombstone tombstone;
+  char fingerprint[PROPERTY_VALUE_MAX];
+  property_get("ro.build.fingerprint", fingerprint, "unknown");
+  tombstone.abi = ABI_STRING;
+  tombstone.build_fingerprint = fingerprint;
+  tombstone.process_name = process_name;
+  tombstone.pid = pid;
+  tombstone.tid = tid;
+
+  siginfo_t si;
+  memset(&si, 0, sizeof(si));
+  if (ptrace(PTRACE_GETSIGINFO, tid, 0, &si) == -1) {
+    ALOGE("cannot get siginfo: %s\n", strerror(errno));
+  } else {
+    tombstone.signo = si.si_signo;
+    tombstone.code = si.si_code;
+    if (signal_has_si_addr(si.si_signo, si.si_code)) {
+      tombstone.fault_address = reinterpret_cast<uintptr_t>(si.si_addr);
+    }
+  }
+
+  tombstone.threads.emplace_back();
+  std::unique_ptr<Backtrace> backtrace = collect_binary_thread(
+      &tombstone.threads.back(), map, pid, tid, threads.find(tid)->second);
+  for (const auto& it : sibling_threads) {
+    tombstone.threads.push_back(it.second);
+  }
+
+  if (abort_msg_address != 0) {
+    tombstone.abort_message = get_abort_message(backtrace.get(), abort_msg_address);
+  }
+  if (backtrace->NumFrames() != 0) {
+    const backtrace_frame_data_t* frame = backtrace->GetFrame(0);
+    add_binary_memory(&tombstone, backtrace.get(), frame->pc - BINARY_CODE_BYTES / 2,
+                      BINARY_CODE_BYTES);
+    add_binary_memory(&tombstone, backtrace.get(), frame->sp, BINARY_STACK_BYTES);
+  }
+
+  if (map) {
+    ScopedBacktraceMapIteratorLock lock(map);
+    for (BacktraceMap::const_iterator it = map->begin(); it != map->end(); ++it) {
+      BinaryTombstone::Map binary_map;
+      binary_map.start = it->start;
+      binary_map.end = it->end;
+      binary_map.offset = it->offset;
+      binary_map.load_bias = it->load_bias;
+      binary_map.flags = it->flags;
+      binary_map.name = it->name;
+
+      // Build ids cost a read each, only get them for maps that need symbolizing.
+      bool has_frame = false;
+      for (const auto& thread : tombstone.threads) {
+        for (uint64_t pc : thread.pcs) {
+          has_frame |= pc >= it->start && pc < it->end;
+        }
+      }
+      if (has_frame) {
+        elf_get_build_id(backtrace.get(), it->start, &binary_map.build_id);
+      }
+      tombstone.maps.push_back(std::move(binary_map));
+    }
+  }
+
+  if (!write_binary_tombstone(tombstone_fd, tombstone)) {
+    ALOGE("failed to write binary tombstone: %s", strerror(errno));
+  }
 }
 
 void engrave_tombstone_ucontext(int tombstone_fd, uintptr_t abort_msg_address, siginfo_t* siginfo,
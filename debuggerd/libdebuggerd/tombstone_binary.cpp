@@ -0,0 +1,254 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "tombstone_binary.h"
+
+#include <string.h>
+
+#include <string>
+#include <vector>
+
+#include <android-base/file.h>
+#include <zlib.h>
+
+enum RecordType : uint32_t {
+  kRecordProcess = 1,
+  kRecordMap = 2,
+  kRecordThread = 3,
+  kRecordMemory = 4,
+};
+
+class RecordWriter {
+ public:
+  template <typename T>
+  void Put(T value) {
+    data_.append(reinterpret_cast<const char*>(&value), sizeof(value));
+  }
+
+  void PutBytes(const void* data, size_t size) {
+    Put<uint32_t>(size);
+    data_.append(reinterpret_cast<const char*>(data), size);
+  }
+
+  void PutString(const std::string& value) { PutBytes(value.data(), value.size()); }
+
+  // Appends everything written so far as one record to |out|.
+  void Finish(uint32_t type, std::string* out) {
+    uint32_t header[2] = {type, static_cast<uint32_t>(data_.size())};
+    out->append(reinterpret_cast<const char*>(header), sizeof(header));
+    out->append(data_);
+    data_.clear();
+  }
+
+ private:
+  std::string data_;
+};
+
+class RecordReader {
+ public:
+  RecordReader(const char* data, size_t size) : data_(data), size_(size) {}
+
+  template <typename T>
+  bool Get(T* value) {
+    if (size_ - pos_ < sizeof(T)) {
+      return false;
+    }
+    memcpy(value, &data_[pos_], sizeof(T));
+    pos_ += sizeof(T);
+    return true;
+  }
+
+  bool GetBytes(const char** data, uint32_t* size) {
+    if (!Get(size) || size_ - pos_ < *size) {
+      return false;
+    }
+    *data = &data_[pos_];
+    pos_ += *size;
+    return true;
+  }
+
+  bool GetString(std::string* value) {
+    const char* data;
+    uint32_t size;
+    if (!GetBytes(&data, &size)) {
+      return false;
+    }
+    value->assign(data, size);
+    return true;
+  }
+
+ private:
+  const char* data_;
+  size_t size_;
+  size_t pos_ = 0;
+};
+
+bool write_binary_tombstone(int fd, const BinaryTombstone& tombstone) {
+  std::string out(kBinaryTombstoneMagic, sizeof(kBinaryTombstoneMagic));
+  out.append(reinterpret_cast<const char*>(&kBinaryTombstoneVersion),
+             sizeof(kBinaryTombstoneVersion));
+
+  RecordWriter record;
+  record.PutString(tombstone.abi);
+  record.PutString(tombstone.build_fingerprint);
+  record.PutString(tombstone.process_name);
+  record.Put(tombstone.pid);
+  record.Put(tombstone.tid);
+  record.Put(tombstone.signo);
+  record.Put(tombstone.code);
+  record.Put(tombstone.fault_address);
+  record.PutString(tombstone.abort_message);
+  record.Finish(kRecordProcess, &out);
+
+  for (const auto& map : tombstone.maps) {
+    record.Put(map.start);
+    record.Put(map.end);
+    record.Put(map.offset);
+    record.Put(map.load_bias);
+    record.Put(map.flags);
+    record.PutString(map.name);
+    record.PutString(map.build_id);
+    record.Finish(kRecordMap, &out);
+  }
+
+  for (const auto& thread : tombstone.threads) {
+    record.Put(thread.tid);
+    record.PutString(thread.name);
+    record.PutBytes(thread.registers.data(), thread.registers.size());
+    record.PutBytes(thread.pcs.data(), thread.pcs.size() * sizeof(uint64_t));
+    record.Finish(kRecordThread, &out);
+  }
+
+  for (const auto& memory : tombstone.memory) {
+    uLongf compressed_size = compressBound(memory.data.size());
+    std::vector<uint8_t> compressed(compressed_size);
+    bool use_compressed = compress2(compressed.data(), &compressed_size, memory.data.data(),
+                                    memory.data.size(), Z_BEST_SPEED) == Z_OK &&
+                          compressed_size < memory.data.size();
+    record.Put(memory.address);
+    record.Put<uint32_t>(memory.data.size());
+    record.Put<uint8_t>(use_compressed);
+    if (use_compressed) {
+      record.PutBytes(compressed.data(), compressed_size);
+    } else {
+      record.PutBytes(memory.data.data(), memory.data.size());
+    }
+    record.Finish(kRecordMemory, &out);
+  }
+
+  return android::base::WriteStringToFd(out, fd);
+}
+
+static bool read_process(RecordReader* reader, BinaryTombstone* tombstone) {
+  return reader->GetString(&tombstone->abi) && reader->GetString(&tombstone->build_fingerprint) &&
+         reader->GetString(&tombstone->process_name) && reader->Get(&tombstone->pid) &&
+         reader->Get(&tombstone->tid) && reader->Get(&tombstone->signo) &&
+         reader->Get(&tombstone->code) && reader->Get(&tombstone->fault_address) &&
+         reader->GetString(&tombstone->abort_message);
+}
+
+static bool read_map(RecordReader* reader, BinaryTombstone::Map* map) {
+  return reader->Get(&map->start) && reader->Get(&map->end) && reader->Get(&map->offset) &&
+         reader->Get(&map->load_bias) && reader->Get(&map->flags) &&
+         reader->GetString(&map->name) && reader->GetString(&map->build_id);
+}
+
+static bool read_thread(RecordReader* reader, BinaryTombstone::Thread* thread) {
+  const char* data;
+  uint32_t size;
+  if (!reader->Get(&thread->tid) || !reader->GetString(&thread->name) ||
+      !reader->GetBytes(&data, &size)) {
+    return false;
+  }
+  thread->registers.assign(data, data + size);
+  if (!reader->GetBytes(&data, &size) || size % sizeof(uint64_t) != 0) {
+    return false;
+  }
+  thread->pcs.resize(size / sizeof(uint64_t));
+  memcpy(thread->pcs.data(), data, size);
+  return true;
+}
+
+static bool read_memory(RecordReader* reader, BinaryTombstone::Memory* memory) {
+  uint32_t size;
+  uint8_t compressed;
+  const char* data;
+  uint32_t data_size;
+  if (!reader->Get(&memory->address) || !reader->Get(&size) || !reader->Get(&compressed) ||
+      !reader->GetBytes(&data, &data_size)) {
+    return false;
+  }
+  if (!compressed) {
+    memory->data.assign(data, data + data_size);
+    return data_size == size;
+  }
+  memory->data.resize(size);
+  uLongf uncompressed_size = size;
+  return uncompress(memory->data.data(), &uncompressed_size,
+                    reinterpret_cast<const Bytef*>(data), data_size) == Z_OK &&
+         uncompressed_size == size;
+}
+
+bool read_binary_tombstone(int fd, BinaryTombstone* tombstone) {
+  std::string content;
+  if (!android::base::ReadFdToString(fd, &content)) {
+    return false;
+  }
+
+  RecordReader file(content.data(), content.size());
+  char magic[sizeof(kBinaryTombstoneMagic)];
+  uint32_t version;
+  if (!file.Get(&magic) || memcmp(magic, kBinaryTombstoneMagic, sizeof(magic)) != 0 ||
+      !file.Get(&version) || version != kBinaryTombstoneVersion) {
+    return false;
+  }
+
+  *tombstone = BinaryTombstone();
+  uint32_t type;
+  while (file.Get(&type)) {
+    const char* payload;
+    uint32_t payload_size;
+    if (!file.GetBytes(&payload, &payload_size)) {
+      return false;
+    }
+
+    RecordReader reader(payload, payload_size);
+    bool valid = true;
+    switch (type) {
+      case kRecordProcess:
+        valid = read_process(&reader, tombstone);
+        break;
+      case kRecordMap:
+        tombstone->maps.emplace_back();
+        valid = read_map(&reader, &tombstone->maps.back());
+        break;
+      case kRecordThread:
+        tombstone->threads.emplace_back();
+        valid = read_thread(&reader, &tombstone->threads.back());
+        break;
+      case kRecordMemory:
+        tombstone->memory.emplace_back();
+        valid = read_memory(&reader, &tombstone->memory.back());
+        break;
+      default:
+        break;
+    }
+    if (!valid) {
+      return false;
+    }
+  }
+  return true;
+}
@@ -44,7 +44,7 @@ bool is_allowed_in_logcat(enum logtype ltype) {
 
 __attribute__((__weak__, visibility("default")))
 void _LOG(log_t* log, enum logtype ltype, const char* fmt, ...) {
-  bool write_to_tombstone = (log->tfd != -1);
+  bool write_to_tombstone = (log->tfd != -1 || log->output_buffer != nullptr);
   bool write_to_logcat = is_allowed_in_logcat(ltype)
                       && log->crashed_tid != -1
                       && log->current_tid != -1
@@ -62,7 +62,11 @@ void _LOG(log_t* log, enum logtype ltype, const char* fmt, ...) {
   }
 
   if (write_to_tombstone) {
-    TEMP_FAILURE_RETRY(write(log->tfd, buf, len));
+    if (log->output_buffer != nullptr) {
+      log->output_buffer->append(buf, len);
+    } else {
+      TEMP_FAILURE_RETRY(write(log->tfd, buf, len));
+    }
   }
 
   if (write_to_logcat) {
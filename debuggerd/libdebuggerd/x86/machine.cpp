@@ -60,3 +60,32 @@ void dump_registers(log_t* log, pid_t tid) {
   _LOG(log, logtype::REGISTERS, "    eip %08lx  ebp %08lx  esp %08lx  flags %08lx\n",
        r.eip, r.ebp, r.esp, r.eflags);
 }
+
+bool get_thread_context(pid_t tid, ucontext_t* uc, uintptr_t* sp) {
+  struct pt_regs r;
+  if (ptrace(PTRACE_GETREGS, tid, 0, &r) == -1) {
+    ALOGE("cannot get registers: %s\n", strerror(errno));
+    return false;
+  }
+
+  memset(uc, 0, sizeof(*uc));
+  greg_t* gregs = uc->uc_mcontext.gregs;
+  gregs[REG_GS] = r.xgs;
+  gregs[REG_FS] = r.xfs;
+  gregs[REG_ES] = r.xes;
+  gregs[REG_DS] = r.xds;
+  gregs[REG_EAX] = r.eax;
+  gregs[REG_EBX] = r.ebx;
+  gregs[REG_ECX] = r.ecx;
+  gregs[REG_EDX] = r.edx;
+  gregs[REG_ESI] = r.esi;
+  gregs[REG_EDI] = r.edi;
+  gregs[REG_EBP] = r.ebp;
+  gregs[REG_ESP] = r.esp;
+  gregs[REG_EIP] = r.eip;
+  gregs[REG_CS] = r.xcs;
+  gregs[REG_EFL] = r.eflags;
+  gregs[REG_SS] = r.xss;
+  *sp = r.esp;
+  return true;
+}
@@ -65,3 +65,34 @@ void dump_registers(log_t* log, pid_t tid) {
   _LOG(log, logtype::REGISTERS, "    rip %016lx  rbp %016lx  rsp %016lx  eflags %016lx\n",
        r.rip, r.rbp, r.rsp, r.eflags);
 }
+
+bool get_thread_context(pid_t tid, ucontext_t* uc, uintptr_t* sp) {
+  struct user_regs_struct r;
+  if (ptrace(PTRACE_GETREGS, tid, 0, &r) == -1) {
+    ALOGE("cannot get registers: %s\n", strerror(errno));
+    return false;
+  }
+
+  memset(uc, 0, sizeof(*uc));
+  greg_t* gregs = uc->uc_mcontext.gregs;
+  gregs[REG_R8] = r.r8;
+  gregs[REG_R9] = r.r9;
+  gregs[REG_R10] = r.r10;
+  gregs[REG_R11] = r.r11;
+  gregs[REG_R12] = r.r12;
+  gregs[REG_R13] = r.r13;
+  gregs[REG_R14] = r.r14;
+  gregs[REG_R15] = r.r15;
+  gregs[REG_RDI] = r.rdi;
+  gregs[REG_RSI] = r.rsi;
+  gregs[REG_RBP] = r.rbp;
+  gregs[REG_RBX] = r.rbx;
+  gregs[REG_RDX] = r.rdx;
+  gregs[REG_RAX] = r.rax;
+  gregs[REG_RCX] = r.rcx;
+  gregs[REG_RSP] = r.rsp;
+  gregs[REG_RIP] = r.rip;
+  gregs[REG_EFL] = r.eflags;
+  *sp = r.rsp;
+  return true;
+}
@@ -0,0 +1,236 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Renders a binary tombstone (see tombstone_binary.h) as text, symbolizing the
+// pcs from the libraries on this machine, or from a symbols directory.
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <map>
+#include <memory>
+#include <string>
+
+#include <android-base/unique_fd.h>
+#include <unwindstack/Elf.h>
+#include <unwindstack/MapInfo.h>
+#include <unwindstack/Memory.h>
+
+#include "tombstone_binary.h"
+
+class Symbolizer {
+ public:
+  explicit Symbolizer(const std::string& symbols_dir) : symbols_dir_(symbols_dir) {}
+
+  std::string GetFunctionName(const BinaryTombstone::Map& map, uint64_t pc) {
+    auto it = elves_.find(&map);
+    if (it == elves_.end()) {
+      it = elves_.emplace(&map, Open(map)).first;
+    }
+    Entry* entry = it->second.get();
+    if (entry == nullptr) {
+      return "";
+    }
+
+    std::string name;
+    uint64_t func_offset;
+    uint64_t rel_pc = entry->elf->GetRelPc(pc, &entry->info);
+    if (!entry->elf->GetFunctionName(rel_pc, &name, &func_offset)) {
+      return "";
+    }
+    if (func_offset != 0) {
+      name += "+" + std::to_string(func_offset);
+    }
+    return name;
+  }
+
+ private:
+  struct Entry {
+    unwindstack::MapInfo info;
+    std::unique_ptr<unwindstack::Elf> elf;
+  };
+
+  std::unique_ptr<Entry> Open(const BinaryTombstone::Map& map) {
+    if (map.name.empty() || map.name[0] != '/') {
+      return nullptr;
+    }
+    std::unique_ptr<Entry> entry(new Entry);
+    entry->info.start = map.start;
+    entry->info.end = map.end;
+    entry->info.offset = map.offset;
+    entry->info.flags = map.flags;
+    entry->info.elf_offset = 0;
+    entry->info.name = symbols_dir_ + map.name;
+    unwindstack::Memory* memory = entry->info.CreateFileMemory();
+    if (memory == nullptr) {
+      return nullptr;
+    }
+    entry->elf.reset(new unwindstack::Elf(memory));
+    if (!entry->elf->Init()) {
+      return nullptr;
+    }
+    entry->elf->InitGnuDebugdata();
+    return entry;
+  }
+
+  std::string symbols_dir_;
+  std::map<const BinaryTombstone::Map*, std::unique_ptr<Entry>> elves_;
+};
+
+static const BinaryTombstone::Map* find_map(const BinaryTombstone& tombstone, uint64_t address) {
+  for (const auto& map : tombstone.maps) {
+    if (address >= map.start && address < map.end) {
+      return &map;
+    }
+  }
+  return nullptr;
+}
+
+static void print_registers(const BinaryTombstone::Thread& thread, size_t word_size) {
+  for (size_t i = 0; i + word_size <= thread.registers.size(); i += word_size) {
+    uint64_t value = 0;
+    memcpy(&value, &thread.registers[i], word_size);
+    printf("%s%0*" PRIx64, (i % (4 * word_size)) == 0 ? "    " : "  ",
+           static_cast<int>(word_size * 2), value);
+    if ((i / word_size) % 4 == 3) {
+      printf("\n");
+    }
+  }
+  if ((thread.registers.size() / word_size) % 4 != 0) {
+    printf("\n");
+  }
+}
+
+static void print_backtrace(const BinaryTombstone& tombstone,
+                            const BinaryTombstone::Thread& thread, size_t word_size,
+                            Symbolizer* symbolizer) {
+  printf("\nbacktrace:\n");
+  for (size_t i = 0; i < thread.pcs.size(); i++) {
+    uint64_t pc = thread.pcs[i];
+    const BinaryTombstone::Map* map = find_map(tombstone, pc);
+    if (map == nullptr) {
+      printf("    #%02zu pc %0*" PRIx64 "  <unknown>\n", i, static_cast<int>(word_size * 2), pc);
+      continue;
+    }
+    uint64_t rel_pc = pc - map->start + map->load_bias;
+    std::string line = map->name.empty() ? "<anonymous>" : map->name;
+    if (map->offset != 0) {
+      char offset[32];
+      snprintf(offset, sizeof(offset), " (offset 0x%" PRIx64 ")", map->offset);
+      line += offset;
+    }
+    std::string function = symbolizer->GetFunctionName(*map, pc);
+    if (!function.empty()) {
+      line += " (" + function + ")";
+    }
+    if (!map->build_id.empty()) {
+      line += " (BuildId: " + map->build_id + ")";
+    }
+    printf("    #%02zu pc %0*" PRIx64 "  %s\n", i, static_cast<int>(word_size * 2), rel_pc,
+           line.c_str());
+  }
+}
+
+static void print_memory(const BinaryTombstone::Memory& memory, size_t word_size) {
+  printf("\nmemory near %" PRIx64 ":\n", memory.address);
+  for (size_t i = 0; i < memory.data.size(); i += 16) {
+    printf("    %0*" PRIx64, static_cast<int>(word_size * 2), memory.address + i);
+    std::string ascii;
+    for (size_t j = i; j < std::min(i + 16, memory.data.size()); j++) {
+      uint8_t byte = memory.data[j];
+      printf("%s%02x", (j - i) % 4 == 0 ? " " : "", byte);
+      ascii += (byte >= 0x20 && byte < 0x7f) ? static_cast<char>(byte) : '.';
+    }
+    printf("  %s\n", ascii.c_str());
+  }
+}
+
+static void usage() {
+  fprintf(stderr, "usage: tombstone_symbolize [-s SYMBOLS_DIR] TOMBSTONE\n");
+  fprintf(stderr, "  -s  look for the libraries under SYMBOLS_DIR, for example $OUT/symbols\n");
+}
+
+int main(int argc, char** argv) {
+  std::string symbols_dir;
+  int opt;
+  while ((opt = getopt(argc, argv, "s:")) != -1) {
+    if (opt == 's') {
+      symbols_dir = optarg;
+    } else {
+      usage();
+      return 1;
+    }
+  }
+  if (optind != argc - 1) {
+    usage();
+    return 1;
+  }
+
+  android::base::unique_fd fd(TEMP_FAILURE_RETRY(open(argv[optind], O_RDONLY | O_CLOEXEC)));
+  if (fd == -1) {
+    fprintf(stderr, "failed to open %s: %s\n", argv[optind], strerror(errno));
+    return 1;
+  }
+  BinaryTombstone tombstone;
+  if (!read_binary_tombstone(fd, &tombstone)) {
+    fprintf(stderr, "%s is not a valid binary tombstone\n", argv[optind]);
+    return 1;
+  }
+
+  size_t word_size = tombstone.abi.find("64") != std::string::npos ? 8 : 4;
+  Symbolizer symbolizer(symbols_dir);
+
+  printf("*** *** *** *** *** *** *** *** *** *** *** *** *** *** *** ***\n");
+  printf("Build fingerprint: '%s'\n", tombstone.build_fingerprint.c_str());
+  printf("ABI: '%s'\n", tombstone.abi.c_str());
+  for (size_t i = 0; i < tombstone.threads.size(); i++) {
+    const BinaryTombstone::Thread& thread = tombstone.threads[i];
+    if (i != 0) {
+      printf("--- --- --- --- --- --- --- --- --- --- --- --- --- --- --- ---\n");
+    }
+    printf("pid: %d, tid: %d, name: %s  >>> %s <<<\n", tombstone.pid, thread.tid,
+           thread.name.c_str(), tombstone.process_name.c_str());
+    if (i == 0) {
+      printf("signal %d, code %d, fault addr 0x%" PRIx64 "\n", tombstone.signo, tombstone.code,
+             tombstone.fault_address);
+      if (!tombstone.abort_message.empty()) {
+        printf("Abort message: '%s'\n", tombstone.abort_message.c_str());
+      }
+    }
+    print_registers(thread, word_size);
+    print_backtrace(tombstone, thread, word_size, &symbolizer);
+    if (i == 0) {
+      for (const auto& memory : tombstone.memory) {
+        print_memory(memory, word_size);
+      }
+    }
+  }
+
+  printf("\nmemory map:\n");
+  for (const auto& map : tombstone.maps) {
+    printf("    %0*" PRIx64 "-%0*" PRIx64 " %c%c%c %8" PRIx64 "  %s\n",
+           static_cast<int>(word_size * 2), map.start, static_cast<int>(word_size * 2),
+           map.end - 1, (map.flags & PROT_READ) ? 'r' : '-', (map.flags & PROT_WRITE) ? 'w' : '-',
+           (map.flags & PROT_EXEC) ? 'x' : '-', map.offset, map.name.c_str());
+  }
+  return 0;
+}
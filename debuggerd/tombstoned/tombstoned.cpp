@@ -21,7 +21,9 @@
 #include <sys/types.h>
 #include <unistd.h>
 
+#include <algorithm>
 #include <array>
+#include <chrono>
 #include <deque>
 #include <string>
 #include <unordered_map>
@@ -67,6 +69,9 @@ struct Crash {
   std::string crash_path;
 
   DebuggerdDumpType crash_type;
+
+  // When the request was put in the queue, if it had to wait.
+  std::chrono::steady_clock::time_point queued_time;
 };
 
 class CrashQueue {
@@ -78,7 +83,7 @@ class CrashQueue {
         dir_fd_(open(dir_path.c_str(), O_DIRECTORY | O_RDONLY | O_CLOEXEC)),
         max_artifacts_(max_artifacts),
         next_artifact_(0),
-        max_concurrent_dumps_(max_concurrent_dumps),
+        max_concurrent_dumps_(std::max<size_t>(1, max_concurrent_dumps)),
         num_concurrent_dumps_(0) {
     if (dir_fd_ == -1) {
       PLOG(FATAL) << "failed to open directory: " << dir_path;
@@ -98,14 +103,14 @@ class CrashQueue {
   static CrashQueue* for_tombstones() {
     static CrashQueue queue("/data/tombstones", "tombstone_" /* file_name_prefix */,
                             GetIntProperty("tombstoned.max_tombstone_count", 10),
-                            1 /* max_concurrent_dumps */);
+                            GetIntProperty("tombstoned.max_concurrent_tombstones", 1));
     return &queue;
   }
 
   static CrashQueue* for_anrs() {
     static CrashQueue queue("/data/anr", "trace_" /* file_name_prefix */,
                             GetIntProperty("tombstoned.max_anr_count", 64),
-                            4 /* max_concurrent_dumps */);
+                            GetIntProperty("tombstoned.max_concurrent_anrs", 4));
     return &queue;
   }
 
@@ -131,7 +136,17 @@ class CrashQueue {
 
   bool maybe_enqueue_crash(Crash* crash) {
     if (num_concurrent_dumps_ == max_concurrent_dumps_) {
-      queued_requests_.push_back(crash);
+      crash->queued_time = std::chrono::steady_clock::now();
+      if (crash->crash_type == kDebuggerdTombstone) {
+        // A process that crashed is stuck until it's dumped, so let it go ahead of
+        // backtrace requests (debuggerd -b), which are only inspecting a live process.
+        auto it = std::find_if(queued_requests_.begin(), queued_requests_.end(), [](Crash* queued) {
+          return queued->crash_type != kDebuggerdTombstone;
+        });
+        queued_requests_.insert(it, crash);
+      } else {
+        queued_requests_.push_back(crash);
+      }
       return true;
     }
 
@@ -142,6 +157,7 @@ class CrashQueue {
     while (!queued_requests_.empty() && num_concurrent_dumps_ < max_concurrent_dumps_) {
       Crash* next_crash = queued_requests_.front();
       queued_requests_.pop_front();
+      record_wait(next_crash);
       handler(next_crash);
     }
   }
@@ -151,6 +167,18 @@ class CrashQueue {
   void on_crash_completed() { --num_concurrent_dumps_; }
 
  private:
+  void record_wait(const Crash* crash) {
+    auto wait = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now() - crash->queued_time);
+    ++num_waits_;
+    total_wait_ += wait;
+    max_wait_ = std::max(max_wait_, wait);
+    LOG(INFO) << "pid " << crash->crash_pid << " waited " << wait.count() << "ms in " << dir_path_
+              << " queue (" << queued_requests_.size() << " still queued; " << num_waits_
+              << " waits, average " << (total_wait_ / num_waits_).count() << "ms, max "
+              << max_wait_.count() << "ms)";
+  }
+
   void find_oldest_artifact() {
     size_t oldest_tombstone = 0;
     time_t oldest_time = std::numeric_limits<time_t>::max();
@@ -188,8 +216,13 @@ class CrashQueue {
   const size_t max_concurrent_dumps_;
   size_t num_concurrent_dumps_;
 
+  // Tombstone requests come before any other type of request.
   std::deque<Crash*> queued_requests_;
 
+  size_t num_waits_ = 0;
+  std::chrono::milliseconds total_wait_{0};
+  std::chrono::milliseconds max_wait_{0};
+
   DISALLOW_COPY_AND_ASSIGN(CrashQueue);
 };
 
@@ -0,0 +1,86 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <string>
+
+#include <benchmark/benchmark.h>
+
+#include <demangle.h>
+
+#include "Demangler.h"
+
+// Names from libart, libc++ and libc as they show up in backtraces.
+static const char* kSymbols[] = {
+  "_ZN3art11interpreter6DoCallILb0ELb0EEEbPNS_9ArtMethodEPNS_6ThreadERNS_11ShadowFrameEPKNS_11InstructionEtPNS_6JValueE",
+  "_ZN3art11interpreter20ExecuteSwitchImplCppILb0ELb0EEEvPNS0_27SwitchImplContextE",
+  "_ZN3art9ArtMethod6InvokeEPNS_6ThreadEPjjPNS_6JValueEPKc",
+  "_ZN3art6Thread14CreateCallbackEPv",
+  "_ZN3art6Thread10RunCheckpointEPNS_7ClosureE",
+  "_ZN3art2gc4Heap22CollectGarbageInternalENS0_9collector6GcTypeENS0_7GcCauseEb",
+  "_ZN3art7Monitor4WaitEPNS_6ThreadElibNS_11ThreadStateE",
+  "_ZN3art9JNIEnvExt11NewLocalRefEPNS_6mirror6ObjectE",
+  "_ZN3art12_GLOBAL__N_18CheckJNI11CallMethodVERNS_18ScopedObjectAccessEP7_JNIEnvP8_jobjectP7_jclassP10_jmethodIDSt9__va_listNS_9Primitive4TypeENS_10InvokeTypeE",
+  "_ZNSt3__112basic_stringIcNS_11char_traitsIcEENS_9allocatorIcEEE6appendEPKcm",
+  "_ZNSt3__16vectorIiNS_9allocatorIiEEE21__push_back_slow_pathIRKiEEvOT_",
+  "_ZNSt3__113basic_ostreamIcNS_11char_traitsIcEEE5writeEPKcl",
+  "_ZNKSt3__18functionIFvvEEclEv",
+  "_ZN7android6Looper9pollInnerEi",
+  "_ZN7android6Looper8pollOnceEiPiS1_PPv",
+  "_ZN7android14IPCThreadState14talkWithDriverEb",
+  "_ZN7android14IPCThreadState20getAndExecuteCommandEv",
+  "_ZN7android6Thread11_threadLoopEPv",
+  "_ZL15__pthread_startPv",
+  "_Z15__libc_init_mainPvPFvvEPFivE",
+};
+
+static constexpr size_t kSymbolCount = sizeof(kSymbols) / sizeof(kSymbols[0]);
+
+// What demangle() did before: a new Demangler for every name.
+static void BM_Demangler_Parse_new(benchmark::State& state) {
+  while (state.KeepRunning()) {
+    for (const char* symbol : kSymbols) {
+      Demangler demangler;
+      benchmark::DoNotOptimize(demangler.Parse(symbol));
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * kSymbolCount);
+}
+BENCHMARK(BM_Demangler_Parse_new);
+
+// One Demangler for every name, with no cache.
+static void BM_Demangler_Parse_reused(benchmark::State& state) {
+  Demangler demangler;
+  while (state.KeepRunning()) {
+    for (const char* symbol : kSymbols) {
+      benchmark::DoNotOptimize(demangler.Parse(symbol));
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * kSymbolCount);
+}
+BENCHMARK(BM_Demangler_Parse_reused);
+
+// demangle(), with every name in the cache after the first pass.
+static void BM_demangle(benchmark::State& state) {
+  while (state.KeepRunning()) {
+    for (const char* symbol : kSymbols) {
+      benchmark::DoNotOptimize(demangle(symbol));
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * kSymbolCount);
+}
+BENCHMARK(BM_demangle);
+
+BENCHMARK_MAIN();
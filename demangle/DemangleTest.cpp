@@ -449,3 +449,17 @@ TEST(DemangleTest, demangle) {
   str = demangle("Xa");
   ASSERT_EQ("Xa", str);
 }
+
+TEST(DemangleTest, demangle_repeated) {
+  // Enough different names to push the first ones out of the cache, and each
+  // name again after that.
+  for (size_t pass = 0; pass < 3; pass++) {
+    for (size_t i = 0; i < 300; i++) {
+      std::string number(std::to_string(i));
+      std::string name("_ZN3art" + std::to_string(number.size() + 1) + 'f' + number + "Ei");
+      ASSERT_EQ("art::f" + number + "(int)", demangle(name.c_str())) << name;
+    }
+    ASSERT_EQ("a::b::c(a::b)", demangle("_ZN1a1b1cES0_"));
+    ASSERT_EQ("_Za", demangle("_Za"));
+  }
+}
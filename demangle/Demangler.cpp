@@ -15,10 +15,13 @@
  */
 
 #include <assert.h>
+#include <stdint.h>
+#include <string.h>
 
 #include <cctype>
 #include <stack>
 #include <string>
+#include <utility>
 #include <vector>
 
 #include "Demangler.h"
@@ -393,7 +396,7 @@ const char* Demangler::ParseComplexArgument(const char* name) {
 
 void Demangler::FinalizeTemplate() {
   std::string arg_str(GetArgumentsString());
-  cur_state_ = state_stack_.top();
+  cur_state_ = std::move(state_stack_.top());
   state_stack_.pop();
   cur_state_.str += '<' + arg_str + '>';
 }
@@ -454,7 +457,7 @@ const char* Demangler::ParseComplexString(const char* name) {
   }
   if (*name == 'I') {
     // Save the current argument state.
-    state_stack_.push(cur_state_);
+    state_stack_.push(std::move(cur_state_));
     cur_state_.Clear();
 
     parse_funcs_.push_back(parse_func_);
@@ -507,7 +510,7 @@ const char* Demangler::ParseFunctionArgument(const char* name) {
     }
     str += cur_state_.args[0];
 
-    cur_state_ = state_stack_.top();
+    cur_state_ = std::move(state_stack_.top());
     state_stack_.pop();
     cur_state_.args.emplace_back(std::move(str));
 
@@ -568,7 +571,7 @@ const char* Demangler::ParseArguments(const char* name) {
       }
     }
 
-    state_stack_.push(cur_state_);
+    state_stack_.push(std::move(cur_state_));
 
     cur_state_.Clear();
 
@@ -620,7 +623,7 @@ const char* Demangler::ParseArguments(const char* name) {
 
   case 'I':
     // Save the current argument state.
-    state_stack_.push(cur_state_);
+    state_stack_.push(std::move(cur_state_));
     cur_state_.Clear();
 
     parse_funcs_.push_back(parse_func_);
@@ -742,7 +745,77 @@ std::string Demangler::Parse(const char* name, size_t max_length) {
   return function_name_ + arg_str + function_suffix_;
 }
 
+// Symbolizing backtraces demangles the same few functions over and over, so
+// demangle() remembers the last names it did on each thread.  Four way set
+// associative, least recently used out.
+class DemangleCache {
+ public:
+  const std::string* Find(const char* name, uint32_t hash) {
+    Entry* set = &entries_[(hash % kSets) * kWays];
+    for (size_t i = 0; i < kWays; i++) {
+      if (set[i].hash == hash && set[i].name == name) {
+        set[i].last_used = ++clock_;
+        return &set[i].demangled;
+      }
+    }
+    return nullptr;
+  }
+
+  void Add(const char* name, uint32_t hash, const std::string& demangled) {
+    Entry* set = &entries_[(hash % kSets) * kWays];
+    Entry* oldest = &set[0];
+    for (size_t i = 1; i < kWays; i++) {
+      if (set[i].last_used < oldest->last_used) {
+        oldest = &set[i];
+      }
+    }
+    oldest->hash = hash;
+    oldest->name = name;
+    oldest->demangled = demangled;
+    oldest->last_used = ++clock_;
+  }
+
+  static uint32_t Hash(const char* name, size_t length) {
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < length; i++) {
+      hash = (hash ^ static_cast<uint8_t>(name[i])) * 16777619u;
+    }
+    return hash;
+  }
+
+ private:
+  static constexpr size_t kSets = 32;
+  static constexpr size_t kWays = 4;
+
+  struct Entry {
+    uint32_t hash = 0;
+    uint32_t last_used = 0;
+    std::string name;
+    std::string demangled;
+  };
+  Entry entries_[kSets * kWays];
+  uint32_t clock_ = 0;
+};
+
 std::string demangle(const char* name) {
-  Demangler demangler;
-  return demangler.Parse(name);
+  if (name[0] != '_' || name[1] != 'Z') {
+    return name;
+  }
+
+  // The demangler keeps its buffers from one name to the next.
+  static thread_local Demangler demangler;
+  static thread_local DemangleCache cache;
+
+  size_t length = strlen(name);
+  if (length >= Demangler::kMaxDefaultLength) {
+    return demangler.Parse(name);
+  }
+  uint32_t hash = DemangleCache::Hash(name, length);
+  const std::string* cached = cache.Find(name, hash);
+  if (cached != nullptr) {
+    return *cached;
+  }
+  std::string demangled(demangler.Parse(name));
+  cache.Add(name, hash, demangled);
+  return demangled;
 }
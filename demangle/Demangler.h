@@ -27,6 +27,9 @@ class Demangler {
  public:
   Demangler() = default;
 
+  // The default maximum string length string to process.
+  static constexpr size_t kMaxDefaultLength = 2048;
+
   // NOTE: The max_length is not guaranteed to be the absolute max length
   // of a string that will be rejected. Under certain circumstances the
   // length check will not occur until after the second letter of a pair
@@ -80,7 +83,9 @@ class Demangler {
     std::vector<std::string> suffixes;
     std::string last_save;
   };
-  std::stack<StateData> state_stack_;
+  // A vector rather than a deque, which would free and allocate its blocks
+  // again for every name.
+  std::stack<StateData, std::vector<StateData>> state_stack_;
   std::string first_save_;
   StateData cur_state_;
 
@@ -97,9 +102,6 @@ class Demangler {
   const char* FindFunctionName(const char* name);
   const char* Fail(const char*) { return nullptr; }
 
-  // The default maximum string length string to process.
-  static constexpr size_t kMaxDefaultLength = 2048;
-
   static constexpr const char* kTypes[] = {
     "signed char",        // a
     "bool",               // b
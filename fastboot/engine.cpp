@@ -38,11 +38,20 @@
 #include <sys/types.h>
 #include <unistd.h>
 
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <android-base/stringprintf.h>
+#include <sparse/sparse.h>
+
 #define OP_DOWNLOAD   1
 #define OP_COMMAND    2
 #define OP_QUERY      3
 #define OP_NOTICE     4
-#define OP_DOWNLOAD_SPARSE 5
+#define OP_FLASH_SPARSE 5
 #define OP_WAIT_FOR_DISCONNECT 6
 #define OP_DOWNLOAD_FD 7
 #define OP_UPLOAD 8
@@ -66,13 +75,15 @@ struct Action {
 
     const char *msg;
     int (*func)(Action* a, int status, const char* resp);
-
-    double start;
 };
 
 static Action *action_list = 0;
 static Action *action_last = 0;
 
+// The queue is shared by every device being flashed, so the start of the
+// action each thread is running can't live in the Action.
+static thread_local double action_start;
+
 
 
 
@@ -89,13 +100,13 @@ bool fb_getvar(Transport* transport, const std::string& key, std::string* value)
     return true;
 }
 
-static int cb_default(Action* a, int status, const char* resp) {
+static int cb_default(Action*, int status, const char* resp) {
     if (status) {
-        fprintf(stderr,"FAILED (%s)\n", resp);
+        report("FAILED (%s)\n", resp);
     } else {
         double split = now();
-        fprintf(stderr,"OKAY [%7.3fs]\n", (split - a->start));
-        a->start = split;
+        report("OKAY [%7.3fs]\n", (split - action_start));
+        action_start = split;
     }
     return status;
 }
@@ -126,8 +137,6 @@ static Action *queue_action(unsigned op, const char *fmt, ...)
     a->op = op;
     a->func = cb_default;
 
-    a->start = -1;
-
     return a;
 }
 
@@ -171,17 +180,99 @@ void fb_queue_flash(const char *ptn, void *data, uint32_t sz)
     a->msg = mkmsg("writing '%s'", ptn);
 }
 
-void fb_queue_flash_sparse(const char* ptn, struct sparse_file* s, uint32_t sz, size_t current,
-                           size_t total) {
-    Action *a;
+// The pieces of a sparse image too big for a single download. A thread of its
+// own splits them off from when the image is queued, so the first one can be
+// sent as soon as it's ready rather than once all of them are. Devices flashed
+// in parallel all get the same pieces.
+class SparsePieces {
+  public:
+    struct Piece {
+        sparse_file* file;
+        int64_t size;
+    };
+
+    SparsePieces(sparse_file* s, uint32_t max_size) : s_(s), max_size_(max_size) {
+#if defined(_WIN32)
+        // Without mmap, libsparse counts file backed chunks by reading them
+        // through the shared file offset, which the downloads also use.
+        Split();
+#else
+        std::thread(&SparsePieces::Split, this).detach();
+#endif
+    }
 
-    a = queue_action(OP_DOWNLOAD_SPARSE, "");
-    a->data = s;
-    a->size = 0;
-    a->msg = mkmsg("sending sparse '%s' %zu/%zu (%d KB)", ptn, current, total, sz / 1024);
+    // Waits for piece |i|, returning false once past the last one.
+    bool Get(size_t i, Piece* piece) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        cv_.wait(lock, [this, i]() { return i < pieces_.size() || done_; });
+        if (failed_) die("Failed to resparse");
+        if (i >= pieces_.size()) return false;
+        *piece = pieces_[i];
+        return true;
+    }
 
-    a = queue_action(OP_COMMAND, "flash:%s", ptn);
-    a->msg = mkmsg("writing '%s' %zu/%zu", ptn, current, total);
+    // "?" until the last piece has been split off.
+    std::string Total() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return done_ ? std::to_string(pieces_.size()) : "?";
+    }
+
+  private:
+    void Split() {
+        bool more;
+        do {
+            sparse_file* file = sparse_file_resparse_next(s_, max_size_, &more);
+            int64_t size = file ? sparse_file_len(file, true, false) : -1;
+
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (size < 0) {
+                failed_ = true;
+                more = false;
+            } else {
+                pieces_.push_back({file, size});
+            }
+            done_ = !more;
+            cv_.notify_all();
+        } while (more);
+    }
+
+    sparse_file* s_;
+    uint32_t max_size_;
+
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    std::vector<Piece> pieces_;
+    bool done_ = false;
+    bool failed_ = false;
+};
+
+void fb_queue_flash_sparse(const char* ptn, struct sparse_file* s, uint32_t max_size) {
+    Action* a = queue_action(OP_FLASH_SPARSE, "flash:%s", ptn);
+    a->data = new SparsePieces(s, max_size);
+}
+
+// Sends and writes each piece in turn, reporting them as separately queued
+// downloads and flashes would be.
+static int execute_flash_sparse(Transport* transport, Action* a) {
+    SparsePieces* pieces = reinterpret_cast<SparsePieces*>(a->data);
+    const char* ptn = a->cmd + strlen("flash:");
+    SparsePieces::Piece piece;
+    for (size_t i = 0; pieces->Get(i, &piece); ++i) {
+        report("sending sparse '%s' %zu/%s (%" PRId64 " KB)...\n", ptn, i + 1,
+               pieces->Total().c_str(), piece.size / 1024);
+        SparseDownloadTiming timing;
+        int status = fb_download_data_sparse(transport, piece.file, &timing);
+        status = a->func(a, status, status ? fb_get_error().c_str() : "");
+        if (status) return status;
+        report("  generate %.3fs, send %.3fs, stalled %.3fs\n", timing.generate,
+               timing.send, timing.stalled);
+
+        report("writing '%s' %zu/%s...\n", ptn, i + 1, pieces->Total().c_str());
+        status = fb_command(transport, a->cmd);
+        status = a->func(a, status, status ? fb_get_error().c_str() : "");
+        if (status) return status;
+    }
+    return 0;
 }
 
 static int match(const char* str, const char** value, unsigned count) {
@@ -215,16 +306,16 @@ static int cb_check(Action* a, int status, const char* resp, int invert)
     int yes;
 
     if (status) {
-        fprintf(stderr,"FAILED (%s)\n", resp);
+        report("FAILED (%s)\n", resp);
         return status;
     }
 
     if (a->prod) {
         if (strcmp(a->prod, cur_product) != 0) {
             double split = now();
-            fprintf(stderr,"IGNORE, product is %s required only for %s [%7.3fs]\n",
-                    cur_product, a->prod, (split - a->start));
-            a->start = split;
+            report("IGNORE, product is %s required only for %s [%7.3fs]\n",
+                   cur_product, a->prod, (split - action_start));
+            action_start = split;
             return 0;
         }
     }
@@ -234,19 +325,17 @@ static int cb_check(Action* a, int status, const char* resp, int invert)
 
     if (yes) {
         double split = now();
-        fprintf(stderr,"OKAY [%7.3fs]\n", (split - a->start));
-        a->start = split;
+        report("OKAY [%7.3fs]\n", (split - action_start));
+        action_start = split;
         return 0;
     }
 
-    fprintf(stderr,"FAILED\n\n");
-    fprintf(stderr,"Device %s is '%s'.\n", a->cmd + 7, resp);
-    fprintf(stderr,"Update %s '%s'",
-            invert ? "rejects" : "requires", value[0]);
+    std::string values = android::base::StringPrintf("'%s'", value[0]);
     for (n = 1; n < count; n++) {
-        fprintf(stderr," or '%s'", value[n]);
+        values += android::base::StringPrintf(" or '%s'", value[n]);
     }
-    fprintf(stderr,".\n\n");
+    report("FAILED\n\nDevice %s is '%s'.\nUpdate %s %s.\n\n", a->cmd + 7, resp,
+           invert ? "rejects" : "requires", values.c_str());
     return -1;
 }
 
@@ -279,11 +368,11 @@ void fb_queue_require(const char *prod, const char *var,
 
 static int cb_display(Action* a, int status, const char* resp) {
     if (status) {
-        fprintf(stderr, "%s FAILED (%s)\n", a->cmd, resp);
+        report("%s FAILED (%s)\n", a->cmd, resp);
         return status;
     }
-    fprintf(stderr, "%s: %s\n", static_cast<const char*>(a->data), resp);
-    free(static_cast<char*>(a->data));
+    // Not freed: every device being flashed runs this action.
+    report("%s: %s\n", static_cast<const char*>(a->data), resp);
     return 0;
 }
 
@@ -293,24 +382,24 @@ void fb_queue_display(const char* var, const char* prettyname) {
     a->func = cb_display;
 }
 
-static int cb_save(Action* a, int status, const char* resp) {
+static int cb_save_product(Action* a, int status, const char* resp) {
     if (status) {
-        fprintf(stderr, "%s FAILED (%s)\n", a->cmd, resp);
+        report("%s FAILED (%s)\n", a->cmd, resp);
         return status;
     }
-    strncpy(reinterpret_cast<char*>(a->data), resp, a->size);
+    // cur_product is per thread, so this has to be looked up here rather
+    // than when the action is queued.
+    strncpy(cur_product, resp, sizeof(cur_product) - 1);
     return 0;
 }
 
-void fb_queue_query_save(const char* var, char* dest, uint32_t dest_size) {
-    Action* a = queue_action(OP_QUERY, "getvar:%s", var);
-    a->data = dest;
-    a->size = dest_size;
-    a->func = cb_save;
+void fb_queue_query_product() {
+    Action* a = queue_action(OP_QUERY, "getvar:product");
+    a->func = cb_save_product;
 }
 
 static int cb_do_nothing(Action*, int , const char*) {
-    fprintf(stderr,"\n");
+    report("\n");
     return 0;
 }
 
@@ -373,11 +462,10 @@ int64_t fb_execute_queue(Transport* transport)
 
     double start = -1;
     for (a = action_list; a; a = a->next) {
-        a->start = now();
-        if (start < 0) start = a->start;
+        action_start = now();
+        if (start < 0) start = action_start;
         if (a->msg) {
-            // fprintf(stderr,"%30s... ",a->msg);
-            fprintf(stderr,"%s...\n",a->msg);
+            report("%s...\n",a->msg);
         }
         if (a->op == OP_DOWNLOAD) {
             status = fb_download_data(transport, a->data, a->size);
@@ -396,10 +484,9 @@ int64_t fb_execute_queue(Transport* transport)
             status = a->func(a, status, status ? fb_get_error().c_str() : resp);
             if (status) break;
         } else if (a->op == OP_NOTICE) {
-            fprintf(stderr,"%s\n",(char*)a->data);
-        } else if (a->op == OP_DOWNLOAD_SPARSE) {
-            status = fb_download_data_sparse(transport, reinterpret_cast<sparse_file*>(a->data));
-            status = a->func(a, status, status ? fb_get_error().c_str() : "");
+            report("%s\n",(char*)a->data);
+        } else if (a->op == OP_FLASH_SPARSE) {
+            status = execute_flash_sparse(transport, a);
             if (status) break;
         } else if (a->op == OP_WAIT_FOR_DISCONNECT) {
             transport->WaitForDisconnect();
@@ -411,6 +498,31 @@ int64_t fb_execute_queue(Transport* transport)
         }
     }
 
-    fprintf(stderr,"finished. total time: %.3fs\n", (now() - start));
+    report("finished. total time: %.3fs\n", (now() - start));
     return status;
 }
+
+int64_t fb_execute_queue_parallel(const std::vector<Transport*>& transports,
+                                  const std::vector<std::string>& labels)
+{
+    std::vector<int64_t> statuses(transports.size());
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < transports.size(); i++) {
+        threads.emplace_back([&, i]() {
+            set_report_label(labels[i].c_str());
+            statuses[i] = fb_execute_queue(transports[i]);
+        });
+    }
+
+    size_t failed = 0;
+    for (size_t i = 0; i < threads.size(); i++) {
+        threads[i].join();
+        if (statuses[i]) {
+            fprintf(stderr, "%s: FAILED\n", labels[i].c_str());
+            failed++;
+        }
+    }
+    fprintf(stderr, "%zu of %zu devices succeeded\n", transports.size() - failed,
+            transports.size());
+    return failed ? -1 : 0;
+}
@@ -73,9 +73,12 @@ using android::base::unique_fd;
 #define O_BINARY 0
 #endif
 
-char cur_product[FB_RESPONSE_SZ + 1];
+thread_local char cur_product[FB_RESPONSE_SZ + 1];
 
 static const char* serial = nullptr;
+// Every device given with -s, or found by --all.
+static std::vector<std::string> serials;
+static bool all_devices = false;
 static const char* cmdline = nullptr;
 static unsigned short vendor_id = 0;
 static int long_listing = 0;
@@ -207,8 +210,11 @@ static int match_fastboot_with_serial(usb_ifc_info* info, const char* local_seri
     return 0;
 }
 
+// The device usb_open is looking for, since its callback has no context.
+static const char* usb_match_serial = nullptr;
+
 static int match_fastboot(usb_ifc_info* info) {
-    return match_fastboot_with_serial(info, serial);
+    return match_fastboot_with_serial(info, usb_match_serial);
 }
 
 static int list_devices_callback(usb_ifc_info* info) {
@@ -238,17 +244,10 @@ static int list_devices_callback(usb_ifc_info* info) {
 //
 // If |serial| is non-null but invalid, this prints an error message to stderr and returns nullptr.
 // Otherwise it blocks until the target is available.
-//
-// The returned Transport is a singleton, so multiple calls to this function will return the same
-// object, and the caller should not attempt to delete the returned Transport.
-static Transport* open_device() {
-    static Transport* transport = nullptr;
+static Transport* open_device(const char* serial) {
+    Transport* transport = nullptr;
     bool announce = true;
 
-    if (transport != nullptr) {
-        return transport;
-    }
-
     Socket::Protocol protocol = Socket::Protocol::kTcp;
     std::string host;
     int port = 0;
@@ -288,6 +287,7 @@ static Transport* open_device() {
                 fprintf(stderr, "error: %s\n", error.c_str());
             }
         } else {
+            usb_match_serial = serial;
             transport = usb_open(match_fastboot);
         }
 
@@ -303,6 +303,69 @@ static Transport* open_device() {
     }
 }
 
+// Opens the device given by -s. The returned Transport is a singleton, so multiple calls to this
+// function will return the same object, and the caller should not attempt to delete it.
+static Transport* open_device() {
+    static Transport* transport = nullptr;
+    if (transport == nullptr) {
+        transport = open_device(serial);
+    }
+    return transport;
+}
+
+static int collect_devices_callback(usb_ifc_info* info) {
+    if (match_fastboot_with_serial(info, nullptr) == 0) {
+        if (!info->writable) {
+            fprintf(stderr, "skipping %s: %s\n", info->device_path,
+                    UsbNoPermissionsShortHelpText().c_str());
+        } else if (info->serial_number[0]) {
+            serials.push_back(info->serial_number);
+        } else {
+            serials.push_back(info->device_path);
+        }
+    }
+    return -1;
+}
+
+// Checks that |transport| has the same answers as |reference| for the variables building the
+// action queue depends on, since the queue is only built once, against the first device.
+static bool matches_first_device(Transport* reference, Transport* transport,
+                                 const std::string& label) {
+    static const char* const kVars[] = {"product", "slot-count", "current-slot",
+                                        "max-download-size"};
+    for (const char* var : kVars) {
+        std::string expected;
+        std::string actual;
+        bool has_expected = fb_getvar(reference, var, &expected);
+        bool has_actual = fb_getvar(transport, var, &actual);
+        if (has_expected != has_actual || expected != actual) {
+            fprintf(stderr, "error: %s has %s '%s', but %s has '%s'\n", label.c_str(), var,
+                    actual.c_str(), serials[0].c_str(), expected.c_str());
+            return false;
+        }
+    }
+    return true;
+}
+
+// Opens every device in |serials|. The first one is the one open_device() returns.
+static bool open_devices(std::vector<Transport*>* transports) {
+    serial = serials[0].c_str();
+    Transport* first = open_device();
+    if (first == nullptr) {
+        return false;
+    }
+    transports->push_back(first);
+
+    for (size_t i = 1; i < serials.size(); i++) {
+        Transport* transport = open_device(serials[i].c_str());
+        if (transport == nullptr || !matches_first_device(first, transport, serials[i])) {
+            return false;
+        }
+        transports->push_back(transport);
+    }
+    return true;
+}
+
 static void list_devices() {
     // We don't actually open a USB device here,
     // just getting our callback called so we can
@@ -388,6 +451,14 @@ static int show_help() {
             "                                           For ethernet, provide an address in the\n"
             "                                           form <protocol>:<hostname>[:port] where\n"
             "                                           <protocol> is either tcp or udp.\n"
+            "                                           Repeat -s, or separate devices with\n"
+            "                                           commas, to run the commands on all of\n"
+            "                                           them at once. Images are only loaded\n"
+            "                                           once, and the devices must report the\n"
+            "                                           same product and slots.\n"
+            "  --all                                    Run the commands on every USB device\n"
+            "                                           in fastboot mode at once, as with\n"
+            "                                           several -s options.\n"
             "  -c <cmdline>                             Override kernel commandline.\n"
             "  -i <vendor id>                           Specify a custom USB vendor id.\n"
             "  -b, --base <base_addr>                   Specify a custom kernel base\n"
@@ -738,29 +809,14 @@ static void queue_info_dump() {
     fb_queue_notice("--------------------------------------------");
 }
 
-static struct sparse_file **load_sparse_files(int fd, int max_size)
+static struct sparse_file* load_sparse_file(int fd)
 {
     struct sparse_file* s = sparse_file_import_auto(fd, false, true);
     if (!s) {
         die("cannot sparse read file\n");
     }
 
-    int files = sparse_file_resparse(s, max_size, nullptr, 0);
-    if (files < 0) {
-        die("Failed to resparse\n");
-    }
-
-    sparse_file** out_s = reinterpret_cast<sparse_file**>(calloc(sizeof(struct sparse_file *), files + 1));
-    if (!out_s) {
-        die("Failed to allocate sparse file array\n");
-    }
-
-    files = sparse_file_resparse(s, max_size, out_s, files);
-    if (files < 0) {
-        die("Failed to resparse\n");
-    }
-
-    return out_s;
+    return s;
 }
 
 static int64_t get_target_sparse_limit(Transport* transport) {
@@ -830,12 +886,10 @@ static bool load_buf_fd(Transport* transport, int fd, struct fastboot_buffer* bu
     lseek64(fd, 0, SEEK_SET);
     int64_t limit = get_sparse_limit(transport, sz);
     if (limit) {
-        sparse_file** s = load_sparse_files(fd, limit);
-        if (s == nullptr) {
-            return false;
-        }
+        // Split into pieces of |limit| as they're sent, see fb_queue_flash_sparse.
         buf->type = FB_BUFFER_SPARSE;
-        buf->data = s;
+        buf->data = load_sparse_file(fd);
+        buf->sz = limit;
     } else {
         buf->type = FB_BUFFER_FD;
         buf->data = nullptr;
@@ -905,8 +959,6 @@ static void rewrite_vbmeta_buffer(struct fastboot_buffer* buf) {
 
 static void flash_buf(const char *pname, struct fastboot_buffer *buf)
 {
-    sparse_file** s;
-
     // Rewrite vbmeta if that's what we're flashing and modification has been requested.
     if ((g_disable_verity || g_disable_verification) &&
         (strcmp(pname, "vbmeta") == 0 || strcmp(pname, "vbmeta_a") == 0 ||
@@ -915,21 +967,9 @@ static void flash_buf(const char *pname, struct fastboot_buffer *buf)
     }
 
     switch (buf->type) {
-        case FB_BUFFER_SPARSE: {
-            std::vector<std::pair<sparse_file*, int64_t>> sparse_files;
-            s = reinterpret_cast<sparse_file**>(buf->data);
-            while (*s) {
-                int64_t sz = sparse_file_len(*s, true, false);
-                sparse_files.emplace_back(*s, sz);
-                ++s;
-            }
-
-            for (size_t i = 0; i < sparse_files.size(); ++i) {
-                const auto& pair = sparse_files[i];
-                fb_queue_flash_sparse(pname, pair.first, pair.second, i + 1, sparse_files.size());
-            }
+        case FB_BUFFER_SPARSE:
+            fb_queue_flash_sparse(pname, reinterpret_cast<sparse_file*>(buf->data), buf->sz);
             break;
-        }
         case FB_BUFFER_FD:
             fb_queue_flash_fd(pname, buf->fd, buf->sz);
             break;
@@ -1141,7 +1181,7 @@ static void set_active(Transport* transport, const std::string& slot_override) {
 static void do_update(Transport* transport, const char* filename, const std::string& slot_override, bool erase_first, bool skip_secondary) {
     queue_info_dump();
 
-    fb_queue_query_save("product", cur_product, sizeof(cur_product));
+    fb_queue_query_product();
 
     ZipArchiveHandle zip;
     int error = OpenArchive(filename, &zip);
@@ -1236,7 +1276,7 @@ static void do_flashall(Transport* transport, const std::string& slot_override,
     std::string fname;
     queue_info_dump();
 
-    fb_queue_query_save("product", cur_product, sizeof(cur_product));
+    fb_queue_query_product();
 
     fname = find_item_given_name("android-info.txt");
     if (fname.empty()) die("cannot find android-info.txt");
@@ -1515,6 +1555,7 @@ int main(int argc, char **argv)
         {"tags_offset", required_argument, 0, 't'},
         {"tags-offset", required_argument, 0, 't'},
         {"help", no_argument, 0, 'h'},
+        {"all", no_argument, 0, 0},
         {"unbuffered", no_argument, 0, 0},
         {"version", no_argument, 0, 0},
         {"slot", required_argument, 0, 0},
@@ -1580,6 +1621,9 @@ int main(int argc, char **argv)
             break;
         case 's':
             serial = optarg;
+            for (const auto& device : android::base::Split(optarg, ",")) {
+                if (!device.empty()) serials.push_back(device);
+            }
             break;
         case 'S':
             sparse_limit = parse_num(optarg);
@@ -1596,7 +1640,9 @@ int main(int argc, char **argv)
         case '?':
             return 1;
         case 0:
-            if (strcmp("unbuffered", longopts[longindex].name) == 0) {
+            if (strcmp("all", longopts[longindex].name) == 0) {
+                all_devices = true;
+            } else if (strcmp("unbuffered", longopts[longindex].name) == 0) {
                 setvbuf(stdout, nullptr, _IONBF, 0);
                 setvbuf(stderr, nullptr, _IONBF, 0);
             } else if (strcmp("version", longopts[longindex].name) == 0) {
@@ -1643,6 +1689,23 @@ int main(int argc, char **argv)
         return show_help();
     }
 
+    if (all_devices) {
+        serials.clear();
+        usb_open(collect_devices_callback);
+        if (serials.empty()) {
+            fprintf(stderr, "error: no devices found\n");
+            return 1;
+        }
+    }
+    std::vector<Transport*> transports;
+    if (serials.size() > 1 || all_devices) {
+        if (!open_devices(&transports)) {
+            return 1;
+        }
+    } else if (serials.size() == 1) {
+        serial = serials[0].c_str();
+    }
+
     Transport* transport = open_device();
     if (transport == nullptr) {
         return 1;
@@ -1824,6 +1887,7 @@ int main(int argc, char **argv)
             }
             fb_queue_download_fd(filename.c_str(), buf.fd, buf.sz);
         } else if (command == "get_staged") {
+            if (transports.size() > 1) die("get_staged can only be used with a single device");
             std::string filename = next_arg(&args);
             fb_queue_upload(filename.c_str());
         } else if (command == "oem") {
@@ -1884,5 +1948,8 @@ int main(int argc, char **argv)
         fb_queue_wait_for_disconnect();
     }
 
+    if (transports.size() > 1) {
+        return fb_execute_queue_parallel(transports, serials) ? EXIT_FAILURE : EXIT_SUCCESS;
+    }
     return fb_execute_queue(transport) ? EXIT_FAILURE : EXIT_SUCCESS;
 }
@@ -33,6 +33,7 @@
 #include <stdlib.h>
 
 #include <string>
+#include <vector>
 
 #include "transport.h"
 
@@ -43,7 +44,17 @@ int fb_command(Transport* transport, const char* cmd);
 int fb_command_response(Transport* transport, const char* cmd, char* response);
 int64_t fb_download_data(Transport* transport, const void* data, uint32_t size);
 int64_t fb_download_data_fd(Transport* transport, int fd, uint32_t size);
-int fb_download_data_sparse(Transport* transport, struct sparse_file* s);
+// Where the time of a sparse download went, in seconds. Generating the chunks
+// and sending them overlap, so |generate| + |send| can exceed |total|.
+struct SparseDownloadTiming {
+    double total = 0;
+    double generate = 0;
+    double send = 0;
+    // Time the generating thread spent waiting for a buffer to be sent.
+    double stalled = 0;
+};
+int fb_download_data_sparse(Transport* transport, struct sparse_file* s,
+                            SparseDownloadTiming* timing = nullptr);
 int64_t fb_upload_data(Transport* transport, const char* outfile);
 const std::string fb_get_error();
 
@@ -54,14 +65,14 @@ const std::string fb_get_error();
 bool fb_getvar(Transport* transport, const std::string& key, std::string* value);
 void fb_queue_flash(const char *ptn, void *data, uint32_t sz);
 void fb_queue_flash_fd(const char *ptn, int fd, uint32_t sz);
-void fb_queue_flash_sparse(const char* ptn, struct sparse_file* s, uint32_t sz, size_t current,
-                           size_t total);
+// Splits |s| into pieces of at most |max_size| as they're needed, and flashes each.
+void fb_queue_flash_sparse(const char* ptn, struct sparse_file* s, uint32_t max_size);
 void fb_queue_erase(const char *ptn);
 void fb_queue_format(const char *ptn, int skip_if_not_supported, int32_t max_chunk_sz);
 void fb_queue_require(const char *prod, const char *var, bool invert,
                       size_t nvalues, const char **value);
 void fb_queue_display(const char *var, const char *prettyname);
-void fb_queue_query_save(const char *var, char *dest, uint32_t dest_size);
+void fb_queue_query_product();
 void fb_queue_reboot(void);
 void fb_queue_command(const char *cmd, const char *msg);
 void fb_queue_download(const char *name, void *data, uint32_t size);
@@ -70,14 +81,22 @@ void fb_queue_upload(const char* outfile);
 void fb_queue_notice(const char *notice);
 void fb_queue_wait_for_disconnect(void);
 int64_t fb_execute_queue(Transport* transport);
+// Runs the queue on every transport at once, one thread each, prefixing each
+// device's output with its label. Fails if any device failed.
+int64_t fb_execute_queue_parallel(const std::vector<Transport*>& transports,
+                                  const std::vector<std::string>& labels);
 void fb_set_active(const char *slot);
 
 /* util stuff */
 double now();
 char *mkmsg(const char *fmt, ...);
+// Prints to stderr, starting each line with the calling thread's label if it
+// has one.
+void report(const char* fmt, ...) __attribute__((__format__(__printf__, 1, 2)));
+void set_report_label(const char* label);
 __attribute__((__noreturn__)) void die(const char *fmt, ...);
 
 /* Current product */
-extern char cur_product[FB_RESPONSE_SZ + 1];
+extern thread_local char cur_product[FB_RESPONSE_SZ + 1];
 
 #endif
@@ -26,9 +26,6 @@
  * SUCH DAMAGE.
  */
 
-#define round_down(a, b) \
-    ({ typeof(a) _a = (a); typeof(b) _b = (b); _a - (_a % _b); })
-
 #include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -36,6 +33,9 @@
 #include <errno.h>
 
 #include <algorithm>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
 #include <vector>
 
 #include <android-base/file.h>
@@ -47,7 +47,8 @@
 #include "fastboot.h"
 #include "transport.h"
 
-static std::string g_error;
+// Per thread, since fb_execute_queue_parallel drives several devices at once.
+static thread_local std::string g_error;
 
 using android::base::unique_fd;
 using android::base::WriteStringToFile;
@@ -75,7 +76,7 @@ static int64_t check_response(Transport* transport, uint32_t size, char* respons
         }
 
         if (!memcmp(status, "INFO", 4)) {
-            fprintf(stderr,"(bootloader) %s\n", status + 4);
+            report("(bootloader) %s\n", status + 4);
             continue;
         }
 
@@ -267,72 +268,145 @@ int64_t fb_upload_data(Transport* transport, const char* outfile) {
     return _command_end(transport);
 }
 
-#define TRANSPORT_BUF_SIZE 1024
-static char transport_buf[TRANSPORT_BUF_SIZE];
-static int transport_buf_len;
+// Sparse images are sent through two buffers: the calling thread runs
+// sparse_file_callback, which reads the backing file and builds the chunks,
+// into one buffer while a writer thread sends the other one to the transport.
+// Every write but the last is a whole buffer, which keeps the transfers a
+// multiple of the USB packet size.
+static constexpr size_t SPARSE_BUF_SIZE = 1024 * 1024;
+
+class SparseWriter {
+  public:
+    explicit SparseWriter(Transport* transport) : transport_(transport) {
+        for (auto& buffer : buffers_) {
+            buffer.data.resize(SPARSE_BUF_SIZE);
+        }
+        thread_ = std::thread(&SparseWriter::WriterLoop, this);
+    }
 
-static int fb_download_data_sparse_write(void *priv, const void *data, int len)
-{
-    int r;
-    Transport* transport = reinterpret_cast<Transport*>(priv);
-    int to_write;
-    const char* ptr = reinterpret_cast<const char*>(data);
-
-    if (transport_buf_len) {
-        to_write = std::min(TRANSPORT_BUF_SIZE - transport_buf_len, len);
-
-        memcpy(transport_buf + transport_buf_len, ptr, to_write);
-        transport_buf_len += to_write;
-        ptr += to_write;
-        len -= to_write;
+    ~SparseWriter() {
+        if (thread_.joinable()) {
+            Finish(nullptr);
+        }
     }
 
-    if (transport_buf_len == TRANSPORT_BUF_SIZE) {
-        r = _command_write_data(transport, transport_buf, TRANSPORT_BUF_SIZE);
-        if (r != TRANSPORT_BUF_SIZE) {
-            return -1;
+    // Copies |len| bytes into the buffer being filled, handing it to the
+    // writer thread each time it fills up.
+    int Write(const char* data, size_t len) {
+        while (len > 0) {
+            Buffer* buffer = &buffers_[filling_];
+            size_t to_copy = std::min(len, SPARSE_BUF_SIZE - buffer->len);
+            memcpy(&buffer->data[buffer->len], data, to_copy);
+            buffer->len += to_copy;
+            data += to_copy;
+            len -= to_copy;
+            if (buffer->len == SPARSE_BUF_SIZE && !Submit()) {
+                return -1;
+            }
         }
-        transport_buf_len = 0;
+        return 0;
     }
 
-    if (len > TRANSPORT_BUF_SIZE) {
-        if (transport_buf_len > 0) {
-            g_error = "internal error: transport_buf not empty";
-            return -1;
+    // Sends whatever is left and waits for the writer thread to exit.
+    // Returns false if any write failed, with g_error set by the writer.
+    bool Finish(SparseDownloadTiming* timing) {
+        // Waiting for the last buffers is sending time, not a stall.
+        double stalled = stall_time_;
+        bool ok = buffers_[filling_].len == 0 || Submit();
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            done_ = true;
         }
-        to_write = round_down(len, TRANSPORT_BUF_SIZE);
-        r = _command_write_data(transport, ptr, to_write);
-        if (r != to_write) {
-            return -1;
+        cv_.notify_all();
+        thread_.join();
+        if (failed_) {
+            g_error = error_;
+            ok = false;
         }
-        ptr += to_write;
-        len -= to_write;
+        if (timing != nullptr) {
+            timing->send = send_time_;
+            timing->stalled = stalled;
+        }
+        return ok;
     }
 
-    if (len > 0) {
-        if (len > TRANSPORT_BUF_SIZE) {
-            g_error = "internal error: too much left for transport_buf";
-            return -1;
-        }
-        memcpy(transport_buf, ptr, len);
-        transport_buf_len = len;
+  private:
+    struct Buffer {
+        std::vector<char> data;
+        size_t len = 0;
+        bool ready = false;
+    };
+
+    // Passes the buffer being filled to the writer thread and waits for the
+    // other one to be free, which is the only point the two threads meet.
+    bool Submit() {
+        double start = now();
+        std::unique_lock<std::mutex> lock(mutex_);
+        buffers_[filling_].ready = true;
+        cv_.notify_all();
+        filling_ ^= 1;
+        cv_.wait(lock, [this]() { return !buffers_[filling_].ready || failed_; });
+        stall_time_ += now() - start;
+        return !failed_;
     }
 
-    return 0;
-}
+    void WriterLoop() {
+        size_t sending = 0;
+        while (true) {
+            Buffer* buffer = &buffers_[sending];
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                cv_.wait(lock, [this, buffer]() { return buffer->ready || done_; });
+                if (!buffer->ready) {
+                    return;
+                }
+            }
 
-static int fb_download_data_sparse_flush(Transport* transport) {
-    if (transport_buf_len > 0) {
-        int64_t r = _command_write_data(transport, transport_buf, transport_buf_len);
-        if (r != static_cast<int64_t>(transport_buf_len)) {
-            return -1;
+            double start = now();
+            bool ok = _command_write_data(transport_, buffer->data.data(), buffer->len) >= 0;
+            send_time_ += now() - start;
+
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                buffer->len = 0;
+                buffer->ready = false;
+                if (!ok) {
+                    // g_error is per thread, so hand it back to the caller.
+                    error_ = g_error;
+                    failed_ = true;
+                }
+            }
+            cv_.notify_all();
+            if (!ok) {
+                return;
+            }
+            sending ^= 1;
         }
-        transport_buf_len = 0;
     }
-    return 0;
+
+    Transport* transport_;
+    std::thread thread_;
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    Buffer buffers_[2];
+    // Only touched by the calling thread.
+    size_t filling_ = 0;
+    double stall_time_ = 0;
+    // Only touched by the writer thread until it has been joined.
+    double send_time_ = 0;
+    std::string error_;
+    bool done_ = false;
+    bool failed_ = false;
+};
+
+static int fb_download_data_sparse_write(void *priv, const void *data, int len)
+{
+    SparseWriter* writer = reinterpret_cast<SparseWriter*>(priv);
+    return writer->Write(reinterpret_cast<const char*>(data), len);
 }
 
-int fb_download_data_sparse(Transport* transport, struct sparse_file* s) {
+int fb_download_data_sparse(Transport* transport, struct sparse_file* s,
+                            SparseDownloadTiming* timing) {
     int size = sparse_file_len(s, true, false);
     if (size <= 0) {
         return -1;
@@ -344,15 +418,30 @@ int fb_download_data_sparse(Transport* transport, struct sparse_file* s) {
         return -1;
     }
 
-    r = sparse_file_callback(s, true, false, fb_download_data_sparse_write, transport);
-    if (r < 0) {
-        return -1;
+    double start = now();
+    SparseWriter writer(transport);
+    {
+#if defined(_WIN32)
+        // Without mmap, libsparse reads the backing file through its shared
+        // file offset, so devices being flashed in parallel take turns.
+        static std::mutex callback_mutex;
+        std::lock_guard<std::mutex> lock(callback_mutex);
+#endif
+        r = sparse_file_callback(s, true, false, fb_download_data_sparse_write, &writer);
     }
-
-    r = fb_download_data_sparse_flush(transport);
-    if (r < 0) {
+    // The generation time is whatever the calling thread didn't spend waiting
+    // for a free buffer.
+    double generated = now();
+    SparseDownloadTiming local_timing;
+    bool sent = writer.Finish(&local_timing);
+    local_timing.total = now() - start;
+    local_timing.generate = generated - start - local_timing.stalled;
+    if (r < 0 || !sent) {
         return -1;
     }
+    if (timing != nullptr) {
+        *timing = local_timing;
+    }
 
     return _command_end(transport);
 }
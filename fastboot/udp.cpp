@@ -33,6 +33,7 @@
 #include <errno.h>
 #include <stdio.h>
 
+#include <deque>
 #include <list>
 #include <memory>
 #include <vector>
@@ -68,6 +69,7 @@ class Header {
     ~Header() = default;
 
     uint8_t id() const { return bytes_[kIndexId]; }
+    uint16_t sequence() const { return ExtractUint16(bytes_ + kIndexSeqH); }
     const uint8_t* bytes() const { return bytes_; }
 
     void Set(uint8_t id, uint16_t sequence, Flag flag);
@@ -130,9 +132,16 @@ class UdpTransport : public Transport {
                                    uint8_t* rx_data, size_t rx_length, int attempts,
                                    std::string* error);
 
+    // Like SendData() for Fastboot packets whose responses must be empty ACKs, but keeps up to
+    // |window_size_| packets unacknowledged. Returns true on success; otherwise returns false and
+    // fills |error|.
+    bool SendDataWindowed(const uint8_t* tx_data, size_t tx_length, int attempts,
+                          std::string* error);
+
     std::unique_ptr<Socket> socket_;
     int sequence_ = -1;
     size_t max_data_length_ = kMinPacketSize - kHeaderSize;
+    size_t window_size_ = 1;
     std::vector<uint8_t> rx_packet_;
 
     DISALLOW_COPY_AND_ASSIGN(UdpTransport);
@@ -150,7 +159,7 @@ std::unique_ptr<UdpTransport> UdpTransport::NewTransport(std::unique_ptr<Socket>
 }
 
 bool UdpTransport::InitializeProtocol(std::string* error) {
-    uint8_t rx_data[4];
+    uint8_t rx_data[6];
 
     sequence_ = 0;
     rx_packet_.resize(kMinPacketSize);
@@ -181,9 +190,10 @@ bool UdpTransport::InitializeProtocol(std::string* error) {
     }
 
     // The first two data bytes contain the version, the second two bytes contain the target max
-    // supported packet size, which must be at least 512 bytes.
+    // supported packet size, which must be at least 512 bytes. Version 2 targets may follow that
+    // with how many packets they can have outstanding.
     uint16_t version = ExtractUint16(rx_data);
-    if (version < kProtocolVersion) {
+    if (version < kMinProtocolVersion) {
         *error = android::base::StringPrintf("target reported invalid protocol version %d",
                                              version);
         return false;
@@ -198,6 +208,11 @@ bool UdpTransport::InitializeProtocol(std::string* error) {
     max_data_length_ = packet_size - kHeaderSize;
     rx_packet_.resize(packet_size);
 
+    if (version >= 2 && rx_bytes >= 6) {
+        uint16_t window_size = ExtractUint16(rx_data + 4);
+        window_size_ = std::max<uint16_t>(1, std::min(kHostMaxWindowSize, window_size));
+    }
+
     return true;
 }
 
@@ -324,6 +339,97 @@ ssize_t UdpTransport::SendSinglePacketHelper(
     return total_data_bytes;
 }
 
+bool UdpTransport::SendDataWindowed(const uint8_t* tx_data, size_t tx_length, int attempts,
+                                    std::string* error) {
+    if (socket_ == nullptr) {
+        *error = "socket is closed";
+        return false;
+    }
+    error->clear();
+
+    struct Packet {
+        Header header;
+        const uint8_t* data;
+        size_t length;
+    };
+
+    auto send = [this, error](const Packet& packet) {
+        if (!socket_->Send({{packet.header.bytes(), kHeaderSize}, {packet.data, packet.length}})) {
+            *error = Socket::GetErrorMessage();
+            return false;
+        }
+        return true;
+    };
+
+    // The unacknowledged packets, oldest first. Since the target handles packets in order, a
+    // response for any one of them acknowledges every packet before it too.
+    std::deque<Packet> window;
+    bool sent_any = false;
+    int attempts_left = attempts;
+    while (true) {
+        while ((!sent_any || tx_length > 0) && window.size() < window_size_) {
+            Packet packet;
+            packet.data = tx_data;
+            packet.length = std::min(tx_length, max_data_length_);
+            tx_data += packet.length;
+            tx_length -= packet.length;
+            packet.header.Set(kIdFastboot, sequence_++,
+                              tx_length > 0 ? kFlagContinuation : kFlagNone);
+            if (!send(packet)) {
+                return false;
+            }
+            window.push_back(packet);
+            sent_any = true;
+        }
+        if (window.empty()) {
+            return true;
+        }
+
+        ssize_t bytes = socket_->Receive(rx_packet_.data(), rx_packet_.size(), kResponseTimeoutMs);
+        if (bytes == -1) {
+            if (!socket_->ReceiveTimedOut()) {
+                *error = Socket::GetErrorMessage();
+                return false;
+            }
+            if (--attempts_left <= 0) {
+                *error = "no response from target";
+                return false;
+            }
+            // Only the packets still in the window need to go again.
+            for (const Packet& packet : window) {
+                if (!send(packet)) {
+                    return false;
+                }
+            }
+            continue;
+        } else if (bytes < static_cast<ssize_t>(kHeaderSize)) {
+            *error = "protocol error: incomplete header";
+            return false;
+        }
+
+        // Anything else is a response to a packet acknowledged already.
+        uint16_t index = ExtractUint16(rx_packet_.data() + kIndexSeqH) -
+                         window.front().header.sequence();
+        if (index >= window.size() || !window[index].header.Matches(rx_packet_.data())) {
+            continue;
+        }
+
+        if (rx_packet_[kIndexId] == kIdError) {
+            *error = "target reported error: ";
+            error->append(rx_packet_.data() + kHeaderSize, rx_packet_.data() + bytes);
+            return false;
+        } else if (bytes > static_cast<ssize_t>(kHeaderSize) ||
+                   (rx_packet_[kIndexFlags] & kFlagContinuation)) {
+            // Only empty ACK packets are allowed when writing to a device.
+            *error = "target sent fastboot data out-of-turn";
+            return false;
+        }
+
+        window.erase(window.begin(), window.begin() + index + 1);
+        attempts_left = attempts;
+    }
+}
+
 ssize_t UdpTransport::Read(void* data, size_t length) {
     // Read from the target by sending an empty packet.
     std::string error;
@@ -345,6 +451,15 @@ ssize_t UdpTransport::Read(void* data, size_t length) {
 
 ssize_t UdpTransport::Write(const void* data, size_t length) {
     std::string error;
+    if (window_size_ > 1) {
+        if (!SendDataWindowed(reinterpret_cast<const uint8_t*>(data), length,
+                              kMaxTransmissionAttempts, &error)) {
+            fprintf(stderr, "UDP error: %s\n", error.c_str());
+            return -1;
+        }
+        return length;
+    }
+
     ssize_t bytes = SendData(kIdFastboot, reinterpret_cast<const uint8_t*>(data), length, nullptr,
                              0, kMaxTransmissionAttempts, &error);
 
@@ -46,10 +46,13 @@ std::unique_ptr<Transport> Connect(const std::string& hostname, int port, std::s
 // Internal namespace for test use only.
 namespace internal {
 
-constexpr uint16_t kProtocolVersion = 1;
+// Version 2 adds windowed writes; version 1 devices are still supported.
+constexpr uint16_t kProtocolVersion = 2;
+constexpr uint16_t kMinProtocolVersion = 1;
 
-// This will be negotiated with the device so may end up being smaller.
+// These will be negotiated with the device so may end up being smaller.
 constexpr uint16_t kHostMaxPacketSize = 8192;
+constexpr uint16_t kHostMaxWindowSize = 32;
 
 // Retransmission constants. Retransmission timeout must be at least 500ms, and the host must
 // attempt to send packets for at least 1 minute once the device has connected. See
@@ -16,6 +16,13 @@
 
 #include "udp.h"
 
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+#include <deque>
+#include <map>
+
 #include <gtest/gtest.h>
 
 #include "socket.h"
@@ -310,14 +317,20 @@ class UdpTest : public ::testing::Test {
 
     // Sets up |mock_socket_| to correctly initialize the protocol and creates |transport_|. This
     // can be called multiple times in a test if needed.
-    bool InitializeTransport(uint16_t starting_sequence, int device_max_packet_size = 512) {
+    // A non-zero |device_window_size| is given in the Init response.
+    bool InitializeTransport(uint16_t starting_sequence, int device_max_packet_size = 512,
+                             int device_window_size = 0) {
         mock_socket_ = new SocketMock;
         mock_socket_->ExpectSend(QueryPacket(0));
         mock_socket_->AddReceive(QueryPacket(0, starting_sequence));
         mock_socket_->ExpectSend(
                 InitPacket(starting_sequence, kProtocolVersion, kHostMaxPacketSize));
-        mock_socket_->AddReceive(
-                InitPacket(starting_sequence, kProtocolVersion, device_max_packet_size));
+        std::string response =
+                InitPacket(starting_sequence, kProtocolVersion, device_max_packet_size);
+        if (device_window_size != 0) {
+            response += PacketValue(device_window_size);
+        }
+        mock_socket_->AddReceive(response);
 
         std::string error;
         transport_ = Connect(std::unique_ptr<Socket>(mock_socket_), &error);
@@ -529,3 +542,294 @@ TEST_F(UdpTest, CloseTransport) {
     EXPECT_EQ(-1, transport_->Write("foo", 3));
     EXPECT_EQ(-1, transport_->Read(buffer, sizeof(buffer)));
 }
+
+// Returns |count| chunks of |size| bytes each with a different fill.
+static std::vector<std::string> MakeChunks(size_t count, size_t size) {
+    std::vector<std::string> chunks;
+    for (size_t i = 0; i < count; ++i) {
+        chunks.push_back(std::string(size, 'a' + i));
+    }
+    return chunks;
+}
+
+static std::string Join(const std::vector<std::string>& chunks) {
+    std::string data;
+    for (const std::string& chunk : chunks) {
+        data += chunk;
+    }
+    return data;
+}
+
+// Tests that a version 1 target, or one that doesn't give a window size, gets one packet at a
+// time even though the host speaks version 2.
+TEST_F(UdpTest, WindowNotNegotiated) {
+    std::vector<std::string> chunks = MakeChunks(2, 508);
+
+    for (int version : {1, 2}) {
+        mock_socket_ = new SocketMock;
+        mock_socket_->ExpectSend(QueryPacket(0));
+        mock_socket_->AddReceive(QueryPacket(0, 0));
+        mock_socket_->ExpectSend(InitPacket(0, kProtocolVersion, kHostMaxPacketSize));
+        mock_socket_->AddReceive(InitPacket(0, version, 512) +
+                                 (version == 1 ? PacketValue(8) : ""));
+        std::string error;
+        transport_ = Connect(std::unique_ptr<Socket>(mock_socket_), &error);
+        ASSERT_NE(nullptr, transport_);
+
+        mock_socket_->ExpectSend(FastbootPacket(1, chunks[0], kFlagContinuation));
+        mock_socket_->AddReceive(FastbootPacket(1));
+        mock_socket_->ExpectSend(FastbootPacket(2, chunks[1]));
+        mock_socket_->AddReceive(FastbootPacket(2));
+        EXPECT_TRUE(Write(Join(chunks)));
+    }
+}
+
+// Tests that a windowed write keeps the window full and takes one response as the ACK for every
+// packet before it.
+TEST_F(UdpTest, WindowedWrite) {
+    ASSERT_TRUE(InitializeTransport(0, 512, 4));
+    std::vector<std::string> chunks = MakeChunks(6, 508);
+
+    mock_socket_->ExpectSend(FastbootPacket(1, chunks[0], kFlagContinuation));
+    mock_socket_->ExpectSend(FastbootPacket(2, chunks[1], kFlagContinuation));
+    mock_socket_->ExpectSend(FastbootPacket(3, chunks[2], kFlagContinuation));
+    mock_socket_->ExpectSend(FastbootPacket(4, chunks[3], kFlagContinuation));
+    mock_socket_->AddReceive(FastbootPacket(1));
+    mock_socket_->ExpectSend(FastbootPacket(5, chunks[4], kFlagContinuation));
+    mock_socket_->AddReceive(FastbootPacket(3));
+    mock_socket_->ExpectSend(FastbootPacket(6, chunks[5]));
+    mock_socket_->AddReceive(FastbootPacket(6));
+    EXPECT_TRUE(Write(Join(chunks)));
+
+    // Small writes and reads still work as before.
+    mock_socket_->ExpectSend(FastbootPacket(7, "foo"));
+    mock_socket_->AddReceive(FastbootPacket(7));
+    mock_socket_->ExpectSend(FastbootPacket(8));
+    mock_socket_->AddReceive(FastbootPacket(8, "bar"));
+    EXPECT_TRUE(Write("foo"));
+    EXPECT_TRUE(Read("bar"));
+}
+
+// Tests that the window is limited to what the host supports.
+TEST_F(UdpTest, WindowSizeLimit) {
+    ASSERT_TRUE(InitializeTransport(0, 512, kHostMaxWindowSize + 1));
+    std::vector<std::string> chunks = MakeChunks(kHostMaxWindowSize + 1, 508);
+
+    for (size_t i = 0; i < kHostMaxWindowSize; ++i) {
+        mock_socket_->ExpectSend(FastbootPacket(i + 1, chunks[i], kFlagContinuation));
+    }
+    mock_socket_->AddReceive(FastbootPacket(1));
+    mock_socket_->ExpectSend(FastbootPacket(kHostMaxWindowSize + 1, chunks.back()));
+    mock_socket_->AddReceive(FastbootPacket(kHostMaxWindowSize + 1));
+    EXPECT_TRUE(Write(Join(chunks)));
+}
+
+// Tests that a timeout sends only the packets that weren't acknowledged again, and that stale
+// responses are ignored.
+TEST_F(UdpTest, WindowedWriteRetransmit) {
+    ASSERT_TRUE(InitializeTransport(0, 512, 4));
+    std::vector<std::string> chunks = MakeChunks(3, 508);
+
+    mock_socket_->ExpectSend(FastbootPacket(1, chunks[0], kFlagContinuation));
+    mock_socket_->ExpectSend(FastbootPacket(2, chunks[1], kFlagContinuation));
+    mock_socket_->ExpectSend(FastbootPacket(3, chunks[2]));
+    mock_socket_->AddReceive(FastbootPacket(1));
+    mock_socket_->AddReceiveTimeout();
+    mock_socket_->ExpectSend(FastbootPacket(2, chunks[1], kFlagContinuation));
+    mock_socket_->ExpectSend(FastbootPacket(3, chunks[2]));
+    mock_socket_->AddReceive(FastbootPacket(1));
+    mock_socket_->AddReceive(FastbootPacket(4));
+    mock_socket_->AddReceive(QueryPacket(2));
+    mock_socket_->AddReceive(FastbootPacket(3));
+    EXPECT_TRUE(Write(Join(chunks)));
+}
+
+// Tests sequence numbers wrapping around inside the window.
+TEST_F(UdpTest, WindowedWriteSequenceWrap) {
+    ASSERT_TRUE(InitializeTransport(0xFFFD, 512, 4));
+    std::vector<std::string> chunks = MakeChunks(4, 508);
+
+    mock_socket_->ExpectSend(FastbootPacket(0xFFFE, chunks[0], kFlagContinuation));
+    mock_socket_->ExpectSend(FastbootPacket(0xFFFF, chunks[1], kFlagContinuation));
+    mock_socket_->ExpectSend(FastbootPacket(0x0000, chunks[2], kFlagContinuation));
+    mock_socket_->ExpectSend(FastbootPacket(0x0001, chunks[3]));
+    mock_socket_->AddReceive(FastbootPacket(0xFFFD));
+    mock_socket_->AddReceive(FastbootPacket(0x0000));
+    mock_socket_->AddReceive(FastbootPacket(0x0001));
+    EXPECT_TRUE(Write(Join(chunks)));
+}
+
+TEST_F(UdpTest, WindowedWriteTimeoutFailure) {
+    ASSERT_TRUE(InitializeTransport(0, 512, 4));
+    std::vector<std::string> chunks = MakeChunks(2, 508);
+
+    mock_socket_->ExpectSend(FastbootPacket(1, chunks[0], kFlagContinuation));
+    mock_socket_->ExpectSend(FastbootPacket(2, chunks[1]));
+    for (int i = 1; i < kMaxTransmissionAttempts; ++i) {
+        mock_socket_->AddReceiveTimeout();
+        mock_socket_->ExpectSend(FastbootPacket(1, chunks[0], kFlagContinuation));
+        mock_socket_->ExpectSend(FastbootPacket(2, chunks[1]));
+    }
+    mock_socket_->AddReceiveTimeout();
+    EXPECT_FALSE(Write(Join(chunks)));
+}
+
+// Tests that errors, and data in the ACKs, fail a windowed write immediately.
+TEST_F(UdpTest, WindowedWriteErrors) {
+    std::vector<std::string> chunks = MakeChunks(2, 508);
+
+    ASSERT_TRUE(InitializeTransport(0, 512, 4));
+    mock_socket_->ExpectSend(FastbootPacket(1, chunks[0], kFlagContinuation));
+    mock_socket_->ExpectSend(FastbootPacket(2, chunks[1]));
+    mock_socket_->AddReceive(ErrorPacket(0, "ignored error"));
+    mock_socket_->AddReceive(ErrorPacket(2, "test error"));
+    EXPECT_FALSE(Write(Join(chunks)));
+
+    ASSERT_TRUE(InitializeTransport(0, 512, 4));
+    mock_socket_->ExpectSend(FastbootPacket(1, chunks[0], kFlagContinuation));
+    mock_socket_->ExpectSend(FastbootPacket(2, chunks[1]));
+    mock_socket_->AddReceive(FastbootPacket(1, "OKAY"));
+    EXPECT_FALSE(Write(Join(chunks)));
+
+    ASSERT_TRUE(InitializeTransport(0, 512, 4));
+    mock_socket_->ExpectSend(FastbootPacket(1, chunks[0], kFlagContinuation));
+    mock_socket_->ExpectSend(FastbootPacket(2, chunks[1]));
+    mock_socket_->AddReceiveFailure();
+    EXPECT_FALSE(Write(Join(chunks)));
+}
+
+// A target on a simulated link for the benchmarks below. It follows the device rules of the
+// protocol, ignoring packets that arrive ahead of the one it expects, and keeps a virtual clock:
+// packets take |kLinkBytesPerMs| to go out one at a time and arrive |kLinkRttMs| later, and
+// waiting for a response moves the clock forward.
+class SimulatedTarget : public Socket {
+  public:
+    static constexpr double kLinkRttMs = 2;
+    static constexpr double kLinkBytesPerMs = 100 * 1024;
+
+    // The host packets whose 1-based index is a multiple of |drop_every| are lost.
+    SimulatedTarget(uint16_t window_size, int drop_every)
+        : Socket(INVALID_SOCKET), window_size_(window_size), drop_every_(drop_every) {}
+
+    bool Send(const void* data, size_t length) override {
+        double start = std::max(now_ms_, link_free_ms_);
+        link_free_ms_ = start + length / kLinkBytesPerMs;
+        if (drop_every_ != 0 && ++packets_ % drop_every_ == 0) {
+            return true;
+        }
+
+        std::string packet(reinterpret_cast<const char*>(data), length);
+        std::string response = Handle(packet);
+        if (!response.empty()) {
+            responses_.push_back({link_free_ms_ + kLinkRttMs, response});
+        }
+        return true;
+    }
+
+    bool Send(std::vector<cutils_socket_buffer_t> buffers) override {
+        std::string data;
+        for (const auto& buffer : buffers) {
+            data.append(reinterpret_cast<const char*>(buffer.data), buffer.length);
+        }
+        return Send(data.data(), data.size());
+    }
+
+    ssize_t Receive(void* data, size_t length, int timeout_ms) override {
+        if (responses_.empty() || responses_.front().first > now_ms_ + timeout_ms) {
+            now_ms_ += timeout_ms;
+            receive_timed_out_ = true;
+            return -1;
+        }
+        receive_timed_out_ = false;
+        now_ms_ = std::max(now_ms_, responses_.front().first);
+        std::string response = responses_.front().second;
+        responses_.pop_front();
+        size_t bytes = std::min(length, response.size());
+        memcpy(data, response.data(), bytes);
+        return bytes;
+    }
+
+    int Close() override { return 0; }
+
+    double now_ms() const { return now_ms_; }
+    const std::string& received() const { return received_; }
+
+  private:
+    std::string Handle(const std::string& packet) {
+        uint16_t sequence = (static_cast<uint8_t>(packet[2]) << 8) | static_cast<uint8_t>(packet[3]);
+        if (packet[0] == kIdDeviceQuery) {
+            return QueryPacket(sequence, expected_);
+        }
+        if (sequence != expected_) {
+            auto saved = saved_.find(sequence);
+            uint16_t age = expected_ - sequence;
+            return saved != saved_.end() && age <= window_size_ ? saved->second : "";
+        }
+
+        std::string response;
+        if (packet[0] == kIdInitialization) {
+            response = InitPacket(sequence, kProtocolVersion, kHostMaxPacketSize) +
+                       PacketValue(window_size_);
+        } else {
+            received_.append(packet, 4, std::string::npos);
+            response = FastbootPacket(sequence);
+        }
+        saved_[sequence] = response;
+        saved_.erase(static_cast<uint16_t>(sequence - window_size_ - 1));
+        ++expected_;
+        return response;
+    }
+
+    uint16_t window_size_;
+    int drop_every_;
+    int packets_ = 0;
+    uint16_t expected_ = 0;
+    std::map<uint16_t, std::string> saved_;
+    std::string received_;
+    double now_ms_ = 0;
+    double link_free_ms_ = 0;
+    std::deque<std::pair<double, std::string>> responses_;
+};
+
+// Writes |data| to a SimulatedTarget, and returns how many ms it took.
+static double SimulatedWrite(uint16_t window_size, int drop_every, const std::string& data) {
+    SimulatedTarget* target = new SimulatedTarget(window_size, drop_every);
+    std::string error;
+    std::unique_ptr<Transport> transport = Connect(std::unique_ptr<Socket>(target), &error);
+    if (transport == nullptr) {
+        ADD_FAILURE() << error;
+        return -1;
+    }
+
+    double start = target->now_ms();
+    EXPECT_EQ(static_cast<ssize_t>(data.size()), transport->Write(data.data(), data.size()));
+    EXPECT_EQ(data, target->received());
+    return target->now_ms() - start;
+}
+
+// Compares the transfer rate of one outstanding packet with a full window over a 2ms RTT link.
+TEST(UdpBenchmark, WindowedWriteThroughput) {
+    std::string data(4 * 1024 * 1024, '\0');
+    for (size_t i = 0; i < data.size(); ++i) {
+        data[i] = i * 7;
+    }
+
+    double single_ms = SimulatedWrite(1, 0, data);
+    double windowed_ms = SimulatedWrite(kHostMaxWindowSize, 0, data);
+    printf("4MiB over a %.0fms RTT link: %.1f MB/s with 1 packet, %.1f MB/s with %d\n",
+           SimulatedTarget::kLinkRttMs, data.size() / 1000.0 / single_ms,
+           data.size() / 1000.0 / windowed_ms, kHostMaxWindowSize);
+    EXPECT_LT(windowed_ms * 10, single_ms);
+}
+
+// Tests that lost packets anywhere in the window are recovered.
+TEST(UdpBenchmark, WindowedWriteLoss) {
+    std::string data(1024 * 1024, '\0');
+    for (size_t i = 0; i < data.size(); ++i) {
+        data[i] = i * 13;
+    }
+
+    for (int drop_every : {7, 50, 101}) {
+        EXPECT_LT(0, SimulatedWrite(8, drop_every, data));
+    }
+}
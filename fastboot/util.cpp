@@ -33,8 +33,14 @@
 
 #include <sys/time.h>
 
+#include <string>
+
+#include <android-base/stringprintf.h>
+
 #include "fastboot.h"
 
+static thread_local const char* report_label = nullptr;
+
 double now()
 {
     struct timeval tv;
@@ -57,6 +63,39 @@ char *mkmsg(const char *fmt, ...)
     return s;
 }
 
+void set_report_label(const char* label)
+{
+    report_label = label;
+}
+
+void report(const char* fmt, ...)
+{
+    std::string text;
+    va_list ap;
+    va_start(ap, fmt);
+    android::base::StringAppendV(&text, fmt, ap);
+    va_end(ap);
+
+    if (report_label == nullptr) {
+        fputs(text.c_str(), stderr);
+        return;
+    }
+
+    // Build the whole message first so that a single write keeps other
+    // threads' lines from landing in the middle of it.
+    std::string line;
+    size_t pos = 0;
+    while (pos < text.size()) {
+        size_t end = text.find('\n', pos);
+        end = (end == std::string::npos) ? text.size() : end + 1;
+        line += report_label;
+        line += ": ";
+        line.append(text, pos, end - pos);
+        pos = end;
+    }
+    fputs(line.c_str(), stderr);
+}
+
 void die(const char *fmt, ...)
 {
     va_list ap;
@@ -19,9 +19,11 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <libgen.h>
+#include <poll.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/inotify.h>
 #include <sys/ioctl.h>
 #include <sys/mount.h>
 #include <sys/stat.h>
@@ -31,9 +33,13 @@
 #include <time.h>
 #include <unistd.h>
 
+#include <condition_variable>
 #include <memory>
+#include <mutex>
 #include <thread>
+#include <vector>
 
+#include <android-base/chrono_utils.h>
 #include <android-base/file.h>
 #include <android-base/properties.h>
 #include <android-base/stringprintf.h>
@@ -90,21 +96,52 @@ enum FsStatFlags {
     FS_STAT_ENABLE_ENCRYPTION_FAILED = 0x40000,
 };
 
-// TODO: switch to inotify()
+// Watches the deepest directory on the way to |filename| that exists, so that
+// whatever ueventd creates next along the path wakes fs_mgr_wait_for_file up.
+static int watch_closest_dir(int inotify_fd, const std::string& filename) {
+    std::string dir = filename;
+    while (true) {
+        size_t slash = dir.rfind('/');
+        if (slash == std::string::npos) return -1;
+        dir.resize(slash == 0 ? 1 : slash);
+        int wd = inotify_add_watch(inotify_fd, dir.c_str(),
+                                   IN_CREATE | IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF);
+        if (wd != -1 || errno != ENOENT || dir == "/") return wd;
+    }
+}
+
 bool fs_mgr_wait_for_file(const std::string& filename,
                           const std::chrono::milliseconds relative_timeout) {
     auto start_time = std::chrono::steady_clock::now();
+    android::base::unique_fd inotify_fd(inotify_init1(IN_CLOEXEC | IN_NONBLOCK));
 
     while (true) {
         if (!access(filename.c_str(), F_OK) || errno != ENOENT) {
             return true;
         }
 
-        std::this_thread::sleep_for(50ms);
-
         auto now = std::chrono::steady_clock::now();
         auto time_elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(now - start_time);
         if (time_elapsed > relative_timeout) return false;
+
+        int wd = inotify_fd == -1 ? -1 : watch_closest_dir(inotify_fd, filename);
+        if (wd == -1) {
+            // Fall back to polling.
+            std::this_thread::sleep_for(50ms);
+            continue;
+        }
+
+        // The file may have shown up before the watch was in place. The
+        // timeout still rechecks every 50ms, for the changes that happen out of
+        // sight of the watch, such as under a dangling symlink.
+        if (access(filename.c_str(), F_OK) && errno == ENOENT) {
+            struct pollfd pfd = {.fd = inotify_fd, .events = POLLIN};
+            TEMP_FAILURE_RETRY(poll(&pfd, 1, 50));
+            char events[4096];
+            while (read(inotify_fd, events, sizeof(events)) > 0) {
+            }
+        }
+        inotify_rm_watch(inotify_fd, wd);
     }
 }
 
@@ -791,37 +828,41 @@ bool is_device_secure() {
     return strcmp(value, "0") ? true : false;
 }
 
-/* When multiple fstab records share the same mount_point, it will
- * try to mount each one in turn, and ignore any duplicates after a
- * first successful mount.
+/* Whether mount_all has to mount |rec| in |mount_mode|. */
+static bool should_mount(const struct fstab_rec* rec, int mount_mode)
+{
+    /* Don't mount entries that are managed by vold or not for the mount mode*/
+    if ((rec->fs_mgr_flags & (MF_VOLDMANAGED | MF_RECOVERYONLY)) ||
+         ((mount_mode == MOUNT_MODE_LATE) && !fs_mgr_is_latemount(rec)) ||
+         ((mount_mode == MOUNT_MODE_EARLY) && fs_mgr_is_latemount(rec))) {
+        return false;
+    }
+
+    /* Skip swap and raw partition entries such as boot, recovery, etc */
+    if (!strcmp(rec->fs_type, "swap") ||
+        !strcmp(rec->fs_type, "emmc") ||
+        !strcmp(rec->fs_type, "mtd")) {
+        return false;
+    }
+    return true;
+}
+
+/* Mounts the entries in [start, end) of the fstab. The range must not split
+ * the records that share a mount point. The failures that don't stop the
+ * other entries from being mounted are counted in |error_count|.
  * Returns -1 on error, and  FS_MGR_MNTALL_* otherwise.
  */
-int fs_mgr_mount_all(struct fstab *fstab, int mount_mode)
+static int mount_entries(struct fstab* fstab, int mount_mode, int start, int end,
+                         FsManagerAvbUniquePtr* avb_handle, int* error_count)
 {
     int i = 0;
     int encryptable = FS_MGR_MNTALL_DEV_NOT_ENCRYPTABLE;
-    int error_count = 0;
     int mret = -1;
     int mount_errno = 0;
     int attempted_idx = -1;
-    FsManagerAvbUniquePtr avb_handle(nullptr);
-
-    if (!fstab) {
-        return FS_MGR_MNTALL_FAIL;
-    }
-
-    for (i = 0; i < fstab->num_entries; i++) {
-        /* Don't mount entries that are managed by vold or not for the mount mode*/
-        if ((fstab->recs[i].fs_mgr_flags & (MF_VOLDMANAGED | MF_RECOVERYONLY)) ||
-             ((mount_mode == MOUNT_MODE_LATE) && !fs_mgr_is_latemount(&fstab->recs[i])) ||
-             ((mount_mode == MOUNT_MODE_EARLY) && fs_mgr_is_latemount(&fstab->recs[i]))) {
-            continue;
-        }
 
-        /* Skip swap and raw partition entries such as boot, recovery, etc */
-        if (!strcmp(fstab->recs[i].fs_type, "swap") ||
-            !strcmp(fstab->recs[i].fs_type, "emmc") ||
-            !strcmp(fstab->recs[i].fs_type, "mtd")) {
+    for (i = start; i < end; i++) {
+        if (!should_mount(&fstab->recs[i], mount_mode)) {
             continue;
         }
 
@@ -849,14 +890,14 @@ int fs_mgr_mount_all(struct fstab *fstab, int mount_mode)
         }
 
         if (fstab->recs[i].fs_mgr_flags & MF_AVB) {
-            if (!avb_handle) {
-                avb_handle = FsManagerAvbHandle::Open(*fstab);
-                if (!avb_handle) {
+            if (!*avb_handle) {
+                *avb_handle = FsManagerAvbHandle::Open(*fstab);
+                if (!*avb_handle) {
                     LERROR << "Failed to open FsManagerAvbHandle";
                     return FS_MGR_MNTALL_FAIL;
                 }
             }
-            if (avb_handle->SetUpAvbHashtree(&fstab->recs[i], true /* wait_for_verity_dev */) ==
+            if ((*avb_handle)->SetUpAvbHashtree(&fstab->recs[i], true /* wait_for_verity_dev */) ==
                 SetUpAvbHashtreeResult::kFail) {
                 LERROR << "Failed to set up AVB on partition: "
                        << fstab->recs[i].mount_point << ", skipping!";
@@ -964,7 +1005,7 @@ int fs_mgr_mount_all(struct fstab *fstab, int mount_mode)
                        << " for mount " << fstab->recs[attempted_idx].mount_point
                        << " type " << fstab->recs[attempted_idx].fs_type;
                 if (fs_mgr_do_tmpfs_mount(fstab->recs[attempted_idx].mount_point) < 0) {
-                    ++error_count;
+                    ++*error_count;
                     continue;
                 }
             }
@@ -987,13 +1028,179 @@ int fs_mgr_mount_all(struct fstab *fstab, int mount_mode)
                     "on %s at %s options: %s",
                     fstab->recs[attempted_idx].blk_device, fstab->recs[attempted_idx].mount_point,
                     fstab->recs[attempted_idx].fs_options);
-                ++error_count;
+                ++*error_count;
             }
             continue;
         }
     }
 
-    if (error_count) {
+    return encryptable;
+}
+
+/* When multiple fstab records share the same mount_point, it will
+ * try to mount each one in turn, and ignore any duplicates after a
+ * first successful mount.
+ * Returns -1 on error, and  FS_MGR_MNTALL_* otherwise.
+ */
+int fs_mgr_mount_all(struct fstab *fstab, int mount_mode)
+{
+    int error_count = 0;
+    FsManagerAvbUniquePtr avb_handle(nullptr);
+
+    if (!fstab) {
+        return FS_MGR_MNTALL_FAIL;
+    }
+
+    int encryptable = mount_entries(fstab, mount_mode, 0, fstab->num_entries, &avb_handle,
+                                    &error_count);
+    if (encryptable == FS_MGR_MNTALL_FAIL || error_count) {
+        return FS_MGR_MNTALL_FAIL;
+    } else {
+        return encryptable;
+    }
+}
+
+/* The records of an fstab that share a mount point, along with the earlier
+ * groups that have to be mounted before them.
+ */
+struct mount_group {
+    int start;
+    int end;
+    std::vector<size_t> deps;
+    bool done = false;
+    int encryptable = FS_MGR_MNTALL_DEV_NOT_ENCRYPTABLE;
+    int error_count = 0;
+    std::chrono::milliseconds duration{0};
+};
+
+/* Whether |path| is |dir| or anything under it. */
+static bool path_is_under(const char* path, const char* dir)
+{
+    size_t len = strlen(dir);
+    if (len == 0 || strncmp(path, dir, len)) {
+        return false;
+    }
+    return path[len] == '\0' || path[len] == '/' || dir[len - 1] == '/';
+}
+
+/* Whether the records in |later| could see a different tree if they were
+ * mounted before, or at the same time as, the ones in |earlier|: one mount
+ * point is under the other, or the block device is a file on |earlier|.
+ */
+static bool group_depends_on(const struct fstab* fstab, const mount_group& later,
+                             const mount_group& earlier)
+{
+    const char* mount_point = fstab->recs[earlier.start].mount_point;
+    for (int i = later.start; i < later.end; i++) {
+        if (path_is_under(fstab->recs[i].mount_point, mount_point) ||
+            path_is_under(mount_point, fstab->recs[i].mount_point) ||
+            path_is_under(fstab->recs[i].blk_device, mount_point)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/* Does what fs_mgr_mount_all does, but checks, sets up verity for and mounts
+ * the entries whose mount points don't depend on each other at the same time,
+ * each on its own thread. How long each mount point took is passed to
+ * |callback|, if there is one, once everything is done.
+ * Returns -1 on error, and  FS_MGR_MNTALL_* otherwise.
+ */
+int fs_mgr_mount_all_parallel(struct fstab* fstab, int mount_mode,
+                              fs_mgr_mount_timing_callback callback)
+{
+    if (!fstab) {
+        return FS_MGR_MNTALL_FAIL;
+    }
+
+    std::vector<mount_group> groups;
+    for (int i = 0; i < fstab->num_entries;) {
+        mount_group group;
+        group.start = i;
+        while (++i < fstab->num_entries &&
+               !strcmp(fstab->recs[group.start].mount_point, fstab->recs[i].mount_point)) {
+        }
+        group.end = i;
+        for (size_t j = 0; j < groups.size(); j++) {
+            if (group_depends_on(fstab, group, groups[j])) {
+                group.deps.push_back(j);
+            }
+        }
+        groups.push_back(std::move(group));
+    }
+
+    /* Opened up front, the threads only read it. */
+    FsManagerAvbUniquePtr avb_handle(nullptr);
+    for (int i = 0; i < fstab->num_entries; i++) {
+        if ((fstab->recs[i].fs_mgr_flags & MF_AVB) && should_mount(&fstab->recs[i], mount_mode)) {
+            avb_handle = FsManagerAvbHandle::Open(*fstab);
+            if (!avb_handle) {
+                LERROR << "Failed to open FsManagerAvbHandle";
+                return FS_MGR_MNTALL_FAIL;
+            }
+            break;
+        }
+    }
+
+    std::mutex lock;
+    std::condition_variable done_cv;
+    bool failed = false;
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < groups.size(); i++) {
+        threads.emplace_back([&, i]() {
+            mount_group& group = groups[i];
+            bool skip;
+            {
+                std::unique_lock<std::mutex> l(lock);
+                done_cv.wait(l, [&]() {
+                    for (size_t dep : group.deps) {
+                        if (!groups[dep].done) return false;
+                    }
+                    return true;
+                });
+                /* Like the sequential version, nothing more is mounted after a fatal error. */
+                skip = failed;
+            }
+            if (!skip) {
+                android::base::Timer t;
+                group.encryptable = mount_entries(fstab, mount_mode, group.start, group.end,
+                                                  &avb_handle, &group.error_count);
+                group.duration = t.duration();
+            }
+            {
+                std::lock_guard<std::mutex> l(lock);
+                group.done = true;
+                if (group.encryptable == FS_MGR_MNTALL_FAIL) {
+                    failed = true;
+                }
+            }
+            done_cv.notify_all();
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    int encryptable = FS_MGR_MNTALL_DEV_NOT_ENCRYPTABLE;
+    int error_count = 0;
+    for (const auto& group : groups) {
+        const struct fstab_rec* rec = &fstab->recs[group.start];
+        if (callback && should_mount(rec, mount_mode) && strcmp(rec->mount_point, "/")) {
+            LINFO << rec->mount_point << " took " << group.duration.count() << "ms";
+            callback(rec->mount_point, group.duration.count());
+        }
+        error_count += group.error_count;
+        if (group.encryptable != FS_MGR_MNTALL_DEV_NOT_ENCRYPTABLE) {
+            if (encryptable != FS_MGR_MNTALL_DEV_NOT_ENCRYPTABLE) {
+                // Log and continue
+                LERROR << "Only one encryptable/encrypted partition supported";
+            }
+            encryptable = group.encryptable;
+        }
+    }
+
+    if (failed || error_count) {
         return FS_MGR_MNTALL_FAIL;
     } else {
         return encryptable;
@@ -401,6 +401,13 @@ static bool hashtree_dm_verity_setup(struct fstab_rec* fstab_entry,
         return false;
     }
 
+    if (wait_for_verity_dev && (fstab_entry->fs_mgr_flags & MF_VERITYPREFETCH)) {
+        fs_mgr_prefetch_verity_hashtree(verity_blk_name, hashtree_desc.image_size,
+                                        hashtree_desc.data_block_size,
+                                        hashtree_desc.hash_block_size,
+                                        hashtree_desc.root_digest_len);
+    }
+
     return true;
 }
 
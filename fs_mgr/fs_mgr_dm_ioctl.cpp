@@ -15,9 +15,11 @@
  */
 
 #include <errno.h>
+#include <fcntl.h>
 #include <string.h>
 
 #include <android-base/logging.h>
+#include <android-base/unique_fd.h>
 #include <sys/ioctl.h>
 
 #include "fs_mgr_priv.h"
@@ -78,3 +80,35 @@ bool fs_mgr_resume_verity_table(struct dm_ioctl* io, const std::string& name, in
     }
     return true;
 }
+
+void fs_mgr_prefetch_verity_hashtree(const std::string& verity_blk_name, uint64_t data_size,
+                                     uint32_t data_block_size, uint32_t hash_block_size,
+                                     uint32_t digest_size) {
+    if (data_block_size == 0 || digest_size == 0) {
+        return;
+    }
+
+    // dm-verity rounds the digests up to a power of two in the hash blocks.
+    uint32_t digest_slot = 1;
+    while (digest_slot < digest_size) {
+        digest_slot <<= 1;
+    }
+    uint64_t hashes_per_block = hash_block_size / digest_slot;
+    if (hashes_per_block == 0) {
+        return;
+    }
+    uint64_t stride = data_block_size * hashes_per_block * hashes_per_block;
+
+    android::base::unique_fd fd(TEMP_FAILURE_RETRY(open(verity_blk_name.c_str(),
+                                                        O_RDONLY | O_CLOEXEC)));
+    if (fd == -1) {
+        PWARNING << "Couldn't open " << verity_blk_name << " to prefetch its hash tree";
+        return;
+    }
+
+    // POSIX_FADV_WILLNEED only queues the reads, the verification runs in the kernel.
+    for (uint64_t offset = 0; offset < data_size; offset += stride) {
+        posix_fadvise(fd, offset, data_block_size, POSIX_FADV_WILLNEED);
+    }
+    LINFO << "Prefetching the hash tree of " << verity_blk_name;
+}
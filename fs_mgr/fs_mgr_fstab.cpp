@@ -19,13 +19,20 @@
 #include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <fcntl.h>
 #include <string.h>
+#include <sys/mman.h>
 #include <sys/mount.h>
+#include <sys/stat.h>
 #include <unistd.h>
 
+#include <functional>
+#include <memory>
+
 #include <android-base/file.h>
 #include <android-base/stringprintf.h>
 #include <android-base/strings.h>
+#include <android-base/unique_fd.h>
 
 #include "fs_mgr_priv.h"
 
@@ -90,6 +97,7 @@ static struct flag_list fs_mgr_flags[] = {
     {"verifyatboot", MF_VERIFYATBOOT},
     {"verify", MF_VERIFY},
     {"avb", MF_AVB},
+    {"verityprefetch", MF_VERITYPREFETCH},
     {"noemulatedsd", MF_NOEMULATEDSD},
     {"notrim", MF_NOTRIM},
     {"formattable", MF_FORMATTABLE},
@@ -713,12 +721,204 @@ struct fstab *fs_mgr_read_fstab_dt()
     return fstab;
 }
 
+/*
+ * The default fstab as published by init, so that the rest of boot doesn't
+ * have to find, read and parse it, or walk the device tree, again. /dev is
+ * a tmpfs, so it's never left over from an earlier boot.
+ *
+ * The file is a fstab_cache_header, followed by num_entries fstab_cache_recs
+ * and then the strings they point to. Each string is stored as its offset
+ * from the start of the file plus one, so that 0 can stand for NULL.
+ */
+#define FSTAB_CACHE_FILE    "/dev/.fstab_default"
+#define FSTAB_CACHE_MAGIC   0x62617466 /* "ftab" */
+#define FSTAB_CACHE_VERSION 1
+
+struct fstab_cache_header {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t size;
+    uint32_t num_entries;
+    uint32_t fstab_filename;
+};
+
+struct fstab_cache_rec {
+    uint32_t blk_device;
+    uint32_t mount_point;
+    uint32_t fs_type;
+    uint32_t fs_options;
+    uint32_t key_loc;
+    uint32_t key_dir;
+    uint32_t verity_loc;
+    uint32_t label;
+    uint64_t flags;
+    int64_t length;
+    uint64_t reserved_size;
+    int32_t fs_mgr_flags;
+    int32_t partnum;
+    int32_t swap_prio;
+    int32_t max_comp_streams;
+    uint32_t zram_size;
+    uint32_t file_contents_mode;
+    uint32_t file_names_mode;
+    uint32_t erase_blk_size;
+    uint32_t logical_blk_size;
+};
+
+static uint32_t add_cache_string(std::string* buf, const char* str)
+{
+    if (!str) {
+        return 0;
+    }
+    uint32_t offset = buf->size() + 1;
+    buf->append(str, strlen(str) + 1);
+    return offset;
+}
+
+static bool write_fstab_cache(const struct fstab* fstab, const char* path)
+{
+    size_t strings_start = sizeof(fstab_cache_header) +
+                           fstab->num_entries * sizeof(fstab_cache_rec);
+    std::string buf(strings_start, '\0');
+    fstab_cache_header header = {};
+    header.magic = FSTAB_CACHE_MAGIC;
+    header.version = FSTAB_CACHE_VERSION;
+    header.num_entries = fstab->num_entries;
+    header.fstab_filename = add_cache_string(&buf, fstab->fstab_filename);
+
+    for (int i = 0; i < fstab->num_entries; i++) {
+        const struct fstab_rec& rec = fstab->recs[i];
+        fstab_cache_rec cached = {};
+        cached.blk_device = add_cache_string(&buf, rec.blk_device);
+        cached.mount_point = add_cache_string(&buf, rec.mount_point);
+        cached.fs_type = add_cache_string(&buf, rec.fs_type);
+        cached.fs_options = add_cache_string(&buf, rec.fs_options);
+        cached.key_loc = add_cache_string(&buf, rec.key_loc);
+        cached.key_dir = add_cache_string(&buf, rec.key_dir);
+        cached.verity_loc = add_cache_string(&buf, rec.verity_loc);
+        cached.label = add_cache_string(&buf, rec.label);
+        cached.flags = rec.flags;
+        cached.length = rec.length;
+        cached.reserved_size = rec.reserved_size;
+        cached.fs_mgr_flags = rec.fs_mgr_flags;
+        cached.partnum = rec.partnum;
+        cached.swap_prio = rec.swap_prio;
+        cached.max_comp_streams = rec.max_comp_streams;
+        cached.zram_size = rec.zram_size;
+        cached.file_contents_mode = rec.file_contents_mode;
+        cached.file_names_mode = rec.file_names_mode;
+        cached.erase_blk_size = rec.erase_blk_size;
+        cached.logical_blk_size = rec.logical_blk_size;
+        memcpy(&buf[sizeof(header) + i * sizeof(cached)], &cached, sizeof(cached));
+    }
+    header.size = buf.size();
+    memcpy(&buf[0], &header, sizeof(header));
+
+    // Readers only ever see a complete file.
+    std::string tmp_path = android::base::StringPrintf("%s.tmp", path);
+    android::base::unique_fd fd(TEMP_FAILURE_RETRY(
+        open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC | O_NOFOLLOW, 0444)));
+    if (fd == -1) {
+        PERROR << __FUNCTION__ << "(): cannot create '" << tmp_path << "'";
+        return false;
+    }
+    if (!android::base::WriteStringToFd(buf, fd) || rename(tmp_path.c_str(), path) == -1) {
+        PERROR << __FUNCTION__ << "(): cannot write '" << path << "'";
+        unlink(tmp_path.c_str());
+        return false;
+    }
+    return true;
+}
+
+/* Checks that the string at |offset| is in the string part of the file. */
+static bool get_cache_string(const char* base, size_t strings_start, size_t size,
+                             uint32_t offset, char** out)
+{
+    if (offset == 0) {
+        *out = nullptr;
+        return true;
+    }
+    offset--;
+    if (offset < strings_start || offset >= size || !memchr(base + offset, '\0', size - offset)) {
+        return false;
+    }
+    *out = strdup(base + offset);
+    return true;
+}
+
+static struct fstab *read_fstab_cache(const char* path)
+{
+    android::base::unique_fd fd(TEMP_FAILURE_RETRY(open(path, O_RDONLY | O_CLOEXEC)));
+    struct stat sb;
+    if (fd == -1 || fstat(fd, &sb) == -1 || sb.st_size < (off_t)sizeof(fstab_cache_header)) {
+        return nullptr;
+    }
+    size_t size = sb.st_size;
+    void* map = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED) {
+        return nullptr;
+    }
+    std::unique_ptr<void, std::function<void(void*)>> unmapper(
+        map, [size](void* addr) { munmap(addr, size); });
+    const char* base = static_cast<const char*>(map);
+
+    fstab_cache_header header;
+    memcpy(&header, base, sizeof(header));
+    if (header.magic != FSTAB_CACHE_MAGIC || header.version != FSTAB_CACHE_VERSION ||
+        header.size != size || header.num_entries == 0 ||
+        header.num_entries > (size - sizeof(header)) / sizeof(fstab_cache_rec)) {
+        LERROR << __FUNCTION__ << "(): ignoring invalid '" << path << "'";
+        return nullptr;
+    }
+    size_t strings_start = sizeof(header) + header.num_entries * sizeof(fstab_cache_rec);
+
+    struct fstab *fstab = static_cast<struct fstab *>(calloc(1, sizeof(struct fstab)));
+    fstab->num_entries = header.num_entries;
+    fstab->recs = static_cast<struct fstab_rec *>(
+        calloc(fstab->num_entries, sizeof(struct fstab_rec)));
+    bool ok = get_cache_string(base, strings_start, size, header.fstab_filename,
+                               &fstab->fstab_filename);
+    for (int i = 0; ok && i < fstab->num_entries; i++) {
+        fstab_cache_rec cached;
+        memcpy(&cached, base + sizeof(header) + i * sizeof(cached), sizeof(cached));
+        struct fstab_rec& rec = fstab->recs[i];
+        ok = get_cache_string(base, strings_start, size, cached.blk_device, &rec.blk_device) &&
+             get_cache_string(base, strings_start, size, cached.mount_point, &rec.mount_point) &&
+             get_cache_string(base, strings_start, size, cached.fs_type, &rec.fs_type) &&
+             get_cache_string(base, strings_start, size, cached.fs_options, &rec.fs_options) &&
+             get_cache_string(base, strings_start, size, cached.key_loc, &rec.key_loc) &&
+             get_cache_string(base, strings_start, size, cached.key_dir, &rec.key_dir) &&
+             get_cache_string(base, strings_start, size, cached.verity_loc, &rec.verity_loc) &&
+             get_cache_string(base, strings_start, size, cached.label, &rec.label);
+        rec.flags = cached.flags;
+        rec.length = cached.length;
+        rec.reserved_size = cached.reserved_size;
+        rec.fs_mgr_flags = cached.fs_mgr_flags;
+        rec.partnum = cached.partnum;
+        rec.swap_prio = cached.swap_prio;
+        rec.max_comp_streams = cached.max_comp_streams;
+        rec.zram_size = cached.zram_size;
+        rec.file_contents_mode = cached.file_contents_mode;
+        rec.file_names_mode = cached.file_names_mode;
+        rec.erase_blk_size = cached.erase_blk_size;
+        rec.logical_blk_size = cached.logical_blk_size;
+        // Every rec needs its mandatory fields, as they would have after parsing.
+        ok = ok && rec.blk_device && rec.mount_point && rec.fs_type;
+    }
+    if (!ok) {
+        LERROR << __FUNCTION__ << "(): ignoring invalid '" << path << "'";
+        fs_mgr_free_fstab(fstab);
+        return nullptr;
+    }
+    return fstab;
+}
+
 /*
  * tries to load default fstab.<hardware> file from /odm/etc, /vendor/etc
  * or /. loads the first one found and also combines fstab entries passed
  * in from device tree.
  */
-struct fstab *fs_mgr_read_fstab_default()
+static struct fstab *read_fstab_default_uncached()
 {
     std::string hw;
     std::string default_fstab;
@@ -743,6 +943,26 @@ struct fstab *fs_mgr_read_fstab_default()
     return in_place_merge(fstab_dt, fstab);
 }
 
+struct fstab *fs_mgr_read_fstab_default()
+{
+    struct fstab *fstab = read_fstab_cache(FSTAB_CACHE_FILE);
+    if (fstab) {
+        return fstab;
+    }
+    return read_fstab_default_uncached();
+}
+
+/* Parses the default fstab and publishes it for fs_mgr_read_fstab_default() */
+bool fs_mgr_publish_default_fstab()
+{
+    std::unique_ptr<struct fstab, decltype(&fs_mgr_free_fstab)> fstab(
+        read_fstab_default_uncached(), fs_mgr_free_fstab);
+    if (!fstab) {
+        return false;
+    }
+    return write_fstab_cache(fstab.get(), FSTAB_CACHE_FILE);
+}
+
 void fs_mgr_free_fstab(struct fstab *fstab)
 {
     int i;
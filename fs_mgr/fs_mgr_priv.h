@@ -110,6 +110,7 @@
 #define MF_LOGICALBLKSIZE  0X1000000
 #define MF_AVB             0X2000000
 #define MF_KEYDIRECTORY 0X4000000
+#define MF_VERITYPREFETCH 0X8000000
 
 #define DM_BUF_SIZE 4096
 
@@ -18,6 +18,7 @@
 #define __CORE_FS_MGR_PRIV_DM_IOCTL_H
 
 #include <linux/dm-ioctl.h>
+#include <stdint.h>
 #include <string>
 
 void fs_mgr_verity_ioctl_init(struct dm_ioctl* io, const std::string& name, unsigned flags);
@@ -31,4 +32,12 @@ bool fs_mgr_get_verity_device_name(struct dm_ioctl* io, const std::string& name,
 
 bool fs_mgr_resume_verity_table(struct dm_ioctl* io, const std::string& name, int fd);
 
+// Queues a read of one data block of |verity_blk_name| under each hash block of the
+// second level of its hash tree. Verifying those reads brings every hash block above
+// the lowest level into dm-verity's cache, so the first reads after mount only have to
+// fetch one hash block. Doesn't wait for the reads.
+void fs_mgr_prefetch_verity_hashtree(const std::string& verity_blk_name, uint64_t data_size,
+                                     uint32_t data_block_size, uint32_t hash_block_size,
+                                     uint32_t digest_size);
+
 #endif /* __CORE_FS_MGR_PRIV_DM_IOCTL_H */
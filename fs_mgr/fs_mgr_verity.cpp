@@ -29,6 +29,8 @@
 #include <time.h>
 #include <unistd.h>
 
+#include <mutex>
+
 #include <android-base/file.h>
 #include <android-base/properties.h>
 #include <android-base/strings.h>
@@ -656,6 +658,10 @@ static int get_verity_state_offset(struct fstab_rec *fstab, off64_t *offset)
                 offset);
 }
 
+// The verity state of every partition is kept on the one metadata partition,
+// so partitions that are set up at the same time take turns with it.
+static std::mutex verity_state_lock;
+
 int load_verity_state(struct fstab_rec* fstab, int* mode) {
     int match = 0;
     off64_t offset = 0;
@@ -672,6 +678,7 @@ int load_verity_state(struct fstab_rec* fstab, int* mode) {
         return 0;
     }
 
+    std::lock_guard<std::mutex> lock(verity_state_lock);
     if (get_verity_state_offset(fstab, &offset) < 0) {
         /* fall back to stateless behavior */
         return 0;
@@ -939,6 +946,12 @@ loaded:
         goto out;
     }
 
+    if (wait_for_verity_dev && !verified_at_boot &&
+        (fstab->fs_mgr_flags & MF_VERITYPREFETCH)) {
+        fs_mgr_prefetch_verity_hashtree(fstab->blk_device, verity.data_size, FEC_BLOCKSIZE,
+                                        FEC_BLOCKSIZE, SHA256_DIGEST_LENGTH);
+    }
+
     retval = FS_MGR_SETUP_VERITY_SUCCESS;
 
 out:
@@ -64,6 +64,14 @@ typedef void (*fs_mgr_verity_state_callback)(struct fstab_rec *fstab,
 #define FS_MGR_MNTALL_FAIL (-1)
 int fs_mgr_mount_all(struct fstab *fstab, int mount_mode);
 
+// Callback function for the time it took to check and mount a mount point
+typedef void (*fs_mgr_mount_timing_callback)(const char* mount_point, int64_t duration_ms);
+
+// Same as fs_mgr_mount_all, except that mount points that don't depend on each
+// other are checked and mounted concurrently.
+int fs_mgr_mount_all_parallel(struct fstab* fstab, int mount_mode,
+                              fs_mgr_mount_timing_callback callback);
+
 #define FS_MGR_DOMNT_FAILED (-1)
 #define FS_MGR_DOMNT_BUSY (-2)
 #define FS_MGR_DOMNT_SUCCESS 0
@@ -65,6 +65,9 @@ struct fstab_rec {
 };
 
 struct fstab* fs_mgr_read_fstab_default();
+// Parses the default fstab once and stores the result where later calls to
+// fs_mgr_read_fstab_default(), in any process, load it from instead.
+bool fs_mgr_publish_default_fstab();
 struct fstab* fs_mgr_read_fstab_dt();
 struct fstab* fs_mgr_read_fstab(const char* fstab_path);
 void fs_mgr_free_fstab(struct fstab* fstab);
@@ -25,10 +25,10 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <sys/types.h>
+#include <time.h>
 #include <unistd.h>
 #include <memory>
 
-#include <android-base/file.h>
 #include <android-base/parseint.h>
 #include <android-base/strings.h>
 #include <batteryservice/BatteryService.h>
@@ -82,10 +82,18 @@ static void initBatteryProperties(BatteryProperties* props) {
 }
 
 BatteryMonitor::BatteryMonitor() : mHealthdConfig(nullptr), mBatteryDevicePresent(false),
-    mAlwaysPluggedDevice(false), mBatteryFixedCapacity(0), mBatteryFixedTemperature(0) {
+    mAlwaysPluggedDevice(false), mBatteryFixedCapacity(0), mBatteryFixedTemperature(0),
+    mUpdateCount(0), mUpdateCpuNs(0), mSysfsOpens(0), mSysfsReads(0) {
     initBatteryProperties(&props);
 }
 
+BatteryMonitor::~BatteryMonitor() {
+    for (const auto& it : mSysfsFds) {
+        if (it.second >= 0)
+            close(it.second);
+    }
+}
+
 int BatteryMonitor::getBatteryStatus(const char* status) {
     int ret;
     struct sysfsStringEnumMap batteryStatusMap[] = {
@@ -132,10 +140,49 @@ int BatteryMonitor::getBatteryHealth(const char* status) {
     return ret;
 }
 
+int BatteryMonitor::getSysfsFd(const String8& path) {
+    auto it = mSysfsFds.find(path.string());
+    if (it != mSysfsFds.end())
+        return it->second;
+
+    int fd = open(path.string(), O_RDONLY | O_CLOEXEC);
+    mSysfsOpens++;
+    // Remember files that aren't there, but retry other failures.
+    if (fd >= 0 || errno == ENOENT)
+        mSysfsFds[path.string()] = fd;
+    return fd;
+}
+
+bool BatteryMonitor::hasFile(const String8& path) {
+    return getSysfsFd(path) >= 0;
+}
+
 int BatteryMonitor::readFromFile(const String8& path, std::string* buf) {
-    if (android::base::ReadFileToString(path.c_str(), buf)) {
-        *buf = android::base::Trim(*buf);
+    // sysfs attributes are at most a page.
+    char data[4096];
+    ssize_t n = -1;
+
+    buf->clear();
+    if (path.isEmpty())
+        return 0;
+
+    // A supply that went away leaves a dead fd behind, so retry once on a
+    // fresh one.
+    for (int attempt = 0; attempt < 2 && n < 0; attempt++) {
+        int fd = getSysfsFd(path);
+        if (fd < 0)
+            return 0;
+        n = TEMP_FAILURE_RETRY(pread(fd, data, sizeof(data) - 1, 0));
+        mSysfsReads++;
+        if (n < 0) {
+            close(fd);
+            mSysfsFds.erase(path.string());
+        }
     }
+    if (n <= 0)
+        return 0;
+
+    *buf = android::base::Trim(std::string(data, n));
     return buf->length();
 }
 
@@ -193,6 +240,19 @@ int BatteryMonitor::getIntField(const String8& path) {
 }
 
 bool BatteryMonitor::update(void) {
+    struct timespec start, end;
+
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &start);
+    bool ret = updateProperties();
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &end);
+
+    mUpdateCount++;
+    mUpdateCpuNs += (end.tv_sec - start.tv_sec) * 1000000000LL +
+                    (end.tv_nsec - start.tv_nsec);
+    return ret;
+}
+
+bool BatteryMonitor::updateProperties(void) {
     bool logthis;
 
     initBatteryProperties(&props);
@@ -281,16 +341,13 @@ bool BatteryMonitor::update(void) {
             path.clear();
             path.appendFormat("%s/%s/current_max", POWER_SUPPLY_SYSFS_PATH,
                               mChargerNames[i].string());
-            int ChargingCurrent =
-                    (access(path.string(), R_OK) == 0) ? getIntField(path) : 0;
+            int ChargingCurrent = hasFile(path) ? getIntField(path) : 0;
 
             path.clear();
             path.appendFormat("%s/%s/voltage_max", POWER_SUPPLY_SYSFS_PATH,
                               mChargerNames[i].string());
 
-            int ChargingVoltage =
-                (access(path.string(), R_OK) == 0) ? getIntField(path) :
-                DEFAULT_VBUS_VOLTAGE;
+            int ChargingVoltage = hasFile(path) ? getIntField(path) : DEFAULT_VBUS_VOLTAGE;
 
             double power = ((double)ChargingCurrent / MILLION) *
                            ((double)ChargingVoltage / MILLION);
@@ -479,6 +536,12 @@ void BatteryMonitor::dumpState(int fd) {
         snprintf(vs, sizeof(vs), "Full charge: %d\n", props.batteryFullCharge);
         write(fd, vs, strlen(vs));
     }
+
+    snprintf(vs, sizeof(vs), "updates: %llu cpu per update: %llu us sysfs opens: %llu reads: %llu\n",
+             (unsigned long long)mUpdateCount,
+             (unsigned long long)(mUpdateCount ? mUpdateCpuNs / mUpdateCount / 1000 : 0),
+             (unsigned long long)mSysfsOpens, (unsigned long long)mSysfsReads);
+    write(fd, vs, strlen(vs));
 }
 
 void BatteryMonitor::init(struct healthd_config *hc) {
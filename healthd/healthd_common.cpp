@@ -31,6 +31,7 @@
 #include <cutils/uevent.h>
 #include <sys/epoll.h>
 #include <sys/timerfd.h>
+#include <time.h>
 #include <utils/Errors.h>
 
 using namespace android;
@@ -49,6 +50,14 @@ using namespace android;
   #define DEFAULT_PERIODIC_CHORES_INTERVAL_SLOW (BOARD_PERIODIC_CHORES_INTERVAL_SLOW)
 #endif
 
+#ifndef BOARD_UEVENT_COALESCE_INTERVAL_MS
+  // power_supply uevents closer than this to the last update are folded
+  // into one update at the end of the interval
+  #define DEFAULT_UEVENT_COALESCE_INTERVAL_MS 100
+#else
+  #define DEFAULT_UEVENT_COALESCE_INTERVAL_MS (BOARD_UEVENT_COALESCE_INTERVAL_MS)
+#endif
+
 static struct healthd_config healthd_config = {
     .periodic_chores_interval_fast = DEFAULT_PERIODIC_CHORES_INTERVAL_FAST,
     .periodic_chores_interval_slow = DEFAULT_PERIODIC_CHORES_INTERVAL_SLOW,
@@ -86,6 +95,13 @@ static int wakealarm_wake_interval = DEFAULT_PERIODIC_CHORES_INTERVAL_FAST;
 
 static BatteryMonitor* gBatteryMonitor;
 
+// when the battery was last updated, and whether a uevent since then is
+// still waiting for the next one
+static int64_t battery_update_ms = -DEFAULT_UEVENT_COALESCE_INTERVAL_MS;
+static bool battery_update_pending;
+static unsigned long long power_supply_uevents;
+static unsigned long long coalesced_uevents;
+
 struct healthd_mode_ops *healthd_mode_ops;
 
 int healthd_register_event(int fd, void (*handler)(uint32_t), EventWakeup wakeup) {
@@ -127,11 +143,28 @@ static void wakealarm_set_interval(int interval) {
         KLOG_ERROR(LOG_TAG, "wakealarm_set_interval: timerfd_settime failed\n");
 }
 
+static int64_t now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+// How long until a pending update is due, or -1 if none is pending.
+static int battery_update_pending_timeout(void) {
+    if (!battery_update_pending)
+        return -1;
+    int64_t remaining = battery_update_ms + DEFAULT_UEVENT_COALESCE_INTERVAL_MS - now_ms();
+    return remaining > 0 ? (int)remaining : 0;
+}
+
 status_t healthd_get_property(int id, struct BatteryProperty *val) {
     return gBatteryMonitor->getProperty(id, val);
 }
 
 void healthd_battery_update(void) {
+    battery_update_ms = now_ms();
+    battery_update_pending = false;
+
     // Fast wake interval when on charger (watch for overheat);
     // slow wake interval when on battery (watch for drained battery).
 
@@ -156,7 +189,12 @@ void healthd_battery_update(void) {
 }
 
 void healthd_dump_battery_state(int fd) {
+    char vs[128];
+
     gBatteryMonitor->dumpState(fd);
+    snprintf(vs, sizeof(vs), "power_supply uevents: %llu coalesced: %llu\n",
+             power_supply_uevents, coalesced_uevents);
+    write(fd, vs, strlen(vs));
     fsync(fd);
 }
 
@@ -182,7 +220,17 @@ static void uevent_event(uint32_t /*epevents*/) {
 
     while (*cp) {
         if (!strcmp(cp, "SUBSYSTEM=" POWER_SUPPLY_SUBSYSTEM)) {
-            healthd_battery_update();
+            // Chargers send bursts of these. The first one is handled right
+            // away, the rest of the burst by a single update once the
+            // interval is over.
+            power_supply_uevents++;
+            if (now_ms() - battery_update_ms < DEFAULT_UEVENT_COALESCE_INTERVAL_MS) {
+                if (battery_update_pending)
+                    coalesced_uevents++;
+                battery_update_pending = true;
+            } else {
+                healthd_battery_update();
+            }
             break;
         }
 
@@ -237,6 +285,7 @@ static void healthd_mainloop(void) {
         struct epoll_event events[eventct];
         int timeout = awake_poll_interval;
         int mode_timeout;
+        int pending_timeout;
 
         /* Don't wait for first timer timeout to run periodic chores */
         if (!nevents)
@@ -247,6 +296,9 @@ static void healthd_mainloop(void) {
         mode_timeout = healthd_mode_ops->preparetowait();
         if (timeout < 0 || (mode_timeout > 0 && mode_timeout < timeout))
             timeout = mode_timeout;
+        pending_timeout = battery_update_pending_timeout();
+        if (pending_timeout >= 0 && (timeout < 0 || pending_timeout < timeout))
+            timeout = pending_timeout;
         nevents = epoll_wait(epollfd, events, eventct, timeout);
         if (nevents == -1) {
             if (errno == EINTR)
@@ -259,6 +311,10 @@ static void healthd_mainloop(void) {
             if (events[n].data.ptr)
                 (*(void (*)(int))events[n].data.ptr)(events[n].events);
         }
+
+        // A timeout runs the update through periodic_chores() above.
+        if (nevents > 0 && battery_update_pending_timeout() == 0)
+            healthd_battery_update();
     }
 
     return;
@@ -14,6 +14,8 @@
  * limitations under the License.
  */
 
+#include <time.h>
+
 #include <android-base/stringprintf.h>
 #include <batteryservice/BatteryService.h>
 #include <cutils/klog.h>
@@ -23,9 +25,26 @@
 #define LOGE(x...) KLOG_ERROR("charger", x);
 #define LOGV(x...) KLOG_DEBUG("charger", x);
 
+#define LOGW(x...) KLOG_WARNING("charger", x);
+
+static int64_t now_ns(clockid_t clock) {
+  struct timespec ts;
+  clock_gettime(clock, &ts);
+  return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
 HealthdDraw::HealthdDraw(animation* anim)
   : kSplitScreen(HEALTHD_DRAW_SPLIT_SCREEN),
-    kSplitOffset(HEALTHD_DRAW_SPLIT_OFFSET) {
+    kSplitOffset(HEALTHD_DRAW_SPLIT_OFFSET),
+    full_redraws_(kBufferCount),
+    last_unknown_(false),
+    last_surface_width_(0),
+    last_surface_height_(0),
+    cur_buffer_(0),
+    frames_(0),
+    full_frames_(0),
+    frame_time_ns_(0),
+    frame_cpu_ns_(0) {
   gr_init();
   gr_font_size(gr_sys_font(), &char_width_, &char_height_);
 
@@ -48,23 +67,79 @@ HealthdDraw::HealthdDraw(animation* anim)
 HealthdDraw::~HealthdDraw() {}
 
 void HealthdDraw::redraw_screen(const animation* batt_anim, GRSurface* surf_unknown) {
-  clear_screen();
+  int64_t start_ns = now_ns(CLOCK_MONOTONIC);
+  int64_t start_cpu_ns = now_ns(CLOCK_THREAD_CPUTIME_ID);
+
+  bool unknown = batt_anim->cur_level < 0 || batt_anim->num_frames == 0;
+  GRSurface* surface = unknown ? surf_unknown : batt_anim->frames[batt_anim->cur_frame].surface;
+  int width = surface ? gr_get_width(surface) : 0;
+  int height = surface ? gr_get_height(surface) : 0;
+
+  // Battery frames are opaque and all the same size, so each one covers the
+  // last; everything else is cheap enough to repaint in full.
+  if (unknown || last_unknown_ || width != last_surface_width_ ||
+      height != last_surface_height_) {
+    full_redraws_ = kBufferCount;
+  }
+  last_unknown_ = unknown;
+  last_surface_width_ = width;
+  last_surface_height_ = height;
+
+  bool full = full_redraws_ > 0;
+  if (full) {
+    clear_screen();
+    full_redraws_--;
+    full_frames_++;
+  } else {
+    clear_dirty_rects();
+  }
+  cur_buffer_ = (cur_buffer_ + 1) % kBufferCount;
+  text_rects_[cur_buffer_].clear();
 
   /* try to display *something* */
-  if (batt_anim->cur_level < 0 || batt_anim->num_frames == 0)
+  if (unknown)
     draw_unknown(surf_unknown);
   else
     draw_battery(batt_anim);
   gr_flip();
+
+  int64_t time_ns = now_ns(CLOCK_MONOTONIC) - start_ns;
+  int64_t cpu_ns = now_ns(CLOCK_THREAD_CPUTIME_ID) - start_cpu_ns;
+  frames_++;
+  frame_time_ns_ += time_ns;
+  frame_cpu_ns_ += cpu_ns;
+  LOGV("frame %s in %" PRId64 " us, %" PRId64 " us cpu\n", full ? "repainted" : "updated",
+       time_ns / 1000, cpu_ns / 1000);
 }
 
-void HealthdDraw::blank_screen(bool blank) { gr_fb_blank(blank); }
+void HealthdDraw::blank_screen(bool blank) {
+  gr_fb_blank(blank);
+  // Not every display keeps its buffers while blanked.
+  if (!blank) full_redraws_ = kBufferCount;
+}
+
+void HealthdDraw::log_stats() {
+  if (frames_ == 0) return;
+  LOGW("drew %d frames (%d repainted), %" PRId64 " us per frame, %" PRId64 " us cpu\n",
+       frames_, full_frames_, frame_time_ns_ / frames_ / 1000, frame_cpu_ns_ / frames_ / 1000);
+  frames_ = 0;
+  full_frames_ = 0;
+  frame_time_ns_ = 0;
+  frame_cpu_ns_ = 0;
+}
 
 void HealthdDraw::clear_screen(void) {
   gr_color(0, 0, 0, 255);
   gr_clear();
 }
 
+void HealthdDraw::clear_dirty_rects(void) {
+  gr_color(0, 0, 0, 255);
+  for (const auto& rects : text_rects_) {
+    for (const Rect& r : rects) gr_fill(r.x1, r.y1, r.x2, r.y2);
+  }
+}
+
 int HealthdDraw::draw_surface_centered(GRSurface* surface) {
   int w = gr_get_width(surface);
   int h = gr_get_height(surface);
@@ -84,12 +159,20 @@ int HealthdDraw::draw_surface_centered(GRSurface* surface) {
 
 int HealthdDraw::draw_text(const GRFont* font, int x, int y, const char* str) {
   int str_len_px = gr_measure(font, str);
+  int font_width, font_height;
+  gr_font_size(font, &font_width, &font_height);
 
   if (x < 0) x = (screen_width_ - str_len_px) / 2;
   if (y < 0) y = (screen_height_ - char_height_) / 2;
   gr_text(font, x + kSplitOffset, y, str, false /* bold */);
-  if (kSplitScreen)
+  text_rects_[cur_buffer_].push_back(
+      {x + kSplitOffset, y, x + kSplitOffset + str_len_px, y + font_height});
+  if (kSplitScreen) {
     gr_text(font, x - kSplitOffset + screen_width_, y, str, false /* bold */);
+    text_rects_[cur_buffer_].push_back({x - kSplitOffset + screen_width_, y,
+                                        x - kSplitOffset + screen_width_ + str_len_px,
+                                        y + font_height});
+  }
 
   return y + char_height_;
 }
@@ -19,6 +19,9 @@
 
 #include <linux/input.h>
 #include <minui/minui.h>
+#include <stdint.h>
+
+#include <vector>
 
 #include "animation.h"
 
@@ -30,14 +33,27 @@ class HealthdDraw {
   HealthdDraw(animation* anim);
   virtual ~HealthdDraw();
 
-  // Redraws screen.
+  // Redraws screen. Only the text and the battery image are repainted,
+  // unless what is drawn changes shape.
   void redraw_screen(const animation* batt_anim, GRSurface* surf_unknown);
 
   // Blanks screen if true, unblanks if false.
   virtual void blank_screen(bool blank);
 
+  // Logs and resets the frame time statistics.
+  void log_stats();
+
  protected:
+  // Number of buffers minui flips between; each needs its own repaint.
+  static constexpr int kBufferCount = 2;
+
+  struct Rect {
+    int x1, y1, x2, y2;
+  };
+
   virtual void clear_screen();
+  // Blanks the rectangles text went to in the frames still in the buffers.
+  virtual void clear_dirty_rects();
 
   // returns the last y-offset of where the surface ends.
   virtual int draw_surface_centered(GRSurface* surface);
@@ -70,6 +86,22 @@ class HealthdDraw {
   const bool kSplitScreen;
   // Pixels to offset graphics towards center split.
   const int kSplitOffset;
+
+  // Frames left to repaint in full, one per buffer.
+  int full_redraws_;
+  // What the last frame showed, to tell when a full repaint is needed.
+  bool last_unknown_;
+  int last_surface_width_;
+  int last_surface_height_;
+  // Text drawn by each of the last kBufferCount frames.
+  std::vector<Rect> text_rects_[kBufferCount];
+  int cur_buffer_;
+
+  // Frame time statistics since the last log_stats().
+  int frames_;
+  int full_frames_;
+  int64_t frame_time_ns_;
+  int64_t frame_cpu_ns_;
 };
 
 #endif  // HEALTHD_DRAW_H
@@ -99,6 +99,8 @@ struct charger {
 
     animation* batt_anim;
     GRSurface* surf_unknown;
+    // images are decoded when first shown, not at startup
+    bool images_loaded;
     int boot_min_cap;
 };
 
@@ -272,6 +274,49 @@ static void reset_animation(animation* anim) {
     anim->run = false;
 }
 
+static void load_images(charger* charger) {
+    animation* anim = charger->batt_anim;
+    int64_t start = curr_time_ms();
+    int ret;
+
+    charger->images_loaded = true;
+
+    ret = res_create_display_surface(anim->fail_file.c_str(), &charger->surf_unknown);
+    if (ret < 0) {
+        LOGE("Cannot load custom battery_fail image. Reverting to built in.\n");
+        ret = res_create_display_surface("charger/battery_fail", &charger->surf_unknown);
+        if (ret < 0) {
+            LOGE("Cannot load built in battery_fail image\n");
+            charger->surf_unknown = NULL;
+        }
+    }
+
+    // All frames live interlaced in one PNG, so they can only be decoded
+    // together.
+    GRSurface** scale_frames;
+    int scale_count;
+    int scale_fps;  // Not in use (charger/battery_scale doesn't have FPS text
+                    // chunk). We are using hard-coded frame.disp_time instead.
+    ret = res_create_multi_display_surface(anim->animation_file.c_str(), &scale_count, &scale_fps,
+                                           &scale_frames);
+    if (ret < 0) {
+        LOGE("Cannot load battery_scale image\n");
+        anim->num_frames = 0;
+        anim->num_cycles = 1;
+    } else if (scale_count != anim->num_frames) {
+        LOGE("battery_scale image has unexpected frame count (%d, expected %d)\n", scale_count,
+             anim->num_frames);
+        anim->num_frames = 0;
+        anim->num_cycles = 1;
+    } else {
+        for (int i = 0; i < anim->num_frames; i++) {
+            anim->frames[i].surface = scale_frames[i];
+        }
+    }
+
+    LOGV("images decoded in %" PRId64 " ms\n", curr_time_ms() - start);
+}
+
 static void update_screen_state(charger* charger, int64_t now) {
     animation* batt_anim = charger->batt_anim;
     int disp_time;
@@ -290,6 +335,7 @@ static void update_screen_state(charger* charger, int64_t now) {
         }
 
         healthd_draw.reset(new HealthdDraw(batt_anim));
+        if (!charger->images_loaded) load_images(charger);
 
 #ifndef CHARGER_DISABLE_INIT_BLANK
         healthd_draw->blank_screen(true);
@@ -302,6 +348,7 @@ static void update_screen_state(charger* charger, int64_t now) {
         charger->next_screen_transition = -1;
         healthd_draw->blank_screen(true);
         LOGV("[%" PRId64 "] animation done\n", now);
+        healthd_draw->log_stats();
         if (charger->charger_connected) request_suspend(true);
         return;
     }
@@ -615,7 +662,6 @@ animation* init_animation() {
 void healthd_mode_charger_init(struct healthd_config* config) {
     int ret;
     charger* charger = &charger_state;
-    int i;
     int epollfd;
 
     dump_last_kmsg();
@@ -628,39 +674,10 @@ void healthd_mode_charger_init(struct healthd_config* config) {
         healthd_register_event(epollfd, charger_event_handler, EVENT_WAKEUP_FD);
     }
 
-    animation* anim = init_animation();
-    charger->batt_anim = anim;
-
-    ret = res_create_display_surface(anim->fail_file.c_str(), &charger->surf_unknown);
-    if (ret < 0) {
-        LOGE("Cannot load custom battery_fail image. Reverting to built in.\n");
-        ret = res_create_display_surface("charger/battery_fail", &charger->surf_unknown);
-        if (ret < 0) {
-            LOGE("Cannot load built in battery_fail image\n");
-            charger->surf_unknown = NULL;
-        }
-    }
+    charger->batt_anim = init_animation();
+    charger->surf_unknown = NULL;
+    charger->images_loaded = false;
 
-    GRSurface** scale_frames;
-    int scale_count;
-    int scale_fps;  // Not in use (charger/battery_scale doesn't have FPS text
-                    // chunk). We are using hard-coded frame.disp_time instead.
-    ret = res_create_multi_display_surface(anim->animation_file.c_str(), &scale_count, &scale_fps,
-                                           &scale_frames);
-    if (ret < 0) {
-        LOGE("Cannot load battery_scale image\n");
-        anim->num_frames = 0;
-        anim->num_cycles = 1;
-    } else if (scale_count != anim->num_frames) {
-        LOGE("battery_scale image has unexpected frame count (%d, expected %d)\n", scale_count,
-             anim->num_frames);
-        anim->num_frames = 0;
-        anim->num_cycles = 1;
-    } else {
-        for (i = 0; i < anim->num_frames; i++) {
-            anim->frames[i].surface = scale_frames[i];
-        }
-    }
     ev_sync_key_state(
         std::bind(&set_key_callback, charger, std::placeholders::_1, std::placeholders::_2));
 
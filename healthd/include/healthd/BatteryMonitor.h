@@ -17,6 +17,11 @@
 #ifndef HEALTHD_BATTERYMONITOR_H
 #define HEALTHD_BATTERYMONITOR_H
 
+#include <stdint.h>
+
+#include <string>
+#include <unordered_map>
+
 #include <batteryservice/BatteryService.h>
 #include <binder/IInterface.h>
 #include <utils/String8.h>
@@ -38,6 +43,7 @@ class BatteryMonitor {
     };
 
     BatteryMonitor();
+    ~BatteryMonitor();
     void init(struct healthd_config *hc);
     bool update(void);
     int getChargeStatus();
@@ -52,7 +58,18 @@ class BatteryMonitor {
     int mBatteryFixedCapacity;
     int mBatteryFixedTemperature;
     struct BatteryProperties props;
+    // sysfs attributes stay open and are read again from offset 0; -1 for
+    // files that don't exist
+    std::unordered_map<std::string, int> mSysfsFds;
+    // cost of update(), for dumpState
+    uint64_t mUpdateCount;
+    uint64_t mUpdateCpuNs;
+    uint64_t mSysfsOpens;
+    uint64_t mSysfsReads;
 
+    bool updateProperties(void);
+    int getSysfsFd(const String8& path);
+    bool hasFile(const String8& path);
     int getBatteryStatus(const char* status);
     int getBatteryHealth(const char* status);
     int readFromFile(const String8& path, std::string* buf);
@@ -21,6 +21,7 @@
 #include <android-base/properties.h>
 #include <android-base/strings.h>
 
+#include "boot_timeline.h"
 #include "util.h"
 
 using android::base::Join;
@@ -92,8 +93,13 @@ void Action::ExecuteAllCommands() const {
 
 void Action::ExecuteCommand(const Command& command) const {
     android::base::Timer t;
+    auto start = boot_clock::now();
     int result = command.InvokeFunc();
 
+    if (BootTimelineRecording()) {
+        BootTimelineAdd("action." + BuildTriggersString(), boot_clock::now() - start);
+    }
+
     auto duration = t.duration();
     // Any action longer than 50ms will be warned to user as slow operation
     if (duration > 50ms || android::base::GetMinimumLogSeverity() <= android::base::DEBUG) {
@@ -245,9 +251,57 @@ ActionManager& ActionManager::GetInstance() {
 }
 
 void ActionManager::AddAction(std::unique_ptr<Action> action) {
+    IndexAction(action.get());
     actions_.emplace_back(std::move(action));
 }
 
+void ActionManager::IndexAction(const Action* action) {
+    if (!action->event_trigger().empty()) {
+        event_trigger_actions_[action->event_trigger()].emplace_back(action);
+        return;
+    }
+    for (const auto& [trigger_name, trigger_value] : action->property_triggers()) {
+        property_trigger_actions_[trigger_name].emplace_back(action);
+    }
+    property_actions_.emplace_back(action);
+}
+
+void ActionManager::UnindexAction(const Action* action) {
+    auto erase = [action](std::vector<const Action*>* actions) {
+        actions->erase(std::remove(actions->begin(), actions->end(), action), actions->end());
+    };
+    if (!action->event_trigger().empty()) {
+        erase(&event_trigger_actions_[action->event_trigger()]);
+        return;
+    }
+    for (const auto& [trigger_name, trigger_value] : action->property_triggers()) {
+        erase(&property_trigger_actions_[trigger_name]);
+    }
+    erase(&property_actions_);
+}
+
+static const std::vector<const Action*> kNoActions;
+
+const std::vector<const Action*>& ActionManager::CandidateActions(
+    const EventTrigger& event_trigger) const {
+    auto it = event_trigger_actions_.find(event_trigger);
+    return it == event_trigger_actions_.end() ? kNoActions : it->second;
+}
+
+const std::vector<const Action*>& ActionManager::CandidateActions(
+    const PropertyChange& property_change) {
+    const auto& name = property_change.first;
+    // QueueAllPropertyActions() checks every action that only has property triggers.
+    if (name.empty()) return property_actions_;
+
+    auto it = property_trigger_actions_.find(name);
+    const auto& candidates = it == property_trigger_actions_.end() ? kNoActions : it->second;
+    auto& count = property_dispatch_counts_[name];
+    ++count.changes;
+    count.checked_actions += candidates.size();
+    return candidates;
+}
+
 void ActionManager::QueueEventTrigger(const std::string& trigger) {
     event_queue_.emplace(trigger);
 }
@@ -277,11 +331,21 @@ void ActionManager::QueueBuiltinAction(BuiltinFunction func, const std::string&
 void ActionManager::ExecuteOneCommand() {
     // Loop through the event queue until we have an action to execute
     while (current_executing_actions_.empty() && !event_queue_.empty()) {
-        for (const auto& action : actions_) {
-            if (std::visit([&action](const auto& event) { return action->CheckEvent(event); },
-                           event_queue_.front())) {
-                current_executing_actions_.emplace(action.get());
+        const auto& event = event_queue_.front();
+        auto queue_matching_actions = [this](const auto& event) {
+            for (const auto& action : CandidateActions(event)) {
+                if (action->CheckEvent(event)) {
+                    current_executing_actions_.emplace(action);
+                }
             }
+        };
+        if (auto builtin_action = std::get_if<BuiltinAction>(&event)) {
+            // Nothing but the action that was queued can match.
+            current_executing_actions_.emplace(*builtin_action);
+        } else if (auto event_trigger = std::get_if<EventTrigger>(&event)) {
+            queue_matching_actions(*event_trigger);
+        } else {
+            queue_matching_actions(std::get<PropertyChange>(event));
         }
         event_queue_.pop();
     }
@@ -311,6 +375,7 @@ void ActionManager::ExecuteOneCommand() {
             auto eraser = [&action] (std::unique_ptr<Action>& a) {
                 return a.get() == action;
             };
+            UnindexAction(action);
             actions_.erase(std::remove_if(actions_.begin(), actions_.end(), eraser));
         }
     }
@@ -324,6 +389,10 @@ void ActionManager::DumpState() const {
     for (const auto& a : actions_) {
         a->DumpState();
     }
+    for (const auto& [name, count] : property_dispatch_counts_) {
+        LOG(INFO) << "property " << name << ": " << count.changes << " changes dispatched to "
+                  << count.checked_actions << " actions";
+    }
 }
 
 void ActionManager::ClearQueue() {
@@ -67,6 +67,10 @@ class Action {
     void DumpState() const;
 
     bool oneshot() const { return oneshot_; }
+    const std::map<std::string, std::string>& property_triggers() const {
+        return property_triggers_;
+    }
+    const std::string& event_trigger() const { return event_trigger_; }
     const std::string& filename() const { return filename_; }
     int line() const { return line_; }
     static void set_function_map(const KeywordMap<BuiltinFunction>* function_map) {
@@ -110,7 +114,27 @@ class ActionManager {
     ActionManager(ActionManager const&) = delete;
     void operator=(ActionManager const&) = delete;
 
+    // How often changes of one property were dispatched, and how many actions they were checked
+    // against in total.
+    struct DispatchCount {
+        std::size_t changes = 0;
+        std::size_t checked_actions = 0;
+    };
+
+    const std::vector<const Action*>& CandidateActions(const EventTrigger& event_trigger) const;
+    const std::vector<const Action*>& CandidateActions(const PropertyChange& property_change);
+    void IndexAction(const Action* action);
+    void UnindexAction(const Action* action);
+
     std::vector<std::unique_ptr<Action>> actions_;
+    // The only actions that an event or a property change can trigger, in the order of actions_.
+    // Actions with an event trigger are indexed by it, the others by each of their property
+    // triggers, and also kept in property_actions_ for QueueAllPropertyActions().
+    std::map<std::string, std::vector<const Action*>> event_trigger_actions_;
+    std::map<std::string, std::vector<const Action*>> property_trigger_actions_;
+    std::vector<const Action*> property_actions_;
+    std::map<std::string, DispatchCount> property_dispatch_counts_;
+
     std::queue<std::variant<EventTrigger, PropertyChange, BuiltinAction>> event_queue_;
     std::queue<const Action*> current_executing_actions_;
     std::size_t current_command_;
@@ -0,0 +1,86 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "boot_timeline.h"
+
+#include <ctype.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <map>
+
+#include <android-base/file.h>
+#include <android-base/logging.h>
+#include <android-base/unique_fd.h>
+#include <private/android_filesystem_config.h>
+
+#include "util.h"
+
+using android::base::unique_fd;
+using android::base::WriteStringToFd;
+
+namespace android {
+namespace init {
+
+static bool recording = true;
+// In ns, so that the many commands that take well under a millisecond still add up.
+static std::map<std::string, int64_t> timeline;
+
+// bootstat turns the names into Tron histograms, so only keep what is safe there: triggers
+// come with spaces, colons and equals signs.
+static std::string TimelineName(const std::string& name) {
+    std::string result(name);
+    for (char& c : result) {
+        if (!isalnum(c) && c != '.' && c != '_' && c != '-') c = '_';
+    }
+    return result;
+}
+
+bool BootTimelineRecording() {
+    return recording;
+}
+
+void BootTimelineAdd(const std::string& name, std::chrono::nanoseconds duration) {
+    if (!recording) return;
+    timeline[TimelineName(name)] += duration.count();
+}
+
+void BootTimelineMark(const std::string& name) {
+    if (!recording) return;
+    timeline.emplace(TimelineName(name), boot_clock::now().time_since_epoch().count());
+}
+
+void BootTimelineWrite() {
+    if (!recording) return;
+    recording = false;
+
+    std::string content;
+    for (const auto& [name, ns] : timeline) {
+        content += name + " " + std::to_string(ns / 1000000) + "\n";
+    }
+    timeline.clear();
+
+    // bootstat runs as system:log.
+    unique_fd fd(TEMP_FAILURE_RETRY(
+        open(BOOT_TIMELINE_FILE, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC | O_NOFOLLOW, 0440)));
+    if (fd == -1 || fchown(fd, AID_ROOT, AID_LOG) == -1 || !WriteStringToFd(content, fd)) {
+        PLOG(ERROR) << "Failed to write " << BOOT_TIMELINE_FILE;
+    }
+}
+
+}  // namespace init
+}  // namespace android
@@ -0,0 +1,48 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _INIT_BOOT_TIMELINE_H
+#define _INIT_BOOT_TIMELINE_H
+
+#include <chrono>
+#include <string>
+
+#define BOOT_TIMELINE_FILE "/dev/.boot_timeline"
+
+namespace android {
+namespace init {
+
+// What init spent its time on until sys.boot_completed, for bootstat to record: how long each
+// action ran, when each service first started, and how long init waited for each exec service.
+// Kept in memory, and written to BOOT_TIMELINE_FILE in one go when the boot completes, as lines
+// of "<name> <ms>".
+
+// Whether anything is still being recorded, so callers can skip building the name.
+bool BootTimelineRecording();
+
+// Adds |duration| to the total for |name|.
+void BootTimelineAdd(const std::string& name, std::chrono::nanoseconds duration);
+
+// Sets |name| to the time since boot, if it isn't set already.
+void BootTimelineMark(const std::string& name);
+
+// Writes the timeline, and stops recording.
+void BootTimelineWrite();
+
+}  // namespace init
+}  // namespace android
+
+#endif
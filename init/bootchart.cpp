@@ -26,33 +26,107 @@
 #include <time.h>
 #include <unistd.h>
 
+#include <algorithm>
 #include <chrono>
 #include <condition_variable>
+#include <deque>
 #include <memory>
 #include <mutex>
 #include <thread>
+#include <unordered_map>
 
 #include <android-base/file.h>
 #include <android-base/logging.h>
+#include <android-base/parseint.h>
 #include <android-base/properties.h>
 #include <android-base/stringprintf.h>
+#include <android-base/strings.h>
+#include <android-base/unique_fd.h>
 
+using android::base::boot_clock;
 using android::base::StringPrintf;
 using namespace std::chrono_literals;
 
 namespace android {
 namespace init {
 
+// /data/bootchart/bootchart.bin, which convert-bootchart.py turns into the text logs that the
+// bootchart tools read, is a kBootchartMagic and kBootchartVersion, each a little-endian
+// uint32_t, followed by records. Every record starts with a RecordHeader and is followed by
+// |size| bytes of payload. |time_ns| is the boot_clock time at which the record was taken.
+static constexpr uint32_t kBootchartMagic = 0x54484342;  // "BCHT"
+static constexpr uint32_t kBootchartVersion = 1;
+
+struct RecordHeader {
+  uint32_t type;
+  uint32_t size;
+  uint64_t time_ns;
+};
+
+enum RecordType : uint32_t {
+  // The text of the "header" file.
+  kRecordHeader = 1,
+  // The contents of /proc/stat.
+  kRecordProcStat = 2,
+  // The contents of /proc/diskstats.
+  kRecordProcDiskstats = 3,
+  // /proc/<pid>/stat of every process, with the full name from /proc/<pid>/cmdline.
+  kRecordProcPs = 4,
+  // A ServiceEventPayload followed by the name of the service.
+  kRecordServiceEvent = 5,
+};
+
+struct ServiceEventPayload {
+  int32_t pid;
+  uint32_t event;  // BootchartServiceEvent
+  // Only for kStart and kExecStart: how long Service::Start() took until fork, and in total.
+  uint64_t fork_ns;
+  uint64_t total_ns;
+};
+
+static constexpr std::chrono::milliseconds kDefaultSamplePeriod = 200ms;
+// Finer than a jiffy is wasted on the text logs, whose timestamps are in jiffies.
+static constexpr std::chrono::milliseconds kMinSamplePeriod = 10ms;
+// Once the records take more than this, the oldest are dropped to make room.
+static constexpr size_t kDefaultBufferSize = 32 * 1024 * 1024;
+
 static std::thread* g_bootcharting_thread;
 
 static std::mutex g_bootcharting_finished_mutex;
 static std::condition_variable g_bootcharting_finished_cv;
 static bool g_bootcharting_finished;
 
-static long long get_uptime_jiffies() {
-  std::string uptime;
-  if (!android::base::ReadFileToString("/proc/uptime", &uptime)) return 0;
-  return 100LL * strtod(uptime.c_str(), NULL);
+// Everything recorded while bootcharting, which is only written out once it stops, so that
+// bootcharting doesn't write to /data while the boot is being measured. Samples are added by
+// the bootcharting thread, service events by the main thread.
+static std::mutex g_records_mutex;
+static std::deque<std::string> g_records;
+static size_t g_records_size;
+static size_t g_records_dropped;
+static size_t g_buffer_size = kDefaultBufferSize;
+
+static uint64_t now_ns() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+      boot_clock::now().time_since_epoch()).count();
+}
+
+static std::string make_record(RecordType type, uint64_t time_ns, const void* payload,
+                               size_t size) {
+  RecordHeader header = {type, static_cast<uint32_t>(size), time_ns};
+  std::string record(reinterpret_cast<const char*>(&header), sizeof(header));
+  record.append(static_cast<const char*>(payload), size);
+  return record;
+}
+
+static void add_record(std::string record) {
+  std::lock_guard<std::mutex> lock(g_records_mutex);
+  g_records_size += record.size();
+  g_records.emplace_back(std::move(record));
+  while (g_records_size > g_buffer_size && g_records.size() > 1) {
+    g_records_size -= g_records.front().size();
+    g_records.pop_front();
+    g_records_dropped++;
+  }
 }
 
 static std::unique_ptr<FILE, decltype(&fclose)> fopen_unique(const char* filename,
@@ -62,104 +136,156 @@ static std::unique_ptr<FILE, decltype(&fclose)> fopen_unique(const char* filenam
   return result;
 }
 
-static void log_header() {
+// Reads |path| relative to |dir_fd| into |content|, reusing its storage.
+static bool read_file_at(int dir_fd, const char* path, std::string* content) {
+  content->clear();
+  android::base::unique_fd fd(openat(dir_fd, path, O_RDONLY | O_CLOEXEC));
+  if (fd == -1) return false;
+  char buf[4096];
+  ssize_t n;
+  while ((n = TEMP_FAILURE_RETRY(read(fd, buf, sizeof(buf)))) > 0) {
+    content->append(buf, n);
+  }
+  return n == 0;
+}
+
+static std::string get_header() {
   char date[32];
   time_t now_t = time(NULL);
   struct tm now = *localtime(&now_t);
   strftime(date, sizeof(date), "%F %T", &now);
 
   utsname uts;
-  if (uname(&uts) == -1) return;
+  if (uname(&uts) == -1) return "";
 
   std::string fingerprint = android::base::GetProperty("ro.build.fingerprint", "");
-  if (fingerprint.empty()) return;
+  if (fingerprint.empty()) return "";
 
   std::string kernel_cmdline;
   android::base::ReadFileToString("/proc/cmdline", &kernel_cmdline);
 
-  auto fp = fopen_unique("/data/bootchart/header", "we");
-  if (!fp) return;
-  fprintf(&*fp, "version = Android init 0.8\n");
-  fprintf(&*fp, "title = Boot chart for Android (%s)\n", date);
-  fprintf(&*fp, "system.uname = %s %s %s %s\n", uts.sysname, uts.release, uts.version, uts.machine);
-  fprintf(&*fp, "system.release = %s\n", fingerprint.c_str());
+  std::string header;
+  header += "version = Android init 0.8\n";
+  header += StringPrintf("title = Boot chart for Android (%s)\n", date);
+  header += StringPrintf("system.uname = %s %s %s %s\n", uts.sysname, uts.release, uts.version,
+                         uts.machine);
+  header += StringPrintf("system.release = %s\n", fingerprint.c_str());
   // TODO: use /proc/cpuinfo "model name" line for x86, "Processor" line for arm.
-  fprintf(&*fp, "system.cpu = %s\n", uts.machine);
-  fprintf(&*fp, "system.kernel.options = %s\n", kernel_cmdline.c_str());
+  header += StringPrintf("system.cpu = %s\n", uts.machine);
+  header += StringPrintf("system.kernel.options = %s\n", kernel_cmdline.c_str());
+  return header;
 }
 
-static void log_uptime(FILE* log) {
-  fprintf(log, "%lld\n", get_uptime_jiffies());
-}
-
-static void log_file(FILE* log, const char* procfile) {
-  log_uptime(log);
-
-  std::string content;
-  if (android::base::ReadFileToString(procfile, &content)) {
-    fprintf(log, "%s\n", content.c_str());
+static void log_file(RecordType type, const char* procfile, std::string* content) {
+  uint64_t time_ns = now_ns();
+  if (read_file_at(AT_FDCWD, procfile, content)) {
+    add_record(make_record(type, time_ns, content->data(), content->size()));
   }
 }
 
-static void log_processes(FILE* log) {
-  log_uptime(log);
-
-  std::unique_ptr<DIR, int(*)(DIR*)> dir(opendir("/proc"), closedir);
+// The full names of the processes seen so far, with the name from /proc/<pid>/stat they were
+// read for: the full name is only read again once that changes, after an exec or when the pid
+// has been reused.
+struct ProcessName {
+  std::string comm;
+  std::string full_name;
+};
+
+static void log_processes(int proc_fd, std::unordered_map<int, ProcessName>* names,
+                          std::string* stat, std::string* cmdline) {
+  uint64_t time_ns = now_ns();
+  std::string ps;
+
+  std::unique_ptr<DIR, int(*)(DIR*)> dir(fdopendir(dup(proc_fd)), closedir);
+  if (!dir) return;
+  rewinddir(dir.get());
   struct dirent* entry;
   while ((entry = readdir(dir.get())) != NULL) {
     // Only match numeric values.
     int pid = atoi(entry->d_name);
     if (pid == 0) continue;
 
+    // Read process stat line.
+    if (!read_file_at(proc_fd, StringPrintf("%d/stat", pid).c_str(), stat)) continue;
+    size_t open = stat->find('(');
+    size_t close = stat->find_last_of(')');
+    if (open == std::string::npos || close == std::string::npos) {
+      ps += *stat;
+      continue;
+    }
+
     // /proc/<pid>/stat only has truncated task names, so get the full
     // name from /proc/<pid>/cmdline.
-    std::string cmdline;
-    android::base::ReadFileToString(StringPrintf("/proc/%d/cmdline", pid), &cmdline);
-    const char* full_name = cmdline.c_str(); // So we stop at the first NUL.
-
-    // Read process stat line.
-    std::string stat;
-    if (android::base::ReadFileToString(StringPrintf("/proc/%d/stat", pid), &stat)) {
-      if (!cmdline.empty()) {
-        // Substitute the process name with its real name.
-        size_t open = stat.find('(');
-        size_t close = stat.find_last_of(')');
-        if (open != std::string::npos && close != std::string::npos) {
-          stat.replace(open + 1, close - open - 1, full_name);
-        }
-      }
-      fputs(stat.c_str(), log);
+    std::string comm = stat->substr(open + 1, close - open - 1);
+    auto it = names->find(pid);
+    if (it == names->end() || it->second.comm != comm) {
+      read_file_at(proc_fd, StringPrintf("%d/cmdline", pid).c_str(), cmdline);
+      // So we stop at the first NUL.
+      it = names->insert_or_assign(pid, ProcessName{comm, cmdline->c_str()}).first;
     }
+    const ProcessName& name = it->second;
+    if (!name.full_name.empty()) {
+      // Substitute the process name with its real name.
+      stat->replace(open + 1, close - open - 1, name.full_name);
+    }
+    ps += *stat;
+  }
+
+  add_record(make_record(kRecordProcPs, time_ns, ps.data(), ps.size()));
+}
+
+static void write_records() {
+  std::deque<std::string> records;
+  size_t dropped;
+  {
+    std::lock_guard<std::mutex> lock(g_records_mutex);
+    records.swap(g_records);
+    g_records_size = 0;
+    dropped = g_records_dropped;
+    g_records_dropped = 0;
+  }
+  if (dropped != 0) {
+    LOG(WARNING) << "bootchart: dropped the oldest " << dropped << " records to stay within "
+                 << g_buffer_size << " bytes";
   }
 
-  fputc('\n', log);
+  auto fp = fopen_unique("/data/bootchart/bootchart.bin", "we");
+  if (!fp) return;
+  fwrite(&kBootchartMagic, sizeof(kBootchartMagic), 1, &*fp);
+  fwrite(&kBootchartVersion, sizeof(kBootchartVersion), 1, &*fp);
+  for (const auto& record : records) {
+    fwrite(record.data(), record.size(), 1, &*fp);
+  }
 }
 
-static void bootchart_thread_main() {
-  LOG(INFO) << "Bootcharting started";
+static void bootchart_thread_main(std::chrono::milliseconds period) {
+  LOG(INFO) << "Bootcharting started, sampling every " << period.count() << "ms";
 
-  // Open log files.
-  auto stat_log = fopen_unique("/data/bootchart/proc_stat.log", "we");
-  if (!stat_log) return;
-  auto proc_log = fopen_unique("/data/bootchart/proc_ps.log", "we");
-  if (!proc_log) return;
-  auto disk_log = fopen_unique("/data/bootchart/proc_diskstats.log", "we");
-  if (!disk_log) return;
+  std::string header = get_header();
+  add_record(make_record(kRecordHeader, now_ns(), header.data(), header.size()));
 
-  log_header();
+  android::base::unique_fd proc_fd(open("/proc", O_RDONLY | O_DIRECTORY | O_CLOEXEC));
+  std::unordered_map<int, ProcessName> names;
+  // Reused by every sample, so that sampling doesn't allocate once they are big enough.
+  std::string content;
+  std::string cmdline;
 
+  boot_clock::time_point next_sample = boot_clock::now();
   while (true) {
     {
       std::unique_lock<std::mutex> lock(g_bootcharting_finished_mutex);
-      g_bootcharting_finished_cv.wait_for(lock, 200ms);
+      next_sample += period;
+      g_bootcharting_finished_cv.wait_until(lock, next_sample,
+                                            [] { return g_bootcharting_finished; });
       if (g_bootcharting_finished) break;
     }
 
-    log_file(&*stat_log, "/proc/stat");
-    log_file(&*disk_log, "/proc/diskstats");
-    log_processes(&*proc_log);
+    log_file(kRecordProcStat, "/proc/stat", &content);
+    log_file(kRecordProcDiskstats, "/proc/diskstats", &content);
+    if (proc_fd != -1) log_processes(proc_fd, &names, &content, &cmdline);
   }
 
+  write_records();
   LOG(INFO) << "Bootcharting finished";
 }
 
@@ -171,7 +297,23 @@ static int do_bootchart_start() {
     return 0;
   }
 
-  g_bootcharting_thread = new std::thread(bootchart_thread_main);
+  // The sampling period in milliseconds, and the size of the buffer in bytes, can be set in
+  // /data/bootchart/period and /data/bootchart/buffer_size.
+  std::chrono::milliseconds period = kDefaultSamplePeriod;
+  std::string value;
+  unsigned int period_ms;
+  if (android::base::ReadFileToString("/data/bootchart/period", &value) &&
+      android::base::ParseUint(android::base::Trim(value), &period_ms)) {
+    period = std::max(std::chrono::milliseconds(period_ms), kMinSamplePeriod);
+  }
+  size_t buffer_size;
+  if (android::base::ReadFileToString("/data/bootchart/buffer_size", &value) &&
+      android::base::ParseUint(android::base::Trim(value), &buffer_size)) {
+    g_buffer_size = buffer_size;
+  }
+
+  g_bootcharting_finished = false;
+  g_bootcharting_thread = new std::thread(bootchart_thread_main, period);
   return 0;
 }
 
@@ -196,5 +338,31 @@ int do_bootchart(const std::vector<std::string>& args) {
   return do_bootchart_stop();
 }
 
+static void log_service_event(BootchartServiceEvent event, const std::string& name, pid_t pid,
+                              boot_clock::time_point time, std::chrono::nanoseconds fork_duration,
+                              std::chrono::nanoseconds total_duration) {
+  if (!g_bootcharting_thread) return;
+
+  ServiceEventPayload payload = {pid, static_cast<uint32_t>(event),
+                                 static_cast<uint64_t>(fork_duration.count()),
+                                 static_cast<uint64_t>(total_duration.count())};
+  std::string data(reinterpret_cast<const char*>(&payload), sizeof(payload));
+  data += name;
+  uint64_t time_ns =
+      std::chrono::duration_cast<std::chrono::nanoseconds>(time.time_since_epoch()).count();
+  add_record(make_record(kRecordServiceEvent, time_ns, data.data(), data.size()));
+}
+
+void bootchart_log_service_start(const std::string& name, pid_t pid, bool exec,
+                                 boot_clock::time_point start, boot_clock::time_point fork,
+                                 boot_clock::time_point end) {
+  log_service_event(exec ? BootchartServiceEvent::kExecStart : BootchartServiceEvent::kStart,
+                    name, pid, start, fork - start, end - start);
+}
+
+void bootchart_log_service_exit(const std::string& name, pid_t pid) {
+  log_service_event(BootchartServiceEvent::kExit, name, pid, boot_clock::now(), 0ns, 0ns);
+}
+
 }  // namespace init
 }  // namespace android
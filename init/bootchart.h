@@ -17,14 +17,34 @@
 #ifndef _BOOTCHART_H
 #define _BOOTCHART_H
 
+#include <stdint.h>
+#include <sys/types.h>
+
 #include <string>
 #include <vector>
 
+#include <android-base/chrono_utils.h>
+
 namespace android {
 namespace init {
 
 int do_bootchart(const std::vector<std::string>& args);
 
+enum class BootchartServiceEvent : uint32_t {
+  kStart = 0,
+  // The start of a service that init waits for, from exec or exec_start.
+  kExecStart = 1,
+  kExit = 2,
+};
+
+// Record, while bootcharting, what happens to services. Service::Start() of |name| began at
+// |start|, forked |pid| at |fork| and was done at |end|.
+void bootchart_log_service_start(const std::string& name, pid_t pid, bool exec,
+                                 android::base::boot_clock::time_point start,
+                                 android::base::boot_clock::time_point fork,
+                                 android::base::boot_clock::time_point end);
+void bootchart_log_service_exit(const std::string& name, pid_t pid);
+
 }  // namespace init
 }  // namespace android
 
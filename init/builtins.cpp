@@ -19,6 +19,7 @@
 #include <dirent.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <inttypes.h>
 #include <linux/loop.h>
 #include <linux/module.h>
 #include <mntent.h>
@@ -39,12 +40,17 @@
 #include <sys/wait.h>
 #include <unistd.h>
 
+#include <algorithm>
+#include <thread>
+
 #include <android-base/chrono_utils.h>
 #include <android-base/file.h>
 #include <android-base/logging.h>
 #include <android-base/parseint.h>
 #include <android-base/properties.h>
+#include <android-base/stringprintf.h>
 #include <android-base/strings.h>
+#include <android-base/unique_fd.h>
 #include <bootloader_message/bootloader_message.h>
 #include <cutils/android_reboot.h>
 #include <ext4_utils/ext4_crypt.h>
@@ -129,6 +135,7 @@ static int do_class_start(const std::vector<std::string>& args) {
          * which are explicitly disabled.  They must
          * be started individually.
          */
+    ServiceManager::GetInstance().PrepareClassStart(args[1]);
     ServiceManager::GetInstance().
         ForEachServiceInClass(args[1], [] (Service* s) { s->StartIfNotDisabled(); });
     return 0;
@@ -414,13 +421,55 @@ static void import_late(const std::vector<std::string>& args, size_t start_index
     if (false) DumpState();
 }
 
+// The write end of the pipe that the mount_all child sends its timings through.
+static int mount_timing_fd = -1;
+
+static void write_mount_timing(const char* mount_point, int64_t duration_ms) {
+    android::base::WriteStringToFd(
+        android::base::StringPrintf("%s %" PRId64 "\n", mount_point, duration_ms),
+        mount_timing_fd);
+}
+
+// Sets ro.boottime.init.mount.<mount point> for each "<mount point> <ms>"
+// line that the mount_all child wrote, for bootstat to record.
+static void set_mount_timing_properties(int fd) {
+    std::string timings;
+    if (!android::base::ReadFdToString(fd, &timings)) {
+        PLOG(WARNING) << "could not read the mount_all timings";
+        return;
+    }
+    for (const auto& line : android::base::Split(timings, "\n")) {
+        std::vector<std::string> fields = android::base::Split(line, " ");
+        if (fields.size() != 2 || fields[0].size() < 2 || fields[0][0] != '/') {
+            continue;
+        }
+        std::string name = fields[0].substr(1);
+        std::replace(name.begin(), name.end(), '/', '_');
+        property_set("ro.boottime.init.mount." + name, fields[1]);
+    }
+}
+
 /* mount_fstab
  *
  *  Call fs_mgr_mount_all() to mount the given fstab
  */
-static int mount_fstab(const char* fstabfile, int mount_mode) {
+static int mount_fstab(const char* fstabfile, int mount_mode, bool parallel) {
     int ret = -1;
 
+    // The child can't set properties while we wait for it, so it hands the
+    // time each mount point took back through a pipe.
+    android::base::unique_fd timing_read_fd;
+    android::base::unique_fd timing_write_fd;
+    if (parallel) {
+        int fds[2];
+        if (pipe2(fds, O_CLOEXEC) == 0) {
+            timing_read_fd.reset(fds[0]);
+            timing_write_fd.reset(fds[1]);
+        } else {
+            PLOG(WARNING) << "pipe2 failed, not recording the mount_all timings";
+        }
+    }
+
     /*
      * Call fs_mgr_mount_all() to mount all filesystems.  We fork(2) and
      * do the call in the child to provide protection to the main init
@@ -430,6 +479,13 @@ static int mount_fstab(const char* fstabfile, int mount_mode) {
     pid_t pid = fork();
     if (pid > 0) {
         /* Parent.  Wait for the child to return */
+        timing_write_fd.reset();
+        if (timing_read_fd != -1) {
+            // Reading until the child closes its end also keeps it from
+            // blocking on a full pipe.
+            set_mount_timing_properties(timing_read_fd);
+        }
+
         int status;
         int wp_ret = TEMP_FAILURE_RETRY(waitpid(pid, &status, 0));
         if (wp_ret == -1) {
@@ -450,7 +506,14 @@ static int mount_fstab(const char* fstabfile, int mount_mode) {
         android::base::ScopedLogSeverity info(android::base::INFO);
 
         struct fstab* fstab = fs_mgr_read_fstab(fstabfile);
-        int child_ret = fs_mgr_mount_all(fstab, mount_mode);
+        int child_ret;
+        if (parallel) {
+            mount_timing_fd = timing_write_fd;
+            child_ret = fs_mgr_mount_all_parallel(
+                fstab, mount_mode, timing_write_fd != -1 ? write_mount_timing : nullptr);
+        } else {
+            child_ret = fs_mgr_mount_all(fstab, mount_mode);
+        }
         fs_mgr_free_fstab(fstab);
         if (child_ret == -1) {
             PLOG(ERROR) << "fs_mgr_mount_all returned an error";
@@ -529,6 +592,9 @@ static int queue_fs_event(int code) {
 }
 
 /* mount_all <fstab> [ <path> ]* [--<options>]*
+ *
+ * --parallel checks and mounts the entries that don't depend on each
+ * other at the same time, and records how long each one took.
  *
  * This function might request a reboot, in which case it will
  * not return.
@@ -541,6 +607,7 @@ static int do_mount_all(const std::vector<std::string>& args) {
     const char* fstabfile = args[1].c_str();
     std::size_t path_arg_end = args.size();
     const char* prop_post_fix = "default";
+    bool parallel = false;
 
     for (na = args.size() - 1; na > 1; --na) {
         if (args[na] == "--early") {
@@ -553,12 +620,15 @@ static int do_mount_all(const std::vector<std::string>& args) {
             import_rc = false;
             mount_mode = MOUNT_MODE_LATE;
             prop_post_fix = "late";
+        } else if (args[na] == "--parallel") {
+            path_arg_end = na;
+            parallel = true;
         }
     }
 
     std::string prop_name = "ro.boottime.init.mount_all."s + prop_post_fix;
     android::base::Timer t;
-    int ret =  mount_fstab(fstabfile, mount_mode);
+    int ret =  mount_fstab(fstabfile, mount_mode, parallel);
     property_set(prop_name, std::to_string(t.duration().count()));
 
     if (import_rc) {
@@ -779,7 +849,14 @@ static int do_restorecon(const std::vector<std::string>& args) {
             }
         } else {
             in_flags = false;
-            if (selinux_android_restorecon(args[i].c_str(), flag) < 0) {
+            // sysfs is large, and has no restorecon_last digest that labeling its subdirectories
+            // separately could get wrong.
+            bool parallel = (flag & SELINUX_ANDROID_RESTORECON_RECURSE) &&
+                            (args[i] == "/sys" || android::base::StartsWith(args[i], "/sys/"));
+            int result = parallel ? restorecon_recursive_parallel(
+                                        args[i], flag, std::thread::hardware_concurrency() ?: 4)
+                                  : selinux_android_restorecon(args[i].c_str(), flag);
+            if (result < 0) {
                 ret = -errno;
             }
         }
@@ -826,15 +903,29 @@ static int do_load_system_props(const std::vector<std::string>& args) {
 }
 
 static int do_wait(const std::vector<std::string>& args) {
-    if (args.size() == 2) {
-        return wait_for_file(args[1].c_str(), kCommandRetryTimeout);
-    } else if (args.size() == 3) {
-        int timeout;
-        if (android::base::ParseInt(args[2], &timeout)) {
-            return wait_for_file(args[1].c_str(), std::chrono::seconds(timeout));
+    std::chrono::nanoseconds timeout = kCommandRetryTimeout;
+    if (args.size() == 3) {
+        int timeout_s;
+        if (!android::base::ParseInt(args[2], &timeout_s)) {
+            return -1;
         }
+        timeout = std::chrono::seconds(timeout_s);
     }
-    return -1;
+
+    // The following commands only run once the file exists or the wait timed out.
+    std::string path = args[1];
+    android::base::Timer t;
+    if (!start_waiting_for_file(path, timeout, [path, t](bool found) {
+            if (!found) {
+                LOG(ERROR) << "Timed out waiting for " << path << " after " << t;
+            } else if (t.duration() > 50ms) {
+                LOG(INFO) << "Wait for " << path << " took " << t;
+            }
+        })) {
+        LOG(ERROR) << "do_wait(\"" << path << "\") failed: init already in waiting";
+        return -1;
+    }
+    return 0;
 }
 
 static int do_wait_for_prop(const std::vector<std::string>& args) {
@@ -0,0 +1,101 @@
+#!/usr/bin/env python
+
+# Copyright (C) 2017 The Android Open Source Project
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#      http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+"""Convert a bootchart.bin written by init into the text logs bootchart reads.
+
+Usage: convert-bootchart.py bootchart.bin OUTPUT_DIR
+
+Writes header, proc_stat.log, proc_ps.log and proc_diskstats.log, in the
+format init used to write them in directly, and services.log, with a line
+for every service event:
+
+<time, us since boot> <start|exec_start|exit> <pid> <name> [<us to fork> <us in total>]
+
+The format of bootchart.bin is described in bootchart.cpp.
+"""
+
+import os
+import struct
+import sys
+
+MAGIC = 0x54484342
+VERSION = 1
+
+RECORD_HEADER = 1
+RECORD_PROC_STAT = 2
+RECORD_PROC_DISKSTATS = 3
+RECORD_PROC_PS = 4
+RECORD_SERVICE_EVENT = 5
+
+SERVICE_EVENTS = {0: 'start', 1: 'exec_start', 2: 'exit'}
+
+# The text logs are timestamped in jiffies, as read from /proc/uptime.
+NS_PER_JIFFY = 10 * 1000 * 1000
+
+
+def convert(data, output_dir):
+    magic, version = struct.unpack_from('<II', data, 0)
+    if magic != MAGIC or version != VERSION:
+        sys.exit('not a version %d bootchart.bin' % VERSION)
+
+    logs = {
+        RECORD_PROC_STAT: open(os.path.join(output_dir, 'proc_stat.log'), 'wb'),
+        RECORD_PROC_DISKSTATS: open(os.path.join(output_dir, 'proc_diskstats.log'), 'wb'),
+        RECORD_PROC_PS: open(os.path.join(output_dir, 'proc_ps.log'), 'wb'),
+    }
+    services = open(os.path.join(output_dir, 'services.log'), 'w')
+
+    offset = 8
+    while offset + 16 <= len(data):
+        record_type, size, time_ns = struct.unpack_from('<IIQ', data, offset)
+        offset += 16
+        payload = data[offset:offset + size]
+        offset += size
+        if len(payload) != size:
+            break
+
+        if record_type == RECORD_HEADER:
+            with open(os.path.join(output_dir, 'header'), 'wb') as header:
+                header.write(payload)
+        elif record_type in logs:
+            log = logs[record_type]
+            log.write(('%d\n' % (time_ns // NS_PER_JIFFY)).encode())
+            log.write(payload)
+            log.write(b'\n')
+        elif record_type == RECORD_SERVICE_EVENT:
+            pid, event, fork_ns, total_ns = struct.unpack_from('<iIQQ', payload, 0)
+            name = payload[24:].decode('utf-8', 'replace')
+            line = '%d %s %d %s' % (time_ns // 1000, SERVICE_EVENTS.get(event, str(event)),
+                                    pid, name)
+            if event != 2:
+                line += ' %d %d' % (fork_ns // 1000, total_ns // 1000)
+            services.write(line + '\n')
+
+    for log in logs.values():
+        log.close()
+    services.close()
+
+
+def main():
+    if len(sys.argv) != 3:
+        sys.exit('usage: %s bootchart.bin OUTPUT_DIR' % sys.argv[0])
+    with open(sys.argv[1], 'rb') as f:
+        data = f.read()
+    convert(data, sys.argv[2])
+
+
+if __name__ == '__main__':
+    main()
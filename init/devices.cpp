@@ -21,6 +21,8 @@
 #include <sys/sysmacros.h>
 #include <unistd.h>
 
+#include <algorithm>
+#include <iterator>
 #include <memory>
 
 #include <android-base/logging.h>
@@ -134,13 +136,81 @@ bool Permissions::Match(const std::string& path) const {
 bool SysfsPermissions::MatchWithSubsystem(const std::string& path,
                                           const std::string& subsystem) const {
     std::string path_basename = Basename(path);
-    if (name().find(subsystem) != std::string::npos) {
+    if (NamesSubsystem(subsystem)) {
         if (Match("/sys/class/" + subsystem + "/" + path_basename)) return true;
         if (Match("/sys/bus/" + subsystem + "/devices/" + path_basename)) return true;
     }
     return Match(path);
 }
 
+void PermissionsIndex::Add(const Permissions& permissions, size_t index) {
+    const std::string& name = permissions.name_;
+    // fnmatch() compares everything before the first special character literally, so a wildcard
+    // rule can only match paths that start with it.
+    size_t literal_length =
+        permissions.wildcard_ ? std::min(name.find_first_of("*?[\\"), name.size()) : name.size();
+
+    Node* node = &root_;
+    size_t position = 0;
+    while (position < literal_length) {
+        auto& child = node->children[name[position]];
+        if (!child) {
+            child = std::make_unique<Node>();
+            child->label = name.substr(position, literal_length - position);
+            node = child.get();
+            break;
+        }
+
+        // Split the edge where the name leaves it, so that every rule ends on a node.
+        const std::string& label = child->label;
+        size_t common = 0;
+        while (common < label.size() && position + common < literal_length &&
+               label[common] == name[position + common]) {
+            ++common;
+        }
+        if (common < label.size()) {
+            auto middle = std::make_unique<Node>();
+            middle->label = label.substr(0, common);
+            child->label.erase(0, common);
+            char first = child->label[0];
+            middle->children[first] = std::move(child);
+            child = std::move(middle);
+        }
+        node = child.get();
+        position += common;
+    }
+
+    if (permissions.prefix_) {
+        node->prefix.emplace_back(index);
+    } else if (permissions.wildcard_) {
+        node->wildcard.emplace_back(index, name);
+    } else {
+        node->exact.emplace_back(index);
+    }
+}
+
+void PermissionsIndex::Match(const std::string& path, std::vector<size_t>* matches) const {
+    const Node* node = &root_;
+    size_t position = 0;
+    while (true) {
+        matches->insert(matches->end(), node->prefix.begin(), node->prefix.end());
+        for (const auto& [index, pattern] : node->wildcard) {
+            if (fnmatch(pattern.c_str(), path.c_str(), FNM_PATHNAME) == 0) {
+                matches->emplace_back(index);
+            }
+        }
+        if (position == path.size()) {
+            matches->insert(matches->end(), node->exact.begin(), node->exact.end());
+            return;
+        }
+        auto child = node->children.find(path[position]);
+        if (child == node->children.end()) return;
+        node = child->second.get();
+        if (path.compare(position, node->label.size(), node->label) != 0) return;
+        position += node->label.size();
+    }
+}
+
 void SysfsPermissions::SetPermissions(const std::string& path) const {
     std::string attribute_file = path + "/" + attribute_;
     LOG(VERBOSE) << "fixup " << attribute_file << " " << uid() << " " << gid() << " " << std::oct
@@ -194,8 +264,25 @@ void DeviceHandler::FixupSysPermissions(const std::string& upath,
     // contain, so we prepend it...
     std::string path = "/sys" + upath;
 
-    for (const auto& s : sysfs_permissions_) {
-        if (s.MatchWithSubsystem(path, subsystem)) s.SetPermissions(path);
+    // This is SysfsPermissions::MatchWithSubsystem() for every rule at once: rules that name the
+    // subsystem also match under its /sys/class and /sys/bus directories.  Matching rules are
+    // applied in the order they were parsed in, like before the index existed.
+    std::vector<size_t> matches;
+    sysfs_permissions_index_.Match(path, &matches);
+    std::string path_basename = Basename(path);
+    for (const auto& alias : {"/sys/class/" + subsystem + "/" + path_basename,
+                              "/sys/bus/" + subsystem + "/devices/" + path_basename}) {
+        std::vector<size_t> alias_matches;
+        sysfs_permissions_index_.Match(alias, &alias_matches);
+        std::copy_if(alias_matches.begin(), alias_matches.end(), std::back_inserter(matches),
+                     [this, &subsystem](size_t i) {
+                         return sysfs_permissions_[i].NamesSubsystem(subsystem);
+                     });
+    }
+    std::sort(matches.begin(), matches.end());
+    matches.erase(std::unique(matches.begin(), matches.end()), matches.end());
+    for (size_t i : matches) {
+        sysfs_permissions_[i].SetPermissions(path);
     }
 
     if (!skip_restorecon_ && access(path.c_str(), F_OK) == 0) {
@@ -208,12 +295,15 @@ void DeviceHandler::FixupSysPermissions(const std::string& upath,
 
 std::tuple<mode_t, uid_t, gid_t> DeviceHandler::GetDevicePermissions(
     const std::string& path, const std::vector<std::string>& links) const {
-    // Search the perms list in reverse so that ueventd.$hardware can override ueventd.rc.
-    for (auto it = dev_permissions_.crbegin(); it != dev_permissions_.crend(); ++it) {
-        if (it->Match(path) || std::any_of(links.cbegin(), links.cend(),
-                                           [it](const auto& link) { return it->Match(link); })) {
-            return {it->perm(), it->uid(), it->gid()};
-        }
+    // The last matching rule wins, so that ueventd.$hardware can override ueventd.rc.
+    std::vector<size_t> matches;
+    dev_permissions_index_.Match(path, &matches);
+    for (const auto& link : links) {
+        dev_permissions_index_.Match(link, &matches);
+    }
+    if (!matches.empty()) {
+        const auto& permissions = dev_permissions_[*std::max_element(matches.begin(), matches.end())];
+        return {permissions.perm(), permissions.uid(), permissions.gid()};
     }
     /* Default if nothing found. */
     return {0600, 0, 0};
@@ -425,6 +515,8 @@ DeviceHandler::DeviceHandler(std::vector<Permissions> dev_permissions,
                              std::vector<Subsystem> subsystems, bool skip_restorecon)
     : dev_permissions_(std::move(dev_permissions)),
       sysfs_permissions_(std::move(sysfs_permissions)),
+      dev_permissions_index_(dev_permissions_),
+      sysfs_permissions_index_(sysfs_permissions_),
       subsystems_(std::move(subsystems)),
       sehandle_(selinux_android_file_context_handle()),
       skip_restorecon_(skip_restorecon),
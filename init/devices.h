@@ -21,7 +21,10 @@
 #include <sys/types.h>
 
 #include <algorithm>
+#include <memory>
 #include <string>
+#include <unordered_map>
+#include <utility>
 #include <vector>
 
 #include <android-base/file.h>
@@ -46,6 +49,8 @@ class Permissions {
     const std::string& name() const { return name_; }
 
   private:
+    friend class PermissionsIndex;
+
     std::string name_;
     mode_t perm_;
     uid_t uid_;
@@ -63,10 +68,49 @@ class SysfsPermissions : public Permissions {
     bool MatchWithSubsystem(const std::string& path, const std::string& subsystem) const;
     void SetPermissions(const std::string& path) const;
 
+    // Whether the rule also applies to the /sys/class and /sys/bus paths of |subsystem|.
+    bool NamesSubsystem(const std::string& subsystem) const {
+        return name().find(subsystem) != std::string::npos;
+    }
+
   private:
     const std::string attribute_;
 };
 
+// Finds the rules that match a path without trying each of them in turn.  The rules are kept in
+// a radix tree under the literal start of their names: all of it for exact and prefix rules, and
+// up to the first wildcard for the rest.  A lookup walks the tree along the path once, and only
+// runs fnmatch() for the wildcard rules whose literal start the path shares.
+class PermissionsIndex {
+  public:
+    PermissionsIndex() = default;
+
+    // Rule i of |permissions| is reported as i by Match().
+    template <typename T>
+    explicit PermissionsIndex(const std::vector<T>& permissions) {
+        for (size_t i = 0; i < permissions.size(); ++i) {
+            Add(permissions[i], i);
+        }
+    }
+
+    // Appends the index of every rule that matches |path| to |matches|, in no particular order.
+    void Match(const std::string& path, std::vector<size_t>* matches) const;
+
+  private:
+    struct Node {
+        // The part of the names between the parent and this node.
+        std::string label;
+        std::unordered_map<char, std::unique_ptr<Node>> children;
+        std::vector<size_t> exact;
+        std::vector<size_t> prefix;
+        std::vector<std::pair<size_t, std::string>> wildcard;
+    };
+
+    void Add(const Permissions& permissions, size_t index);
+
+    Node root_;
+};
+
 class Subsystem {
   public:
     friend class SubsystemParser;
@@ -123,6 +167,8 @@ class DeviceHandler {
 
     std::vector<Permissions> dev_permissions_;
     std::vector<SysfsPermissions> sysfs_permissions_;
+    PermissionsIndex dev_permissions_index_;
+    PermissionsIndex sysfs_permissions_index_;
     std::vector<Subsystem> subsystems_;
     selabel_handle* sehandle_;
     bool skip_restorecon_;
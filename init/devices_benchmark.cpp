@@ -0,0 +1,250 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Compares finding the permissions of the devices created during a cold boot by trying every
+// rule in turn against looking them up in a PermissionsIndex.
+
+#include <string>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+#include <private/android_filesystem_config.h>
+
+#include "devices.h"
+
+namespace android {
+namespace init {
+
+// The rules of rootdir/ueventd.rc.
+static const std::vector<Permissions> kDevPermissions = {
+    {"/dev/null", 0666, AID_ROOT, AID_ROOT},
+    {"/dev/zero", 0666, AID_ROOT, AID_ROOT},
+    {"/dev/full", 0666, AID_ROOT, AID_ROOT},
+    {"/dev/ptmx", 0666, AID_ROOT, AID_ROOT},
+    {"/dev/tty", 0666, AID_ROOT, AID_ROOT},
+    {"/dev/random", 0666, AID_ROOT, AID_ROOT},
+    {"/dev/urandom", 0666, AID_ROOT, AID_ROOT},
+    {"/dev/hw_random", 0440, AID_ROOT, AID_SYSTEM},
+    {"/dev/ashmem", 0666, AID_ROOT, AID_ROOT},
+    {"/dev/binder", 0666, AID_ROOT, AID_ROOT},
+    {"/dev/hwbinder", 0666, AID_ROOT, AID_ROOT},
+    {"/dev/vndbinder", 0666, AID_ROOT, AID_ROOT},
+    {"/dev/pmsg0", 0222, AID_ROOT, AID_LOG},
+    {"/dev/msm_hw3dc", 0666, AID_ROOT, AID_ROOT},
+    {"/dev/kgsl", 0666, AID_ROOT, AID_ROOT},
+    {"/dev/dri/*", 0666, AID_ROOT, AID_GRAPHICS},
+    {"/dev/diag", 0660, AID_RADIO, AID_RADIO},
+    {"/dev/diag_arm9", 0660, AID_RADIO, AID_RADIO},
+    {"/dev/ttyMSM0", 0600, AID_BLUETOOTH, AID_BLUETOOTH},
+    {"/dev/uhid", 0660, AID_UHID, AID_UHID},
+    {"/dev/uinput", 0660, AID_SYSTEM, AID_BLUETOOTH},
+    {"/dev/alarm", 0664, AID_SYSTEM, AID_RADIO},
+    {"/dev/rtc0", 0640, AID_SYSTEM, AID_SYSTEM},
+    {"/dev/tty0", 0660, AID_ROOT, AID_SYSTEM},
+    {"/dev/graphics/*", 0660, AID_ROOT, AID_GRAPHICS},
+    {"/dev/msm_hw3dm", 0660, AID_SYSTEM, AID_GRAPHICS},
+    {"/dev/input/*", 0660, AID_ROOT, AID_INPUT},
+    {"/dev/eac", 0660, AID_ROOT, AID_AUDIO},
+    {"/dev/cam", 0660, AID_ROOT, AID_CAMERA},
+    {"/dev/pmem", 0660, AID_SYSTEM, AID_GRAPHICS},
+    {"/dev/pmem_adsp*", 0660, AID_SYSTEM, AID_AUDIO},
+    {"/dev/pmem_camera*", 0660, AID_SYSTEM, AID_CAMERA},
+    {"/dev/oncrpc/*", 0660, AID_ROOT, AID_SYSTEM},
+    {"/dev/adsp/*", 0660, AID_SYSTEM, AID_AUDIO},
+    {"/dev/snd/*", 0660, AID_SYSTEM, AID_AUDIO},
+    {"/dev/mt9t013", 0660, AID_SYSTEM, AID_SYSTEM},
+    {"/dev/msm_camera/*", 0660, AID_SYSTEM, AID_SYSTEM},
+    {"/dev/akm8976_daemon", 0640, AID_COMPASS, AID_SYSTEM},
+    {"/dev/akm8976_aot", 0640, AID_COMPASS, AID_SYSTEM},
+    {"/dev/akm8973_daemon", 0640, AID_COMPASS, AID_SYSTEM},
+    {"/dev/akm8973_aot", 0640, AID_COMPASS, AID_SYSTEM},
+    {"/dev/bma150", 0640, AID_COMPASS, AID_SYSTEM},
+    {"/dev/cm3602", 0640, AID_COMPASS, AID_SYSTEM},
+    {"/dev/akm8976_pffd", 0640, AID_COMPASS, AID_SYSTEM},
+    {"/dev/lightsensor", 0640, AID_SYSTEM, AID_SYSTEM},
+    {"/dev/msm_pcm_out*", 0660, AID_SYSTEM, AID_AUDIO},
+    {"/dev/msm_pcm_in*", 0660, AID_SYSTEM, AID_AUDIO},
+    {"/dev/msm_pcm_ctl*", 0660, AID_SYSTEM, AID_AUDIO},
+    {"/dev/msm_snd*", 0660, AID_SYSTEM, AID_AUDIO},
+    {"/dev/msm_mp3*", 0660, AID_SYSTEM, AID_AUDIO},
+    {"/dev/audience_a1026*", 0660, AID_SYSTEM, AID_AUDIO},
+    {"/dev/tpa2018d1*", 0660, AID_SYSTEM, AID_AUDIO},
+    {"/dev/msm_audpre", 0660, AID_SYSTEM, AID_AUDIO},
+    {"/dev/msm_audio_ctl", 0660, AID_SYSTEM, AID_AUDIO},
+    {"/dev/htc-acoustic", 0660, AID_SYSTEM, AID_AUDIO},
+    {"/dev/vdec", 0660, AID_SYSTEM, AID_AUDIO},
+    {"/dev/q6venc", 0660, AID_SYSTEM, AID_AUDIO},
+    {"/dev/snd/dsp", 0660, AID_SYSTEM, AID_AUDIO},
+    {"/dev/snd/dsp1", 0660, AID_SYSTEM, AID_AUDIO},
+    {"/dev/snd/mixer", 0660, AID_SYSTEM, AID_AUDIO},
+    {"/dev/smd0", 0640, AID_RADIO, AID_RADIO},
+    {"/dev/qmi", 0640, AID_RADIO, AID_RADIO},
+    {"/dev/qmi0", 0640, AID_RADIO, AID_RADIO},
+    {"/dev/qmi1", 0640, AID_RADIO, AID_RADIO},
+    {"/dev/qmi2", 0640, AID_RADIO, AID_RADIO},
+    {"/dev/bus/usb/*", 0660, AID_ROOT, AID_USB},
+    {"/dev/mtp_usb", 0660, AID_ROOT, AID_MTP},
+    {"/dev/usb_accessory", 0660, AID_ROOT, AID_USB},
+    {"/dev/tun", 0660, AID_SYSTEM, AID_VPN},
+    {"/dev/ts0710mux*", 0640, AID_RADIO, AID_RADIO},
+    {"/dev/ppp", 0660, AID_RADIO, AID_VPN},
+    {"/dev/dvb*", 0660, AID_ROOT, AID_SYSTEM},
+};
+
+static const std::vector<SysfsPermissions> kSysfsPermissions = {
+    {"/sys/devices/platform/trusty.*", "trusty_version", 0440, AID_ROOT, AID_LOG},
+    {"/sys/devices/virtual/input/input*", "enable", 0660, AID_ROOT, AID_INPUT},
+    {"/sys/devices/virtual/input/input*", "poll_delay", 0660, AID_ROOT, AID_INPUT},
+    {"/sys/devices/virtual/usb_composite/*", "enable", 0664, AID_ROOT, AID_SYSTEM},
+    {"/sys/devices/system/cpu/cpu*", "cpufreq/scaling_max_freq", 0664, AID_SYSTEM, AID_SYSTEM},
+    {"/sys/devices/system/cpu/cpu*", "cpufreq/scaling_min_freq", 0664, AID_SYSTEM, AID_SYSTEM},
+};
+
+// The devices and their symlinks from the uevents of a cold boot of a phone.
+static const std::vector<std::string> kDevPaths = {
+    "/dev/null",
+    "/dev/zero",
+    "/dev/urandom",
+    "/dev/ashmem",
+    "/dev/binder",
+    "/dev/hwbinder",
+    "/dev/vndbinder",
+    "/dev/pmsg0",
+    "/dev/kgsl-3d0",
+    "/dev/dri/card0",
+    "/dev/dri/renderD128",
+    "/dev/ttyMSM0",
+    "/dev/uinput",
+    "/dev/rtc0",
+    "/dev/tty0",
+    "/dev/tty1",
+    "/dev/graphics/fb0",
+    "/dev/input/event0",
+    "/dev/input/event1",
+    "/dev/input/event2",
+    "/dev/input/mice",
+    "/dev/snd/controlC0",
+    "/dev/snd/pcmC0D0p",
+    "/dev/snd/pcmC0D1c",
+    "/dev/snd/timer",
+    "/dev/bus/usb/001/001",
+    "/dev/mtp_usb",
+    "/dev/usb_accessory",
+    "/dev/tun",
+    "/dev/ppp",
+    "/dev/loop0",
+    "/dev/loop1",
+    "/dev/ram0",
+    "/dev/block/mmcblk0",
+    "/dev/block/mmcblk0p1",
+    "/dev/block/platform/soc/7824900.sdhci/mmcblk0p1",
+    "/dev/block/platform/soc/7824900.sdhci/by-name/boot",
+    "/dev/block/bootdevice/by-name/boot",
+    "/dev/block/mmcblk0p20",
+    "/dev/block/platform/soc/7824900.sdhci/mmcblk0p20",
+    "/dev/block/platform/soc/7824900.sdhci/by-name/system",
+    "/dev/block/bootdevice/by-name/system",
+    "/dev/block/dm-0",
+    "/dev/cpu_dma_latency",
+    "/dev/ion",
+    "/dev/kmsg",
+    "/dev/fuse",
+    "/dev/uhid",
+    "/dev/video0",
+    "/dev/media0",
+};
+
+static const std::vector<std::string> kSysfsPaths = {
+    "/sys/devices/system/cpu/cpu0",
+    "/sys/devices/system/cpu/cpu1",
+    "/sys/devices/system/cpu/cpu2",
+    "/sys/devices/system/cpu/cpu3",
+    "/sys/devices/virtual/input/input0",
+    "/sys/devices/virtual/input/input1",
+    "/sys/devices/virtual/misc/uinput",
+    "/sys/devices/virtual/tty/tty0",
+    "/sys/devices/virtual/mem/null",
+    "/sys/devices/platform/soc/7824900.sdhci/mmc_host/mmc0",
+    "/sys/devices/platform/soc/7824900.sdhci/mmc_host/mmc0/mmc0:0001/block/mmcblk0",
+    "/sys/devices/platform/soc/78b0000.serial/tty/ttyMSM0",
+    "/sys/devices/virtual/usb_composite/mtp",
+    "/sys/devices/platform/trusty.0",
+};
+
+// The loop GetDevicePermissions() used to run for every device.
+static void BM_linear_last_match(benchmark::State& state,
+                                 const std::vector<Permissions>& permissions,
+                                 const std::vector<std::string>& paths) {
+    while (state.KeepRunning()) {
+        for (const auto& path : paths) {
+            for (auto it = permissions.crbegin(); it != permissions.crend(); ++it) {
+                if (it->Match(path)) {
+                    benchmark::DoNotOptimize(it->perm());
+                    break;
+                }
+            }
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * paths.size());
+}
+
+// The loop FixupSysPermissions() used to run for every device, less the subsystem aliases.
+static void BM_linear_all_matches(benchmark::State& state,
+                                  const std::vector<SysfsPermissions>& permissions,
+                                  const std::vector<std::string>& paths) {
+    std::vector<size_t> matches;
+    while (state.KeepRunning()) {
+        for (const auto& path : paths) {
+            matches.clear();
+            for (size_t i = 0; i < permissions.size(); ++i) {
+                if (permissions[i].Match(path)) matches.emplace_back(i);
+            }
+            benchmark::DoNotOptimize(matches.data());
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * paths.size());
+}
+
+template <typename T>
+static void BM_index_match(benchmark::State& state, const std::vector<T>& permissions,
+                           const std::vector<std::string>& paths) {
+    PermissionsIndex index(permissions);
+    std::vector<size_t> matches;
+    while (state.KeepRunning()) {
+        for (const auto& path : paths) {
+            matches.clear();
+            index.Match(path, &matches);
+            benchmark::DoNotOptimize(matches.data());
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * paths.size());
+}
+
+BENCHMARK_CAPTURE(BM_linear_last_match, dev, kDevPermissions, kDevPaths);
+BENCHMARK_CAPTURE(BM_index_match, dev, kDevPermissions, kDevPaths);
+BENCHMARK_CAPTURE(BM_linear_all_matches, sysfs, kSysfsPermissions, kSysfsPaths);
+BENCHMARK_CAPTURE(BM_index_match, sysfs, kSysfsPermissions, kSysfsPaths);
+
+static void BM_build_index(benchmark::State& state) {
+    while (state.KeepRunning()) {
+        PermissionsIndex index(kDevPermissions);
+        benchmark::DoNotOptimize(&index);
+    }
+}
+BENCHMARK(BM_build_index);
+
+}  // namespace init
+}  // namespace android
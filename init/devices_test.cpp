@@ -16,6 +16,10 @@
 
 #include "devices.h"
 
+#include <algorithm>
+#include <string>
+#include <vector>
+
 #include <android-base/scopeguard.h>
 #include <android-base/test_utils.h>
 #include <gtest/gtest.h>
@@ -311,5 +315,76 @@ TEST(device_handler, SysfsPermissionsMatchWithSubsystemBus) {
     EXPECT_EQ(1001U, permissions.gid());
 }
 
+// The index has to find exactly the rules that Permissions::Match() would.
+static std::vector<size_t> LinearMatch(const std::vector<Permissions>& permissions,
+                                       const std::string& path) {
+    std::vector<size_t> matches;
+    for (size_t i = 0; i < permissions.size(); ++i) {
+        if (permissions[i].Match(path)) matches.emplace_back(i);
+    }
+    return matches;
+}
+
+static std::vector<size_t> IndexMatch(const PermissionsIndex& index, const std::string& path) {
+    std::vector<size_t> matches;
+    index.Match(path, &matches);
+    std::sort(matches.begin(), matches.end());
+    return matches;
+}
+
+TEST(device_handler, PermissionsIndexMatchesLikeLinearScan) {
+    std::vector<Permissions> permissions = {
+        {"/dev/null", 0666, 0, 0},
+        {"/dev/nul", 0666, 0, 0},
+        {"/dev/*", 0600, 0, 0},
+        {"*", 0600, 0, 0},
+        {"/dev/ttyS*", 0660, 0, 1000},
+        {"/dev/block/*/by-name/*", 0660, 0, 1006},
+        {"/dev/block/platform/*", 0660, 0, 1006},
+        {"/dev/snd/pcmC*D*", 0660, 1000, 1005},
+        {"/dev/tty?", 0660, 0, 1000},
+        {"/dev/input/event[0-3]*", 0660, 0, 1004},
+        {"/dev/null", 0600, 1000, 1000},
+        {"", 0600, 0, 0},
+    };
+    PermissionsIndex index(permissions);
+
+    for (const auto& path : {
+             "/dev/null"s,
+             "/dev/nul"s,
+             "/dev/nulll"s,
+             "/dev/ttyS0"s,
+             "/dev/ttyS"s,
+             "/dev/tty1"s,
+             "/dev/tty10"s,
+             "/dev/block/platform/soc/by-name/system"s,
+             "/dev/block/platform/soc/1da4000.ufshc/by-name/system"s,
+             "/dev/block/mmcblk0/by-name/boot"s,
+             "/dev/snd/pcmC0D1p"s,
+             "/dev/snd/controlC0"s,
+             "/dev/input/event2"s,
+             "/dev/input/event7"s,
+             "/dev"s,
+             "/sys/devices/virtual/input/input0"s,
+             ""s,
+         }) {
+        EXPECT_EQ(LinearMatch(permissions, path), IndexMatch(index, path)) << path;
+    }
+}
+
+TEST(device_handler, PermissionsIndexSysfs) {
+    std::vector<SysfsPermissions> permissions = {
+        {"/sys/devices/virtual/input/input*", "enable", 0660, 0, 1001},
+        {"/sys/class/input/event*", "enable", 0660, 0, 1001},
+        {"/sys/devices/system/cpu/cpu*", "cpufreq/scaling_max_freq", 0664, 1000, 1000},
+    };
+    PermissionsIndex index(permissions);
+
+    EXPECT_EQ(std::vector<size_t>{0}, IndexMatch(index, "/sys/devices/virtual/input/input0"));
+    EXPECT_EQ(std::vector<size_t>{1}, IndexMatch(index, "/sys/class/input/event3"));
+    EXPECT_EQ(std::vector<size_t>{2}, IndexMatch(index, "/sys/devices/system/cpu/cpu4"));
+    EXPECT_EQ(std::vector<size_t>{}, IndexMatch(index, "/sys/devices/system/cpu"));
+}
+
 }  // namespace init
 }  // namespace android
@@ -17,12 +17,21 @@
 #include "firmware_handler.h"
 
 #include <fcntl.h>
+#include <limits.h>
+#include <string.h>
 #include <sys/sendfile.h>
+#include <sys/socket.h>
 #include <sys/wait.h>
 #include <unistd.h>
 
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <mutex>
 #include <string>
 #include <thread>
+#include <vector>
 
 #include <android-base/chrono_utils.h>
 #include <android-base/file.h>
@@ -36,16 +45,26 @@ using android::base::WriteFully;
 namespace android {
 namespace init {
 
-static void LoadFirmware(const Uevent& uevent, const std::string& root, int fw_fd, size_t fw_size,
-                         int loading_fd, int data_fd) {
+static const char* firmware_dirs[] = {"/etc/firmware/", "/vendor/firmware/", "/firmware/image/"};
+
+// How many firmware images the loader process copies at once.
+static constexpr size_t kFirmwareLoaderThreads = 4;
+
+// How long to wait before looking again for firmware that wasn't found while booting.
+static constexpr auto kFirmwareRetryDelay = 100ms;
+
+// Where HandleFirmwareEvent() sends requests to the loader process, or -1 to fork for each one.
+static int firmware_loader_socket = -1;
+
+static void LoadFirmware(const std::string& firmware, const std::string& root, int fw_fd,
+                         size_t fw_size, int loading_fd, int data_fd) {
     // Start transfer.
     WriteFully(loading_fd, "1", 1);
 
     // Copy the firmware.
     int rc = sendfile(data_fd, fw_fd, nullptr, fw_size);
     if (rc == -1) {
-        PLOG(ERROR) << "firmware: sendfile failed { '" << root << "', '" << uevent.firmware
-                    << "' }";
+        PLOG(ERROR) << "firmware: sendfile failed { '" << root << "', '" << firmware << "' }";
     }
 
     // Tell the firmware whether to abort or commit.
@@ -57,58 +76,259 @@ static bool IsBooting() {
     return access("/dev/.booting", F_OK) == 0;
 }
 
-static void ProcessFirmwareEvent(const Uevent& uevent) {
-    int booting = IsBooting();
+// Remembers which of firmware_dirs each firmware was found in, so that it is looked for there
+// first next time.  Only used by the loader process, which outlives every request.
+static std::mutex firmware_dir_cache_lock;
+static std::map<std::string, size_t> firmware_dir_cache;
 
-    LOG(INFO) << "firmware: loading '" << uevent.firmware << "' for '" << uevent.path << "'";
+// Loads |firmware| from the first of firmware_dirs that has it, returning false if none do.
+static bool TryLoadFirmware(const std::string& firmware, const std::string& root, int loading_fd,
+                            int data_fd, bool use_cache) {
+    size_t cached = arraysize(firmware_dirs);
+    if (use_cache) {
+        std::lock_guard<std::mutex> lock(firmware_dir_cache_lock);
+        auto it = firmware_dir_cache.find(firmware);
+        if (it != firmware_dir_cache.end()) cached = it->second;
+    }
 
-    std::string root = "/sys" + uevent.path;
+    for (size_t n = 0; n <= arraysize(firmware_dirs); n++) {
+        // The cached directory first, then all of them in order.
+        size_t i = (n == 0) ? cached : n - 1;
+        if (i == arraysize(firmware_dirs) || (n > 0 && i == cached)) continue;
+
+        std::string file = firmware_dirs[i] + firmware;
+        unique_fd fw_fd(open(file.c_str(), O_RDONLY | O_CLOEXEC));
+        struct stat sb;
+        if (fw_fd != -1 && fstat(fw_fd, &sb) != -1) {
+            LoadFirmware(firmware, root, fw_fd, sb.st_size, loading_fd, data_fd);
+            if (use_cache && i != cached) {
+                std::lock_guard<std::mutex> lock(firmware_dir_cache_lock);
+                firmware_dir_cache[firmware] = i;
+            }
+            return true;
+        }
+    }
+    return false;
+}
+
+static void NoFirmwareFound(const std::string& firmware, int loading_fd) {
+    LOG(ERROR) << "firmware: could not find firmware for " << firmware;
+
+    // Write "-1" as our response to the kernel's firmware request, since we have nothing for it.
+    write(loading_fd, "-1", 2);
+}
+
+static bool OpenFirmwareFds(const std::string& firmware, const std::string& root,
+                            unique_fd* loading_fd, unique_fd* data_fd) {
     std::string loading = root + "/loading";
     std::string data = root + "/data";
 
-    unique_fd loading_fd(open(loading.c_str(), O_WRONLY | O_CLOEXEC));
-    if (loading_fd == -1) {
-        PLOG(ERROR) << "couldn't open firmware loading fd for " << uevent.firmware;
-        return;
+    loading_fd->reset(open(loading.c_str(), O_WRONLY | O_CLOEXEC));
+    if (*loading_fd == -1) {
+        PLOG(ERROR) << "couldn't open firmware loading fd for " << firmware;
+        return false;
     }
 
-    unique_fd data_fd(open(data.c_str(), O_WRONLY | O_CLOEXEC));
-    if (data_fd == -1) {
-        PLOG(ERROR) << "couldn't open firmware data fd for " << uevent.firmware;
-        return;
+    data_fd->reset(open(data.c_str(), O_WRONLY | O_CLOEXEC));
+    if (*data_fd == -1) {
+        PLOG(ERROR) << "couldn't open firmware data fd for " << firmware;
+        return false;
     }
+    return true;
+}
 
-    static const char* firmware_dirs[] = {"/etc/firmware/", "/vendor/firmware/",
-                                          "/firmware/image/"};
+static void ProcessFirmwareEvent(const Uevent& uevent) {
+    int booting = IsBooting();
+
+    LOG(INFO) << "firmware: loading '" << uevent.firmware << "' for '" << uevent.path << "'";
+
+    std::string root = "/sys" + uevent.path;
+    unique_fd loading_fd, data_fd;
+    if (!OpenFirmwareFds(uevent.firmware, root, &loading_fd, &data_fd)) return;
 
 try_loading_again:
-    for (size_t i = 0; i < arraysize(firmware_dirs); i++) {
-        std::string file = firmware_dirs[i] + uevent.firmware;
-        unique_fd fw_fd(open(file.c_str(), O_RDONLY | O_CLOEXEC));
-        struct stat sb;
-        if (fw_fd != -1 && fstat(fw_fd, &sb) != -1) {
-            LoadFirmware(uevent, root, fw_fd, sb.st_size, loading_fd, data_fd);
-            return;
-        }
-    }
+    if (TryLoadFirmware(uevent.firmware, root, loading_fd, data_fd, false)) return;
 
     if (booting) {
         // If we're not fully booted, we may be missing
         // filesystems needed for firmware, wait and retry.
-        std::this_thread::sleep_for(100ms);
+        std::this_thread::sleep_for(kFirmwareRetryDelay);
         booting = IsBooting();
         goto try_loading_again;
     }
 
-    LOG(ERROR) << "firmware: could not find firmware for " << uevent.firmware;
+    NoFirmwareFound(uevent.firmware, loading_fd);
+}
+
+// A request waiting in the loader process for one of its threads.
+struct FirmwareRequest {
+    std::string path;
+    std::string firmware;
+    unique_fd loading_fd;
+    unique_fd data_fd;
+    std::chrono::steady_clock::time_point not_before;
+    Timer timer;
+};
 
-    // Write "-1" as our response to the kernel's firmware request, since we have nothing for it.
-    write(loading_fd, "-1", 2);
+class FirmwareLoader {
+  public:
+    explicit FirmwareLoader(int socket) : socket_(socket) {}
+
+    void Run();
+
+  private:
+    void ReceiveRequests();
+    void LoadRequests();
+
+    int socket_;
+    std::mutex lock_;
+    std::condition_variable cv_;
+    std::deque<FirmwareRequest> requests_;
+    bool done_ = false;
+};
+
+// Requests are the uevent's path and firmware, each followed by a '\0'.
+static std::string SerializeFirmwareRequest(const Uevent& uevent) {
+    std::string message = uevent.path;
+    message += '\0';
+    message += uevent.firmware;
+    message += '\0';
+    return message;
+}
+
+void FirmwareLoader::ReceiveRequests() {
+    char message[2 * PATH_MAX];
+    while (true) {
+        ssize_t size = TEMP_FAILURE_RETRY(recv(socket_, message, sizeof(message), 0));
+        // Every ueventd process that could send requests is gone.
+        if (size <= 0) {
+            if (size < 0) PLOG(ERROR) << "recv() of firmware request failed";
+            break;
+        }
+
+        const char* path = message;
+        const char* path_end = static_cast<const char*>(memchr(message, '\0', size));
+        const char* firmware = path_end ? path_end + 1 : nullptr;
+        if (!firmware || !memchr(firmware, '\0', message + size - firmware)) {
+            LOG(ERROR) << "Discarding malformed firmware request of " << size << " bytes";
+            continue;
+        }
+
+        FirmwareRequest request;
+        request.path = path;
+        request.firmware = firmware;
+        LOG(INFO) << "firmware: loading '" << request.firmware << "' for '" << request.path
+                  << "'";
+        if (!OpenFirmwareFds(request.firmware, "/sys" + request.path, &request.loading_fd,
+                             &request.data_fd)) {
+            continue;
+        }
+
+        std::lock_guard<std::mutex> lock(lock_);
+        requests_.emplace_back(std::move(request));
+        cv_.notify_one();
+    }
+
+    std::lock_guard<std::mutex> lock(lock_);
+    done_ = true;
+    cv_.notify_all();
+}
+
+void FirmwareLoader::LoadRequests() {
+    std::unique_lock<std::mutex> lock(lock_);
+    while (true) {
+        // Firmware that wasn't there while booting waits its turn without holding up a thread.
+        auto now = std::chrono::steady_clock::now();
+        auto next = std::chrono::steady_clock::time_point::max();
+        auto it = requests_.begin();
+        for (; it != requests_.end(); ++it) {
+            if (it->not_before <= now) break;
+            next = std::min(next, it->not_before);
+        }
+
+        if (it == requests_.end()) {
+            // Requests still waiting to be retried are given up on when ueventd goes away.
+            if (done_) break;
+            if (next == std::chrono::steady_clock::time_point::max()) {
+                cv_.wait(lock);
+            } else {
+                cv_.wait_until(lock, next);
+            }
+            continue;
+        }
+
+        FirmwareRequest request = std::move(*it);
+        requests_.erase(it);
+        lock.unlock();
+
+        std::string root = "/sys" + request.path;
+        bool booting = IsBooting();
+        if (TryLoadFirmware(request.firmware, root, request.loading_fd, request.data_fd, true)) {
+            LOG(INFO) << "loading " << request.path << " took " << request.timer;
+        } else if (booting) {
+            // If we're not fully booted, we may be missing
+            // filesystems needed for firmware, wait and retry.
+            request.not_before = std::chrono::steady_clock::now() + kFirmwareRetryDelay;
+            lock.lock();
+            requests_.emplace_back(std::move(request));
+            continue;
+        } else {
+            NoFirmwareFound(request.firmware, request.loading_fd);
+        }
+
+        lock.lock();
+    }
+}
+
+void FirmwareLoader::Run() {
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < kFirmwareLoaderThreads; ++i) {
+        threads.emplace_back(&FirmwareLoader::LoadRequests, this);
+    }
+    ReceiveRequests();
+    for (auto& thread : threads) {
+        thread.join();
+    }
+}
+
+void StartFirmwareLoader() {
+    int sockets[2];
+    if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, sockets) == -1) {
+        PLOG(ERROR) << "socketpair() for the firmware loader failed";
+        return;
+    }
+    unique_fd request_socket(sockets[0]);
+    unique_fd loader_socket(sockets[1]);
+
+    auto pid = fork();
+    if (pid == -1) {
+        PLOG(ERROR) << "could not fork the firmware loader";
+        return;
+    }
+    if (pid == 0) {
+        request_socket.reset();
+        FirmwareLoader(loader_socket).Run();
+        _exit(EXIT_SUCCESS);
+    }
+
+    // If the loader falls behind, requests are forked off rather than waited for.
+    fcntl(request_socket, F_SETFL, O_NONBLOCK);
+    firmware_loader_socket = request_socket.release();
 }
 
 void HandleFirmwareEvent(const Uevent& uevent) {
     if (uevent.subsystem != "firmware" || uevent.action != "add") return;
 
+    if (firmware_loader_socket != -1) {
+        std::string message = SerializeFirmwareRequest(uevent);
+        if (TEMP_FAILURE_RETRY(send(firmware_loader_socket, message.data(), message.size(),
+                                    MSG_NOSIGNAL)) != -1) {
+            return;
+        }
+        PLOG(WARNING) << "could not send firmware request for " << uevent.firmware
+                      << " to the loader";
+    }
+
     // Loading the firmware in a child means we can do that in parallel...
     auto pid = fork();
     if (pid == -1) {
@@ -22,6 +22,12 @@
 namespace android {
 namespace init {
 
+// Forks the process that HandleFirmwareEvent() hands firmware requests to, which loads several
+// at a time on its own threads.  Call it while ueventd has only the one thread.
+void StartFirmwareLoader();
+
+// Answers the kernel's request for firmware, or does nothing if |uevent| isn't one.  The
+// firmware is loaded by the loader process, or by a child forked for it if there is none.
 void HandleFirmwareEvent(const Uevent& uevent);
 
 }  // namespace init
@@ -13,9 +13,9 @@ TARBALL=bootchart.tgz
 
 FILES="header proc_stat.log proc_ps.log proc_diskstats.log"
 
-for f in $FILES; do
-    adb "${@}" pull $LOGROOT/$f $TMPDIR/$f 2>&1 > /dev/null
-done
+# init keeps everything in bootchart.bin until bootcharting stops.
+adb "${@}" pull $LOGROOT/bootchart.bin $TMPDIR/bootchart.bin 2>&1 > /dev/null
+python $(dirname $0)/convert-bootchart.py $TMPDIR/bootchart.bin $TMPDIR || exit 1
 (cd $TMPDIR && tar -czf $TARBALL $FILES)
 bootchart ${TMPDIR}/${TARBALL}
 gnome-open ${TARBALL%.tgz}.png
@@ -44,6 +44,7 @@
 #include <android-base/properties.h>
 #include <android-base/strings.h>
 #include <android-base/unique_fd.h>
+#include <fstab/fstab.h>
 #include <keyutils.h>
 #include <libavb/libavb.h>
 #include <private/android_filesystem_config.h>
@@ -55,6 +56,7 @@
 #include <vector>
 
 #include "action.h"
+#include "boot_timeline.h"
 #include "bootchart.h"
 #include "import_parser.h"
 #include "init_first_stage.h"
@@ -95,6 +97,9 @@ static int epoll_fd = -1;
 static std::unique_ptr<Timer> waiting_for_prop(nullptr);
 static std::string wait_prop_name;
 static std::string wait_prop_value;
+static std::unique_ptr<FileWaiter> waiting_for_file;
+static boot_clock::time_point wait_file_timeout;
+static std::function<void(bool)> wait_file_callback;
 static bool shutting_down;
 static std::string shutdown_command;
 static bool do_shutdown = false;
@@ -113,6 +118,12 @@ void register_epoll_handler(int fd, void (*fn)()) {
     }
 }
 
+void unregister_epoll_handler(int fd) {
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, nullptr) == -1) {
+        PLOG(ERROR) << "epoll_ctl failed";
+    }
+}
+
 /* add_environment - add "key=value" to the current environment */
 int add_environment(const char *key, const char *val)
 {
@@ -168,6 +179,59 @@ void ResetWaitForProp() {
     waiting_for_prop.reset();
 }
 
+void ResetWaitForFile() {
+    if (!waiting_for_file) return;
+
+    if (waiting_for_file->fd() != -1) unregister_epoll_handler(waiting_for_file->fd());
+    waiting_for_file.reset();
+    wait_file_callback = nullptr;
+}
+
+static void finish_waiting_for_file(bool found) {
+    auto callback = std::move(wait_file_callback);
+    ResetWaitForFile();
+    callback(found);
+}
+
+// Checks on the file being waited for, and returns how long init can then sleep before doing
+// so again.
+static int check_waiting_for_file() {
+    if (waiting_for_file->Exists()) {
+        finish_waiting_for_file(true);
+        return 0;
+    }
+    boot_clock::time_point now = boot_clock::now();
+    if (now >= wait_file_timeout) {
+        finish_waiting_for_file(false);
+        return 0;
+    }
+    auto wait = std::min(std::chrono::duration_cast<std::chrono::milliseconds>(
+                                 wait_file_timeout - now) + 1ms,
+                         waiting_for_file->recheck_interval());
+    return wait.count();
+}
+
+static void handle_wait_file_event() {
+    // The main loop looks at the file every time it wakes up.
+}
+
+bool start_waiting_for_file(const std::string& path, std::chrono::nanoseconds timeout,
+                            std::function<void(bool found)> callback) {
+    if (waiting_for_file) {
+        return false;
+    }
+    auto waiter = std::make_unique<FileWaiter>(path);
+    if (waiter->Exists()) {
+        callback(true);
+        return true;
+    }
+    if (waiter->fd() != -1) register_epoll_handler(waiter->fd(), handle_wait_file_event);
+    waiting_for_file = std::move(waiter);
+    wait_file_timeout = boot_clock::now() + timeout;
+    wait_file_callback = std::move(callback);
+    return true;
+}
+
 void property_changed(const std::string& name, const std::string& value) {
     // If the property is sys.powerctl, we bypass the event queue and immediately handle it.
     // This is to ensure that init will always and immediately shutdown/reboot, regardless of
@@ -188,6 +252,9 @@ void property_changed(const std::string& name, const std::string& value) {
         do_shutdown = true;
     }
 
+    // Before the triggers run, bootstat among them.
+    if (name == "sys.boot_completed" && value == "1") BootTimelineWrite();
+
     if (property_triggers_enabled) ActionManager::GetInstance().QueuePropertyChange(name, value);
 
     if (waiting_for_prop) {
@@ -237,12 +304,29 @@ static int wait_for_coldboot_done_action(const std::vector<std::string>& args) {
     // property. We still panic if it takes more than a minute though,
     // because any build that slow isn't likely to boot at all, and we'd
     // rather any test lab devices fail back to the bootloader.
-    if (wait_for_file(COLDBOOT_DONE, 60s) < 0) {
-        LOG(ERROR) << "Timed out waiting for " COLDBOOT_DONE;
-        panic();
-    }
+    //
+    // ueventd creating COLDBOOT_DONE is what tells us it's done. The commands
+    // after this one don't run until it does, but init keeps serving
+    // properties and reaping children meanwhile.
+    start_waiting_for_file(COLDBOOT_DONE, 60s, [t](bool found) {
+        if (!found) {
+            LOG(ERROR) << "Timed out waiting for " COLDBOOT_DONE;
+            panic();
+        }
+
+        property_set("ro.boottime.init.cold_boot_wait", std::to_string(t.duration().count()));
 
-    property_set("ro.boottime.init.cold_boot_wait", std::to_string(t.duration().count()));
+        // ueventd leaves how long each step of cold boot took in COLDBOOT_DONE.
+        std::string timings;
+        if (android::base::ReadFileToString(COLDBOOT_DONE, &timings)) {
+            for (const auto& line : android::base::Split(timings, "\n")) {
+                std::vector<std::string> fields = android::base::Split(line, " ");
+                if (fields.size() == 2) {
+                    property_set("ro.boottime.init.coldboot." + fields[0], fields[1]);
+                }
+            }
+        }
+    });
     return 0;
 }
 
@@ -1109,6 +1193,9 @@ int main(int argc, char** argv) {
     selinux_initialize(false);
     selinux_restore_context();
 
+    // Parse the default fstab once, for init and everything it starts.
+    fs_mgr_publish_default_fstab();
+
     epoll_fd = epoll_create1(EPOLL_CLOEXEC);
     if (epoll_fd == -1) {
         PLOG(ERROR) << "epoll_create1 failed";
@@ -1191,10 +1278,12 @@ int main(int argc, char** argv) {
             }
         }
 
-        if (!(waiting_for_prop || sm.IsWaitingForExec())) {
+        if (waiting_for_file) epoll_timeout_ms = check_waiting_for_file();
+
+        if (!(waiting_for_prop || waiting_for_file || sm.IsWaitingForExec())) {
             am.ExecuteOneCommand();
         }
-        if (!(waiting_for_prop || sm.IsWaitingForExec())) {
+        if (!(waiting_for_prop || waiting_for_file || sm.IsWaitingForExec())) {
             if (!shutting_down) restart_processes();
 
             // If there's a process that needs restarting, wake up in time for that.
@@ -1207,6 +1296,10 @@ int main(int argc, char** argv) {
             if (am.HasMoreCommands()) epoll_timeout_ms = 0;
         }
 
+        // Sync the persistent properties set while busy before going idle, rather than once
+        // per property.
+        if (epoll_timeout_ms != 0) sync_persistent_properties();
+
         epoll_event ev;
         int nr = TEMP_FAILURE_RETRY(epoll_wait(epoll_fd, &ev, 1, epoll_timeout_ms));
         if (nr == -1) {
@@ -17,6 +17,8 @@
 #ifndef _INIT_INIT_H
 #define _INIT_INIT_H
 
+#include <chrono>
+#include <functional>
 #include <string>
 
 #include <selinux/label.h>
@@ -37,15 +39,23 @@ void handle_control_message(const std::string& msg, const std::string& arg);
 void property_changed(const std::string& name, const std::string& value);
 
 void register_epoll_handler(int fd, void (*fn)());
+void unregister_epoll_handler(int fd);
 
 int add_environment(const char* key, const char* val);
 
 bool start_waiting_for_property(const char *name, const char *value);
 
+// Stops init from running commands until |path| exists or |timeout| has passed, and then calls
+// |callback| with whether it appeared. Returns false if init is already waiting for a file.
+bool start_waiting_for_file(const std::string& path, std::chrono::nanoseconds timeout,
+                            std::function<void(bool found)> callback);
+
 void DumpState();
 
 void ResetWaitForProp();
 
+void ResetWaitForFile();
+
 }  // namespace init
 }  // namespace android
 
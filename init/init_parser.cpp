@@ -18,6 +18,10 @@
 
 #include <dirent.h>
 
+#include <algorithm>
+#include <atomic>
+#include <thread>
+
 #include <android-base/chrono_utils.h>
 #include <android-base/logging.h>
 #include <android-base/stringprintf.h>
@@ -46,7 +50,7 @@ void Parser::AddSingleLineParser(const std::string& prefix, LineCallback callbac
     line_callbacks_.emplace_back(prefix, callback);
 }
 
-void Parser::ParseData(const std::string& filename, const std::string& data) {
+Parser::TokenizedLines Parser::Tokenize(const std::string& data) {
     //TODO: Use a parser with const input and remove this copy
     std::vector<char> data_copy(data.begin(), data.end());
     data_copy.push_back('\0');
@@ -56,52 +60,19 @@ void Parser::ParseData(const std::string& filename, const std::string& data) {
     state.ptr = &data_copy[0];
     state.nexttoken = 0;
 
-    SectionParser* section_parser = nullptr;
+    TokenizedLines lines;
     std::vector<std::string> args;
 
     for (;;) {
         switch (next_token(&state)) {
         case T_EOF:
-            if (section_parser) {
-                section_parser->EndSection();
-            }
-            return;
+            return lines;
         case T_NEWLINE:
             state.line++;
-            if (args.empty()) {
-                break;
-            }
-            // If we have a line matching a prefix we recognize, call its callback and unset any
-            // current section parsers.  This is meant for /sys/ and /dev/ line entries for uevent.
-            for (const auto& [prefix, callback] : line_callbacks_) {
-                if (android::base::StartsWith(args[0], prefix.c_str())) {
-                    if (section_parser) section_parser->EndSection();
-
-                    std::string ret_err;
-                    if (!callback(std::move(args), &ret_err)) {
-                        LOG(ERROR) << filename << ": " << state.line << ": " << ret_err;
-                    }
-                    section_parser = nullptr;
-                    break;
-                }
-            }
-            if (section_parsers_.count(args[0])) {
-                if (section_parser) {
-                    section_parser->EndSection();
-                }
-                section_parser = section_parsers_[args[0]].get();
-                std::string ret_err;
-                if (!section_parser->ParseSection(std::move(args), filename, state.line, &ret_err)) {
-                    LOG(ERROR) << filename << ": " << state.line << ": " << ret_err;
-                    section_parser = nullptr;
-                }
-            } else if (section_parser) {
-                std::string ret_err;
-                if (!section_parser->ParseLineSection(std::move(args), state.line, &ret_err)) {
-                    LOG(ERROR) << filename << ": " << state.line << ": " << ret_err;
-                }
+            if (!args.empty()) {
+                lines.emplace_back(state.line, std::move(args));
+                args.clear();
             }
-            args.clear();
             break;
         case T_TEXT:
             args.emplace_back(state.text);
@@ -110,23 +81,83 @@ void Parser::ParseData(const std::string& filename, const std::string& data) {
     }
 }
 
-bool Parser::ParseConfigFile(const std::string& path) {
-    LOG(INFO) << "Parsing file " << path << "...";
-    android::base::Timer t;
+void Parser::ParseLines(const std::string& filename, TokenizedLines&& lines) {
+    SectionParser* section_parser = nullptr;
+
+    for (auto& [line, args] : lines) {
+        // If we have a line matching a prefix we recognize, call its callback and unset any
+        // current section parsers.  This is meant for /sys/ and /dev/ line entries for uevent.
+        for (const auto& [prefix, callback] : line_callbacks_) {
+            if (android::base::StartsWith(args[0], prefix.c_str())) {
+                if (section_parser) section_parser->EndSection();
+
+                std::string ret_err;
+                if (!callback(std::move(args), &ret_err)) {
+                    LOG(ERROR) << filename << ": " << line << ": " << ret_err;
+                }
+                section_parser = nullptr;
+                break;
+            }
+        }
+        if (args.empty()) continue;
+
+        if (section_parsers_.count(args[0])) {
+            if (section_parser) {
+                section_parser->EndSection();
+            }
+            section_parser = section_parsers_[args[0]].get();
+            std::string ret_err;
+            if (!section_parser->ParseSection(std::move(args), filename, line, &ret_err)) {
+                LOG(ERROR) << filename << ": " << line << ": " << ret_err;
+                section_parser = nullptr;
+            }
+        } else if (section_parser) {
+            std::string ret_err;
+            if (!section_parser->ParseLineSection(std::move(args), line, &ret_err)) {
+                LOG(ERROR) << filename << ": " << line << ": " << ret_err;
+            }
+        }
+    }
+
+    if (section_parser) {
+        section_parser->EndSection();
+    }
+}
+
+void Parser::ParseData(const std::string& filename, const std::string& data) {
+    ParseLines(filename, Tokenize(data));
+}
+
+bool Parser::ReadConfigFile(const std::string& path, TokenizedLines* lines, std::string* err) {
     std::string data;
-    std::string err;
-    if (!ReadFile(path, &data, &err)) {
-        LOG(ERROR) << err;
+    if (!ReadFile(path, &data, err)) {
         return false;
     }
 
     data.push_back('\n'); // TODO: fix parse_config.
-    ParseData(path, data);
+    *lines = Tokenize(data);
+    return true;
+}
+
+void Parser::ParseTokenizedConfigFile(const std::string& path, TokenizedLines&& lines) {
+    android::base::Timer t;
+    ParseLines(path, std::move(lines));
     for (const auto& [section_name, section_parser] : section_parsers_) {
         section_parser->EndFile();
     }
-
     LOG(VERBOSE) << "(Parsing " << path << " took " << t << ".)";
+}
+
+bool Parser::ParseConfigFile(const std::string& path) {
+    LOG(INFO) << "Parsing file " << path << "...";
+    TokenizedLines lines;
+    std::string err;
+    if (!ReadConfigFile(path, &lines, &err)) {
+        LOG(ERROR) << err;
+        return false;
+    }
+
+    ParseTokenizedConfigFile(path, std::move(lines));
     return true;
 }
 
@@ -149,10 +180,42 @@ bool Parser::ParseConfigDir(const std::string& path) {
     }
     // Sort first so we load files in a consistent order (bug 31996208)
     std::sort(files.begin(), files.end());
-    for (const auto& file : files) {
-        if (!ParseConfigFile(file)) {
-            LOG(ERROR) << "could not import file '" << file << "'";
+
+    // Reading and tokenizing the files doesn't touch the section parsers, so it's done on several
+    // threads at once.  The lines are then parsed in the sorted order, as if read one by one.
+    struct TokenizedFile {
+        bool read = false;
+        std::string err;
+        TokenizedLines lines;
+    };
+    std::vector<TokenizedFile> tokenized_files(files.size());
+    std::atomic<size_t> next_file = 0;
+    auto tokenize = [&] {
+        size_t i;
+        while ((i = next_file.fetch_add(1)) < files.size()) {
+            auto& file = tokenized_files[i];
+            file.read = ReadConfigFile(files[i], &file.lines, &file.err);
+        }
+    };
+    std::vector<std::thread> threads;
+    unsigned int num_threads = std::thread::hardware_concurrency() ?: 4;
+    for (unsigned int i = 1; i < std::min<size_t>(num_threads, files.size()); ++i) {
+        threads.emplace_back(tokenize);
+    }
+    tokenize();
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    for (size_t i = 0; i < files.size(); ++i) {
+        LOG(INFO) << "Parsing file " << files[i] << "...";
+        auto& file = tokenized_files[i];
+        if (!file.read) {
+            LOG(ERROR) << file.err;
+            LOG(ERROR) << "could not import file '" << files[i] << "'";
+            continue;
         }
+        ParseTokenizedConfigFile(files[i], std::move(file.lines));
     }
     return true;
 }
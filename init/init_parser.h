@@ -17,9 +17,11 @@
 #ifndef _INIT_INIT_PARSER_H_
 #define _INIT_INIT_PARSER_H_
 
+#include <functional>
 #include <map>
 #include <memory>
 #include <string>
+#include <utility>
 #include <vector>
 
 //  SectionParser is an interface that can parse a given 'section' in init.
@@ -85,7 +87,14 @@ class Parser {
     bool is_odm_etc_init_loaded() { return is_odm_etc_init_loaded_; }
 
   private:
+    // The lines of a config file that have any tokens, with their line numbers.
+    using TokenizedLines = std::vector<std::pair<int, std::vector<std::string>>>;
+
+    static TokenizedLines Tokenize(const std::string& data);
+    static bool ReadConfigFile(const std::string& path, TokenizedLines* lines, std::string* err);
+    void ParseLines(const std::string& filename, TokenizedLines&& lines);
     void ParseData(const std::string& filename, const std::string& data);
+    void ParseTokenizedConfigFile(const std::string& path, TokenizedLines&& lines);
     bool ParseConfigFile(const std::string& path);
     bool ParseConfigDir(const std::string& path);
 
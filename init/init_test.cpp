@@ -128,6 +128,39 @@ execute_third
     TestInitText(init_script, test_function_map, commands);
 }
 
+TEST(init, PropertyTriggerOrder) {
+    std::string init_script =
+        R"init(
+on property:init.test.prop=1
+execute_first
+
+on property:init.test.other=1
+execute_never
+
+on property:init.test.prop=2
+execute_never
+
+on property:init.test.prop=*
+execute_second
+
+)init";
+
+    int num_executed = 0;
+    TestFunctionMap test_function_map;
+    test_function_map.Add("execute_first", [&num_executed]() { EXPECT_EQ(0, num_executed++); });
+    test_function_map.Add("execute_second", [&num_executed]() { EXPECT_EQ(1, num_executed++); });
+    test_function_map.Add("execute_never", []() { FAIL(); });
+
+    ActionManagerCommand change_prop = [](ActionManager& am) {
+        am.QueuePropertyChange("init.test.prop", "1");
+    };
+    std::vector<ActionManagerCommand> commands{change_prop};
+
+    TestInitText(init_script, test_function_map, commands);
+
+    EXPECT_EQ(2, num_executed);
+}
+
 TEST(init, EventTriggerOrderMultipleFiles) {
     // 6 total files, which should have their triggers executed in the following order:
     // 1: start - original script parsed
@@ -0,0 +1,231 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "persistent_properties.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <android-base/file.h>
+#include <android-base/stringprintf.h>
+
+using android::base::StringPrintf;
+using android::base::boot_clock;
+
+namespace android {
+namespace init {
+
+// The log starts with kMagic and kVersion, followed by records of
+//   uint32_t name size, uint32_t value size, uint32_t checksum, name, value
+// where the checksum is the FNV-1a hash of the two sizes, the name and the value.
+static constexpr uint32_t kMagic = 0x504c5050;  // "PPLP"
+static constexpr uint32_t kVersion = 1;
+static constexpr size_t kHeaderSize = 2 * sizeof(uint32_t);
+static constexpr size_t kRecordHeaderSize = 3 * sizeof(uint32_t);
+
+static uint32_t Checksum(uint32_t name_size, uint32_t value_size, const char* name,
+                         const char* value) {
+    uint32_t hash = 2166136261u;
+    auto add = [&hash](const void* data, size_t size) {
+        for (size_t i = 0; i < size; ++i) {
+            hash = (hash ^ static_cast<const uint8_t*>(data)[i]) * 16777619u;
+        }
+    };
+    add(&name_size, sizeof(name_size));
+    add(&value_size, sizeof(value_size));
+    add(name, name_size);
+    add(value, value_size);
+    return hash;
+}
+
+static void AppendUint32(std::string* data, uint32_t value) {
+    data->append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+static void AppendRecord(std::string* data, const std::string& name, const std::string& value) {
+    AppendUint32(data, name.size());
+    AppendUint32(data, value.size());
+    AppendUint32(data, Checksum(name.size(), value.size(), name.data(), value.data()));
+    data->append(name);
+    data->append(value);
+}
+
+static uint32_t ReadUint32(const std::string& data, size_t offset) {
+    uint32_t value;
+    memcpy(&value, data.data() + offset, sizeof(value));
+    return value;
+}
+
+bool PersistentPropertyLog::Load(std::string* err) {
+    android::base::unique_fd fd(open(path_.c_str(), O_RDONLY | O_NOFOLLOW | O_CLOEXEC));
+    if (fd == -1) {
+        *err = StringPrintf("Unable to open '%s': %s", path_.c_str(), strerror(errno));
+        return false;
+    }
+
+    struct stat sb;
+    if (fstat(fd, &sb) == -1) {
+        *err = StringPrintf("fstat of '%s' failed: %s", path_.c_str(), strerror(errno));
+        return false;
+    }
+    // The log must not be accessible to others, be owned by root/root, and not be a hard link to
+    // any other file.
+    if ((sb.st_mode & (S_IRWXG | S_IRWXO)) != 0 || sb.st_uid != 0 || sb.st_gid != 0 ||
+        sb.st_nlink != 1) {
+        *err = StringPrintf("Skipping insecure '%s' (uid=%u gid=%u nlink=%u mode=%o)",
+                            path_.c_str(), sb.st_uid, sb.st_gid,
+                            static_cast<unsigned int>(sb.st_nlink), sb.st_mode);
+        errno = EPERM;
+        return false;
+    }
+
+    std::string data;
+    if (!android::base::ReadFdToString(fd, &data)) {
+        *err = StringPrintf("Unable to read '%s': %s", path_.c_str(), strerror(errno));
+        return false;
+    }
+    if (data.size() < kHeaderSize || ReadUint32(data, 0) != kMagic ||
+        ReadUint32(data, sizeof(uint32_t)) != kVersion) {
+        *err = StringPrintf("'%s' is not a persistent property log", path_.c_str());
+        errno = EINVAL;
+        return false;
+    }
+
+    properties_.clear();
+    num_records_ = 0;
+    size_t offset = kHeaderSize;
+    while (data.size() - offset >= kRecordHeaderSize) {
+        uint32_t name_size = ReadUint32(data, offset);
+        uint32_t value_size = ReadUint32(data, offset + sizeof(uint32_t));
+        uint32_t checksum = ReadUint32(data, offset + 2 * sizeof(uint32_t));
+        size_t record_size = kRecordHeaderSize + static_cast<size_t>(name_size) + value_size;
+        if (data.size() - offset < record_size) break;
+
+        const char* name = data.data() + offset + kRecordHeaderSize;
+        const char* value = name + name_size;
+        if (Checksum(name_size, value_size, name, value) != checksum) break;
+
+        properties_[std::string(name, name_size)] = std::string(value, value_size);
+        ++num_records_;
+        offset += record_size;
+    }
+
+    if (!OpenForAppend(offset, err)) {
+        return false;
+    }
+    if (NeedsCompaction()) {
+        return Compact(properties_, err);
+    }
+    return true;
+}
+
+bool PersistentPropertyLog::OpenForAppend(off_t valid_size, std::string* err) {
+    fd_.reset(open(path_.c_str(), O_WRONLY | O_APPEND | O_NOFOLLOW | O_CLOEXEC));
+    if (fd_ == -1) {
+        *err = StringPrintf("Unable to open '%s' for writing: %s", path_.c_str(), strerror(errno));
+        return false;
+    }
+    // Drop whatever a crash left of the last record, so that the next one follows the last
+    // complete record.
+    struct stat sb;
+    if (fstat(fd_, &sb) == -1 || (sb.st_size != valid_size && ftruncate(fd_, valid_size) == -1)) {
+        *err = StringPrintf("Unable to truncate '%s': %s", path_.c_str(), strerror(errno));
+        fd_.reset();
+        return false;
+    }
+    return true;
+}
+
+bool PersistentPropertyLog::Compact(std::map<std::string, std::string> properties,
+                                    std::string* err) {
+    std::string data;
+    AppendUint32(&data, kMagic);
+    AppendUint32(&data, kVersion);
+    for (const auto& [name, value] : properties) {
+        AppendRecord(&data, name, value);
+    }
+
+    std::string temp_path = path_ + ".tmp";
+    android::base::unique_fd fd(
+        open(temp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_NOFOLLOW | O_CLOEXEC, 0600));
+    if (fd == -1 || !android::base::WriteStringToFd(data, fd) || fsync(fd) == -1) {
+        *err = StringPrintf("Unable to write '%s': %s", temp_path.c_str(), strerror(errno));
+        unlink(temp_path.c_str());
+        return false;
+    }
+    if (rename(temp_path.c_str(), path_.c_str()) == -1) {
+        *err = StringPrintf("Unable to rename '%s' to '%s': %s", temp_path.c_str(), path_.c_str(),
+                            strerror(errno));
+        unlink(temp_path.c_str());
+        return false;
+    }
+    // Make the rename itself durable.
+    android::base::unique_fd dir_fd(
+        open(android::base::Dirname(path_).c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC));
+    if (dir_fd != -1) fsync(dir_fd);
+
+    properties_ = std::move(properties);
+    num_records_ = properties_.size();
+    needs_sync_ = false;
+    return OpenForAppend(data.size(), err);
+}
+
+bool PersistentPropertyLog::Append(const std::string& name, const std::string& value,
+                                   std::string* err) {
+    if (fd_ == -1) {
+        *err = StringPrintf("'%s' isn't open", path_.c_str());
+        return false;
+    }
+
+    std::string record;
+    AppendRecord(&record, name, value);
+    if (!android::base::WriteStringToFd(record, fd_)) {
+        *err = StringPrintf("Unable to append to '%s': %s", path_.c_str(), strerror(errno));
+        return false;
+    }
+    properties_[name] = value;
+    ++num_records_;
+
+    if (NeedsCompaction()) {
+        return Compact(properties_, err);
+    }
+
+    auto now = boot_clock::now();
+    if (!needs_sync_) {
+        needs_sync_ = true;
+        first_unsynced_append_ = now;
+    } else if (now - first_unsynced_append_ > kMaxSyncDelay) {
+        return Sync(err);
+    }
+    return true;
+}
+
+bool PersistentPropertyLog::Sync(std::string* err) {
+    if (!needs_sync_) return true;
+
+    needs_sync_ = false;
+    if (fdatasync(fd_) == -1) {
+        *err = StringPrintf("Unable to sync '%s': %s", path_.c_str(), strerror(errno));
+        return false;
+    }
+    return true;
+}
+
+}  // namespace init
+}  // namespace android
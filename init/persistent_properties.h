@@ -0,0 +1,73 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _INIT_PERSISTENT_PROPERTIES_H
+#define _INIT_PERSISTENT_PROPERTIES_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <map>
+#include <string>
+
+#include <android-base/chrono_utils.h>
+#include <android-base/unique_fd.h>
+
+namespace android {
+namespace init {
+
+// Keeps the persist.* properties in one file, as a log of (name, value) records where a later
+// record replaces any earlier one of the same name.  Setting a property appends one record, and
+// the whole file is read with one read() at boot.  The log is rewritten with one record per
+// property when it has grown to more than twice that, and by rename(), so that it is always
+// either the old or the new file.
+//
+// Every record has a checksum, so a record that was torn by a crash is detected when loading;
+// it and anything after it are dropped, and the next record is appended in its place.
+class PersistentPropertyLog {
+  public:
+    explicit PersistentPropertyLog(const std::string& path) : path_(path) {}
+
+    // Reads the log.  Fails with errno set to ENOENT if there is none yet.  Like the files it
+    // replaces, the log is only trusted if only root can read or write it.
+    bool Load(std::string* err);
+    // Replaces the log with one that has a record for each of |properties|, and syncs it.
+    bool Compact(std::map<std::string, std::string> properties, std::string* err);
+    // Appends a record that isn't durable before the next Sync(), unless the oldest record that
+    // wasn't synced yet is more than kMaxSyncDelay old.
+    bool Append(const std::string& name, const std::string& value, std::string* err);
+    bool Sync(std::string* err);
+
+    const std::map<std::string, std::string>& properties() const { return properties_; }
+
+    static constexpr std::chrono::milliseconds kMaxSyncDelay = std::chrono::milliseconds(1000);
+
+  private:
+    bool OpenForAppend(off_t valid_size, std::string* err);
+    bool NeedsCompaction() const { return num_records_ > 2 * properties_.size() + 16; }
+
+    std::string path_;
+    android::base::unique_fd fd_;
+    std::map<std::string, std::string> properties_;
+    size_t num_records_ = 0;
+    bool needs_sync_ = false;
+    android::base::boot_clock::time_point first_unsynced_append_;
+};
+
+}  // namespace init
+}  // namespace android
+
+#endif
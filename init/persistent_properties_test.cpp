@@ -0,0 +1,122 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "persistent_properties.h"
+
+#include <errno.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <string>
+
+#include <android-base/test_utils.h>
+#include <gtest/gtest.h>
+
+namespace android {
+namespace init {
+
+class PersistentPropertyLogTest : public ::testing::Test {
+  protected:
+    std::string path() const { return std::string(dir_.path) + "/properties"; }
+
+    off_t size() const {
+        struct stat sb;
+        EXPECT_EQ(0, stat(path().c_str(), &sb));
+        return sb.st_size;
+    }
+
+    TemporaryDir dir_;
+};
+
+TEST_F(PersistentPropertyLogTest, MissingLog) {
+    PersistentPropertyLog log(path());
+    std::string err;
+    errno = 0;
+    EXPECT_FALSE(log.Load(&err));
+    EXPECT_EQ(ENOENT, errno);
+}
+
+TEST_F(PersistentPropertyLogTest, AppendAndReload) {
+    std::string err;
+    {
+        PersistentPropertyLog log(path());
+        ASSERT_TRUE(log.Compact({{"persist.a", "1"}, {"persist.b", "2"}}, &err)) << err;
+        ASSERT_TRUE(log.Append("persist.a", "3", &err)) << err;
+        ASSERT_TRUE(log.Append("persist.c", "", &err)) << err;
+        ASSERT_TRUE(log.Sync(&err)) << err;
+    }
+
+    PersistentPropertyLog log(path());
+    ASSERT_TRUE(log.Load(&err)) << err;
+    std::map<std::string, std::string> expected = {
+        {"persist.a", "3"}, {"persist.b", "2"}, {"persist.c", ""}};
+    EXPECT_EQ(expected, log.properties());
+}
+
+TEST_F(PersistentPropertyLogTest, TornRecord) {
+    std::string err;
+    {
+        PersistentPropertyLog log(path());
+        ASSERT_TRUE(log.Compact({{"persist.a", "1"}}, &err)) << err;
+        ASSERT_TRUE(log.Append("persist.a", "2", &err)) << err;
+    }
+    off_t complete_size = size();
+    ASSERT_EQ(0, truncate(path().c_str(), complete_size - 1));
+
+    {
+        PersistentPropertyLog log(path());
+        ASSERT_TRUE(log.Load(&err)) << err;
+        EXPECT_EQ("1", log.properties().at("persist.a"));
+        ASSERT_TRUE(log.Append("persist.b", "3", &err)) << err;
+    }
+
+    PersistentPropertyLog log(path());
+    ASSERT_TRUE(log.Load(&err)) << err;
+    std::map<std::string, std::string> expected = {{"persist.a", "1"}, {"persist.b", "3"}};
+    EXPECT_EQ(expected, log.properties());
+}
+
+TEST_F(PersistentPropertyLogTest, Compaction) {
+    std::string err;
+    PersistentPropertyLog log(path());
+    ASSERT_TRUE(log.Compact({}, &err)) << err;
+    off_t max_size = 0;
+    for (int i = 0; i < 1000; ++i) {
+        ASSERT_TRUE(log.Append("persist.counter", std::to_string(i), &err)) << err;
+        max_size = std::max(max_size, size());
+    }
+    // The log never holds much more than a few dozen records for one property.
+    EXPECT_LT(max_size, 1024);
+
+    PersistentPropertyLog reloaded(path());
+    ASSERT_TRUE(reloaded.Load(&err)) << err;
+    EXPECT_EQ("999", reloaded.properties().at("persist.counter"));
+}
+
+TEST_F(PersistentPropertyLogTest, InsecureLog) {
+    std::string err;
+    {
+        PersistentPropertyLog log(path());
+        ASSERT_TRUE(log.Compact({{"persist.a", "1"}}, &err)) << err;
+    }
+    ASSERT_EQ(0, chmod(path().c_str(), 0644));
+
+    PersistentPropertyLog log(path());
+    EXPECT_FALSE(log.Load(&err));
+}
+
+}  // namespace init
+}  // namespace android
@@ -38,8 +38,11 @@
 #define _REALLY_INCLUDE_SYS__SYSTEM_PROPERTIES_H_
 #include <sys/_system_properties.h>
 
+#include <map>
 #include <memory>
 #include <queue>
+#include <unordered_set>
+#include <utility>
 #include <vector>
 
 #include <android-base/chrono_utils.h>
@@ -54,17 +57,22 @@
 #include <selinux/selinux.h>
 
 #include "init.h"
+#include "persistent_properties.h"
 #include "util.h"
 
 using android::base::Timer;
 
 #define PERSISTENT_PROPERTY_DIR  "/data/property"
+#define PERSISTENT_PROPERTY_LOG  PERSISTENT_PROPERTY_DIR "/persistent_properties"
 #define RECOVERY_MOUNT_POINT "/recovery"
 
 namespace android {
 namespace init {
 
 static int persistent_properties_loaded = 0;
+// Where persist.* properties are written once they have been loaded.  Null if the log couldn't
+// be set up, in which case they are written to one file each, as before the log existed.
+static std::unique_ptr<PersistentPropertyLog> persistent_property_log;
 
 static int property_set_fd = -1;
 
@@ -75,6 +83,12 @@ void property_init() {
     }
 }
 
+// Source context and property name pairs that have been allowed to be set.  The policy is only
+// loaded once, so an access that was granted stays granted.  Denials aren't cached, so that they
+// keep being audited.
+static std::unordered_set<std::string> allowed_property_sets;
+static constexpr size_t kMaxAllowedPropertySets = 4096;
+
 static bool check_mac_perms(const std::string& name, char* sctx, struct ucred* cr) {
 
     if (!sctx) {
@@ -85,6 +99,11 @@ static bool check_mac_perms(const std::string& name, char* sctx, struct ucred* c
       return false;
     }
 
+    std::string cache_key = std::string(sctx) + '\0' + name;
+    if (allowed_property_sets.count(cache_key)) {
+      return true;
+    }
+
     char* tctx = nullptr;
     if (selabel_lookup(sehandle_prop, &tctx, name.c_str(), 1) != 0) {
       return false;
@@ -98,6 +117,12 @@ static bool check_mac_perms(const std::string& name, char* sctx, struct ucred* c
     bool has_access = (selinux_check_access(sctx, tctx, "property_service", "set", &audit_data) == 0);
 
     freecon(tctx);
+    if (has_access) {
+      if (allowed_property_sets.size() >= kMaxAllowedPropertySets) {
+        allowed_property_sets.clear();
+      }
+      allowed_property_sets.emplace(std::move(cache_key));
+    }
     return has_access;
 }
 
@@ -120,6 +145,14 @@ static int check_control_mac_perms(const char *name, char *sctx, struct ucred *c
 
 static void write_persistent_property(const char *name, const char *value)
 {
+    if (persistent_property_log) {
+        std::string err;
+        if (!persistent_property_log->Append(name, value, &err)) {
+            LOG(ERROR) << "Unable to write persistent property " << name << ": " << err;
+        }
+        return;
+    }
+
     char tempPath[PATH_MAX];
     char path[PATH_MAX];
     int fd;
@@ -336,6 +369,12 @@ class SocketConnection {
     return result == sizeof(value);
   }
 
+  bool SendUint32s(const std::vector<uint32_t>& values) {
+    size_t size = values.size() * sizeof(values[0]);
+    ssize_t result = TEMP_FAILURE_RETRY(send(socket_, values.data(), size, 0));
+    return result == static_cast<ssize_t>(size);
+  }
+
   int socket() {
     return socket_;
   }
@@ -407,52 +446,87 @@ class SocketConnection {
   DISALLOW_IMPLICIT_CONSTRUCTORS(SocketConnection);
 };
 
+// Returns the result to report to the client.
+static uint32_t handle_property_set(const std::string& name, const std::string& value,
+                                    char* source_ctx, struct ucred* cr, const char* cmd_name) {
+  if (!is_legal_property_name(name)) {
+    LOG(ERROR) << "sys_prop(" << cmd_name << "): illegal property name \"" << name << "\"";
+    return PROP_ERROR_INVALID_NAME;
+  }
+
+  if (android::base::StartsWith(name, "ctl.")) {
+    if (check_control_mac_perms(value.c_str(), source_ctx, cr)) {
+      handle_control_message(name.c_str() + 4, value.c_str());
+      return PROP_SUCCESS;
+    }
+    LOG(ERROR) << "sys_prop(" << cmd_name << "): Unable to " << (name.c_str() + 4)
+               << " service ctl [" << value << "]"
+               << " uid:" << cr->uid
+               << " gid:" << cr->gid
+               << " pid:" << cr->pid;
+    return PROP_ERROR_HANDLE_CONTROL_MESSAGE;
+  }
+
+  if (check_mac_perms(name, source_ctx, cr)) {
+    return property_set(name, value);
+  }
+  LOG(ERROR) << "sys_prop(" << cmd_name << "): permission denied uid:" << cr->uid << " name:" << name;
+  return PROP_ERROR_PERMISSION_DENIED;
+}
+
 static void handle_property_set(SocketConnection& socket,
                                 const std::string& name,
                                 const std::string& value,
                                 bool legacy_protocol) {
   const char* cmd_name = legacy_protocol ? "PROP_MSG_SETPROP" : "PROP_MSG_SETPROP2";
-  if (!is_legal_property_name(name)) {
-    LOG(ERROR) << "sys_prop(" << cmd_name << "): illegal property name \"" << name << "\"";
-    socket.SendUint32(PROP_ERROR_INVALID_NAME);
+  struct ucred cr = socket.cred();
+  char* source_ctx = nullptr;
+  if (is_legal_property_name(name)) {
+    getpeercon(socket.socket(), &source_ctx);
+  }
+
+  uint32_t result = handle_property_set(name, value, source_ctx, &cr, cmd_name);
+  // The legacy protocol only ever hears back about illegal names.
+  if (!legacy_protocol || result == PROP_ERROR_INVALID_NAME) {
+    socket.SendUint32(result);
+  }
+
+  freecon(source_ctx);
+}
+
+// Reads up to kMaxPropertyBatchSize name and value pairs, sets them in order, and then replies
+// with one result per pair.  A client that always has several properties to set pays for one
+// connection and one SELinux context lookup instead of one per property.
+static void handle_property_set_batch(SocketConnection& socket, uint32_t* timeout_ms) {
+  uint32_t count = 0;
+  if (!socket.RecvUint32(&count, timeout_ms) || count > kMaxPropertyBatchSize) {
+    PLOG(ERROR) << "sys_prop(PROP_MSG_SETPROP_BATCH): error while reading the batch size";
+    socket.SendUint32(PROP_ERROR_READ_DATA);
     return;
   }
 
+  std::vector<std::pair<std::string, std::string>> properties(count);
+  for (auto& [name, value] : properties) {
+    if (!socket.RecvString(&name, timeout_ms) || !socket.RecvString(&value, timeout_ms)) {
+      PLOG(ERROR) << "sys_prop(PROP_MSG_SETPROP_BATCH): error while reading name/value from the socket";
+      socket.SendUint32(PROP_ERROR_READ_DATA);
+      return;
+    }
+  }
+
   struct ucred cr = socket.cred();
   char* source_ctx = nullptr;
   getpeercon(socket.socket(), &source_ctx);
 
-  if (android::base::StartsWith(name, "ctl.")) {
-    if (check_control_mac_perms(value.c_str(), source_ctx, &cr)) {
-      handle_control_message(name.c_str() + 4, value.c_str());
-      if (!legacy_protocol) {
-        socket.SendUint32(PROP_SUCCESS);
-      }
-    } else {
-      LOG(ERROR) << "sys_prop(" << cmd_name << "): Unable to " << (name.c_str() + 4)
-                 << " service ctl [" << value << "]"
-                 << " uid:" << cr.uid
-                 << " gid:" << cr.gid
-                 << " pid:" << cr.pid;
-      if (!legacy_protocol) {
-        socket.SendUint32(PROP_ERROR_HANDLE_CONTROL_MESSAGE);
-      }
-    }
-  } else {
-    if (check_mac_perms(name, source_ctx, &cr)) {
-      uint32_t result = property_set(name, value);
-      if (!legacy_protocol) {
-        socket.SendUint32(result);
-      }
-    } else {
-      LOG(ERROR) << "sys_prop(" << cmd_name << "): permission denied uid:" << cr.uid << " name:" << name;
-      if (!legacy_protocol) {
-        socket.SendUint32(PROP_ERROR_PERMISSION_DENIED);
-      }
-    }
+  std::vector<uint32_t> results;
+  results.reserve(count);
+  for (const auto& [name, value] : properties) {
+    results.emplace_back(
+        handle_property_set(name, value, source_ctx, &cr, "PROP_MSG_SETPROP_BATCH"));
   }
-
   freecon(source_ctx);
+
+  socket.SendUint32s(results);
 }
 
 static void handle_property_set_fd() {
@@ -513,6 +587,10 @@ static void handle_property_set_fd() {
         break;
       }
 
+    case PROP_MSG_SETPROP_BATCH:
+        handle_property_set_batch(socket, &timeout_ms);
+        break;
+
     default:
         LOG(ERROR) << "sys_prop: invalid command " << cmd;
         socket.SendUint32(PROP_ERROR_INVALID_CMD);
@@ -598,9 +676,9 @@ static bool load_properties_from_file(const char* filename, const char* filter)
     return true;
 }
 
-static void load_persistent_properties() {
-    persistent_properties_loaded = 1;
-
+// Reads the one file per property that persistent properties were kept in before
+// PERSISTENT_PROPERTY_LOG, into |properties|.
+static void load_legacy_persistent_properties(std::map<std::string, std::string>* properties) {
     std::unique_ptr<DIR, int(*)(DIR*)> dir(opendir(PERSISTENT_PROPERTY_DIR), closedir);
     if (!dir) {
         PLOG(ERROR) << "Unable to open persistent property directory \""
@@ -645,7 +723,7 @@ static void load_persistent_properties() {
         int length = read(fd, value, sizeof(value) - 1);
         if (length >= 0) {
             value[length] = 0;
-            property_set(entry->d_name, value);
+            (*properties)[entry->d_name] = value;
         } else {
             PLOG(ERROR) << "Unable to read persistent property file " << entry->d_name;
         }
@@ -653,6 +731,54 @@ static void load_persistent_properties() {
     }
 }
 
+static void load_persistent_properties() {
+    auto log = std::make_unique<PersistentPropertyLog>(PERSISTENT_PROPERTY_LOG);
+    std::string err;
+    if (log->Load(&err)) {
+        for (const auto& [name, value] : log->properties()) {
+            property_set(name, value);
+        }
+        persistent_property_log = std::move(log);
+    } else {
+        bool missing = errno == ENOENT;
+        if (!missing) {
+            // Leave a log that can't be read alone, rather than replace what may be in it.
+            LOG(ERROR) << err << "; keeping persistent properties in separate files";
+        }
+
+        std::map<std::string, std::string> properties;
+        load_legacy_persistent_properties(&properties);
+        for (const auto& [name, value] : properties) {
+            property_set(name, value);
+        }
+
+        // Move the properties from the files they used to be kept in into a new log, and only
+        // remove the files once the log is safely on disk.
+        if (missing) {
+            if (log->Compact(properties, &err)) {
+                for (const auto& [name, value] : properties) {
+                    unlink((PERSISTENT_PROPERTY_DIR "/" + name).c_str());
+                }
+                persistent_property_log = std::move(log);
+            } else {
+                LOG(ERROR) << err;
+            }
+        }
+    }
+
+    // Only now, so that loading them doesn't write them back.
+    persistent_properties_loaded = 1;
+}
+
+void sync_persistent_properties() {
+    if (!persistent_property_log) return;
+
+    std::string err;
+    if (!persistent_property_log->Sync(&err)) {
+        LOG(ERROR) << err;
+    }
+}
+
 // persist.sys.usb.config values can't be combined on build-time when property
 // files are split into each partition.
 // So we need to apply the same rule of build/make/tools/post_process_props.py
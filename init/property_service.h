@@ -17,6 +17,7 @@
 #ifndef _INIT_PROPERTY_H
 #define _INIT_PROPERTY_H
 
+#include <stdint.h>
 #include <sys/socket.h>
 
 #include <string>
@@ -24,6 +25,14 @@
 namespace android {
 namespace init {
 
+// Sets several properties over one connection to the property service:
+//   uint32_t PROP_MSG_SETPROP_BATCH, uint32_t count,
+//   then count times: uint32_t name length, name, uint32_t value length, value.
+// The service answers with count uint32_t PROP_SUCCESS or PROP_ERROR_* results, one per property
+// and in the same order, or with a single PROP_ERROR_READ_DATA if the batch couldn't be read.
+static constexpr uint32_t PROP_MSG_SETPROP_BATCH = 0x00030001;
+static constexpr uint32_t kMaxPropertyBatchSize = 256;
+
 struct property_audit_data {
     ucred *cr;
     const char* name;
@@ -34,6 +43,8 @@ extern bool PropertyChildReap(pid_t pid);
 void property_init(void);
 void property_load_boot_defaults(void);
 void load_persist_props(void);
+// Makes the persistent properties that were set since the last call durable.
+void sync_persistent_properties(void);
 void load_system_props(void);
 void start_property_service(void);
 uint32_t property_set(const std::string& name, const std::string& value);
@@ -0,0 +1,114 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Compares setting properties one connection at a time, the way __system_property_set() does,
+// against sending them to the property service in one PROP_MSG_SETPROP_BATCH message.  Runs
+// against the property service of the device, so it measures init's handling of the sets too.
+
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#define _REALLY_INCLUDE_SYS__SYSTEM_PROPERTIES_H_
+#include <sys/_system_properties.h>
+
+#include <string>
+#include <vector>
+
+#include <android-base/stringprintf.h>
+#include <android-base/unique_fd.h>
+#include <benchmark/benchmark.h>
+
+#include "property_service.h"
+
+namespace android {
+namespace init {
+
+static std::vector<std::string> PropertyNames(size_t count) {
+    std::vector<std::string> names;
+    for (size_t i = 0; i < count; ++i) {
+        names.emplace_back(android::base::StringPrintf("debug.init.benchmark.%zu", i));
+    }
+    return names;
+}
+
+static void BM_property_set(benchmark::State& state) {
+    auto names = PropertyNames(state.range(0));
+    size_t iteration = 0;
+    while (state.KeepRunning()) {
+        std::string value = std::to_string(iteration++);
+        for (const auto& name : names) {
+            if (__system_property_set(name.c_str(), value.c_str()) != 0) {
+                state.SkipWithError("__system_property_set failed");
+                return;
+            }
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * names.size());
+}
+BENCHMARK(BM_property_set)->Arg(1)->Arg(8)->Arg(64);
+
+static void AppendUint32(std::string* message, uint32_t value) {
+    message->append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+static bool SetPropertyBatch(const std::vector<std::string>& names, const std::string& value) {
+    std::string message;
+    AppendUint32(&message, PROP_MSG_SETPROP_BATCH);
+    AppendUint32(&message, names.size());
+    for (const auto& name : names) {
+        AppendUint32(&message, name.size());
+        message += name;
+        AppendUint32(&message, value.size());
+        message += value;
+    }
+
+    android::base::unique_fd fd(socket(AF_LOCAL, SOCK_STREAM | SOCK_CLOEXEC, 0));
+    if (fd == -1) return false;
+    static const char* property_service_socket = "/dev/socket/" PROP_SERVICE_NAME;
+    sockaddr_un addr = {};
+    addr.sun_family = AF_LOCAL;
+    strlcpy(addr.sun_path, property_service_socket, sizeof(addr.sun_path));
+    socklen_t addr_len = strlen(property_service_socket) + offsetof(sockaddr_un, sun_path) + 1;
+    if (connect(fd, reinterpret_cast<sockaddr*>(&addr), addr_len) == -1 ||
+        send(fd, message.data(), message.size(), 0) != static_cast<ssize_t>(message.size())) {
+        return false;
+    }
+
+    std::vector<uint32_t> results(names.size());
+    ssize_t size = results.size() * sizeof(results[0]);
+    if (TEMP_FAILURE_RETRY(recv(fd, results.data(), size, MSG_WAITALL)) != size) return false;
+    for (uint32_t result : results) {
+        if (result != PROP_SUCCESS) return false;
+    }
+    return true;
+}
+
+static void BM_property_set_batch(benchmark::State& state) {
+    auto names = PropertyNames(state.range(0));
+    size_t iteration = 0;
+    while (state.KeepRunning()) {
+        if (!SetPropertyBatch(names, std::to_string(iteration++))) {
+            state.SkipWithError("PROP_MSG_SETPROP_BATCH failed");
+            return;
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * names.size());
+}
+BENCHMARK(BM_property_set_batch)->Arg(1)->Arg(8)->Arg(64);
+
+}  // namespace init
+}  // namespace android
@@ -21,8 +21,16 @@
 #define _REALLY_INCLUDE_SYS__SYSTEM_PROPERTIES_H_
 #include <sys/_system_properties.h>
 
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <android-base/properties.h>
+#include <android-base/unique_fd.h>
 #include <gtest/gtest.h>
 
+#include "property_service.h"
+
 namespace android {
 namespace init {
 
@@ -50,5 +58,69 @@ TEST(property_service, very_long_name_35166374) {
   ASSERT_EQ(0, close(fd));
 }
 
+static android::base::unique_fd ConnectToPropertyService() {
+  android::base::unique_fd fd(socket(AF_LOCAL, SOCK_STREAM | SOCK_CLOEXEC, 0));
+  if (fd == -1) return fd;
+
+  static const char* property_service_socket = "/dev/socket/" PROP_SERVICE_NAME;
+  sockaddr_un addr = {};
+  addr.sun_family = AF_LOCAL;
+  strlcpy(addr.sun_path, property_service_socket, sizeof(addr.sun_path));
+
+  socklen_t addr_len = strlen(property_service_socket) + offsetof(sockaddr_un, sun_path) + 1;
+  if (connect(fd, reinterpret_cast<sockaddr*>(&addr), addr_len) == -1) fd.reset();
+  return fd;
+}
+
+static void AppendUint32(std::string* message, uint32_t value) {
+  message->append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+TEST(property_service, set_batch) {
+  std::vector<std::pair<std::string, std::string>> properties = {
+      {"debug.init.test.batch.a", "1"},
+      {"debug.init.test.batch.b", "2"},
+      {"debug.init.test.batch a", "illegal name"},
+  };
+  std::string message;
+  AppendUint32(&message, PROP_MSG_SETPROP_BATCH);
+  AppendUint32(&message, properties.size());
+  for (const auto& [name, value] : properties) {
+    AppendUint32(&message, name.size());
+    message += name;
+    AppendUint32(&message, value.size());
+    message += value;
+  }
+
+  auto fd = ConnectToPropertyService();
+  ASSERT_NE(fd, -1);
+  ASSERT_EQ(static_cast<ssize_t>(message.size()), send(fd, message.data(), message.size(), 0));
+
+  uint32_t results[3];
+  ASSERT_EQ(static_cast<ssize_t>(sizeof(results)),
+            TEMP_FAILURE_RETRY(recv(fd, results, sizeof(results), MSG_WAITALL)));
+  EXPECT_EQ(static_cast<uint32_t>(PROP_SUCCESS), results[0]);
+  EXPECT_EQ(static_cast<uint32_t>(PROP_SUCCESS), results[1]);
+  EXPECT_EQ(static_cast<uint32_t>(PROP_ERROR_INVALID_NAME), results[2]);
+
+  EXPECT_EQ("1", android::base::GetProperty("debug.init.test.batch.a", ""));
+  EXPECT_EQ("2", android::base::GetProperty("debug.init.test.batch.b", ""));
+}
+
+TEST(property_service, set_batch_too_large) {
+  std::string message;
+  AppendUint32(&message, PROP_MSG_SETPROP_BATCH);
+  AppendUint32(&message, kMaxPropertyBatchSize + 1);
+
+  auto fd = ConnectToPropertyService();
+  ASSERT_NE(fd, -1);
+  ASSERT_EQ(static_cast<ssize_t>(message.size()), send(fd, message.data(), message.size(), 0));
+
+  uint32_t result;
+  ASSERT_EQ(static_cast<ssize_t>(sizeof(result)),
+            TEMP_FAILURE_RETRY(recv(fd, &result, sizeof(result), MSG_WAITALL)));
+  EXPECT_EQ(static_cast<uint32_t>(PROP_ERROR_READ_DATA), result);
+}
+
 }  // namespace init
 }  // namespace android
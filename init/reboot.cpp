@@ -20,6 +20,7 @@
 #include <fcntl.h>
 #include <linux/fs.h>
 #include <mntent.h>
+#include <signal.h>
 #include <sys/capability.h>
 #include <sys/cdefs.h>
 #include <sys/ioctl.h>
@@ -29,7 +30,9 @@
 #include <sys/syscall.h>
 #include <sys/types.h>
 #include <sys/wait.h>
+#include <unistd.h>
 
+#include <algorithm>
 #include <memory>
 #include <set>
 #include <thread>
@@ -39,6 +42,7 @@
 #include <android-base/file.h>
 #include <android-base/logging.h>
 #include <android-base/macros.h>
+#include <android-base/parseint.h>
 #include <android-base/properties.h>
 #include <android-base/stringprintf.h>
 #include <android-base/strings.h>
@@ -85,6 +89,12 @@ class MountEntry {
           mnt_opts_(entry.mnt_opts) {}
 
     bool Umount(bool force) {
+        // Flush this file system on its own first, so writeback to independent devices can
+        // happen at once when they're unmounted from different threads.
+        android::base::unique_fd fd(open(mnt_dir_.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC));
+        if (fd != -1) syncfs(fd);
+        fd.reset();
+
         int r = umount2(mnt_dir_.c_str(), force ? MNT_FORCE : 0);
         if (r == 0) {
             LOG(INFO) << "umounted " << mnt_fsname_ << ":" << mnt_dir_ << " opts " << mnt_opts_;
@@ -113,6 +123,13 @@ class MountEntry {
         }
     }
 
+    const std::string& mnt_dir() const { return mnt_dir_; }
+
+    // Whether |other| is mounted somewhere under this mount point.
+    bool IsParentOf(const MountEntry& other) const {
+        return android::base::StartsWith(other.mnt_dir_, (mnt_dir_ + "/").c_str());
+    }
+
     static bool IsBlockDevice(const struct mntent& mntent) {
         return android::base::StartsWith(mntent.mnt_fsname, "/dev/block");
     }
@@ -167,6 +184,33 @@ static void LogShutdownTime(UmountStat stat, Timer* t) {
                  << stat;
 }
 
+// Records when each step of the shutdown finished, in ms since it started. Each step is set as
+// sys.shutdown.timeline.<step>, and Log() writes them all to the kernel log as one
+// powerctl_shutdown_timeline line, which bootstat records from the console ramoops on the next
+// boot.
+class ShutdownTimeline {
+  public:
+    void Mark(const std::string& step) {
+        std::string ms = std::to_string(t_.duration().count());
+        property_set("sys.shutdown.timeline." + step, ms);
+        if (!line_.empty()) line_ += ",";
+        line_ += step + "=" + ms;
+    }
+
+    // Marks umount.<mount point> for |mount_dir|, with the slashes made property friendly.
+    void MarkUmount(const std::string& mount_dir) {
+        std::string name = mount_dir.substr(1);
+        std::replace(name.begin(), name.end(), '/', '_');
+        Mark("umount." + name);
+    }
+
+    void Log() const { LOG(WARNING) << "powerctl_shutdown_timeline:" << line_; }
+
+  private:
+    Timer t_;
+    std::string line_;
+};
+
 // Determines whether the system is capable of rebooting. This is conservative,
 // so if any of the attempts to determine this fail, it will still return true.
 static bool IsRebootCapable() {
@@ -263,7 +307,134 @@ static void DumpUmountDebuggingInfo(bool dump_all) {
     }
 }
 
-static UmountStat UmountPartitions(std::chrono::milliseconds timeout) {
+// Returns the processes other than init with a file, mapping, working directory or root on the
+// file system mounted at |mount_dir|.
+static std::set<pid_t> FindProcessesUsing(const std::string& mount_dir) {
+    std::set<pid_t> pids;
+    std::unique_ptr<DIR, int (*)(DIR*)> proc(opendir("/proc"), closedir);
+    if (!proc) {
+        PLOG(ERROR) << "Failed to open /proc";
+        return pids;
+    }
+
+    auto on_mount = [&mount_dir](const std::string& path) {
+        return path == mount_dir || android::base::StartsWith(path, (mount_dir + "/").c_str());
+    };
+    auto link_on_mount = [&on_mount](const std::string& link) {
+        std::string path;
+        return android::base::Readlink(link, &path) && on_mount(path);
+    };
+
+    struct dirent* dp;
+    while ((dp = readdir(proc.get())) != nullptr) {
+        pid_t pid;
+        if (!android::base::ParseInt(dp->d_name, &pid) || pid <= 1 || pid == getpid()) {
+            continue;
+        }
+        std::string dir = StringPrintf("/proc/%d/", pid);
+
+        bool found = link_on_mount(dir + "cwd") || link_on_mount(dir + "root") ||
+                     link_on_mount(dir + "exe");
+        if (!found) {
+            std::unique_ptr<DIR, int (*)(DIR*)> fds(opendir((dir + "fd").c_str()), closedir);
+            struct dirent* fd_dp;
+            while (fds && !found && (fd_dp = readdir(fds.get())) != nullptr) {
+                found = fd_dp->d_name[0] != '.' && link_on_mount(dir + "fd/" + fd_dp->d_name);
+            }
+        }
+        if (!found) {
+            std::string maps;
+            android::base::ReadFileToString(dir + "maps", &maps);
+            for (const auto& line : android::base::Split(maps, "\n")) {
+                size_t path = line.find('/');
+                if (path != std::string::npos && on_mount(line.substr(path))) {
+                    found = true;
+                    break;
+                }
+            }
+        }
+        if (found) pids.insert(pid);
+    }
+    return pids;
+}
+
+// Kills the processes keeping the file systems at |busy_dirs| from being unmounted, except for
+// shutdown critical services, and waits until |deadline| for them to exit. Returns false if
+// nothing could be killed.
+static bool KillProcessesUsing(const std::vector<std::string>& busy_dirs, Timer* t,
+                               std::chrono::milliseconds deadline) {
+    std::set<pid_t> critical;
+    ServiceManager::GetInstance().ForEachService([&critical](Service* s) {
+        if (s->IsShutdownCritical() && s->pid() != 0) critical.insert(s->pid());
+    });
+
+    std::set<pid_t> killed;
+    for (const auto& mount_dir : busy_dirs) {
+        for (pid_t pid : FindProcessesUsing(mount_dir)) {
+            if (critical.count(pid) || killed.count(pid)) continue;
+            std::string cmdline;
+            android::base::ReadFileToString(StringPrintf("/proc/%d/cmdline", pid), &cmdline);
+            LOG(INFO) << "killing " << pid << " (" << cmdline.c_str() << ") for using "
+                      << mount_dir;
+            if (kill(pid, SIGKILL) == 0) killed.insert(pid);
+        }
+    }
+    if (killed.empty()) return false;
+
+    // Dead processes have closed their files even before they're reaped.
+    auto exited = [](pid_t pid) {
+        std::string stat;
+        if (!android::base::ReadFileToString(StringPrintf("/proc/%d/stat", pid), &stat)) {
+            return true;
+        }
+        size_t state = stat.rfind(')');
+        return state != std::string::npos && state + 2 < stat.size() && stat[state + 2] == 'Z';
+    };
+    while (t->duration() < deadline) {
+        ServiceManager::GetInstance().ReapAnyOutstandingChildren();
+        if (std::all_of(killed.begin(), killed.end(), exited)) break;
+        std::this_thread::sleep_for(5ms);
+    }
+    return true;
+}
+
+// Unmounts |block_devices| that nothing else is mounted under, each from its own thread, and
+// returns the mount points that failed. The rest are left for the next pass.
+static std::vector<std::string> UmountLeaves(std::vector<MountEntry>* block_devices, bool force,
+                                             ShutdownTimeline* timeline) {
+    std::vector<MountEntry*> leaves;
+    for (auto& entry : *block_devices) {
+        if (std::none_of(block_devices->begin(), block_devices->end(),
+                         [&entry](auto& other) { return entry.IsParentOf(other); })) {
+            leaves.emplace_back(&entry);
+        }
+    }
+
+    std::unique_ptr<bool[]> umounted(new bool[leaves.size()]());
+    std::vector<std::thread> threads;
+    for (size_t i = 1; i < leaves.size(); ++i) {
+        threads.emplace_back([&leaves, &umounted, i, force]() {
+            umounted[i] = leaves[i]->Umount(force);
+        });
+    }
+    if (!leaves.empty()) umounted[0] = leaves[0]->Umount(force);
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    std::vector<std::string> busy;
+    for (size_t i = 0; i < leaves.size(); ++i) {
+        if (umounted[i]) {
+            if (timeline) timeline->MarkUmount(leaves[i]->mnt_dir());
+        } else {
+            busy.emplace_back(leaves[i]->mnt_dir());
+        }
+    }
+    return busy;
+}
+
+static UmountStat UmountPartitions(std::chrono::milliseconds timeout,
+                                   ShutdownTimeline* timeline) {
     Timer t;
     UmountStat stat = UMOUNT_STAT_TIMEOUT;
     int retry = 0;
@@ -290,11 +461,13 @@ static UmountStat UmountPartitions(std::chrono::milliseconds timeout) {
                         [](auto& entry) { return entry.Umount(false); })) {
             sync();
         }
-        for (auto& entry : block_devices) {
-            entry.Umount(timeout == 0ms);
-        }
+        std::vector<std::string> busy = UmountLeaves(&block_devices, timeout == 0ms, timeline);
         retry++;
-        std::this_thread::sleep_for(100ms);
+        // Rather than waiting for whatever is using the busy ones to go away on its own, kill
+        // it. Only if nothing can be found holding them is there nothing to do but wait.
+        if (!busy.empty() && (timeout == 0ms || !KillProcessesUsing(busy, &t, timeout))) {
+            std::this_thread::sleep_for(100ms);
+        }
     }
     return stat;
 }
@@ -310,7 +483,8 @@ static void KillAllProcesses() { android::base::WriteStringToFile("i", "/proc/sy
  *
  * return true when umount was successful. false when timed out.
  */
-static UmountStat TryUmountAndFsck(bool runFsck, std::chrono::milliseconds timeout) {
+static UmountStat TryUmountAndFsck(bool runFsck, std::chrono::milliseconds timeout,
+                                   ShutdownTimeline* timeline) {
     Timer t;
     std::vector<MountEntry> block_devices;
     std::vector<MountEntry> emulated_devices;
@@ -321,14 +495,16 @@ static UmountStat TryUmountAndFsck(bool runFsck, std::chrono::milliseconds timeo
         return UMOUNT_STAT_ERROR;
     }
 
-    UmountStat stat = UmountPartitions(timeout - t.duration());
+    UmountStat stat = UmountPartitions(timeout - t.duration(), timeline);
+    timeline->Mark("umount");
     if (stat != UMOUNT_STAT_SUCCESS) {
         LOG(INFO) << "umount timeout, last resort, kill all and try";
         if (DUMP_ON_UMOUNT_FAILURE) DumpUmountDebuggingInfo(true);
         KillAllProcesses();
         // even if it succeeds, still it is timeout and do not run fsck with all processes killed
-        UmountStat st = UmountPartitions(0ms);
+        UmountStat st = UmountPartitions(0ms, timeline);
         if ((st != UMOUNT_STAT_SUCCESS) && DUMP_ON_UMOUNT_FAILURE) DumpUmountDebuggingInfo(false);
+        timeline->Mark("umount_after_kill");
     }
 
     if (stat == UMOUNT_STAT_SUCCESS && runFsck) {
@@ -337,6 +513,7 @@ static UmountStat TryUmountAndFsck(bool runFsck, std::chrono::milliseconds timeo
         for (auto& entry : block_devices) {
             entry.DoFsck();
         }
+        timeline->Mark("fsck");
     }
     return stat;
 }
@@ -344,6 +521,7 @@ static UmountStat TryUmountAndFsck(bool runFsck, std::chrono::milliseconds timeo
 void DoReboot(unsigned int cmd, const std::string& reason, const std::string& rebootTarget,
               bool runFsck) {
     Timer t;
+    ShutdownTimeline timeline;
     LOG(INFO) << "Reboot start, reason: " << reason << ", rebootTarget: " << rebootTarget;
 
     android::base::WriteStringToFile(StringPrintf("%s\n", reason.c_str()), LAST_REBOOT_REASON_FILE,
@@ -430,6 +608,7 @@ void DoReboot(unsigned int cmd, const std::string& reason, const std::string& re
         }
         LOG(INFO) << "Terminating running services took " << t
                   << " with remaining services:" << service_count;
+        timeline.Mark("terminate");
     }
 
     // minimum safety steps before restarting
@@ -438,6 +617,7 @@ void DoReboot(unsigned int cmd, const std::string& reason, const std::string& re
         if (!s->IsShutdownCritical()) s->Stop();
     });
     ServiceManager::GetInstance().ReapAnyOutstandingChildren();
+    timeline.Mark("stop");
 
     // 3. send volume shutdown to vold
     Service* voldService = ServiceManager::GetInstance().FindServiceByName("vold");
@@ -447,16 +627,19 @@ void DoReboot(unsigned int cmd, const std::string& reason, const std::string& re
     } else {
         LOG(INFO) << "vold not running, skipping vold shutdown";
     }
+    timeline.Mark("vold");
     // logcat stopped here
     ServiceManager::GetInstance().ForEachService([&kill_after_apps](Service* s) {
         if (kill_after_apps.count(s->name())) s->Stop();
     });
-    // 4. sync, try umount, and optionally run fsck for user shutdown
-    sync();
-    UmountStat stat = TryUmountAndFsck(runFsck, shutdown_timeout - t.duration());
+    // 4. sync, try umount, and optionally run fsck for user shutdown. Each block device is
+    // synced just before it's unmounted, in parallel with the others.
+    UmountStat stat = TryUmountAndFsck(runFsck, shutdown_timeout - t.duration(), &timeline);
     // Follow what linux shutdown is doing: one more sync with little bit delay
     sync();
     if (!is_thermal_shutdown) std::this_thread::sleep_for(100ms);
+    timeline.Mark("total");
+    timeline.Log();
     LogShutdownTime(stat, &t);
     // Reboot regardless of umount status. If umount fails, fsck after reboot will fix it.
     RebootSystem(cmd, rebootTarget);
@@ -524,6 +707,9 @@ bool HandlePowerctlMessage(const std::string& command) {
     // Skip wait for prop if it is in progress
     ResetWaitForProp();
 
+    // Skip wait for file if it is in progress
+    ResetWaitForFile();
+
     // Skip wait for exec if it is in progress
     if (ServiceManager::GetInstance().IsWaitingForExec()) {
         ServiceManager::GetInstance().ClearExecWait();
@@ -30,6 +30,12 @@
 #include <termios.h>
 #include <unistd.h>
 
+#include <algorithm>
+#include <atomic>
+#include <map>
+#include <mutex>
+#include <thread>
+
 #include <android-base/file.h>
 #include <android-base/logging.h>
 #include <android-base/parseint.h>
@@ -41,6 +47,8 @@
 #include <selinux/selinux.h>
 #include <system/thread_defs.h>
 
+#include "boot_timeline.h"
+#include "bootchart.h"
 #include "init.h"
 #include "property_service.h"
 #include "util.h"
@@ -57,6 +65,39 @@ using android::base::WriteStringToFile;
 namespace android {
 namespace init {
 
+// The domains that security_compute_create() gave executables started from init, by the
+// executable's file context. The policy doesn't change once init is running, so the same label
+// always transitions to the same domain, and only the first start of each has to ask the kernel.
+static std::mutex exec_contexts_lock;
+static std::map<std::string, std::string> exec_contexts;
+
+// Like security_compute_create() for the "process" class, but cached in exec_contexts.
+static int ComputeExecContext(const char* mycon, const char* filecon, std::string* context) {
+    {
+        std::lock_guard<std::mutex> guard(exec_contexts_lock);
+        auto it = exec_contexts.find(filecon);
+        if (it != exec_contexts.end()) {
+            *context = it->second;
+            return 0;
+        }
+    }
+
+    char* new_con = nullptr;
+    int rc = security_compute_create(mycon, filecon, string_to_security_class("process"),
+                                     &new_con);
+    if (rc == 0) {
+        *context = new_con;
+        free(new_con);
+        // Executables without a domain stay in init's, and are refused every time, so there's
+        // no point in keeping those.
+        if (*context != mycon) {
+            std::lock_guard<std::mutex> guard(exec_contexts_lock);
+            exec_contexts.emplace(filecon, *context);
+        }
+    }
+    return rc;
+}
+
 static std::string ComputeContextFromExecutable(std::string& service_name,
                                                 const std::string& service_path) {
     std::string computed_context;
@@ -76,13 +117,7 @@ static std::string ComputeContextFromExecutable(std::string& service_name,
     }
     std::unique_ptr<char> filecon(raw_filecon);
 
-    char* new_con = nullptr;
-    int rc = security_compute_create(mycon.get(), filecon.get(),
-                                     string_to_security_class("process"), &new_con);
-    if (rc == 0) {
-        computed_context = new_con;
-        free(new_con);
-    }
+    int rc = ComputeExecContext(mycon.get(), filecon.get(), &computed_context);
     if (rc == 0 && computed_context == mycon.get()) {
         LOG(ERROR) << "service " << service_name << " does not have a SELinux domain defined";
         return "";
@@ -222,6 +257,7 @@ void Service::NotifyStateChange(const std::string& new_state) const {
     if (new_state == "running") {
         uint64_t start_ns = time_started_.time_since_epoch().count();
         property_set("ro.boottime." + name_, std::to_string(start_ns));
+        BootTimelineMark("service." + name_ + ".start");
     }
 }
 
@@ -293,6 +329,8 @@ void Service::SetProcessAttributes() {
 }
 
 void Service::Reap() {
+    bootchart_log_service_exit(name_, pid_);
+
     if (!(flags_ & SVC_ONESHOT) || (flags_ & SVC_RESTART)) {
         KillProcessGroup(SIGKILL);
     }
@@ -686,6 +724,8 @@ bool Service::ExecStart(std::unique_ptr<android::base::Timer>* exec_waiter) {
 }
 
 bool Service::Start() {
+    boot_clock::time_point start_time = boot_clock::now();
+
     // Starting a service removes it from the disabled or reset state and
     // immediately takes it out of the restarting state if it was in there.
     flags_ &= (~(SVC_DISABLED|SVC_RESTARTING|SVC_RESET|SVC_RESTART|SVC_DISABLED_START));
@@ -732,6 +772,7 @@ bool Service::Start() {
     }
 
     LOG(INFO) << "starting service '" << name_ << "'...";
+    boot_clock::time_point fork_time = boot_clock::now();
 
     pid_t pid = -1;
     if (namespace_flags_) {
@@ -860,6 +901,8 @@ bool Service::Start() {
     }
 
     NotifyStateChange("running");
+    bootchart_log_service_start(name_, pid_, (flags_ & SVC_EXEC) != 0, start_time, fork_time,
+                                boot_clock::now());
     return true;
 }
 
@@ -1127,6 +1170,53 @@ void ServiceManager::ForEachServiceInClass(const std::string& classname,
     }
 }
 
+void ServiceManager::PrepareClassStart(const std::string& classname) const {
+    // Only services that will compute their domain from their executable, which is the part of
+    // Start() that doesn't depend on anything that changes between now and then.
+    std::vector<std::string> paths;
+    for (const auto& s : services_) {
+        if (s->classnames().find(classname) != s->classnames().end() &&
+            !(s->flags() & (SVC_DISABLED | SVC_RUNNING)) && s->seclabel().empty()) {
+            paths.emplace_back(s->args()[0]);
+        }
+    }
+    // Any class small enough doesn't make up for starting threads, and later class_starts are
+    // mostly served from exec_contexts anyway.
+    unsigned int num_threads = std::min(std::thread::hardware_concurrency(), 4U);
+    if (paths.size() < 8 || num_threads < 2) {
+        return;
+    }
+
+    char* raw_con = nullptr;
+    if (getcon(&raw_con) == -1) {
+        return;
+    }
+    std::unique_ptr<char> mycon(raw_con);
+
+    // Errors are left for Start() to log, with the service's name.
+    std::atomic<size_t> next(0);
+    auto worker = [&]() {
+        for (size_t i = next++; i < paths.size(); i = next++) {
+            char* raw_filecon = nullptr;
+            if (getfilecon(paths[i].c_str(), &raw_filecon) == -1) {
+                continue;
+            }
+            std::unique_ptr<char> filecon(raw_filecon);
+            std::string context;
+            ComputeExecContext(mycon.get(), filecon.get(), &context);
+        }
+    };
+    // Every thread is joined before returning, so none of them is around when Start() forks.
+    std::vector<std::thread> threads;
+    for (unsigned int i = 1; i < num_threads; i++) {
+        threads.emplace_back(worker);
+    }
+    worker();
+    for (auto& thread : threads) {
+        thread.join();
+    }
+}
+
 void ServiceManager::ForEachServiceWithFlags(unsigned matchflags,
                                              void (*func)(Service* svc)) const {
     for (const auto& s : services_) {
@@ -1185,6 +1275,7 @@ bool ServiceManager::ReapOneProcess() {
         if (svc->flags() & SVC_EXEC) {
             wait_string = StringPrintf(" waiting took %f seconds",
                                        exec_waiter_->duration().count() / 1000.0f);
+            BootTimelineAdd("exec." + svc->name(), exec_waiter_->duration());
         }
     } else {
         name = StringPrintf("Untracked pid %d", pid);
@@ -211,6 +211,9 @@ class ServiceManager {
     void ForEachService(const std::function<void(Service*)>& callback) const;
     void ForEachServiceInClass(const std::string& classname,
                                void (*func)(Service* svc)) const;
+    // Computes the SELinux domains of the services in |classname| that are about to be started
+    // on several threads, so that starting each of them after this only has to fork.
+    void PrepareClassStart(const std::string& classname) const;
     void ForEachServiceWithFlags(unsigned matchflags,
                              void (*func)(Service* svc)) const;
     void ReapAnyOutstandingChildren();
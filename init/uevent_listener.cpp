@@ -21,7 +21,12 @@
 #include <string.h>
 #include <unistd.h>
 
+#include <algorithm>
+#include <atomic>
 #include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
 
 #include <android-base/logging.h>
 #include <cutils/uevent.h>
@@ -124,10 +129,8 @@ bool UeventListener::ReadUevent(Uevent* uevent) const {
 // make sure we don't overrun the socket's buffer.
 //
 
-ListenerAction UeventListener::RegenerateUeventsForDir(DIR* d,
-                                                       const ListenerCallback& callback) const {
-    int dfd = dirfd(d);
-
+ListenerAction UeventListener::RegenerateUeventForDir(int dfd,
+                                                      const ListenerCallback& callback) const {
     int fd = openat(dfd, "uevent", O_WRONLY);
     if (fd >= 0) {
         write(fd, "add\n", 4);
@@ -138,12 +141,22 @@ ListenerAction UeventListener::RegenerateUeventsForDir(DIR* d,
             if (callback(uevent) == ListenerAction::kStop) return ListenerAction::kStop;
         }
     }
+    return ListenerAction::kContinue;
+}
+
+ListenerAction UeventListener::RegenerateUeventsForDir(DIR* d,
+                                                       const ListenerCallback& callback) const {
+    int dfd = dirfd(d);
+
+    if (RegenerateUeventForDir(dfd, callback) == ListenerAction::kStop) {
+        return ListenerAction::kStop;
+    }
 
     dirent* de;
     while ((de = readdir(d)) != nullptr) {
         if (de->d_type != DT_DIR || de->d_name[0] == '.') continue;
 
-        fd = openat(dfd, de->d_name, O_RDONLY | O_DIRECTORY);
+        int fd = openat(dfd, de->d_name, O_RDONLY | O_DIRECTORY);
         if (fd < 0) continue;
 
         std::unique_ptr<DIR, decltype(&closedir)> d2(fdopendir(fd), closedir);
@@ -176,6 +189,55 @@ void UeventListener::RegenerateUevents(const ListenerCallback& callback) const {
     }
 }
 
+// The walk is split by the directories right under the regeneration paths, which the threads take
+// in order.  Any thread may read the uevent that another one caused, since they all drain the same
+// socket, so the order in which uevents reach |callback| is only roughly that of the serial walk.
+void UeventListener::RegenerateUeventsInParallel(const ListenerCallback& callback,
+                                                 unsigned int num_threads) const {
+    std::mutex callback_lock;
+    std::atomic<bool> stopped = false;
+    auto locked_callback = [&](const Uevent& uevent) {
+        std::lock_guard<std::mutex> lock(callback_lock);
+        if (stopped || callback(uevent) == ListenerAction::kStop) {
+            stopped = true;
+            return ListenerAction::kStop;
+        }
+        return ListenerAction::kContinue;
+    };
+
+    std::vector<std::string> subdirs;
+    for (const auto path : kRegenerationPaths) {
+        std::unique_ptr<DIR, decltype(&closedir)> d(opendir(path), closedir);
+        if (!d) continue;
+        if (RegenerateUeventForDir(dirfd(d.get()), locked_callback) == ListenerAction::kStop) {
+            return;
+        }
+
+        dirent* de;
+        while ((de = readdir(d.get())) != nullptr) {
+            if (de->d_type != DT_DIR || de->d_name[0] == '.') continue;
+            subdirs.emplace_back(std::string(path) + "/" + de->d_name);
+        }
+    }
+
+    std::atomic<size_t> next_subdir = 0;
+    auto walk = [&] {
+        size_t i;
+        while (!stopped && (i = next_subdir.fetch_add(1)) < subdirs.size()) {
+            RegenerateUeventsForPath(subdirs[i], locked_callback);
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (unsigned int i = 1; i < std::min<size_t>(num_threads, subdirs.size()); ++i) {
+        threads.emplace_back(walk);
+    }
+    walk();
+    for (auto& thread : threads) {
+        thread.join();
+    }
+}
+
 void UeventListener::Poll(const ListenerCallback& callback,
                           const std::optional<std::chrono::milliseconds> relative_timeout) const {
     using namespace std::chrono;
@@ -44,6 +44,10 @@ class UeventListener {
     UeventListener();
 
     void RegenerateUevents(const ListenerCallback& callback) const;
+    // Like RegenerateUevents(), but walks /sys on up to |num_threads| threads.  |callback| is
+    // never called by two of them at once.
+    void RegenerateUeventsInParallel(const ListenerCallback& callback,
+                                     unsigned int num_threads) const;
     ListenerAction RegenerateUeventsForPath(const std::string& path,
                                             const ListenerCallback& callback) const;
     void Poll(const ListenerCallback& callback,
@@ -51,6 +55,7 @@ class UeventListener {
 
   private:
     bool ReadUevent(Uevent* uevent) const;
+    ListenerAction RegenerateUeventForDir(int dfd, const ListenerCallback& callback) const;
     ListenerAction RegenerateUeventsForDir(DIR* d, const ListenerCallback& callback) const;
 
     android::base::unique_fd device_fd_;
@@ -22,14 +22,21 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
 #include <sys/wait.h>
 
+#include <atomic>
 #include <set>
+#include <string_view>
 #include <thread>
 
 #include <android-base/chrono_utils.h>
+#include <android-base/file.h>
 #include <android-base/logging.h>
 #include <android-base/properties.h>
+#include <android-base/stringprintf.h>
+#include <android-base/unique_fd.h>
 #include <selinux/android.h>
 #include <selinux/selinux.h>
 
@@ -77,20 +84,24 @@
 // once that has completed, restorecon is done for each device as its uevent is handled.
 
 // With all of the above considered, the cold boot process has the below steps:
-// 1) ueventd regenerates uevents by doing the /sys traversal and listens to the netlink socket for
-//    the generated uevents.  It writes these uevents into a queue represented by a vector.
+// 1) ueventd forks 'n' separate uevent handler subprocesses, which wait on a SOCK_SEQPACKET socket
+//    for uevents.  Each uevent is one message, so it is read by exactly one subprocess, and one
+//    that gets a run of slow uevents doesn't hold the others up.  Other than that socket, no IPC
+//    happens at this point and only const functions from DeviceHandler should be called from this
+//    context.  Firmware requests are passed on by the subprocesses too, to the firmware loader
+//    process that is forked before cold boot starts, so that the main process never forks while
+//    it has more than one thread.
 //
-// 2) ueventd forks 'n' separate uevent handler subprocesses and has each of them to handle the
-//    uevents in the queue based on a starting offset (their process number) and a stride (the total
-//    number of processes).  Note that no IPC happens at this point and only const functions from
-//    DeviceHandler should be called from this context.
+// 2) ueventd regenerates uevents by doing the /sys traversal on 'n' threads and listens to the
+//    netlink socket for the generated uevents.  It sends them to the subprocesses as they arrive,
+//    so handling starts with the first one, and closes the socket once the traversal is done.
 //
-// 3) In parallel to the subprocesses handling the uevents, the main thread of ueventd calls
-//    selinux_android_restorecon() recursively on /sys/class, /sys/block, and /sys/devices.
+// 3) In parallel to the subprocesses handling the uevents, ueventd restorecons /sys recursively,
+//    with 'n' threads each taking one of its subdirectories at a time.
 //
 // 4) Once the restorecon operation finishes, the main thread calls waitpid() to wait for all
 //    subprocess handlers to complete and exit.  Once this happens, it marks coldboot as having
-//    completed.
+//    completed, writing how long each step took into COLDBOOT_DONE for init to export.
 //
 // At this point, ueventd is single threaded, poll()'s and then handles any future uevents.
 
@@ -100,6 +111,8 @@
 // the uevent listener resumes in polling mode and will handle the uevents that occurred during
 // coldboot.
 
+using android::base::boot_clock;
+
 namespace android {
 namespace init {
 
@@ -113,39 +126,147 @@ class ColdBoot {
     void Run();
 
   private:
-    void UeventHandlerMain(unsigned int process_num, unsigned int total_processes);
+    void UeventHandlerMain(int uevent_socket);
     void RegenerateUevents();
     void ForkSubProcesses();
     void DoRestoreCon();
     void WaitForSubProcesses();
+    void WriteColdBootDone();
 
     UeventListener& uevent_listener_;
     DeviceHandler& device_handler_;
 
     unsigned int num_handler_subprocesses_;
-    std::vector<Uevent> uevent_queue_;
+    // Where the regenerated uevents are sent to the subprocesses.
+    android::base::unique_fd uevent_socket_;
 
     std::set<pid_t> subprocess_pids_;
+
+    // Shared with the subprocesses.
+    struct HandlerState {
+        // When the last subprocess ran out of uevents to handle.
+        std::atomic<int64_t> handled_time;
+    };
+    static_assert(std::atomic<int64_t>::is_always_lock_free,
+                  "HandlerState has to work across processes");
+    HandlerState* handler_state_ = nullptr;
+
+    std::chrono::milliseconds regenerate_duration_;
+    std::chrono::milliseconds handle_duration_;
+    std::chrono::milliseconds restorecon_duration_;
 };
 
-void ColdBoot::UeventHandlerMain(unsigned int process_num, unsigned int total_processes) {
-    for (unsigned int i = process_num; i < uevent_queue_.size(); i += total_processes) {
-        auto& uevent = uevent_queue_[i];
+// A uevent is sent as its three numbers followed by its strings, each prefixed with its length.
+// They all come from one netlink message, so they fit in a buffer twice the size of one.
+static constexpr size_t kMaxUeventMessageSize = 2 * UEVENT_MSG_LEN;
+
+static void AppendInt(std::string* message, int32_t value) {
+    message->append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+static void AppendString(std::string* message, const std::string& value) {
+    AppendInt(message, static_cast<int32_t>(value.size()));
+    message->append(value);
+}
+
+static std::string SerializeUevent(const Uevent& uevent) {
+    std::string message;
+    AppendInt(&message, uevent.partition_num);
+    AppendInt(&message, uevent.major);
+    AppendInt(&message, uevent.minor);
+    for (const auto& value : {uevent.action, uevent.path, uevent.subsystem, uevent.firmware,
+                              uevent.partition_name, uevent.device_name}) {
+        AppendString(&message, value);
+    }
+    return message;
+}
+
+static bool ReadInt(std::string_view* message, int32_t* value) {
+    if (message->size() < sizeof(*value)) return false;
+    memcpy(value, message->data(), sizeof(*value));
+    message->remove_prefix(sizeof(*value));
+    return true;
+}
+
+static bool ReadString(std::string_view* message, std::string* value) {
+    int32_t size;
+    if (!ReadInt(message, &size) || size < 0 || message->size() < static_cast<size_t>(size)) {
+        return false;
+    }
+    value->assign(message->data(), size);
+    message->remove_prefix(size);
+    return true;
+}
+
+static bool DeserializeUevent(std::string_view message, Uevent* uevent) {
+    return ReadInt(&message, &uevent->partition_num) && ReadInt(&message, &uevent->major) &&
+           ReadInt(&message, &uevent->minor) && ReadString(&message, &uevent->action) &&
+           ReadString(&message, &uevent->path) && ReadString(&message, &uevent->subsystem) &&
+           ReadString(&message, &uevent->firmware) &&
+           ReadString(&message, &uevent->partition_name) &&
+           ReadString(&message, &uevent->device_name) && message.empty();
+}
+
+void ColdBoot::UeventHandlerMain(int uevent_socket) {
+    char message[kMaxUeventMessageSize];
+    while (true) {
+        ssize_t size = TEMP_FAILURE_RETRY(recv(uevent_socket, message, sizeof(message), 0));
+        // The main process has regenerated every uevent and closed its end.
+        if (size == 0) break;
+        if (size < 0) {
+            PLOG(FATAL) << "recv() of uevent failed";
+        }
+
+        Uevent uevent;
+        if (!DeserializeUevent(std::string_view(message, size), &uevent)) {
+            LOG(ERROR) << "Discarding malformed uevent message of " << size << " bytes";
+            continue;
+        }
+        HandleFirmwareEvent(uevent);
         device_handler_.HandleDeviceEvent(uevent);
     }
+
+    auto now = boot_clock::now().time_since_epoch().count();
+    auto handled_time = handler_state_->handled_time.load();
+    while (handled_time < now &&
+           !handler_state_->handled_time.compare_exchange_weak(handled_time, now)) {
+    }
     _exit(EXIT_SUCCESS);
 }
 
 void ColdBoot::RegenerateUevents() {
-    uevent_listener_.RegenerateUevents([this](const Uevent& uevent) {
-        HandleFirmwareEvent(uevent);
+    uevent_listener_.RegenerateUeventsInParallel(
+        [this](const Uevent& uevent) {
+            std::string message = SerializeUevent(uevent);
+            // Blocks while the subprocesses are behind, which keeps the netlink socket from
+            // overrunning just like handling the uevents here would.
+            if (TEMP_FAILURE_RETRY(send(uevent_socket_, message.data(), message.size(),
+                                        MSG_NOSIGNAL)) == -1) {
+                PLOG(FATAL) << "send() of uevent failed";
+            }
+            return ListenerAction::kContinue;
+        },
+        num_handler_subprocesses_);
 
-        uevent_queue_.emplace_back(std::move(uevent));
-        return ListenerAction::kContinue;
-    });
+    // Lets the subprocesses exit once they have taken every uevent.
+    uevent_socket_.reset();
 }
 
 void ColdBoot::ForkSubProcesses() {
+    void* state = mmap(nullptr, sizeof(HandlerState), PROT_READ | PROT_WRITE,
+                       MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (state == MAP_FAILED) {
+        PLOG(FATAL) << "mmap() failed!";
+    }
+    handler_state_ = new (state) HandlerState{{0}};
+
+    int sockets[2];
+    if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, sockets) == -1) {
+        PLOG(FATAL) << "socketpair() failed!";
+    }
+    uevent_socket_.reset(sockets[0]);
+    android::base::unique_fd handler_socket(sockets[1]);
+
     for (unsigned int i = 0; i < num_handler_subprocesses_; ++i) {
         auto pid = fork();
         if (pid < 0) {
@@ -153,7 +274,8 @@ void ColdBoot::ForkSubProcesses() {
         }
 
         if (pid == 0) {
-            UeventHandlerMain(i, num_handler_subprocesses_);
+            uevent_socket_.reset();
+            UeventHandlerMain(handler_socket);
         }
 
         subprocess_pids_.emplace(pid);
@@ -161,7 +283,7 @@ void ColdBoot::ForkSubProcesses() {
 }
 
 void ColdBoot::DoRestoreCon() {
-    selinux_android_restorecon("/sys", SELINUX_ANDROID_RESTORECON_RECURSE);
+    restorecon_recursive_parallel("/sys", 0, num_handler_subprocesses_);
     device_handler_.set_skip_restorecon(false);
 }
 
@@ -198,19 +320,51 @@ void ColdBoot::WaitForSubProcesses() {
     }
 }
 
+// Writes one "<step> <milliseconds>" line per cold boot step into COLDBOOT_DONE, which is
+// renamed into place so that init never sees it half written.
+void ColdBoot::WriteColdBootDone() {
+    std::string timings = android::base::StringPrintf(
+        "regenerate %lld\nhandle %lld\nrestorecon %lld\n",
+        static_cast<long long>(regenerate_duration_.count()),
+        static_cast<long long>(handle_duration_.count()),
+        static_cast<long long>(restorecon_duration_.count()));
+
+    std::string tmp_path = COLDBOOT_DONE ".tmp";
+    android::base::unique_fd fd(
+        open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0000));
+    if (fd == -1 || !android::base::WriteStringToFd(timings, fd) ||
+        rename(tmp_path.c_str(), COLDBOOT_DONE) == -1) {
+        PLOG(ERROR) << "Could not write the cold boot timings";
+        close(open(COLDBOOT_DONE, O_WRONLY | O_CREAT | O_CLOEXEC, 0000));
+    }
+}
+
 void ColdBoot::Run() {
     android::base::Timer cold_boot_timer;
 
-    RegenerateUevents();
-
+    auto handle_start = boot_clock::now();
     ForkSubProcesses();
 
+    android::base::Timer regenerate_timer;
+    RegenerateUevents();
+    regenerate_duration_ = regenerate_timer.duration();
+
+    android::base::Timer restorecon_timer;
     DoRestoreCon();
+    restorecon_duration_ = restorecon_timer.duration();
 
     WaitForSubProcesses();
-
-    close(open(COLDBOOT_DONE, O_WRONLY | O_CREAT | O_CLOEXEC, 0000));
-    LOG(INFO) << "Coldboot took " << cold_boot_timer.duration().count() / 1000.0f << " seconds";
+    handle_duration_ = std::chrono::duration_cast<std::chrono::milliseconds>(
+        boot_clock::time_point(boot_clock::duration(handler_state_->handled_time.load())) -
+        handle_start);
+    munmap(handler_state_, sizeof(HandlerState));
+    handler_state_ = nullptr;
+
+    WriteColdBootDone();
+    LOG(INFO) << "Coldboot took " << cold_boot_timer.duration().count() / 1000.0f << " seconds"
+              << " (regenerate " << regenerate_duration_.count() << "ms, handle "
+              << handle_duration_.count() << "ms, restorecon " << restorecon_duration_.count()
+              << "ms)";
 }
 
 DeviceHandler CreateDeviceHandler() {
@@ -264,6 +418,10 @@ int ueventd_main(int argc, char** argv) {
     DeviceHandler device_handler = CreateDeviceHandler();
     UeventListener uevent_listener;
 
+    // Before cold boot starts any threads, and so that its subprocesses hand firmware requests
+    // to the loader too.
+    StartFirmwareLoader();
+
     if (access(COLDBOOT_DONE, F_OK) != 0) {
         ColdBoot cold_boot(uevent_listener, device_handler);
         cold_boot.Run();
@@ -17,19 +17,27 @@
 #include "util.h"
 
 #include <ctype.h>
+#include <dirent.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <poll.h>
 #include <pwd.h>
 #include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/inotify.h>
 #include <sys/socket.h>
 #include <sys/un.h>
 #include <time.h>
 #include <unistd.h>
 
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <mutex>
 #include <thread>
+#include <vector>
 
 #include <android-base/file.h>
 #include <android-base/logging.h>
@@ -225,15 +233,76 @@ int mkdir_recursive(const std::string& path, mode_t mode, selabel_handle* sehand
     return 0;
 }
 
+FileWaiter::FileWaiter(const std::string& path)
+    : path_(path), inotify_fd_(inotify_init1(IN_CLOEXEC | IN_NONBLOCK)) {
+    if (inotify_fd_ == -1) {
+        PLOG(ERROR) << "inotify_init1 failed, polling for " << path_;
+    }
+}
+
+bool FileWaiter::Exists() {
+    // The events only say that something changed, it's simpler to look again. Only a watch
+    // that went away, with its directory, needs to be noticed.
+    alignas(inotify_event) char buf[4096];
+    ssize_t n;
+    while (inotify_fd_ != -1 && (n = read(inotify_fd_, buf, sizeof(buf))) > 0) {
+        for (char* p = buf; p < buf + n;) {
+            auto event = reinterpret_cast<inotify_event*>(p);
+            if (event->wd == watch_ && (event->mask & IN_IGNORED)) {
+                watch_ = -1;
+                watched_dir_.clear();
+            }
+            p += sizeof(inotify_event) + event->len;
+        }
+    }
+
+    struct stat sb;
+    while (stat(path_.c_str(), &sb) == -1) {
+        if (inotify_fd_ == -1) return false;
+
+        std::string dir = path_;
+        do {
+            size_t slash = dir.find_last_of('/');
+            dir = slash == 0 || slash == std::string::npos ? "/" : dir.substr(0, slash);
+        } while (dir != "/" && stat(dir.c_str(), &sb) == -1);
+        if (dir == watched_dir_) return false;
+
+        if (watch_ != -1) inotify_rm_watch(inotify_fd_, watch_);
+        watched_dir_ = dir;
+        watch_ = inotify_add_watch(inotify_fd_, dir.c_str(),
+                                   IN_CREATE | IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF);
+        if (watch_ == -1) {
+            PLOG(ERROR) << "inotify_add_watch(" << dir << ") failed, polling for " << path_;
+            inotify_fd_.reset();
+            return false;
+        }
+        // Whatever was created before the watch was added won't have an event, so look again.
+    }
+    return true;
+}
+
+std::chrono::milliseconds FileWaiter::recheck_interval() const {
+    if (inotify_fd_ == -1 || android::base::StartsWith(path_, "/sys/") ||
+        android::base::StartsWith(path_, "/proc/")) {
+        return 10ms;
+    }
+    return 100ms;
+}
+
 int wait_for_file(const char* filename, std::chrono::nanoseconds timeout) {
     boot_clock::time_point timeout_time = boot_clock::now() + timeout;
-    while (boot_clock::now() < timeout_time) {
-        struct stat sb;
-        if (stat(filename, &sb) != -1) return 0;
-
-        std::this_thread::sleep_for(10ms);
+    FileWaiter waiter(filename);
+    while (!waiter.Exists()) {
+        boot_clock::time_point now = boot_clock::now();
+        if (now >= timeout_time) return -1;
+
+        auto wait = std::min(std::chrono::duration_cast<std::chrono::milliseconds>(
+                                     timeout_time - now) + 1ms,
+                             waiter.recheck_interval());
+        pollfd pfd = {waiter.fd(), POLLIN, 0};
+        TEMP_FAILURE_RETRY(poll(&pfd, waiter.fd() == -1 ? 0 : 1, wait.count()));
     }
-    return -1;
+    return 0;
 }
 
 void import_kernel_cmdline(bool in_qemu,
@@ -292,6 +361,71 @@ bool is_dir(const char* pathname) {
     return S_ISDIR(info.st_mode);
 }
 
+// Labels |path| itself on the calling thread, and hands each directory right under it to a pool
+// of threads that restorecon them recursively.  Mount points are only relabeled themselves,
+// unless |flags| has SELINUX_ANDROID_RESTORECON_CROSS_FILESYSTEMS, as fts would do.
+int restorecon_recursive_parallel(const std::string& path, unsigned int flags,
+                                  unsigned int num_threads) {
+    flags &= ~SELINUX_ANDROID_RESTORECON_RECURSE;
+
+    std::unique_ptr<DIR, decltype(&closedir)> dir(opendir(path.c_str()), closedir);
+    struct stat root_stat;
+    if (!dir || fstat(dirfd(dir.get()), &root_stat) == -1) {
+        // Not a directory, or one we can't read; let libselinux decide what to do with it.
+        return selinux_android_restorecon(path.c_str(), flags | SELINUX_ANDROID_RESTORECON_RECURSE);
+    }
+
+    std::mutex errno_lock;
+    int first_errno = 0;
+    auto restorecon = [&](const std::string& path, unsigned int flags) {
+        if (selinux_android_restorecon(path.c_str(), flags) < 0) {
+            std::lock_guard<std::mutex> lock(errno_lock);
+            if (first_errno == 0) first_errno = errno;
+        }
+    };
+
+    restorecon(path, flags);
+
+    std::vector<std::string> subdirs;
+    dirent* de;
+    while ((de = readdir(dir.get())) != nullptr) {
+        if (!strcmp(de->d_name, ".") || !strcmp(de->d_name, "..")) continue;
+
+        std::string child = path + "/" + de->d_name;
+        struct stat child_stat;
+        if (de->d_type != DT_DIR ||
+            fstatat(dirfd(dir.get()), de->d_name, &child_stat, AT_SYMLINK_NOFOLLOW) == -1 ||
+            (!(flags & SELINUX_ANDROID_RESTORECON_CROSS_FILESYSTEMS) &&
+             child_stat.st_dev != root_stat.st_dev)) {
+            restorecon(child, flags);
+        } else {
+            subdirs.emplace_back(std::move(child));
+        }
+    }
+
+    std::atomic<size_t> next_subdir = 0;
+    auto worker = [&] {
+        size_t i;
+        while ((i = next_subdir.fetch_add(1)) < subdirs.size()) {
+            restorecon(subdirs[i], flags | SELINUX_ANDROID_RESTORECON_RECURSE);
+        }
+    };
+    std::vector<std::thread> threads;
+    for (unsigned int i = 1; i < std::min<size_t>(num_threads, subdirs.size()); ++i) {
+        threads.emplace_back(worker);
+    }
+    worker();
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    if (first_errno != 0) {
+        errno = first_errno;
+        return -1;
+    }
+    return 0;
+}
+
 bool expand_props(const std::string& src, std::string* dst) {
     const char* src_ptr = src.c_str();
 
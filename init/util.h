@@ -26,6 +26,7 @@
 #include <string>
 
 #include <android-base/chrono_utils.h>
+#include <android-base/unique_fd.h>
 #include <selinux/label.h>
 
 #define COLDBOOT_DONE "/dev/.coldboot_done"
@@ -46,11 +47,40 @@ bool DecodeUid(const std::string& name, uid_t* uid, std::string* err);
 
 int mkdir_recursive(const std::string& pathname, mode_t mode, selabel_handle* sehandle);
 int wait_for_file(const char *filename, std::chrono::nanoseconds timeout);
+
+// Tells when |path| appears, using inotify on the closest of its parents that exists, so that
+// waiting for it doesn't have to poll. Exists() has to be called again every time fd() becomes
+// readable, and at least every recheck_interval(), which covers what inotify can't see: files
+// in sysfs and procfs, and paths through symbolic links whose target doesn't exist yet.
+class FileWaiter {
+  public:
+    explicit FileWaiter(const std::string& path);
+
+    bool Exists();
+
+    // -1 if inotify isn't available, in which case Exists() has to be polled.
+    int fd() const { return inotify_fd_; }
+    std::chrono::milliseconds recheck_interval() const;
+    const std::string& path() const { return path_; }
+
+  private:
+    std::string path_;
+    android::base::unique_fd inotify_fd_;
+    std::string watched_dir_;
+    int watch_ = -1;
+};
+
 void import_kernel_cmdline(bool in_qemu,
                            const std::function<void(const std::string&, const std::string&, bool)>&);
 int make_dir(const char* path, mode_t mode, selabel_handle* sehandle);
 std::string bytes_to_hex(const uint8_t *bytes, size_t bytes_len);
 bool is_dir(const char* pathname);
+// selinux_android_restorecon() of |path| with SELINUX_ANDROID_RESTORECON_RECURSE added to |flags|,
+// spread over |num_threads| threads.  Only meant for trees such as /sys that libselinux doesn't
+// record a restorecon_last digest for, since the digest would be set on each subdirectory
+// instead of on |path|.
+int restorecon_recursive_parallel(const std::string& path, unsigned int flags,
+                                  unsigned int num_threads);
 bool expand_props(const std::string& src, std::string* dst);
 
 void panic() __attribute__((__noreturn__));
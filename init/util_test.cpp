@@ -18,8 +18,12 @@
 
 #include <errno.h>
 #include <fcntl.h>
+#include <poll.h>
 #include <sys/stat.h>
 
+#include <thread>
+
+#include <android-base/file.h>
 #include <android-base/stringprintf.h>
 #include <android-base/test_utils.h>
 #include <gtest/gtest.h>
@@ -191,5 +195,39 @@ TEST(util, mkdir_recursive_extra_slashes) {
     EXPECT_TRUE(is_dir(path1.c_str()));
 }
 
+TEST(util, FileWaiter) {
+    TemporaryDir test_dir;
+    std::string dir = android::base::StringPrintf("%s/two/directories", test_dir.path);
+    std::string path = dir + "/file";
+    FileWaiter waiter(path);
+    ASSERT_NE(-1, waiter.fd());
+    EXPECT_FALSE(waiter.Exists());
+
+    // Every directory on the way has to be noticed, for the watch to move down to it.
+    ASSERT_EQ(0, mkdir_recursive(dir, 0755, nullptr));
+    pollfd pfd = {waiter.fd(), POLLIN, 0};
+    ASSERT_EQ(1, poll(&pfd, 1, 1000));
+    EXPECT_FALSE(waiter.Exists());
+
+    ASSERT_TRUE(android::base::WriteStringToFile("", path));
+    ASSERT_EQ(1, poll(&pfd, 1, 1000));
+    EXPECT_TRUE(waiter.Exists());
+}
+
+TEST(util, wait_for_file) {
+    TemporaryDir test_dir;
+    std::string path = android::base::StringPrintf("%s/dir/file", test_dir.path);
+    EXPECT_EQ(-1, wait_for_file(path.c_str(), 10ms));
+
+    std::thread creator([&]() {
+        std::this_thread::sleep_for(50ms);
+        mkdir_recursive(android::base::StringPrintf("%s/dir", test_dir.path), 0755, nullptr);
+        android::base::WriteStringToFile("", path);
+    });
+    EXPECT_EQ(0, wait_for_file(path.c_str(), 10s));
+    creator.join();
+    EXPECT_EQ(0, wait_for_file(path.c_str(), 0s));
+}
+
 }  // namespace init
 }  // namespace android
@@ -19,6 +19,8 @@
 #include <sys/eventfd.h>
 #include <sys/stat.h>
 
+#include <algorithm>
+
 #include <android-base/logging.h>
 #include <android-base/unique_fd.h>
 
@@ -85,12 +87,19 @@ bool HandleWrite(FuseAppLoop* loop, FuseBuffer* buffer, FuseAppLoopCallback* cal
     return true;
 }
 
-bool HandleMessage(FuseAppLoop* loop, FuseBuffer* buffer, int fd, FuseAppLoopCallback* callback) {
-    if (!buffer->request.Read(fd)) {
-        return false;
-    }
+} // namespace
+
+FuseAppLoopCallback::~FuseAppLoopCallback() = default;
+
+FuseAppLoop::FuseAppLoop(base::unique_fd&& fd, size_t max_in_flight)
+    : fd_(std::move(fd)), max_in_flight_(std::max<size_t>(max_in_flight, 1)), breaking_(false) {}
 
-    const uint32_t opcode = buffer->request.header.opcode;
+bool FuseAppLoop::HandleMessage(std::unique_ptr<FuseBuffer>* buffer,
+                                FuseAppLoopCallback* callback) {
+    // A request waiting for a reply takes |buffer| with it until it is replied
+    // to, which the callback may do before returning. Otherwise it is reused.
+    FuseBuffer* const request = buffer->get();
+    const uint32_t opcode = request->request.header.opcode;
     LOG(VERBOSE) << "Read a fuse packet, opcode=" << opcode;
     switch (opcode) {
         case FUSE_FORGET:
@@ -98,42 +107,90 @@ bool HandleMessage(FuseAppLoop* loop, FuseBuffer* buffer, int fd, FuseAppLoopCal
             return true;
 
         case FUSE_LOOKUP:
-            return HandleLookUp(loop, buffer, callback);
+            return AddInFlight(std::move(*buffer)) && HandleLookUp(this, request, callback);
 
         case FUSE_GETATTR:
-            return HandleGetAttr(loop, buffer, callback);
+            return AddInFlight(std::move(*buffer)) && HandleGetAttr(this, request, callback);
 
         case FUSE_OPEN:
-            callback->OnOpen(buffer->request.header.unique, buffer->request.header.nodeid);
+            if (!AddInFlight(std::move(*buffer))) {
+                return false;
+            }
+            callback->OnOpen(request->request.header.unique, request->request.header.nodeid);
             return true;
 
         case FUSE_READ:
-            return HandleRead(loop, buffer, callback);
+            return AddInFlight(std::move(*buffer)) && HandleRead(this, request, callback);
 
         case FUSE_WRITE:
-            return HandleWrite(loop, buffer, callback);
+            return AddInFlight(std::move(*buffer)) && HandleWrite(this, request, callback);
 
         case FUSE_RELEASE:
-            callback->OnRelease(buffer->request.header.unique, buffer->request.header.nodeid);
+            if (!AddInFlight(std::move(*buffer))) {
+                return false;
+            }
+            callback->OnRelease(request->request.header.unique, request->request.header.nodeid);
             return true;
 
         case FUSE_FSYNC:
-            callback->OnFsync(buffer->request.header.unique, buffer->request.header.nodeid);
+            if (!AddInFlight(std::move(*buffer))) {
+                return false;
+            }
+            callback->OnFsync(request->request.header.unique, request->request.header.nodeid);
             return true;
 
         default:
-            buffer->HandleNotImpl();
-            return buffer->response.Write(fd);
+            request->HandleNotImpl();
+            return request->response.Write(fd_);
     }
 }
 
-} // namespace
+std::unique_ptr<FuseBuffer> FuseAppLoop::AcquireBuffer() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (spare_buffers_.empty()) {
+        return std::unique_ptr<FuseBuffer>(new FuseBuffer);
+    }
+    std::unique_ptr<FuseBuffer> buffer = std::move(spare_buffers_.back());
+    spare_buffers_.pop_back();
+    return buffer;
+}
 
-FuseAppLoopCallback::~FuseAppLoopCallback() = default;
+bool FuseAppLoop::AddInFlight(std::unique_ptr<FuseBuffer> buffer) {
+    const uint64_t unique = buffer->request.header.unique;
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!in_flight_.emplace(unique, std::move(buffer)).second) {
+        LOG(ERROR) << "Received a request whose unique is already in flight: unique=" << unique;
+        return false;
+    }
+    return true;
+}
+
+bool FuseAppLoop::RetireRequest(uint64_t unique) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = in_flight_.find(unique);
+    if (it == in_flight_.end()) {
+        LOG(ERROR) << "Tried to reply to a request which is not in flight: unique=" << unique;
+        return false;
+    }
+    spare_buffers_.push_back(std::move(it->second));
+    in_flight_.erase(it);
+    window_cv_.notify_one();
+    return true;
+}
 
-FuseAppLoop::FuseAppLoop(base::unique_fd&& fd) : fd_(std::move(fd)) {}
+bool FuseAppLoop::WaitForWindow() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    window_cv_.wait(lock, [this] { return in_flight_.size() < max_in_flight_ || breaking_; });
+    return !breaking_;
+}
 
 void FuseAppLoop::Break() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        breaking_ = true;
+    }
+    window_cv_.notify_one();
+
     const int64_t value = 1;
     if (write(break_fd_, &value, sizeof(value)) == -1) {
         PLOG(ERROR) << "Failed to send a break event";
@@ -146,12 +203,18 @@ bool FuseAppLoop::ReplySimple(uint64_t unique, int32_t result) {
         // command after receiving -ENOSYS as a result for the command.
         result = -EBADF;
     }
+    if (!RetireRequest(unique)) {
+        return false;
+    }
     FuseSimpleResponse response;
     response.Reset(0, result, unique);
     return response.Write(fd_);
 }
 
 bool FuseAppLoop::ReplyLookup(uint64_t unique, uint64_t inode, int64_t size) {
+    if (!RetireRequest(unique)) {
+        return false;
+    }
     FuseSimpleResponse response;
     response.Reset(sizeof(fuse_entry_out), 0, unique);
     response.entry_out.nodeid = inode;
@@ -165,6 +228,9 @@ bool FuseAppLoop::ReplyLookup(uint64_t unique, uint64_t inode, int64_t size) {
 
 bool FuseAppLoop::ReplyGetAttr(uint64_t unique, uint64_t inode, int64_t size, int mode) {
     CHECK(mode == (S_IFREG | 0777) || mode == (S_IFDIR | 0777));
+    if (!RetireRequest(unique)) {
+        return false;
+    }
     FuseSimpleResponse response;
     response.Reset(sizeof(fuse_attr_out), 0, unique);
     response.attr_out.attr_valid = 10;
@@ -175,6 +241,9 @@ bool FuseAppLoop::ReplyGetAttr(uint64_t unique, uint64_t inode, int64_t size, in
 }
 
 bool FuseAppLoop::ReplyOpen(uint64_t unique, uint64_t fh) {
+    if (!RetireRequest(unique)) {
+        return false;
+    }
     FuseSimpleResponse response;
     response.Reset(sizeof(fuse_open_out), kFuseSuccess, unique);
     response.open_out.fh = fh;
@@ -183,6 +252,9 @@ bool FuseAppLoop::ReplyOpen(uint64_t unique, uint64_t fh) {
 
 bool FuseAppLoop::ReplyWrite(uint64_t unique, uint32_t size) {
     CHECK(size <= kFuseMaxWrite);
+    if (!RetireRequest(unique)) {
+        return false;
+    }
     FuseSimpleResponse response;
     response.Reset(sizeof(fuse_write_out), kFuseSuccess, unique);
     response.write_out.size = size;
@@ -191,6 +263,9 @@ bool FuseAppLoop::ReplyWrite(uint64_t unique, uint32_t size) {
 
 bool FuseAppLoop::ReplyRead(uint64_t unique, uint32_t size, const void* data) {
     CHECK(size <= kFuseMaxRead);
+    if (!RetireRequest(unique)) {
+        return false;
+    }
     FuseSimpleResponse response;
     response.ResetHeader(size, kFuseSuccess, unique);
     return response.WriteWithBody(fd_, sizeof(FuseResponse), data);
@@ -223,8 +298,11 @@ void FuseAppLoop::Start(FuseAppLoopCallback* callback) {
     last_event = 0;
     break_event = 0;
 
-    FuseBuffer buffer;
+    std::unique_ptr<FuseBuffer> buffer;
     while (true) {
+        if (!WaitForWindow()) {
+            break;
+        }
         if (!epoll_controller->Wait(1)) {
             break;
         }
@@ -236,7 +314,13 @@ void FuseAppLoop::Start(FuseAppLoopCallback* callback) {
             break;
         }
 
-        if (!HandleMessage(this, &buffer, fd_, callback)) {
+        if (!buffer) {
+            buffer = AcquireBuffer();
+        }
+        if (!buffer->request.Read(fd_)) {
+            break;
+        }
+        if (!HandleMessage(&buffer, callback)) {
             break;
         }
     }
@@ -17,9 +17,14 @@
 #include "libappfuse/FuseBridgeLoop.h"
 
 #include <sys/epoll.h>
+#include <sys/eventfd.h>
 #include <sys/socket.h>
 
+#include <algorithm>
+#include <deque>
+#include <thread>
 #include <unordered_map>
+#include <vector>
 
 #include <android-base/logging.h>
 #include <android-base/unique_fd.h>
@@ -30,54 +35,51 @@ namespace android {
 namespace fuse {
 namespace {
 
-enum class FuseBridgeState { kWaitToReadEither, kWaitToReadProxy, kWaitToWriteProxy, kClosing };
+// Requests read from the device while the proxy socket is full wait in a
+// queue of at most this many instead of stalling the device.
+constexpr size_t kMaxQueuedRequests = 4;
+
+// Responses forwarded per wakeup, so that one busy proxy can't starve the other
+// bridges on the same thread.
+constexpr int kMaxResponsesPerTransfer = 8;
 
 struct FuseBridgeEntryEvent {
     FuseBridgeEntry* entry;
     int events;
 };
 
-void GetObservedEvents(FuseBridgeState state, int* device_events, int* proxy_events) {
-    switch (state) {
-        case FuseBridgeState::kWaitToReadEither:
-            *device_events = EPOLLIN;
-            *proxy_events = EPOLLIN;
-            return;
-        case FuseBridgeState::kWaitToReadProxy:
-            *device_events = 0;
-            *proxy_events = EPOLLIN;
-            return;
-        case FuseBridgeState::kWaitToWriteProxy:
-            *device_events = 0;
-            *proxy_events = EPOLLOUT;
-            return;
-        case FuseBridgeState::kClosing:
-            *device_events = 0;
-            *proxy_events = 0;
-            return;
-    }
-}
-
 void LogResponseError(const std::string& message, const FuseResponse& response) {
     LOG(ERROR) << message << ": header.len=" << response.header.len
                << " header.error=" << response.header.error
                << " header.unique=" << response.header.unique;
 }
+
+void LogRequestError(const std::string& message, const FuseRequest& request) {
+    LOG(ERROR) << message << ":"
+               << " header.len=" << request.header.len
+               << " header.opcode=" << request.header.opcode
+               << " header.unique=" << request.header.unique
+               << " header.nodeid=" << request.header.nodeid;
+}
 }
 
 class FuseBridgeEntry {
   public:
-    FuseBridgeEntry(int mount_id, base::unique_fd&& dev_fd, base::unique_fd&& proxy_fd)
+    FuseBridgeEntry(int mount_id, size_t thread_index, base::unique_fd&& dev_fd,
+                    base::unique_fd&& proxy_fd)
         : mount_id_(mount_id),
+          thread_index_(thread_index),
           device_fd_(std::move(dev_fd)),
           proxy_fd_(std::move(proxy_fd)),
-          state_(FuseBridgeState::kWaitToReadEither),
-          last_state_(FuseBridgeState::kWaitToReadEither),
+          closing_(false),
+          registered_device_events_(0),
+          registered_proxy_events_(0),
           last_device_events_({this, 0}),
           last_proxy_events_({this, 0}),
+          request_buffer_(new FuseBuffer),
           open_count_(0) {}
 
-    // Transfer bytes depends on availability of FDs and the internal |state_|.
+    // Transfer bytes depends on availability of FDs and the internal queue.
     void Transfer(FuseBridgeLoopCallback* callback) {
         constexpr int kUnexpectedEventMask = ~(EPOLLIN | EPOLLOUT);
         const bool unexpected_event = (last_device_events_.events & kUnexpectedEventMask) ||
@@ -91,65 +93,77 @@ class FuseBridgeEntry {
 
         LOG(VERBOSE) << "Transfer device_read_ready=" << device_read_ready
                      << " proxy_read_ready=" << proxy_read_ready
-                     << " proxy_write_ready=" << proxy_write_ready;
+                     << " proxy_write_ready=" << proxy_write_ready
+                     << " queued=" << queue_.size();
 
         if (unexpected_event) {
             LOG(ERROR) << "Invalid epoll event is observed";
-            state_ = FuseBridgeState::kClosing;
+            closing_ = true;
             return;
         }
 
-        switch (state_) {
-            case FuseBridgeState::kWaitToReadEither:
-                if (proxy_read_ready) {
-                    state_ = ReadFromProxy();
-                } else if (device_read_ready) {
-                    state_ = ReadFromDevice(callback);
-                }
-                return;
-
-            case FuseBridgeState::kWaitToReadProxy:
-                CHECK(proxy_read_ready);
-                state_ = ReadFromProxy();
-                return;
-
-            case FuseBridgeState::kWaitToWriteProxy:
-                CHECK(proxy_write_ready);
-                state_ = WriteToProxy();
-                return;
-
-            case FuseBridgeState::kClosing:
-                return;
+        // Responses go first: they retire requests and never wait for the proxy.
+        if (proxy_read_ready) {
+            ReadFromProxy();
+        }
+        if (proxy_write_ready && !closing_) {
+            WriteToProxy();
+        }
+        if (device_read_ready && !closing_ && queue_.size() < kMaxQueuedRequests) {
+            ReadFromDevice(callback);
         }
     }
 
-    bool IsClosing() const { return state_ == FuseBridgeState::kClosing; }
+    bool IsClosing() const { return closing_; }
 
     int mount_id() const { return mount_id_; }
 
+    size_t thread_index() const { return thread_index_; }
+
   private:
     friend class BridgeEpollController;
 
-    FuseBridgeState ReadFromProxy() {
-        switch (buffer_.response.ReadOrAgain(proxy_fd_)) {
-            case ResultOrAgain::kSuccess:
-                break;
-            case ResultOrAgain::kFailure:
-                return FuseBridgeState::kClosing;
-            case ResultOrAgain::kAgain:
-                return FuseBridgeState::kWaitToReadProxy;
+    // The device is read only while there is room in the queue, and the proxy
+    // is written only while there is something in it.
+    int device_events() const {
+        return closing_ || queue_.size() >= kMaxQueuedRequests ? 0 : EPOLLIN;
+    }
+
+    int proxy_events() const {
+        return closing_ ? 0 : EPOLLIN | (queue_.empty() ? 0 : EPOLLOUT);
+    }
+
+    void ReadFromProxy() {
+        for (int i = 0; i < kMaxResponsesPerTransfer; ++i) {
+            switch (response_.ReadOrAgain(proxy_fd_)) {
+                case ResultOrAgain::kSuccess:
+                    break;
+                case ResultOrAgain::kFailure:
+                    closing_ = true;
+                    return;
+                case ResultOrAgain::kAgain:
+                    return;
+            }
+            if (!ForwardResponse()) {
+                closing_ = true;
+                return;
+            }
         }
+    }
 
-        if (!buffer_.response.Write(device_fd_)) {
-            LogResponseError("Failed to write a reply from proxy to device", buffer_.response);
-            return FuseBridgeState::kClosing;
+    // Writes |response_| to the device. Returns false if the bridge should be
+    // closed, either on error or after the last file was released.
+    bool ForwardResponse() {
+        if (!response_.Write(device_fd_)) {
+            LogResponseError("Failed to write a reply from proxy to device", response_);
+            return false;
         }
 
-        auto it = opcode_map_.find(buffer_.response.header.unique);
+        auto it = opcode_map_.find(response_.header.unique);
         if (it != opcode_map_.end()) {
             switch (it->second) {
                 case FUSE_OPEN:
-                    if (buffer_.response.header.error == fuse::kFuseSuccess) {
+                    if (response_.header.error == fuse::kFuseSuccess) {
                         open_count_++;
                     }
                     break;
@@ -162,32 +176,34 @@ class FuseBridgeEntry {
                         break;
                     }
                     if (open_count_ == 0) {
-                        return FuseBridgeState::kClosing;
+                        return false;
                     }
                     break;
             }
             opcode_map_.erase(it);
         }
 
-        return FuseBridgeState::kWaitToReadEither;
+        return true;
     }
 
-    FuseBridgeState ReadFromDevice(FuseBridgeLoopCallback* callback) {
+    void ReadFromDevice(FuseBridgeLoopCallback* callback) {
         LOG(VERBOSE) << "ReadFromDevice";
-        if (!buffer_.request.Read(device_fd_)) {
-            return FuseBridgeState::kClosing;
+        FuseBuffer* const buffer = request_buffer_.get();
+        if (!buffer->request.Read(device_fd_)) {
+            closing_ = true;
+            return;
         }
 
-        const uint32_t opcode = buffer_.request.header.opcode;
-        const uint64_t unique = buffer_.request.header.unique;
+        const uint32_t opcode = buffer->request.header.opcode;
+        const uint64_t unique = buffer->request.header.unique;
         LOG(VERBOSE) << "Read a fuse packet, opcode=" << opcode << " unique=" << unique;
         if (unique == 0) {
-            return FuseBridgeState::kWaitToReadEither;
+            return;
         }
         switch (opcode) {
             case FUSE_FORGET:
                 // Do not reply to FUSE_FORGET.
-                return FuseBridgeState::kWaitToReadEither;
+                return;
 
             case FUSE_LOOKUP:
             case FUSE_GETATTR:
@@ -197,56 +213,92 @@ class FuseBridgeEntry {
             case FUSE_RELEASE:
             case FUSE_FSYNC:
                 if (opcode == FUSE_OPEN || opcode == FUSE_RELEASE) {
-                    opcode_map_.emplace(buffer_.request.header.unique, opcode);
+                    opcode_map_.emplace(unique, opcode);
                 }
-                return WriteToProxy();
+                SendToProxy();
+                return;
 
             case FUSE_INIT:
-                buffer_.HandleInit();
+                buffer->HandleInit();
                 break;
 
             default:
-                buffer_.HandleNotImpl();
+                buffer->HandleNotImpl();
                 break;
         }
 
-        if (!buffer_.response.Write(device_fd_)) {
-            LogResponseError("Failed to write a response to device", buffer_.response);
-            return FuseBridgeState::kClosing;
+        if (!buffer->response.Write(device_fd_)) {
+            LogResponseError("Failed to write a response to device", buffer->response);
+            closing_ = true;
+            return;
         }
 
         if (opcode == FUSE_INIT) {
             callback->OnMount(mount_id_);
         }
+    }
 
-        return FuseBridgeState::kWaitToReadEither;
+    // Sends the request just read from the device to the proxy, or queues it
+    // behind the ones still waiting for the proxy to drain its socket.
+    void SendToProxy() {
+        if (queue_.empty()) {
+            switch (request_buffer_->request.WriteOrAgain(proxy_fd_)) {
+                case ResultOrAgain::kSuccess:
+                    return;
+                case ResultOrAgain::kFailure:
+                    LogRequestError("Failed to write a request to proxy", request_buffer_->request);
+                    closing_ = true;
+                    return;
+                case ResultOrAgain::kAgain:
+                    break;
+            }
+        }
+
+        queue_.push_back(std::move(request_buffer_));
+        if (spare_buffers_.empty()) {
+            request_buffer_.reset(new FuseBuffer);
+        } else {
+            request_buffer_ = std::move(spare_buffers_.back());
+            spare_buffers_.pop_back();
+        }
     }
 
-    FuseBridgeState WriteToProxy() {
-        switch (buffer_.request.WriteOrAgain(proxy_fd_)) {
-            case ResultOrAgain::kSuccess:
-                return FuseBridgeState::kWaitToReadEither;
-            case ResultOrAgain::kFailure:
-                LOG(ERROR) << "Failed to write a request to proxy:"
-                           << " header.len=" << buffer_.request.header.len
-                           << " header.opcode=" << buffer_.request.header.opcode
-                           << " header.unique=" << buffer_.request.header.unique
-                           << " header.nodeid=" << buffer_.request.header.nodeid;
-                return FuseBridgeState::kClosing;
-            case ResultOrAgain::kAgain:
-                return FuseBridgeState::kWaitToWriteProxy;
+    void WriteToProxy() {
+        while (!queue_.empty()) {
+            switch (queue_.front()->request.WriteOrAgain(proxy_fd_)) {
+                case ResultOrAgain::kSuccess:
+                    break;
+                case ResultOrAgain::kFailure:
+                    LogRequestError("Failed to write a request to proxy", queue_.front()->request);
+                    closing_ = true;
+                    return;
+                case ResultOrAgain::kAgain:
+                    return;
+            }
+            spare_buffers_.push_back(std::move(queue_.front()));
+            queue_.pop_front();
         }
     }
 
     const int mount_id_;
+    const size_t thread_index_;
     base::unique_fd device_fd_;
     base::unique_fd proxy_fd_;
-    FuseBuffer buffer_;
-    FuseBridgeState state_;
-    FuseBridgeState last_state_;
+    bool closing_;
+    int registered_device_events_;
+    int registered_proxy_events_;
     FuseBridgeEntryEvent last_device_events_;
     FuseBridgeEntryEvent last_proxy_events_;
 
+    // Buffer the next request from the device is read into.
+    std::unique_ptr<FuseBuffer> request_buffer_;
+    FuseResponse response_;
+
+    // Requests waiting for the proxy, oldest first, and buffers that were
+    // queued before and can be reused.
+    std::deque<std::unique_ptr<FuseBuffer>> queue_;
+    std::vector<std::unique_ptr<FuseBuffer>> spare_buffers_;
+
     // Remember map between unique and opcode in fuse_in_header so that we can
     // refer the opcode later.
     std::unordered_map<uint64_t, uint32_t> opcode_map_;
@@ -265,13 +317,16 @@ class BridgeEpollController : private EpollController {
     }
 
     bool UpdateOrDeleteBridgePoll(FuseBridgeEntry* bridge) const {
-        return InvokeControl(
-            bridge->state_ != FuseBridgeState::kClosing ? EPOLL_CTL_MOD : EPOLL_CTL_DEL, bridge);
+        return InvokeControl(!bridge->closing_ ? EPOLL_CTL_MOD : EPOLL_CTL_DEL, bridge);
     }
 
+    // |fd| only interrupts Wait, it never shows up in its results.
+    bool AddWakePoll(int fd) { return AddFd(fd, EPOLLIN, nullptr); }
+
     bool Wait(size_t bridge_count, std::unordered_set<FuseBridgeEntry*>* entries_out) {
         CHECK(entries_out);
-        const size_t event_count = std::max<size_t>(bridge_count * 2, 1);
+        // Two FDs per bridge, and the one for waking up.
+        const size_t event_count = bridge_count * 2 + 1;
         if (!EpollController::Wait(event_count)) {
             return false;
         }
@@ -279,6 +334,9 @@ class BridgeEpollController : private EpollController {
         for (const auto& event : events()) {
             FuseBridgeEntryEvent* const entry_event =
                 reinterpret_cast<FuseBridgeEntryEvent*>(event.data.ptr);
+            if (entry_event == nullptr) {
+                continue;
+            }
             entry_event->events = event.events;
             entries_out->insert(entry_event->entry);
         }
@@ -287,37 +345,52 @@ class BridgeEpollController : private EpollController {
 
   private:
     bool InvokeControl(int op, FuseBridgeEntry* bridge) const {
+        const int device_events = bridge->device_events();
+        const int proxy_events = bridge->proxy_events();
         LOG(VERBOSE) << "InvokeControl op=" << op << " bridge=" << bridge->mount_id_
-                     << " state=" << static_cast<int>(bridge->state_)
-                     << " last_state=" << static_cast<int>(bridge->last_state_);
-
-        int last_device_events;
-        int last_proxy_events;
-        int device_events;
-        int proxy_events;
-        GetObservedEvents(bridge->last_state_, &last_device_events, &last_proxy_events);
-        GetObservedEvents(bridge->state_, &device_events, &proxy_events);
+                     << " device_events=" << device_events << " proxy_events=" << proxy_events;
+
         bool result = true;
-        if (op != EPOLL_CTL_MOD || last_device_events != device_events) {
+        if (op != EPOLL_CTL_MOD || bridge->registered_device_events_ != device_events) {
             result &= EpollController::InvokeControl(op, bridge->device_fd_, device_events,
                                                      &bridge->last_device_events_);
+            bridge->registered_device_events_ = device_events;
         }
-        if (op != EPOLL_CTL_MOD || last_proxy_events != proxy_events) {
+        if (op != EPOLL_CTL_MOD || bridge->registered_proxy_events_ != proxy_events) {
             result &= EpollController::InvokeControl(op, bridge->proxy_fd_, proxy_events,
                                                      &bridge->last_proxy_events_);
+            bridge->registered_proxy_events_ = proxy_events;
         }
         return result;
     }
 };
 
-FuseBridgeLoop::FuseBridgeLoop() : opened_(true) {
-    base::unique_fd epoll_fd(epoll_create1(/* no flag */ 0));
-    if (epoll_fd.get() == -1) {
-        PLOG(ERROR) << "Failed to open FD for epoll";
-        opened_ = false;
-        return;
+FuseBridgeLoop::FuseBridgeLoop(size_t threads) : opened_(true) {
+    threads = std::max<size_t>(threads, 1);
+    if (threads > 1) {
+        wake_fd_.reset(eventfd(0, EFD_CLOEXEC));
+        if (wake_fd_.get() == -1) {
+            PLOG(ERROR) << "Failed to open FD for waking up loop threads";
+            opened_ = false;
+            return;
+        }
+    }
+    for (size_t i = 0; i < threads; ++i) {
+        base::unique_fd epoll_fd(epoll_create1(/* no flag */ 0));
+        if (epoll_fd.get() == -1) {
+            PLOG(ERROR) << "Failed to open FD for epoll";
+            opened_ = false;
+            return;
+        }
+        std::unique_ptr<BridgeEpollController> controller(
+            new BridgeEpollController(std::move(epoll_fd)));
+        if (wake_fd_.get() != -1 && !controller->AddWakePoll(wake_fd_)) {
+            opened_ = false;
+            return;
+        }
+        epoll_controllers_.push_back(std::move(controller));
+        bridge_counts_.push_back(0);
     }
-    epoll_controller_.reset(new BridgeEpollController(std::move(epoll_fd)));
 }
 
 FuseBridgeLoop::~FuseBridgeLoop() { CHECK(bridges_.empty()); }
@@ -325,8 +398,6 @@ FuseBridgeLoop::~FuseBridgeLoop() { CHECK(bridges_.empty()); }
 bool FuseBridgeLoop::AddBridge(int mount_id, base::unique_fd dev_fd, base::unique_fd proxy_fd) {
     LOG(VERBOSE) << "Adding bridge " << mount_id;
 
-    std::unique_ptr<FuseBridgeEntry> bridge(
-        new FuseBridgeEntry(mount_id, std::move(dev_fd), std::move(proxy_fd)));
     std::lock_guard<std::mutex> lock(mutex_);
     if (!opened_) {
         LOG(ERROR) << "Tried to add a mount to a closed bridge";
@@ -336,25 +407,44 @@ bool FuseBridgeLoop::AddBridge(int mount_id, base::unique_fd dev_fd, base::uniqu
         LOG(ERROR) << "Tried to add a mount point that has already been added";
         return false;
     }
-    if (!epoll_controller_->AddBridgePoll(bridge.get())) {
+
+    // The thread with the fewest bridges takes this one.
+    const size_t index =
+        std::min_element(bridge_counts_.begin(), bridge_counts_.end()) - bridge_counts_.begin();
+    std::unique_ptr<FuseBridgeEntry> bridge(
+        new FuseBridgeEntry(mount_id, index, std::move(dev_fd), std::move(proxy_fd)));
+    if (!epoll_controllers_[index]->AddBridgePoll(bridge.get())) {
         return false;
     }
 
     bridges_.emplace(mount_id, std::move(bridge));
+    bridge_counts_[index]++;
     return true;
 }
 
-bool FuseBridgeLoop::ProcessEventLocked(const std::unordered_set<FuseBridgeEntry*>& entries,
-                                        FuseBridgeLoopCallback* callback) {
+void FuseBridgeLoop::StopLocked() {
+    opened_ = false;
+    if (wake_fd_.get() != -1 && eventfd_write(wake_fd_, 1) == -1) {
+        PLOG(ERROR) << "Failed to wake up loop threads";
+    }
+}
+
+bool FuseBridgeLoop::ProcessEvents(size_t index,
+                                   const std::unordered_set<FuseBridgeEntry*>& entries,
+                                   FuseBridgeLoopCallback* callback) {
     for (auto entry : entries) {
+        // Only this thread touches its entries, so the lock is needed just for
+        // closing them.
         entry->Transfer(callback);
-        if (!epoll_controller_->UpdateOrDeleteBridgePoll(entry)) {
+        if (!epoll_controllers_[index]->UpdateOrDeleteBridgePoll(entry)) {
             return false;
         }
         if (entry->IsClosing()) {
             const int mount_id = entry->mount_id();
+            std::lock_guard<std::mutex> lock(mutex_);
             callback->OnClosed(mount_id);
             bridges_.erase(mount_id);
+            bridge_counts_[index]--;
             if (bridges_.size() == 0) {
                 // All bridges are now closed.
                 return false;
@@ -364,23 +454,56 @@ bool FuseBridgeLoop::ProcessEventLocked(const std::unordered_set<FuseBridgeEntry
     return true;
 }
 
-void FuseBridgeLoop::Start(FuseBridgeLoopCallback* callback) {
-    LOG(DEBUG) << "Start fuse bridge loop";
+void FuseBridgeLoop::Run(size_t index, FuseBridgeLoopCallback* callback) {
     std::unordered_set<FuseBridgeEntry*> entries;
     while (true) {
-        const bool wait_result = epoll_controller_->Wait(bridges_.size(), &entries);
-        LOG(VERBOSE) << "Receive epoll events";
+        size_t bridge_count;
         {
             std::lock_guard<std::mutex> lock(mutex_);
-            if (!(wait_result && ProcessEventLocked(entries, callback))) {
-                for (auto it = bridges_.begin(); it != bridges_.end();) {
-                    callback->OnClosed(it->second->mount_id());
-                    it = bridges_.erase(it);
-                }
-                opened_ = false;
-                return;
+            if (!opened_) {
+                break;
             }
+            bridge_count = bridge_counts_[index];
+        }
+        const bool wait_result = epoll_controllers_[index]->Wait(bridge_count, &entries);
+        LOG(VERBOSE) << "Receive epoll events";
+        if (!(wait_result && ProcessEvents(index, entries, callback))) {
+            std::lock_guard<std::mutex> lock(mutex_);
+            StopLocked();
+            break;
+        }
+    }
+
+    // Every thread closes the bridges it was serving.
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (auto it = bridges_.begin(); it != bridges_.end();) {
+        if (it->second->thread_index() != index) {
+            ++it;
+            continue;
         }
+        callback->OnClosed(it->second->mount_id());
+        it = bridges_.erase(it);
+    }
+    bridge_counts_[index] = 0;
+}
+
+void FuseBridgeLoop::Start(FuseBridgeLoopCallback* callback) {
+    LOG(DEBUG) << "Start fuse bridge loop";
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!opened_) {
+            LOG(ERROR) << "Tried to start a closed bridge loop";
+            return;
+        }
+    }
+
+    std::vector<std::thread> threads;
+    for (size_t i = 1; i < epoll_controllers_.size(); ++i) {
+        threads.emplace_back(&FuseBridgeLoop::Run, this, i, callback);
+    }
+    Run(0, callback);
+    for (auto& thread : threads) {
+        thread.join();
     }
 }
 
@@ -17,8 +17,11 @@
 #ifndef ANDROID_LIBAPPFUSE_FUSEAPPLOOP_H_
 #define ANDROID_LIBAPPFUSE_FUSEAPPLOOP_H_
 
+#include <condition_variable>
 #include <memory>
 #include <mutex>
+#include <unordered_map>
+#include <vector>
 
 #include <android-base/unique_fd.h>
 
@@ -29,6 +32,14 @@ namespace fuse {
 
 class EpollController;
 
+// Requests handed to the callback and not replied to yet, unless the loop is
+// given another limit.
+constexpr size_t kDefaultMaxInFlightRequests = 16;
+
+// Callbacks are invoked on the thread running FuseAppLoop::Start. They don't
+// have to reply before returning: a request can be replied to later, from any
+// thread and in any order, by its |unique|. The |data| passed to OnWrite stays
+// valid until the request is replied to.
 class FuseAppLoopCallback {
  public:
    virtual void OnLookup(uint64_t unique, uint64_t inode) = 0;
@@ -44,7 +55,9 @@ class FuseAppLoopCallback {
 
 class FuseAppLoop final {
   public:
-    FuseAppLoop(base::unique_fd&& fd);
+    // Once |max_in_flight| requests are waiting for a reply, no more are read
+    // until one of them is replied to.
+    FuseAppLoop(base::unique_fd&& fd, size_t max_in_flight = kDefaultMaxInFlightRequests);
 
     void Start(FuseAppLoopCallback* callback);
     void Break();
@@ -57,11 +70,27 @@ class FuseAppLoop final {
     bool ReplyRead(uint64_t unique, uint32_t size, const void* data);
 
   private:
+    bool HandleMessage(std::unique_ptr<FuseBuffer>* buffer, FuseAppLoopCallback* callback);
+    std::unique_ptr<FuseBuffer> AcquireBuffer();
+    bool AddInFlight(std::unique_ptr<FuseBuffer> buffer);
+    bool RetireRequest(uint64_t unique);
+    bool WaitForWindow();
+
     base::unique_fd fd_;
     base::unique_fd break_fd_;
+    const size_t max_in_flight_;
 
-    // Lock for multi-threading.
+    // Lock for multi-threading. Guards everything below.
     std::mutex mutex_;
+
+    // Requests waiting for a reply by unique, and buffers left over from those
+    // already replied to.
+    std::unordered_map<uint64_t, std::unique_ptr<FuseBuffer>> in_flight_;
+    std::vector<std::unique_ptr<FuseBuffer>> spare_buffers_;
+
+    // Notified when a request is replied to or the loop is broken.
+    std::condition_variable window_cv_;
+    bool breaking_;
 };
 
 bool StartFuseAppLoop(int fd, FuseAppLoopCallback* callback);
@@ -18,9 +18,11 @@
 #define ANDROID_LIBAPPFUSE_FUSEBRIDGELOOP_H_
 
 #include <map>
+#include <memory>
 #include <mutex>
 #include <queue>
 #include <unordered_set>
+#include <vector>
 
 #include <android-base/macros.h>
 
@@ -41,9 +43,14 @@ class BridgeEpollController;
 
 class FuseBridgeLoop final {
   public:
-    FuseBridgeLoop();
+    // Bridges are spread over |threads| threads, each running its own epoll
+    // loop. With more than one thread, |callback| is invoked from any of them,
+    // concurrently for different mounts.
+    explicit FuseBridgeLoop(size_t threads = 1);
     ~FuseBridgeLoop();
 
+    // Runs the loop until all bridges are closed. The first thread is the
+    // calling one, the others are started and joined here.
     void Start(FuseBridgeLoopCallback* callback);
 
     // Add bridge to the loop. It's OK to invoke the method from a different
@@ -51,10 +58,17 @@ class FuseBridgeLoop final {
     bool AddBridge(int mount_id, base::unique_fd dev_fd, base::unique_fd proxy_fd);
 
   private:
-    bool ProcessEventLocked(const std::unordered_set<FuseBridgeEntry*>& entries,
-                            FuseBridgeLoopCallback* callback);
+    void Run(size_t index, FuseBridgeLoopCallback* callback);
+    bool ProcessEvents(size_t index, const std::unordered_set<FuseBridgeEntry*>& entries,
+                       FuseBridgeLoopCallback* callback);
+    void StopLocked();
 
-    std::unique_ptr<BridgeEpollController> epoll_controller_;
+    // One epoll controller per thread, and the number of bridges it serves.
+    std::vector<std::unique_ptr<BridgeEpollController>> epoll_controllers_;
+    std::vector<size_t> bridge_counts_;
+
+    // Readable once the loop is stopped, to wake up the other threads.
+    base::unique_fd wake_fd_;
 
     // Map between |mount_id| and bridge entry.
     std::map<int, std::unique_ptr<FuseBridgeEntry>> bridges_;
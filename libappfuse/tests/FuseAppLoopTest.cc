@@ -21,7 +21,14 @@
 #include <android-base/logging.h>
 #include <android-base/unique_fd.h>
 #include <gtest/gtest.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <string>
 #include <thread>
+#include <vector>
 
 #include "libappfuse/EpollController.h"
 #include "libappfuse/FuseBridgeLoop.h"
@@ -80,6 +87,58 @@ class Callback : public FuseAppLoopCallback {
   }
 };
 
+// Replies to nothing itself, leaving that to the test.
+class AsyncCallback : public FuseAppLoopCallback {
+ public:
+  struct Request {
+    uint64_t unique;
+    const void* data;
+    uint32_t size;
+  };
+
+  std::mutex mutex;
+  std::condition_variable cv;
+  std::vector<Request> requests;
+
+  void OnGetAttr(uint64_t unique, uint64_t /*inode*/) override { Add({unique, nullptr, 0}); }
+
+  void OnLookup(uint64_t unique, uint64_t /*inode*/) override { Add({unique, nullptr, 0}); }
+
+  void OnFsync(uint64_t unique, uint64_t /*inode*/) override { Add({unique, nullptr, 0}); }
+
+  void OnWrite(uint64_t unique, uint64_t /*inode*/, uint64_t /*offset*/, uint32_t size,
+               const void* data) override {
+    Add({unique, data, size});
+  }
+
+  void OnRead(uint64_t unique, uint64_t /*inode*/, uint64_t /*offset*/,
+              uint32_t /*size*/) override {
+    Add({unique, nullptr, 0});
+  }
+
+  void OnOpen(uint64_t unique, uint64_t /*inode*/) override { Add({unique, nullptr, 0}); }
+
+  void OnRelease(uint64_t unique, uint64_t /*inode*/) override { Add({unique, nullptr, 0}); }
+
+  bool WaitForRequests(size_t count) {
+    std::unique_lock<std::mutex> lock(mutex);
+    return cv.wait_for(lock, std::chrono::seconds(10),
+                       [this, count] { return requests.size() >= count; });
+  }
+
+  size_t RequestCount() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return requests.size();
+  }
+
+ private:
+  void Add(const Request& request) {
+    std::lock_guard<std::mutex> lock(mutex);
+    requests.push_back(request);
+    cv.notify_all();
+  }
+};
+
 class FuseAppLoopTest : public ::testing::Test {
  protected:
    std::thread thread_;
@@ -295,5 +354,68 @@ TEST_F(FuseAppLoopTest, Break) {
     }
 }
 
+TEST(FuseAppLoopAsyncTest, ReplyOutOfOrder) {
+  base::unique_fd sockets[2];
+  ASSERT_TRUE(SetupMessageSockets(&sockets));
+  FuseAppLoop loop(std::move(sockets[1]), 2);
+  AsyncCallback callback;
+  std::thread thread([&] { loop.Start(&callback); });
+
+  std::unique_ptr<FuseBuffer> buffer(new FuseBuffer);
+  for (uint64_t unique = 1; unique <= 3; ++unique) {
+    buffer->request.Reset(sizeof(fuse_write_in) + 4, FUSE_WRITE, unique);
+    buffer->request.header.nodeid = 10;
+    buffer->request.write_in.size = 4;
+    memset(buffer->request.write_data, '0' + unique, 4);
+    ASSERT_TRUE(buffer->request.Write(sockets[0]));
+  }
+
+  // Only two requests fit in the window, and the data of the first is still
+  // there after the second was read.
+  ASSERT_TRUE(callback.WaitForRequests(2));
+  usleep(100 * 1000);
+  EXPECT_EQ(2u, callback.RequestCount());
+  EXPECT_EQ("1111", std::string(static_cast<const char*>(callback.requests[0].data),
+                                callback.requests[0].size));
+  EXPECT_EQ("2222", std::string(static_cast<const char*>(callback.requests[1].data),
+                                callback.requests[1].size));
+
+  // Replying to the second lets the third in.
+  ASSERT_TRUE(loop.ReplyWrite(2, 4));
+  ASSERT_TRUE(buffer->response.Read(sockets[0]));
+  EXPECT_EQ(2u, buffer->response.header.unique);
+  EXPECT_FALSE(loop.ReplyWrite(2, 4)) << "A request must be replied to only once";
+  ASSERT_TRUE(callback.WaitForRequests(3));
+  EXPECT_EQ(3u, callback.requests[2].unique);
+
+  for (uint64_t unique : {3u, 1u}) {
+    ASSERT_TRUE(loop.ReplyWrite(unique, 4));
+    ASSERT_TRUE(buffer->response.Read(sockets[0]));
+    EXPECT_EQ(unique, buffer->response.header.unique);
+    EXPECT_EQ(kFuseSuccess, buffer->response.header.error);
+    EXPECT_EQ(4u, buffer->response.write_out.size);
+  }
+
+  sockets[0].reset();
+  thread.join();
+}
+
+TEST(FuseAppLoopAsyncTest, BreakWithFullWindow) {
+  base::unique_fd sockets[2];
+  ASSERT_TRUE(SetupMessageSockets(&sockets));
+  FuseAppLoop loop(std::move(sockets[1]), 1);
+  AsyncCallback callback;
+  std::thread thread([&] { loop.Start(&callback); });
+
+  std::unique_ptr<FuseBuffer> buffer(new FuseBuffer);
+  buffer->request.Reset(sizeof(fuse_open_in), FUSE_OPEN, 1);
+  buffer->request.header.nodeid = 10;
+  ASSERT_TRUE(buffer->request.Write(sockets[0]));
+  ASSERT_TRUE(callback.WaitForRequests(1));
+
+  loop.Break();
+  thread.join();
+}
+
 }  // namespace fuse
 }  // namespace android
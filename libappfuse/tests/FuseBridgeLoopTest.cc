@@ -18,8 +18,11 @@
 
 #include <sys/socket.h>
 
+#include <atomic>
+#include <memory>
 #include <sstream>
 #include <thread>
+#include <vector>
 
 #include <android-base/logging.h>
 #include <android-base/unique_fd.h>
@@ -40,6 +43,38 @@ class Callback : public FuseBridgeLoopCallback {
   void OnClosed(int /* mount_id */) override { closed = true; }
 };
 
+class CountingCallback : public FuseBridgeLoopCallback {
+ public:
+  std::atomic<int> mounted;
+  std::atomic<int> closed;
+  CountingCallback() : mounted(0), closed(0) {}
+
+  void OnMount(int /*mount_id*/) override { mounted++; }
+
+  void OnClosed(int /* mount_id */) override { closed++; }
+};
+
+// Passes a header-only request from |dev_fd| through the bridge to |proxy_fd|
+// and a reply back.
+void ProxyRoundTrip(int dev_fd, int proxy_fd, uint32_t opcode, uint64_t unique) {
+  std::unique_ptr<FuseBuffer> buffer(new FuseBuffer);
+  buffer->request.Reset(0, opcode, unique);
+  ASSERT_TRUE(buffer->request.Write(dev_fd));
+
+  memset(&buffer->request, 0, sizeof(FuseRequest));
+  ASSERT_TRUE(buffer->request.Read(proxy_fd));
+  EXPECT_EQ(opcode, buffer->request.header.opcode);
+  EXPECT_EQ(unique, buffer->request.header.unique);
+
+  buffer->response.Reset(0, kFuseSuccess, unique);
+  ASSERT_TRUE(buffer->response.Write(proxy_fd));
+
+  memset(&buffer->response, 0, sizeof(FuseResponse));
+  ASSERT_TRUE(buffer->response.Read(dev_fd));
+  EXPECT_EQ(unique, buffer->response.header.unique);
+  EXPECT_EQ(kFuseSuccess, buffer->response.header.error);
+}
+
 class FuseBridgeLoopTest : public ::testing::Test {
  protected:
   base::unique_fd dev_sockets_[2];
@@ -210,5 +245,83 @@ TEST_F(FuseBridgeLoopTest, Proxy) {
   Close();
 }
 
+TEST_F(FuseBridgeLoopTest, Pipelining) {
+  // More of these than the sockets can hold, so some have to wait in the loop
+  // while the device keeps being read.
+  constexpr uint64_t kRequestCount = 6;
+  for (uint64_t unique = 1; unique <= kRequestCount; ++unique) {
+    request_.Reset(sizeof(fuse_write_in) + kFuseMaxWrite, FUSE_WRITE, unique);
+    request_.write_in.size = kFuseMaxWrite;
+    memset(request_.write_data, static_cast<int>(unique), kFuseMaxWrite);
+    ASSERT_TRUE(request_.Write(dev_sockets_[0]));
+  }
+
+  for (uint64_t unique = 1; unique <= kRequestCount; ++unique) {
+    memset(&request_, 0, sizeof(FuseRequest));
+    ASSERT_TRUE(request_.Read(proxy_sockets_[1]));
+    EXPECT_EQ(static_cast<uint32_t>(FUSE_WRITE), request_.header.opcode);
+    EXPECT_EQ(unique, request_.header.unique);
+    EXPECT_EQ(static_cast<char>(unique), request_.write_data[kFuseMaxWrite - 1]);
+  }
+
+  // The proxy may reply in any order.
+  for (uint64_t unique = kRequestCount; unique >= 1; --unique) {
+    response_.Reset(sizeof(fuse_write_out), kFuseSuccess, unique);
+    response_.write_out.size = kFuseMaxWrite;
+    ASSERT_TRUE(response_.Write(proxy_sockets_[1]));
+  }
+  for (uint64_t unique = kRequestCount; unique >= 1; --unique) {
+    memset(&response_, 0, sizeof(FuseResponse));
+    ASSERT_TRUE(response_.Read(dev_sockets_[0]));
+    EXPECT_EQ(unique, response_.header.unique);
+    EXPECT_EQ(kFuseMaxWrite, response_.write_out.size);
+  }
+}
+
+TEST(FuseBridgeLoopThreadsTest, Proxy) {
+  constexpr int kBridgeCount = 4;
+  base::unique_fd dev_sockets[kBridgeCount][2];
+  base::unique_fd proxy_sockets[kBridgeCount][2];
+  CountingCallback callback;
+
+  FuseBridgeLoop loop(2);
+  for (int i = 0; i < kBridgeCount; ++i) {
+    ASSERT_TRUE(SetupMessageSockets(&dev_sockets[i]));
+    ASSERT_TRUE(SetupMessageSockets(&proxy_sockets[i]));
+    ASSERT_TRUE(loop.AddBridge(i, std::move(dev_sockets[i][1]), std::move(proxy_sockets[i][0])));
+  }
+  std::thread thread([&] { loop.Start(&callback); });
+
+  // Every bridge is driven by its own client at the same time, and is closed
+  // by the release of its only file.
+  std::vector<std::thread> clients;
+  for (int i = 0; i < kBridgeCount; ++i) {
+    clients.emplace_back([&, i] {
+      const int dev_fd = dev_sockets[i][0];
+      const int proxy_fd = proxy_sockets[i][1];
+      std::unique_ptr<FuseBuffer> buffer(new FuseBuffer);
+      buffer->request.Reset(sizeof(fuse_init_in), FUSE_INIT, 1);
+      buffer->request.init_in.major = FUSE_KERNEL_VERSION;
+      buffer->request.init_in.minor = FUSE_KERNEL_MINOR_VERSION;
+      ASSERT_TRUE(buffer->request.Write(dev_fd));
+      ASSERT_TRUE(buffer->response.Read(dev_fd));
+      EXPECT_EQ(kFuseSuccess, buffer->response.header.error);
+
+      ProxyRoundTrip(dev_fd, proxy_fd, FUSE_OPEN, 2);
+      for (uint64_t unique = 3; unique < 64; ++unique) {
+        ProxyRoundTrip(dev_fd, proxy_fd, FUSE_GETATTR, unique);
+      }
+      ProxyRoundTrip(dev_fd, proxy_fd, FUSE_RELEASE, 64);
+    });
+  }
+  for (auto& client : clients) {
+    client.join();
+  }
+
+  thread.join();
+  EXPECT_EQ(kBridgeCount, callback.mounted);
+  EXPECT_EQ(kBridgeCount, callback.closed);
+}
+
 }  // namespace fuse
 }  // namespace android
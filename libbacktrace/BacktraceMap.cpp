@@ -22,6 +22,8 @@
 #include <sys/types.h>
 #include <unistd.h>
 
+#include <algorithm>
+
 #include <log/log.h>
 
 #include <backtrace/backtrace_constants.h>
@@ -40,11 +42,14 @@ BacktraceMap::~BacktraceMap() {
 
 void BacktraceMap::FillIn(uintptr_t addr, backtrace_map_t* map) {
   ScopedBacktraceMapIteratorLock lock(this);
-  for (BacktraceMap::const_iterator it = begin(); it != end(); ++it) {
-    if (addr >= it->start && addr < it->end) {
-      *map = *it;
-      return;
-    }
+  // The maps are sorted by start address and don't overlap.
+  auto it = std::upper_bound(maps_.begin(), maps_.end(), addr,
+                             [](uintptr_t addr, const backtrace_map_t& map) {
+                               return addr < map.start;
+                             });
+  if (it != maps_.begin() && addr < (--it)->end) {
+    *map = *it;
+    return;
   }
   *map = {};
 }
@@ -155,3 +160,30 @@ BacktraceMap* BacktraceMap::Create(pid_t pid, const std::vector<backtrace_map_t>
             });
     return backtrace_map;
 }
+
+std::shared_ptr<BacktraceMap> BacktraceMapCache::Get(pid_t pid) {
+  auto now = std::chrono::steady_clock::now();
+  std::lock_guard<std::mutex> guard(lock_);
+  auto it = entries_.find(pid);
+  if (it != entries_.end() && now - it->second.created < max_age_) {
+    return it->second.map;
+  }
+
+  std::shared_ptr<BacktraceMap> map(BacktraceMap::Create(pid));
+  if (map == nullptr) {
+    entries_.erase(pid);
+    return nullptr;
+  }
+  entries_[pid] = Entry{map, now};
+  return map;
+}
+
+void BacktraceMapCache::Invalidate(pid_t pid) {
+  std::lock_guard<std::mutex> guard(lock_);
+  entries_.erase(pid);
+}
+
+void BacktraceMapCache::Clear() {
+  std::lock_guard<std::mutex> guard(lock_);
+  entries_.clear();
+}
@@ -20,6 +20,7 @@
 #include <sys/param.h>
 #include <sys/ptrace.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <ucontext.h>
 #include <unistd.h>
 
@@ -74,6 +75,15 @@ size_t BacktracePtrace::Read(uintptr_t addr, uint8_t* buffer, size_t bytes) {
   }
 
   bytes = MIN(map.end - addr, bytes);
+
+  // A single process_vm_readv replaces one ptrace call per word, only fall
+  // back to ptrace if it is refused or comes up short.
+  struct iovec local_io = {buffer, bytes};
+  struct iovec remote_io = {reinterpret_cast<void*>(addr), bytes};
+  if (process_vm_readv(Pid(), &local_io, 1, &remote_io, 1, 0) == static_cast<ssize_t>(bytes)) {
+    return bytes;
+  }
+
   size_t bytes_read = 0;
   word_t data_word;
   size_t align_bytes = addr & (sizeof(word_t) - 1);
@@ -34,6 +34,7 @@
 #include <unistd.h>
 
 #include <algorithm>
+#include <chrono>
 #include <list>
 #include <memory>
 #include <ostream>
@@ -777,6 +778,63 @@ TEST(libbacktrace, fillin_erases) {
   ASSERT_EQ("", map.name);
 }
 
+TEST(libbacktrace, fillin_sorted_search) {
+  std::vector<backtrace_map_t> maps;
+  for (uintptr_t start : {0x5000, 0x1000, 0x3000, 0x4000}) {
+    backtrace_map_t map;
+    map.start = start;
+    map.end = start + 0x800;
+    map.name = std::to_string(start);
+    maps.push_back(map);
+  }
+  std::unique_ptr<BacktraceMap> back_map(BacktraceMap::Create(getpid(), maps));
+
+  backtrace_map_t map;
+  back_map->FillIn(0x1000, &map);
+  ASSERT_TRUE(BacktraceMap::IsValid(map));
+  ASSERT_EQ(static_cast<uintptr_t>(0x1000), map.start);
+  back_map->FillIn(0x37ff, &map);
+  ASSERT_TRUE(BacktraceMap::IsValid(map));
+  ASSERT_EQ(static_cast<uintptr_t>(0x3000), map.start);
+  back_map->FillIn(0x4400, &map);
+  ASSERT_TRUE(BacktraceMap::IsValid(map));
+  ASSERT_EQ(static_cast<uintptr_t>(0x4000), map.start);
+  back_map->FillIn(0x5000, &map);
+  ASSERT_TRUE(BacktraceMap::IsValid(map));
+  ASSERT_EQ(static_cast<uintptr_t>(0x5000), map.start);
+
+  // Before the first map, in a gap, and after the last map.
+  for (uintptr_t addr : {0xfff, 0x1800, 0x2000, 0x5800, 0x10000}) {
+    back_map->FillIn(addr, &map);
+    ASSERT_FALSE(BacktraceMap::IsValid(map)) << "addr " << std::hex << addr;
+  }
+}
+
+TEST(libbacktrace, map_cache) {
+  BacktraceMapCache cache(std::chrono::hours(1));
+  std::shared_ptr<BacktraceMap> map1 = cache.Get(getpid());
+  ASSERT_TRUE(map1 != nullptr);
+  ASSERT_EQ(map1, cache.Get(getpid()));
+
+  cache.Invalidate(getpid());
+  std::shared_ptr<BacktraceMap> map2 = cache.Get(getpid());
+  ASSERT_TRUE(map2 != nullptr);
+  ASSERT_NE(map1, map2);
+
+  // The invalidated map is still usable.
+  std::unique_ptr<Backtrace> backtrace(
+      Backtrace::Create(getpid(), BACKTRACE_CURRENT_THREAD, map1.get()));
+  ASSERT_TRUE(backtrace.get() != nullptr);
+  ASSERT_TRUE(backtrace->Unwind(0));
+}
+
+TEST(libbacktrace, map_cache_expires) {
+  BacktraceMapCache cache(std::chrono::milliseconds(0));
+  std::shared_ptr<BacktraceMap> map = cache.Get(getpid());
+  ASSERT_TRUE(map != nullptr);
+  ASSERT_NE(map, cache.Get(getpid()));
+}
+
 TEST(libbacktrace, format_test) {
   std::unique_ptr<Backtrace> backtrace(Backtrace::Create(getpid(), BACKTRACE_CURRENT_THREAD));
   ASSERT_TRUE(backtrace.get() != nullptr);
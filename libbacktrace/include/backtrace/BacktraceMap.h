@@ -29,8 +29,12 @@
 #include <sys/mman.h>
 #endif
 
+#include <chrono>
 #include <deque>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
 // Special flag to indicate a map is in /dev/. However, a map in
@@ -102,6 +106,7 @@ protected:
 
   virtual bool ParseLine(const char* line, backtrace_map_t* map);
 
+  // Sorted by start address.
   std::deque<backtrace_map_t> maps_;
   pid_t pid_;
 };
@@ -120,4 +125,31 @@ private:
   BacktraceMap* map_;
 };
 
+// Keeps recently built maps, keyed by pid, for tools that backtrace many
+// processes, or the same process many times, in a short period. A map is
+// rebuilt once it is older than max_age, or after Invalidate is called for
+// its pid, for example because the process has loaded a library.
+class BacktraceMapCache {
+public:
+  explicit BacktraceMapCache(std::chrono::milliseconds max_age = std::chrono::seconds(1))
+      : max_age_(max_age) {}
+
+  // Returns nullptr if the map cannot be built. The returned map stays usable
+  // for as long as the caller holds it, even if it is invalidated meanwhile.
+  std::shared_ptr<BacktraceMap> Get(pid_t pid);
+
+  void Invalidate(pid_t pid);
+  void Clear();
+
+private:
+  struct Entry {
+    std::shared_ptr<BacktraceMap> map;
+    std::chrono::steady_clock::time_point created;
+  };
+
+  const std::chrono::milliseconds max_age_;
+  std::mutex lock_;
+  std::unordered_map<pid_t, Entry> entries_;
+};
+
 #endif // _BACKTRACE_BACKTRACE_MAP_H
@@ -214,6 +214,42 @@ int ashmem_unpin_region(int fd, size_t offset, size_t len)
     return TEMP_FAILURE_RETRY(ioctl(fd, ASHMEM_UNPIN, &pin));
 }
 
+static int ashmem_batch(int fd, int cmd, const struct ashmem_range *ranges, size_t count)
+{
+    int result = 0;
+    size_t i = 0;
+
+    int ret = __ashmem_is_ashmem(fd, 1);
+    if (ret < 0) {
+        return ret;
+    }
+
+    while (i < count) {
+        struct ashmem_pin pin = { ranges[i].offset, ranges[i].len };
+        for (++i; i < count && ranges[i].offset == pin.offset + pin.len; ++i) {
+            pin.len += ranges[i].len;
+        }
+        ret = TEMP_FAILURE_RETRY(ioctl(fd, cmd, &pin));
+        if (ret < 0) {
+            return ret;
+        }
+        if (ret == ASHMEM_WAS_PURGED) {
+            result = ret;
+        }
+    }
+    return result;
+}
+
+int ashmem_pin_regions(int fd, const struct ashmem_range *ranges, size_t count)
+{
+    return ashmem_batch(fd, ASHMEM_PIN, ranges, count);
+}
+
+int ashmem_unpin_regions(int fd, const struct ashmem_range *ranges, size_t count)
+{
+    return ashmem_batch(fd, ASHMEM_UNPIN, ranges, count);
+}
+
 int ashmem_get_size_region(int fd)
 {
     int ret = __ashmem_is_ashmem(fd, 1);
@@ -70,6 +70,18 @@ int ashmem_unpin_region(int fd __unused, size_t offset __unused, size_t len __un
     return 0 /*ASHMEM_IS_UNPINNED*/;
 }
 
+int ashmem_pin_regions(int fd __unused, const struct ashmem_range *ranges __unused,
+                       size_t count __unused)
+{
+    return 0 /*ASHMEM_NOT_PURGED*/;
+}
+
+int ashmem_unpin_regions(int fd __unused, const struct ashmem_range *ranges __unused,
+                         size_t count __unused)
+{
+    return 0 /*ASHMEM_IS_UNPINNED*/;
+}
+
 int ashmem_get_size_region(int fd)
 {
     struct stat buf;
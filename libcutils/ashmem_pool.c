@@ -0,0 +1,359 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "ashmem_pool"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <cutils/ashmem_pool.h>
+#include <log/log.h>
+#include <utils/Compat.h>
+
+/* Not in all of the kernel and libc headers this is built against. */
+#ifndef MFD_CLOEXEC
+#define MFD_CLOEXEC 0x0001U
+#endif
+#ifndef MFD_ALLOW_SEALING
+#define MFD_ALLOW_SEALING 0x0002U
+#endif
+#ifndef F_ADD_SEALS
+#define F_ADD_SEALS 1033
+#define F_GET_SEALS 1034
+#define F_SEAL_SEAL 0x0001
+#define F_SEAL_SHRINK 0x0002
+#define F_SEAL_GROW 0x0004
+#endif
+
+struct ashmem_pool {
+    pthread_mutex_t lock;
+    int fd;
+    bool memfd;
+    uint8_t *base;
+    size_t size;
+    /* Free space, sorted by offset, no two ranges touching. */
+    struct ashmem_range *free;
+    size_t free_count;
+    size_t free_capacity;
+};
+
+static size_t round_up(size_t len, size_t alignment)
+{
+    return (len + alignment - 1) & ~(alignment - 1);
+}
+
+static int memfd_create_sealed(const char *name, size_t size)
+{
+#if defined(__NR_memfd_create)
+    int fd = syscall(__NR_memfd_create, name ? name : "ashmem_pool",
+                     MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (fd < 0) {
+        return -1;
+    }
+    if (TEMP_FAILURE_RETRY(ftruncate(fd, size)) < 0 ||
+            fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL) < 0) {
+        int save_errno = errno;
+        close(fd);
+        errno = save_errno;
+        return -1;
+    }
+    return fd;
+#else
+    (void)name;
+    (void)size;
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+struct ashmem_pool *ashmem_pool_create(const char *name, size_t size)
+{
+    struct ashmem_pool *pool;
+    int save_errno;
+
+    size = round_up(size ? size : 1, getpagesize());
+    if (size > INT_MAX) {
+        /* native handles carry offsets as ints */
+        errno = EINVAL;
+        return NULL;
+    }
+
+    pool = calloc(1, sizeof(*pool));
+    if (!pool) {
+        return NULL;
+    }
+    pthread_mutex_init(&pool->lock, NULL);
+    pool->size = size;
+
+    pool->fd = memfd_create_sealed(name, size);
+    pool->memfd = pool->fd >= 0;
+    if (pool->fd < 0) {
+        pool->fd = ashmem_create_region(name, size);
+        if (pool->fd < 0) {
+            goto error;
+        }
+    }
+
+    pool->base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, pool->fd, 0);
+    if (pool->base == MAP_FAILED) {
+        pool->base = NULL;
+        goto error;
+    }
+
+    pool->free = malloc(sizeof(*pool->free));
+    if (!pool->free) {
+        goto error;
+    }
+    pool->free[0].offset = 0;
+    pool->free[0].len = size;
+    pool->free_count = 1;
+    pool->free_capacity = 1;
+    return pool;
+
+error:
+    save_errno = errno;
+    ashmem_pool_destroy(pool);
+    errno = save_errno;
+    return NULL;
+}
+
+void ashmem_pool_destroy(struct ashmem_pool *pool)
+{
+    if (!pool) {
+        return;
+    }
+    if (pool->base) {
+        munmap(pool->base, pool->size);
+    }
+    if (pool->fd >= 0) {
+        close(pool->fd);
+    }
+    free(pool->free);
+    pthread_mutex_destroy(&pool->lock);
+    free(pool);
+}
+
+int ashmem_pool_fd(const struct ashmem_pool *pool)
+{
+    return pool->fd;
+}
+
+size_t ashmem_pool_size(const struct ashmem_pool *pool)
+{
+    return pool->size;
+}
+
+void *ashmem_pool_data(const struct ashmem_pool *pool, size_t offset)
+{
+    return pool->base + offset;
+}
+
+ssize_t ashmem_pool_alloc(struct ashmem_pool *pool, size_t len)
+{
+    ssize_t offset = -ENOMEM;
+    size_t i;
+
+    if (len == 0 || len > pool->size) {
+        return len ? -ENOMEM : -EINVAL;
+    }
+    len = round_up(len, ASHMEM_POOL_ALIGNMENT);
+
+    /* First fit, which keeps the low offsets busy and the high ones whole. */
+    pthread_mutex_lock(&pool->lock);
+    for (i = 0; i < pool->free_count; ++i) {
+        struct ashmem_range *range = &pool->free[i];
+        if (range->len < len) {
+            continue;
+        }
+        offset = range->offset;
+        range->offset += len;
+        range->len -= len;
+        if (range->len == 0) {
+            memmove(range, range + 1, (pool->free_count - i - 1) * sizeof(*range));
+            pool->free_count--;
+        }
+        break;
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return offset;
+}
+
+int ashmem_pool_free(struct ashmem_pool *pool, size_t offset, size_t len)
+{
+    size_t lo, hi;
+    bool merge_prev, merge_next;
+
+    len = round_up(len, ASHMEM_POOL_ALIGNMENT);
+    if (len == 0 || offset % ASHMEM_POOL_ALIGNMENT || offset > pool->size ||
+            len > pool->size - offset) {
+        return -EINVAL;
+    }
+
+    pthread_mutex_lock(&pool->lock);
+
+    /* Find the first free range after offset. */
+    lo = 0;
+    hi = pool->free_count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (pool->free[mid].offset <= offset) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    /* Overlapping free space means a double or mismatched free. */
+    if ((lo > 0 && pool->free[lo - 1].offset + pool->free[lo - 1].len > offset) ||
+            (lo < pool->free_count && offset + len > pool->free[lo].offset)) {
+        pthread_mutex_unlock(&pool->lock);
+        ALOGE("freeing unallocated region %zu+%zu", offset, len);
+        return -EINVAL;
+    }
+
+    merge_prev = lo > 0 && pool->free[lo - 1].offset + pool->free[lo - 1].len == offset;
+    merge_next = lo < pool->free_count && offset + len == pool->free[lo].offset;
+    if (merge_prev && merge_next) {
+        pool->free[lo - 1].len += len + pool->free[lo].len;
+        memmove(&pool->free[lo], &pool->free[lo + 1],
+                (pool->free_count - lo - 1) * sizeof(*pool->free));
+        pool->free_count--;
+    } else if (merge_prev) {
+        pool->free[lo - 1].len += len;
+    } else if (merge_next) {
+        pool->free[lo].offset = offset;
+        pool->free[lo].len += len;
+    } else {
+        if (pool->free_count == pool->free_capacity) {
+            size_t capacity = pool->free_capacity * 2;
+            struct ashmem_range *ranges = realloc(pool->free, capacity * sizeof(*ranges));
+            if (!ranges) {
+                /* The region stays allocated, which is safe. */
+                pthread_mutex_unlock(&pool->lock);
+                return -ENOMEM;
+            }
+            pool->free = ranges;
+            pool->free_capacity = capacity;
+        }
+        memmove(&pool->free[lo + 1], &pool->free[lo],
+                (pool->free_count - lo) * sizeof(*pool->free));
+        pool->free[lo].offset = offset;
+        pool->free[lo].len = len;
+        pool->free_count++;
+    }
+
+    pthread_mutex_unlock(&pool->lock);
+    return 0;
+}
+
+int ashmem_pool_pin(struct ashmem_pool *pool, const struct ashmem_range *ranges, size_t count)
+{
+    if (pool->memfd) {
+        return 0 /*ASHMEM_NOT_PURGED*/;
+    }
+    return ashmem_pin_regions(pool->fd, ranges, count);
+}
+
+int ashmem_pool_unpin(struct ashmem_pool *pool, const struct ashmem_range *ranges, size_t count)
+{
+    if (pool->memfd) {
+        return 0 /*ASHMEM_IS_UNPINNED*/;
+    }
+    return ashmem_unpin_regions(pool->fd, ranges, count);
+}
+
+native_handle_t *ashmem_pool_create_handle(const struct ashmem_pool *pool, size_t offset,
+                                           size_t len)
+{
+    native_handle_t *handle;
+
+    if (offset > pool->size || len > pool->size - offset) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    handle = native_handle_create(1, 2);
+    if (!handle) {
+        return NULL;
+    }
+    handle->data[0] = fcntl(pool->fd, F_DUPFD_CLOEXEC, 0);
+    if (handle->data[0] < 0) {
+        int save_errno = errno;
+        native_handle_delete(handle);
+        errno = save_errno;
+        return NULL;
+    }
+    handle->data[1] = (int)offset;
+    handle->data[2] = (int)len;
+    return handle;
+}
+
+void *ashmem_pool_map_handle(const native_handle_t *handle, int prot, void **mapping,
+                             size_t *mapping_len)
+{
+    size_t page_size = getpagesize();
+    size_t offset, len, start;
+    struct stat st;
+    int fd, seals;
+    void *map;
+
+    if (!handle || handle->numFds != 1 || handle->numInts != 2 ||
+            handle->data[1] < 0 || handle->data[2] < 0) {
+        errno = EINVAL;
+        return NULL;
+    }
+    fd = handle->data[0];
+    offset = handle->data[1];
+    len = handle->data[2];
+
+    /*
+     * A memfd that could shrink under us would turn our reads into SIGBUS,
+     * and one that is too short already would too. ashmem can't be resized.
+     */
+    seals = fcntl(fd, F_GET_SEALS);
+    if (seals >= 0) {
+        if (!(seals & F_SEAL_SHRINK)) {
+            errno = EPERM;
+            return NULL;
+        }
+        if (TEMP_FAILURE_RETRY(fstat(fd, &st)) < 0) {
+            return NULL;
+        }
+        if ((uint64_t)offset + len > (uint64_t)st.st_size) {
+            errno = EINVAL;
+            return NULL;
+        }
+    }
+
+    start = offset & ~(page_size - 1);
+    *mapping_len = offset - start + len;
+    map = mmap(NULL, *mapping_len, prot, MAP_SHARED, fd, start);
+    if (map == MAP_FAILED) {
+        return NULL;
+    }
+    *mapping = map;
+    return (uint8_t *)map + (offset - start);
+}
@@ -35,6 +35,14 @@
 #include <private/fs_config.h>
 #include <utils/Compat.h>
 
+#include <algorithm>
+#include <array>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
 #ifndef O_BINARY
 #define O_BINARY 0
 #endif
@@ -302,70 +310,272 @@ static bool fs_config_cmp(bool partial, const char* prefix, size_t len, const ch
 auto __for_testing_only__fs_config_cmp = fs_config_cmp;
 #endif
 
-void fs_config(const char* path, int dir, const char* target_out_path, unsigned* uid, unsigned* gid,
-               unsigned* mode, uint64_t* capabilities) {
-    const struct fs_path_config* pc;
-    size_t which, plen;
+// fs_config() is called for every file of an image by the build tools, so the
+// rules are compiled once into a trie keyed by prefix and cached. A path only
+// has to be walked down the trie to collect the rules that may match it, and
+// the lowest numbered of those that fs_config_cmp() accepts is the first match.
+namespace {
+
+struct fs_config_rule {
+    unsigned mode;
+    unsigned uid;
+    unsigned gid;
+    uint64_t capabilities;
+    std::string prefix;
+};
 
-    if (path[0] == '/') {
-        path++;
+struct fs_config_trie_node {
+    // Sorted by character.
+    std::vector<std::pair<char, uint32_t>> children;
+    // Rules, in order, that match paths starting with, or equal to, this node.
+    std::vector<uint32_t> partial;
+    std::vector<uint32_t> exact;
+};
+
+// Identifies the contents of an override file without reading it.
+struct fs_config_stamp {
+    bool present;
+    dev_t dev;
+    ino_t ino;
+    off_t size;
+    time_t mtime;
+    long mtime_nsec;
+
+    bool operator==(const fs_config_stamp& rhs) const {
+        return present == rhs.present && dev == rhs.dev && ino == rhs.ino && size == rhs.size &&
+               mtime == rhs.mtime && mtime_nsec == rhs.mtime_nsec;
+    }
+};
+
+class fs_config_index {
+  public:
+    fs_config_index(int dir, const char* target_out_path)
+        : dir_(dir), target_out_path_(target_out_path ? target_out_path : "") {
+        nodes_.emplace_back();
+        if (target_out_path_.empty()) stamps_ = current_stamps();
+        for (size_t which = 0; which < (sizeof(conf) / sizeof(conf[0])); ++which) {
+            load(which);
+        }
+        const struct fs_path_config* pc;
+        for (pc = dir ? android_dirs : android_files; pc->prefix; pc++) {
+            add(pc->mode, pc->uid, pc->gid, pc->capabilities, pc->prefix, strlen(pc->prefix));
+        }
+        default_ = *pc;
+    }
+
+    // Whether this index was built for these arguments, from override files
+    // that haven't changed since. The files under a target_out_path are part
+    // of a build output that the tools packing it don't modify, so they are
+    // only read once. The device's own may be replaced under a long running
+    // adbd by a sync to a remounted partition, so those are stat()ed instead.
+    bool current(int dir, const char* target_out_path) const {
+        if (dir != dir_ || target_out_path_ != (target_out_path ? target_out_path : "")) {
+            return false;
+        }
+        return !target_out_path_.empty() || stamps_ == current_stamps();
     }
 
-    plen = strlen(path);
+    void lookup(const char* path, size_t plen, unsigned* uid, unsigned* gid, unsigned* mode,
+                uint64_t* capabilities) const {
+        uint32_t best = UINT32_MAX;
+        find(path, plen, path, plen, &best);
+        // Rules for <partition>/ also apply to system/<partition>/.
+        static const char system[] = "system/";
+        if (!strncmp(path, system, strlen(system))) {
+            find(path + strlen(system), plen - strlen(system), path, plen, &best);
+        }
+        if (best == UINT32_MAX) {
+            *uid = default_.uid;
+            *gid = default_.gid;
+            *mode = (*mode & (~07777)) | default_.mode;
+            *capabilities = default_.capabilities;
+            return;
+        }
+        const fs_config_rule& rule = rules_[best];
+        *uid = rule.uid;
+        *gid = rule.gid;
+        *mode = (*mode & (~07777)) | rule.mode;
+        *capabilities = rule.capabilities;
+    }
 
-    for (which = 0; which < (sizeof(conf) / sizeof(conf[0])); ++which) {
-        struct fs_path_config_from_file header;
+  private:
+    typedef std::array<fs_config_stamp, sizeof(conf) / sizeof(conf[0])> stamps;
+
+    static fs_config_stamp stamp(const char* name) {
+        fs_config_stamp result = {};
+        struct stat st;
+        if (stat(name, &st) != 0) return result;
+        result.present = true;
+        result.dev = st.st_dev;
+        result.ino = st.st_ino;
+        result.size = st.st_size;
+        result.mtime = st.st_mtime;
+#if defined(__linux__)
+        result.mtime_nsec = st.st_mtim.tv_nsec;
+#endif
+        return result;
+    }
 
-        int fd = fs_config_open(dir, which, target_out_path);
-        if (fd < 0) continue;
+    stamps current_stamps() const {
+        stamps result;
+        for (size_t which = 0; which < result.size(); ++which) {
+            result[which] = stamp(conf[which][dir_]);
+        }
+        return result;
+    }
 
-        while (TEMP_FAILURE_RETRY(read(fd, &header, sizeof(header))) == sizeof(header)) {
-            char* prefix;
+    void load(size_t which) {
+        int fd = fs_config_open(dir_, which, target_out_path_.c_str());
+        if (fd < 0) return;
+        std::string data;
+        char buf[4096];
+        ssize_t n;
+        while ((n = TEMP_FAILURE_RETRY(read(fd, buf, sizeof(buf)))) > 0) {
+            data.append(buf, n);
+        }
+        close(fd);
+
+        const char* name = conf[which][dir_];
+        size_t pos = 0;
+        while (data.size() - pos >= sizeof(struct fs_path_config_from_file)) {
+            struct fs_path_config_from_file header;
+            memcpy(&header, data.data() + pos, sizeof(header));
+            pos += sizeof(header);
             uint16_t host_len = get2LE((const uint8_t*)&header.len);
             ssize_t len, remainder = host_len - sizeof(header);
             if (remainder <= 0) {
-                ALOGE("%s len is corrupted", conf[which][dir]);
+                ALOGE("%s len is corrupted", name);
                 break;
             }
-            prefix = static_cast<char*>(calloc(1, remainder));
-            if (!prefix) {
-                ALOGE("%s out of memory", conf[which][dir]);
-                break;
-            }
-            if (TEMP_FAILURE_RETRY(read(fd, prefix, remainder)) != remainder) {
-                free(prefix);
-                ALOGE("%s prefix is truncated", conf[which][dir]);
+            if (data.size() - pos < static_cast<size_t>(remainder)) {
+                ALOGE("%s prefix is truncated", name);
                 break;
             }
+            const char* prefix = data.data() + pos;
+            pos += remainder;
             len = strnlen(prefix, remainder);
             if (len >= remainder) {  // missing a terminating null
-                free(prefix);
-                ALOGE("%s is corrupted", conf[which][dir]);
+                ALOGE("%s is corrupted", name);
                 break;
             }
-            if (fs_config_cmp(dir, prefix, len, path, plen)) {
-                free(prefix);
-                close(fd);
-                *uid = get2LE((const uint8_t*)&(header.uid));
-                *gid = get2LE((const uint8_t*)&(header.gid));
-                *mode = (*mode & (~07777)) | get2LE((const uint8_t*)&(header.mode));
-                *capabilities = get8LE((const uint8_t*)&(header.capabilities));
-                return;
+            add(get2LE((const uint8_t*)&(header.mode)), get2LE((const uint8_t*)&(header.uid)),
+                get2LE((const uint8_t*)&(header.gid)),
+                get8LE((const uint8_t*)&(header.capabilities)), prefix, len);
+        }
+    }
+
+    void add(unsigned mode, unsigned uid, unsigned gid, uint64_t capabilities, const char* prefix,
+             size_t len) {
+        uint32_t index = rules_.size();
+        rules_.push_back({mode, uid, gid, capabilities, std::string(prefix, len)});
+
+        // Mirrors fs_config_cmp(): directory rules and rules ending in * match
+        // any path they are a prefix of.
+        bool partial = dir_;
+        if (!partial && len > 0 && prefix[len - 1] == '*') {
+            len--;
+            partial = true;
+        }
+        insert(prefix, len, partial, index);
+        // Rules for system/<partition>/ also apply to <partition>/.
+        static const char system[] = "system/";
+        if (len > strlen(system) && !strncmp(prefix, system, strlen(system))) {
+            insert(prefix + strlen(system), len - strlen(system), partial, index);
+        }
+    }
+
+    void insert(const char* key, size_t len, bool partial, uint32_t index) {
+        uint32_t node = 0;
+        for (size_t i = 0; i < len; ++i) {
+            auto& children = nodes_[node].children;
+            auto it = std::lower_bound(
+                children.begin(), children.end(), key[i],
+                [](const std::pair<char, uint32_t>& child, char c) { return child.first < c; });
+            if (it != children.end() && it->first == key[i]) {
+                node = it->second;
+                continue;
             }
-            free(prefix);
+            uint32_t child = nodes_.size();
+            children.insert(it, std::make_pair(key[i], child));
+            nodes_.emplace_back();
+            node = child;
         }
-        close(fd);
+        auto& rules = partial ? nodes_[node].partial : nodes_[node].exact;
+        // A rule may be reached under both of its names.
+        if (rules.empty() || rules.back() != index) rules.push_back(index);
     }
 
-    for (pc = dir ? android_dirs : android_files; pc->prefix; pc++) {
-        if (fs_config_cmp(dir, pc->prefix, strlen(pc->prefix), path, plen)) {
-            break;
+    uint32_t child(uint32_t node, char c) const {
+        auto& children = nodes_[node].children;
+        auto it = std::lower_bound(
+            children.begin(), children.end(), c,
+            [](const std::pair<char, uint32_t>& child, char c) { return child.first < c; });
+        if (it == children.end() || it->first != c) return 0;
+        return it->second;
+    }
+
+    // Lowers *best to the first of the rules on key's path through the trie
+    // that fs_config_cmp() says matches path.
+    void find(const char* key, size_t len, const char* path, size_t plen, uint32_t* best) const {
+        uint32_t node = 0;
+        for (size_t i = 0;; ++i) {
+            check(nodes_[node].partial, path, plen, best);
+            if (i == len) break;
+            node = child(node, key[i]);
+            if (node == 0) return;
         }
+        check(nodes_[node].exact, path, plen, best);
     }
-    *uid = pc->uid;
-    *gid = pc->gid;
-    *mode = (*mode & (~07777)) | pc->mode;
-    *capabilities = pc->capabilities;
+
+    void check(const std::vector<uint32_t>& rules, const char* path, size_t plen,
+               uint32_t* best) const {
+        for (uint32_t index : rules) {
+            if (index >= *best) return;
+            const std::string& prefix = rules_[index].prefix;
+            if (fs_config_cmp(dir_, prefix.c_str(), prefix.size(), path, plen)) {
+                *best = index;
+                return;
+            }
+        }
+    }
+
+    const int dir_;
+    const std::string target_out_path_;
+    stamps stamps_ = {};
+    std::vector<fs_config_rule> rules_;
+    std::vector<fs_config_trie_node> nodes_;
+    struct fs_path_config default_;
+};
+
+}  // namespace
+
+static std::shared_ptr<const fs_config_index> fs_config_get_index(int dir,
+                                                                  const char* target_out_path) {
+    // One per type; callers rarely switch between target_out_paths.
+    static std::mutex lock;
+    static std::shared_ptr<const fs_config_index> cache[2];
+
+    std::shared_ptr<const fs_config_index> index;
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        index = cache[dir];
+    }
+    if (index && index->current(dir, target_out_path)) return index;
+
+    index = std::make_shared<fs_config_index>(dir, target_out_path);
+    std::lock_guard<std::mutex> guard(lock);
+    cache[dir] = index;
+    return index;
+}
+
+void fs_config(const char* path, int dir, const char* target_out_path, unsigned* uid, unsigned* gid,
+               unsigned* mode, uint64_t* capabilities) {
+    if (path[0] == '/') {
+        path++;
+    }
+
+    fs_config_get_index(dir ? 1 : 0, target_out_path)
+        ->lookup(path, strlen(path), uid, gid, mode, capabilities);
 }
 
 ssize_t fs_config_generate(char* buffer, size_t length, const struct fs_path_config* pc) {
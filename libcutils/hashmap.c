@@ -18,62 +18,136 @@
 #include <assert.h>
 #include <errno.h>
 #include <cutils/threads.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdbool.h>
 #include <sys/types.h>
 
-typedef struct Entry Entry;
-struct Entry {
+/*
+ * An open addressing table with linear probing, laid out like a Swiss table:
+ * each slot has a control byte, in an array of their own, saying whether the
+ * slot is empty, deleted, or full, in which case it also holds 7 bits of the
+ * entry's hash. Lookups scan the control bytes, 64 to a cache line, and only
+ * look at slots whose bits match. Entries live in the slots array itself, so
+ * there's no allocation per entry and no list to chase.
+ *
+ * Removing an entry marks its slot deleted rather than moving others into
+ * it, so that hashmapForEach() callbacks can still remove entries. Deleted
+ * slots are reused by later puts, and dropped when the table is rehashed.
+ */
+
+#define CONTROL_EMPTY 0x80
+#define CONTROL_DELETED 0xfe
+/* Full slots have the top bit clear. */
+
+#define NOT_FOUND ((size_t) -1)
+
+typedef struct Slot {
     void* key;
-    int hash;
     void* value;
-    Entry* next;
-};
+    int hash;
+} Slot;
+
+typedef struct Table {
+    uint8_t* control;
+    Slot* slots;
+    size_t capacity; /* Always a power of two. */
+    size_t size;
+    size_t deleted;
+    mutex_t lock; /* Only used by striped maps. */
+} Table;
 
 struct Hashmap {
-    Entry** buckets;
-    size_t bucketCount;
     int (*hash)(void* key);
     bool (*equals)(void* keyA, void* keyB);
-    mutex_t lock; 
-    size_t size;
+    mutex_t lock;
+    /* Striped maps are split into tableCount tables, each with its own lock. */
+    bool striped;
+    size_t tableCount;
+    Table tables[];
 };
 
-Hashmap* hashmapCreate(size_t initialCapacity,
-        int (*hash)(void* key), bool (*equals)(void* keyA, void* keyB)) {
+static size_t capacityFor(size_t entries) {
+    // 0.75 load factor.
+    size_t minimumCapacity = entries * 4 / 3;
+    size_t capacity = 1;
+    while (capacity <= minimumCapacity) {
+        // Capacity must be power of 2.
+        capacity <<= 1;
+    }
+    return capacity;
+}
+
+static bool tableInit(Table* table, size_t capacity) {
+    table->control = malloc(capacity);
+    if (table->control == NULL) {
+        return false;
+    }
+    table->slots = malloc(capacity * sizeof(Slot));
+    if (table->slots == NULL) {
+        free(table->control);
+        return false;
+    }
+    memset(table->control, CONTROL_EMPTY, capacity);
+    table->capacity = capacity;
+    table->size = 0;
+    table->deleted = 0;
+    return true;
+}
+
+static void tableFree(Table* table) {
+    free(table->control);
+    free(table->slots);
+}
+
+static Hashmap* createMap(size_t initialCapacity, int (*hash)(void* key),
+        bool (*equals)(void* keyA, void* keyB), bool striped, size_t tableCount) {
     assert(hash != NULL);
     assert(equals != NULL);
-    
-    Hashmap* map = malloc(sizeof(Hashmap));
+
+    Hashmap* map = malloc(sizeof(Hashmap) + tableCount * sizeof(Table));
     if (map == NULL) {
         return NULL;
     }
-    
-    // 0.75 load factor.
-    size_t minimumBucketCount = initialCapacity * 4 / 3;
-    map->bucketCount = 1;
-    while (map->bucketCount <= minimumBucketCount) {
-        // Bucket count must be power of 2.
-        map->bucketCount <<= 1; 
-    }
 
-    map->buckets = calloc(map->bucketCount, sizeof(Entry*));
-    if (map->buckets == NULL) {
-        free(map);
-        return NULL;
+    size_t capacity = capacityFor((initialCapacity + tableCount - 1) / tableCount);
+    size_t i;
+    for (i = 0; i < tableCount; i++) {
+        if (!tableInit(&map->tables[i], capacity)) {
+            while (i > 0) {
+                tableFree(&map->tables[--i]);
+            }
+            free(map);
+            return NULL;
+        }
+        mutex_init(&map->tables[i].lock);
     }
-    
-    map->size = 0;
 
     map->hash = hash;
     map->equals = equals;
-    
+    map->striped = striped;
+    map->tableCount = tableCount;
+
     mutex_init(&map->lock);
-    
+
     return map;
 }
 
+Hashmap* hashmapCreate(size_t initialCapacity,
+        int (*hash)(void* key), bool (*equals)(void* keyA, void* keyB)) {
+    return createMap(initialCapacity, hash, equals, false, 1);
+}
+
+Hashmap* hashmapCreateStriped(size_t initialCapacity, size_t stripes,
+        int (*hash)(void* key), bool (*equals)(void* keyA, void* keyB)) {
+    size_t tableCount = 1;
+    while (tableCount < stripes && tableCount < 256) {
+        tableCount <<= 1;
+    }
+    return createMap(initialCapacity, hash, equals, true, tableCount);
+}
+
 /**
  * Hashes the given key.
  */
@@ -89,47 +163,165 @@ static inline int hashKey(Hashmap* map, void* key) {
     h ^= (((unsigned int) h) >> 14);
     h += (h << 4);
     h ^= (((unsigned int) h) >> 10);
-       
+
     return h;
 }
 
-size_t hashmapSize(Hashmap* map) {
-    return map->size;
+/**
+ * The 7 bits of the hash kept in a full slot's control byte. The table index
+ * comes from the low bits, so these come from the top.
+ */
+static inline uint8_t controlHash(int hash) {
+    return ((unsigned int) hash) >> 25;
+}
+
+#ifdef __clang__
+__attribute__((no_sanitize("integer")))
+#endif
+static inline Table* tableFor(Hashmap* map, int hash) {
+    if (map->tableCount == 1) {
+        return &map->tables[0];
+    }
+    // Mixed, so that a stripe's entries don't all share the low bits its
+    // own table indexes with.
+    unsigned int h = ((unsigned int) hash) * 0x9e3779b9u;
+    return &map->tables[(h >> 16) & (map->tableCount - 1)];
 }
 
-static inline size_t calculateIndex(size_t bucketCount, int hash) {
-    return ((size_t) hash) & (bucketCount - 1);
+static inline void lockTable(Hashmap* map, Table* table) {
+    if (map->striped) {
+        mutex_lock(&table->lock);
+    }
 }
 
-static void expandIfNecessary(Hashmap* map) {
-    // If the load factor exceeds 0.75...
-    if (map->size > (map->bucketCount * 3 / 4)) {
-        // Start off with a 0.33 load factor.
-        size_t newBucketCount = map->bucketCount << 1;
-        Entry** newBuckets = calloc(newBucketCount, sizeof(Entry*));
-        if (newBuckets == NULL) {
-            // Abort expansion.
-            return;
-        }
-        
-        // Move over existing entries.
-        size_t i;
-        for (i = 0; i < map->bucketCount; i++) {
-            Entry* entry = map->buckets[i];
-            while (entry != NULL) {
-                Entry* next = entry->next;
-                size_t index = calculateIndex(newBucketCount, entry->hash);
-                entry->next = newBuckets[index];
-                newBuckets[index] = entry;
-                entry = next;
+static inline void unlockTable(Hashmap* map, Table* table) {
+    if (map->striped) {
+        mutex_unlock(&table->lock);
+    }
+}
+
+/**
+ * Looks for key. Returns true and its slot's index if found, and otherwise
+ * false and the index of the slot to put it in.
+ */
+static bool tableProbe(Table* table, void* key, int hash,
+        bool (*equals)(void*, void*), size_t* index) {
+    uint8_t h2 = controlHash(hash);
+    size_t mask = table->capacity - 1;
+    size_t firstDeleted = NOT_FOUND;
+    size_t i = ((size_t) hash) & mask;
+    while (true) {
+        uint8_t control = table->control[i];
+        if (control == h2) {
+            Slot* slot = &table->slots[i];
+            if (slot->key == key || (slot->hash == hash && equals(slot->key, key))) {
+                *index = i;
+                return true;
             }
+        } else if (control == CONTROL_EMPTY) {
+            // There's always at least one empty slot, so this ends.
+            *index = (firstDeleted != NOT_FOUND) ? firstDeleted : i;
+            return false;
+        } else if (control == CONTROL_DELETED && firstDeleted == NOT_FOUND) {
+            firstDeleted = i;
+        }
+        i = (i + 1) & mask;
+    }
+}
+
+static size_t tableFind(Table* table, void* key, int hash, bool (*equals)(void*, void*)) {
+    size_t index;
+    return tableProbe(table, key, hash, equals, &index) ? index : NOT_FOUND;
+}
+
+/**
+ * Rehashes into newCapacity slots, dropping deleted ones.
+ */
+static bool tableRehash(Table* table, size_t newCapacity) {
+    uint8_t* control = malloc(newCapacity);
+    if (control == NULL) {
+        return false;
+    }
+    Slot* slots = malloc(newCapacity * sizeof(Slot));
+    if (slots == NULL) {
+        free(control);
+        return false;
+    }
+    memset(control, CONTROL_EMPTY, newCapacity);
+
+    // Move over existing entries. Keys are known to be distinct, so only an
+    // empty slot needs finding.
+    size_t mask = newCapacity - 1;
+    size_t i;
+    for (i = 0; i < table->capacity; i++) {
+        if (table->control[i] & CONTROL_EMPTY) {
+            continue;
+        }
+        size_t j = ((size_t) table->slots[i].hash) & mask;
+        while (control[j] != CONTROL_EMPTY) {
+            j = (j + 1) & mask;
         }
+        control[j] = table->control[i];
+        slots[j] = table->slots[i];
+    }
+
+    tableFree(table);
+    table->control = control;
+    table->slots = slots;
+    table->capacity = newCapacity;
+    table->deleted = 0;
+    return true;
+}
 
-        // Copy over internals.
-        free(map->buckets);
-        map->buckets = newBuckets;
-        map->bucketCount = newBucketCount;
+/**
+ * Makes room for a new entry, which tableProbe() said goes at *index,
+ * rehashing if need be, in which case *index is updated. Returns false if
+ * there's no room and rehashing failed.
+ */
+static bool tableReserve(Table* table, void* key, int hash,
+        bool (*equals)(void*, void*), size_t* index) {
+    if (table->control[*index] == CONTROL_DELETED) {
+        // Reusing a slot doesn't make probes any longer.
+        return true;
+    }
+    // If the load factor, counting deleted slots, would exceed 0.75...
+    if (table->size + table->deleted + 1 > table->capacity * 3 / 4) {
+        // Grow if the table is at least half full; otherwise the deleted
+        // slots are the problem, and rehashing in place gets rid of them.
+        size_t newCapacity = table->capacity;
+        if (table->size + 1 > table->capacity / 2) {
+            newCapacity <<= 1;
+        }
+        if (tableRehash(table, newCapacity)) {
+            tableProbe(table, key, hash, equals, index);
+        } else if (table->size + table->deleted + 1 >= table->capacity) {
+            // The last empty slot must stay empty, for probes to stop at.
+            return false;
+        }
     }
+    return true;
+}
+
+static void tableInsert(Table* table, size_t index, void* key, int hash, void* value) {
+    if (table->control[index] == CONTROL_DELETED) {
+        table->deleted--;
+    }
+    table->control[index] = controlHash(hash);
+    table->slots[index].key = key;
+    table->slots[index].hash = hash;
+    table->slots[index].value = value;
+    table->size++;
+}
+
+size_t hashmapSize(Hashmap* map) {
+    size_t size = 0;
+    size_t i;
+    for (i = 0; i < map->tableCount; i++) {
+        lockTable(map, &map->tables[i]);
+        size += map->tables[i].size;
+        unlockTable(map, &map->tables[i]);
+    }
+    return size;
 }
 
 void hashmapLock(Hashmap* map) {
@@ -142,15 +334,10 @@ void hashmapUnlock(Hashmap* map) {
 
 void hashmapFree(Hashmap* map) {
     size_t i;
-    for (i = 0; i < map->bucketCount; i++) {
-        Entry* entry = map->buckets[i];
-        while (entry != NULL) {
-            Entry* next = entry->next;
-            free(entry);
-            entry = next;
-        }
+    for (i = 0; i < map->tableCount; i++) {
+        tableFree(&map->tables[i]);
+        mutex_destroy(&map->tables[i].lock);
     }
-    free(map->buckets);
     mutex_destroy(&map->lock);
     free(map);
 }
@@ -170,178 +357,147 @@ int hashmapHash(void* key, size_t keySize) {
     return h;
 }
 
-static Entry* createEntry(void* key, int hash, void* value) {
-    Entry* entry = malloc(sizeof(Entry));
-    if (entry == NULL) {
-        return NULL;
-    }
-    entry->key = key;
-    entry->hash = hash;
-    entry->value = value;
-    entry->next = NULL;
-    return entry;
-}
-
-static inline bool equalKeys(void* keyA, int hashA, void* keyB, int hashB,
-        bool (*equals)(void*, void*)) {
-    if (keyA == keyB) {
-        return true;
-    }
-    if (hashA != hashB) {
-        return false;
-    }
-    return equals(keyA, keyB);
-}
-
 void* hashmapPut(Hashmap* map, void* key, void* value) {
     int hash = hashKey(map, key);
-    size_t index = calculateIndex(map->bucketCount, hash);
-
-    Entry** p = &(map->buckets[index]);
-    while (true) {
-        Entry* current = *p;
-
-        // Add a new entry.
-        if (current == NULL) {
-            *p = createEntry(key, hash, value);
-            if (*p == NULL) {
-                errno = ENOMEM;
-                return NULL;
-            }
-            map->size++;
-            expandIfNecessary(map);
-            return NULL;
-        }
+    Table* table = tableFor(map, hash);
+    void* result = NULL;
+    size_t index;
 
+    lockTable(map, table);
+    if (tableProbe(table, key, hash, map->equals, &index)) {
         // Replace existing entry.
-        if (equalKeys(current->key, current->hash, key, hash, map->equals)) {
-            void* oldValue = current->value;
-            current->value = value;
-            return oldValue;
-        }
-
-        // Move to next entry.
-        p = &current->next;
+        result = table->slots[index].value;
+        table->slots[index].value = value;
+    } else if (tableReserve(table, key, hash, map->equals, &index)) {
+        // Add a new entry.
+        tableInsert(table, index, key, hash, value);
+    } else {
+        errno = ENOMEM;
     }
+    unlockTable(map, table);
+    return result;
 }
 
 void* hashmapGet(Hashmap* map, void* key) {
     int hash = hashKey(map, key);
-    size_t index = calculateIndex(map->bucketCount, hash);
-
-    Entry* entry = map->buckets[index];
-    while (entry != NULL) {
-        if (equalKeys(entry->key, entry->hash, key, hash, map->equals)) {
-            return entry->value;
-        }
-        entry = entry->next;
-    }
+    Table* table = tableFor(map, hash);
 
-    return NULL;
+    lockTable(map, table);
+    size_t index = tableFind(table, key, hash, map->equals);
+    void* value = (index != NOT_FOUND) ? table->slots[index].value : NULL;
+    unlockTable(map, table);
+    return value;
 }
 
 bool hashmapContainsKey(Hashmap* map, void* key) {
     int hash = hashKey(map, key);
-    size_t index = calculateIndex(map->bucketCount, hash);
-
-    Entry* entry = map->buckets[index];
-    while (entry != NULL) {
-        if (equalKeys(entry->key, entry->hash, key, hash, map->equals)) {
-            return true;
-        }
-        entry = entry->next;
-    }
+    Table* table = tableFor(map, hash);
 
-    return false;
+    lockTable(map, table);
+    bool found = tableFind(table, key, hash, map->equals) != NOT_FOUND;
+    unlockTable(map, table);
+    return found;
 }
 
-void* hashmapMemoize(Hashmap* map, void* key, 
+void* hashmapMemoize(Hashmap* map, void* key,
         void* (*initialValue)(void* key, void* context), void* context) {
     int hash = hashKey(map, key);
-    size_t index = calculateIndex(map->bucketCount, hash);
-
-    Entry** p = &(map->buckets[index]);
-    while (true) {
-        Entry* current = *p;
-
-        // Add a new entry.
-        if (current == NULL) {
-            *p = createEntry(key, hash, NULL);
-            if (*p == NULL) {
-                errno = ENOMEM;
-                return NULL;
-            }
-            void* value = initialValue(key, context);
-            (*p)->value = value;
-            map->size++;
-            expandIfNecessary(map);
-            return value;
-        }
+    Table* table = tableFor(map, hash);
+    void* value = NULL;
+    size_t index;
 
+    lockTable(map, table);
+    if (tableProbe(table, key, hash, map->equals, &index)) {
         // Return existing value.
-        if (equalKeys(current->key, current->hash, key, hash, map->equals)) {
-            return current->value;
+        value = table->slots[index].value;
+    } else if (tableReserve(table, key, hash, map->equals, &index)) {
+        // Add a new entry, then ask for its value. The callback may use the
+        // map, and even rehash it, so find the entry again afterwards.
+        tableInsert(table, index, key, hash, NULL);
+        value = initialValue(key, context);
+        index = tableFind(table, key, hash, map->equals);
+        if (index != NOT_FOUND) {
+            table->slots[index].value = value;
         }
-
-        // Move to next entry.
-        p = &current->next;
+    } else {
+        errno = ENOMEM;
     }
+    unlockTable(map, table);
+    return value;
 }
 
 void* hashmapRemove(Hashmap* map, void* key) {
     int hash = hashKey(map, key);
-    size_t index = calculateIndex(map->bucketCount, hash);
-
-    // Pointer to the current entry.
-    Entry** p = &(map->buckets[index]);
-    Entry* current;
-    while ((current = *p) != NULL) {
-        if (equalKeys(current->key, current->hash, key, hash, map->equals)) {
-            void* value = current->value;
-            *p = current->next;
-            free(current);
-            map->size--;
-            return value;
+    Table* table = tableFor(map, hash);
+    void* value = NULL;
+
+    lockTable(map, table);
+    size_t index = tableFind(table, key, hash, map->equals);
+    if (index != NOT_FOUND) {
+        value = table->slots[index].value;
+        // If the next slot is empty, no probe goes past this one, so it can
+        // be empty too rather than deleted.
+        size_t next = (index + 1) & (table->capacity - 1);
+        if (table->control[next] == CONTROL_EMPTY) {
+            table->control[index] = CONTROL_EMPTY;
+        } else {
+            table->control[index] = CONTROL_DELETED;
+            table->deleted++;
         }
-
-        p = &current->next;
+        table->size--;
     }
-
-    return NULL;
+    unlockTable(map, table);
+    return value;
 }
 
-void hashmapForEach(Hashmap* map, 
+void hashmapForEach(Hashmap* map,
         bool (*callback)(void* key, void* value, void* context),
         void* context) {
-    size_t i;
-    for (i = 0; i < map->bucketCount; i++) {
-        Entry* entry = map->buckets[i];
-        while (entry != NULL) {
-            Entry *next = entry->next;
-            if (!callback(entry->key, entry->value, context)) {
+    size_t t;
+    for (t = 0; t < map->tableCount; t++) {
+        Table* table = &map->tables[t];
+        lockTable(map, table);
+        size_t i;
+        for (i = 0; i < table->capacity; i++) {
+            if (table->control[i] & CONTROL_EMPTY) {
+                continue;
+            }
+            if (!callback(table->slots[i].key, table->slots[i].value, context)) {
+                unlockTable(map, table);
                 return;
             }
-            entry = next;
         }
+        unlockTable(map, table);
     }
 }
 
 size_t hashmapCurrentCapacity(Hashmap* map) {
-    size_t bucketCount = map->bucketCount;
-    return bucketCount * 3 / 4;
+    size_t capacity = 0;
+    size_t i;
+    for (i = 0; i < map->tableCount; i++) {
+        lockTable(map, &map->tables[i]);
+        capacity += map->tables[i].capacity * 3 / 4;
+        unlockTable(map, &map->tables[i]);
+    }
+    return capacity;
 }
 
 size_t hashmapCountCollisions(Hashmap* map) {
+    // Entries that aren't in the slot their hash points at.
     size_t collisions = 0;
-    size_t i;
-    for (i = 0; i < map->bucketCount; i++) {
-        Entry* entry = map->buckets[i];
-        while (entry != NULL) {
-            if (entry->next != NULL) {
+    size_t t;
+    for (t = 0; t < map->tableCount; t++) {
+        Table* table = &map->tables[t];
+        lockTable(map, table);
+        size_t mask = table->capacity - 1;
+        size_t i;
+        for (i = 0; i < table->capacity; i++) {
+            if (!(table->control[i] & CONTROL_EMPTY)
+                    && (((size_t) table->slots[i].hash) & mask) != i) {
                 collisions++;
             }
-            entry = entry->next;
         }
+        unlockTable(map, table);
     }
     return collisions;
 }
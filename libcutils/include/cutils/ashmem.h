@@ -27,6 +27,20 @@ int ashmem_pin_region(int fd, size_t offset, size_t len);
 int ashmem_unpin_region(int fd, size_t offset, size_t len);
 int ashmem_get_size_region(int fd);
 
+struct ashmem_range {
+    size_t offset;
+    size_t len;
+};
+
+/*
+ * Pins or unpins each of count ranges of the region, checking fd only once
+ * and merging ranges that follow each other into a single call. Pinning
+ * returns ASHMEM_WAS_PURGED if any range was purged, ASHMEM_NOT_PURGED if
+ * none was; both return <0 on error, after which ranges may have been done.
+ */
+int ashmem_pin_regions(int fd, const struct ashmem_range *ranges, size_t count);
+int ashmem_unpin_regions(int fd, const struct ashmem_range *ranges, size_t count);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,99 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _CUTILS_ASHMEM_POOL_H
+#define _CUTILS_ASHMEM_POOL_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+#include <cutils/ashmem.h>
+#include <cutils/native_handle.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * A fixed size block of shared memory, mapped once, that many small regions
+ * are allocated from, so that sharing a region costs neither a file
+ * descriptor of its own nor an mmap.
+ *
+ * The block is a memfd, sealed against resizing so that receivers can map it
+ * without risking SIGBUS, or an ashmem region where memfd isn't supported.
+ * Every function but ashmem_pool_destroy is thread safe.
+ */
+struct ashmem_pool;
+
+/* Regions are aligned to, and sized in multiples of, this many bytes. */
+#define ASHMEM_POOL_ALIGNMENT 64
+
+/*
+ * Creates a pool of size bytes, rounded up to whole pages. name labels the
+ * memory in /proc/pid/maps, and may be NULL. Returns NULL and sets errno on
+ * failure.
+ */
+struct ashmem_pool *ashmem_pool_create(const char *name, size_t size);
+
+/* Unmaps the pool and closes its fd. Regions that receivers mapped remain. */
+void ashmem_pool_destroy(struct ashmem_pool *pool);
+
+int ashmem_pool_fd(const struct ashmem_pool *pool);
+size_t ashmem_pool_size(const struct ashmem_pool *pool);
+
+/*
+ * Allocates a region of len bytes. Returns its offset in the pool, or
+ * -ENOMEM if there is no room, -EINVAL if len is 0.
+ */
+ssize_t ashmem_pool_alloc(struct ashmem_pool *pool, size_t len);
+
+/*
+ * Frees the region at offset, of the len it was allocated with. Returns 0,
+ * or -EINVAL if it isn't allocated.
+ */
+int ashmem_pool_free(struct ashmem_pool *pool, size_t offset, size_t len);
+
+/* Returns the pool's own mapping of offset. */
+void *ashmem_pool_data(const struct ashmem_pool *pool, size_t offset);
+
+/*
+ * As ashmem_pin_regions and ashmem_unpin_regions, whose page alignment rules
+ * apply. A memfd pool is never purged, so for it these do nothing.
+ */
+int ashmem_pool_pin(struct ashmem_pool *pool, const struct ashmem_range *ranges, size_t count);
+int ashmem_pool_unpin(struct ashmem_pool *pool, const struct ashmem_range *ranges, size_t count);
+
+/*
+ * Creates a native_handle_t, with a dup of the pool's fd, describing the
+ * region at offset, to be sent to another process and mapped there with
+ * ashmem_pool_map_handle. Must be closed and deleted by the caller.
+ */
+native_handle_t *ashmem_pool_create_handle(const struct ashmem_pool *pool, size_t offset,
+                                           size_t len);
+
+/*
+ * Maps the region that handle describes with prot and returns its address,
+ * or NULL with errno set. *mapping and *mapping_len are what to munmap once
+ * done: the mapping starts at the region's page.
+ */
+void *ashmem_pool_map_handle(const native_handle_t *handle, int prot, void **mapping,
+                             size_t *mapping_len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _CUTILS_ASHMEM_POOL_H */
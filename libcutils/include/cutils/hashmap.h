@@ -41,6 +41,18 @@ typedef struct Hashmap Hashmap;
 Hashmap* hashmapCreate(size_t initialCapacity,
         int (*hash)(void* key), bool (*equals)(void* keyA, void* keyB));
 
+/**
+ * Like hashmapCreate, but the map is split into the given number of stripes,
+ * rounded up to a power of two, each with its own lock. Every function below
+ * locks the stripe it needs, so threads using different keys rarely wait for
+ * each other; hashmapLock() doesn't exclude them, and shouldn't be used.
+ *
+ * Callbacks from hashmapForEach() and hashmapMemoize() run with a stripe
+ * locked, so they must not call back into the map.
+ */
+Hashmap* hashmapCreateStriped(size_t initialCapacity, size_t stripes,
+        int (*hash)(void* key), bool (*equals)(void* keyA, void* keyB));
+
 /**
  * Frees the hash map. Does not free the keys or values themselves.
  */
@@ -95,7 +107,8 @@ size_t hashmapSize(Hashmap* map);
 
 /**
  * Invokes the given callback on each entry in the map. Stops iterating if
- * the callback returns false.
+ * the callback returns false. The callback may remove entries, but not add
+ * them.
  */
 void hashmapForEach(Hashmap* map, 
         bool (*callback)(void* key, void* value, void* context),
@@ -139,7 +152,8 @@ bool hashmapIntEquals(void* keyA, void* keyB);
 size_t hashmapCurrentCapacity(Hashmap* map);
 
 /**
- * Counts the number of entry collisions.
+ * Counts the number of entry collisions: entries that aren't in the first
+ * slot their hash would put them in.
  */
 size_t hashmapCountCollisions(Hashmap* map);
 
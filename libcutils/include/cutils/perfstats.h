@@ -0,0 +1,116 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _CUTILS_PERFSTATS_H
+#define _CUTILS_PERFSTATS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Counters and latency histograms that a daemon updates on its hot paths,
+ * exported in a shared memory file that anyone may read at any time, without
+ * asking the daemon anything.
+ *
+ * Every writer thread gets a slot of its own in the file the first time it
+ * updates a metric, so updates are plain stores to memory no other thread
+ * writes. Threads beyond the number the file was created for share a last
+ * slot, with atomic adds. Readers sum the slots.
+ *
+ * perfstats_add and perfstats_record are thread safe and lock free, once a
+ * thread has its slot. perfstats_destroy must not race with them.
+ */
+struct perfstats;
+
+/* Where perfstats_create puts each daemon's file, as the daemon's name. */
+#define PERFSTATS_DIR "/dev/perfstats"
+
+/* Metric names, their NUL included, are at most this long. */
+#define PERFSTATS_NAME_MAX 48
+
+/*
+ * Histogram bucket 0 counts values of 0, and bucket i > 0 those from 2^(i-1)
+ * to 2^i - 1, the last bucket everything above too.
+ */
+#define PERFSTATS_HISTOGRAM_BUCKETS 32
+
+enum perfstats_type {
+    PERFSTATS_COUNTER = 0,
+    PERFSTATS_HISTOGRAM = 1,
+};
+
+struct perfstats_metric {
+    const char *name;
+    enum perfstats_type type;
+};
+
+/*
+ * Creates PERFSTATS_DIR/name, replacing any left by a previous instance, with
+ * count metrics, which are referred to by their index in metrics from then
+ * on, and threads slots besides the shared one. Returns NULL and sets errno
+ * on failure: there, the daemon should carry on, its updates go nowhere.
+ */
+struct perfstats *perfstats_create(const char *name, const struct perfstats_metric *metrics,
+                                   size_t count, size_t threads);
+
+/* As perfstats_create, at path. */
+struct perfstats *perfstats_create_at(const char *path, const struct perfstats_metric *metrics,
+                                      size_t count, size_t threads);
+
+/* Unmaps and removes the file. NULL is ignored. */
+void perfstats_destroy(struct perfstats *ps);
+
+/*
+ * Adds n to counter id. ps may be NULL, so that a daemon that failed to
+ * create its file needn't check before every update.
+ */
+void perfstats_add(struct perfstats *ps, size_t id, uint64_t n);
+
+/* Counts value, e.g. a latency in microseconds, in histogram id. */
+void perfstats_record(struct perfstats *ps, size_t id, uint64_t value);
+
+/*
+ * One metric, summed over the slots. For counters, count is the value and
+ * there is no sum or buckets.
+ */
+struct perfstats_value {
+    const char *name;
+    enum perfstats_type type;
+    uint64_t count;
+    uint64_t sum;
+    const uint64_t *buckets;
+};
+
+typedef void (*perfstats_callback)(const struct perfstats_value *value, void *arg);
+
+/*
+ * Reads the file at path, storing the pid of the daemon that created it in
+ * *pid, if pid isn't NULL, and calling callback for each metric in order.
+ * Returns 0, or -errno if the file can't be read, -EINVAL if it is not a
+ * perfstats file.
+ */
+int perfstats_read(const char *path, pid_t *pid, perfstats_callback callback, void *arg);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _CUTILS_PERFSTATS_H */
@@ -114,6 +114,34 @@ int property_set(const char *key, const char *value);
 
 int property_list(void (*propfn)(const char *key, const char *value, void *cookie), void *cookie);
 
+/* property_cache: holds the value of one property, read again only when the
+** property's serial number shows it has changed, so that polling it costs an
+** atomic load rather than a lookup and a copy. Initialize it with
+** PROPERTY_CACHE_INIT and use it only through property_cache_get.
+**
+** Not thread safe: use one per thread, or guard it with a lock.
+*/
+struct property_cache {
+    const char *key;
+    const struct prop_info *pinfo;
+    uint32_t area_serial;
+    uint32_t serial;
+    uint8_t looked_up;
+    uint8_t read;
+    char value[PROPERTY_VALUE_MAX];
+};
+
+#define PROPERTY_CACHE_INIT(key) { (key), NULL, 0, 0, 0, 0, { '\0' } }
+
+/* property_cache_get: returns the current value of cache->key, or
+** default_value if the property is empty or doesn't exist, as property_get
+** would. The returned pointer is good until the next call. If changed is
+** nonnull, *changed is set to whether the value may differ from that of the
+** previous call.
+*/
+const char *property_cache_get(struct property_cache *cache, const char *default_value,
+                               int *changed);
+
 #if defined(__BIONIC_FORTIFY)
 #define __property_get_err_str "property_get() called with too small of a buffer"
 
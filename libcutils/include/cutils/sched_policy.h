@@ -18,6 +18,7 @@
 #define __CUTILS_SCHED_POLICY_H
 
 #include <stdbool.h>
+#include <stddef.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -55,6 +56,14 @@ typedef enum {
 
 extern int set_cpuset_policy(int tid, SchedPolicy policy);
 
+/* Like set_cpuset_policy() and set_sched_policy(), for each of the count
+ * threads in tids, for callers moving all the threads of a process at once.
+ * Every thread is tried, even after errors.
+ * Return value: 0 for success, or -errno for the first error.
+ */
+extern int set_cpuset_policy_tids(const int* tids, size_t count, SchedPolicy policy);
+extern int set_sched_policy_tids(const int* tids, size_t count, SchedPolicy policy);
+
 /* Assign thread tid to the cgroup associated with the specified policy.
  * If the thread is a thread group leader, that is it's gettid() == getpid(),
  * then the other threads in the same thread group are _not_ affected.
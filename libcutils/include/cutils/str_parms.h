@@ -17,6 +17,7 @@
 #ifndef __CUTILS_STR_PARMS_H
 #define __CUTILS_STR_PARMS_H
 
+#include <stddef.h>
 #include <stdint.h>
 #include <sys/cdefs.h>
 
@@ -55,6 +56,46 @@ char *str_parms_to_str(struct str_parms *str_parms);
 /* debug */
 void str_parms_dump(struct str_parms *str_parms);
 
+/*
+ * A read-only alternative to str_parms_create_str() that doesn't allocate or
+ * copy anything: the pairs point into the parsed string, which must outlive
+ * the view and not change. Strings are split exactly as by
+ * str_parms_create_str(), and a later value for a key replaces an earlier one.
+ */
+
+#define STR_PARMS_VIEW_MAX_PAIRS 16
+
+struct str_parms_pair {
+    const char *key;
+    size_t key_len;
+    const char *value;
+    size_t value_len;
+};
+
+struct str_parms_view {
+    size_t count;
+    struct str_parms_pair pairs[STR_PARMS_VIEW_MAX_PAIRS];
+};
+
+// Parses "key1=value1;key2=value2;..." into view. Returns the number of
+// distinct keys, or -E2BIG if there are more than STR_PARMS_VIEW_MAX_PAIRS,
+// in which case the caller should fall back to str_parms_create_str().
+int str_parms_view_parse(struct str_parms_view *view, const char *string);
+
+// Returns the pair for key, or NULL.
+const struct str_parms_pair *str_parms_view_find(const struct str_parms_view *view,
+                                                 const char *key);
+
+// As the str_parms_ functions of the same names. The numeric ones return
+// -EINVAL for values longer than 63 characters.
+int str_parms_view_has_key(const struct str_parms_view *view, const char *key);
+int str_parms_view_get_str(const struct str_parms_view *view, const char *key,
+                           char *out_val, int len);
+int str_parms_view_get_int(const struct str_parms_view *view, const char *key,
+                           int *out_val);
+int str_parms_view_get_float(const struct str_parms_view *view, const char *key,
+                             float *out_val);
+
 __END_DECLS
 
 #endif /* __CUTILS_STR_PARMS_H */
@@ -29,6 +29,28 @@ ssize_t uevent_kernel_multicast_recv(int socket, void *buffer, size_t length);
 ssize_t uevent_kernel_multicast_uid_recv(int socket, void *buffer, size_t length, uid_t *uid);
 ssize_t uevent_kernel_recv(int socket, void *buffer, size_t length, bool require_group, uid_t *uid);
 
+#define UEVENT_RECVMMSG_MAX 64
+
+struct uevent_msg {
+    /* Set by the caller */
+    void *buffer;
+    size_t length;
+    /* Set by uevent_kernel_recvmmsg() */
+    ssize_t received;
+    int error;
+    uid_t uid;
+};
+
+/*
+ * Like calling uevent_kernel_recv() for each of count messages (at most
+ * UEVENT_RECVMMSG_MAX) in one system call, but only blocking for the first.
+ * Returns the number of messages received, or -1 with errno set. Messages
+ * that failed uevent_kernel_recv()'s checks, or didn't fit in their buffer,
+ * have a received of -1 and error set to EIO or EMSGSIZE.
+ */
+int uevent_kernel_recvmmsg(int socket, struct uevent_msg *msgs, unsigned int count,
+                           bool require_group);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1 @@
+../../include/cutils/ashmem_pool.h
\ No newline at end of file
@@ -0,0 +1 @@
+../../include/cutils/perfstats.h
\ No newline at end of file
@@ -0,0 +1,476 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "perfstats"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cutils/perfstats.h>
+#include <log/log.h>
+#include <utils/Compat.h>
+
+/*
+ * The file: a header, a descriptor per metric, then the slots, each of
+ * slot_words 64 bit words. A metric is the same words at its offset in every
+ * slot, one for a counter, the buckets then the sum for a histogram. Slots
+ * are whole cache lines, so that threads don't share any.
+ */
+#define PERFSTATS_MAGIC 0x41545350 /* "PSTA" */
+#define PERFSTATS_VERSION 1
+
+#define WORDS_PER_LINE 8
+#define MAX_METRICS 4096
+#define MAX_THREADS 1024
+
+struct perfstats_header {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t metric_count;
+    uint32_t slot_count;
+    uint32_t slot_words;
+    int32_t pid;
+    uint32_t reserved[10];
+};
+
+struct perfstats_descriptor {
+    char name[PERFSTATS_NAME_MAX];
+    uint32_t type;
+    uint32_t offset;
+    uint64_t reserved;
+};
+
+struct perfstats {
+    uint8_t *base;
+    size_t size;
+    char *path;
+    /* So as only to remove our own file, not what replaced it. */
+    dev_t dev;
+    ino_t ino;
+    const struct perfstats_descriptor *metrics;
+    size_t metric_count;
+    _Atomic uint64_t *slots;
+    size_t slot_words;
+    /* The shared slot, the one after the threads'. */
+    uint32_t shared;
+
+    pthread_key_t key;
+    pthread_mutex_t lock;
+    /* Slots of threads that exited, and the first never handed out. */
+    uint32_t *free;
+    size_t free_count;
+    uint32_t next;
+};
+
+struct perfstats_thread {
+    struct perfstats *ps;
+    uint32_t slot;
+};
+
+static size_t metric_words(enum perfstats_type type)
+{
+    return type == PERFSTATS_HISTOGRAM ? PERFSTATS_HISTOGRAM_BUCKETS + 1 : 1;
+}
+
+static size_t data_offset(size_t metric_count)
+{
+    return sizeof(struct perfstats_header) +
+           metric_count * sizeof(struct perfstats_descriptor);
+}
+
+static void release_slot(void *arg)
+{
+    struct perfstats_thread *thread = arg;
+    struct perfstats *ps = thread->ps;
+
+    /* What the thread counted stays in the slot, for the next one to add to. */
+    pthread_mutex_lock(&ps->lock);
+    ps->free[ps->free_count++] = thread->slot;
+    pthread_mutex_unlock(&ps->lock);
+    free(thread);
+}
+
+/* Returns the calling thread's slot, the shared one if it has none. */
+static uint32_t thread_slot(struct perfstats *ps)
+{
+    struct perfstats_thread *thread = pthread_getspecific(ps->key);
+    uint32_t slot;
+
+    if (thread) {
+        return thread->slot;
+    }
+
+    pthread_mutex_lock(&ps->lock);
+    if (ps->free_count) {
+        slot = ps->free[--ps->free_count];
+    } else if (ps->next < ps->shared) {
+        slot = ps->next++;
+    } else {
+        pthread_mutex_unlock(&ps->lock);
+        return ps->shared;
+    }
+    pthread_mutex_unlock(&ps->lock);
+
+    thread = malloc(sizeof(*thread));
+    if (!thread || pthread_setspecific(ps->key, thread)) {
+        free(thread);
+        pthread_mutex_lock(&ps->lock);
+        ps->free[ps->free_count++] = slot;
+        pthread_mutex_unlock(&ps->lock);
+        return ps->shared;
+    }
+    thread->ps = ps;
+    thread->slot = slot;
+    return slot;
+}
+
+static void add_word(_Atomic uint64_t *word, uint64_t n, bool shared)
+{
+    if (shared) {
+        atomic_fetch_add_explicit(word, n, memory_order_relaxed);
+    } else {
+        /* Ours alone, the atomics are only so that readers see whole words. */
+        atomic_store_explicit(word, atomic_load_explicit(word, memory_order_relaxed) + n,
+                              memory_order_relaxed);
+    }
+}
+
+static _Atomic uint64_t *metric_data(struct perfstats *ps, size_t id,
+                                     enum perfstats_type type, bool *shared)
+{
+    uint32_t slot;
+
+    if (!ps || id >= ps->metric_count || ps->metrics[id].type != (uint32_t)type) {
+        return NULL;
+    }
+    slot = thread_slot(ps);
+    *shared = slot == ps->shared;
+    return ps->slots + slot * ps->slot_words + ps->metrics[id].offset;
+}
+
+void perfstats_add(struct perfstats *ps, size_t id, uint64_t n)
+{
+    bool shared = false;
+    _Atomic uint64_t *data = metric_data(ps, id, PERFSTATS_COUNTER, &shared);
+
+    if (data) {
+        add_word(data, n, shared);
+    }
+}
+
+void perfstats_record(struct perfstats *ps, size_t id, uint64_t value)
+{
+    bool shared = false;
+    _Atomic uint64_t *data = metric_data(ps, id, PERFSTATS_HISTOGRAM, &shared);
+    size_t bucket = 0;
+
+    if (!data) {
+        return;
+    }
+    if (value) {
+        bucket = 64 - __builtin_clzll(value);
+        if (bucket >= PERFSTATS_HISTOGRAM_BUCKETS) {
+            bucket = PERFSTATS_HISTOGRAM_BUCKETS - 1;
+        }
+    }
+    add_word(&data[bucket], 1, shared);
+    add_word(&data[PERFSTATS_HISTOGRAM_BUCKETS], value, shared);
+}
+
+static bool valid_metrics(const struct perfstats_metric *metrics, size_t count)
+{
+    size_t i;
+
+    if (count == 0 || count > MAX_METRICS) {
+        return false;
+    }
+    for (i = 0; i < count; ++i) {
+        size_t len = metrics[i].name ? strlen(metrics[i].name) : 0;
+        if (len == 0 || len >= PERFSTATS_NAME_MAX ||
+                (metrics[i].type != PERFSTATS_COUNTER &&
+                 metrics[i].type != PERFSTATS_HISTOGRAM)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/*
+ * Fills in a temporary file next to path and renames it over path, so that
+ * readers only ever open complete files, and any still reading one left by a
+ * previous instance of the daemon aren't pulled from under.
+ */
+static int create_file(struct perfstats *ps, const char *path,
+                       const struct perfstats_metric *metrics, size_t count, size_t threads)
+{
+    const char *base = strrchr(path, '/');
+    size_t dir_len = base ? (size_t)(base - path + 1) : 0;
+    struct perfstats_header *header;
+    struct perfstats_descriptor *descriptors;
+    char temp[PATH_MAX];
+    struct stat st;
+    size_t offset = 0;
+    size_t i;
+    int save_errno;
+    int fd;
+
+    base = path + dir_len;
+    if (snprintf(temp, sizeof(temp), "%.*s.%s.XXXXXX", (int)dir_len, path, base) >=
+            (int)sizeof(temp)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+
+    for (i = 0; i < count; ++i) {
+        offset += metric_words(metrics[i].type);
+    }
+    ps->slot_words = (offset + WORDS_PER_LINE - 1) & ~(size_t)(WORDS_PER_LINE - 1);
+    ps->size = data_offset(count) + (threads + 1) * ps->slot_words * sizeof(uint64_t);
+
+    fd = mkstemp(temp);
+    if (fd < 0) {
+        return -1;
+    }
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+    if (fchmod(fd, 0644) < 0 || TEMP_FAILURE_RETRY(ftruncate(fd, ps->size)) < 0) {
+        goto error;
+    }
+    ps->base = mmap(NULL, ps->size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (ps->base == MAP_FAILED) {
+        ps->base = NULL;
+        goto error;
+    }
+
+    header = (struct perfstats_header *)ps->base;
+    header->magic = PERFSTATS_MAGIC;
+    header->version = PERFSTATS_VERSION;
+    header->metric_count = count;
+    header->slot_count = threads + 1;
+    header->slot_words = ps->slot_words;
+    header->pid = getpid();
+
+    descriptors = (struct perfstats_descriptor *)(header + 1);
+    for (i = 0, offset = 0; i < count; ++i) {
+        /* validated to fit, and the file starts out zeroed */
+        memcpy(descriptors[i].name, metrics[i].name, strlen(metrics[i].name));
+        descriptors[i].type = metrics[i].type;
+        descriptors[i].offset = offset;
+        offset += metric_words(metrics[i].type);
+    }
+
+    if (fstat(fd, &st) < 0 || rename(temp, path) < 0) {
+        goto error;
+    }
+    close(fd);
+    ps->dev = st.st_dev;
+    ps->ino = st.st_ino;
+    ps->metrics = descriptors;
+    ps->metric_count = count;
+    ps->slots = (_Atomic uint64_t *)(ps->base + data_offset(count));
+    ps->shared = threads;
+    return 0;
+
+error:
+    save_errno = errno;
+    if (ps->base) {
+        munmap(ps->base, ps->size);
+        ps->base = NULL;
+    }
+    unlink(temp);
+    close(fd);
+    errno = save_errno;
+    return -1;
+}
+
+struct perfstats *perfstats_create_at(const char *path, const struct perfstats_metric *metrics,
+                                      size_t count, size_t threads)
+{
+    struct perfstats *ps;
+    int save_errno;
+
+    if (!valid_metrics(metrics, count) || threads > MAX_THREADS) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    ps = calloc(1, sizeof(*ps));
+    if (!ps) {
+        return NULL;
+    }
+    pthread_mutex_init(&ps->lock, NULL);
+    ps->path = strdup(path);
+    ps->free = malloc((threads + 1) * sizeof(*ps->free));
+    if (!ps->path || !ps->free) {
+        goto error;
+    }
+    if ((errno = pthread_key_create(&ps->key, release_slot)) != 0) {
+        goto error_key;
+    }
+    if (create_file(ps, path, metrics, count, threads) < 0) {
+        save_errno = errno;
+        pthread_key_delete(ps->key);
+        errno = save_errno;
+        goto error_key;
+    }
+    return ps;
+
+error:
+    errno = ENOMEM;
+error_key:
+    save_errno = errno;
+    ALOGW("could not create %s: %s", path, strerror(save_errno));
+    free(ps->path);
+    free(ps->free);
+    pthread_mutex_destroy(&ps->lock);
+    free(ps);
+    errno = save_errno;
+    return NULL;
+}
+
+struct perfstats *perfstats_create(const char *name, const struct perfstats_metric *metrics,
+                                   size_t count, size_t threads)
+{
+    char path[PATH_MAX];
+
+    if (!name || !*name || *name == '.' || strchr(name, '/')) {
+        errno = EINVAL;
+        return NULL;
+    }
+    snprintf(path, sizeof(path), PERFSTATS_DIR "/%s", name);
+    return perfstats_create_at(path, metrics, count, threads);
+}
+
+void perfstats_destroy(struct perfstats *ps)
+{
+    struct perfstats_thread *thread;
+    struct stat st;
+
+    if (!ps) {
+        return;
+    }
+    /* Other threads' are lost, deleting the key keeps them from running. */
+    thread = pthread_getspecific(ps->key);
+    pthread_key_delete(ps->key);
+    free(thread);
+
+    if (stat(ps->path, &st) == 0 && st.st_dev == ps->dev && st.st_ino == ps->ino) {
+        unlink(ps->path);
+    }
+    munmap(ps->base, ps->size);
+    free(ps->path);
+    free(ps->free);
+    pthread_mutex_destroy(&ps->lock);
+    free(ps);
+}
+
+int perfstats_read(const char *path, pid_t *pid, perfstats_callback callback, void *arg)
+{
+    const struct perfstats_header *header;
+    const struct perfstats_descriptor *descriptors;
+    uint64_t buckets[PERFSTATS_HISTOGRAM_BUCKETS];
+    _Atomic uint64_t *slots;
+    struct stat st;
+    uint8_t *base;
+    int ret = -EINVAL;
+    size_t i, slot, words;
+    int fd;
+
+    fd = TEMP_FAILURE_RETRY(open(path, O_RDONLY | O_CLOEXEC));
+    if (fd < 0) {
+        return -errno;
+    }
+    if (fstat(fd, &st) < 0) {
+        ret = -errno;
+        close(fd);
+        return ret;
+    }
+    if ((uint64_t)st.st_size < sizeof(*header) || (uint64_t)st.st_size > SIZE_MAX) {
+        close(fd);
+        return -EINVAL;
+    }
+    base = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) {
+        return -errno;
+    }
+
+    header = (const struct perfstats_header *)base;
+    if (header->magic != PERFSTATS_MAGIC || header->version != PERFSTATS_VERSION ||
+            header->metric_count > MAX_METRICS || header->slot_count > MAX_THREADS + 1 ||
+            data_offset(header->metric_count) +
+                (uint64_t)header->slot_count * header->slot_words * sizeof(uint64_t) >
+                (uint64_t)st.st_size) {
+        goto out;
+    }
+    descriptors = (const struct perfstats_descriptor *)(header + 1);
+    for (i = 0; i < header->metric_count; ++i) {
+        if ((descriptors[i].type != PERFSTATS_COUNTER &&
+             descriptors[i].type != PERFSTATS_HISTOGRAM) ||
+                descriptors[i].offset + metric_words(descriptors[i].type) >
+                    header->slot_words ||
+                !memchr(descriptors[i].name, '\0', sizeof(descriptors[i].name))) {
+            goto out;
+        }
+    }
+
+    if (pid) {
+        *pid = header->pid;
+    }
+    slots = (_Atomic uint64_t *)(base + data_offset(header->metric_count));
+    for (i = 0; i < header->metric_count; ++i) {
+        struct perfstats_value value;
+        words = metric_words(descriptors[i].type);
+        memset(buckets, 0, sizeof(buckets));
+        memset(&value, 0, sizeof(value));
+        value.name = descriptors[i].name;
+        value.type = descriptors[i].type;
+        for (slot = 0; slot < header->slot_count; ++slot) {
+            _Atomic uint64_t *data = slots + slot * header->slot_words + descriptors[i].offset;
+            if (words == 1) {
+                value.count += atomic_load_explicit(data, memory_order_relaxed);
+                continue;
+            }
+            for (size_t b = 0; b < PERFSTATS_HISTOGRAM_BUCKETS; ++b) {
+                buckets[b] += atomic_load_explicit(&data[b], memory_order_relaxed);
+            }
+            value.sum +=
+                atomic_load_explicit(&data[PERFSTATS_HISTOGRAM_BUCKETS], memory_order_relaxed);
+        }
+        if (words > 1) {
+            for (size_t b = 0; b < PERFSTATS_HISTOGRAM_BUCKETS; ++b) {
+                value.count += buckets[b];
+            }
+            value.buckets = buckets;
+        }
+        callback(&value, arg);
+    }
+    ret = 0;
+
+out:
+    munmap(base, st.st_size);
+    return ret;
+}
@@ -26,6 +26,9 @@
 #include <string.h>
 #include <unistd.h>
 
+#define _REALLY_INCLUDE_SYS__SYSTEM_PROPERTIES_H_
+#include <sys/_system_properties.h>
+
 #include <cutils/properties.h>
 #include <cutils/sockets.h>
 #include <log/log.h>
@@ -142,3 +145,35 @@ int property_list(void (*fn)(const char* name, const char* value, void* cookie),
     callback_data data = { fn, cookie };
     return __system_property_foreach(property_list_callback, &data);
 }
+
+static void property_cache_callback(void* cookie, const char* /*name*/, const char* value,
+                                    unsigned serial) {
+    property_cache* cache = reinterpret_cast<property_cache*>(cookie);
+    strlcpy(cache->value, value, sizeof(cache->value));
+    cache->serial = serial;
+}
+
+const char* property_cache_get(property_cache* cache, const char* default_value, int* changed) {
+    if (changed) *changed = 0;
+
+    if (!cache->pinfo) {
+        // Properties can't be removed, so a missing one stays missing until
+        // some property is added, which moves the area serial. Read that
+        // before looking, so that a property added meanwhile isn't missed.
+        uint32_t area_serial = __system_property_area_serial();
+        if (cache->looked_up && area_serial == cache->area_serial) return default_value;
+        cache->looked_up = 1;
+        cache->area_serial = area_serial;
+        cache->pinfo = __system_property_find(cache->key);
+        if (!cache->pinfo) return default_value;
+    }
+
+    if (!cache->read || __system_property_serial(cache->pinfo) != cache->serial) {
+        char old_value[PROPERTY_VALUE_MAX];
+        if (changed) strlcpy(old_value, cache->value, sizeof(old_value));
+        __system_property_read_callback(cache->pinfo, property_cache_callback, cache);
+        if (changed) *changed = !cache->read || strcmp(old_value, cache->value) != 0;
+        cache->read = 1;
+    }
+    return cache->value[0] ? cache->value : default_value;
+}
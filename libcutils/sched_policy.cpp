@@ -172,75 +172,72 @@ static void __initialize() {
 }
 
 /*
- * Returns the path under the requested cgroup subsystem (if it exists)
+ * Returns the paths under the schedtune and cpuset cgroup subsystems
  *
  * The data from /proc/<pid>/cgroup looks (something) like:
- *  2:cpu:/bg_non_interactive
+ *  3:schedtune:/foreground
+ *  2:cpuset:/foreground
  *  1:cpuacct:/
  *
  * We return the part after the "/", which will be an empty string for
  * the default cgroup.  If the string is longer than "bufLen", the string
- * will be truncated.
+ * will be truncated.  The file is read with a single read(2) and parsed in
+ * place, once for both subsystems, since ActivityManager asks for the
+ * policy of every thread of a process at a time.
+ *
+ * Returns a bitmask of the subsystems that were found: 1 for schedtune,
+ * 2 for cpuset, or -1 if /proc/<pid>/cgroup couldn't be read.
  */
-static int getCGroupSubsys(int tid, const char* subsys, char* buf, size_t bufLen)
+static int getCGroupSubsys(int tid, char* schedtune, char* cpuset, size_t bufLen)
 {
-#if defined(__ANDROID__)
     char pathBuf[32];
-    char lineBuf[256];
-    FILE *fp;
+    char data[1024];
 
     snprintf(pathBuf, sizeof(pathBuf), "/proc/%d/cgroup", tid);
-    if (!(fp = fopen(pathBuf, "re"))) {
+    int fd = open(pathBuf, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
         return -1;
     }
+    ssize_t len = TEMP_FAILURE_RETRY(read(fd, data, sizeof(data) - 1));
+    close(fd);
+    if (len < 0) {
+        return -1;
+    }
+    data[len] = '\0';
 
-    while(fgets(lineBuf, sizeof(lineBuf) -1, fp)) {
-        char *next = lineBuf;
-        char *found_subsys;
-        char *grp;
-        size_t len;
-
-        /* Junk the first field */
-        if (!strsep(&next, ":")) {
-            goto out_bad_data;
+    int found = 0;
+    char *next = data;
+    char *line;
+    while ((line = strsep(&next, "\n")) != NULL) {
+        if (*line == '\0') {
+            continue;
         }
 
-        if (!(found_subsys = strsep(&next, ":"))) {
-            goto out_bad_data;
+        /* Junk the first field */
+        char *fields = line;
+        char *subsys;
+        char *grp;
+        if (!strsep(&fields, ":") || !(subsys = strsep(&fields, ":")) ||
+                !(grp = fields) || *grp != '/') {
+            SLOGE("Bad cgroup data {%s}", line);
+            return -1;
         }
 
-        if (strcmp(found_subsys, subsys)) {
-            /* Not the subsys we're looking for */
+        char *out;
+        if (!strcmp(subsys, "schedtune")) {
+            out = schedtune;
+            found |= 1;
+        } else if (!strcmp(subsys, "cpuset")) {
+            out = cpuset;
+            found |= 2;
+        } else {
+            /* Not a subsys we're looking for */
             continue;
         }
-
-        if (!(grp = strsep(&next, ":"))) {
-            goto out_bad_data;
-        }
         grp++; /* Drop the leading '/' */
-        len = strlen(grp);
-        grp[len-1] = '\0'; /* Drop the trailing '\n' */
-
-        if (bufLen <= len) {
-            len = bufLen - 1;
-        }
-        strncpy(buf, grp, len);
-        buf[len] = '\0';
-        fclose(fp);
-        return 0;
+        strlcpy(out, grp, bufLen);
     }
-
-    SLOGE("Failed to find subsys %s", subsys);
-    fclose(fp);
-    return -1;
- out_bad_data:
-    SLOGE("Bad cgroup data {%s}", lineBuf);
-    fclose(fp);
-    return -1;
-#else
-    errno = ENOSYS;
-    return -1;
-#endif
+    return found;
 }
 
 int get_sched_policy(int tid, SchedPolicy *policy)
@@ -250,14 +247,26 @@ int get_sched_policy(int tid, SchedPolicy *policy)
     }
     pthread_once(&the_once, __initialize);
 
-    char grpBuf[32];
-
-    grpBuf[0] = '\0';
-    if (schedboost_enabled()) {
-        if (getCGroupSubsys(tid, "schedtune", grpBuf, sizeof(grpBuf)) < 0) return -1;
-    }
-    if ((grpBuf[0] == '\0') && cpusets_enabled()) {
-        if (getCGroupSubsys(tid, "cpuset", grpBuf, sizeof(grpBuf)) < 0) return -1;
+    char schedtuneBuf[32];
+    char cpusetBuf[32];
+    schedtuneBuf[0] = '\0';
+    cpusetBuf[0] = '\0';
+
+    char *grpBuf = schedtuneBuf;
+    if (schedboost_enabled() || cpusets_enabled()) {
+        int found = getCGroupSubsys(tid, schedtuneBuf, cpusetBuf, sizeof(schedtuneBuf));
+        if (found < 0) return -1;
+        if (schedboost_enabled() && !(found & 1)) {
+            SLOGE("Failed to find subsys schedtune");
+            return -1;
+        }
+        if ((!schedboost_enabled() || grpBuf[0] == '\0') && cpusets_enabled()) {
+            if (!(found & 2)) {
+                SLOGE("Failed to find subsys cpuset");
+                return -1;
+            }
+            grpBuf = cpusetBuf;
+        }
     }
     if (grpBuf[0] == '\0') {
         *policy = SP_FOREGROUND;
@@ -277,15 +286,17 @@ int get_sched_policy(int tid, SchedPolicy *policy)
 }
 
 int set_cpuset_policy(int tid, SchedPolicy policy)
+{
+    return set_cpuset_policy_tids(&tid, 1, policy);
+}
+
+int set_cpuset_policy_tids(const int* tids, size_t count, SchedPolicy policy)
 {
     // in the absence of cpusets, use the old sched policy
     if (!cpusets_enabled()) {
-        return set_sched_policy(tid, policy);
+        return set_sched_policy_tids(tids, count, policy);
     }
 
-    if (tid == 0) {
-        tid = gettid();
-    }
     policy = _policy(policy);
     pthread_once(&the_once, __initialize);
 
@@ -314,19 +325,27 @@ int set_cpuset_policy(int tid, SchedPolicy policy)
         break;
     }
 
-    if (add_tid_to_cgroup(tid, fd) != 0) {
-        if (errno != ESRCH && errno != ENOENT)
-            return -errno;
-    }
+    int ret = 0;
+    for (size_t i = 0; i < count; i++) {
+        int tid = tids[i] == 0 ? gettid() : tids[i];
 
-    if (schedboost_enabled()) {
-        if (boost_fd > 0 && add_tid_to_cgroup(tid, boost_fd) != 0) {
-            if (errno != ESRCH && errno != ENOENT)
-                return -errno;
+        if (add_tid_to_cgroup(tid, fd) != 0) {
+            if (errno != ESRCH && errno != ENOENT) {
+                if (ret == 0) ret = -errno;
+                continue;
+            }
+        }
+
+        if (schedboost_enabled()) {
+            if (boost_fd > 0 && add_tid_to_cgroup(tid, boost_fd) != 0) {
+                if (errno != ESRCH && errno != ENOENT) {
+                    if (ret == 0) ret = -errno;
+                }
+            }
         }
     }
 
-    return 0;
+    return ret;
 }
 
 static void set_timerslack_ns(int tid, unsigned long slack) {
@@ -356,58 +375,16 @@ static void set_timerslack_ns(int tid, unsigned long slack) {
 
 int set_sched_policy(int tid, SchedPolicy policy)
 {
-    if (tid == 0) {
-        tid = gettid();
-    }
+    return set_sched_policy_tids(&tid, 1, policy);
+}
+
+int set_sched_policy_tids(const int* tids, size_t count, SchedPolicy policy)
+{
     policy = _policy(policy);
     pthread_once(&the_once, __initialize);
 
-#if POLICY_DEBUG
-    char statfile[64];
-    char statline[1024];
-    char thread_name[255];
-
-    snprintf(statfile, sizeof(statfile), "/proc/%d/stat", tid);
-    memset(thread_name, 0, sizeof(thread_name));
-
-    int fd = open(statfile, O_RDONLY | O_CLOEXEC);
-    if (fd >= 0) {
-        int rc = read(fd, statline, 1023);
-        close(fd);
-        statline[rc] = 0;
-        char *p = statline;
-        char *q;
-
-        for (p = statline; *p != '('; p++);
-        p++;
-        for (q = p; *q != ')'; q++);
-
-        strncpy(thread_name, p, (q-p));
-    }
-    switch (policy) {
-    case SP_BACKGROUND:
-        SLOGD("vvv tid %d (%s)", tid, thread_name);
-        break;
-    case SP_FOREGROUND:
-    case SP_AUDIO_APP:
-    case SP_AUDIO_SYS:
-    case SP_TOP_APP:
-        SLOGD("^^^ tid %d (%s)", tid, thread_name);
-        break;
-    case SP_SYSTEM:
-        SLOGD("/// tid %d (%s)", tid, thread_name);
-        break;
-    case SP_RT_APP:
-	SLOGD("RT  tid %d (%s)", tid, thread_name);
-	break;
-    default:
-        SLOGD("??? tid %d (%s)", tid, thread_name);
-        break;
-    }
-#endif
-
+    int boost_fd = -1;
     if (schedboost_enabled()) {
-        int boost_fd = -1;
         switch (policy) {
         case SP_BACKGROUND:
             boost_fd = bg_schedboost_fd;
@@ -427,17 +404,67 @@ int set_sched_policy(int tid, SchedPolicy policy)
             boost_fd = -1;
             break;
         }
+    }
+
+    int ret = 0;
+    for (size_t i = 0; i < count; i++) {
+        int tid = tids[i] == 0 ? gettid() : tids[i];
+
+#if POLICY_DEBUG
+        char statfile[64];
+        char statline[1024];
+        char thread_name[255];
+
+        snprintf(statfile, sizeof(statfile), "/proc/%d/stat", tid);
+        memset(thread_name, 0, sizeof(thread_name));
+
+        int fd = open(statfile, O_RDONLY | O_CLOEXEC);
+        if (fd >= 0) {
+            int rc = read(fd, statline, 1023);
+            close(fd);
+            statline[rc] = 0;
+            char *p = statline;
+            char *q;
+
+            for (p = statline; *p != '('; p++);
+            p++;
+            for (q = p; *q != ')'; q++);
+
+            strncpy(thread_name, p, (q-p));
+        }
+        switch (policy) {
+        case SP_BACKGROUND:
+            SLOGD("vvv tid %d (%s)", tid, thread_name);
+            break;
+        case SP_FOREGROUND:
+        case SP_AUDIO_APP:
+        case SP_AUDIO_SYS:
+        case SP_TOP_APP:
+            SLOGD("^^^ tid %d (%s)", tid, thread_name);
+            break;
+        case SP_SYSTEM:
+            SLOGD("/// tid %d (%s)", tid, thread_name);
+            break;
+        case SP_RT_APP:
+            SLOGD("RT  tid %d (%s)", tid, thread_name);
+            break;
+        default:
+            SLOGD("??? tid %d (%s)", tid, thread_name);
+            break;
+        }
+#endif
 
         if (boost_fd > 0 && add_tid_to_cgroup(tid, boost_fd) != 0) {
-            if (errno != ESRCH && errno != ENOENT)
-                return -errno;
+            if (errno != ESRCH && errno != ENOENT) {
+                if (ret == 0) ret = -errno;
+                continue;
+            }
         }
 
+        set_timerslack_ns(tid, policy == SP_BACKGROUND ? TIMER_SLACK_BG : TIMER_SLACK_FG);
     }
 
-    set_timerslack_ns(tid, policy == SP_BACKGROUND ? TIMER_SLACK_BG : TIMER_SLACK_FG);
-
-    return 0;
+    return ret;
 }
 
 #else
@@ -449,6 +476,11 @@ int set_sched_policy(int tid UNUSED, SchedPolicy policy UNUSED)
     return 0;
 }
 
+int set_sched_policy_tids(const int* tids UNUSED, size_t count UNUSED, SchedPolicy policy UNUSED)
+{
+    return 0;
+}
+
 int get_sched_policy(int tid UNUSED, SchedPolicy *policy)
 {
     *policy = SP_SYSTEM_DEFAULT;
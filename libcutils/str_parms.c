@@ -143,43 +143,69 @@ void str_parms_destroy(struct str_parms *str_parms)
     free(str_parms);
 }
 
+/*
+ * Finds the next pair in the ';' separated string at *cursor, splitting it as
+ * strtok_r() and strchr() would, and moves *cursor past it. Pairs without a
+ * key ("=value") are skipped. Returns false at the end of the string.
+ */
+static bool next_pair(const char **cursor, struct str_parms_pair *pair)
+{
+    const char *p = *cursor;
+
+    for (;;) {
+        while (*p == ';')
+            p++;
+        if (!*p)
+            break;
+
+        const char *start = p;
+        const char *eq = NULL;
+        for (; *p && *p != ';'; p++) {
+            if (*p == '=' && !eq)
+                eq = p;
+        }
+        if (eq == start)
+            continue;
+
+        pair->key = start;
+        if (eq) {
+            pair->key_len = eq - start;
+            pair->value = eq + 1;
+        } else {
+            pair->key_len = p - start;
+            pair->value = p;
+        }
+        pair->value_len = p - pair->value;
+        *cursor = p;
+        return true;
+    }
+
+    *cursor = p;
+    return false;
+}
+
 struct str_parms *str_parms_create_str(const char *_string)
 {
     struct str_parms *str_parms;
-    char *str;
-    char *kvpair;
-    char *tmpstr;
+    const char *cursor = _string;
+    struct str_parms_pair pair;
     int items = 0;
 
     str_parms = str_parms_create();
     if (!str_parms)
         goto err_create_str_parms;
 
-    str = strdup(_string);
-    if (!str)
-        goto err_strdup;
-
     ALOGV("%s: source string == '%s'\n", __func__, _string);
 
-    kvpair = strtok_r(str, ";", &tmpstr);
-    while (kvpair && *kvpair) {
-        char *eq = strchr(kvpair, '='); /* would love strchrnul */
-        char *value;
-        char *key;
+    while (next_pair(&cursor, &pair)) {
+        char *key = strndup(pair.key, pair.key_len);
+        char *value = strndup(pair.value, pair.value_len);
         void *old_val;
 
-        if (eq == kvpair)
-            goto next_pair;
-
-        if (eq) {
-            key = strndup(kvpair, eq - kvpair);
-            if (*(++eq))
-                value = strdup(eq);
-            else
-                value = strdup("");
-        } else {
-            key = strdup(kvpair);
-            value = strdup("");
+        if (!key || !value) {
+            free(key);
+            free(value);
+            goto err_strdup;
         }
 
         /* if we replaced a value, free it */
@@ -193,15 +219,11 @@ struct str_parms *str_parms_create_str(const char *_string)
         }
 
         items++;
-next_pair:
-        kvpair = strtok_r(NULL, ";", &tmpstr);
     }
 
     if (!items)
         ALOGV("%s: no items found in string\n", __func__);
 
-    free(str);
-
     return str_parms;
 
 err_strdup:
@@ -380,3 +402,118 @@ void str_parms_dump(struct str_parms *str_parms)
 {
     hashmapForEach(str_parms->map, dump_entry, str_parms);
 }
+
+static const struct str_parms_pair *find_pair(const struct str_parms_view *view,
+                                              const char *key, size_t key_len)
+{
+    size_t i;
+
+    for (i = 0; i < view->count; i++) {
+        const struct str_parms_pair *pair = &view->pairs[i];
+        if (pair->key_len == key_len && !memcmp(pair->key, key, key_len))
+            return pair;
+    }
+    return NULL;
+}
+
+int str_parms_view_parse(struct str_parms_view *view, const char *string)
+{
+    const char *cursor = string;
+    struct str_parms_pair pair;
+
+    view->count = 0;
+    while (next_pair(&cursor, &pair)) {
+        struct str_parms_pair *old =
+                (struct str_parms_pair *)find_pair(view, pair.key, pair.key_len);
+        if (old) {
+            *old = pair;
+            continue;
+        }
+        if (view->count == STR_PARMS_VIEW_MAX_PAIRS)
+            return -E2BIG;
+        view->pairs[view->count++] = pair;
+    }
+    return view->count;
+}
+
+const struct str_parms_pair *str_parms_view_find(const struct str_parms_view *view,
+                                                 const char *key)
+{
+    return find_pair(view, key, strlen(key));
+}
+
+int str_parms_view_has_key(const struct str_parms_view *view, const char *key)
+{
+    return str_parms_view_find(view, key) != NULL;
+}
+
+int str_parms_view_get_str(const struct str_parms_view *view, const char *key,
+                           char *val, int len)
+{
+    const struct str_parms_pair *pair = str_parms_view_find(view, key);
+    size_t copied;
+
+    if (!pair)
+        return -ENOENT;
+
+    /* as strlcpy */
+    if (len > 0) {
+        copied = pair->value_len < (size_t)len - 1 ? pair->value_len : (size_t)len - 1;
+        memcpy(val, pair->value, copied);
+        val[copied] = '\0';
+    }
+    return pair->value_len;
+}
+
+/* Copies the value of key, NUL terminated, for strtol() and strtof(). */
+static int get_number(const struct str_parms_view *view, const char *key,
+                      char *buf, size_t size)
+{
+    const struct str_parms_pair *pair = str_parms_view_find(view, key);
+
+    if (!pair)
+        return -ENOENT;
+    if (pair->value_len >= size)
+        return -EINVAL;
+    memcpy(buf, pair->value, pair->value_len);
+    buf[pair->value_len] = '\0';
+    return 0;
+}
+
+int str_parms_view_get_int(const struct str_parms_view *view, const char *key,
+                           int *val)
+{
+    char value[64];
+    char *end;
+    int ret;
+
+    ret = get_number(view, key, value, sizeof(value));
+    if (ret)
+        return ret;
+
+    *val = (int)strtol(value, &end, 0);
+    if (*value != '\0' && *end == '\0')
+        return 0;
+
+    return -EINVAL;
+}
+
+int str_parms_view_get_float(const struct str_parms_view *view, const char *key,
+                             float *val)
+{
+    char value[64];
+    char *end;
+    float out;
+    int ret;
+
+    ret = get_number(view, key, value, sizeof(value));
+    if (ret)
+        return ret;
+
+    out = strtof(value, &end);
+    if (*value == '\0' || *end != '\0')
+        return -EINVAL;
+
+    *val = out;
+    return 0;
+}
@@ -357,4 +357,36 @@ TEST_F(PropertiesTest, GetInt32) {
     }
 }
 
+TEST_F(PropertiesTest, Cache) {
+    property_cache cache = PROPERTY_CACHE_INIT(PROPERTY_TEST_KEY);
+    int changed;
+
+    ASSERT_OK(property_set(PROPERTY_TEST_KEY, "one"));
+    EXPECT_STREQ("one", property_cache_get(&cache, PROPERTY_TEST_VALUE_DEFAULT, &changed));
+    EXPECT_TRUE(changed);
+    EXPECT_STREQ("one", property_cache_get(&cache, PROPERTY_TEST_VALUE_DEFAULT, &changed));
+    EXPECT_FALSE(changed);
+
+    ASSERT_OK(property_set(PROPERTY_TEST_KEY, "two"));
+    EXPECT_STREQ("two", property_cache_get(&cache, PROPERTY_TEST_VALUE_DEFAULT, &changed));
+    EXPECT_TRUE(changed);
+    EXPECT_STREQ("two", property_cache_get(&cache, PROPERTY_TEST_VALUE_DEFAULT, NULL));
+
+    ASSERT_OK(property_set(PROPERTY_TEST_KEY, ""));
+    EXPECT_STREQ(PROPERTY_TEST_VALUE_DEFAULT,
+                 property_cache_get(&cache, PROPERTY_TEST_VALUE_DEFAULT, &changed));
+    EXPECT_TRUE(changed);
+}
+
+TEST_F(PropertiesTest, CacheMissing) {
+    property_cache cache = PROPERTY_CACHE_INIT("libcutils.test.does.not.exist");
+    int changed = 1;
+
+    EXPECT_STREQ(PROPERTY_TEST_VALUE_DEFAULT,
+                 property_cache_get(&cache, PROPERTY_TEST_VALUE_DEFAULT, &changed));
+    EXPECT_FALSE(changed);
+    EXPECT_TRUE(property_cache_get(&cache, NULL, &changed) == NULL);
+    EXPECT_FALSE(changed);
+}
+
 } // namespace android
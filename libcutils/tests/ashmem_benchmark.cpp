@@ -0,0 +1,67 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <benchmark/benchmark.h>
+#include <cutils/ashmem.h>
+#include <cutils/ashmem_pool.h>
+
+// Creating, mapping, writing and tearing down a small shared buffer.
+static void BM_ashmem_region(benchmark::State& state) {
+    size_t size = state.range(0);
+    while (state.KeepRunning()) {
+        int fd = ashmem_create_region("ashmem_benchmark", size);
+        void* data = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        static_cast<char*>(data)[0] = 1;
+        munmap(data, size);
+        close(fd);
+    }
+}
+BENCHMARK(BM_ashmem_region)->Arg(256)->Arg(4096);
+
+static void BM_ashmem_pool_region(benchmark::State& state) {
+    size_t size = state.range(0);
+    ashmem_pool* pool = ashmem_pool_create("ashmem_benchmark", 1024 * 1024);
+    while (state.KeepRunning()) {
+        ssize_t offset = ashmem_pool_alloc(pool, size);
+        static_cast<char*>(ashmem_pool_data(pool, offset))[0] = 1;
+        ashmem_pool_free(pool, offset, size);
+    }
+    ashmem_pool_destroy(pool);
+}
+BENCHMARK(BM_ashmem_pool_region)->Arg(256)->Arg(4096);
+
+// As sent to, and mapped by, another process.
+static void BM_ashmem_pool_handle(benchmark::State& state) {
+    size_t size = state.range(0);
+    ashmem_pool* pool = ashmem_pool_create("ashmem_benchmark", 1024 * 1024);
+    while (state.KeepRunning()) {
+        ssize_t offset = ashmem_pool_alloc(pool, size);
+        native_handle_t* handle = ashmem_pool_create_handle(pool, offset, size);
+        void* mapping;
+        size_t mapping_len;
+        void* data = ashmem_pool_map_handle(handle, PROT_READ | PROT_WRITE, &mapping, &mapping_len);
+        static_cast<char*>(data)[0] = 1;
+        munmap(mapping, mapping_len);
+        native_handle_close(handle);
+        native_handle_delete(handle);
+        ashmem_pool_free(pool, offset, size);
+    }
+    ashmem_pool_destroy(pool);
+}
+BENCHMARK(BM_ashmem_pool_handle)->Arg(256)->Arg(4096);
@@ -0,0 +1,127 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <errno.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <set>
+#include <vector>
+
+#include <cutils/ashmem_pool.h>
+#include <gtest/gtest.h>
+
+TEST(ashmem_pool, alloc_free) {
+    ashmem_pool* pool = ashmem_pool_create("ashmem_pool_test", 1);
+    ASSERT_TRUE(pool != nullptr);
+    size_t size = ashmem_pool_size(pool);
+    ASSERT_EQ(static_cast<size_t>(getpagesize()), size);
+
+    EXPECT_EQ(-EINVAL, ashmem_pool_alloc(pool, 0));
+    EXPECT_EQ(-ENOMEM, ashmem_pool_alloc(pool, size + 1));
+
+    // Every region is aligned and none overlap.
+    std::vector<ssize_t> offsets;
+    ssize_t offset;
+    while ((offset = ashmem_pool_alloc(pool, 1)) >= 0) {
+        EXPECT_EQ(0, offset % ASHMEM_POOL_ALIGNMENT);
+        offsets.push_back(offset);
+    }
+    EXPECT_EQ(-ENOMEM, offset);
+    ASSERT_EQ(size / ASHMEM_POOL_ALIGNMENT, offsets.size());
+    EXPECT_EQ(offsets.size(), std::set<ssize_t>(offsets.begin(), offsets.end()).size());
+
+    // Freeing every other region, then the rest, coalesces back into one.
+    for (size_t i = 0; i < offsets.size(); i += 2) {
+        EXPECT_EQ(0, ashmem_pool_free(pool, offsets[i], 1));
+    }
+    EXPECT_EQ(-EINVAL, ashmem_pool_free(pool, offsets[0], 1));
+    EXPECT_EQ(-ENOMEM, ashmem_pool_alloc(pool, 2 * ASHMEM_POOL_ALIGNMENT));
+    for (size_t i = 1; i < offsets.size(); i += 2) {
+        EXPECT_EQ(0, ashmem_pool_free(pool, offsets[i], 1));
+    }
+    EXPECT_EQ(0, ashmem_pool_alloc(pool, size));
+
+    ashmem_pool_destroy(pool);
+}
+
+TEST(ashmem_pool, bad_free) {
+    ashmem_pool* pool = ashmem_pool_create(nullptr, 4 * getpagesize());
+    ASSERT_TRUE(pool != nullptr);
+    ssize_t offset = ashmem_pool_alloc(pool, 256);
+    ASSERT_EQ(0, offset);
+    EXPECT_EQ(-EINVAL, ashmem_pool_free(pool, 1, 64));
+    EXPECT_EQ(-EINVAL, ashmem_pool_free(pool, 512, 64));
+    EXPECT_EQ(-EINVAL, ashmem_pool_free(pool, 192, 128));
+    EXPECT_EQ(-EINVAL, ashmem_pool_free(pool, ashmem_pool_size(pool), 64));
+    EXPECT_EQ(0, ashmem_pool_free(pool, 0, 256));
+    ashmem_pool_destroy(pool);
+}
+
+TEST(ashmem_pool, pin) {
+    ashmem_pool* pool = ashmem_pool_create(nullptr, 4 * getpagesize());
+    ASSERT_TRUE(pool != nullptr);
+    size_t page = getpagesize();
+    ashmem_range ranges[] = {{0, page}, {page, page}, {3 * page, page}};
+    EXPECT_EQ(0, ashmem_pool_unpin(pool, ranges, 3));
+    EXPECT_GE(ashmem_pool_pin(pool, ranges, 3), 0);
+    ashmem_pool_destroy(pool);
+}
+
+TEST(ashmem_pool, handle) {
+    ashmem_pool* pool = ashmem_pool_create("ashmem_pool_test", 4 * getpagesize());
+    ASSERT_TRUE(pool != nullptr);
+    // Straddles a page boundary.
+    ssize_t first = ashmem_pool_alloc(pool, getpagesize() - 64);
+    ASSERT_EQ(0, first);
+    ssize_t offset = ashmem_pool_alloc(pool, 128);
+    ASSERT_EQ(getpagesize() - 64, offset);
+    memcpy(ashmem_pool_data(pool, offset), "hello", 6);
+
+    native_handle_t* handle = ashmem_pool_create_handle(pool, offset, 128);
+    ASSERT_TRUE(handle != nullptr);
+    ASSERT_EXIT({
+        void* mapping;
+        size_t mapping_len;
+        char* data = static_cast<char*>(
+            ashmem_pool_map_handle(handle, PROT_READ | PROT_WRITE, &mapping, &mapping_len));
+        if (data == nullptr) _exit(1);
+        if (strcmp(data, "hello") != 0) _exit(2);
+        strcpy(data, "world");
+        munmap(mapping, mapping_len);
+        _exit(0);
+    }, ::testing::ExitedWithCode(0), "");
+    EXPECT_STREQ("world", static_cast<char*>(ashmem_pool_data(pool, offset)));
+
+    // The handle outlives the pool.
+    ashmem_pool_destroy(pool);
+    void* mapping;
+    size_t mapping_len;
+    char* data =
+        static_cast<char*>(ashmem_pool_map_handle(handle, PROT_READ, &mapping, &mapping_len));
+    ASSERT_TRUE(data != nullptr);
+    EXPECT_STREQ("world", data);
+    EXPECT_EQ(0, munmap(mapping, mapping_len));
+
+    // Out of bounds.
+    handle->data[1] = 4 * getpagesize();
+    EXPECT_TRUE(ashmem_pool_map_handle(handle, PROT_READ, &mapping, &mapping_len) == nullptr);
+
+    native_handle_close(handle);
+    native_handle_delete(handle);
+}
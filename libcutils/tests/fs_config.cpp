@@ -16,13 +16,18 @@
 
 #include <inttypes.h>
 
+#include <stdio.h>
+#include <sys/stat.h>
+
 #include <string>
+#include <vector>
 
 #include <gtest/gtest.h>
 
 #include <android-base/file.h>
 #include <android-base/stringprintf.h>
 #include <android-base/strings.h>
+#include <android-base/test_utils.h>
 
 #include <private/android_filesystem_config.h>
 #include <private/fs_config.h>
@@ -246,3 +251,152 @@ TEST(fs_config, odm_files_alias) {
 TEST(fs_config, system_alias) {
     EXPECT_FALSE(check_fs_config_cmp(fs_config_cmp_tests));
 }
+
+// Overrides for every partition under a temporary target_out_path, so that
+// fs_config() doesn't also see the device's own.
+class fs_config_overrides {
+  public:
+    fs_config_overrides() {
+        for (const char* partition : {"system", "vendor", "oem", "odm"}) {
+            mkdir((std::string(dir_.path) + "/" + partition).c_str(), 0700);
+            mkdir((std::string(dir_.path) + "/" + partition + "/etc").c_str(), 0700);
+            write(partition, "dirs", {});
+            write(partition, "files", {});
+        }
+    }
+
+    void write(const char* partition, const char* type,
+               const std::vector<fs_path_config>& rules) {
+        std::string data;
+        for (const fs_path_config& pc : rules) {
+            char buffer[1024];
+            ssize_t len = fs_config_generate(buffer, sizeof(buffer), &pc);
+            ASSERT_GT(len, 0);
+            data.append(buffer, len);
+        }
+        std::string name =
+            std::string(dir_.path) + "/" + partition + "/etc/fs_config_" + type;
+        ASSERT_TRUE(android::base::WriteStringToFile(data, name + ".tmp"));
+        ASSERT_EQ(0, rename((name + ".tmp").c_str(), name.c_str()));
+    }
+
+    std::string target_out_path() const { return std::string(dir_.path) + "/system"; }
+
+  private:
+    TemporaryDir dir_;
+};
+
+static const std::vector<fs_path_config> system_dirs_overrides = {
+    // clang-format off
+    { 00700, AID_SHELL, AID_SHELL, 0, "data/local/fs_config_test" },
+    { 00750, AID_LOGD,  AID_LOGD,  0, "system/vendor/fs_config_test" },
+    { 00751, AID_ROOT,  AID_SHELL, 0, "system/odm" },
+    // clang-format on
+};
+
+static const std::vector<fs_path_config> system_files_overrides = {
+    // clang-format off
+    { 00700, AID_SHELL, AID_SHELL, CAP_MASK_LONG(CAP_NET_RAW), "data/local/fs_config_test" },
+    { 00750, AID_LOGD,  AID_LOGD,  0,                          "vendor/bin/fs_config_test*" },
+    { 00751, AID_ROOT,  AID_SHELL, 0,                          "system/bin/fs_config_test" },
+    { 00755, AID_ROOT,  AID_LOGD,  0,                          "fs_config_test/*" },
+    // clang-format on
+};
+
+// The first of overrides, then of the built in rules, to fs_config_cmp().
+static void reference_fs_config(const std::vector<fs_path_config>& overrides,
+                                const fs_path_config* paths, const char* path, bool dir,
+                                unsigned* uid, unsigned* gid, unsigned* mode,
+                                uint64_t* capabilities) {
+    if (path[0] == '/') path++;
+    const fs_path_config* found = nullptr;
+    for (const fs_path_config& pc : overrides) {
+        if (__for_testing_only__fs_config_cmp(dir, pc.prefix, strlen(pc.prefix), path,
+                                              strlen(path))) {
+            found = &pc;
+            break;
+        }
+    }
+    if (!found) {
+        for (found = paths; found->prefix; ++found) {
+            if (__for_testing_only__fs_config_cmp(dir, found->prefix, strlen(found->prefix), path,
+                                                  strlen(path))) {
+                break;
+            }
+        }
+    }
+    *uid = found->uid;
+    *gid = found->gid;
+    *mode = (*mode & ~07777) | found->mode;
+    *capabilities = found->capabilities;
+}
+
+static std::vector<std::string> fs_config_test_paths(const std::vector<fs_path_config>& overrides,
+                                                     const fs_path_config* paths) {
+    std::vector<std::string> prefixes;
+    for (const fs_path_config& pc : overrides) prefixes.push_back(pc.prefix);
+    for (size_t idx = 0; paths[idx].prefix; ++idx) prefixes.push_back(paths[idx].prefix);
+
+    std::vector<std::string> result = {"", "/", "a", "system", "system/", "system/vendor/",
+                                       "vendor/", "/data/local/tmp/x"};
+    for (std::string prefix : prefixes) {
+        if (android::base::EndsWith(prefix, "*")) prefix.pop_back();
+        for (const std::string& path :
+             {prefix, prefix.substr(0, prefix.size() / 2), prefix + "x", prefix + "/x"}) {
+            result.push_back(path);
+            result.push_back("/" + path);
+            result.push_back("system/" + path);
+            if (android::base::StartsWith(path, "system/")) result.push_back(path.substr(7));
+        }
+    }
+    return result;
+}
+
+static void check_first_match(bool dir, const std::vector<fs_path_config>& overrides,
+                              const fs_path_config* paths) {
+    fs_config_overrides files;
+    files.write("system", dir ? "dirs" : "files", overrides);
+
+    for (const std::string& path : fs_config_test_paths(overrides, paths)) {
+        unsigned uid = 0, gid = 0, mode = S_IFREG | 07777;
+        uint64_t capabilities = 0;
+        fs_config(path.c_str(), dir, files.target_out_path().c_str(), &uid, &gid, &mode,
+                  &capabilities);
+        unsigned expected_uid = 0, expected_gid = 0, expected_mode = S_IFREG | 07777;
+        uint64_t expected_capabilities = 0;
+        reference_fs_config(overrides, paths, path.c_str(), dir, &expected_uid, &expected_gid,
+                            &expected_mode, &expected_capabilities);
+        EXPECT_EQ(expected_uid, uid) << path;
+        EXPECT_EQ(expected_gid, gid) << path;
+        EXPECT_EQ(expected_mode, mode) << path;
+        EXPECT_EQ(expected_capabilities, capabilities) << path;
+    }
+}
+
+TEST(fs_config, dirs_first_match) {
+    check_first_match(true, system_dirs_overrides, __for_testing_only__android_dirs);
+}
+
+TEST(fs_config, files_first_match) {
+    check_first_match(false, system_files_overrides, __for_testing_only__android_files);
+}
+
+TEST(fs_config, target_out_paths) {
+    fs_config_overrides first, second;
+    first.write("vendor", "files", {{00700, AID_SHELL, AID_SHELL, 0, "vendor/fs_config_test"}});
+    second.write("vendor", "files", {{00750, AID_LOGD, AID_SHELL, 0, "vendor/fs_config_test"}});
+
+    for (int i = 0; i < 2; ++i) {
+        unsigned uid, gid, mode = 0;
+        uint64_t capabilities;
+        fs_config("vendor/fs_config_test", false, first.target_out_path().c_str(), &uid, &gid,
+                  &mode, &capabilities);
+        EXPECT_EQ(static_cast<unsigned>(AID_SHELL), uid);
+        EXPECT_EQ(00700U, mode);
+
+        fs_config("/system/vendor/fs_config_test", false, second.target_out_path().c_str(), &uid,
+                  &gid, &mode, &capabilities);
+        EXPECT_EQ(static_cast<unsigned>(AID_LOGD), uid);
+        EXPECT_EQ(00750U, mode);
+    }
+}
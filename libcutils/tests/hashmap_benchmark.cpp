@@ -0,0 +1,125 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <string.h>
+
+#include <string>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+#include <cutils/hashmap.h>
+
+static int StringHash(void* key) {
+    return hashmapHash(key, strlen(static_cast<char*>(key)));
+}
+
+static bool StringEquals(void* keyA, void* keyB) {
+    return strcmp(static_cast<char*>(keyA), static_cast<char*>(keyB)) == 0;
+}
+
+static std::vector<std::string> MakeKeys(size_t count) {
+    std::vector<std::string> keys;
+    for (size_t i = 0; i < count; i++) {
+        keys.push_back("key" + std::to_string(i));
+    }
+    return keys;
+}
+
+static void BM_hashmap_put(benchmark::State& state) {
+    std::vector<std::string> keys = MakeKeys(state.range(0));
+    while (state.KeepRunning()) {
+        Hashmap* map = hashmapCreate(0, StringHash, StringEquals);
+        for (auto& key : keys) {
+            hashmapPut(map, &key[0], &key);
+        }
+        hashmapFree(map);
+    }
+    state.SetItemsProcessed(state.iterations() * keys.size());
+}
+BENCHMARK(BM_hashmap_put)->Arg(16)->Arg(1024)->Arg(64 * 1024);
+
+static void BM_hashmap_get(benchmark::State& state) {
+    std::vector<std::string> keys = MakeKeys(state.range(0));
+    // Copies, so that lookups can't get away with comparing pointers.
+    std::vector<std::string> lookups = keys;
+    Hashmap* map = hashmapCreate(0, StringHash, StringEquals);
+    for (auto& key : keys) {
+        hashmapPut(map, &key[0], &key);
+    }
+    while (state.KeepRunning()) {
+        for (auto& key : lookups) {
+            benchmark::DoNotOptimize(hashmapGet(map, &key[0]));
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * keys.size());
+    hashmapFree(map);
+}
+BENCHMARK(BM_hashmap_get)->Arg(16)->Arg(1024)->Arg(64 * 1024);
+
+static void BM_hashmap_put_remove(benchmark::State& state) {
+    std::vector<std::string> keys = MakeKeys(1024);
+    Hashmap* map = hashmapCreate(0, StringHash, StringEquals);
+    while (state.KeepRunning()) {
+        for (auto& key : keys) {
+            hashmapPut(map, &key[0], &key);
+        }
+        for (auto& key : keys) {
+            hashmapRemove(map, &key[0]);
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * keys.size());
+    hashmapFree(map);
+}
+BENCHMARK(BM_hashmap_put_remove);
+
+static Hashmap* gSharedMap;
+static std::vector<std::string> gSharedKeys;
+
+// Threads looking up keys in one map, locked as a whole or by stripe.
+static void SharedGet(benchmark::State& state, bool striped) {
+    if (state.thread_index == 0) {
+        gSharedKeys = MakeKeys(1024);
+        gSharedMap = striped ? hashmapCreateStriped(0, 16, StringHash, StringEquals)
+                             : hashmapCreate(0, StringHash, StringEquals);
+        for (auto& key : gSharedKeys) {
+            hashmapPut(gSharedMap, &key[0], &key);
+        }
+    }
+    while (state.KeepRunning()) {
+        for (size_t i = state.thread_index; i < gSharedKeys.size(); i += state.threads) {
+            if (striped) {
+                benchmark::DoNotOptimize(hashmapGet(gSharedMap, &gSharedKeys[i][0]));
+            } else {
+                hashmapLock(gSharedMap);
+                benchmark::DoNotOptimize(hashmapGet(gSharedMap, &gSharedKeys[i][0]));
+                hashmapUnlock(gSharedMap);
+            }
+        }
+    }
+    if (state.thread_index == 0) {
+        hashmapFree(gSharedMap);
+    }
+}
+
+static void BM_hashmap_shared_get_locked(benchmark::State& state) {
+    SharedGet(state, false);
+}
+BENCHMARK(BM_hashmap_shared_get_locked)->ThreadRange(1, 8);
+
+static void BM_hashmap_shared_get_striped(benchmark::State& state) {
+    SharedGet(state, true);
+}
+BENCHMARK(BM_hashmap_shared_get_striped)->ThreadRange(1, 8);
@@ -0,0 +1,199 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <cutils/hashmap.h>
+#include <gtest/gtest.h>
+
+#include <thread>
+#include <vector>
+
+static int ConstantHash(void*) {
+    return 42;
+}
+
+static void* Value(int i) {
+    return reinterpret_cast<void*>(static_cast<intptr_t>(i + 1));
+}
+
+class HashmapTest : public ::testing::Test {
+  protected:
+    void SetUp() override {
+        for (int i = 0; i < kKeys; i++) keys_[i] = i;
+    }
+
+    static constexpr int kKeys = 1000;
+    int keys_[kKeys];
+};
+
+TEST_F(HashmapTest, PutGetRemove) {
+    Hashmap* map = hashmapCreate(0, hashmapIntHash, hashmapIntEquals);
+    ASSERT_TRUE(map != nullptr);
+
+    for (int i = 0; i < kKeys; i++) {
+        EXPECT_EQ(nullptr, hashmapPut(map, &keys_[i], Value(i)));
+    }
+    EXPECT_EQ(static_cast<size_t>(kKeys), hashmapSize(map));
+    EXPECT_GE(hashmapCurrentCapacity(map), static_cast<size_t>(kKeys));
+
+    // Keys are compared with equals(), not by address.
+    for (int i = 0; i < kKeys; i++) {
+        int key = i;
+        EXPECT_EQ(Value(i), hashmapGet(map, &key));
+        EXPECT_TRUE(hashmapContainsKey(map, &key));
+    }
+    int missing = kKeys;
+    EXPECT_EQ(nullptr, hashmapGet(map, &missing));
+    EXPECT_FALSE(hashmapContainsKey(map, &missing));
+
+    EXPECT_EQ(Value(7), hashmapPut(map, &keys_[7], Value(70)));
+    EXPECT_EQ(Value(70), hashmapGet(map, &keys_[7]));
+    EXPECT_EQ(static_cast<size_t>(kKeys), hashmapSize(map));
+
+    for (int i = 0; i < kKeys; i += 2) {
+        EXPECT_EQ(i == 6 ? Value(6) : Value(i), hashmapRemove(map, &keys_[i]));
+    }
+    EXPECT_EQ(nullptr, hashmapRemove(map, &keys_[0]));
+    EXPECT_EQ(static_cast<size_t>(kKeys / 2), hashmapSize(map));
+    for (int i = 0; i < kKeys; i++) {
+        EXPECT_EQ(i % 2 != 0, hashmapContainsKey(map, &keys_[i])) << i;
+    }
+
+    hashmapFree(map);
+}
+
+TEST_F(HashmapTest, Collisions) {
+    // Every key in one probe sequence.
+    Hashmap* map = hashmapCreate(0, ConstantHash, hashmapIntEquals);
+    ASSERT_TRUE(map != nullptr);
+    for (int i = 0; i < 100; i++) {
+        hashmapPut(map, &keys_[i], Value(i));
+    }
+    EXPECT_EQ(99U, hashmapCountCollisions(map));
+    hashmapRemove(map, &keys_[50]);
+    for (int i = 0; i < 100; i++) {
+        EXPECT_EQ(i == 50 ? nullptr : Value(i), hashmapGet(map, &keys_[i])) << i;
+    }
+    hashmapFree(map);
+}
+
+TEST_F(HashmapTest, Churn) {
+    // Deleted slots get reused or rehashed away, rather than growing the table.
+    Hashmap* map = hashmapCreate(16, hashmapIntHash, hashmapIntEquals);
+    ASSERT_TRUE(map != nullptr);
+    size_t capacity = hashmapCurrentCapacity(map);
+    for (int round = 0; round < 100; round++) {
+        for (int i = 0; i < 10; i++) {
+            hashmapPut(map, &keys_[(round * 10 + i) % kKeys], Value(i));
+        }
+        for (int i = 0; i < 10; i++) {
+            EXPECT_EQ(Value(i), hashmapRemove(map, &keys_[(round * 10 + i) % kKeys]));
+        }
+    }
+    EXPECT_EQ(0U, hashmapSize(map));
+    EXPECT_EQ(capacity, hashmapCurrentCapacity(map));
+    hashmapFree(map);
+}
+
+static void* MemoizedValue(void* key, void* context) {
+    ++*static_cast<int*>(context);
+    return Value(*static_cast<int*>(key));
+}
+
+TEST_F(HashmapTest, Memoize) {
+    Hashmap* map = hashmapCreate(0, hashmapIntHash, hashmapIntEquals);
+    ASSERT_TRUE(map != nullptr);
+    int calls = 0;
+    for (int round = 0; round < 2; round++) {
+        for (int i = 0; i < kKeys; i++) {
+            EXPECT_EQ(Value(i), hashmapMemoize(map, &keys_[i], MemoizedValue, &calls));
+        }
+    }
+    EXPECT_EQ(kKeys, calls);
+    hashmapFree(map);
+}
+
+struct RemoveContext {
+    Hashmap* map;
+    int visits;
+};
+
+static bool RemoveEach(void* key, void* value, void* context) {
+    RemoveContext* ctxt = static_cast<RemoveContext*>(context);
+    EXPECT_EQ(Value(*static_cast<int*>(key)), value);
+    EXPECT_EQ(value, hashmapRemove(ctxt->map, key));
+    ctxt->visits++;
+    return true;
+}
+
+TEST_F(HashmapTest, ForEachRemovingEntries) {
+    // As str_parms_destroy does.
+    Hashmap* map = hashmapCreate(0, hashmapIntHash, hashmapIntEquals);
+    ASSERT_TRUE(map != nullptr);
+    for (int i = 0; i < kKeys; i++) {
+        hashmapPut(map, &keys_[i], Value(i));
+    }
+    RemoveContext ctxt = { map, 0 };
+    hashmapForEach(map, RemoveEach, &ctxt);
+    EXPECT_EQ(kKeys, ctxt.visits);
+    EXPECT_EQ(0U, hashmapSize(map));
+    hashmapFree(map);
+}
+
+static bool StopAtThree(void*, void*, void* context) {
+    return ++*static_cast<int*>(context) < 3;
+}
+
+TEST_F(HashmapTest, ForEachStops) {
+    Hashmap* map = hashmapCreateStriped(0, 4, hashmapIntHash, hashmapIntEquals);
+    ASSERT_TRUE(map != nullptr);
+    for (int i = 0; i < 10; i++) {
+        hashmapPut(map, &keys_[i], Value(i));
+    }
+    int visits = 0;
+    hashmapForEach(map, StopAtThree, &visits);
+    EXPECT_EQ(3, visits);
+    hashmapFree(map);
+}
+
+TEST_F(HashmapTest, StripedConcurrentUse) {
+    Hashmap* map = hashmapCreateStriped(0, 8, hashmapIntHash, hashmapIntEquals);
+    ASSERT_TRUE(map != nullptr);
+
+    constexpr int kThreads = 4;
+    std::vector<std::thread> threads;
+    for (int t = 0; t < kThreads; t++) {
+        threads.emplace_back([this, map, t]() {
+            for (int round = 0; round < 20; round++) {
+                for (int i = t; i < kKeys; i += kThreads) {
+                    hashmapPut(map, &keys_[i], Value(i));
+                }
+                for (int i = t; i < kKeys; i += kThreads) {
+                    EXPECT_EQ(Value(i), hashmapGet(map, &keys_[i]));
+                }
+                if (round != 19) {
+                    for (int i = t; i < kKeys; i += kThreads) {
+                        EXPECT_EQ(Value(i), hashmapRemove(map, &keys_[i]));
+                    }
+                }
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    EXPECT_EQ(static_cast<size_t>(kKeys), hashmapSize(map));
+    hashmapFree(map);
+}
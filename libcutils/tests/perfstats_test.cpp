@@ -0,0 +1,172 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <errno.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <android-base/file.h>
+#include <android-base/test_utils.h>
+#include <cutils/perfstats.h>
+#include <gtest/gtest.h>
+
+enum { kRequests, kLatency, kMetricCount };
+
+static const perfstats_metric kMetrics[kMetricCount] = {
+    { "requests", PERFSTATS_COUNTER },
+    { "latency_us", PERFSTATS_HISTOGRAM },
+};
+
+struct Value {
+    std::string name;
+    perfstats_type type;
+    uint64_t count;
+    uint64_t sum;
+    std::vector<uint64_t> buckets;
+};
+
+static void collect(const perfstats_value* value, void* arg) {
+    std::vector<uint64_t> buckets;
+    if (value->buckets) {
+        buckets.assign(value->buckets, value->buckets + PERFSTATS_HISTOGRAM_BUCKETS);
+    }
+    static_cast<std::vector<Value>*>(arg)->push_back(
+        { value->name, value->type, value->count, value->sum, buckets });
+}
+
+static std::vector<Value> read(const std::string& path) {
+    std::vector<Value> values;
+    pid_t pid = 0;
+    EXPECT_EQ(0, perfstats_read(path.c_str(), &pid, collect, &values));
+    EXPECT_EQ(getpid(), pid);
+    return values;
+}
+
+TEST(perfstats, counters_and_histograms) {
+    TemporaryDir dir;
+    std::string path = std::string(dir.path) + "/test";
+    perfstats* ps = perfstats_create_at(path.c_str(), kMetrics, kMetricCount, 4);
+    ASSERT_TRUE(ps != nullptr);
+
+    std::vector<Value> values = read(path);
+    ASSERT_EQ(2U, values.size());
+    EXPECT_EQ("requests", values[0].name);
+    EXPECT_EQ(PERFSTATS_COUNTER, values[0].type);
+    EXPECT_EQ(0U, values[0].count);
+    EXPECT_TRUE(values[0].buckets.empty());
+    EXPECT_EQ("latency_us", values[1].name);
+    EXPECT_EQ(PERFSTATS_HISTOGRAM, values[1].type);
+    EXPECT_EQ(0U, values[1].count);
+
+    perfstats_add(ps, kRequests, 3);
+    perfstats_add(ps, kRequests, 4);
+    perfstats_record(ps, kLatency, 0);
+    perfstats_record(ps, kLatency, 1);
+    perfstats_record(ps, kLatency, 5);
+    perfstats_record(ps, kLatency, 7);
+    perfstats_record(ps, kLatency, UINT64_MAX / 2);
+
+    // Out of range, or of the other type, are ignored.
+    perfstats_add(ps, kLatency, 1);
+    perfstats_record(ps, kRequests, 1);
+    perfstats_add(ps, kMetricCount, 1);
+    perfstats_add(nullptr, kRequests, 1);
+
+    values = read(path);
+    EXPECT_EQ(7U, values[0].count);
+    EXPECT_EQ(5U, values[1].count);
+    EXPECT_EQ(13 + UINT64_MAX / 2, values[1].sum);
+    ASSERT_EQ(static_cast<size_t>(PERFSTATS_HISTOGRAM_BUCKETS), values[1].buckets.size());
+    EXPECT_EQ(1U, values[1].buckets[0]);
+    EXPECT_EQ(1U, values[1].buckets[1]);
+    EXPECT_EQ(2U, values[1].buckets[3]);
+    EXPECT_EQ(1U, values[1].buckets[PERFSTATS_HISTOGRAM_BUCKETS - 1]);
+
+    perfstats_destroy(ps);
+    EXPECT_EQ(-ENOENT, perfstats_read(path.c_str(), nullptr, collect, &values));
+}
+
+TEST(perfstats, threads) {
+    TemporaryDir dir;
+    std::string path = std::string(dir.path) + "/test";
+    // Fewer slots than threads, so that some share the last one.
+    perfstats* ps = perfstats_create_at(path.c_str(), kMetrics, kMetricCount, 2);
+    ASSERT_TRUE(ps != nullptr);
+
+    static const size_t kThreads = 8;
+    static const size_t kUpdates = 100000;
+    for (size_t round = 0; round < 2; ++round) {
+        std::vector<std::thread> threads;
+        for (size_t i = 0; i < kThreads; ++i) {
+            threads.emplace_back([ps]() {
+                for (size_t j = 0; j < kUpdates; ++j) {
+                    perfstats_add(ps, kRequests, 1);
+                    perfstats_record(ps, kLatency, j & 0xff);
+                }
+            });
+        }
+        for (auto& thread : threads) thread.join();
+
+        // What exited threads counted is kept, for those that reuse their slots.
+        std::vector<Value> values = read(path);
+        ASSERT_EQ(2U, values.size());
+        EXPECT_EQ((round + 1) * kThreads * kUpdates, values[0].count);
+        EXPECT_EQ((round + 1) * kThreads * kUpdates, values[1].count);
+        EXPECT_EQ((round + 1) * kThreads * (kUpdates / 256) * (255 * 256 / 2) +
+                      (round + 1) * kThreads * (kUpdates % 256) * (kUpdates % 256 - 1) / 2,
+                  values[1].sum);
+    }
+
+    perfstats_destroy(ps);
+}
+
+TEST(perfstats, replaces_and_validates) {
+    TemporaryDir dir;
+    std::string path = std::string(dir.path) + "/test";
+    perfstats* old_ps = perfstats_create_at(path.c_str(), kMetrics, kMetricCount, 1);
+    ASSERT_TRUE(old_ps != nullptr);
+    perfstats_add(old_ps, kRequests, 1);
+
+    // A restarted daemon starts over, in a file of its own.
+    perfstats* ps = perfstats_create_at(path.c_str(), kMetrics, 1, 1);
+    ASSERT_TRUE(ps != nullptr);
+    std::vector<Value> values = read(path);
+    ASSERT_EQ(1U, values.size());
+    EXPECT_EQ(0U, values[0].count);
+    struct stat st;
+    ASSERT_EQ(0, stat(path.c_str(), &st));
+    EXPECT_EQ(0644U, st.st_mode & 0777);
+
+    perfstats_metric bad = { "", PERFSTATS_COUNTER };
+    errno = 0;
+    EXPECT_TRUE(perfstats_create_at(path.c_str(), &bad, 1, 1) == nullptr);
+    EXPECT_EQ(EINVAL, errno);
+    EXPECT_TRUE(perfstats_create_at(path.c_str(), kMetrics, 0, 1) == nullptr);
+    EXPECT_TRUE(perfstats_create("../test", kMetrics, kMetricCount, 1) == nullptr);
+    EXPECT_EQ(EINVAL, errno);
+
+    std::string junk = std::string(dir.path) + "/junk";
+    ASSERT_TRUE(android::base::WriteStringToFile(std::string(4096, 'x'), junk));
+    EXPECT_EQ(-EINVAL, perfstats_read(junk.c_str(), nullptr, collect, &values));
+    unlink(junk.c_str());
+
+    perfstats_destroy(old_ps);
+    perfstats_destroy(ps);
+}
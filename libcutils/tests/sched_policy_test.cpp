@@ -96,3 +96,16 @@ TEST(SchedPolicy, get_sched_policy) {
     ASSERT_EQ(0, get_sched_policy(0, &newPolicy));
     EXPECT_EQ(SP_BACKGROUND, newPolicy);
 }
+
+TEST(SchedPolicy, set_sched_policy_tids) {
+    // Also checks that 0 still means the calling thread.
+    int tids[] = { 0, gettid() };
+    ASSERT_EQ(0, set_sched_policy_tids(tids, 2, SP_BACKGROUND));
+    SchedPolicy policy;
+    ASSERT_EQ(0, get_sched_policy(0, &policy));
+    EXPECT_EQ(SP_BACKGROUND, policy);
+
+    ASSERT_EQ(0, set_sched_policy_tids(tids, 2, SP_FOREGROUND));
+    ASSERT_EQ(0, get_sched_policy(0, &policy));
+    EXPECT_EQ(SP_FOREGROUND, policy);
+}
@@ -0,0 +1,49 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <string.h>
+
+#include <benchmark/benchmark.h>
+#include <cutils/str_parms.h>
+
+// What an audio HAL's set_parameters() typically gets.
+static const char kParameters[] =
+    "routing=2;format=1;channels=3;sampling_rate=48000;frame_count=960;"
+    "input_source=1;screen_state=on";
+
+static void BM_str_parms_create_str(benchmark::State& state) {
+    while (state.KeepRunning()) {
+        str_parms* parms = str_parms_create_str(kParameters);
+        int value;
+        str_parms_get_int(parms, "sampling_rate", &value);
+        benchmark::DoNotOptimize(value);
+        str_parms_destroy(parms);
+    }
+    state.SetBytesProcessed(state.iterations() * strlen(kParameters));
+}
+BENCHMARK(BM_str_parms_create_str);
+
+static void BM_str_parms_view_parse(benchmark::State& state) {
+    while (state.KeepRunning()) {
+        str_parms_view view;
+        str_parms_view_parse(&view, kParameters);
+        int value;
+        str_parms_view_get_int(&view, "sampling_rate", &value);
+        benchmark::DoNotOptimize(value);
+    }
+    state.SetBytesProcessed(state.iterations() * strlen(kParameters));
+}
+BENCHMARK(BM_str_parms_view_parse);
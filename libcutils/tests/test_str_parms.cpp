@@ -14,6 +14,11 @@
  * limitations under the License.
  */
 
+#include <errno.h>
+#include <string.h>
+
+#include <string>
+
 #include <cutils/str_parms.h>
 #include <gtest/gtest.h>
 
@@ -55,3 +60,102 @@ TEST(str_parms, put_ENOMEM) {
     ASSERT_EQ(ENOMEM, errno);
     test_str_parms_str("foo=bar;baz=", "foo=bar;baz=");
 }
+
+static void test_str_parms_view(const char* str, const char* key, const char* expected) {
+    str_parms_view view;
+    ASSERT_GE(str_parms_view_parse(&view, str), 0) << str;
+    char value[64];
+    if (expected == nullptr) {
+        ASSERT_FALSE(str_parms_view_has_key(&view, key)) << str;
+        ASSERT_EQ(-ENOENT, str_parms_view_get_str(&view, key, value, sizeof(value))) << str;
+        return;
+    }
+    ASSERT_TRUE(str_parms_view_has_key(&view, key)) << str;
+    ASSERT_EQ(static_cast<int>(strlen(expected)),
+              str_parms_view_get_str(&view, key, value, sizeof(value)))
+        << str;
+    ASSERT_STREQ(expected, value) << str;
+}
+
+TEST(str_parms, view) {
+    test_str_parms_view("", "foo", nullptr);
+    test_str_parms_view(";", "foo", nullptr);
+    test_str_parms_view("=bar", "", nullptr);
+    test_str_parms_view("=bar;", "foo", nullptr);
+    test_str_parms_view("foo=", "foo", "");
+    test_str_parms_view("foo=;", "foo", "");
+    test_str_parms_view("foo=bar", "foo", "bar");
+    test_str_parms_view("foo=bar;", "foo", "bar");
+    test_str_parms_view("foo=bar;baz", "baz", "");
+    test_str_parms_view("foo=bar;baz", "ba", nullptr);
+    test_str_parms_view(";;foo=bar;;baz=bat;", "baz", "bat");
+    test_str_parms_view("foo=bar=baz", "foo", "bar=baz");
+    test_str_parms_view("foo=bar1;baz=bat;foo=bar2", "foo", "bar2");
+}
+
+TEST(str_parms, view_matches_str_parms) {
+    static const char* strings[] = {
+        "", ";", "=", "foo", "foo=bar;baz", "routing=2;format=1;sampling_rate=48000",
+        "a=1;b=2;a=3;;c;=d;e=f=g",
+    };
+    for (const char* str : strings) {
+        str_parms* str_parms = str_parms_create_str(str);
+        ASSERT_TRUE(str_parms != nullptr);
+        str_parms_view view;
+        int count = str_parms_view_parse(&view, str);
+        ASSERT_GE(count, 0);
+        char* expected = str_parms_to_str(str_parms);
+        for (size_t i = 0; i < view.count; ++i) {
+            std::string key(view.pairs[i].key, view.pairs[i].key_len);
+            char value[64];
+            ASSERT_EQ(static_cast<int>(view.pairs[i].value_len),
+                      str_parms_get_str(str_parms, key.c_str(), value, sizeof(value)))
+                << str;
+            ASSERT_EQ(std::string(view.pairs[i].value, view.pairs[i].value_len), value) << str;
+            str_parms_del(str_parms, key.c_str());
+        }
+        char* rest = str_parms_to_str(str_parms);
+        ASSERT_STREQ("", rest) << str << " -> " << expected;
+        free(rest);
+        free(expected);
+        str_parms_destroy(str_parms);
+    }
+}
+
+TEST(str_parms, view_numbers) {
+    str_parms_view view;
+    ASSERT_EQ(5, str_parms_view_parse(&view, "i=-12;h=0x10;f=0.5;bad=1x;long="
+                                             "00000000000000000000000000000000000000000000000000"
+                                             "00000000000000000001"));
+    int i = 0;
+    ASSERT_EQ(0, str_parms_view_get_int(&view, "i", &i));
+    ASSERT_EQ(-12, i);
+    ASSERT_EQ(0, str_parms_view_get_int(&view, "h", &i));
+    ASSERT_EQ(16, i);
+    ASSERT_EQ(-EINVAL, str_parms_view_get_int(&view, "bad", &i));
+    ASSERT_EQ(-EINVAL, str_parms_view_get_int(&view, "long", &i));
+    ASSERT_EQ(-ENOENT, str_parms_view_get_int(&view, "missing", &i));
+    float f = 0;
+    ASSERT_EQ(0, str_parms_view_get_float(&view, "f", &f));
+    ASSERT_EQ(0.5f, f);
+    ASSERT_EQ(-EINVAL, str_parms_view_get_float(&view, "bad", &f));
+}
+
+TEST(str_parms, view_get_str_truncates) {
+    str_parms_view view;
+    ASSERT_EQ(1, str_parms_view_parse(&view, "foo=barbaz;"));
+    char value[4];
+    ASSERT_EQ(6, str_parms_view_get_str(&view, "foo", value, sizeof(value)));
+    ASSERT_STREQ("bar", value);
+}
+
+TEST(str_parms, view_E2BIG) {
+    std::string str;
+    for (int i = 0; i < STR_PARMS_VIEW_MAX_PAIRS; ++i) {
+        str += "key" + std::to_string(i) + "=" + std::to_string(i) + ";";
+    }
+    str_parms_view view;
+    ASSERT_EQ(STR_PARMS_VIEW_MAX_PAIRS, str_parms_view_parse(&view, str.c_str()));
+    ASSERT_EQ(STR_PARMS_VIEW_MAX_PAIRS, str_parms_view_parse(&view, (str + "key0=x").c_str()));
+    ASSERT_EQ(-E2BIG, str_parms_view_parse(&view, (str + "extra").c_str()));
+}
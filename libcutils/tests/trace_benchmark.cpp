@@ -0,0 +1,63 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <benchmark/benchmark.h>
+#include <cutils/trace.h>
+
+// The cost of an ATRACE_BEGIN/ATRACE_END pair, writing to |fd| with the
+// tag enabled or not.
+static void TracePair(benchmark::State& state, int fd, bool enabled) {
+  atrace_setup();
+  int saved_fd = atrace_marker_fd;
+  uint64_t saved_tags = atrace_enabled_tags;
+  atrace_marker_fd = fd;
+  atrace_enabled_tags = enabled ? ATRACE_TAG_ALWAYS : 0;
+
+  while (state.KeepRunning()) {
+    atrace_begin(ATRACE_TAG_ALWAYS, "RenderThread::draw");
+    atrace_end(ATRACE_TAG_ALWAYS);
+  }
+
+  atrace_marker_fd = saved_fd;
+  atrace_enabled_tags = saved_tags;
+}
+
+static void BM_atrace_pair_disabled(benchmark::State& state) {
+  TracePair(state, -1, false);
+}
+BENCHMARK(BM_atrace_pair_disabled);
+
+// Everything but the trace buffer itself: formatting and the syscalls.
+static void BM_atrace_pair_dev_null(benchmark::State& state) {
+  int fd = open("/dev/null", O_WRONLY | O_CLOEXEC);
+  TracePair(state, fd, true);
+  close(fd);
+}
+BENCHMARK(BM_atrace_pair_dev_null);
+
+static void BM_atrace_pair_trace_marker(benchmark::State& state) {
+  int fd = open("/sys/kernel/debug/tracing/trace_marker", O_WRONLY | O_CLOEXEC);
+  if (fd == -1) {
+    state.SkipWithError("trace_marker not writable");
+    return;
+  }
+  TracePair(state, fd, true);
+  close(fd);
+}
+BENCHMARK(BM_atrace_pair_trace_marker);
@@ -181,13 +181,32 @@ void atrace_setup()
 
 void atrace_begin_body(const char* name)
 {
+    // This runs for every traced section, so build "B|<pid>|<name>" by hand
+    // rather than with snprintf, leaving only the write itself.
     char buf[ATRACE_MESSAGE_LENGTH];
-
-    int len = snprintf(buf, sizeof(buf), "B|%d|%s", getpid(), name);
-    if (len >= (int) sizeof(buf)) {
+    char pid[16];
+    char* p = pid + sizeof(pid);
+    unsigned int n = getpid();
+    do {
+        *--p = '0' + n % 10;
+        n /= 10;
+    } while (n != 0);
+    size_t pid_len = pid + sizeof(pid) - p;
+
+    buf[0] = 'B';
+    buf[1] = '|';
+    memcpy(buf + 2, p, pid_len);
+    size_t len = 2 + pid_len;
+    buf[len++] = '|';
+
+    // Leave room for the '\0' snprintf used to, so names are truncated as before.
+    size_t name_len = strlen(name);
+    if (name_len > sizeof(buf) - 1 - len) {
         ALOGW("Truncated name in %s: %s\n", __FUNCTION__, name);
-        len = sizeof(buf) - 1;
+        name_len = sizeof(buf) - 1 - len;
     }
+    memcpy(buf + len, name, name_len);
+    len += name_len;
     write(atrace_marker_fd, buf, len);
 }
 
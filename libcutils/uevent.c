@@ -14,6 +14,8 @@
  * limitations under the License.
  */
 
+#define _GNU_SOURCE 1
+
 #include <cutils/uevent.h>
 
 #include <errno.h>
@@ -49,6 +51,44 @@ ssize_t uevent_kernel_multicast_uid_recv(int socket, void *buffer, size_t length
     return uevent_kernel_recv(socket, buffer, length, true, uid);
 }
 
+/*
+ * Returns 0 if the message received with hdr came from the kernel, which
+ * means: with credentials, of root, from port 0 and, if require_group, to a
+ * multicast group. Otherwise returns -1, with errno set to EIO.
+ */
+static int uevent_check(const struct msghdr *hdr, bool require_group, uid_t *uid)
+{
+    const struct sockaddr_nl *addr = (const struct sockaddr_nl *)hdr->msg_name;
+
+    *uid = -1;
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(hdr);
+    if (cmsg == NULL || cmsg->cmsg_type != SCM_CREDENTIALS) {
+        /* ignoring netlink message with no sender credentials */
+        goto out;
+    }
+
+    struct ucred *cred = (struct ucred *)CMSG_DATA(cmsg);
+    *uid = cred->uid;
+    if (cred->uid != 0) {
+        /* ignoring netlink message from non-root user */
+        goto out;
+    }
+
+    if (addr->nl_pid != 0) {
+        /* ignore non-kernel */
+        goto out;
+    }
+    if (require_group && addr->nl_groups == 0) {
+        /* ignore unicast messages when requested */
+        goto out;
+    }
+    return 0;
+
+out:
+    errno = EIO;
+    return -1;
+}
+
 ssize_t uevent_kernel_recv(int socket, void *buffer, size_t length, bool require_group, uid_t *uid)
 {
     struct iovec iov = { buffer, length };
@@ -70,35 +110,60 @@ ssize_t uevent_kernel_recv(int socket, void *buffer, size_t length, bool require
         return n;
     }
 
-    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&hdr);
-    if (cmsg == NULL || cmsg->cmsg_type != SCM_CREDENTIALS) {
-        /* ignoring netlink message with no sender credentials */
-        goto out;
+    if (uevent_check(&hdr, require_group, uid) < 0) {
+        /* clear residual potentially malicious data */
+        bzero(buffer, length);
+        return -1;
     }
+    return n;
+}
 
-    struct ucred *cred = (struct ucred *)CMSG_DATA(cmsg);
-    *uid = cred->uid;
-    if (cred->uid != 0) {
-        /* ignoring netlink message from non-root user */
-        goto out;
+int uevent_kernel_recvmmsg(int socket, struct uevent_msg *msgs, unsigned int count,
+                           bool require_group)
+{
+    struct mmsghdr hdrs[UEVENT_RECVMMSG_MAX];
+    struct iovec iovs[UEVENT_RECVMMSG_MAX];
+    struct sockaddr_nl addrs[UEVENT_RECVMMSG_MAX];
+    char controls[UEVENT_RECVMMSG_MAX][CMSG_SPACE(sizeof(struct ucred))];
+    unsigned int i;
+
+    if (count > UEVENT_RECVMMSG_MAX) {
+        count = UEVENT_RECVMMSG_MAX;
     }
-
-    if (addr.nl_pid != 0) {
-        /* ignore non-kernel */
-        goto out;
+    memset(hdrs, 0, count * sizeof(hdrs[0]));
+    for (i = 0; i < count; ++i) {
+        iovs[i].iov_base = msgs[i].buffer;
+        iovs[i].iov_len = msgs[i].length;
+        hdrs[i].msg_hdr.msg_name = &addrs[i];
+        hdrs[i].msg_hdr.msg_namelen = sizeof(addrs[i]);
+        hdrs[i].msg_hdr.msg_iov = &iovs[i];
+        hdrs[i].msg_hdr.msg_iovlen = 1;
+        hdrs[i].msg_hdr.msg_control = controls[i];
+        hdrs[i].msg_hdr.msg_controllen = sizeof(controls[i]);
     }
-    if (require_group && addr.nl_groups == 0) {
-        /* ignore unicast messages when requested */
-        goto out;
+
+    /* Wait for the first message only, and take whatever else is queued. */
+    int n = recvmmsg(socket, hdrs, count, MSG_WAITFORONE, NULL);
+    if (n <= 0) {
+        return n;
     }
 
+    for (i = 0; i < (unsigned int)n; ++i) {
+        struct uevent_msg *msg = &msgs[i];
+        msg->received = hdrs[i].msg_len;
+        msg->error = 0;
+        if (uevent_check(&hdrs[i].msg_hdr, require_group, &msg->uid) < 0) {
+            msg->error = errno;
+        } else if (hdrs[i].msg_hdr.msg_flags & MSG_TRUNC) {
+            msg->error = EMSGSIZE;
+        }
+        if (msg->error) {
+            /* clear residual potentially malicious data */
+            bzero(msg->buffer, msg->length);
+            msg->received = -1;
+        }
+    }
     return n;
-
-out:
-    /* clear residual potentially malicious data */
-    bzero(buffer, length);
-    errno = EIO;
-    return -1;
 }
 
 int uevent_open_socket(int buf_sz, bool passcred)
@@ -0,0 +1,78 @@
+/*
+ *  ion_pool.h
+ *
+ * Recycling of ion buffers
+ *
+ *   Copyright 2017 The Android Open Source Project
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#ifndef __SYS_CORE_ION_POOL_H
+#define __SYS_CORE_ION_POOL_H
+
+#include <sys/types.h>
+
+__BEGIN_DECLS
+
+/*
+ * Keeps freed ion buffers around, by heap mask, flags and size class, to
+ * hand out again instead of going to the kernel for a new one: for clients
+ * that allocate and free buffers of the same few sizes at frame rate.
+ *
+ * A size class is the length rounded up to the next quarter power of two (and
+ * whole pages), so a recycled buffer may be up to 25% larger than asked for.
+ * A recycled buffer still holds what it was last written with. Every function
+ * but ion_pool_destroy is thread safe.
+ */
+struct ion_pool;
+
+/*
+ * Creates a pool allocating from the ion device fd, which must outlive it,
+ * and keeping at most max_cached bytes of free buffers. Returns NULL and sets
+ * errno on failure.
+ */
+struct ion_pool *ion_pool_create(int fd, size_t max_cached);
+
+/* Closes the free buffers. Buffers still allocated are the caller's to close. */
+void ion_pool_destroy(struct ion_pool *pool);
+
+/*
+ * As ion_alloc_fd, from a free buffer of the same heap mask, flags and size
+ * class if there is one. When the kernel is out of memory, the free buffers
+ * are released and the allocation tried once more.
+ */
+int ion_pool_alloc_fd(struct ion_pool *pool, size_t len, unsigned int heap_mask,
+                      unsigned int flags, int *handle_fd);
+
+/*
+ * Takes back handle_fd, from ion_pool_alloc_fd, to be handed out again. It
+ * must no longer be mapped or used by anyone, in this process or another.
+ * Returns 0, or -EINVAL if handle_fd is not one of the pool's.
+ */
+int ion_pool_free_fd(struct ion_pool *pool, int handle_fd);
+
+/*
+ * Closes free buffers, least recently freed first, until no more than
+ * max_cached bytes are left. 0 releases them all, as on memory pressure.
+ * Returns the number of bytes released.
+ */
+size_t ion_pool_trim(struct ion_pool *pool, size_t max_cached);
+
+/* Bytes of free buffers kept, and bytes handed out and not freed. */
+size_t ion_pool_cached(struct ion_pool *pool);
+size_t ion_pool_allocated(struct ion_pool *pool);
+
+__END_DECLS
+
+#endif /* __SYS_CORE_ION_POOL_H */
@@ -0,0 +1,265 @@
+/*
+ *  ion_pool.c
+ *
+ * Recycling of ion buffers
+ *
+ *   Copyright 2017 The Android Open Source Project
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+#define LOG_TAG "ion"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <ion/ion.h>
+#include <ion/ion_pool.h>
+#include <log/log.h>
+
+/* what a buffer was allocated as, and has to be asked for as to be reused */
+struct ion_pool_key {
+    size_t size;  /* 0 for fds that are not the pool's */
+    unsigned int heap_mask;
+    unsigned int flags;
+};
+
+struct ion_pool_buffer {
+    struct ion_pool_buffer *prev;
+    struct ion_pool_buffer *next;
+    struct ion_pool_key key;
+    int fd;
+};
+
+struct ion_pool {
+    pthread_mutex_t lock;
+    int ion_fd;
+    size_t max_cached;
+    size_t cached;
+    size_t allocated;
+
+    /*
+     * Free buffers, most recently freed first. There are few enough of them
+     * that looking one up walks the list; reuse usually finds it near the
+     * head anyway.
+     */
+    struct ion_pool_buffer *head;
+    struct ion_pool_buffer *tail;
+
+    /* buffers handed out, indexed by fd */
+    struct ion_pool_key *live;
+    size_t live_size;
+};
+
+static size_t size_class(size_t len)
+{
+    size_t page = getpagesize();
+    size_t step = page;
+
+    /* a quarter of the power of two at or below len, whole pages */
+    while (step * 8 <= len)
+        step *= 2;
+    return (len + step - 1) & ~(step - 1);
+}
+
+static int key_equal(const struct ion_pool_key *a, const struct ion_pool_key *b)
+{
+    return a->size == b->size && a->heap_mask == b->heap_mask &&
+           a->flags == b->flags;
+}
+
+static void unlink_buffer(struct ion_pool *pool, struct ion_pool_buffer *buf)
+{
+    if (buf->prev)
+        buf->prev->next = buf->next;
+    else
+        pool->head = buf->next;
+    if (buf->next)
+        buf->next->prev = buf->prev;
+    else
+        pool->tail = buf->prev;
+    pool->cached -= buf->key.size;
+}
+
+static size_t trim_locked(struct ion_pool *pool, size_t max_cached)
+{
+    size_t released = 0;
+
+    while (pool->cached > max_cached) {
+        struct ion_pool_buffer *buf = pool->tail;
+        unlink_buffer(pool, buf);
+        released += buf->key.size;
+        close(buf->fd);
+        free(buf);
+    }
+    return released;
+}
+
+static int add_live(struct ion_pool *pool, int fd, const struct ion_pool_key *key)
+{
+    if ((size_t)fd >= pool->live_size) {
+        size_t size = pool->live_size ? pool->live_size : 64;
+        while (size <= (size_t)fd)
+            size *= 2;
+        struct ion_pool_key *live = realloc(pool->live, size * sizeof(*live));
+        if (!live)
+            return -ENOMEM;
+        memset(live + pool->live_size, 0,
+               (size - pool->live_size) * sizeof(*live));
+        pool->live = live;
+        pool->live_size = size;
+    }
+    pool->live[fd] = *key;
+    pool->allocated += key->size;
+    return 0;
+}
+
+struct ion_pool *ion_pool_create(int fd, size_t max_cached)
+{
+    struct ion_pool *pool = calloc(1, sizeof(*pool));
+
+    if (!pool)
+        return NULL;
+    pthread_mutex_init(&pool->lock, NULL);
+    pool->ion_fd = fd;
+    pool->max_cached = max_cached;
+    return pool;
+}
+
+void ion_pool_destroy(struct ion_pool *pool)
+{
+    if (!pool)
+        return;
+    trim_locked(pool, 0);
+    pthread_mutex_destroy(&pool->lock);
+    free(pool->live);
+    free(pool);
+}
+
+int ion_pool_alloc_fd(struct ion_pool *pool, size_t len, unsigned int heap_mask,
+                      unsigned int flags, int *handle_fd)
+{
+    struct ion_pool_key key = {
+        .size = size_class(len),
+        .heap_mask = heap_mask,
+        .flags = flags,
+    };
+    struct ion_pool_buffer *buf;
+    int fd;
+    int ret;
+
+    if (handle_fd == NULL || len == 0)
+        return -EINVAL;
+
+    pthread_mutex_lock(&pool->lock);
+    for (buf = pool->head; buf; buf = buf->next) {
+        if (key_equal(&buf->key, &key))
+            break;
+    }
+    if (buf) {
+        unlink_buffer(pool, buf);
+        fd = buf->fd;
+        free(buf);
+    } else {
+        /* allocating under the lock keeps a retry from racing a free */
+        ret = ion_alloc_fd(pool->ion_fd, key.size, 0, heap_mask, flags, &fd);
+        if (ret == -ENOMEM && pool->cached) {
+            ALOGW("out of memory, releasing %zu bytes of free buffers\n",
+                  pool->cached);
+            trim_locked(pool, 0);
+            ret = ion_alloc_fd(pool->ion_fd, key.size, 0, heap_mask, flags, &fd);
+        }
+        if (ret < 0) {
+            pthread_mutex_unlock(&pool->lock);
+            return ret;
+        }
+    }
+
+    ret = add_live(pool, fd, &key);
+    pthread_mutex_unlock(&pool->lock);
+    if (ret < 0) {
+        close(fd);
+        return ret;
+    }
+    *handle_fd = fd;
+    return 0;
+}
+
+int ion_pool_free_fd(struct ion_pool *pool, int handle_fd)
+{
+    struct ion_pool_buffer *buf;
+
+    pthread_mutex_lock(&pool->lock);
+    if (handle_fd < 0 || (size_t)handle_fd >= pool->live_size ||
+        !pool->live[handle_fd].size) {
+        pthread_mutex_unlock(&pool->lock);
+        return -EINVAL;
+    }
+
+    struct ion_pool_key key = pool->live[handle_fd];
+    pool->live[handle_fd].size = 0;
+    pool->allocated -= key.size;
+
+    buf = (key.size <= pool->max_cached) ? malloc(sizeof(*buf)) : NULL;
+    if (!buf) {
+        pthread_mutex_unlock(&pool->lock);
+        close(handle_fd);
+        return 0;
+    }
+
+    trim_locked(pool, pool->max_cached - key.size);
+    buf->key = key;
+    buf->fd = handle_fd;
+    buf->prev = NULL;
+    buf->next = pool->head;
+    if (pool->head)
+        pool->head->prev = buf;
+    else
+        pool->tail = buf;
+    pool->head = buf;
+    pool->cached += key.size;
+    pthread_mutex_unlock(&pool->lock);
+    return 0;
+}
+
+size_t ion_pool_trim(struct ion_pool *pool, size_t max_cached)
+{
+    size_t released;
+
+    pthread_mutex_lock(&pool->lock);
+    released = trim_locked(pool, max_cached);
+    pthread_mutex_unlock(&pool->lock);
+    return released;
+}
+
+size_t ion_pool_cached(struct ion_pool *pool)
+{
+    size_t cached;
+
+    pthread_mutex_lock(&pool->lock);
+    cached = pool->cached;
+    pthread_mutex_unlock(&pool->lock);
+    return cached;
+}
+
+size_t ion_pool_allocated(struct ion_pool *pool)
+{
+    size_t allocated;
+
+    pthread_mutex_lock(&pool->lock);
+    allocated = pool->allocated;
+    pthread_mutex_unlock(&pool->lock);
+    return allocated;
+}
@@ -0,0 +1,71 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <unistd.h>
+
+#include <benchmark/benchmark.h>
+#include <ion/ion.h>
+#include <ion/ion_pool.h>
+
+// The first heap there is, as the system heap usually is.
+static unsigned int first_heap(int fd) {
+    for (unsigned int heap = 1; heap != 0; heap <<= 1) {
+        ion_user_handle_t handle;
+        if (ion_alloc(fd, 4096, 0, heap, 0, &handle) == 0) {
+            ion_free(fd, handle);
+            return heap;
+        }
+    }
+    return 0;
+}
+
+// A buffer from the kernel, and back, every time.
+static void BM_ion_alloc_fd(benchmark::State& state) {
+    size_t size = state.range(0);
+    int ion_fd = ion_open();
+    unsigned int heap = first_heap(ion_fd);
+    while (state.KeepRunning()) {
+        int fd;
+        if (ion_alloc_fd(ion_fd, size, 0, heap, 0, &fd) < 0) {
+            state.SkipWithError("ion_alloc_fd failed");
+            break;
+        }
+        close(fd);
+    }
+    ion_close(ion_fd);
+}
+BENCHMARK(BM_ion_alloc_fd)->Arg(4096)->Arg(1024 * 1024)->Arg(8 * 1024 * 1024);
+
+// The same, recycled by a pool.
+static void BM_ion_pool_alloc_fd(benchmark::State& state) {
+    size_t size = state.range(0);
+    int ion_fd = ion_open();
+    unsigned int heap = first_heap(ion_fd);
+    struct ion_pool* pool = ion_pool_create(ion_fd, 16 * 1024 * 1024);
+    while (state.KeepRunning()) {
+        int fd;
+        if (ion_pool_alloc_fd(pool, size, heap, 0, &fd) < 0) {
+            state.SkipWithError("ion_pool_alloc_fd failed");
+            break;
+        }
+        ion_pool_free_fd(pool, fd);
+    }
+    ion_pool_destroy(pool);
+    ion_close(ion_fd);
+}
+BENCHMARK(BM_ion_pool_alloc_fd)->Arg(4096)->Arg(1024 * 1024)->Arg(8 * 1024 * 1024);
+
+BENCHMARK_MAIN();
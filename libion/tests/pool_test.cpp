@@ -0,0 +1,110 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <gtest/gtest.h>
+
+#include <ion/ion.h>
+#include <ion/ion_pool.h>
+
+#include "ion_test_fixture.h"
+
+class Pool : public IonAllHeapsTest {
+};
+
+TEST_F(Pool, Recycle)
+{
+    static const size_t allocationSizes[] = {4*1024, 64*1024, 1024*1024, 2*1024*1024};
+    struct ion_pool *pool = ion_pool_create(m_ionFd, 8*1024*1024);
+    ASSERT_TRUE(pool != NULL);
+    for (unsigned int heapMask : m_allHeaps) {
+        for (size_t size : allocationSizes) {
+            SCOPED_TRACE(::testing::Message() << "heap " << heapMask);
+            SCOPED_TRACE(::testing::Message() << "size " << size);
+            int fd = -1, fd2 = -1;
+
+            ASSERT_EQ(0, ion_pool_alloc_fd(pool, size, heapMask, 0, &fd));
+            ASSERT_GE(fd, 0);
+            ASSERT_EQ(size, ion_pool_allocated(pool));
+
+            void *ptr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+            ASSERT_TRUE(ptr != MAP_FAILED);
+            memset(ptr, 0xaa, size);
+            ASSERT_EQ(0, munmap(ptr, size));
+
+            ASSERT_EQ(0, ion_pool_free_fd(pool, fd));
+            ASSERT_EQ(size, ion_pool_cached(pool));
+            ASSERT_EQ(0U, ion_pool_allocated(pool));
+
+            /* the same buffer comes back, for the same heap and size only */
+            ASSERT_EQ(0, ion_pool_alloc_fd(pool, size, heapMask, ION_FLAG_CACHED, &fd2));
+            ASSERT_EQ(size, ion_pool_cached(pool));
+            ASSERT_EQ(0, ion_pool_free_fd(pool, fd2));
+
+            ASSERT_EQ(0, ion_pool_alloc_fd(pool, size - 1, heapMask, 0, &fd2));
+            ASSERT_EQ(fd, fd2);
+            ASSERT_EQ(0, ion_pool_free_fd(pool, fd2));
+
+            ASSERT_EQ(2 * size, ion_pool_trim(pool, 0));
+            ASSERT_EQ(0U, ion_pool_cached(pool));
+        }
+    }
+    ion_pool_destroy(pool);
+}
+
+TEST_F(Pool, MaxCached)
+{
+    struct ion_pool *pool = ion_pool_create(m_ionFd, 128*1024);
+    ASSERT_TRUE(pool != NULL);
+    for (unsigned int heapMask : m_allHeaps) {
+        SCOPED_TRACE(::testing::Message() << "heap " << heapMask);
+        int fds[4];
+
+        for (int &fd : fds)
+            ASSERT_EQ(0, ion_pool_alloc_fd(pool, 64*1024, heapMask, 0, &fd));
+        for (int fd : fds)
+            ASSERT_EQ(0, ion_pool_free_fd(pool, fd));
+        ASSERT_EQ(128U*1024, ion_pool_cached(pool));
+
+        /* too large to keep at all */
+        int fd = -1;
+        ASSERT_EQ(0, ion_pool_alloc_fd(pool, 256*1024, heapMask, 0, &fd));
+        ASSERT_EQ(0, ion_pool_free_fd(pool, fd));
+        ASSERT_EQ(128U*1024, ion_pool_cached(pool));
+
+        ion_pool_trim(pool, 0);
+    }
+    ion_pool_destroy(pool);
+}
+
+TEST_F(Pool, InvalidValues)
+{
+    struct ion_pool *pool = ion_pool_create(m_ionFd, 1024*1024);
+    ASSERT_TRUE(pool != NULL);
+    int fd = -1;
+
+    ASSERT_EQ(-EINVAL, ion_pool_alloc_fd(pool, 0, m_firstHeap, 0, &fd));
+    ASSERT_EQ(-EINVAL, ion_pool_alloc_fd(pool, 4096, m_firstHeap, 0, NULL));
+    ASSERT_EQ(-EINVAL, ion_pool_free_fd(pool, -1));
+    ASSERT_EQ(-EINVAL, ion_pool_free_fd(pool, m_ionFd));
+
+    ASSERT_EQ(0, ion_pool_alloc_fd(pool, 4096, m_firstHeap, 0, &fd));
+    ASSERT_EQ(0, ion_pool_free_fd(pool, fd));
+    ASSERT_EQ(-EINVAL, ion_pool_free_fd(pool, fd));
+    ion_pool_destroy(pool);
+}
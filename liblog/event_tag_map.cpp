@@ -24,6 +24,8 @@
 #include <stdlib.h>
 #include <string.h>
 #include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include <experimental/string_view>
 #include <functional>
@@ -118,6 +120,8 @@ struct EventTagMap {
   // memory-mapped source file; we get strings from here
   void* mapAddr[NUM_MAPS];
   size_t mapLen[NUM_MAPS];
+  // precompiled stand in for the system file, shared and never copied
+  const android_event_tag_table_header_t* table;
 
  private:
   std::unordered_map<uint32_t, TagFmt> Idx2TagFmt;
@@ -127,12 +131,13 @@ struct EventTagMap {
   android::RWLock rwlock;
 
  public:
-  EventTagMap() {
+  EventTagMap() : table(NULL) {
     memset(mapAddr, 0, sizeof(mapAddr));
     memset(mapLen, 0, sizeof(mapLen));
   }
 
   ~EventTagMap() {
+    __android_event_tag_table_close(table);
     Idx2TagFmt.clear();
     TagFmt2Idx.clear();
     Tag2Idx.clear();
@@ -215,6 +220,21 @@ const TagFmt* EventTagMap::find(uint32_t tag) const {
 }
 
 int EventTagMap::find(TagFmt&& tagfmt) const {
+  if (table) {
+    const android_event_tag_table_entry_t* e =
+        __android_event_tag_table_find_name(table, tagfmt.first.data(),
+                                            tagfmt.first.length());
+    for (; e; e = (e->next_name == EVENT_TAG_TABLE_NONE)
+                      ? NULL
+                      : __android_event_tag_table_entry(table, e->next_name)) {
+      if ((e->format_len == tagfmt.second.length()) &&
+          !memcmp(__android_event_tag_table_string(table, e->format),
+                  tagfmt.second.data(), e->format_len)) {
+        return e->tag;
+      }
+    }
+  }
+
   std::unordered_map<TagFmt, uint32_t>::const_iterator it;
   android::RWLock::AutoRLock readLock(const_cast<android::RWLock&>(rwlock));
   it = TagFmt2Idx.find(std::move(tagfmt));
@@ -223,6 +243,12 @@ int EventTagMap::find(TagFmt&& tagfmt) const {
 }
 
 int EventTagMap::find(MapString&& tag) const {
+  if (table) {
+    const android_event_tag_table_entry_t* e =
+        __android_event_tag_table_find_name(table, tag.data(), tag.length());
+    if (e) return e->tag;
+  }
+
   std::unordered_map<MapString, uint32_t>::const_iterator it;
   android::RWLock::AutoRLock readLock(const_cast<android::RWLock&>(rwlock));
   it = Tag2Idx.find(std::move(tag));
@@ -343,6 +369,111 @@ static int scanTagLine(EventTagMap* map, const char*& pData, int lineNum) {
   return -1;
 }
 
+LIBLOG_ABI_PRIVATE const android_event_tag_table_header_t*
+__android_event_tag_table_open(const char* filename, size_t source_size) {
+  int fd = open(filename ? filename : EVENT_TAG_TABLE_FILE,
+                O_RDONLY | O_CLOEXEC);
+  if (fd < 0) return NULL;
+
+  struct stat st;
+  void* addr = MAP_FAILED;
+  if (!fstat(fd, &st) &&
+      ((size_t)st.st_size >= sizeof(android_event_tag_table_header_t)) &&
+      ((uint64_t)st.st_size <= UINT32_MAX)) {
+    addr = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  }
+  close(fd);
+  if (addr == MAP_FAILED) return NULL;
+
+  const android_event_tag_table_header_t* table =
+      static_cast<const android_event_tag_table_header_t*>(addr);
+  const uint64_t size = st.st_size;
+  const uint64_t count = table->count;
+  const uint64_t buckets = table->buckets;
+
+  // Everything must fit, in order, and the file must end with the strings
+  bool valid =
+      (table->magic == EVENT_TAG_TABLE_MAGIC) &&
+      (table->source_size == source_size) && count && buckets &&
+      (table->entries >= sizeof(*table)) &&
+      ((table->entries + count * sizeof(android_event_tag_table_entry_t)) <=
+       table->tag_disp) &&
+      ((table->tag_disp + buckets * sizeof(uint32_t)) <= table->tag_slot) &&
+      ((table->tag_slot + count * sizeof(uint32_t)) <= table->name_disp) &&
+      ((table->name_disp + buckets * sizeof(uint32_t)) <= table->name_slot) &&
+      ((table->name_slot + count * sizeof(uint32_t)) <= table->strings) &&
+      ((table->strings + (uint64_t)table->strings_size) == size) &&
+      !(table->tag_disp % sizeof(uint32_t)) &&
+      !(table->tag_slot % sizeof(uint32_t)) &&
+      !(table->name_disp % sizeof(uint32_t)) &&
+      !(table->name_slot % sizeof(uint32_t));
+
+  const uint32_t* tagSlot = reinterpret_cast<const uint32_t*>(
+      static_cast<const char*>(addr) + (valid ? table->tag_slot : 0));
+  const uint32_t* nameSlot = reinterpret_cast<const uint32_t*>(
+      static_cast<const char*>(addr) + (valid ? table->name_slot : 0));
+  const char* strings = static_cast<const char*>(addr) + table->strings;
+  for (uint32_t i = 0; valid && (i < count); ++i) {
+    const android_event_tag_table_entry_t* e =
+        __android_event_tag_table_entry(table, i);
+    valid = (tagSlot[i] < count) &&
+            ((nameSlot[i] < count) || (nameSlot[i] == EVENT_TAG_TABLE_NONE)) &&
+            ((e->next_name < count) || (e->next_name == EVENT_TAG_TABLE_NONE)) &&
+            (e->next_name != i) &&
+            (((uint64_t)e->name + e->name_len) < table->strings_size) &&
+            (((uint64_t)e->format + e->format_len) < table->strings_size) &&
+            !strings[e->name + e->name_len] &&
+            !strings[e->format + e->format_len];
+  }
+  if (!valid) {
+    munmap(addr, st.st_size);
+    return NULL;
+  }
+  return table;
+}
+
+LIBLOG_ABI_PRIVATE void __android_event_tag_table_close(
+    const android_event_tag_table_header_t* table) {
+  if (!table) return;
+  munmap(const_cast<android_event_tag_table_header_t*>(table),
+         table->strings + table->strings_size);
+}
+
+LIBLOG_ABI_PRIVATE const android_event_tag_table_entry_t*
+__android_event_tag_table_find_tag(
+    const android_event_tag_table_header_t* table, uint32_t tag) {
+  const char* base = reinterpret_cast<const char*>(table);
+  const uint8_t key[sizeof(tag)] = {
+    uint8_t(tag), uint8_t(tag >> 8), uint8_t(tag >> 16), uint8_t(tag >> 24)
+  };
+  uint32_t slot = __android_event_tag_table_slot(
+      reinterpret_cast<const uint32_t*>(base + table->tag_disp),
+      table->buckets, table->count, key, sizeof(key));
+  const android_event_tag_table_entry_t* e = __android_event_tag_table_entry(
+      table, reinterpret_cast<const uint32_t*>(base + table->tag_slot)[slot]);
+  return (e->tag == tag) ? e : NULL;
+}
+
+LIBLOG_ABI_PRIVATE const android_event_tag_table_entry_t*
+__android_event_tag_table_find_name(
+    const android_event_tag_table_header_t* table, const char* name,
+    size_t len) {
+  const char* base = reinterpret_cast<const char*>(table);
+  uint32_t slot = __android_event_tag_table_slot(
+      reinterpret_cast<const uint32_t*>(base + table->name_disp),
+      table->buckets, table->count, name, len);
+  uint32_t index =
+      reinterpret_cast<const uint32_t*>(base + table->name_slot)[slot];
+  if (index == EVENT_TAG_TABLE_NONE) return NULL;
+  const android_event_tag_table_entry_t* e =
+      __android_event_tag_table_entry(table, index);
+  if ((e->name_len != len) ||
+      memcmp(__android_event_tag_table_string(table, e->name), name, len)) {
+    return NULL;
+  }
+  return e;
+}
+
 static const char* eventTagFiles[NUM_MAPS] = {
   EVENT_TAG_MAP_FILE, "/dev/event-log-tags",
 };
@@ -447,6 +578,15 @@ LIBLOG_ABI_PUBLIC EventTagMap* android_openEventTagMap(const char* fileName) {
     goto fail_close;
   }
 
+  // An up to date precompiled table spares us the system file parse
+  if (!fileName && (fd[0] >= 0)) {
+    newTagMap->table = __android_event_tag_table_open(NULL, end[0]);
+    if (newTagMap->table) {
+      close(fd[0]);
+      fd[0] = -1;
+    }
+  }
+
   for (which = 0; which < NUM_MAPS; ++which) {
     if (fd[which] >= 0) {
       newTagMap->mapAddr[which] =
@@ -469,6 +609,7 @@ LIBLOG_ABI_PUBLIC EventTagMap* android_openEventTagMap(const char* fileName) {
   }
 
   for (which = 0; which < NUM_MAPS; ++which) {
+    if (!which && newTagMap->table) continue;
     if (parseMapLines(newTagMap, which) != 0) {
       delete newTagMap;
       return NULL;
@@ -540,6 +681,12 @@ LIBLOG_ABI_PUBLIC const char* android_lookupEventTag_len(const EventTagMap* map,
                                                          size_t* len,
                                                          unsigned int tag) {
   if (len) *len = 0;
+  const android_event_tag_table_entry_t* e =
+      map->table ? __android_event_tag_table_find_tag(map->table, tag) : NULL;
+  if (e) {
+    if (len) *len = e->name_len;
+    return __android_event_tag_table_string(map->table, e->name);
+  }
   const TagFmt* str = map->find(tag);
   if (!str) {
     str = __getEventTag(const_cast<EventTagMap*>(map), tag);
@@ -553,6 +700,12 @@ LIBLOG_ABI_PUBLIC const char* android_lookupEventTag_len(const EventTagMap* map,
 LIBLOG_ABI_PUBLIC const char* android_lookupEventFormat_len(
     const EventTagMap* map, size_t* len, unsigned int tag) {
   if (len) *len = 0;
+  const android_event_tag_table_entry_t* e =
+      map->table ? __android_event_tag_table_find_tag(map->table, tag) : NULL;
+  if (e) {
+    if (len) *len = e->format_len;
+    return __android_event_tag_table_string(map->table, e->format);
+  }
   const TagFmt* str = map->find(tag);
   if (!str) {
     str = __getEventTag(const_cast<EventTagMap*>(map), tag);
@@ -0,0 +1,285 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Build time generator of EVENT_TAG_TABLE_FILE from event-log-tags:
+//
+//   event-log-tags-table <event-log-tags> <event-log-tags.table>
+
+#include <ctype.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <private/android_filesystem_config.h>
+#include <private/android_logger.h>
+
+struct Tag {
+  uint32_t tag;
+  uint32_t uid;
+  std::string name;
+  std::string format;
+};
+
+// Same grammar as scanTagLine() in event_tag_map.cpp
+static bool parse(const std::string& content, std::vector<Tag>& tags) {
+  std::unordered_map<uint32_t, size_t> seen;
+  size_t lineNum = 0;
+  size_t pos = 0;
+
+  while (pos < content.length()) {
+    size_t eol = content.find('\n', pos);
+    if (eol == std::string::npos) eol = content.length();
+    std::string line = content.substr(pos, eol - pos);
+    pos = eol + 1;
+    ++lineNum;
+
+    const char* cp = line.c_str();
+    while (isspace(*cp)) ++cp;
+    if (!*cp || (*cp == '#')) continue;
+    if (!isdigit(*cp)) {
+      fprintf(stderr, "line %zu: unexpected chars\n", lineNum);
+      return false;
+    }
+
+    char* ep;
+    unsigned long val = strtoul(cp, &ep, 10);
+    if (val > UINT32_MAX) {
+      fprintf(stderr, "line %zu: tag number too large\n", lineNum);
+      return false;
+    }
+    cp = ep;
+    while (isspace(*cp)) ++cp;
+    const char* name = cp;
+    while (*cp && (isalnum(*cp) || strchr("_.-@,", *cp))) ++cp;
+    if ((cp == name) || (*cp && !isspace(*cp))) {
+      fprintf(stderr, "line %zu: invalid tag name\n", lineNum);
+      return false;
+    }
+
+    Tag t;
+    t.tag = val;
+    t.uid = AID_ROOT;
+    t.name = std::string(name, cp - name);
+    while (isspace(*cp)) ++cp;
+    const char* format = cp;
+    while (*cp && (*cp != '#')) ++cp;
+    const char* end = cp;
+    while ((end > format) && isspace(end[-1])) --end;
+    t.format = std::string(format, end - format);
+    if (*cp == '#') {
+      do {
+        ++cp;
+      } while (isspace(*cp));
+      if (!strncmp(cp, "uid=", strlen("uid=")) && isdigit(cp[4])) {
+        t.uid = strtoul(cp + 4, nullptr, 10);
+      }
+    }
+
+    if ((t.name.length() > UINT16_MAX) || (t.format.length() > UINT16_MAX)) {
+      fprintf(stderr, "line %zu: too long\n", lineNum);
+      return false;
+    }
+    if (seen.find(t.tag) != seen.end()) {
+      fprintf(stderr, "line %zu: duplicate tag %u\n", lineNum, t.tag);
+      return false;
+    }
+    seen[t.tag] = tags.size();
+    tags.push_back(t);
+  }
+  return true;
+}
+
+// Hash and displace: place the largest buckets first, searching for a seed
+// that lands every key of the bucket in a free slot.
+static bool buildHash(const std::vector<std::string>& keys, uint32_t count,
+                      uint32_t buckets, std::vector<uint32_t>& disp,
+                      std::vector<uint32_t>& slot) {
+  std::vector<std::vector<uint32_t>> bucket(buckets);
+  for (uint32_t i = 0; i < keys.size(); ++i) {
+    bucket[__android_event_tag_table_hash(keys[i].data(), keys[i].length(),
+                                          0) %
+           buckets]
+        .push_back(i);
+  }
+  std::vector<uint32_t> order(buckets);
+  for (uint32_t b = 0; b < buckets; ++b) order[b] = b;
+  std::stable_sort(order.begin(), order.end(), [&](uint32_t l, uint32_t r) {
+    return bucket[l].size() > bucket[r].size();
+  });
+
+  disp.assign(buckets, 0);
+  slot.assign(count, EVENT_TAG_TABLE_NONE);
+  std::vector<bool> used(count, false);
+  for (uint32_t b : order) {
+    if (bucket[b].empty()) break;
+    for (uint32_t seed = 1;; ++seed) {
+      if (!seed) return false;  // wrapped, give up
+      std::vector<uint32_t> placed;
+      for (uint32_t k : bucket[b]) {
+        uint32_t s = __android_event_tag_table_hash(
+                         keys[k].data(), keys[k].length(), seed) %
+                     count;
+        if (used[s] ||
+            (std::find(placed.begin(), placed.end(), s) != placed.end())) {
+          break;
+        }
+        placed.push_back(s);
+      }
+      if (placed.size() != bucket[b].size()) continue;
+      disp[b] = seed;
+      for (size_t i = 0; i < placed.size(); ++i) {
+        used[placed[i]] = true;
+        slot[placed[i]] = bucket[b][i];
+      }
+      break;
+    }
+  }
+  return true;
+}
+
+static void put(std::string& out, const void* data, size_t len) {
+  out.append(static_cast<const char*>(data), len);
+}
+
+static void put(std::string& out, const std::vector<uint32_t>& v) {
+  for (uint32_t val : v) {
+    uint8_t le[sizeof(val)] = { uint8_t(val), uint8_t(val >> 8),
+                                uint8_t(val >> 16), uint8_t(val >> 24) };
+    put(out, le, sizeof(le));
+  }
+}
+
+int main(int argc, char** argv) {
+  if (argc != 3) {
+    fprintf(stderr, "Usage: %s <event-log-tags> <event-log-tags.table>\n",
+            argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  FILE* fp = fopen(argv[1], "re");
+  if (!fp) {
+    fprintf(stderr, "%s: %s\n", argv[1], strerror(errno));
+    return EXIT_FAILURE;
+  }
+  std::string content;
+  char buf[4096];
+  size_t len;
+  while ((len = fread(buf, 1, sizeof(buf), fp)) > 0) content.append(buf, len);
+  fclose(fp);
+
+  std::vector<Tag> tags;
+  if (!parse(content, tags)) {
+    fprintf(stderr, "%s: parse failed\n", argv[1]);
+    return EXIT_FAILURE;
+  }
+  if (tags.empty() || (content.length() > UINT32_MAX)) {
+    fprintf(stderr, "%s: no table for empty or huge file\n", argv[1]);
+    return EXIT_FAILURE;
+  }
+  const uint32_t count = tags.size();
+  const uint32_t buckets = (count + 3) / 4;
+
+  // Strings, and chains of entries sharing a name.  As with Tag2Idx the
+  // first entry of a chain is any without a format, else the first seen.
+  std::string strings;
+  std::vector<android_event_tag_table_entry_t> entries(count);
+  std::unordered_map<std::string, uint32_t> first;
+  std::vector<std::string> names;
+  std::vector<uint32_t> nameIndex;
+  for (uint32_t i = 0; i < count; ++i) {
+    android_event_tag_table_entry_t& e = entries[i];
+    e.tag = tags[i].tag;
+    e.uid = tags[i].uid;
+    e.name = strings.length();
+    e.name_len = tags[i].name.length();
+    strings += tags[i].name;
+    strings += '\0';
+    e.format = strings.length();
+    e.format_len = tags[i].format.length();
+    strings += tags[i].format;
+    strings += '\0';
+    e.next_name = EVENT_TAG_TABLE_NONE;
+
+    auto it = first.find(tags[i].name);
+    if (it == first.end()) {
+      first[tags[i].name] = names.size();
+      names.push_back(tags[i].name);
+      nameIndex.push_back(i);
+    } else if (!e.format_len && entries[nameIndex[it->second]].format_len) {
+      e.next_name = nameIndex[it->second];
+      nameIndex[it->second] = i;
+    } else {
+      uint32_t j = nameIndex[it->second];
+      while (entries[j].next_name != EVENT_TAG_TABLE_NONE) {
+        j = entries[j].next_name;
+      }
+      entries[j].next_name = i;
+    }
+  }
+
+  std::vector<std::string> tagKeys;
+  for (const Tag& t : tags) {
+    uint8_t le[sizeof(t.tag)] = { uint8_t(t.tag), uint8_t(t.tag >> 8),
+                                  uint8_t(t.tag >> 16), uint8_t(t.tag >> 24) };
+    tagKeys.push_back(std::string(reinterpret_cast<char*>(le), sizeof(le)));
+  }
+  std::vector<uint32_t> tagDisp, tagSlot, nameDisp, nameSlot;
+  if (!buildHash(tagKeys, count, buckets, tagDisp, tagSlot) ||
+      !buildHash(names, count, buckets, nameDisp, nameSlot)) {
+    fprintf(stderr, "%s: no perfect hash found\n", argv[1]);
+    return EXIT_FAILURE;
+  }
+  for (uint32_t& s : nameSlot) {
+    if (s != EVENT_TAG_TABLE_NONE) s = nameIndex[s];
+  }
+
+  android_event_tag_table_header_t header;
+  header.magic = EVENT_TAG_TABLE_MAGIC;
+  header.source_size = content.length();
+  header.count = count;
+  header.buckets = buckets;
+  header.entries = sizeof(header);
+  header.tag_disp = header.entries + count * sizeof(entries[0]);
+  header.tag_slot = header.tag_disp + buckets * sizeof(uint32_t);
+  header.name_disp = header.tag_slot + count * sizeof(uint32_t);
+  header.name_slot = header.name_disp + buckets * sizeof(uint32_t);
+  header.strings = header.name_slot + count * sizeof(uint32_t);
+  header.strings_size = strings.length();
+
+  // Generated on little endian hosts, which is all the targets as well
+  std::string out;
+  put(out, &header, sizeof(header));
+  put(out, entries.data(), count * sizeof(entries[0]));
+  put(out, tagDisp);
+  put(out, tagSlot);
+  put(out, nameDisp);
+  put(out, nameSlot);
+  out += strings;
+
+  fp = fopen(argv[2], "we");
+  if (!fp || (fwrite(out.data(), 1, out.length(), fp) != out.length()) ||
+      fclose(fp)) {
+    fprintf(stderr, "%s: %s\n", argv[2], strerror(errno));
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,244 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include <private/android_logger.h>
+
+#include "config_read.h"
+#include "logger.h"
+
+/*
+ * Binary log dumps, the struct log_msg records logcat -B writes back to
+ * back, mapped and read in place. Selected with android_logger_list_set_file()
+ * rather than registered with the other transports, as it reads a file the
+ * caller names and not the live logs.
+ */
+
+static int fileVersion(struct android_log_logger* logger,
+                       struct android_log_transport_context* transp);
+static int fileRead(struct android_log_logger_list* logger_list,
+                    struct android_log_transport_context* transp,
+                    struct log_msg* log_msg);
+static void fileClose(struct android_log_logger_list* logger_list,
+                      struct android_log_transport_context* transp);
+
+LIBLOG_HIDDEN struct android_log_transport_read fileLoggerRead = {
+  .node = { &fileLoggerRead.node, &fileLoggerRead.node },
+  .name = "file",
+  .available = NULL,
+  .version = fileVersion,
+  .read = fileRead,
+  .poll = NULL,
+  .close = fileClose,
+  .clear = NULL,
+  .setSize = NULL,
+  .getSize = NULL,
+  .getReadableSize = NULL,
+  .getPrune = NULL,
+  .setPrune = NULL,
+  .getStats = NULL,
+};
+
+struct file_context {
+  const char* map;
+  size_t size;
+  size_t offset;  /* of the next record */
+  size_t skip;    /* selected records to pass over to honour tail */
+};
+
+static int fileVersion(struct android_log_logger* logger __unused,
+                       struct android_log_transport_context* transp __unused) {
+  return 4;
+}
+
+static void fileClose(struct android_log_logger_list* logger_list __unused,
+                      struct android_log_transport_context* transp) {
+  struct file_context* context = transp->priv;
+
+  if (!context) {
+    return;
+  }
+  if (context->map) {
+    munmap((void*)context->map, context->size);
+  }
+  free(context);
+  transp->priv = NULL;
+}
+
+/*
+ * Validates the record at offset, returns its size and sets *entry, 0 at
+ * the end of the file or -errno if what follows is not a whole record.
+ */
+static ssize_t fileRecord(const struct file_context* context, size_t offset,
+                          struct logger_entry_v4* entry) {
+  size_t hdr_size, size, left = context->size - offset;
+
+  if (!left) {
+    return 0;
+  }
+  if (left < sizeof(struct logger_entry)) {
+    return -EIO;
+  }
+  memcpy(entry, context->map + offset,
+         (left < sizeof(*entry)) ? left : sizeof(*entry));
+  hdr_size = entry->hdr_size ? entry->hdr_size : sizeof(struct logger_entry);
+  if ((hdr_size < sizeof(struct logger_entry)) ||
+      (hdr_size > sizeof(struct logger_entry_v4)) ||
+      (entry->len > LOGGER_ENTRY_MAX_PAYLOAD)) {
+    return -EINVAL;
+  }
+  size = hdr_size + entry->len;
+  if (size > left) {
+    return -EIO;
+  }
+  /* what was copied past a shorter header is payload */
+  memset((char*)entry + hdr_size, 0, sizeof(*entry) - hdr_size);
+  /* earlier records carry no log id, they could only be from main */
+  if (hdr_size < sizeof(struct logger_entry_v3)) {
+    entry->lid = LOG_ID_MAIN;
+  }
+  return size;
+}
+
+static bool fileSelected(struct android_log_logger_list* logger_list,
+                         struct android_log_transport_context* transp,
+                         const struct logger_entry_v4* entry) {
+  if ((entry->lid >= LOG_ID_MAX) || !(transp->logMask & (1 << entry->lid))) {
+    return false;
+  }
+  if (logger_list->pid && (logger_list->pid != entry->pid)) {
+    return false;
+  }
+  if (logger_list->start.tv_sec || logger_list->start.tv_nsec) {
+    if ((entry->sec < logger_list->start.tv_sec) ||
+        ((entry->sec == logger_list->start.tv_sec) &&
+         (entry->nsec < logger_list->start.tv_nsec))) {
+      return false;
+    }
+  }
+  return true;
+}
+
+static int fileOpen(struct android_log_logger_list* logger_list,
+                    struct android_log_transport_context* transp) {
+  struct file_context* context;
+  struct stat st;
+  int fd;
+
+  context = calloc(1, sizeof(*context));
+  if (!context) {
+    return -ENOMEM;
+  }
+
+  fd = TEMP_FAILURE_RETRY(open(logger_list->file, O_RDONLY | O_CLOEXEC));
+  if (fd < 0) {
+    int save_errno = errno;
+    free(context);
+    return -save_errno;
+  }
+  if (fstat(fd, &st) < 0) {
+    int save_errno = errno;
+    close(fd);
+    free(context);
+    return -save_errno;
+  }
+  if (st.st_size > 0) {
+    void* map;
+
+    context->size = st.st_size;
+    map = mmap(NULL, context->size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED) {
+      int save_errno = errno;
+      close(fd);
+      free(context);
+      return -save_errno;
+    }
+    /* read once front to back, let the kernel read ahead and drop behind */
+    madvise(map, context->size, MADV_SEQUENTIAL);
+    context->map = map;
+  }
+  close(fd);
+
+  /* A tail means a pass to count what is selected first */
+  if (logger_list->tail) {
+    size_t offset = 0, count = 0;
+    struct logger_entry_v4 entry;
+    ssize_t size;
+
+    while ((size = fileRecord(context, offset, &entry)) > 0) {
+      if (fileSelected(logger_list, transp, &entry)) {
+        ++count;
+      }
+      offset += size;
+    }
+    if (count > logger_list->tail) {
+      context->skip = count - logger_list->tail;
+    }
+  }
+
+  transp->priv = context;
+  return 0;
+}
+
+static int fileRead(struct android_log_logger_list* logger_list,
+                    struct android_log_transport_context* transp,
+                    struct log_msg* log_msg) {
+  struct file_context* context;
+
+  if (!transp->priv) {
+    int ret = fileOpen(logger_list, transp);
+    if (ret < 0) {
+      return ret;
+    }
+  }
+  context = transp->priv;
+
+  for (;;) {
+    struct logger_entry_v4 entry;
+    ssize_t size = fileRecord(context, context->offset, &entry);
+
+    if (size <= 0) {
+      /* nothing more will be appended to a dump to wait for */
+      return size ? size : -EAGAIN;
+    }
+    if (!fileSelected(logger_list, transp, &entry)) {
+      context->offset += size;
+      continue;
+    }
+    if (context->skip) {
+      --context->skip;
+      context->offset += size;
+      continue;
+    }
+
+    /* widen older headers, so there is always a log id to hand back */
+    memcpy(log_msg->entry_v4.msg,
+           context->map + context->offset + size - entry.len, entry.len);
+    entry.hdr_size = sizeof(struct logger_entry_v4);
+    memcpy(&log_msg->entry_v4, &entry, sizeof(entry));
+    context->offset += size;
+    return sizeof(struct logger_entry_v4) + entry.len;
+  }
+}
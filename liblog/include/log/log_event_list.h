@@ -19,6 +19,7 @@
 
 #include <errno.h>
 #include <stdint.h>
+#include <string.h>
 
 #if (defined(__cplusplus) && defined(_USING_LIBCXX))
 extern "C++" {
@@ -100,6 +101,13 @@ int android_log_write_float32(android_log_context ctx, float value);
 /* NB: LOG_ID_EVENTS and LOG_ID_SECURITY only valid binary buffers */
 int android_log_write_list(android_log_context ctx, log_id_t id);
 
+/*
+ * Submit a list composed elsewhere, laid out as android_log_write_list would
+ * send it, without copying it.
+ */
+int android_log_write_list_payload(uint32_t tag, const char* msg, size_t len,
+                                   log_id_t id);
+
 /*
  * Creates a context from a raw buffer representing a list of events to be read.
  */
@@ -305,6 +313,230 @@ class android_log_event_list {
 };
 }
 #endif
+
+#ifndef __class_android_log_event_stack_list_defined
+#define __class_android_log_event_stack_list_defined
+/*
+ * android_log_event_list without a context to allocate: the list is composed
+ * in the Size bytes of storage inside the object, which is what is handed to
+ * the logger.  The API is that of android_log_event_list for writing, and
+ * the elements are laid out the same way; what does not fit in Size is
+ * truncated, as android_log_event_list does at the maximum payload.
+ */
+extern "C++" {
+template <size_t Size = 512>
+class android_log_event_stack_list {
+  static_assert((Size >= 2) &&
+                    (Size <= (LOGGER_ENTRY_MAX_PAYLOAD - sizeof(int32_t))),
+                "event list storage must fit in one entry");
+
+ private:
+  uint32_t tag;
+  int ret;
+  bool overflow;
+  unsigned pos;
+  unsigned list_nest_depth;
+  unsigned count[ANDROID_MAX_LIST_NEST_DEPTH + 1];
+  unsigned list[ANDROID_MAX_LIST_NEST_DEPTH + 1];
+  uint8_t storage[Size];
+
+  android_log_event_stack_list(const android_log_event_stack_list&) = delete;
+  void operator=(const android_log_event_stack_list&) = delete;
+
+  void error(int retval) {
+    if (retval < 0) ret = retval;
+  }
+
+  int put(uint8_t type, uint64_t value, size_t len) {
+    if (overflow) return -EIO;
+    if ((pos + sizeof(uint8_t) + len) > Size) {
+      overflow = true;
+      return -EIO;
+    }
+    count[list_nest_depth]++;
+    storage[pos++] = type;
+    for (size_t i = 0; i < len; ++i, value >>= 8) {
+      storage[pos++] = value & 0xFF;
+    }
+    return 0;
+  }
+
+  int put_string(const char* value, size_t maxlen) {
+    if (overflow) return -EIO;
+    if (!value) value = "";
+    size_t len = strnlen(value, maxlen);
+    size_t needed = sizeof(uint8_t) + sizeof(int32_t) + len;
+    if ((pos + needed) > Size) {
+      /* Truncate string for delivery */
+      if ((pos + sizeof(uint8_t) + sizeof(int32_t)) >= Size) {
+        overflow = true;
+        return -EIO;
+      }
+      len = Size - pos - sizeof(uint8_t) - sizeof(int32_t);
+    }
+    put(EVENT_TYPE_STRING, len, sizeof(int32_t));
+    memcpy(&storage[pos], value, len);
+    pos += len;
+    return len;
+  }
+
+ public:
+  explicit android_log_event_stack_list(int tag)
+      : tag(static_cast<uint32_t>(tag)),
+        ret(0),
+        overflow(false),
+        pos(2),
+        list_nest_depth(0) {
+    memset(count, 0, sizeof(count));
+    /* Everything is a list */
+    storage[0] = EVENT_TYPE_LIST;
+    list[0] = 1;
+  }
+
+  /* return errors or transmit status */
+  int status() const {
+    return ret;
+  }
+
+  int begin() {
+    if (list_nest_depth > ANDROID_MAX_LIST_NEST_DEPTH) {
+      overflow = true;
+      error(-EOVERFLOW);
+      return ret;
+    }
+    if ((pos + sizeof(uint8_t) + sizeof(uint8_t)) > Size) {
+      overflow = true;
+      error(-EIO);
+      return ret;
+    }
+    count[list_nest_depth]++;
+    if (++list_nest_depth > ANDROID_MAX_LIST_NEST_DEPTH) {
+      overflow = true;
+      error(-EOVERFLOW);
+      return ret;
+    }
+    if (overflow) {
+      error(-EIO);
+      return ret;
+    }
+    storage[pos] = EVENT_TYPE_LIST;
+    storage[pos + 1] = 0;
+    list[list_nest_depth] = pos + 1;
+    count[list_nest_depth] = 0;
+    pos += sizeof(uint8_t) + sizeof(uint8_t);
+    return ret;
+  }
+
+  int end() {
+    if (list_nest_depth > ANDROID_MAX_LIST_NEST_DEPTH) {
+      overflow = true;
+      list_nest_depth--;
+      error(-EOVERFLOW);
+      return ret;
+    }
+    if (!list_nest_depth) {
+      overflow = true;
+      error(-EOVERFLOW);
+      return ret;
+    }
+    storage[list[list_nest_depth]] = count[list_nest_depth];
+    list_nest_depth--;
+    return ret;
+  }
+
+  android_log_event_stack_list& operator<<(int32_t value) {
+    error(put(EVENT_TYPE_INT, static_cast<uint32_t>(value), sizeof(value)));
+    return *this;
+  }
+
+  android_log_event_stack_list& operator<<(uint32_t value) {
+    error(put(EVENT_TYPE_INT, value, sizeof(value)));
+    return *this;
+  }
+
+  android_log_event_stack_list& operator<<(bool value) {
+    error(put(EVENT_TYPE_INT, value ? 1 : 0, sizeof(int32_t)));
+    return *this;
+  }
+
+  android_log_event_stack_list& operator<<(int64_t value) {
+    error(put(EVENT_TYPE_LONG, static_cast<uint64_t>(value), sizeof(value)));
+    return *this;
+  }
+
+  android_log_event_stack_list& operator<<(uint64_t value) {
+    error(put(EVENT_TYPE_LONG, value, sizeof(value)));
+    return *this;
+  }
+
+  android_log_event_stack_list& operator<<(const char* value) {
+    error(put_string(value, Size));
+    return *this;
+  }
+
+#if defined(_USING_LIBCXX)
+  android_log_event_stack_list& operator<<(const std::string& value) {
+    error(put_string(value.data(), value.length()));
+    return *this;
+  }
+#endif
+
+  android_log_event_stack_list& operator<<(float value) {
+    uint32_t ivalue;
+    memcpy(&ivalue, &value, sizeof(ivalue));
+    error(put(EVENT_TYPE_FLOAT, ivalue, sizeof(ivalue)));
+    return *this;
+  }
+
+  /* Every element in one go, each appender chosen at compile time */
+  template <typename... Tvalues>
+  bool Append(const Tvalues&... values) {
+    int unused[] = { 0, ((*this << values), 0)... };
+    (void)unused;
+    return ret >= 0;
+  }
+
+  bool Append(const char* value, size_t len) {
+    error(put_string(value, len));
+    return ret >= 0;
+  }
+
+  /*
+   * Points msg at what write() would send, which is the storage itself, and
+   * returns its length.
+   */
+  ssize_t payload(const char** msg) {
+    if (list_nest_depth) return -EIO;
+    /* NB: if there was overflow, then log is truncated. Nothing reported */
+    storage[1] = count[0];
+    *msg = reinterpret_cast<const char*>(storage);
+    /* it's not a list */
+    if (count[0] <= 1) {
+      *msg += sizeof(uint8_t) + sizeof(uint8_t);
+      return pos - sizeof(uint8_t) - sizeof(uint8_t);
+    }
+    return pos;
+  }
+
+  int write(log_id_t id = LOG_ID_EVENTS) {
+    /* facilitate -EBUSY retry */
+    if ((ret == -EBUSY) || (ret > 0)) ret = 0;
+    const char* msg;
+    ssize_t len = payload(&msg);
+    int retval = (len < 0)
+                     ? len
+                     : android_log_write_list_payload(tag, msg, len, id);
+    /* existing errors trump transmission errors */
+    if (!ret) ret = retval;
+    return ret;
+  }
+
+  int operator<<(log_id_t id) {
+    return write(id);
+  }
+};
+}
+#endif
 #endif
 
 #endif /* __ANDROID_USE_LIBLOG_EVENT_INTERFACE */
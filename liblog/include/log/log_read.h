@@ -246,6 +246,7 @@ int android_logger_set_prune_list(struct logger_list* logger_list, char* buf,
 #if __ANDROID_USE_LIBLOG_READER_INTERFACE > 2
 #define ANDROID_LOG_WRAP 0x40000000 /* Block until buffer about to wrap */
 #define ANDROID_LOG_WRAP_DEFAULT_TIMEOUT 7200 /* 2 hour default */
+#define ANDROID_LOG_RING 0x20000000 /* Read from logd via shared memory */
 #endif
 #if __ANDROID_USE_LIBLOG_READER_INTERFACE > 1
 #define ANDROID_LOG_PSTORE 0x80000000
@@ -256,6 +257,14 @@ struct logger_list* android_logger_list_alloc(int mode, unsigned int tail,
 struct logger_list* android_logger_list_alloc_time(int mode, log_time start,
                                                    pid_t pid);
 void android_logger_list_free(struct logger_list* logger_list);
+#if __ANDROID_USE_LIBLOG_READER_INTERFACE > 2
+/* comma or whitespace separated logcat filterspecs, eg "AT:d *:i" */
+int android_logger_list_set_filter(struct logger_list* logger_list,
+                                   const char* filterString);
+/* read the records of a binary (logcat -B) dump at path, not the live logs */
+int android_logger_list_set_file(struct logger_list* logger_list,
+                                 const char* path);
+#endif
 /* In the purest sense, the following two are orthogonal interfaces */
 int android_logger_list_read(struct logger_list* logger_list,
                              struct log_msg* log_msg);
@@ -70,6 +70,13 @@ AndroidLogFormat* android_log_format_new();
 
 void android_log_format_free(AndroidLogFormat* p_format);
 
+/*
+ * Copies the format and filters, so another thread can format entries with
+ * the copy while this one uses the original. Freed with
+ * android_log_format_free() only after those threads are done formatting.
+ */
+AndroidLogFormat* android_log_format_dup(const AndroidLogFormat* p_format);
+
 /* currently returns 0 if format is a modifier, 1 if not */
 int android_log_setPrintFormat(AndroidLogFormat* p_format,
                                AndroidLogPrintFormat format);
@@ -146,6 +153,20 @@ char* android_log_formatLogLine(AndroidLogFormat* p_format, char* defaultBuffer,
                                 const AndroidLogEntry* p_line,
                                 size_t* p_outLength);
 
+/**
+ * Formats consecutive log messages back to back into buf
+ *
+ * Never allocates, stops at the first entry that does not fit in what is
+ * left of bufSize.  Returns the number of entries formatted and stores the
+ * total length in *p_outLength.  Callers fall back to
+ * android_log_formatLogLine() when an entry does not fit an empty buffer.
+ */
+
+size_t android_log_formatLogLines(AndroidLogFormat* p_format, char* buf,
+                                  size_t bufSize,
+                                  const AndroidLogEntry* entries, size_t count,
+                                  size_t* p_outLength);
+
 /**
  * Either print or do not print log line, based on filter
  *
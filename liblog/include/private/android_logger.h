@@ -55,6 +55,25 @@ typedef struct __attribute__((__packed__)) {
   log_time realtime;
 } android_log_header_t;
 
+/*
+ * Several records coalesced into one datagram to logd.  A datagram whose
+ * first byte is LOGGER_BATCH_ID carries an android_log_batch_header_t, then
+ * count android_log_batch_record_t each followed by len bytes of payload.
+ * All records of a batch come from the same thread.
+ */
+#define LOGGER_BATCH_ID 0x7F
+#define LOGGER_BATCH_MAX_LEN 8192
+
+typedef struct __attribute__((__packed__)) {
+  typeof_log_id_t id; /* LOGGER_BATCH_ID */
+  uint16_t count;
+} android_log_batch_header_t;
+
+typedef struct __attribute__((__packed__)) {
+  uint16_t len; /* payload following this record header */
+  android_log_header_t header;
+} android_log_batch_record_t;
+
 /* Event Header Structure to logd */
 typedef struct __attribute__((__packed__)) {
   int32_t tag;  // Little Endian Order
@@ -110,6 +129,130 @@ typedef struct __attribute__((__packed__)) {
   char data[];
 } android_log_event_string_t;
 
+/*
+ * Shared memory reader ring, requested with " ring=<bytes>" on logdr.
+ *
+ * logd answers with an android_log_ring_setup_t message that carries two
+ * descriptors (SCM_RIGHTS): the entry data, read-only to the reader, and a
+ * read-write android_log_ring_control_t page.  Entries are then announced in
+ * batches with android_log_ring_cursor_t messages instead of one packet per
+ * entry.  Each record in the data ring is a logger_entry_v4 (or _v3) header
+ * and payload padded to LOGGER_RING_ALIGN, a record with a zero hdr_size
+ * means wrap to the start.  The magic values land a 0xFFFF in the hdr_size
+ * position, which no logger_entry packet can carry.
+ */
+#define LOGGER_RING_SETUP_MAGIC 0xFFFF5253U  /* "SR" */
+#define LOGGER_RING_CURSOR_MAGIC 0xFFFF5243U /* "CR" */
+#define LOGGER_RING_ALIGN 8
+#define LOGGER_RING_MIN_SIZE (64 * 1024UL)
+#define LOGGER_RING_MAX_SIZE (4 * 1024 * 1024UL)
+
+typedef struct __attribute__((__packed__)) {
+  uint32_t magic; /* LOGGER_RING_SETUP_MAGIC */
+  uint32_t size;  /* data ring size in bytes, a power of two */
+} android_log_ring_setup_t;
+
+typedef struct __attribute__((__packed__)) {
+  uint32_t magic; /* LOGGER_RING_CURSOR_MAGIC */
+  uint32_t reserved;
+  uint64_t head; /* bytes committed to the data ring since setup */
+} android_log_ring_cursor_t;
+
+typedef struct {
+  uint64_t head; /* written by logd, bytes committed */
+  uint64_t tail; /* written by the reader, bytes consumed */
+} android_log_ring_control_t;
+
+/*
+ * Precompiled event tag table, generated at build time from
+ * /system/etc/event-log-tags by event-log-tags-table and installed next to
+ * it.  Mapped read-only and shared, it replaces parsing the text file into
+ * per process hash maps.  Minimal perfect hashes (hash and displace) index
+ * the entries by tag number and by name.  A table whose source_size does not
+ * match the text file is stale and ignored.  All integers little endian,
+ * offsets from the start of the file, strings nul terminated.
+ */
+#define EVENT_TAG_TABLE_FILE "/system/etc/event-log-tags.table"
+#define EVENT_TAG_TABLE_MAGIC 0x31545445U /* "ETT1" */
+#define EVENT_TAG_TABLE_NONE UINT32_MAX
+
+typedef struct __attribute__((__packed__)) {
+  uint32_t magic;       /* EVENT_TAG_TABLE_MAGIC */
+  uint32_t source_size; /* bytes of event-log-tags it was built from */
+  uint32_t count;       /* entries, and slots in each hash */
+  uint32_t buckets;     /* displacements in each hash */
+  uint32_t entries;     /* android_event_tag_table_entry_t[count] */
+  uint32_t tag_disp;    /* uint32_t[buckets] */
+  uint32_t tag_slot;    /* uint32_t[count], entry index */
+  uint32_t name_disp;   /* uint32_t[buckets] */
+  uint32_t name_slot;   /* uint32_t[count], first entry with that name */
+  uint32_t strings;
+  uint32_t strings_size;
+} android_event_tag_table_header_t;
+
+typedef struct __attribute__((__packed__)) {
+  uint32_t tag;
+  uint32_t uid;  /* from a "# uid=" comment, else AID_ROOT */
+  uint32_t name; /* string offset */
+  uint32_t format;
+  uint16_t name_len;
+  uint16_t format_len;
+  uint32_t next_name; /* next entry with the same name, or NONE */
+} android_event_tag_table_entry_t;
+
+/* Key hash for both indexes, a tag number is hashed as its 4 LE bytes */
+static inline uint32_t __android_event_tag_table_hash(const void* key,
+                                                      size_t len,
+                                                      uint32_t seed) {
+  const uint8_t* cp = (const uint8_t*)key;
+  uint32_t h = 2166136261U ^ (seed * 0x9E3779B9U);
+  while (len--) h = (h ^ *cp++) * 16777619U;
+  h ^= h >> 16;
+  h *= 0x85EBCA6BU;
+  h ^= h >> 13;
+  h *= 0xC2B2AE35U;
+  return h ^ (h >> 16);
+}
+
+/* The slot for a key: bucket by seed 0, then the bucket's displacement */
+static inline uint32_t __android_event_tag_table_slot(const uint32_t* disp,
+                                                      uint32_t buckets,
+                                                      uint32_t count,
+                                                      const void* key,
+                                                      size_t len) {
+  uint32_t bucket = __android_event_tag_table_hash(key, len, 0) % buckets;
+  return __android_event_tag_table_hash(key, len, disp[bucket]) % count;
+}
+
+/*
+ * Map EVENT_TAG_TABLE_FILE (or filename), NULL if absent, corrupt or not
+ * built from source_size bytes of text.  Every offset is checked here so the
+ * lookups below can trust the table.
+ */
+const android_event_tag_table_header_t* __android_event_tag_table_open(
+    const char* filename, size_t source_size);
+void __android_event_tag_table_close(
+    const android_event_tag_table_header_t* table);
+const android_event_tag_table_entry_t* __android_event_tag_table_find_tag(
+    const android_event_tag_table_header_t* table, uint32_t tag);
+/* First entry with that name, follow next_name for other formats */
+const android_event_tag_table_entry_t* __android_event_tag_table_find_name(
+    const android_event_tag_table_header_t* table, const char* name,
+    size_t len);
+
+static inline const android_event_tag_table_entry_t*
+__android_event_tag_table_entry(const android_event_tag_table_header_t* table,
+                                uint32_t index) {
+  return (const android_event_tag_table_entry_t*)((const char*)table +
+                                                   table->entries) +
+         index;
+}
+
+static inline const char* __android_event_tag_table_string(
+    const android_event_tag_table_header_t* table, uint32_t offset) {
+  return (const char*)table + table->strings + offset;
+}
+
 #define ANDROID_LOG_PMSG_FILE_MAX_SEQUENCE 256 /* 1MB file */
 #define ANDROID_LOG_PMSG_FILE_SEQUENCE 1000
 
@@ -324,9 +324,17 @@ LIBLOG_ABI_PUBLIC int android_log_write_list(android_log_context ctx,
     }
     msg += sizeof(uint8_t) + sizeof(uint8_t);
   }
-  return (id == LOG_ID_EVENTS)
-             ? __android_log_bwrite(context->tag, msg, len)
-             : __android_log_security_bwrite(context->tag, msg, len);
+  return android_log_write_list_payload(context->tag, msg, len, id);
+}
+
+LIBLOG_ABI_PUBLIC int android_log_write_list_payload(uint32_t tag,
+                                                     const char* msg,
+                                                     size_t len, log_id_t id) {
+  if ((id != LOG_ID_EVENTS) && (id != LOG_ID_SECURITY)) {
+    return -EINVAL;
+  }
+  return (id == LOG_ID_EVENTS) ? __android_log_bwrite(tag, msg, len)
+                               : __android_log_security_bwrite(tag, msg, len);
 }
 
 LIBLOG_ABI_PRIVATE int android_log_write_list_buffer(android_log_context ctx,
@@ -24,6 +24,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
 #include <sys/socket.h>
 #include <sys/stat.h>
 #include <sys/types.h>
@@ -458,13 +459,200 @@ static ssize_t logdSetPrune(struct android_log_logger_list* logger_list __unused
 static void caught_signal(int signum __unused) {
 }
 
+/* Shared memory ring state for ANDROID_LOG_RING, see android_log_ring_setup_t */
+#define LOGD_RING_REQUEST_SIZE (1024 * 1024)
+
+struct logd_ring {
+  const char* data;
+  android_log_ring_control_t* control;
+  size_t size;
+  uint64_t head; /* last announced by logd */
+  uint64_t tail; /* consumed so far */
+};
+
+static void logdRingFree(struct logd_ring* ring) {
+  if (!ring) {
+    return;
+  }
+  munmap((void*)ring->data, ring->size);
+  munmap(ring->control, sizeof(*ring->control));
+  free(ring);
+}
+
+static int logdRingSetup(struct android_log_transport_context* transp,
+                         const android_log_ring_setup_t* setup, int fds[2]) {
+  struct logd_ring* ring;
+  void* data = MAP_FAILED;
+  void* control = MAP_FAILED;
+  size_t size = setup->size;
+
+  if ((size < LOGGER_RING_MIN_SIZE) || (size > LOGGER_RING_MAX_SIZE) ||
+      (size & (size - 1))) {
+    return -EBADMSG;
+  }
+
+  ring = calloc(1, sizeof(*ring));
+  if (ring) {
+    data = mmap(NULL, size, PROT_READ, MAP_SHARED, fds[0], 0);
+    control = mmap(NULL, sizeof(*ring->control), PROT_READ | PROT_WRITE,
+                   MAP_SHARED, fds[1], 0);
+  }
+  if (!ring || (data == MAP_FAILED) || (control == MAP_FAILED)) {
+    int e = ring ? errno : ENOMEM;
+    if (data != MAP_FAILED) {
+      munmap(data, size);
+    }
+    if (control != MAP_FAILED) {
+      munmap(control, sizeof(*ring->control));
+    }
+    free(ring);
+    return -e;
+  }
+
+  ring->data = data;
+  ring->control = control;
+  ring->size = size;
+  transp->priv = ring;
+  return 0;
+}
+
+/* Copy the next announced entry out of the ring, 0 if there is none */
+static int logdRingRead(struct logd_ring* ring, struct log_msg* log_msg) {
+  struct logger_entry_v4 entry;
+  size_t offset, total;
+
+  if (ring->tail == ring->head) {
+    return 0;
+  }
+
+  offset = ring->tail & (ring->size - 1);
+  memcpy(&entry, ring->data + offset, 2 * sizeof(uint16_t));
+  if (!entry.hdr_size) {
+    /* wrap marker */
+    ring->tail += ring->size - offset;
+    offset = 0;
+    if (ring->tail == ring->head) {
+      return -EBADMSG;
+    }
+    memcpy(&entry, ring->data, 2 * sizeof(uint16_t));
+  }
+
+  if ((entry.hdr_size != sizeof(struct logger_entry_v3)) &&
+      (entry.hdr_size != sizeof(struct logger_entry_v4))) {
+    return -EBADMSG;
+  }
+  total = entry.hdr_size + entry.len;
+  if ((total > LOGGER_ENTRY_MAX_LEN) || ((offset + total) > ring->size)) {
+    return -EBADMSG;
+  }
+
+  memcpy(log_msg->buf, ring->data + offset, total);
+  ring->tail += (total + LOGGER_RING_ALIGN - 1) & ~(LOGGER_RING_ALIGN - 1);
+  __atomic_store_n(&ring->control->tail, ring->tail, __ATOMIC_RELEASE);
+
+  return total;
+}
+
+/*
+ * Receive the next entry.  In ANDROID_LOG_RING mode this also consumes any
+ * ring setup and cursor messages, an older logd that ignores the request
+ * just keeps sending entries, which are passed through untouched.
+ */
+static int logdRecv(struct android_log_logger_list* logger_list,
+                    struct android_log_transport_context* transp, int sock,
+                    struct log_msg* log_msg) {
+  if (!(logger_list->mode & ANDROID_LOG_RING)) {
+    /* NOTE: SOCK_SEQPACKET guarantees we read exactly one full entry */
+    return recv(sock, log_msg, LOGGER_ENTRY_MAX_LEN, 0);
+  }
+
+  for (;;) {
+    union {
+      struct cmsghdr cmsg;
+      char buf[CMSG_SPACE(2 * sizeof(int))];
+    } control;
+    struct iovec iov;
+    struct msghdr msg;
+    struct cmsghdr* cmsg;
+    struct logd_ring* ring = transp->priv;
+    int fds[2] = { -1, -1 };
+    size_t nfds = 0;
+    int ret;
+
+    iov.iov_base = log_msg->buf;
+    iov.iov_len = LOGGER_ENTRY_MAX_LEN;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buf;
+    msg.msg_controllen = sizeof(control.buf);
+
+    ret = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC);
+    if (ret <= 0) {
+      return ret;
+    }
+
+    for (cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+      if ((cmsg->cmsg_level == SOL_SOCKET) &&
+          (cmsg->cmsg_type == SCM_RIGHTS)) {
+        nfds = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        if (nfds > 2) {
+          nfds = 2;
+        }
+        memcpy(fds, CMSG_DATA(cmsg), nfds * sizeof(int));
+      }
+    }
+
+    if (!ring && (nfds == 2) && (ret == sizeof(android_log_ring_setup_t)) &&
+        (((android_log_ring_setup_t*)log_msg->buf)->magic ==
+         LOGGER_RING_SETUP_MAGIC)) {
+      android_log_ring_setup_t setup;
+      memcpy(&setup, log_msg->buf, sizeof(setup));
+      ret = logdRingSetup(transp, &setup, fds);
+      close(fds[0]);
+      close(fds[1]);
+      if (ret < 0) {
+        errno = -ret;
+        return -1;
+      }
+      continue;
+    }
+    while (nfds) {
+      close(fds[--nfds]);
+    }
+
+    if (ring && (ret == sizeof(android_log_ring_cursor_t)) &&
+        (((android_log_ring_cursor_t*)log_msg->buf)->magic ==
+         LOGGER_RING_CURSOR_MAGIC)) {
+      android_log_ring_cursor_t cursor;
+      memcpy(&cursor, log_msg->buf, sizeof(cursor));
+      if ((cursor.head < ring->tail) ||
+          ((cursor.head - ring->tail) > ring->size)) {
+        errno = EBADMSG;
+        return -1;
+      }
+      ring->head = cursor.head;
+      memset(log_msg, 0, sizeof(*log_msg));
+      ret = logdRingRead(ring, log_msg);
+      if (ret < 0) {
+        errno = -ret;
+        return -1;
+      }
+      if (ret == 0) {
+        continue;
+      }
+    }
+    return ret;
+  }
+}
+
 static int logdOpen(struct android_log_logger_list* logger_list,
                     struct android_log_transport_context* transp) {
   struct android_log_logger* logger;
   struct sigaction ignore;
   struct sigaction old_sigaction;
   unsigned int old_alarm = 0;
-  char buffer[256], *cp, c;
+  char buffer[1024], *cp, c;
   int e, ret, remaining, sock;
 
   if (!logger_list) {
@@ -534,9 +722,24 @@ static int logdOpen(struct android_log_logger_list* logger_list,
   if (logger_list->pid) {
     ret = snprintf(cp, remaining, " pid=%u", logger_list->pid);
     ret = min(ret, remaining);
+    remaining -= ret;
+    cp += ret;
+  }
+
+  if (logger_list->mode & ANDROID_LOG_RING) {
+    ret = snprintf(cp, remaining, " ring=%u", LOGD_RING_REQUEST_SIZE);
+    ret = min(ret, remaining);
+    remaining -= ret;
     cp += ret;
   }
 
+  /* All or nothing, logd would drop what the dropped rules let through */
+  if (logger_list->filter &&
+      (snprintf(cp, remaining, " filter=%s", logger_list->filter) <
+       remaining)) {
+    cp += strlen(cp);
+  }
+
   if (logger_list->mode & ANDROID_LOG_NONBLOCK) {
     /* Deal with an unresponsive logd */
     memset(&ignore, 0, sizeof(ignore));
@@ -579,6 +782,7 @@ static int logdRead(struct android_log_logger_list* logger_list,
                     struct android_log_transport_context* transp,
                     struct log_msg* log_msg) {
   int ret, e;
+  struct logd_ring* ring;
   struct sigaction ignore;
   struct sigaction old_sigaction;
   unsigned int old_alarm = 0;
@@ -590,6 +794,12 @@ static int logdRead(struct android_log_logger_list* logger_list,
 
   memset(log_msg, 0, sizeof(*log_msg));
 
+  /* Entries already announced in the ring need no system call */
+  ring = transp->priv;
+  if (ring && (ring->tail != ring->head)) {
+    return logdRingRead(ring, log_msg);
+  }
+
   unsigned int new_alarm = 0;
   if (logger_list->mode & ANDROID_LOG_NONBLOCK) {
     if ((logger_list->mode & ANDROID_LOG_WRAP) &&
@@ -609,8 +819,7 @@ static int logdRead(struct android_log_logger_list* logger_list,
     old_alarm = alarm(new_alarm);
   }
 
-  /* NOTE: SOCK_SEQPACKET guarantees we read exactly one full entry */
-  ret = recv(ret, log_msg, LOGGER_ENTRY_MAX_LEN, 0);
+  ret = logdRecv(logger_list, transp, ret, log_msg);
   e = errno;
 
   if (new_alarm) {
@@ -637,6 +846,11 @@ static int logdPoll(struct android_log_logger_list* logger_list,
     return ret;
   }
 
+  struct logd_ring* ring = transp->priv;
+  if (ring && (ring->tail != ring->head)) {
+    return 1;
+  }
+
   memset(&p, 0, sizeof(p));
   p.fd = ret;
   p.events = POLLIN;
@@ -657,4 +871,6 @@ static void logdClose(struct android_log_logger_list* logger_list __unused,
   if (sock > 0) {
     close(sock);
   }
+  logdRingFree(transp->priv);
+  transp->priv = NULL;
 }
@@ -19,6 +19,7 @@
 #include <fcntl.h>
 #include <inttypes.h>
 #include <poll.h>
+#include <pthread.h>
 #include <stdarg.h>
 #include <stdatomic.h>
 #include <stdio.h>
@@ -107,7 +108,10 @@ static void __logdClose(int negative_errno) {
   }
 }
 
+static void logdBatchFlushAll(bool wait);
+
 static void logdClose() {
+  logdBatchFlushAll(true);
   __logdClose(-EBADF);
 }
 
@@ -124,6 +128,321 @@ static int logdAvailable(log_id_t logId) {
   return 1;
 }
 
+static atomic_int_fast32_t dropped;
+static atomic_int_fast32_t droppedSecurity;
+
+/*
+ * The write below could be lost, but will never block.
+ *
+ * ENOTCONN occurs if logd has died.
+ * ENOENT occurs if logd is not running and socket is missing.
+ * ECONNREFUSED occurs if we can not reconnect to logd.
+ * EAGAIN occurs if logd is overloaded.
+ */
+static ssize_t logdSend(int sock, struct iovec* vec, int nr) {
+  ssize_t ret;
+
+  if (sock < 0) {
+    ret = sock;
+  } else {
+    ret = TEMP_FAILURE_RETRY(writev(sock, vec, nr));
+    if (ret < 0) {
+      ret = -errno;
+    }
+  }
+  switch (ret) {
+    case -ENOTCONN:
+    case -ECONNREFUSED:
+    case -ENOENT:
+      if (__android_log_trylock()) {
+        return ret; /* in a signal handler? try again when less stressed */
+      }
+      __logdClose(ret);
+      ret = logdOpen();
+      __android_log_unlock();
+
+      if (ret < 0) {
+        return ret;
+      }
+
+      ret = TEMP_FAILURE_RETRY(
+          writev(atomic_load(&logdLoggerWrite.context.sock), vec, nr));
+      if (ret < 0) {
+        ret = -errno;
+      }
+    /* FALLTHRU */
+    default:
+      break;
+  }
+
+  return ret;
+}
+
+/*
+ * Optional per-thread coalescing, enabled with log.batch (persist.log.batch,
+ * ro.log.batch), read once per process.  Records are packed into one
+ * LOGGER_BATCH_ID datagram and held no longer than LOGD_BATCH_LATENCY_MS; a
+ * flusher thread pushes out the buffers of threads that went quiet.  Crash
+ * and security records, and text records of ANDROID_LOG_ERROR or above,
+ * flush what is pending and go out immediately so nothing is left behind
+ * when the process is about to die.
+ */
+#define LOGD_BATCH_LATENCY_MS 20
+#define LOGD_BATCH_LATENCY_NS (LOGD_BATCH_LATENCY_MS * 1000000ULL)
+
+struct logd_batch {
+  struct listnode node;
+  pthread_mutex_t lock;
+  uint64_t first; /* CLOCK_MONOTONIC of the oldest record held */
+  size_t len;
+  uint16_t count;
+  char buf[LOGGER_BATCH_MAX_LEN];
+};
+
+static pthread_once_t batchOnce = PTHREAD_ONCE_INIT;
+static bool batchEnabled;
+static pthread_key_t batchKey;
+static pthread_mutex_t batchListLock = PTHREAD_MUTEX_INITIALIZER;
+static struct listnode batchList = { &batchList, &batchList };
+static bool batchFlusherRunning;
+
+static uint64_t logdBatchNow() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void logdBatchReset(struct logd_batch* batch) {
+  batch->len = sizeof(android_log_batch_header_t);
+  batch->count = 0;
+}
+
+/* batch->lock held */
+static void logdBatchFlush_locked(struct logd_batch* batch) {
+  android_log_batch_header_t header;
+  struct iovec vec;
+  ssize_t ret;
+
+  if (!batch->count) {
+    return;
+  }
+
+  header.id = LOGGER_BATCH_ID;
+  header.count = batch->count;
+  memcpy(batch->buf, &header, sizeof(header));
+
+  vec.iov_base = batch->buf;
+  vec.iov_len = batch->len;
+  ret = logdSend(atomic_load(&logdLoggerWrite.context.sock), &vec, 1);
+  if (ret == -EAGAIN) {
+    atomic_fetch_add_explicit(&dropped, batch->count, memory_order_relaxed);
+  }
+
+  logdBatchReset(batch);
+}
+
+static void logdBatchFlushAll(bool wait) {
+  struct listnode* node;
+
+  if (!batchEnabled) {
+    return;
+  }
+  if (wait) {
+    pthread_mutex_lock(&batchListLock);
+  } else if (pthread_mutex_trylock(&batchListLock)) {
+    return;
+  }
+  list_for_each(node, &batchList) {
+    struct logd_batch* batch = node_to_item(node, struct logd_batch, node);
+    if (wait) {
+      pthread_mutex_lock(&batch->lock);
+    } else if (pthread_mutex_trylock(&batch->lock)) {
+      continue;
+    }
+    logdBatchFlush_locked(batch);
+    pthread_mutex_unlock(&batch->lock);
+  }
+  pthread_mutex_unlock(&batchListLock);
+}
+
+static void* logdBatchFlusher(void* obj __unused) {
+  for (;;) {
+    struct timespec ts = { 0, LOGD_BATCH_LATENCY_MS * 1000000L };
+    struct listnode* node;
+    uint64_t now;
+
+    nanosleep(&ts, NULL);
+
+    now = logdBatchNow();
+    pthread_mutex_lock(&batchListLock);
+    list_for_each(node, &batchList) {
+      struct logd_batch* batch = node_to_item(node, struct logd_batch, node);
+      if (pthread_mutex_trylock(&batch->lock)) {
+        continue; /* owner is busy appending, and will check the age */
+      }
+      if (batch->count && ((now - batch->first) >= LOGD_BATCH_LATENCY_NS)) {
+        logdBatchFlush_locked(batch);
+      }
+      pthread_mutex_unlock(&batch->lock);
+    }
+    pthread_mutex_unlock(&batchListLock);
+  }
+  return NULL;
+}
+
+/* Thread exit, send what the thread left behind */
+static void logdBatchExit(void* obj) {
+  struct logd_batch* batch = obj;
+
+  pthread_mutex_lock(&batchListLock);
+  list_remove(&batch->node);
+  pthread_mutex_unlock(&batchListLock);
+
+  pthread_mutex_lock(&batch->lock);
+  logdBatchFlush_locked(batch);
+  pthread_mutex_unlock(&batch->lock);
+  pthread_mutex_destroy(&batch->lock);
+  free(batch);
+}
+
+static void logdBatchPrepareFork() {
+  pthread_mutex_lock(&batchListLock);
+}
+
+static void logdBatchParentFork() {
+  pthread_mutex_unlock(&batchListLock);
+}
+
+/*
+ * The child has a copy of everything the parent still holds, and the parent
+ * will send it, so start over empty.  Only the forking thread survives.
+ */
+static void logdBatchChildFork() {
+  struct logd_batch* self = pthread_getspecific(batchKey);
+  struct listnode* node;
+  struct listnode* n;
+
+  list_for_each_safe(node, n, &batchList) {
+    struct logd_batch* batch = node_to_item(node, struct logd_batch, node);
+    if (batch == self) {
+      pthread_mutex_init(&batch->lock, NULL);
+      logdBatchReset(batch);
+    } else {
+      list_remove(&batch->node);
+      free(batch);
+    }
+  }
+  batchFlusherRunning = false;
+  pthread_mutex_init(&batchListLock, NULL);
+}
+
+static void logdBatchInit() {
+  if (!__android_logger_property_get_bool(
+          "log.batch", BOOL_DEFAULT_FALSE | BOOL_DEFAULT_FLAG_PERSIST)) {
+    return;
+  }
+  if (pthread_key_create(&batchKey, logdBatchExit)) {
+    return;
+  }
+  if (pthread_atfork(logdBatchPrepareFork, logdBatchParentFork,
+                     logdBatchChildFork)) {
+    return;
+  }
+  batchEnabled = true;
+}
+
+static struct logd_batch* logdBatchGet() {
+  struct logd_batch* batch = pthread_getspecific(batchKey);
+  if (batch) {
+    return batch;
+  }
+
+  batch = calloc(1, sizeof(*batch));
+  if (!batch) {
+    return NULL;
+  }
+  pthread_mutex_init(&batch->lock, NULL);
+  logdBatchReset(batch);
+  if (pthread_setspecific(batchKey, batch)) {
+    pthread_mutex_destroy(&batch->lock);
+    free(batch);
+    return NULL;
+  }
+
+  pthread_mutex_lock(&batchListLock);
+  list_add_tail(&batchList, &batch->node);
+  if (!batchFlusherRunning) {
+    pthread_attr_t attr;
+    pthread_t thread;
+
+    if (!pthread_attr_init(&attr)) {
+      if (!pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED) &&
+          !pthread_create(&thread, &attr, logdBatchFlusher, NULL)) {
+        batchFlusherRunning = true;
+      }
+      pthread_attr_destroy(&attr);
+    }
+  }
+  pthread_mutex_unlock(&batchListLock);
+
+  return batch;
+}
+
+/* text logs carry their priority in the first byte */
+static int logdBatchPriority(log_id_t logId, struct iovec* vec, size_t nr) {
+  switch (logId) {
+    case LOG_ID_EVENTS:
+    case LOG_ID_SECURITY:
+      return ANDROID_LOG_UNKNOWN;
+    default:
+      if (!nr || !vec[0].iov_len) {
+        return ANDROID_LOG_UNKNOWN;
+      }
+      return *(const unsigned char*)vec[0].iov_base;
+  }
+}
+
+/* Returns the payload size accepted, the same as a direct write would */
+static ssize_t logdBatchAppend(struct logd_batch* batch,
+                               const android_log_header_t* header,
+                               struct iovec* vec, size_t nr,
+                               size_t payloadSize) {
+  android_log_batch_record_t record;
+  uint64_t now = logdBatchNow();
+  char* cp;
+  size_t i;
+
+  pthread_mutex_lock(&batch->lock);
+
+  if ((batch->len + sizeof(record) + payloadSize) > LOGGER_BATCH_MAX_LEN) {
+    logdBatchFlush_locked(batch);
+  }
+  if (!batch->count) {
+    batch->first = now;
+  }
+
+  record.len = payloadSize;
+  record.header = *header;
+  cp = batch->buf + batch->len;
+  memcpy(cp, &record, sizeof(record));
+  cp += sizeof(record);
+  for (i = 0; i < nr; ++i) {
+    memcpy(cp, vec[i].iov_base, vec[i].iov_len);
+    cp += vec[i].iov_len;
+  }
+  batch->len += sizeof(record) + payloadSize;
+  ++batch->count;
+
+  /* Do not depend on the flusher if we are still busy logging */
+  if ((now - batch->first) >= LOGD_BATCH_LATENCY_NS) {
+    logdBatchFlush_locked(batch);
+  }
+
+  pthread_mutex_unlock(&batch->lock);
+
+  return payloadSize;
+}
+
 static int logdWrite(log_id_t logId, struct timespec* ts, struct iovec* vec,
                      size_t nr) {
   ssize_t ret;
@@ -132,8 +451,6 @@ static int logdWrite(log_id_t logId, struct timespec* ts, struct iovec* vec,
   struct iovec newVec[nr + headerLength];
   android_log_header_t header;
   size_t i, payloadSize;
-  static atomic_int_fast32_t dropped;
-  static atomic_int_fast32_t droppedSecurity;
 
   sock = atomic_load(&logdLoggerWrite.context.sock);
   if (sock < 0) switch (sock) {
@@ -236,47 +553,32 @@ static int logdWrite(log_id_t logId, struct timespec* ts, struct iovec* vec,
     }
   }
 
-  /*
-   * The write below could be lost, but will never block.
-   *
-   * ENOTCONN occurs if logd has died.
-   * ENOENT occurs if logd is not running and socket is missing.
-   * ECONNREFUSED occurs if we can not reconnect to logd.
-   * EAGAIN occurs if logd is overloaded.
-   */
-  if (sock < 0) {
-    ret = sock;
-  } else {
-    ret = TEMP_FAILURE_RETRY(writev(sock, newVec, i));
-    if (ret < 0) {
-      ret = -errno;
-    }
-  }
-  switch (ret) {
-    case -ENOTCONN:
-    case -ECONNREFUSED:
-    case -ENOENT:
-      if (__android_log_trylock()) {
-        return ret; /* in a signal handler? try again when less stressed */
-      }
-      __logdClose(ret);
-      ret = logdOpen();
-      __android_log_unlock();
-
-      if (ret < 0) {
-        return ret;
+  pthread_once(&batchOnce, logdBatchInit);
+  if (batchEnabled && (sock >= 0)) {
+    int prio = logdBatchPriority(logId, vec, nr);
+    if ((logId != LOG_ID_SECURITY) && (logId != LOG_ID_CRASH) &&
+        (prio < ANDROID_LOG_ERROR)) {
+      struct logd_batch* batch = logdBatchGet();
+      if (batch) {
+        return logdBatchAppend(batch, &header, newVec + headerLength,
+                               i - headerLength,
+                               min(payloadSize, LOGGER_ENTRY_MAX_PAYLOAD));
       }
-
-      ret = TEMP_FAILURE_RETRY(
-          writev(atomic_load(&logdLoggerWrite.context.sock), newVec, i));
-      if (ret < 0) {
-        ret = -errno;
+    } else if ((logId == LOG_ID_CRASH) || (prio >= ANDROID_LOG_FATAL)) {
+      /* the context leading up to a crash matters, do not wait for it */
+      logdBatchFlushAll(false);
+    } else {
+      struct logd_batch* batch = pthread_getspecific(batchKey);
+      if (batch) {
+        pthread_mutex_lock(&batch->lock);
+        logdBatchFlush_locked(batch);
+        pthread_mutex_unlock(&batch->lock);
       }
-    /* FALLTHRU */
-    default:
-      break;
+    }
   }
 
+  ret = logdSend(sock, newVec, i);
+
   if (ret > (ssize_t)sizeof(header)) {
     ret -= sizeof(header);
   } else if (ret == -EAGAIN) {
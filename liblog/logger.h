@@ -105,6 +105,8 @@ struct android_log_logger_list {
   unsigned int tail;
   log_time start;
   pid_t pid;
+  char* filter; /* comma separated logcat filterspecs, or NULL */
+  char* file;   /* binary log dump read in place of the transports, or NULL */
 };
 
 struct android_log_logger {
@@ -123,6 +125,7 @@ struct android_log_transport_context {
   unsigned logMask;      /* mask of requested log buffers */
   int ret;               /* return value associated with following data */
   struct log_msg logMsg; /* peek at upcoming data, valid if logMsg.len != 0 */
+  void* priv;            /* zero init transport private state */
 };
 
 /* assumes caller has structures read-locked, single threaded, or fenced */
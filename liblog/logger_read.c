@@ -14,6 +14,7 @@
 ** limitations under the License.
 */
 
+#include <ctype.h>
 #include <errno.h>
 #include <fcntl.h>
 #include <pthread.h>
@@ -53,6 +54,40 @@ LIBLOG_ABI_PUBLIC log_id_t android_logger_get_id(struct logger* logger) {
   return ((struct android_log_logger*)logger)->logId;
 }
 
+static int add_transport_context(struct android_log_logger_list* logger_list,
+                                 struct android_log_transport_read* transport) {
+  struct android_log_transport_context* transp;
+  struct android_log_logger* logger;
+  unsigned logMask = 0;
+
+  logger_for_each(logger, logger_list) {
+    log_id_t logId = logger->logId;
+
+    /* a dump file is only as private as its permissions make it */
+    if ((logId == LOG_ID_SECURITY) && !logger_list->file &&
+        (__android_log_uid() != AID_SYSTEM)) {
+      continue;
+    }
+    if (transport->read &&
+        (!transport->available || (transport->available(logId) >= 0))) {
+      logMask |= 1 << logId;
+    }
+  }
+  if (!logMask) {
+    return 0;
+  }
+  transp = calloc(1, sizeof(*transp));
+  if (!transp) {
+    return -ENOMEM;
+  }
+  transp->parent = logger_list;
+  transp->transport = transport;
+  transp->logMask = logMask;
+  transp->ret = 1;
+  list_add_tail(&logger_list->transport, &transp->node);
+  return 0;
+}
+
 static int init_transport_context(struct android_log_logger_list* logger_list) {
   struct android_log_transport_read* transport;
   struct listnode* node;
@@ -69,6 +104,18 @@ static int init_transport_context(struct android_log_logger_list* logger_list) {
     return 0;
   }
 
+#if !defined(_WIN32)
+  if (logger_list->file) {
+    extern struct android_log_transport_read fileLoggerRead;
+    int ret = add_transport_context(logger_list, &fileLoggerRead);
+
+    if (ret < 0) {
+      return ret;
+    }
+    return list_empty(&logger_list->transport) ? -ENODEV : 0;
+  }
+#endif
+
   __android_log_lock();
   /* mini __write_to_log_initialize() to populate transports */
   if (list_empty(&__android_log_transport_read) &&
@@ -82,33 +129,11 @@ static int init_transport_context(struct android_log_logger_list* logger_list) {
              : &__android_log_transport_read;
 
   read_transport_for_each(transport, node) {
-    struct android_log_transport_context* transp;
-    struct android_log_logger* logger;
-    unsigned logMask = 0;
-
-    logger_for_each(logger, logger_list) {
-      log_id_t logId = logger->logId;
+    int ret = add_transport_context(logger_list, transport);
 
-      if ((logId == LOG_ID_SECURITY) && (__android_log_uid() != AID_SYSTEM)) {
-        continue;
-      }
-      if (transport->read &&
-          (!transport->available || (transport->available(logId) >= 0))) {
-        logMask |= 1 << logId;
-      }
-    }
-    if (!logMask) {
-      continue;
-    }
-    transp = calloc(1, sizeof(*transp));
-    if (!transp) {
-      return -ENOMEM;
+    if (ret < 0) {
+      return ret;
     }
-    transp->parent = logger_list;
-    transp->transport = transport;
-    transp->logMask = logMask;
-    transp->ret = 1;
-    list_add_tail(&logger_list->transport, &transp->node);
   }
   if (list_empty(&logger_list->transport)) {
     return -ENODEV;
@@ -264,6 +289,112 @@ LIBLOG_ABI_PUBLIC struct logger_list* android_logger_list_alloc_time(
   return (struct logger_list*)logger_list;
 }
 
+/*
+ * Have logd drop the entries a reader would reject with the same filterspecs
+ * in android_log_shouldPrintLine(), rather than send them all over. Entries
+ * the reader may still be handed regardless are binary, chatty or malformed
+ * ones, or all of them for other transports, so it must keep filtering.
+ */
+LIBLOG_ABI_PUBLIC int android_logger_list_set_filter(
+    struct logger_list* logger_list, const char* filterString) {
+  struct android_log_logger_list* logger_list_internal =
+      (struct android_log_logger_list*)logger_list;
+  char *filter = NULL, *cp;
+  const char* rule;
+
+  if (!logger_list_internal) {
+    return -EINVAL;
+  }
+
+  if (filterString) {
+    filter = malloc(strlen(filterString) + 1);
+    if (!filter) {
+      return -ENOMEM;
+    }
+    /* same rules as android_log_addFilterString(), rejoined with commas */
+    cp = filter;
+    for (rule = filterString; *rule;) {
+      size_t len = strcspn(rule, " \t,");
+      size_t tagLen = strcspn(rule, ":");
+
+      if (len) {
+        if ((tagLen == 0) ||
+            ((tagLen < len) &&
+             (((tagLen + 1) == len) ||
+              !strchr("0123456789vdiwefs*", tolower(rule[tagLen + 1]))))) {
+          free(filter);
+          return -EINVAL;
+        }
+        if (cp != filter) {
+          *cp++ = ',';
+        }
+        memcpy(cp, rule, len);
+        cp += len;
+      }
+      rule += len;
+      if (*rule) {
+        ++rule;
+      }
+    }
+    *cp = '\0';
+    if (cp == filter) {
+      free(filter);
+      filter = NULL;
+    }
+  }
+
+  free(logger_list_internal->filter);
+  logger_list_internal->filter = filter;
+  return 0;
+}
+
+/*
+ * Read the records of a binary log dump, as written by logcat -B, instead
+ * of asking the transports for the live logs. The mode, tail, start and pid
+ * the list was allocated with still select the entries, a dump has no end
+ * to wait for so reads return -EAGAIN once it is exhausted.
+ */
+LIBLOG_ABI_PUBLIC int android_logger_list_set_file(
+    struct logger_list* logger_list, const char* path) {
+  struct android_log_logger_list* logger_list_internal =
+      (struct android_log_logger_list*)logger_list;
+  char* file = NULL;
+
+  if (!logger_list_internal) {
+    return -EINVAL;
+  }
+
+#if defined(_WIN32)
+  if (path) {
+    return -ENOSYS;
+  }
+#else
+  if (path) {
+    file = strdup(path);
+    if (!file) {
+      return -ENOMEM;
+    }
+  }
+#endif
+
+  /* Reset known transports to re-evaluate, as android_logger_open() does */
+  while (!list_empty(&logger_list_internal->transport)) {
+    struct listnode* node = list_head(&logger_list_internal->transport);
+    struct android_log_transport_context* transp =
+        node_to_item(node, struct android_log_transport_context, node);
+
+    if (transp->transport && transp->transport->close) {
+      (*transp->transport->close)(logger_list_internal, transp);
+    }
+    list_remove(&transp->node);
+    free(transp);
+  }
+
+  free(logger_list_internal->file);
+  logger_list_internal->file = file;
+  return 0;
+}
+
 /* android_logger_list_register unimplemented, no use case */
 /* android_logger_list_unregister unimplemented, no use case */
 
@@ -495,5 +626,7 @@ LIBLOG_ABI_PUBLIC void android_logger_list_free(struct logger_list* logger_list)
     android_logger_free((struct logger*)logger);
   }
 
+  free(logger_list_internal->filter);
+  free(logger_list_internal->file);
   free(logger_list_internal);
 }
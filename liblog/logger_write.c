@@ -241,11 +241,16 @@ static inline uint32_t get4LE(const uint8_t* src) {
   return src[0] | (src[1] << 8) | (src[2] << 16) | (src[3] << 24);
 }
 
-static int __write_to_log_daemon(log_id_t log_id, struct iovec* vec, size_t nr) {
-  struct android_log_transport_write* node;
-  int ret;
-  struct timespec ts;
+/*
+ * Timestamps the entry into ts, returns 0 if it is to be written or -errno
+ * if it is invalid or not loggable.
+ */
+static inline int __write_to_log_check(log_id_t log_id, struct iovec* vec,
+                                       size_t nr, struct timespec* ts) {
   size_t len, i;
+#if defined(__ANDROID__)
+  int ret;
+#endif
 
   for (len = i = 0; i < nr; ++i) {
     len += vec[i].iov_len;
@@ -255,7 +260,7 @@ static int __write_to_log_daemon(log_id_t log_id, struct iovec* vec, size_t nr)
   }
 
 #if defined(__ANDROID__)
-  clock_gettime(android_log_clockid(), &ts);
+  clock_gettime(android_log_clockid(), ts);
 
   if (log_id == LOG_ID_SECURITY) {
     if (vec[0].iov_len < 4) {
@@ -348,12 +353,25 @@ static int __write_to_log_daemon(log_id_t log_id, struct iovec* vec, size_t nr)
   {
     struct timeval tv;
     gettimeofday(&tv, NULL);
-    ts.tv_sec = tv.tv_sec;
-    ts.tv_nsec = tv.tv_usec * 1000;
+    ts->tv_sec = tv.tv_sec;
+    ts->tv_nsec = tv.tv_usec * 1000;
   }
 #endif
 
-  ret = 0;
+  return 0;
+}
+
+static int __write_to_log_daemon(log_id_t log_id, struct iovec* vec, size_t nr) {
+  struct android_log_transport_write* node;
+  int ret;
+  struct timespec ts;
+  size_t i;
+
+  ret = __write_to_log_check(log_id, vec, nr, &ts);
+  if (ret < 0) {
+    return ret;
+  }
+
   i = 1 << log_id;
   write_transport_for_each(node, &__android_log_transport_write) {
     if (node->logMask & i) {
@@ -374,6 +392,62 @@ static int __write_to_log_daemon(log_id_t log_id, struct iovec* vec, size_t nr)
   return ret;
 }
 
+#if (FAKE_LOG_DEVICE == 0)
+extern struct android_log_transport_write logdLoggerWrite;
+extern struct android_log_transport_write pmsgLoggerWrite;
+
+/*
+ * __write_to_log_daemon() for when the transports came out as they do by
+ * default, logd with or without pmsg persisting: the same checks, then
+ * straight to the two writers instead of walking both transport lists.
+ */
+static int __write_to_log_logd(log_id_t log_id, struct iovec* vec, size_t nr) {
+  int ret;
+  struct timespec ts;
+  size_t i;
+
+  ret = __write_to_log_check(log_id, vec, nr, &ts);
+  if (ret < 0) {
+    return ret;
+  }
+
+  ret = 0;
+  i = 1 << log_id;
+  if (logdLoggerWrite.logMask & i) {
+    ret = (*logdLoggerWrite.write)(log_id, &ts, vec, nr);
+  }
+  if (pmsgLoggerWrite.logMask & i) {
+    (void)(*pmsgLoggerWrite.write)(log_id, &ts, vec, nr);
+  }
+
+  return ret;
+}
+
+/* log_init_lock assumed */
+static bool __write_to_log_only_logd() {
+  struct listnode* list = &__android_log_transport_write;
+  struct listnode* persist = &__android_log_persist_write;
+
+  if ((list_head(list) != &logdLoggerWrite.node) ||
+      (list_tail(list) != &logdLoggerWrite.node)) {
+    return false;
+  }
+  return list_empty(persist) ||
+         ((list_head(persist) == &pmsgLoggerWrite.node) &&
+          (list_tail(persist) == &pmsgLoggerWrite.node));
+}
+#endif
+
+/* Whether write_to_log is through __write_to_log_init() to the transports */
+static bool __write_to_log_initialized() {
+#if (FAKE_LOG_DEVICE == 0)
+  if (write_to_log == __write_to_log_logd) {
+    return true;
+  }
+#endif
+  return write_to_log == __write_to_log_daemon;
+}
+
 static int __write_to_log_init(log_id_t log_id, struct iovec* vec, size_t nr) {
   __android_log_lock();
 
@@ -390,6 +464,11 @@ static int __write_to_log_init(log_id_t log_id, struct iovec* vec, size_t nr) {
     }
 
     write_to_log = __write_to_log_daemon;
+#if (FAKE_LOG_DEVICE == 0)
+    if (__write_to_log_only_logd()) {
+      write_to_log = __write_to_log_logd;
+    }
+#endif
   }
 
   __android_log_unlock();
@@ -672,7 +751,7 @@ LIBLOG_ABI_PUBLIC int android_set_log_transport(int transport_flag) {
     write_to_log = __write_to_log_init;
     /* generically we only expect these two values for write_to_log */
   } else if ((write_to_log != __write_to_log_init) &&
-             (write_to_log != __write_to_log_daemon)) {
+             !__write_to_log_initialized()) {
     write_to_log = __write_to_log_init;
   }
 
@@ -693,7 +772,7 @@ LIBLOG_ABI_PUBLIC int android_get_log_transport() {
     __android_log_transport &= LOGGER_LOCAL | LOGGER_LOGD | LOGGER_STDERR;
     ret = __android_log_transport;
     if ((write_to_log != __write_to_log_init) &&
-        (write_to_log != __write_to_log_daemon)) {
+        !__write_to_log_initialized()) {
       ret = -EINVAL;
     }
   }
@@ -68,6 +68,11 @@ struct AndroidLogFormat_t {
   bool monotonic_output;
   bool uid_output;
   bool descriptive_output;
+  /* last second formatted, consecutive entries mostly share it */
+  bool time_cache_valid;
+  time_t time_cache_sec;
+  char time_cache[32];
+  char zone_cache[16];
 };
 
 /*
@@ -232,6 +237,29 @@ LIBLOG_ABI_PUBLIC AndroidLogFormat* android_log_format_new() {
 
 static list_declare(convertHead);
 
+LIBLOG_ABI_PUBLIC AndroidLogFormat* android_log_format_dup(
+    const AndroidLogFormat* p_format) {
+  AndroidLogFormat* p_ret;
+  FilterInfo *p_info, **pp_next;
+
+  p_ret = malloc(sizeof(AndroidLogFormat));
+  if (!p_ret) {
+    return NULL;
+  }
+  *p_ret = *p_format;
+  p_ret->time_cache_valid = false;
+
+  /* same rules in the same order */
+  p_ret->filters = NULL;
+  pp_next = &p_ret->filters;
+  for (p_info = p_format->filters; p_info; p_info = p_info->p_next) {
+    *pp_next = filterinfo_new(p_info->mTag, p_info->mPri);
+    pp_next = &(*pp_next)->p_next;
+  }
+
+  return p_ret;
+}
+
 LIBLOG_ABI_PUBLIC void android_log_format_free(AndroidLogFormat* p_format) {
   FilterInfo *p_info, *p_info_old;
 
@@ -256,6 +284,7 @@ LIBLOG_ABI_PUBLIC void android_log_format_free(AndroidLogFormat* p_format) {
 
 LIBLOG_ABI_PUBLIC int android_log_setPrintFormat(AndroidLogFormat* p_format,
                                                  AndroidLogPrintFormat format) {
+  p_format->time_cache_valid = false;
   switch (format) {
     case FORMAT_MODIFIER_COLOR:
       p_format->colored_output = true;
@@ -1217,6 +1246,37 @@ static size_t convertPrintable(char* p, const char* message, size_t messageLen)
   bool print = p != NULL;
 
   while (messageLen) {
+    /*
+     * Fast path, copy runs of plain printable ASCII (0x20-0x7E except for
+     * the backslash) a word at a time, only the rest needs per-character
+     * classification.
+     */
+    size_t run = 0;
+    while ((messageLen - run) >= sizeof(uint64_t)) {
+      uint64_t v;
+      memcpy(&v, message + run, sizeof(v));
+      /* high bit of each byte that is < 0x20, >= 0x7F or '\\' */
+      uint64_t bad = (v - 0x2020202020202020ULL) | (v + 0x0101010101010101ULL) |
+                     ((v ^ 0x5C5C5C5C5C5C5C5CULL) - 0x0101010101010101ULL);
+      bad = (bad | v) & 0x8080808080808080ULL;
+      if (bad) break;
+      run += sizeof(v);
+    }
+    while ((run < messageLen) && (message[run] >= ' ') &&
+           (message[run] < 0x7F) && (message[run] != '\\')) {
+      ++run;
+    }
+    if (run) {
+      if (print) {
+        memcpy(p, message, run);
+        p[run] = '\0';
+      }
+      p += run;
+      message += run;
+      messageLen -= run;
+      continue;
+    }
+
     char buf[6];
     ssize_t len = sizeof(buf) - 1;
     if ((size_t)len > messageLen) {
@@ -1539,19 +1599,15 @@ static void convertMonotonic(struct timespec* result,
 }
 #endif
 
-/**
- * Formats a log message into a buffer
- *
- * Uses defaultBuffer if it can, otherwise malloc()'s a new buffer
- * If return value != defaultBuffer, caller must call free()
- * Returns NULL on malloc error
+/*
+ * Formats a log message into defaultBuffer, or into a malloc()'d buffer if
+ * it does not fit and allocate is set.  Returns NULL on malloc error, or if
+ * it does not fit and allocate is clear.
  */
-
-LIBLOG_ABI_PUBLIC char* android_log_formatLogLine(AndroidLogFormat* p_format,
-                                                  char* defaultBuffer,
-                                                  size_t defaultBufferSize,
-                                                  const AndroidLogEntry* entry,
-                                                  size_t* p_outLength) {
+static char* formatLogLine(AndroidLogFormat* p_format, char* defaultBuffer,
+                           size_t defaultBufferSize,
+                           const AndroidLogEntry* entry, size_t* p_outLength,
+                           bool allocate) {
 #if !defined(_WIN32)
   struct tm tmBuf;
 #endif
@@ -1601,14 +1657,28 @@ LIBLOG_ABI_PUBLIC char* android_log_formatLogLine(AndroidLogFormat* p_format,
     ptm = NULL;
     snprintf(timeBuf, sizeof(timeBuf),
              p_format->monotonic_output ? "%6lld" : "%19lld", (long long)now);
+  } else if (p_format->time_cache_valid && (p_format->time_cache_sec == now)) {
+    /* same second as the last entry, skip localtime and strftime */
+    ptm = NULL;
+    strcpy(timeBuf, p_format->time_cache);
   } else {
 #if !defined(_WIN32)
     ptm = localtime_r(&now, &tmBuf);
 #else
     ptm = localtime(&now);
 #endif
-    strftime(timeBuf, sizeof(timeBuf),
-             &"%Y-%m-%d %H:%M:%S"[p_format->year_output ? 0 : 3], ptm);
+    p_format->time_cache_valid = false;
+    if (ptm) {
+      strftime(p_format->time_cache, sizeof(p_format->time_cache),
+               &"%Y-%m-%d %H:%M:%S"[p_format->year_output ? 0 : 3], ptm);
+      p_format->zone_cache[0] = '\0';
+      strftime(p_format->zone_cache, sizeof(p_format->zone_cache), " %z", ptm);
+      p_format->time_cache_sec = now;
+      p_format->time_cache_valid = true;
+      strcpy(timeBuf, p_format->time_cache);
+    } else {
+      timeBuf[0] = '\0';
+    }
   }
   len = strlen(timeBuf);
   if (p_format->nsec_time_output) {
@@ -1620,8 +1690,9 @@ LIBLOG_ABI_PUBLIC char* android_log_formatLogLine(AndroidLogFormat* p_format,
     len += snprintf(timeBuf + len, sizeof(timeBuf) - len, ".%03ld",
                     nsec / MS_PER_NSEC);
   }
-  if (p_format->zone_output && ptm) {
-    strftime(timeBuf + len, sizeof(timeBuf) - len, " %z", ptm);
+  if (p_format->zone_output && !p_format->epoch_output &&
+      !p_format->monotonic_output && p_format->time_cache_valid) {
+    strcpy(timeBuf + len, p_format->zone_cache);
   }
 
   /*
@@ -1761,9 +1832,12 @@ LIBLOG_ABI_PUBLIC char* android_log_formatLogLine(AndroidLogFormat* p_format,
      * The line-end finding here must match the line-end finding
      * in for ( ... numLines...) loop below
      */
-    while (pm < (entry->message + entry->messageLen)) {
-      if (*pm++ == '\n') numLines++;
+    const char* end = entry->message + entry->messageLen;
+    while ((pm < end) && (pm = memchr(pm, '\n', end - pm))) {
+      ++pm;
+      numLines++;
     }
+    pm = end;
     /* plus one line for anything not newline-terminated at the end */
     if (pm > entry->message && *(pm - 1) != '\n') numLines++;
   }
@@ -1782,6 +1856,8 @@ LIBLOG_ABI_PUBLIC char* android_log_formatLogLine(AndroidLogFormat* p_format,
 
   if (defaultBufferSize >= bufferSize) {
     ret = defaultBuffer;
+  } else if (!allocate) {
+    return NULL;
   } else {
     ret = (char*)malloc(bufferSize);
 
@@ -1813,7 +1889,9 @@ LIBLOG_ABI_PUBLIC char* android_log_formatLogLine(AndroidLogFormat* p_format,
       lineStart = pm;
 
       /* Find the next end-of-line in message */
-      while (pm < (entry->message + entry->messageLen) && *pm != '\n') pm++;
+      pm = memchr(lineStart, '\n',
+                  entry->message + entry->messageLen - lineStart);
+      if (!pm) pm = entry->message + entry->messageLen;
       lineLen = pm - lineStart;
 
       strcat(p, prefixBuf);
@@ -1838,6 +1916,53 @@ LIBLOG_ABI_PUBLIC char* android_log_formatLogLine(AndroidLogFormat* p_format,
   return ret;
 }
 
+/**
+ * Formats a log message into a buffer
+ *
+ * Uses defaultBuffer if it can, otherwise malloc()'s a new buffer
+ * If return value != defaultBuffer, caller must call free()
+ * Returns NULL on malloc error
+ */
+
+LIBLOG_ABI_PUBLIC char* android_log_formatLogLine(AndroidLogFormat* p_format,
+                                                  char* defaultBuffer,
+                                                  size_t defaultBufferSize,
+                                                  const AndroidLogEntry* entry,
+                                                  size_t* p_outLength) {
+  return formatLogLine(p_format, defaultBuffer, defaultBufferSize, entry,
+                       p_outLength, true);
+}
+
+/**
+ * Formats consecutive log messages back to back into a buffer
+ *
+ * Stops at the first entry that does not fit in what is left of buf,
+ * never allocates.  Returns the number of entries formatted, the total
+ * length (not counting the trailing nul) is stored in *p_outLength.
+ */
+
+LIBLOG_ABI_PUBLIC size_t android_log_formatLogLines(
+    AndroidLogFormat* p_format, char* buf, size_t bufSize,
+    const AndroidLogEntry* entries, size_t count, size_t* p_outLength) {
+  size_t used = 0;
+  size_t i;
+
+  for (i = 0; i < count; ++i) {
+    size_t len;
+    if (!formatLogLine(p_format, buf + used, bufSize - used, &entries[i], &len,
+                       false)) {
+      break;
+    }
+    used += len;
+  }
+
+  if (p_outLength != NULL) {
+    *p_outLength = used;
+  }
+
+  return i;
+}
+
 /**
  * Either print or do not print log line, based on filter
  *
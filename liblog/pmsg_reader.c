@@ -129,6 +129,11 @@ static int pmsgVersion(struct android_log_logger* logger __unused,
   return 4;
 }
 
+/*
+ * pstore keeps no write boundaries, records are found by their header alone.
+ * That is what lets pmsg_writer.c coalesce many records into one write
+ * without anything here having to know.
+ */
 static int pmsgRead(struct android_log_logger_list* logger_list,
                     struct android_log_transport_context* transp,
                     struct log_msg* log_msg) {
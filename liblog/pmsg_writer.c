@@ -20,6 +20,7 @@
 
 #include <errno.h>
 #include <fcntl.h>
+#include <pthread.h>
 #include <stdbool.h>
 #include <stdlib.h>
 #include <string.h>
@@ -65,7 +66,10 @@ static int pmsgOpen() {
   return fd;
 }
 
+static ssize_t pmsgCoalesceFlush();
+
 static void pmsgClose() {
+  pmsgCoalesceFlush();
   int fd = atomic_exchange(&pmsgLoggerWrite.context.fd, -1);
   if (fd >= 0) {
     close(fd);
@@ -89,6 +93,178 @@ static int pmsgAvailable(log_id_t logId) {
   return 1;
 }
 
+/*
+ * Optional coalescing, enabled with log.pmsg.coalesce (persist.log.pmsg.coalesce,
+ * ro.log.pmsg.coalesce), read once per process.  Every write to /dev/pmsg0 is
+ * its own trip into pstore, and so is every iovec of a writev, so records are
+ * copied end to end into one buffer and written with a single write() once
+ * it is full, the oldest record has been held PMSG_COALESCE_LATENCY_MS, or a
+ * crash or ANDROID_LOG_ERROR and above record arrives.  A flusher thread
+ * pushes out what a quiet process left behind.  The records are laid out
+ * exactly as separate writes would have left them in pstore.
+ */
+#define PMSG_COALESCE_MAX_LEN (4 * (LOGGER_ENTRY_MAX_PAYLOAD + 64))
+#define PMSG_COALESCE_LATENCY_MS 50
+#define PMSG_COALESCE_LATENCY_NS (PMSG_COALESCE_LATENCY_MS * 1000000ULL)
+
+static pthread_once_t coalesceOnce = PTHREAD_ONCE_INIT;
+static pthread_once_t coalesceAllocOnce = PTHREAD_ONCE_INIT;
+static bool coalesceEnabled;
+static pthread_mutex_t coalesceLock = PTHREAD_MUTEX_INITIALIZER;
+static bool coalesceFlusherRunning;
+static uint64_t coalesceFirst; /* CLOCK_MONOTONIC of the oldest record held */
+static size_t coalesceLen;
+static char* coalesceBuf;
+
+static uint64_t pmsgCoalesceNow() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* coalesceLock held */
+static ssize_t pmsgCoalesceFlush_locked() {
+  ssize_t ret;
+
+  if (!coalesceLen) {
+    return 0;
+  }
+  ret = TEMP_FAILURE_RETRY(write(atomic_load(&pmsgLoggerWrite.context.fd),
+                                 coalesceBuf, coalesceLen));
+  if (ret < 0) {
+    ret = errno ? -errno : -ENOTCONN;
+  }
+  coalesceLen = 0;
+  return ret;
+}
+
+static ssize_t pmsgCoalesceFlush() {
+  ssize_t ret;
+
+  if (!coalesceBuf) {
+    return 0;
+  }
+  pthread_mutex_lock(&coalesceLock);
+  ret = pmsgCoalesceFlush_locked();
+  pthread_mutex_unlock(&coalesceLock);
+  return ret;
+}
+
+static void* pmsgCoalesceFlusher(void* obj __unused) {
+  for (;;) {
+    struct timespec ts = { 0, PMSG_COALESCE_LATENCY_MS * 1000000L };
+
+    nanosleep(&ts, NULL);
+
+    pthread_mutex_lock(&coalesceLock);
+    if (coalesceLen &&
+        ((pmsgCoalesceNow() - coalesceFirst) >= PMSG_COALESCE_LATENCY_NS)) {
+      pmsgCoalesceFlush_locked();
+    }
+    pthread_mutex_unlock(&coalesceLock);
+  }
+  return NULL;
+}
+
+static void pmsgCoalescePrepareFork() {
+  pthread_mutex_lock(&coalesceLock);
+}
+
+static void pmsgCoalesceParentFork() {
+  pthread_mutex_unlock(&coalesceLock);
+}
+
+/* The parent still holds, and will write, what the child inherited */
+static void pmsgCoalesceChildFork() {
+  coalesceLen = 0;
+  coalesceFlusherRunning = false;
+  pthread_mutex_init(&coalesceLock, NULL);
+}
+
+static void pmsgCoalesceAlloc() {
+  if (pthread_atfork(pmsgCoalescePrepareFork, pmsgCoalesceParentFork,
+                     pmsgCoalesceChildFork)) {
+    return;
+  }
+  coalesceBuf = malloc(PMSG_COALESCE_MAX_LEN);
+}
+
+static void pmsgCoalesceInit() {
+  coalesceEnabled = __android_logger_property_get_bool(
+      "log.pmsg.coalesce", BOOL_DEFAULT_FALSE | BOOL_DEFAULT_FLAG_PERSIST);
+}
+
+/*
+ * Copies the record in vec onto the end of the buffer, flushing first if it
+ * would not fit, and after if flush is set or the buffer has aged.  Returns
+ * the size of the record, or the error of a flush that failed.
+ */
+static ssize_t pmsgCoalesceAppend(struct iovec* vec, size_t nr, size_t len,
+                                  bool flush) {
+  uint64_t now = pmsgCoalesceNow();
+  ssize_t ret = len;
+  size_t i;
+
+  pthread_mutex_lock(&coalesceLock);
+
+  if ((coalesceLen + len) > PMSG_COALESCE_MAX_LEN) {
+    ssize_t err = pmsgCoalesceFlush_locked();
+    if (err < 0) {
+      ret = err;
+    }
+  }
+  if (!coalesceLen) {
+    coalesceFirst = now;
+  }
+  for (i = 0; i < nr; ++i) {
+    memcpy(coalesceBuf + coalesceLen, vec[i].iov_base, vec[i].iov_len);
+    coalesceLen += vec[i].iov_len;
+  }
+
+  if (flush || ((now - coalesceFirst) >= PMSG_COALESCE_LATENCY_NS)) {
+    ssize_t err = pmsgCoalesceFlush_locked();
+    if (err < 0) {
+      ret = err;
+    }
+  } else if (coalesceEnabled && !coalesceFlusherRunning) {
+    pthread_attr_t attr;
+    pthread_t thread;
+
+    if (!pthread_attr_init(&attr)) {
+      if (!pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED) &&
+          !pthread_create(&thread, &attr, pmsgCoalesceFlusher, NULL)) {
+        coalesceFlusherRunning = true;
+      }
+      pthread_attr_destroy(&attr);
+    }
+    if (!coalesceFlusherRunning) {
+      /* nobody is going to come back for it */
+      ssize_t err = pmsgCoalesceFlush_locked();
+      if (err < 0) {
+        ret = err;
+      }
+    }
+  }
+
+  pthread_mutex_unlock(&coalesceLock);
+
+  return ret;
+}
+
+/* text logs carry their priority in the first byte */
+static bool pmsgCoalesceUrgent(log_id_t logId, struct iovec* vec, size_t nr) {
+  switch (logId) {
+    case LOG_ID_CRASH:
+      return true;
+    case LOG_ID_EVENTS:
+    case LOG_ID_SECURITY:
+      return false;
+    default:
+      return nr && vec[0].iov_len &&
+             (*(const unsigned char*)vec[0].iov_base >= ANDROID_LOG_ERROR);
+  }
+}
+
 /*
  * Extract a 4-byte value from a byte stream.
  */
@@ -96,8 +272,13 @@ static inline uint32_t get4LE(const uint8_t* src) {
   return src[0] | (src[1] << 8) | (src[2] << 16) | (src[3] << 24);
 }
 
-static int pmsgWrite(log_id_t logId, struct timespec* ts, struct iovec* vec,
-                     size_t nr) {
+/*
+ * Writes one record, or with coalesce set adds it to the buffer and only
+ * writes when the buffer is due.  Without log.pmsg.coalesce nothing comes
+ * back for the buffer, the caller has to pmsgCoalesceFlush().
+ */
+static int pmsgWriteRecord(log_id_t logId, struct timespec* ts,
+                           struct iovec* vec, size_t nr, bool coalesce) {
   static const unsigned headerLength = 2;
   struct iovec newVec[nr + headerLength];
   android_log_header_t header;
@@ -169,10 +350,19 @@ static int pmsgWrite(log_id_t logId, struct timespec* ts, struct iovec* vec,
   }
   pmsgHeader.len += payloadSize;
 
-  ret = TEMP_FAILURE_RETRY(
-      writev(atomic_load(&pmsgLoggerWrite.context.fd), newVec, i));
-  if (ret < 0) {
-    ret = errno ? -errno : -ENOTCONN;
+  if (coalesce) {
+    pthread_once(&coalesceAllocOnce, pmsgCoalesceAlloc);
+    coalesce = coalesceBuf != NULL;
+  }
+  if (coalesce) {
+    ret = pmsgCoalesceAppend(newVec, i, pmsgHeader.len,
+                             pmsgCoalesceUrgent(logId, vec, nr));
+  } else {
+    ret = TEMP_FAILURE_RETRY(
+        writev(atomic_load(&pmsgLoggerWrite.context.fd), newVec, i));
+    if (ret < 0) {
+      ret = errno ? -errno : -ENOTCONN;
+    }
   }
 
   if (ret > (ssize_t)(sizeof(header) + sizeof(pmsgHeader))) {
@@ -182,6 +372,12 @@ static int pmsgWrite(log_id_t logId, struct timespec* ts, struct iovec* vec,
   return ret;
 }
 
+static int pmsgWrite(log_id_t logId, struct timespec* ts, struct iovec* vec,
+                     size_t nr) {
+  pthread_once(&coalesceOnce, pmsgCoalesceInit);
+  return pmsgWriteRecord(logId, ts, vec, nr, coalesceEnabled);
+}
+
 /*
  * Virtual pmsg filesystem
  *
@@ -209,6 +405,7 @@ LIBLOG_ABI_PRIVATE ssize_t __android_log_pmsg_file_write(log_id_t logId,
                                                          const char* buf,
                                                          size_t len) {
   bool weOpened;
+  ssize_t flushed;
   size_t length, packet_len;
   const char* tag;
   char *cp, *slash;
@@ -285,7 +482,8 @@ LIBLOG_ABI_PRIVATE ssize_t __android_log_pmsg_file_write(log_id_t logId,
       }
     }
 
-    ret = pmsgWrite(logId, &ts, vec, sizeof(vec) / sizeof(vec[0]));
+    /* One write for the whole file, or as near as the buffer allows */
+    ret = pmsgWriteRecord(logId, &ts, vec, sizeof(vec) / sizeof(vec[0]), true);
 
     if (ret <= 0) {
       if (weOpened) {
@@ -298,10 +496,11 @@ LIBLOG_ABI_PRIVATE ssize_t __android_log_pmsg_file_write(log_id_t logId,
     length -= transfer;
     buf += transfer;
   }
+  flushed = pmsgCoalesceFlush();
   if (weOpened) {
     pmsgClose();
     __android_log_unlock();
   }
   free(cp);
-  return len;
+  return (flushed < 0) ? flushed : (ssize_t)len;
 }
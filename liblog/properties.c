@@ -16,6 +16,7 @@
 
 #include <ctype.h>
 #include <pthread.h>
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <stdlib.h>
 #include <string.h>
@@ -88,114 +89,42 @@ static void refresh_cache(struct cache_char* cache, const char* key) {
   }
 }
 
-static int __android_log_level(const char* tag, size_t len, int default_prio) {
+/*
+ * Resolve the level character of a tag. Priorities are:
+ *    log.tag.<tag>
+ *    persist.log.tag.<tag>
+ *    log.tag
+ *    persist.log.tag
+ * Where the missing tag matches all tags and becomes the
+ * system global default. We do not support ro.log.tag* .
+ *
+ * tag_cache and global_cache are two entries each, refreshed in place.
+ */
+static char resolve_level(const char* tag, size_t taglen,
+                          struct cache_char* tag_cache,
+                          struct cache_char* global_cache) {
   /* sizeof() is used on this array below */
   static const char log_namespace[] = "persist.log.tag.";
   static const size_t base_offset = 8; /* skip "persist." */
-  /* calculate the size of our key temporary buffer */
-  const size_t taglen = tag ? len : 0;
   /* sizeof(log_namespace) = strlen(log_namespace) + 1 */
   char key[sizeof(log_namespace) + taglen];
   char* kp;
   size_t i;
   char c = 0;
-  /*
-   * Single layer cache of four properties. Priorities are:
-   *    log.tag.<tag>
-   *    persist.log.tag.<tag>
-   *    log.tag
-   *    persist.log.tag
-   * Where the missing tag matches all tags and becomes the
-   * system global default. We do not support ro.log.tag* .
-   */
-  static char* last_tag;
-  static size_t last_tag_len;
-  static uint32_t global_serial;
-  /* some compilers erroneously see uninitialized use. !not_locked */
-  uint32_t current_global_serial = 0;
-  static struct cache_char tag_cache[2];
-  static struct cache_char global_cache[2];
-  int change_detected;
-  int global_change_detected;
-  int not_locked;
 
   strcpy(key, log_namespace);
 
-  global_change_detected = change_detected = not_locked = lock();
-
-  if (!not_locked) {
-    /*
-     *  check all known serial numbers to changes.
-     */
-    for (i = 0; i < (sizeof(tag_cache) / sizeof(tag_cache[0])); ++i) {
-      if (check_cache(&tag_cache[i].cache)) {
-        change_detected = 1;
-      }
-    }
-    for (i = 0; i < (sizeof(global_cache) / sizeof(global_cache[0])); ++i) {
-      if (check_cache(&global_cache[i].cache)) {
-        global_change_detected = 1;
-      }
-    }
-
-    current_global_serial = __system_property_area_serial();
-    if (current_global_serial != global_serial) {
-      change_detected = 1;
-      global_change_detected = 1;
-    }
-  }
-
   if (taglen) {
-    int local_change_detected = change_detected;
-    if (!not_locked) {
-      if (!last_tag || !last_tag[0] || (last_tag[0] != tag[0]) ||
-          strncmp(last_tag + 1, tag + 1, last_tag_len - 1)) {
-        /* invalidate log.tag.<tag> cache */
-        for (i = 0; i < (sizeof(tag_cache) / sizeof(tag_cache[0])); ++i) {
-          tag_cache[i].cache.pinfo = NULL;
-          tag_cache[i].c = '\0';
-        }
-        if (last_tag) last_tag[0] = '\0';
-        local_change_detected = 1;
-      }
-      if (!last_tag || !last_tag[0]) {
-        if (!last_tag) {
-          last_tag = calloc(1, len + 1);
-          last_tag_len = 0;
-          if (last_tag) last_tag_len = len + 1;
-        } else if (len >= last_tag_len) {
-          last_tag = realloc(last_tag, len + 1);
-          last_tag_len = 0;
-          if (last_tag) last_tag_len = len + 1;
-        }
-        if (last_tag) {
-          strncpy(last_tag, tag, len);
-          last_tag[len] = '\0';
-        }
-      }
-    }
-    strncpy(key + sizeof(log_namespace) - 1, tag, len);
-    key[sizeof(log_namespace) - 1 + len] = '\0';
+    strncpy(key + sizeof(log_namespace) - 1, tag, taglen);
+    key[sizeof(log_namespace) - 1 + taglen] = '\0';
 
     kp = key;
-    for (i = 0; i < (sizeof(tag_cache) / sizeof(tag_cache[0])); ++i) {
-      struct cache_char* cache = &tag_cache[i];
-      struct cache_char temp_cache;
-
-      if (not_locked) {
-        temp_cache.cache.pinfo = NULL;
-        temp_cache.c = '\0';
-        cache = &temp_cache;
-      }
-      if (local_change_detected) {
-        refresh_cache(cache, kp);
-      }
-
-      if (cache->c) {
-        c = cache->c;
+    for (i = 0; i < 2; ++i) {
+      refresh_cache(&tag_cache[i], kp);
+      if (tag_cache[i].c) {
+        c = tag_cache[i].c;
         break;
       }
-
       kp = key + base_offset;
     }
   }
@@ -215,38 +144,170 @@ static int __android_log_level(const char* tag, size_t len, int default_prio) {
       /* clear '.' after log.tag */
       key[sizeof(log_namespace) - 2] = '\0';
 
+      c = 0;
       kp = key;
-      for (i = 0; i < (sizeof(global_cache) / sizeof(global_cache[0])); ++i) {
-        struct cache_char* cache = &global_cache[i];
-        struct cache_char temp_cache;
-
-        if (not_locked) {
-          temp_cache = *cache;
-          if (temp_cache.cache.pinfo != cache->cache.pinfo) { /* check atomic */
-            temp_cache.cache.pinfo = NULL;
-            temp_cache.c = '\0';
-          }
-          cache = &temp_cache;
-        }
-        if (global_change_detected) {
-          refresh_cache(cache, kp);
-        }
-
-        if (cache->c) {
-          c = cache->c;
+      for (i = 0; i < 2; ++i) {
+        refresh_cache(&global_cache[i], kp);
+        if (global_cache[i].c) {
+          c = global_cache[i].c;
           break;
         }
-
         kp = key + base_offset;
       }
       break;
   }
 
-  if (!not_locked) {
-    global_serial = current_global_serial;
+  return c;
+}
+
+/*
+ * Resolved levels for recently used tags, direct mapped on a hash of the
+ * tag, with one extra slot for the untagged global level. A slot is good
+ * for as long as __system_property_area_serial(), which moves on any
+ * property change, stays put. Readers take no lock: each slot is a seqlock
+ * and a hot check is a handful of atomic loads. Only a refresh takes
+ * lock_loggable, and with the usual trylock policy any contention is served
+ * by reading the properties directly.
+ */
+#define TAG_CACHE_SLOTS 64 /* power of two */
+#define TAG_CACHE_WORDS 16 /* longer tags always take the locked path */
+
+struct tag_cache_slot {
+  atomic_uint seq; /* odd while a refresh is being published */
+  atomic_uint area_serial;
+  atomic_uint len; /* tag length + 1, zero while empty */
+  atomic_int c;
+  atomic_uint tag[TAG_CACHE_WORDS];
+  /* only touched with lock_loggable held */
+  struct cache_char cache[2];
+};
+
+static struct tag_cache_slot tag_cache_slots[TAG_CACHE_SLOTS + 1];
+static struct cache_char global_cache[2]; /* lock_loggable held */
+
+static size_t tag_cache_index(const uint32_t* words, size_t taglen) {
+  const unsigned char* cp = (const unsigned char*)words;
+  uint32_t hash = 2166136261U; /* FNV-1a */
+  size_t i;
+
+  if (!taglen) {
+    return TAG_CACHE_SLOTS;
+  }
+  for (i = 0; i < taglen; ++i) {
+    hash = (hash ^ cp[i]) * 16777619U;
+  }
+  return hash & (TAG_CACHE_SLOTS - 1);
+}
+
+static bool tag_cache_lookup(struct tag_cache_slot* slot,
+                             const uint32_t* words, uint32_t len,
+                             uint32_t area_serial, char* c) {
+  uint32_t seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+  uint32_t nwords = (len + sizeof(uint32_t) - 2) / sizeof(uint32_t);
+  bool hit;
+  int value;
+  uint32_t i;
+
+  if (seq & 1) {
+    return false;
+  }
+  hit = (atomic_load_explicit(&slot->len, memory_order_relaxed) == len) &&
+        (atomic_load_explicit(&slot->area_serial, memory_order_relaxed) ==
+         area_serial);
+  for (i = 0; hit && (i < nwords); ++i) {
+    hit = atomic_load_explicit(&slot->tag[i], memory_order_relaxed) == words[i];
+  }
+  value = atomic_load_explicit(&slot->c, memory_order_relaxed);
+  atomic_thread_fence(memory_order_acquire);
+  if (atomic_load_explicit(&slot->seq, memory_order_relaxed) != seq) {
+    return false;
+  }
+  if (hit) {
+    *c = value;
+  }
+  return hit;
+}
+
+/* lock_loggable held, writers are serialized */
+static bool tag_cache_owns(struct tag_cache_slot* slot, const uint32_t* words,
+                           uint32_t len) {
+  uint32_t nwords = (len + sizeof(uint32_t) - 2) / sizeof(uint32_t);
+  uint32_t i;
+
+  if (atomic_load_explicit(&slot->len, memory_order_relaxed) != len) {
+    return false;
+  }
+  for (i = 0; i < nwords; ++i) {
+    if (atomic_load_explicit(&slot->tag[i], memory_order_relaxed) != words[i]) {
+      return false;
+    }
+  }
+  return true;
+}
+
+/* lock_loggable held */
+static void tag_cache_store(struct tag_cache_slot* slot, const uint32_t* words,
+                            uint32_t len, uint32_t area_serial, char c) {
+  uint32_t seq = atomic_load_explicit(&slot->seq, memory_order_relaxed);
+  uint32_t i;
+
+  atomic_store_explicit(&slot->seq, seq + 1, memory_order_relaxed);
+  atomic_thread_fence(memory_order_release);
+
+  atomic_store_explicit(&slot->len, len, memory_order_relaxed);
+  atomic_store_explicit(&slot->area_serial, area_serial, memory_order_relaxed);
+  atomic_store_explicit(&slot->c, c, memory_order_relaxed);
+  for (i = 0; i < TAG_CACHE_WORDS; ++i) {
+    atomic_store_explicit(&slot->tag[i], words[i], memory_order_relaxed);
+  }
+
+  atomic_store_explicit(&slot->seq, seq + 2, memory_order_release);
+}
+
+static int __android_log_level(const char* tag, size_t len, int default_prio) {
+  /* calculate the size of our key temporary buffer */
+  const size_t taglen = tag ? len : 0;
+  uint32_t area_serial = __system_property_area_serial();
+  uint32_t words[TAG_CACHE_WORDS];
+  struct tag_cache_slot* slot = NULL;
+  char c = 0;
+
+  if (taglen < sizeof(words)) {
+    memset(words, 0, sizeof(words));
+    memcpy(words, tag, taglen);
+    slot = &tag_cache_slots[tag_cache_index(words, taglen)];
+    if (tag_cache_lookup(slot, words, taglen + 1, area_serial, &c)) {
+      goto done;
+    }
+  }
+
+  if (lock()) {
+    /* contention, go straight to the properties */
+    struct cache_char temp_tag[2] = { { { NULL, -1 }, '\0' },
+                                      { { NULL, -1 }, '\0' } };
+    struct cache_char temp_global[2] = { { { NULL, -1 }, '\0' },
+                                         { { NULL, -1 }, '\0' } };
+    c = resolve_level(tag, taglen, temp_tag, temp_global);
+  } else {
+    struct cache_char temp_tag[2] = { { { NULL, -1 }, '\0' },
+                                      { { NULL, -1 }, '\0' } };
+    struct cache_char* tag_cache = temp_tag;
+
+    if (slot) {
+      if (!tag_cache_owns(slot, words, taglen + 1)) {
+        /* evict, the property info belongs to another tag */
+        memset(slot->cache, 0, sizeof(slot->cache));
+      }
+      tag_cache = slot->cache;
+    }
+    c = resolve_level(tag, taglen, tag_cache, global_cache);
+    if (slot) {
+      tag_cache_store(slot, words, taglen + 1, area_serial, c);
+    }
     unlock();
   }
 
+done:
   switch (toupper(c)) {
     /* clang-format off */
     case 'V': return ANDROID_LOG_VERBOSE;
@@ -17,6 +17,7 @@
 #include <fcntl.h>
 #include <inttypes.h>
 #include <poll.h>
+#include <pthread.h>
 #include <sys/endian.h>
 #include <sys/socket.h>
 #include <sys/types.h>
@@ -79,6 +80,22 @@ static void BM_log_maximum(int iters) {
 }
 BENCHMARK(BM_log_maximum);
 
+/*
+ *	Measure the cost of the write path itself, __android_log_buf_write()
+ * through the transports to the socket, without the formatting of a print.
+ */
+static void BM_log_buf_write(int iters) {
+  StartBenchmarkTiming();
+
+  for (int i = 0; i < iters; ++i) {
+    __android_log_buf_write(LOG_ID_MAIN, ANDROID_LOG_INFO, "BM_log_buf_write",
+                            "a message of a typical length, not printf'd");
+  }
+
+  StopBenchmarkTiming();
+}
+BENCHMARK(BM_log_buf_write);
+
 static void set_log_null() {
   android_set_log_transport(LOGGER_NULL);
 }
@@ -570,6 +587,37 @@ static void BM_log_event_overhead_null(int iters) {
 }
 BENCHMARK(BM_log_event_overhead_null);
 
+/*
+ *	Measure the time it takes to compose and submit a list event to the
+ * null transport, with the heap allocated context of android_log_event_list
+ * and with the storage of android_log_event_stack_list.
+ */
+static void BM_log_event_list_null(int iters) {
+  set_log_null();
+  StartBenchmarkTiming();
+  for (int i = 0; i < iters; ++i) {
+    android_log_event_list ctx(42);
+    ctx << i << (int64_t)i << "answer";
+    ctx.write();
+  }
+  StopBenchmarkTiming();
+  set_log_default();
+}
+BENCHMARK(BM_log_event_list_null);
+
+static void BM_log_event_stack_list_null(int iters) {
+  set_log_null();
+  StartBenchmarkTiming();
+  for (int i = 0; i < iters; ++i) {
+    android_log_event_stack_list<> ctx(42);
+    ctx << i << (int64_t)i << "answer";
+    ctx.write();
+  }
+  StopBenchmarkTiming();
+  set_log_default();
+}
+BENCHMARK(BM_log_event_stack_list_null);
+
 /*
  *	Measure the time it takes to submit the android event logging call
  * using discrete acquisition (StartBenchmarkTiming() -> StopBenchmarkTiming())
@@ -772,6 +820,53 @@ static void BM_is_loggable(int iters) {
 }
 BENCHMARK(BM_is_loggable);
 
+/*
+ *	Measure __android_log_is_loggable with 8 threads checking a handful of
+ * tags concurrently, the reported time is for one check on each thread.
+ */
+static const int loggable_threads = 8;
+
+struct loggable_arg {
+  int iters;
+  pthread_barrier_t* barrier;
+};
+
+static void* loggable_thread(void* obj) {
+  static const char* tags[] = { "logd", "ActivityManager", "libc", "chatty" };
+  loggable_arg* arg = reinterpret_cast<loggable_arg*>(obj);
+
+  pthread_barrier_wait(arg->barrier);
+  for (int i = 0; i < arg->iters; ++i) {
+    const char* tag = tags[i % (sizeof(tags) / sizeof(tags[0]))];
+    __android_log_is_loggable_len(ANDROID_LOG_WARN, tag, strlen(tag),
+                                  ANDROID_LOG_VERBOSE);
+  }
+  pthread_barrier_wait(arg->barrier);
+  return nullptr;
+}
+
+static void BM_is_loggable_threads(int iters) {
+  pthread_barrier_t barrier;
+  pthread_barrier_init(&barrier, nullptr, loggable_threads + 1);
+
+  loggable_arg arg = { iters, &barrier };
+  pthread_t threads[loggable_threads];
+  for (int i = 0; i < loggable_threads; ++i) {
+    pthread_create(&threads[i], nullptr, loggable_thread, &arg);
+  }
+
+  pthread_barrier_wait(&barrier);
+  StartBenchmarkTiming();
+  pthread_barrier_wait(&barrier);
+  StopBenchmarkTiming();
+
+  for (int i = 0; i < loggable_threads; ++i) {
+    pthread_join(threads[i], nullptr);
+  }
+  pthread_barrier_destroy(&barrier);
+}
+BENCHMARK(BM_is_loggable_threads);
+
 /*
  *	Measure the time it takes for android_log_clockid.
  */
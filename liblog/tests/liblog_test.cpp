@@ -24,17 +24,21 @@
 #include <signal.h>
 #include <stdio.h>
 #include <string.h>
+#include <sys/stat.h>
 #include <sys/types.h>
 #include <unistd.h>
 
 #include <string>
+#include <vector>
 
 #include <android-base/file.h>
 #include <android-base/stringprintf.h>
+#include <android-base/test_utils.h>
 #ifdef __ANDROID__  // includes sys/properties.h which does not exist outside
 #include <cutils/properties.h>
 #endif
 #include <gtest/gtest.h>
+#include <log/event_tag_map.h>
 #include <log/log_event_list.h>
 #include <log/log_properties.h>
 #include <log/log_transport.h>
@@ -268,6 +272,199 @@ TEST(liblog, __android_log_btwrite__android_logger_list_read) {
 #endif
 }
 
+TEST(liblog, android_logger_list_read__ring) {
+#if (defined(__ANDROID__) && defined(USING_LOGGER_DEFAULT))
+#ifdef TEST_PREFIX
+  TEST_PREFIX
+#endif
+  static const int num = 2000;  // enough to need several cursor updates
+  pid_t pid = getpid();
+
+  log_time ts(CLOCK_MONOTONIC);
+  for (int i = 0; i < num; ++i) {
+    EXPECT_LT(0, __android_log_btwrite(0, EVENT_TYPE_LONG, &ts, sizeof(ts)));
+  }
+  usleep(1000000);
+
+  struct logger_list* logger_list;
+  ASSERT_TRUE(NULL != (logger_list = android_logger_list_open(
+                           LOG_ID_EVENTS,
+                           ANDROID_LOG_RDONLY | ANDROID_LOG_NONBLOCK |
+                               ANDROID_LOG_RING,
+                           num * 2, pid)));
+
+  int count = 0;
+  for (;;) {
+    log_msg log_msg;
+    if (android_logger_list_read(logger_list, &log_msg) <= 0) {
+      break;
+    }
+
+    EXPECT_EQ(log_msg.entry.pid, pid);
+
+    if ((log_msg.entry.len != sizeof(android_log_event_long_t)) ||
+        (log_msg.id() != LOG_ID_EVENTS)) {
+      continue;
+    }
+
+    android_log_event_long_t* eventData;
+    eventData = reinterpret_cast<android_log_event_long_t*>(log_msg.msg());
+    if (!eventData || (eventData->payload.type != EVENT_TYPE_LONG)) {
+      continue;
+    }
+
+    log_time tx(reinterpret_cast<char*>(&eventData->payload.data));
+    if (ts == tx) {
+      ++count;
+    }
+  }
+
+  EXPECT_EQ(num, count);
+
+  android_logger_list_close(logger_list);
+#else
+  GTEST_LOG_(INFO) << "This test does nothing.\n";
+#endif
+}
+
+TEST(liblog, android_logger_list_read__filter) {
+#if (defined(__ANDROID__) && defined(USING_LOGGER_DEFAULT))
+#ifdef TEST_PREFIX
+  TEST_PREFIX
+#endif
+  static const int num = 100;
+  static const char tag_kept[] = "liblog.filter.kept";
+  static const char tag_dropped[] = "liblog.filter.dropped";
+  pid_t pid = getpid();
+
+  for (int i = 0; i < num; ++i) {
+    EXPECT_LT(0, __android_log_buf_write(LOG_ID_MAIN, ANDROID_LOG_INFO,
+                                         tag_kept, "kept"));
+    EXPECT_LT(0, __android_log_buf_write(LOG_ID_MAIN, ANDROID_LOG_INFO,
+                                         tag_dropped, "dropped"));
+    EXPECT_LT(0, __android_log_buf_write(LOG_ID_MAIN, ANDROID_LOG_DEBUG,
+                                         tag_kept, "too verbose"));
+  }
+  usleep(1000000);
+
+  struct logger_list* logger_list;
+  ASSERT_TRUE(NULL != (logger_list = android_logger_list_open(
+                           LOG_ID_MAIN,
+                           ANDROID_LOG_RDONLY | ANDROID_LOG_NONBLOCK, num,
+                           pid)));
+  EXPECT_EQ(-EINVAL, android_logger_list_set_filter(logger_list, "x:q"));
+  EXPECT_EQ(0, android_logger_list_set_filter(
+                   logger_list, "liblog.filter.kept:I *:S"));
+
+  int kept = 0;
+  int leaked = 0;
+  for (;;) {
+    log_msg log_msg;
+    if (android_logger_list_read(logger_list, &log_msg) <= 0) {
+      break;
+    }
+
+    EXPECT_EQ(log_msg.entry.pid, pid);
+
+    AndroidLogEntry entry;
+    if (android_log_processLogBuffer(&log_msg.entry_v1, &entry)) {
+      continue;
+    }
+    if (!strcmp(entry.tag, tag_kept)) {
+      if (entry.priority == ANDROID_LOG_INFO) {
+        ++kept;
+      } else {
+        ++leaked;
+      }
+    } else if (!strcmp(entry.tag, tag_dropped)) {
+      ++leaked;
+    }
+  }
+
+  // the tail counts only what passed the filter
+  EXPECT_EQ(num, kept);
+  EXPECT_EQ(0, leaked);
+
+  android_logger_list_close(logger_list);
+#else
+  GTEST_LOG_(INFO) << "This test does nothing.\n";
+#endif
+}
+
+#ifdef USING_LOGGER_DEFAULT  // Do not retest the file reader
+// Writes what logcat -B would, a v1 record among v4 ones
+static void write_dump(int fd, size_t num) {
+  for (size_t i = 0; i < num; ++i) {
+    log_msg log_msg;
+    memset(&log_msg, 0, sizeof(log_msg));
+    std::string payload = android::base::StringPrintf(
+        "%cliblog.file%cmessage %zu", ANDROID_LOG_INFO, '\0', i);
+    payload += '\0';
+    size_t hdr_size = (i == 1) ? sizeof(log_msg.entry_v1)
+                               : sizeof(log_msg.entry_v4);
+    log_msg.entry_v4.len = payload.length();
+    log_msg.entry_v4.pid = 1000 + i;
+    log_msg.entry_v4.sec = 1000000000 + i;
+    if (hdr_size == sizeof(log_msg.entry_v4)) {
+      log_msg.entry_v4.hdr_size = hdr_size;
+      log_msg.entry_v4.lid = (i & 1) ? LOG_ID_SYSTEM : LOG_ID_MAIN;
+    }
+    memcpy(log_msg.buf + hdr_size, payload.data(), payload.length());
+    ASSERT_TRUE(android::base::WriteFully(fd, log_msg.buf,
+                                          hdr_size + payload.length()));
+  }
+}
+
+TEST(liblog, android_logger_list_set_file) {
+  static const size_t num = 10;
+  TemporaryFile tf;
+  write_dump(tf.fd, num);
+
+  for (unsigned int tail : { 0U, 3U }) {
+    struct logger_list* logger_list =
+        android_logger_list_alloc(ANDROID_LOG_RDONLY | ANDROID_LOG_NONBLOCK,
+                                  tail, 0);
+    ASSERT_TRUE(NULL != logger_list);
+    ASSERT_EQ(0, android_logger_list_set_file(logger_list, tf.path));
+    ASSERT_TRUE(NULL != android_logger_open(logger_list, LOG_ID_MAIN));
+
+    // all but the v4 system records, the v1 one can only be main
+    std::vector<size_t> read;
+    log_msg log_msg;
+    int ret;
+    while ((ret = android_logger_list_read(logger_list, &log_msg)) > 0) {
+      EXPECT_EQ(sizeof(log_msg.entry_v4), log_msg.entry.hdr_size);
+      EXPECT_EQ(LOG_ID_MAIN, log_msg.id());
+      AndroidLogEntry entry;
+      ASSERT_EQ(0, android_log_processLogBuffer(&log_msg.entry_v1, &entry));
+      EXPECT_STREQ("liblog.file", entry.tag);
+      read.push_back(entry.pid - 1000);
+    }
+    // a dump only ever ends
+    EXPECT_EQ(-EAGAIN, ret);
+
+    std::vector<size_t> expected = { 0, 1, 2, 4, 6, 8 };
+    if (tail) expected.erase(expected.begin(), expected.end() - tail);
+    EXPECT_EQ(expected, read);
+
+    android_logger_list_free(logger_list);
+  }
+
+  // a truncated last record is an error, not the end of the dump
+  ASSERT_EQ(0, ftruncate(tf.fd, lseek(tf.fd, 0, SEEK_END) - 1));
+  struct logger_list* logger_list =
+      android_logger_list_alloc(ANDROID_LOG_RDONLY | ANDROID_LOG_NONBLOCK, 0, 0);
+  ASSERT_EQ(0, android_logger_list_set_file(logger_list, tf.path));
+  ASSERT_TRUE(NULL != android_logger_open(logger_list, LOG_ID_SYSTEM));
+  log_msg log_msg;
+  int ret;
+  while ((ret = android_logger_list_read(logger_list, &log_msg)) > 0) {
+  }
+  EXPECT_EQ(-EIO, ret);
+  android_logger_list_free(logger_list);
+}
+#endif  // USING_LOGGER_DEFAULT
+
 #if (defined(__ANDROID__) || defined(USING_LOGGER_LOCAL))
 static void print_transport(const char* prefix, int logger) {
   static const char orstr[] = " | ";
@@ -3039,6 +3236,67 @@ TEST(liblog, android_log_write_list_buffer) {
             0);
   EXPECT_STREQ(msgBuf, "[1005,tag_def,(tag|1),(name|3),(format|3)]");
 }
+
+TEST(liblog, android_log_event_stack_list) {
+  __android_log_event_list heap(1005);
+  heap << 1005 << "tag_def";
+  heap.begin();
+  heap << (int64_t)-2 << 1.5f << true;
+  heap.end();
+  heap << std::string("(tag|1)");
+  std::string expected(heap);
+  heap.close();
+
+  android_log_event_stack_list<> stack(1005);
+  EXPECT_TRUE(stack.Append(1005, "tag_def"));
+  stack.begin();
+  EXPECT_TRUE(stack.Append((int64_t)-2, 1.5f, true));
+  stack.end();
+  stack << std::string("(tag|1)");
+  EXPECT_EQ(0, stack.status());
+
+  const char* msg;
+  ssize_t len = stack.payload(&msg);
+  ASSERT_LT(0, len);
+  EXPECT_EQ(expected, std::string(msg, len));
+
+  char msgBuf[1024];
+  memset(msgBuf, 0, sizeof(msgBuf));
+  EXPECT_EQ(0, android_log_buffer_to_string(msg, len, msgBuf, sizeof(msgBuf)));
+  EXPECT_STREQ(msgBuf, "[1005,tag_def,[-2,1.500000,1],(tag|1)]");
+
+  // A single element is not a list
+  android_log_event_stack_list<16> single(1005);
+  single << (int32_t)42;
+  ASSERT_EQ(5, single.payload(&msg));
+  EXPECT_EQ(EVENT_TYPE_INT, msg[0]);
+
+  // An open list can not be sent
+  single.begin();
+  EXPECT_EQ(-EIO, single.payload(&msg));
+}
+
+TEST(liblog, android_log_event_stack_list_overflow) {
+  // Room for the list header, one int and part of a string
+  android_log_event_stack_list<16> ctx(1005);
+  ctx << (int32_t)1 << "truncated string";
+  EXPECT_EQ(0, ctx.status());
+  const char* msg;
+  ASSERT_EQ(16, ctx.payload(&msg));
+  EXPECT_EQ(std::string("trun"), std::string(msg + 12, 4));
+
+  ctx << (int32_t)2;
+  EXPECT_EQ(-EIO, ctx.status());
+  ASSERT_EQ(16, ctx.payload(&msg));
+
+  android_log_event_stack_list<> nest(1005);
+  for (size_t i = 0; i < ANDROID_MAX_LIST_NEST_DEPTH; ++i) {
+    EXPECT_LE(0, nest.begin());
+  }
+  EXPECT_GT(0, nest.begin());
+  /* One more for good measure, must be permanently unhappy */
+  EXPECT_GT(0, nest.begin());
+}
 #endif  // USING_LOGGER_DEFAULT
 
 #ifdef USING_LOGGER_DEFAULT  // Do not retest pmsg functionality
@@ -3340,3 +3598,107 @@ TEST(liblog, android_lookupEventTagNum) {
 #endif
 }
 #endif  // USING_LOGGER_DEFAULT
+
+#ifdef USING_LOGGER_DEFAULT  // Do not retest event mapping functionality
+TEST(liblog, android_event_tag_table) {
+#ifdef __ANDROID__
+  struct stat st;
+  ASSERT_EQ(0, stat(EVENT_TAG_MAP_FILE, &st));
+  const android_event_tag_table_header_t* table =
+      __android_event_tag_table_open(NULL, st.st_size);
+  if (!table) {
+    GTEST_LOG_(INFO) << "No up to date " EVENT_TAG_TABLE_FILE "\n";
+    return;
+  }
+  EXPECT_TRUE(NULL ==
+              __android_event_tag_table_open(NULL, st.st_size + 1));
+
+  EventTagMap* map = android_openEventTagMap(NULL);
+  ASSERT_TRUE(NULL != map);
+  for (uint32_t i = 0; i < table->count; ++i) {
+    const android_event_tag_table_entry_t* e =
+        __android_event_tag_table_entry(table, i);
+    EXPECT_EQ(e, __android_event_tag_table_find_tag(table, e->tag));
+    const char* name = __android_event_tag_table_string(table, e->name);
+    const android_event_tag_table_entry_t* n =
+        __android_event_tag_table_find_name(table, name, e->name_len);
+    while (n && (n != e)) {
+      n = (n->next_name == EVENT_TAG_TABLE_NONE)
+              ? NULL
+              : __android_event_tag_table_entry(table, n->next_name);
+    }
+    EXPECT_EQ(e, n);
+
+    size_t len;
+    EXPECT_EQ(name, android_lookupEventTag_len(map, &len, e->tag));
+    EXPECT_EQ(e->name_len, len);
+  }
+  android_closeEventTagMap(map);
+  __android_event_tag_table_close(table);
+#else
+  GTEST_LOG_(INFO) << "This test does nothing.\n";
+#endif
+}
+#endif  // USING_LOGGER_DEFAULT
+
+#ifdef USING_LOGGER_DEFAULT  // Do not retest logprint functionality
+TEST(liblog, android_log_formatLogLines) {
+  static const char tag[] = "liblog";
+  static const char* messages[] = {
+    "plain ascii message that spans several words",
+    "two\nlines",
+    "escape\\ \a\b\v\f\r and tab\t and utf8 \xc3\xa9 and bad \xff\x01",
+  };
+  static const size_t num_messages = sizeof(messages) / sizeof(messages[0]);
+  static const size_t num_entries = num_messages * 2;
+  AndroidLogEntry entries[num_entries];
+  for (size_t i = 0; i < num_entries; ++i) {
+    const char* message = messages[i % num_messages];
+    entries[i].tv_sec = 1000000000 + (i / 2);  // same second pairs
+    entries[i].tv_nsec = i * 1000;
+    entries[i].priority = ANDROID_LOG_INFO;
+    entries[i].uid = -1;
+    entries[i].pid = getpid();
+    entries[i].tid = gettid();
+    entries[i].tag = tag;
+    entries[i].tagLen = strlen(tag);
+    entries[i].message = message;
+    entries[i].messageLen = strlen(message);
+  }
+
+  AndroidLogFormat* logformat = android_log_format_new();
+  ASSERT_TRUE(NULL != logformat);
+  android_log_setPrintFormat(logformat, FORMAT_THREADTIME);
+  android_log_setPrintFormat(logformat, FORMAT_MODIFIER_PRINTABLE);
+  android_log_setPrintFormat(logformat, FORMAT_MODIFIER_ZONE);
+
+  std::string expected;
+  for (size_t i = 0; i < num_entries; ++i) {
+    char buf[512];
+    size_t len;
+    char* line = android_log_formatLogLine(logformat, buf, sizeof(buf),
+                                           &entries[i], &len);
+    ASSERT_TRUE(NULL != line);
+    expected += std::string(line, len);
+    if (line != buf) free(line);
+  }
+
+  char buf[4096];
+  size_t len = 0;
+  EXPECT_EQ(num_entries,
+            android_log_formatLogLines(logformat, buf, sizeof(buf), entries,
+                                       num_entries, &len));
+  EXPECT_EQ(expected, std::string(buf, len));
+
+  // Stops short, rather than allocating, once the buffer is full
+  size_t first = expected.find('\n') + 1;
+  EXPECT_EQ(1U, android_log_formatLogLines(logformat, buf, first + 2, entries,
+                                           num_entries, &len));
+  EXPECT_EQ(first, len);
+  EXPECT_EQ(0U, android_log_formatLogLines(logformat, buf, first - 1, entries,
+                                           num_entries, &len));
+  EXPECT_EQ(0U, len);
+
+  android_log_format_free(logformat);
+}
+#endif  // USING_LOGGER_DEFAULT
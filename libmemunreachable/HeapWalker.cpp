@@ -16,10 +16,13 @@
 
 #include <errno.h>
 #include <inttypes.h>
+#include <pthread.h>
 #include <sys/mman.h>
 #include <unistd.h>
 
+#include <algorithm>
 #include <map>
+#include <tuple>
 #include <utility>
 
 #include "Allocator.h"
@@ -35,11 +38,13 @@ bool HeapWalker::Allocation(uintptr_t begin, uintptr_t end) {
     end = begin + 1;
   }
   Range range{begin, end};
-  auto inserted = allocations_.insert(std::pair<Range, AllocationInfo>(range, AllocationInfo{}));
+  auto inserted =
+      allocations_.emplace(std::piecewise_construct, std::forward_as_tuple(range), std::tuple<>());
   if (inserted.second) {
     valid_allocations_range_.begin = std::min(valid_allocations_range_.begin, begin);
     valid_allocations_range_.end = std::max(valid_allocations_range_.end, end);
     allocation_bytes_ += range.size();
+    allocation_index_valid_ = false;
     return true;
   } else {
     Range overlap = inserted.first->first;
@@ -52,36 +57,90 @@ bool HeapWalker::Allocation(uintptr_t begin, uintptr_t end) {
   }
 }
 
-bool HeapWalker::WordContainsAllocationPtr(uintptr_t word_ptr, Range* range, AllocationInfo** info) {
-  walking_ptr_ = word_ptr;
+bool HeapWalker::WordContainsAllocationPtr(uintptr_t word_ptr, Range* range, AllocationInfo** info,
+                                           size_t thread) {
+  walking_ptrs_[thread].store(word_ptr, std::memory_order_relaxed);
   // This access may segfault if the process under test has done something strange,
   // for example mprotect(PROT_NONE) on a native heap page.  If so, it will be
   // caught and handled by mmaping a zero page over the faulting page.
   uintptr_t value = *reinterpret_cast<uintptr_t*>(word_ptr);
-  walking_ptr_ = 0;
+  walking_ptrs_[thread].store(0, std::memory_order_relaxed);
   if (value >= valid_allocations_range_.begin && value < valid_allocations_range_.end) {
-    AllocationMap::iterator it = allocations_.find(Range{value, value + 1});
-    if (it != allocations_.end()) {
-      *range = it->first;
-      *info = &it->second;
+    size_t bucket = (value - valid_allocations_range_.begin) >> bucket_shift_;
+    // Allocations are sorted and don't overlap, so the one that contains value,
+    // if any, is the last one to begin at or before it, and that is at most one
+    // past the first allocation that extends into the next bucket.
+    auto first = allocation_index_.begin() + allocation_buckets_[bucket];
+    auto last = allocation_index_.begin() +
+                std::min<size_t>(allocation_buckets_[bucket + 1] + 1, allocation_index_.size());
+    auto it = std::upper_bound(first, last, value, [](uintptr_t v, const IndexedAllocation& a) {
+      return v < a.range.begin;
+    });
+    if (it != first && value < (it - 1)->range.end) {
+      *range = (it - 1)->range;
+      *info = (it - 1)->info;
       return true;
     }
   }
   return false;
 }
 
-void HeapWalker::RecurseRoot(const Range& root) {
-  allocator::vector<Range> to_do(1, root, allocator_);
+void HeapWalker::BuildAllocationIndex() {
+  allocation_index_.clear();
+  allocation_index_.reserve(allocations_.size());
+  for (auto& it : allocations_) {
+    allocation_index_.push_back(IndexedAllocation{it.first, &it.second});
+  }
+
+  // About one bucket per allocation.
+  allocation_buckets_.clear();
+  bucket_shift_ = 0;
+  if (!allocation_index_.empty()) {
+    uintptr_t span = valid_allocations_range_.end - valid_allocations_range_.begin;
+    while ((span >> bucket_shift_) > allocation_index_.size()) {
+      bucket_shift_++;
+    }
+    size_t num_buckets = ((span - 1) >> bucket_shift_) + 1;
+    allocation_buckets_.reserve(num_buckets + 1);
+    size_t i = 0;
+    for (size_t bucket = 0; bucket < num_buckets; bucket++) {
+      uintptr_t bucket_begin = valid_allocations_range_.begin + (bucket << bucket_shift_);
+      while (i < allocation_index_.size() && allocation_index_[i].range.end <= bucket_begin) {
+        i++;
+      }
+      allocation_buckets_.push_back(i);
+    }
+    // Past the last bucket, so a lookup can always read the next entry.
+    allocation_buckets_.push_back(allocation_index_.size());
+  }
+
+  allocation_index_valid_ = true;
+}
+
+void HeapWalker::RecurseRoot(const Range& root, size_t thread, allocator::vector<Range>& to_do) {
+  to_do.push_back(root);
   while (!to_do.empty()) {
     Range range = to_do.back();
     to_do.pop_back();
 
-    ForEachPtrInRange(range, [&](Range& ref_range, AllocationInfo* ref_info) {
-      if (!ref_info->referenced_from_root) {
-        ref_info->referenced_from_root = true;
-        to_do.push_back(ref_range);
-      }
-    });
+    ForEachPtrInRange(range,
+                      [&](Range& ref_range, AllocationInfo* ref_info) {
+                        // Check before the exchange to avoid dirtying the cache line of
+                        // allocations that are already marked.
+                        if (!ref_info->referenced_from_root.load(std::memory_order_relaxed) &&
+                            !ref_info->referenced_from_root.exchange(true,
+                                                                     std::memory_order_relaxed)) {
+                          to_do.push_back(ref_range);
+                        }
+                      },
+                      thread);
+  }
+}
+
+void HeapWalker::MarkRootChunks(size_t thread) {
+  allocator::vector<Range> to_do(allocator_);
+  for (size_t i = next_root_chunk_++; i < root_chunks_.size(); i = next_root_chunk_++) {
+    RecurseRoot(root_chunks_[i], thread, to_do);
   }
 }
 
@@ -101,17 +160,57 @@ size_t HeapWalker::AllocationBytes() {
   return allocation_bytes_;
 }
 
-bool HeapWalker::DetectLeaks() {
-  // Recursively walk pointers from roots to mark referenced allocations
-  for (auto it = roots_.begin(); it != roots_.end(); it++) {
-    RecurseRoot(*it);
-  }
-
+bool HeapWalker::DetectLeaks(size_t num_threads) {
   Range vals;
   vals.begin = reinterpret_cast<uintptr_t>(root_vals_.data());
   vals.end = vals.begin + root_vals_.size() * sizeof(uintptr_t);
 
-  RecurseRoot(vals);
+  // ForEachPtrInRange reads every aligned word that starts inside a chunk, so
+  // splitting a root neither skips nor repeats any word.
+  root_chunks_.clear();
+  root_chunks_.push_back(vals);
+  for (auto it = roots_.begin(); it != roots_.end(); it++) {
+    for (uintptr_t begin = it->begin; begin < it->end; begin += kRootChunkSize) {
+      root_chunks_.push_back(Range{begin, std::min(it->end, begin + kRootChunkSize)});
+    }
+  }
+  next_root_chunk_ = 0;
+
+  BuildAllocationIndex();
+
+  // Recursively walk pointers from roots to mark referenced allocations.  Each
+  // thread claims root chunks until there are none left, and follows every
+  // pointer it finds itself.  Threads are created with pthread_create rather
+  // than std::thread, which would allocate with malloc.
+  num_threads = std::max<size_t>(1, std::min({num_threads, kMaxThreads, root_chunks_.size()}));
+  struct MarkThread {
+    HeapWalker* walker;
+    size_t thread;
+    pthread_t pthread;
+    bool started;
+  } threads[kMaxThreads];
+  for (size_t i = 1; i < num_threads; i++) {
+    threads[i] = MarkThread{this, i, pthread_t{}, false};
+    threads[i].started =
+        pthread_create(&threads[i].pthread, nullptr,
+                       [](void* arg) -> void* {
+                         MarkThread* t = reinterpret_cast<MarkThread*>(arg);
+                         t->walker->MarkRootChunks(t->thread);
+                         return nullptr;
+                       },
+                       &threads[i]) == 0;
+    if (!threads[i].started) {
+      MEM_ALOGW("failed to start heap walker thread %zu, continuing with fewer", i);
+    }
+  }
+
+  MarkRootChunks(0);
+
+  for (size_t i = 1; i < num_threads; i++) {
+    if (threads[i].started) {
+      pthread_join(threads[i].pthread, nullptr);
+    }
+  }
 
   return true;
 }
@@ -164,7 +263,11 @@ static bool MapOverPage(void* addr) {
 void HeapWalker::HandleSegFault(ScopedSignalHandler& handler, int signal, siginfo_t* si,
                                 void* /*uctx*/) {
   uintptr_t addr = reinterpret_cast<uintptr_t>(si->si_addr);
-  if (addr != walking_ptr_) {
+  if (std::none_of(std::begin(walking_ptrs_), std::end(walking_ptrs_),
+                   [&](const std::atomic<uintptr_t>& walking_ptr) {
+                     return walking_ptr != 0 && addr >= walking_ptr &&
+                            addr < walking_ptr + kBlockSize;
+                   })) {
     handler.reset();
     return;
   }
@@ -19,6 +19,8 @@
 
 #include <signal.h>
 
+#include <atomic>
+
 #include "android-base/macros.h"
 
 #include "Allocator.h"
@@ -50,12 +52,20 @@ class HeapWalker {
       : allocator_(allocator),
         allocations_(allocator),
         allocation_bytes_(0),
+        allocation_index_(allocator),
+        allocation_buckets_(allocator),
+        bucket_shift_(0),
+        allocation_index_valid_(false),
         roots_(allocator),
         root_vals_(allocator),
-        segv_handler_(allocator),
-        walking_ptr_(0) {
+        root_chunks_(allocator),
+        next_root_chunk_(0),
+        segv_handler_(allocator) {
     valid_allocations_range_.end = 0;
     valid_allocations_range_.begin = ~valid_allocations_range_.end;
+    for (auto& walking_ptr : walking_ptrs_) {
+      walking_ptr = 0;
+    }
 
     segv_handler_.install(
         SIGSEGV, [=](ScopedSignalHandler& handler, int signal, siginfo_t* siginfo, void* uctx) {
@@ -68,25 +78,50 @@ class HeapWalker {
   void Root(uintptr_t begin, uintptr_t end);
   void Root(const allocator::vector<uintptr_t>& vals);
 
-  bool DetectLeaks();
+  // Marks everything reachable from the roots, splitting the roots between
+  // up to num_threads threads, including the calling one.
+  bool DetectLeaks(size_t num_threads = 1);
 
   bool Leaked(allocator::vector<Range>&, size_t limit, size_t* num_leaks, size_t* leak_bytes);
   size_t Allocations();
   size_t AllocationBytes();
 
+  // thread is the index of the calling thread in DetectLeaks, 0 outside of it.
   template <class F>
-  void ForEachPtrInRange(const Range& range, F&& f);
+  void ForEachPtrInRange(const Range& range, F&& f, size_t thread = 0);
 
   template <class F>
   void ForEachAllocation(F&& f);
 
   struct AllocationInfo {
-    bool referenced_from_root;
+    // Set by whichever DetectLeaks thread reaches the allocation first.
+    std::atomic<bool> referenced_from_root;
   };
 
+  static constexpr size_t kMaxThreads = 8;
+
  private:
-  void RecurseRoot(const Range& root);
-  bool WordContainsAllocationPtr(uintptr_t ptr, Range* range, AllocationInfo** info);
+  // Roots are split into chunks of at most this size, claimed one at a time by
+  // the DetectLeaks threads, so that one huge root doesn't serialize the walk.
+  static constexpr size_t kRootChunkSize = 256 * 1024;
+
+  // Aligned blocks of this size are first checked as a whole against
+  // valid_allocations_range_, in a loop the compiler can vectorize, and
+  // skipped if none of their words could point to an allocation.
+  static constexpr size_t kBlockSize = 64;
+
+  // The allocations in address order, for the lookups of the heap walk.
+  struct IndexedAllocation {
+    Range range;
+    AllocationInfo* info;
+  };
+
+  void BuildAllocationIndex();
+  bool BlockMayContainAllocationPtr(uintptr_t block, size_t thread);
+  void MarkRootChunks(size_t thread);
+  void RecurseRoot(const Range& root, size_t thread, allocator::vector<Range>& to_do);
+  bool WordContainsAllocationPtr(uintptr_t ptr, Range* range, AllocationInfo** info,
+                                 size_t thread);
   void HandleSegFault(ScopedSignalHandler&, int, siginfo_t*, void*);
 
   DISALLOW_COPY_AND_ASSIGN(HeapWalker);
@@ -96,23 +131,65 @@ class HeapWalker {
   size_t allocation_bytes_;
   Range valid_allocations_range_;
 
+  // allocation_index_ sorted by address, and for each 1 << bucket_shift_ bytes
+  // of valid_allocations_range_ the index of the first allocation that ends
+  // after the start of that bucket, which narrows the binary search of a
+  // lookup down to the allocations overlapping one bucket.  Rebuilt on the
+  // first walk after an allocation is added.
+  allocator::vector<IndexedAllocation> allocation_index_;
+  allocator::vector<uint32_t> allocation_buckets_;
+  unsigned int bucket_shift_;
+  bool allocation_index_valid_;
+
   allocator::vector<Range> roots_;
   allocator::vector<uintptr_t> root_vals_;
 
+  allocator::vector<Range> root_chunks_;
+  std::atomic<size_t> next_root_chunk_;
+
   ScopedSignalHandler segv_handler_;
-  uintptr_t walking_ptr_;
+  // The word or block each thread is reading, to recognize faults in
+  // HandleSegFault.
+  std::atomic<uintptr_t> walking_ptrs_[kMaxThreads];
 };
 
+inline bool HeapWalker::BlockMayContainAllocationPtr(uintptr_t block, size_t thread) {
+  const uintptr_t begin = valid_allocations_range_.begin;
+  const uintptr_t size = valid_allocations_range_.end - valid_allocations_range_.begin;
+  const uintptr_t* words = reinterpret_cast<const uintptr_t*>(block);
+
+  walking_ptrs_[thread].store(block, std::memory_order_relaxed);
+  // Branch free so it compiles to a few vector compares.
+  uintptr_t in_range = 0;
+  for (size_t i = 0; i < kBlockSize / sizeof(uintptr_t); i++) {
+    in_range |= (words[i] - begin) < size;
+  }
+  walking_ptrs_[thread].store(0, std::memory_order_relaxed);
+
+  return in_range != 0;
+}
+
 template <class F>
-inline void HeapWalker::ForEachPtrInRange(const Range& range, F&& f) {
+inline void HeapWalker::ForEachPtrInRange(const Range& range, F&& f, size_t thread) {
+  // DetectLeaks builds the index before starting threads, this only happens
+  // for walks outside of it.
+  if (!allocation_index_valid_) {
+    BuildAllocationIndex();
+  }
+
   uintptr_t begin = (range.begin + (sizeof(uintptr_t) - 1)) & ~(sizeof(uintptr_t) - 1);
   // TODO(ccross): we might need to consider a pointer to the end of a buffer
   // to be inside the buffer, which means the common case of a pointer to the
   // beginning of a buffer may keep two ranges live.
   for (uintptr_t i = begin; i < range.end; i += sizeof(uintptr_t)) {
+    if ((i & (kBlockSize - 1)) == 0 && range.end - i >= kBlockSize &&
+        !BlockMayContainAllocationPtr(i, thread)) {
+      i += kBlockSize - sizeof(uintptr_t);
+      continue;
+    }
     Range ref_range;
     AllocationInfo* ref_info;
-    if (WordContainsAllocationPtr(i, &ref_range, &ref_info)) {
+    if (WordContainsAllocationPtr(i, &ref_range, &ref_info, thread)) {
       f(ref_range, ref_info);
     }
   }
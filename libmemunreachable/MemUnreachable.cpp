@@ -15,8 +15,11 @@
  */
 
 #include <inttypes.h>
+#include <limits.h>
 #include <string.h>
+#include <unistd.h>
 
+#include <chrono>
 #include <functional>
 #include <iomanip>
 #include <mutex>
@@ -133,7 +136,10 @@ bool MemUnreachable::GetUnreachableMemory(allocator::vector<Leak>& leaks, size_t
   MEM_ALOGI("sweeping process %d for unreachable memory", pid_);
   leaks.clear();
 
-  if (!heap_walker_.DetectLeaks()) {
+  // The heap walker process runs after all the threads have been released, so
+  // this doesn't pause the target process, but it still holds up the caller.
+  long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+  if (!heap_walker_.DetectLeaks(cpus > 0 ? cpus : 1)) {
     return false;
   }
 
@@ -155,54 +161,75 @@ bool MemUnreachable::GetUnreachableMemory(allocator::vector<Leak>& leaks, size_t
     return false;
   }
 
-  allocator::unordered_map<Leak::Backtrace, Leak*> backtrace_map{allocator_};
+  auto fill_leak = [](Leak* leak, const LeakFolding::Leak& folded) {
+    leak->begin = folded.range.begin;
+    leak->size = folded.range.size();
+    leak->referenced_count = folded.referenced_count;
+    leak->referenced_size = folded.referenced_size;
+    leak->total_size = leak->size + leak->referenced_size;
+    memcpy(leak->contents, reinterpret_cast<void*>(folded.range.begin),
+           std::min(leak->size, Leak::contents_length));
+  };
+
+  // Only the largest limit leaks are kept, in a heap with the smallest of them
+  // at the front, so memory use and the final sort are bounded by limit rather
+  // than by the number of leaks.
+  auto larger = [](const Leak& a, const Leak& b) { return a.total_size > b.total_size; };
+  leaks.reserve(std::min(limit, leaked.size()));
+  auto keep_leak = [&](const Leak& leak) {
+    if (leaks.size() < limit) {
+      leaks.push_back(leak);
+      std::push_heap(leaks.begin(), leaks.end(), larger);
+    } else if (limit > 0 && leak.total_size > leaks.front().total_size) {
+      std::pop_heap(leaks.begin(), leaks.end(), larger);
+      leaks.back() = leak;
+      std::push_heap(leaks.begin(), leaks.end(), larger);
+    }
+  };
 
-  // Prevent reallocations of backing memory so we can store pointers into it
-  // in backtrace_map.
-  leaks.reserve(leaked.size());
+  // Leaks with the same backtrace are merged into one group, which can only
+  // be ranked once all of them have been seen.  Leaks without a backtrace are
+  // ranked right away.
+  allocator::unordered_map<Leak::Backtrace, size_t> backtrace_map{allocator_};
+  allocator::vector<Leak> backtrace_leaks{allocator_};
 
   for (auto& it : leaked) {
-    leaks.emplace_back();
-    Leak* leak = &leaks.back();
+    Leak leak{};
 
     ssize_t num_backtrace_frames = malloc_backtrace(
-        reinterpret_cast<void*>(it.range.begin), leak->backtrace.frames, leak->backtrace.max_frames);
-    if (num_backtrace_frames > 0) {
-      leak->backtrace.num_frames = num_backtrace_frames;
-
-      auto inserted = backtrace_map.emplace(leak->backtrace, leak);
-      if (!inserted.second) {
-        // Leak with same backtrace already exists, drop this one and
-        // increment similar counts on the existing one.
-        leaks.pop_back();
-        Leak* similar_leak = inserted.first->second;
-        similar_leak->similar_count++;
-        similar_leak->similar_size += it.range.size();
-        similar_leak->similar_referenced_count += it.referenced_count;
-        similar_leak->similar_referenced_size += it.referenced_size;
-        similar_leak->total_size += it.range.size();
-        similar_leak->total_size += it.referenced_size;
-        continue;
-      }
+        reinterpret_cast<void*>(it.range.begin), leak.backtrace.frames, leak.backtrace.max_frames);
+    if (num_backtrace_frames <= 0) {
+      fill_leak(&leak, it);
+      keep_leak(leak);
+      continue;
     }
 
-    leak->begin = it.range.begin;
-    leak->size = it.range.size();
-    leak->referenced_count = it.referenced_count;
-    leak->referenced_size = it.referenced_size;
-    leak->total_size = leak->size + leak->referenced_size;
-    memcpy(leak->contents, reinterpret_cast<void*>(it.range.begin),
-           std::min(leak->size, Leak::contents_length));
+    leak.backtrace.num_frames = num_backtrace_frames;
+    auto inserted = backtrace_map.emplace(leak.backtrace, backtrace_leaks.size());
+    if (!inserted.second) {
+      // Leak with same backtrace already exists, drop this one and
+      // increment similar counts on the existing one.
+      Leak* similar_leak = &backtrace_leaks[inserted.first->second];
+      similar_leak->similar_count++;
+      similar_leak->similar_size += it.range.size();
+      similar_leak->similar_referenced_count += it.referenced_count;
+      similar_leak->similar_referenced_size += it.referenced_size;
+      similar_leak->total_size += it.range.size();
+      similar_leak->total_size += it.referenced_size;
+      continue;
+    }
+
+    fill_leak(&leak, it);
+    backtrace_leaks.push_back(leak);
+  }
+
+  for (auto& leak : backtrace_leaks) {
+    keep_leak(leak);
   }
 
   MEM_ALOGI("folding done");
 
-  std::sort(leaks.begin(), leaks.end(),
-            [](const Leak& a, const Leak& b) { return a.total_size > b.total_size; });
-
-  if (leaks.size() > limit) {
-    leaks.resize(limit);
-  }
+  std::sort(leaks.begin(), leaks.end(), larger);
 
   return true;
 }
@@ -269,7 +296,8 @@ static inline const char* plural(T val) {
   return (val == 1) ? "" : "s";
 }
 
-bool GetUnreachableMemory(UnreachableMemoryInfo& info, size_t limit) {
+bool GetUnreachableMemory(UnreachableMemoryInfo& info, size_t limit,
+                          const std::function<void(const Leak&)>& leak_callback) {
   int parent_pid = getpid();
   int parent_tid = gettid();
 
@@ -286,7 +314,6 @@ bool GetUnreachableMemory(UnreachableMemoryInfo& info, size_t limit) {
 
     ThreadCapture thread_capture(parent_pid, heap);
     allocator::vector<ThreadInfo> thread_info(heap);
-    allocator::vector<Mapping> mappings(heap);
     allocator::vector<uintptr_t> refs(heap);
 
     // ptrace all the threads
@@ -301,12 +328,6 @@ bool GetUnreachableMemory(UnreachableMemoryInfo& info, size_t limit) {
       return 1;
     }
 
-    // snapshot /proc/pid/maps
-    if (!ProcessMappings(parent_pid, mappings)) {
-      continue_parent_sem.Post();
-      return 1;
-    }
-
     if (!BinderReferences(refs)) {
       continue_parent_sem.Post();
       return 1;
@@ -335,6 +356,16 @@ bool GetUnreachableMemory(UnreachableMemoryInfo& info, size_t limit) {
         _exit(1);
       }
 
+      // Only the registers and binder references have to be read with the
+      // threads stopped.  The heap walker process has a copy of the memory map
+      // as it was at fork time, so snapshot /proc/self/maps here rather than
+      // /proc/pid/maps in the collection thread, after the threads have been
+      // released.
+      allocator::vector<Mapping> mappings(heap);
+      if (!ProcessMappings(getpid(), mappings)) {
+        _exit(4);
+      }
+
       MemUnreachable unreachable{parent_pid, heap};
 
       if (!unreachable.CollectAllocations(thread_info, mappings, refs)) {
@@ -353,7 +384,12 @@ bool GetUnreachableMemory(UnreachableMemoryInfo& info, size_t limit) {
       ok = ok && pipe.Sender().Send(allocation_bytes);
       ok = ok && pipe.Sender().Send(num_leaks);
       ok = ok && pipe.Sender().Send(leak_bytes);
-      ok = ok && pipe.Sender().SendVector(leaks);
+      // Send the leaks one at a time, so the receiver can hand each one over as
+      // it arrives.
+      ok = ok && pipe.Sender().Send(leaks.size());
+      for (auto it = leaks.begin(); ok && it != leaks.end(); it++) {
+        ok = pipe.Sender().Send(*it);
+      }
 
       if (!ok) {
         _exit(3);
@@ -372,6 +408,9 @@ bool GetUnreachableMemory(UnreachableMemoryInfo& info, size_t limit) {
   // Original thread
   /////////////////////////////////////////////
 
+  // The other threads stay frozen from the start of the collection thread until
+  // it exits.
+  auto freeze_start = std::chrono::steady_clock::now();
   {
     // Disable malloc to get a consistent view of memory
     ScopedDisableMalloc disable_malloc;
@@ -388,6 +427,9 @@ bool GetUnreachableMemory(UnreachableMemoryInfo& info, size_t limit) {
 
   // Wait for the collection thread to exit
   int ret = thread.Join();
+  info.freeze_duration_us = std::chrono::duration_cast<std::chrono::microseconds>(
+                                std::chrono::steady_clock::now() - freeze_start)
+                                .count();
   if (ret != 0) {
     return false;
   }
@@ -404,18 +446,41 @@ bool GetUnreachableMemory(UnreachableMemoryInfo& info, size_t limit) {
   ok = ok && pipe.Receiver().Receive(&info.allocation_bytes);
   ok = ok && pipe.Receiver().Receive(&info.num_leaks);
   ok = ok && pipe.Receiver().Receive(&info.leak_bytes);
-  ok = ok && pipe.Receiver().ReceiveVector(info.leaks);
   if (!ok) {
     return false;
   }
 
-  MEM_ALOGI("unreachable memory detection done");
   MEM_ALOGE("%zu bytes in %zu allocation%s unreachable out of %zu bytes in %zu allocation%s",
             info.leak_bytes, info.num_leaks, plural(info.num_leaks), info.allocation_bytes,
             info.num_allocations, plural(info.num_allocations));
+
+  // Each leak is written to the pipe with a single write, which is only atomic
+  // up to PIPE_BUF.
+  static_assert(sizeof(Leak) <= PIPE_BUF, "Leak is too large to be sent atomically");
+  size_t num_leaks_sent = 0;
+  ok = pipe.Receiver().Receive(&num_leaks_sent);
+  Leak leak;
+  for (size_t i = 0; ok && i < num_leaks_sent; i++) {
+    ok = pipe.Receiver().Receive(&leak);
+    if (ok) {
+      leak_callback(leak);
+    }
+  }
+  // Like ~UnreachableMemoryInfo, don't leave pointers to the leaks behind.
+  memset(&leak, 0, sizeof(leak));
+  if (!ok) {
+    return false;
+  }
+
+  MEM_ALOGI("unreachable memory detection done");
   return true;
 }
 
+bool GetUnreachableMemory(UnreachableMemoryInfo& info, size_t limit) {
+  info.leaks.clear();
+  return GetUnreachableMemory(info, limit, [&](const Leak& leak) { info.leaks.push_back(leak); });
+}
+
 std::string Leak::ToString(bool log_contents) const {
   std::ostringstream oss;
 
@@ -502,6 +567,7 @@ std::string UnreachableMemoryInfo::ToString(bool log_contents) const {
   oss << num_leaks << " unreachable allocation" << plural(num_leaks);
   oss << std::endl;
   oss << "  ABI: '" ABI_STRING "'" << std::endl;
+  oss << "  Threads frozen for " << freeze_duration_us / 1000 << " ms" << std::endl;
   oss << std::endl;
 
   for (auto it = leaks.begin(); it != leaks.end(); it++) {
@@ -528,14 +594,9 @@ std::string GetUnreachableMemoryString(bool log_contents, size_t limit) {
 
 bool LogUnreachableMemory(bool log_contents, size_t limit) {
   android::UnreachableMemoryInfo info;
-  if (!android::GetUnreachableMemory(info, limit)) {
-    return false;
-  }
-
-  for (auto it = info.leaks.begin(); it != info.leaks.end(); it++) {
-    MEM_ALOGE("%s", it->ToString(log_contents).c_str());
-  }
-  return true;
+  return android::GetUnreachableMemory(info, limit, [&](const android::Leak& leak) {
+    MEM_ALOGE("%s", leak.ToString(log_contents).c_str());
+  });
 }
 
 bool NoLeaks() {
@@ -17,11 +17,13 @@
 #ifndef LIBMEMUNREACHABLE_MEMUNREACHABLE_H_
 #define LIBMEMUNREACHABLE_MEMUNREACHABLE_H_
 
+#include <stdint.h>
 #include <string.h>
 #include <sys/cdefs.h>
 
 #ifdef __cplusplus
 
+#include <functional>
 #include <string>
 #include <vector>
 
@@ -60,6 +62,8 @@ struct UnreachableMemoryInfo {
   size_t leak_bytes;
   size_t num_allocations;
   size_t allocation_bytes;
+  // How long the threads of the process were stopped to collect their state.
+  uint64_t freeze_duration_us;
 
   UnreachableMemoryInfo() {}
   ~UnreachableMemoryInfo() {
@@ -74,6 +78,13 @@ struct UnreachableMemoryInfo {
 
 bool GetUnreachableMemory(UnreachableMemoryInfo& info, size_t limit = 100);
 
+// Like GetUnreachableMemory above, but instead of collecting the largest limit
+// leaks in info.leaks, passes each of them to leak_callback as soon as it is
+// received from the heap walker process, largest first.  Copies of a Leak kept
+// by the callback should be cleared when done with, see ~UnreachableMemoryInfo.
+bool GetUnreachableMemory(UnreachableMemoryInfo& info, size_t limit,
+                          const std::function<void(const Leak&)>& leak_callback);
+
 std::string GetUnreachableMemoryString(bool log_contents = false, size_t limit = 100);
 
 }  // namespace android
@@ -0,0 +1,80 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdint.h>
+#include <sys/mman.h>
+
+#include <random>
+
+#include <benchmark/benchmark.h>
+
+#include "Allocator.h"
+#include "HeapWalker.h"
+
+namespace android {
+
+static constexpr size_t kRootSize = 8 * 1024 * 1024;
+static constexpr size_t kAllocationSize = 64;
+
+// Scans a root of random small values with one word in state.range(0) pointing
+// into one of 64k allocations, the way a walk scans mostly non-pointer data.
+static void BM_scan_root(benchmark::State& state) {
+  const size_t num_allocations = 64 * 1024;
+  // Leave gaps between the allocations, like a real heap.
+  const size_t allocations_size = num_allocations * kAllocationSize * 2;
+  void* allocations =
+      mmap(nullptr, allocations_size, PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+  void* root = mmap(nullptr, kRootSize, PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+  if (allocations == MAP_FAILED || root == MAP_FAILED) {
+    state.SkipWithError("mmap failed");
+    return;
+  }
+
+  Heap heap;
+  {
+    HeapWalker heap_walker(heap);
+    uintptr_t base = reinterpret_cast<uintptr_t>(allocations);
+    for (size_t i = 0; i < num_allocations; i++) {
+      uintptr_t begin = base + i * kAllocationSize * 2;
+      heap_walker.Allocation(begin, begin + kAllocationSize);
+    }
+
+    std::mt19937_64 random(0);
+    uintptr_t* words = reinterpret_cast<uintptr_t*>(root);
+    for (size_t i = 0; i < kRootSize / sizeof(uintptr_t); i++) {
+      if (random() % state.range(0) == 0) {
+        words[i] = base + (random() % num_allocations) * kAllocationSize * 2;
+      } else {
+        words[i] = random() % 4096;
+      }
+    }
+
+    Range root_range{reinterpret_cast<uintptr_t>(root), reinterpret_cast<uintptr_t>(root) + kRootSize};
+    size_t found = 0;
+    while (state.KeepRunning()) {
+      heap_walker.ForEachPtrInRange(root_range, [&](Range&, HeapWalker::AllocationInfo*) { found++; });
+    }
+    benchmark::DoNotOptimize(found);
+  }
+
+  state.SetBytesProcessed(state.iterations() * kRootSize);
+  state.SetItemsProcessed(state.iterations() * (kRootSize / sizeof(uintptr_t)));
+  munmap(root, kRootSize);
+  munmap(allocations, allocations_size);
+}
+BENCHMARK(BM_scan_root)->Arg(1)->Arg(16)->Arg(1024);
+
+}  // namespace android
@@ -202,4 +202,42 @@ TEST_F(HeapWalkerTest, segv) {
   ASSERT_EQ(0U, leaked.size());
 }
 
+TEST_F(HeapWalkerTest, threads) {
+  // Chains of buffers, each pointing at the next, of which all but the last one
+  // are reachable from a root big enough to be split between threads.
+  const size_t num_chains = 64;
+  const size_t chain_length = 16;
+  void* chains[num_chains][chain_length][2]{};
+  const size_t root_size = HeapWalker::kMaxThreads * 256 * 1024;
+  void* map = mmap(NULL, root_size, PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+  ASSERT_NE(MAP_FAILED, map);
+  void** root = reinterpret_cast<void**>(map);
+
+  HeapWalker heap_walker(heap_);
+  for (size_t i = 0; i < num_chains; i++) {
+    for (size_t j = 0; j < chain_length; j++) {
+      heap_walker.Allocation(buffer_begin(chains[i][j]), buffer_end(chains[i][j]));
+      if (j + 1 < chain_length) {
+        chains[i][j][0] = &chains[i][j + 1];
+      }
+    }
+    if (i + 1 < num_chains) {
+      root[i * (root_size / sizeof(void*) / num_chains)] = &chains[i][0];
+    }
+  }
+  heap_walker.Root(buffer_begin(root), buffer_begin(root) + root_size);
+
+  ASSERT_EQ(true, heap_walker.DetectLeaks(HeapWalker::kMaxThreads));
+  munmap(map, root_size);
+
+  allocator::vector<Range> leaked(heap_);
+  size_t num_leaks = 0;
+  size_t leaked_bytes = 0;
+  ASSERT_EQ(true, heap_walker.Leaked(leaked, 100, &num_leaks, &leaked_bytes));
+
+  EXPECT_EQ(chain_length, num_leaks);
+  EXPECT_EQ(chain_length * sizeof(chains[0][0]), leaked_bytes);
+  ASSERT_EQ(chain_length, leaked.size());
+}
+
 }  // namespace android
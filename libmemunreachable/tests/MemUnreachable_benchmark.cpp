@@ -0,0 +1,75 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdlib.h>
+
+#include <benchmark/benchmark.h>
+
+#include <memunreachable/memunreachable.h>
+
+// A heap of count reachable allocations of 64 bytes, each pointing to
+// the next, so the heap walk has to follow the whole chain.
+class SyntheticHeap {
+ public:
+  explicit SyntheticHeap(size_t count) {
+    for (size_t i = 0; i < count; i++) {
+      void** allocation = reinterpret_cast<void**>(malloc(64));
+      *allocation = head_;
+      head_ = allocation;
+    }
+  }
+  ~SyntheticHeap() {
+    while (head_ != nullptr) {
+      void** next = reinterpret_cast<void**>(*head_);
+      free(head_);
+      head_ = next;
+    }
+  }
+
+ private:
+  void** head_ = nullptr;
+};
+
+// Time for the whole GetUnreachableMemory call.
+static void BM_get_unreachable_memory(benchmark::State& state) {
+  SyntheticHeap heap(state.range(0));
+  while (state.KeepRunning()) {
+    android::UnreachableMemoryInfo info;
+    if (!android::GetUnreachableMemory(info, 0)) {
+      state.SkipWithError("GetUnreachableMemory failed");
+      break;
+    }
+  }
+}
+BENCHMARK(BM_get_unreachable_memory)->Arg(1 << 16)->Arg(1 << 20)->Unit(benchmark::kMillisecond);
+
+// Only the time the threads of the process are stopped for.
+static void BM_get_unreachable_memory_freeze(benchmark::State& state) {
+  SyntheticHeap heap(state.range(0));
+  while (state.KeepRunning()) {
+    android::UnreachableMemoryInfo info;
+    if (!android::GetUnreachableMemory(info, 0)) {
+      state.SkipWithError("GetUnreachableMemory failed");
+      break;
+    }
+    state.SetIterationTime(info.freeze_duration_us / 1e6);
+  }
+}
+BENCHMARK(BM_get_unreachable_memory_freeze)
+    ->Arg(1 << 16)
+    ->Arg(1 << 20)
+    ->UseManualTime()
+    ->Unit(benchmark::kMillisecond);
@@ -19,6 +19,9 @@
 #include <sys/prctl.h>
 #include <unistd.h>
 
+#include <algorithm>
+#include <vector>
+
 #include <gtest/gtest.h>
 
 #include <memunreachable/memunreachable.h>
@@ -154,6 +157,32 @@ TEST(MemunreachableTest, tls) {
   pthread_key_delete(key);
 }
 
+TEST(MemunreachableTest, callback) {
+  HiddenPointer hidden_ptr1(256);
+  HiddenPointer hidden_ptr2(1024);
+  HiddenPointer hidden_ptr3(512);
+
+  {
+    UnreachableMemoryInfo info;
+    std::vector<size_t> sizes;
+
+    ASSERT_TRUE(GetUnreachableMemory(info, 2, [&](const Leak& leak) {
+      sizes.push_back(leak.total_size);
+    }));
+    ASSERT_EQ(3U, info.num_leaks);
+    ASSERT_EQ(0U, info.leaks.size());
+    // Leaks with the same backtrace are merged into one.
+    ASSERT_GE(sizes.size(), 1U);
+    ASSERT_LE(sizes.size(), 2U);
+    ASSERT_GE(sizes[0], 1024U);
+    ASSERT_TRUE(std::is_sorted(sizes.rbegin(), sizes.rend()));
+  }
+
+  hidden_ptr1.Free();
+  hidden_ptr2.Free();
+  hidden_ptr3.Free();
+}
+
 TEST(MemunreachableTest, twice) {
   HiddenPointer hidden_ptr;
 
@@ -14,6 +14,7 @@
  * limitations under the License.
  */
 
+#include <cstddef>
 #include <cstdint>
 #include <string>
 
@@ -32,6 +33,23 @@ void LogCounter(const std::string& name, int32_t val);
 // |value| in the field |field|.
 void LogMultiAction(int32_t category, int32_t field, const std::string& value);
 
+// Adds |data| to the Tron histogram |event| in this process, to be logged
+// together with every other time it was added since the last flush.  Counts
+// are kept per thread, so adding takes no lock anyone else holds for long.
+void AddHistogram(const std::string& event, int32_t data);
+
+// Adds |val| to the Tron counter |name| in this process, to be logged as one
+// total with the rest of the additions since the last flush.
+void AddCounter(const std::string& name, int32_t val);
+
+// Logs everything added with AddHistogram() and AddCounter() since the last
+// flush, one event per histogram bucket and per counter, and returns how many
+// events that was.  This is done every kMetricsFlushIntervalSeconds, and at
+// exit, without being called.
+size_t FlushMetrics();
+
+constexpr unsigned kMetricsFlushIntervalSeconds = 60;
+
 // TODO: replace these with the metric_logger.proto definitions
 enum {
     LOGBUILDER_CATEGORY = 757,
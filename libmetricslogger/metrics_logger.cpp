@@ -16,18 +16,32 @@
 
 #include "metricslogger/metrics_logger.h"
 
+#include <stdlib.h>
+
+#include <algorithm>
+#include <chrono>
 #include <cstdlib>
+#include <limits>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <tuple>
+#include <vector>
 
 #include <log/log_event_list.h>
 
 namespace android {
 namespace metricslogger {
 
-// Mirror com.android.internal.logging.MetricsLogger#histogram().
-void LogHistogram(const std::string& event, int32_t data) {
+static void WriteHistogram(const std::string& event, int32_t data, int32_t count) {
     android_log_event_list log(MULTI_ACTION_LOG_TAG);
     log << LOGBUILDER_CATEGORY << LOGBUILDER_HISTOGRAM << LOGBUILDER_NAME << event
-        << LOGBUILDER_BUCKET << data << LOGBUILDER_VALUE << 1 << LOG_ID_EVENTS;
+        << LOGBUILDER_BUCKET << data << LOGBUILDER_VALUE << count << LOG_ID_EVENTS;
+}
+
+// Mirror com.android.internal.logging.MetricsLogger#histogram().
+void LogHistogram(const std::string& event, int32_t data) {
+    WriteHistogram(event, data, 1);
 }
 
 // Mirror com.android.internal.logging.MetricsLogger#count().
@@ -44,5 +58,131 @@ void LogMultiAction(int32_t category, int32_t field, const std::string& value) {
         << field << value << LOG_ID_EVENTS;
 }
 
+namespace {
+
+// A histogram bucket, or a counter (whose bucket is always 0).
+struct MetricKey {
+    bool histogram;
+    std::string name;
+    int32_t bucket;
+
+    bool operator<(const MetricKey& other) const {
+        return std::tie(histogram, name, bucket) <
+               std::tie(other.histogram, other.name, other.bucket);
+    }
+};
+
+using MetricTotals = std::map<MetricKey, int64_t>;
+
+void MergeTotals(MetricTotals* to, const MetricTotals& from) {
+    for (const auto& total : from) {
+        (*to)[total.first] += total.second;
+    }
+}
+
+// What one thread added since the last flush.  Only the flush ever waits on
+// its lock.
+struct MetricShard {
+    std::mutex lock;
+    MetricTotals totals;
+};
+
+struct MetricRegistry {
+    std::mutex lock;
+    std::vector<MetricShard*> shards;
+    // Left by threads that exited before the flush.
+    MetricTotals orphaned;
+    bool flusher_started = false;
+};
+
+// Never destroyed: the flusher thread and the flush at exit may run after
+// static destructors.
+MetricRegistry& Registry() {
+    static MetricRegistry* registry = new MetricRegistry();
+    return *registry;
+}
+
+void FlushAtExit() {
+    FlushMetrics();
+}
+
+void FlushPeriodically() {
+    while (true) {
+        std::this_thread::sleep_for(std::chrono::seconds(kMetricsFlushIntervalSeconds));
+        FlushMetrics();
+    }
+}
+
+class ThreadShard {
+  public:
+    ThreadShard() {
+        MetricRegistry& registry = Registry();
+        std::lock_guard<std::mutex> guard(registry.lock);
+        registry.shards.push_back(&shard_);
+        if (!registry.flusher_started) {
+            registry.flusher_started = true;
+            atexit(FlushAtExit);
+            std::thread(FlushPeriodically).detach();
+        }
+    }
+
+    ~ThreadShard() {
+        MetricRegistry& registry = Registry();
+        std::lock_guard<std::mutex> guard(registry.lock);
+        registry.shards.erase(std::find(registry.shards.begin(), registry.shards.end(), &shard_));
+        MergeTotals(&registry.orphaned, shard_.totals);
+    }
+
+    void Add(bool histogram, const std::string& name, int32_t bucket, int64_t value) {
+        std::lock_guard<std::mutex> guard(shard_.lock);
+        shard_.totals[MetricKey{histogram, name, bucket}] += value;
+    }
+
+  private:
+    MetricShard shard_;
+};
+
+thread_local ThreadShard thread_shard;
+
+int32_t ClampToInt32(int64_t value) {
+    return static_cast<int32_t>(
+        std::min<int64_t>(std::max<int64_t>(value, std::numeric_limits<int32_t>::min()),
+                          std::numeric_limits<int32_t>::max()));
+}
+
+}  // namespace
+
+void AddHistogram(const std::string& event, int32_t data) {
+    thread_shard.Add(true, event, data, 1);
+}
+
+void AddCounter(const std::string& name, int32_t val) {
+    thread_shard.Add(false, name, 0, val);
+}
+
+size_t FlushMetrics() {
+    MetricTotals totals;
+    {
+        MetricRegistry& registry = Registry();
+        std::lock_guard<std::mutex> guard(registry.lock);
+        totals.swap(registry.orphaned);
+        for (MetricShard* shard : registry.shards) {
+            std::lock_guard<std::mutex> shard_guard(shard->lock);
+            MergeTotals(&totals, shard->totals);
+            shard->totals.clear();
+        }
+    }
+
+    for (const auto& total : totals) {
+        const MetricKey& key = total.first;
+        if (key.histogram) {
+            WriteHistogram(key.name, key.bucket, ClampToInt32(total.second));
+        } else {
+            LogCounter(key.name, ClampToInt32(total.second));
+        }
+    }
+    return totals.size();
+}
+
 }  // namespace metricslogger
 }  // namespace android
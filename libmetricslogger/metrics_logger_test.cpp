@@ -16,6 +16,8 @@
 
 #include "metricslogger/metrics_logger.h"
 
+#include <thread>
+
 #include <gtest/gtest.h>
 
 TEST(MetricsLoggerTest, AddSingleBootEvent) {
@@ -26,3 +28,21 @@ TEST(MetricsLoggerTest, AddSingleBootEvent) {
 TEST(MetricsLoggerTest, AddCounterVal) {
     android::metricslogger::LogCounter("test_count", 10);
 }
+
+TEST(MetricsLoggerTest, FlushAggregated) {
+    android::metricslogger::FlushMetrics();
+
+    std::thread other([] {
+        android::metricslogger::AddCounter("test_count", 1);
+        android::metricslogger::AddHistogram("test_event", 7);
+    });
+    other.join();
+    for (int i = 0; i < 100; i++) {
+        android::metricslogger::AddCounter("test_count", 2);
+        android::metricslogger::AddHistogram("test_event", i % 2);
+    }
+
+    // One counter, and histogram buckets 0, 1 and 7, whichever thread they came from.
+    EXPECT_EQ(4u, android::metricslogger::FlushMetrics());
+    EXPECT_EQ(0u, android::metricslogger::FlushMetrics());
+}
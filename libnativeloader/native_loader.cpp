@@ -27,6 +27,7 @@
 #include "nativebridge/native_bridge.h"
 
 #include <algorithm>
+#include <chrono>
 #include <vector>
 #include <string>
 #include <mutex>
@@ -112,7 +113,10 @@ static bool is_debuggable() {
 
 class LibraryNamespaces {
  public:
-  LibraryNamespaces() : initialized_(false) { }
+  LibraryNamespaces()
+      : initialized_(false), get_parent_(nullptr), last_found_(0),
+        exported_namespaces_found_(false), vndk_ns_(nullptr), vendor_ns_(nullptr),
+        created_count_(0), create_time_(0) { }
 
   bool Create(JNIEnv* env,
               uint32_t target_sdk_version,
@@ -123,6 +127,7 @@ class LibraryNamespaces {
               jstring java_permitted_path,
               NativeLoaderNamespace* ns,
               std::string* error_msg) {
+    auto start = std::chrono::steady_clock::now();
     std::string library_path; // empty string by default.
 
     if (java_library_path != nullptr) {
@@ -174,7 +179,9 @@ class LibraryNamespaces {
       is_native_bridge = NativeBridgeIsPathSupported(library_path.c_str());
     }
 
-    std::string system_exposed_libraries = system_public_libraries_;
+    FindExportedNamespaces();
+
+    const std::string* system_exposed_libraries = &system_public_libraries_;
     const char* namespace_name = kClassloaderNamespaceName;
     android_namespace_t* vndk_ns = nullptr;
     if (is_for_vendor && !is_shared) {
@@ -192,10 +199,10 @@ class LibraryNamespaces {
       permitted_path = permitted_path + ":" + vendor_lib_path.c_str();
 
       // Also give access to LLNDK libraries since they are available to vendors
-      system_exposed_libraries = system_exposed_libraries + ":" + system_llndk_libraries_.c_str();
+      system_exposed_libraries = &vendor_exposed_libraries_;
 
       // Give access to VNDK-SP libraries from the 'vndk' namespace.
-      vndk_ns = android_get_exported_namespace(kVndkNamespaceName);
+      vndk_ns = vndk_ns_;
       LOG_ALWAYS_FATAL_IF(vndk_ns == nullptr,
                           "Cannot find \"%s\" namespace for vendor apks", kVndkNamespaceName);
 
@@ -217,12 +224,12 @@ class LibraryNamespaces {
         return false;
       }
 
-      // Note that when vendor_ns is not configured this function will return nullptr
-      // and it will result in linking vendor_public_libraries_ to the default namespace
+      // Note that when vendor_ns is not configured this is nullptr and it
+      // will result in linking vendor_public_libraries_ to the default namespace
       // which is expected behavior in this case.
-      android_namespace_t* vendor_ns = android_get_exported_namespace(kVendorNamespaceName);
+      android_namespace_t* vendor_ns = vendor_ns_;
 
-      if (!android_link_namespaces(ns, nullptr, system_exposed_libraries.c_str())) {
+      if (!android_link_namespaces(ns, nullptr, system_exposed_libraries->c_str())) {
         *error_msg = dlerror();
         return false;
       }
@@ -258,7 +265,7 @@ class LibraryNamespaces {
 
       native_bridge_namespace_t* vendor_ns = NativeBridgeGetVendorNamespace();
 
-      if (!NativeBridgeLinkNamespaces(ns, nullptr, system_exposed_libraries.c_str())) {
+      if (!NativeBridgeLinkNamespaces(ns, nullptr, system_exposed_libraries->c_str())) {
         *error_msg = NativeBridgeGetError();
         return false;
       }
@@ -274,24 +281,41 @@ class LibraryNamespaces {
     }
 
     namespaces_.push_back(std::make_pair(env->NewWeakGlobalRef(class_loader), native_loader_ns));
+    last_found_ = namespaces_.size() - 1;
+
+    auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - start);
+    created_count_++;
+    create_time_ += elapsed;
+    ALOGV("%s %zu created in %lldus, %lldus for all of them", namespace_name, created_count_,
+          static_cast<long long>(elapsed.count()), static_cast<long long>(create_time_.count()));
 
     *ns = native_loader_ns;
     return true;
   }
 
   bool FindNamespaceByClassLoader(JNIEnv* env, jobject class_loader, NativeLoaderNamespace* ns) {
-    auto it = std::find_if(namespaces_.begin(), namespaces_.end(),
-                [&](const std::pair<jweak, NativeLoaderNamespace>& value) {
-                  return env->IsSameObject(value.first, class_loader);
-                });
-    if (it != namespaces_.end()) {
+    // Each comparison is a JNI call: try the classloader last asked for or
+    // created first, as libraries tend to be loaded a few in a row for the same
+    // one, then the others newest first.
+    if (last_found_ < namespaces_.size() &&
+        env->IsSameObject(namespaces_[last_found_].first, class_loader)) {
       if (ns != nullptr) {
-        *ns = it->second;
+        *ns = namespaces_[last_found_].second;
       }
-
       return true;
     }
 
+    for (size_t i = namespaces_.size(); i-- > 0; ) {
+      if (i != last_found_ && env->IsSameObject(namespaces_[i].first, class_loader)) {
+        last_found_ = i;
+        if (ns != nullptr) {
+          *ns = namespaces_[i].second;
+        }
+        return true;
+      }
+    }
+
     return false;
   }
 
@@ -349,6 +373,7 @@ class LibraryNamespaces {
     sonames.clear();
     ReadConfig(kLlndkNativeLibrariesSystemConfigPathFromRoot, &sonames);
     system_llndk_libraries_ = base::Join(sonames, ':');
+    vendor_exposed_libraries_ = system_public_libraries_ + ":" + system_llndk_libraries_;
 
     sonames.clear();
     ReadConfig(kVndkspNativeLibrariesSystemConfigPathFromRoot, &sonames);
@@ -363,6 +388,7 @@ class LibraryNamespaces {
 
   void Reset() {
     namespaces_.clear();
+    last_found_ = 0;
   }
 
  private:
@@ -436,13 +462,28 @@ class LibraryNamespaces {
     return initialized_;
   }
 
+  // The linker's exported namespaces are there from the start and never change,
+  // look them up once.
+  void FindExportedNamespaces() {
+    if (exported_namespaces_found_) {
+      return;
+    }
+    vndk_ns_ = android_get_exported_namespace(kVndkNamespaceName);
+    vendor_ns_ = android_get_exported_namespace(kVendorNamespaceName);
+    exported_namespaces_found_ = true;
+  }
+
   jobject GetParentClassLoader(JNIEnv* env, jobject class_loader) {
-    jclass class_loader_class = env->FindClass("java/lang/ClassLoader");
-    jmethodID get_parent = env->GetMethodID(class_loader_class,
-                                            "getParent",
-                                            "()Ljava/lang/ClassLoader;");
+    // java.lang.ClassLoader is never unloaded, so neither is the method.
+    if (get_parent_ == nullptr) {
+      jclass class_loader_class = env->FindClass("java/lang/ClassLoader");
+      get_parent_ = env->GetMethodID(class_loader_class,
+                                     "getParent",
+                                     "()Ljava/lang/ClassLoader;");
+      env->DeleteLocalRef(class_loader_class);
+    }
 
-    return env->CallObjectMethod(class_loader, get_parent);
+    return env->CallObjectMethod(class_loader, get_parent_);
   }
 
   bool FindParentNamespaceByClassLoader(JNIEnv* env,
@@ -462,11 +503,19 @@ class LibraryNamespaces {
   }
 
   bool initialized_;
+  jmethodID get_parent_;
   std::vector<std::pair<jweak, NativeLoaderNamespace>> namespaces_;
+  size_t last_found_;
+  bool exported_namespaces_found_;
+  android_namespace_t* vndk_ns_;
+  android_namespace_t* vendor_ns_;
   std::string system_public_libraries_;
   std::string vendor_public_libraries_;
   std::string system_llndk_libraries_;
   std::string system_vndksp_libraries_;
+  std::string vendor_exposed_libraries_;  // system public and llndk ones
+  size_t created_count_;
+  std::chrono::microseconds create_time_;
 
   DISALLOW_COPY_AND_ASSIGN(LibraryNamespaces);
 };
@@ -34,8 +34,12 @@
 
 __BEGIN_DECLS
 
+/** The directory and name of the file containing the list of installed packages */
+#define PACKAGES_LIST_DIR   "/data/system"
+#define PACKAGES_LIST_NAME  "packages.list"
+
 /** The file containing the list of installed packages on the system */
-#define PACKAGES_LIST_FILE  "/data/system/packages.list"
+#define PACKAGES_LIST_FILE  PACKAGES_LIST_DIR "/" PACKAGES_LIST_NAME
 
 typedef struct pkg_info pkg_info;
 typedef struct gid_list gid_list;
@@ -87,6 +91,94 @@ extern bool packagelist_parse(pfn_on_package callback, void *userdata);
  */
 extern void packagelist_free(pkg_info *info);
 
+/**
+ * Looks up a single package by name, without parsing or allocating for any
+ * of the others. For one-off users such as run-as.
+ * @param name
+ *  The package name to look for.
+ * @return
+ *  The package's information, to be freed with packagelist_free(), or NULL
+ *  with errno set if it could not be read or is not in the list (ENOENT).
+ */
+extern pkg_info *packagelist_lookup(const char *name);
+
+/**
+ * An index of the packages list, for long-lived users that look packages up
+ * repeatedly. It maps PACKAGES_LIST_FILE and records where each package's
+ * entry is by name and by uid; entries are only parsed when looked up.
+ * Not thread safe; callers must serialize their use of it.
+ */
+typedef struct packagelist packagelist;
+
+/**
+ * Builds an index of PACKAGES_LIST_FILE.
+ * @param watch
+ *  Whether to watch the file for replacement, see packagelist_get_fd().
+ * @return
+ *  The index, to be freed with packagelist_close(), or NULL on failure.
+ */
+extern packagelist *packagelist_open(bool watch);
+
+/**
+ * Frees an index.
+ * @param list
+ *  The index to free
+ */
+extern void packagelist_close(packagelist *list);
+
+/**
+ * Rebuilds the index if PACKAGES_LIST_FILE has been replaced or modified
+ * since it was last built. On failure the previous index is kept.
+ * @param list
+ *  The index to refresh
+ * @param changed
+ *  Set to whether the index was rebuilt.
+ * @return
+ *  true on success false on failure.
+ */
+extern bool packagelist_refresh(packagelist *list, bool *changed);
+
+/**
+ * Returns a file descriptor that becomes readable when PACKAGES_LIST_FILE
+ * may have changed, for adding to the caller's poll loop, or -1 if the index
+ * was not opened to watch. Call packagelist_process_events() when readable.
+ */
+extern int packagelist_get_fd(packagelist *list);
+
+/**
+ * Consumes the events pending on packagelist_get_fd() and, if any of them were
+ * for PACKAGES_LIST_FILE, refreshes the index as packagelist_refresh() does.
+ * @param list
+ *  The index to update
+ * @param changed
+ *  Set to whether the index was rebuilt.
+ * @return
+ *  true on success false on failure.
+ */
+extern bool packagelist_process_events(packagelist *list, bool *changed);
+
+/**
+ * Returns the number of packages in the index.
+ */
+extern size_t packagelist_count(const packagelist *list);
+
+/**
+ * Looks up a package by name.
+ * @return
+ *  The package's information, to be freed with packagelist_free(), or NULL
+ *  with errno set to ENOENT if there is no such package.
+ */
+extern pkg_info *packagelist_find_name(const packagelist *list, const char *name);
+
+/**
+ * Looks up a package by uid. Of packages sharing a uid, the first listed is
+ * returned.
+ * @return
+ *  The package's information, to be freed with packagelist_free(), or NULL
+ *  with errno set to ENOENT if there is no such package.
+ */
+extern pkg_info *packagelist_find_uid(const packagelist *list, uid_t uid);
+
 __END_DECLS
 
 #endif /* PACKAGELISTPARSER_H_ */
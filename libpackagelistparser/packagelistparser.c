@@ -21,11 +21,17 @@
 #define LOG_TAG "packagelistparser"
 
 #include <errno.h>
+#include <fcntl.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/inotify.h>
 #include <sys/limits.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include <log/log.h>
 #include <packagelistparser/packagelistparser.h>
@@ -87,140 +93,164 @@ static bool parse_gids(char *gids, gid_t *gid_list, size_t *cnt)
     return true;
 }
 
-extern bool packagelist_parse(pfn_on_package callback, void *userdata)
+/*
+ * Parses one NUL terminated line of the packages list into a newly allocated
+ * pkg_info. Returns NULL, having logged why, if the line is malformed.
+ */
+static pkg_info *parse_line(char *line, unsigned long lineno)
 {
-
-    FILE *fp;
     char *cur;
     char *next;
     char *endptr;
     unsigned long tmp;
-    ssize_t bytesread;
-
-    bool rc = false;
-    char *buf = NULL;
-    size_t buflen = 0;
-    unsigned long lineno = 1;
     const char *errmsg = NULL;
-    struct pkg_info *pkg_info = NULL;
+    struct pkg_info *pkg_info;
 
-    fp = fopen(PACKAGES_LIST_FILE, "re");
-    if (!fp) {
-        CLOGE("Could not open: \"%s\", error: \"%s\"\n", PACKAGES_LIST_FILE,
-                strerror(errno));
-        return false;
+    pkg_info = calloc(1, sizeof(*pkg_info));
+    if (!pkg_info) {
+        goto err;
     }
 
-    while ((bytesread = getline(&buf, &buflen, fp)) > 0) {
+    next = line;
 
-        pkg_info = calloc(1, sizeof(*pkg_info));
-        if (!pkg_info) {
-            goto err;
-        }
+    cur = strsep(&next, " \t\r\n");
+    if (!cur) {
+        errmsg = "Could not get next token for \"package name\"";
+        goto err;
+    }
 
-        next = buf;
+    pkg_info->name = strdup(cur);
+    if (!pkg_info->name) {
+        goto err;
+    }
 
-        cur = strsep(&next, " \t\r\n");
-        if (!cur) {
-            errmsg = "Could not get next token for \"package name\"";
-            goto err;
-        }
+    cur = strsep(&next, " \t\r\n");
+    if (!cur) {
+        errmsg = "Could not get next token for field \"uid\"";
+        goto err;
+    }
 
-        pkg_info->name = strdup(cur);
-        if (!pkg_info->name) {
-            goto err;
-        }
+    tmp = strtoul(cur, &endptr, 10);
+    if (*endptr != '\0') {
+        errmsg = "Could not convert field \"uid\" to integer value";
+        goto err;
+    }
 
-        cur = strsep(&next, " \t\r\n");
-        if (!cur) {
-            errmsg = "Could not get next token for field \"uid\"";
-            goto err;
-        }
+    /*
+     * if unsigned long is greater than size of uid_t,
+     * prevent a truncation based roll-over
+     */
+    if (tmp > UID_MAX) {
+        errmsg = "Field \"uid\" greater than UID_MAX";
+        goto err;
+    }
 
-        tmp = strtoul(cur, &endptr, 10);
-        if (*endptr != '\0') {
-            errmsg = "Could not convert field \"uid\" to integer value";
-            goto err;
-        }
+    pkg_info->uid = (uid_t) tmp;
 
-        /*
-         * if unsigned long is greater than size of uid_t,
-         * prevent a truncation based roll-over
-         */
-        if (tmp > UID_MAX) {
-            errmsg = "Field \"uid\" greater than UID_MAX";
-            goto err;
-        }
+    cur = strsep(&next, " \t\r\n");
+    if (!cur) {
+        errmsg = "Could not get next token for field \"debuggable\"";
+        goto err;
+    }
 
-        pkg_info->uid = (uid_t) tmp;
+    tmp = strtoul(cur, &endptr, 10);
+    if (*endptr != '\0') {
+        errmsg = "Could not convert field \"debuggable\" to integer value";
+        goto err;
+    }
 
-        cur = strsep(&next, " \t\r\n");
-        if (!cur) {
-            errmsg = "Could not get next token for field \"debuggable\"";
-            goto err;
-        }
+    /* should be a valid boolean of 1 or 0 */
+    if (!(tmp == 0 || tmp == 1)) {
+        errmsg = "Field \"debuggable\" is not 0 or 1 boolean value";
+        goto err;
+    }
 
-        tmp = strtoul(cur, &endptr, 10);
-        if (*endptr != '\0') {
-            errmsg = "Could not convert field \"debuggable\" to integer value";
-            goto err;
-        }
+    pkg_info->debuggable = (bool) tmp;
 
-        /* should be a valid boolean of 1 or 0 */
-        if (!(tmp == 0 || tmp == 1)) {
-            errmsg = "Field \"debuggable\" is not 0 or 1 boolean value";
-            goto err;
-        }
+    cur = strsep(&next, " \t\r\n");
+    if (!cur) {
+        errmsg = "Could not get next token for field \"data dir\"";
+        goto err;
+    }
 
-        pkg_info->debuggable = (bool) tmp;
+    pkg_info->data_dir = strdup(cur);
+    if (!pkg_info->data_dir) {
+        goto err;
+    }
 
-        cur = strsep(&next, " \t\r\n");
-        if (!cur) {
-            errmsg = "Could not get next token for field \"data dir\"";
-            goto err;
-        }
+    cur = strsep(&next, " \t\r\n");
+    if (!cur) {
+        errmsg = "Could not get next token for field \"seinfo\"";
+        goto err;
+    }
 
-        pkg_info->data_dir = strdup(cur);
-        if (!pkg_info->data_dir) {
-            goto err;
-        }
+    pkg_info->seinfo = strdup(cur);
+    if (!pkg_info->seinfo) {
+        goto err;
+    }
 
-        cur = strsep(&next, " \t\r\n");
-        if (!cur) {
-            errmsg = "Could not get next token for field \"seinfo\"";
-            goto err;
-        }
+    cur = strsep(&next, " \t\r\n");
+    if (!cur) {
+        errmsg = "Could not get next token for field \"gid(s)\"";
+        goto err;
+    }
 
-        pkg_info->seinfo = strdup(cur);
-        if (!pkg_info->seinfo) {
+    /*
+     * Parse the gid list, could be in the form of none, single gid or list:
+     * none
+     * gid
+     * gid, gid ...
+     */
+    pkg_info->gids.cnt = get_gid_cnt(cur);
+    if (pkg_info->gids.cnt > 0) {
+
+        pkg_info->gids.gids = calloc(pkg_info->gids.cnt, sizeof(gid_t));
+        if (!pkg_info->gids.gids) {
             goto err;
         }
 
-        cur = strsep(&next, " \t\r\n");
-        if (!cur) {
-            errmsg = "Could not get next token for field \"gid(s)\"";
+        if (!parse_gids(cur, pkg_info->gids.gids, &pkg_info->gids.cnt)) {
+            errmsg = "Could not parse field \"gid list\"";
             goto err;
         }
+    }
 
-        /*
-         * Parse the gid list, could be in the form of none, single gid or list:
-         * none
-         * gid
-         * gid, gid ...
-         */
-        pkg_info->gids.cnt = get_gid_cnt(cur);
-        if (pkg_info->gids.cnt > 0) {
+    return pkg_info;
 
-            pkg_info->gids.gids = calloc(pkg_info->gids.cnt, sizeof(gid_t));
-            if (!pkg_info->gids.gids) {
-                goto err;
-            }
+err:
+    if (errmsg) {
+        CLOGE("Error Parsing \"%s\" on line: %lu for reason: %s",
+                PACKAGES_LIST_FILE, lineno, errmsg);
+    }
+    packagelist_free(pkg_info);
+    return NULL;
+}
 
-            rc = parse_gids(cur, pkg_info->gids.gids, &pkg_info->gids.cnt);
-            if (!rc) {
-                errmsg = "Could not parse field \"gid list\"";
-                goto err;
-            }
+extern bool packagelist_parse(pfn_on_package callback, void *userdata)
+{
+
+    FILE *fp;
+    ssize_t bytesread;
+
+    bool rc = false;
+    char *buf = NULL;
+    size_t buflen = 0;
+    unsigned long lineno = 1;
+    struct pkg_info *pkg_info = NULL;
+
+    fp = fopen(PACKAGES_LIST_FILE, "re");
+    if (!fp) {
+        CLOGE("Could not open: \"%s\", error: \"%s\"\n", PACKAGES_LIST_FILE,
+                strerror(errno));
+        return false;
+    }
+
+    while ((bytesread = getline(&buf, &buflen, fp)) > 0) {
+
+        pkg_info = parse_line(buf, lineno);
+        if (!pkg_info) {
+            rc = false;
+            goto out;
         }
 
         rc = callback(pkg_info, userdata);
@@ -242,15 +272,6 @@ out:
     free(buf);
     fclose(fp);
     return rc;
-
-err:
-    if (errmsg) {
-        CLOGE("Error Parsing \"%s\" on line: %lu for reason: %s",
-                PACKAGES_LIST_FILE, lineno, errmsg);
-    }
-    rc = false;
-    packagelist_free(pkg_info);
-    goto out;
 }
 
 void packagelist_free(pkg_info *info)
@@ -263,3 +284,421 @@ void packagelist_free(pkg_info *info)
         free(info);
     }
 }
+
+/*
+ * The index: packages.list mapped read only, and each line's name and uid
+ * found once and hashed, so that a lookup goes straight to its line and only
+ * that line is parsed into a pkg_info. PackageManager replaces the file by
+ * renaming a new one over it, so a mapping of the old one stays readable
+ * until the index is refreshed.
+ */
+struct pkg_entry {
+    size_t offset;      /* of the line */
+    size_t len;         /* of the line, without its newline */
+    size_t name_len;
+    uid_t uid;
+    unsigned long lineno;
+};
+
+struct packagelist {
+    const char *map;
+    size_t size;
+    struct stat st;     /* of the file mapped */
+    struct pkg_entry *entries;  /* in file order */
+    size_t cnt;
+    /* open addressed, entry index + 1 or 0 for empty, of the first listed */
+    uint32_t *by_name;
+    uint32_t *by_uid;
+    size_t mask;
+    int inotify_fd;
+};
+
+static const char *entry_name(const packagelist *list, const struct pkg_entry *e)
+{
+    return list->map + e->offset;
+}
+
+static size_t hash_name(const char *name, size_t len)
+{
+    /* FNV-1a, widened so as not to trip the integer sanitizer */
+    uint32_t h = 2166136261u;
+    while (len--) {
+        h = (uint32_t)((uint64_t)(h ^ (unsigned char) *name++) * 16777619u);
+    }
+    return h;
+}
+
+static size_t hash_uid(uid_t uid)
+{
+    return (size_t)(((uint64_t) uid * 2654435761u) >> 16);
+}
+
+/* Returns the by_name slot holding name, or the empty one it would go in. */
+static uint32_t *name_slot(const packagelist *list, const char *name, size_t len)
+{
+    size_t i = hash_name(name, len) & list->mask;
+    for (;; i = (i + 1) & list->mask) {
+        uint32_t *slot = &list->by_name[i];
+        const struct pkg_entry *e;
+        if (!*slot) {
+            return slot;
+        }
+        e = &list->entries[*slot - 1];
+        if (e->name_len == len && !memcmp(entry_name(list, e), name, len)) {
+            return slot;
+        }
+    }
+}
+
+static uint32_t *uid_slot(const packagelist *list, uid_t uid)
+{
+    size_t i = hash_uid(uid) & list->mask;
+    for (;; i = (i + 1) & list->mask) {
+        uint32_t *slot = &list->by_uid[i];
+        if (!*slot || list->entries[*slot - 1].uid == uid) {
+            return slot;
+        }
+    }
+}
+
+static void unmap_list(packagelist *list)
+{
+    if (list->map) {
+        munmap((void *)list->map, list->size);
+    }
+    free(list->entries);
+    free(list->by_name);
+    free(list->by_uid);
+    list->map = NULL;
+    list->size = 0;
+    list->entries = NULL;
+    list->by_name = NULL;
+    list->by_uid = NULL;
+    list->cnt = 0;
+    list->mask = 0;
+}
+
+/*
+ * Reads the name and uid that start the line at p, without copying it.
+ * Returns false if they are not there, and the line is left for
+ * parse_line() to complain about should it be looked up.
+ */
+static bool scan_entry(const char *p, size_t len, struct pkg_entry *e)
+{
+    size_t i = 0;
+    unsigned long uid = 0;
+
+    while (i < len && p[i] != ' ' && p[i] != '\t' && p[i] != '\r') {
+        i++;
+    }
+    if (!i || i == len) {
+        return false;
+    }
+    e->name_len = i++;
+
+    if (i == len || p[i] < '0' || p[i] > '9') {
+        return false;
+    }
+    for (; i < len && p[i] >= '0' && p[i] <= '9'; i++) {
+        unsigned long digit = p[i] - '0';
+        if (uid > (UID_MAX - digit) / 10) {
+            return false;
+        }
+        uid = uid * 10 + digit;
+    }
+    e->uid = (uid_t) uid;
+    return true;
+}
+
+static bool map_file(packagelist *list)
+{
+    int fd;
+
+    fd = TEMP_FAILURE_RETRY(open(PACKAGES_LIST_FILE, O_RDONLY | O_CLOEXEC));
+    if (fd < 0) {
+        CLOGE("Could not open: \"%s\", error: \"%s\"\n", PACKAGES_LIST_FILE,
+                strerror(errno));
+        return false;
+    }
+    if (fstat(fd, &list->st) < 0) {
+        goto err_close;
+    }
+
+    list->size = list->st.st_size;
+    if (list->size) {
+        void *map = mmap(NULL, list->size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map == MAP_FAILED) {
+            CLOGE("Could not map: \"%s\", error: \"%s\"\n", PACKAGES_LIST_FILE,
+                    strerror(errno));
+            goto err_close;
+        }
+        list->map = map;
+    }
+    close(fd);
+    return true;
+
+err_close:
+    close(fd);
+    return false;
+}
+
+/*
+ * Returns the length of the line at *off, without its newline, and advances
+ * *off to the line after it.
+ */
+static size_t next_line(const packagelist *list, size_t *off)
+{
+    const char *p = list->map + *off;
+    const char *nl = memchr(p, '\n', list->size - *off);
+    size_t len = nl ? (size_t)(nl - p) : list->size - *off;
+
+    *off += len + 1;
+    return len;
+}
+
+static bool map_list(packagelist *list)
+{
+    size_t off, cnt = 0, slots = 1;
+    unsigned long lineno = 1;
+
+    if (!map_file(list)) {
+        return false;
+    }
+
+    for (off = 0; off < list->size; cnt++) {
+        const char *nl = memchr(list->map + off, '\n', list->size - off);
+        if (!nl) {
+            break;
+        }
+        off = nl - list->map + 1;
+    }
+    /* a last line without a newline */
+    cnt++;
+    /* at most half full */
+    while (slots < cnt * 2) {
+        slots <<= 1;
+    }
+
+    list->entries = malloc(cnt * sizeof(*list->entries));
+    list->by_name = calloc(slots, sizeof(*list->by_name));
+    list->by_uid = calloc(slots, sizeof(*list->by_uid));
+    if (!list->entries || !list->by_name || !list->by_uid) {
+        goto err_unmap;
+    }
+    list->mask = slots - 1;
+
+    for (off = 0; off < list->size; lineno++) {
+        struct pkg_entry *e = &list->entries[list->cnt];
+        size_t start = off;
+        size_t len = next_line(list, &off);
+        uint32_t *slot;
+
+        if (!scan_entry(list->map + start, len, e)) {
+            continue;
+        }
+        e->offset = start;
+        e->len = len;
+        e->lineno = lineno;
+        list->cnt++;
+
+        /* the first listed wins, as it does for packagelist_parse callers */
+        slot = name_slot(list, entry_name(list, e), e->name_len);
+        if (!*slot) {
+            *slot = list->cnt;
+        }
+        slot = uid_slot(list, e->uid);
+        if (!*slot) {
+            *slot = list->cnt;
+        }
+    }
+    return true;
+
+err_unmap:
+    unmap_list(list);
+    return false;
+}
+
+/* Parses the entry's line from the mapping, which it does not terminate. */
+static pkg_info *parse_entry(const packagelist *list, const struct pkg_entry *e)
+{
+    pkg_info *info;
+    char *line = malloc(e->len + 1);
+
+    if (!line) {
+        return NULL;
+    }
+    memcpy(line, list->map + e->offset, e->len);
+    line[e->len] = '\0';
+    info = parse_line(line, e->lineno);
+    free(line);
+    return info;
+}
+
+static bool watch_list(packagelist *list)
+{
+    list->inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (list->inotify_fd < 0) {
+        CLOGE("inotify_init1 failed: \"%s\"\n", strerror(errno));
+        return false;
+    }
+    /* the directory, as the file is replaced rather than written to */
+    if (inotify_add_watch(list->inotify_fd, PACKAGES_LIST_DIR,
+            IN_MOVED_TO | IN_CLOSE_WRITE | IN_CREATE) < 0) {
+        CLOGE("Could not watch: \"%s\", error: \"%s\"\n", PACKAGES_LIST_DIR,
+                strerror(errno));
+        close(list->inotify_fd);
+        list->inotify_fd = -1;
+        return false;
+    }
+    return true;
+}
+
+extern packagelist *packagelist_open(bool watch)
+{
+    packagelist *list = calloc(1, sizeof(*list));
+
+    if (!list) {
+        return NULL;
+    }
+    list->inotify_fd = -1;
+
+    /* watch first, so that a change made while mapping is not missed */
+    if ((watch && !watch_list(list)) || !map_list(list)) {
+        packagelist_close(list);
+        return NULL;
+    }
+    return list;
+}
+
+extern void packagelist_close(packagelist *list)
+{
+    if (list) {
+        unmap_list(list);
+        if (list->inotify_fd >= 0) {
+            close(list->inotify_fd);
+        }
+        free(list);
+    }
+}
+
+extern bool packagelist_refresh(packagelist *list, bool *changed)
+{
+    struct stat st;
+
+    *changed = false;
+    if (stat(PACKAGES_LIST_FILE, &st) < 0) {
+        CLOGE("Could not stat: \"%s\", error: \"%s\"\n", PACKAGES_LIST_FILE,
+                strerror(errno));
+        return false;
+    }
+    if (list->map && st.st_ino == list->st.st_ino && st.st_dev == list->st.st_dev &&
+            st.st_size == list->st.st_size &&
+            st.st_mtim.tv_sec == list->st.st_mtim.tv_sec &&
+            st.st_mtim.tv_nsec == list->st.st_mtim.tv_nsec) {
+        return true;
+    }
+
+    /* rebuild into a copy, so the old index stays good on failure */
+    packagelist update = *list;
+    update.map = NULL;
+    update.entries = NULL;
+    update.by_name = NULL;
+    update.by_uid = NULL;
+    update.cnt = 0;
+    update.mask = 0;
+    if (!map_list(&update)) {
+        return false;
+    }
+    unmap_list(list);
+    *list = update;
+    *changed = true;
+    return true;
+}
+
+extern int packagelist_get_fd(packagelist *list)
+{
+    return list->inotify_fd;
+}
+
+extern bool packagelist_process_events(packagelist *list, bool *changed)
+{
+    char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    bool relevant = false;
+    ssize_t len;
+
+    *changed = false;
+    while ((len = TEMP_FAILURE_RETRY(read(list->inotify_fd, buf, sizeof(buf)))) > 0) {
+        const struct inotify_event *event;
+        for (char *p = buf; p < buf + len; p += sizeof(*event) + event->len) {
+            event = (const struct inotify_event *)p;
+            if (event->len && !strcmp(event->name, PACKAGES_LIST_NAME)) {
+                relevant = true;
+            }
+        }
+    }
+    if (len < 0 && errno != EAGAIN) {
+        CLOGE("Could not read inotify events: \"%s\"\n", strerror(errno));
+        return false;
+    }
+    return relevant ? packagelist_refresh(list, changed) : true;
+}
+
+extern size_t packagelist_count(const packagelist *list)
+{
+    return list->cnt;
+}
+
+extern pkg_info *packagelist_find_name(const packagelist *list, const char *name)
+{
+    uint32_t slot = *name_slot(list, name, strlen(name));
+
+    if (!slot) {
+        errno = ENOENT;
+        return NULL;
+    }
+    return parse_entry(list, &list->entries[slot - 1]);
+}
+
+extern pkg_info *packagelist_find_uid(const packagelist *list, uid_t uid)
+{
+    uint32_t slot = *uid_slot(list, uid);
+
+    if (!slot) {
+        errno = ENOENT;
+        return NULL;
+    }
+    return parse_entry(list, &list->entries[slot - 1]);
+}
+
+extern pkg_info *packagelist_lookup(const char *name)
+{
+    packagelist list = { .inotify_fd = -1 };
+    size_t len = strlen(name);
+    unsigned long lineno = 1;
+    pkg_info *info = NULL;
+    size_t off = 0;
+
+    if (!map_file(&list)) {
+        return NULL;
+    }
+
+    /* a single lookup is cheaper as a scan than as an index */
+    errno = ENOENT;
+    while (off < list.size) {
+        struct pkg_entry e;
+        size_t start = off;
+
+        e.len = next_line(&list, &off);
+        if (scan_entry(list.map + start, e.len, &e) && e.name_len == len &&
+                !memcmp(list.map + start, name, len)) {
+            e.offset = start;
+            e.lineno = lineno;
+            info = parse_entry(&list, &e);
+            break;
+        }
+        lineno++;
+    }
+    unmap_list(&list);
+    return info;
+}
+
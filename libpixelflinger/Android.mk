@@ -34,6 +34,7 @@ PIXELFLINGER_SRC_FILES_arm := \
 
 ifeq ($(ARCH_ARM_HAVE_NEON),true)
 PIXELFLINGER_SRC_FILES_arm += col32cb16blend_neon.S
+PIXELFLINGER_SRC_FILES_arm += blend_simd.c
 PIXELFLINGER_CFLAGS_arm += -D__ARM_HAVE_NEON
 endif
 
@@ -42,6 +43,13 @@ PIXELFLINGER_SRC_FILES_arm64 := \
 	codeflinger/Arm64Disassembler.cpp \
 	arch-arm64/col32cb16blend.S \
 	arch-arm64/t32cb16blend.S \
+	blend_simd.c \
+
+PIXELFLINGER_SRC_FILES_x86 := \
+	blend_simd.c \
+
+PIXELFLINGER_SRC_FILES_x86_64 := \
+	blend_simd.c \
 
 ifndef ARCH_MIPS_REV6
 PIXELFLINGER_SRC_FILES_mips := \
@@ -68,11 +76,13 @@ LOCAL_SRC_FILES_arm := $(PIXELFLINGER_SRC_FILES_arm)
 LOCAL_SRC_FILES_arm64 := $(PIXELFLINGER_SRC_FILES_arm64)
 LOCAL_SRC_FILES_mips := $(PIXELFLINGER_SRC_FILES_mips)
 LOCAL_SRC_FILES_mips64 := $(PIXELFLINGER_SRC_FILES_mips64)
+LOCAL_SRC_FILES_x86 := $(PIXELFLINGER_SRC_FILES_x86)
+LOCAL_SRC_FILES_x86_64 := $(PIXELFLINGER_SRC_FILES_x86_64)
 LOCAL_CFLAGS := $(PIXELFLINGER_CFLAGS)
 LOCAL_EXPORT_C_INCLUDE_DIRS := $(LOCAL_PATH)/include
 LOCAL_C_INCLUDES += $(LOCAL_EXPORT_C_INCLUDE_DIRS) \
 		    external/safe-iop/include
-LOCAL_SHARED_LIBRARIES := libcutils liblog libutils
+LOCAL_SHARED_LIBRARIES := libbase libcutils liblog libutils
 
 include $(BUILD_SHARED_LIBRARY)
 
@@ -0,0 +1,307 @@
+/* libs/pixelflinger/blend_simd.c
+ *
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * SRC_OVER blending of 8888 (0xAABBGGRR in memory order) source pixels,
+ * eight at a time with SSE2 or NEON, the rest one at a time in C. The
+ * arithmetic is that of scanline.cpp's blenders, with each component
+ * clamped like the assembly versions do:
+ *
+ *   f = 0x100 - (sA + (sA>>7))
+ *   d = min(s + ((f*d)>>8), max)
+ *
+ * Only little-endian layouts are handled, scanline.cpp does not call
+ * these otherwise.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON__) || defined(__ARM_NEON)
+#include <arm_neon.h>
+#define BLEND_NEON 1
+#endif
+
+static inline uint16_t blend565(uint32_t s, uint16_t d)
+{
+    int sA = (s>>24);
+    int f = 0x100 - (sA + (sA>>7));
+    int sR = ((s >> (   3))&0x1F) + ((f*((d>>11)&0x1f))>>8);
+    int sG = ((s >> ( 8+2))&0x3F) + ((f*((d>>5)&0x3f))>>8);
+    int sB = ((s >> (16+3))&0x1F) + ((f*((d)&0x1f))>>8);
+    if (sR > 0x1f) sR = 0x1f;
+    if (sG > 0x3f) sG = 0x3f;
+    if (sB > 0x1f) sB = 0x1f;
+    return (uint16_t)((sR<<11)|(sG<<5)|sB);
+}
+
+static inline uint16_t blend565_mod(uint32_t s, uint16_t d, const int32_t* m)
+{
+    int sA = (((s >> 24)       ) * m[3]) >> 8;
+    int sR = (((s      ) & 0xff) * m[0]) >> (8 - 5);
+    int sG = (((s >>  8) & 0xff) * m[1]) >> (8 - 6);
+    int sB = (((s >> 16) & 0xff) * m[2]) >> (8 - 5);
+    int f = 0x100 - (sA + (sA>>7));
+    sR = (sR + f*((d>>11)&0x1f))>>8;
+    sG = (sG + f*((d>>5)&0x3f))>>8;
+    sB = (sB + f*((d)&0x1f))>>8;
+    if (sR > 0x1f) sR = 0x1f;
+    if (sG > 0x3f) sG = 0x3f;
+    if (sB > 0x1f) sB = 0x1f;
+    return (uint16_t)((sR<<11)|(sG<<5)|sB);
+}
+
+static inline uint32_t blend8888(uint32_t s, uint32_t d)
+{
+    int sA = (s>>24);
+    int f = 0x100 - (sA + (sA>>7));
+    uint32_t r = 0;
+    int i;
+    for (i=0 ; i<32 ; i+=8) {
+        int c = ((s>>i)&0xff) + ((f*((d>>i)&0xff))>>8);
+        if (c > 0xff) c = 0xff;
+        r |= (uint32_t)c << i;
+    }
+    return r;
+}
+
+#if defined(__SSE2__)
+
+/* 0x00RR, 0x00GG, ... of the four pixels in v, shifted and masked */
+#define FIELD(v, shift, mask) \
+    _mm_and_si128(_mm_srli_epi32((v), (shift)), _mm_set1_epi32(mask))
+
+/* eight 565 pixels from the 5.x/6.x components, clamped */
+static inline __m128i pack565(__m128i r, __m128i g, __m128i b)
+{
+    r = _mm_min_epi16(r, _mm_set1_epi16(0x1f));
+    g = _mm_min_epi16(g, _mm_set1_epi16(0x3f));
+    b = _mm_min_epi16(b, _mm_set1_epi16(0x1f));
+    return _mm_or_si128(_mm_or_si128(_mm_slli_epi16(r, 11),
+                                     _mm_slli_epi16(g, 5)), b);
+}
+
+#endif
+
+void scanline_t32cb16blend_simd(uint16_t* dst, const uint32_t* src, size_t ct)
+{
+#if defined(__SSE2__)
+    const __m128i m5 = _mm_set1_epi16(0x1f);
+    const __m128i m6 = _mm_set1_epi16(0x3f);
+    const __m128i one = _mm_set1_epi16(0x100);
+    for ( ; ct >= 8 ; ct -= 8, src += 8, dst += 8) {
+        __m128i s0 = _mm_loadu_si128((const __m128i*)src);
+        __m128i s1 = _mm_loadu_si128((const __m128i*)(src + 4));
+        __m128i d  = _mm_loadu_si128((const __m128i*)dst);
+        __m128i a = _mm_packs_epi32(_mm_srli_epi32(s0, 24),
+                                    _mm_srli_epi32(s1, 24));
+        __m128i f = _mm_sub_epi16(one, _mm_add_epi16(a, _mm_srli_epi16(a, 7)));
+        __m128i r = _mm_packs_epi32(FIELD(s0, 3, 0x1f), FIELD(s1, 3, 0x1f));
+        __m128i g = _mm_packs_epi32(FIELD(s0, 10, 0x3f), FIELD(s1, 10, 0x3f));
+        __m128i b = _mm_packs_epi32(FIELD(s0, 19, 0x1f), FIELD(s1, 19, 0x1f));
+        __m128i dR = _mm_srli_epi16(d, 11);
+        __m128i dG = _mm_and_si128(_mm_srli_epi16(d, 5), m6);
+        __m128i dB = _mm_and_si128(d, m5);
+        r = _mm_add_epi16(r, _mm_srli_epi16(_mm_mullo_epi16(f, dR), 8));
+        g = _mm_add_epi16(g, _mm_srli_epi16(_mm_mullo_epi16(f, dG), 8));
+        b = _mm_add_epi16(b, _mm_srli_epi16(_mm_mullo_epi16(f, dB), 8));
+        _mm_storeu_si128((__m128i*)dst, pack565(r, g, b));
+    }
+#elif defined(BLEND_NEON)
+    const uint16x8_t one = vdupq_n_u16(0x100);
+    for ( ; ct >= 8 ; ct -= 8, src += 8, dst += 8) {
+        uint8x8x4_t s = vld4_u8((const uint8_t*)src);
+        uint16x8_t d = vld1q_u16(dst);
+        uint16x8_t a = vmovl_u8(s.val[3]);
+        uint16x8_t f = vsubq_u16(one, vsraq_n_u16(a, a, 7));
+        uint16x8_t dR = vshrq_n_u16(d, 11);
+        uint16x8_t dG = vandq_u16(vshrq_n_u16(d, 5), vdupq_n_u16(0x3f));
+        uint16x8_t dB = vandq_u16(d, vdupq_n_u16(0x1f));
+        uint16x8_t r = vmovl_u8(vshr_n_u8(s.val[0], 3));
+        uint16x8_t g = vmovl_u8(vshr_n_u8(s.val[1], 2));
+        uint16x8_t b = vmovl_u8(vshr_n_u8(s.val[2], 3));
+        r = vminq_u16(vsraq_n_u16(r, vmulq_u16(f, dR), 8), vdupq_n_u16(0x1f));
+        g = vminq_u16(vsraq_n_u16(g, vmulq_u16(f, dG), 8), vdupq_n_u16(0x3f));
+        b = vminq_u16(vsraq_n_u16(b, vmulq_u16(f, dB), 8), vdupq_n_u16(0x1f));
+        vst1q_u16(dst, vorrq_u16(vorrq_u16(vshlq_n_u16(r, 11),
+                                           vshlq_n_u16(g, 5)), b));
+    }
+#endif
+    while (ct--) {
+        *dst = blend565(*src++, *dst);
+        dst++;
+    }
+}
+
+void scanline_col32cb16blend_simd(uint16_t* dst, uint32_t col, size_t ct)
+{
+#if defined(__SSE2__)
+    const int sA = (col>>24);
+    const __m128i f = _mm_set1_epi16(0x100 - (sA + (sA>>7)));
+    const __m128i r = _mm_set1_epi16((col >> (   3))&0x1F);
+    const __m128i g = _mm_set1_epi16((col >> ( 8+2))&0x3F);
+    const __m128i b = _mm_set1_epi16((col >> (16+3))&0x1F);
+    const __m128i m5 = _mm_set1_epi16(0x1f);
+    const __m128i m6 = _mm_set1_epi16(0x3f);
+    for ( ; ct >= 8 ; ct -= 8, dst += 8) {
+        __m128i d  = _mm_loadu_si128((const __m128i*)dst);
+        __m128i dR = _mm_srli_epi16(d, 11);
+        __m128i dG = _mm_and_si128(_mm_srli_epi16(d, 5), m6);
+        __m128i dB = _mm_and_si128(d, m5);
+        dR = _mm_add_epi16(r, _mm_srli_epi16(_mm_mullo_epi16(f, dR), 8));
+        dG = _mm_add_epi16(g, _mm_srli_epi16(_mm_mullo_epi16(f, dG), 8));
+        dB = _mm_add_epi16(b, _mm_srli_epi16(_mm_mullo_epi16(f, dB), 8));
+        _mm_storeu_si128((__m128i*)dst, pack565(dR, dG, dB));
+    }
+#elif defined(BLEND_NEON)
+    const int sA = (col>>24);
+    const uint16x8_t f = vdupq_n_u16(0x100 - (sA + (sA>>7)));
+    const uint16x8_t r = vdupq_n_u16((col >> (   3))&0x1F);
+    const uint16x8_t g = vdupq_n_u16((col >> ( 8+2))&0x3F);
+    const uint16x8_t b = vdupq_n_u16((col >> (16+3))&0x1F);
+    for ( ; ct >= 8 ; ct -= 8, dst += 8) {
+        uint16x8_t d = vld1q_u16(dst);
+        uint16x8_t dR = vshrq_n_u16(d, 11);
+        uint16x8_t dG = vandq_u16(vshrq_n_u16(d, 5), vdupq_n_u16(0x3f));
+        uint16x8_t dB = vandq_u16(d, vdupq_n_u16(0x1f));
+        dR = vminq_u16(vsraq_n_u16(r, vmulq_u16(f, dR), 8), vdupq_n_u16(0x1f));
+        dG = vminq_u16(vsraq_n_u16(g, vmulq_u16(f, dG), 8), vdupq_n_u16(0x3f));
+        dB = vminq_u16(vsraq_n_u16(b, vmulq_u16(f, dB), 8), vdupq_n_u16(0x1f));
+        vst1q_u16(dst, vorrq_u16(vorrq_u16(vshlq_n_u16(dR, 11),
+                                           vshlq_n_u16(dG, 5)), dB));
+    }
+#endif
+    while (ct--) {
+        *dst = blend565(col, *dst);
+        dst++;
+    }
+}
+
+/* mod[] holds the r, g, b and a factors, 0 to 0x100 */
+void scanline_t32cb16blend_mod_simd(uint16_t* dst, const uint32_t* src,
+        size_t ct, const int32_t* mod)
+{
+#if defined(__SSE2__)
+    const __m128i mR = _mm_set1_epi16(mod[0]);
+    const __m128i mG = _mm_set1_epi16(mod[1]);
+    const __m128i mB = _mm_set1_epi16(mod[2]);
+    const __m128i mA = _mm_set1_epi16(mod[3]);
+    const __m128i m5 = _mm_set1_epi16(0x1f);
+    const __m128i m6 = _mm_set1_epi16(0x3f);
+    const __m128i one = _mm_set1_epi16(0x100);
+    for ( ; ct >= 8 ; ct -= 8, src += 8, dst += 8) {
+        __m128i s0 = _mm_loadu_si128((const __m128i*)src);
+        __m128i s1 = _mm_loadu_si128((const __m128i*)(src + 4));
+        __m128i d  = _mm_loadu_si128((const __m128i*)dst);
+        /* 8 bits times at most 0x100 still fits, unsigned, in 16 */
+        __m128i a = _mm_packs_epi32(_mm_srli_epi32(s0, 24),
+                                    _mm_srli_epi32(s1, 24));
+        __m128i r = _mm_packs_epi32(FIELD(s0, 0, 0xff), FIELD(s1, 0, 0xff));
+        __m128i g = _mm_packs_epi32(FIELD(s0, 8, 0xff), FIELD(s1, 8, 0xff));
+        __m128i b = _mm_packs_epi32(FIELD(s0, 16, 0xff), FIELD(s1, 16, 0xff));
+        a = _mm_srli_epi16(_mm_mullo_epi16(a, mA), 8);
+        r = _mm_srli_epi16(_mm_mullo_epi16(r, mR), 8 - 5);
+        g = _mm_srli_epi16(_mm_mullo_epi16(g, mG), 8 - 6);
+        b = _mm_srli_epi16(_mm_mullo_epi16(b, mB), 8 - 5);
+        __m128i f = _mm_sub_epi16(one, _mm_add_epi16(a, _mm_srli_epi16(a, 7)));
+        __m128i dR = _mm_srli_epi16(d, 11);
+        __m128i dG = _mm_and_si128(_mm_srli_epi16(d, 5), m6);
+        __m128i dB = _mm_and_si128(d, m5);
+        r = _mm_srli_epi16(_mm_add_epi16(r, _mm_mullo_epi16(f, dR)), 8);
+        g = _mm_srli_epi16(_mm_add_epi16(g, _mm_mullo_epi16(f, dG)), 8);
+        b = _mm_srli_epi16(_mm_add_epi16(b, _mm_mullo_epi16(f, dB)), 8);
+        _mm_storeu_si128((__m128i*)dst, pack565(r, g, b));
+    }
+#elif defined(BLEND_NEON)
+    const uint16x8_t mR = vdupq_n_u16(mod[0]);
+    const uint16x8_t mG = vdupq_n_u16(mod[1]);
+    const uint16x8_t mB = vdupq_n_u16(mod[2]);
+    const uint16x8_t mA = vdupq_n_u16(mod[3]);
+    const uint16x8_t one = vdupq_n_u16(0x100);
+    for ( ; ct >= 8 ; ct -= 8, src += 8, dst += 8) {
+        uint8x8x4_t s = vld4_u8((const uint8_t*)src);
+        uint16x8_t d = vld1q_u16(dst);
+        uint16x8_t a = vshrq_n_u16(vmulq_u16(vmovl_u8(s.val[3]), mA), 8);
+        uint16x8_t r = vshrq_n_u16(vmulq_u16(vmovl_u8(s.val[0]), mR), 8 - 5);
+        uint16x8_t g = vshrq_n_u16(vmulq_u16(vmovl_u8(s.val[1]), mG), 8 - 6);
+        uint16x8_t b = vshrq_n_u16(vmulq_u16(vmovl_u8(s.val[2]), mB), 8 - 5);
+        uint16x8_t f = vsubq_u16(one, vsraq_n_u16(a, a, 7));
+        uint16x8_t dR = vshrq_n_u16(d, 11);
+        uint16x8_t dG = vandq_u16(vshrq_n_u16(d, 5), vdupq_n_u16(0x3f));
+        uint16x8_t dB = vandq_u16(d, vdupq_n_u16(0x1f));
+        r = vminq_u16(vshrq_n_u16(vmlaq_u16(r, f, dR), 8), vdupq_n_u16(0x1f));
+        g = vminq_u16(vshrq_n_u16(vmlaq_u16(g, f, dG), 8), vdupq_n_u16(0x3f));
+        b = vminq_u16(vshrq_n_u16(vmlaq_u16(b, f, dB), 8), vdupq_n_u16(0x1f));
+        vst1q_u16(dst, vorrq_u16(vorrq_u16(vshlq_n_u16(r, 11),
+                                           vshlq_n_u16(g, 5)), b));
+    }
+#endif
+    while (ct--) {
+        *dst = blend565_mod(*src++, *dst, mod);
+        dst++;
+    }
+}
+
+void scanline_t32cb32blend_simd(uint32_t* dst, const uint32_t* src, size_t ct)
+{
+#if defined(__SSE2__)
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i one = _mm_set1_epi16(0x100);
+    for ( ; ct >= 4 ; ct -= 4, src += 4, dst += 4) {
+        __m128i s = _mm_loadu_si128((const __m128i*)src);
+        __m128i d = _mm_loadu_si128((const __m128i*)dst);
+        __m128i slo = _mm_unpacklo_epi8(s, zero);
+        __m128i shi = _mm_unpackhi_epi8(s, zero);
+        __m128i dlo = _mm_unpacklo_epi8(d, zero);
+        __m128i dhi = _mm_unpackhi_epi8(d, zero);
+        /* each pixel's alpha in all four of its components */
+        __m128i alo = _mm_shufflehi_epi16(
+                _mm_shufflelo_epi16(slo, _MM_SHUFFLE(3,3,3,3)),
+                _MM_SHUFFLE(3,3,3,3));
+        __m128i ahi = _mm_shufflehi_epi16(
+                _mm_shufflelo_epi16(shi, _MM_SHUFFLE(3,3,3,3)),
+                _MM_SHUFFLE(3,3,3,3));
+        __m128i flo = _mm_sub_epi16(one,
+                _mm_add_epi16(alo, _mm_srli_epi16(alo, 7)));
+        __m128i fhi = _mm_sub_epi16(one,
+                _mm_add_epi16(ahi, _mm_srli_epi16(ahi, 7)));
+        dlo = _mm_add_epi16(slo, _mm_srli_epi16(_mm_mullo_epi16(dlo, flo), 8));
+        dhi = _mm_add_epi16(shi, _mm_srli_epi16(_mm_mullo_epi16(dhi, fhi), 8));
+        _mm_storeu_si128((__m128i*)dst, _mm_packus_epi16(dlo, dhi));
+    }
+#elif defined(BLEND_NEON)
+    const uint16x8_t one = vdupq_n_u16(0x100);
+    for ( ; ct >= 8 ; ct -= 8, src += 8, dst += 8) {
+        uint8x8x4_t s = vld4_u8((const uint8_t*)src);
+        uint8x8x4_t d = vld4_u8((const uint8_t*)dst);
+        uint16x8_t a = vmovl_u8(s.val[3]);
+        uint16x8_t f = vsubq_u16(one, vsraq_n_u16(a, a, 7));
+        int i;
+        for (i=0 ; i<4 ; i++) {
+            uint16x8_t c = vshrq_n_u16(vmulq_u16(vmovl_u8(d.val[i]), f), 8);
+            d.val[i] = vqmovn_u16(vaddw_u8(c, s.val[i]));
+        }
+        vst4_u8((uint8_t*)dst, d);
+    }
+#endif
+    while (ct--) {
+        *dst = blend8888(*src++, *dst);
+        dst++;
+    }
+}
@@ -149,7 +149,8 @@ ssize_t Assembly::resize(size_t newSize)
 // ----------------------------------------------------------------------------
 
 CodeCache::CodeCache(size_t size)
-    : mCacheSize(size), mCacheInUse(0)
+    : mWhen(0), mCacheSize(size), mCacheInUse(0),
+      mHits(0), mMisses(0), mEvictions(0)
 {
     pthread_mutex_init(&mLock, 0);
 }
@@ -168,6 +169,9 @@ sp<Assembly> CodeCache::lookup(const AssemblyKeyBase& keyBase) const
         const cache_entry_t& e = mCacheData.valueAt(index);
         e.when = mWhen++;
         r = e.entry;
+        mHits++;
+    } else {
+        mMisses++;
     }
     pthread_mutex_unlock(&mLock);
     return r;
@@ -179,7 +183,33 @@ int CodeCache::cache(  const AssemblyKeyBase& keyBase,
     pthread_mutex_lock(&mLock);
 
     const ssize_t assemblySize = assembly->size();
-    while (mCacheInUse + assemblySize > mCacheSize) {
+    const size_t evicted = evict(assemblySize);
+    if (evicted) {
+        ALOGI("evicted %zu assemblies for %zd bytes of code, "
+              "%zu hits %zu misses %zu evictions so far",
+              evicted, assemblySize, mHits, mMisses, mEvictions);
+    }
+
+    ssize_t err = mCacheData.add(key_t(keyBase), cache_entry_t(assembly, mWhen));
+    if (err >= 0) {
+        mCacheInUse += assemblySize;
+        mWhen++;
+        // synchronize caches...
+        char* base = reinterpret_cast<char*>(assembly->base());
+        char* curr = reinterpret_cast<char*>(base + assembly->size());
+        __builtin___clear_cache(base, curr);
+    }
+
+    pthread_mutex_unlock(&mLock);
+    return err;
+}
+
+// Makes room for size more bytes, returns how many entries that took.
+// An assembly larger than the whole cache is still cached, alone.
+size_t CodeCache::evict(size_t size)
+{
+    size_t evicted = 0;
+    while (mCacheData.size() && (mCacheInUse + size > mCacheSize)) {
         // evict the LRU
         size_t lru = 0;
         size_t count = mCacheData.size();
@@ -192,20 +222,33 @@ int CodeCache::cache(  const AssemblyKeyBase& keyBase,
         const cache_entry_t& e = mCacheData.valueAt(lru);
         mCacheInUse -= e.entry->size();
         mCacheData.removeItemsAt(lru);
+        evicted++;
     }
+    mEvictions += evicted;
+    return evicted;
+}
 
-    ssize_t err = mCacheData.add(key_t(keyBase), cache_entry_t(assembly, mWhen));
-    if (err >= 0) {
-        mCacheInUse += assemblySize;
-        mWhen++;
-        // synchronize caches...
-        char* base = reinterpret_cast<char*>(assembly->base());
-        char* curr = reinterpret_cast<char*>(base + assembly->size());
-        __builtin___clear_cache(base, curr);
+void CodeCache::setCacheSize(size_t size)
+{
+    if (size > kMaxCodeCacheCapacity) {
+        size = kMaxCodeCacheCapacity;
     }
+    pthread_mutex_lock(&mLock);
+    mCacheSize = size;
+    evict(0);
+    pthread_mutex_unlock(&mLock);
+}
 
+void CodeCache::getStats(Stats* stats) const
+{
+    pthread_mutex_lock(&mLock);
+    stats->hits = mHits;
+    stats->misses = mMisses;
+    stats->evictions = mEvictions;
+    stats->entries = mCacheData.size();
+    stats->inUse = mCacheInUse;
+    stats->size = mCacheSize;
     pthread_mutex_unlock(&mLock);
-    return err;
 }
 
 // ----------------------------------------------------------------------------
@@ -80,6 +80,15 @@ private:
 class CodeCache
 {
 public:
+    struct Stats {
+        size_t  hits;
+        size_t  misses;
+        size_t  evictions;
+        size_t  entries;
+        size_t  inUse;      // bytes of code cached
+        size_t  size;       // bytes of code cached before evicting
+    };
+
 // pretty simple cache API...
     explicit            CodeCache(size_t size);
                         ~CodeCache();
@@ -89,7 +98,15 @@ public:
     int                 cache(const AssemblyKeyBase& key,
                               const sp<Assembly>& assembly);
 
+    // evicts the least recently used entries down to the new size, which
+    // is capped to what the executable store can hold
+    void                setCacheSize(size_t size);
+
+    void                getStats(Stats* stats) const;
+
 private:
+    size_t              evict(size_t size);
+
     // nothing to see here...
     struct cache_entry_t {
         inline cache_entry_t() { }
@@ -113,6 +130,9 @@ private:
     mutable int64_t                     mWhen;
     size_t                              mCacheSize;
     size_t                              mCacheInUse;
+    mutable size_t                      mHits;
+    mutable size_t                      mMisses;
+    size_t                              mEvictions;
     KeyedVector<key_t, cache_entry_t>   mCacheData;
 
     friend int compare_type(
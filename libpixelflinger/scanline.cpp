@@ -23,6 +23,7 @@
 #include <string.h>
 
 #include <cutils/memory.h>
+#include <cutils/properties.h>
 #include <log/log.h>
 
 #include "buffer.h"
@@ -62,6 +63,15 @@
 #   define ANDROID_ARM_CODEGEN  0
 #endif
 
+/* SSE2 or NEON versions of the common blending shortcuts, blend_simd.c */
+#if (ANDROID_CODEGEN >= ANDROID_CODEGEN_ASM) && (BYTE_ORDER == LITTLE_ENDIAN) && \
+    (defined(__SSE2__) || defined(__aarch64__) || \
+     (defined(__arm__) && defined(__ARM_HAVE_NEON)))
+#   define ANDROID_SIMD_BLEND   1
+#else
+#   define ANDROID_SIMD_BLEND   0
+#endif
+
 #define DEBUG__CODEGEN_ONLY     0
 
 /* Set to 1 to dump to the log the states that need a new
@@ -111,6 +121,9 @@ static void scanline_t32cb16_clamp(context_t* c);
 static void scanline_t32cb16_clamp_dither(context_t* c);
 static void scanline_col32cb16blend(context_t* c);
 static void scanline_t16cb16_clamp(context_t* c);
+#if ANDROID_SIMD_BLEND
+static void scanline_t32cb32blend(context_t* c);
+#endif
 static void scanline_t16cb16blend_clamp_mod(context_t* c);
 static void scanline_memcpy(context_t* c);
 static void scanline_memset8(context_t* c);
@@ -138,6 +151,17 @@ extern "C" void scanline_t32cb16blend_mips64(uint16_t*, uint32_t*, size_t);
 extern "C" void scanline_col32cb16blend_mips64(uint16_t *dst, uint32_t col, size_t ct);
 #endif
 
+#if ANDROID_SIMD_BLEND
+extern "C" void scanline_t32cb16blend_simd(uint16_t*, const uint32_t*, size_t);
+extern "C" void scanline_col32cb16blend_simd(uint16_t *dst, uint32_t col, size_t ct);
+extern "C" void scanline_t32cb16blend_mod_simd(uint16_t*, const uint32_t*, size_t,
+        const int32_t* mod);
+extern "C" void scanline_t32cb32blend_simd(uint32_t*, const uint32_t*, size_t);
+
+/* texels fetched ahead of each call to the blending kernels */
+#define SIMD_BLEND_CHUNK    64
+#endif
+
 // ----------------------------------------------------------------------------
 
 static inline uint16_t  convertAbgr8888ToRgb565(uint32_t  pix)
@@ -166,6 +190,9 @@ struct shortcut_t {
  *   - the last nibble of the third value is the source texture format
  *   - formats: 4=rgb565 1=abgr8888 2=xbgr8888
  *
+ * Entries only present with ANDROID_SIMD_BLEND have no C version, on
+ * other targets the code generator is at least as fast.
+ *
  * In the descriptions below:
  *
  *   SRC      means we copy the source pixels to the destination
@@ -247,6 +274,12 @@ static shortcut_t shortcuts[] = {
     { { { 0x03515104, 0x00000077, { 0x00000000, 0x00000000 } },
         { 0xFFFFFFFF, 0xFFFFFFFF, { 0xFFFFFFFF, 0xFFFFFFFF } } },
         "565 fb, 8888 fixed color", scanline_col32cb16blend, init_y_packed  },  
+#if ANDROID_SIMD_BLEND
+    /* dithering has nothing to do with a 32 bits fb */
+    { { { 0x03515101, 0x00000077, { 0x00000A01, 0x00000000 } },
+        { 0xFFFFFFFF, 0xFFFFFEFF, { 0xFFFFFFFF, 0x0000003F } } },
+        "8888 fb, 8888 tx, blend SRC_OVER", scanline_t32cb32blend, init_y_noop },
+#endif
     { { { 0x00000000, 0x00000000, { 0x00000000, 0x00000000 } },
         { 0x00000000, 0x00000007, { 0x00000000, 0x00000000 } } },
         "(nop) alpha test", scanline_noop, init_y_noop },
@@ -310,6 +343,17 @@ void ggl_init_scanline(context_t* c)
     c->init_y = init_y;
     c->step_y = step_y__generic;
     c->scanline = scanline;
+
+#if ANDROID_ARM_CODEGEN
+    // processes cycling through many pipelines can ask for a larger cache
+    char value[PROPERTY_VALUE_MAX];
+    if (property_get("debug.pf.codecache_kb", value, NULL) > 0) {
+        const int kb = atoi(value);
+        if (kb > 0) {
+            gCodeCache.setCacheSize(size_t(kb) * 1024);
+        }
+    }
+#endif
 }
 
 void ggl_uninit_scanline(context_t* c)
@@ -419,6 +463,12 @@ static void pick_scanline(context_t* c)
             // finally, cache this assembly
             err = gCodeCache.cache(a->key(), a) < 0;
         }
+        CodeCache::Stats stats;
+        gCodeCache.getStats(&stats);
+        ALOGD("code cache: %zu assemblies, %zu of %zu bytes, "
+              "%zu hits %zu misses %zu evictions",
+              stats.entries, stats.inUse, stats.size,
+              stats.hits, stats.misses, stats.evictions);
         if (ggl_unlikely(err)) {
             ALOGE("error generating or caching assembly. Reverting to NOP.");
             c->scanline = scanline_noop;
@@ -1259,6 +1309,13 @@ struct blender_modulate {
         m_b = b + (b >> 7);
         m_a = a + (a >> 7);
     }
+    /* r, g, b and a, as scanline_t32cb16blend_mod_simd() takes them */
+    void get_factors(int32_t* f) const {
+        f[0] = m_r;
+        f[1] = m_g;
+        f[2] = m_b;
+        f[3] = m_a;
+    }
 protected:
     int m_r, m_g, m_b, m_a;
 };
@@ -1552,11 +1609,27 @@ void scanline_t32cb16blend_clamp_mod(context_t* c)
     blender_32to16_modulate bl(c);
 
     clamp_iterator ci(c);
+#if ANDROID_SIMD_BLEND
+    /* fetch a run of texels, then modulate and blend them all at once */
+    int32_t mod[4];
+    uint32_t src[SIMD_BLEND_CHUNK];
+    bl.get_factors(mod);
+    while (di.count > 0) {
+        const int n = (di.count < SIMD_BLEND_CHUNK) ? di.count : SIMD_BLEND_CHUNK;
+        for (int i=0 ; i<n ; i++) {
+            src[i] = ci.get_pixel32();
+        }
+        scanline_t32cb16blend_mod_simd(di.dst, src, n, mod);
+        di.dst += n;
+        di.count -= n;
+    }
+#else
     while (di.count--) {
         uint32_t s = ci.get_pixel32();
         bl.write(s, di.dst);
         di.dst++;
     }
+#endif
 }
 
 void scanline_t32cb16blend_clamp_mod_dither(context_t* c)
@@ -2107,6 +2180,8 @@ void scanline_col32cb16blend(context_t* c)
     scanline_col32cb16blend_arm64(dst, GGL_RGBA_TO_HOST(c->packed8888), ct);
 #elif ((ANDROID_CODEGEN >= ANDROID_CODEGEN_ASM) && (defined(__mips__) && defined(__LP64__)))
     scanline_col32cb16blend_mips64(dst, GGL_RGBA_TO_HOST(c->packed8888), ct);
+#elif ANDROID_SIMD_BLEND
+    scanline_col32cb16blend_simd(dst, GGL_RGBA_TO_HOST(c->packed8888), ct);
 #else
     uint32_t s = GGL_RGBA_TO_HOST(c->packed8888);
     int sA = (s>>24);
@@ -2179,7 +2254,8 @@ last_one:
 
 void scanline_t32cb16blend(context_t* c)
 {
-#if ((ANDROID_CODEGEN >= ANDROID_CODEGEN_ASM) && (defined(__arm__) || defined(__aarch64__) || \
+#if ANDROID_SIMD_BLEND || \
+    ((ANDROID_CODEGEN >= ANDROID_CODEGEN_ASM) && (defined(__arm__) || defined(__aarch64__) || \
     (defined(__mips__) && ((!defined(__LP64__) && __mips_isa_rev < 6) || defined(__LP64__)))))
     int32_t x = c->iterators.xl;
     size_t ct = c->iterators.xr - x;
@@ -2192,7 +2268,9 @@ void scanline_t32cb16blend(context_t* c)
     const int32_t v = (c->state.texture[0].shade.it0>>16) + y;
     uint32_t *src = reinterpret_cast<uint32_t*>(tex->data)+(u+(tex->stride*v));
 
-#ifdef __arm__
+#if ANDROID_SIMD_BLEND
+    scanline_t32cb16blend_simd(dst, src, ct);
+#elif defined(__arm__)
     scanline_t32cb16blend_arm(dst, src, ct);
 #elif defined(__aarch64__)
     scanline_t32cb16blend_arm64(dst, src, ct);
@@ -2213,6 +2291,24 @@ void scanline_t32cb16blend(context_t* c)
 #endif
 }
 
+#if ANDROID_SIMD_BLEND
+void scanline_t32cb32blend(context_t* c)
+{
+    int32_t x = c->iterators.xl;
+    size_t ct = c->iterators.xr - x;
+    int32_t y = c->iterators.y;
+    surface_t* cb = &(c->state.buffers.color);
+    uint32_t* dst = reinterpret_cast<uint32_t*>(cb->data) + (x+(cb->stride*y));
+
+    surface_t* tex = &(c->state.texture[0].surface);
+    const int32_t u = (c->state.texture[0].shade.is0>>16) + x;
+    const int32_t v = (c->state.texture[0].shade.it0>>16) + y;
+    uint32_t *src = reinterpret_cast<uint32_t*>(tex->data)+(u+(tex->stride*v));
+
+    scanline_t32cb32blend_simd(dst, src, ct);
+}
+#endif
+
 void scanline_t32cb16blend_srca(context_t* c)
 {
     dst_iterator16  di(c);
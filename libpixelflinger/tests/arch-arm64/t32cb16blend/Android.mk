@@ -3,7 +3,8 @@ include $(CLEAR_VARS)
 
 LOCAL_SRC_FILES:= \
     t32cb16blend_test.c \
-    ../../../arch-arm64/t32cb16blend.S
+    ../../../arch-arm64/t32cb16blend.S \
+    ../../../blend_simd.c
 
 LOCAL_SHARED_LIBRARIES :=
 
@@ -57,11 +57,15 @@ struct test_t tests[] =
     {"Count 3, Src=Rand, Dst=Rand", 0x11111111, 0xEDFE, 3},
     {"Count 4, Src=Rand, Dst=Rand", 0x12345678, 0x9ABC, 4},
     {"Count 5, Src=Rand, Dst=Rand", 0xEFEFFEFE, 0xFACC, 5},
-    {"Count 10, Src=Rand, Dst=Rand", 0x12345678, 0x9ABC, 10}
+    {"Count 10, Src=Rand, Dst=Rand", 0x12345678, 0x9ABC, 10},
+    {"Count 8, Src=Rand, Dst=Rand", 0x80402010, 0x9ABC, 8},
+    {"Count 16, Src=Rand, Dst=Rand", 0x7F7F7F7F, 0xFFFF, 16},
+    {"Count 15, Src=Rand, Dst=Rand", 0xC0123456, 0x1234, 15}
 
 };
 
 void scanline_t32cb16blend_arm64(uint16_t*, uint32_t*, size_t);
+void scanline_t32cb16blend_simd(uint16_t*, const uint32_t*, size_t);
 void scanline_t32cb16blend_c(uint16_t * dst, uint32_t* src, size_t count)
 {
     while (count--)
@@ -90,7 +94,7 @@ void scanline_t32cb16blend_c(uint16_t * dst, uint32_t* src, size_t count)
 
 void scanline_t32cb16blend_test()
 {
-    uint16_t dst_c[16], dst_asm[16];
+    uint16_t dst_c[16], dst_asm[16], dst_neon[16];
     uint32_t src[16];
     uint32_t i;
     uint32_t  j;
@@ -103,26 +107,31 @@ void scanline_t32cb16blend_test()
 
         memset(dst_c, 0, sizeof(dst_c));
         memset(dst_asm, 0, sizeof(dst_asm));
+        memset(dst_neon, 0, sizeof(dst_neon));
 
         for(j = 0; j < test.count; ++j)
         {
             dst_c[j]   = test.dst_color;
             dst_asm[j] = test.dst_color;
+            dst_neon[j] = test.dst_color;
             src[j] = test.src_color;
         }
 
         scanline_t32cb16blend_c(dst_c,src,test.count);
         scanline_t32cb16blend_arm64(dst_asm,src,test.count);
+        scanline_t32cb16blend_simd(dst_neon,src,test.count);
 
 
-        if(memcmp(dst_c, dst_asm, sizeof(dst_c)) == 0)
+        if(memcmp(dst_c, dst_asm, sizeof(dst_c)) == 0 &&
+           memcmp(dst_c, dst_neon, sizeof(dst_c)) == 0)
             printf("Passed\n");
         else
             printf("Failed\n");
 
         for(j = 0; j < test.count; ++j)
         {
-            printf("dst_c[%d] = %x, dst_asm[%d] = %x \n", j, dst_c[j], j, dst_asm[j]);
+            printf("dst_c[%d] = %x, dst_asm[%d] = %x, dst_neon[%d] = %x \n",
+                   j, dst_c[j], j, dst_asm[j], j, dst_neon[j]);
         }
     }
 }
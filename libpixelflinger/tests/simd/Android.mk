@@ -0,0 +1,16 @@
+LOCAL_PATH:= $(call my-dir)
+include $(CLEAR_VARS)
+
+LOCAL_SRC_FILES:= \
+    blend_simd_test.c \
+    ../../blend_simd.c
+
+LOCAL_SHARED_LIBRARIES :=
+
+LOCAL_C_INCLUDES :=
+
+LOCAL_MODULE:= test-pixelflinger-blend-simd
+
+LOCAL_MODULE_TAGS := tests
+
+include $(BUILD_NATIVE_TEST)
@@ -0,0 +1,242 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Checks the blend_simd.c kernels against the per pixel C loops of
+ * scanline.cpp (clamped, as the assembly versions are), then reports
+ * how many Mpixels/s each of them blends.
+ */
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define MAX_COUNT       67
+#define BENCH_PIXELS    (64 * 1024)
+#define BENCH_RUNS      200
+
+void scanline_t32cb16blend_simd(uint16_t*, const uint32_t*, size_t);
+void scanline_col32cb16blend_simd(uint16_t*, uint32_t, size_t);
+void scanline_t32cb16blend_mod_simd(uint16_t*, const uint32_t*, size_t,
+        const int32_t*);
+void scanline_t32cb32blend_simd(uint32_t*, const uint32_t*, size_t);
+
+static const int32_t mod[4] = { 0x100, 0x81, 0x40, 0xc0 };
+
+static void scanline_t32cb16blend_c(uint16_t* dst, const uint32_t* src,
+        size_t count)
+{
+    while (count--) {
+        uint16_t d = *dst;
+        uint32_t s = *src++;
+        int dstR = (d>>11)&0x1f;
+        int dstG = (d>>5)&0x3f;
+        int dstB = (d)&0x1f;
+        int srcR = (s >> (   3))&0x1F;
+        int srcG = (s >> ( 8+2))&0x3F;
+        int srcB = (s >> (16+3))&0x1F;
+        int srcAlpha = (s>>24) & 0xFF;
+        int f = 0x100 - (srcAlpha + (srcAlpha>>7));
+        srcR += (f*dstR)>>8;
+        srcG += (f*dstG)>>8;
+        srcB += (f*dstB)>>8;
+        srcR = srcR > 0x1F? 0x1F: srcR;
+        srcG = srcG > 0x3F? 0x3F: srcG;
+        srcB = srcB > 0x1F? 0x1F: srcB;
+        *dst++ = (uint16_t)((srcR<<11)|(srcG<<5)|srcB);
+    }
+}
+
+static void scanline_col32cb16blend_c(uint16_t* dst, uint32_t col,
+        size_t count)
+{
+    while (count--) {
+        scanline_t32cb16blend_c(dst++, &col, 1);
+    }
+}
+
+static void scanline_t32cb16blend_mod_c(uint16_t* dst, const uint32_t* src,
+        size_t count, const int32_t* m)
+{
+    while (count--) {
+        uint16_t d = *dst;
+        uint32_t s = *src++;
+        int sA = ((s >> 24) * m[3]) >> 8;
+        int sR = (((s      ) & 0xff) * m[0]) >> 3;
+        int sG = (((s >>  8) & 0xff) * m[1]) >> 2;
+        int sB = (((s >> 16) & 0xff) * m[2]) >> 3;
+        int f = 0x100 - (sA + (sA>>7));
+        sR = (sR + f*((d>>11)&0x1f))>>8;
+        sG = (sG + f*((d>>5)&0x3f))>>8;
+        sB = (sB + f*((d)&0x1f))>>8;
+        sR = sR > 0x1F? 0x1F: sR;
+        sG = sG > 0x3F? 0x3F: sG;
+        sB = sB > 0x1F? 0x1F: sB;
+        *dst++ = (uint16_t)((sR<<11)|(sG<<5)|sB);
+    }
+}
+
+static void scanline_t32cb32blend_c(uint32_t* dst, const uint32_t* src,
+        size_t count)
+{
+    while (count--) {
+        uint32_t d = *dst;
+        uint32_t s = *src++;
+        int sA = (s>>24);
+        int f = 0x100 - (sA + (sA>>7));
+        uint32_t r = 0;
+        int i;
+        for (i = 0; i < 32; i += 8) {
+            int c = ((s>>i)&0xff) + ((f*((d>>i)&0xff))>>8);
+            r |= (uint32_t)(c > 0xff ? 0xff : c) << i;
+        }
+        *dst++ = r;
+    }
+}
+
+/* premultiplied or not, transparent, opaque or anything in between */
+static uint32_t random_src()
+{
+    uint32_t s = ((uint32_t)rand() << 16) ^ (uint32_t)rand();
+    switch (rand() % 4) {
+        case 0: return 0;
+        case 1: return s | 0xff000000;
+        case 2: {
+            uint32_t a = s >> 24;
+            return (a << 24) | ((((s >> 16) & 0xff) * a / 255) << 16) |
+                   ((((s >> 8) & 0xff) * a / 255) << 8) | ((s & 0xff) * a / 255);
+        }
+    }
+    return s;
+}
+
+static int check()
+{
+    uint32_t src[MAX_COUNT], dst32_c[MAX_COUNT], dst32_simd[MAX_COUNT];
+    uint16_t dst_c[MAX_COUNT], dst_simd[MAX_COUNT];
+    int failed = 0;
+    size_t count;
+    int i, run;
+
+    for (run = 0; run < 100; ++run) {
+        for (count = 0; count < MAX_COUNT; ++count) {
+            for (i = 0; i < MAX_COUNT; ++i) {
+                src[i] = random_src();
+                dst_c[i] = dst_simd[i] = (uint16_t)rand();
+                dst32_c[i] = dst32_simd[i] = random_src();
+            }
+            /* what is past count must be left alone */
+            scanline_t32cb16blend_c(dst_c, src, count);
+            scanline_t32cb16blend_simd(dst_simd, src, count);
+            if (memcmp(dst_c, dst_simd, sizeof(dst_c))) {
+                printf("t32cb16blend failed, count %zu\n", count);
+                failed = 1;
+            }
+            scanline_col32cb16blend_c(dst_c, src[0], count);
+            scanline_col32cb16blend_simd(dst_simd, src[0], count);
+            if (memcmp(dst_c, dst_simd, sizeof(dst_c))) {
+                printf("col32cb16blend failed, count %zu\n", count);
+                failed = 1;
+            }
+            scanline_t32cb16blend_mod_c(dst_c, src, count, mod);
+            scanline_t32cb16blend_mod_simd(dst_simd, src, count, mod);
+            if (memcmp(dst_c, dst_simd, sizeof(dst_c))) {
+                printf("t32cb16blend_mod failed, count %zu\n", count);
+                failed = 1;
+            }
+            scanline_t32cb32blend_c(dst32_c, src, count);
+            scanline_t32cb32blend_simd(dst32_simd, src, count);
+            if (memcmp(dst32_c, dst32_simd, sizeof(dst32_c))) {
+                printf("t32cb32blend failed, count %zu\n", count);
+                failed = 1;
+            }
+        }
+    }
+    printf("%s\n", failed ? "Failed" : "Passed");
+    return failed;
+}
+
+static int64_t now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void report(const char* name, int64_t c_ns, int64_t simd_ns)
+{
+    const double pixels = (double)BENCH_PIXELS * BENCH_RUNS;
+    printf("%-18s C %8.1f Mpixels/s  SIMD %8.1f Mpixels/s\n", name,
+           pixels * 1000 / c_ns, pixels * 1000 / simd_ns);
+}
+
+static void bench()
+{
+    uint32_t* src = malloc(BENCH_PIXELS * sizeof(*src));
+    uint32_t* dst32 = malloc(BENCH_PIXELS * sizeof(*dst32));
+    uint16_t* dst = malloc(BENCH_PIXELS * sizeof(*dst));
+    int64_t c_ns, simd_ns, t;
+    int i;
+
+    if (!src || !dst32 || !dst) {
+        free(src);
+        free(dst32);
+        free(dst);
+        return;
+    }
+    for (i = 0; i < BENCH_PIXELS; ++i) {
+        src[i] = random_src();
+        dst[i] = (uint16_t)rand();
+        dst32[i] = random_src();
+    }
+
+#define BENCH(name, c_call, simd_call)                          \
+    t = now_ns();                                               \
+    for (i = 0; i < BENCH_RUNS; ++i) c_call;                    \
+    c_ns = now_ns() - t;                                        \
+    t = now_ns();                                               \
+    for (i = 0; i < BENCH_RUNS; ++i) simd_call;                 \
+    simd_ns = now_ns() - t;                                     \
+    report(name, c_ns, simd_ns)
+
+    BENCH("t32cb16blend",
+          scanline_t32cb16blend_c(dst, src, BENCH_PIXELS),
+          scanline_t32cb16blend_simd(dst, src, BENCH_PIXELS));
+    BENCH("col32cb16blend",
+          scanline_col32cb16blend_c(dst, src[i], BENCH_PIXELS),
+          scanline_col32cb16blend_simd(dst, src[i], BENCH_PIXELS));
+    BENCH("t32cb16blend_mod",
+          scanline_t32cb16blend_mod_c(dst, src, BENCH_PIXELS, mod),
+          scanline_t32cb16blend_mod_simd(dst, src, BENCH_PIXELS, mod));
+    BENCH("t32cb32blend",
+          scanline_t32cb32blend_c(dst32, src, BENCH_PIXELS),
+          scanline_t32cb32blend_simd(dst32, src, BENCH_PIXELS));
+
+#undef BENCH
+
+    free(src);
+    free(dst32);
+    free(dst);
+}
+
+int main()
+{
+    int failed = check();
+    bench();
+    return failed;
+}
@@ -20,8 +20,14 @@
 #include <assert.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
+#include <condition_variable>
+#include <mutex>
+
+#include <android-base/thread_pool.h>
 #include <cutils/memory.h>
+#include <cutils/properties.h>
 #include <log/log.h>
 
 #include "trap.h"
@@ -34,6 +40,13 @@ namespace android {
 // enable to see triangles edges
 #define DEBUG_TRANGLES  0
 
+// rects of at least that many pixels are split into bands of rows rendered
+// in parallel, when debug.pf.raster_threads asks for more than one thread
+#define TILE_MIN_PIXELS (128 * 1024)
+
+// bytes of color buffer per band, so each stays in its cpu's cache
+#define TILE_BYTES      (64 * 1024)
+
 // ----------------------------------------------------------------------------
 
 static void pointx_validate(void *con, const GGLcoord* c, GGLcoord r);
@@ -47,6 +60,9 @@ static void aa_linex(void *con, const GGLcoord* v0, const GGLcoord* v1, GGLcoord
 
 static void recti_validate(void* c, GGLint l, GGLint t, GGLint r, GGLint b); 
 static void recti(void* c, GGLint l, GGLint t, GGLint r, GGLint b); 
+static void recti_tiled(context_t* c, int xc, int yc,
+        android::base::ThreadPool* pool);
+static android::base::ThreadPool* raster_pool();
 
 static void trianglex_validate(void*,
         const GGLcoord*, const GGLcoord*, const GGLcoord*);
@@ -438,8 +454,76 @@ void recti(void* con, GGLint l, GGLint t, GGLint r, GGLint b)
         c->iterators.xl = l;
         c->iterators.xr = r;
         c->init_y(c, t);
+        android::base::ThreadPool* pool = raster_pool();
+        if (pool && (xc * yc >= TILE_MIN_PIXELS)) {
+            recti_tiled(c, xc, yc, pool);
+        } else {
+            c->rect(c, yc);
+        }
+    }
+}
+
+android::base::ThreadPool* raster_pool()
+{
+    static android::base::ThreadPool* const pool = []() {
+        char value[PROPERTY_VALUE_MAX];
+        property_get("debug.pf.raster_threads", value, "0");
+        const int threads = atoi(value);
+        return (threads > 1) ? new android::base::ThreadPool(threads - 1)
+                             : nullptr;
+    }();
+    return pool;
+}
+
+// Each band renders with its own copy of the context, stepped to the
+// band's first row from the one before, so the iterators match what
+// rendering the rect in one go would have seen row for row.
+void recti_tiled(context_t* c, int xc, int yc, android::base::ThreadPool* pool)
+{
+    const size_t bpp = c->formats[c->state.buffers.color.format].size;
+    const int rows = max(1, int(TILE_BYTES / (xc * bpp)));
+    const int bands = (yc + rows - 1) / rows;
+    if (bands < 2) {
         c->rect(c, yc);
+        return;
+    }
+
+    // generated pipelines want the context aligned, as gglInit() does
+    void* const base = malloc(bands * sizeof(context_t) + 32);
+    if (!base) {
+        c->rect(c, yc);
+        return;
     }
+    context_t* const contexts = (context_t*)((ptrdiff_t(base)+31) & ~0x1FL);
+
+    std::mutex lock;
+    std::condition_variable done;
+    int pending = bands - 1;
+    for (int i=0 ; i<bands ; i++) {
+        const int count = min(rows, yc - i*rows);
+        context_t* const band = contexts + i;
+        memcpy(band, c, sizeof(context_t));
+        for (int y=0 ; y<count ; y++) {
+            c->step_y(c);
+        }
+        if (i == 0) {
+            continue;
+        }
+        pool->Submit([band, count, &lock, &done, &pending]() {
+            band->rect(band, count);
+            std::lock_guard<std::mutex> guard(lock);
+            if (--pending == 0) {
+                done.notify_one();
+            }
+        });
+    }
+
+    // the first band is ours
+    contexts->rect(contexts, min(rows, yc));
+    std::unique_lock<std::mutex> guard(lock);
+    done.wait(guard, [&pending]() { return pending == 0; });
+    guard.unlock();
+    free(base);
 }
 
 // ----------------------------------------------------------------------------
@@ -22,6 +22,8 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <inttypes.h>
+#include <poll.h>
+#include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -29,6 +31,7 @@
 #include <sys/types.h>
 #include <unistd.h>
 
+#include <algorithm>
 #include <chrono>
 #include <memory>
 #include <mutex>
@@ -53,6 +56,9 @@ using namespace std::chrono_literals;
 #define PROCESSGROUP_UID_PREFIX "uid_"
 #define PROCESSGROUP_PID_PREFIX "pid_"
 #define PROCESSGROUP_CGROUP_PROCS_FILE "/cgroup.procs"
+// Only on cgroup v2.
+#define PROCESSGROUP_CGROUP_EVENTS_FILE "/cgroup.events"
+#define PROCESSGROUP_CGROUP_KILL_FILE "/cgroup.kill"
 #define PROCESSGROUP_MAX_UID_LEN 11
 #define PROCESSGROUP_MAX_PID_LEN 11
 #define PROCESSGROUP_MAX_PATH_LEN \
@@ -284,7 +290,7 @@ static int doKillProcessGroupOnce(uid_t uid, int initialPid, int signal) {
 
     // Erase all pids that will be killed when we kill the process groups.
     for (auto it = pids.begin(); it != pids.end();) {
-        pid_t pgid = getpgid(pid);
+        pid_t pgid = getpgid(*it);
         if (pgids.count(pgid) == 1) {
             it = pids.erase(it);
         } else {
@@ -315,16 +321,70 @@ static int doKillProcessGroupOnce(uid_t uid, int initialPid, int signal) {
     return ret >= 0 ? processes : ret;
 }
 
+static int openProcessGroupFile(uid_t uid, int pid, const char* fileName, int flags) {
+    char path[PROCESSGROUP_MAX_PATH_LEN] = {0};
+    convertUidPidToPath(path, sizeof(path), uid, pid);
+    strlcat(path, fileName, sizeof(path));
+    return TEMP_FAILURE_RETRY(open(path, flags | O_CLOEXEC));
+}
+
+// Returns whether the cgroup.events file open at |fd| says that the cgroup still has processes.
+static bool isProcessGroupPopulated(int fd) {
+    char buf[128];
+    ssize_t len = TEMP_FAILURE_RETRY(pread(fd, buf, sizeof(buf) - 1, 0));
+    if (len <= 0) return true;
+    buf[len] = '\0';
+    const char* populated = strstr(buf, "populated ");
+    return populated == nullptr || populated[strlen("populated ")] != '0';
+}
+
+// Waits until the processes that were sent a signal are gone, or |timeout| has passed. The
+// kernel notifies changes to cgroup.events, so on cgroup v2 this returns as soon as the cgroup
+// is empty. cgroup v1 has no such notification, so all that's left is to sleep.
+static void waitForProcessGroup(int events_fd, std::chrono::milliseconds timeout) {
+    if (events_fd == -1) {
+        std::this_thread::sleep_for(timeout);
+        return;
+    }
+    if (!isProcessGroupPopulated(events_fd)) return;
+    pollfd pfd = {events_fd, POLLPRI, 0};
+    TEMP_FAILURE_RETRY(poll(&pfd, 1, timeout.count()));
+}
+
 static int killProcessGroup(uid_t uid, int initialPid, int signal, int retries) {
     std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
 
-    int retry = retries;
+    android::base::unique_fd events_fd(
+            openProcessGroupFile(uid, initialPid, PROCESSGROUP_CGROUP_EVENTS_FILE, O_RDONLY));
+
+    // cgroup v2 can kill every process in the cgroup at once, including any that are forked
+    // while doing so, which saves going through cgroup.procs until nothing is left to kill.
+    bool killed_in_bulk = false;
+    if (signal == SIGKILL && retries > 0) {
+        android::base::unique_fd kill_fd(
+                openProcessGroupFile(uid, initialPid, PROCESSGROUP_CGROUP_KILL_FILE, O_WRONLY));
+        killed_in_bulk = kill_fd != -1 && TEMP_FAILURE_RETRY(write(kill_fd, "1", 1)) == 1;
+    }
+
+    // Without the notification, check back quickly at first, since most processes are gone in
+    // well under the 5ms that was waited for every time, and then every 5ms up to the same
+    // limit of retries * 5ms as before.
+    std::chrono::steady_clock::time_point deadline = start + retries * 5ms;
+    std::chrono::milliseconds wait = events_fd != -1 ? 5ms : 1ms;
+    int passes = 0;
     int processes;
+    if (killed_in_bulk) {
+        waitForProcessGroup(events_fd, std::chrono::duration_cast<std::chrono::milliseconds>(
+                                               deadline - std::chrono::steady_clock::now()));
+    }
     while ((processes = doKillProcessGroupOnce(uid, initialPid, signal)) > 0) {
+        passes++;
         LOG(VERBOSE) << "Killed " << processes << " processes for processgroup " << initialPid;
-        if (retry > 0) {
-            std::this_thread::sleep_for(5ms);
-            --retry;
+        std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+        if (now < deadline) {
+            auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - now);
+            waitForProcessGroup(events_fd, std::min(wait, remaining + 1ms));
+            wait = std::min<std::chrono::milliseconds>(wait * 2, 5ms);
         } else {
             break;
         }
@@ -348,7 +408,9 @@ static int killProcessGroup(uid_t uid, int initialPid, int signal, int retries)
     if (processes == 0) {
         if (retries > 0) {
             LOG(INFO) << "Successfully killed process cgroup uid " << uid << " pid " << initialPid
-                      << " in " << static_cast<int>(ms) << "ms";
+                      << " in " << static_cast<int>(ms) << "ms"
+                      << (killed_in_bulk ? " with cgroup.kill" : "") << ", " << passes
+                      << " signal passes";
         }
         return removeProcessGroup(uid, initialPid);
     } else {
@@ -18,15 +18,19 @@
 
 #include <dirent.h>
 #include <fcntl.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <sys/types.h>
 #include <unistd.h>
 
+#include <functional>
 #include <memory>
 #include <string>
 #include <type_traits>
+#include <unordered_map>
 
 #include <android-base/logging.h>
+#include <android-base/macros.h>
 #include <android-base/parseint.h>
 #include <android-base/unique_fd.h>
 
@@ -110,6 +114,86 @@ auto GetProcessTids(pid_t pid, Collection* out) ->
   return GetProcessTidsFromProcPidFd(fd.get(), out);
 }
 
+// The fields of /proc/<tid>/stat that are commonly wanted.
+struct ProcessStat {
+  pid_t tid;
+  std::string comm;  // without the parentheses
+  ProcessState state;
+  pid_t ppid;
+  pid_t pgrp;
+  pid_t session;
+  uint64_t utime;  // in clock ticks, as the rest of the times
+  uint64_t stime;
+  int64_t priority;
+  int64_t nice;
+  int64_t num_threads;
+  uint64_t starttime;  // since boot: tells a reused pid from the process it was
+  uint64_t vsize;      // in bytes
+  int64_t rss;         // in pages
+};
+
+// Parse the len bytes of a /proc/<tid>/stat line at data, in a single pass
+// over its fixed fields, into |stat|.
+bool ParseProcessStat(const char* data, size_t len, ProcessStat* stat);
+
+// Read and parse /proc/<tid>/stat into |stat|.
+bool GetProcessStat(pid_t tid, ProcessStat* stat);
+
+// Walks all of /proc, or the threads of a process, reading each stat file
+// into the same buffer and ProcessStat: no per task allocation or directory
+// fd. Tasks that exit while being walked are skipped.
+class ProcessStatReader {
+ public:
+  using Callback = std::function<void(const ProcessStat&)>;
+
+  ProcessStatReader() = default;
+
+  // Call |callback| with the stat of every process.
+  bool ForEachProcess(const Callback& callback);
+
+  // Call |callback| with the stat of every thread of process |pid|.
+  bool ForEachThread(pid_t pid, const Callback& callback);
+
+ private:
+  bool ForEachIn(const char* path, const Callback& callback);
+  bool Read(int dirfd, const char* name);
+
+  char buffer_[1024];
+  ProcessStat stat_;
+
+  DISALLOW_COPY_AND_ASSIGN(ProcessStatReader);
+};
+
+// The stats of all processes as of the last Update(), which walks /proc once.
+// A pid that has since gone to another process is told apart by its start
+// time: Update() reports it as new, like a pid not seen before.
+class ProcessStatCache {
+ public:
+  ProcessStatCache() = default;
+
+  // Rewalk /proc. |started| and |exited|, if set, are called for processes
+  // (and reused pids) not there last time, and for those no longer there.
+  bool Update(const ProcessStatReader::Callback& started = nullptr,
+              const std::function<void(pid_t)>& exited = nullptr);
+
+  // nullptr if there was no process |pid| at the last Update().
+  const ProcessStat* Find(pid_t pid) const;
+
+  size_t size() const { return stats_.size(); }
+
+ private:
+  struct Entry {
+    ProcessStat stat;
+    uint64_t generation = 0;
+  };
+
+  ProcessStatReader reader_;
+  std::unordered_map<pid_t, Entry> stats_;
+  uint64_t generation_ = 0;
+
+  DISALLOW_COPY_AND_ASSIGN(ProcessStatCache);
+};
+
 #endif
 
 } /* namespace procinfo */
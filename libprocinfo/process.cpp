@@ -16,6 +16,7 @@
 
 #include <procinfo/process.h>
 
+#include <dirent.h>
 #include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -126,5 +127,181 @@ bool GetProcessInfoFromProcPidFd(int fd, ProcessInfo* process_info) {
   return field_bitmap == finished_bitmap;
 }
 
+// Unlike parse_state, quiet about the states only stat reports (idle, dead,
+// ...), as walking all of /proc meets them all the time.
+static ProcessState parse_stat_state(char state) {
+  switch (state) {
+    case 'R':
+      return kProcessStateRunning;
+    case 'S':
+      return kProcessStateSleeping;
+    case 'D':
+      return kProcessStateUninterruptibleWait;
+    case 'T':
+    case 't':
+      return kProcessStateStopped;
+    case 'Z':
+      return kProcessStateZombie;
+    default:
+      return kProcessStateUnknown;
+  }
+}
+
+bool ParseProcessStat(const char* data, size_t len, ProcessStat* stat) {
+  const char* end = data + len;
+
+  // "tid (comm) state ...": comm may hold anything, spaces and ')' included,
+  // so it ends at the last ')'.
+  const char* open_paren = static_cast<const char*>(memchr(data, '(', len));
+  const char* close_paren = nullptr;
+  for (const char* p = end; p > data; --p) {
+    if (p[-1] == ')') {
+      close_paren = p - 1;
+      break;
+    }
+  }
+  if (open_paren == nullptr || close_paren == nullptr || close_paren < open_paren ||
+      end - close_paren < 4) {
+    return false;
+  }
+
+  stat->tid = atoi(data);
+  stat->comm.assign(open_paren + 1, close_paren - open_paren - 1);
+  stat->state = parse_stat_state(close_paren[2]);
+
+  // Fields 4 (ppid) to 24 (rss), numbers one space apart.
+  static constexpr int kFirstField = 4;
+  static constexpr int kLastField = 24;
+  int64_t fields[kLastField + 1];
+  const char* p = close_paren + 3;
+  for (int field = kFirstField; field <= kLastField; ++field) {
+    if (p >= end || *p != ' ') {
+      return false;
+    }
+    ++p;
+    bool negative = (p < end && *p == '-');
+    if (negative) {
+      ++p;
+    }
+    if (p >= end || *p < '0' || *p > '9') {
+      return false;
+    }
+    uint64_t value = 0;
+    while (p < end && *p >= '0' && *p <= '9') {
+      value = value * 10 + (*p++ - '0');
+    }
+    fields[field] = negative ? -static_cast<int64_t>(value) : static_cast<int64_t>(value);
+  }
+
+  stat->ppid = fields[4];
+  stat->pgrp = fields[5];
+  stat->session = fields[6];
+  stat->utime = fields[14];
+  stat->stime = fields[15];
+  stat->priority = fields[18];
+  stat->nice = fields[19];
+  stat->num_threads = fields[20];
+  stat->starttime = fields[22];
+  stat->vsize = fields[23];
+  stat->rss = fields[24];
+  return true;
+}
+
+// Reads dirfd/path, at most len bytes, into buffer in one read. Returns the
+// number of bytes read, or -1. Quietly: the task may well have gone.
+static ssize_t read_proc_file(int dirfd, const char* path, char* buffer, size_t len) {
+  unique_fd fd(openat(dirfd, path, O_RDONLY | O_CLOEXEC));
+  if (fd == -1) {
+    return -1;
+  }
+  return TEMP_FAILURE_RETRY(read(fd.get(), buffer, len));
+}
+
+bool GetProcessStat(pid_t tid, ProcessStat* stat) {
+  char path[PATH_MAX];
+  snprintf(path, sizeof(path), "/proc/%d/stat", tid);
+
+  char buffer[1024];
+  ssize_t len = read_proc_file(AT_FDCWD, path, buffer, sizeof(buffer));
+  if (len == -1) {
+    PLOG(ERROR) << "failed to read " << path;
+    return false;
+  }
+  return ParseProcessStat(buffer, len, stat);
+}
+
+bool ProcessStatReader::Read(int dirfd, const char* name) {
+  char path[32];
+  snprintf(path, sizeof(path), "%s/stat", name);
+
+  ssize_t len = read_proc_file(dirfd, path, buffer_, sizeof(buffer_));
+  return len > 0 && ParseProcessStat(buffer_, len, &stat_);
+}
+
+bool ProcessStatReader::ForEachIn(const char* path, const Callback& callback) {
+  std::unique_ptr<DIR, int (*)(DIR*)> dir(opendir(path), closedir);
+  if (!dir) {
+    PLOG(ERROR) << "failed to open " << path;
+    return false;
+  }
+
+  int dirfd = ::dirfd(dir.get());
+  struct dirent* dent;
+  while ((dent = readdir(dir.get()))) {
+    // Only the numbered entries are tasks.
+    if (dent->d_name[0] < '0' || dent->d_name[0] > '9') {
+      continue;
+    }
+    if (Read(dirfd, dent->d_name)) {
+      callback(stat_);
+    }
+  }
+  return true;
+}
+
+bool ProcessStatReader::ForEachProcess(const Callback& callback) {
+  return ForEachIn("/proc", callback);
+}
+
+bool ProcessStatReader::ForEachThread(pid_t pid, const Callback& callback) {
+  char path[PATH_MAX];
+  snprintf(path, sizeof(path), "/proc/%d/task", pid);
+  return ForEachIn(path, callback);
+}
+
+bool ProcessStatCache::Update(const ProcessStatReader::Callback& started,
+                              const std::function<void(pid_t)>& exited) {
+  ++generation_;
+  bool ok = reader_.ForEachProcess([&](const ProcessStat& stat) {
+    Entry& entry = stats_[stat.tid];
+    bool is_new = entry.generation == 0 || entry.stat.starttime != stat.starttime;
+    entry.stat = stat;
+    entry.generation = generation_;
+    if (is_new && started) {
+      started(entry.stat);
+    }
+  });
+  if (!ok) {
+    return false;
+  }
+
+  for (auto it = stats_.begin(); it != stats_.end();) {
+    if (it->second.generation != generation_) {
+      if (exited) {
+        exited(it->first);
+      }
+      it = stats_.erase(it);
+    } else {
+      ++it;
+    }
+  }
+  return true;
+}
+
+const ProcessStat* ProcessStatCache::Find(pid_t pid) const {
+  auto it = stats_.find(pid);
+  return it != stats_.end() ? &it->second.stat : nullptr;
+}
+
 } /* namespace procinfo */
 } /* namespace android */
@@ -0,0 +1,88 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <procinfo/process.h>
+
+#include <dirent.h>
+
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+static std::vector<pid_t> all_pids() {
+  std::vector<pid_t> pids;
+  std::unique_ptr<DIR, int (*)(DIR*)> dir(opendir("/proc"), closedir);
+  struct dirent* dent;
+  while ((dent = readdir(dir.get()))) {
+    pid_t pid = atoi(dent->d_name);
+    if (pid > 0) {
+      pids.push_back(pid);
+    }
+  }
+  return pids;
+}
+
+// Every process, one /proc/<pid>/status at a time, as the tools do today.
+static void BM_GetProcessInfo_all(benchmark::State& state) {
+  while (state.KeepRunning()) {
+    for (pid_t pid : all_pids()) {
+      android::procinfo::ProcessInfo info;
+      android::procinfo::GetProcessInfo(pid, &info);
+    }
+  }
+}
+BENCHMARK(BM_GetProcessInfo_all);
+
+static void BM_GetProcessStat_all(benchmark::State& state) {
+  while (state.KeepRunning()) {
+    for (pid_t pid : all_pids()) {
+      android::procinfo::ProcessStat stat;
+      android::procinfo::GetProcessStat(pid, &stat);
+    }
+  }
+}
+BENCHMARK(BM_GetProcessStat_all);
+
+static void BM_ProcessStatReader_ForEachProcess(benchmark::State& state) {
+  android::procinfo::ProcessStatReader reader;
+  while (state.KeepRunning()) {
+    size_t count = 0;
+    reader.ForEachProcess([&count](const android::procinfo::ProcessStat&) { count++; });
+    benchmark::DoNotOptimize(count);
+  }
+}
+BENCHMARK(BM_ProcessStatReader_ForEachProcess);
+
+static void BM_ProcessStatCache_Update(benchmark::State& state) {
+  android::procinfo::ProcessStatCache cache;
+  while (state.KeepRunning()) {
+    cache.Update();
+  }
+}
+BENCHMARK(BM_ProcessStatCache_Update);
+
+static void BM_ParseProcessStat(benchmark::State& state) {
+  static const char line[] =
+      "1234 (surfaceflinger) S 1 1234 1234 0 -1 4194560 1030 0 0 0 17 5 0 0 20 0 3 0 "
+      "4711 12345678 901 18446744073709551615 1 1 0 0 0 0 0 0 0 0 0 0 17 1 0 0 0 0 0\n";
+  android::procinfo::ProcessStat stat;
+  while (state.KeepRunning()) {
+    android::procinfo::ParseProcessStat(line, sizeof(line) - 1, &stat);
+  }
+}
+BENCHMARK(BM_ParseProcessStat);
+
+BENCHMARK_MAIN();
@@ -116,3 +116,94 @@ TEST(process_info, process_state) {
 
   ASSERT_EQ(forkpid, waitpid(forkpid, nullptr, 0));
 }
+
+TEST(process_info, parse_process_stat) {
+  // comm may hold spaces and parentheses of its own.
+  static const char line[] =
+      "1234 (a) b (c)) S 1 1234 1234 0 -1 4194560 1030 0 0 0 17 5 0 0 20 -2 3 0 "
+      "4711 12345678 901 18446744073709551615 1 1 0 0 0 0 0 0 0 0 0 0 17 1 0 0 0 0 0\n";
+  android::procinfo::ProcessStat stat;
+  ASSERT_TRUE(android::procinfo::ParseProcessStat(line, sizeof(line) - 1, &stat));
+  ASSERT_EQ(1234, stat.tid);
+  ASSERT_EQ("a) b (c)", stat.comm);
+  ASSERT_EQ(android::procinfo::kProcessStateSleeping, stat.state);
+  ASSERT_EQ(1, stat.ppid);
+  ASSERT_EQ(1234, stat.pgrp);
+  ASSERT_EQ(1234, stat.session);
+  ASSERT_EQ(17U, stat.utime);
+  ASSERT_EQ(5U, stat.stime);
+  ASSERT_EQ(20, stat.priority);
+  ASSERT_EQ(-2, stat.nice);
+  ASSERT_EQ(3, stat.num_threads);
+  ASSERT_EQ(4711U, stat.starttime);
+  ASSERT_EQ(12345678U, stat.vsize);
+  ASSERT_EQ(901, stat.rss);
+
+  // Cut short before rss.
+  ASSERT_FALSE(android::procinfo::ParseProcessStat(line, 80, &stat));
+  ASSERT_FALSE(android::procinfo::ParseProcessStat("1234 (a", 7, &stat));
+}
+
+TEST(process_info, process_stat_smoke) {
+  android::procinfo::ProcessStat self;
+  ASSERT_TRUE(android::procinfo::GetProcessStat(getpid(), &self));
+  ASSERT_EQ(getpid(), self.tid);
+  ASSERT_EQ("libprocinfo_tes", self.comm);
+  ASSERT_EQ(android::procinfo::kProcessStateRunning, self.state);
+  ASSERT_EQ(getppid(), self.ppid);
+  ASSERT_GE(self.num_threads, 1);
+}
+
+TEST(process_info, process_stat_reader_smoke) {
+  android::procinfo::ProcessStatReader reader;
+  size_t processes = 0;
+  bool found_self = false;
+  ASSERT_TRUE(reader.ForEachProcess([&](const android::procinfo::ProcessStat& stat) {
+    processes++;
+    found_self |= stat.tid == getpid();
+  }));
+  ASSERT_TRUE(found_self);
+  ASSERT_GE(processes, 2U);
+
+  pid_t main_tid = gettid();
+  std::thread([&reader, main_tid]() {
+    pid_t thread_tid = gettid();
+    std::set<pid_t> tids;
+    ASSERT_TRUE(reader.ForEachThread(getpid(), [&](const android::procinfo::ProcessStat& stat) {
+      tids.insert(stat.tid);
+    }));
+    ASSERT_EQ(1U, tids.count(main_tid));
+    ASSERT_EQ(1U, tids.count(thread_tid));
+  }).join();
+}
+
+TEST(process_info, process_stat_cache) {
+  android::procinfo::ProcessStatCache cache;
+  std::set<pid_t> started, exited;
+  auto on_started = [&](const android::procinfo::ProcessStat& stat) { started.insert(stat.tid); };
+  auto on_exited = [&](pid_t pid) { exited.insert(pid); };
+
+  ASSERT_TRUE(cache.Update(on_started, on_exited));
+  ASSERT_EQ(cache.size(), started.size());
+  ASSERT_TRUE(cache.Find(getpid()) != nullptr);
+  ASSERT_EQ(getppid(), cache.Find(getpid())->ppid);
+
+  pid_t forkpid = fork();
+  ASSERT_NE(-1, forkpid);
+  if (forkpid == 0) {
+    pause();
+    _exit(0);
+  }
+
+  started.clear();
+  ASSERT_TRUE(cache.Update(on_started, on_exited));
+  ASSERT_EQ(1U, started.count(forkpid));
+  ASSERT_EQ(0U, started.count(getpid()));
+
+  ASSERT_EQ(0, kill(forkpid, SIGKILL));
+  ASSERT_EQ(forkpid, waitpid(forkpid, nullptr, 0));
+
+  ASSERT_TRUE(cache.Update(on_started, on_exited));
+  ASSERT_EQ(1U, exited.count(forkpid));
+  ASSERT_TRUE(cache.Find(forkpid) == nullptr);
+}
@@ -285,6 +285,24 @@ struct sparse_file *sparse_file_import_auto(int fd, bool crc, bool verbose);
 int sparse_file_resparse(struct sparse_file *in_s, unsigned int max_len,
 		struct sparse_file **out_s, int out_s_count);
 
+/**
+ * sparse_file_resparse_next - split the next piece off an existing sparse file
+ *
+ * @in_s - sparse file cookie of the existing sparse file
+ * @max_len - maximum file size
+ * @more - set to whether in_s has chunks left after this piece
+ *
+ * Moves as many of the chunks at the start of in_s as fit in a sparse file of
+ * less than max_len into a new sparse file, splitting the last one if needed,
+ * so that a big file can be consumed one piece at a time rather than resparsed
+ * all at once.  Calling it until more is false gives the same pieces as
+ * sparse_file_resparse, then leaves in_s empty.
+ *
+ * Returns the new sparse file cookie, or NULL on error.
+ */
+struct sparse_file *sparse_file_resparse_next(struct sparse_file *in_s,
+		unsigned int max_len, bool *more);
+
 /**
  * sparse_file_verbose - set a sparse file cookie to print verbose errors
  *
@@ -294,6 +312,20 @@ int sparse_file_resparse(struct sparse_file *in_s, unsigned int max_len,
  */
 void sparse_file_verbose(struct sparse_file *s);
 
+/**
+ * sparse_file_gz_threads - set the number of threads used for gzip output
+ *
+ * @s - sparse file cookie
+ * @threads - number of compression threads
+ *
+ * With more than one thread, sparse_file_write with gz set compresses the
+ * output in independent 1MB blocks on that many threads, and writes each one
+ * as its own gzip member.  Any gzip reader expands the result to the same
+ * data, but the file differs from, and is slightly larger than, the single
+ * member written by default.  Ignored where threads aren't supported.
+ */
+void sparse_file_gz_threads(struct sparse_file *s, unsigned int threads);
+
 /**
  * sparse_print_verbose - function called to print verbose errors
  *
@@ -36,6 +36,16 @@
 
 #ifndef _WIN32
 #include <sys/mman.h>
+#endif
+#ifndef _WIN32
+#include <pthread.h>
+#endif
+#if defined(__linux__)
+#include <sys/sendfile.h>
+#include <sys/syscall.h>
+#endif
+
+#ifndef _WIN32
 #define O_BINARY 0
 #else
 #define ftruncate64 ftruncate
@@ -64,12 +74,20 @@ struct output_file_ops {
 	int (*skip)(struct output_file *, int64_t);
 	int (*pad)(struct output_file *, int64_t);
 	int (*write)(struct output_file *, void *, size_t);
+	/*
+	 * Optional: writes len bytes of fd starting at offset, letting the
+	 * kernel move them without a copy through user space.
+	 */
+	int (*write_fd)(struct output_file *, int fd, int64_t offset, size_t len);
 	void (*close)(struct output_file *);
 };
 
 struct sparse_file_ops {
 	int (*write_data_chunk)(struct output_file *out, unsigned int len,
 			void *data);
+	/* Only used when out->ops->write_fd is set and there is no crc. */
+	int (*write_fd_data_chunk)(struct output_file *out, unsigned int len,
+			int fd, int64_t offset);
 	int (*write_fill_chunk)(struct output_file *out, unsigned int len,
 			uint32_t fill_val);
 	int (*write_skip_chunk)(struct output_file *out, int64_t len);
@@ -171,6 +189,126 @@ static int file_write(struct output_file *out, void *data, size_t len)
 	return 0;
 }
 
+/*
+ * Maps the len bytes of fd at offset, or reads them into a buffer where
+ * there is no mmap. Returns a pointer to the data, which is released with
+ * unmap_fd_range(map, map_size).
+ */
+static char *map_fd_range(int fd, int64_t offset, size_t len, char **map,
+		uint64_t *map_size, int *err)
+{
+	int64_t aligned_offset = offset & ~(4096 - 1);
+	int aligned_diff = offset - aligned_offset;
+	uint64_t buffer_size = (uint64_t)len + (uint64_t)aligned_diff;
+
+#ifndef _WIN32
+	if (buffer_size > SIZE_MAX) {
+		*err = -E2BIG;
+		return NULL;
+	}
+	*map = mmap64(NULL, buffer_size, PROT_READ, MAP_SHARED, fd,
+			aligned_offset);
+	if (*map == MAP_FAILED) {
+		*err = -errno;
+		return NULL;
+	}
+	*map_size = buffer_size;
+	return *map + aligned_diff;
+#else
+	off64_t pos;
+	*map = malloc(len);
+	if (!*map) {
+		*err = -errno;
+		return NULL;
+	}
+	*map_size = len;
+	pos = lseek64(fd, offset, SEEK_SET);
+	if (pos < 0) {
+		*err = -errno;
+		free(*map);
+		return NULL;
+	}
+	*err = read_all(fd, *map, len);
+	if (*err < 0) {
+		free(*map);
+		return NULL;
+	}
+	return *map;
+#endif
+}
+
+static void unmap_fd_range(char *map, uint64_t map_size)
+{
+#ifndef _WIN32
+	munmap(map, map_size);
+#else
+	(void)map_size;
+	free(map);
+#endif
+}
+
+static int file_write_fd(struct output_file *out, int fd, int64_t offset,
+		size_t len)
+{
+	struct output_file_normal *outn = to_output_file_normal(out);
+	ssize_t ret;
+	char *map;
+	uint64_t map_size;
+	char *data;
+	int err = 0;
+
+#if defined(__linux__)
+	/*
+	 * copy_file_range can share or copy the blocks inside the kernel, and
+	 * sendfile at least avoids the copy out to user space. Either can be
+	 * refused for a pair of files (different file systems, O_APPEND, old
+	 * kernels), in which case whatever is left goes through a mapping.
+	 */
+#ifdef __NR_copy_file_range
+	while (len > 0) {
+		loff_t off_in = offset;
+		ret = syscall(__NR_copy_file_range, fd, &off_in, outn->fd, NULL,
+				len, 0);
+		if (ret < 0 && errno == EINTR) {
+			continue;
+		}
+		if (ret <= 0) {
+			break;
+		}
+		offset += ret;
+		len -= ret;
+	}
+#endif
+	while (len > 0) {
+		off_t off_in = offset;
+		ret = sendfile(outn->fd, fd, &off_in, len);
+		if (ret < 0 && errno == EINTR) {
+			continue;
+		}
+		if (ret == 0) {
+			/* The input is shorter than the chunk says. */
+			return -EINVAL;
+		}
+		if (ret < 0) {
+			break;
+		}
+		offset += ret;
+		len -= ret;
+	}
+	if (len == 0) {
+		return 0;
+	}
+#endif
+
+	data = map_fd_range(fd, offset, len, &map, &map_size, &err);
+	if (!data) {
+		return err;
+	}
+	ret = file_write(out, data, len);
+	unmap_fd_range(map, map_size);
+	return ret;
+}
+
 static void file_close(struct output_file *out)
 {
 	struct output_file_normal *outn = to_output_file_normal(out);
@@ -183,6 +321,7 @@ static struct output_file_ops file_ops = {
 	.skip = file_skip,
 	.pad = file_pad,
 	.write = file_write,
+	.write_fd = file_write_fd,
 	.close = file_close,
 };
 
@@ -272,6 +411,300 @@ static struct output_file_ops gz_file_ops = {
 	.close = gz_file_close,
 };
 
+#ifndef _WIN32
+/*
+ * Multithreaded gzip output: the stream is cut into PGZ_BLOCK_SIZE blocks
+ * that are compressed on their own, each into a complete gzip member, and
+ * written out in order. Concatenated members are a valid gzip file (RFC 1952)
+ * that gunzip, pigz and zlib's gzread all expand to the whole stream.
+ */
+#define PGZ_BLOCK_SIZE (1024 * 1024)
+
+struct pgz_job {
+	char *in;
+	size_t in_len;
+	unsigned char *out;
+	size_t out_len;
+	/* Set by the worker once out is ready, or err on failure. */
+	int done;
+	int err;
+};
+
+struct output_file_pgz {
+	struct output_file out;
+	int fd;
+
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	pthread_t *threads;
+	unsigned int nthreads;
+
+	/*
+	 * A ring of jobs: [next_write, next_compress) are being compressed or
+	 * waiting to be written, [next_compress, next_submit) wait for a worker,
+	 * and next_submit is the block being filled.
+	 */
+	struct pgz_job *jobs;
+	unsigned int njobs;
+	uint64_t next_write;
+	uint64_t next_compress;
+	uint64_t next_submit;
+	int stop;
+
+	/* Uncompressed bytes written so far. */
+	int64_t pos;
+	int err;
+};
+
+#define to_output_file_pgz(_o) \
+	container_of((_o), struct output_file_pgz, out)
+
+static int pgz_compress(struct pgz_job *job)
+{
+	z_stream zs;
+	int ret;
+
+	memset(&zs, 0, sizeof(zs));
+	/* The same settings as gzdopen(fd, "wb9"). */
+	if (deflateInit2(&zs, 9, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+		return -ENOMEM;
+	}
+	zs.next_in = (Bytef *)job->in;
+	zs.avail_in = job->in_len;
+	zs.next_out = job->out;
+	zs.avail_out = deflateBound(&zs, PGZ_BLOCK_SIZE);
+	ret = deflate(&zs, Z_FINISH);
+	job->out_len = zs.total_out;
+	deflateEnd(&zs);
+	return ret == Z_STREAM_END ? 0 : -EIO;
+}
+
+static void *pgz_worker(void *arg)
+{
+	struct output_file_pgz *outp = arg;
+	struct pgz_job *job;
+	int err;
+
+	pthread_mutex_lock(&outp->lock);
+	while (true) {
+		while (!outp->stop && outp->next_compress == outp->next_submit) {
+			pthread_cond_wait(&outp->cond, &outp->lock);
+		}
+		if (outp->next_compress == outp->next_submit) {
+			break;
+		}
+		job = &outp->jobs[outp->next_compress++ % outp->njobs];
+		pthread_mutex_unlock(&outp->lock);
+
+		err = pgz_compress(job);
+
+		pthread_mutex_lock(&outp->lock);
+		job->err = err;
+		job->done = 1;
+		pthread_cond_broadcast(&outp->cond);
+	}
+	pthread_mutex_unlock(&outp->lock);
+	return NULL;
+}
+
+/* Waits for the oldest job and writes it out, freeing its slot. */
+static int pgz_write_oldest(struct output_file_pgz *outp)
+{
+	struct pgz_job *job = &outp->jobs[outp->next_write % outp->njobs];
+	const unsigned char *ptr;
+	size_t len;
+	ssize_t ret;
+
+	pthread_mutex_lock(&outp->lock);
+	while (!job->done) {
+		pthread_cond_wait(&outp->cond, &outp->lock);
+	}
+	pthread_mutex_unlock(&outp->lock);
+
+	if (job->err < 0) {
+		error("gzip compression failed");
+		return job->err;
+	}
+	ptr = job->out;
+	len = job->out_len;
+	while (len > 0) {
+		ret = write(outp->fd, ptr, len);
+		if (ret < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			error_errno("write");
+			return -errno;
+		}
+		ptr += ret;
+		len -= ret;
+	}
+
+	job->in_len = 0;
+	job->done = 0;
+	outp->next_write++;
+	return 0;
+}
+
+/* Hands the block being filled to the workers. */
+static void pgz_submit(struct output_file_pgz *outp)
+{
+	pthread_mutex_lock(&outp->lock);
+	outp->next_submit++;
+	pthread_cond_signal(&outp->cond);
+	pthread_mutex_unlock(&outp->lock);
+}
+
+/* Appends len bytes of data, or zeros if data is NULL. */
+static int pgz_append(struct output_file_pgz *outp, const void *data, size_t len)
+{
+	struct pgz_job *job;
+	size_t to_copy;
+	int ret;
+
+	if (outp->err < 0) {
+		return outp->err;
+	}
+	while (len > 0) {
+		/* The block being filled needs a free slot in the ring. */
+		if (outp->next_submit - outp->next_write == outp->njobs) {
+			ret = pgz_write_oldest(outp);
+			if (ret < 0) {
+				outp->err = ret;
+				return ret;
+			}
+		}
+		job = &outp->jobs[outp->next_submit % outp->njobs];
+		to_copy = min(len, (size_t)(PGZ_BLOCK_SIZE - job->in_len));
+		if (data) {
+			memcpy(job->in + job->in_len, data, to_copy);
+			data = (const char *)data + to_copy;
+		} else {
+			memset(job->in + job->in_len, 0, to_copy);
+		}
+		job->in_len += to_copy;
+		len -= to_copy;
+		outp->pos += to_copy;
+		if (job->in_len == PGZ_BLOCK_SIZE) {
+			pgz_submit(outp);
+		}
+	}
+	return 0;
+}
+
+static void pgz_free(struct output_file_pgz *outp)
+{
+	unsigned int i;
+
+	if (outp->jobs) {
+		for (i = 0; i < outp->njobs; i++) {
+			free(outp->jobs[i].in);
+			free(outp->jobs[i].out);
+		}
+	}
+	free(outp->jobs);
+	free(outp->threads);
+	pthread_cond_destroy(&outp->cond);
+	pthread_mutex_destroy(&outp->lock);
+	free(outp);
+}
+
+/* Stops and joins the workers, which finish the blocks already submitted. */
+static void pgz_stop(struct output_file_pgz *outp)
+{
+	unsigned int i;
+
+	pthread_mutex_lock(&outp->lock);
+	outp->stop = 1;
+	pthread_cond_broadcast(&outp->cond);
+	pthread_mutex_unlock(&outp->lock);
+	for (i = 0; i < outp->nthreads; i++) {
+		pthread_join(outp->threads[i], NULL);
+	}
+	outp->nthreads = 0;
+}
+
+static int pgz_file_open(struct output_file *out, int fd)
+{
+	struct output_file_pgz *outp = to_output_file_pgz(out);
+	unsigned int wanted = outp->nthreads;
+	unsigned int i;
+	size_t out_size = compressBound(PGZ_BLOCK_SIZE) + 64;
+
+	outp->fd = fd;
+	/* Enough blocks to keep every worker busy while the oldest is written. */
+	outp->njobs = 2 * wanted;
+	outp->jobs = calloc(outp->njobs, sizeof(struct pgz_job));
+	outp->threads = calloc(wanted, sizeof(pthread_t));
+	if (!outp->jobs || !outp->threads) {
+		return -ENOMEM;
+	}
+	for (i = 0; i < outp->njobs; i++) {
+		outp->jobs[i].in = malloc(PGZ_BLOCK_SIZE);
+		outp->jobs[i].out = malloc(out_size);
+		if (!outp->jobs[i].in || !outp->jobs[i].out) {
+			return -ENOMEM;
+		}
+	}
+
+	outp->nthreads = 0;
+	for (i = 0; i < wanted; i++) {
+		if (pthread_create(&outp->threads[i], NULL, pgz_worker, outp)) {
+			error("failed to start gzip thread");
+			pgz_stop(outp);
+			return -EAGAIN;
+		}
+		outp->nthreads++;
+	}
+	return 0;
+}
+
+static int pgz_file_skip(struct output_file *out, int64_t cnt)
+{
+	/* Like gzseek forward, which writes zeros. */
+	return pgz_append(to_output_file_pgz(out), NULL, cnt);
+}
+
+static int pgz_file_pad(struct output_file *out, int64_t len)
+{
+	struct output_file_pgz *outp = to_output_file_pgz(out);
+
+	if (outp->pos >= len) {
+		return 0;
+	}
+	return pgz_append(outp, NULL, len - outp->pos);
+}
+
+static int pgz_file_write(struct output_file *out, void *data, size_t len)
+{
+	return pgz_append(to_output_file_pgz(out), data, len);
+}
+
+static void pgz_file_close(struct output_file *out)
+{
+	struct output_file_pgz *outp = to_output_file_pgz(out);
+
+	if (outp->jobs[outp->next_submit % outp->njobs].in_len > 0) {
+		pgz_submit(outp);
+	}
+	pgz_stop(outp);
+	while (outp->err == 0 && outp->next_write < outp->next_submit) {
+		outp->err = pgz_write_oldest(outp);
+	}
+	/* gzclose closes the descriptor too. */
+	close(outp->fd);
+	pgz_free(outp);
+}
+
+static struct output_file_ops pgz_file_ops = {
+	.open = pgz_file_open,
+	.skip = pgz_file_skip,
+	.pad = pgz_file_pad,
+	.write = pgz_file_write,
+	.close = pgz_file_close,
+};
+#endif
+
 static int callback_file_open(struct output_file *out __unused, int fd __unused)
 {
 	return 0;
@@ -405,8 +838,9 @@ static int write_sparse_fill_chunk(struct output_file *out, unsigned int len,
 	return 0;
 }
 
-static int write_sparse_data_chunk(struct output_file *out, unsigned int len,
-		void *data)
+/* Writes the data from memory if data is set, otherwise from fd at offset. */
+static int write_sparse_raw_chunk(struct output_file *out, unsigned int len,
+		void *data, int fd, int64_t offset)
 {
 	chunk_header_t chunk_header;
 	int rnd_up_len, zero_len;
@@ -425,7 +859,10 @@ static int write_sparse_data_chunk(struct output_file *out, unsigned int len,
 
 	if (ret < 0)
 		return -1;
-	ret = out->ops->write(out, data, len);
+	if (data)
+		ret = out->ops->write(out, data, len);
+	else
+		ret = out->ops->write_fd(out, fd, offset, len);
 	if (ret < 0)
 		return -1;
 	if (zero_len) {
@@ -446,6 +883,18 @@ static int write_sparse_data_chunk(struct output_file *out, unsigned int len,
 	return 0;
 }
 
+static int write_sparse_data_chunk(struct output_file *out, unsigned int len,
+		void *data)
+{
+	return write_sparse_raw_chunk(out, len, data, -1, 0);
+}
+
+static int write_sparse_fd_data_chunk(struct output_file *out,
+		unsigned int len, int fd, int64_t offset)
+{
+	return write_sparse_raw_chunk(out, len, NULL, fd, offset);
+}
+
 int write_sparse_end_chunk(struct output_file *out)
 {
 	chunk_header_t chunk_header;
@@ -474,18 +923,23 @@ int write_sparse_end_chunk(struct output_file *out)
 
 static struct sparse_file_ops sparse_file_ops = {
 		.write_data_chunk = write_sparse_data_chunk,
+		.write_fd_data_chunk = write_sparse_fd_data_chunk,
 		.write_fill_chunk = write_sparse_fill_chunk,
 		.write_skip_chunk = write_sparse_skip_chunk,
 		.write_end_chunk = write_sparse_end_chunk,
 };
 
-static int write_normal_data_chunk(struct output_file *out, unsigned int len,
-		void *data)
+static int write_normal_raw_chunk(struct output_file *out, unsigned int len,
+		void *data, int fd, int64_t offset)
 {
 	int ret;
 	unsigned int rnd_up_len = ALIGN(len, out->block_size);
 
-	ret = out->ops->write(out, data, len);
+	if (data) {
+		ret = out->ops->write(out, data, len);
+	} else {
+		ret = out->ops->write_fd(out, fd, offset, len);
+	}
 	if (ret < 0) {
 		return ret;
 	}
@@ -497,6 +951,18 @@ static int write_normal_data_chunk(struct output_file *out, unsigned int len,
 	return ret;
 }
 
+static int write_normal_data_chunk(struct output_file *out, unsigned int len,
+		void *data)
+{
+	return write_normal_raw_chunk(out, len, data, -1, 0);
+}
+
+static int write_normal_fd_data_chunk(struct output_file *out,
+		unsigned int len, int fd, int64_t offset)
+{
+	return write_normal_raw_chunk(out, len, NULL, fd, offset);
+}
+
 static int write_normal_fill_chunk(struct output_file *out, unsigned int len,
 		uint32_t fill_val)
 {
@@ -534,6 +1000,7 @@ int write_normal_end_chunk(struct output_file *out)
 
 static struct sparse_file_ops normal_file_ops = {
 		.write_data_chunk = write_normal_data_chunk,
+		.write_fd_data_chunk = write_normal_fd_data_chunk,
 		.write_fill_chunk = write_normal_fill_chunk,
 		.write_skip_chunk = write_normal_skip_chunk,
 		.write_end_chunk = write_normal_end_chunk,
@@ -621,6 +1088,24 @@ static struct output_file *output_file_new_gz(void)
 	return &outgz->out;
 }
 
+#ifndef _WIN32
+static struct output_file *output_file_new_pgz(unsigned int threads)
+{
+	struct output_file_pgz *outp = calloc(1, sizeof(struct output_file_pgz));
+	if (!outp) {
+		error_errno("malloc struct outp");
+		return NULL;
+	}
+
+	outp->out.ops = &pgz_file_ops;
+	outp->nthreads = threads;
+	pthread_mutex_init(&outp->lock, NULL);
+	pthread_cond_init(&outp->cond, NULL);
+
+	return &outp->out;
+}
+#endif
+
 static struct output_file *output_file_new_normal(void)
 {
 	struct output_file_normal *outn = calloc(1, sizeof(struct output_file_normal));
@@ -661,24 +1146,46 @@ struct output_file *output_file_open_callback(int (*write)(void *, const void *,
 }
 
 struct output_file *output_file_open_fd(int fd, unsigned int block_size, int64_t len,
-		int gz, int sparse, int chunks, int crc)
+		int gz, unsigned int gz_threads, int sparse, int chunks, int crc)
 {
 	int ret;
 	struct output_file *out;
 
-	if (gz) {
-		out = output_file_new_gz();
-	} else {
-		out = output_file_new_normal();
-	}
-	if (!out) {
-		return NULL;
-	}
+#ifndef _WIN32
+	if (gz && gz_threads > 1) {
+		out = output_file_new_pgz(gz_threads);
+		if (!out) {
+			return NULL;
+		}
+		ret = out->ops->open(out, fd);
+		if (ret < 0) {
+			pgz_free(to_output_file_pgz(out));
+			return NULL;
+		}
+	} else
+#endif
+	{
+		if (gz) {
+			out = output_file_new_gz();
+		} else {
+			out = output_file_new_normal();
+		}
+		if (!out) {
+			return NULL;
+		}
 
-	out->ops->open(out, fd);
+		out->ops->open(out, fd);
+	}
 
 	ret = output_file_init(out, block_size, len, sparse, chunks, crc);
 	if (ret < 0) {
+#ifndef _WIN32
+		if (out->ops == &pgz_file_ops) {
+			pgz_stop(to_output_file_pgz(out));
+			pgz_free(to_output_file_pgz(out));
+			return NULL;
+		}
+#endif
 		free(out);
 		return NULL;
 	}
@@ -702,51 +1209,24 @@ int write_fill_chunk(struct output_file *out, unsigned int len,
 int write_fd_chunk(struct output_file *out, unsigned int len,
 		int fd, int64_t offset)
 {
-	int ret;
-	int64_t aligned_offset;
-	int aligned_diff;
-	uint64_t buffer_size;
+	int ret = 0;
+	char *map;
+	uint64_t map_size;
 	char *ptr;
 
-	aligned_offset = offset & ~(4096 - 1);
-	aligned_diff = offset - aligned_offset;
-	buffer_size = (uint64_t)len + (uint64_t)aligned_diff;
-
-#ifndef _WIN32
-	if (buffer_size > SIZE_MAX)
-		return -E2BIG;
-	char *data = mmap64(NULL, buffer_size, PROT_READ, MAP_SHARED, fd,
-			aligned_offset);
-	if (data == MAP_FAILED) {
-		return -errno;
+	/* The crc needs to see the data, so only plain copies skip user space. */
+	if (out->ops->write_fd && !out->use_crc) {
+		return out->sparse_ops->write_fd_data_chunk(out, len, fd, offset);
 	}
-	ptr = data + aligned_diff;
-#else
-	off64_t pos;
-	char *data = malloc(len);
-	if (!data) {
-		return -errno;
-	}
-	pos = lseek64(fd, offset, SEEK_SET);
-	if (pos < 0) {
-                free(data);
-		return -errno;
-	}
-	ret = read_all(fd, data, len);
-	if (ret < 0) {
-                free(data);
+
+	ptr = map_fd_range(fd, offset, len, &map, &map_size, &ret);
+	if (!ptr) {
 		return ret;
 	}
-	ptr = data;
-#endif
 
 	ret = out->sparse_ops->write_data_chunk(out, len, ptr);
 
-#ifndef _WIN32
-	munmap(data, buffer_size);
-#else
-	free(data);
-#endif
+	unmap_fd_range(map, map_size);
 
 	return ret;
 }
@@ -25,8 +25,9 @@ extern "C" {
 
 struct output_file;
 
+/* gz_threads above 1 compresses on that many threads, where supported. */
 struct output_file *output_file_open_fd(int fd, unsigned int block_size, int64_t len,
-		int gz, int sparse, int chunks, int crc);
+		int gz, unsigned int gz_threads, int sparse, int chunks, int crc);
 struct output_file *output_file_open_callback(int (*write)(void *, const void *, int),
 		void *priv, unsigned int block_size, int64_t len, int gz, int sparse,
 		int chunks, int crc);
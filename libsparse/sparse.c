@@ -166,7 +166,8 @@ int sparse_file_write(struct sparse_file *s, int fd, bool gz, bool sparse,
 	struct output_file *out;
 
 	chunks = sparse_count_chunks(s);
-	out = output_file_open_fd(fd, s->block_size, s->len, gz, sparse, chunks, crc);
+	out = output_file_open_fd(fd, s->block_size, s->len, gz, s->gz_threads,
+			sparse, chunks, crc);
 
 	if (!out)
 		return -ENOMEM;
@@ -389,7 +390,27 @@ int sparse_file_resparse(struct sparse_file *in_s, unsigned int max_len,
 	return c;
 }
 
+struct sparse_file *sparse_file_resparse_next(struct sparse_file *in_s,
+		unsigned int max_len, bool *more)
+{
+	struct sparse_file *s;
+
+	s = sparse_file_new(in_s->block_size, in_s->len);
+	if (!s) {
+		return NULL;
+	}
+
+	*more = move_chunks_up_to_len(in_s, s, max_len) != NULL;
+
+	return s;
+}
+
 void sparse_file_verbose(struct sparse_file *s)
 {
 	s->verbose = true;
 }
+
+void sparse_file_gz_threads(struct sparse_file *s, unsigned int threads)
+{
+	s->gz_threads = threads;
+}
@@ -17,6 +17,7 @@
 #ifndef _LIBSPARSE_SPARSE_CRC32_H_
 #define _LIBSPARSE_SPARSE_CRC32_H_
 
+#include <stddef.h>
 #include <stdint.h>
 
 #ifdef __cplusplus
@@ -25,6 +26,13 @@ extern "C" {
 
 uint32_t sparse_crc32(uint32_t crc, const void *buf, size_t size);
 
+/*
+ * Returns the crc of the concatenation of two buffers, from crc1 of the first,
+ * crc2 of the second and len2, the length of the second. Lets the crcs of
+ * pieces computed separately be put together.
+ */
+uint32_t sparse_crc32_combine(uint32_t crc1, uint32_t crc2, uint64_t len2);
+
 #ifdef __cplusplus
 }
 #endif
@@ -27,6 +27,7 @@ struct sparse_file {
 	unsigned int block_size;
 	int64_t len;
 	bool verbose;
+	unsigned int gz_threads;
 
 	struct backed_block_list *backed_block_list;
 	struct output_file *out;
@@ -25,15 +25,20 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <string>
+#include <thread>
 #include <unistd.h>
+#include <vector>
 
 #include <sparse/sparse.h>
 
+#include "android-base/macros.h"
 #include "android-base/stringprintf.h"
 #include "defs.h"
 #include "output_file.h"
 #include "sparse_crc32.h"
+#include "sparse_defs.h"
 #include "sparse_file.h"
 #include "sparse_format.h"
 
@@ -329,55 +334,148 @@ static int sparse_file_read_sparse(struct sparse_file *s, int fd, bool crc)
 	return 0;
 }
 
-static int sparse_file_read_normal(struct sparse_file *s, int fd)
+/* Returns true if every 32-bit word of the block is the same as the first. */
+static bool is_fill_block(const uint32_t *buf, unsigned int block_size)
 {
-	int ret;
-	uint32_t *buf = (uint32_t *)malloc(s->block_size);
-	unsigned int block = 0;
-	int64_t remain = s->len;
-	int64_t offset = 0;
-	unsigned int to_read;
-	unsigned int i;
-	bool sparse_block;
+	/*
+	 * Each word has to match the next one, which is a single overlapping
+	 * memcmp: that runs on the platform's vectorized memcmp rather than a
+	 * word at a time.
+	 */
+	return memcmp(buf, buf + 1, block_size - sizeof(uint32_t)) == 0;
+}
 
-	if (!buf) {
-		return -ENOMEM;
+static int read_at(int fd, void *buf, size_t len, int64_t offset)
+{
+#if defined(_WIN32)
+	if (lseek64(fd, offset, SEEK_SET) < 0) {
+		return -errno;
+	}
+	return read_all(fd, buf, len);
+#else
+	char *ptr = (char *)buf;
+	while (len > 0) {
+		ssize_t ret = TEMP_FAILURE_RETRY(pread(fd, ptr, len, offset));
+		if (ret < 0) {
+			return -errno;
+		}
+		if (ret == 0) {
+			return -EINVAL;
+		}
+		ptr += ret;
+		len -= ret;
+		offset += ret;
 	}
+	return 0;
+#endif
+}
+
+/* What a block of a non-sparse file turned out to hold. */
+struct block_class {
+	bool fill;
+	uint32_t fill_val;
+};
 
-	while (remain > 0) {
-		to_read = std::min(remain, (int64_t)(s->block_size));
-		ret = read_all(fd, buf, to_read);
+/*
+ * Reads |count| blocks starting at |first| and classifies them into
+ * |classes|, a COPY_BUF_SIZE read at a time.
+ */
+static int classify_blocks(struct sparse_file *s, int fd, unsigned int first,
+		unsigned int count, struct block_class *classes)
+{
+	unsigned int blocks_per_read = COPY_BUF_SIZE / s->block_size;
+	std::vector<uint32_t> buf((int64_t)blocks_per_read * s->block_size / sizeof(uint32_t));
+	unsigned int block = first;
+	unsigned int end = first + count;
+
+	while (block < end) {
+		unsigned int blocks = std::min(end - block, blocks_per_read);
+		int64_t offset = (int64_t)block * s->block_size;
+		int64_t len = std::min((int64_t)blocks * s->block_size, s->len - offset);
+		int ret = read_at(fd, buf.data(), len, offset);
 		if (ret < 0) {
-			error("failed to read sparse file");
-			free(buf);
 			return ret;
 		}
 
-		if (to_read == s->block_size) {
-			sparse_block = true;
-			for (i = 1; i < s->block_size / sizeof(uint32_t); i++) {
-				if (buf[0] != buf[i]) {
-					sparse_block = false;
-					break;
-				}
-			}
+		for (unsigned int i = 0; i < blocks; i++) {
+			const uint32_t *block_buf = &buf[(int64_t)i * s->block_size / sizeof(uint32_t)];
+			struct block_class *c = &classes[block + i - first];
+			/* A partial last block is always data. */
+			c->fill = (int64_t)(i + 1) * s->block_size <= len &&
+					is_fill_block(block_buf, s->block_size);
+			c->fill_val = block_buf[0];
+		}
+		block += blocks;
+	}
+	return 0;
+}
+
+/*
+ * Files at least this big are classified by several threads, each reading its
+ * own range of blocks.
+ */
+static constexpr int64_t PARALLEL_READ_MIN_SIZE = 64 * 1024 * 1024;
+static constexpr unsigned int MAX_READ_THREADS = 8;
+
+static int sparse_file_read_normal(struct sparse_file *s, int fd)
+{
+	unsigned int blocks = DIV_ROUND_UP(s->len, s->block_size);
+	std::vector<struct block_class> classes;
+	unsigned int i;
+
+	if (s->block_size < sizeof(uint32_t) || s->block_size > COPY_BUF_SIZE) {
+		return -EINVAL;
+	}
+	classes.resize(blocks);
+
+	unsigned int nthreads = 1;
+#if !defined(_WIN32)
+	if (s->len >= PARALLEL_READ_MIN_SIZE) {
+		nthreads = std::max(1U, std::min(std::thread::hardware_concurrency(), MAX_READ_THREADS));
+	}
+#endif
+
+	std::vector<int> results(nthreads);
+	std::vector<std::thread> threads;
+	unsigned int per_thread = DIV_ROUND_UP(blocks, nthreads);
+	for (i = 0; i < nthreads; i++) {
+		unsigned int first = std::min(blocks, i * per_thread);
+		unsigned int count = std::min(blocks - first, per_thread);
+		if (i == nthreads - 1) {
+			/* The calling thread takes the last range. */
+			results[i] = classify_blocks(s, fd, first, count, &classes[first]);
 		} else {
-			sparse_block = false;
+			threads.emplace_back([=, &results, &classes]() {
+				results[i] = classify_blocks(s, fd, first, count, &classes[first]);
+			});
+		}
+	}
+	for (auto& thread : threads) {
+		thread.join();
+	}
+	for (int ret : results) {
+		if (ret < 0) {
+			error("failed to read sparse file");
+			return ret;
 		}
+	}
 
-		if (sparse_block) {
+	/* Added in order, so the backed blocks are the same as a serial read's. */
+	int64_t remain = s->len;
+	for (i = 0; i < blocks; i++) {
+		unsigned int len = std::min(remain, (int64_t)(s->block_size));
+		int64_t offset = (int64_t)i * s->block_size;
+		if (classes[i].fill) {
 			/* TODO: add flag to use skip instead of fill for buf[0] == 0 */
-			sparse_file_add_fill(s, buf[0], to_read, block);
+			sparse_file_add_fill(s, classes[i].fill_val, len, i);
 		} else {
-			sparse_file_add_fd(s, fd, offset, to_read, block);
+			sparse_file_add_fd(s, fd, offset, len, i);
 		}
-
-		remain -= to_read;
-		offset += to_read;
-		block++;
+		remain -= len;
 	}
 
-	free(buf);
+	/* Leave the file offset where a read through the whole file would. */
+	lseek64(fd, s->len, SEEK_SET);
 	return 0;
 }
 
@@ -0,0 +1,73 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdint.h>
+#include <unistd.h>
+
+#include <vector>
+
+#include <android-base/file.h>
+#include <android-base/test_utils.h>
+#include <benchmark/benchmark.h>
+#include <sparse/sparse.h>
+
+static constexpr size_t kBlockSize = 4096;
+
+// Writes a raw image of |size| bytes that looks like a mostly empty file
+// system: runs of data blocks between long runs of zero and fill blocks.
+static bool WriteImage(int fd, size_t size) {
+  std::vector<uint32_t> block(kBlockSize / sizeof(uint32_t));
+  for (size_t i = 0; i < size / kBlockSize; i++) {
+    switch (i % 16) {
+      case 0:
+      case 1:
+      case 2:
+        for (size_t j = 0; j < block.size(); j++) block[j] = i * 7919 + j;
+        break;
+      case 3:
+        std::fill(block.begin(), block.end(), 0xdeadbeef);
+        break;
+      default:
+        std::fill(block.begin(), block.end(), 0);
+        break;
+    }
+    if (!android::base::WriteFully(fd, block.data(), kBlockSize)) return false;
+  }
+  return true;
+}
+
+// Imports a raw image through the non-sparse path that img2simg uses.
+static void BM_sparse_file_read_normal(benchmark::State& state) {
+  size_t size = state.range(0);
+  TemporaryFile tf;
+  if (!WriteImage(tf.fd, size)) {
+    state.SkipWithError("failed to write the image");
+    return;
+  }
+
+  while (state.KeepRunning()) {
+    lseek(tf.fd, 0, SEEK_SET);
+    sparse_file* s = sparse_file_new(kBlockSize, size);
+    if (sparse_file_read(s, tf.fd, false, false) < 0) {
+      state.SkipWithError("sparse_file_read failed");
+    }
+    sparse_file_destroy(s);
+  }
+  state.SetBytesProcessed(state.iterations() * size);
+}
+BENCHMARK(BM_sparse_file_read_normal)->Arg(16 << 20)->Arg(256 << 20);
+
+BENCHMARK_MAIN();
@@ -17,9 +17,12 @@
 #ifndef _LIBSUSPEND_AUTOSUSPEND_OPS_H_
 #define _LIBSUSPEND_AUTOSUSPEND_OPS_H_
 
+struct autosuspend_stats;
+
 struct autosuspend_ops {
     int (*enable)(void);
     int (*disable)(void);
+    int (*get_stats)(struct autosuspend_stats *stats);
 };
 
 struct autosuspend_ops *autosuspend_autosleep_init(void);
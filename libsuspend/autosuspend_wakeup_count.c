@@ -27,10 +27,13 @@
 #include <sys/param.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <time.h>
 #include <unistd.h>
 
 #include <log/log.h>
 
+#include <suspend/autosuspend.h>
+
 #include "autosuspend_ops.h"
 
 #define SYS_POWER_STATE "/sys/power/state"
@@ -46,6 +49,9 @@ static const char *sleep_state = "mem";
 static void (*wakeup_func)(bool success) = NULL;
 static int sleep_time = BASE_SLEEP_TIME;
 
+static pthread_mutex_t stats_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct autosuspend_stats stats;
+
 static void update_sleep_time(bool success) {
     if (success) {
         sleep_time = BASE_SLEEP_TIME;
@@ -55,34 +61,85 @@ static void update_sleep_time(bool success) {
     sleep_time = MIN(sleep_time * 2, 60000000);
 }
 
+static uint64_t now_ms(clockid_t clock)
+{
+    struct timespec ts;
+    clock_gettime(clock, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void record_attempt(bool success, bool wakeup_abort, int error,
+                           uint64_t awake_ms, uint64_t suspended_ms)
+{
+    pthread_mutex_lock(&stats_lock);
+    stats.attempts++;
+    if (!success) {
+        stats.failures++;
+        if (wakeup_abort) {
+            stats.wakeup_aborts++;
+        }
+    }
+    stats.awake_ms += awake_ms;
+    stats.suspended_ms += suspended_ms;
+    stats.last_awake_ms = awake_ms;
+    stats.last_error = error;
+    pthread_mutex_unlock(&stats_lock);
+}
+
+/*
+ * Reads the wakeup count into wakeup_count, returning its length or 0 on
+ * error.  The kernel blocks the read for as long as any wakeup source is
+ * active, so this is also how the thread waits for the system to go quiet.
+ */
+static int read_wakeup_count(char *wakeup_count, size_t size)
+{
+    char buf[80];
+    int len;
+
+    ALOGV("%s: read wakeup_count\n", __func__);
+    lseek(wakeup_count_fd, 0, SEEK_SET);
+    len = TEMP_FAILURE_RETRY(read(wakeup_count_fd, wakeup_count, size));
+    if (len < 0) {
+        strerror_r(errno, buf, sizeof(buf));
+        ALOGE("Error reading from %s: %s\n", SYS_POWER_WAKEUP_COUNT, buf);
+        return 0;
+    }
+    if (!len) {
+        ALOGE("Empty wakeup count\n");
+    }
+    return len;
+}
+
 static void *suspend_thread_func(void *arg __attribute__((unused)))
 {
     char buf[80];
     char wakeup_count[20];
+    char attempted_count[20];
     int wakeup_count_len;
+    int attempted_count_len;
     int ret;
     bool success = true;
+    bool wakeup_abort = false;
+    uint64_t awake_since = now_ms(CLOCK_MONOTONIC);
 
     while (1) {
-        update_sleep_time(success);
+        /*
+         * A failure the wakeup count moved across was a wakeup event aborting
+         * the suspend, not the kernel refusing it, and the read after it has
+         * already waited for the event's wakeup sources to be released: retry
+         * as soon as after a successful suspend.  Only failures no wakeup
+         * event explains are backed off.
+         */
+        update_sleep_time(success || wakeup_abort);
         usleep(sleep_time);
+        wakeup_count_len = read_wakeup_count(wakeup_count, sizeof(wakeup_count));
         success = false;
-        ALOGV("%s: read wakeup_count\n", __func__);
-        lseek(wakeup_count_fd, 0, SEEK_SET);
-        wakeup_count_len = TEMP_FAILURE_RETRY(read(wakeup_count_fd, wakeup_count,
-                sizeof(wakeup_count)));
-        if (wakeup_count_len < 0) {
-            strerror_r(errno, buf, sizeof(buf));
-            ALOGE("Error reading from %s: %s\n", SYS_POWER_WAKEUP_COUNT, buf);
-            wakeup_count_len = 0;
-            continue;
-        }
         if (!wakeup_count_len) {
-            ALOGE("Empty wakeup count\n");
             continue;
         }
 
         ALOGV("%s: wait\n", __func__);
+        uint64_t lockout_start = now_ms(CLOCK_MONOTONIC);
         ret = sem_wait(&suspend_lockout);
         if (ret < 0) {
             strerror_r(errno, buf, sizeof(buf));
@@ -90,16 +147,34 @@ static void *suspend_thread_func(void *arg __attribute__((unused)))
             continue;
         }
 
+        /* Time spent disabled is not time spent failing to suspend. */
+        uint64_t attempt_start = now_ms(CLOCK_MONOTONIC);
+        awake_since += attempt_start - lockout_start;
+        uint64_t awake_ms = attempt_start > awake_since ? attempt_start - awake_since : 0;
+        uint64_t suspended_ms = 0;
+        int error = 0;
+
+        memcpy(attempted_count, wakeup_count, wakeup_count_len);
+        attempted_count_len = wakeup_count_len;
+
         ALOGV("%s: write %*s to wakeup_count\n", __func__, wakeup_count_len, wakeup_count);
         ret = TEMP_FAILURE_RETRY(write(wakeup_count_fd, wakeup_count, wakeup_count_len));
         if (ret < 0) {
+            error = errno;
             strerror_r(errno, buf, sizeof(buf));
             ALOGE("Error writing to %s: %s\n", SYS_POWER_WAKEUP_COUNT, buf);
         } else {
+            uint64_t boottime_start = now_ms(CLOCK_BOOTTIME);
             ALOGV("%s: write %s to %s\n", __func__, sleep_state, SYS_POWER_STATE);
             ret = TEMP_FAILURE_RETRY(write(state_fd, sleep_state, strlen(sleep_state)));
             if (ret >= 0) {
                 success = true;
+                /* The monotonic clock stops while suspended, the boottime clock doesn't. */
+                uint64_t boottime = now_ms(CLOCK_BOOTTIME) - boottime_start;
+                uint64_t monotonic = now_ms(CLOCK_MONOTONIC) - attempt_start;
+                suspended_ms = boottime > monotonic ? boottime - monotonic : 0;
+            } else {
+                error = errno;
             }
             void (*func)(bool success) = wakeup_func;
             if (func != NULL) {
@@ -107,12 +182,27 @@ static void *suspend_thread_func(void *arg __attribute__((unused)))
             }
         }
 
+        awake_since = now_ms(CLOCK_MONOTONIC);
+
         ALOGV("%s: release sem\n", __func__);
         ret = sem_post(&suspend_lockout);
         if (ret < 0) {
             strerror_r(errno, buf, sizeof(buf));
             ALOGE("Error releasing semaphore: %s\n", buf);
         }
+
+        /*
+         * Blocks until the wakeup sources behind the failure, if any, are
+         * released, so it must not hold off autosuspend_disable().
+         */
+        wakeup_abort = false;
+        if (!success) {
+            wakeup_count_len = read_wakeup_count(wakeup_count, sizeof(wakeup_count));
+            wakeup_abort = wakeup_count_len &&
+                    (wakeup_count_len != attempted_count_len ||
+                     memcmp(wakeup_count, attempted_count, wakeup_count_len));
+        }
+        record_attempt(success, wakeup_abort, error, awake_ms, suspended_ms);
     }
     return NULL;
 }
@@ -164,9 +254,18 @@ void set_wakeup_callback(void (*func)(bool success))
     wakeup_func = func;
 }
 
+static int autosuspend_wakeup_count_get_stats(struct autosuspend_stats *out)
+{
+    pthread_mutex_lock(&stats_lock);
+    *out = stats;
+    pthread_mutex_unlock(&stats_lock);
+    return 0;
+}
+
 struct autosuspend_ops autosuspend_wakeup_count_ops = {
         .enable = autosuspend_wakeup_count_enable,
         .disable = autosuspend_wakeup_count_disable,
+        .get_stats = autosuspend_wakeup_count_get_stats,
 };
 
 struct autosuspend_ops *autosuspend_wakeup_count_init(void)
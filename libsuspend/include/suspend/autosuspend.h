@@ -19,6 +19,7 @@
 
 #include <sys/cdefs.h>
 #include <stdbool.h>
+#include <stdint.h>
 
 __BEGIN_DECLS
 
@@ -53,6 +54,26 @@ int autosuspend_disable(void);
  */
 void set_wakeup_callback(void (*func)(bool success));
 
+struct autosuspend_stats {
+    uint64_t attempts;       /* times suspend was tried */
+    uint64_t failures;       /* attempts that did not suspend */
+    uint64_t wakeup_aborts;  /* failures a wakeup event caused, retried without backoff */
+    uint64_t awake_ms;       /* time spent awake between attempts while enabled */
+    uint64_t suspended_ms;   /* time spent in suspend */
+    uint64_t last_awake_ms;  /* awake_ms of the most recent attempt alone */
+    int last_error;          /* errno of the most recent attempt, 0 if it suspended */
+};
+
+/*
+ * autosuspend_get_stats
+ *
+ * Fill in stats with the counters since the process started autosuspend.
+ * Time autosuspend was disabled is not counted as awake.
+ *
+ * Returns 0 on success, -1 if the statistics are not available.
+ */
+int autosuspend_get_stats(struct autosuspend_stats *stats);
+
 __END_DECLS
 
 #endif
@@ -37,6 +37,8 @@
  * break builds.
  */
 
+#include <stddef.h>
+
 #include "../ndk/sync.h"
 
 __BEGIN_DECLS
@@ -64,6 +66,30 @@ struct sync_pt_info *sync_pt_info(struct sync_fence_info_data *info,
                                   struct sync_pt_info *itr);
 void sync_fence_info_free(struct sync_fence_info_data *info);
 
+/* Status of sync file fd, as in sync_file_info but without allocating it:
+ * 1 signaled, 0 unsignaled, < 0 error. Returns INT32_MIN with errno set if
+ * fd cannot be queried.
+ */
+int sync_status(int fd);
+
+/* Merges the count sync files in fds into a new one, with one poll to leave
+ * out those already signaled and a balanced tree of merges for the rest.
+ * Returns a dup() of fds[0] if all of them are signaled, or -1 with errno
+ * set. The originals remain the caller's to close.
+ */
+int sync_merge_many(const char *name, const int *fds, size_t count);
+
+/* Waits up to timeout msecs, < 0 forever, for all of the count sync files in
+ * fds to signal, polling them all at once. Returns 0, or -1 with errno ETIME
+ * on timeout or EINVAL if one of them is invalid.
+ */
+int sync_wait_all(const int *fds, size_t count, int timeout);
+
+/* As sync_wait_all, but returns as soon as any one of them signals, with its
+ * index in fds.
+ */
+int sync_wait_any(const int *fds, size_t count, int timeout);
+
 __END_DECLS
 
 #endif /* __SYS_CORE_SYNC_H */
@@ -21,8 +21,12 @@
 #include <malloc.h>
 #include <poll.h>
 #include <stdatomic.h>
+#include <stdbool.h>
 #include <stdint.h>
+#include <stdlib.h>
 #include <string.h>
+#include <time.h>
+#include <unistd.h>
 
 #include <sys/ioctl.h>
 #include <sys/stat.h>
@@ -386,6 +390,265 @@ void sync_file_info_free(struct sync_file_info *info)
     free(info);
 }
 
+// ---------------------------------------------------------------------------
+// Many sync files at once.
+
+#define LOCAL_FDS 16
+
+int sync_status(int fd)
+{
+    int uapi;
+    int err;
+
+    uapi = atomic_load_explicit(&g_uapi_version, memory_order_acquire);
+
+    if (uapi == UAPI_MODERN || uapi == UAPI_UNKNOWN) {
+        // With num_fences 0 the kernel fills in the header only.
+        struct sync_file_info info;
+        memset(&info, 0, sizeof(info));
+        err = ioctl(fd, SYNC_IOC_FILE_INFO, &info);
+        if (err >= 0 || errno != ENOTTY) {
+            if (err < 0)
+                return INT32_MIN;
+            if (uapi == UAPI_UNKNOWN) {
+                atomic_store_explicit(&g_uapi_version, UAPI_MODERN,
+                                      memory_order_release);
+            }
+            return info.status;
+        }
+    }
+
+    // The legacy ioctl insists on room for the pts, as legacy_sync_fence_info.
+    union {
+        struct sync_fence_info_data info;
+        uint8_t buf[4096];
+    } legacy;
+    legacy.info.len = sizeof(legacy);
+    err = ioctl(fd, SYNC_IOC_LEGACY_FENCE_INFO, &legacy.info);
+    if (err < 0)
+        return INT32_MIN;
+    if (uapi == UAPI_UNKNOWN) {
+        atomic_store_explicit(&g_uapi_version, UAPI_LEGACY,
+                              memory_order_release);
+    }
+    return legacy.info.status;
+}
+
+static struct pollfd *get_pollfds(const int *fds, size_t count,
+                                  struct pollfd *local)
+{
+    struct pollfd *pfds = local;
+
+    if (fds == NULL || count == 0) {
+        errno = EINVAL;
+        return NULL;
+    }
+    if (count > LOCAL_FDS) {
+        pfds = malloc(count * sizeof(*pfds));
+        if (pfds == NULL)
+            return NULL;
+    }
+    for (size_t i = 0; i < count; i++) {
+        if (fds[i] < 0) {
+            if (pfds != local)
+                free(pfds);
+            errno = EINVAL;
+            return NULL;
+        }
+        pfds[i].fd = fds[i];
+        pfds[i].events = POLLIN;
+        pfds[i].revents = 0;
+    }
+    return pfds;
+}
+
+static void put_pollfds(struct pollfd *pfds, struct pollfd *local)
+{
+    if (pfds != local) {
+        int save_errno = errno;
+        free(pfds);
+        errno = save_errno;
+    }
+}
+
+static int64_t now_ms(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+// Polls until one of pfds[0..count) is ready or deadline (< 0 for none)
+// passes. Returns what poll() does, errno ETIME on timeout.
+static int poll_until(struct pollfd *pfds, size_t count, int64_t deadline)
+{
+    int ret;
+
+    do {
+        int timeout = -1;
+        if (deadline >= 0) {
+            int64_t left = deadline - now_ms();
+            timeout = (left > 0) ? (left < INT32_MAX ? left : INT32_MAX) : 0;
+        }
+        ret = poll(pfds, count, timeout);
+        if (ret == 0) {
+            errno = ETIME;
+            return 0;
+        }
+    } while (ret == -1 && (errno == EINTR || errno == EAGAIN));
+
+    return ret;
+}
+
+int sync_wait_all(const int *fds, size_t count, int timeout)
+{
+    struct pollfd local[LOCAL_FDS];
+    struct pollfd *pfds;
+    int64_t deadline = (timeout >= 0) ? now_ms() + timeout : -1;
+    int ret = -1;
+
+    pfds = get_pollfds(fds, count, local);
+    if (pfds == NULL)
+        return -1;
+
+    while (count) {
+        if (poll_until(pfds, count, deadline) <= 0)
+            goto out;
+
+        // Drop what has signaled, moving the last one into its place.
+        for (size_t i = count; i-- > 0; ) {
+            if (pfds[i].revents & (POLLERR | POLLNVAL)) {
+                errno = EINVAL;
+                goto out;
+            }
+            if (pfds[i].revents)
+                pfds[i] = pfds[--count];
+        }
+    }
+    ret = 0;
+
+out:
+    put_pollfds(pfds, local);
+    return ret;
+}
+
+int sync_wait_any(const int *fds, size_t count, int timeout)
+{
+    struct pollfd local[LOCAL_FDS];
+    struct pollfd *pfds;
+    int64_t deadline = (timeout >= 0) ? now_ms() + timeout : -1;
+    int ret = -1;
+
+    pfds = get_pollfds(fds, count, local);
+    if (pfds == NULL)
+        return -1;
+
+    if (poll_until(pfds, count, deadline) > 0) {
+        for (size_t i = 0; i < count; i++) {
+            if (pfds[i].revents & (POLLERR | POLLNVAL)) {
+                errno = EINVAL;
+                break;
+            }
+            if (pfds[i].revents) {
+                ret = i;
+                break;
+            }
+        }
+    }
+
+    put_pollfds(pfds, local);
+    return ret;
+}
+
+struct merge_fd {
+    int fd;
+    bool owned;  // an intermediate merge, to be closed
+};
+
+int sync_merge_many(const char *name, const int *fds, size_t count)
+{
+    struct pollfd local[LOCAL_FDS];
+    struct pollfd *pfds;
+    struct merge_fd *todo;
+    size_t n = 0;
+    int ret = -1;
+
+    pfds = get_pollfds(fds, count, local);
+    if (pfds == NULL)
+        return -1;
+    todo = malloc(count * sizeof(*todo));
+    if (todo == NULL)
+        goto out;
+
+    // One poll for all of them; signaled ones only matter if in error.
+    if (poll(pfds, count, 0) < 0)
+        goto out;
+    for (size_t i = 0; i < count; i++) {
+        if (pfds[i].revents & (POLLERR | POLLNVAL)) {
+            errno = EINVAL;
+            goto out;
+        }
+        if (pfds[i].revents && sync_status(fds[i]) >= 0)
+            continue;
+        todo[n].fd = fds[i];
+        todo[n].owned = false;
+        n++;
+    }
+
+    if (n == 0) {
+        ret = dup(fds[0]);
+        goto out;
+    }
+    if (n == 1) {
+        ret = dup(todo[0].fd);
+        goto out;
+    }
+
+    // Pairwise, level by level, so no merge copies the same pts over and over.
+    while (n > 1) {
+        size_t m = 0;
+        for (size_t i = 0; i < n; i += 2) {
+            if (i + 1 == n) {
+                todo[m++] = todo[i];
+                break;
+            }
+            int merged = sync_merge(name, todo[i].fd, todo[i + 1].fd);
+            int save_errno = errno;
+            if (todo[i].owned)
+                close(todo[i].fd);
+            if (todo[i + 1].owned)
+                close(todo[i + 1].fd);
+            if (merged < 0) {
+                for (size_t j = i + 2; j < n; j++) {
+                    if (todo[j].owned)
+                        close(todo[j].fd);
+                }
+                for (size_t j = 0; j < m; j++) {
+                    if (todo[j].owned)
+                        close(todo[j].fd);
+                }
+                errno = save_errno;
+                goto out;
+            }
+            todo[m].fd = merged;
+            todo[m].owned = true;
+            m++;
+        }
+        n = m;
+    }
+    ret = todo[0].fd;
+
+out:
+    put_pollfds(pfds, local);
+    if (todo) {
+        int save_errno = errno;
+        free(todo);
+        errno = save_errno;
+    }
+    return ret;
+}
+
 
 int sw_sync_timeline_create(void)
 {
@@ -448,6 +448,76 @@ TEST(FenceTest, MultiTimelineWait) {
     ASSERT_EQ(mergedFence.wait(100), 0);
 }
 
+TEST(FenceTest, MultiTimelineWaitAllAny) {
+    SyncTimeline timelineA, timelineB, timelineC;
+
+    SyncFence fenceA(timelineA, 5);
+    SyncFence fenceB(timelineB, 5);
+    SyncFence fenceC(timelineC, 5);
+    const int fds[] = {fenceA.getFd(), fenceB.getFd(), fenceC.getFd()};
+
+    ASSERT_EQ(sync_wait_any(fds, 3, 0), -1);
+    ASSERT_EQ(errno, ETIME);
+    ASSERT_EQ(sync_wait_all(fds, 3, 0), -1);
+    ASSERT_EQ(errno, ETIME);
+    ASSERT_EQ(sync_status(fenceB.getFd()), 0);
+
+    timelineB.inc(5);
+    ASSERT_EQ(sync_status(fenceB.getFd()), 1);
+    ASSERT_EQ(sync_wait_any(fds, 3, 0), 1);
+    ASSERT_EQ(sync_wait_all(fds, 3, 0), -1);
+    ASSERT_EQ(errno, ETIME);
+
+    timelineA.inc(5);
+    timelineC.inc(5);
+    ASSERT_EQ(sync_wait_all(fds, 3, 100), 0);
+
+    const int bad[] = {fenceA.getFd(), -1};
+    ASSERT_EQ(sync_wait_all(bad, 2, 0), -1);
+    ASSERT_EQ(errno, EINVAL);
+    ASSERT_EQ(sync_wait_any(fds, 0, 0), -1);
+    ASSERT_EQ(errno, EINVAL);
+}
+
+TEST(FenceTest, MergeMany) {
+    const int count = 40;
+    SyncTimeline timeline[count];
+    vector<SyncFence> fences;
+    vector<int> fds;
+
+    for (int i = 0; i < count; i++) {
+        fences.emplace_back(timeline[i], 1);
+        ASSERT_TRUE(fences.back().isValid());
+        fds.push_back(fences.back().getFd());
+    }
+    // signaled ones are left out
+    for (int i = 0; i < count; i += 2) {
+        timeline[i].inc(1);
+    }
+
+    int merged = sync_merge_many("mergeMany", fds.data(), fds.size());
+    ASSERT_GE(merged, 0);
+    struct sync_file_info *info = sync_file_info(merged);
+    ASSERT_TRUE(info != NULL);
+    EXPECT_EQ(info->num_fences, count / 2u);
+    EXPECT_EQ(info->status, 0);
+    sync_file_info_free(info);
+
+    ASSERT_EQ(sync_wait(merged, 0), -1);
+    for (int i = 1; i < count; i += 2) {
+        timeline[i].inc(1);
+    }
+    ASSERT_EQ(sync_wait(merged, 0), 0);
+    ASSERT_EQ(sync_status(merged), 1);
+    close(merged);
+
+    // all of them signaled
+    merged = sync_merge_many("mergeMany", fds.data(), fds.size());
+    ASSERT_GE(merged, 0);
+    ASSERT_EQ(sync_wait(merged, 0), 0);
+    close(merged);
+}
+
 TEST(StressTest, TwoThreadsSharedTimeline) {
     const int iterations = 1 << 16;
     int counter = 0;
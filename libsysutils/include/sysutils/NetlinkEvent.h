@@ -42,12 +42,18 @@ private:
     Action mAction;
     char *mSubsystem;
     char *mParams[NL_PARAMS_MAX];
+    // The strings above point into the decoded buffer
+    bool mInPlace;
 
 public:
     NetlinkEvent();
     virtual ~NetlinkEvent();
 
     bool decode(char *buffer, int size, int format = NetlinkListener::NETLINK_FORMAT_ASCII);
+    // Like decode(), but ASCII events are parsed without copying: the path,
+    // subsystem and parameters point into buffer, which must outlive the event.
+    bool decodeInPlace(char *buffer, int size,
+                       int format = NetlinkListener::NETLINK_FORMAT_ASCII);
     const char *findParam(const char *paramName);
 
     const char *getSubsystem() { return mSubsystem; }
@@ -64,6 +70,9 @@ public:
     bool parseNfPacketMessage(struct nlmsghdr *nh);
     bool parseRtMessage(const struct nlmsghdr *nh);
     bool parseNdUserOptMessage(const struct nlmsghdr *nh);
+
+ private:
+    char *keepString(const char *s);
 };
 
 #endif
@@ -21,8 +21,17 @@
 class NetlinkEvent;
 
 class NetlinkListener : public SocketListener {
-    char mBuffer[64 * 1024] __attribute__((aligned(4)));
+    // Datagrams received per system call, for ASCII and binary formats, and
+    // the space each gets; uevents are at most a few KiB.
+    static const int kAsciiSlots = 8;
+    static const size_t kAsciiSlotSize = 8 * 1024;
+    static const int kBinarySlots = 4;
+    static const size_t kBinarySlotSize = 64 * 1024;
+
+    char *mBuffer;
     int mFormat;
+    int mSlots;
+    size_t mSlotSize;
 
 public:
     static const int NETLINK_FORMAT_ASCII = 0;
@@ -39,11 +48,15 @@ public:
 #else
     NetlinkListener(int socket, int format = NETLINK_FORMAT_ASCII);
 #endif
-    virtual ~NetlinkListener() {}
+    virtual ~NetlinkListener();
 
 protected:
     virtual bool onDataAvailable(SocketClient *cli);
+    // evt, and the strings it returns, are only valid until this returns.
     virtual void onEvent(NetlinkEvent *evt) = 0;
+
+private:
+    void init(int format);
 };
 
 #endif
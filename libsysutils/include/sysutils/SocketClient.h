@@ -4,6 +4,7 @@
 #include "List.h"
 
 #include <pthread.h>
+#include <stdint.h>
 #include <cutils/atomic.h>
 #include <sys/types.h>
 #include <sys/uio.h>
@@ -30,6 +31,57 @@ class SocketClient {
 
     bool mUseCmdNum;
 
+public:
+    // How well the client keeps up with us, and we with it.
+    struct Stats {
+        // onDataAvailable() calls for this client
+        uint64_t dispatches;
+        // Time it spent readable, waiting for a SocketListener dispatch thread
+        uint64_t queuedNs;
+        uint64_t maxQueuedNs;
+        // Data written to it, and the time that took: writes block while the
+        // client leaves its socket buffer full
+        uint64_t bytesSent;
+        uint64_t sendNs;
+        uint64_t maxSendNs;
+        // With an output queue: its high-water mark, and the messages
+        // OVERFLOW_DROP_OLDEST threw away
+        uint64_t maxOutputQueued;
+        uint64_t droppedMessages;
+        uint64_t droppedBytes;
+    };
+
+    // What a client with an output queue does when the queue is full.
+    enum OverflowPolicy {
+        // Discard the oldest messages that haven't been started on yet
+        OVERFLOW_DROP_OLDEST,
+        // Shut the socket down; the listener then sees the peer hang up
+        OVERFLOW_DISCONNECT,
+    };
+
+private:
+    pthread_mutex_t mStatsMutex;
+    Stats mStats;
+
+    // Output the peer wasn't ready for, guarded by mWriteMutex. NULL unless
+    // enableOutputQueue() was called.
+    struct OutputBuffer {
+        char *data;
+        size_t len;
+        size_t offset;
+    };
+    android::sysutils::List<OutputBuffer> *mOutput;
+    size_t mOutputBytes;
+    size_t mOutputMax;
+    OverflowPolicy mOverflowPolicy;
+    // Whether the flusher thread is watching us, holding a reference
+    bool mOutputArmed;
+    // The error that ended the queue's writes
+    int mOutputError;
+    // SO_SNDTIMEO, and when the queue last got anywhere
+    uint64_t mOutputTimeoutNs;
+    uint64_t mOutputProgressNs;
+
 public:
     SocketClient(int sock, bool owned);
     SocketClient(int sock, bool owned, bool useCmdNum);
@@ -70,6 +122,19 @@ public:
     void incRef();
     bool decRef(); // returns true at 0 (but note: SocketClient already deleted)
 
+    // Stop sends from blocking on a slow peer: whatever the socket won't
+    // take right away is queued, up to maxBytes, and written by a
+    // background thread as the peer reads. Messages are only ever dropped
+    // whole. A peer that takes nothing for as long as the socket's
+    // SO_SNDTIMEO (as set when this is called) is disconnected, the way a
+    // blocking send would have timed out. Fails with ENOTSOCK unless the
+    // client is a socket.
+    int enableOutputQueue(size_t maxBytes, OverflowPolicy policy);
+
+    void getStats(Stats* stats);
+    // Called by SocketListener before each onDataAvailable().
+    void noteDispatch(uint64_t queuedNs);
+
     // return a new string in quotes with '\\' and '\"' escaped for "my arg"
     // transmissions
     static char *quoteArg(const char *arg);
@@ -82,6 +147,15 @@ private:
     // returns 0 if successful, -1 if there is a 0 byte write or if any
     // other error occurred (use errno to get the error)
     int sendDataLockedv(struct iovec *iov, int iovcnt);
+    int queueDataLockedv(struct iovec *iov, int iovcnt);
+    bool makeOutputRoomLocked(size_t len);
+    void disconnectOutputLocked(int error);
+    void clearOutputLocked();
+    // Returns true once there is nothing left that can be written.
+    bool flushOutputLocked();
+    void noteSent(uint64_t bytes, uint64_t elapsedNs);
+    static void startFlusher();
+    static void *flusherStart(void *obj);
 };
 
 typedef android::sysutils::List<SocketClient *> SocketClientCollection;
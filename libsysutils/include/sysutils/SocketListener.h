@@ -17,20 +17,40 @@
 #define _SOCKETLISTENER_H
 
 #include <pthread.h>
+#include <stdint.h>
 
 #include <sysutils/SocketClient.h>
 #include "SocketClientCommand.h"
 
 class SocketListener {
+    // A readable client waiting for a dispatch thread
+    struct PendingClient {
+        SocketClient *client;
+        uint64_t readyNs;
+    };
+    typedef android::sysutils::List<PendingClient> PendingClientCollection;
+
     bool                    mListen;
     const char              *mSocketName;
     int                     mSock;
     SocketClientCollection  *mClients;
     pthread_mutex_t         mClientsLock;
     int                     mCtrlPipe[2];
+    int                     mEpollFd;
     pthread_t               mThread;
     bool                    mUseCmdNum;
 
+    // Released by release() but possibly still named by the epoll events the
+    // listener thread is working through; guarded by mClientsLock
+    SocketClientCollection  *mReleased;
+
+    int                     mDispatchThreads;
+    pthread_t               *mWorkers;
+    PendingClientCollection *mPending;
+    pthread_mutex_t         mPendingLock;
+    pthread_cond_t          mPendingCond;
+    bool                    mStopping;
+
 public:
     SocketListener(const char *socketName, bool listen);
     SocketListener(const char *socketName, bool listen, bool useCmdNum);
@@ -39,12 +59,18 @@ public:
     virtual ~SocketListener();
     int startListener();
     int startListener(int backlog);
+    // With dispatchThreads > 0, onDataAvailable() runs on that many threads
+    // rather than the listener thread. A client is only handed to one of them
+    // at a time, but different clients are handled concurrently, so the
+    // subclass's onDataAvailable() must be thread safe.
+    int startListener(int backlog, int dispatchThreads);
     int stopListener();
 
     void sendBroadcast(int code, const char *msg, bool addErrno);
 
     void runOnEachSocket(SocketClientCommand *command);
 
+    // Returns true if c was one of our clients.
     bool release(SocketClient *c) { return release(c, true); }
 
 protected:
@@ -52,8 +78,13 @@ protected:
 
 private:
     bool release(SocketClient *c, bool wakeup);
+    bool registerClient(SocketClient *c);
+    void dispatch(SocketClient *c, uint64_t readyNs);
+    void releasePending();
     static void *threadStart(void *obj);
+    static void *workerStart(void *obj);
     void runListener();
+    void runWorker();
     void init(const char *socketName, int socketFd, bool listen, bool useCmdNum);
 };
 #endif
@@ -49,10 +49,13 @@ NetlinkEvent::NetlinkEvent() {
     memset(mParams, 0, sizeof(mParams));
     mPath = NULL;
     mSubsystem = NULL;
+    mInPlace = false;
 }
 
 NetlinkEvent::~NetlinkEvent() {
     int i;
+    if (mInPlace)
+        return;
     if (mPath)
         free(mPath);
     if (mSubsystem)
@@ -602,7 +605,7 @@ bool NetlinkEvent::parseAsciiNetlinkMessage(char *buffer, int size) {
                     return false;
                 }
             }
-            mPath = strdup(p+1);
+            mPath = keepString(p+1);
             first = 0;
         } else {
             const char* a;
@@ -616,9 +619,9 @@ bool NetlinkEvent::parseAsciiNetlinkMessage(char *buffer, int size) {
             } else if ((a = HAS_CONST_PREFIX(s, end, "SEQNUM=")) != NULL) {
                 mSeq = atoi(a);
             } else if ((a = HAS_CONST_PREFIX(s, end, "SUBSYSTEM=")) != NULL) {
-                mSubsystem = strdup(a);
+                mSubsystem = keepString(a);
             } else if (param_idx < NL_PARAMS_MAX) {
-                mParams[param_idx++] = strdup(s);
+                mParams[param_idx++] = keepString(s);
             }
         }
         s += strlen(s) + 1;
@@ -626,6 +629,17 @@ bool NetlinkEvent::parseAsciiNetlinkMessage(char *buffer, int size) {
     return true;
 }
 
+char *NetlinkEvent::keepString(const char *s) {
+    return mInPlace ? const_cast<char *>(s) : strdup(s);
+}
+
+bool NetlinkEvent::decodeInPlace(char *buffer, int size, int format) {
+    if (format == NetlinkListener::NETLINK_FORMAT_ASCII) {
+        mInPlace = true;
+    }
+    return decode(buffer, size, format);
+}
+
 bool NetlinkEvent::decode(char *buffer, int size, int format) {
     if (format == NetlinkListener::NETLINK_FORMAT_BINARY
             || format == NetlinkListener::NETLINK_FORMAT_BINARY_UNICAST) {
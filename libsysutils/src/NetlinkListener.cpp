@@ -35,41 +35,70 @@
  */
 NetlinkListener::NetlinkListener(int socket) :
                             SocketListener(socket, false) {
-    mFormat = NETLINK_FORMAT_ASCII;
+    init(NETLINK_FORMAT_ASCII);
 }
 #endif
 
 NetlinkListener::NetlinkListener(int socket, int format) :
-                            SocketListener(socket, false), mFormat(format) {
+                            SocketListener(socket, false) {
+    init(format);
+}
+
+void NetlinkListener::init(int format) {
+    mFormat = format;
+    if (mFormat == NETLINK_FORMAT_ASCII) {
+        mSlots = kAsciiSlots;
+        mSlotSize = kAsciiSlotSize;
+    } else {
+        mSlots = kBinarySlots;
+        mSlotSize = kBinarySlotSize;
+    }
+    mBuffer = new char[mSlots * mSlotSize];
+}
+
+NetlinkListener::~NetlinkListener() {
+    delete[] mBuffer;
 }
 
 bool NetlinkListener::onDataAvailable(SocketClient *cli)
 {
     int socket = cli->getSocket();
-    ssize_t count;
-    uid_t uid = -1;
+    struct uevent_msg msgs[kAsciiSlots > kBinarySlots ? kAsciiSlots : kBinarySlots];
+    int count;
 
     bool require_group = true;
     if (mFormat == NETLINK_FORMAT_BINARY_UNICAST) {
         require_group = false;
     }
 
-    count = TEMP_FAILURE_RETRY(uevent_kernel_recv(socket,
-            mBuffer, sizeof(mBuffer), require_group, &uid));
+    for (int i = 0; i < mSlots; i++) {
+        msgs[i].buffer = mBuffer + i * mSlotSize;
+        msgs[i].length = mSlotSize;
+    }
+
+    // Everything already queued on the socket, up to mSlots datagrams.
+    count = TEMP_FAILURE_RETRY(uevent_kernel_recvmmsg(socket, msgs, mSlots, require_group));
     if (count < 0) {
-        SLOGE("recvmsg failed (%s)", strerror(errno));
+        SLOGE("recvmmsg failed (%s)", strerror(errno));
         return false;
     }
 
-    NetlinkEvent *evt = new NetlinkEvent();
-    if (evt->decode(mBuffer, count, mFormat)) {
-        onEvent(evt);
-    } else if (mFormat != NETLINK_FORMAT_BINARY) {
-        // Don't complain if parseBinaryNetlinkMessage returns false. That can
-        // just mean that the buffer contained no messages we're interested in.
-        SLOGE("Error decoding NetlinkEvent");
-    }
+    for (int i = 0; i < count; i++) {
+        if (msgs[i].received < 0) {
+            SLOGE("recvmsg failed (%s)", strerror(msgs[i].error));
+            continue;
+        }
 
-    delete evt;
+        // The event only lives as long as onEvent(), and the slot until the
+        // next call, so nothing needs copying out of it.
+        NetlinkEvent evt;
+        if (evt.decodeInPlace(static_cast<char *>(msgs[i].buffer), msgs[i].received, mFormat)) {
+            onEvent(&evt);
+        } else if (mFormat != NETLINK_FORMAT_BINARY) {
+            // Don't complain if parseBinaryNetlinkMessage returns false. That can
+            // just mean that the buffer contained no messages we're interested in.
+            SLOGE("Error decoding NetlinkEvent");
+        }
+    }
     return true;
 }
@@ -23,13 +23,45 @@
 #include <pthread.h>
 #include <signal.h>
 #include <string.h>
+#include <sys/epoll.h>
 #include <sys/socket.h>
 #include <sys/types.h>
+#include <time.h>
 #include <unistd.h>
 
 #include <log/log.h>
 #include <sysutils/SocketClient.h>
 
+static uint64_t nowNs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * UINT64_C(1000000000) + ts.tv_nsec;
+}
+
+// One thread writes out the output queues of all of the process's clients,
+// watching those with something queued through sFlusherEpollFd.
+static pthread_once_t sFlusherOnce = PTHREAD_ONCE_INIT;
+static int sFlusherEpollFd = -1;
+
+void SocketClient::startFlusher() {
+    sFlusherEpollFd = epoll_create1(EPOLL_CLOEXEC);
+    if (sFlusherEpollFd < 0) {
+        SLOGE("epoll_create1 failed (%s)", strerror(errno));
+        return;
+    }
+
+    pthread_t thread;
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    if (pthread_create(&thread, &attr, SocketClient::flusherStart, NULL)) {
+        SLOGE("pthread_create (%s)", strerror(errno));
+        close(sFlusherEpollFd);
+        sFlusherEpollFd = -1;
+    }
+    pthread_attr_destroy(&attr);
+}
+
 SocketClient::SocketClient(int socket, bool owned) {
     init(socket, owned, false);
 }
@@ -44,6 +76,16 @@ void SocketClient::init(int socket, bool owned, bool useCmdNum) {
     mUseCmdNum = useCmdNum;
     pthread_mutex_init(&mWriteMutex, NULL);
     pthread_mutex_init(&mRefCountMutex, NULL);
+    pthread_mutex_init(&mStatsMutex, NULL);
+    memset(&mStats, 0, sizeof(mStats));
+    mOutput = NULL;
+    mOutputBytes = 0;
+    mOutputMax = 0;
+    mOverflowPolicy = OVERFLOW_DROP_OLDEST;
+    mOutputArmed = false;
+    mOutputError = 0;
+    mOutputTimeoutNs = 0;
+    mOutputProgressNs = 0;
     mPid = -1;
     mUid = -1;
     mGid = -1;
@@ -66,6 +108,10 @@ SocketClient::~SocketClient() {
     if (mSocketOwned) {
         close(mSocket);
     }
+    if (mOutput) {
+        clearOutputLocked();
+        delete mOutput;
+    }
 }
 
 int SocketClient::sendMsg(int code, const char *msg, bool addErrno) {
@@ -198,6 +244,10 @@ int SocketClient::sendDataLockedv(struct iovec *iov, int iovcnt) {
         return 0;
     }
 
+    if (mOutput) {
+        return queueDataLockedv(iov, iovcnt);
+    }
+
     int ret = 0;
     int e = 0; // SLOGW and sigaction are not inert regarding errno
     int current = 0;
@@ -207,12 +257,15 @@ int SocketClient::sendDataLockedv(struct iovec *iov, int iovcnt) {
     new_action.sa_handler = SIG_IGN;
     sigaction(SIGPIPE, &new_action, &old_action);
 
+    uint64_t start = nowNs();
+    uint64_t sent = 0;
     for (;;) {
         ssize_t rc = TEMP_FAILURE_RETRY(
             writev(mSocket, iov + current, iovcnt - current));
 
         if (rc > 0) {
             size_t written = rc;
+            sent += rc;
             while ((current < iovcnt) && (written >= iov[current].iov_len)) {
                 written -= iov[current].iov_len;
                 current++;
@@ -238,12 +291,293 @@ int SocketClient::sendDataLockedv(struct iovec *iov, int iovcnt) {
 
     sigaction(SIGPIPE, &old_action, &new_action);
 
+    noteSent(sent, nowNs() - start);
+
     if (e != 0) {
         errno = e;
     }
     return ret;
 }
 
+int SocketClient::enableOutputQueue(size_t maxBytes, OverflowPolicy policy) {
+    int type;
+    socklen_t len = sizeof(type);
+    if (getsockopt(mSocket, SOL_SOCKET, SO_TYPE, &type, &len)) {
+        return -1;
+    }
+    struct timeval timeout;
+    len = sizeof(timeout);
+    if (getsockopt(mSocket, SOL_SOCKET, SO_SNDTIMEO, &timeout, &len)) {
+        return -1;
+    }
+
+    pthread_once(&sFlusherOnce, startFlusher);
+    if (sFlusherEpollFd < 0) {
+        errno = EAGAIN;
+        return -1;
+    }
+
+    pthread_mutex_lock(&mWriteMutex);
+    if (!mOutput) {
+        mOutput = new android::sysutils::List<OutputBuffer>();
+    }
+    mOutputMax = maxBytes;
+    mOverflowPolicy = policy;
+    mOutputTimeoutNs = timeout.tv_sec * UINT64_C(1000000000) + timeout.tv_usec * UINT64_C(1000);
+    pthread_mutex_unlock(&mWriteMutex);
+    return 0;
+}
+
+int SocketClient::queueDataLockedv(struct iovec *iov, int iovcnt) {
+    if (mOutputError) {
+        errno = mOutputError;
+        return -1;
+    }
+
+    size_t total = 0;
+    for (int i = 0; i < iovcnt; i++) {
+        total += iov[i].iov_len;
+    }
+
+    // Anything already queued has to go first.
+    size_t sent = 0;
+    if (mOutput->empty()) {
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = iov;
+        msg.msg_iovlen = iovcnt;
+        uint64_t start = nowNs();
+        ssize_t rc = TEMP_FAILURE_RETRY(sendmsg(mSocket, &msg, MSG_DONTWAIT | MSG_NOSIGNAL));
+        if (rc < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
+            int e = errno;
+            SLOGW("write error (%s)", strerror(e));
+            errno = e;
+            return -1;
+        }
+        if (rc > 0) {
+            sent = rc;
+        }
+        noteSent(sent, nowNs() - start);
+        if (sent == total) {
+            return 0;
+        }
+        mOutputProgressNs = nowNs();
+    } else if (mOutputTimeoutNs && nowNs() - mOutputProgressNs > mOutputTimeoutNs) {
+        SLOGW("Disconnecting client %d, stalled with %zu bytes queued", mSocket, mOutputBytes);
+        disconnectOutputLocked(EAGAIN);
+        errno = mOutputError;
+        return -1;
+    }
+
+    size_t len = total - sent;
+    if (mOutputBytes + len > mOutputMax && !makeOutputRoomLocked(len)) {
+        if (mOverflowPolicy == OVERFLOW_DISCONNECT) {
+            errno = mOutputError;
+            return -1;
+        }
+        // Too big to ever fit, so it goes rather than anything older.
+        pthread_mutex_lock(&mStatsMutex);
+        mStats.droppedMessages++;
+        mStats.droppedBytes += len;
+        pthread_mutex_unlock(&mStatsMutex);
+        return 0;
+    }
+
+    OutputBuffer buffer;
+    buffer.data = (char *)malloc(len);
+    if (!buffer.data) {
+        errno = ENOMEM;
+        return -1;
+    }
+    buffer.len = len;
+    buffer.offset = 0;
+    char *dst = buffer.data;
+    for (int i = 0; i < iovcnt; i++) {
+        size_t skip = sent < iov[i].iov_len ? sent : iov[i].iov_len;
+        sent -= skip;
+        memcpy(dst, (char *)iov[i].iov_base + skip, iov[i].iov_len - skip);
+        dst += iov[i].iov_len - skip;
+    }
+    mOutput->push_back(buffer);
+    mOutputBytes += len;
+
+    pthread_mutex_lock(&mStatsMutex);
+    if (mOutputBytes > mStats.maxOutputQueued) {
+        mStats.maxOutputQueued = mOutputBytes;
+    }
+    pthread_mutex_unlock(&mStatsMutex);
+
+    if (!mOutputArmed) {
+        struct epoll_event ev;
+        memset(&ev, 0, sizeof(ev));
+        ev.events = EPOLLOUT | EPOLLONESHOT;
+        ev.data.ptr = this;
+        // The flusher's reference; our caller's keeps this from being the
+        // last one should epoll_ctl fail.
+        incRef();
+        if (epoll_ctl(sFlusherEpollFd, EPOLL_CTL_ADD, mSocket, &ev)) {
+            int e = errno;
+            SLOGE("epoll_ctl failed (%s)", strerror(e));
+            decRef();
+            clearOutputLocked();
+            errno = e;
+            return -1;
+        }
+        mOutputArmed = true;
+    }
+    return 0;
+}
+
+// Called with the queue full. Returns true if len more bytes now fit.
+bool SocketClient::makeOutputRoomLocked(size_t len) {
+    if (mOverflowPolicy == OVERFLOW_DISCONNECT) {
+        SLOGW("Disconnecting client %d, %zu bytes behind", mSocket, mOutputBytes);
+        disconnectOutputLocked(ENOBUFS);
+        return false;
+    }
+
+    if (len > mOutputMax) {
+        return false;
+    }
+
+    uint64_t messages = 0;
+    uint64_t bytes = 0;
+    android::sysutils::List<OutputBuffer>::iterator it = mOutput->begin();
+    while (it != mOutput->end() && mOutputBytes + len > mOutputMax) {
+        // The peer has part of this one already.
+        if (it->offset) {
+            ++it;
+            continue;
+        }
+        messages++;
+        bytes += it->len;
+        mOutputBytes -= it->len;
+        free(it->data);
+        it = mOutput->erase(it);
+    }
+
+    pthread_mutex_lock(&mStatsMutex);
+    mStats.droppedMessages += messages;
+    mStats.droppedBytes += bytes;
+    pthread_mutex_unlock(&mStatsMutex);
+    return mOutputBytes + len <= mOutputMax;
+}
+
+// The listener sees the peer hang up, and the flusher an empty queue.
+void SocketClient::disconnectOutputLocked(int error) {
+    shutdown(mSocket, SHUT_RDWR);
+    clearOutputLocked();
+    mOutputError = error;
+}
+
+void SocketClient::clearOutputLocked() {
+    android::sysutils::List<OutputBuffer>::iterator it;
+    for (it = mOutput->begin(); it != mOutput->end();) {
+        free(it->data);
+        it = mOutput->erase(it);
+    }
+    mOutputBytes = 0;
+}
+
+bool SocketClient::flushOutputLocked() {
+    uint64_t start = nowNs();
+    uint64_t sent = 0;
+    bool done = true;
+
+    while (!mOutput->empty()) {
+        OutputBuffer &buffer = *mOutput->begin();
+        ssize_t rc = TEMP_FAILURE_RETRY(send(mSocket, buffer.data + buffer.offset,
+                                             buffer.len - buffer.offset,
+                                             MSG_DONTWAIT | MSG_NOSIGNAL));
+        if (rc < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                done = false;
+            } else {
+                mOutputError = errno;
+                SLOGW("write error (%s)", strerror(mOutputError));
+                clearOutputLocked();
+            }
+            break;
+        }
+        sent += rc;
+        buffer.offset += rc;
+        mOutputBytes -= rc;
+        if (buffer.offset == buffer.len) {
+            free(buffer.data);
+            mOutput->erase(mOutput->begin());
+        }
+    }
+
+    uint64_t now = nowNs();
+    if (sent) {
+        mOutputProgressNs = now;
+    }
+    noteSent(sent, now - start);
+    return done;
+}
+
+void SocketClient::noteSent(uint64_t bytes, uint64_t elapsedNs) {
+    pthread_mutex_lock(&mStatsMutex);
+    mStats.bytesSent += bytes;
+    mStats.sendNs += elapsedNs;
+    if (elapsedNs > mStats.maxSendNs) {
+        mStats.maxSendNs = elapsedNs;
+    }
+    pthread_mutex_unlock(&mStatsMutex);
+}
+
+void *SocketClient::flusherStart(void *) {
+    struct epoll_event events[32];
+
+    while (1) {
+        int rc = epoll_wait(sFlusherEpollFd, events, 32, -1);
+        if (rc < 0) {
+            if (errno != EINTR) {
+                SLOGE("epoll_wait failed (%s)", strerror(errno));
+                sleep(1);
+            }
+            continue;
+        }
+
+        for (int i = 0; i < rc; i++) {
+            SocketClient *c = reinterpret_cast<SocketClient *>(events[i].data.ptr);
+            pthread_mutex_lock(&c->mWriteMutex);
+            bool done = c->flushOutputLocked();
+            if (done) {
+                epoll_ctl(sFlusherEpollFd, EPOLL_CTL_DEL, c->mSocket, NULL);
+                c->mOutputArmed = false;
+            } else {
+                struct epoll_event ev;
+                memset(&ev, 0, sizeof(ev));
+                ev.events = EPOLLOUT | EPOLLONESHOT;
+                ev.data.ptr = c;
+                epoll_ctl(sFlusherEpollFd, EPOLL_CTL_MOD, c->mSocket, &ev);
+            }
+            pthread_mutex_unlock(&c->mWriteMutex);
+            if (done) {
+                c->decRef();
+            }
+        }
+    }
+    return NULL;
+}
+
+void SocketClient::getStats(Stats* stats) {
+    pthread_mutex_lock(&mStatsMutex);
+    *stats = mStats;
+    pthread_mutex_unlock(&mStatsMutex);
+}
+
+void SocketClient::noteDispatch(uint64_t queuedNs) {
+    pthread_mutex_lock(&mStatsMutex);
+    mStats.dispatches++;
+    mStats.queuedNs += queuedNs;
+    if (queuedNs > mStats.maxQueuedNs) {
+        mStats.maxQueuedNs = queuedNs;
+    }
+    pthread_mutex_unlock(&mStatsMutex);
+}
+
 void SocketClient::incRef() {
     pthread_mutex_lock(&mRefCountMutex);
     mRefCount++;
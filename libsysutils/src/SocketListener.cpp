@@ -17,13 +17,16 @@
 #define LOG_TAG "SocketListener"
 
 #include <errno.h>
+#include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
-#include <sys/select.h>
+#include <string.h>
+#include <sys/epoll.h>
 #include <sys/socket.h>
 #include <sys/time.h>
 #include <sys/types.h>
 #include <sys/un.h>
+#include <time.h>
 #include <unistd.h>
 
 #include <cutils/sockets.h>
@@ -34,6 +37,15 @@
 #define CtrlPipe_Shutdown 0
 #define CtrlPipe_Wakeup   1
 
+// Events handled per epoll_wait()
+#define MaxEvents 32
+
+static uint64_t nowNs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * UINT64_C(1000000000) + ts.tv_nsec;
+}
+
 SocketListener::SocketListener(const char *socketName, bool listen) {
     init(socketName, -1, listen, false);
 }
@@ -51,8 +63,18 @@ void SocketListener::init(const char *socketName, int socketFd, bool listen, boo
     mSocketName = socketName;
     mSock = socketFd;
     mUseCmdNum = useCmdNum;
+    mCtrlPipe[0] = -1;
+    mCtrlPipe[1] = -1;
+    mEpollFd = -1;
     pthread_mutex_init(&mClientsLock, NULL);
     mClients = new SocketClientCollection();
+    mReleased = new SocketClientCollection();
+    mDispatchThreads = 0;
+    mWorkers = NULL;
+    mPending = new PendingClientCollection();
+    pthread_mutex_init(&mPendingLock, NULL);
+    pthread_cond_init(&mPendingCond, NULL);
+    mStopping = false;
 }
 
 SocketListener::~SocketListener() {
@@ -63,12 +85,19 @@ SocketListener::~SocketListener() {
         close(mCtrlPipe[0]);
         close(mCtrlPipe[1]);
     }
+    if (mEpollFd != -1) {
+        close(mEpollFd);
+    }
     SocketClientCollection::iterator it;
     for (it = mClients->begin(); it != mClients->end();) {
         (*it)->decRef();
         it = mClients->erase(it);
     }
     delete mClients;
+    releasePending();
+    delete mReleased;
+    delete mPending;
+    delete[] mWorkers;
 }
 
 int SocketListener::startListener() {
@@ -76,6 +105,10 @@ int SocketListener::startListener() {
 }
 
 int SocketListener::startListener(int backlog) {
+    return startListener(backlog, 0);
+}
+
+int SocketListener::startListener(int backlog, int dispatchThreads) {
 
     if (!mSocketName && mSock == -1) {
         SLOGE("Failed to start unbound listener");
@@ -94,14 +127,60 @@ int SocketListener::startListener(int backlog) {
     if (mListen && listen(mSock, backlog) < 0) {
         SLOGE("Unable to listen on socket (%s)", strerror(errno));
         return -1;
-    } else if (!mListen)
-        mClients->push_back(new SocketClient(mSock, false, mUseCmdNum));
+    }
 
-    if (pipe(mCtrlPipe)) {
+    if (pipe2(mCtrlPipe, O_CLOEXEC)) {
         SLOGE("pipe failed (%s)", strerror(errno));
         return -1;
     }
 
+    if ((mEpollFd = epoll_create1(EPOLL_CLOEXEC)) < 0) {
+        SLOGE("epoll_create1 failed (%s)", strerror(errno));
+        return -1;
+    }
+
+    // The listening socket and the control pipe are told apart from the
+    // clients by their addresses.
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.ptr = &mCtrlPipe[0];
+    if (epoll_ctl(mEpollFd, EPOLL_CTL_ADD, mCtrlPipe[0], &ev)) {
+        SLOGE("epoll_ctl failed (%s)", strerror(errno));
+        return -1;
+    }
+    if (mListen) {
+        ev.data.ptr = &mSock;
+        if (epoll_ctl(mEpollFd, EPOLL_CTL_ADD, mSock, &ev)) {
+            SLOGE("epoll_ctl failed (%s)", strerror(errno));
+            return -1;
+        }
+    }
+
+    mDispatchThreads = dispatchThreads > 0 ? dispatchThreads : 0;
+    mStopping = false;
+
+    if (!mListen) {
+        SocketClient *c = new SocketClient(mSock, false, mUseCmdNum);
+        pthread_mutex_lock(&mClientsLock);
+        bool registered = registerClient(c);
+        pthread_mutex_unlock(&mClientsLock);
+        if (!registered) {
+            return -1;
+        }
+    }
+
+    if (mDispatchThreads) {
+        delete[] mWorkers;
+        mWorkers = new pthread_t[mDispatchThreads];
+        for (int i = 0; i < mDispatchThreads; i++) {
+            if (pthread_create(&mWorkers[i], NULL, SocketListener::workerStart, this)) {
+                SLOGE("pthread_create (%s)", strerror(errno));
+                return -1;
+            }
+        }
+    }
+
     if (pthread_create(&mThread, NULL, SocketListener::threadStart, this)) {
         SLOGE("pthread_create (%s)", strerror(errno));
         return -1;
@@ -125,6 +204,22 @@ int SocketListener::stopListener() {
         SLOGE("Error joining to listener thread (%s)", strerror(errno));
         return -1;
     }
+
+    // The workers finish whatever the listener thread queued before exiting.
+    pthread_mutex_lock(&mPendingLock);
+    mStopping = true;
+    pthread_cond_broadcast(&mPendingCond);
+    pthread_mutex_unlock(&mPendingLock);
+    for (int i = 0; i < mDispatchThreads; i++) {
+        if (pthread_join(mWorkers[i], &ret)) {
+            SLOGE("Error joining to dispatch thread (%s)", strerror(errno));
+            return -1;
+        }
+    }
+    mDispatchThreads = 0;
+
+    close(mEpollFd);
+    mEpollFd = -1;
     close(mCtrlPipe[0]);
     close(mCtrlPipe[1]);
     mCtrlPipe[0] = -1;
@@ -137,9 +232,10 @@ int SocketListener::stopListener() {
 
     SocketClientCollection::iterator it;
     for (it = mClients->begin(); it != mClients->end();) {
-        delete (*it);
+        (*it)->decRef();
         it = mClients->erase(it);
     }
+    releasePending();
     return 0;
 }
 
@@ -151,94 +247,143 @@ void *SocketListener::threadStart(void *obj) {
     return NULL;
 }
 
-void SocketListener::runListener() {
+void *SocketListener::workerStart(void *obj) {
+    SocketListener *me = reinterpret_cast<SocketListener *>(obj);
 
-    SocketClientCollection pendingList;
+    me->runWorker();
+    pthread_exit(NULL);
+    return NULL;
+}
 
-    while(1) {
-        SocketClientCollection::iterator it;
-        fd_set read_fds;
-        int rc = 0;
-        int max = -1;
+// Called with mClientsLock held. The reference c was created with becomes
+// mClients'.
+bool SocketListener::registerClient(SocketClient *c) {
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    // With dispatch threads the client stays disarmed until the thread
+    // handling it is done, so that no two threads ever read from it at once.
+    ev.events = EPOLLIN;
+    if (mDispatchThreads) {
+        ev.events |= EPOLLONESHOT;
+    }
+    ev.data.ptr = c;
+    if (epoll_ctl(mEpollFd, EPOLL_CTL_ADD, c->getSocket(), &ev)) {
+        SLOGE("epoll_ctl failed (%s)", strerror(errno));
+        c->decRef();
+        return false;
+    }
+    mClients->push_back(c);
+    return true;
+}
 
-        FD_ZERO(&read_fds);
+void SocketListener::releasePending() {
+    SocketClientCollection released;
 
-        if (mListen) {
-            max = mSock;
-            FD_SET(mSock, &read_fds);
-        }
+    pthread_mutex_lock(&mClientsLock);
+    SocketClientCollection::iterator it;
+    for (it = mReleased->begin(); it != mReleased->end();) {
+        released.push_back(*it);
+        it = mReleased->erase(it);
+    }
+    pthread_mutex_unlock(&mClientsLock);
 
-        FD_SET(mCtrlPipe[0], &read_fds);
-        if (mCtrlPipe[0] > max)
-            max = mCtrlPipe[0];
+    for (it = released.begin(); it != released.end();) {
+        (*it)->decRef();
+        it = released.erase(it);
+    }
+}
 
-        pthread_mutex_lock(&mClientsLock);
-        for (it = mClients->begin(); it != mClients->end(); ++it) {
-            // NB: calling out to an other object with mClientsLock held (safe)
-            int fd = (*it)->getSocket();
-            FD_SET(fd, &read_fds);
-            if (fd > max) {
-                max = fd;
-            }
+void SocketListener::dispatch(SocketClient *c, uint64_t readyNs) {
+    c->noteDispatch(nowNs() - readyNs);
+    /* Process it, if false is returned, remove from list */
+    if (!onDataAvailable(c) && release(c, mDispatchThreads != 0)) {
+        return;
+    }
+    if (mDispatchThreads) {
+        struct epoll_event ev;
+        memset(&ev, 0, sizeof(ev));
+        ev.events = EPOLLIN | EPOLLONESHOT;
+        ev.data.ptr = c;
+        // ENOENT if another thread released it meanwhile.
+        if (epoll_ctl(mEpollFd, EPOLL_CTL_MOD, c->getSocket(), &ev) && errno != ENOENT) {
+            SLOGE("epoll_ctl failed (%s)", strerror(errno));
         }
-        pthread_mutex_unlock(&mClientsLock);
-        SLOGV("mListen=%d, max=%d, mSocketName=%s", mListen, max, mSocketName);
-        if ((rc = select(max + 1, &read_fds, NULL, NULL, NULL)) < 0) {
+    }
+}
+
+void SocketListener::runListener() {
+    struct epoll_event events[MaxEvents];
+    bool shutdown = false;
+
+    while (!shutdown) {
+        SLOGV("mListen=%d, mSocketName=%s", mListen, mSocketName);
+        int rc = epoll_wait(mEpollFd, events, MaxEvents, -1);
+        if (rc < 0) {
             if (errno == EINTR)
                 continue;
-            SLOGE("select failed (%s) mListen=%d, max=%d", strerror(errno), mListen, max);
+            SLOGE("epoll_wait failed (%s) mListen=%d", strerror(errno), mListen);
             sleep(1);
             continue;
-        } else if (!rc)
-            continue;
-
-        if (FD_ISSET(mCtrlPipe[0], &read_fds)) {
-            char c = CtrlPipe_Shutdown;
-            TEMP_FAILURE_RETRY(read(mCtrlPipe[0], &c, 1));
-            if (c == CtrlPipe_Shutdown) {
-                break;
-            }
-            continue;
-        }
-        if (mListen && FD_ISSET(mSock, &read_fds)) {
-            int c = TEMP_FAILURE_RETRY(accept4(mSock, nullptr, nullptr, SOCK_CLOEXEC));
-            if (c < 0) {
-                SLOGE("accept failed (%s)", strerror(errno));
-                sleep(1);
-                continue;
-            }
-            pthread_mutex_lock(&mClientsLock);
-            mClients->push_back(new SocketClient(c, true, mUseCmdNum));
-            pthread_mutex_unlock(&mClientsLock);
         }
 
-        /* Add all active clients to the pending list first */
-        pendingList.clear();
-        pthread_mutex_lock(&mClientsLock);
-        for (it = mClients->begin(); it != mClients->end(); ++it) {
-            SocketClient* c = *it;
-            // NB: calling out to an other object with mClientsLock held (safe)
-            int fd = c->getSocket();
-            if (FD_ISSET(fd, &read_fds)) {
-                pendingList.push_back(c);
+        uint64_t readyNs = nowNs();
+        for (int i = 0; i < rc; i++) {
+            void *ptr = events[i].data.ptr;
+            if (ptr == &mCtrlPipe[0]) {
+                char c = CtrlPipe_Shutdown;
+                TEMP_FAILURE_RETRY(read(mCtrlPipe[0], &c, 1));
+                if (c == CtrlPipe_Shutdown) {
+                    shutdown = true;
+                    break;
+                }
+            } else if (ptr == &mSock) {
+                int c = TEMP_FAILURE_RETRY(accept4(mSock, nullptr, nullptr, SOCK_CLOEXEC));
+                if (c < 0) {
+                    SLOGE("accept failed (%s)", strerror(errno));
+                    sleep(1);
+                    continue;
+                }
+                pthread_mutex_lock(&mClientsLock);
+                registerClient(new SocketClient(c, true, mUseCmdNum));
+                pthread_mutex_unlock(&mClientsLock);
+            } else {
+                SocketClient *c = reinterpret_cast<SocketClient *>(ptr);
                 c->incRef();
+                if (!mDispatchThreads) {
+                    dispatch(c, readyNs);
+                    c->decRef();
+                    continue;
+                }
+                PendingClient pending = { c, readyNs };
+                pthread_mutex_lock(&mPendingLock);
+                mPending->push_back(pending);
+                pthread_cond_signal(&mPendingCond);
+                pthread_mutex_unlock(&mPendingLock);
             }
         }
-        pthread_mutex_unlock(&mClientsLock);
 
-        /* Process the pending list, since it is owned by the thread,
-         * there is no need to lock it */
-        while (!pendingList.empty()) {
-            /* Pop the first item from the list */
-            it = pendingList.begin();
-            SocketClient* c = *it;
-            pendingList.erase(it);
-            /* Process it, if false is returned, remove from list */
-            if (!onDataAvailable(c)) {
-                release(c, false);
-            }
-            c->decRef();
+        // Nothing names the clients released so far any more.
+        releasePending();
+    }
+}
+
+void SocketListener::runWorker() {
+    while (1) {
+        pthread_mutex_lock(&mPendingLock);
+        while (mPending->empty() && !mStopping) {
+            pthread_cond_wait(&mPendingCond, &mPendingLock);
         }
+        if (mPending->empty()) {
+            pthread_mutex_unlock(&mPendingLock);
+            break;
+        }
+        PendingClientCollection::iterator it = mPending->begin();
+        PendingClient pending = *it;
+        mPending->erase(it);
+        pthread_mutex_unlock(&mPendingLock);
+
+        dispatch(pending.client, pending.readyNs);
+        pending.client->decRef();
     }
 }
 
@@ -257,13 +402,18 @@ bool SocketListener::release(SocketClient* c, bool wakeup) {
                 break;
             }
         }
-        pthread_mutex_unlock(&mClientsLock);
         if (ret) {
-            ret = c->decRef();
-            if (wakeup) {
-                char b = CtrlPipe_Wakeup;
-                TEMP_FAILURE_RETRY(write(mCtrlPipe[1], &b, 1));
+            // The listener thread drops our reference once it is done with
+            // the events it already has, which may include this client's.
+            if (mEpollFd != -1) {
+                epoll_ctl(mEpollFd, EPOLL_CTL_DEL, c->getSocket(), NULL);
             }
+            mReleased->push_back(c);
+        }
+        pthread_mutex_unlock(&mClientsLock);
+        if (ret && wakeup && mCtrlPipe[1] != -1) {
+            char b = CtrlPipe_Wakeup;
+            TEMP_FAILURE_RETRY(write(mCtrlPipe[1], &b, 1));
         }
     }
     return ret;
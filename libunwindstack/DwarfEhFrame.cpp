@@ -16,11 +16,14 @@
 
 #include <stdint.h>
 
+#include <algorithm>
+
 #include <unwindstack/DwarfStructs.h>
 #include <unwindstack/Memory.h>
 
 #include "Check.h"
 #include "DwarfEhFrame.h"
+#include "DwarfEncoding.h"
 #include "DwarfError.h"
 
 namespace unwindstack {
@@ -69,6 +72,14 @@ bool DwarfEhFrame<AddressType>::Init(uint64_t offset, uint64_t size) {
   entries_data_offset_ = offset;
   cur_entries_offset_ = entries_offset_;
 
+  // Without a search table the eh_frame has to be scanned to find the fdes.
+  scan_eh_frame_ = fde_count_encoding == DW_EH_PE_omit || table_encoding_ == DW_EH_PE_omit;
+  if (scan_eh_frame_) {
+    fde_count_ = 0;
+  }
+  fde_ranges_created_ = false;
+  fde_ranges_.clear();
+
   return true;
 }
 
@@ -195,8 +206,123 @@ bool DwarfEhFrame<AddressType>::GetFdeOffsetSequential(uint64_t pc, uint64_t* fd
   return false;
 }
 
+template <typename AddressType>
+bool DwarfEhFrame<AddressType>::CreateSortedFdeRanges() {
+  memory_.clear_func_offset();
+  memory_.clear_text_offset();
+  memory_.set_data_offset(entries_data_offset_);
+
+  // Read just enough of every fde to know the pc range it covers. The
+  // eh_frame has no size of its own, it ends with a zero length entry.
+  uint64_t cur_offset = ptr_offset_;
+  while (true) {
+    memory_.set_cur_offset(cur_offset);
+    uint32_t value32;
+    if (!memory_.ReadBytes(&value32, sizeof(value32))) {
+      last_error_ = DWARF_ERROR_MEMORY_INVALID;
+      break;
+    }
+    if (value32 == 0) {
+      // Terminator.
+      break;
+    }
+
+    uint64_t next_offset;
+    uint64_t cie_offset;
+    if (value32 == static_cast<uint32_t>(-1)) {
+      uint64_t length64;
+      uint64_t value64;
+      if (!memory_.ReadBytes(&length64, sizeof(length64)) ||
+          !memory_.ReadBytes(&value64, sizeof(value64))) {
+        last_error_ = DWARF_ERROR_MEMORY_INVALID;
+        break;
+      }
+      next_offset = cur_offset + 12 + length64;
+      if (IsCie64(value64)) {
+        cur_offset = next_offset;
+        continue;
+      }
+      cie_offset = GetCieOffsetFromFde64(value64);
+    } else {
+      uint32_t id32;
+      if (!memory_.ReadBytes(&id32, sizeof(id32))) {
+        last_error_ = DWARF_ERROR_MEMORY_INVALID;
+        break;
+      }
+      next_offset = cur_offset + 4 + value32;
+      if (IsCie32(id32)) {
+        cur_offset = next_offset;
+        continue;
+      }
+      cie_offset = GetCieOffsetFromFde32(id32);
+    }
+    if (next_offset <= cur_offset) {
+      last_error_ = DWARF_ERROR_ILLEGAL_VALUE;
+      break;
+    }
+    uint64_t pc_offset = memory_.cur_offset();
+
+    // The cie is cached, so this only costs a parse once per cie.
+    const DwarfCie* cie = this->GetCie(cie_offset);
+    if (cie == nullptr) {
+      break;
+    }
+    memory_.set_cur_offset(pc_offset + cie->segment_size);
+
+    // Decode the pcs the same way as FillInFde.
+    uint64_t pc_start;
+    uint64_t pc_length;
+    if (!memory_.template ReadEncodedValue<AddressType>(cie->fde_address_encoding & 0xf,
+                                                        &pc_start)) {
+      last_error_ = DWARF_ERROR_MEMORY_INVALID;
+      break;
+    }
+    pc_start = AdjustPcFromFde(pc_start);
+    if (!memory_.template ReadEncodedValue<AddressType>(cie->fde_address_encoding & 0xf,
+                                                        &pc_length)) {
+      last_error_ = DWARF_ERROR_MEMORY_INVALID;
+      break;
+    }
+    if (pc_length != 0) {
+      fde_ranges_.push_back(FdeRange{static_cast<AddressType>(pc_start),
+                                     static_cast<AddressType>(pc_start + pc_length), cur_offset});
+    }
+    cur_offset = next_offset;
+  }
+
+  std::sort(fde_ranges_.begin(), fde_ranges_.end(),
+            [](const FdeRange& a, const FdeRange& b) { return a.pc_start < b.pc_start; });
+  fde_ranges_.shrink_to_fit();
+  return !fde_ranges_.empty();
+}
+
+template <typename AddressType>
+bool DwarfEhFrame<AddressType>::GetFdeOffsetFromRanges(uint64_t pc, uint64_t* fde_offset) {
+  if (!fde_ranges_created_) {
+    // Whatever was found before an error is still usable.
+    fde_ranges_created_ = true;
+    CreateSortedFdeRanges();
+  }
+
+  auto entry = std::upper_bound(
+      fde_ranges_.begin(), fde_ranges_.end(), pc,
+      [](uint64_t pc, const FdeRange& range) { return pc < range.pc_start; });
+  if (entry == fde_ranges_.begin()) {
+    return false;
+  }
+  --entry;
+  if (pc >= entry->pc_end) {
+    return false;
+  }
+  *fde_offset = entry->offset;
+  return true;
+}
+
 template <typename AddressType>
 bool DwarfEhFrame<AddressType>::GetFdeOffsetFromPc(uint64_t pc, uint64_t* fde_offset) {
+  if (scan_eh_frame_) {
+    return GetFdeOffsetFromRanges(pc, fde_offset);
+  }
   if (fde_count_ == 0) {
     return false;
   }
@@ -19,6 +19,8 @@
 
 #include <stdint.h>
 
+#include <vector>
+
 #include <unwindstack/DwarfSection.h>
 
 namespace unwindstack {
@@ -40,6 +42,14 @@ class DwarfEhFrame : public DwarfSectionImpl<AddressType> {
     uint64_t offset;
   };
 
+  // Entry of the index built by scanning the eh_frame itself, used when
+  // the eh_frame_hdr has no search table.
+  struct FdeRange {
+    AddressType pc_start;
+    AddressType pc_end;
+    uint64_t offset;
+  };
+
   DwarfEhFrame(Memory* memory) : DwarfSectionImpl<AddressType>(memory) {}
   virtual ~DwarfEhFrame() = default;
 
@@ -72,6 +82,10 @@ class DwarfEhFrame : public DwarfSectionImpl<AddressType> {
 
   bool GetFdeOffsetBinary(uint64_t pc, uint64_t* fde_offset, uint64_t total_entries);
 
+  bool GetFdeOffsetFromRanges(uint64_t pc, uint64_t* fde_offset);
+
+  bool CreateSortedFdeRanges();
+
  protected:
   uint8_t version_;
   uint8_t ptr_encoding_;
@@ -86,6 +100,12 @@ class DwarfEhFrame : public DwarfSectionImpl<AddressType> {
   uint64_t cur_entries_offset_ = 0;
 
   std::unordered_map<uint64_t, FdeInfo> fde_info_;
+
+  // Set when the eh_frame_hdr omits the search table, fde_ranges_ is then
+  // filled on the first lookup.
+  bool scan_eh_frame_ = false;
+  bool fde_ranges_created_ = false;
+  std::vector<FdeRange> fde_ranges_;
 };
 
 }  // namespace unwindstack
@@ -55,6 +55,48 @@ bool DwarfOp<AddressType>::Eval(uint64_t start, uint64_t end, uint8_t dwarf_vers
   return true;
 }
 
+template <typename AddressType>
+bool DwarfOp<AddressType>::Compile(uint64_t start, uint64_t end, uint16_t* reg,
+                                   AddressType* offset, bool* deref) {
+  memory_->set_cur_offset(start);
+  uint8_t op;
+  if (!memory_->ReadBytes(&op, 1)) {
+    return false;
+  }
+  uint64_t reg_value;
+  if (op >= 0x70 && op <= 0x8f) {
+    // DW_OP_breg0 .. DW_OP_breg31
+    reg_value = op - 0x70;
+  } else if (op != 0x92 || !memory_->ReadULEB128(&reg_value)) {
+    // Not DW_OP_bregx.
+    return false;
+  }
+  int64_t breg_offset;
+  if (reg_value > UINT16_MAX || !memory_->ReadSLEB128(&breg_offset)) {
+    return false;
+  }
+  *reg = reg_value;
+  *offset = breg_offset;
+  *deref = false;
+
+  while (memory_->cur_offset() < end) {
+    if (*deref || !memory_->ReadBytes(&op, 1)) {
+      return false;
+    }
+    uint64_t value;
+    if (op == 0x23 && memory_->ReadULEB128(&value)) {
+      // DW_OP_plus_uconst
+      *offset += value;
+    } else if (op == 0x06) {
+      // DW_OP_deref
+      *deref = true;
+    } else {
+      return false;
+    }
+  }
+  return memory_->cur_offset() == end;
+}
+
 template <typename AddressType>
 bool DwarfOp<AddressType>::Decode(uint8_t dwarf_version) {
   last_error_ = DWARF_ERROR_NONE;
@@ -65,6 +65,13 @@ class DwarfOp {
 
   bool Eval(uint64_t start, uint64_t end, uint8_t dwarf_version);
 
+  // Recognizes the expressions that compilers and ART emit for most cfa and
+  // register rules: DW_OP_breg<n> or DW_OP_bregx, any number of
+  // DW_OP_plus_uconst, and an optional final DW_OP_deref. Those evaluate to
+  // the value of |reg| plus |offset|, read from memory if |deref| is set, so
+  // the caller can skip Eval for them. Returns false for anything else.
+  bool Compile(uint64_t start, uint64_t end, uint16_t* reg, AddressType* offset, bool* deref);
+
   void GetLogInfo(uint64_t start, uint64_t end, std::vector<std::string>* lines);
 
   AddressType StackAt(size_t index) { return stack_[index]; }
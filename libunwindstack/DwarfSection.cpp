@@ -16,6 +16,8 @@
 
 #include <stdint.h>
 
+#include <utility>
+
 #include <unwindstack/DwarfLocation.h>
 #include <unwindstack/DwarfMemory.h>
 #include <unwindstack/DwarfSection.h>
@@ -39,6 +41,9 @@ const DwarfFde* DwarfSection::GetFdeFromPc(uint64_t pc) {
     return nullptr;
   }
   const DwarfFde* fde = GetFdeFromOffset(fde_offset);
+  if (fde == nullptr) {
+    return nullptr;
+  }
   // Guaranteed pc >= pc_start, need to check pc in the fde range.
   if (pc < fde->pc_end) {
     return fde;
@@ -48,31 +53,68 @@ const DwarfFde* DwarfSection::GetFdeFromPc(uint64_t pc) {
 }
 
 bool DwarfSection::Step(uint64_t pc, Regs* regs, Memory* process_memory) {
+  std::lock_guard<std::mutex> guard(lock_);
   last_error_ = DWARF_ERROR_NONE;
-  const DwarfFde* fde = GetFdeFromPc(pc);
-  if (fde == nullptr || fde->cie == nullptr) {
-    last_error_ = DWARF_ERROR_ILLEGAL_STATE;
-    return false;
-  }
 
-  // Now get the location information for this pc.
-  dwarf_loc_regs_t loc_regs;
-  if (!GetCfaLocationInfo(pc, fde, &loc_regs)) {
-    return false;
+  auto entry = loc_regs_cache_.find(pc);
+  if (entry == loc_regs_cache_.end()) {
+    const DwarfFde* fde = GetFdeFromPc(pc);
+    if (fde == nullptr || fde->cie == nullptr) {
+      last_error_ = DWARF_ERROR_ILLEGAL_STATE;
+      return false;
+    }
+
+    // Now get the location information for this pc.
+    dwarf_loc_regs_t loc_regs;
+    if (!GetCfaLocationInfo(pc, fde, &loc_regs)) {
+      return false;
+    }
+
+    if (loc_regs_cache_.size() >= kMaxCachedLocRegs) {
+      loc_regs_cache_.clear();
+    }
+    entry = loc_regs_cache_.emplace(pc, CachedLocRegs{fde, std::move(loc_regs)}).first;
   }
 
   // Now eval the actual registers.
-  return Eval(fde->cie, process_memory, loc_regs, regs);
+  return Eval(entry->second.fde->cie, process_memory, entry->second.loc_regs, regs);
 }
 
 template <typename AddressType>
 bool DwarfSectionImpl<AddressType>::EvalExpression(const DwarfLocation& loc, uint8_t version,
-                                                   Memory* regular_memory, AddressType* value) {
+                                                   Memory* regular_memory,
+                                                   RegsImpl<AddressType>* regs,
+                                                   AddressType* value) {
   DwarfOp<AddressType> op(&memory_, regular_memory);
+  op.set_regs(regs);
 
-  // Need to evaluate the op data.
   uint64_t start = loc.values[1];
   uint64_t end = start + loc.values[0];
+  auto entry = compiled_expressions_.find(start);
+  if (entry == compiled_expressions_.end() || entry->second.size != loc.values[0]) {
+    if (compiled_expressions_.size() >= kMaxCachedLocRegs) {
+      compiled_expressions_.clear();
+    }
+    entry = compiled_expressions_.emplace(start, CompiledExpression()).first;
+    CompiledExpression* compiled = &entry->second;
+    compiled->size = loc.values[0];
+    compiled->valid = op.Compile(start, end, &compiled->reg, &compiled->offset, &compiled->deref);
+  }
+  const CompiledExpression& compiled = entry->second;
+  if (compiled.valid) {
+    if (compiled.reg >= regs->total_regs()) {
+      last_error_ = DWARF_ERROR_ILLEGAL_VALUE;
+      return false;
+    }
+    *value = (*regs)[compiled.reg] + compiled.offset;
+    if (compiled.deref && !regular_memory->Read(*value, value, sizeof(AddressType))) {
+      last_error_ = DWARF_ERROR_MEMORY_INVALID;
+      return false;
+    }
+    return true;
+  }
+
+  // Need to evaluate the op data.
   if (!op.Eval(start, end, version)) {
     last_error_ = op.last_error();
     return false;
@@ -131,7 +173,7 @@ bool DwarfSectionImpl<AddressType>::Eval(const DwarfCie* cie, Memory* regular_me
     case DWARF_LOCATION_EXPRESSION:
     case DWARF_LOCATION_VAL_EXPRESSION: {
       AddressType value;
-      if (!EvalExpression(*loc, cie->version, regular_memory, &value)) {
+      if (!EvalExpression(*loc, cie->version, regular_memory, cur_regs, &value)) {
         return false;
       }
       if (loc->type == DWARF_LOCATION_EXPRESSION) {
@@ -199,7 +241,7 @@ bool DwarfSectionImpl<AddressType>::Eval(const DwarfCie* cie, Memory* regular_me
       case DWARF_LOCATION_EXPRESSION:
       case DWARF_LOCATION_VAL_EXPRESSION: {
         AddressType value;
-        if (!EvalExpression(*loc, cie->version, regular_memory, &value)) {
+        if (!EvalExpression(*loc, cie->version, regular_memory, cur_regs, &value)) {
           return false;
         }
         if (loc->type == DWARF_LOCATION_EXPRESSION) {
@@ -18,7 +18,10 @@
 #include <string.h>
 
 #include <memory>
+#include <mutex>
 #include <string>
+#include <unordered_map>
+#include <utility>
 
 #define LOG_TAG "unwind"
 #include <log/log.h>
@@ -57,7 +60,7 @@ bool Elf::Init() {
 // It is expensive to initialize the .gnu_debugdata section. Provide a method
 // to initialize this data separately.
 void Elf::InitGnuDebugdata() {
-  if (!valid_ || interface_->gnu_debugdata_offset() == 0) {
+  if (!valid_ || interface_->gnu_debugdata_offset() == 0 || gnu_debugdata_interface_) {
     return;
   }
 
@@ -171,4 +174,38 @@ ElfInterface* Elf::CreateInterfaceFromMemory(Memory* memory) {
   return interface.release();
 }
 
+bool Elf::cache_enabled_ = false;
+std::mutex Elf::cache_lock_;
+std::unordered_map<std::string, std::pair<std::shared_ptr<Elf>, uint64_t>>* Elf::cache_ = nullptr;
+
+void Elf::SetCachingEnabled(bool enable) {
+  std::lock_guard<std::mutex> guard(cache_lock_);
+  if (enable && cache_ == nullptr) {
+    cache_ = new std::unordered_map<std::string, std::pair<std::shared_ptr<Elf>, uint64_t>>;
+  } else if (!enable && cache_ != nullptr) {
+    delete cache_;
+    cache_ = nullptr;
+  }
+  cache_enabled_ = enable;
+}
+
+bool Elf::CacheGet(const std::string& key, std::shared_ptr<Elf>* elf, uint64_t* elf_offset) {
+  if (cache_ == nullptr) {
+    return false;
+  }
+  auto entry = cache_->find(key);
+  if (entry == cache_->end()) {
+    return false;
+  }
+  *elf = entry->second.first;
+  *elf_offset = entry->second.second;
+  return true;
+}
+
+void Elf::CacheAdd(const std::string& key, const std::shared_ptr<Elf>& elf, uint64_t elf_offset) {
+  if (cache_ != nullptr) {
+    (*cache_)[key] = std::make_pair(elf, elf_offset);
+  }
+}
+
 }  // namespace unwindstack
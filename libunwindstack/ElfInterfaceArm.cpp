@@ -17,6 +17,8 @@
 #include <elf.h>
 #include <stdint.h>
 
+#include <mutex>
+
 #include <unwindstack/Memory.h>
 #include <unwindstack/Regs.h>
 
@@ -108,6 +110,7 @@ bool ElfInterfaceArm::Step(uint64_t pc, Regs* regs, Memory* process_memory) {
 }
 
 bool ElfInterfaceArm::StepExidx(uint64_t pc, Regs* regs, Memory* process_memory) {
+  std::lock_guard<std::mutex> guard(lock_);
   RegsArm* regs_arm = reinterpret_cast<RegsArm*>(regs);
   uint64_t entry_offset;
   if (!FindEntry(pc, &entry_offset)) {
@@ -115,7 +118,22 @@ bool ElfInterfaceArm::StepExidx(uint64_t pc, Regs* regs, Memory* process_memory)
   }
   ArmExidx arm(regs_arm, memory_, process_memory);
   arm.set_cfa(regs_arm->sp());
-  if (arm.ExtractEntryData(entry_offset) && arm.Eval()) {
+
+  // Only the register values differ between steps through the same entry,
+  // so the decoded instructions are kept.
+  auto entry = entry_data_.find(entry_offset);
+  if (entry != entry_data_.end()) {
+    *arm.data() = entry->second;
+  } else {
+    if (!arm.ExtractEntryData(entry_offset)) {
+      return false;
+    }
+    if (entry_data_.size() >= kMaxCachedEntries) {
+      entry_data_.clear();
+    }
+    entry_data_[entry_offset] = *arm.data();
+  }
+  if (arm.Eval()) {
     // If the pc was not set, then use the LR registers for the PC.
     if (!arm.pc_set()) {
       regs_arm->set_pc((*regs_arm)[ARM_REG_LR]);
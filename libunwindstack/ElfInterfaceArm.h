@@ -20,7 +20,9 @@
 #include <elf.h>
 #include <stdint.h>
 
+#include <deque>
 #include <iterator>
+#include <mutex>
 #include <unordered_map>
 
 #include <unwindstack/ElfInterface.h>
@@ -82,11 +84,19 @@ class ElfInterfaceArm : public ElfInterface32 {
 
   void set_total_entries(size_t total_entries) { total_entries_ = total_entries; }
 
+  // Upper bound on the number of entries in entry_data_.
+  static constexpr size_t kMaxCachedEntries = 4096;
+
  private:
   uint64_t start_offset_ = 0;
   size_t total_entries_ = 0;
 
   std::unordered_map<size_t, uint32_t> addrs_;
+
+  // Serializes StepExidx calls from threads unwinding through this elf.
+  std::mutex lock_;
+  // The extracted unwind instructions of each entry already used.
+  std::unordered_map<uint64_t, std::deque<uint8_t>> entry_data_;
 };
 
 }  // namespace unwindstack
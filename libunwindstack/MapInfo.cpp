@@ -18,6 +18,7 @@
 #include <unistd.h>
 
 #include <memory>
+#include <mutex>
 #include <string>
 
 #include <unwindstack/Elf.h>
@@ -27,6 +28,31 @@
 
 namespace unwindstack {
 
+Memory* MapInfo::CreateFileMemory() {
+  std::unique_ptr<MemoryFileAtOffset> file_memory(new MemoryFileAtOffset);
+  uint64_t map_size;
+  if (offset != 0) {
+    // Only map in a piece of the file.
+    map_size = end - start;
+  } else {
+    map_size = UINT64_MAX;
+  }
+  if (!file_memory->Init(name, offset, map_size)) {
+    return nullptr;
+  }
+  // It's possible that a non-zero offset might not be pointing to
+  // valid elf data. Check if this is a valid elf, and if not assume
+  // that this was meant to incorporate the entire file.
+  if (offset != 0 && !Elf::IsValidElf(file_memory.get())) {
+    // Don't bother checking the validity that will happen on the elf init.
+    if (!file_memory->Init(name, 0)) {
+      return nullptr;
+    }
+    elf_offset = offset;
+  }
+  return file_memory.release();
+}
+
 Memory* MapInfo::CreateMemory(pid_t pid) {
   if (end <= start) {
     return nullptr;
@@ -41,46 +67,25 @@ Memory* MapInfo::CreateMemory(pid_t pid) {
       return nullptr;
     }
 
-    std::unique_ptr<MemoryFileAtOffset> file_memory(new MemoryFileAtOffset);
-    uint64_t map_size;
-    if (offset != 0) {
-      // Only map in a piece of the file.
-      map_size = end - start;
-    } else {
-      map_size = UINT64_MAX;
-    }
-    if (file_memory->Init(name, offset, map_size)) {
-      // It's possible that a non-zero offset might not be pointing to
-      // valid elf data. Check if this is a valid elf, and if not assume
-      // that this was meant to incorporate the entire file.
-      if (offset != 0 && !Elf::IsValidElf(file_memory.get())) {
-        // Don't bother checking the validity that will happen on the elf init.
-        if (file_memory->Init(name, 0)) {
-          elf_offset = offset;
-          return file_memory.release();
-        }
-        // Fall through if the init fails.
-      } else {
-        return file_memory.release();
-      }
+    Memory* file_memory = CreateFileMemory();
+    if (file_memory != nullptr) {
+      return file_memory;
     }
+    // Fall through if the init fails.
+    elf_offset = 0;
   }
 
   Memory* memory = nullptr;
   if (pid == getpid()) {
     memory = new MemoryLocal();
   } else {
-    memory = new MemoryRemote(pid);
+    memory = new MemoryCache(new MemoryRemote(pid));
   }
   return new MemoryRange(memory, start, end);
 }
 
-Elf* MapInfo::GetElf(pid_t pid, bool init_gnu_debugdata) {
-  if (elf) {
-    return elf;
-  }
-
-  elf = new Elf(CreateMemory(pid));
+static std::shared_ptr<Elf> CreateElf(Memory* memory, bool init_gnu_debugdata) {
+  std::shared_ptr<Elf> elf(new Elf(memory));
   if (elf->Init() && init_gnu_debugdata) {
     elf->InitGnuDebugdata();
   }
@@ -89,4 +94,37 @@ Elf* MapInfo::GetElf(pid_t pid, bool init_gnu_debugdata) {
   return elf;
 }
 
+Elf* MapInfo::GetElf(pid_t pid, bool init_gnu_debugdata) {
+  if (elf) {
+    return elf.get();
+  }
+
+  // Only the elf of a mapped file can be shared, anything read out of
+  // process memory is specific to that process.
+  if (!Elf::CachingEnabled() || inode == 0 || end <= start || name.empty() ||
+      (flags & MAPS_FLAGS_DEVICE_MAP)) {
+    elf = CreateElf(CreateMemory(pid), init_gnu_debugdata);
+    return elf.get();
+  }
+
+  std::string key = name + ':' + std::to_string(offset) + ':' + std::to_string(inode);
+  std::lock_guard<std::mutex> guard(Elf::CacheLock());
+  if (Elf::CacheGet(key, &elf, &elf_offset)) {
+    if (init_gnu_debugdata) {
+      elf->InitGnuDebugdata();
+    }
+    return elf.get();
+  }
+
+  elf_offset = 0;
+  Memory* memory = CreateFileMemory();
+  if (memory == nullptr) {
+    elf = CreateElf(CreateMemory(pid), init_gnu_debugdata);
+    return elf.get();
+  }
+  elf = CreateElf(memory, init_gnu_debugdata);
+  Elf::CacheAdd(key, elf, elf_offset);
+  return elf.get();
+}
+
 }  // namespace unwindstack
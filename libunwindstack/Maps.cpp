@@ -27,6 +27,7 @@
 
 #include <memory>
 #include <string>
+#include <utility>
 #include <vector>
 
 #include <unwindstack/Elf.h>
@@ -39,12 +40,19 @@ MapInfo* Maps::Find(uint64_t pc) {
   if (maps_.empty()) {
     return nullptr;
   }
+  if (last_found_ < maps_.size()) {
+    MapInfo* cur = &maps_[last_found_];
+    if (pc >= cur->start && pc < cur->end) {
+      return cur;
+    }
+  }
   size_t first = 0;
   size_t last = maps_.size();
   while (first < last) {
     size_t index = (first + last) / 2;
     MapInfo* cur = &maps_[index];
     if (pc >= cur->start && pc < cur->end) {
+      last_found_ = index;
       return cur;
     } else if (pc < cur->start) {
       last = index;
@@ -60,8 +68,9 @@ bool Maps::ParseLine(const char* line, MapInfo* map_info) {
   int name_pos;
   // Linux /proc/<pid>/maps lines:
   // 6f000000-6f01e000 rwxp 00000000 00:0c 16389419   /system/lib/libcomposer.so
-  if (sscanf(line, "%" SCNx64 "-%" SCNx64 " %4s %" SCNx64 " %*x:%*x %*d %n", &map_info->start,
-             &map_info->end, permissions, &map_info->offset, &name_pos) != 4) {
+  if (sscanf(line, "%" SCNx64 "-%" SCNx64 " %4s %" SCNx64 " %*x:%*x %" SCNu64 " %n",
+             &map_info->start, &map_info->end, permissions, &map_info->offset, &map_info->inode,
+             &name_pos) != 5) {
     return false;
   }
   map_info->flags = PROT_NONE;
@@ -114,11 +123,33 @@ bool Maps::Parse() {
   return valid;
 }
 
-Maps::~Maps() {
+bool Maps::Update() {
+  std::vector<MapInfo> old_maps;
+  old_maps.swap(maps_);
+  if (!Parse()) {
+    maps_.swap(old_maps);
+    return false;
+  }
+  last_found_ = 0;
+
+  // Both lists are sorted by start address, so walk them together and
+  // hand over the elf of each map that is still there unchanged.
+  auto old_map = old_maps.begin();
   for (auto& map : maps_) {
-    delete map.elf;
-    map.elf = nullptr;
+    while (old_map != old_maps.end() && old_map->start < map.start) {
+      ++old_map;
+    }
+    if (old_map == old_maps.end()) {
+      break;
+    }
+    if (old_map->start == map.start && old_map->end == map.end &&
+        old_map->offset == map.offset && old_map->flags == map.flags &&
+        old_map->inode == map.inode && old_map->name == map.name) {
+      map.elf = std::move(old_map->elf);
+      map.elf_offset = old_map->elf_offset;
+    }
   }
+  return true;
 }
 
 bool BufferMaps::Parse() {
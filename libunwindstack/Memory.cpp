@@ -131,6 +131,21 @@ bool MemoryFileAtOffset::Read(uint64_t addr, void* dst, size_t size) {
   return true;
 }
 
+bool MemoryOfflineBuffer::Read(uint64_t addr, void* dst, size_t size) {
+  uint64_t max_read;
+  if (addr < start_ || __builtin_add_overflow(addr, size, &max_read) || max_read > end_) {
+    return false;
+  }
+  memcpy(dst, &data_[addr - start_], size);
+  return true;
+}
+
+void MemoryOfflineBuffer::Reset(const uint8_t* data, uint64_t start, uint64_t end) {
+  data_ = data;
+  start_ = start;
+  end_ = end;
+}
+
 bool MemoryRemote::PtraceRead(uint64_t addr, long* value) {
 #if !defined(__LP64__)
   // Cannot read an address greater than 32 bits.
@@ -148,6 +163,25 @@ bool MemoryRemote::PtraceRead(uint64_t addr, long* value) {
   return true;
 }
 
+bool MemoryRemote::VmRead(uint64_t addr, void* dst, size_t size) {
+#if !defined(__LP64__)
+  // Cannot read an address greater than 32 bits.
+  if (addr > UINT32_MAX) {
+    return false;
+  }
+#endif
+  struct iovec local_io;
+  local_io.iov_base = dst;
+  local_io.iov_len = size;
+
+  struct iovec remote_io;
+  remote_io.iov_base = reinterpret_cast<void*>(static_cast<uintptr_t>(addr));
+  remote_io.iov_len = size;
+
+  ssize_t bytes_read = process_vm_readv(pid_, &local_io, 1, &remote_io, 1, 0);
+  return bytes_read != -1 && static_cast<size_t>(bytes_read) == size;
+}
+
 bool MemoryRemote::Read(uint64_t addr, void* dst, size_t bytes) {
   // Make sure that there is no overflow.
   uint64_t max_size;
@@ -155,6 +189,12 @@ bool MemoryRemote::Read(uint64_t addr, void* dst, size_t bytes) {
     return false;
   }
 
+  // One process_vm_readv call instead of a ptrace call per word. It can fail
+  // where ptrace does not (e.g. it is not permitted), so fall back then.
+  if (VmRead(addr, dst, bytes)) {
+    return true;
+  }
+
   size_t bytes_read = 0;
   long data;
   size_t align_bytes = addr & (sizeof(long) - 1);
@@ -249,6 +289,43 @@ bool MemoryOffline::Read(uint64_t addr, void* dst, size_t size) {
   return true;
 }
 
+bool MemoryCache::Read(uint64_t addr, void* dst, size_t size) {
+  if (size > kMaxCachedRead) {
+    return impl_->Read(addr, dst, size);
+  }
+  uint64_t max_size;
+  if (__builtin_add_overflow(addr, size, &max_size)) {
+    return false;
+  }
+
+  uint8_t* buffer = reinterpret_cast<uint8_t*>(dst);
+  while (size != 0) {
+    uint64_t page = addr >> kCacheBits;
+    size_t page_offset = addr & kCacheMask;
+    size_t bytes = std::min(size, kCacheSize - page_offset);
+
+    auto entry = cache_.find(page);
+    if (entry != cache_.end()) {
+      memcpy(buffer, &entry->second[page_offset], bytes);
+    } else {
+      uint8_t* data = cache_[page];
+      if (impl_->Read(page << kCacheBits, data, kCacheSize)) {
+        memcpy(buffer, &data[page_offset], bytes);
+      } else {
+        // Only part of the page is readable, read just what was asked for.
+        cache_.erase(page);
+        if (!impl_->Read(addr, buffer, bytes)) {
+          return false;
+        }
+      }
+    }
+    addr += bytes;
+    buffer += bytes;
+    size -= bytes;
+  }
+  return true;
+}
+
 MemoryRange::MemoryRange(Memory* memory, uint64_t begin, uint64_t end)
     : memory_(memory), begin_(begin), length_(end - begin) {
   CHECK(end > begin);
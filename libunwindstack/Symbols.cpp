@@ -16,8 +16,12 @@
 
 #include <elf.h>
 #include <stdint.h>
+#include <string.h>
 
+#include <algorithm>
+#include <mutex>
 #include <string>
+#include <vector>
 
 #include <unwindstack/Memory.h>
 
@@ -28,84 +32,99 @@ namespace unwindstack {
 
 Symbols::Symbols(uint64_t offset, uint64_t size, uint64_t entry_size, uint64_t str_offset,
                  uint64_t str_size)
-    : cur_offset_(offset),
-      offset_(offset),
+    : offset_(offset),
       end_(offset + size),
       entry_size_(entry_size),
       str_offset_(str_offset),
       str_end_(str_offset_ + str_size) {}
 
 const Symbols::Info* Symbols::GetInfoFromCache(uint64_t addr) {
-  // Binary search the table.
-  size_t first = 0;
-  size_t last = symbols_.size();
-  while (first < last) {
-    size_t current = first + (last - first) / 2;
-    const Info* info = &symbols_[current];
-    if (addr < info->start_offset) {
-      last = current;
-    } else if (addr < info->end_offset) {
-      return info;
-    } else {
-      first = current + 1;
-    }
+  // Find the last symbol starting at or before addr.
+  auto entry = std::upper_bound(symbols_.begin(), symbols_.end(), addr,
+                                [](uint64_t addr, const Info& info) {
+                                  return addr < info.start_offset;
+                                });
+  if (entry == symbols_.begin()) {
+    return nullptr;
+  }
+  --entry;
+  if (addr - entry->start_offset >= entry->size) {
+    return nullptr;
   }
-  return nullptr;
+  return &*entry;
 }
 
 template <typename SymType>
-bool Symbols::GetName(uint64_t addr, uint64_t load_bias, Memory* elf_memory, std::string* name,
-                      uint64_t* func_offset) {
-  addr += load_bias;
-
-  if (symbols_.size() != 0) {
-    const Info* info = GetInfoFromCache(addr);
-    if (info) {
-      CHECK(addr >= info->start_offset && addr <= info->end_offset);
-      *func_offset = addr - info->start_offset;
-      return elf_memory->ReadString(info->str_offset, name, str_end_ - info->str_offset);
-    }
+void Symbols::BuildCache(uint64_t load_bias, Memory* elf_memory) {
+  // Read the table a batch of entries at a time rather than one read per
+  // entry, this matters when the elf is read out of a remote process.
+  constexpr size_t kReadEntries = 256;
+  if (entry_size_ == 0) {
+    return;
   }
-
-  bool symbol_added = false;
-  bool return_value = false;
-  while (cur_offset_ + entry_size_ <= end_) {
-    SymType entry;
-    if (!elf_memory->Read(cur_offset_, &entry, sizeof(entry))) {
-      // Stop all processing, something looks like it is corrupted.
-      cur_offset_ = UINT64_MAX;
-      return false;
-    }
-    cur_offset_ += entry_size_;
-
-    if (entry.st_shndx != SHN_UNDEF && ELF32_ST_TYPE(entry.st_info) == STT_FUNC) {
+  size_t entry_size = static_cast<size_t>(entry_size_);
+  std::vector<uint8_t> buffer((kReadEntries - 1) * entry_size + sizeof(SymType));
+  uint64_t cur_offset = offset_;
+  bool read_failed = false;
+  while (!read_failed && cur_offset + entry_size_ <= end_) {
+    size_t entries = std::min<uint64_t>(kReadEntries, (end_ - cur_offset) / entry_size_);
+    // Only the symbol itself is needed out of the last entry.
+    bool batch_read =
+        elf_memory->Read(cur_offset, buffer.data(), (entries - 1) * entry_size + sizeof(SymType));
+
+    for (size_t i = 0; i < entries; i++) {
+      SymType entry;
+      if (batch_read) {
+        memcpy(&entry, &buffer[i * entry_size], sizeof(entry));
+      } else if (!elf_memory->Read(cur_offset + i * entry_size_, &entry, sizeof(entry))) {
+        // Stop all processing, something looks like it is corrupted.
+        read_failed = true;
+        break;
+      }
+      if (entry.st_shndx == SHN_UNDEF || ELF32_ST_TYPE(entry.st_info) != STT_FUNC ||
+          entry.st_size == 0) {
+        continue;
+      }
+      // A name past the end of the string table can never be read.
+      if (str_offset_ + entry.st_name >= str_end_) {
+        continue;
+      }
       // Treat st_value as virtual address.
       uint64_t start_offset = entry.st_value;
       if (entry.st_shndx != SHN_ABS) {
         start_offset += load_bias;
       }
-      uint64_t end_offset = start_offset + entry.st_size;
+      symbols_.emplace_back(start_offset,
+                            static_cast<uint32_t>(std::min<uint64_t>(entry.st_size, UINT32_MAX)),
+                            entry.st_name);
+    }
+    cur_offset += entries * entry_size_;
+  }
 
-      // Cache the value.
-      symbols_.emplace_back(start_offset, end_offset, str_offset_ + entry.st_name);
-      symbol_added = true;
+  std::sort(symbols_.begin(), symbols_.end(),
+            [](const Info& a, const Info& b) { return a.start_offset < b.start_offset; });
+  symbols_.shrink_to_fit();
+}
 
-      if (addr >= start_offset && addr < end_offset) {
-        *func_offset = addr - start_offset;
-        uint64_t offset = str_offset_ + entry.st_name;
-        if (offset < str_end_) {
-          return_value = elf_memory->ReadString(offset, name, str_end_ - offset);
-        }
-        break;
-      }
-    }
+template <typename SymType>
+bool Symbols::GetName(uint64_t addr, uint64_t load_bias, Memory* elf_memory, std::string* name,
+                      uint64_t* func_offset) {
+  addr += load_bias;
+
+  std::lock_guard<std::mutex> guard(lock_);
+  if (!cache_built_) {
+    cache_built_ = true;
+    BuildCache<SymType>(load_bias, elf_memory);
   }
 
-  if (symbol_added) {
-    std::sort(symbols_.begin(), symbols_.end(),
-              [](const Info& a, const Info& b) { return a.start_offset < b.start_offset; });
+  const Info* info = GetInfoFromCache(addr);
+  if (info == nullptr) {
+    return false;
   }
-  return return_value;
+  CHECK(addr >= info->start_offset && addr - info->start_offset < info->size);
+  *func_offset = addr - info->start_offset;
+  uint64_t offset = str_offset_ + info->name_offset;
+  return elf_memory->ReadString(offset, name, str_end_ - offset);
 }
 
 // Instantiate all of the needed template functions.
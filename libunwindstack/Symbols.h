@@ -19,6 +19,7 @@
 
 #include <stdint.h>
 
+#include <mutex>
 #include <string>
 #include <vector>
 
@@ -28,12 +29,14 @@ namespace unwindstack {
 class Memory;
 
 class Symbols {
+  // One function symbol. The name is an offset into the string table, kept
+  // small so that the whole index of a large library stays compact.
   struct Info {
-    Info(uint64_t start_offset, uint64_t end_offset, uint64_t str_offset)
-        : start_offset(start_offset), end_offset(end_offset), str_offset(str_offset) {}
+    Info(uint64_t start_offset, uint32_t size, uint32_t name_offset)
+        : start_offset(start_offset), size(size), name_offset(name_offset) {}
     uint64_t start_offset;
-    uint64_t end_offset;
-    uint64_t str_offset;
+    uint32_t size;
+    uint32_t name_offset;
   };
 
  public:
@@ -48,18 +51,26 @@ class Symbols {
                uint64_t* func_offset);
 
   void ClearCache() {
+    std::lock_guard<std::mutex> guard(lock_);
     symbols_.clear();
-    cur_offset_ = offset_;
+    cache_built_ = false;
   }
 
  private:
-  uint64_t cur_offset_;
+  template <typename SymType>
+  void BuildCache(uint64_t load_bias, Memory* elf_memory);
+
   uint64_t offset_;
   uint64_t end_;
   uint64_t entry_size_;
   uint64_t str_offset_;
   uint64_t str_end_;
 
+  // Elf objects can be shared between threads, the index is built once
+  // under this lock.
+  std::mutex lock_;
+  bool cache_built_ = false;
+  // All function symbols, sorted by start_offset.
   std::vector<Info> symbols_;
 };
 
@@ -20,6 +20,7 @@
 #include <stdint.h>
 
 #include <iterator>
+#include <mutex>
 #include <unordered_map>
 
 #include <unwindstack/DwarfLocation.h>
@@ -32,6 +33,8 @@ namespace unwindstack {
 enum DwarfError : uint8_t;
 class Memory;
 class Regs;
+template <typename AddressType>
+class RegsImpl;
 
 class DwarfSection {
  public:
@@ -102,10 +105,25 @@ class DwarfSection {
 
   bool Step(uint64_t pc, Regs* regs, Memory* process_memory);
 
+  // Upper bound on the number of pcs in loc_regs_cache_.
+  static constexpr size_t kMaxCachedLocRegs = 4096;
+
  protected:
+  struct CachedLocRegs {
+    const DwarfFde* fde;
+    dwarf_loc_regs_t loc_regs;
+  };
+
   DwarfMemory memory_;
   DwarfError last_error_;
 
+  // Step can be called from several threads unwinding through the same elf,
+  // this serializes them since memory_ and the caches are shared state.
+  std::mutex lock_;
+  // The evaluated cfa instructions for each pc already stepped through, so
+  // a frame seen again is only evaluated.
+  std::unordered_map<uint64_t, CachedLocRegs> loc_regs_cache_;
+
   uint64_t fde_count_;
   std::unordered_map<uint64_t, DwarfFde> fde_entries_;
   std::unordered_map<uint64_t, DwarfCie> cie_entries_;
@@ -133,7 +151,18 @@ class DwarfSectionImpl : public DwarfSection {
 
  protected:
   bool EvalExpression(const DwarfLocation& loc, uint8_t version, Memory* regular_memory,
-                      AddressType* value);
+                      RegsImpl<AddressType>* regs, AddressType* value);
+
+  // The result of DwarfOp::Compile for an expression, keyed by its offset. An
+  // entry with valid false is an expression that has to run through DwarfOp.
+  struct CompiledExpression {
+    uint64_t size;
+    bool valid;
+    bool deref;
+    uint16_t reg;
+    AddressType offset;
+  };
+  std::unordered_map<uint64_t, CompiledExpression> compiled_expressions_;
 };
 
 }  // namespace unwindstack
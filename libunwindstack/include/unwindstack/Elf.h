@@ -20,7 +20,10 @@
 #include <stddef.h>
 
 #include <memory>
+#include <mutex>
 #include <string>
+#include <unordered_map>
+#include <utility>
 
 #include <unwindstack/ElfInterface.h>
 #include <unwindstack/Memory.h>
@@ -70,6 +73,18 @@ class Elf {
 
   static bool IsValidElf(Memory* memory);
 
+  // Process wide cache of the elf objects of file backed maps, keyed by
+  // path, offset and inode, so that unwinding many processes only reads and
+  // parses each shared library once. Disabling the cache empties it.
+  static void SetCachingEnabled(bool enable);
+  static bool CachingEnabled() { return cache_enabled_; }
+
+  // The cache lock must be held around CacheGet and CacheAdd.
+  static std::mutex& CacheLock() { return cache_lock_; }
+  static bool CacheGet(const std::string& key, std::shared_ptr<Elf>* elf, uint64_t* elf_offset);
+  static void CacheAdd(const std::string& key, const std::shared_ptr<Elf>& elf,
+                       uint64_t elf_offset);
+
  protected:
   bool valid_ = false;
   std::unique_ptr<ElfInterface> interface_;
@@ -79,6 +94,10 @@ class Elf {
 
   std::unique_ptr<Memory> gnu_debugdata_memory_;
   std::unique_ptr<ElfInterface> gnu_debugdata_interface_;
+
+  static bool cache_enabled_;
+  static std::mutex cache_lock_;
+  static std::unordered_map<std::string, std::pair<std::shared_ptr<Elf>, uint64_t>>* cache_;
 };
 
 }  // namespace unwindstack
@@ -19,6 +19,7 @@
 
 #include <stdint.h>
 
+#include <memory>
 #include <string>
 
 namespace unwindstack {
@@ -31,15 +32,17 @@ struct MapInfo {
   uint64_t start;
   uint64_t end;
   uint64_t offset;
+  uint64_t inode = 0;
   uint16_t flags;
   std::string name;
-  Elf* elf = nullptr;
+  std::shared_ptr<Elf> elf;
   // This value is only non-zero if the offset is non-zero but there is
   // no elf signature found at that offset. This indicates that the
   // entire file is represented by the Memory object returned by CreateMemory,
   // instead of a portion of the file.
   uint64_t elf_offset;
 
+  Memory* CreateFileMemory();
   Memory* CreateMemory(pid_t pid);
   Elf* GetElf(pid_t pid, bool init_gnu_debugdata = false);
 };
@@ -34,7 +34,7 @@ static constexpr int MAPS_FLAGS_DEVICE_MAP = 0x8000;
 class Maps {
  public:
   Maps() = default;
-  virtual ~Maps();
+  virtual ~Maps() = default;
 
   MapInfo* Find(uint64_t pc);
 
@@ -42,6 +42,10 @@ class Maps {
 
   virtual bool Parse();
 
+  // Parses the maps again, keeping the elf objects of every map that did
+  // not change. On failure the previous maps are left untouched.
+  bool Update();
+
   virtual const std::string GetMapsFile() const { return ""; }
 
   typedef std::vector<MapInfo>::iterator iterator;
@@ -56,6 +60,9 @@ class Maps {
 
  protected:
   std::vector<MapInfo> maps_;
+  // Index of the map returned by the last Find, consecutive lookups tend to
+  // land in the same map.
+  size_t last_found_ = 0;
 };
 
 class RemoteMaps : public Maps {
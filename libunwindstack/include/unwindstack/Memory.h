@@ -22,6 +22,7 @@
 #include <unistd.h>
 
 #include <string>
+#include <unordered_map>
 #include <vector>
 
 namespace unwindstack {
@@ -99,6 +100,24 @@ class MemoryOffline : public MemoryFileAtOffset {
   uint64_t start_;
 };
 
+// Memory backed by a copy of the range [start, end) of a process, such as a
+// stack snapshot taken by the kernel. The data is not owned.
+class MemoryOfflineBuffer : public Memory {
+ public:
+  MemoryOfflineBuffer(const uint8_t* data, uint64_t start, uint64_t end)
+      : data_(data), start_(start), end_(end) {}
+  virtual ~MemoryOfflineBuffer() = default;
+
+  bool Read(uint64_t addr, void* dst, size_t size) override;
+
+  void Reset(const uint8_t* data, uint64_t start, uint64_t end);
+
+ private:
+  const uint8_t* data_;
+  uint64_t start_;
+  uint64_t end_;
+};
+
 class MemoryRemote : public Memory {
  public:
   MemoryRemote(pid_t pid) : pid_(pid) {}
@@ -109,6 +128,8 @@ class MemoryRemote : public Memory {
   pid_t pid() { return pid_; }
 
  protected:
+  virtual bool VmRead(uint64_t addr, void* dst, size_t size);
+
   virtual bool PtraceRead(uint64_t addr, long* value);
 
  private:
@@ -136,6 +157,30 @@ class MemoryRange : public Memory {
   uint64_t length_;
 };
 
+// Keeps every page read through memory, so that repeated small reads of the
+// same data (dwarf parsing, stack walking) are only fetched once. The cache
+// is never invalidated, it is meant to live as long as a single unwind.
+class MemoryCache : public Memory {
+ public:
+  MemoryCache(Memory* memory) : impl_(memory) {}
+  virtual ~MemoryCache() { delete impl_; }
+
+  bool Read(uint64_t addr, void* dst, size_t size) override;
+
+  void Clear() { cache_.clear(); }
+
+ private:
+  constexpr static size_t kCacheBits = 12;
+  constexpr static size_t kCacheSize = 1 << kCacheBits;
+  constexpr static uint64_t kCacheMask = kCacheSize - 1;
+  // Reads larger than this go straight to impl_.
+  constexpr static size_t kMaxCachedRead = 4 * kCacheSize;
+  typedef uint8_t CacheDataType[kCacheSize];
+
+  Memory* impl_;
+  std::unordered_map<uint64_t, CacheDataType> cache_;
+};
+
 }  // namespace unwindstack
 
 #endif  // _LIBUNWINDSTACK_MEMORY_H
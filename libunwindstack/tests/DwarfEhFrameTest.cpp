@@ -318,6 +318,61 @@ TYPED_TEST_P(DwarfEhFrameTest, GetFdeOffsetFromPc_sequential_search) {
   EXPECT_EQ(0x10100U, fde_offset);
 }
 
+TYPED_TEST_P(DwarfEhFrameTest, GetFdeOffsetFromPc_no_table) {
+  // An eh_frame_hdr with no fde count and no table.
+  this->memory_.SetMemory(
+      0x1000, std::vector<uint8_t>{0x1, DW_EH_PE_udata4, DW_EH_PE_omit, DW_EH_PE_omit});
+  this->memory_.SetData32(0x1004, 0x2000);
+
+  // CIE 32 information.
+  this->memory_.SetData32(0x2000, 0x10);
+  this->memory_.SetData32(0x2004, 0);
+  this->memory_.SetData8(0x2008, 0x1);
+  this->memory_.SetData8(0x2009, '\0');
+  this->memory_.SetData8(0x200a, 4);
+  this->memory_.SetData8(0x200b, 8);
+  this->memory_.SetData8(0x200c, 0x20);
+
+  // FDE 32 information, the fdes are not in pc order.
+  this->memory_.SetData32(0x2014, 0x10);
+  this->memory_.SetData32(0x2018, 0x18);
+  this->memory_.SetData32(0x201c, 0x3000);
+  this->memory_.SetData32(0x2020, 0x100);
+
+  this->memory_.SetData32(0x2028, 0x10);
+  this->memory_.SetData32(0x202c, 0x2c);
+  this->memory_.SetData32(0x2030, 0x2000);
+  this->memory_.SetData32(0x2034, 0x200);
+
+  // Terminator.
+  this->memory_.SetData32(0x203c, 0);
+
+  ASSERT_TRUE(this->eh_frame_->Init(0x1000, 0x100));
+  EXPECT_EQ(0x2000U, this->eh_frame_->TestGetPtrOffset());
+  EXPECT_EQ(0U, this->eh_frame_->TestGetFdeCount());
+
+  uint64_t fde_offset;
+  ASSERT_TRUE(this->eh_frame_->GetFdeOffsetFromPc(0x4034, &fde_offset));
+  EXPECT_EQ(0x2028U, fde_offset);
+  ASSERT_TRUE(this->eh_frame_->GetFdeOffsetFromPc(0x4233, &fde_offset));
+  EXPECT_EQ(0x2028U, fde_offset);
+  ASSERT_TRUE(this->eh_frame_->GetFdeOffsetFromPc(0x5020, &fde_offset));
+  EXPECT_EQ(0x2014U, fde_offset);
+  ASSERT_TRUE(this->eh_frame_->GetFdeOffsetFromPc(0x511f, &fde_offset));
+  EXPECT_EQ(0x2014U, fde_offset);
+
+  // Pcs outside of any fde.
+  ASSERT_FALSE(this->eh_frame_->GetFdeOffsetFromPc(0x4000, &fde_offset));
+  ASSERT_FALSE(this->eh_frame_->GetFdeOffsetFromPc(0x4234, &fde_offset));
+  ASSERT_FALSE(this->eh_frame_->GetFdeOffsetFromPc(0x5120, &fde_offset));
+
+  const DwarfFde* fde = this->eh_frame_->GetFdeFromPc(0x5050);
+  ASSERT_TRUE(fde != nullptr);
+  EXPECT_EQ(0x5020U, fde->pc_start);
+  EXPECT_EQ(0x5120U, fde->pc_end);
+  EXPECT_EQ(0x2000U, fde->cie_offset);
+}
+
 TYPED_TEST_P(DwarfEhFrameTest, GetCieFde32) {
   // CIE 32 information.
   this->memory_.SetData32(0xf000, 0x100);
@@ -406,7 +461,7 @@ REGISTER_TYPED_TEST_CASE_P(DwarfEhFrameTest, Init, GetFdeInfoFromIndex_expect_ca
                            GetFdeOffsetSequential, GetFdeOffsetSequential_last_element,
                            GetFdeOffsetSequential_end_check, GetFdeOffsetFromPc_fail_fde_count,
                            GetFdeOffsetFromPc_binary_search, GetFdeOffsetFromPc_sequential_search,
-                           GetCieFde32, GetCieFde64);
+                           GetFdeOffsetFromPc_no_table, GetCieFde32, GetCieFde64);
 
 typedef ::testing::Types<uint32_t, uint64_t> DwarfEhFrameTestTypes;
 INSTANTIATE_TYPED_TEST_CASE_P(, DwarfEhFrameTest, DwarfEhFrameTestTypes);
@@ -0,0 +1,90 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdint.h>
+
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+#include <unwindstack/DwarfSection.h>
+
+#include "MemoryFake.h"
+#include "RegsFake.h"
+
+namespace unwindstack {
+
+// Only Eval is exercised, so none of the section parsing is needed.
+class BenchmarkDwarfSection : public DwarfSectionImpl<uint64_t> {
+ public:
+  BenchmarkDwarfSection(Memory* memory) : DwarfSectionImpl<uint64_t>(memory) {}
+  virtual ~BenchmarkDwarfSection() = default;
+
+  bool Init(uint64_t, uint64_t) override { return false; }
+  bool GetFdeOffsetFromPc(uint64_t, uint64_t*) override { return false; }
+  const DwarfFde* GetFdeFromIndex(size_t) override { return nullptr; }
+  bool IsCie32(uint32_t) override { return false; }
+  bool IsCie64(uint64_t) override { return false; }
+  uint64_t GetCieOffsetFromFde32(uint32_t) override { return 0; }
+  uint64_t GetCieOffsetFromFde64(uint64_t) override { return 0; }
+  uint64_t AdjustPcFromFde(uint64_t pc) override { return pc; }
+};
+
+// Evaluates the rules of one frame whose cfa is the expression in |expression|,
+// which has to compute *(r8 + 0x10). Each iteration is one step.
+static void RunEval(benchmark::State& state, const std::vector<uint8_t>& expression) {
+  MemoryFake memory;
+  memory.SetMemory(0x5000, expression);
+  uint64_t cfa = 0x12345;
+  memory.SetMemory(0x3010, &cfa, sizeof(cfa));
+  uint64_t return_address = 0x1000;
+  memory.SetMemory(0x12345 - 8, &return_address, sizeof(return_address));
+
+  BenchmarkDwarfSection section(&memory);
+  DwarfCie cie{.version = 3, .return_address_register = 5};
+  dwarf_loc_regs_t loc_regs;
+  loc_regs[CFA_REG] = DwarfLocation{DWARF_LOCATION_VAL_EXPRESSION, {expression.size(), 0x5000}};
+  loc_regs[5] = DwarfLocation{DWARF_LOCATION_OFFSET, {static_cast<uint64_t>(-8), 0}};
+
+  RegsFake<uint64_t> regs(10, 9);
+  while (state.KeepRunning()) {
+    regs.set_pc(0x100);
+    regs.set_sp(0x2000);
+    regs[8] = 0x3000;
+    if (!section.Eval(&cie, &memory, loc_regs, &regs)) {
+      state.SkipWithError("Eval failed");
+      break;
+    }
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+
+// DW_OP_breg8 0x10, DW_OP_deref: matches a compiled pattern.
+static void BM_eval_compiled_expression(benchmark::State& state) {
+  RunEval(state, {0x78, 0x10, 0x06});
+}
+BENCHMARK(BM_eval_compiled_expression);
+
+// DW_OP_breg8 0, DW_OP_lit16, DW_OP_plus, DW_OP_deref: the same value, but
+// only DwarfOp can evaluate it.
+static void BM_eval_interpreted_expression(benchmark::State& state) {
+  RunEval(state, {0x78, 0x00, 0x40, 0x22, 0x06});
+}
+BENCHMARK(BM_eval_interpreted_expression);
+
+}  // namespace unwindstack
+
+BENCHMARK_MAIN();
@@ -1571,6 +1571,45 @@ TYPED_TEST_P(DwarfOpTest, op_nop) {
   ASSERT_EQ(0U, this->op_->StackSize());
 }
 
+TYPED_TEST_P(DwarfOpTest, compile) {
+  uint16_t reg;
+  TypeParam offset;
+  bool deref;
+
+  // DW_OP_breg7 -8
+  this->op_memory_.SetMemory(0x100, std::vector<uint8_t>{0x77, 0x78});
+  ASSERT_TRUE(this->op_->Compile(0x100, 0x102, &reg, &offset, &deref));
+  ASSERT_EQ(7U, reg);
+  ASSERT_EQ(static_cast<TypeParam>(-8), offset);
+  ASSERT_FALSE(deref);
+
+  // DW_OP_bregx 40 0x10, DW_OP_plus_uconst 0x100, DW_OP_deref
+  this->op_memory_.SetMemory(0x200, std::vector<uint8_t>{0x92, 0x28, 0x10, 0x23, 0x80, 0x02, 0x06});
+  ASSERT_TRUE(this->op_->Compile(0x200, 0x207, &reg, &offset, &deref));
+  ASSERT_EQ(40U, reg);
+  ASSERT_EQ(0x110U, offset);
+  ASSERT_TRUE(deref);
+
+  // Nothing may follow DW_OP_deref.
+  this->op_memory_.SetMemory(0x300, std::vector<uint8_t>{0x70, 0x00, 0x06, 0x06});
+  ASSERT_FALSE(this->op_->Compile(0x300, 0x304, &reg, &offset, &deref));
+
+  // Doesn't start with a register.
+  this->op_memory_.SetMemory(0x400, std::vector<uint8_t>{0x30, 0x23, 0x01});
+  ASSERT_FALSE(this->op_->Compile(0x400, 0x403, &reg, &offset, &deref));
+
+  // Any other op after the register: DW_OP_breg0 0, DW_OP_lit1, DW_OP_plus
+  this->op_memory_.SetMemory(0x500, std::vector<uint8_t>{0x70, 0x00, 0x31, 0x22});
+  ASSERT_FALSE(this->op_->Compile(0x500, 0x504, &reg, &offset, &deref));
+
+  // Runs past the end of the expression.
+  this->op_memory_.SetMemory(0x600, std::vector<uint8_t>{0x70, 0x00, 0x23, 0x01});
+  ASSERT_FALSE(this->op_->Compile(0x600, 0x603, &reg, &offset, &deref));
+
+  // Memory error.
+  ASSERT_FALSE(this->op_->Compile(0x1000, 0x1002, &reg, &offset, &deref));
+}
+
 REGISTER_TYPED_TEST_CASE_P(DwarfOpTest, decode, eval, illegal_opcode, illegal_in_version3,
                            illegal_in_version4, not_implemented, op_addr, op_deref, op_deref_size,
                            const_unsigned, const_signed, const_uleb, const_sleb, op_dup, op_drop,
@@ -1578,7 +1617,7 @@ REGISTER_TYPED_TEST_CASE_P(DwarfOpTest, decode, eval, illegal_opcode, illegal_in
                            op_mod, op_mul, op_neg, op_not, op_or, op_plus, op_plus_uconst, op_shl,
                            op_shr, op_shra, op_xor, op_bra, compare_opcode_stack_error,
                            compare_opcodes, op_skip, op_lit, op_reg, op_regx, op_breg,
-                           op_breg_invalid_register, op_bregx, op_nop);
+                           op_breg_invalid_register, op_bregx, op_nop, compile);
 
 typedef ::testing::Types<uint32_t, uint64_t> DwarfOpTestTypes;
 INSTANTIATE_TYPED_TEST_CASE_P(, DwarfOpTest, DwarfOpTestTypes);
@@ -401,6 +401,57 @@ TYPED_TEST_P(DwarfSectionImplTest, Eval_same_cfa_same_pc) {
   EXPECT_EQ(0x100U, regs.pc());
 }
 
+TYPED_TEST_P(DwarfSectionImplTest, Eval_cfa_compiled_expr) {
+  DwarfCie cie{.version = 3, .return_address_register = 5};
+  RegsFake<TypeParam> regs(10, 9);
+  dwarf_loc_regs_t loc_regs;
+
+  regs.set_pc(0x100);
+  regs.set_sp(0x2000);
+  regs[5] = 0x20;
+  regs[8] = 0x3000;
+  // DW_OP_breg8 0x10, DW_OP_deref
+  this->memory_.SetMemory(0x5000, std::vector<uint8_t>{0x78, 0x10, 0x06});
+  TypeParam cfa_value = 0x12345;
+  this->memory_.SetMemory(0x3010, &cfa_value, sizeof(cfa_value));
+  loc_regs[CFA_REG] = DwarfLocation{DWARF_LOCATION_VAL_EXPRESSION, {0x3, 0x5000}};
+  ASSERT_TRUE(this->section_->Eval(&cie, &this->memory_, loc_regs, &regs));
+  EXPECT_EQ(0x12345U, regs.sp());
+  EXPECT_EQ(0x20U, regs.pc());
+
+  // The second evaluation uses the compiled form with the new register value.
+  regs.set_pc(0x100);
+  regs[8] = 0x4000;
+  cfa_value = 0x23456;
+  this->memory_.SetMemory(0x4010, &cfa_value, sizeof(cfa_value));
+  ASSERT_TRUE(this->section_->Eval(&cie, &this->memory_, loc_regs, &regs));
+  EXPECT_EQ(0x23456U, regs.sp());
+
+  // Reading through the compiled form fails the same way.
+  regs.set_pc(0x100);
+  regs[8] = 0x8000;
+  ASSERT_FALSE(this->section_->Eval(&cie, &this->memory_, loc_regs, &regs));
+  EXPECT_EQ(DWARF_ERROR_MEMORY_INVALID, this->section_->last_error());
+}
+
+TYPED_TEST_P(DwarfSectionImplTest, Eval_reg_breg_expr) {
+  DwarfCie cie{.version = 3, .return_address_register = 5};
+  RegsFake<TypeParam> regs(10, 9);
+  dwarf_loc_regs_t loc_regs;
+
+  regs.set_pc(0x100);
+  regs.set_sp(0x2000);
+  regs[3] = 0x234;
+  regs[8] = 0x3000;
+  // DW_OP_breg3 0x10, DW_OP_lit1, DW_OP_plus, which isn't compiled.
+  this->memory_.SetMemory(0x5000, std::vector<uint8_t>{0x73, 0x10, 0x31, 0x22});
+  loc_regs[CFA_REG] = DwarfLocation{DWARF_LOCATION_REGISTER, {8, 0}};
+  loc_regs[5] = DwarfLocation{DWARF_LOCATION_VAL_EXPRESSION, {0x4, 0x5000}};
+  ASSERT_TRUE(this->section_->Eval(&cie, &this->memory_, loc_regs, &regs));
+  EXPECT_EQ(0x3000U, regs.sp());
+  EXPECT_EQ(0x245U, regs.pc());
+}
+
 TYPED_TEST_P(DwarfSectionImplTest, GetCie_fail_should_not_cache) {
   ASSERT_TRUE(this->section_->GetCie(0x4000) == nullptr);
   EXPECT_EQ(DWARF_ERROR_MEMORY_INVALID, this->section_->last_error());
@@ -826,12 +877,12 @@ REGISTER_TYPED_TEST_CASE_P(
     Eval_cfa_bad, Eval_cfa_register_prev, Eval_cfa_register_from_value, Eval_double_indirection,
     Eval_invalid_register, Eval_different_reg_locations, Eval_return_address_undefined,
     Eval_return_address, Eval_ignore_large_reg_loc, Eval_reg_expr, Eval_reg_val_expr,
-    Eval_same_cfa_same_pc, GetCie_fail_should_not_cache, GetCie_32_version_check,
-    GetCie_negative_data_alignment_factor, GetCie_64_no_augment, GetCie_augment, GetCie_version_3,
-    GetCie_version_4, GetFdeFromOffset_fail_should_not_cache, GetFdeFromOffset_32_no_augment,
-    GetFdeFromOffset_32_no_augment_non_zero_segment_size, GetFdeFromOffset_32_augment,
-    GetFdeFromOffset_64_no_augment, GetFdeFromOffset_cached, GetCfaLocationInfo_cie_not_cached,
-    GetCfaLocationInfo_cie_cached, Log);
+    Eval_same_cfa_same_pc, Eval_cfa_compiled_expr, Eval_reg_breg_expr, GetCie_fail_should_not_cache,
+    GetCie_32_version_check, GetCie_negative_data_alignment_factor, GetCie_64_no_augment,
+    GetCie_augment, GetCie_version_3, GetCie_version_4, GetFdeFromOffset_fail_should_not_cache,
+    GetFdeFromOffset_32_no_augment, GetFdeFromOffset_32_no_augment_non_zero_segment_size,
+    GetFdeFromOffset_32_augment, GetFdeFromOffset_64_no_augment, GetFdeFromOffset_cached,
+    GetCfaLocationInfo_cie_not_cached, GetCfaLocationInfo_cie_cached, Log);
 
 typedef ::testing::Types<uint32_t, uint64_t> DwarfSectionImplTestTypes;
 INSTANTIATE_TYPED_TEST_CASE_P(, DwarfSectionImplTest, DwarfSectionImplTestTypes);
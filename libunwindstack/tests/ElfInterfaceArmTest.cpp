@@ -374,4 +374,32 @@ TEST_F(ElfInterfaceArmTest, StepExidx_pc_set) {
   ASSERT_EQ(0x10U, regs[ARM_REG_PC]);
 }
 
+TEST_F(ElfInterfaceArmTest, StepExidx_cached_entry) {
+  ElfInterfaceArm interface(&memory_);
+
+  interface.set_start_offset(0x1000);
+  interface.set_total_entries(2);
+  memory_.SetData32(0x1000, 0x6000);
+  memory_.SetData32(0x1004, 0x808800b0);
+  memory_.SetData32(0x1008, 0x8000);
+  process_memory_.SetData32(0x10000, 0x10);
+  process_memory_.SetData32(0x20000, 0x30);
+
+  RegsArm regs;
+  regs[ARM_REG_SP] = 0x10000;
+  regs.set_sp(regs[ARM_REG_SP]);
+  regs.set_pc(0x1234);
+  ASSERT_TRUE(interface.StepExidx(0x7000, &regs, &process_memory_));
+  ASSERT_EQ(0x10004U, regs.sp());
+  ASSERT_EQ(0x10U, regs.pc());
+
+  // Changing the entry in the elf does not matter, the decoded entry is reused.
+  memory_.SetData32(0x1004, 1);
+  regs[ARM_REG_SP] = 0x20000;
+  regs.set_sp(regs[ARM_REG_SP]);
+  ASSERT_TRUE(interface.StepExidx(0x7000, &regs, &process_memory_));
+  ASSERT_EQ(0x20004U, regs.sp());
+  ASSERT_EQ(0x30U, regs.pc());
+}
+
 }  // namespace unwindstack
@@ -58,8 +58,8 @@ class MapInfoGetElfTest : public ::testing::Test {
 
 TEST_F(MapInfoGetElfTest, invalid) {
   // The map is empty, but this should still create an invalid elf object.
-  std::unique_ptr<Elf> elf(info_->GetElf(getpid(), false));
-  ASSERT_TRUE(elf.get() != nullptr);
+  Elf* elf = info_->GetElf(getpid(), false);
+  ASSERT_TRUE(elf != nullptr);
   ASSERT_FALSE(elf->valid());
 }
 
@@ -68,8 +68,8 @@ TEST_F(MapInfoGetElfTest, valid32) {
   TestInitEhdr<Elf32_Ehdr>(&ehdr, ELFCLASS32, EM_ARM);
   memcpy(map_, &ehdr, sizeof(ehdr));
 
-  std::unique_ptr<Elf> elf(info_->GetElf(getpid(), false));
-  ASSERT_TRUE(elf.get() != nullptr);
+  Elf* elf = info_->GetElf(getpid(), false);
+  ASSERT_TRUE(elf != nullptr);
   ASSERT_TRUE(elf->valid());
   EXPECT_EQ(static_cast<uint32_t>(EM_ARM), elf->machine_type());
   EXPECT_EQ(ELFCLASS32, elf->class_type());
@@ -80,8 +80,8 @@ TEST_F(MapInfoGetElfTest, valid64) {
   TestInitEhdr<Elf64_Ehdr>(&ehdr, ELFCLASS64, EM_AARCH64);
   memcpy(map_, &ehdr, sizeof(ehdr));
 
-  std::unique_ptr<Elf> elf(info_->GetElf(getpid(), false));
-  ASSERT_TRUE(elf.get() != nullptr);
+  Elf* elf = info_->GetElf(getpid(), false);
+  ASSERT_TRUE(elf != nullptr);
   ASSERT_TRUE(elf->valid());
   EXPECT_EQ(static_cast<uint32_t>(EM_AARCH64), elf->machine_type());
   EXPECT_EQ(ELFCLASS64, elf->class_type());
@@ -93,8 +93,8 @@ TEST_F(MapInfoGetElfTest, gnu_debugdata_do_not_init32) {
         memcpy(&reinterpret_cast<uint8_t*>(map_)[offset], ptr, size);
       });
 
-  std::unique_ptr<Elf> elf(info_->GetElf(getpid(), false));
-  ASSERT_TRUE(elf.get() != nullptr);
+  Elf* elf = info_->GetElf(getpid(), false);
+  ASSERT_TRUE(elf != nullptr);
   ASSERT_TRUE(elf->valid());
   EXPECT_EQ(static_cast<uint32_t>(EM_ARM), elf->machine_type());
   EXPECT_EQ(ELFCLASS32, elf->class_type());
@@ -107,8 +107,8 @@ TEST_F(MapInfoGetElfTest, gnu_debugdata_do_not_init64) {
         memcpy(&reinterpret_cast<uint8_t*>(map_)[offset], ptr, size);
       });
 
-  std::unique_ptr<Elf> elf(info_->GetElf(getpid(), false));
-  ASSERT_TRUE(elf.get() != nullptr);
+  Elf* elf = info_->GetElf(getpid(), false);
+  ASSERT_TRUE(elf != nullptr);
   ASSERT_TRUE(elf->valid());
   EXPECT_EQ(static_cast<uint32_t>(EM_AARCH64), elf->machine_type());
   EXPECT_EQ(ELFCLASS64, elf->class_type());
@@ -121,8 +121,8 @@ TEST_F(MapInfoGetElfTest, gnu_debugdata_init32) {
         memcpy(&reinterpret_cast<uint8_t*>(map_)[offset], ptr, size);
       });
 
-  std::unique_ptr<Elf> elf(info_->GetElf(getpid(), true));
-  ASSERT_TRUE(elf.get() != nullptr);
+  Elf* elf = info_->GetElf(getpid(), true);
+  ASSERT_TRUE(elf != nullptr);
   ASSERT_TRUE(elf->valid());
   EXPECT_EQ(static_cast<uint32_t>(EM_ARM), elf->machine_type());
   EXPECT_EQ(ELFCLASS32, elf->class_type());
@@ -135,12 +135,44 @@ TEST_F(MapInfoGetElfTest, gnu_debugdata_init64) {
         memcpy(&reinterpret_cast<uint8_t*>(map_)[offset], ptr, size);
       });
 
-  std::unique_ptr<Elf> elf(info_->GetElf(getpid(), true));
-  ASSERT_TRUE(elf.get() != nullptr);
+  Elf* elf = info_->GetElf(getpid(), true);
+  ASSERT_TRUE(elf != nullptr);
   ASSERT_TRUE(elf->valid());
   EXPECT_EQ(static_cast<uint32_t>(EM_AARCH64), elf->machine_type());
   EXPECT_EQ(ELFCLASS64, elf->class_type());
   EXPECT_TRUE(elf->gnu_debugdata_interface() != nullptr);
 }
 
+TEST_F(MapInfoGetElfTest, cache) {
+  TemporaryFile tf;
+  ASSERT_TRUE(tf.fd != -1);
+  Elf64_Ehdr ehdr;
+  TestInitEhdr<Elf64_Ehdr>(&ehdr, ELFCLASS64, EM_AARCH64);
+  ASSERT_TRUE(android::base::WriteFully(tf.fd, &ehdr, sizeof(ehdr)));
+
+  MapInfo info1{.start = 0x1000, .end = 0x2000, .offset = 0, .inode = 100, .name = tf.path};
+  MapInfo info2{.start = 0x5000, .end = 0x6000, .offset = 0, .inode = 100, .name = tf.path};
+  MapInfo info3{.start = 0x5000, .end = 0x6000, .offset = 0, .inode = 101, .name = tf.path};
+
+  // Without the cache every map gets its own elf.
+  ASSERT_NE(info1.GetElf(getpid(), false), info2.GetElf(getpid(), false));
+
+  info1.elf.reset();
+  info2.elf.reset();
+  Elf::SetCachingEnabled(true);
+  Elf* elf = info1.GetElf(getpid(), false);
+  ASSERT_TRUE(elf != nullptr);
+  ASSERT_TRUE(elf->valid());
+  ASSERT_EQ(elf, info2.GetElf(getpid(), false));
+  // A different inode is a different file.
+  ASSERT_NE(elf, info3.GetElf(getpid(), false));
+
+  // The cached elf outlives the maps it was created for.
+  info1.elf.reset();
+  info2.elf.reset();
+  MapInfo info4{.start = 0x1000, .end = 0x2000, .offset = 0, .inode = 100, .name = tf.path};
+  ASSERT_EQ(elf, info4.GetElf(getpid(), false));
+  Elf::SetCachingEnabled(false);
+}
+
 }  // namespace unwindstack
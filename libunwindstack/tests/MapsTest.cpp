@@ -180,6 +180,52 @@ TEST(MapsTest, file_smoke) {
   ASSERT_EQ(it, maps.end());
 }
 
+TEST(MapsTest, update) {
+  TemporaryFile tf;
+  ASSERT_TRUE(tf.fd != -1);
+
+  ASSERT_TRUE(
+      android::base::WriteStringToFile("1000-2000 r-xp 00000000 00:00 10 /fake.so\n"
+                                       "3000-4000 r-xp 00000000 00:00 11 /fake2.so\n"
+                                       "5000-6000 r-xp 00000000 00:00 12 /fake3.so\n",
+                                       tf.path, 0660, getuid(), getgid()));
+
+  FileMaps maps(tf.path);
+  ASSERT_TRUE(maps.Parse());
+  ASSERT_EQ(3U, maps.Total());
+  Elf* elfs[3];
+  size_t i = 0;
+  for (auto& map : maps) {
+    elfs[i++] = map.GetElf(getpid(), false);
+  }
+
+  // An unchanged map, one with a new inode, a new map and a removed map.
+  ASSERT_TRUE(
+      android::base::WriteStringToFile("1000-2000 r-xp 00000000 00:00 10 /fake.so\n"
+                                       "3000-4000 r-xp 00000000 00:00 21 /fake2.so\n"
+                                       "4000-5000 r-xp 00000000 00:00 22 /fake4.so\n",
+                                       tf.path, 0660, getuid(), getgid()));
+  ASSERT_TRUE(maps.Update());
+  ASSERT_EQ(3U, maps.Total());
+  auto it = maps.begin();
+  ASSERT_EQ(0x1000U, it->start);
+  ASSERT_EQ(elfs[0], it->elf.get());
+  ++it;
+  ASSERT_EQ(0x3000U, it->start);
+  ASSERT_EQ(21U, it->inode);
+  ASSERT_TRUE(it->elf == nullptr);
+  ++it;
+  ASSERT_EQ(0x4000U, it->start);
+  ASSERT_EQ("/fake4.so", it->name);
+  ASSERT_TRUE(it->elf == nullptr);
+
+  // A failed update keeps the old maps.
+  ASSERT_TRUE(android::base::WriteStringToFile("not a map\n", tf.path, 0660, getuid(), getgid()));
+  ASSERT_FALSE(maps.Update());
+  ASSERT_EQ(3U, maps.Total());
+  ASSERT_EQ(elfs[0], maps.begin()->elf.get());
+}
+
 TEST(MapsTest, find) {
   BufferMaps maps(
       "1000-2000 r--p 00000010 00:00 0 /system/lib/fake1.so\n"
@@ -0,0 +1,115 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#include <memory>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include <unwindstack/Memory.h>
+
+#include "MemoryFake.h"
+
+namespace unwindstack {
+
+class MemoryCacheTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    memory_ = new MemoryFake;
+    cache_.reset(new MemoryCache(memory_));
+  }
+
+  MemoryFake* memory_;
+  std::unique_ptr<MemoryCache> cache_;
+};
+
+TEST_F(MemoryCacheTest, cached_read) {
+  std::vector<uint8_t> src(8192);
+  for (size_t i = 0; i < src.size(); i++) {
+    src[i] = i & 0xff;
+  }
+  memory_->SetMemory(0x10000, src);
+
+  std::vector<uint8_t> dst(64);
+  ASSERT_TRUE(cache_->Read(0x10100, dst.data(), dst.size()));
+  for (size_t i = 0; i < dst.size(); i++) {
+    ASSERT_EQ(i & 0xff, dst[i]) << "Failed at byte " << i;
+  }
+
+  // Change the underlying memory, the cached page is still returned.
+  memory_->Clear();
+  ASSERT_TRUE(cache_->Read(0x10000, dst.data(), dst.size()));
+  for (size_t i = 0; i < dst.size(); i++) {
+    ASSERT_EQ(i & 0xff, dst[i]) << "Failed at byte " << i;
+  }
+
+  // Until the cache is cleared.
+  cache_->Clear();
+  ASSERT_FALSE(cache_->Read(0x10000, dst.data(), dst.size()));
+}
+
+TEST_F(MemoryCacheTest, read_across_pages) {
+  std::vector<uint8_t> src(8192);
+  for (size_t i = 0; i < src.size(); i++) {
+    src[i] = i & 0xff;
+  }
+  memory_->SetMemory(0x10000, src);
+
+  std::vector<uint8_t> dst(100);
+  ASSERT_TRUE(cache_->Read(0x10fd0, dst.data(), dst.size()));
+  for (size_t i = 0; i < dst.size(); i++) {
+    ASSERT_EQ((0xfd0 + i) & 0xff, dst[i]) << "Failed at byte " << i;
+  }
+}
+
+TEST_F(MemoryCacheTest, read_partial_page) {
+  // Only part of the page exists, reads inside of it still work.
+  std::vector<uint8_t> src(100, 0x4c);
+  memory_->SetMemory(0x10020, src);
+
+  std::vector<uint8_t> dst(100);
+  ASSERT_TRUE(cache_->Read(0x10020, dst.data(), dst.size()));
+  for (size_t i = 0; i < dst.size(); i++) {
+    ASSERT_EQ(0x4cU, dst[i]) << "Failed at byte " << i;
+  }
+  ASSERT_FALSE(cache_->Read(0x10020, dst.data(), dst.size() + 1));
+  ASSERT_FALSE(cache_->Read(0x10000, dst.data(), 1));
+}
+
+TEST_F(MemoryCacheTest, read_large) {
+  std::vector<uint8_t> src(20000, 0x23);
+  memory_->SetMemory(0x10000, src);
+
+  std::vector<uint8_t> dst(20000);
+  ASSERT_TRUE(cache_->Read(0x10000, dst.data(), dst.size()));
+  for (size_t i = 0; i < dst.size(); i++) {
+    ASSERT_EQ(0x23U, dst[i]) << "Failed at byte " << i;
+  }
+
+  // Large reads are not cached.
+  memory_->Clear();
+  ASSERT_FALSE(cache_->Read(0x10000, dst.data(), dst.size()));
+}
+
+TEST_F(MemoryCacheTest, read_overflow) {
+  std::vector<uint8_t> dst(100);
+  ASSERT_FALSE(cache_->Read(UINT64_MAX - 10, dst.data(), dst.size()));
+}
+
+}  // namespace unwindstack
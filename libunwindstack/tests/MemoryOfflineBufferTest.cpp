@@ -0,0 +1,73 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdint.h>
+
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include <unwindstack/Memory.h>
+
+namespace unwindstack {
+
+TEST(MemoryOfflineBufferTest, read) {
+  std::vector<uint8_t> buffer(1024);
+  for (size_t i = 0; i < buffer.size(); i++) {
+    buffer[i] = i & 0xff;
+  }
+  MemoryOfflineBuffer memory(buffer.data(), 0x1000, 0x1400);
+
+  std::vector<uint8_t> dst(1024);
+  ASSERT_TRUE(memory.Read(0x1000, dst.data(), 1024));
+  for (size_t i = 0; i < 1024; i++) {
+    ASSERT_EQ(i & 0xff, dst[i]) << "Failed at byte " << i;
+  }
+
+  ASSERT_TRUE(memory.Read(0x13fc, dst.data(), 4));
+  ASSERT_EQ(0xfcU, dst[0]);
+  ASSERT_EQ(0xffU, dst[3]);
+
+  // Reads outside of the buffer fail.
+  ASSERT_FALSE(memory.Read(0xfff, dst.data(), 1));
+  ASSERT_FALSE(memory.Read(0x13fc, dst.data(), 5));
+  ASSERT_FALSE(memory.Read(0x1400, dst.data(), 1));
+}
+
+TEST(MemoryOfflineBufferTest, reset) {
+  std::vector<uint8_t> buffer1(16, 0x11);
+  std::vector<uint8_t> buffer2(16, 0x22);
+  MemoryOfflineBuffer memory(buffer1.data(), 0x1000, 0x1010);
+
+  uint8_t value;
+  ASSERT_TRUE(memory.Read(0x1000, &value, 1));
+  ASSERT_EQ(0x11U, value);
+
+  memory.Reset(buffer2.data(), 0x2000, 0x2010);
+  ASSERT_FALSE(memory.Read(0x1000, &value, 1));
+  ASSERT_TRUE(memory.Read(0x200f, &value, 1));
+  ASSERT_EQ(0x22U, value);
+}
+
+TEST(MemoryOfflineBufferTest, read_overflow) {
+  std::vector<uint8_t> buffer(16);
+  MemoryOfflineBuffer memory(buffer.data(), 0x1000, 0x1010);
+
+  std::vector<uint8_t> dst(100);
+  ASSERT_FALSE(memory.Read(UINT64_MAX - 10, dst.data(), 100));
+}
+
+}  // namespace unwindstack
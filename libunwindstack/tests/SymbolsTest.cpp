@@ -26,6 +26,7 @@
 #include <time.h>
 #include <unistd.h>
 
+#include <string>
 #include <vector>
 
 #include <android-base/file.h>
@@ -330,9 +331,45 @@ TYPED_TEST_P(SymbolsTest, symtab_read_cached) {
   ASSERT_EQ(3U, func_offset);
 }
 
+// Verify a table that takes several reads is fully indexed.
+TYPED_TEST_P(SymbolsTest, symtab_large) {
+  const size_t kEntries = 1000;
+  Symbols symbols(0x10000, kEntries * sizeof(TypeParam), sizeof(TypeParam), 0x2000, 0x100);
+
+  // Descending addresses, every other entry is not a function.
+  uint64_t offset = 0x10000;
+  for (size_t i = 0; i < kEntries; i++) {
+    TypeParam sym;
+    this->InitSym(&sym, 0x100000 - i * 0x100, 0x80, 0x10 * (i % 8));
+    if (i % 2) {
+      sym.st_info = 0;
+    }
+    this->memory_.SetMemory(offset, &sym, sizeof(sym));
+    offset += sizeof(sym);
+  }
+  for (size_t i = 0; i < 8; i++) {
+    std::string fake_name("function_" + std::to_string(i));
+    this->memory_.SetMemory(0x2000 + 0x10 * i, fake_name.c_str(), fake_name.size() + 1);
+  }
+
+  std::string name;
+  uint64_t func_offset;
+  for (size_t i = 0; i < kEntries; i += 2) {
+    uint64_t addr = 0x100000 - i * 0x100;
+    ASSERT_TRUE(symbols.GetName<TypeParam>(addr + 0x7f, 0, &this->memory_, &name, &func_offset))
+        << "Failed at entry " << i;
+    ASSERT_EQ("function_" + std::to_string(i % 8), name);
+    ASSERT_EQ(0x7fU, func_offset);
+    ASSERT_FALSE(symbols.GetName<TypeParam>(addr + 0x80, 0, &this->memory_, &name, &func_offset));
+    // The non-function entry right after.
+    ASSERT_FALSE(
+        symbols.GetName<TypeParam>(addr - 0x100, 0, &this->memory_, &name, &func_offset));
+  }
+}
+
 REGISTER_TYPED_TEST_CASE_P(SymbolsTest, function_bounds_check, no_symbol, multiple_entries,
                            multiple_entries_nonstandard_size, load_bias, symtab_value_out_of_bounds,
-                           symtab_read_cached);
+                           symtab_read_cached, symtab_large);
 
 typedef ::testing::Types<Elf32_Sym, Elf64_Sym> SymbolsTestTypes;
 INSTANTIATE_TYPED_TEST_CASE_P(, SymbolsTest, SymbolsTestTypes);
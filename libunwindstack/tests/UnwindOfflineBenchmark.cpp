@@ -0,0 +1,357 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Replays recorded unwinds, and measures each part of them separately: elf
+// init, fde lookup, stepping and symbolization, as well as all of them
+// together.
+//
+// One unwind of this process is always recorded when it starts. More are
+// read from the directories listed in $UNWINDSTACK_BENCHMARK_RECORDINGS
+// (separated by ':'), as written by `unwind -r <dir> <pid>`:
+//   maps.txt    The /proc/<pid>/maps of the process.
+//   regs.data   <uint32_t> machine type, then the registers as laid out
+//               by Regs::RawData().
+//   stack.data  <uint64_t> start address, then the stack from there on.
+// The mapped files are read from the directory if a file with the same base
+// name is in it, and from their own path otherwise.
+
+#include <elf.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <android-base/file.h>
+#include <android-base/strings.h>
+#include <benchmark/benchmark.h>
+
+#include <unwindstack/DwarfSection.h>
+#include <unwindstack/Elf.h>
+#include <unwindstack/ElfInterface.h>
+#include <unwindstack/MapInfo.h>
+#include <unwindstack/Maps.h>
+#include <unwindstack/Memory.h>
+#include <unwindstack/Regs.h>
+#include <unwindstack/RegsGetLocal.h>
+
+namespace unwindstack {
+
+static constexpr size_t kMaxFrames = 64;
+
+// The most stack copied by RecordLocal.
+static constexpr size_t kMaxStackSize = 1024 * 1024;
+
+struct Recording {
+  std::string name;
+  std::string dir;
+  std::string maps;
+  uint32_t machine_type;
+  std::vector<uint8_t> regs;
+  uint64_t stack_start;
+  std::vector<uint8_t> stack;
+};
+
+static Regs* CreateRegs(uint32_t machine_type) {
+  switch (machine_type) {
+    case EM_ARM:
+      return new RegsArm();
+    case EM_AARCH64:
+      return new RegsArm64();
+    case EM_386:
+      return new RegsX86();
+    case EM_X86_64:
+      return new RegsX86_64();
+  }
+  return nullptr;
+}
+
+static size_t RegsSize(Regs* regs, uint32_t machine_type) {
+  bool bits32 = machine_type == EM_ARM || machine_type == EM_386;
+  return regs->total_regs() * (bits32 ? sizeof(uint32_t) : sizeof(uint64_t));
+}
+
+static bool LoadRecording(const std::string& dir, Recording* recording) {
+  std::string regs;
+  std::string stack;
+  if (!android::base::ReadFileToString(dir + "/maps.txt", &recording->maps) ||
+      !android::base::ReadFileToString(dir + "/regs.data", &regs) ||
+      !android::base::ReadFileToString(dir + "/stack.data", &stack) ||
+      regs.size() < sizeof(recording->machine_type) ||
+      stack.size() < sizeof(recording->stack_start)) {
+    return false;
+  }
+
+  memcpy(&recording->machine_type, regs.data(), sizeof(recording->machine_type));
+  std::unique_ptr<Regs> machine_regs(CreateRegs(recording->machine_type));
+  if (machine_regs == nullptr ||
+      regs.size() != sizeof(recording->machine_type) +
+                         RegsSize(machine_regs.get(), recording->machine_type)) {
+    return false;
+  }
+  recording->regs.assign(regs.begin() + sizeof(recording->machine_type), regs.end());
+
+  memcpy(&recording->stack_start, stack.data(), sizeof(recording->stack_start));
+  recording->stack.assign(stack.begin() + sizeof(recording->stack_start), stack.end());
+
+  recording->dir = dir;
+  recording->name = android::base::Basename(dir);
+  return true;
+}
+
+// Records this process from |depth| calls down, so that there is something
+// to unwind through.
+static __attribute__((noinline)) bool RecordLocal(size_t depth, Recording* recording) {
+  if (depth > 0) {
+    bool recorded = RecordLocal(depth - 1, recording);
+    // Keeps the call from being a tail call.
+    benchmark::DoNotOptimize(recorded);
+    return recorded;
+  }
+
+  std::unique_ptr<Regs> regs(Regs::CreateFromLocal());
+  RegsGetLocal(regs.get());
+  recording->machine_type = Regs::GetMachineType();
+  const uint8_t* raw = reinterpret_cast<const uint8_t*>(regs->RawData());
+  recording->regs.assign(raw, raw + RegsSize(regs.get(), recording->machine_type));
+
+  if (!android::base::ReadFileToString("/proc/self/maps", &recording->maps)) {
+    return false;
+  }
+  BufferMaps maps(recording->maps.c_str());
+  MapInfo* stack_map;
+  if (!maps.Parse() || (stack_map = maps.Find(regs->sp())) == nullptr) {
+    return false;
+  }
+  uint64_t stack_end = std::min<uint64_t>(stack_map->end, regs->sp() + kMaxStackSize);
+  recording->stack_start = regs->sp();
+  recording->stack.resize(stack_end - regs->sp());
+  memcpy(recording->stack.data(), reinterpret_cast<void*>(regs->sp()), recording->stack.size());
+
+  recording->name = "local";
+  return true;
+}
+
+// The maps, elf objects and memory of one recording, set up to unwind it.
+class Replay {
+ public:
+  explicit Replay(const Recording& recording)
+      : recording_(recording),
+        maps_(recording.maps.c_str()),
+        stack_memory_(recording.stack.data(), recording.stack_start,
+                      recording.stack_start + recording.stack.size()) {
+    maps_.Parse();
+    if (recording_.dir.empty()) return;
+    for (MapInfo& map_info : maps_) {
+      if (map_info.name.empty()) continue;
+      std::string copy = recording_.dir + '/' + android::base::Basename(map_info.name);
+      if (access(copy.c_str(), R_OK) == 0) map_info.name = copy;
+    }
+  }
+
+  Regs* NewRegs() {
+    Regs* regs = CreateRegs(recording_.machine_type);
+    memcpy(regs->RawData(), recording_.regs.data(), recording_.regs.size());
+    regs->SetFromRaw();
+    return regs;
+  }
+
+  // Creates the elf of |map_info| from the mapped file, or finds it already
+  // created. Nothing but the stack was recorded, so maps without a file
+  // have no elf.
+  Elf* GetElf(MapInfo* map_info) {
+    if (!map_info->elf) {
+      Memory* memory = map_info->CreateFileMemory();
+      map_info->elf.reset(new Elf(memory != nullptr ? memory : new MemoryBuffer));
+      map_info->elf->Init();
+    }
+    return map_info->elf.get();
+  }
+
+  void ClearElfs() {
+    for (MapInfo& map_info : maps_) {
+      map_info.elf.reset();
+    }
+  }
+
+  struct Frame {
+    MapInfo* map_info;
+    uint64_t rel_pc;
+    uint64_t adjusted_rel_pc;
+  };
+
+  // Unwinds the recording, leaving where each frame is in |frames| if not null.
+  size_t Unwind(std::vector<Frame>* frames, bool symbolize) {
+    std::unique_ptr<Regs> regs(NewRegs());
+    size_t frame_num = 0;
+    for (; frame_num < kMaxFrames && regs->pc() != 0; frame_num++) {
+      MapInfo* map_info = maps_.Find(regs->pc());
+      if (map_info == nullptr) break;
+
+      Elf* elf = GetElf(map_info);
+      uint64_t rel_pc = elf->GetRelPc(regs->pc(), map_info);
+      uint64_t adjusted_rel_pc = frame_num == 0 ? rel_pc : regs->GetAdjustedPc(rel_pc, elf);
+      if (frames != nullptr) {
+        frames->push_back(Frame{map_info, rel_pc, adjusted_rel_pc});
+      }
+      if (symbolize) {
+        std::string name;
+        uint64_t func_offset;
+        elf->GetFunctionName(adjusted_rel_pc, &name, &func_offset);
+        benchmark::DoNotOptimize(name);
+      }
+
+      if (!elf->Step(rel_pc + map_info->elf_offset, regs.get(), &stack_memory_)) {
+        frame_num++;
+        break;
+      }
+    }
+    return frame_num;
+  }
+
+ private:
+  const Recording& recording_;
+  BufferMaps maps_;
+  MemoryOfflineBuffer stack_memory_;
+};
+
+static std::vector<Replay::Frame> GetFrames(benchmark::State& state, Replay* replay) {
+  std::vector<Replay::Frame> frames;
+  if (replay->Unwind(&frames, false) < 2) {
+    state.SkipWithError("The recording doesn't unwind");
+  }
+  return frames;
+}
+
+// Every iteration creates the elf objects of all of the frames again.
+static void BM_offline_elf_init(benchmark::State& state, const Recording* recording) {
+  Replay replay(*recording);
+  std::vector<Replay::Frame> frames = GetFrames(state, &replay);
+  while (state.KeepRunning()) {
+    replay.ClearElfs();
+    for (const auto& frame : frames) {
+      benchmark::DoNotOptimize(replay.GetElf(frame.map_info));
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * frames.size());
+}
+
+// Looks up the fde of each frame in its eh_frame or debug_frame.
+static void BM_offline_fde_lookup(benchmark::State& state, const Recording* recording) {
+  Replay replay(*recording);
+  std::vector<Replay::Frame> frames = GetFrames(state, &replay);
+  while (state.KeepRunning()) {
+    for (const auto& frame : frames) {
+      ElfInterface* interface = replay.GetElf(frame.map_info)->interface();
+      if (interface == nullptr || frame.rel_pc < interface->load_bias()) continue;
+      uint64_t pc = frame.rel_pc + frame.map_info->elf_offset - interface->load_bias();
+      const DwarfFde* fde = nullptr;
+      if (interface->eh_frame() != nullptr) {
+        fde = interface->eh_frame()->GetFdeFromPc(pc);
+      }
+      if (fde == nullptr && interface->debug_frame() != nullptr) {
+        fde = interface->debug_frame()->GetFdeFromPc(pc);
+      }
+      benchmark::DoNotOptimize(fde);
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * frames.size());
+}
+
+// Steps through all of the frames with every elf already created.
+static void BM_offline_step(benchmark::State& state, const Recording* recording) {
+  Replay replay(*recording);
+  std::vector<Replay::Frame> frames = GetFrames(state, &replay);
+  while (state.KeepRunning()) {
+    benchmark::DoNotOptimize(replay.Unwind(nullptr, false));
+  }
+  state.SetItemsProcessed(state.iterations() * frames.size());
+}
+
+// Finds the function name of each frame.
+static void BM_offline_symbolize(benchmark::State& state, const Recording* recording) {
+  Replay replay(*recording);
+  std::vector<Replay::Frame> frames = GetFrames(state, &replay);
+  while (state.KeepRunning()) {
+    for (const auto& frame : frames) {
+      std::string name;
+      uint64_t func_offset;
+      replay.GetElf(frame.map_info)->GetFunctionName(frame.adjusted_rel_pc, &name, &func_offset);
+      benchmark::DoNotOptimize(name);
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * frames.size());
+}
+
+// All of the above, the way a crash dump would: nothing is set up beforehand.
+static void BM_offline_unwind(benchmark::State& state, const Recording* recording) {
+  size_t frames = 0;
+  while (state.KeepRunning()) {
+    Replay replay(*recording);
+    frames = replay.Unwind(nullptr, true);
+  }
+  if (frames < 2) {
+    state.SkipWithError("The recording doesn't unwind");
+  }
+  state.SetItemsProcessed(state.iterations() * frames);
+}
+
+static void RegisterRecording(const Recording* recording) {
+  benchmark::RegisterBenchmark(("BM_offline_elf_init/" + recording->name).c_str(),
+                               BM_offline_elf_init, recording);
+  benchmark::RegisterBenchmark(("BM_offline_fde_lookup/" + recording->name).c_str(),
+                               BM_offline_fde_lookup, recording);
+  benchmark::RegisterBenchmark(("BM_offline_step/" + recording->name).c_str(), BM_offline_step,
+                               recording);
+  benchmark::RegisterBenchmark(("BM_offline_symbolize/" + recording->name).c_str(),
+                               BM_offline_symbolize, recording);
+  benchmark::RegisterBenchmark(("BM_offline_unwind/" + recording->name).c_str(),
+                               BM_offline_unwind, recording);
+}
+
+static bool RegisterRecordings() {
+  // Never freed, the benchmarks refer to them until the process exits.
+  auto recordings = new std::vector<std::unique_ptr<Recording>>;
+
+  std::unique_ptr<Recording> local(new Recording);
+  if (RecordLocal(8, local.get())) {
+    recordings->emplace_back(std::move(local));
+  }
+
+  const char* dirs = getenv("UNWINDSTACK_BENCHMARK_RECORDINGS");
+  if (dirs != nullptr) {
+    for (const auto& dir : android::base::Split(dirs, ":")) {
+      if (dir.empty()) continue;
+      std::unique_ptr<Recording> recording(new Recording);
+      if (!LoadRecording(dir, recording.get())) {
+        fprintf(stderr, "Could not load the recorded unwind in %s\n", dir.c_str());
+        continue;
+      }
+      recordings->emplace_back(std::move(recording));
+    }
+  }
+
+  for (const auto& recording : *recordings) {
+    RegisterRecording(recording.get());
+  }
+  return true;
+}
+
+static bool registered __attribute__((unused)) = RegisterRecordings();
+
+}  // namespace unwindstack
@@ -26,7 +26,12 @@
 #include <sys/types.h>
 #include <unistd.h>
 
+#include <algorithm>
+#include <memory>
 #include <string>
+#include <vector>
+
+#include <android-base/file.h>
 
 #include <unwindstack/Elf.h>
 #include <unwindstack/MapInfo.h>
@@ -92,7 +97,7 @@ void DoUnwind(pid_t pid) {
   }
   printf("\n");
 
-  unwindstack::MemoryRemote remote_memory(pid);
+  unwindstack::MemoryCache remote_memory(new unwindstack::MemoryRemote(pid));
   for (size_t frame_num = 0; frame_num < 64; frame_num++) {
     if (regs->pc() == 0) {
       break;
@@ -142,18 +147,78 @@ void DoUnwind(pid_t pid) {
   }
 }
 
+// The most stack saved by DoRecord.
+static constexpr size_t kMaxRecordedStack = 1024 * 1024;
+
+// Saves what it takes to replay the unwind offline into |dir|, in the layout
+// libunwindstack_benchmarks reads.
+bool DoRecord(pid_t pid, const std::string& dir) {
+  std::string maps_data;
+  if (!android::base::ReadFileToString("/proc/" + std::to_string(pid) + "/maps", &maps_data)) {
+    printf("Failed to read map data.\n");
+    return false;
+  }
+  unwindstack::BufferMaps maps(maps_data.c_str());
+  if (!maps.Parse()) {
+    printf("Failed to parse map data.\n");
+    return false;
+  }
+
+  uint32_t machine_type;
+  std::unique_ptr<unwindstack::Regs> regs(unwindstack::Regs::RemoteGet(pid, &machine_type));
+  if (regs == nullptr) {
+    printf("Unable to get remote reg data\n");
+    return false;
+  }
+  size_t reg_size = (machine_type == EM_ARM || machine_type == EM_386) ? sizeof(uint32_t)
+                                                                         : sizeof(uint64_t);
+  std::string regs_data(reinterpret_cast<const char*>(&machine_type), sizeof(machine_type));
+  regs_data.append(reinterpret_cast<const char*>(regs->RawData()), regs->total_regs() * reg_size);
+
+  unwindstack::MapInfo* stack_map = maps.Find(regs->sp());
+  if (stack_map == nullptr) {
+    printf("Failed to find map data for the sp\n");
+    return false;
+  }
+  uint64_t stack_start = regs->sp();
+  std::vector<char> stack(
+      std::min<uint64_t>(stack_map->end - stack_start, kMaxRecordedStack));
+  unwindstack::MemoryRemote memory(pid);
+  if (!memory.Read(stack_start, stack.data(), stack.size())) {
+    printf("Failed to read the stack.\n");
+    return false;
+  }
+  std::string stack_data(reinterpret_cast<const char*>(&stack_start), sizeof(stack_start));
+  stack_data.append(stack.data(), stack.size());
+
+  if (!android::base::WriteStringToFile(maps_data, dir + "/maps.txt") ||
+      !android::base::WriteStringToFile(regs_data, dir + "/regs.data") ||
+      !android::base::WriteStringToFile(stack_data, dir + "/stack.data")) {
+    printf("Failed to write to %s: %s\n", dir.c_str(), strerror(errno));
+    return false;
+  }
+  return true;
+}
+
 int main(int argc, char** argv) {
-  if (argc != 2) {
-    printf("Usage: unwind <PID>\n");
+  std::string record_dir;
+  if (argc == 4 && strcmp(argv[1], "-r") == 0) {
+    record_dir = argv[2];
+  } else if (argc != 2) {
+    printf("Usage: unwind [-r <DIR>] <PID>\n");
+    printf("  -r <DIR>  Also save the unwind to DIR, for libunwindstack_benchmarks.\n");
     return 1;
   }
 
-  pid_t pid = atoi(argv[1]);
+  pid_t pid = atoi(argv[argc - 1]);
   if (!Attach(pid)) {
     printf("Failed to attach to pid %d: %s\n", pid, strerror(errno));
     return 1;
   }
 
+  if (!record_dir.empty()) {
+    DoRecord(pid, record_dir);
+  }
   DoUnwind(pid);
 
   Detach(pid);
@@ -0,0 +1,514 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Samples a running process with perf_event_open and unwinds every sample
+// offline from the registers and the copy of the stack the kernel recorded,
+// so the process is never stopped with ptrace. Prints the most common stacks.
+
+#include <dirent.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <linux/perf_event.h>
+#include <poll.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/types.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <android-base/unique_fd.h>
+
+#include <unwindstack/Elf.h>
+#include <unwindstack/MapInfo.h>
+#include <unwindstack/Maps.h>
+#include <unwindstack/Memory.h>
+#include <unwindstack/Regs.h>
+
+#include "Machine.h"
+
+// Pages in each per thread ring buffer, not counting the metadata page.
+static constexpr size_t kRingPages = 32;
+// Samples waiting to be unwound, past this new samples are dropped.
+static constexpr size_t kMaxQueuedSamples = 4096;
+static constexpr size_t kMaxFrames = 64;
+
+// Which perf_event user registers are recorded, and the unwindstack register
+// each one is copied into. The perf numbering is the kernel's, from
+// asm/perf_regs.h, and samples list the registers in increasing order.
+struct PerfReg {
+  uint16_t perf_reg;
+  uint16_t reg;
+};
+
+#if defined(__aarch64__)
+static const PerfReg kPerfRegs[] = {
+    {0, unwindstack::ARM64_REG_R0},   {1, unwindstack::ARM64_REG_R1},
+    {2, unwindstack::ARM64_REG_R2},   {3, unwindstack::ARM64_REG_R3},
+    {4, unwindstack::ARM64_REG_R4},   {5, unwindstack::ARM64_REG_R5},
+    {6, unwindstack::ARM64_REG_R6},   {7, unwindstack::ARM64_REG_R7},
+    {8, unwindstack::ARM64_REG_R8},   {9, unwindstack::ARM64_REG_R9},
+    {10, unwindstack::ARM64_REG_R10}, {11, unwindstack::ARM64_REG_R11},
+    {12, unwindstack::ARM64_REG_R12}, {13, unwindstack::ARM64_REG_R13},
+    {14, unwindstack::ARM64_REG_R14}, {15, unwindstack::ARM64_REG_R15},
+    {16, unwindstack::ARM64_REG_R16}, {17, unwindstack::ARM64_REG_R17},
+    {18, unwindstack::ARM64_REG_R18}, {19, unwindstack::ARM64_REG_R19},
+    {20, unwindstack::ARM64_REG_R20}, {21, unwindstack::ARM64_REG_R21},
+    {22, unwindstack::ARM64_REG_R22}, {23, unwindstack::ARM64_REG_R23},
+    {24, unwindstack::ARM64_REG_R24}, {25, unwindstack::ARM64_REG_R25},
+    {26, unwindstack::ARM64_REG_R26}, {27, unwindstack::ARM64_REG_R27},
+    {28, unwindstack::ARM64_REG_R28}, {29, unwindstack::ARM64_REG_R29},
+    {30, unwindstack::ARM64_REG_R30}, {31, unwindstack::ARM64_REG_SP},
+    {32, unwindstack::ARM64_REG_PC},
+};
+#elif defined(__arm__)
+static const PerfReg kPerfRegs[] = {
+    {0, unwindstack::ARM_REG_R0},   {1, unwindstack::ARM_REG_R1},   {2, unwindstack::ARM_REG_R2},
+    {3, unwindstack::ARM_REG_R3},   {4, unwindstack::ARM_REG_R4},   {5, unwindstack::ARM_REG_R5},
+    {6, unwindstack::ARM_REG_R6},   {7, unwindstack::ARM_REG_R7},   {8, unwindstack::ARM_REG_R8},
+    {9, unwindstack::ARM_REG_R9},   {10, unwindstack::ARM_REG_R10}, {11, unwindstack::ARM_REG_R11},
+    {12, unwindstack::ARM_REG_R12}, {13, unwindstack::ARM_REG_SP},  {14, unwindstack::ARM_REG_LR},
+    {15, unwindstack::ARM_REG_PC},
+};
+#elif defined(__x86_64__)
+static const PerfReg kPerfRegs[] = {
+    {0, unwindstack::X86_64_REG_RAX},  {1, unwindstack::X86_64_REG_RBX},
+    {2, unwindstack::X86_64_REG_RCX},  {3, unwindstack::X86_64_REG_RDX},
+    {4, unwindstack::X86_64_REG_RSI},  {5, unwindstack::X86_64_REG_RDI},
+    {6, unwindstack::X86_64_REG_RBP},  {7, unwindstack::X86_64_REG_RSP},
+    {8, unwindstack::X86_64_REG_RIP},  {16, unwindstack::X86_64_REG_R8},
+    {17, unwindstack::X86_64_REG_R9},  {18, unwindstack::X86_64_REG_R10},
+    {19, unwindstack::X86_64_REG_R11}, {20, unwindstack::X86_64_REG_R12},
+    {21, unwindstack::X86_64_REG_R13}, {22, unwindstack::X86_64_REG_R14},
+    {23, unwindstack::X86_64_REG_R15},
+};
+#elif defined(__i386__)
+static const PerfReg kPerfRegs[] = {
+    {0, unwindstack::X86_REG_EAX}, {1, unwindstack::X86_REG_EBX}, {2, unwindstack::X86_REG_ECX},
+    {3, unwindstack::X86_REG_EDX}, {4, unwindstack::X86_REG_ESI}, {5, unwindstack::X86_REG_EDI},
+    {6, unwindstack::X86_REG_EBP}, {7, unwindstack::X86_REG_ESP}, {8, unwindstack::X86_REG_EIP},
+};
+#else
+#error "Unsupported architecture."
+#endif
+
+static constexpr size_t kNumPerfRegs = sizeof(kPerfRegs) / sizeof(kPerfRegs[0]);
+
+struct Sample {
+  pid_t tid;
+  uint64_t regs[kNumPerfRegs];
+  std::vector<uint8_t> stack;
+};
+
+struct PerfBuffer {
+  android::base::unique_fd fd;
+  void* map = nullptr;
+  size_t map_size = 0;
+};
+
+class Profiler {
+ public:
+  Profiler(pid_t pid, uint64_t frequency, uint32_t stack_size)
+      : pid_(pid), frequency_(frequency), stack_size_(stack_size), maps_(pid) {}
+
+  bool Init(size_t workers);
+  void Collect(uint64_t duration_ms);
+  void Finish();
+  void Print(size_t top);
+
+ private:
+  bool OpenThread(pid_t tid);
+  void Drain(PerfBuffer* buffer);
+  void HandleSample(const uint8_t* record, size_t size);
+  void Worker();
+  void Unwind(Sample* sample, unwindstack::Regs* regs, std::vector<std::string>* frames);
+
+  pid_t pid_;
+  uint64_t frequency_;
+  uint32_t stack_size_;
+  unwindstack::RemoteMaps maps_;
+  std::mutex maps_lock_;
+
+  std::vector<PerfBuffer> buffers_;
+  std::vector<uint8_t> record_;
+
+  std::mutex queue_lock_;
+  std::condition_variable queue_cv_;
+  std::deque<std::unique_ptr<Sample>> queue_;
+  bool done_ = false;
+  std::vector<std::thread> workers_;
+
+  std::mutex stacks_lock_;
+  std::map<std::vector<std::string>, size_t> stacks_;
+
+  size_t samples_ = 0;
+  size_t dropped_ = 0;
+  size_t lost_ = 0;
+};
+
+bool Profiler::Init(size_t workers) {
+  if (!maps_.Parse()) {
+    printf("Failed to parse the maps of %d.\n", pid_);
+    return false;
+  }
+
+  std::string task_dir = "/proc/" + std::to_string(pid_) + "/task";
+  DIR* dir = opendir(task_dir.c_str());
+  if (dir == nullptr) {
+    printf("Failed to open %s: %s\n", task_dir.c_str(), strerror(errno));
+    return false;
+  }
+  dirent* entry;
+  while ((entry = readdir(dir)) != nullptr) {
+    pid_t tid = atoi(entry->d_name);
+    if (tid != 0 && !OpenThread(tid)) {
+      printf("Failed to open perf event for thread %d: %s\n", tid, strerror(errno));
+    }
+  }
+  closedir(dir);
+  if (buffers_.empty()) {
+    return false;
+  }
+
+  for (size_t i = 0; i < workers; i++) {
+    workers_.emplace_back(&Profiler::Worker, this);
+  }
+  return true;
+}
+
+bool Profiler::OpenThread(pid_t tid) {
+  perf_event_attr attr;
+  memset(&attr, 0, sizeof(attr));
+  attr.size = sizeof(attr);
+  attr.type = PERF_TYPE_SOFTWARE;
+  attr.config = PERF_COUNT_SW_TASK_CLOCK;
+  attr.freq = 1;
+  attr.sample_freq = frequency_;
+  attr.sample_type = PERF_SAMPLE_TID | PERF_SAMPLE_REGS_USER | PERF_SAMPLE_STACK_USER;
+  for (size_t i = 0; i < kNumPerfRegs; i++) {
+    attr.sample_regs_user |= 1ULL << kPerfRegs[i].perf_reg;
+  }
+  attr.sample_stack_user = stack_size_;
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+  attr.wakeup_events = 1;
+
+  PerfBuffer buffer;
+  buffer.fd.reset(syscall(__NR_perf_event_open, &attr, tid, -1, -1, PERF_FLAG_FD_CLOEXEC));
+  if (buffer.fd == -1) {
+    return false;
+  }
+  buffer.map_size = (kRingPages + 1) * getpagesize();
+  buffer.map = mmap(nullptr, buffer.map_size, PROT_READ | PROT_WRITE, MAP_SHARED, buffer.fd, 0);
+  if (buffer.map == MAP_FAILED) {
+    return false;
+  }
+  buffers_.push_back(std::move(buffer));
+  return true;
+}
+
+void Profiler::Collect(uint64_t duration_ms) {
+  std::vector<pollfd> fds(buffers_.size());
+  for (size_t i = 0; i < buffers_.size(); i++) {
+    fds[i].fd = buffers_[i].fd;
+    fds[i].events = POLLIN;
+  }
+
+  timespec start;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  while (true) {
+    timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    uint64_t elapsed_ms = (now.tv_sec - start.tv_sec) * 1000 + now.tv_nsec / 1000000 -
+                          start.tv_nsec / 1000000;
+    if (elapsed_ms >= duration_ms) {
+      break;
+    }
+    if (poll(fds.data(), fds.size(), std::min<uint64_t>(100, duration_ms - elapsed_ms)) == -1 &&
+        errno != EINTR) {
+      break;
+    }
+    for (auto& buffer : buffers_) {
+      Drain(&buffer);
+    }
+  }
+  for (auto& buffer : buffers_) {
+    Drain(&buffer);
+  }
+}
+
+void Profiler::Drain(PerfBuffer* buffer) {
+  perf_event_mmap_page* meta = reinterpret_cast<perf_event_mmap_page*>(buffer->map);
+  const uint8_t* data = reinterpret_cast<const uint8_t*>(buffer->map) + getpagesize();
+  const size_t data_size = buffer->map_size - getpagesize();
+
+  uint64_t head = __atomic_load_n(&meta->data_head, __ATOMIC_ACQUIRE);
+  uint64_t tail = meta->data_tail;
+  while (tail + sizeof(perf_event_header) <= head) {
+    // Records can wrap around the end of the ring, copy them out first.
+    auto copy = [&](uint64_t pos, void* dst, size_t size) {
+      size_t offset = pos % data_size;
+      size_t first = std::min(size, data_size - offset);
+      memcpy(dst, &data[offset], first);
+      memcpy(reinterpret_cast<uint8_t*>(dst) + first, data, size - first);
+    };
+    perf_event_header header;
+    copy(tail, &header, sizeof(header));
+    if (header.size < sizeof(header) || tail + header.size > head) {
+      break;
+    }
+    if (header.type == PERF_RECORD_SAMPLE) {
+      record_.resize(header.size);
+      copy(tail, record_.data(), header.size);
+      HandleSample(record_.data() + sizeof(header), header.size - sizeof(header));
+    } else if (header.type == PERF_RECORD_LOST) {
+      uint64_t lost[2];
+      copy(tail + sizeof(header), lost, sizeof(lost));
+      lost_ += lost[1];
+    }
+    tail += header.size;
+  }
+  __atomic_store_n(&meta->data_tail, tail, __ATOMIC_RELEASE);
+}
+
+void Profiler::HandleSample(const uint8_t* record, size_t size) {
+  // PERF_SAMPLE_TID: u32 pid, tid
+  // PERF_SAMPLE_REGS_USER: u64 abi, u64 regs[] (regs only if abi != 0)
+  // PERF_SAMPLE_STACK_USER: u64 size, u8 data[size], u64 dyn_size (if size != 0)
+  std::unique_ptr<Sample> sample(new Sample);
+  size_t pos = 0;
+  auto read = [&](void* dst, size_t bytes) {
+    if (pos + bytes > size) {
+      return false;
+    }
+    memcpy(dst, &record[pos], bytes);
+    pos += bytes;
+    return true;
+  };
+  uint32_t ids[2];
+  uint64_t abi;
+  if (!read(ids, sizeof(ids)) || !read(&abi, sizeof(abi))) {
+    return;
+  }
+  sample->tid = ids[1];
+  if (abi == PERF_SAMPLE_REGS_ABI_NONE) {
+    // Kernel thread, or the registers were not available.
+    return;
+  }
+  uint64_t stack_size;
+  if (!read(sample->regs, sizeof(sample->regs)) || !read(&stack_size, sizeof(stack_size)) ||
+      stack_size == 0 || pos + stack_size + sizeof(uint64_t) > size) {
+    return;
+  }
+  const uint8_t* stack = &record[pos];
+  pos += stack_size;
+  uint64_t dyn_size;
+  read(&dyn_size, sizeof(dyn_size));
+  sample->stack.assign(stack, stack + std::min(stack_size, dyn_size));
+
+  samples_++;
+  std::lock_guard<std::mutex> guard(queue_lock_);
+  if (queue_.size() >= kMaxQueuedSamples) {
+    dropped_++;
+    return;
+  }
+  queue_.push_back(std::move(sample));
+  queue_cv_.notify_one();
+}
+
+void Profiler::Worker() {
+  std::unique_ptr<unwindstack::Regs> regs(unwindstack::Regs::CreateFromLocal());
+  std::vector<std::string> frames;
+  while (true) {
+    std::unique_ptr<Sample> sample;
+    {
+      std::unique_lock<std::mutex> lock(queue_lock_);
+      queue_cv_.wait(lock, [this] { return done_ || !queue_.empty(); });
+      if (queue_.empty()) {
+        return;
+      }
+      sample = std::move(queue_.front());
+      queue_.pop_front();
+    }
+
+    frames.clear();
+    Unwind(sample.get(), regs.get(), &frames);
+    std::lock_guard<std::mutex> guard(stacks_lock_);
+    stacks_[frames]++;
+  }
+}
+
+void Profiler::Unwind(Sample* sample, unwindstack::Regs* regs, std::vector<std::string>* frames) {
+  auto regs_impl = static_cast<unwindstack::RegsImpl<uintptr_t>*>(regs);
+  for (size_t i = 0; i < kNumPerfRegs; i++) {
+    (*regs_impl)[kPerfRegs[i].reg] = sample->regs[i];
+  }
+  regs->SetFromRaw();
+
+  // Everything the unwind reads out of the process has to come from the
+  // stack copy, the process keeps running.
+  uint64_t sp = regs->sp();
+  unwindstack::MemoryOfflineBuffer stack_memory(sample->stack.data(), sp,
+                                                sp + sample->stack.size());
+  for (size_t frame_num = 0; frame_num < kMaxFrames; frame_num++) {
+    if (regs->pc() == 0) {
+      break;
+    }
+    unwindstack::MapInfo* map_info;
+    unwindstack::Elf* elf;
+    {
+      std::lock_guard<std::mutex> guard(maps_lock_);
+      map_info = maps_.Find(regs->pc());
+      if (map_info == nullptr) {
+        frames->push_back("[unknown]");
+        break;
+      }
+      elf = map_info->GetElf(pid_, true);
+    }
+
+    uint64_t rel_pc = elf->GetRelPc(regs->pc(), map_info);
+    uint64_t adjusted_rel_pc = rel_pc;
+    if (frame_num != 0) {
+      adjusted_rel_pc = regs->GetAdjustedPc(rel_pc, elf);
+    }
+
+    std::string frame = map_info->name.empty() ? "[anon]" : map_info->name;
+    std::string name;
+    uint64_t func_offset;
+    if (elf->GetFunctionName(adjusted_rel_pc, &name, &func_offset)) {
+      frame += " (" + name + ")";
+    } else {
+      char pc[32];
+      snprintf(pc, sizeof(pc), " (0x%" PRIx64 ")", adjusted_rel_pc);
+      frame += pc;
+    }
+    frames->push_back(frame);
+
+    // GetRelPc already accounts for elf_offset.
+    if (!elf->Step(rel_pc, regs, &stack_memory)) {
+      break;
+    }
+  }
+}
+
+void Profiler::Finish() {
+  {
+    std::lock_guard<std::mutex> guard(queue_lock_);
+    done_ = true;
+  }
+  queue_cv_.notify_all();
+  for (auto& worker : workers_) {
+    worker.join();
+  }
+  for (auto& buffer : buffers_) {
+    munmap(buffer.map, buffer.map_size);
+  }
+}
+
+void Profiler::Print(size_t top) {
+  std::vector<std::pair<size_t, const std::vector<std::string>*>> sorted;
+  for (const auto& entry : stacks_) {
+    sorted.emplace_back(entry.second, &entry.first);
+  }
+  std::sort(sorted.begin(), sorted.end(),
+            [](const auto& a, const auto& b) { return a.first > b.first; });
+
+  printf("%zu samples, %zu dropped, %zu lost, %zu distinct stacks\n", samples_, dropped_, lost_,
+         stacks_.size());
+  size_t unwound = samples_ - dropped_;
+  for (size_t i = 0; i < std::min(top, sorted.size()); i++) {
+    printf("\n%zu samples (%.1f%%)\n", sorted[i].first,
+           unwound ? 100.0 * sorted[i].first / unwound : 0.0);
+    const std::vector<std::string>& frames = *sorted[i].second;
+    for (size_t frame_num = 0; frame_num < frames.size(); frame_num++) {
+      printf("  #%02zu %s\n", frame_num, frames[frame_num].c_str());
+    }
+  }
+}
+
+static void Usage() {
+  printf("Usage: unwind_sample [-f FREQ] [-d SECONDS] [-j WORKERS] [-n TOP] [-s STACK] <PID>\n");
+  printf("  -f  samples per second for each thread (default 1000)\n");
+  printf("  -d  how long to sample for (default 5)\n");
+  printf("  -j  unwinding threads (default the number of cpus)\n");
+  printf("  -n  how many of the most common stacks to print (default 20)\n");
+  printf("  -s  bytes of stack copied with each sample (default 16384, max 65528)\n");
+  printf("Only the threads running when sampling starts are sampled, and the\n");
+  printf("process must use the same abi as this tool.\n");
+}
+
+int main(int argc, char** argv) {
+  uint64_t frequency = 1000;
+  uint64_t seconds = 5;
+  size_t workers = std::max<size_t>(1, std::thread::hardware_concurrency());
+  size_t top = 20;
+  uint32_t stack_size = 16384;
+  int opt;
+  while ((opt = getopt(argc, argv, "f:d:j:n:s:")) != -1) {
+    switch (opt) {
+      case 'f':
+        frequency = strtoull(optarg, nullptr, 10);
+        break;
+      case 'd':
+        seconds = strtoull(optarg, nullptr, 10);
+        break;
+      case 'j':
+        workers = std::max<size_t>(1, strtoul(optarg, nullptr, 10));
+        break;
+      case 'n':
+        top = strtoul(optarg, nullptr, 10);
+        break;
+      case 's':
+        // Must be a multiple of 8 and fit in a perf record.
+        stack_size = std::min<unsigned long>(65528, strtoul(optarg, nullptr, 10)) & ~7U;
+        break;
+      default:
+        Usage();
+        return 1;
+    }
+  }
+  if (optind != argc - 1 || frequency == 0 || stack_size == 0) {
+    Usage();
+    return 1;
+  }
+  pid_t pid = atoi(argv[optind]);
+
+  // Every sample unwinds through the same libraries.
+  unwindstack::Elf::SetCachingEnabled(true);
+
+  Profiler profiler(pid, frequency, stack_size);
+  if (!profiler.Init(workers)) {
+    return 1;
+  }
+  profiler.Collect(seconds * 1000);
+  profiler.Finish();
+  profiler.Print(top);
+  return 0;
+}
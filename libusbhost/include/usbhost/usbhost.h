@@ -241,6 +241,69 @@ struct usb_request *usb_request_wait(struct usb_device *dev, int timeoutMillis);
 /* Cancels a pending usb_request_queue() operation. */
 int usb_request_cancel(struct usb_request *req);
 
+/* Streaming transfers: a usb_stream keeps num_requests requests queued on one
+ * bulk or interrupt endpoint, handing each to a callback as it completes and
+ * queueing it again, so that the bus never waits on the client between
+ * transfers.
+ *
+ * The callback is passed each request as it comes back, with status 0 or a
+ * negative errno, and the data in req->buffer[0..req->actual_length). For an
+ * IN endpoint it returns >= 0 to queue the request again for a full buffer.
+ * For an OUT endpoint it fills req->buffer and returns how many bytes to send;
+ * it is also called once for every request before the first one is sent, with
+ * actual_length 0. A negative return retires the request.
+ *
+ * Completions are dispatched by usb_device_process_streams on the thread that
+ * calls it; streams must not be shared between threads. A device whose streams
+ * are running must not use usb_request_wait, which would reap their requests,
+ * and the streams' requests' client_data is the library's.
+ */
+struct usb_stream;
+
+typedef int (* usb_stream_cb)(struct usb_stream *stream, struct usb_request *req,
+                              int status, void *client_data);
+
+struct usb_stream_stats {
+    uint64_t bytes;         /* transferred by requests that succeeded */
+    uint64_t requests;      /* completed, successfully or not */
+    uint64_t errors;        /* completed with an error, or failed to queue */
+    uint64_t elapsed_us;    /* since usb_stream_start */
+    uint64_t bytes_per_sec; /* bytes / elapsed */
+};
+
+/* Creates a stream of num_requests requests of request_size bytes each on the
+ * endpoint ep_desc describes. request_size is capped as for usb_request_queue.
+ * Returns NULL for error.
+ */
+struct usb_stream *usb_stream_new(struct usb_device *dev,
+        const struct usb_endpoint_descriptor *ep_desc, int num_requests,
+        int request_size, usb_stream_cb cb, void *client_data);
+
+/* Queues all of the stream's requests. Returns 0, or negative value for error. */
+int usb_stream_start(struct usb_stream *stream);
+
+/* Cancels the stream's queued requests. They still come back through
+ * usb_device_process_streams, with an error status, but are not queued again.
+ */
+void usb_stream_stop(struct usb_stream *stream);
+
+/* Returns the number of the stream's requests queued and not yet completed. */
+int usb_stream_in_flight(struct usb_stream *stream);
+
+/* Copies the stream's throughput statistics into stats. */
+void usb_stream_get_stats(struct usb_stream *stream, struct usb_stream_stats *stats);
+
+/* Frees a stream with no requests in flight. */
+void usb_stream_free(struct usb_stream *stream);
+
+/* Waits up to timeoutMillis (-1 to wait forever, 0 not to wait) for the
+ * device's streams' requests to complete, and dispatches all of those that
+ * have. To wait on many devices, poll or epoll their fds for POLLOUT and call
+ * this with 0 when one is ready.
+ * Returns the number of requests dispatched, or negative value for error.
+ */
+int usb_device_process_streams(struct usb_device *dev, int timeoutMillis);
+
 #ifdef __cplusplus
 }
 #endif
@@ -38,6 +38,7 @@
 #include <unistd.h>
 #include <string.h>
 #include <stddef.h>
+#include <time.h>
 
 #include <sys/ioctl.h>
 #include <sys/types.h>
@@ -727,3 +728,181 @@ int usb_request_cancel(struct usb_request *req)
     struct usbdevfs_urb *urb = ((struct usbdevfs_urb*)req->private_data);
     return ioctl(req->dev->fd, USBDEVFS_DISCARDURB, urb);
 }
+
+struct usb_stream {
+    struct usb_device *dev;
+    usb_stream_cb cb;
+    void *client_data;
+    int is_in;
+    int request_size;
+    int num_requests;
+    int in_flight;
+    int stopping;
+    uint64_t start_us;
+    struct usb_stream_stats stats;
+    struct usb_request *requests[];
+};
+
+static uint64_t usb_stream_now_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+struct usb_stream *usb_stream_new(struct usb_device *dev,
+        const struct usb_endpoint_descriptor *ep_desc, int num_requests,
+        int request_size, usb_stream_cb cb, void *client_data)
+{
+    if (num_requests <= 0 || request_size <= 0 || !cb)
+        return NULL;
+    if (request_size > MAX_USBFS_BUFFER_SIZE)
+        request_size = MAX_USBFS_BUFFER_SIZE;
+
+    struct usb_stream *stream = calloc(1, sizeof(struct usb_stream) +
+                                       num_requests * sizeof(struct usb_request *));
+    if (!stream)
+        return NULL;
+
+    stream->dev = dev;
+    stream->cb = cb;
+    stream->client_data = client_data;
+    stream->is_in = (ep_desc->bEndpointAddress & USB_ENDPOINT_DIR_MASK) == USB_DIR_IN;
+    stream->request_size = request_size;
+
+    for (int i = 0; i < num_requests; i++) {
+        struct usb_request *req = usb_request_new(dev, ep_desc);
+        if (!req) {
+            usb_stream_free(stream);
+            return NULL;
+        }
+        req->buffer = malloc(request_size);
+        if (!req->buffer) {
+            usb_request_free(req);
+            usb_stream_free(stream);
+            return NULL;
+        }
+        req->buffer_length = request_size;
+        req->client_data = stream;
+        stream->requests[stream->num_requests++] = req;
+    }
+    return stream;
+}
+
+/* Hands req to the client and queues it again if it wants. */
+static void usb_stream_refill(struct usb_stream *stream, struct usb_request *req, int status)
+{
+    int len = stream->cb(stream, req, status, stream->client_data);
+    if (len < 0 || stream->stopping)
+        return;
+
+    if (stream->is_in)
+        req->buffer_length = stream->request_size;
+    else
+        req->buffer_length = len < stream->request_size ? len : stream->request_size;
+
+    if (usb_request_queue(req) < 0) {
+        D("[ stream queue on ep 0x%x - error %d]\n", req->endpoint, errno);
+        stream->stats.errors++;
+        return;
+    }
+    stream->in_flight++;
+}
+
+int usb_stream_start(struct usb_stream *stream)
+{
+    stream->stopping = 0;
+    stream->start_us = usb_stream_now_us();
+    memset(&stream->stats, 0, sizeof(stream->stats));
+
+    for (int i = 0; i < stream->num_requests; i++) {
+        struct usb_request *req = stream->requests[i];
+        if (stream->is_in) {
+            req->buffer_length = stream->request_size;
+            if (usb_request_queue(req) < 0) {
+                int saved_errno = errno;
+                usb_stream_stop(stream);
+                errno = saved_errno;
+                return -1;
+            }
+            stream->in_flight++;
+        } else {
+            req->actual_length = 0;
+            usb_stream_refill(stream, req, 0);
+        }
+    }
+    return 0;
+}
+
+void usb_stream_stop(struct usb_stream *stream)
+{
+    stream->stopping = 1;
+    for (int i = 0; i < stream->num_requests; i++) {
+        /* fails harmlessly for those that are not queued */
+        usb_request_cancel(stream->requests[i]);
+    }
+}
+
+int usb_stream_in_flight(struct usb_stream *stream)
+{
+    return stream->in_flight;
+}
+
+void usb_stream_get_stats(struct usb_stream *stream, struct usb_stream_stats *stats)
+{
+    *stats = stream->stats;
+    stats->elapsed_us = stream->start_us ? usb_stream_now_us() - stream->start_us : 0;
+    stats->bytes_per_sec = stats->elapsed_us ?
+            stats->bytes * 1000000 / stats->elapsed_us : 0;
+}
+
+void usb_stream_free(struct usb_stream *stream)
+{
+    for (int i = 0; i < stream->num_requests; i++) {
+        free(stream->requests[i]->buffer);
+        usb_request_free(stream->requests[i]);
+    }
+    free(stream);
+}
+
+int usb_device_process_streams(struct usb_device *dev, int timeoutMillis)
+{
+    int count = 0;
+
+    if (timeoutMillis != 0) {
+        struct pollfd p = {.fd = dev->fd, .events = POLLOUT, .revents = 0};
+        int res = TEMP_FAILURE_RETRY(poll(&p, 1, timeoutMillis));
+        if (res < 0)
+            return -1;
+        if (res == 0)
+            return 0;
+    }
+
+    /* take everything that has completed, not one per wakeup */
+    while (1) {
+        struct usbdevfs_urb *urb = NULL;
+        int res = TEMP_FAILURE_RETRY(ioctl(dev->fd, USBDEVFS_REAPURBNDELAY, &urb));
+        if (res < 0) {
+            if (errno == EAGAIN)
+                break;
+            D("[ stream reap urb - error %d]\n", errno);
+            return count ? count : -1;
+        }
+
+        struct usb_request *req = (struct usb_request*)urb->usercontext;
+        struct usb_stream *stream = (struct usb_stream*)req->client_data;
+        req->actual_length = urb->actual_length;
+
+        stream->in_flight--;
+        stream->stats.requests++;
+        if (urb->status == 0)
+            stream->stats.bytes += urb->actual_length;
+        else
+            stream->stats.errors++;
+        count++;
+
+        usb_stream_refill(stream, req, urb->status);
+    }
+    return count;
+}
+
@@ -18,13 +18,22 @@
 
 #include <utils/CallStack.h>
 
+#include <unistd.h>
+
 #include <memory>
 
 #include <utils/Printer.h>
 #include <utils/Errors.h>
 #include <utils/Log.h>
+#include <utils/Mutex.h>
 
 #include <backtrace/Backtrace.h>
+#include <backtrace/BacktraceMap.h>
+
+#if defined(__linux__)
+#include <link.h>
+#include <unwind.h>
+#endif
 
 namespace android {
 
@@ -41,6 +50,7 @@ CallStack::~CallStack() {
 
 void CallStack::update(int32_t ignoreDepth, pid_t tid) {
     mFrameLines.clear();
+    mPcCount = 0;
 
     std::unique_ptr<Backtrace> backtrace(Backtrace::Create(BACKTRACE_CURRENT_PROCESS, tid));
     if (!backtrace->Unwind(ignoreDepth)) {
@@ -51,6 +61,112 @@ void CallStack::update(int32_t ignoreDepth, pid_t tid) {
     }
 }
 
+#if defined(__linux__)
+
+// What is loaded where.  Hashed rather than counted, so that one library going
+// and another coming in its place still gives a different value.
+static int mapGenerationCallback(struct dl_phdr_info* info, size_t, void* data) {
+    size_t* generation = reinterpret_cast<size_t*>(data);
+    *generation = (*generation ^ info->dlpi_addr) * 1099511628211u + 1;
+    return 0;
+}
+
+static size_t mapGeneration() {
+    size_t generation = 0;
+    dl_iterate_phdr(mapGenerationCallback, &generation);
+    return generation;
+}
+
+struct CaptureState {
+    uintptr_t* pcs;
+    size_t count;
+    size_t max;
+    int32_t ignoreDepth;
+};
+
+static _Unwind_Reason_Code captureCallback(struct _Unwind_Context* context, void* data) {
+    CaptureState* state = reinterpret_cast<CaptureState*>(data);
+    uintptr_t pc = _Unwind_GetIP(context);
+    if (pc == 0) {
+        return _URC_END_OF_STACK;
+    }
+    if (state->ignoreDepth > 0) {
+        state->ignoreDepth--;
+        return _URC_NO_REASON;
+    }
+    state->pcs[state->count++] = pc;
+    return state->count < state->max ? _URC_NO_REASON : _URC_END_OF_STACK;
+}
+
+// One map of the process, and one Backtrace to look names up with, for every
+// CallStack to symbolize against.  Rebuilt when libraries have come or gone.
+// Never freed, a stack may be printed from a static destructor.
+static Mutex& gSymbolizerLock = *new Mutex();
+static BacktraceMap* gSymbolizerMap = nullptr;
+static Backtrace* gSymbolizer = nullptr;
+static size_t gSymbolizerGeneration = 0;
+
+void CallStack::capture(int32_t ignoreDepth) {
+    mFrameLines.clear();
+
+    // Not counting capture() itself.
+    CaptureState state = { mPcs, 0, kMaxCapturedFrames, ignoreDepth + 1 };
+    _Unwind_Backtrace(captureCallback, &state);
+    mPcCount = state.count;
+    mMapGeneration = mapGeneration();
+}
+
+void CallStack::symbolize() const {
+    Mutex::Autolock _l(gSymbolizerLock);
+    if (mPcCount == 0) {
+        return;
+    }
+
+    size_t generation = mapGeneration();
+    if (gSymbolizer == nullptr || generation != gSymbolizerGeneration) {
+        delete gSymbolizer;
+        delete gSymbolizerMap;
+        gSymbolizerMap = BacktraceMap::Create(getpid());
+        gSymbolizer = Backtrace::Create(BACKTRACE_CURRENT_PROCESS, BACKTRACE_CURRENT_THREAD,
+                                        gSymbolizerMap);
+        gSymbolizerGeneration = generation;
+    }
+
+    for (size_t i = 0; i < mPcCount; i++) {
+        backtrace_frame_data_t frame;
+        frame.num = i;
+        frame.pc = mPcs[i];
+        frame.sp = 0;
+        frame.stack_size = 0;
+        frame.func_offset = 0;
+        gSymbolizer->FillInMap(frame.pc, &frame.map);
+        if (BacktraceMap::IsValid(frame.map)) {
+            frame.rel_pc = frame.pc - frame.map.start + frame.map.load_bias;
+            frame.func_name = gSymbolizer->GetFunctionName(frame.pc, &frame.func_offset,
+                                                           &frame.map);
+        } else {
+            frame.rel_pc = frame.pc;
+        }
+        String8 line(gSymbolizer->FormatFrameData(&frame).c_str());
+        if (!BacktraceMap::IsValid(frame.map) && generation != mMapGeneration) {
+            line.append(" (unloaded since captured)");
+        }
+        mFrameLines.push_back(line);
+    }
+    mPcCount = 0;
+}
+
+#else
+
+void CallStack::capture(int32_t ignoreDepth) {
+    update(ignoreDepth + 1);
+}
+
+void CallStack::symbolize() const {
+}
+
+#endif
+
 void CallStack::log(const char* logtag, android_LogPriority priority, const char* prefix) const {
     LogPrinter printer(logtag, priority, prefix, /*ignoreBlankLines*/false);
     print(printer);
@@ -71,6 +187,7 @@ String8 CallStack::toString(const char* prefix) const {
 }
 
 void CallStack::print(Printer& printer) const {
+    symbolize();
     for (size_t i = 0; i < mFrameLines.size(); i++) {
         printer.printLine(mFrameLines[i]);
     }
@@ -16,6 +16,8 @@
 #include <utils/Looper.h>
 #include <sys/eventfd.h>
 
+#include <algorithm>
+
 namespace android {
 
 // --- WeakMessageHandler ---
@@ -57,11 +59,14 @@ static const int EPOLL_SIZE_HINT = 8;
 // Maximum number of file descriptors for which to retrieve poll events each iteration.
 static const int EPOLL_MAX_EVENTS = 16;
 
+// Initial number of slots in the file descriptor table, must be a power of two.
+static const size_t REQUEST_SLOTS_MIN = 16;
+
 static pthread_once_t gTLSOnce = PTHREAD_ONCE_INIT;
 static pthread_key_t gTLSKey = 0;
 
 Looper::Looper(bool allowNonCallbacks) :
-        mAllowNonCallbacks(allowNonCallbacks), mSendingMessage(false),
+        mAllowNonCallbacks(allowNonCallbacks), mNextMessageSeq(0), mSendingMessage(false),
         mPolling(false), mEpollFd(-1), mEpollRebuildRequired(false),
         mNextRequestSeq(0), mResponseIndex(0), mNextMessageUptime(LLONG_MAX) {
     mWakeEventFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
@@ -153,7 +158,7 @@ void Looper::rebuildEpollLocked() {
                         strerror(errno));
 
     for (size_t i = 0; i < mRequests.size(); i++) {
-        const Request& request = mRequests.valueAt(i);
+        const Request& request = mRequests.itemAt(i);
         struct epoll_event eventItem;
         request.initEventItem(&eventItem);
 
@@ -288,14 +293,14 @@ int Looper::pollInner(int timeoutMillis) {
                 ALOGW("Ignoring unexpected epoll events 0x%x on wake event fd.", epollEvents);
             }
         } else {
-            ssize_t requestIndex = mRequests.indexOfKey(fd);
+            ssize_t requestIndex = findRequestLocked(fd);
             if (requestIndex >= 0) {
                 int events = 0;
                 if (epollEvents & EPOLLIN) events |= EVENT_INPUT;
                 if (epollEvents & EPOLLOUT) events |= EVENT_OUTPUT;
                 if (epollEvents & EPOLLERR) events |= EVENT_ERROR;
                 if (epollEvents & EPOLLHUP) events |= EVENT_HANGUP;
-                pushResponse(events, mRequests.valueAt(requestIndex));
+                pushResponse(events, mRequests.itemAt(requestIndex));
             } else {
                 ALOGW("Ignoring unexpected epoll events 0x%x on fd %d that is "
                         "no longer registered.", epollEvents, fd);
@@ -317,7 +322,9 @@ Done: ;
             { // obtain handler
                 sp<MessageHandler> handler = messageEnvelope.handler;
                 Message message = messageEnvelope.message;
-                mMessageEnvelopes.removeAt(0);
+                std::pop_heap(mMessageEnvelopes.begin(), mMessageEnvelopes.end(),
+                        isMessageLater);
+                mMessageEnvelopes.removeAt(mMessageEnvelopes.size() - 1);
                 mSendingMessage = true;
                 mLock.unlock();
 
@@ -465,14 +472,14 @@ int Looper::addFd(int fd, int ident, int events, const sp<LooperCallback>& callb
         struct epoll_event eventItem;
         request.initEventItem(&eventItem);
 
-        ssize_t requestIndex = mRequests.indexOfKey(fd);
+        ssize_t requestIndex = findRequestLocked(fd);
         if (requestIndex < 0) {
             int epollResult = epoll_ctl(mEpollFd, EPOLL_CTL_ADD, fd, & eventItem);
             if (epollResult < 0) {
                 ALOGE("Error adding epoll events for fd %d: %s", fd, strerror(errno));
                 return -1;
             }
-            mRequests.add(fd, request);
+            addRequestLocked(request);
         } else {
             int epollResult = epoll_ctl(mEpollFd, EPOLL_CTL_MOD, fd, & eventItem);
             if (epollResult < 0) {
@@ -507,7 +514,7 @@ int Looper::addFd(int fd, int ident, int events, const sp<LooperCallback>& callb
                     return -1;
                 }
             }
-            mRequests.replaceValueAt(requestIndex, request);
+            mRequests.replaceAt(request, requestIndex);
         }
     } // release lock
     return 1;
@@ -524,23 +531,30 @@ int Looper::removeFd(int fd, int seq) {
 
     { // acquire lock
         AutoMutex _l(mLock);
-        ssize_t requestIndex = mRequests.indexOfKey(fd);
+        ssize_t requestIndex = findRequestLocked(fd);
         if (requestIndex < 0) {
             return 0;
         }
 
         // Check the sequence number if one was given.
-        if (seq != -1 && mRequests.valueAt(requestIndex).seq != seq) {
+        if (seq != -1 && mRequests.itemAt(requestIndex).seq != seq) {
 #if DEBUG_CALLBACKS
             ALOGD("%p ~ removeFd - sequence number mismatch, oldSeq=%d",
-                    this, mRequests.valueAt(requestIndex).seq);
+                    this, mRequests.itemAt(requestIndex).seq);
 #endif
             return 0;
         }
 
         // Always remove the FD from the request map even if an error occurs while
         // updating the epoll set so that we avoid accidentally leaking callbacks.
-        mRequests.removeItemsAt(requestIndex);
+        removeRequestAtLocked(requestIndex);
+
+        // The epoll set is about to be replaced by one built from mRequests, so there
+        // is nothing to remove it from.  This batches all of the updates made while a
+        // rebuild is pending into the rebuild itself.
+        if (mEpollRebuildRequired) {
+            return 1;
+        }
 
         int epollResult = epoll_ctl(mEpollFd, EPOLL_CTL_DEL, fd, NULL);
         if (epollResult < 0) {
@@ -593,17 +607,14 @@ void Looper::sendMessageAtTime(nsecs_t uptime, const sp<MessageHandler>& handler
             this, uptime, handler.get(), message.what);
 #endif
 
-    size_t i = 0;
+    bool isHead;
     { // acquire lock
         AutoMutex _l(mLock);
 
-        size_t messageCount = mMessageEnvelopes.size();
-        while (i < messageCount && uptime >= mMessageEnvelopes.itemAt(i).uptime) {
-            i += 1;
-        }
-
-        MessageEnvelope messageEnvelope(uptime, handler, message);
-        mMessageEnvelopes.insertAt(messageEnvelope, i, 1);
+        uint64_t seq = mNextMessageSeq++;
+        mMessageEnvelopes.push(MessageEnvelope(uptime, seq, handler, message));
+        std::push_heap(mMessageEnvelopes.begin(), mMessageEnvelopes.end(), isMessageLater);
+        isHead = mMessageEnvelopes.itemAt(0).seq == seq;
 
         // Optimization: If the Looper is currently sending a message, then we can skip
         // the call to wake() because the next thing the Looper will do after processing
@@ -615,7 +626,7 @@ void Looper::sendMessageAtTime(nsecs_t uptime, const sp<MessageHandler>& handler
     } // release lock
 
     // Wake the poll loop only when we enqueue a new message at the head.
-    if (i == 0) {
+    if (isHead) {
         wake();
     }
 }
@@ -628,12 +639,9 @@ void Looper::removeMessages(const sp<MessageHandler>& handler) {
     { // acquire lock
         AutoMutex _l(mLock);
 
-        for (size_t i = mMessageEnvelopes.size(); i != 0; ) {
-            const MessageEnvelope& messageEnvelope = mMessageEnvelopes.itemAt(--i);
-            if (messageEnvelope.handler == handler) {
-                mMessageEnvelopes.removeAt(i);
-            }
-        }
+        removeMessagesLocked([&](const MessageEnvelope& messageEnvelope) {
+            return messageEnvelope.handler == handler;
+        });
     } // release lock
 }
 
@@ -645,16 +653,89 @@ void Looper::removeMessages(const sp<MessageHandler>& handler, int what) {
     { // acquire lock
         AutoMutex _l(mLock);
 
-        for (size_t i = mMessageEnvelopes.size(); i != 0; ) {
-            const MessageEnvelope& messageEnvelope = mMessageEnvelopes.itemAt(--i);
-            if (messageEnvelope.handler == handler
-                    && messageEnvelope.message.what == what) {
-                mMessageEnvelopes.removeAt(i);
-            }
-        }
+        removeMessagesLocked([&](const MessageEnvelope& messageEnvelope) {
+            return messageEnvelope.handler == handler
+                    && messageEnvelope.message.what == what;
+        });
     } // release lock
 }
 
+bool Looper::isMessageLater(const MessageEnvelope& a, const MessageEnvelope& b) {
+    return a.isLaterThan(b);
+}
+
+template <typename Predicate>
+void Looper::removeMessagesLocked(Predicate predicate) {
+    // Compact the messages that are kept in one pass and then restore the heap, rather
+    // than removing matches one at a time, which would shift the rest each time.
+    MessageEnvelope* begin = mMessageEnvelopes.begin();
+    MessageEnvelope* end = std::remove_if(begin, mMessageEnvelopes.end(), predicate);
+    size_t removed = mMessageEnvelopes.end() - end;
+    if (removed != 0) {
+        mMessageEnvelopes.removeItemsAt(end - begin, removed);
+        std::make_heap(mMessageEnvelopes.begin(), mMessageEnvelopes.end(), isMessageLater);
+    }
+}
+
+size_t Looper::findRequestSlotLocked(int fd) const {
+    // Descriptors are small and densely allocated so they are their own hash.  There
+    // is always an empty slot so the probe terminates.
+    size_t mask = mRequestSlots.size() - 1;
+    for (size_t slot = size_t(fd) & mask; ; slot = (slot + 1) & mask) {
+        ssize_t requestIndex = mRequestSlots.itemAt(slot);
+        if (requestIndex < 0 || mRequests.itemAt(requestIndex).fd == fd) {
+            return slot;
+        }
+    }
+}
+
+ssize_t Looper::findRequestLocked(int fd) const {
+    if (mRequestSlots.isEmpty()) {
+        return -1;
+    }
+    return mRequestSlots.itemAt(findRequestSlotLocked(fd));
+}
+
+void Looper::addRequestLocked(const Request& request) {
+    // Keep the table at most half full.
+    if ((mRequests.size() + 1) * 2 > mRequestSlots.size()) {
+        size_t slots = std::max(REQUEST_SLOTS_MIN, mRequestSlots.size() * 2);
+        mRequestSlots.clear();
+        mRequestSlots.insertAt(-1, 0, slots);
+        for (size_t i = 0; i < mRequests.size(); i++) {
+            mRequestSlots.editItemAt(findRequestSlotLocked(mRequests.itemAt(i).fd)) = i;
+        }
+    }
+
+    mRequestSlots.editItemAt(findRequestSlotLocked(request.fd)) = mRequests.size();
+    mRequests.push(request);
+}
+
+void Looper::removeRequestAtLocked(size_t requestIndex) {
+    // Empty the slot, then move back any later entries in the same run that would
+    // no longer be reachable from their home slot.
+    size_t mask = mRequestSlots.size() - 1;
+    size_t hole = findRequestSlotLocked(mRequests.itemAt(requestIndex).fd);
+    for (size_t slot = (hole + 1) & mask; mRequestSlots.itemAt(slot) >= 0;
+            slot = (slot + 1) & mask) {
+        size_t home = size_t(mRequests.itemAt(mRequestSlots.itemAt(slot)).fd) & mask;
+        if (((slot - home) & mask) >= ((slot - hole) & mask)) {
+            mRequestSlots.editItemAt(hole) = mRequestSlots.itemAt(slot);
+            hole = slot;
+        }
+    }
+    mRequestSlots.editItemAt(hole) = -1;
+
+    // Fill the gap in the request array with the last request.
+    size_t lastIndex = mRequests.size() - 1;
+    if (requestIndex != lastIndex) {
+        mRequests.editItemAt(requestIndex) = mRequests.itemAt(lastIndex);
+        mRequestSlots.editItemAt(findRequestSlotLocked(mRequests.itemAt(requestIndex).fd)) =
+                requestIndex;
+    }
+    mRequests.removeAt(lastIndex);
+}
+
 bool Looper::isPolling() const {
     return mPolling;
 }
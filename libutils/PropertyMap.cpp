@@ -18,6 +18,10 @@
 
 #include <utils/PropertyMap.h>
 
+#include <string.h>
+
+#include <algorithm>
+
 // Enables debug output for the parser.
 #define DEBUG_PARSER 0
 
@@ -33,6 +37,37 @@ static const char* WHITESPACE_OR_PROPERTY_DELIMITER = " \t\r=";
 
 // --- PropertyMap ---
 
+static int compareKeys(const char* a, size_t aLength, const char* b, size_t bLength) {
+    int result = memcmp(a, b, aLength < bLength ? aLength : bLength);
+    if (result == 0 && aLength != bLength) {
+        result = aLength < bLength ? -1 : 1;
+    }
+    return result;
+}
+
+// strtol() and strtof() want a null terminated string, where a loaded value is
+// followed by the rest of the file.
+class ValueString {
+public:
+    ValueString(const char* value, size_t length) {
+        if (length < sizeof(mShort)) {
+            memcpy(mShort, value, length);
+            mShort[length] = '\0';
+            mString = mShort;
+        } else {
+            mLong.setTo(value, length);
+            mString = mLong.string();
+        }
+    }
+
+    const char* string() const { return mString; }
+
+private:
+    char mShort[32];
+    String8 mLong;
+    const char* mString;
+};
+
 PropertyMap::PropertyMap() {
 }
 
@@ -41,23 +76,71 @@ PropertyMap::~PropertyMap() {
 
 void PropertyMap::clear() {
     mProperties.clear();
+    mLoaded.clear();
+    mSource.reset();
 }
 
 void PropertyMap::addProperty(const String8& key, const String8& value) {
+    materialize();
     mProperties.add(key, value);
 }
 
 bool PropertyMap::hasProperty(const String8& key) const {
+    if (!mLoaded.empty()) {
+        return findLoaded(key) != NULL;
+    }
     return mProperties.indexOfKey(key) >= 0;
 }
 
-bool PropertyMap::tryGetProperty(const String8& key, String8& outValue) const {
+const PropertyMap::LoadedProperty* PropertyMap::findLoaded(const String8& key) const {
+    size_t low = 0;
+    size_t high = mLoaded.size();
+    while (low < high) {
+        size_t mid = low + (high - low) / 2;
+        const LoadedProperty& property = mLoaded[mid];
+        int result = compareKeys(property.key, property.keyLength, key.string(), key.length());
+        if (result == 0) {
+            return &property;
+        }
+        if (result < 0) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    return NULL;
+}
+
+bool PropertyMap::tryGetValue(const String8& key, const char** outValue,
+        size_t* outLength) const {
+    if (!mLoaded.empty()) {
+        const LoadedProperty* property = findLoaded(key);
+        if (!property) {
+            return false;
+        }
+        *outValue = property->value;
+        *outLength = property->valueLength;
+        return true;
+    }
+
     ssize_t index = mProperties.indexOfKey(key);
     if (index < 0) {
         return false;
     }
+    const String8& value = mProperties.valueAt(index);
+    *outValue = value.string();
+    *outLength = value.length();
+    return true;
+}
+
+bool PropertyMap::tryGetProperty(const String8& key, String8& outValue) const {
+    const char* value;
+    size_t length;
+    if (!tryGetValue(key, &value, &length)) {
+        return false;
+    }
 
-    outValue = mProperties.valueAt(index);
+    outValue.setTo(value, length);
     return true;
 }
 
@@ -72,11 +155,13 @@ bool PropertyMap::tryGetProperty(const String8& key, bool& outValue) const {
 }
 
 bool PropertyMap::tryGetProperty(const String8& key, int32_t& outValue) const {
-    String8 stringValue;
-    if (! tryGetProperty(key, stringValue) || stringValue.length() == 0) {
+    const char* rawValue;
+    size_t length;
+    if (!tryGetValue(key, &rawValue, &length) || length == 0) {
         return false;
     }
 
+    ValueString stringValue(rawValue, length);
     char* end;
     int value = strtol(stringValue.string(), & end, 10);
     if (*end != '\0') {
@@ -89,11 +174,13 @@ bool PropertyMap::tryGetProperty(const String8& key, int32_t& outValue) const {
 }
 
 bool PropertyMap::tryGetProperty(const String8& key, float& outValue) const {
-    String8 stringValue;
-    if (! tryGetProperty(key, stringValue) || stringValue.length() == 0) {
+    const char* rawValue;
+    size_t length;
+    if (!tryGetValue(key, &rawValue, &length) || length == 0) {
         return false;
     }
 
+    ValueString stringValue(rawValue, length);
     char* end;
     float value = strtof(stringValue.string(), & end);
     if (*end != '\0') {
@@ -106,9 +193,30 @@ bool PropertyMap::tryGetProperty(const String8& key, float& outValue) const {
 }
 
 void PropertyMap::addAll(const PropertyMap* map) {
-    for (size_t i = 0; i < map->mProperties.size(); i++) {
-        mProperties.add(map->mProperties.keyAt(i), map->mProperties.valueAt(i));
+    materialize();
+    const KeyedVector<String8, String8>& properties = map->getProperties();
+    for (size_t i = 0; i < properties.size(); i++) {
+        mProperties.add(properties.keyAt(i), properties.valueAt(i));
+    }
+}
+
+const KeyedVector<String8, String8>& PropertyMap::getProperties() const {
+    materialize();
+    return mProperties;
+}
+
+void PropertyMap::materialize() const {
+    if (mLoaded.empty()) {
+        return;
     }
+
+    mProperties.setCapacity(mLoaded.size());
+    for (const LoadedProperty& property : mLoaded) {
+        mProperties.add(String8(property.key, property.keyLength),
+                String8(property.value, property.valueLength));
+    }
+    mLoaded.clear();
+    mSource.reset();
 }
 
 status_t PropertyMap::load(const String8& filename, PropertyMap** outMap) {
@@ -123,10 +231,13 @@ status_t PropertyMap::load(const String8& filename, PropertyMap** outMap) {
         if (!map) {
             ALOGE("Error allocating property map.");
             status = NO_MEMORY;
+            delete tokenizer;
         } else {
 #if DEBUG_PARSER_PERFORMANCE
             nsecs_t startTime = systemTime(SYSTEM_TIME_MONOTONIC);
 #endif
+            // The loaded keys and values point into the tokenizer's buffer.
+            map->mSource.reset(tokenizer);
             Parser parser(map, tokenizer);
             status = parser.parse();
 #if DEBUG_PARSER_PERFORMANCE
@@ -138,10 +249,12 @@ status_t PropertyMap::load(const String8& filename, PropertyMap** outMap) {
             if (status) {
                 delete map;
             } else {
+                if (map->mLoaded.empty()) {
+                    map->mSource.reset();
+                }
                 *outMap = map;
             }
         }
-        delete tokenizer;
     }
     return status;
 }
@@ -166,8 +279,11 @@ status_t PropertyMap::Parser::parse() {
         mTokenizer->skipDelimiters(WHITESPACE);
 
         if (!mTokenizer->isEol() && mTokenizer->peekChar() != '#') {
-            String8 keyToken = mTokenizer->nextToken(WHITESPACE_OR_PROPERTY_DELIMITER);
-            if (keyToken.isEmpty()) {
+            LoadedProperty property;
+            property.lineNumber = mTokenizer->getLineNumber();
+            property.key = mTokenizer->nextTokenInPlace(WHITESPACE_OR_PROPERTY_DELIMITER,
+                    &property.keyLength);
+            if (property.keyLength == 0) {
                 ALOGE("%s: Expected non-empty property key.", mTokenizer->getLocation().string());
                 return BAD_VALUE;
             }
@@ -182,8 +298,9 @@ status_t PropertyMap::Parser::parse() {
 
             mTokenizer->skipDelimiters(WHITESPACE);
 
-            String8 valueToken = mTokenizer->nextToken(WHITESPACE);
-            if (valueToken.find("\\", 0) >= 0 || valueToken.find("\"", 0) >= 0) {
+            property.value = mTokenizer->nextTokenInPlace(WHITESPACE, &property.valueLength);
+            if (memchr(property.value, '\\', property.valueLength)
+                    || memchr(property.value, '"', property.valueLength)) {
                 ALOGE("%s: Found reserved character '\\' or '\"' in property value.",
                         mTokenizer->getLocation().string());
                 return BAD_VALUE;
@@ -197,17 +314,27 @@ status_t PropertyMap::Parser::parse() {
                 return BAD_VALUE;
             }
 
-            if (mMap->hasProperty(keyToken)) {
-                ALOGE("%s: Duplicate property value for key '%s'.",
-                        mTokenizer->getLocation().string(), keyToken.string());
-                return BAD_VALUE;
-            }
-
-            mMap->addProperty(keyToken, valueToken);
+            mMap->mLoaded.push_back(property);
         }
 
         mTokenizer->nextLine();
     }
+
+    std::vector<LoadedProperty>& loaded = mMap->mLoaded;
+    std::stable_sort(loaded.begin(), loaded.end(),
+            [](const LoadedProperty& a, const LoadedProperty& b) {
+                return compareKeys(a.key, a.keyLength, b.key, b.keyLength) < 0;
+            });
+    for (size_t i = 1; i < loaded.size(); i++) {
+        const LoadedProperty& property = loaded[i];
+        if (compareKeys(loaded[i - 1].key, loaded[i - 1].keyLength,
+                property.key, property.keyLength) == 0) {
+            ALOGE("%s:%d: Duplicate property value for key '%.*s'.",
+                    mTokenizer->getFilename().string(), property.lineNumber,
+                    int(property.keyLength), property.key);
+            return BAD_VALUE;
+        }
+    }
     return NO_ERROR;
 }
 
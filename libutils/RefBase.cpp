@@ -19,7 +19,12 @@
 
 #include <utils/RefBase.h>
 
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+
 #include <utils/CallStack.h>
+#include <utils/Mutex.h>
 
 #ifndef __unused
 #define __unused __attribute__((__unused__))
@@ -42,6 +47,10 @@
 // log all reference counting operations
 #define PRINT_REFS                      0
 
+// count reference operations per class for objects that called
+// trackRefContention(), see RefBase::dumpRefContention()
+#define DEBUG_REFS_CONTENTION           0
+
 // ---------------------------------------------------------------------------
 
 namespace android {
@@ -65,8 +74,12 @@ namespace android {
 // reference, and thus may fail when attemptIncStrong would succeed.
 //
 // mStrong is the strong reference count.  mWeak is the weak reference count.
-// Between calls, and ignoring memory ordering effects, mWeak includes strong
-// references, and is thus >= mStrong.
+// All strong references together hold a single weak reference, acquired when
+// mStrong leaves INITIAL_STRONG_VALUE or 0 and released when it drops back to
+// 0, so that only the first and last strong reference touch mWeak.  Between
+// calls, and ignoring memory ordering effects, mWeak is thus > 0 whenever
+// mStrong is.  The weak reference held for the strong ones is tracked under
+// the weakref_impl's own address as its id.
 //
 // A weakref_impl holds all the information, including both reference counts,
 // required to perform wp<> operations.  Thus these can continue to be performed
@@ -113,6 +126,12 @@ namespace android {
 // count decrement, and all reference count decrements happen before the final
 // one, we are guaranteed that all other object accesses happen before the
 // object is destroyed.
+//
+// The weak reference taken for the first strong reference is acquired before
+// the INITIAL_STRONG_VALUE offset is removed by a release operation, so no
+// decStrong() can see the final count of 1, and release that weak reference,
+// until it has been acquired.  The 0 to 1 case only occurs with
+// OBJECT_LIFETIME_WEAK, where the caller holds a weak reference of its own.
 
 
 #define INITIAL_STRONG_VALUE (1<<28)
@@ -132,6 +151,25 @@ namespace android {
 
 // ---------------------------------------------------------------------------
 
+#if DEBUG_REFS_CONTENTION
+// Counters shared by all tracked objects of one class.  weak includes the weak
+// reference taken for each first strong reference.  Retries are failed
+// compare-and-swaps while promoting or acquiring a weak reference, i.e. other
+// threads changing the count at the same time.
+struct ref_contention
+{
+    ref_contention*         next;
+    const char*             name;
+    std::atomic<uint64_t>   strong;
+    std::atomic<uint64_t>   weak;
+    std::atomic<uint64_t>   promotions;
+    std::atomic<uint64_t>   retries;
+};
+
+static Mutex gRefContentionLock;
+static ref_contention* gRefContention = NULL;
+#endif
+
 class RefBase::weakref_impl : public RefBase::weakref_type
 {
 public:
@@ -140,6 +178,27 @@ public:
     RefBase* const          mBase;
     std::atomic<int32_t>    mFlags;
 
+#if DEBUG_REFS_CONTENTION
+    // Set by trackRefContention() before the object is shared.
+    ref_contention*         mContention = NULL;
+
+    void countStrong() { count(&ref_contention::strong); }
+    void countWeak() { count(&ref_contention::weak); }
+    void countPromotion() { count(&ref_contention::promotions); }
+    void countRetry() { count(&ref_contention::retries); }
+
+    void count(std::atomic<uint64_t> ref_contention::* counter) {
+        if (mContention != NULL) {
+            (mContention->*counter).fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+#else
+    void countStrong() { }
+    void countWeak() { }
+    void countPromotion() { }
+    void countRetry() { }
+#endif
+
 #if !DEBUG_REFS
 
     explicit weakref_impl(RefBase* base)
@@ -311,7 +370,7 @@ private:
             ref->ref = mRef;
             ref->id = id;
 #if DEBUG_REFS_CALLSTACK_ENABLED
-            ref->stack.update(2);
+            ref->stack.capture(2);
 #endif
             ref->next = *refs;
             *refs = ref;
@@ -398,8 +457,7 @@ private:
 void RefBase::incStrong(const void* id) const
 {
     weakref_impl* const refs = mRefs;
-    refs->incWeak(id);
-    
+    refs->countStrong();
     refs->addStrongRef(id);
     const int32_t c = refs->mStrong.fetch_add(1, std::memory_order_relaxed);
     ALOG_ASSERT(c > 0, "incStrong() called on %p after last strong ref", refs);
@@ -407,11 +465,19 @@ void RefBase::incStrong(const void* id) const
     ALOGD("incStrong of %p from %p: cnt=%d\n", this, id, c);
 #endif
     if (c != INITIAL_STRONG_VALUE)  {
+        if (c == 0) {
+            // Not allowed, but tolerated for OBJECT_LIFETIME_WEAK: this
+            // revives the strong references, so they need their weak one back.
+            refs->incWeak(refs);
+        }
         return;
     }
 
+    refs->incWeak(refs);
+    // Release: a decStrong() seeing the count drop to 0 must also see the
+    // weak reference above.
     int32_t old = refs->mStrong.fetch_sub(INITIAL_STRONG_VALUE,
-            std::memory_order_relaxed);
+            std::memory_order_release);
     // A decStrong() must still happen after us.
     ALOG_ASSERT(old > INITIAL_STRONG_VALUE, "0x%x too small", old);
     refs->mBase->onFirstRef();
@@ -427,14 +493,15 @@ void RefBase::decStrong(const void* id) const
 #endif
     LOG_ALWAYS_FATAL_IF(BAD_STRONG(c), "decStrong() called on %p too many times",
             refs);
-    if (c == 1) {
-        std::atomic_thread_fence(std::memory_order_acquire);
-        refs->mBase->onLastStrongRef(id);
-        int32_t flags = refs->mFlags.load(std::memory_order_relaxed);
-        if ((flags&OBJECT_LIFETIME_MASK) == OBJECT_LIFETIME_STRONG) {
-            delete this;
-            // The destructor does not delete refs in this case.
-        }
+    if (c != 1) {
+        return;
+    }
+    std::atomic_thread_fence(std::memory_order_acquire);
+    refs->mBase->onLastStrongRef(id);
+    int32_t flags = refs->mFlags.load(std::memory_order_relaxed);
+    if ((flags&OBJECT_LIFETIME_MASK) == OBJECT_LIFETIME_STRONG) {
+        delete this;
+        // The destructor does not delete refs in this case.
     }
     // Note that even with only strong reference operations, the thread
     // deallocating this may not be the same as the thread deallocating refs.
@@ -442,7 +509,7 @@ void RefBase::decStrong(const void* id) const
     // and all accesses to refs happen before its deletion in the final decWeak.
     // The destructor can safely access mRefs because either it's deleting
     // mRefs itself, or it's running entirely before the final mWeak decrement.
-    refs->decWeak(id);
+    refs->decWeak(refs);
 }
 
 void RefBase::forceIncStrong(const void* id) const
@@ -450,8 +517,7 @@ void RefBase::forceIncStrong(const void* id) const
     // Allows initial mStrong of 0 in addition to INITIAL_STRONG_VALUE.
     // TODO: Better document assumptions.
     weakref_impl* const refs = mRefs;
-    refs->incWeak(id);
-    
+    refs->countStrong();
     refs->addStrongRef(id);
     const int32_t c = refs->mStrong.fetch_add(1, std::memory_order_relaxed);
     ALOG_ASSERT(c >= 0, "forceIncStrong called on %p after ref count underflow",
@@ -462,11 +528,15 @@ void RefBase::forceIncStrong(const void* id) const
 
     switch (c) {
     case INITIAL_STRONG_VALUE:
+        refs->incWeak(refs);
         refs->mStrong.fetch_sub(INITIAL_STRONG_VALUE,
-                std::memory_order_relaxed);
-        // fall through...
+                std::memory_order_release);
+        refs->mBase->onFirstRef();
+        break;
     case 0:
+        refs->incWeak(refs);
         refs->mBase->onFirstRef();
+        break;
     }
 }
 
@@ -484,6 +554,7 @@ RefBase* RefBase::weakref_type::refBase() const
 void RefBase::weakref_type::incWeak(const void* id)
 {
     weakref_impl* const impl = static_cast<weakref_impl*>(this);
+    impl->countWeak();
     impl->addWeakRef(id);
     const int32_t c __unused = impl->mWeak.fetch_add(1,
             std::memory_order_relaxed);
@@ -532,9 +603,11 @@ void RefBase::weakref_type::decWeak(const void* id)
 
 bool RefBase::weakref_type::attemptIncStrong(const void* id)
 {
-    incWeak(id);
-    
+    // The caller holds a weak reference, so unlike incStrong() we never need
+    // one to keep impl alive; only becoming the first strong reference takes
+    // the weak reference held for all of them.
     weakref_impl* const impl = static_cast<weakref_impl*>(this);
+    impl->countPromotion();
     int32_t curCount = impl->mStrong.load(std::memory_order_relaxed);
 
     ALOG_ASSERT(curCount >= 0,
@@ -549,6 +622,7 @@ bool RefBase::weakref_type::attemptIncStrong(const void* id)
         }
         // the strong count has changed on us, we need to re-assert our
         // situation. curCount was updated by compare_exchange_weak.
+        impl->countRetry();
     }
     
     if (curCount <= 0 || curCount == INITIAL_STRONG_VALUE) {
@@ -562,7 +636,6 @@ bool RefBase::weakref_type::attemptIncStrong(const void* id)
             if (curCount <= 0) {
                 // the last strong-reference got released, the object cannot
                 // be revived.
-                decWeak(id);
                 return false;
             }
 
@@ -577,12 +650,12 @@ bool RefBase::weakref_type::attemptIncStrong(const void* id)
                 // the strong count has changed on us, we need to re-assert our
                 // situation (e.g.: another thread has inc/decStrong'ed us)
                 // curCount has been updated.
+                impl->countRetry();
             }
 
             if (curCount <= 0) {
                 // promote() failed, some other thread destroyed us in the
                 // meantime (i.e.: strong count reached zero).
-                decWeak(id);
                 return false;
             }
         } else {
@@ -591,7 +664,6 @@ bool RefBase::weakref_type::attemptIncStrong(const void* id)
             // Ask the object's implementation if it agrees to be revived
             if (!impl->mBase->onIncStrongAttempted(FIRST_INC_STRONG, id)) {
                 // it didn't so give-up.
-                decWeak(id);
                 return false;
             }
             // grab a strong-reference, which is always safe due to the
@@ -614,6 +686,11 @@ bool RefBase::weakref_type::attemptIncStrong(const void* id)
     ALOGD("attemptIncStrong of %p from %p: cnt=%d\n", this, id, curCount);
 #endif
 
+    // Either we revived the strong references, or we're the first one.
+    if (curCount == 0 || curCount == INITIAL_STRONG_VALUE) {
+        incWeak(impl);
+    }
+
     // curCount is the value of mStrong before we incremented it.
     // Now we need to fix-up the count if it was INITIAL_STRONG_VALUE.
     // This must be done safely, i.e.: handle the case where several threads
@@ -623,7 +700,7 @@ bool RefBase::weakref_type::attemptIncStrong(const void* id)
     // by the thread that started with INITIAL_STRONG_VALUE.
     if (curCount == INITIAL_STRONG_VALUE) {
         impl->mStrong.fetch_sub(INITIAL_STRONG_VALUE,
-                std::memory_order_relaxed);
+                std::memory_order_release);
     }
 
     return true;
@@ -642,9 +719,11 @@ bool RefBase::weakref_type::attemptIncWeak(const void* id)
             break;
         }
         // curCount has been updated.
+        impl->countRetry();
     }
 
     if (curCount > 0) {
+        impl->countWeak();
         impl->addWeakRef(id);
     }
 
@@ -718,6 +797,41 @@ void RefBase::extendObjectLifetime(int32_t mode)
     mRefs->mFlags.fetch_or(mode, std::memory_order_relaxed);
 }
 
+#if DEBUG_REFS_CONTENTION
+void RefBase::trackRefContention(const char* className)
+{
+    AutoMutex _l(gRefContentionLock);
+    ref_contention* stats = gRefContention;
+    while (stats != NULL && strcmp(stats->name, className) != 0) {
+        stats = stats->next;
+    }
+    if (stats == NULL) {
+        stats = new ref_contention();
+        stats->name = strdup(className);
+        stats->next = gRefContention;
+        gRefContention = stats;
+    }
+    mRefs->mContention = stats;
+}
+
+void RefBase::dumpRefContention(int fd)
+{
+    AutoMutex _l(gRefContentionLock);
+    for (ref_contention* stats = gRefContention; stats != NULL; stats = stats->next) {
+        dprintf(fd, "%s: strong %" PRIu64 " weak %" PRIu64 " promotions %" PRIu64
+                " retries %" PRIu64 "\n", stats->name,
+                stats->strong.load(std::memory_order_relaxed),
+                stats->weak.load(std::memory_order_relaxed),
+                stats->promotions.load(std::memory_order_relaxed),
+                stats->retries.load(std::memory_order_relaxed));
+    }
+}
+#else
+void RefBase::trackRefContention(const char* /*className*/) { }
+
+void RefBase::dumpRefContention(int /*fd*/) { }
+#endif
+
 void RefBase::onFirstRef()
 {
 }
@@ -17,6 +17,8 @@
 #include <utils/String16.h>
 
 #include <utils/Log.h>
+#include <utils/Mutex.h>
+#include <utils/SortedVector.h>
 
 #include <ctype.h>
 
@@ -428,4 +430,20 @@ status_t String16::remove(size_t len, size_t begin)
     return NO_MEMORY;
 }
 
+String16 String16::intern() const
+{
+    // The pool holds a reference to every interned string for good, which
+    // is what keeps their storage alive.
+    static Mutex* sPoolLock = new Mutex();
+    static SortedVector<String16>* sPool = new SortedVector<String16>();
+
+    AutoMutex _l(*sPoolLock);
+    ssize_t index = sPool->indexOf(*this);
+    if (index >= 0) {
+        return sPool->itemAt(index);
+    }
+    sPool->add(*this);
+    return *this;
+}
+
 }; // namespace android
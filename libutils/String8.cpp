@@ -21,6 +21,8 @@
 
 #include <utils/Compat.h>
 #include <utils/Log.h>
+#include <utils/Mutex.h>
+#include <utils/SortedVector.h>
 #include <utils/String16.h>
 
 #include <ctype.h>
@@ -40,20 +42,11 @@ namespace android {
 // to OS_PATH_SEPARATOR.
 #define RES_PATH_SEPARATOR '/'
 
-static SharedBuffer* gEmptyStringBuf = NULL;
-static char* gEmptyString = NULL;
-
 extern int gDarwinCantLoadAllObjects;
 int gDarwinIsReallyAnnoying;
 
 void initialize_string8();
 
-static inline char* getEmptyString()
-{
-    gEmptyStringBuf->acquire();
-    return gEmptyString;
-}
-
 void initialize_string8()
 {
     // HACK: This dummy dependency forces linking libutils Static.cpp,
@@ -61,162 +54,178 @@ void initialize_string8()
     // These variables are named for Darwin, but are needed elsewhere too,
     // including static linking on any platform.
     gDarwinIsReallyAnnoying = gDarwinCantLoadAllObjects;
-
-    SharedBuffer* buf = SharedBuffer::alloc(1);
-    char* str = (char*)buf->data();
-    *str = 0;
-    gEmptyStringBuf = buf;
-    gEmptyString = str;
 }
 
 void terminate_string8()
 {
-    SharedBuffer::bufferFromData(gEmptyString)->release();
-    gEmptyStringBuf = NULL;
-    gEmptyString = NULL;
 }
 
 // ---------------------------------------------------------------------------
 
-static char* allocFromUTF8(const char* in, size_t len)
+const size_t String8::kInlineLength;
+const unsigned char String8::kSharedTag;
+
+// Makes room for a string of len bytes, in the object if it fits and in a new
+// SharedBuffer otherwise, and returns where to write it and its terminator.
+// Any previous storage must already have been released.
+char* String8::initBuffer(size_t len)
 {
-    if (len > 0) {
-        if (len == SIZE_MAX) {
-            return NULL;
-        }
-        SharedBuffer* buf = SharedBuffer::alloc(len+1);
-        ALOG_ASSERT(buf, "Unable to allocate shared buffer");
-        if (buf) {
-            char* str = (char*)buf->data();
-            memcpy(str, in, len);
-            str[len] = 0;
-            return str;
-        }
+    if (len <= kInlineLength) {
+        setTag(len);
+        return mInline;
+    }
+
+    if (len == SIZE_MAX) {
+        return NULL;
+    }
+    SharedBuffer* buf = SharedBuffer::alloc(len+1);
+    ALOG_ASSERT(buf, "Unable to allocate shared buffer");
+    if (!buf) {
         return NULL;
     }
+    mString = (char*)buf->data();
+    setTag(kSharedTag);
+    return (char*)buf->data();
+}
 
-    return getEmptyString();
+status_t String8::initFromUTF8(const char* in, size_t len)
+{
+    char* str = initBuffer(len);
+    if (!str) {
+        return NO_MEMORY;
+    }
+    memcpy(str, in, len);
+    str[len] = 0;
+    return NO_ERROR;
 }
 
-static char* allocFromUTF16(const char16_t* in, size_t len)
+status_t String8::initFromUTF16(const char16_t* in, size_t len)
 {
-    if (len == 0) return getEmptyString();
+    if (len == 0) return NO_ERROR;
 
-     // Allow for closing '\0'
-    const ssize_t resultStrLen = utf16_to_utf8_length(in, len) + 1;
-    if (resultStrLen < 1) {
-        return getEmptyString();
+    const ssize_t resultStrLen = utf16_to_utf8_length(in, len);
+    if (resultStrLen < 0) {
+        return NO_ERROR;
     }
 
-    SharedBuffer* buf = SharedBuffer::alloc(resultStrLen);
-    ALOG_ASSERT(buf, "Unable to allocate shared buffer");
-    if (!buf) {
-        return getEmptyString();
+    char* resultStr = initBuffer(resultStrLen);
+    if (!resultStr) {
+        return NO_MEMORY;
     }
-
-    char* resultStr = (char*)buf->data();
-    utf16_to_utf8(in, len, resultStr, resultStrLen);
-    return resultStr;
+    utf16_to_utf8(in, len, resultStr, resultStrLen + 1);
+    return NO_ERROR;
 }
 
-static char* allocFromUTF32(const char32_t* in, size_t len)
+status_t String8::initFromUTF32(const char32_t* in, size_t len)
 {
-    if (len == 0) {
-        return getEmptyString();
-    }
+    if (len == 0) return NO_ERROR;
 
-    const ssize_t resultStrLen = utf32_to_utf8_length(in, len) + 1;
-    if (resultStrLen < 1) {
-        return getEmptyString();
+    const ssize_t resultStrLen = utf32_to_utf8_length(in, len);
+    if (resultStrLen < 0) {
+        return NO_ERROR;
     }
 
-    SharedBuffer* buf = SharedBuffer::alloc(resultStrLen);
-    ALOG_ASSERT(buf, "Unable to allocate shared buffer");
-    if (!buf) {
-        return getEmptyString();
+    char* resultStr = initBuffer(resultStrLen);
+    if (!resultStr) {
+        return NO_MEMORY;
     }
+    utf32_to_utf8(in, len, resultStr, resultStrLen + 1);
+    return NO_ERROR;
+}
 
-    char* resultStr = (char*) buf->data();
-    utf32_to_utf8(in, len, resultStr, resultStrLen);
+// Drops this string's reference to its storage and leaves it empty.
+void String8::releaseBuffer()
+{
+    if (!isInline()) {
+        SharedBuffer::bufferFromData(mString)->release();
+    }
+    mInline[0] = 0;
+    setTag(0);
+}
 
-    return resultStr;
+void String8::swap(String8& other)
+{
+    char tmp[kStorageSize];
+    memcpy(tmp, mInline, kStorageSize);
+    memcpy(mInline, other.mInline, kStorageSize);
+    memcpy(other.mInline, tmp, kStorageSize);
 }
 
 // ---------------------------------------------------------------------------
 
 String8::String8()
-    : mString(getEmptyString())
 {
+    mInline[0] = 0;
+    setTag(0);
 }
 
 String8::String8(StaticLinkage)
-    : mString(0)
+    : String8()
 {
     // this constructor is used when we can't rely on the static-initializers
-    // having run. In this case we always allocate an empty string. It's less
-    // efficient than using getEmptyString(), but we assume it's uncommon.
-
-    char* data = static_cast<char*>(
-            SharedBuffer::alloc(sizeof(char))->data());
-    data[0] = 0;
-    mString = data;
+    // having run.  An empty string is stored inline and doesn't need any.
 }
 
 String8::String8(const String8& o)
-    : mString(o.mString)
 {
-    SharedBuffer::bufferFromData(mString)->acquire();
+    memcpy(mInline, o.mInline, kStorageSize);
+    if (!isInline()) {
+        SharedBuffer::bufferFromData(mString)->acquire();
+    }
 }
 
 String8::String8(const char* o)
-    : mString(allocFromUTF8(o, strlen(o)))
+    : String8()
 {
-    if (mString == NULL) {
-        mString = getEmptyString();
-    }
+    initFromUTF8(o, strlen(o));
 }
 
 String8::String8(const char* o, size_t len)
-    : mString(allocFromUTF8(o, len))
+    : String8()
 {
-    if (mString == NULL) {
-        mString = getEmptyString();
-    }
+    initFromUTF8(o, len);
 }
 
 String8::String8(const String16& o)
-    : mString(allocFromUTF16(o.string(), o.size()))
+    : String8()
 {
+    initFromUTF16(o.string(), o.size());
 }
 
 String8::String8(const char16_t* o)
-    : mString(allocFromUTF16(o, strlen16(o)))
+    : String8()
 {
+    initFromUTF16(o, strlen16(o));
 }
 
 String8::String8(const char16_t* o, size_t len)
-    : mString(allocFromUTF16(o, len))
+    : String8()
 {
+    initFromUTF16(o, len);
 }
 
 String8::String8(const char32_t* o)
-    : mString(allocFromUTF32(o, strlen32(o)))
+    : String8()
 {
+    initFromUTF32(o, strlen32(o));
 }
 
 String8::String8(const char32_t* o, size_t len)
-    : mString(allocFromUTF32(o, len))
+    : String8()
 {
+    initFromUTF32(o, len);
 }
 
 String8::~String8()
 {
-    SharedBuffer::bufferFromData(mString)->release();
+    if (!isInline()) {
+        SharedBuffer::bufferFromData(mString)->release();
+    }
 }
 
 size_t String8::length() const
 {
-    return SharedBuffer::sizeFromData(mString)-1;
+    return isInline() ? tag() : SharedBuffer::sizeFromData(mString)-1;
 }
 
 String8 String8::format(const char* fmt, ...)
@@ -238,59 +247,52 @@ String8 String8::formatV(const char* fmt, va_list args)
 }
 
 void String8::clear() {
-    SharedBuffer::bufferFromData(mString)->release();
-    mString = getEmptyString();
+    releaseBuffer();
 }
 
 void String8::setTo(const String8& other)
 {
-    SharedBuffer::bufferFromData(other.mString)->acquire();
-    SharedBuffer::bufferFromData(mString)->release();
-    mString = other.mString;
+    if (&other == this) {
+        return;
+    }
+    if (!other.isInline()) {
+        SharedBuffer::bufferFromData(other.mString)->acquire();
+    }
+    if (!isInline()) {
+        SharedBuffer::bufferFromData(mString)->release();
+    }
+    memcpy(mInline, other.mInline, kStorageSize);
 }
 
 status_t String8::setTo(const char* other)
 {
-    const char *newString = allocFromUTF8(other, strlen(other));
-    SharedBuffer::bufferFromData(mString)->release();
-    mString = newString;
-    if (mString) return NO_ERROR;
-
-    mString = getEmptyString();
-    return NO_MEMORY;
+    return setTo(other, strlen(other));
 }
 
+// The new value is built in a separate string first because other may point
+// into this one.  On failure this string is left empty.
 status_t String8::setTo(const char* other, size_t len)
 {
-    const char *newString = allocFromUTF8(other, len);
-    SharedBuffer::bufferFromData(mString)->release();
-    mString = newString;
-    if (mString) return NO_ERROR;
-
-    mString = getEmptyString();
-    return NO_MEMORY;
+    String8 result;
+    status_t err = result.initFromUTF8(other, len);
+    swap(result);
+    return err;
 }
 
 status_t String8::setTo(const char16_t* other, size_t len)
 {
-    const char *newString = allocFromUTF16(other, len);
-    SharedBuffer::bufferFromData(mString)->release();
-    mString = newString;
-    if (mString) return NO_ERROR;
-
-    mString = getEmptyString();
-    return NO_MEMORY;
+    String8 result;
+    status_t err = result.initFromUTF16(other, len);
+    swap(result);
+    return err;
 }
 
 status_t String8::setTo(const char32_t* other, size_t len)
 {
-    const char *newString = allocFromUTF32(other, len);
-    SharedBuffer::bufferFromData(mString)->release();
-    mString = newString;
-    if (mString) return NO_ERROR;
-
-    mString = getEmptyString();
-    return NO_MEMORY;
+    String8 result;
+    status_t err = result.initFromUTF32(other, len);
+    swap(result);
+    return err;
 }
 
 status_t String8::append(const String8& other)
@@ -362,11 +364,24 @@ status_t String8::real_append(const char* other, size_t otherLen)
 {
     const size_t myLen = bytes();
 
-    SharedBuffer* buf = SharedBuffer::bufferFromData(mString)
-        ->editResize(myLen+otherLen+1);
-    if (buf) {
+    if (isInline() && myLen+otherLen > kInlineLength) {
+        // Copy both parts before the inline text is replaced, other may point
+        // into it.
+        SharedBuffer* buf = SharedBuffer::alloc(myLen+otherLen+1);
+        if (!buf) {
+            return NO_MEMORY;
+        }
         char* str = (char*)buf->data();
+        memcpy(str, mInline, myLen);
+        memcpy(str+myLen, other, otherLen);
+        str[myLen+otherLen] = '\0';
         mString = str;
+        setTag(kSharedTag);
+        return NO_ERROR;
+    }
+
+    char* str = lockBuffer(myLen+otherLen);
+    if (str) {
         str += myLen;
         memcpy(str, other, otherLen);
         str[otherLen] = '\0';
@@ -377,6 +392,28 @@ status_t String8::real_append(const char* other, size_t otherLen)
 
 char* String8::lockBuffer(size_t size)
 {
+    if (isInline()) {
+        if (size <= kInlineLength) {
+            setTag(size);
+            return mInline;
+        }
+
+        // Move to a SharedBuffer, keeping the current text (and terminator)
+        // like editResize would.
+        if (size == SIZE_MAX) {
+            return NULL;
+        }
+        SharedBuffer* buf = SharedBuffer::alloc(size+1);
+        if (!buf) {
+            return NULL;
+        }
+        char* str = (char*)buf->data();
+        memcpy(str, mInline, tag()+1);
+        mString = str;
+        setTag(kSharedTag);
+        return str;
+    }
+
     SharedBuffer* buf = SharedBuffer::bufferFromData(mString)
         ->editResize(size+1);
     if (buf) {
@@ -389,21 +426,31 @@ char* String8::lockBuffer(size_t size)
 
 void String8::unlockBuffer()
 {
-    unlockBuffer(strlen(mString));
+    unlockBuffer(strlen(string()));
 }
 
 status_t String8::unlockBuffer(size_t size)
 {
     if (size != this->size()) {
-        SharedBuffer* buf = SharedBuffer::bufferFromData(mString)
-            ->editResize(size+1);
-        if (! buf) {
-            return NO_MEMORY;
+        char* str;
+        if (isInline() && size <= kInlineLength) {
+            setTag(size);
+            str = mInline;
+        } else if (isInline()) {
+            str = lockBuffer(size);
+            if (! str) {
+                return NO_MEMORY;
+            }
+        } else {
+            SharedBuffer* buf = SharedBuffer::bufferFromData(mString)
+                ->editResize(size+1);
+            if (! buf) {
+                return NO_MEMORY;
+            }
+            str = (char*)buf->data();
+            mString = str;
         }
-
-        char* str = (char*)buf->data();
         str[size] = 0;
-        mString = str;
     }
 
     return NO_ERROR;
@@ -415,9 +462,9 @@ ssize_t String8::find(const char* other, size_t start) const
     if (start >= len) {
         return -1;
     }
-    const char* s = mString+start;
+    const char* s = string()+start;
     const char* p = strstr(s, other);
-    return p ? p-mString : -1;
+    return p ? p-string() : -1;
 }
 
 bool String8::removeAll(const char* other) {
@@ -494,17 +541,38 @@ void String8::toUpper(size_t start, size_t length)
 
 size_t String8::getUtf32Length() const
 {
-    return utf8_to_utf32_length(mString, length());
+    return utf8_to_utf32_length(string(), length());
 }
 
 int32_t String8::getUtf32At(size_t index, size_t *next_index) const
 {
-    return utf32_from_utf8_at(mString, length(), index, next_index);
+    return utf32_from_utf8_at(string(), length(), index, next_index);
 }
 
 void String8::getUtf32(char32_t* dst) const
 {
-    utf8_to_utf32(mString, length(), dst);
+    utf8_to_utf32(string(), length(), dst);
+}
+
+String8 String8::intern() const
+{
+    // Inline strings don't allocate, so there is nothing to share.
+    if (isInline()) {
+        return *this;
+    }
+
+    // The pool holds a reference to every interned string for good, which
+    // is what keeps their storage alive.
+    static Mutex* sPoolLock = new Mutex();
+    static SortedVector<String8>* sPool = new SortedVector<String8>();
+
+    AutoMutex _l(*sPoolLock);
+    ssize_t index = sPool->indexOf(*this);
+    if (index >= 0) {
+        return sPool->itemAt(index);
+    }
+    sPool->add(*this);
+    return *this;
 }
 
 // ---------------------------------------------------------------------------
@@ -533,7 +601,7 @@ void String8::setPathName(const char* name, size_t len)
 String8 String8::getPathLeaf(void) const
 {
     const char* cp;
-    const char*const buf = mString;
+    const char*const buf = string();
 
     cp = strrchr(buf, OS_PATH_SEPARATOR);
     if (cp == NULL)
@@ -545,7 +613,7 @@ String8 String8::getPathLeaf(void) const
 String8 String8::getPathDir(void) const
 {
     const char* cp;
-    const char*const str = mString;
+    const char*const str = string();
 
     cp = strrchr(str, OS_PATH_SEPARATOR);
     if (cp == NULL)
@@ -557,7 +625,7 @@ String8 String8::getPathDir(void) const
 String8 String8::walkPath(String8* outRemains) const
 {
     const char* cp;
-    const char*const str = mString;
+    const char*const str = string();
     const char* buf = str;
 
     cp = strchr(buf, OS_PATH_SEPARATOR);
@@ -581,13 +649,13 @@ String8 String8::walkPath(String8* outRemains) const
 /*
  * Helper function for finding the start of an extension in a pathname.
  *
- * Returns a pointer inside mString, or NULL if no extension was found.
+ * Returns a pointer inside the string, or NULL if no extension was found.
  */
 char* String8::find_extension(void) const
 {
     const char* lastSlash;
     const char* lastDot;
-    const char* const str = mString;
+    const char* const str = string();
 
     // only look at the filename
     lastSlash = strrchr(str, OS_PATH_SEPARATOR);
@@ -619,7 +687,7 @@ String8 String8::getPathExtension(void) const
 String8 String8::getBasePath(void) const
 {
     char* ext;
-    const char* const str = mString;
+    const char* const str = string();
 
     ext = find_extension();
     if (ext == NULL)
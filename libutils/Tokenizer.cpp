@@ -123,6 +123,12 @@ String8 Tokenizer::peekRemainderOfLine() const {
 }
 
 String8 Tokenizer::nextToken(const char* delimiters) {
+    size_t length;
+    const char* token = nextTokenInPlace(delimiters, &length);
+    return String8(token, length);
+}
+
+const char* Tokenizer::nextTokenInPlace(const char* delimiters, size_t* outLength) {
 #if DEBUG_TOKENIZER
     ALOGD("nextToken");
 #endif
@@ -135,7 +141,8 @@ String8 Tokenizer::nextToken(const char* delimiters) {
         }
         mCurrent += 1;
     }
-    return String8(tokenStart, mCurrent - tokenStart);
+    *outLength = mCurrent - tokenStart;
+    return tokenStart;
 }
 
 void Tokenizer::nextLine() {
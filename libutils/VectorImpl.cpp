@@ -41,6 +41,18 @@ static inline size_t max(size_t a, size_t b) {
     return a>b ? a : b;
 }
 
+// Whether the storage can be resized with SharedBuffer::editResize(), which
+// may realloc() it and otherwise copies it with memcpy().  That is fine for
+// items that can be copied with memcpy, and for items that can be moved with
+// memmove as long as nobody else shares the storage.
+static inline bool canEditResize(const void* storage, uint32_t flags) {
+    if ((flags & VectorImpl::HAS_TRIVIAL_COPY) && (flags & VectorImpl::HAS_TRIVIAL_DTOR)) {
+        return true;
+    }
+    return (flags & VectorImpl::HAS_TRIVIAL_MOVE) &&
+            SharedBuffer::bufferFromData(storage)->onlyOwner();
+}
+
 // ----------------------------------------------------------------------------
 
 VectorImpl::VectorImpl(size_t itemSize, uint32_t flags)
@@ -343,6 +355,14 @@ ssize_t VectorImpl::setCapacity(size_t new_capacity)
 
     size_t new_allocation_size = 0;
     LOG_ALWAYS_FATAL_IF(!safe_mul(&new_allocation_size, new_capacity, mItemSize));
+    if (mStorage && canEditResize(mStorage, mFlags)) {
+        SharedBuffer* sb = SharedBuffer::bufferFromData(mStorage)->editResize(new_allocation_size);
+        if (!sb) {
+            return NO_MEMORY;
+        }
+        mStorage = sb->data();
+        return new_capacity;
+    }
     SharedBuffer* sb = SharedBuffer::alloc(new_allocation_size);
     if (sb) {
         void* array = sb->data();
@@ -408,11 +428,7 @@ void* VectorImpl::_grow(size_t where, size_t amount)
                             "new_alloc_size overflow");
 
 //        ALOGV("grow vector %p, new_capacity=%d", this, (int)new_capacity);
-        if ((mStorage) &&
-            (mCount==where) &&
-            (mFlags & HAS_TRIVIAL_COPY) &&
-            (mFlags & HAS_TRIVIAL_DTOR))
-        {
+        if (mStorage && canEditResize(mStorage, mFlags)) {
             const SharedBuffer* cur_sb = SharedBuffer::bufferFromData(mStorage);
             SharedBuffer* sb = cur_sb->editResize(new_alloc_size);
             if (sb) {
@@ -420,6 +436,11 @@ void* VectorImpl::_grow(size_t where, size_t amount)
             } else {
                 return NULL;
             }
+            if (where != mCount) {
+                const void* from = reinterpret_cast<const uint8_t *>(mStorage) + where*mItemSize;
+                void* to = reinterpret_cast<uint8_t *>(mStorage) + (where+amount)*mItemSize;
+                memmove(to, from, (mCount-where)*mItemSize);
+            }
         } else {
             SharedBuffer* sb = SharedBuffer::alloc(new_alloc_size);
             if (sb) {
@@ -467,25 +488,34 @@ void VectorImpl::_shrink(size_t where, size_t amount)
     LOG_ALWAYS_FATAL_IF(!safe_sub(&new_size, mCount, amount));
 
     if (new_size < (capacity() / 2)) {
-        // NOTE: (new_size * 2) is safe because capacity didn't overflow and
-        // new_size < (capacity / 2)).
-        const size_t new_capacity = max(kMinVectorCapacity, new_size * 2);
+        // Leave the same headroom _grow would, so that removing one item at a
+        // time from the end doesn't reallocate (and copy) on every removal.
+        //
+        // NOTE: (new_size + (new_size / 2) + 1) is safe because capacity didn't
+        // overflow and new_size < (capacity / 2)).
+        const size_t new_capacity = max(kMinVectorCapacity, new_size + (new_size / 2) + 1);
 
         // NOTE: (new_capacity * mItemSize), (where * mItemSize) and
         // ((where + amount) * mItemSize) beyond this point are safe because
         // we are always reducing the capacity of the underlying SharedBuffer.
         // In other words, (old_capacity * mItemSize) did not overflow, and
         // where < (where + amount) < new_capacity < old_capacity.
-        if ((where == new_size) &&
-            (mFlags & HAS_TRIVIAL_COPY) &&
-            (mFlags & HAS_TRIVIAL_DTOR))
+        if (canEditResize(mStorage, mFlags) &&
+            ((where == new_size) || SharedBuffer::bufferFromData(mStorage)->onlyOwner()))
         {
+            // Close the gap first, so that only the items that are kept are
+            // moved into the smaller buffer.  If that can't be allocated, the
+            // current one is still valid and just stays bigger than needed.
+            void* to = reinterpret_cast<uint8_t *>(mStorage) + where*mItemSize;
+            _do_destroy(to, amount);
+            if (where != new_size) {
+                const void* from = reinterpret_cast<const uint8_t *>(mStorage) + (where+amount)*mItemSize;
+                memmove(to, from, (new_size - where)*mItemSize);
+            }
             const SharedBuffer* cur_sb = SharedBuffer::bufferFromData(mStorage);
             SharedBuffer* sb = cur_sb->editResize(new_capacity * mItemSize);
             if (sb) {
                 mStorage = sb->data();
-            } else {
-                return;
             }
         } else {
             SharedBuffer* sb = SharedBuffer::alloc(new_capacity * mItemSize);
@@ -549,11 +579,19 @@ void VectorImpl::_do_splat(void* dest, const void* item, size_t num) const {
 }
 
 void VectorImpl::_do_move_forward(void* dest, const void* from, size_t num) const {
-    do_move_forward(dest, from, num);
+    if (mFlags & HAS_TRIVIAL_MOVE) {
+        memmove(dest, from, num*itemSize());
+    } else {
+        do_move_forward(dest, from, num);
+    }
 }
 
 void VectorImpl::_do_move_backward(void* dest, const void* from, size_t num) const {
-    do_move_backward(dest, from, num);
+    if (mFlags & HAS_TRIVIAL_MOVE) {
+        memmove(dest, from, num*itemSize());
+    } else {
+        do_move_backward(dest, from, num);
+    }
 }
 
 /*****************************************************************************/
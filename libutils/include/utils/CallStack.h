@@ -40,12 +40,20 @@ public:
     ~CallStack();
 
     // Reset the stack frames (same as creating an empty call stack).
-    void clear() { mFrameLines.clear(); }
+    void clear() { mFrameLines.clear(); mPcCount = 0; }
 
     // Immediately collect the stack traces for the specified thread.
     // The default is to dump the stack of the current call.
     void update(int32_t ignoreDepth=1, pid_t tid=BACKTRACE_CURRENT_THREAD);
 
+    // Record the current thread's pcs, and nothing else, into this object.
+    // They are symbolized the first time the stack is logged, dumped or
+    // printed, against a map of the process shared by every CallStack.  A
+    // library unloaded in between leaves its frames unnamed, and marked as
+    // such.  For traces taken far more often than they are looked at, such
+    // as the RefBase DEBUG_REFS ones.
+    void capture(int32_t ignoreDepth=1);
+
     // Dump a stack trace to the log using the supplied logtag.
     void log(const char* logtag,
              android_LogPriority priority = ANDROID_LOG_DEBUG,
@@ -61,10 +69,18 @@ public:
     void print(Printer& printer) const;
 
     // Get the count of stack frames that are in this call stack.
-    size_t size() const { return mFrameLines.size(); }
+    size_t size() const { return mPcCount ? mPcCount : mFrameLines.size(); }
 
 private:
-    Vector<String8> mFrameLines;
+    static const size_t kMaxCapturedFrames = 64;
+
+    void symbolize() const;
+
+    mutable Vector<String8> mFrameLines;
+    // Pending capture(), until symbolize() turns it into mFrameLines.
+    mutable size_t mPcCount = 0;
+    size_t mMapGeneration = 0;
+    uintptr_t mPcs[kMaxCapturedFrames];
 };
 
 }; // namespace android
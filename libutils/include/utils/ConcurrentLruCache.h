@@ -0,0 +1,204 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_UTILS_CONCURRENT_LRU_CACHE_H
+#define ANDROID_UTILS_CONCURRENT_LRU_CACHE_H
+
+#include <memory>
+#include <vector>
+
+#include "utils/LruCache.h"
+#include "utils/Mutex.h"
+#include "utils/TypeHelpers.h"  // hash_t
+
+namespace android {
+
+/**
+ * A thread-safe LruCache, split into shards that each have their own lock, so
+ * that threads using different keys rarely wait for each other.
+ *
+ * Keys are spread over the shards by hash_type(), and every shard is an
+ * LruCache holding its share of the capacity. Eviction is thus only
+ * approximately least recently used: the entry evicted by put() is the oldest
+ * one of the key's shard, not of the whole cache.
+ *
+ * The OnEntryRemoved listener is called with the lock of the entry's shard
+ * held, so it must not call back into the cache.
+ */
+template <typename TKey, typename TValue>
+class ConcurrentLruCache {
+public:
+    enum {
+        kDefaultShardCount = 16,
+    };
+
+    /**
+     * shardCount is rounded up to a power of two. maxCapacity, unless it is
+     * LruCache::kUnlimitedCapacity, is divided evenly between the shards,
+     * each getting at least one entry.
+     */
+    explicit ConcurrentLruCache(uint32_t maxCapacity,
+            size_t shardCount = kDefaultShardCount);
+
+    void setOnEntryRemovedListener(OnEntryRemoved<TKey, TValue>* listener);
+    size_t size() const;
+    // Copies the value for key to outValue and marks it as recently used.
+    // Returns false, leaving outValue untouched, on a miss.
+    bool get(const TKey& key, TValue* outValue);
+    bool put(const TKey& key, const TValue& value);
+    bool remove(const TKey& key);
+    void clear();
+
+    //! Number of get() calls that found, and didn't find, their key.
+    uint64_t hitCount() const;
+    uint64_t missCount() const;
+    //! Number of entries evicted by put() to stay within capacity.
+    uint64_t evictionCount() const;
+
+private:
+    ConcurrentLruCache(const ConcurrentLruCache& that);  // disallow copy constructor
+
+    struct Shard {
+        explicit Shard(uint32_t capacity)
+            : cache(capacity), capacity(capacity), hits(0), misses(0), evictions(0) {
+        }
+
+        mutable Mutex lock;
+        LruCache<TKey, TValue> cache;
+        const uint32_t capacity;
+        uint64_t hits;
+        uint64_t misses;
+        uint64_t evictions;
+    };
+
+    Shard& shardFor(const TKey& key) const {
+        // hash_type() is the identity for integers, so mix it before taking
+        // the top bits, which the shard's own hash table doesn't depend on.
+        uint32_t hash = static_cast<uint32_t>(hash_type(key)) * 0x9e3779b9u;
+        return *mShards[(hash >> 16) & mShardMask];
+    }
+
+    std::vector<std::unique_ptr<Shard>> mShards;
+    size_t mShardMask;
+};
+
+// Implementation is here, because it's fully templated
+template <typename TKey, typename TValue>
+ConcurrentLruCache<TKey, TValue>::ConcurrentLruCache(uint32_t maxCapacity, size_t shardCount) {
+    size_t count = 1;
+    while (count < shardCount && count < 0x10000) {
+        count <<= 1;
+    }
+    uint32_t capacity = LruCache<TKey, TValue>::kUnlimitedCapacity;
+    if (maxCapacity != LruCache<TKey, TValue>::kUnlimitedCapacity) {
+        capacity = (maxCapacity + count - 1) / count;
+    }
+    mShards.reserve(count);
+    for (size_t i = 0; i < count; i++) {
+        mShards.emplace_back(new Shard(capacity));
+    }
+    mShardMask = count - 1;
+}
+
+template <typename TKey, typename TValue>
+void ConcurrentLruCache<TKey, TValue>::setOnEntryRemovedListener(
+        OnEntryRemoved<TKey, TValue>* listener) {
+    for (auto& shard : mShards) {
+        Mutex::Autolock _l(shard->lock);
+        shard->cache.setOnEntryRemovedListener(listener);
+    }
+}
+
+template <typename TKey, typename TValue>
+size_t ConcurrentLruCache<TKey, TValue>::size() const {
+    size_t total = 0;
+    for (auto& shard : mShards) {
+        Mutex::Autolock _l(shard->lock);
+        total += shard->cache.size();
+    }
+    return total;
+}
+
+template <typename TKey, typename TValue>
+bool ConcurrentLruCache<TKey, TValue>::get(const TKey& key, TValue* outValue) {
+    Shard& shard = shardFor(key);
+    Mutex::Autolock _l(shard.lock);
+    if (!shard.cache.get(key, outValue)) {
+        shard.misses++;
+        return false;
+    }
+    shard.hits++;
+    return true;
+}
+
+template <typename TKey, typename TValue>
+bool ConcurrentLruCache<TKey, TValue>::put(const TKey& key, const TValue& value) {
+    Shard& shard = shardFor(key);
+    Mutex::Autolock _l(shard.lock);
+    if (shard.capacity != LruCache<TKey, TValue>::kUnlimitedCapacity
+            && shard.cache.size() >= shard.capacity) {
+        shard.evictions++;
+    }
+    return shard.cache.put(key, value);
+}
+
+template <typename TKey, typename TValue>
+bool ConcurrentLruCache<TKey, TValue>::remove(const TKey& key) {
+    Shard& shard = shardFor(key);
+    Mutex::Autolock _l(shard.lock);
+    return shard.cache.remove(key);
+}
+
+template <typename TKey, typename TValue>
+void ConcurrentLruCache<TKey, TValue>::clear() {
+    for (auto& shard : mShards) {
+        Mutex::Autolock _l(shard->lock);
+        shard->cache.clear();
+    }
+}
+
+template <typename TKey, typename TValue>
+uint64_t ConcurrentLruCache<TKey, TValue>::hitCount() const {
+    uint64_t total = 0;
+    for (auto& shard : mShards) {
+        Mutex::Autolock _l(shard->lock);
+        total += shard->hits;
+    }
+    return total;
+}
+
+template <typename TKey, typename TValue>
+uint64_t ConcurrentLruCache<TKey, TValue>::missCount() const {
+    uint64_t total = 0;
+    for (auto& shard : mShards) {
+        Mutex::Autolock _l(shard->lock);
+        total += shard->misses;
+    }
+    return total;
+}
+
+template <typename TKey, typename TValue>
+uint64_t ConcurrentLruCache<TKey, TValue>::evictionCount() const {
+    uint64_t total = 0;
+    for (auto& shard : mShards) {
+        Mutex::Autolock _l(shard->lock);
+        total += shard->evictions;
+    }
+    return total;
+}
+
+}
+#endif // ANDROID_UTILS_CONCURRENT_LRU_CACHE_H
@@ -434,13 +434,20 @@ private:
     };
 
     struct MessageEnvelope {
-        MessageEnvelope() : uptime(0) { }
+        MessageEnvelope() : uptime(0), seq(0) { }
 
-        MessageEnvelope(nsecs_t u, const sp<MessageHandler> h,
-                const Message& m) : uptime(u), handler(h), message(m) {
+        MessageEnvelope(nsecs_t u, uint64_t s, const sp<MessageHandler> h,
+                const Message& m) : uptime(u), seq(s), handler(h), message(m) {
+        }
+
+        // Whether this message is due after other, messages sent for the same
+        // time are delivered in the order they were sent.
+        bool isLaterThan(const MessageEnvelope& other) const {
+            return uptime > other.uptime || (uptime == other.uptime && seq > other.seq);
         }
 
         nsecs_t uptime;
+        uint64_t seq;
         sp<MessageHandler> handler;
         Message message;
     };
@@ -450,7 +457,9 @@ private:
     int mWakeEventFd;  // immutable
     Mutex mLock;
 
+    // A binary heap with the next message due at index 0.
     Vector<MessageEnvelope> mMessageEnvelopes; // guarded by mLock
+    uint64_t mNextMessageSeq; // guarded by mLock
     bool mSendingMessage; // guarded by mLock
 
     // Whether we are currently waiting for work.  Not protected by a lock,
@@ -460,8 +469,10 @@ private:
     int mEpollFd; // guarded by mLock but only modified on the looper thread
     bool mEpollRebuildRequired; // guarded by mLock
 
-    // Locked list of file descriptor monitoring requests.
-    KeyedVector<int, Request> mRequests;  // guarded by mLock
+    // Locked list of file descriptor monitoring requests, in no particular order.
+    Vector<Request> mRequests;  // guarded by mLock
+    // Open-addressed table from fd to index in mRequests, -1 for empty slots.
+    Vector<ssize_t> mRequestSlots;  // guarded by mLock
     int mNextRequestSeq;
 
     // This state is only used privately by pollOnce and does not require a lock since
@@ -474,7 +485,14 @@ private:
     int removeFd(int fd, int seq);
     void awoken();
     void pushResponse(int events, const Request& request);
+    size_t findRequestSlotLocked(int fd) const;
+    ssize_t findRequestLocked(int fd) const;
+    void addRequestLocked(const Request& request);
+    void removeRequestAtLocked(size_t requestIndex);
     void rebuildEpollLocked();
+    static bool isMessageLater(const MessageEnvelope& a, const MessageEnvelope& b);
+    template <typename Predicate>
+    void removeMessagesLocked(Predicate predicate);
     void scheduleEpollRebuildLocked();
 
     static void initTLSKey();
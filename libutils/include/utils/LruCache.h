@@ -47,6 +47,9 @@ public:
     void setOnEntryRemovedListener(OnEntryRemoved<TKey, TValue>* listener);
     size_t size() const;
     const TValue& get(const TKey& key);
+    // Like get(), but tells a miss apart from a stored null value: returns
+    // false, leaving outValue untouched, if key isn't in the cache.
+    bool get(const TKey& key, TValue* outValue);
     bool put(const TKey& key, const TValue& value);
     bool remove(const TKey& key);
     bool removeOldest();
@@ -200,6 +203,19 @@ const TValue& LruCache<TKey, TValue>::get(const TKey& key) {
     return entry->value;
 }
 
+template <typename TKey, typename TValue>
+bool LruCache<TKey, TValue>::get(const TKey& key, TValue* outValue) {
+    typename LruCacheSet::const_iterator find_result = findByKey(key);
+    if (find_result == mSet->end()) {
+        return false;
+    }
+    Entry *entry = reinterpret_cast<Entry*>(*find_result);
+    detachFromCache(*entry);
+    attachToCache(*entry);
+    *outValue = entry->value;
+    return true;
+}
+
 template <typename TKey, typename TValue>
 bool LruCache<TKey, TValue>::put(const TKey& key, const TValue& value) {
     if (mMaxCapacity != kUnlimitedCapacity && size() >= mMaxCapacity) {
@@ -17,6 +17,9 @@
 #ifndef _UTILS_PROPERTY_MAP_H
 #define _UTILS_PROPERTY_MAP_H
 
+#include <memory>
+#include <vector>
+
 #include <utils/KeyedVector.h>
 #include <utils/String8.h>
 #include <utils/Errors.h>
@@ -43,6 +46,10 @@ namespace android {
  *
  * The file must not contain duplicate keys.
  *
+ * A loaded map keeps the file mapped and looks keys and values up where they are
+ * in it.  Nothing is copied into String8s until a value is asked for as a string,
+ * or the map is changed or iterated over with getProperties().
+ *
  * TODO Support escape sequences and quoted values when needed.
  */
 class PropertyMap {
@@ -75,7 +82,7 @@ public:
     void addAll(const PropertyMap* map);
 
     /* Gets the underlying property map. */
-    inline const KeyedVector<String8, String8>& getProperties() const { return mProperties; }
+    const KeyedVector<String8, String8>& getProperties() const;
 
     /* Loads a property map from a file. */
     static status_t load(const String8& filename, PropertyMap** outMap);
@@ -98,7 +105,23 @@ private:
         status_t parseCharacterLiteral(char16_t* outCharacter);
     };
 
-    KeyedVector<String8, String8> mProperties;
+    struct LoadedProperty {
+        const char* key;
+        size_t keyLength;
+        const char* value;
+        size_t valueLength;
+        int32_t lineNumber;
+    };
+
+    const LoadedProperty* findLoaded(const String8& key) const;
+    bool tryGetValue(const String8& key, const char** outValue, size_t* outLength) const;
+    // Copies what was loaded into mProperties, and lets go of the file.
+    void materialize() const;
+
+    mutable KeyedVector<String8, String8> mProperties;
+    // Sorted by key.  While not empty, mProperties is.
+    mutable std::vector<LoadedProperty> mLoaded;
+    mutable std::shared_ptr<Tokenizer> mSource;
 };
 
 } // namespace android
@@ -290,6 +290,12 @@ public:
         getWeakRefs()->trackMe(enable, retain); 
     }
 
+            //! DEBUGGING ONLY: Write, for every class that called
+            //! trackRefContention(), its reference count operations and
+            //! compare-and-swap retries to fd. Writes nothing unless
+            //! RefBase.cpp is built with DEBUG_REFS_CONTENTION.
+    static  void            dumpRefContention(int fd);
+
     typedef RefBase basetype;
 
 protected:
@@ -304,6 +310,12 @@ protected:
     };
     
             void            extendObjectLifetime(int32_t mode);
+
+            //! DEBUGGING ONLY: Count reference operations on this object
+            //! under className, see dumpRefContention(). Call it from the
+            //! constructor, before any reference is taken. Has no effect
+            //! unless RefBase.cpp is built with DEBUG_REFS_CONTENTION.
+            void            trackRefContention(const char* className);
             
     //! Flags for onIncStrongAttempted()
     enum {
@@ -106,6 +106,12 @@ public:
 
             status_t            remove(size_t len, size_t begin=0);
 
+            // Returns a string equal to this one that shares its storage with
+            // every other interned copy of the same text, so that identifiers
+            // such as interface descriptors are only stored once.  Interned
+            // text is never freed.
+            String16            intern() const;
+
     inline  int                 compare(const String16& other) const;
 
     inline  bool                operator<(const String16& other) const;
@@ -102,6 +102,12 @@ public:
                                            size_t *next_index) const;
             void                getUtf32(char32_t* dst) const;
 
+            // Returns a string equal to this one that shares its storage with
+            // every other interned copy of the same text, so that identifiers
+            // which are created over and over are only stored once.  Interned
+            // text is never freed.
+            String8             intern() const;
+
     inline  String8&            operator=(const String8& other);
     inline  String8&            operator=(const char* other);
 
@@ -238,14 +244,37 @@ public:
     String8& convertToResPath();
 
 private:
+    // Strings of up to kInlineLength bytes are stored in the object itself,
+    // longer ones in a SharedBuffer that copies share until one is modified.
+    // The last byte of the storage holds the length of an inline string, or
+    // kSharedTag if mString points to a SharedBuffer.
+    enum { kStorageSize = 3 * sizeof(void*) };
+    static const size_t kInlineLength = kStorageSize - 2;
+    static const unsigned char kSharedTag = 0xff;
+
+    inline  bool                isInline() const;
+    inline  unsigned char       tag() const;
+    inline  void                setTag(unsigned char tag);
+
+            char*               initBuffer(size_t len);
+            status_t            initFromUTF8(const char* in, size_t len);
+            status_t            initFromUTF16(const char16_t* in, size_t len);
+            status_t            initFromUTF32(const char32_t* in, size_t len);
+            void                releaseBuffer();
+            void                swap(String8& other);
+
             status_t            real_append(const char* other, size_t numChars);
             char*               find_extension(void) const;
 
-            const char* mString;
+    union {
+            const char*         mString;
+            char                mInline[kStorageSize];
+    };
 };
 
-// String8 can be trivially moved using memcpy() because moving does not
-// require any change to the underlying SharedBuffer contents or reference count.
+// String8 can be trivially moved using memcpy() because neither representation
+// points into the object itself, and moving does not require any change to the
+// underlying SharedBuffer contents or reference count.
 ANDROID_TRIVIAL_MOVE_TRAIT(String8)
 
 // ---------------------------------------------------------------------------
@@ -265,13 +294,28 @@ inline const String8 String8::empty() {
     return String8();
 }
 
+inline unsigned char String8::tag() const
+{
+    return static_cast<unsigned char>(mInline[kStorageSize - 1]);
+}
+
+inline void String8::setTag(unsigned char tag)
+{
+    mInline[kStorageSize - 1] = static_cast<char>(tag);
+}
+
+inline bool String8::isInline() const
+{
+    return tag() != kSharedTag;
+}
+
 inline const char* String8::c_str() const
 {
-    return mString;
+    return isInline() ? mInline : mString;
 }
 inline const char* String8::string() const
 {
-    return mString;
+    return c_str();
 }
 
 inline std::string String8::std_string(const String8& str)
@@ -339,72 +383,72 @@ inline String8 String8::operator+(const char* other) const
 
 inline int String8::compare(const String8& other) const
 {
-    return strcmp(mString, other.mString);
+    return strcmp(string(), other.string());
 }
 
 inline bool String8::operator<(const String8& other) const
 {
-    return strcmp(mString, other.mString) < 0;
+    return strcmp(string(), other.string()) < 0;
 }
 
 inline bool String8::operator<=(const String8& other) const
 {
-    return strcmp(mString, other.mString) <= 0;
+    return strcmp(string(), other.string()) <= 0;
 }
 
 inline bool String8::operator==(const String8& other) const
 {
-    return strcmp(mString, other.mString) == 0;
+    return strcmp(string(), other.string()) == 0;
 }
 
 inline bool String8::operator!=(const String8& other) const
 {
-    return strcmp(mString, other.mString) != 0;
+    return strcmp(string(), other.string()) != 0;
 }
 
 inline bool String8::operator>=(const String8& other) const
 {
-    return strcmp(mString, other.mString) >= 0;
+    return strcmp(string(), other.string()) >= 0;
 }
 
 inline bool String8::operator>(const String8& other) const
 {
-    return strcmp(mString, other.mString) > 0;
+    return strcmp(string(), other.string()) > 0;
 }
 
 inline bool String8::operator<(const char* other) const
 {
-    return strcmp(mString, other) < 0;
+    return strcmp(string(), other) < 0;
 }
 
 inline bool String8::operator<=(const char* other) const
 {
-    return strcmp(mString, other) <= 0;
+    return strcmp(string(), other) <= 0;
 }
 
 inline bool String8::operator==(const char* other) const
 {
-    return strcmp(mString, other) == 0;
+    return strcmp(string(), other) == 0;
 }
 
 inline bool String8::operator!=(const char* other) const
 {
-    return strcmp(mString, other) != 0;
+    return strcmp(string(), other) != 0;
 }
 
 inline bool String8::operator>=(const char* other) const
 {
-    return strcmp(mString, other) >= 0;
+    return strcmp(string(), other) >= 0;
 }
 
 inline bool String8::operator>(const char* other) const
 {
-    return strcmp(mString, other) > 0;
+    return strcmp(string(), other) > 0;
 }
 
 inline String8::operator const char*() const
 {
-    return mString;
+    return string();
 }
 
 }  // namespace android
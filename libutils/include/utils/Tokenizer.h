@@ -103,6 +103,13 @@ public:
      */
     String8 nextToken(const char* delimiters);
 
+    /**
+     * Same as nextToken() but without the copy: returns where the token starts in
+     * the tokenizer's buffer and sets outLength to how long it is.  The token is
+     * not null terminated, and lives as long as the tokenizer does.
+     */
+    const char* nextTokenInPlace(const char* delimiters, size_t* outLength);
+
     /**
      * Advances to the next line.
      * Does nothing if already at the end of the file.
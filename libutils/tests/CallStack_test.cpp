@@ -0,0 +1,50 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <gtest/gtest.h>
+
+#include <string.h>
+
+#include <utils/CallStack.h>
+
+using namespace android;
+
+static void __attribute__((noinline)) CallStackTestCapture(CallStack* stack) {
+    stack->capture(0);
+    asm volatile("");
+}
+
+TEST(CallStack, capture_symbolizes_when_printed) {
+    CallStack stack;
+    CallStackTestCapture(&stack);
+    size_t frames = stack.size();
+    ASSERT_LT(1u, frames);
+
+    String8 trace = stack.toString();
+    EXPECT_EQ(0, strncmp("#00 pc ", trace.string(), 7)) << trace.string();
+    size_t lines = 0;
+    for (const char* p = trace.string(); (p = strchr(p, '\n')) != nullptr; ++p) {
+        ++lines;
+    }
+    EXPECT_EQ(frames, lines);
+    // Printing again gives the same thing, without symbolizing twice.
+    EXPECT_EQ(frames, stack.size());
+    EXPECT_STREQ(trace.string(), stack.toString().string());
+
+    stack.clear();
+    EXPECT_EQ(0u, stack.size());
+    EXPECT_STREQ("", stack.toString().string());
+}
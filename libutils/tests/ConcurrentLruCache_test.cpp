@@ -0,0 +1,129 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include <gtest/gtest.h>
+#include <utils/ConcurrentLruCache.h>
+
+namespace android {
+
+typedef ConcurrentLruCache<int, int> IntCache;
+
+class CountingCallback : public OnEntryRemoved<int, int> {
+public:
+    CountingCallback() : callbackCount(0) { }
+    void operator()(int&, int&) {
+        callbackCount++;
+    }
+    std::atomic<int> callbackCount;
+};
+
+TEST(ConcurrentLruCacheTest, Simple) {
+    IntCache cache(100);
+    EXPECT_TRUE(cache.put(1, 10));
+    EXPECT_TRUE(cache.put(2, 20));
+    EXPECT_FALSE(cache.put(1, 11)) << "put() replaced an existing entry";
+    EXPECT_EQ(2U, cache.size());
+
+    int value = -1;
+    EXPECT_TRUE(cache.get(1, &value));
+    EXPECT_EQ(10, value);
+    EXPECT_FALSE(cache.get(3, &value));
+    EXPECT_EQ(10, value) << "a miss changed the out value";
+
+    EXPECT_TRUE(cache.remove(1));
+    EXPECT_FALSE(cache.remove(1));
+    EXPECT_FALSE(cache.get(1, &value));
+    EXPECT_EQ(1U, cache.hitCount());
+    EXPECT_EQ(2U, cache.missCount());
+}
+
+TEST(ConcurrentLruCacheTest, MaxCapacity) {
+    // The callback has to outlive the cache, whose destructor calls it.
+    CountingCallback callback;
+    // 4 shards of 2 each.
+    IntCache cache(8, 4);
+    cache.setOnEntryRemovedListener(&callback);
+    for (int i = 0; i < 1000; i++) {
+        cache.put(i, i);
+    }
+    EXPECT_LE(cache.size(), 8U);
+    EXPECT_EQ(1000U - cache.size(), cache.evictionCount());
+    EXPECT_EQ(static_cast<int>(cache.evictionCount()), callback.callbackCount);
+
+    cache.clear();
+    EXPECT_EQ(0U, cache.size());
+    EXPECT_EQ(1000, callback.callbackCount);
+}
+
+TEST(ConcurrentLruCacheTest, EvictsOldestOfShard) {
+    // A single shard is an exact LruCache.
+    IntCache cache(3, 1);
+    cache.put(1, 1);
+    cache.put(2, 2);
+    cache.put(3, 3);
+    int value;
+    cache.get(1, &value);
+    cache.put(4, 4);
+    EXPECT_TRUE(cache.get(1, &value));
+    EXPECT_FALSE(cache.get(2, &value));
+    EXPECT_EQ(1U, cache.evictionCount());
+}
+
+TEST(ConcurrentLruCacheTest, UnlimitedCapacity) {
+    IntCache cache(LruCache<int, int>::kUnlimitedCapacity);
+    for (int i = 0; i < 1000; i++) {
+        cache.put(i, i);
+    }
+    EXPECT_EQ(1000U, cache.size());
+    EXPECT_EQ(0U, cache.evictionCount());
+}
+
+TEST(ConcurrentLruCacheTest, ConcurrentAccess) {
+    CountingCallback callback;
+    IntCache cache(256);
+    cache.setOnEntryRemovedListener(&callback);
+    constexpr int kThreads = 4;
+    constexpr int kIterations = 20000;
+    std::vector<std::thread> threads;
+    for (int t = 0; t < kThreads; t++) {
+        threads.emplace_back([&cache, t]() {
+            for (int i = 0; i < kIterations; i++) {
+                int key = (i * 7 + t) % 512;
+                int value;
+                if (cache.get(key, &value)) {
+                    ASSERT_EQ(key * 3, value);
+                } else {
+                    cache.put(key, key * 3);
+                }
+                if (i % 64 == 0) {
+                    cache.remove(key);
+                }
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    EXPECT_LE(cache.size(), 256U);
+    EXPECT_EQ(static_cast<uint64_t>(kThreads * kIterations),
+            cache.hitCount() + cache.missCount());
+}
+
+}  // namespace android
@@ -0,0 +1,147 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include <vector>
+
+#include <benchmark/benchmark.h>
+#include <utils/Looper.h>
+#include <utils/Timers.h>
+
+namespace android {
+
+class CountingMessageHandler : public MessageHandler {
+public:
+    size_t count = 0;
+
+    virtual void handleMessage(const Message&) {
+        count++;
+    }
+};
+
+// Delays spread over a second in a fixed pseudo-random order, as from many
+// handlers posting with different timeouts.
+static nsecs_t delay(size_t i) {
+    return ms2ns((i * 7919) % 1000);
+}
+
+// Posts state.range(0) delayed messages, then removes them all.
+static void BM_post_remove(benchmark::State& state) {
+    sp<Looper> looper = new Looper(false);
+    sp<CountingMessageHandler> handler = new CountingMessageHandler();
+    nsecs_t now = systemTime(SYSTEM_TIME_MONOTONIC);
+    while (state.KeepRunning()) {
+        for (int i = 0; i < state.range(0); i++) {
+            looper->sendMessageAtTime(now + s2ns(1) + delay(i), handler, Message(i));
+        }
+        looper->removeMessages(handler);
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_post_remove)->Arg(10)->Arg(100)->Arg(1000)->Arg(10000);
+
+// Posts state.range(0) messages, all already due, and dispatches them.
+static void BM_post_dispatch(benchmark::State& state) {
+    sp<Looper> looper = new Looper(false);
+    sp<CountingMessageHandler> handler = new CountingMessageHandler();
+    nsecs_t now = systemTime(SYSTEM_TIME_MONOTONIC);
+    while (state.KeepRunning()) {
+        for (int i = 0; i < state.range(0); i++) {
+            looper->sendMessageAtTime(now - delay(i), handler, Message(i));
+        }
+        looper->pollOnce(0);
+    }
+    if (handler->count != size_t(state.iterations() * state.range(0))) {
+        state.SkipWithError("not all messages were dispatched");
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_post_dispatch)->Arg(10)->Arg(100)->Arg(1000)->Arg(10000);
+
+// Removes one message kind out of state.range(0) pending ones, which are then
+// posted again.
+static void BM_remove_what(benchmark::State& state) {
+    sp<Looper> looper = new Looper(false);
+    sp<CountingMessageHandler> handler = new CountingMessageHandler();
+    nsecs_t now = systemTime(SYSTEM_TIME_MONOTONIC);
+    for (int i = 0; i < state.range(0); i++) {
+        looper->sendMessageAtTime(now + s2ns(1) + delay(i), handler, Message(i % 16));
+    }
+    int what = 0;
+    while (state.KeepRunning()) {
+        looper->removeMessages(handler, what);
+        state.PauseTiming();
+        for (int i = what; i < state.range(0); i += 16) {
+            looper->sendMessageAtTime(now + s2ns(1) + delay(i), handler, Message(what));
+        }
+        what = (what + 1) % 16;
+        state.ResumeTiming();
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_remove_what)->Arg(100)->Arg(1000)->Arg(10000);
+
+static int stubCallback(int, int, void*) {
+    return 1;
+}
+
+// Registers state.range(0) descriptors and then removes them all.
+static void BM_add_remove_fd(benchmark::State& state) {
+    sp<Looper> looper = new Looper(false);
+    std::vector<int> fds(state.range(0));
+    for (int& fd : fds) {
+        fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    }
+    while (state.KeepRunning()) {
+        for (int fd : fds) {
+            looper->addFd(fd, 0, Looper::EVENT_INPUT, stubCallback, nullptr);
+        }
+        for (int fd : fds) {
+            looper->removeFd(fd);
+        }
+    }
+    for (int fd : fds) {
+        close(fd);
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_add_remove_fd)->Arg(10)->Arg(100)->Arg(1000);
+
+// Polls with state.range(0) registered descriptors, the last of which is always ready.
+static void BM_poll_ready_fd(benchmark::State& state) {
+    sp<Looper> looper = new Looper(false);
+    std::vector<int> fds(state.range(0));
+    for (int& fd : fds) {
+        fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        looper->addFd(fd, 0, Looper::EVENT_INPUT, stubCallback, nullptr);
+    }
+    uint64_t value = 1;
+    if (write(fds.back(), &value, sizeof(value)) != sizeof(value)) {
+        state.SkipWithError("could not signal the eventfd");
+    }
+    while (state.KeepRunning()) {
+        looper->pollOnce(0);
+    }
+    for (int fd : fds) {
+        close(fd);
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_poll_ready_fd)->Arg(10)->Arg(100)->Arg(1000);
+
+}  // namespace android
@@ -412,6 +412,42 @@ TEST_F(LooperTest, RemoveFd_WhenCallbackAddedThenRemovedTwice_ReturnsOnceFirstTi
             << "removeFd should return 0 second time because FD was no longer registered";
 }
 
+TEST_F(LooperTest, PollOnce_WhenManyCallbacksAddedAndSomeRemoved_OnlyRemainingCallbacksShouldBeInvoked) {
+    const size_t PIPE_COUNT = 64;
+    Pipe pipes[PIPE_COUNT];
+    StubCallbackHandler* handlers[PIPE_COUNT];
+    for (size_t i = 0; i < PIPE_COUNT; i++) {
+        handlers[i] = new StubCallbackHandler(true);
+        handlers[i]->setCallback(mLooper, pipes[i].receiveFd, Looper::EVENT_INPUT);
+        pipes[i].writeSignal();
+    }
+
+    // Remove every other callback, in an order that moves entries around.
+    for (size_t i = 0; i < PIPE_COUNT; i += 2) {
+        EXPECT_EQ(1, mLooper->removeFd(pipes[PIPE_COUNT - 2 - i].receiveFd))
+                << "removeFd should return 1 because FD was registered";
+    }
+
+    for (int polls = 0; polls < 10; polls++) {
+        mLooper->pollOnce(0);
+    }
+
+    for (size_t i = 0; i < PIPE_COUNT; i++) {
+        if (i % 2 == 0) {
+            EXPECT_EQ(0, handlers[i]->callbackCount)
+                    << "removed callback " << i << " should not be invoked";
+        } else {
+            EXPECT_LT(0, handlers[i]->callbackCount)
+                    << "remaining callback " << i << " should be invoked";
+            EXPECT_EQ(pipes[i].receiveFd, handlers[i]->fd)
+                    << "remaining callback " << i << " should receive its own FD";
+            EXPECT_EQ(1, mLooper->removeFd(pipes[i].receiveFd))
+                    << "removeFd should return 1 because FD was still registered";
+        }
+        delete handlers[i];
+    }
+}
+
 TEST_F(LooperTest, PollOnce_WhenCallbackAddedTwice_OnlySecondCallbackShouldBeInvoked) {
     Pipe pipe;
     StubCallbackHandler handler1(true);
@@ -632,6 +668,33 @@ TEST_F(LooperTest, SendMessageAtTime_WhenSentToThePresent_ShouldInvokeHandlerDur
             << "handled message";
 }
 
+TEST_F(LooperTest, SendMessageAtTime_WhenSentForTheSameTime_ShouldInvokeHandlersInOrderSent) {
+    nsecs_t now = systemTime(SYSTEM_TIME_MONOTONIC);
+    sp<StubMessageHandler> handler = new StubMessageHandler();
+    mLooper->sendMessageAtTime(now, handler, Message(MSG_TEST1));
+    mLooper->sendMessageAtTime(now - ms2ns(10), handler, Message(MSG_TEST2));
+    mLooper->sendMessageAtTime(now, handler, Message(MSG_TEST3));
+    mLooper->sendMessageAtTime(now - ms2ns(10), handler, Message(MSG_TEST4));
+    mLooper->sendMessageAtTime(now, handler, Message(MSG_TEST1));
+
+    int result = mLooper->pollOnce(0);
+
+    EXPECT_EQ(Looper::POLL_CALLBACK, result)
+            << "pollOnce result should be Looper::POLL_CALLBACK because messages were sent";
+    ASSERT_EQ(size_t(5), handler->messages.size())
+            << "handled all messages";
+    EXPECT_EQ(MSG_TEST2, handler->messages[0].what)
+            << "earliest message first";
+    EXPECT_EQ(MSG_TEST4, handler->messages[1].what)
+            << "then the next one sent for the same time";
+    EXPECT_EQ(MSG_TEST1, handler->messages[2].what)
+            << "later messages in the order sent";
+    EXPECT_EQ(MSG_TEST3, handler->messages[3].what)
+            << "later messages in the order sent";
+    EXPECT_EQ(MSG_TEST1, handler->messages[4].what)
+            << "later messages in the order sent";
+}
+
 TEST_F(LooperTest, RemoveMessage_WhenRemovingAllMessagesForHandler_ShouldRemoveThoseMessage) {
     sp<StubMessageHandler> handler = new StubMessageHandler();
     mLooper->sendMessage(handler, Message(MSG_TEST1));
@@ -0,0 +1,61 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <benchmark/benchmark.h>
+#include <utils/ConcurrentLruCache.h>
+#include <utils/LruCache.h>
+#include <utils/Mutex.h>
+
+namespace android {
+
+// A working set of half the capacity: after warming up, almost every lookup
+// hits, like a glyph cache would.
+static constexpr int kKeys = 512;
+static constexpr uint32_t kCapacity = 1024;
+
+// What users do without ConcurrentLruCache: one lock around an LruCache.
+static Mutex gLock;
+static LruCache<int, int> gLockedCache(kCapacity);
+static ConcurrentLruCache<int, int> gShardedCache(kCapacity);
+
+static void BM_LruCache_single_lock(benchmark::State& state) {
+    int key = state.thread_index * 7919;
+    while (state.KeepRunning()) {
+        key = (key + 31) % kKeys;
+        Mutex::Autolock _l(gLock);
+        int value;
+        if (!gLockedCache.get(key, &value)) {
+            gLockedCache.put(key, key);
+        }
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_LruCache_single_lock)->ThreadRange(1, 8);
+
+static void BM_ConcurrentLruCache(benchmark::State& state) {
+    int key = state.thread_index * 7919;
+    while (state.KeepRunning()) {
+        key = (key + 31) % kKeys;
+        int value;
+        if (!gShardedCache.get(key, &value)) {
+            gShardedCache.put(key, key);
+        }
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_ConcurrentLruCache)->ThreadRange(1, 8);
+
+}  // namespace android
@@ -169,6 +169,24 @@ TEST_F(LruCacheTest, Simple) {
     EXPECT_EQ(3u, cache.size());
 }
 
+TEST_F(LruCacheTest, GetWithOutValue) {
+    LruCache<SimpleKey, StringValue> cache(100);
+    cache.put(1, "one");
+    cache.put(2, NULL);
+
+    StringValue value = "unchanged";
+    EXPECT_FALSE(cache.get(3, &value));
+    EXPECT_STREQ("unchanged", value);
+    EXPECT_TRUE(cache.get(1, &value));
+    EXPECT_STREQ("one", value);
+    // A stored null value is still a hit.
+    EXPECT_TRUE(cache.get(2, &value));
+    EXPECT_EQ(NULL, value);
+    // And, like get(key), marks the entry as recently used.
+    cache.get(1, &value);
+    EXPECT_EQ(NULL, cache.peekOldestValue());
+}
+
 TEST_F(LruCacheTest, MaxCapacity) {
     LruCache<SimpleKey, StringValue> cache(2);
 
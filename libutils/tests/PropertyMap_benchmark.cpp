@@ -0,0 +1,116 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <dirent.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <string>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+#include <utils/PropertyMap.h>
+
+namespace android {
+
+// The input device configuration files the input stack loads at startup.
+static std::vector<String8> idcFiles() {
+    std::vector<String8> files;
+    for (const char* dir : { "/system/usr/idc", "/vendor/usr/idc", "/odm/usr/idc" }) {
+        DIR* d = opendir(dir);
+        if (!d) {
+            continue;
+        }
+        while (dirent* entry = readdir(d)) {
+            size_t length = strlen(entry->d_name);
+            if (length > 4 && !strcmp(entry->d_name + length - 4, ".idc")) {
+                files.push_back(String8::format("%s/%s", dir, entry->d_name));
+            }
+        }
+        closedir(d);
+    }
+    return files;
+}
+
+// A configuration file of state.range(0) properties, the sort a touch screen has.
+static String8 generatedFile(benchmark::State& state) {
+    const char* tmpdir = getenv("TMPDIR");
+    String8 path = String8::format("%s/PropertyMap_benchmark_XXXXXX",
+            tmpdir ? tmpdir : "/data/local/tmp");
+    int fd = mkstemp(const_cast<char*>(path.string()));
+    if (fd < 0) {
+        state.SkipWithError("mkstemp failed");
+        return path;
+    }
+    std::string contents = "# Generated\ntouch.deviceType = touchScreen\n";
+    for (int64_t i = 1; i < state.range(0); i++) {
+        char line[64];
+        snprintf(line, sizeof(line), "touch.property%" PRId64 " = %" PRId64 ".5\n", i, i);
+        contents += line;
+    }
+    if (write(fd, contents.data(), contents.size()) != ssize_t(contents.size())) {
+        state.SkipWithError("write failed");
+    }
+    close(fd);
+    return path;
+}
+
+// Loads a file and looks up a few properties, as InputDevice configuration does.
+static void loadAndQuery(benchmark::State& state, const String8& file) {
+    PropertyMap* map;
+    if (PropertyMap::load(file, &map)) {
+        state.SkipWithError("load failed");
+        return;
+    }
+    String8 deviceType;
+    float scale;
+    bool orientationAware;
+    map->tryGetProperty(String8("touch.deviceType"), deviceType);
+    map->tryGetProperty(String8("touch.size.scale"), scale);
+    map->tryGetProperty(String8("touch.orientationAware"), orientationAware);
+    benchmark::DoNotOptimize(deviceType.string());
+    delete map;
+}
+
+static void BM_PropertyMap_load_idc(benchmark::State& state) {
+    std::vector<String8> files = idcFiles();
+    if (files.empty()) {
+        state.SkipWithError("no .idc files");
+        return;
+    }
+    while (state.KeepRunning()) {
+        for (const String8& file : files) {
+            loadAndQuery(state, file);
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * files.size());
+}
+BENCHMARK(BM_PropertyMap_load_idc);
+
+static void BM_PropertyMap_load_generated(benchmark::State& state) {
+    String8 file = generatedFile(state);
+    while (state.KeepRunning()) {
+        loadAndQuery(state, file);
+    }
+    unlink(file.string());
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_PropertyMap_load_generated)->Arg(8)->Arg(32)->Arg(128);
+
+}  // namespace android
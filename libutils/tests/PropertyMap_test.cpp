@@ -0,0 +1,96 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <android-base/file.h>
+#include <android-base/test_utils.h>
+#include <gtest/gtest.h>
+#include <utils/PropertyMap.h>
+
+using namespace android;
+
+static PropertyMap* loadContents(const char* contents) {
+    TemporaryFile tf;
+    EXPECT_TRUE(android::base::WriteStringToFile(contents, tf.path));
+    PropertyMap* map = NULL;
+    PropertyMap::load(String8(tf.path), &map);
+    return map;
+}
+
+TEST(PropertyMap, load) {
+    PropertyMap* map = loadContents(
+            "# Comment\n"
+            "touch.deviceType = touchScreen\n"
+            "\n"
+            "  touch.size.scale=2.5   \n"
+            "touch.orientationAware = 1\n"
+            "device.internal = 0");
+    ASSERT_TRUE(map != NULL);
+
+    String8 deviceType;
+    ASSERT_TRUE(map->tryGetProperty(String8("touch.deviceType"), deviceType));
+    EXPECT_STREQ("touchScreen", deviceType.string());
+    float scale = 0;
+    ASSERT_TRUE(map->tryGetProperty(String8("touch.size.scale"), scale));
+    EXPECT_EQ(2.5f, scale);
+    bool orientationAware = false;
+    ASSERT_TRUE(map->tryGetProperty(String8("touch.orientationAware"), orientationAware));
+    EXPECT_TRUE(orientationAware);
+    // The last value runs to the end of the file.
+    int32_t internal = -1;
+    ASSERT_TRUE(map->tryGetProperty(String8("device.internal"), internal));
+    EXPECT_EQ(0, internal);
+
+    EXPECT_FALSE(map->hasProperty(String8("touch")));
+    EXPECT_FALSE(map->hasProperty(String8("touch.deviceTypes")));
+    // Not an integer.
+    EXPECT_FALSE(map->tryGetProperty(String8("touch.deviceType"), internal));
+    EXPECT_EQ(0, internal);
+
+    // Changing the map keeps what was loaded.
+    map->addProperty(String8("touch.deviceType"), String8("pointer"));
+    ASSERT_TRUE(map->tryGetProperty(String8("touch.deviceType"), deviceType));
+    EXPECT_STREQ("pointer", deviceType.string());
+    ASSERT_TRUE(map->tryGetProperty(String8("touch.size.scale"), scale));
+    EXPECT_EQ(2.5f, scale);
+    EXPECT_EQ(4u, map->getProperties().size());
+
+    PropertyMap copy;
+    copy.addAll(map);
+    delete map;
+    ASSERT_TRUE(copy.tryGetProperty(String8("touch.orientationAware"), orientationAware));
+    EXPECT_TRUE(orientationAware);
+}
+
+TEST(PropertyMap, load_getProperties) {
+    PropertyMap* map = loadContents("b = 2\na = 1\n");
+    ASSERT_TRUE(map != NULL);
+
+    const KeyedVector<String8, String8>& properties = map->getProperties();
+    ASSERT_EQ(2u, properties.size());
+    EXPECT_STREQ("a", properties.keyAt(0).string());
+    EXPECT_STREQ("1", properties.valueAt(0).string());
+    EXPECT_STREQ("b", properties.keyAt(1).string());
+    EXPECT_STREQ("2", properties.valueAt(1).string());
+    delete map;
+}
+
+TEST(PropertyMap, load_errors) {
+    EXPECT_TRUE(loadContents("a = 1\nb = 2\na = 3\n") == NULL);
+    EXPECT_TRUE(loadContents("a 1\n") == NULL);
+    EXPECT_TRUE(loadContents("a = 1 2\n") == NULL);
+    EXPECT_TRUE(loadContents("a = \"1\"\n") == NULL);
+    EXPECT_TRUE(loadContents(" = 1\n") == NULL);
+}
@@ -0,0 +1,79 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <benchmark/benchmark.h>
+#include <utils/RefBase.h>
+#include <utils/StrongPointer.h>
+
+namespace android {
+
+class BenchmarkObject : public RefBase {
+};
+
+// Shared by all threads of the threaded runs, so they fight over its counts.
+static sp<BenchmarkObject> gShared;
+
+static void setUp(const benchmark::State& state) {
+    if (state.thread_index == 0) {
+        gShared = new BenchmarkObject();
+    }
+}
+
+static void tearDown(const benchmark::State& state) {
+    if (state.thread_index == 0) {
+        gShared = nullptr;
+    }
+}
+
+// Copies and drops a strong reference, with another one held throughout.
+static void BM_sp_copy(benchmark::State& state) {
+    setUp(state);
+    while (state.KeepRunning()) {
+        sp<BenchmarkObject> copy(gShared);
+        benchmark::DoNotOptimize(copy.get());
+    }
+    state.SetItemsProcessed(state.iterations());
+    tearDown(state);
+}
+BENCHMARK(BM_sp_copy)->ThreadRange(1, 4);
+
+// Promotes a weak reference to an object that has a strong one.
+static void BM_wp_promote(benchmark::State& state) {
+    setUp(state);
+    wp<BenchmarkObject> weak;
+    while (state.KeepRunning()) {
+        if (weak == nullptr) {
+            weak = gShared;
+        }
+        sp<BenchmarkObject> strong = weak.promote();
+        benchmark::DoNotOptimize(strong.get());
+    }
+    state.SetItemsProcessed(state.iterations());
+    tearDown(state);
+}
+BENCHMARK(BM_wp_promote)->ThreadRange(1, 4);
+
+// An object's whole life: first and last strong reference.
+static void BM_sp_create_destroy(benchmark::State& state) {
+    while (state.KeepRunning()) {
+        sp<BenchmarkObject> object = new BenchmarkObject();
+        benchmark::DoNotOptimize(object.get());
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_sp_create_destroy);
+
+}  // namespace android
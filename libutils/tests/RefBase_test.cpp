@@ -90,6 +90,77 @@ TEST(RefBase, WeakCopies) {
     ASSERT_FALSE(isDeleted) << "Deletion on wp destruction should no longer occur";
 }
 
+TEST(RefBase, StrongRefsShareOneWeakRef) {
+    bool isDeleted;
+    Foo* foo = new Foo(&isDeleted);
+    wp<Foo> wp1(foo);
+    {
+        sp<Foo> sp1(foo);
+        sp<Foo> sp2(sp1);
+        sp<Foo> sp3(sp1);
+        ASSERT_EQ(3, foo->getStrongCount());
+        // One weak reference for wp1, one for all of the strong ones.
+        EXPECT_EQ(2, foo->getWeakRefs()->getWeakCount());
+        sp2 = nullptr;
+        EXPECT_EQ(2, foo->getWeakRefs()->getWeakCount());
+    }
+    ASSERT_TRUE(isDeleted) << "foo was leaked!";
+    EXPECT_EQ(1, wp1.get_refs()->getWeakCount());
+}
+
+TEST(RefBase, PromotionTakesWeakRefOnlyWhenFirst) {
+    bool isDeleted;
+    Foo* foo = new Foo(&isDeleted);
+    wp<Foo> wp1(foo);
+    {
+        sp<Foo> sp1 = wp1.promote();
+        ASSERT_EQ(foo, sp1.get());
+        EXPECT_EQ(1, foo->getStrongCount());
+        EXPECT_EQ(2, foo->getWeakRefs()->getWeakCount());
+        sp<Foo> sp2 = wp1.promote();
+        EXPECT_EQ(2, foo->getStrongCount());
+        EXPECT_EQ(2, foo->getWeakRefs()->getWeakCount());
+    }
+    ASSERT_TRUE(isDeleted) << "foo was leaked!";
+    ASSERT_EQ(nullptr, wp1.promote().get());
+    // The failed promotion must not have kept a weak reference.
+    EXPECT_EQ(1, wp1.get_refs()->getWeakCount());
+}
+
+class WeakLifetimeFoo : public RefBase {
+public:
+    WeakLifetimeFoo(bool* deleted_check) : mDeleted(deleted_check) {
+        *mDeleted = false;
+        extendObjectLifetime(OBJECT_LIFETIME_WEAK);
+    }
+
+    ~WeakLifetimeFoo() {
+        *mDeleted = true;
+    }
+private:
+    bool* mDeleted;
+};
+
+TEST(RefBase, WeakLifetimeRevival) {
+    bool isDeleted;
+    WeakLifetimeFoo* foo = new WeakLifetimeFoo(&isDeleted);
+    wp<WeakLifetimeFoo> wp1(foo);
+    sp<WeakLifetimeFoo> sp1(foo);
+    sp1 = nullptr;
+    ASSERT_FALSE(isDeleted) << "deleted with a weak reference left";
+    EXPECT_EQ(0, foo->getStrongCount());
+    EXPECT_EQ(1, foo->getWeakRefs()->getWeakCount());
+
+    sp1 = wp1.promote();
+    ASSERT_EQ(foo, sp1.get()) << "revival failed";
+    EXPECT_EQ(2, foo->getWeakRefs()->getWeakCount());
+    sp1 = nullptr;
+    EXPECT_EQ(1, foo->getWeakRefs()->getWeakCount());
+    ASSERT_FALSE(isDeleted);
+    wp1 = nullptr;
+    ASSERT_TRUE(isDeleted) << "foo was leaked!";
+}
+
 
 // Set up a situation in which we race with visit2AndRremove() to delete
 // 2 strong references.  Bar destructor checks that there are no early
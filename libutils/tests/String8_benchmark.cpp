@@ -0,0 +1,111 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <malloc.h>
+#include <stdio.h>
+
+#include <vector>
+
+#include <benchmark/benchmark.h>
+#include <utils/String16.h>
+#include <utils/String8.h>
+
+namespace android {
+
+static size_t heapBytes() {
+    return mallinfo().uordblks;
+}
+
+// Text of state.range(0) bytes, different for each i.
+static std::string text(benchmark::State& state, size_t i) {
+    char prefix[32];
+    snprintf(prefix, sizeof(prefix), "%zu_", i);
+    std::string result(prefix);
+    result.resize(std::max(result.size(), size_t(state.range(0))), 'x');
+    return result;
+}
+
+// Creates strings of state.range(0) bytes, reporting the heap used per string
+// on top of the String8 objects themselves.
+static void BM_String8_create(benchmark::State& state) {
+    const size_t count = 1000;
+    std::vector<std::string> texts;
+    for (size_t i = 0; i < count; i++) {
+        texts.push_back(text(state, i));
+    }
+    std::vector<String8> strings;
+    strings.reserve(count);
+    size_t heapPerString = 0;
+    while (state.KeepRunning()) {
+        size_t before = heapBytes();
+        for (const std::string& t : texts) {
+            strings.emplace_back(t.c_str(), t.size());
+        }
+        heapPerString = (heapBytes() - before) / count;
+        strings.clear();
+    }
+    state.counters["heap_bytes_per_string"] = heapPerString;
+    state.SetItemsProcessed(state.iterations() * count);
+}
+BENCHMARK(BM_String8_create)->Arg(4)->Arg(16)->Arg(22)->Arg(64);
+
+// Copies a string of state.range(0) bytes.
+static void BM_String8_copy(benchmark::State& state) {
+    String8 str(text(state, 0).c_str());
+    while (state.KeepRunning()) {
+        String8 copy(str);
+        benchmark::DoNotOptimize(copy.string());
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_String8_copy)->Arg(4)->Arg(16)->Arg(64);
+
+// Builds a string of state.range(0) bytes a few bytes at a time.
+static void BM_String8_append(benchmark::State& state) {
+    while (state.KeepRunning()) {
+        String8 str;
+        while (str.length() < size_t(state.range(0))) {
+            str.append("abcd");
+        }
+        benchmark::DoNotOptimize(str.string());
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_String8_append)->Arg(16)->Arg(64);
+
+// Keeps 1000 copies of an identifier created from scratch each time, as when
+// the same names are read over and over, reporting the heap used per copy.
+static void BM_String16_intern(benchmark::State& state) {
+    const size_t count = 1000;
+    const char* descriptor = "android.os.IServiceManager";
+    std::vector<String16> strings;
+    strings.reserve(count);
+    size_t heapPerString = 0;
+    while (state.KeepRunning()) {
+        size_t before = heapBytes();
+        for (size_t i = 0; i < count; i++) {
+            String16 str(descriptor);
+            strings.push_back(state.range(0) ? str.intern() : str);
+        }
+        heapPerString = (heapBytes() - before) / count;
+        strings.clear();
+    }
+    state.counters["heap_bytes_per_string"] = heapPerString;
+    state.SetItemsProcessed(state.iterations() * count);
+}
+BENCHMARK(BM_String16_intern)->Arg(0)->Arg(1);
+
+}  // namespace android
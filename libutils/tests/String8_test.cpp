@@ -96,4 +96,80 @@ TEST_F(String8Test, CheckUtf32Conversion) {
     EXPECT_EQ(10U, string8.length());
 }
 
+TEST_F(String8Test, GrowsAndShrinksAcrossInlineLength) {
+    String8 str;
+    std::string expected;
+    for (int i = 0; i < 64; i++) {
+        str.append("x");
+        expected += "x";
+        ASSERT_EQ(expected.size(), str.length());
+        ASSERT_STREQ(expected.c_str(), str.string());
+    }
+
+    str.setTo("short");
+    EXPECT_STREQ("short", str.string());
+    EXPECT_EQ(5U, str.length());
+    str.setTo(expected.c_str());
+    EXPECT_STREQ(expected.c_str(), str.string());
+}
+
+TEST_F(String8Test, AppendToSelf) {
+    // Short enough to be stored inline, while the result is not.
+    String8 str("0123456789abcdef");
+    str.append(str.string());
+    EXPECT_STREQ("0123456789abcdef0123456789abcdef", str.string());
+
+    String8 other("0123456789abcdef");
+    other += other;
+    EXPECT_STREQ("0123456789abcdef0123456789abcdef", other.string());
+}
+
+TEST_F(String8Test, CopiesAreIndependent) {
+    const char* text = "a string that is too long to be stored inline";
+    String8 str1(text);
+    String8 str2(str1);
+    EXPECT_EQ(str1.string(), str2.string()) << "copies share the storage of long strings";
+
+    str2.toUpper(0, 1);
+    EXPECT_STREQ(text, str1.string());
+    EXPECT_EQ('A', str2.string()[0]);
+
+    String8 short1("short");
+    String8 short2(short1);
+    short2.toUpper();
+    EXPECT_STREQ("short", short1.string());
+    EXPECT_STREQ("SHORT", short2.string());
+}
+
+TEST_F(String8Test, LockBufferAcrossInlineLength) {
+    String8 str("abc");
+    char* buf = str.lockBuffer(40);
+    ASSERT_TRUE(buf != NULL);
+    EXPECT_STREQ("abc", buf);
+    memset(buf + 3, 'd', 37);
+    buf[40] = 0;
+    str.unlockBuffer(40);
+    EXPECT_EQ(40U, str.length());
+
+    buf = str.lockBuffer(2);
+    ASSERT_TRUE(buf != NULL);
+    buf[2] = 0;
+    str.unlockBuffer(2);
+    EXPECT_STREQ("ab", str.string());
+
+    str.appendFormat("%s-%d", "x", 42);
+    EXPECT_STREQ("abx-42", str.string());
+}
+
+TEST_F(String8Test, Intern) {
+    const char* text = "android.identifier.that.is.too.long.to.be.inline";
+    String8 str1 = String8(text).intern();
+    String8 str2 = String8(text).intern();
+    EXPECT_STREQ(text, str1.string());
+    EXPECT_EQ(str1.string(), str2.string()) << "interned copies share their storage";
+
+    String8 str3 = String8("short").intern();
+    EXPECT_STREQ("short", str3.string());
+}
+
 }
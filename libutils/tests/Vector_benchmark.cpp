@@ -0,0 +1,148 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <algorithm>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+#include <utils/SortedVector.h>
+#include <utils/String8.h>
+#include <utils/Vector.h>
+
+namespace android {
+
+// Long enough for String8 to keep it in a SharedBuffer.
+static String8 item(int i) {
+    return String8::format("an item that is not stored inline, number %d", i);
+}
+
+// Appends state.range(0) ints.
+static void BM_Vector_push_int(benchmark::State& state) {
+    while (state.KeepRunning()) {
+        Vector<int> vector;
+        for (int i = 0; i < state.range(0); i++) {
+            vector.push(i);
+        }
+        benchmark::DoNotOptimize(vector.array());
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_Vector_push_int)->Arg(100)->Arg(10000);
+
+static void BM_std_vector_push_int(benchmark::State& state) {
+    while (state.KeepRunning()) {
+        std::vector<int> vector;
+        for (int i = 0; i < state.range(0); i++) {
+            vector.push_back(i);
+        }
+        benchmark::DoNotOptimize(vector.data());
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_std_vector_push_int)->Arg(100)->Arg(10000);
+
+// Appends state.range(0) strings, which Vector can move with memmove.
+static void BM_Vector_push_String8(benchmark::State& state) {
+    String8 str = item(0);
+    while (state.KeepRunning()) {
+        Vector<String8> vector;
+        for (int i = 0; i < state.range(0); i++) {
+            vector.push(str);
+        }
+        benchmark::DoNotOptimize(vector.array());
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_Vector_push_String8)->Arg(100)->Arg(10000);
+
+static void BM_std_vector_push_String8(benchmark::State& state) {
+    String8 str = item(0);
+    while (state.KeepRunning()) {
+        std::vector<String8> vector;
+        for (int i = 0; i < state.range(0); i++) {
+            vector.push_back(str);
+        }
+        benchmark::DoNotOptimize(vector.data());
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_std_vector_push_String8)->Arg(100)->Arg(10000);
+
+// Inserts state.range(0) strings at the front, then removes them from the front.
+static void BM_Vector_insert_remove_front_String8(benchmark::State& state) {
+    String8 str = item(0);
+    while (state.KeepRunning()) {
+        Vector<String8> vector;
+        for (int i = 0; i < state.range(0); i++) {
+            vector.insertAt(str, 0);
+        }
+        while (!vector.isEmpty()) {
+            vector.removeAt(0);
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_Vector_insert_remove_front_String8)->Arg(100)->Arg(1000);
+
+static void BM_std_vector_insert_remove_front_String8(benchmark::State& state) {
+    String8 str = item(0);
+    while (state.KeepRunning()) {
+        std::vector<String8> vector;
+        for (int i = 0; i < state.range(0); i++) {
+            vector.insert(vector.begin(), str);
+        }
+        while (!vector.empty()) {
+            vector.erase(vector.begin());
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_std_vector_insert_remove_front_String8)->Arg(100)->Arg(1000);
+
+// Adds state.range(0) strings in a scrambled order.
+static void BM_SortedVector_add_String8(benchmark::State& state) {
+    std::vector<String8> items;
+    for (int i = 0; i < state.range(0); i++) {
+        items.push_back(item((i * 7919) % state.range(0)));
+    }
+    while (state.KeepRunning()) {
+        SortedVector<String8> vector;
+        for (const String8& str : items) {
+            vector.add(str);
+        }
+        benchmark::DoNotOptimize(vector.array());
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_SortedVector_add_String8)->Arg(100)->Arg(1000);
+
+static void BM_std_vector_sorted_insert_String8(benchmark::State& state) {
+    std::vector<String8> items;
+    for (int i = 0; i < state.range(0); i++) {
+        items.push_back(item((i * 7919) % state.range(0)));
+    }
+    while (state.KeepRunning()) {
+        std::vector<String8> vector;
+        for (const String8& str : items) {
+            vector.insert(std::lower_bound(vector.begin(), vector.end(), str), str);
+        }
+        benchmark::DoNotOptimize(vector.data());
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_std_vector_sorted_insert_String8)->Arg(100)->Arg(1000);
+
+}  // namespace android
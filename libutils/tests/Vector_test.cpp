@@ -22,6 +22,7 @@
 
 #include <android/log.h>
 #include <gtest/gtest.h>
+#include <utils/String8.h>
 #include <utils/Vector.h>
 
 namespace android {
@@ -136,4 +137,51 @@ TEST_F(VectorTest, editArray_Shared) {
   }
 }
 
+TEST_F(VectorTest, _shrink_RemoveFromEnd) {
+  Vector<int> vector;
+  for (int i = 0; i < 1000; ++i) {
+    vector.add(i);
+  }
+
+  // Removing the last item one at a time should only shrink the storage
+  // every so often, not on every removal once below half the capacity.
+  size_t reallocations = 0;
+  size_t capacity = vector.capacity();
+  while (!vector.isEmpty()) {
+    vector.removeAt(vector.size() - 1);
+    if (vector.capacity() != capacity) {
+      capacity = vector.capacity();
+      reallocations++;
+    }
+  }
+  EXPECT_LT(reallocations, 20U);
+  EXPECT_EQ(4U, vector.capacity());
+}
+
+TEST_F(VectorTest, TriviallyMovable_InsertAndRemove) {
+  Vector<String8> vector;
+  for (int i = 0; i < 100; ++i) {
+    // Insert at the front so that every item is moved, both in place and
+    // when the storage grows.
+    vector.insertAt(String8::format("a string long enough not to be stored inline %d", i), 0);
+  }
+  Vector<String8> copy = vector;
+
+  // Remove from the middle so that the storage shrinks with items after the gap.
+  vector.removeItemsAt(10, 80);
+  ASSERT_EQ(20U, vector.size());
+  for (size_t i = 0; i < vector.size(); ++i) {
+    int expected = i < 10 ? 99 - i : 99 - (i + 80);
+    EXPECT_EQ(String8::format("a string long enough not to be stored inline %d", expected),
+              vector[i]);
+  }
+
+  // The copy shared the storage and must not have been changed.
+  ASSERT_EQ(100U, copy.size());
+  for (size_t i = 0; i < copy.size(); ++i) {
+    EXPECT_EQ(String8::format("a string long enough not to be stored inline %d", int(99 - i)),
+              copy[i]);
+  }
+}
+
 } // namespace android
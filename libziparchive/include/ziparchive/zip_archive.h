@@ -26,6 +26,10 @@
 #include <sys/types.h>
 #include <utils/Compat.h>
 
+namespace android {
+class FileMap;
+}
+
 /* Zip compression methods we support */
 enum {
   kCompressStored = 0,    // no compression
@@ -114,6 +118,15 @@ typedef void* ZipArchiveHandle;
  */
 int32_t OpenArchive(const char* fileName, ZipArchiveHandle* handle);
 
+/*
+ * Like OpenArchive, but the table of entries used by FindEntry and
+ * StartIteration is built the first time one of them is called, which makes
+ * opening cheaper when few lookups follow. The central directory is still
+ * verified on open, except that duplicate entry names are only reported by
+ * that first FindEntry or StartIteration.
+ */
+int32_t OpenArchiveLazy(const char* fileName, ZipArchiveHandle* handle);
+
 /*
  * Like OpenArchive, but takes a file descriptor open for reading
  * at the start of the file.  The descriptor must be mappable (this does
@@ -137,6 +150,26 @@ int32_t OpenArchiveFd(const int fd, const char* debugFileName, ZipArchiveHandle*
 
 int32_t OpenArchiveFromMemory(void* address, size_t length, const char* debugFileName,
                               ZipArchiveHandle* handle);
+
+/*
+ * Like OpenArchiveFd, but takes the table of entries from an index written
+ * by WriteArchiveIndex rather than scanning the central directory. The index
+ * is mapped and shared, not copied. It's used only if it was written for
+ * this same file (device, inode, size and modification time all match);
+ * otherwise, or if |index_fd| is -1, the archive is scanned as usual.
+ *
+ * Returns 0 on success, and negative values on failure.
+ */
+int32_t OpenArchiveFdWithIndex(const int fd, const char* debugFileName, ZipArchiveHandle* handle,
+                               int index_fd, bool assume_ownership = true);
+
+/*
+ * Writes an index of the archive's entries to |index_fd| for later use with
+ * OpenArchiveFdWithIndex. The archive must have been opened from a file.
+ *
+ * Returns 0 on success, and negative values on failure.
+ */
+int32_t WriteArchiveIndex(ZipArchiveHandle handle, int index_fd);
 /*
  * Close archive, releasing resources associated with it. This will
  * unmap the central directory of the zipfile and free all internal
@@ -205,6 +238,20 @@ void EndIteration(void* cookie);
  */
 int32_t ExtractEntryToFile(ZipArchiveHandle handle, ZipEntry* entry, int fd);
 
+/*
+ * Extract |count| entries as ExtractEntryToFile would, |entries[i]| going to
+ * |fds[i]|, on up to |thread_count| threads. Entries are read with pread so
+ * they don't contend for the archive's file offset; on Windows they're
+ * extracted one at a time. Entries not yet started when one fails are
+ * skipped.
+ *
+ * Returns 0 if every entry was extracted. Otherwise returns the error of the
+ * lowest-numbered entry that failed, and stores its index in |failed_index|
+ * if that isn't null.
+ */
+int32_t ExtractEntriesToFiles(ZipArchiveHandle handle, ZipEntry* entries, const int* fds,
+                              size_t count, size_t thread_count, size_t* failed_index);
+
 /**
  * Uncompress a given zip entry to the memory region at |begin| and of
  * size |size|. This size is expected to be the same as the *declared*
@@ -215,6 +262,21 @@ int32_t ExtractEntryToFile(ZipArchiveHandle handle, ZipEntry* entry, int fd);
  */
 int32_t ExtractToMemory(ZipArchiveHandle handle, ZipEntry* entry, uint8_t* begin, uint32_t size);
 
+/*
+ * Gives in-place access to the data of a stored (uncompressed) entry, so
+ * it needn't be copied. For an archive opened from memory, |data| points
+ * into that memory and |map| is set to null. Otherwise the entry's range of
+ * the file is mapped read-only: |data| points into the mapping, and the
+ * caller owns |map| and must delete it when done with |data|. Unlike the
+ * Extract functions, this doesn't check the data against the entry's CRC.
+ * An empty entry gives null |data|.
+ *
+ * Returns 0 on success, and negative values on failure, which include the
+ * entry being compressed.
+ */
+int32_t MapStoredEntry(ZipArchiveHandle handle, const ZipEntry* entry, const uint8_t** data,
+                       android::FileMap** map);
+
 int GetFileDescriptor(const ZipArchiveHandle handle);
 
 const char* ErrorCodeString(int32_t error_code);
@@ -24,14 +24,36 @@
 
 class ZipArchiveStreamEntry {
  public:
+  // How the entry is read from the archive. The defaults suit small entries;
+  // big ones streamed from start to end (OTA payloads, say) go faster with
+  // bigger buffers, readahead and a background thread.
+  struct Options {
+    // How much is read from the archive at a time, and for Create() of a
+    // compressed entry, the most Read() returns at a time.
+    size_t buffer_size = 65535;
+    // Tells the kernel the entry's bytes will be read in order, so that it
+    // reads ahead of us. Only for archives opened from a file on Linux.
+    bool readahead = false;
+    // Reads the next buffer on a thread of its own while the caller works on
+    // the one Read() returned last. Not on Windows, where reads from other
+    // threads would fight over the file offset.
+    bool background = false;
+  };
+
   virtual ~ZipArchiveStreamEntry() {}
 
+  // Returns the next part of the entry, which stays valid until the next call,
+  // or nullptr at the end or on error.
   virtual const std::vector<uint8_t>* Read() = 0;
 
   virtual bool Verify() = 0;
 
   static ZipArchiveStreamEntry* Create(ZipArchiveHandle handle, const ZipEntry& entry);
+  static ZipArchiveStreamEntry* Create(ZipArchiveHandle handle, const ZipEntry& entry,
+                                       const Options& options);
   static ZipArchiveStreamEntry* CreateRaw(ZipArchiveHandle handle, const ZipEntry& entry);
+  static ZipArchiveStreamEntry* CreateRaw(ZipArchiveHandle handle, const ZipEntry& entry,
+                                          const Options& options);
 
  protected:
   ZipArchiveStreamEntry(ZipArchiveHandle handle) : handle_(handle) {}
@@ -40,6 +62,8 @@ class ZipArchiveStreamEntry {
 
   ZipArchiveHandle handle_;
 
+  Options options_;
+
   uint32_t crc32_;
 };
 
@@ -20,6 +20,8 @@
 #include <cstdio>
 #include <ctime>
 
+#include <deque>
+#include <future>
 #include <memory>
 #include <string>
 #include <vector>
@@ -96,6 +98,25 @@ class ZipWriter {
   // Move assignment.
   ZipWriter& operator=(ZipWriter&& zipWriter);
 
+  /**
+   * Compresses entries on up to |thread_count| threads. Compressed data is split into blocks
+   * that are deflated concurrently, each primed with the end of the block before it and
+   * ended with a sync flush, so each entry is still a single deflate stream. Entries are
+   * written in order, so only blocks within an entry overlap. The default of 1 deflates on
+   * the calling thread. Must be called between entries.
+   * Returns 0 on success, and an error value < 0 on failure.
+   */
+  int32_t SetThreadCount(size_t thread_count);
+
+  /**
+   * Never seeks back over what was already written, so that the file can be copied while it
+   * is still being written, as adb bugreport does with bugreport zips. Stored entries
+   * get a DataDescriptor like deflated ones, each entry is flushed as it is finished, and
+   * DiscardLastEntry() fails. Must be called before the first entry.
+   * Returns 0 on success, and an error value < 0 on failure.
+   */
+  int32_t SetAppendOnly();
+
   /**
    * Starts a new zip entry with the given path and flags.
    * Flags can be a bitwise OR of ZipWriter::kCompress and ZipWriter::kAlign.
@@ -165,6 +186,9 @@ class ZipWriter {
   int32_t StoreBytes(FileEntry* file, const void* data, size_t len);
   int32_t CompressBytes(FileEntry* file, const void* data, size_t len);
   int32_t FlushCompressedBytes(FileEntry* file);
+  int32_t CompressBytesParallel(FileEntry* file, const void* data, size_t len);
+  int32_t SubmitBlock(FileEntry* file, bool last);
+  int32_t WriteBlock(FileEntry* file, const std::vector<uint8_t>& block);
 
   enum class State {
     kWritingZip,
@@ -175,6 +199,7 @@ class ZipWriter {
 
   FILE* file_;
   bool seekable_;
+  bool append_only_;
   off64_t current_offset_;
   State state_;
   std::vector<FileEntry> files_;
@@ -182,6 +207,13 @@ class ZipWriter {
 
   std::unique_ptr<z_stream, void (*)(z_stream*)> z_stream_;
   std::vector<uint8_t> buffer_;
+
+  // Used instead of z_stream_ when thread_count_ > 1: input not yet submitted, the end of
+  // the last submitted block, and the blocks being deflated, oldest first.
+  size_t thread_count_;
+  std::vector<uint8_t> block_input_;
+  std::vector<uint8_t> dictionary_;
+  std::deque<std::future<std::vector<uint8_t>>> pending_blocks_;
 };
 
 #endif /* LIBZIPARCHIVE_ZIPWRITER_H_ */
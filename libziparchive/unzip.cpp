@@ -28,6 +28,7 @@
 
 #include <set>
 #include <string>
+#include <vector>
 
 #include <android-base/file.h>
 #include <android-base/strings.h>
@@ -45,6 +46,7 @@ static bool flag_l = false;
 static bool flag_p = false;
 static bool flag_q = false;
 static bool flag_v = false;
+static size_t flag_j = 1;
 static const char* archive_name = nullptr;
 static std::set<std::string> includes;
 static std::set<std::string> excludes;
@@ -52,6 +54,12 @@ static uint64_t total_uncompressed_length = 0;
 static uint64_t total_compressed_length = 0;
 static size_t file_count = 0;
 
+// With -j, files are opened as they're seen and extracted a batch at a time.
+static constexpr size_t kBatchSize = 64;
+static std::vector<ZipEntry> batch_entries;
+static std::vector<int> batch_fds;
+static std::vector<std::string> batch_dsts;
+
 static bool Filter(const std::string& name) {
   if (!excludes.empty() && excludes.find(name) != excludes.end()) return true;
   if (!includes.empty() && includes.find(name) == includes.end()) return true;
@@ -148,6 +156,21 @@ static void ExtractToPipe(ZipArchiveHandle zah, ZipEntry& entry, const std::stri
   delete[] buffer;
 }
 
+static void FlushBatch(ZipArchiveHandle zah) {
+  if (batch_entries.empty()) return;
+  size_t failed_index;
+  int err = ExtractEntriesToFiles(zah, batch_entries.data(), batch_fds.data(),
+                                  batch_entries.size(), flag_j, &failed_index);
+  if (err < 0) {
+    error(1, 0, "failed to extract %s: %s", batch_dsts[failed_index].c_str(),
+          ErrorCodeString(err));
+  }
+  for (int fd : batch_fds) close(fd);
+  batch_entries.clear();
+  batch_fds.clear();
+  batch_dsts.clear();
+}
+
 static void ExtractOne(ZipArchiveHandle zah, ZipEntry& entry, const std::string& name) {
   // Bad filename?
   if (android::base::StartsWith(name, "/") || android::base::StartsWith(name, "../") ||
@@ -193,6 +216,13 @@ static void ExtractOne(ZipArchiveHandle zah, ZipEntry& entry, const std::string&
 
   // Actually extract into the file.
   if (!flag_q) printf("  inflating: %s\n", dst.c_str());
+  if (flag_j > 1) {
+    batch_entries.push_back(entry);
+    batch_fds.push_back(fd);
+    batch_dsts.push_back(dst);
+    if (batch_entries.size() == kBatchSize) FlushBatch(zah);
+    return;
+  }
   int err = ExtractEntryToFile(zah, &entry, fd);
   if (err < 0) error(1, 0, "failed to extract %s: %s", dst.c_str(), ErrorCodeString(err));
   close(fd);
@@ -250,12 +280,13 @@ static void ProcessAll(ZipArchiveHandle zah) {
 
   if (err < -1) error(1, 0, "failed iterating %s: %s", archive_name, ErrorCodeString(err));
   EndIteration(cookie);
+  FlushBatch(zah);
 
   MaybeShowFooter();
 }
 
 static void ShowHelp(bool full) {
-  fprintf(full ? stdout : stderr, "usage: unzip [-d DIR] [-lnopqv] ZIP [FILE...] [-x FILE...]\n");
+  fprintf(full ? stdout : stderr, "usage: unzip [-d DIR] [-j N] [-lnopqv] ZIP [FILE...] [-x FILE...]\n");
   if (!full) exit(EXIT_FAILURE);
 
   printf(
@@ -263,6 +294,7 @@ static void ShowHelp(bool full) {
       "Extract FILEs from ZIP archive. Default is all files.\n"
       "\n"
       "-d DIR	Extract into DIR\n"
+      "-j N	Extract N files at a time\n"
       "-l	List contents (-lq excludes archive name, -lv is verbose)\n"
       "-n	Never overwrite files (default: prompt)\n"
       "-o	Always overwrite files\n"
@@ -279,7 +311,7 @@ int main(int argc, char* argv[]) {
   };
   bool saw_x = false;
   int opt;
-  while ((opt = getopt_long(argc, argv, "-d:hlnopqvx", opts, nullptr)) != -1) {
+  while ((opt = getopt_long(argc, argv, "-d:hj:lnopqvx", opts, nullptr)) != -1) {
     switch (opt) {
       case 'd':
         flag_d = optarg;
@@ -287,6 +319,10 @@ int main(int argc, char* argv[]) {
       case 'h':
         ShowHelp(true);
         break;
+      case 'j':
+        flag_j = strtoul(optarg, nullptr, 10);
+        if (flag_j == 0) error(1, 0, "bad -j count %s", optarg);
+        break;
       case 'l':
         flag_l = true;
         break;
@@ -27,10 +27,14 @@
 #include <limits.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
 #include <time.h>
 #include <unistd.h>
 
+#include <algorithm>
+#include <atomic>
 #include <memory>
+#include <thread>
 #include <vector>
 
 #include <android-base/file.h>
@@ -46,6 +50,7 @@
 #include "entry_name_utils-inl.h"
 #include "zip_archive_common.h"
 #include "zip_archive_private.h"
+#include "zip_crc32.h"
 
 using android::base::get_unaligned;
 
@@ -112,17 +117,32 @@ static uint32_t ComputeHash(const ZipString& name) {
 }
 
 /*
- * Convert a ZipEntry to a hash table index, verifying that it's in a
- * valid range.
+ * Recover the name of the entry in an occupied slot. The name length lives
+ * in the central directory record just before the name.
  */
-static int64_t EntryToIndex(const ZipString* hash_table, const uint32_t hash_table_size,
-                            const ZipString& name) {
+static ZipString SlotName(const ZipArchive* archive, const ZipEntrySlot& slot) {
+  const uint8_t* name = archive->central_directory.GetBasePtr() + slot.name_offset;
+  const CentralDirectoryRecord* cdr =
+      reinterpret_cast<const CentralDirectoryRecord*>(name - sizeof(CentralDirectoryRecord));
+  ZipString result;
+  result.name = name;
+  result.name_length = cdr->file_name_length;
+  return result;
+}
+
+/*
+ * Find the hash table slot holding |name|. The stored hash is compared
+ * first, so names are only compared for likely matches.
+ */
+static int64_t EntryToIndex(const ZipArchive* archive, const ZipString& name) {
+  const ZipEntrySlot* hash_table = archive->hash_table;
+  const uint32_t hash_table_size = archive->hash_table_size;
   const uint32_t hash = ComputeHash(name);
 
   // NOTE: (hash_table_size - 1) is guaranteed to be non-negative.
   uint32_t ent = hash & (hash_table_size - 1);
-  while (hash_table[ent].name != NULL) {
-    if (hash_table[ent] == name) {
+  while (hash_table[ent].name_offset != 0) {
+    if (hash_table[ent].hash == hash && SlotName(archive, hash_table[ent]) == name) {
       return ent;
     }
 
@@ -136,17 +156,18 @@ static int64_t EntryToIndex(const ZipString* hash_table, const uint32_t hash_tab
 /*
  * Add a new entry to the hash table.
  */
-static int32_t AddToHash(ZipString* hash_table, const uint64_t hash_table_size,
-                         const ZipString& name) {
-  const uint64_t hash = ComputeHash(name);
+static int32_t AddToHash(ZipArchive* archive, const ZipString& name) {
+  ZipEntrySlot* hash_table = archive->hash_table;
+  const uint32_t hash_table_size = archive->hash_table_size;
+  const uint32_t hash = ComputeHash(name);
   uint32_t ent = hash & (hash_table_size - 1);
 
   /*
    * We over-allocated the table, so we're guaranteed to find an empty slot.
    * Further, we guarantee that the hashtable size is not 0.
    */
-  while (hash_table[ent].name != NULL) {
-    if (hash_table[ent] == name) {
+  while (hash_table[ent].name_offset != 0) {
+    if (hash_table[ent].hash == hash && SlotName(archive, hash_table[ent]) == name) {
       // We've found a duplicate entry. We don't accept it
       ALOGW("Zip: Found duplicate entry %.*s", name.name_length, name.name);
       return kDuplicateEntry;
@@ -154,8 +175,8 @@ static int32_t AddToHash(ZipString* hash_table, const uint64_t hash_table_size,
     ent = (ent + 1) & (hash_table_size - 1);
   }
 
-  hash_table[ent].name = name.name;
-  hash_table[ent].name_length = name.name_length;
+  hash_table[ent].hash = hash;
+  hash_table[ent].name_offset = name.name - archive->central_directory.GetBasePtr();
   return 0;
 }
 
@@ -294,8 +315,25 @@ static int32_t MapCentralDirectory(const char* debug_file_name, ZipArchive* arch
 }
 
 /*
- * Parses the Zip archive's Central Directory.  Allocates and populates the
- * hash table.
+ * Allocates the hash table.  We have a minimum 75% load factor, possibly as
+ * low as 50% after we round off to a power of 2.  There must be at least one
+ * unused entry to avoid an infinite loop during creation.
+ */
+static int32_t AllocateHashTable(ZipArchive* archive) {
+  archive->hash_table_size = RoundUpPower2(1 + (archive->num_entries * 4) / 3);
+  archive->hash_table =
+      reinterpret_cast<ZipEntrySlot*>(calloc(archive->hash_table_size, sizeof(ZipEntrySlot)));
+  if (archive->hash_table == nullptr) {
+    ALOGW("Zip: unable to allocate the %u-entry hash_table, entry size: %zu",
+          archive->hash_table_size, sizeof(ZipEntrySlot));
+    return -1;
+  }
+  return 0;
+}
+
+/*
+ * Parses the Zip archive's Central Directory.  Unless the archive is being
+ * opened lazily, allocates and populates the hash table.
  *
  * Returns 0 on success.
  */
@@ -304,17 +342,8 @@ static int32_t ParseZipArchive(ZipArchive* archive) {
   const size_t cd_length = archive->central_directory.GetMapLength();
   const uint16_t num_entries = archive->num_entries;
 
-  /*
-   * Create hash table.  We have a minimum 75% load factor, possibly as
-   * low as 50% after we round off to a power of 2.  There must be at
-   * least one unused entry to avoid an infinite loop during creation.
-   */
-  archive->hash_table_size = RoundUpPower2(1 + (num_entries * 4) / 3);
-  archive->hash_table =
-      reinterpret_cast<ZipString*>(calloc(archive->hash_table_size, sizeof(ZipString)));
-  if (archive->hash_table == nullptr) {
-    ALOGW("Zip: unable to allocate the %u-entry hash_table, entry size: %zu",
-          archive->hash_table_size, sizeof(ZipString));
+  const bool add_entries = !archive->lazy_hash_table;
+  if (add_entries && AllocateHashTable(archive) != 0) {
     return -1;
   }
 
@@ -364,13 +393,15 @@ static int32_t ParseZipArchive(ZipArchive* archive) {
     }
 
     /* add the CDE filename to the hash table */
-    ZipString entry_name;
-    entry_name.name = file_name;
-    entry_name.name_length = file_name_length;
-    const int add_result = AddToHash(archive->hash_table, archive->hash_table_size, entry_name);
-    if (add_result != 0) {
-      ALOGW("Zip: Error adding entry to hash table %d", add_result);
-      return add_result;
+    if (add_entries) {
+      ZipString entry_name;
+      entry_name.name = file_name;
+      entry_name.name_length = file_name_length;
+      const int add_result = AddToHash(archive, entry_name);
+      if (add_result != 0) {
+        ALOGW("Zip: Error adding entry to hash table %d", add_result);
+        return add_result;
+      }
     }
 
     ptr += sizeof(CentralDirectoryRecord) + file_name_length + extra_length + comment_length;
@@ -400,6 +431,46 @@ static int32_t ParseZipArchive(ZipArchive* archive) {
   return 0;
 }
 
+/*
+ * Builds the hash table for an archive opened with OpenArchiveLazy, whose
+ * central directory ParseZipArchive has already verified.
+ */
+static int32_t BuildHashTable(ZipArchive* archive) {
+  if (AllocateHashTable(archive) != 0) {
+    return -1;
+  }
+
+  const uint8_t* ptr = archive->central_directory.GetBasePtr();
+  for (uint16_t i = 0; i < archive->num_entries; i++) {
+    const CentralDirectoryRecord* cdr = reinterpret_cast<const CentralDirectoryRecord*>(ptr);
+    ZipString entry_name;
+    entry_name.name = ptr + sizeof(CentralDirectoryRecord);
+    entry_name.name_length = cdr->file_name_length;
+    const int add_result = AddToHash(archive, entry_name);
+    if (add_result != 0) {
+      ALOGW("Zip: Error adding entry to hash table %d", add_result);
+      return add_result;
+    }
+
+    ptr += sizeof(CentralDirectoryRecord) + cdr->file_name_length + cdr->extra_field_length +
+           cdr->comment_length;
+  }
+  return 0;
+}
+
+/*
+ * Returns 0 once the hash table is usable, building it first if the archive
+ * was opened lazily.
+ */
+static int32_t EnsureHashTable(ZipArchive* archive) {
+  if (!archive->lazy_hash_table) {
+    return 0;
+  }
+  std::call_once(archive->hash_table_once,
+                 [archive]() { archive->hash_table_result = BuildHashTable(archive); });
+  return archive->hash_table_result;
+}
+
 static int32_t OpenArchiveInternal(ZipArchive* archive, const char* debug_file_name) {
   int32_t result = -1;
   if ((result = MapCentralDirectory(debug_file_name, archive)) != 0) {
@@ -433,6 +504,163 @@ int32_t OpenArchive(const char* fileName, ZipArchiveHandle* handle) {
   return OpenArchiveInternal(archive, fileName);
 }
 
+int32_t OpenArchiveLazy(const char* fileName, ZipArchiveHandle* handle) {
+  const int fd = open(fileName, O_RDONLY | O_BINARY, 0);
+  ZipArchive* archive = new ZipArchive(fd, true);
+  archive->lazy_hash_table = true;
+  *handle = archive;
+
+  if (fd < 0) {
+    ALOGW("Unable to open '%s': %s", fileName, strerror(errno));
+    return kIoError;
+  }
+
+  return OpenArchiveInternal(archive, fileName);
+}
+
+/*
+ * Fills in the fields of |header| that identify the file open on |fd|.
+ */
+static bool GetIndexIdentity(int fd, ZipArchiveIndexHeader* header) {
+  struct stat sb;
+  if (fstat(fd, &sb) == -1) {
+    return false;
+  }
+  header->file_dev = sb.st_dev;
+  header->file_ino = sb.st_ino;
+  header->file_size = sb.st_size;
+  header->file_mtime_sec = sb.st_mtime;
+#if defined(__linux__)
+  header->file_mtime_nsec = sb.st_mtim.tv_nsec;
+#else
+  header->file_mtime_nsec = 0;
+#endif
+  return true;
+}
+
+/*
+ * Sets up |archive| from the index in |index_fd| instead of scanning the
+ * archive. The index must have been written for this exact file, and its
+ * slots must all point at names within the central directory.
+ */
+static int32_t OpenArchiveFromIndex(ZipArchive* archive, const char* debug_file_name,
+                                    int index_fd) {
+  struct stat sb;
+  if (fstat(index_fd, &sb) == -1 ||
+      sb.st_size < static_cast<off64_t>(sizeof(ZipArchiveIndexHeader))) {
+    return kInvalidFile;
+  }
+  std::unique_ptr<android::FileMap> index_map(new android::FileMap());
+  if (!index_map->create(debug_file_name, index_fd, 0, sb.st_size, true /* read only */)) {
+    return kMmapFailed;
+  }
+
+  const ZipArchiveIndexHeader* header =
+      reinterpret_cast<const ZipArchiveIndexHeader*>(index_map->getDataPtr());
+  ZipArchiveIndexHeader identity;
+  if (header->magic != ZipArchiveIndexHeader::kMagic ||
+      header->version != ZipArchiveIndexHeader::kVersion ||
+      !GetIndexIdentity(archive->mapped_zip.GetFileDescriptor(), &identity) ||
+      header->file_dev != identity.file_dev || header->file_ino != identity.file_ino ||
+      header->file_size != identity.file_size ||
+      header->file_mtime_sec != identity.file_mtime_sec ||
+      header->file_mtime_nsec != identity.file_mtime_nsec) {
+    ALOGV("Zip: index doesn't match %s", debug_file_name);
+    return kInvalidFile;
+  }
+
+  const uint32_t hash_table_size = header->hash_table_size;
+  if (header->num_entries == 0 || header->num_entries > UINT16_MAX ||
+      hash_table_size <= header->num_entries || (hash_table_size & (hash_table_size - 1)) != 0 ||
+      static_cast<uint64_t>(sb.st_size) !=
+          sizeof(ZipArchiveIndexHeader) + uint64_t(hash_table_size) * sizeof(ZipEntrySlot) ||
+      uint64_t(header->directory_offset) + header->cd_size > header->file_size) {
+    ALOGW("Zip: bad index for %s", debug_file_name);
+    return kInvalidFile;
+  }
+
+  if (!archive->InitializeCentralDirectory(debug_file_name, header->directory_offset,
+                                           header->cd_size)) {
+    return kMmapFailed;
+  }
+
+  const ZipEntrySlot* slots = reinterpret_cast<const ZipEntrySlot*>(header + 1);
+  const uint8_t* cd_ptr = archive->central_directory.GetBasePtr();
+  uint32_t used = 0;
+  for (uint32_t i = 0; i < hash_table_size; ++i) {
+    const uint32_t name_offset = slots[i].name_offset;
+    if (name_offset == 0) {
+      continue;
+    }
+    if (name_offset < sizeof(CentralDirectoryRecord) || name_offset > header->cd_size) {
+      ALOGW("Zip: bad index slot %" PRIu32 " for %s", i, debug_file_name);
+      return kInvalidOffset;
+    }
+    const CentralDirectoryRecord* cdr = reinterpret_cast<const CentralDirectoryRecord*>(
+        cd_ptr + name_offset - sizeof(CentralDirectoryRecord));
+    if (name_offset + cdr->file_name_length > header->cd_size) {
+      ALOGW("Zip: bad index slot %" PRIu32 " for %s", i, debug_file_name);
+      return kInvalidOffset;
+    }
+    ++used;
+  }
+  if (used != header->num_entries) {
+    ALOGW("Zip: bad index entry count for %s", debug_file_name);
+    return kInvalidFile;
+  }
+
+  archive->directory_offset = header->directory_offset;
+  archive->num_entries = header->num_entries;
+  archive->hash_table_size = hash_table_size;
+  archive->hash_table = const_cast<ZipEntrySlot*>(slots);
+  archive->index_map = std::move(index_map);
+  return 0;
+}
+
+int32_t OpenArchiveFdWithIndex(int fd, const char* debug_file_name, ZipArchiveHandle* handle,
+                               int index_fd, bool assume_ownership) {
+  ZipArchive* archive = new ZipArchive(fd, assume_ownership);
+  *handle = archive;
+  if (index_fd >= 0 && OpenArchiveFromIndex(archive, debug_file_name, index_fd) == 0) {
+    return 0;
+  }
+
+  // Fall back to scanning, discarding anything the index set up.
+  archive->directory_map.reset(new android::FileMap());
+  return OpenArchiveInternal(archive, debug_file_name);
+}
+
+int32_t WriteArchiveIndex(ZipArchiveHandle handle, int index_fd) {
+  ZipArchive* archive = reinterpret_cast<ZipArchive*>(handle);
+  if (!archive->mapped_zip.HasFd()) {
+    ALOGW("Zip: can't index an archive opened from memory");
+    return kInvalidHandle;
+  }
+  const int32_t result = EnsureHashTable(archive);
+  if (result != 0) {
+    return result;
+  }
+
+  ZipArchiveIndexHeader header = {};
+  header.magic = ZipArchiveIndexHeader::kMagic;
+  header.version = ZipArchiveIndexHeader::kVersion;
+  if (!GetIndexIdentity(archive->mapped_zip.GetFileDescriptor(), &header)) {
+    return kIoError;
+  }
+  header.directory_offset = archive->directory_offset;
+  header.cd_size = archive->central_directory.GetMapLength();
+  header.num_entries = archive->num_entries;
+  header.hash_table_size = archive->hash_table_size;
+
+  if (!android::base::WriteFully(index_fd, &header, sizeof(header)) ||
+      !android::base::WriteFully(index_fd, archive->hash_table,
+                                 archive->hash_table_size * sizeof(ZipEntrySlot))) {
+    ALOGW("Zip: failed to write index: %s", strerror(errno));
+    return kIoError;
+  }
+  return 0;
+}
+
 int32_t OpenArchiveFromMemory(void* address, size_t length, const char* debug_file_name,
                               ZipArchiveHandle* handle) {
   ZipArchive* archive = new ZipArchive(address, length);
@@ -449,9 +677,11 @@ void CloseArchive(ZipArchiveHandle handle) {
   delete archive;
 }
 
-static int32_t ValidateDataDescriptor(MappedZipFile& mapped_zip, ZipEntry* entry) {
+// |dd_offset| is where the entry's data ends.
+static int32_t ValidateDataDescriptor(MappedZipFile& mapped_zip, ZipEntry* entry,
+                                      off64_t dd_offset) {
   uint8_t ddBuf[sizeof(DataDescriptor) + sizeof(DataDescriptor::kOptSignature)];
-  if (!mapped_zip.ReadData(ddBuf, sizeof(ddBuf))) {
+  if (!mapped_zip.ReadAtOffset(ddBuf, sizeof(ddBuf), dd_offset)) {
     return kIoError;
   }
 
@@ -475,12 +705,13 @@ static int32_t ValidateDataDescriptor(MappedZipFile& mapped_zip, ZipEntry* entry
 }
 
 static int32_t FindEntry(const ZipArchive* archive, const int ent, ZipEntry* data) {
-  const uint16_t nameLen = archive->hash_table[ent].name_length;
+  const ZipString entry_name = SlotName(archive, archive->hash_table[ent]);
+  const uint16_t nameLen = entry_name.name_length;
 
   // Recover the start of the central directory entry from the filename
   // pointer.  The filename is the first entry past the fixed-size data,
   // so we can just subtract back from that.
-  const uint8_t* ptr = archive->hash_table[ent].name;
+  const uint8_t* ptr = entry_name.name;
   ptr -= sizeof(CentralDirectoryRecord);
 
   // This is the base of our mmapped region, we have to sanity check that
@@ -591,7 +822,7 @@ static int32_t FindEntry(const ZipArchive* archive, const int ent, ZipEntry* dat
       return kIoError;
     }
 
-    if (memcmp(archive->hash_table[ent].name, name_buf.data(), nameLen)) {
+    if (memcmp(entry_name.name, name_buf.data(), nameLen)) {
       return kInconsistentInformation;
     }
 
@@ -665,7 +896,15 @@ int32_t StartIteration(ZipArchiveHandle handle, void** cookie_ptr, const ZipStri
                        const ZipString* optional_suffix) {
   ZipArchive* archive = reinterpret_cast<ZipArchive*>(handle);
 
-  if (archive == NULL || archive->hash_table == NULL) {
+  if (archive == NULL) {
+    ALOGW("Zip: Invalid ZipArchiveHandle");
+    return kInvalidHandle;
+  }
+  const int32_t result = EnsureHashTable(archive);
+  if (result != 0) {
+    return result;
+  }
+  if (archive->hash_table == NULL) {
     ALOGW("Zip: Invalid ZipArchiveHandle");
     return kInvalidHandle;
   }
@@ -683,13 +922,18 @@ void EndIteration(void* cookie) {
 }
 
 int32_t FindEntry(const ZipArchiveHandle handle, const ZipString& entryName, ZipEntry* data) {
-  const ZipArchive* archive = reinterpret_cast<ZipArchive*>(handle);
+  ZipArchive* archive = reinterpret_cast<ZipArchive*>(handle);
   if (entryName.name_length == 0) {
     ALOGW("Zip: Invalid filename %.*s", entryName.name_length, entryName.name);
     return kInvalidEntryName;
   }
 
-  const int64_t ent = EntryToIndex(archive->hash_table, archive->hash_table_size, entryName);
+  const int32_t result = EnsureHashTable(archive);
+  if (result != 0) {
+    return result;
+  }
+
+  const int64_t ent = EntryToIndex(archive, entryName);
 
   if (ent < 0) {
     ALOGV("Zip: Could not find entry %.*s", entryName.name_length, entryName.name);
@@ -713,17 +957,19 @@ int32_t Next(void* cookie, ZipEntry* data, ZipString* name) {
 
   const uint32_t currentOffset = handle->position;
   const uint32_t hash_table_length = archive->hash_table_size;
-  const ZipString* hash_table = archive->hash_table;
+  const ZipEntrySlot* hash_table = archive->hash_table;
 
   for (uint32_t i = currentOffset; i < hash_table_length; ++i) {
-    if (hash_table[i].name != NULL &&
-        (handle->prefix.name_length == 0 || hash_table[i].StartsWith(handle->prefix)) &&
-        (handle->suffix.name_length == 0 || hash_table[i].EndsWith(handle->suffix))) {
+    if (hash_table[i].name_offset == 0) {
+      continue;
+    }
+    const ZipString entry_name = SlotName(archive, hash_table[i]);
+    if ((handle->prefix.name_length == 0 || entry_name.StartsWith(handle->prefix)) &&
+        (handle->suffix.name_length == 0 || entry_name.EndsWith(handle->suffix))) {
       handle->position = (i + 1);
       const int error = FindEntry(archive, i, data);
       if (!error) {
-        name->name = hash_table[i].name;
-        name->name_length = hash_table[i].name_length;
+        *name = entry_name;
       }
 
       return error;
@@ -865,11 +1111,24 @@ static inline int zlib_inflateInit2(z_stream* stream, int window_bits) {
 }
 #pragma GCC diagnostic pop
 
+// Entry data is read with ReadAtOffset, so several entries of an archive opened
+// from a file descriptor can be extracted at once.
+// Extraction buffers are sized to the data they hold, within these bounds, so
+// large entries take fewer, larger reads and writes and small ones don't
+// allocate more than they need.
+static const size_t kMinBufSize = 4096;
+static const size_t kMaxBufSize = 128 * 1024;
+
+static size_t BufferSizeFor(uint32_t length) {
+  return std::min(kMaxBufSize, std::max<size_t>(kMinBufSize, length));
+}
+
 static int32_t InflateEntryToWriter(MappedZipFile& mapped_zip, const ZipEntry* entry,
                                     Writer* writer, uint64_t* crc_out) {
-  const size_t kBufSize = 32768;
-  std::vector<uint8_t> read_buf(kBufSize);
-  std::vector<uint8_t> write_buf(kBufSize);
+  const size_t read_buf_size = BufferSizeFor(entry->compressed_length);
+  const size_t write_buf_size = BufferSizeFor(entry->uncompressed_length);
+  std::vector<uint8_t> read_buf(read_buf_size);
+  std::vector<uint8_t> write_buf(write_buf_size);
   z_stream zstream;
   int zerr;
 
@@ -883,7 +1142,7 @@ static int32_t InflateEntryToWriter(MappedZipFile& mapped_zip, const ZipEntry* e
   zstream.next_in = NULL;
   zstream.avail_in = 0;
   zstream.next_out = &write_buf[0];
-  zstream.avail_out = kBufSize;
+  zstream.avail_out = write_buf_size;
   zstream.data_type = Z_UNKNOWN;
 
   /*
@@ -911,16 +1170,18 @@ static int32_t InflateEntryToWriter(MappedZipFile& mapped_zip, const ZipEntry* e
 
   uint64_t crc = 0;
   uint32_t compressed_length = entry->compressed_length;
+  off64_t offset = entry->offset;
   do {
     /* read as much as we can */
     if (zstream.avail_in == 0) {
-      const size_t getSize = (compressed_length > kBufSize) ? kBufSize : compressed_length;
-      if (!mapped_zip.ReadData(read_buf.data(), getSize)) {
+      const size_t getSize = std::min<size_t>(compressed_length, read_buf_size);
+      if (!mapped_zip.ReadAtOffset(read_buf.data(), getSize, offset)) {
         ALOGW("Zip: inflate read failed, getSize = %zu: %s", getSize, strerror(errno));
         return kIoError;
       }
 
       compressed_length -= getSize;
+      offset += getSize;
 
       zstream.next_in = &read_buf[0];
       zstream.avail_in = getSize;
@@ -935,17 +1196,17 @@ static int32_t InflateEntryToWriter(MappedZipFile& mapped_zip, const ZipEntry* e
     }
 
     /* write when we're full or when we're done */
-    if (zstream.avail_out == 0 || (zerr == Z_STREAM_END && zstream.avail_out != kBufSize)) {
+    if (zstream.avail_out == 0 || (zerr == Z_STREAM_END && zstream.avail_out != write_buf_size)) {
       const size_t write_size = zstream.next_out - &write_buf[0];
+      // Checksum the output while it's still in cache.
+      crc = ComputeCrc32(crc, &write_buf[0], write_size);
       if (!writer->Append(&write_buf[0], write_size)) {
         // The file might have declared a bogus length.
         return kInconsistentInformation;
-      } else {
-        crc = crc32(crc, &write_buf[0], write_size);
       }
 
       zstream.next_out = &write_buf[0];
-      zstream.avail_out = kBufSize;
+      zstream.avail_out = write_buf_size;
     }
   } while (zerr == Z_OK);
 
@@ -953,10 +1214,9 @@ static int32_t InflateEntryToWriter(MappedZipFile& mapped_zip, const ZipEntry* e
 
   // NOTE: zstream.adler is always set to 0, because we're using the -MAX_WBITS
   // "feature" of zlib to tell it there won't be a zlib file header. zlib
-  // doesn't bother calculating the checksum in that scenario. We just do
-  // it ourselves above because there are no additional gains to be made by
-  // having zlib calculate it for us, since they do it by calling crc32 in
-  // the same manner that we have above.
+  // doesn't bother calculating the checksum in that scenario. We do it
+  // ourselves above, with ComputeCrc32 so that we get the hardware CRC
+  // instructions where the CPU has them.
   *crc_out = crc;
 
   if (zstream.total_out != uncompressed_length || compressed_length != 0) {
@@ -970,19 +1230,19 @@ static int32_t InflateEntryToWriter(MappedZipFile& mapped_zip, const ZipEntry* e
 
 static int32_t CopyEntryToWriter(MappedZipFile& mapped_zip, const ZipEntry* entry, Writer* writer,
                                  uint64_t* crc_out) {
-  static const uint32_t kBufSize = 32768;
-  std::vector<uint8_t> buf(kBufSize);
-
   const uint32_t length = entry->uncompressed_length;
+  const size_t buf_size = BufferSizeFor(length);
+  std::vector<uint8_t> buf(buf_size);
+
   uint32_t count = 0;
   uint64_t crc = 0;
   while (count < length) {
     uint32_t remaining = length - count;
 
-    // Safe conversion because kBufSize is narrow enough for a 32 bit signed
+    // Safe conversion because buf_size is narrow enough for a 32 bit signed
     // value.
-    const size_t block_size = (remaining > kBufSize) ? kBufSize : remaining;
-    if (!mapped_zip.ReadData(buf.data(), block_size)) {
+    const size_t block_size = (remaining > buf_size) ? buf_size : remaining;
+    if (!mapped_zip.ReadAtOffset(buf.data(), block_size, entry->offset + count)) {
       ALOGW("CopyFileToFile: copy read failed, block_size = %zu: %s", block_size, strerror(errno));
       return kIoError;
     }
@@ -990,7 +1250,7 @@ static int32_t CopyEntryToWriter(MappedZipFile& mapped_zip, const ZipEntry* entr
     if (!writer->Append(&buf[0], block_size)) {
       return kIoError;
     }
-    crc = crc32(crc, &buf[0], block_size);
+    crc = ComputeCrc32(crc, &buf[0], block_size);
     count += block_size;
   }
 
@@ -1002,12 +1262,6 @@ static int32_t CopyEntryToWriter(MappedZipFile& mapped_zip, const ZipEntry* entr
 int32_t ExtractToWriter(ZipArchiveHandle handle, ZipEntry* entry, Writer* writer) {
   ZipArchive* archive = reinterpret_cast<ZipArchive*>(handle);
   const uint16_t method = entry->method;
-  off64_t data_offset = entry->offset;
-
-  if (!archive->mapped_zip.SeekToOffset(data_offset)) {
-    ALOGW("Zip: lseek to data at %" PRId64 " failed", static_cast<int64_t>(data_offset));
-    return kIoError;
-  }
 
   // this should default to kUnknownCompressionMethod.
   int32_t return_value = -1;
@@ -1019,7 +1273,8 @@ int32_t ExtractToWriter(ZipArchiveHandle handle, ZipEntry* entry, Writer* writer
   }
 
   if (!return_value && entry->has_data_descriptor) {
-    return_value = ValidateDataDescriptor(archive->mapped_zip, entry);
+    return_value = ValidateDataDescriptor(archive->mapped_zip, entry,
+                                          entry->offset + entry->compressed_length);
     if (return_value) {
       return return_value;
     }
@@ -1039,6 +1294,38 @@ int32_t ExtractToMemory(ZipArchiveHandle handle, ZipEntry* entry, uint8_t* begin
   return ExtractToWriter(handle, entry, writer.get());
 }
 
+int32_t MapStoredEntry(ZipArchiveHandle handle, const ZipEntry* entry, const uint8_t** data,
+                       android::FileMap** map) {
+  ZipArchive* archive = reinterpret_cast<ZipArchive*>(handle);
+  *data = nullptr;
+  *map = nullptr;
+  if (entry->method != kCompressStored) {
+    return kEntryNotStored;
+  }
+
+  // FindEntry has already checked that the data lies before the central directory.
+  const uint32_t length = entry->uncompressed_length;
+  if (length == 0) {
+    return 0;
+  }
+  if (!archive->mapped_zip.HasFd()) {
+    *data = reinterpret_cast<const uint8_t*>(archive->mapped_zip.GetBasePtr()) + entry->offset;
+    return 0;
+  }
+
+  // FileMap takes care of aligning the mapping to a page boundary.
+  std::unique_ptr<android::FileMap> entry_map(new android::FileMap());
+  if (!entry_map->create(nullptr, archive->mapped_zip.GetFileDescriptor(), entry->offset, length,
+                         true /* read only */)) {
+    ALOGW("Zip: failed to map %" PRIu32 " bytes at offset %" PRId64, length,
+          static_cast<int64_t>(entry->offset));
+    return kMmapFailed;
+  }
+  *data = reinterpret_cast<const uint8_t*>(entry_map->getDataPtr());
+  *map = entry_map.release();
+  return 0;
+}
+
 int32_t ExtractEntryToFile(ZipArchiveHandle handle, ZipEntry* entry, int fd) {
   std::unique_ptr<Writer> writer(FileWriter::Create(fd, entry));
   if (writer.get() == nullptr) {
@@ -1048,6 +1335,44 @@ int32_t ExtractEntryToFile(ZipArchiveHandle handle, ZipEntry* entry, int fd) {
   return ExtractToWriter(handle, entry, writer.get());
 }
 
+int32_t ExtractEntriesToFiles(ZipArchiveHandle handle, ZipEntry* entries, const int* fds,
+                              size_t count, size_t thread_count, size_t* failed_index) {
+#if defined(_WIN32)
+  // No pread, so reads from different threads would fight over the file offset.
+  thread_count = 1;
+#endif
+  thread_count = std::max<size_t>(1, std::min(thread_count, count));
+
+  std::vector<int32_t> results(count, 0);
+  std::atomic<size_t> next(0);
+  std::atomic<bool> failed(false);
+  auto extract_some = [&]() {
+    for (size_t i = next++; i < count && !failed; i = next++) {
+      results[i] = ExtractEntryToFile(handle, &entries[i], fds[i]);
+      if (results[i] != 0) {
+        failed = true;
+      }
+    }
+  };
+
+  std::vector<std::thread> threads;
+  for (size_t i = 1; i < thread_count; ++i) {
+    threads.emplace_back(extract_some);
+  }
+  extract_some();
+  for (auto& thread : threads) {
+    thread.join();
+  }
+
+  for (size_t i = 0; i < count; ++i) {
+    if (results[i] != 0) {
+      if (failed_index != nullptr) *failed_index = i;
+      return results[i];
+    }
+  }
+  return 0;
+}
+
 const char* ErrorCodeString(int32_t error_code) {
   // Make sure that the number of entries in kErrorMessages and ErrorCodes
   // match.
@@ -1159,20 +1484,30 @@ bool MappedZipFile::ReadData(uint8_t* buffer, size_t read_amount) {
 }
 
 // Attempts to read |len| bytes into |buf| at offset |off|.
+// Doesn't touch the read position except on Windows, so it's safe to call
+// concurrently.
 bool MappedZipFile::ReadAtOffset(uint8_t* buf, size_t len, off64_t off) {
-#if !defined(_WIN32)
-  if (has_fd_) {
-    if (static_cast<size_t>(TEMP_FAILURE_RETRY(pread64(fd_, buf, len, off))) != len) {
-      ALOGE("Zip: failed to read at offset %" PRId64 "\n", off);
+  if (!has_fd_) {
+    if (off < 0 || off > data_length_ || len > static_cast<uint64_t>(data_length_ - off)) {
+      ALOGE("Zip: invalid read of %zu bytes at %" PRId64 ", data length: %" PRId64 "\n", len, off,
+            data_length_);
       return false;
     }
+    memcpy(buf, static_cast<uint8_t*>(base_ptr_) + off, len);
     return true;
   }
-#endif
+#if !defined(_WIN32)
+  if (static_cast<size_t>(TEMP_FAILURE_RETRY(pread64(fd_, buf, len, off))) != len) {
+    ALOGE("Zip: failed to read at offset %" PRId64 "\n", off);
+    return false;
+  }
+  return true;
+#else
   if (!SeekToOffset(off)) {
     return false;
   }
   return ReadData(buf, len);
+#endif
 }
 
 void CentralDirectory::Initialize(void* map_base_ptr, off64_t cd_start_offset, size_t cd_size) {
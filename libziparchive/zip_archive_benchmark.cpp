@@ -14,10 +14,13 @@
  * limitations under the License.
  */
 
+#include <unistd.h>
+
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
 #include <iostream>
+#include <memory>
 #include <string>
 #include <tuple>
 #include <vector>
@@ -27,6 +30,9 @@
 #include <ziparchive/zip_archive.h>
 #include <ziparchive/zip_archive_stream_entry.h>
 #include <ziparchive/zip_writer.h>
+#include <zlib.h>
+
+#include "zip_crc32.h"
 
 static TemporaryFile* CreateZip() {
   TemporaryFile* result = new TemporaryFile;
@@ -84,4 +90,150 @@ static void Iterate_all_files(benchmark::State& state) {
 }
 BENCHMARK(Iterate_all_files);
 
+static void Extract_all_files(benchmark::State& state) {
+  // Fewer, larger entries than CreateZip so inflating dominates.
+  TemporaryFile temp_file;
+  FILE* fp = fdopen(temp_file.fd, "w");
+  ZipWriter writer(fp);
+  std::vector<uint8_t> contents(256 * 1024);
+  for (size_t i = 0; i < contents.size(); i++) {
+    contents[i] = static_cast<uint8_t>(i * 7 + i / 1024);
+  }
+  for (size_t i = 0; i < 64; i++) {
+    writer.StartEntry(("file" + std::to_string(i)).c_str(), ZipWriter::kCompress);
+    writer.WriteBytes(contents.data(), contents.size());
+    writer.FinishEntry();
+  }
+  writer.Finish();
+  fclose(fp);
+  temp_file.fd = -1;
+
+  ZipArchiveHandle handle;
+  OpenArchive(temp_file.path, &handle);
+  std::vector<ZipEntry> entries;
+  void* iteration_cookie;
+  ZipEntry data;
+  ZipString name;
+  StartIteration(handle, &iteration_cookie, nullptr, nullptr);
+  while (Next(iteration_cookie, &data, &name) == 0) {
+    entries.push_back(data);
+  }
+  EndIteration(iteration_cookie);
+
+  std::vector<std::unique_ptr<TemporaryFile>> outputs;
+  std::vector<int> fds;
+  for (size_t i = 0; i < entries.size(); i++) {
+    outputs.emplace_back(new TemporaryFile);
+    fds.push_back(outputs.back()->fd);
+  }
+
+  while (state.KeepRunning()) {
+    // Each extraction writes from the current offset.
+    for (int fd : fds) lseek(fd, 0, SEEK_SET);
+    ExtractEntriesToFiles(handle, entries.data(), fds.data(), entries.size(), state.range(0),
+                          nullptr);
+  }
+  CloseArchive(handle);
+}
+BENCHMARK(Extract_all_files)->Arg(1)->Arg(2)->Arg(4)->Arg(8);
+
+static void Inflate_large_entry(benchmark::State& state) {
+  TemporaryFile temp_file;
+  FILE* fp = fdopen(temp_file.fd, "w");
+  ZipWriter writer(fp);
+  std::vector<uint8_t> contents(16 * 1024 * 1024);
+  for (size_t i = 0; i < contents.size(); i++) {
+    contents[i] = static_cast<uint8_t>((i % 4096 < 2048) ? (i / 4096) : (i * 2654435761u >> 24));
+  }
+  writer.StartEntry("large", ZipWriter::kCompress);
+  writer.WriteBytes(contents.data(), contents.size());
+  writer.FinishEntry();
+  writer.Finish();
+  fclose(fp);
+  temp_file.fd = -1;
+
+  ZipArchiveHandle handle;
+  ZipEntry data;
+  OpenArchive(temp_file.path, &handle);
+  FindEntry(handle, ZipString("large"), &data);
+  while (state.KeepRunning()) {
+    ExtractToMemory(handle, &data, contents.data(), contents.size());
+  }
+  state.SetBytesProcessed(state.iterations() * contents.size());
+  CloseArchive(handle);
+}
+BENCHMARK(Inflate_large_entry);
+
+// Streams a 64MiB entry, deflated when state.range(0), with state.range(1) KiB
+// buffers, readahead hints when state.range(2) and a background reader thread
+// when state.range(3). The archive is read from the page cache but for the
+// first iteration, so this is mostly about syscalls and overlap.
+static void Stream_large_entry(benchmark::State& state) {
+  TemporaryFile temp_file;
+  FILE* fp = fdopen(temp_file.fd, "w");
+  ZipWriter writer(fp);
+  std::vector<uint8_t> contents(64 * 1024 * 1024);
+  for (size_t i = 0; i < contents.size(); i++) {
+    contents[i] = static_cast<uint8_t>((i % 4096 < 2048) ? (i / 4096) : (i * 2654435761u >> 24));
+  }
+  writer.StartEntry("large", state.range(0) ? ZipWriter::kCompress : 0);
+  writer.WriteBytes(contents.data(), contents.size());
+  writer.FinishEntry();
+  writer.Finish();
+  fclose(fp);
+  temp_file.fd = -1;
+
+  ZipArchiveStreamEntry::Options options;
+  options.buffer_size = state.range(1) * 1024;
+  options.readahead = state.range(2);
+  options.background = state.range(3);
+
+  ZipArchiveHandle handle;
+  ZipEntry data;
+  OpenArchive(temp_file.path, &handle);
+  FindEntry(handle, ZipString("large"), &data);
+  while (state.KeepRunning()) {
+    std::unique_ptr<ZipArchiveStreamEntry> stream(
+        ZipArchiveStreamEntry::Create(handle, data, options));
+    const std::vector<uint8_t>* chunk;
+    while ((chunk = stream->Read()) != nullptr) {
+      benchmark::DoNotOptimize(chunk->data());
+    }
+    if (!stream->Verify()) {
+      state.SkipWithError("entry didn't verify");
+      break;
+    }
+  }
+  state.SetBytesProcessed(state.iterations() * contents.size());
+  CloseArchive(handle);
+}
+BENCHMARK(Stream_large_entry)
+    ->Args({0, 64, 0, 0})
+    ->Args({0, 1024, 0, 0})
+    ->Args({0, 1024, 1, 0})
+    ->Args({0, 1024, 1, 1})
+    ->Args({1, 64, 0, 0})
+    ->Args({1, 1024, 1, 0})
+    ->Args({1, 1024, 1, 1})
+    ->UseRealTime();
+
+// Arg 0 is zlib's crc32, arg 1 the ComputeCrc32 extraction uses.
+static void Crc32_large_buffer(benchmark::State& state) {
+  std::vector<uint8_t> buffer(16 * 1024 * 1024);
+  for (size_t i = 0; i < buffer.size(); i++) {
+    buffer[i] = static_cast<uint8_t>(i * 2654435761u >> 24);
+  }
+  uint32_t crc = 0;
+  while (state.KeepRunning()) {
+    if (state.range(0) == 0) {
+      crc = crc32(crc, buffer.data(), buffer.size());
+    } else {
+      crc = ComputeCrc32(crc, buffer.data(), buffer.size());
+    }
+  }
+  benchmark::DoNotOptimize(crc);
+  state.SetBytesProcessed(state.iterations() * buffer.size());
+}
+BENCHMARK(Crc32_large_buffer)->Arg(0)->Arg(1);
+
 BENCHMARK_MAIN()
@@ -22,6 +22,7 @@
 #include <unistd.h>
 
 #include <memory>
+#include <mutex>
 #include <vector>
 
 #include <utils/FileMap.h>
@@ -42,6 +43,7 @@ static const char* kErrorMessages[] = {
     "Invalid entry name",
     "I/O error",
     "File mapping failed",
+    "Entry is compressed",
 };
 
 enum ErrorCodes : int32_t {
@@ -87,7 +89,10 @@ enum ErrorCodes : int32_t {
   // We were not able to mmap the central directory or entry contents.
   kMmapFailed = -12,
 
-  kLastErrorCode = kMmapFailed,
+  // The entry is compressed, so its data can't be used in place.
+  kEntryNotStored = -13,
+
+  kLastErrorCode = kEntryNotStored,
 };
 
 class MappedZipFile {
@@ -146,6 +151,35 @@ class CentralDirectory {
   size_t length_;
 };
 
+// A slot in the entry hash table: the hash of the entry's name, and the
+// offset of the name from the start of the central directory. Names never
+// start at offset 0, so that marks an empty slot.
+struct ZipEntrySlot {
+  uint32_t hash;
+  uint32_t name_offset;
+};
+
+// Header of an index written by WriteArchiveIndex. It identifies the archive
+// it was written for and is followed by the hash_table_size slots of the
+// archive's hash table. Bump kVersion if the header, the slots or
+// ComputeHash change.
+struct ZipArchiveIndexHeader {
+  static const uint32_t kMagic = 0x5844495a;  // "ZIDX"
+  static const uint32_t kVersion = 1;
+
+  uint32_t magic;
+  uint32_t version;
+  uint64_t file_dev;
+  uint64_t file_ino;
+  uint64_t file_size;
+  int64_t file_mtime_sec;
+  int64_t file_mtime_nsec;
+  uint32_t directory_offset;
+  uint32_t cd_size;
+  uint32_t num_entries;
+  uint32_t hash_table_size;
+};
+
 struct ZipArchive {
   // open Zip archive
   mutable MappedZipFile mapped_zip;
@@ -164,7 +198,15 @@ struct ZipArchive {
   // allocate so the maximum number entries can never be higher than
   // ((4 * UINT16_MAX) / 3 + 1) which can safely fit into a uint32_t.
   uint32_t hash_table_size;
-  ZipString* hash_table;
+  ZipEntrySlot* hash_table;
+
+  // With OpenArchiveLazy the hash table isn't built until it's first needed.
+  bool lazy_hash_table;
+  std::once_flag hash_table_once;
+  int32_t hash_table_result;
+
+  // Set when hash_table points into an index from OpenArchiveFdWithIndex.
+  std::unique_ptr<android::FileMap> index_map;
 
   ZipArchive(const int fd, bool assume_ownership)
       : mapped_zip(fd),
@@ -174,7 +216,9 @@ struct ZipArchive {
         directory_map(new android::FileMap()),
         num_entries(0),
         hash_table_size(0),
-        hash_table(nullptr) {}
+        hash_table(nullptr),
+        lazy_hash_table(false),
+        hash_table_result(0) {}
 
   ZipArchive(void* address, size_t length)
       : mapped_zip(address, length),
@@ -184,14 +228,18 @@ struct ZipArchive {
         directory_map(new android::FileMap()),
         num_entries(0),
         hash_table_size(0),
-        hash_table(nullptr) {}
+        hash_table(nullptr),
+        lazy_hash_table(false),
+        hash_table_result(0) {}
 
   ~ZipArchive() {
     if (close_file && mapped_zip.GetFileDescriptor() >= 0) {
       close(mapped_zip.GetFileDescriptor());
     }
 
-    free(hash_table);
+    if (!index_map) {
+      free(hash_table);
+    }
   }
 
   bool InitializeCentralDirectory(const char* debug_file_name, off64_t cd_start_offset,
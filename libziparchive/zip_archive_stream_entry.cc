@@ -18,12 +18,17 @@
 
 // Read-only stream access to Zip Archive entries.
 #include <errno.h>
+#include <fcntl.h>
 #include <inttypes.h>
 #include <string.h>
 #include <sys/types.h>
 #include <unistd.h>
 
+#include <algorithm>
+#include <condition_variable>
 #include <memory>
+#include <mutex>
+#include <thread>
 #include <vector>
 
 #include <android-base/file.h>
@@ -34,20 +39,124 @@
 #include <zlib.h>
 
 #include "zip_archive_private.h"
-
-static constexpr size_t kBufSize = 65535;
+#include "zip_crc32.h"
 
 bool ZipArchiveStreamEntry::Init(const ZipEntry& entry) {
-  ZipArchive* archive = reinterpret_cast<ZipArchive*>(handle_);
-  off64_t data_offset = entry.offset;
-  if (!archive->mapped_zip.SeekToOffset(data_offset)) {
-    ALOGW("lseek to data at %" PRId64 " failed: %s", data_offset, strerror(errno));
-    return false;
-  }
   crc32_ = entry.crc32;
   return true;
 }
 
+// Reads |length| bytes of the archive from |offset| in order, a buffer at a
+// time. Reads are positioned, so nothing else using the archive moves them.
+// In the background, the next buffer is read while the caller has the last
+// one: there are two, taking turns.
+class EntryReader {
+ public:
+  EntryReader(MappedZipFile* zip, off64_t offset, uint64_t length,
+              const ZipArchiveStreamEntry::Options& options)
+      : zip_(zip), offset_(offset), length_(length), buffer_size_(options.buffer_size) {
+#if defined(__linux__)
+    if (options.readahead && zip_->HasFd()) {
+      // Errors don't matter, these are only hints.
+      int fd = zip_->GetFileDescriptor();
+      posix_fadvise(fd, offset_, length_, POSIX_FADV_SEQUENTIAL);
+      posix_fadvise(fd, offset_, std::min<uint64_t>(length_, buffer_size_), POSIX_FADV_WILLNEED);
+    }
+#endif
+    bool background = options.background;
+#if defined(_WIN32)
+    background = false;
+#endif
+    if (background) {
+      wanted_ = true;
+      thread_ = std::thread(&EntryReader::ReaderLoop, this);
+    }
+  }
+
+  ~EntryReader() {
+    if (thread_.joinable()) {
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stop_ = true;
+      }
+      cv_.notify_all();
+      thread_.join();
+    }
+  }
+
+  // Returns the next buffer_size bytes or what's left, empty at the end, or
+  // nullptr on error. The buffer stays valid until the next call.
+  std::vector<uint8_t>* Next() {
+    if (!thread_.joinable()) {
+      return Fill(&buffers_[0]) ? &buffers_[0] : nullptr;
+    }
+
+    std::unique_lock<std::mutex> lock(mutex_);
+    cv_.wait(lock, [this]() { return !wanted_; });
+    if (!filled_) return nullptr;
+    std::vector<uint8_t>* buffer = &buffers_[filling_];
+    if (!buffer->empty()) {
+      // The caller is done with the other one.
+      filling_ ^= 1;
+      wanted_ = true;
+      cv_.notify_all();
+    }
+    return buffer;
+  }
+
+ private:
+  bool Fill(std::vector<uint8_t>* buffer) {
+    size_t bytes = std::min<uint64_t>(buffer_size_, length_ - position_);
+    buffer->resize(bytes);
+    if (bytes == 0) return true;
+
+    errno = 0;
+    if (!zip_->ReadAtOffset(buffer->data(), bytes, offset_ + position_)) {
+      if (errno != 0) {
+        ALOGE("Error reading from archive fd: %s", strerror(errno));
+      } else {
+        ALOGE("Short read of zip file, possibly corrupted zip?");
+      }
+      return false;
+    }
+    position_ += bytes;
+    return true;
+  }
+
+  void ReaderLoop() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (true) {
+      cv_.wait(lock, [this]() { return wanted_ || stop_; });
+      if (stop_) return;
+      std::vector<uint8_t>* buffer = &buffers_[filling_];
+      lock.unlock();
+      bool filled = Fill(buffer);
+      lock.lock();
+      filled_ = filled;
+      wanted_ = false;
+      cv_.notify_all();
+      if (!filled) return;
+    }
+  }
+
+  MappedZipFile* zip_;
+  const off64_t offset_;
+  const uint64_t length_;
+  const size_t buffer_size_;
+  uint64_t position_ = 0;
+
+  std::vector<uint8_t> buffers_[2];
+
+  std::thread thread_;
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  // The one the thread fills next, or is filling.
+  size_t filling_ = 0;
+  bool wanted_ = false;
+  bool filled_ = false;
+  bool stop_ = false;
+};
+
 class ZipArchiveStreamEntryUncompressed : public ZipArchiveStreamEntry {
  public:
   explicit ZipArchiveStreamEntryUncompressed(ZipArchiveHandle handle)
@@ -61,10 +170,13 @@ class ZipArchiveStreamEntryUncompressed : public ZipArchiveStreamEntry {
  protected:
   bool Init(const ZipEntry& entry) override;
 
+  // Streams the |length| bytes of the entry's data.
+  void InitReader(const ZipEntry& entry, uint32_t length);
+
   uint32_t length_;
 
  private:
-  std::vector<uint8_t> data_;
+  std::unique_ptr<EntryReader> reader_;
   uint32_t computed_crc32_;
 };
 
@@ -73,38 +185,32 @@ bool ZipArchiveStreamEntryUncompressed::Init(const ZipEntry& entry) {
     return false;
   }
 
-  length_ = entry.uncompressed_length;
-
-  data_.resize(kBufSize);
-  computed_crc32_ = 0;
+  InitReader(entry, entry.uncompressed_length);
 
   return true;
 }
 
+void ZipArchiveStreamEntryUncompressed::InitReader(const ZipEntry& entry, uint32_t length) {
+  ZipArchive* archive = reinterpret_cast<ZipArchive*>(handle_);
+  length_ = length;
+  reader_.reset(new EntryReader(&archive->mapped_zip, entry.offset, length_, options_));
+  computed_crc32_ = 0;
+}
+
 const std::vector<uint8_t>* ZipArchiveStreamEntryUncompressed::Read() {
   if (length_ == 0) {
     return nullptr;
   }
 
-  size_t bytes = (length_ > data_.size()) ? data_.size() : length_;
-  ZipArchive* archive = reinterpret_cast<ZipArchive*>(handle_);
-  errno = 0;
-  if (!archive->mapped_zip.ReadData(data_.data(), bytes)) {
-    if (errno != 0) {
-      ALOGE("Error reading from archive fd: %s", strerror(errno));
-    } else {
-      ALOGE("Short read of zip file, possibly corrupted zip?");
-    }
+  const std::vector<uint8_t>* data = reader_->Next();
+  if (data == nullptr || data->empty()) {
     length_ = 0;
     return nullptr;
   }
 
-  if (bytes < data_.size()) {
-    data_.resize(bytes);
-  }
-  computed_crc32_ = crc32(computed_crc32_, data_.data(), data_.size());
-  length_ -= bytes;
-  return &data_;
+  computed_crc32_ = ComputeCrc32(computed_crc32_, data->data(), data->size());
+  length_ -= data->size();
+  return data;
 }
 
 bool ZipArchiveStreamEntryUncompressed::Verify() {
@@ -127,7 +233,7 @@ class ZipArchiveStreamEntryCompressed : public ZipArchiveStreamEntry {
  private:
   bool z_stream_init_ = false;
   z_stream z_stream_;
-  std::vector<uint8_t> in_;
+  std::unique_ptr<EntryReader> reader_;
   std::vector<uint8_t> out_;
   uint32_t uncompressed_length_;
   uint32_t compressed_length_;
@@ -175,8 +281,10 @@ bool ZipArchiveStreamEntryCompressed::Init(const ZipEntry& entry) {
   uncompressed_length_ = entry.uncompressed_length;
   compressed_length_ = entry.compressed_length;
 
-  out_.resize(kBufSize);
-  in_.resize(kBufSize);
+  ZipArchive* archive = reinterpret_cast<ZipArchive*>(handle_);
+  reader_.reset(
+      new EntryReader(&archive->mapped_zip, entry.offset, compressed_length_, options_));
+  out_.resize(options_.buffer_size);
 
   computed_crc32_ = 0;
 
@@ -207,21 +315,15 @@ const std::vector<uint8_t>* ZipArchiveStreamEntryCompressed::Read() {
       if (compressed_length_ == 0) {
         return nullptr;
       }
-      size_t bytes = (compressed_length_ > in_.size()) ? in_.size() : compressed_length_;
-      ZipArchive* archive = reinterpret_cast<ZipArchive*>(handle_);
-      errno = 0;
-      if (!archive->mapped_zip.ReadData(in_.data(), bytes)) {
-        if (errno != 0) {
-          ALOGE("Error reading from archive fd: %s", strerror(errno));
-        } else {
-          ALOGE("Short read of zip file, possibly corrupted zip?");
-        }
+      // inflate() is done with the last one, so the reader may reuse it.
+      const std::vector<uint8_t>* in = reader_->Next();
+      if (in == nullptr || in->empty()) {
         return nullptr;
       }
 
-      compressed_length_ -= bytes;
-      z_stream_.next_in = in_.data();
-      z_stream_.avail_in = bytes;
+      compressed_length_ -= in->size();
+      z_stream_.next_in = in->data();
+      z_stream_.avail_in = in->size();
     }
 
     int zerr = inflate(&z_stream_, Z_NO_FLUSH);
@@ -233,14 +335,14 @@ const std::vector<uint8_t>* ZipArchiveStreamEntryCompressed::Read() {
 
     if (z_stream_.avail_out == 0) {
       uncompressed_length_ -= out_.size();
-      computed_crc32_ = crc32(computed_crc32_, out_.data(), out_.size());
+      computed_crc32_ = ComputeCrc32(computed_crc32_, out_.data(), out_.size());
       return &out_;
     }
     if (zerr == Z_STREAM_END) {
       if (z_stream_.avail_out != 0) {
         // Resize the vector down to the actual size of the data.
         out_.resize(out_.size() - z_stream_.avail_out);
-        computed_crc32_ = crc32(computed_crc32_, out_.data(), out_.size());
+        computed_crc32_ = ComputeCrc32(computed_crc32_, out_.data(), out_.size());
         uncompressed_length_ -= out_.size();
         return &out_;
       }
@@ -263,10 +365,11 @@ class ZipArchiveStreamEntryRawCompressed : public ZipArchiveStreamEntryUncompres
 };
 
 bool ZipArchiveStreamEntryRawCompressed::Init(const ZipEntry& entry) {
-  if (!ZipArchiveStreamEntryUncompressed::Init(entry)) {
+  if (!ZipArchiveStreamEntry::Init(entry)) {
     return false;
   }
-  length_ = entry.compressed_length;
+
+  InitReader(entry, entry.compressed_length);
 
   return true;
 }
@@ -277,15 +380,25 @@ bool ZipArchiveStreamEntryRawCompressed::Verify() {
 
 ZipArchiveStreamEntry* ZipArchiveStreamEntry::Create(ZipArchiveHandle handle,
                                                      const ZipEntry& entry) {
+  return Create(handle, entry, Options());
+}
+
+ZipArchiveStreamEntry* ZipArchiveStreamEntry::Create(ZipArchiveHandle handle,
+                                                     const ZipEntry& entry,
+                                                     const Options& options) {
   ZipArchiveStreamEntry* stream = nullptr;
   if (entry.method != kCompressStored) {
     stream = new ZipArchiveStreamEntryCompressed(handle);
   } else {
     stream = new ZipArchiveStreamEntryUncompressed(handle);
   }
-  if (stream && !stream->Init(entry)) {
-    delete stream;
-    stream = nullptr;
+  if (stream) {
+    stream->options_ = options;
+    stream->options_.buffer_size = std::max<size_t>(options.buffer_size, 1);
+    if (!stream->Init(entry)) {
+      delete stream;
+      stream = nullptr;
+    }
   }
 
   return stream;
@@ -293,6 +406,12 @@ ZipArchiveStreamEntry* ZipArchiveStreamEntry::Create(ZipArchiveHandle handle,
 
 ZipArchiveStreamEntry* ZipArchiveStreamEntry::CreateRaw(ZipArchiveHandle handle,
                                                         const ZipEntry& entry) {
+  return CreateRaw(handle, entry, Options());
+}
+
+ZipArchiveStreamEntry* ZipArchiveStreamEntry::CreateRaw(ZipArchiveHandle handle,
+                                                        const ZipEntry& entry,
+                                                        const Options& options) {
   ZipArchiveStreamEntry* stream = nullptr;
   if (entry.method == kCompressStored) {
     // Not compressed, don't need to do anything special.
@@ -300,9 +419,13 @@ ZipArchiveStreamEntry* ZipArchiveStreamEntry::CreateRaw(ZipArchiveHandle handle,
   } else {
     stream = new ZipArchiveStreamEntryRawCompressed(handle);
   }
-  if (stream && !stream->Init(entry)) {
-    delete stream;
-    stream = nullptr;
+  if (stream) {
+    stream->options_ = options;
+    stream->options_.buffer_size = std::max<size_t>(options.buffer_size, 1);
+    if (!stream->Init(entry)) {
+      delete stream;
+      stream = nullptr;
+    }
   }
   return stream;
 }
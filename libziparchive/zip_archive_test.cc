@@ -117,6 +117,75 @@ TEST(ziparchive, OpenDoNotAssumeFdOwnership) {
   close(fd);
 }
 
+TEST(ziparchive, OpenLazy) {
+  const std::string abs_path = test_data_dir + "/" + kValidZip;
+  ZipArchiveHandle eager_handle;
+  ASSERT_EQ(0, OpenArchive(abs_path.c_str(), &eager_handle));
+  ZipArchiveHandle handle;
+  ASSERT_EQ(0, OpenArchiveLazy(abs_path.c_str(), &handle));
+
+  // The first lookup builds the table.
+  ZipString name;
+  SetZipString(&name, kATxtName);
+  ZipEntry eager_data;
+  ZipEntry data;
+  ASSERT_EQ(0, FindEntry(eager_handle, name, &eager_data));
+  ASSERT_EQ(0, FindEntry(handle, name, &data));
+  ASSERT_EQ(eager_data.offset, data.offset);
+  ASSERT_EQ(eager_data.crc32, data.crc32);
+
+  SetZipString(&name, kNonexistentTxtName);
+  ASSERT_EQ(kEntryNotFound, FindEntry(handle, name, &data));
+
+  void* iteration_cookie;
+  ASSERT_EQ(0, StartIteration(handle, &iteration_cookie, nullptr, nullptr));
+  size_t count = 0;
+  while (Next(iteration_cookie, &data, &name) == 0) {
+    ++count;
+  }
+  ASSERT_EQ(5u, count);
+  EndIteration(iteration_cookie);
+
+  CloseArchive(handle);
+  CloseArchive(eager_handle);
+}
+
+TEST(ziparchive, OpenWithIndex) {
+  const std::string abs_path = test_data_dir + "/" + kValidZip;
+  ZipArchiveHandle handle;
+  ASSERT_EQ(0, OpenArchive(abs_path.c_str(), &handle));
+  TemporaryFile index_file;
+  ASSERT_EQ(0, WriteArchiveIndex(handle, index_file.fd));
+  CloseArchive(handle);
+
+  int fd = open(abs_path.c_str(), O_RDONLY | O_BINARY);
+  ASSERT_NE(-1, fd);
+  ASSERT_EQ(0, OpenArchiveFdWithIndex(fd, "OpenWithIndex", &handle, index_file.fd));
+  ZipString name;
+  SetZipString(&name, kATxtName);
+  ZipEntry data;
+  ASSERT_EQ(0, FindEntry(handle, name, &data));
+  ASSERT_EQ(static_cast<uint32_t>(17), data.uncompressed_length);
+
+  void* iteration_cookie;
+  ASSERT_EQ(0, StartIteration(handle, &iteration_cookie, nullptr, nullptr));
+  size_t count = 0;
+  while (Next(iteration_cookie, &data, &name) == 0) {
+    ++count;
+  }
+  ASSERT_EQ(5u, count);
+  EndIteration(iteration_cookie);
+  CloseArchive(handle);
+
+  // An index written for another file is ignored.
+  fd = open((test_data_dir + "/" + kLargeZip).c_str(), O_RDONLY | O_BINARY);
+  ASSERT_NE(-1, fd);
+  ASSERT_EQ(0, OpenArchiveFdWithIndex(fd, "OpenWithIndex", &handle, index_file.fd));
+  SetZipString(&name, kLargeCompressTxtName);
+  ASSERT_EQ(0, FindEntry(handle, name, &data));
+  CloseArchive(handle);
+}
+
 TEST(ziparchive, Iteration) {
   ZipArchiveHandle handle;
   ASSERT_EQ(0, OpenArchiveWrapper(kValidZip, &handle));
@@ -394,6 +463,50 @@ TEST(ziparchive, EmptyEntries) {
   ASSERT_EQ(0, stat_buf.st_size);
 }
 
+TEST(ziparchive, ExtractEntriesToFiles) {
+  ZipArchiveHandle handle;
+  ASSERT_EQ(0, OpenArchiveWrapper(kLargeZip, &handle));
+
+  void* iteration_cookie;
+  ASSERT_EQ(0, StartIteration(handle, &iteration_cookie, nullptr, nullptr));
+  std::vector<ZipEntry> entries;
+  ZipEntry entry;
+  ZipString name;
+  while (Next(iteration_cookie, &entry, &name) == 0) {
+    entries.push_back(entry);
+  }
+  EndIteration(iteration_cookie);
+  ASSERT_LT(1u, entries.size());
+
+  std::vector<std::unique_ptr<TemporaryFile>> files;
+  std::vector<int> fds;
+  for (size_t i = 0; i < entries.size(); ++i) {
+    files.emplace_back(new TemporaryFile);
+    fds.push_back(files.back()->fd);
+  }
+  size_t failed_index = 123;
+  ASSERT_EQ(0, ExtractEntriesToFiles(handle, entries.data(), fds.data(), entries.size(), 4,
+                                     &failed_index));
+  ASSERT_EQ(123u, failed_index);
+
+  for (size_t i = 0; i < entries.size(); ++i) {
+    std::vector<uint8_t> expected(entries[i].uncompressed_length);
+    ASSERT_EQ(0, ExtractToMemory(handle, &entries[i], expected.data(), expected.size()));
+    std::vector<uint8_t> actual(expected.size());
+    ASSERT_EQ(0, lseek64(fds[i], 0, SEEK_SET));
+    ASSERT_TRUE(android::base::ReadFully(fds[i], actual.data(), actual.size()));
+    ASSERT_EQ(expected, actual);
+  }
+
+  // A bad descriptor is reported against its entry.
+  fds.back() = -1;
+  ASSERT_EQ(kIoError, ExtractEntriesToFiles(handle, entries.data(), fds.data(), entries.size(),
+                                            4, &failed_index));
+  ASSERT_EQ(entries.size() - 1, failed_index);
+
+  CloseArchive(handle);
+}
+
 TEST(ziparchive, EntryLargerThan32K) {
   TemporaryFile tmp_file;
   ASSERT_NE(-1, tmp_file.fd);
@@ -484,6 +597,46 @@ TEST(ziparchive, ExtractToFile) {
             lseek64(tmp_file.fd, 0, SEEK_END));
 }
 
+TEST(ziparchive, MapStoredEntry) {
+  ZipArchiveHandle handle;
+  ASSERT_EQ(0, OpenArchiveWrapper(kLargeZip, &handle));
+
+  ZipEntry entry;
+  ZipString name;
+  SetZipString(&name, kLargeUncompressTxtName);
+  ASSERT_EQ(0, FindEntry(handle, name, &entry));
+  ASSERT_EQ(kCompressStored, entry.method);
+  std::vector<uint8_t> expected(entry.uncompressed_length);
+  ASSERT_EQ(0, ExtractToMemory(handle, &entry, expected.data(), expected.size()));
+
+  const uint8_t* data;
+  android::FileMap* map;
+  ASSERT_EQ(0, MapStoredEntry(handle, &entry, &data, &map));
+  ASSERT_NE(nullptr, map);
+  ASSERT_EQ(0, memcmp(expected.data(), data, expected.size()));
+  delete map;
+
+  SetZipString(&name, kLargeCompressTxtName);
+  ASSERT_EQ(0, FindEntry(handle, name, &entry));
+  ASSERT_EQ(kEntryNotStored, MapStoredEntry(handle, &entry, &data, &map));
+  CloseArchive(handle);
+
+  // An archive in memory gives a pointer into that memory.
+  android::base::unique_fd fd(open((test_data_dir + "/" + kLargeZip).c_str(), O_RDONLY | O_BINARY));
+  ASSERT_NE(-1, fd);
+  android::FileMap file_map;
+  file_map.create(nullptr, fd, 0, lseek64(fd, 0, SEEK_END), true);
+  ASSERT_EQ(0, OpenArchiveFromMemory(file_map.getDataPtr(), file_map.getDataLength(),
+                                     "MapStoredEntry", &handle));
+  SetZipString(&name, kLargeUncompressTxtName);
+  ASSERT_EQ(0, FindEntry(handle, name, &entry));
+  ASSERT_EQ(0, MapStoredEntry(handle, &entry, &data, &map));
+  ASSERT_EQ(nullptr, map);
+  ASSERT_EQ(reinterpret_cast<const uint8_t*>(file_map.getDataPtr()) + entry.offset, data);
+  ASSERT_EQ(0, memcmp(expected.data(), data, expected.size()));
+  CloseArchive(handle);
+}
+
 #if !defined(_WIN32)
 TEST(ziparchive, OpenFromMemory) {
   const std::string zip_path = test_data_dir + "/" + kUpdateZip;
@@ -510,21 +663,23 @@ TEST(ziparchive, OpenFromMemory) {
 }
 #endif
 
-static void ZipArchiveStreamTest(ZipArchiveHandle& handle, const std::string& entry_name, bool raw,
-                                 bool verified, ZipEntry* entry, std::vector<uint8_t>* read_data) {
+static void ZipArchiveStreamTest(
+    ZipArchiveHandle& handle, const std::string& entry_name, bool raw, bool verified,
+    ZipEntry* entry, std::vector<uint8_t>* read_data,
+    const ZipArchiveStreamEntry::Options& options = ZipArchiveStreamEntry::Options()) {
   ZipString name;
   SetZipString(&name, entry_name);
   ASSERT_EQ(0, FindEntry(handle, name, entry));
   std::unique_ptr<ZipArchiveStreamEntry> stream;
   if (raw) {
-    stream.reset(ZipArchiveStreamEntry::CreateRaw(handle, *entry));
+    stream.reset(ZipArchiveStreamEntry::CreateRaw(handle, *entry, options));
     if (entry->method == kCompressStored) {
       read_data->resize(entry->uncompressed_length);
     } else {
       read_data->resize(entry->compressed_length);
     }
   } else {
-    stream.reset(ZipArchiveStreamEntry::Create(handle, *entry));
+    stream.reset(ZipArchiveStreamEntry::Create(handle, *entry, options));
     read_data->resize(entry->uncompressed_length);
   }
   uint8_t* read_data_ptr = read_data->data();
@@ -556,14 +711,15 @@ static void ZipArchiveStreamTestUsingContents(const std::string& zip_file,
   CloseArchive(handle);
 }
 
-static void ZipArchiveStreamTestUsingMemory(const std::string& zip_file,
-                                            const std::string& entry_name) {
+static void ZipArchiveStreamTestUsingMemory(
+    const std::string& zip_file, const std::string& entry_name,
+    const ZipArchiveStreamEntry::Options& options = ZipArchiveStreamEntry::Options()) {
   ZipArchiveHandle handle;
   ASSERT_EQ(0, OpenArchiveWrapper(zip_file, &handle));
 
   ZipEntry entry;
   std::vector<uint8_t> read_data;
-  ZipArchiveStreamTest(handle, entry_name, false, true, &entry, &read_data);
+  ZipArchiveStreamTest(handle, entry_name, false, true, &entry, &read_data, options);
 
   std::vector<uint8_t> cmp_data(entry.uncompressed_length);
   ASSERT_EQ(entry.uncompressed_length, read_data.size());
@@ -597,6 +753,40 @@ TEST(ziparchive, StreamLargeUncompressed) {
   ZipArchiveStreamTestUsingMemory(kLargeZip, kLargeUncompressTxtName);
 }
 
+static ZipArchiveStreamEntry::Options StreamOptions(size_t buffer_size, bool background) {
+  ZipArchiveStreamEntry::Options options;
+  options.buffer_size = buffer_size;
+  options.readahead = true;
+  options.background = background;
+  return options;
+}
+
+TEST(ziparchive, StreamLargeCompressedOptions) {
+  ZipArchiveStreamTestUsingMemory(kLargeZip, kLargeCompressTxtName, StreamOptions(1000, false));
+  ZipArchiveStreamTestUsingMemory(kLargeZip, kLargeCompressTxtName, StreamOptions(1000, true));
+  ZipArchiveStreamTestUsingMemory(kLargeZip, kLargeCompressTxtName,
+                                  StreamOptions(1024 * 1024, true));
+}
+
+TEST(ziparchive, StreamLargeUncompressedOptions) {
+  ZipArchiveStreamTestUsingMemory(kLargeZip, kLargeUncompressTxtName, StreamOptions(1000, false));
+  ZipArchiveStreamTestUsingMemory(kLargeZip, kLargeUncompressTxtName, StreamOptions(1000, true));
+  ZipArchiveStreamTestUsingMemory(kLargeZip, kLargeUncompressTxtName,
+                                  StreamOptions(1024 * 1024, true));
+}
+
+TEST(ziparchive, StreamRawBackground) {
+  ZipArchiveHandle handle;
+  ASSERT_EQ(0, OpenArchiveWrapper(kValidZip, &handle));
+
+  ZipEntry entry;
+  std::vector<uint8_t> read_data;
+  ZipArchiveStreamTest(handle, kATxtName, true, true, &entry, &read_data, StreamOptions(7, true));
+  ASSERT_EQ(kATxtContentsCompressed, read_data);
+
+  CloseArchive(handle);
+}
+
 TEST(ziparchive, StreamCompressedBadCrc) {
   ZipArchiveHandle handle;
   ASSERT_EQ(0, OpenArchiveWrapper(kBadCrcZip, &handle));
@@ -712,7 +902,7 @@ TEST(ziparchive, ErrorCodeString) {
 
   // Out of bounds.
   ASSERT_STREQ("Unknown return code", ErrorCodeString(1));
-  ASSERT_STREQ("Unknown return code", ErrorCodeString(-13));
+  ASSERT_STREQ("Unknown return code", ErrorCodeString(kLastErrorCode - 1));
 
   ASSERT_STREQ("I/O error", ErrorCodeString(kIoError));
 }
@@ -0,0 +1,184 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "zip_crc32.h"
+
+#include <string.h>
+
+#include "zlib.h"
+
+#if defined(__aarch64__) && defined(__linux__)
+#include <arm_acle.h>
+#include <sys/auxv.h>
+#define ZIP_CRC32_ARMV8 1
+#ifndef HWCAP_CRC32
+#define HWCAP_CRC32 (1 << 7)
+#endif
+#elif defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define ZIP_CRC32_PCLMUL 1
+#endif
+
+typedef uint32_t (*Crc32Function)(uint32_t crc, const uint8_t* buf, size_t len);
+
+static uint32_t Crc32Zlib(uint32_t crc, const uint8_t* buf, size_t len) {
+  // zlib takes a uInt length, so feed it at most 1GiB at a time.
+  while (len > 0) {
+    const size_t chunk = (len > (1u << 30)) ? (1u << 30) : len;
+    crc = crc32(crc, buf, chunk);
+    buf += chunk;
+    len -= chunk;
+  }
+  return crc;
+}
+
+#if defined(ZIP_CRC32_ARMV8)
+__attribute__((target("crc"))) static uint32_t Crc32Armv8(uint32_t crc, const uint8_t* buf,
+                                                          size_t len) {
+  crc = ~crc;
+  while (len > 0 && (reinterpret_cast<uintptr_t>(buf) & 7) != 0) {
+    crc = __crc32b(crc, *buf++);
+    --len;
+  }
+  while (len >= 8) {
+    uint64_t word;
+    memcpy(&word, buf, sizeof(word));
+    crc = __crc32d(crc, word);
+    buf += 8;
+    len -= 8;
+  }
+  while (len > 0) {
+    crc = __crc32b(crc, *buf++);
+    --len;
+  }
+  return ~crc;
+}
+#endif
+
+#if defined(ZIP_CRC32_PCLMUL)
+#define PCLMUL_TARGET __attribute__((target("pclmul,sse4.1")))
+
+PCLMUL_TARGET static inline __m128i Load128(const uint8_t* p) {
+  return _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+}
+
+// Folds |x| forward over 128 bits with the constants in |k| and adds |next|.
+PCLMUL_TARGET static inline __m128i Fold128(__m128i x, __m128i k, __m128i next) {
+  __m128i low = _mm_clmulepi64_si128(x, k, 0x00);
+  x = _mm_clmulepi64_si128(x, k, 0x11);
+  return _mm_xor_si128(_mm_xor_si128(x, next), low);
+}
+
+/*
+ * Folds 64-byte blocks with carry-less multiplication and Barrett-reduces the
+ * result, as in Intel's "Fast CRC Computation for Generic Polynomials Using
+ * PCLMULQDQ Instruction". |len| must be a multiple of 16 and at least 64.
+ * |crc| is pre- and post-conditioned by the caller.
+ */
+PCLMUL_TARGET static uint32_t Crc32FoldPclmul(uint32_t crc, const uint8_t* buf, size_t len) {
+  // The bit-reflected constants for the zip polynomial, from the paper.
+  alignas(16) static const uint64_t k1k2[] = {0x0154442bd4, 0x01c6e41596};
+  alignas(16) static const uint64_t k3k4[] = {0x01751997d0, 0x00ccaa009e};
+  alignas(16) static const uint64_t k5k0[] = {0x0163cd6124, 0x0000000000};
+  alignas(16) static const uint64_t poly[] = {0x01db710641, 0x01f7011641};
+
+  __m128i x1 = Load128(buf + 0x00);
+  __m128i x2 = Load128(buf + 0x10);
+  __m128i x3 = Load128(buf + 0x20);
+  __m128i x4 = Load128(buf + 0x30);
+  x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128(static_cast<int>(crc)));
+  __m128i x0 = _mm_load_si128(reinterpret_cast<const __m128i*>(k1k2));
+  buf += 64;
+  len -= 64;
+
+  // Fold four blocks at a time.
+  while (len >= 64) {
+    __m128i x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    __m128i x6 = _mm_clmulepi64_si128(x2, x0, 0x00);
+    __m128i x7 = _mm_clmulepi64_si128(x3, x0, 0x00);
+    __m128i x8 = _mm_clmulepi64_si128(x4, x0, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+    x2 = _mm_clmulepi64_si128(x2, x0, 0x11);
+    x3 = _mm_clmulepi64_si128(x3, x0, 0x11);
+    x4 = _mm_clmulepi64_si128(x4, x0, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x5), Load128(buf + 0x00));
+    x2 = _mm_xor_si128(_mm_xor_si128(x2, x6), Load128(buf + 0x10));
+    x3 = _mm_xor_si128(_mm_xor_si128(x3, x7), Load128(buf + 0x20));
+    x4 = _mm_xor_si128(_mm_xor_si128(x4, x8), Load128(buf + 0x30));
+    buf += 64;
+    len -= 64;
+  }
+
+  // Fold the four lanes into one, then any remaining 16-byte blocks.
+  x0 = _mm_load_si128(reinterpret_cast<const __m128i*>(k3k4));
+  x1 = Fold128(x1, x0, x2);
+  x1 = Fold128(x1, x0, x3);
+  x1 = Fold128(x1, x0, x4);
+  while (len >= 16) {
+    x1 = Fold128(x1, x0, Load128(buf));
+    buf += 16;
+    len -= 16;
+  }
+
+  // Fold 128 bits down to 64.
+  x2 = _mm_clmulepi64_si128(x1, x0, 0x10);
+  x3 = _mm_setr_epi32(~0, 0, ~0, 0);
+  x1 = _mm_srli_si128(x1, 8);
+  x1 = _mm_xor_si128(x1, x2);
+  x0 = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(k5k0));
+  x2 = _mm_srli_si128(x1, 4);
+  x1 = _mm_and_si128(x1, x3);
+  x1 = _mm_clmulepi64_si128(x1, x0, 0x00);
+  x1 = _mm_xor_si128(x1, x2);
+
+  // Barrett reduction to 32 bits.
+  x0 = _mm_load_si128(reinterpret_cast<const __m128i*>(poly));
+  x2 = _mm_and_si128(x1, x3);
+  x2 = _mm_clmulepi64_si128(x2, x0, 0x10);
+  x2 = _mm_and_si128(x2, x3);
+  x2 = _mm_clmulepi64_si128(x2, x0, 0x00);
+  x1 = _mm_xor_si128(x1, x2);
+  return static_cast<uint32_t>(_mm_extract_epi32(x1, 1));
+}
+
+static uint32_t Crc32Pclmul(uint32_t crc, const uint8_t* buf, size_t len) {
+  if (len >= 64) {
+    const size_t folded = len & ~static_cast<size_t>(15);
+    crc = ~Crc32FoldPclmul(~crc, buf, folded);
+    buf += folded;
+    len -= folded;
+  }
+  return Crc32Zlib(crc, buf, len);
+}
+#endif
+
+static Crc32Function SelectCrc32() {
+#if defined(ZIP_CRC32_ARMV8)
+  if (getauxval(AT_HWCAP) & HWCAP_CRC32) {
+    return Crc32Armv8;
+  }
+#elif defined(ZIP_CRC32_PCLMUL)
+  if (__builtin_cpu_supports("pclmul") && __builtin_cpu_supports("sse4.1")) {
+    return Crc32Pclmul;
+  }
+#endif
+  return Crc32Zlib;
+}
+
+uint32_t ComputeCrc32(uint32_t crc, const uint8_t* buf, size_t len) {
+  static const Crc32Function crc32_function = SelectCrc32();
+  return crc32_function(crc, buf, len);
+}
@@ -0,0 +1,27 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef LIBZIPARCHIVE_ZIP_CRC32_H_
+#define LIBZIPARCHIVE_ZIP_CRC32_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Same as zlib's crc32(crc, buf, len), but uses the ARMv8 CRC32 instructions
+// or x86 carry-less multiplication when the CPU has them.
+uint32_t ComputeCrc32(uint32_t crc, const uint8_t* buf, size_t len);
+
+#endif  // LIBZIPARCHIVE_ZIP_CRC32_H_
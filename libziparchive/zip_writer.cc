@@ -22,6 +22,7 @@
 #include <cstdio>
 #define DEF_MEM_LEVEL 8  // normally in zutil.h?
 
+#include <algorithm>
 #include <memory>
 #include <vector>
 
@@ -45,6 +46,11 @@ enum {
 // Size of the output buffer used for compression.
 static const size_t kBufSize = 32768u;
 
+// Size of the blocks deflated concurrently by SetThreadCount, and how much of each block
+// primes the next one (the deflate window).
+static const size_t kParallelBlockSize = 128 * 1024u;
+static const size_t kDictionarySize = 32768u;
+
 // No error, operation completed successfully.
 static const int32_t kNoError = 0;
 
@@ -82,13 +88,68 @@ static void DeleteZStream(z_stream* stream) {
   delete stream;
 }
 
+/*
+ * Deflates |input| as one piece of a raw deflate stream, primed with |dictionary|, the
+ * input that came just before it. Pieces end with a sync flush, so the next one starts
+ * on a byte boundary, and the last piece ends the stream. Returns the compressed bytes,
+ * which are never empty on success, or an empty vector on failure.
+ */
+static std::vector<uint8_t> DeflateBlock(const std::vector<uint8_t>& dictionary,
+                                         const std::vector<uint8_t>& input, bool last) {
+  std::vector<uint8_t> output;
+  z_stream stream = {};
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wold-style-cast"
+  int zerr = deflateInit2(&stream, Z_BEST_COMPRESSION, Z_DEFLATED, -MAX_WBITS, DEF_MEM_LEVEL,
+                          Z_DEFAULT_STRATEGY);
+#pragma GCC diagnostic pop
+  if (zerr != Z_OK) {
+    ALOGE("deflateInit2 failed (zerr=%d)", zerr);
+    return output;
+  }
+  if (!dictionary.empty() &&
+      deflateSetDictionary(&stream, dictionary.data(), dictionary.size()) != Z_OK) {
+    ALOGE("deflateSetDictionary failed");
+    deflateEnd(&stream);
+    return output;
+  }
+
+  // Leave room for the sync flush marker on top of the bound.
+  output.resize(deflateBound(&stream, input.size()) + 16);
+  stream.next_in = const_cast<uint8_t*>(input.data());
+  stream.avail_in = input.size();
+  stream.next_out = output.data();
+  stream.avail_out = output.size();
+  const int flush = last ? Z_FINISH : Z_SYNC_FLUSH;
+  while (true) {
+    zerr = deflate(&stream, flush);
+    if (last ? (zerr == Z_STREAM_END) : (zerr == Z_OK && stream.avail_out != 0)) {
+      break;
+    }
+    if (zerr != Z_OK && zerr != Z_BUF_ERROR) {
+      ALOGE("deflate failed (zerr=%d)", zerr);
+      deflateEnd(&stream);
+      return std::vector<uint8_t>();
+    }
+    const size_t used = output.size() - stream.avail_out;
+    output.resize(output.size() * 2);
+    stream.next_out = output.data() + used;
+    stream.avail_out = output.size() - used;
+  }
+  output.resize(output.size() - stream.avail_out);
+  deflateEnd(&stream);
+  return output;
+}
+
 ZipWriter::ZipWriter(FILE* f)
     : file_(f),
       seekable_(false),
+      append_only_(false),
       current_offset_(0),
       state_(State::kWritingZip),
       z_stream_(nullptr, DeleteZStream),
-      buffer_(kBufSize) {
+      buffer_(kBufSize),
+      thread_count_(1) {
   // Check if the file is seekable (regular file). If fstat fails, that's fine, subsequent calls
   // will fail as well.
   struct stat file_stats;
@@ -100,11 +161,16 @@ ZipWriter::ZipWriter(FILE* f)
 ZipWriter::ZipWriter(ZipWriter&& writer)
     : file_(writer.file_),
       seekable_(writer.seekable_),
+      append_only_(writer.append_only_),
       current_offset_(writer.current_offset_),
       state_(writer.state_),
       files_(std::move(writer.files_)),
       z_stream_(std::move(writer.z_stream_)),
-      buffer_(std::move(writer.buffer_)) {
+      buffer_(std::move(writer.buffer_)),
+      thread_count_(writer.thread_count_),
+      block_input_(std::move(writer.block_input_)),
+      dictionary_(std::move(writer.dictionary_)),
+      pending_blocks_(std::move(writer.pending_blocks_)) {
   writer.file_ = nullptr;
   writer.state_ = State::kError;
 }
@@ -112,11 +178,16 @@ ZipWriter::ZipWriter(ZipWriter&& writer)
 ZipWriter& ZipWriter::operator=(ZipWriter&& writer) {
   file_ = writer.file_;
   seekable_ = writer.seekable_;
+  append_only_ = writer.append_only_;
   current_offset_ = writer.current_offset_;
   state_ = writer.state_;
   files_ = std::move(writer.files_);
   z_stream_ = std::move(writer.z_stream_);
   buffer_ = std::move(writer.buffer_);
+  thread_count_ = writer.thread_count_;
+  block_input_ = std::move(writer.block_input_);
+  dictionary_ = std::move(writer.dictionary_);
+  pending_blocks_ = std::move(writer.pending_blocks_);
   writer.file_ = nullptr;
   writer.state_ = State::kError;
   return *this;
@@ -125,9 +196,28 @@ ZipWriter& ZipWriter::operator=(ZipWriter&& writer) {
 int32_t ZipWriter::HandleError(int32_t error_code) {
   state_ = State::kError;
   z_stream_.reset();
+  pending_blocks_.clear();
   return error_code;
 }
 
+int32_t ZipWriter::SetThreadCount(size_t thread_count) {
+  if (state_ != State::kWritingZip || thread_count == 0) {
+    return kInvalidState;
+  }
+  thread_count_ = thread_count;
+  return kNoError;
+}
+
+int32_t ZipWriter::SetAppendOnly() {
+  if (state_ != State::kWritingZip || !files_.empty()) {
+    return kInvalidState;
+  }
+  // Written as if to a pipe, so nothing needs patching afterwards.
+  seekable_ = false;
+  append_only_ = true;
+  return kNoError;
+}
+
 int32_t ZipWriter::StartEntry(const char* path, size_t flags) {
   uint32_t alignment = 0;
   if (flags & kAlign32) {
@@ -221,9 +311,14 @@ int32_t ZipWriter::StartAlignedEntryWithTime(const char* path, size_t flags, tim
   if (flags & ZipWriter::kCompress) {
     file_entry.compression_method = kCompressDeflated;
 
-    int32_t result = PrepareDeflate();
-    if (result != kNoError) {
-      return result;
+    if (thread_count_ > 1) {
+      block_input_.clear();
+      dictionary_.clear();
+    } else {
+      int32_t result = PrepareDeflate();
+      if (result != kNoError) {
+        return result;
+      }
     }
   } else {
     file_entry.compression_method = kCompressStored;
@@ -266,7 +361,7 @@ int32_t ZipWriter::StartAlignedEntryWithTime(const char* path, size_t flags, tim
 }
 
 int32_t ZipWriter::DiscardLastEntry() {
-  if (state_ != State::kWritingZip || files_.empty()) {
+  if (state_ != State::kWritingZip || files_.empty() || append_only_) {
     return kInvalidState;
   }
 
@@ -322,7 +417,9 @@ int32_t ZipWriter::WriteBytes(const void* data, size_t len) {
   }
 
   int32_t result = kNoError;
-  if (current_file_entry_.compression_method & kCompressDeflated) {
+  if ((current_file_entry_.compression_method & kCompressDeflated) && thread_count_ > 1) {
+    result = CompressBytesParallel(&current_file_entry_, data, len);
+  } else if (current_file_entry_.compression_method & kCompressDeflated) {
     result = CompressBytes(&current_file_entry_, data, len);
   } else {
     result = StoreBytes(&current_file_entry_, data, len);
@@ -383,6 +480,68 @@ int32_t ZipWriter::CompressBytes(FileEntry* file, const void* data, size_t len)
   return kNoError;
 }
 
+int32_t ZipWriter::CompressBytesParallel(FileEntry* file, const void* data, size_t len) {
+  CHECK(state_ == State::kWritingEntry);
+
+  const uint8_t* input = reinterpret_cast<const uint8_t*>(data);
+  while (len > 0) {
+    const size_t take = std::min(len, kParallelBlockSize - block_input_.size());
+    block_input_.insert(block_input_.end(), input, input + take);
+    input += take;
+    len -= take;
+
+    if (block_input_.size() == kParallelBlockSize) {
+      int32_t result = SubmitBlock(file, false /*last*/);
+      if (result != kNoError) {
+        return result;
+      }
+    }
+  }
+  return kNoError;
+}
+
+int32_t ZipWriter::SubmitBlock(FileEntry* file, bool last) {
+  std::vector<uint8_t> input(std::move(block_input_));
+  block_input_.clear();
+  std::vector<uint8_t> dictionary(std::move(dictionary_));
+  dictionary_.clear();
+
+  // A last block with nothing ahead of it needn't leave this thread.
+  if (last && pending_blocks_.empty()) {
+    return WriteBlock(file, DeflateBlock(dictionary, input, last));
+  }
+
+  // Only the last block can be shorter than the window, and nothing follows it.
+  if (!last) {
+    dictionary_.assign(input.end() - kDictionarySize, input.end());
+  }
+  pending_blocks_.push_back(std::async(std::launch::async, DeflateBlock, std::move(dictionary),
+                                       std::move(input), last));
+
+  // Write blocks out in order, keeping at most thread_count_ in flight.
+  while (!pending_blocks_.empty() && (last || pending_blocks_.size() >= thread_count_)) {
+    std::vector<uint8_t> block = pending_blocks_.front().get();
+    pending_blocks_.pop_front();
+    int32_t result = WriteBlock(file, block);
+    if (result != kNoError) {
+      return result;
+    }
+  }
+  return kNoError;
+}
+
+int32_t ZipWriter::WriteBlock(FileEntry* file, const std::vector<uint8_t>& block) {
+  if (block.empty()) {
+    return HandleError(kZlibError);
+  }
+  if (fwrite(block.data(), 1, block.size(), file_) != block.size()) {
+    return HandleError(kIoError);
+  }
+  file->compressed_size += block.size();
+  current_offset_ += block.size();
+  return kNoError;
+}
+
 int32_t ZipWriter::FlushCompressedBytes(FileEntry* file) {
   CHECK(state_ == State::kWritingEntry);
   CHECK(z_stream_);
@@ -426,7 +585,8 @@ int32_t ZipWriter::FinishEntry() {
   }
 
   if (current_file_entry_.compression_method & kCompressDeflated) {
-    int32_t result = FlushCompressedBytes(&current_file_entry_);
+    int32_t result = (thread_count_ > 1) ? SubmitBlock(&current_file_entry_, true /*last*/)
+                                         : FlushCompressedBytes(&current_file_entry_);
     if (result != kNoError) {
       return result;
     }
@@ -466,6 +626,10 @@ int32_t ZipWriter::FinishEntry() {
     }
   }
 
+  if (append_only_ && fflush(file_) != 0) {
+    return HandleError(kIoError);
+  }
+
   files_.emplace_back(std::move(current_file_entry_));
   state_ = State::kWritingZip;
   return kNoError;
@@ -17,6 +17,7 @@
 #include "ziparchive/zip_writer.h"
 #include "ziparchive/zip_archive.h"
 
+#include <android-base/file.h>
 #include <android-base/test_utils.h>
 #include <gtest/gtest.h>
 #include <time.h>
@@ -286,6 +287,55 @@ TEST_F(zipwriter, WriteCompressedZipFlushFull) {
   CloseArchive(handle);
 }
 
+TEST_F(zipwriter, WriteCompressedZipParallel) {
+  // Several blocks' worth plus a partial block, written in uneven pieces.
+  constexpr size_t kBufSize = 1000003;
+  std::vector<uint8_t> buffer(kBufSize);
+  size_t prev = 1;
+  for (size_t i = 0; i < kBufSize; i++) {
+    buffer[i] = (i % 3000 < 1500) ? (i / 7) : (i + prev);
+    prev = i;
+  }
+
+  ZipWriter writer(file_);
+  ASSERT_EQ(0, writer.SetThreadCount(4));
+  ASSERT_EQ(0, writer.StartEntry("file.txt", ZipWriter::kCompress));
+  for (size_t offset = 0; offset < kBufSize; offset += 70000) {
+    const size_t len = std::min<size_t>(70000, kBufSize - offset);
+    ASSERT_EQ(0, writer.WriteBytes(buffer.data() + offset, len));
+  }
+  ASSERT_EQ(0, writer.FinishEntry());
+  ASSERT_EQ(0, writer.StartEntry("small.txt", ZipWriter::kCompress));
+  ASSERT_EQ(0, writer.WriteBytes("helo", 4));
+  ASSERT_EQ(0, writer.FinishEntry());
+  ASSERT_EQ(0, writer.StartEntry("empty.txt", ZipWriter::kCompress));
+  ASSERT_EQ(0, writer.FinishEntry());
+  ASSERT_EQ(0, writer.Finish());
+
+  ASSERT_GE(0, lseek(fd_, 0, SEEK_SET));
+
+  ZipArchiveHandle handle;
+  ASSERT_EQ(0, OpenArchiveFd(fd_, "temp", &handle, false));
+
+  ZipEntry data;
+  ASSERT_EQ(0, FindEntry(handle, ZipString("file.txt"), &data));
+  EXPECT_EQ(kCompressDeflated, data.method);
+  EXPECT_EQ(kBufSize, data.uncompressed_length);
+  EXPECT_GT(kBufSize, data.compressed_length);
+
+  std::vector<uint8_t> decompress(kBufSize);
+  ASSERT_EQ(0, ExtractToMemory(handle, &data, decompress.data(), decompress.size()));
+  EXPECT_EQ(0, memcmp(decompress.data(), buffer.data(), kBufSize))
+      << "Input buffer and output buffer are different.";
+
+  ASSERT_EQ(0, FindEntry(handle, ZipString("small.txt"), &data));
+  EXPECT_TRUE(AssertFileEntryContentsEq("helo", handle, &data));
+  ASSERT_EQ(0, FindEntry(handle, ZipString("empty.txt"), &data));
+  EXPECT_EQ(0u, data.uncompressed_length);
+
+  CloseArchive(handle);
+}
+
 TEST_F(zipwriter, CheckStartEntryErrors) {
   ZipWriter writer(file_);
 
@@ -378,6 +428,57 @@ TEST_F(zipwriter, TruncateFileAfterBackup) {
   ASSERT_GT(before_len, after_len);
 }
 
+TEST_F(zipwriter, AppendOnly) {
+  ZipWriter writer(file_);
+  ASSERT_EQ(0, writer.SetAppendOnly());
+
+  // What was on disk after each entry is where the file starts when it's done.
+  std::vector<std::string> snapshots;
+  auto snapshot = [&]() {
+    std::string contents;
+    ASSERT_TRUE(android::base::ReadFileToString(temp_file_->path, &contents));
+    snapshots.push_back(contents);
+  };
+
+  ASSERT_EQ(0, writer.StartEntry("stored.txt", 0));
+  ASSERT_EQ(0, writer.WriteBytes("stored", 6));
+  ASSERT_EQ(0, writer.FinishEntry());
+  snapshot();
+
+  ASSERT_EQ(0, writer.StartEntry("deflated.txt", ZipWriter::kCompress));
+  ASSERT_EQ(0, writer.WriteBytes("deflated", 8));
+  ASSERT_EQ(0, writer.FinishEntry());
+  snapshot();
+
+  EXPECT_GT(0, writer.SetAppendOnly());
+  EXPECT_GT(0, writer.DiscardLastEntry());
+  ASSERT_EQ(0, writer.Finish());
+
+  std::string contents;
+  ASSERT_TRUE(android::base::ReadFileToString(temp_file_->path, &contents));
+  ASSERT_LT(snapshots[0].size(), snapshots[1].size());
+  for (const std::string& prefix : snapshots) {
+    ASSERT_EQ(prefix, contents.substr(0, prefix.size()));
+  }
+
+  ASSERT_GE(0, lseek(fd_, 0, SEEK_SET));
+
+  ZipArchiveHandle handle;
+  ASSERT_EQ(0, OpenArchiveFd(fd_, "temp", &handle, false));
+
+  ZipEntry data;
+  ASSERT_EQ(0, FindEntry(handle, ZipString("stored.txt"), &data));
+  EXPECT_EQ(kCompressStored, data.method);
+  EXPECT_EQ(1u, data.has_data_descriptor);
+  ASSERT_TRUE(AssertFileEntryContentsEq("stored", handle, &data));
+
+  ASSERT_EQ(0, FindEntry(handle, ZipString("deflated.txt"), &data));
+  EXPECT_EQ(kCompressDeflated, data.method);
+  ASSERT_TRUE(AssertFileEntryContentsEq("deflated", handle, &data));
+
+  CloseArchive(handle);
+}
+
 static ::testing::AssertionResult AssertFileEntryContentsEq(const std::string& expected,
                                                             ZipArchiveHandle handle,
                                                             ZipEntry* zip_entry) {
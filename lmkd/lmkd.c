@@ -18,6 +18,7 @@
 
 #include <arpa/inet.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <inttypes.h>
 #include <sched.h>
 #include <signal.h>
@@ -47,6 +48,7 @@
 #define MEMPRESSURE_WATCH_MEDIUM_LEVEL "medium"
 #define MEMPRESSURE_WATCH_CRITICAL_LEVEL "critical"
 #define ZONEINFO_PATH "/proc/zoneinfo"
+#define PSI_MEMORY_PATH "/proc/pressure/memory"
 #define LINE_MAX 128
 
 #define INKERNEL_MINFREE_PATH "/sys/module/lowmemorykiller/parameters/minfree"
@@ -59,14 +61,38 @@ enum lmk_cmd {
     LMK_TARGET,
     LMK_PROCPRIO,
     LMK_PROCREMOVE,
+    LMK_GETKILLSTATS,
+    LMK_PROCPRIO_BATCH,
 };
 
 #define MAX_TARGETS 6
 /*
- * longest is LMK_TARGET followed by MAX_TARGETS each minfree and minkillprio
- * values
+ * LMK_PROCPRIO_BATCH is followed by the number of updates, then a pid, uid and
+ * oomadj for each of them.  An update is dropped when a later one in the same
+ * batch is for the same pid.
  */
-#define CTRL_PACKET_MAX (sizeof(int) * (MAX_TARGETS * 2 + 1))
+#define MAX_PROCPRIO_BATCH 64
+/*
+ * longest is LMK_PROCPRIO_BATCH followed by the count and MAX_PROCPRIO_BATCH
+ * updates
+ */
+#define CTRL_PACKET_MAX (sizeof(int) * (MAX_PROCPRIO_BATCH * 3 + 2))
+
+/* Control commands and priority updates handled, logged every CTRL_STATS_MS */
+#define CTRL_STATS_MS 10000
+static uint32_t ctrl_cmd_count;
+static uint32_t procprio_count;
+static uint32_t procprio_coalesced_count;
+static int64_t ctrl_stats_start_ms;
+
+/*
+ * Kill latency, from the memory pressure event to kill() returning, is counted
+ * in power of two millisecond buckets: bucket i counts kills that took less
+ * than 2^i ms, and the last one also every slower kill.  LMK_GETKILLSTATS is
+ * answered with LMK_GETKILLSTATS followed by the count in each bucket.
+ */
+#define KILL_LATENCY_BUCKETS 10
+static uint32_t kill_latency_hist[KILL_LATENCY_BUCKETS];
 
 /* default to old in-kernel interface if no memory pressure events */
 static int use_inkernel_interface = 1;
@@ -84,13 +110,32 @@ static bool enable_pressure_upgrade;
 static int64_t upgrade_pressure;
 static int64_t downgrade_pressure;
 static bool is_go_device;
+static bool use_psi_monitors;
+static int psi_partial_stall_ms;
+static int psi_complete_stall_ms;
+static int psi_window_ms;
+static bool kill_heaviest_task;
+static int size_refresh_ms;
+static bool wait_for_kill;
+static int kill_timeout_ms;
+
+/*
+ * With wait_for_kill, the last victim is tracked until its memory is released or
+ * kill_timeout_ms passes, during which no other process is killed.
+ */
+static int pending_kill_pid = -1;
+static int64_t pending_kill_ms;
+#define PENDING_KILL_POLL_MS 5
 
 /* control socket listen and data */
 static int ctrl_lfd;
 static int ctrl_dfd = -1;
 static int ctrl_dfd_reopened; /* did we reopen ctrl conn on this loop? */
 
-/* 2 memory pressure levels, 1 ctrl listen socket, 1 ctrl data socket */
+/*
+ * 2 memory pressure levels (vmpressure or PSI), 1 ctrl listen socket, 1 ctrl
+ * data socket
+ */
 #define MAX_EPOLL_EVENTS 4
 static int epollfd;
 static int maxevents;
@@ -120,6 +165,8 @@ struct proc {
     int pid;
     uid_t uid;
     int oomadj;
+    int req_oomadj; /* as last requested, before any adjustment below */
+    int size; /* resident pages when last refreshed, 0 if unknown */
     struct proc *pidhash_next;
 };
 
@@ -133,6 +180,15 @@ static struct adjslot_list procadjslot_list[ADJTOSLOT(OOM_SCORE_ADJ_MAX) + 1];
 /* PAGE_SIZE / 1024 */
 static long page_k;
 
+/*
+ * A file that is read again and again, such as /proc/zoneinfo or memcg
+ * usage, kept open between reads so each one is only a pread(2).
+ */
+struct reread_data {
+    const char* const path;
+    int fd;
+};
+
 static ssize_t read_all(int fd, char *buf, size_t max_len)
 {
     ssize_t ret = 0;
@@ -153,6 +209,43 @@ static ssize_t read_all(int fd, char *buf, size_t max_len)
     return ret;
 }
 
+/*
+ * Reads all of data->path into buf, NUL terminated, opening it on first use.
+ * Returns the number of bytes read, or -1 on error, after which the file is
+ * opened again on the next call.
+ */
+static ssize_t reread_file(struct reread_data *data, char *buf, size_t buf_size)
+{
+    ssize_t size;
+    ssize_t r;
+
+    if (data->fd == -1) {
+        data->fd = open(data->path, O_RDONLY | O_CLOEXEC);
+        if (data->fd == -1) {
+            ALOGE("%s open: errno=%d", data->path, errno);
+            return -1;
+        }
+    }
+
+    size = 0;
+    while ((size_t)size < buf_size - 1) {
+        r = TEMP_FAILURE_RETRY(pread(data->fd, buf + size, buf_size - 1 - size, size));
+        if (r == 0) {
+            break;
+        }
+        if (r == -1) {
+            ALOGE("%s read: errno=%d", data->path, errno);
+            close(data->fd);
+            data->fd = -1;
+            return -1;
+        }
+        size += r;
+    }
+    buf[size] = 0;
+
+    return size;
+}
+
 static struct proc *pid_lookup(int pid) {
     struct proc *procp;
 
@@ -226,6 +319,13 @@ static int pid_remove(int pid) {
     return 0;
 }
 
+static int64_t get_time_ms(void) {
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (int64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
 static void writefilestring(char *path, char *s) {
     int fd = open(path, O_WRONLY | O_CLOEXEC);
     int len = strlen(s);
@@ -246,17 +346,72 @@ static void writefilestring(char *path, char *s) {
     close(fd);
 }
 
+static int proc_get_size(int pid) {
+    char path[PATH_MAX];
+    char line[LINE_MAX];
+    int fd;
+    int rss = 0;
+    int total;
+    ssize_t ret;
+
+    snprintf(path, PATH_MAX, "/proc/%d/statm", pid);
+    fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+        return -1;
+
+    ret = read_all(fd, line, sizeof(line) - 1);
+    if (ret < 0) {
+        close(fd);
+        return -1;
+    }
+
+    sscanf(line, "%d %d ", &total, &rss);
+    close(fd);
+    return rss;
+}
+
+/*
+ * Sizes are cached so that picking and killing a process under memory
+ * pressure needs no /proc reads but the victim's name.  They are refreshed
+ * whenever ActivityManager sets a priority and every size_refresh_ms.
+ */
+static void proc_refresh_size(struct proc *procp) {
+    int size = proc_get_size(procp->pid);
+
+    procp->size = size > 0 ? size : 0;
+}
+
+static void refresh_proc_sizes(void) {
+    int i;
+    struct proc *procp;
+
+    for (i = 0; i < PIDHASH_SZ; i++) {
+        for (procp = pidhash[i]; procp; procp = procp->pidhash_next)
+            proc_refresh_size(procp);
+    }
+}
+
 static void cmd_procprio(int pid, int uid, int oomadj) {
     struct proc *procp;
     char path[80];
     char val[20];
     int soft_limit_mult;
+    int req_oomadj = oomadj;
 
     if (oomadj < OOM_SCORE_ADJ_MIN || oomadj > OOM_SCORE_ADJ_MAX) {
         ALOGE("Invalid PROCPRIO oomadj argument %d", oomadj);
         return;
     }
 
+    procprio_count++;
+    if (!use_inkernel_interface) {
+        procp = pid_lookup(pid);
+        if (procp && procp->uid == (uid_t)uid && procp->req_oomadj == oomadj) {
+            procprio_coalesced_count++;
+            return;
+        }
+    }
+
     snprintf(path, sizeof(path), "/proc/%d/oom_score_adj", pid);
     snprintf(val, sizeof(val), "%d", oomadj);
     writefilestring(path, val);
@@ -307,14 +462,38 @@ static void cmd_procprio(int pid, int uid, int oomadj) {
             procp->pid = pid;
             procp->uid = uid;
             procp->oomadj = oomadj;
+            procp->req_oomadj = req_oomadj;
+            proc_refresh_size(procp);
             proc_insert(procp);
     } else {
         proc_unslot(procp);
+        procp->uid = uid;
         procp->oomadj = oomadj;
+        procp->req_oomadj = req_oomadj;
+        proc_refresh_size(procp);
         proc_slot(procp);
     }
 }
 
+static void cmd_procprio_batch(int count, int *params) {
+    int i, j;
+
+    /* Walk the batch backwards so the last update for each pid wins */
+    for (i = count - 1; i >= 0; i--) {
+        int pid = ntohl(params[i * 3]);
+
+        for (j = i + 1; j < count && (int)ntohl(params[j * 3]) != pid; j++)
+                ;
+        if (j < count) {
+            procprio_count++;
+            procprio_coalesced_count++;
+            continue;
+        }
+
+        cmd_procprio(pid, ntohl(params[i * 3 + 1]), ntohl(params[i * 3 + 2]));
+    }
+}
+
 static void cmd_procremove(int pid) {
     if (use_inkernel_interface)
         return;
@@ -361,6 +540,23 @@ static void cmd_target(int ntargets, int *params) {
     }
 }
 
+static void cmd_getkillstats(void) {
+    int obuf[KILL_LATENCY_BUCKETS + 1];
+    int i;
+    ssize_t ret;
+
+    obuf[0] = htonl(LMK_GETKILLSTATS);
+    for (i = 0; i < KILL_LATENCY_BUCKETS; i++)
+        obuf[i + 1] = htonl(kill_latency_hist[i]);
+
+    ret = TEMP_FAILURE_RETRY(write(ctrl_dfd, obuf, sizeof(obuf)));
+    if (ret == -1) {
+        ALOGE("control data socket write failed; errno=%d", errno);
+    } else if (ret != (ssize_t)sizeof(obuf)) {
+        ALOGE("Short write on control data socket; length=%zd", ret);
+    }
+}
+
 static void ctrl_data_close(void) {
     ALOGI("Closing Activity Manager data connection");
     close(ctrl_dfd);
@@ -383,12 +579,33 @@ static int ctrl_data_read(char *buf, size_t bufsz) {
     return ret;
 }
 
+static void log_ctrl_stats(void) {
+    int64_t now_ms = get_time_ms();
+    int64_t elapsed_ms = now_ms - ctrl_stats_start_ms;
+
+    if (elapsed_ms < CTRL_STATS_MS)
+        return;
+
+    if (debug_process_killing) {
+        ALOGI("%" PRId64 " commands/s, %" PRId64 " priority updates/s, %u%% of them coalesced",
+              (int64_t)ctrl_cmd_count * 1000 / elapsed_ms,
+              (int64_t)procprio_count * 1000 / elapsed_ms,
+              procprio_count ? procprio_coalesced_count * 100 / procprio_count : 0);
+    }
+
+    ctrl_cmd_count = 0;
+    procprio_count = 0;
+    procprio_coalesced_count = 0;
+    ctrl_stats_start_ms = now_ms;
+}
+
 static void ctrl_command_handler(void) {
     int ibuf[CTRL_PACKET_MAX / sizeof(int)];
     int len;
     int cmd = -1;
     int nargs;
     int targets;
+    int count;
 
     len = ctrl_data_read((char *)ibuf, CTRL_PACKET_MAX);
     if (len <= 0)
@@ -399,6 +616,7 @@ static void ctrl_command_handler(void) {
         goto wronglen;
 
     cmd = ntohl(ibuf[0]);
+    ctrl_cmd_count++;
 
     switch(cmd) {
     case LMK_TARGET:
@@ -417,11 +635,25 @@ static void ctrl_command_handler(void) {
             goto wronglen;
         cmd_procremove(ntohl(ibuf[1]));
         break;
+    case LMK_GETKILLSTATS:
+        if (nargs != 0)
+            goto wronglen;
+        cmd_getkillstats();
+        break;
+    case LMK_PROCPRIO_BATCH:
+        if (nargs < 1)
+            goto wronglen;
+        count = ntohl(ibuf[1]);
+        if (count < 0 || count > MAX_PROCPRIO_BATCH || nargs != count * 3 + 1)
+            goto wronglen;
+        cmd_procprio_batch(count, &ibuf[2]);
+        break;
     default:
         ALOGE("Received unknown command code %d", cmd);
         return;
     }
 
+    log_ctrl_stats();
     return;
 
 wronglen:
@@ -479,32 +711,41 @@ static int zoneinfo_parse_protection(char *cp) {
 }
 
 static void zoneinfo_parse_line(char *line, struct sysmeminfo *mip) {
-    char *cp = line;
+    char *cp;
     char *ap;
-    char *save_ptr;
 
-    cp = strtok_r(line, " ", &save_ptr);
-    if (!cp)
-        return;
-
-    ap = strtok_r(NULL, " ", &save_ptr);
+    /* Only the counters below are needed, skip the leading spaces and the rest quickly */
+    cp = line + strspn(line, " ");
+    ap = strchr(cp, ' ');
     if (!ap)
         return;
-
-    if (!strcmp(cp, "nr_free_pages"))
-        mip->nr_free_pages += strtol(ap, NULL, 0);
-    else if (!strcmp(cp, "nr_file_pages"))
-        mip->nr_file_pages += strtol(ap, NULL, 0);
-    else if (!strcmp(cp, "nr_shmem"))
-        mip->nr_shmem += strtol(ap, NULL, 0);
-    else if (!strcmp(cp, "high"))
-        mip->totalreserve_pages += strtol(ap, NULL, 0);
-    else if (!strcmp(cp, "protection:"))
-        mip->totalreserve_pages += zoneinfo_parse_protection(ap);
+    *ap++ = '\0';
+
+    switch (*cp) {
+    case 'n':
+        if (!strcmp(cp, "nr_free_pages"))
+            mip->nr_free_pages += strtol(ap, NULL, 0);
+        else if (!strcmp(cp, "nr_file_pages"))
+            mip->nr_file_pages += strtol(ap, NULL, 0);
+        else if (!strcmp(cp, "nr_shmem"))
+            mip->nr_shmem += strtol(ap, NULL, 0);
+        break;
+    case 'h':
+        if (!strcmp(cp, "high"))
+            mip->totalreserve_pages += strtol(ap, NULL, 0);
+        break;
+    case 'p':
+        if (!strcmp(cp, "protection:"))
+            mip->totalreserve_pages += zoneinfo_parse_protection(ap);
+        break;
+    }
 }
 
 static int zoneinfo_parse(struct sysmeminfo *mip) {
-    int fd;
+    static struct reread_data file_data = {
+        .path = ZONEINFO_PATH,
+        .fd = -1,
+    };
     ssize_t size;
     char buf[PAGE_SIZE];
     char *save_ptr;
@@ -512,52 +753,18 @@ static int zoneinfo_parse(struct sysmeminfo *mip) {
 
     memset(mip, 0, sizeof(struct sysmeminfo));
 
-    fd = open(ZONEINFO_PATH, O_RDONLY | O_CLOEXEC);
-    if (fd == -1) {
-        ALOGE("%s open: errno=%d", ZONEINFO_PATH, errno);
-        return -1;
-    }
-
-    size = read_all(fd, buf, sizeof(buf) - 1);
+    size = reread_file(&file_data, buf, sizeof(buf));
     if (size < 0) {
-        ALOGE("%s read: errno=%d", ZONEINFO_PATH, errno);
-        close(fd);
         return -1;
     }
     ALOG_ASSERT((size_t)size < sizeof(buf) - 1, "/proc/zoneinfo too large");
-    buf[size] = 0;
 
     for (line = strtok_r(buf, "\n", &save_ptr); line; line = strtok_r(NULL, "\n", &save_ptr))
             zoneinfo_parse_line(line, mip);
 
-    close(fd);
     return 0;
 }
 
-static int proc_get_size(int pid) {
-    char path[PATH_MAX];
-    char line[LINE_MAX];
-    int fd;
-    int rss = 0;
-    int total;
-    ssize_t ret;
-
-    snprintf(path, PATH_MAX, "/proc/%d/statm", pid);
-    fd = open(path, O_RDONLY | O_CLOEXEC);
-    if (fd == -1)
-        return -1;
-
-    ret = read_all(fd, line, sizeof(line) - 1);
-    if (ret < 0) {
-        close(fd);
-        return -1;
-    }
-
-    sscanf(line, "%d %d ", &total, &rss);
-    close(fd);
-    return rss;
-}
-
 static char *proc_get_name(int pid) {
     char path[PATH_MAX];
     static char line[LINE_MAX];
@@ -586,8 +793,43 @@ static struct proc *proc_adj_lru(int oomadj) {
     return (struct proc *)adjslot_tail(&procadjslot_list[ADJTOSLOT(oomadj)]);
 }
 
+/* The process in the oomadj slot with the largest cached size */
+static struct proc *proc_get_heaviest(int oomadj) {
+    struct adjslot_list *head = &procadjslot_list[ADJTOSLOT(oomadj)];
+    struct adjslot_list *curr;
+    struct proc *maxprocp = NULL;
+
+    for (curr = head->next; curr != head; curr = curr->next) {
+        struct proc *procp = (struct proc *)curr;
+
+        if (!maxprocp || procp->size > maxprocp->size)
+            maxprocp = procp;
+    }
+
+    return maxprocp;
+}
+
+static void record_kill_latency(const struct timespec *event_time) {
+    struct timespec now;
+    int64_t elapsed_ms;
+    int i;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    elapsed_ms = (now.tv_sec - event_time->tv_sec) * 1000 +
+            (now.tv_nsec - event_time->tv_nsec) / 1000000;
+
+    for (i = 0; i < KILL_LATENCY_BUCKETS - 1 && elapsed_ms >= (1 << i); i++)
+            ;
+    kill_latency_hist[i]++;
+
+    if (debug_process_killing) {
+        ALOGI("Kill took %" PRId64 "ms after the memory pressure event", elapsed_ms);
+    }
+}
+
 /* Kill one process specified by procp.  Returns the size of the process killed */
-static int kill_one_process(struct proc* procp, int min_score_adj, bool is_critical) {
+static int kill_one_process(struct proc* procp, int min_score_adj, bool is_critical,
+                            const struct timespec *event_time) {
     int pid = procp->pid;
     uid_t uid = procp->uid;
     char *taskname;
@@ -600,7 +842,11 @@ static int kill_one_process(struct proc* procp, int min_score_adj, bool is_criti
         return -1;
     }
 
-    tasksize = proc_get_size(pid);
+    /* Only fall back to reading the size if it was never refreshed */
+    tasksize = procp->size;
+    if (tasksize <= 0) {
+        tasksize = proc_get_size(pid);
+    }
     if (tasksize <= 0) {
         pid_remove(pid);
         return -1;
@@ -615,9 +861,14 @@ static int kill_one_process(struct proc* procp, int min_score_adj, bool is_criti
     pid_remove(pid);
 
     if (r) {
-        ALOGE("kill(%d): errno=%d", procp->pid, errno);
+        ALOGE("kill(%d): errno=%d", pid, errno);
         return -1;
     } else {
+        record_kill_latency(event_time);
+        if (wait_for_kill) {
+            pending_kill_pid = pid;
+            pending_kill_ms = get_time_ms();
+        }
         return tasksize;
     }
 }
@@ -626,7 +877,7 @@ static int kill_one_process(struct proc* procp, int min_score_adj, bool is_criti
  * Find a process to kill based on the current (possibly estimated) free memory
  * and cached memory sizes.  Returns the size of the killed processes.
  */
-static int find_and_kill_process(bool is_critical) {
+static int find_and_kill_process(bool is_critical, const struct timespec *event_time) {
     int i;
     int killed_size = 0;
     int min_score_adj = is_critical ? critical_oomadj : medium_oomadj;
@@ -635,10 +886,10 @@ static int find_and_kill_process(bool is_critical) {
         struct proc *procp;
 
 retry:
-        procp = proc_adj_lru(i);
+        procp = kill_heaviest_task ? proc_get_heaviest(i) : proc_adj_lru(i);
 
         if (procp) {
-            killed_size = kill_one_process(procp, min_score_adj, is_critical);
+            killed_size = kill_one_process(procp, min_score_adj, is_critical, event_time);
             if (killed_size < 0) {
                 goto retry;
             } else {
@@ -650,23 +901,41 @@ retry:
     return 0;
 }
 
-static int64_t get_memory_usage(const char* path) {
+/*
+ * Whether the last victim still holds its memory.  A killed process drops
+ * its mm before it becomes a zombie, whose statm reads as all zeroes.
+ */
+static bool is_kill_pending(void) {
+    int64_t elapsed_ms;
+
+    if (pending_kill_pid < 0)
+        return false;
+
+    elapsed_ms = get_time_ms() - pending_kill_ms;
+    if (proc_get_size(pending_kill_pid) <= 0) {
+        ALOGI("Process %d released its memory %" PRId64 "ms after the kill", pending_kill_pid,
+              elapsed_ms);
+    } else if (elapsed_ms >= kill_timeout_ms) {
+        ALOGI("Process %d still holds its memory %" PRId64 "ms after the kill", pending_kill_pid,
+              elapsed_ms);
+    } else {
+        return true;
+    }
+
+    pending_kill_pid = -1;
+    return false;
+}
+
+static int64_t get_memory_usage(struct reread_data *file_data) {
     int ret;
     int64_t mem_usage;
     char buf[32];
-    int fd = open(path, O_RDONLY | O_CLOEXEC);
-    if (fd == -1) {
-        ALOGE("%s open: errno=%d", path, errno);
-        return -1;
-    }
 
-    ret = read_all(fd, buf, sizeof(buf) - 1);
-    close(fd);
+    ret = reread_file(file_data, buf, sizeof(buf));
     if (ret < 0) {
-        ALOGE("%s error: errno=%d", path, errno);
         return -1;
     }
-    sscanf(buf, "%" SCNd64, &mem_usage);
+    mem_usage = strtoll(buf, NULL, 10);
     if (mem_usage == 0) {
         ALOGE("No memory!");
         return -1;
@@ -675,21 +944,32 @@ static int64_t get_memory_usage(const char* path) {
 }
 
 static void mp_event_common(bool is_critical) {
-    int ret;
-    unsigned long long evcount;
-    int index = is_critical ? CRITICAL_INDEX : MEDIUM_INDEX;
+    static struct reread_data mem_usage_file_data = {
+        .path = MEMCG_MEMORY_USAGE,
+        .fd = -1,
+    };
+    static struct reread_data memsw_usage_file_data = {
+        .path = MEMCG_MEMORYSW_USAGE,
+        .fd = -1,
+    };
     int64_t mem_usage, memsw_usage;
     int64_t mem_pressure;
+    struct timespec event_time;
 
-    ret = read(mpevfd[index], &evcount, sizeof(evcount));
-    if (ret < 0)
-        ALOGE("Error reading memory pressure event fd; errno=%d",
-              errno);
+    clock_gettime(CLOCK_MONOTONIC, &event_time);
 
-    mem_usage = get_memory_usage(MEMCG_MEMORY_USAGE);
-    memsw_usage = get_memory_usage(MEMCG_MEMORYSW_USAGE);
+    if (is_kill_pending()) {
+        if (debug_process_killing) {
+            ALOGI("Ignore %s memory pressure while process %d is dying",
+                  is_critical ? "critical" : "medium", pending_kill_pid);
+        }
+        return;
+    }
+
+    mem_usage = get_memory_usage(&mem_usage_file_data);
+    memsw_usage = get_memory_usage(&memsw_usage_file_data);
     if (memsw_usage < 0 || mem_usage < 0) {
-        find_and_kill_process(is_critical);
+        find_and_kill_process(is_critical, &event_time);
         return;
     }
 
@@ -719,21 +999,117 @@ static void mp_event_common(bool is_critical) {
         is_critical = false;
     }
 
-    if (find_and_kill_process(is_critical) == 0) {
+    if (find_and_kill_process(is_critical, &event_time) == 0) {
         if (debug_process_killing) {
             ALOGI("Nothing to kill");
         }
     }
 }
 
+static void mp_event_read(bool is_critical) {
+    int ret;
+    unsigned long long evcount;
+    int index = is_critical ? CRITICAL_INDEX : MEDIUM_INDEX;
+
+    ret = read(mpevfd[index], &evcount, sizeof(evcount));
+    if (ret < 0)
+        ALOGE("Error reading memory pressure event fd; errno=%d",
+              errno);
+}
+
 static void mp_event(uint32_t events __unused) {
+    mp_event_read(false);
     mp_event_common(false);
 }
 
 static void mp_event_critical(uint32_t events __unused) {
+    mp_event_read(true);
     mp_event_common(true);
 }
 
+/*
+ * PSI triggers fire at most once per window, and only need to be polled
+ * again: there is nothing to read.
+ */
+static void psi_event(uint32_t events) {
+    if (events & EPOLLPRI)
+        mp_event_common(false);
+}
+
+static void psi_event_critical(uint32_t events) {
+    if (events & EPOLLPRI)
+        mp_event_common(true);
+}
+
+/*
+ * Registers a PSI trigger for when tasks are stalled on memory for stall_ms
+ * within every window_ms: "some" tasks for medium pressure, or "full" when
+ * all non-idle tasks stall at once for critical pressure.  Unlike the
+ * vmpressure levels, which are derived from the reclaim efficiency of each
+ * scan, these measure the time lost to memory shortage directly.
+ */
+static int init_psi_monitor(const char *stall_type, int stall_ms, int window_ms,
+                            void *event_handler, bool is_critical)
+{
+    int fd;
+    char buf[64];
+    struct epoll_event epev;
+    int ret;
+    int mpevfd_index = is_critical ? CRITICAL_INDEX : MEDIUM_INDEX;
+
+    fd = open(PSI_MEMORY_PATH, O_WRONLY | O_NONBLOCK | O_CLOEXEC);
+    if (fd < 0) {
+        ALOGI("No kernel PSI support (errno=%d)", errno);
+        return -1;
+    }
+
+    ret = snprintf(buf, sizeof(buf), "%s %d %d", stall_type, stall_ms * 1000, window_ms * 1000);
+    if (ret >= (ssize_t)sizeof(buf)) {
+        ALOGE("PSI trigger line overflow for %s stall", stall_type);
+        goto err;
+    }
+
+    ret = write(fd, buf, strlen(buf) + 1);
+    if (ret == -1) {
+        ALOGE("%s write failed for %s stall %dms in %dms; errno=%d",
+              PSI_MEMORY_PATH, stall_type, stall_ms, window_ms, errno);
+        goto err;
+    }
+
+    epev.events = EPOLLPRI;
+    epev.data.ptr = event_handler;
+    ret = epoll_ctl(epollfd, EPOLL_CTL_ADD, fd, &epev);
+    if (ret == -1) {
+        ALOGE("epoll_ctl for PSI %s stall failed; errno=%d", stall_type, errno);
+        goto err;
+    }
+    maxevents++;
+    mpevfd[mpevfd_index] = fd;
+    return 0;
+
+err:
+    close(fd);
+    return -1;
+}
+
+static int init_psi_monitors()
+{
+    if (init_psi_monitor("some", psi_partial_stall_ms, psi_window_ms, (void *)&psi_event,
+                         false)) {
+        return -1;
+    }
+    if (init_psi_monitor("full", psi_complete_stall_ms, psi_window_ms,
+                         (void *)&psi_event_critical, true)) {
+        epoll_ctl(epollfd, EPOLL_CTL_DEL, mpevfd[MEDIUM_INDEX], NULL);
+        close(mpevfd[MEDIUM_INDEX]);
+        maxevents--;
+        return -1;
+    }
+    ALOGI("Using PSI monitors: %dms some / %dms full stall in %dms", psi_partial_stall_ms,
+          psi_complete_stall_ms, psi_window_ms);
+    return 0;
+}
+
 static int init_mp_common(char *levelstr, void *event_handler, bool is_critical)
 {
     int mpfd;
@@ -847,7 +1223,7 @@ static int init(void) {
 
     if (use_inkernel_interface) {
         ALOGI("Using in-kernel low memory killer interface");
-    } else {
+    } else if (!use_psi_monitors || init_psi_monitors()) {
         ret = init_mp_medium();
         ret |= init_mp_critical();
         if (ret)
@@ -863,13 +1239,33 @@ static int init(void) {
 }
 
 static void mainloop(void) {
+    int64_t next_refresh_ms = get_time_ms() + size_refresh_ms;
+
+    ctrl_stats_start_ms = get_time_ms();
+
     while (1) {
         struct epoll_event events[maxevents];
         int nevents;
+        int timeout = -1;
         int i;
 
+        /* Process sizes are only cached when lmkd tracks the processes itself */
+        if (!use_inkernel_interface && size_refresh_ms > 0) {
+            int64_t now_ms = get_time_ms();
+
+            if (now_ms >= next_refresh_ms) {
+                refresh_proc_sizes();
+                next_refresh_ms = now_ms + size_refresh_ms;
+            }
+            timeout = next_refresh_ms - now_ms;
+        }
+
+        /* Poll for the release of the last victim's memory to report it promptly */
+        if (is_kill_pending() && (timeout < 0 || timeout > PENDING_KILL_POLL_MS))
+            timeout = PENDING_KILL_POLL_MS;
+
         ctrl_dfd_reopened = 0;
-        nevents = epoll_wait(epollfd, events, maxevents, -1);
+        nevents = epoll_wait(epollfd, events, maxevents, timeout);
 
         if (nevents == -1) {
             if (errno == EINTR)
@@ -899,6 +1295,14 @@ int main(int argc __unused, char **argv __unused) {
     upgrade_pressure = (int64_t)property_get_int32("ro.lmk.upgrade_pressure", 50);
     downgrade_pressure = (int64_t)property_get_int32("ro.lmk.downgrade_pressure", 60);
     is_go_device = property_get_bool("ro.config.low_ram", false);
+    use_psi_monitors = property_get_bool("ro.lmk.use_psi", false);
+    psi_partial_stall_ms = property_get_int32("ro.lmk.psi_partial_stall_ms", 70);
+    psi_complete_stall_ms = property_get_int32("ro.lmk.psi_complete_stall_ms", 700);
+    psi_window_ms = property_get_int32("ro.lmk.psi_window_ms", 1000);
+    kill_heaviest_task = property_get_bool("ro.lmk.kill_heaviest_task", false);
+    size_refresh_ms = property_get_int32("ro.lmk.size_refresh_ms", 10000);
+    wait_for_kill = property_get_bool("ro.lmk.wait_for_kill", false);
+    kill_timeout_ms = property_get_int32("ro.lmk.kill_timeout_ms", 100);
 
     mlockall(MCL_FUTURE);
     sched_setscheduler(0, SCHED_FIFO, &param);
@@ -2,7 +2,7 @@
 
 LOCAL_PATH := $(call my-dir)
 
-logcatLibs := liblog libbase libcutils libpcrecpp
+logcatLibs := liblog libbase libcutils libpcrecpp libz
 
 include $(CLEAR_VARS)
 
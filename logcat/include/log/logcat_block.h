@@ -0,0 +1,54 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _LIBS_LOGCAT_BLOCK_H /* header boilerplate */
+#define _LIBS_LOGCAT_BLOCK_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * On disk layout of logcat --compress output.
+ *
+ * The file is a sequence of blocks, each a logcat_block_header_t followed by
+ * compressed_len bytes of zlib (RFC 1950) data that inflate to len bytes of
+ * exactly what logcat would have written without --compress, text or -B
+ * binary.  The header carries the time range of the entries in the block, so
+ * walking the headers is a time index: a reader can find a time range, or
+ * the last entry written, without inflating anything but the blocks needed.
+ * Integers are in host (little endian) order.
+ */
+#define LOGCAT_BLOCK_MAGIC 0x015A474CU /* "LGZ\1" */
+
+typedef struct __attribute__((__packed__)) {
+  uint32_t magic;          /* LOGCAT_BLOCK_MAGIC */
+  uint32_t compressed_len; /* bytes following this header */
+  uint32_t len;            /* bytes once inflated */
+  uint32_t count;          /* entries in the block */
+  uint32_t first_sec;      /* time of the first entry */
+  uint32_t first_nsec;
+  uint32_t last_sec; /* time of the last entry */
+  uint32_t last_nsec;
+} logcat_block_header_t;
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _LIBS_LOGCAT_BLOCK_H */
@@ -20,6 +20,7 @@
 #include <dirent.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <inttypes.h>
 #include <math.h>
 #include <pthread.h>
 #include <sched.h>
@@ -35,27 +36,42 @@
 #include <time.h>
 #include <unistd.h>
 
+#include <algorithm>
 #include <atomic>
+#include <condition_variable>
+#include <deque>
 #include <memory>
+#include <mutex>
 #include <string>
+#include <thread>
 #include <vector>
 
 #include <android-base/file.h>
 #include <android-base/properties.h>
 #include <android-base/stringprintf.h>
 #include <android-base/strings.h>
+#include <android-base/thread_pool.h>
 #include <cutils/sched_policy.h>
 #include <cutils/sockets.h>
 #include <log/event_tag_map.h>
 #include <log/getopt.h>
 #include <log/logcat.h>
+#include <log/logcat_block.h>
 #include <log/logprint.h>
 #include <private/android_logger.h>
 #include <system/thread_defs.h>
 
 #include <pcrecpp.h>
+#include <zlib.h>
 
 #define DEFAULT_MAX_ROTATED_LOGS 4
+// Formatted lines are coalesced into one write, or one --compress block,
+// per this many bytes
+#define OUTPUT_BUFFER_SIZE (64 * 1024)
+// Longest a --compress block is held back, in seconds of log time
+#define COMPRESS_BLOCK_MAX_AGE_SECONDS 60
+// Entries of an --input dump handed to a formatting thread at a time
+#define INPUT_CHUNK_ENTRIES 256
 
 struct log_device_t {
     const char* device;
@@ -108,6 +124,22 @@ struct android_logcat_context_internal {
     // 0 means "unbounded"
     size_t maxRotatedLogs;
     size_t outByteCount;
+    bool fsyncRotated;  // --fsync, before a rotated out file is renamed .1
+    // Renaming the rotated files along, in the background of the next file
+    pthread_t rotateThread;
+    bool rotating;
+    // --debug rotation figures
+    uint64_t outputStart;  // ns CLOCK_MONOTONIC
+    uint64_t outTotalBytes;  // before the current file
+    size_t rotations;
+    uint64_t rotateStallNs;  // longest the read loop waited on a rotation
+    uint64_t rotateNs;       // longest a background rotation took
+    char* outBuffer;  // pending formatted lines, when dumping or compressing
+    size_t outBufferLen;
+    bool compress;  // zlib blocks, see log/logcat_block.h
+    size_t blockCount;
+    log_time blockFirst;
+    log_time blockLast;
     int printBinary;
     int devCount;  // >1 means multiple
     pcrecpp::RE* regex;
@@ -120,6 +152,8 @@ struct android_logcat_context_internal {
     bool printItAnyways;
     bool debug;
     bool hasOpenedEventTagMap;
+    bool monotonic;  // -v monotonic, converted through shared state
+    const char* inputFileName;  // --input, a -B dump read instead of logd
 };
 
 // Creates a context associated with this logcat instance
@@ -231,13 +265,31 @@ static void close_error(android_logcat_context_internal* context) {
     }
 }
 
-static void rotateLogs(android_logcat_context_internal* context) {
-    int err;
+static uint64_t nowNs() {
+    return log_time(CLOCK_MONOTONIC).nsec();
+}
 
-    // Can't rotate logs if we're not outputting to a file
-    if (!context->outputFileName) return;
+static std::string rotatingName(android_logcat_context_internal* context) {
+    return android::base::StringPrintf("%s.rotating", context->outputFileName);
+}
 
-    close_output(context);
+// Moves the files along from .1, then the rotated out file in as .1. Left to
+// a thread so the read loop is back to reading while the renames queue up
+// on the filesystem, which with a large -n is what would have logd decide
+// this reader is too slow and drop entries for it.
+static void* rotateThreadStart(void* obj) {
+    android_logcat_context_internal* context =
+        static_cast<android_logcat_context_internal*>(obj);
+    uint64_t start = nowNs();
+
+    std::string rotated = rotatingName(context);
+    if (context->fsyncRotated) {
+        int fd = open(rotated.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd >= 0) {
+            fsync(fd);
+            close(fd);
+        }
+    }
 
     // Compute the maximum number of digits needed to count up to
     // maxRotatedLogs in decimal.  eg:
@@ -245,9 +297,7 @@ static void rotateLogs(android_logcat_context_internal* context) {
     //   -> log10(30) == 1.477
     //   -> maxRotationCountDigits == 2
     int maxRotationCountDigits =
-        (context->maxRotatedLogs > 0)
-            ? (int)(floor(log10(context->maxRotatedLogs) + 1))
-            : 0;
+        (int)(floor(log10(context->maxRotatedLogs) + 1));
 
     for (int i = context->maxRotatedLogs; i > 0; i--) {
         std::string file1 = android::base::StringPrintf(
@@ -255,7 +305,7 @@ static void rotateLogs(android_logcat_context_internal* context) {
 
         std::string file0;
         if (!(i - 1)) {
-            file0 = android::base::StringPrintf("%s", context->outputFileName);
+            file0 = rotated;
         } else {
             file0 =
                 android::base::StringPrintf("%s.%.*d", context->outputFileName,
@@ -267,13 +317,44 @@ static void rotateLogs(android_logcat_context_internal* context) {
             break;
         }
 
-        err = rename(file0.c_str(), file1.c_str());
+        int err = rename(file0.c_str(), file1.c_str());
 
         if (err < 0 && errno != ENOENT) {
             perror("while rotating log files");
         }
     }
 
+    context->rotateNs = std::max(context->rotateNs, nowNs() - start);
+    return nullptr;
+}
+
+static void waitForRotation(android_logcat_context_internal* context) {
+    if (!context->rotating) return;
+    pthread_join(context->rotateThread, nullptr);
+    context->rotating = false;
+}
+
+static void rotateLogs(android_logcat_context_internal* context) {
+    // Can't rotate logs if we're not outputting to a file
+    if (!context->outputFileName) return;
+
+    uint64_t start = nowNs();
+    // The previous rotation has to be out of the way of this one
+    waitForRotation(context);
+
+    close_output(context);
+
+    // Out of the way of the next file in one rename, the rest is left to
+    // the background
+    bool renamed = false;
+    if (context->maxRotatedLogs > 0) {
+        renamed = rename(context->outputFileName,
+                         rotatingName(context).c_str()) == 0;
+        if (!renamed && (errno != ENOENT)) {
+            perror("while rotating log files");
+        }
+    }
+
     context->output_fd = openLogFile(context->outputFileName);
 
     if (context->output_fd < 0) {
@@ -291,13 +372,119 @@ static void rotateLogs(android_logcat_context_internal* context) {
         context->error_fd = context->output_fd;
     }
 
+    context->outTotalBytes += context->outByteCount;
     context->outByteCount = 0;
+    ++context->rotations;
+
+    if (renamed) {
+        context->rotating = !pthread_create(&context->rotateThread, nullptr,
+                                            rotateThreadStart, context);
+        if (!context->rotating) rotateThreadStart(context);
+    }
+    context->rotateStallNs =
+        std::max(context->rotateStallNs, nowNs() - start);
+}
+
+// --debug summary of the rotations, so their cost is known
+static void reportRotations(android_logcat_context_internal* context) {
+    if (!context->debug || !context->error || !context->rotations) return;
+
+    uint64_t bytes = context->outTotalBytes + context->outByteCount;
+    uint64_t elapsedMs = (nowNs() - context->outputStart) / 1000000;
+    fprintf(context->error,
+            "rotated %zu times writing %" PRIu64 " bytes at %" PRIu64
+            " bytes/s, longest wait %" PRIu64 "us, longest rotation %" PRIu64
+            "us\n",
+            context->rotations, bytes,
+            elapsedMs ? (bytes * 1000) / elapsedMs : 0,
+            context->rotateStallNs / 1000, context->rotateNs / 1000);
+}
+
+// Deflate one --compress block and write it with its index header
+static void writeBlock(android_logcat_context_internal* context,
+                       const char* buf, size_t len) {
+    uLongf compressedLen = compressBound(len);
+    std::unique_ptr<char[]> block(
+        new char[sizeof(logcat_block_header_t) + compressedLen]);
+    logcat_block_header_t* header =
+        reinterpret_cast<logcat_block_header_t*>(block.get());
+
+    if (compress2(reinterpret_cast<Bytef*>(block.get() + sizeof(*header)),
+                  &compressedLen, reinterpret_cast<const Bytef*>(buf), len,
+                  Z_DEFAULT_COMPRESSION) != Z_OK) {
+        logcat_panic(context, HELP_FALSE, "output compression error");
+        return;
+    }
+    header->magic = LOGCAT_BLOCK_MAGIC;
+    header->compressed_len = compressedLen;
+    header->len = len;
+    header->count = context->blockCount;
+    if (!context->blockCount) {  // only dividers
+        context->blockFirst = context->blockLast = log_time::EPOCH;
+    }
+    header->first_sec = context->blockFirst.tv_sec;
+    header->first_nsec = context->blockFirst.tv_nsec;
+    header->last_sec = context->blockLast.tv_sec;
+    header->last_nsec = context->blockLast.tv_nsec;
+    context->blockCount = 0;
+
+    size_t size = sizeof(*header) + compressedLen;
+    ssize_t ret =
+        TEMP_FAILURE_RETRY(write(context->output_fd, block.get(), size));
+    if ((ret < 0) || ((size_t)ret < size)) {
+        logcat_panic(context, HELP_FALSE, "output error");
+        return;
+    }
+    // Rotation is by what actually lands on flash
+    context->outByteCount += size;
+}
+
+static void flushOutput(android_logcat_context_internal* context) {
+    if (!context->outBufferLen) return;
+
+    size_t len = context->outBufferLen;
+    context->outBufferLen = 0;
+    if (context->compress) {
+        writeBlock(context, context->outBuffer, len);
+        return;
+    }
+
+    ssize_t ret =
+        TEMP_FAILURE_RETRY(write(context->output_fd, context->outBuffer, len));
+    if ((ret < 0) || ((size_t)ret < len)) {
+        logcat_panic(context, HELP_FALSE, "output error");
+    }
+}
+
+// Track the time range of the pending --compress block
+static void noteBlockEntry(android_logcat_context_internal* context,
+                           const log_time& realtime) {
+    if (!context->compress) return;
+
+    if (!context->blockCount++) context->blockFirst = realtime;
+    context->blockLast = realtime;
+    // Without -d a block could otherwise sit in memory indefinitely
+    if ((realtime.tv_sec - context->blockFirst.tv_sec) >=
+        COMPRESS_BLOCK_MAX_AGE_SECONDS) {
+        flushOutput(context);
+    }
 }
 
 void printBinary(android_logcat_context_internal* context, struct log_msg* buf) {
     size_t size = buf->len();
 
-    TEMP_FAILURE_RETRY(write(context->output_fd, buf, size));
+    if (!context->outBuffer) {
+        TEMP_FAILURE_RETRY(write(context->output_fd, buf, size));
+        return;
+    }
+
+    if ((OUTPUT_BUFFER_SIZE - context->outBufferLen) < size) {
+        flushOutput(context);
+        if (context->stop) return;
+    }
+    memcpy(context->outBuffer + context->outBufferLen, buf, size);
+    context->outBufferLen += size;
+    noteBlockEntry(context, log_time(buf->entry.sec, buf->entry.nsec));
 }
 
 static bool regexOk(android_logcat_context_internal* context,
@@ -309,67 +496,327 @@ static bool regexOk(android_logcat_context_internal* context,
     return context->regex->PartialMatch(messageString);
 }
 
-static void processBuffer(android_logcat_context_internal* context,
-                          log_device_t* dev, struct log_msg* buf) {
-    int bytesWritten = 0;
+// Append to outBuffer when dumping or compressing, otherwise a write per entry
+static int printLogLine(android_logcat_context_internal* context,
+                        const AndroidLogEntry& entry) {
+    if (!context->outBuffer) {
+        return android_log_printLogLine(context->logformat,
+                                        context->output_fd, &entry);
+    }
+
+    log_time realtime(entry.tv_sec, entry.tv_nsec);
+    for (int retry = 0; retry < 2; ++retry) {
+        size_t len;
+        if (android_log_formatLogLines(
+                context->logformat, context->outBuffer + context->outBufferLen,
+                OUTPUT_BUFFER_SIZE - context->outBufferLen, &entry, 1, &len)) {
+            context->outBufferLen += len;
+            noteBlockEntry(context, realtime);
+            return len;
+        }
+        flushOutput(context);
+        if (context->stop) return -1;
+    }
+
+    // Larger than the whole buffer
+    if (!context->compress) {
+        return android_log_printLogLine(context->logformat,
+                                        context->output_fd, &entry);
+    }
+    char defaultBuffer[512];
+    size_t len;
+    char* line = android_log_formatLogLine(context->logformat, defaultBuffer,
+                                           sizeof(defaultBuffer), &entry, &len);
+    if (!line) return -1;
+    context->blockCount = 0;
+    noteBlockEntry(context, realtime);
+    writeBlock(context, line, len);
+    if (line != defaultBuffer) free(line);
+    return context->stop ? -1 : (int)len;
+}
+
+// Decodes buf into entry, returns whether it passes the filterspecs and
+// --regex (or --print), setting match for the --max-count tally.
+static bool selectEntry(android_logcat_context_internal* context,
+                        AndroidLogFormat* format, log_device_t* dev,
+                        struct log_msg* buf, AndroidLogEntry* entry,
+                        char* binaryMsgBuf, size_t binaryMsgBufLen,
+                        bool* match) {
     int err;
-    AndroidLogEntry entry;
-    char binaryMsgBuf[1024];
 
+    *match = false;
     if (dev->binary) {
         if (!context->eventTagMap && !context->hasOpenedEventTagMap) {
             context->eventTagMap = android_openEventTagMap(nullptr);
             context->hasOpenedEventTagMap = true;
         }
         err = android_log_processBinaryLogBuffer(
-            &buf->entry_v1, &entry, context->eventTagMap, binaryMsgBuf,
-            sizeof(binaryMsgBuf));
+            &buf->entry_v1, entry, context->eventTagMap, binaryMsgBuf,
+            binaryMsgBufLen);
         // printf(">>> pri=%d len=%d msg='%s'\n",
-        //    entry.priority, entry.messageLen, entry.message);
+        //    entry->priority, entry->messageLen, entry->message);
     } else {
-        err = android_log_processLogBuffer(&buf->entry_v1, &entry);
+        err = android_log_processLogBuffer(&buf->entry_v1, entry);
     }
-    if ((err < 0) && !context->debug) return;
+    if ((err < 0) && !context->debug) return false;
 
-    if (android_log_shouldPrintLine(
-            context->logformat, std::string(entry.tag, entry.tagLen).c_str(),
-            entry.priority)) {
-        bool match = regexOk(context, entry);
+    if (!android_log_shouldPrintLine(
+            format, std::string(entry->tag, entry->tagLen).c_str(),
+            entry->priority)) {
+        return false;
+    }
+    *match = regexOk(context, *entry);
+    return *match || context->printItAnyways;
+}
 
-        context->printCount += match;
-        if (match || context->printItAnyways) {
-            bytesWritten = android_log_printLogLine(context->logformat,
-                                                    context->output_fd, &entry);
+static void processBuffer(android_logcat_context_internal* context,
+                          log_device_t* dev, struct log_msg* buf) {
+    int bytesWritten = 0;
+    AndroidLogEntry entry;
+    char binaryMsgBuf[1024];
+    bool match;
 
-            if (bytesWritten < 0) {
-                logcat_panic(context, HELP_FALSE, "output error");
-                return;
-            }
+    if (selectEntry(context, context->logformat, dev, buf, &entry,
+                    binaryMsgBuf, sizeof(binaryMsgBuf), &match)) {
+        bytesWritten = printLogLine(context, entry);
+
+        if (bytesWritten < 0) {
+            logcat_panic(context, HELP_FALSE, "output error");
+            return;
         }
     }
+    context->printCount += match;
 
-    context->outByteCount += bytesWritten;
+    if (!context->compress) context->outByteCount += bytesWritten;
 
     if (context->logRotateSizeKBytes > 0 &&
         (context->outByteCount / 1024) >= context->logRotateSizeKBytes) {
+        flushOutput(context);
         rotateLogs(context);
     }
 }
 
-static void maybePrintStart(android_logcat_context_internal* context,
-                            log_device_t* dev, bool printDividers) {
+// Formats the divider due ahead of the entries from dev into buf, if any
+static size_t formatStart(android_logcat_context_internal* context,
+                          log_device_t* dev, bool printDividers, char* buf,
+                          size_t bufLen) {
+    size_t len = 0;
+
     if (!dev->printed || printDividers) {
         if (context->devCount > 1 && !context->printBinary) {
-            char buf[1024];
-            snprintf(buf, sizeof(buf), "--------- %s %s\n",
+            snprintf(buf, bufLen, "--------- %s %s\n",
                      dev->printed ? "switch to" : "beginning of", dev->device);
-            if (write(context->output_fd, buf, strlen(buf)) < 0) {
+            len = strlen(buf);
+        }
+        dev->printed = true;
+    }
+    return len;
+}
+
+static void maybePrintStart(android_logcat_context_internal* context,
+                            log_device_t* dev, bool printDividers) {
+    char buf[1024];
+    size_t len = formatStart(context, dev, printDividers, buf, sizeof(buf));
+
+    if (!len) return;
+
+    if (context->outBuffer) {
+        if ((OUTPUT_BUFFER_SIZE - context->outBufferLen) < len) {
+            flushOutput(context);
+            if (context->stop) return;
+        }
+        memcpy(context->outBuffer + context->outBufferLen, buf, len);
+        context->outBufferLen += len;
+    } else if (write(context->output_fd, buf, len) < 0) {
+        logcat_panic(context, HELP_FALSE, "output error");
+    }
+}
+
+// Returns false at the end of a dump, or once it has reported a read error
+static bool readLogMsg(android_logcat_context_internal* context,
+                       struct logger_list* logger_list,
+                       struct log_msg* log_msg) {
+    int ret = android_logger_list_read(logger_list, log_msg);
+    if (ret > 0) return true;
+
+    if (!ret || (ret == -EIO)) {
+        logcat_panic(context, HELP_FALSE, "read: unexpected EOF!\n");
+    } else if (ret == -EINVAL) {
+        logcat_panic(context, HELP_FALSE, "read: unexpected length.\n");
+    } else if (ret != -EAGAIN) {
+        logcat_panic(context, HELP_FALSE, "logcat read failure\n");
+    }
+    return false;
+}
+
+static log_device_t* deviceOf(android_logcat_context_internal* context,
+                              log_device_t* unexpected,
+                              struct log_msg* log_msg) {
+    log_device_t* d;
+    for (d = context->devices; d; d = d->next) {
+        if (android_name_to_log_id(d->device) == log_msg->id()) return d;
+    }
+    context->devCount = 2;  // set to Multiple
+    unexpected->binary = log_msg->id() == LOG_ID_EVENTS;
+    return unexpected;
+}
+
+// An --input dump is read in chunks of entries, each decoded and formatted
+// by whichever worker thread takes it, and written out in the order read.
+struct InputChunk {
+    struct Record {
+        log_device_t* dev;
+        size_t offset;  // of the entry in entries
+        size_t len;
+        std::string divider;  // printed ahead of the entry
+    };
+    std::vector<char> entries;
+    std::vector<Record> records;
+    std::string output;
+    bool formatted;
+};
+
+struct InputQueue {
+    std::mutex lock;
+    std::condition_variable formatted;  // the reader waits for the front
+    std::deque<std::unique_ptr<InputChunk>> chunks;  // in the order read
+    std::vector<AndroidLogFormat*> formats;  // not in use by a task
+};
+
+// Each task has a format to itself, it caches the last time it converted
+static void formatChunk(android_logcat_context_internal* context,
+                        InputQueue* queue, InputChunk* chunk) {
+    AndroidLogFormat* format;
+    {
+        std::lock_guard<std::mutex> lock(queue->lock);
+        format = queue->formats.back();
+        queue->formats.pop_back();
+    }
+
+    struct log_msg log_msg;
+    AndroidLogEntry entry;
+    char binaryMsgBuf[1024];
+    char defaultBuffer[512];
+    for (const InputChunk::Record& record : chunk->records) {
+        if (context->stop) break;
+        chunk->output += record.divider;
+
+        bool match;
+        memcpy(&log_msg, chunk->entries.data() + record.offset, record.len);
+        if (!selectEntry(context, format, record.dev, &log_msg, &entry,
+                         binaryMsgBuf, sizeof(binaryMsgBuf), &match)) {
+            continue;
+        }
+        size_t len;
+        char* line = android_log_formatLogLine(
+            format, defaultBuffer, sizeof(defaultBuffer), &entry, &len);
+        if (!line) continue;
+        chunk->output.append(line, len);
+        if (line != defaultBuffer) free(line);
+    }
+
+    std::lock_guard<std::mutex> lock(queue->lock);
+    queue->formats.push_back(format);
+    chunk->formatted = true;
+    queue->formatted.notify_one();
+}
+
+// Writes out formatted chunks from the front until no more than keep remain
+static void writeInput(android_logcat_context_internal* context,
+                       InputQueue* queue, size_t keep) {
+    std::unique_lock<std::mutex> lock(queue->lock);
+    while (queue->chunks.size() > keep) {
+        if (!queue->chunks.front()->formatted) {
+            queue->formatted.wait(lock);
+            continue;
+        }
+        std::unique_ptr<InputChunk> chunk = std::move(queue->chunks.front());
+        queue->chunks.pop_front();
+        lock.unlock();
+
+        const std::string& output = chunk->output;
+        for (size_t offset = 0; !context->stop && (offset < output.length());) {
+            ssize_t ret = TEMP_FAILURE_RETRY(write(
+                context->output_fd, output.data() + offset,
+                output.length() - offset));
+            if (ret <= 0) {
                 logcat_panic(context, HELP_FALSE, "output error");
-                return;
+                break;
             }
+            offset += ret;
         }
-        dev->printed = true;
+        lock.lock();
+    }
+}
+
+// Returns false, having read nothing, if there are no formats to spare
+static bool readInputInParallel(android_logcat_context_internal* context,
+                                struct logger_list* logger_list,
+                                log_device_t* unexpected, bool printDividers) {
+    InputQueue queue;
+    unsigned threads = std::max(1U, std::thread::hardware_concurrency());
+    for (unsigned i = 0; i < threads; ++i) {
+        AndroidLogFormat* format = android_log_format_dup(context->logformat);
+        if (!format) break;
+        queue.formats.push_back(format);
+    }
+    if (queue.formats.empty()) return false;
+
+    // Opened up front so no task has to
+    if (!context->eventTagMap && !context->hasOpenedEventTagMap) {
+        context->eventTagMap = android_openEventTagMap(nullptr);
+        context->hasOpenedEventTagMap = true;
+    }
+
+    // A format per worker, as many as can run a task at once
+    android::base::ThreadPool pool(queue.formats.size());
+    // Enough in flight to keep every worker busy, bounded to spare memory
+    size_t maxQueued = 2 * pool.size();
+
+    log_device_t* dev = nullptr;
+    bool more = true;
+    while (more && !context->stop) {
+        std::unique_ptr<InputChunk> chunk(new InputChunk);
+        chunk->formatted = false;
+        while (chunk->records.size() < INPUT_CHUNK_ENTRIES) {
+            struct log_msg log_msg;
+            more = readLogMsg(context, logger_list, &log_msg);
+            if (!more) break;
+
+            InputChunk::Record record = { deviceOf(context, unexpected,
+                                                   &log_msg),
+                                          chunk->entries.size(),
+                                          log_msg.len(), "" };
+            if (dev != record.dev) {
+                dev = record.dev;
+                char buf[1024];
+                record.divider.assign(
+                    buf, formatStart(context, dev, printDividers, buf,
+                                     sizeof(buf)));
+            }
+            const char* msg = reinterpret_cast<const char*>(&log_msg);
+            chunk->entries.insert(chunk->entries.end(), msg, msg + record.len);
+            chunk->records.push_back(std::move(record));
+        }
+        if (chunk->records.empty()) break;
+
+        writeInput(context, &queue, maxQueued - 1);
+        InputChunk* task = chunk.get();
+        {
+            std::lock_guard<std::mutex> lock(queue.lock);
+            queue.chunks.push_back(std::move(chunk));
+        }
+        pool.Submit([context, &queue, task] {
+            formatChunk(context, &queue, task);
+        });
+    }
+
+    writeInput(context, &queue, 0);
+    pool.Wait();
+    for (AndroidLogFormat* format : queue.formats) {
+        android_log_format_free(format);
     }
+    return true;
 }
 
 static void setupOutputAndSchedulingPolicy(
@@ -421,6 +868,7 @@ static void setupOutputAndSchedulingPolicy(
     context->output = fdopen(context->output_fd, "web");
 
     context->outByteCount = statbuf.st_size;
+    context->outputStart = nowNs();
 }
 
 // clang-format off
@@ -439,8 +887,12 @@ static void show_help(android_logcat_context_internal* context) {
                     "                  Rotate log every kbytes. Requires -f option\n"
                     "  -n <count>, --rotate-count=<count>\n"
                     "                  Sets max number of rotated logs to <count>, default 4\n"
+                    "  --fsync         Sync each rotated log to storage, in the background, before\n"
+                    "                  it is renamed into the set\n"
                     "  --id=<id>       If the signature id for logging to file changes, then clear\n"
                     "                  the fileset and continue\n"
+                    "  --compress      Write zlib compressed blocks, each headed by the time range\n"
+                    "                  of the entries it holds. Rotation counts compressed bytes\n"
                     "  -v <format>, --format=<format>\n"
                     "                  Sets log print format verb and adverbs, where <format> is:\n"
                     "                    brief help long process raw tag thread threadtime time\n"
@@ -464,6 +916,8 @@ static void show_help(android_logcat_context_internal* context) {
                     "                  paired with --regex, but will work on its own.\n"
                     "  --print         Paired with --regex and --max-count to let content bypass\n"
                     "                  regex filter but still stop at number of matches.\n"
+                    "  --input=<file>  Read the log from a -B binary dump <file> instead of the\n"
+                    "                  device, formatting it on all cpus (implies -d)\n"
                     // Leave --tail undocumented as alias for -t
                     "  -t <count>      Print only the most recent <count> lines (implies -d)\n"
                     "  -t '<time>'     Print most recent lines since specified time (implies -d)\n"
@@ -560,6 +1014,7 @@ static int setLogFormat(android_logcat_context_internal* context,
 
     // invalid string?
     if (format == FORMAT_OFF) return -1;
+    if (format == FORMAT_MODIFIER_MONOTONIC) context->monotonic = true;
 
     return android_log_setPrintFormat(context->logformat, format);
 }
@@ -636,6 +1091,30 @@ static char* parseTime(log_time& t, const char* cp) {
     return t.strptime(cp, "%s.%q");
 }
 
+// Walk the --compress block headers, no need to inflate any of them.
+// Returns false if the content is not in blocks.
+static bool lastBlockTime(const std::string& file, const log_time& now,
+                          log_time& retval, bool& found) {
+    logcat_block_header_t header;
+    size_t offset = 0;
+
+    while ((file.length() - offset) >= sizeof(header)) {
+        memcpy(&header, file.data() + offset, sizeof(header));
+        if (header.magic != LOGCAT_BLOCK_MAGIC) break;
+        offset += sizeof(header);
+        if (header.compressed_len > (file.length() - offset)) break;
+        offset += header.compressed_len;
+        if (!header.count) continue;
+
+        log_time t(header.last_sec, header.last_nsec);
+        if ((t < now) && (t > retval)) {
+            retval = t;
+            found = true;
+        }
+    }
+    return offset > 0;
+}
+
 // Find last logged line in <outputFileName>, or <outputFileName>.1
 static log_time lastLogTime(const char* outputFileName) {
     log_time retval(log_time::EPOCH);
@@ -675,6 +1154,12 @@ static log_time lastLogTime(const char* outputFileName) {
         if (!android::base::ReadFileToString(file_name, &file)) continue;
 
         bool found = false;
+        if (lastBlockTime(file, now, retval, found)) {
+            // exact entry times, the next nanosecond is the first unseen
+            modulo.tv_nsec = 1;
+            if (!dp->d_name[len] && found) break;
+            continue;
+        }
         for (const auto& line : android::base::Split(file, "\n")) {
             log_time t(log_time::EPOCH);
             char* ep = parseTime(t, line.c_str());
@@ -740,6 +1225,7 @@ static int __logcat(android_logcat_context_internal* context) {
     const char* setId = nullptr;
     int mode = ANDROID_LOG_RDONLY;
     std::string forceFilters;
+    std::string serverFilters;  // everything added to logformat, for logd
     log_device_t* dev;
     struct logger_list* logger_list;
     size_t tail_lines = 0;
@@ -868,23 +1354,29 @@ static int __logcat(android_logcat_context_internal* context) {
         static const char debug_str[] = "debug";
         static const char id_str[] = "id";
         static const char wrap_str[] = "wrap";
+        static const char compress_str[] = "compress";
         static const char print_str[] = "print";
+        static const char input_str[] = "input";
+        static const char fsync_str[] = "fsync";
         // clang-format off
         static const struct option long_options[] = {
           { "binary",        no_argument,       nullptr, 'B' },
           { "buffer",        required_argument, nullptr, 'b' },
           { "buffer-size",   optional_argument, nullptr, 'g' },
           { "clear",         no_argument,       nullptr, 'c' },
+          { compress_str,    no_argument,       nullptr, 0 },
           { debug_str,       no_argument,       nullptr, 0 },
           { "dividers",      no_argument,       nullptr, 'D' },
           { "file",          required_argument, nullptr, 'f' },
           { "format",        required_argument, nullptr, 'v' },
+          { fsync_str,       no_argument,       nullptr, 0 },
           // hidden and undocumented reserved alias for --regex
           { "grep",          required_argument, nullptr, 'e' },
           // hidden and undocumented reserved alias for --max-count
           { "head",          required_argument, nullptr, 'm' },
           { "help",          no_argument,       nullptr, 'h' },
           { id_str,          required_argument, nullptr, 0 },
+          { input_str,       required_argument, nullptr, 0 },
           { "last",          no_argument,       nullptr, 'L' },
           { "max-count",     required_argument, nullptr, 'm' },
           { pid_str,         required_argument, nullptr, 0 },
@@ -948,6 +1440,20 @@ static int __logcat(android_logcat_context_internal* context) {
                     context->debug = true;
                     break;
                 }
+                if (long_options[option_index].name == compress_str) {
+                    context->compress = true;
+                    break;
+                }
+                if (long_options[option_index].name == fsync_str) {
+                    context->fsyncRotated = true;
+                    break;
+                }
+                if (long_options[option_index].name == input_str) {
+                    context->inputFileName = optctx.optarg;
+                    // a dump ends, there is nothing to wait for
+                    mode |= ANDROID_LOG_RDONLY | ANDROID_LOG_NONBLOCK;
+                    break;
+                }
                 if (long_options[option_index].name == id_str) {
                     setId = (optctx.optarg && optctx.optarg[0]) ? optctx.optarg
                                                                 : nullptr;
@@ -957,6 +1463,7 @@ static int __logcat(android_logcat_context_internal* context) {
             case 's':
                 // default to all silent
                 android_log_addFilterRule(context->logformat, "*:s");
+                serverFilters += " *:s";
                 break;
 
             case 'c':
@@ -1401,6 +1908,7 @@ static int __logcat(android_logcat_context_internal* context) {
                          "Invalid filter expression in logcat args\n");
             goto exit;
         }
+        serverFilters += " " + forceFilters;
     } else if (argc == optctx.optind) {
         // Add from environment variable
         const char* env_tags_orig = android::getenv(context, "ANDROID_LOG_TAGS");
@@ -1414,6 +1922,7 @@ static int __logcat(android_logcat_context_internal* context) {
                             "Invalid filter expression in ANDROID_LOG_TAGS\n");
                 goto exit;
             }
+            serverFilters += std::string(" ") + env_tags_orig;
         }
     } else {
         // Add from commandline
@@ -1429,6 +1938,7 @@ static int __logcat(android_logcat_context_internal* context) {
                              "Invalid filter expression '%s'\n", argv[i]);
                 goto exit;
             }
+            serverFilters += std::string(" ") + argv[i];
         }
     }
 
@@ -1438,6 +1948,21 @@ static int __logcat(android_logcat_context_internal* context) {
     } else {
         logger_list = android_logger_list_alloc(mode, tail_lines, pid);
     }
+    if (context->inputFileName) {
+        err = android_logger_list_set_file(logger_list,
+                                           context->inputFileName);
+        if (err < 0) {
+            logcat_panic(context, HELP_FALSE, "Unable to read '%s': %s\n",
+                         context->inputFileName, strerror(-err));
+            goto close;
+        }
+    }
+    // Have logd apply the same filterspecs ahead of sending the entries,
+    // they are checked again for the few it must let through regardless.
+    // Binary output is not filtered by us, so must not be by logd either.
+    if (!context->printBinary && serverFilters.size()) {
+        android_logger_list_set_filter(logger_list, serverFilters.c_str());
+    }
     // We have three orthogonal actions below to clear, set log size and
     // get log size. All sharing the same iteration loop.
     while (dev) {
@@ -1481,6 +2006,8 @@ static int __logcat(android_logcat_context_internal* context) {
                         reportErrorName(&clearFail, dev->device, allSelected);
                     }
                 }
+                // left behind if a rotation was interrupted
+                unlink(android::rotatingName(context).c_str());
             } else if (android_logger_clear(dev->logger)) {
                 reportErrorName(&clearFail, dev->device, allSelected);
             }
@@ -1618,40 +2145,29 @@ static int __logcat(android_logcat_context_internal* context) {
 
     dev = nullptr;
 
+    // A dump only cares about throughput, a tail needs each line promptly
+    if (context->compress ||
+        ((mode & ANDROID_LOG_NONBLOCK) && !context->printBinary)) {
+        context->outBuffer = (char*)malloc(OUTPUT_BUFFER_SIZE);
+        context->outBufferLen = 0;
+    }
+
+    // Plain formatting of a dump to a plain output can be spread over the
+    // cpus, anything keeping a tally as it goes is left to this thread.
+    if (context->inputFileName && !context->printBinary &&
+        !context->compress && !context->logRotateSizeKBytes &&
+        !context->maxCount && !context->monotonic &&
+        readInputInParallel(context, logger_list, &unexpected,
+                            printDividers)) {
+        goto close;
+    }
+
     while (!context->stop &&
            (!context->maxCount || (context->printCount < context->maxCount))) {
         struct log_msg log_msg;
-        int ret = android_logger_list_read(logger_list, &log_msg);
-        if (!ret) {
-            logcat_panic(context, HELP_FALSE, "read: unexpected EOF!\n");
-            break;
-        }
-
-        if (ret < 0) {
-            if (ret == -EAGAIN) break;
-
-            if (ret == -EIO) {
-                logcat_panic(context, HELP_FALSE, "read: unexpected EOF!\n");
-                break;
-            }
-            if (ret == -EINVAL) {
-                logcat_panic(context, HELP_FALSE, "read: unexpected length.\n");
-                break;
-            }
-            logcat_panic(context, HELP_FALSE, "logcat read failure\n");
-            break;
-        }
-
-        log_device_t* d;
-        for (d = context->devices; d; d = d->next) {
-            if (android_name_to_log_id(d->device) == log_msg.id()) break;
-        }
-        if (!d) {
-            context->devCount = 2; // set to Multiple
-            d = &unexpected;
-            d->binary = log_msg.id() == LOG_ID_EVENTS;
-        }
+        if (!readLogMsg(context, logger_list, &log_msg)) break;
 
+        log_device_t* d = deviceOf(context, &unexpected, &log_msg);
         if (dev != d) {
             dev = d;
             maybePrintStart(context, dev, printDividers);
@@ -1665,6 +2181,13 @@ static int __logcat(android_logcat_context_internal* context) {
     }
 
 close:
+    flushOutput(context);
+    waitForRotation(context);
+    reportRotations(context);
+    free(context->outBuffer);
+    context->outBuffer = nullptr;
+    context->outBufferLen = 0;
+
     // Short and sweet. Implemented generic version in android_logcat_destroy.
     while (!!(dev = context->devices)) {
         context->devices = dev->next;
@@ -17,6 +17,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
 #include <benchmark/benchmark.h>
 
@@ -130,4 +131,25 @@ static void BM_logcat_sorted_order(benchmark::State& state) {
 }
 BENCHMARK(BM_logcat_sorted_order);
 
+// Tail query by time (logcat -T), the reader starts logd's flushTo() from
+// a point state.range(0) seconds back from now. Against a full buffer the
+// cost should track the amount of content returned, not the buffer size.
+static void BM_logcat_tail_time(benchmark::State& state) {
+    while (state.KeepRunning()) {
+        struct timespec now;
+        clock_gettime(CLOCK_REALTIME, &now);
+
+        char command[256];
+        snprintf(command, sizeof(command),
+                 "logcat -b all -d -T %ld.%09ld >/dev/null 2>&1",
+                 (long)(now.tv_sec - state.range(0)), (long)now.tv_nsec);
+        int ret = system(command);
+        if (ret) {
+            fprintf(stderr, "ERROR: \"%s\" returned %d\n", command, ret);
+            break;
+        }
+    }
+}
+BENCHMARK(BM_logcat_tail_time)->Arg(0)->Arg(1)->Arg(10)->Arg(60);
+
 BENCHMARK_MAIN();
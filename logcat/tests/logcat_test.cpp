@@ -36,6 +36,8 @@
 #include <log/event_tag_map.h>
 #include <log/log.h>
 #include <log/log_event_list.h>
+#include <log/logcat_block.h>
+#include <zlib.h>
 
 #ifndef logcat_popen
 #define logcat_define(context)
@@ -906,6 +908,63 @@ TEST(logcat, logrotate_suffix) {
     EXPECT_FALSE(IsFalse(system(command), command));
 }
 
+TEST(logcat, compress) {
+    static const char form[] = "/data/local/tmp/logcat.compress.XXXXXX";
+    char buf[sizeof(form)];
+    ASSERT_TRUE(NULL != mkdtemp(strcpy(buf, form)));
+
+    static const char comm[] = logcat_executable
+        " -b radio -b events -b system -b main"
+        " -d --compress -f %s/log.txt";
+    char command[sizeof(buf) + sizeof(comm)];
+    snprintf(command, sizeof(command), comm, buf);
+
+    int ret;
+    EXPECT_FALSE(IsFalse(ret = logcat_system(command), command));
+    if (!ret) {
+        std::string file;
+        std::string file_name = android::base::StringPrintf("%s/log.txt", buf);
+        EXPECT_TRUE(android::base::ReadFileToString(file_name, &file));
+
+        size_t offset = 0;
+        size_t blocks = 0;
+        size_t lines = 0;
+        size_t entries = 0;
+        while (offset < file.length()) {
+            logcat_block_header_t header;
+            ASSERT_LE(sizeof(header), file.length() - offset);
+            memcpy(&header, file.data() + offset, sizeof(header));
+            offset += sizeof(header);
+            ASSERT_EQ(LOGCAT_BLOCK_MAGIC, header.magic);
+            ASSERT_LE(header.compressed_len, file.length() - offset);
+
+            std::unique_ptr<char[]> text(new char[header.len]);
+            uLongf len = header.len;
+            EXPECT_EQ(Z_OK,
+                      uncompress(reinterpret_cast<Bytef*>(text.get()), &len,
+                                 reinterpret_cast<const Bytef*>(file.data() +
+                                                                offset),
+                                 header.compressed_len));
+            EXPECT_EQ(header.len, len);
+            offset += header.compressed_len;
+
+            // only blocks holding entries carry a time range
+            if (header.count) {
+                EXPECT_NE(0U, header.first_sec);
+                EXPECT_NE(0U, header.last_sec);
+            }
+            for (size_t i = 0; i < len; ++i) lines += text[i] == '\n';
+            entries += header.count;
+            ++blocks;
+        }
+        EXPECT_LT(0U, blocks);
+        EXPECT_LT(0U, entries);
+        EXPECT_LE(entries, lines);
+    }
+    snprintf(command, sizeof(command), "rm -rf %s", buf);
+    EXPECT_FALSE(IsFalse(system(command), command));
+}
+
 TEST(logcat, logrotate_continue) {
     static const char tmp_out_dir_form[] =
         "/data/local/tmp/logcat.logrotate.XXXXXX";
@@ -237,10 +237,11 @@ CommandListener::GetPruneListCmd::GetPruneListCmd(LogBuffer* buf)
     : LogCommand("getPruneList"), mBuf(*buf) {
 }
 
-int CommandListener::GetPruneListCmd::runCommand(SocketClient* cli,
-                                                 int /*argc*/, char** /*argv*/) {
+int CommandListener::GetPruneListCmd::runCommand(SocketClient* cli, int argc,
+                                                 char** argv) {
     setname();
-    cli->sendMsg(package_string(mBuf.formatPrune()).c_str());
+    bool hits = (argc > 1) && !strcmp(argv[1], "hits");
+    cli->sendMsg(package_string(mBuf.formatPrune(hits)).c_str());
     return 0;
 }
 
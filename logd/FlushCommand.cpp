@@ -23,19 +23,29 @@
 #include "LogBufferElement.h"
 #include "LogCommand.h"
 #include "LogReader.h"
+#include "LogReaderFilter.h"
+#include "LogReaderRing.h"
 #include "LogTimes.h"
 #include "LogUtils.h"
 
 FlushCommand::FlushCommand(LogReader& reader, bool nonBlock, unsigned long tail,
                            unsigned int logMask, pid_t pid, log_time start,
-                           uint64_t timeout)
+                           uint64_t timeout, LogReaderRing* ring,
+                           LogReaderFilter* filter)
     : mReader(reader),
       mNonBlock(nonBlock),
       mTail(tail),
       mLogMask(logMask),
       mPid(pid),
       mStart(start),
-      mTimeout((start != log_time::EPOCH) ? timeout : 0) {
+      mTimeout((start != log_time::EPOCH) ? timeout : 0),
+      mRing(ring),
+      mFilter(filter) {
+}
+
+FlushCommand::~FlushCommand() {
+    delete mRing;
+    delete mFilter;
 }
 
 // runSocketCommand is called once for every open client on the
@@ -88,7 +98,9 @@ void FlushCommand::runSocketCommand(SocketClient* client) {
             return;
         }
         entry = new LogTimeEntry(mReader, client, mNonBlock, mTail, mLogMask,
-                                 mPid, mStart, mTimeout);
+                                 mPid, mStart, mTimeout, mRing, mFilter);
+        mRing = nullptr;
+        mFilter = nullptr;
         times.push_front(entry);
     }
 
@@ -24,6 +24,8 @@ class LogBufferElement;
 #include "LogTimes.h"
 
 class LogReader;
+class LogReaderFilter;
+class LogReaderRing;
 
 class FlushCommand : public SocketClientCommand {
     LogReader& mReader;
@@ -33,12 +35,16 @@ class FlushCommand : public SocketClientCommand {
     pid_t mPid;
     log_time mStart;
     uint64_t mTimeout;
+    LogReaderRing* mRing;  // handed to a new LogTimeEntry, else deleted
+    LogReaderFilter* mFilter;  // likewise
 
    public:
     explicit FlushCommand(LogReader& mReader, bool nonBlock = false,
                           unsigned long tail = -1, unsigned int logMask = -1,
                           pid_t pid = 0, log_time start = log_time::EPOCH,
-                          uint64_t timeout = 0);
+                          uint64_t timeout = 0, LogReaderRing* ring = nullptr,
+                          LogReaderFilter* filter = nullptr);
+    virtual ~FlushCommand();
     virtual void runSocketCommand(SocketClient* client);
 
     static bool hasReadLogs(SocketClient* client);
@@ -72,6 +72,13 @@ LogAudit::LogAudit(LogBuffer* buf, LogReader* reader, int fdDmesg)
                                            't',
                                            '\n' };
     write(fdDmesg, auditd_message, sizeof(auditd_message));
+
+    for (Recent& r : recent) {
+        r.hash = 0;
+        r.start = log_time::EPOCH;
+        r.logged = 0;
+        r.suppressed = 0;
+    }
 }
 
 void LogAudit::checkRateLimit() {
@@ -114,6 +121,81 @@ void LogAudit::checkRateLimit() {
     audit_rate_limit(mSock, AUDIT_RATE_LIMIT_DEFAULT);
 }
 
+// Hash of an audit message apart from its " audit(<sec>.<msec>:<serial>)"
+// stamp, which is unique to each message, and the time from the stamp.
+static uint64_t auditHash(const char* str, log_time& when) {
+    static const char audit_str[] = " audit(";
+    const char* stamp = strstr(str, audit_str);
+    const char* estamp = stamp ? strchr(stamp, ')') : NULL;
+    const char* cp;
+
+    when = log_time(CLOCK_REALTIME);
+    if (!estamp) {
+        stamp = estamp = str + strlen(str);
+    } else if (isdigit(*(cp = stamp + sizeof(audit_str) - 1))) {
+        when.tv_sec = 0;
+        while (isdigit(*cp)) {
+            when.tv_sec = (when.tv_sec * 10) + (*cp++ - '0');
+        }
+        unsigned long multiplier = NS_PER_SEC;
+        when.tv_nsec = 0;
+        if (*cp == '.') {
+            while (isdigit(*++cp) && (multiplier /= 10)) {
+                when.tv_nsec += (*cp - '0') * multiplier;
+            }
+        }
+    }
+
+    // FNV-1a
+    uint64_t hash = 14695981039346656037ULL;
+    for (cp = str; *cp; ++cp) {
+        if (cp == stamp) {
+            cp = estamp;
+        }
+        hash = (hash ^ (unsigned char)*cp) * 1099511628211ULL;
+    }
+    return hash;
+}
+
+// Denial floods repeat the same few messages. Returns true if str is one
+// copy too many for its window, otherwise reports how many copies were
+// dropped in its previous window. Counts are lost for messages pushed out
+// of the table by newer ones.
+bool LogAudit::isDuplicate(const char* str, unsigned& suppressed) {
+    log_time when;
+    uint64_t hash = auditHash(str, when);
+
+    static const log_time window(AUDIT_DEDUP_WINDOW, 0);
+    Recent* slot = &recent[0];
+    for (Recent& r : recent) {
+        if ((r.hash == hash) && (r.start != log_time::EPOCH)) {
+            slot = &r;
+            break;
+        }
+        if (r.start < slot->start) {
+            slot = &r;
+        }
+    }
+
+    suppressed = 0;
+    if ((slot->hash == hash) && (slot->start != log_time::EPOCH)) {
+        if ((when >= slot->start) && ((when - slot->start) < window)) {
+            if (slot->logged >= AUDIT_DEDUP_BURST) {
+                ++slot->suppressed;
+                return true;
+            }
+            ++slot->logged;
+            return false;
+        }
+        suppressed = slot->suppressed;
+    }
+    slot->hash = hash;
+    slot->start = when;
+    slot->logged = 1;
+    slot->suppressed = 0;
+    return false;
+}
+
 bool LogAudit::onDataAvailable(SocketClient* cli) {
     if (!initialized) {
         prctl(PR_SET_NAME, "logd.auditd");
@@ -154,6 +236,22 @@ int LogAudit::logPrint(const char* fmt, ...) {
         return rc;
     }
 
+    // Drop repeats before spending any time on them
+    unsigned suppressed;
+    if (isDuplicate(str, suppressed)) {
+        free(str);
+        return 0;
+    }
+    if (suppressed) {
+        char* dup = NULL;
+        rc = asprintf(&dup, "%s (%u duplicate messages suppressed)", str,
+                      suppressed);
+        if (rc >= 0) {
+            free(str);
+            str = dup;
+        }
+    }
+
     char* cp;
     // Work around kernels missing
     // https://github.com/torvalds/linux/commit/b8f89caafeb55fba75b74bea25adc4e4cd91be67
@@ -25,6 +25,13 @@
 
 class LogReader;
 
+// Past the first AUDIT_DEDUP_BURST copies of an audit message within
+// AUDIT_DEDUP_WINDOW seconds, further copies are counted instead of logged.
+#define AUDIT_DEDUP_WINDOW 1
+#define AUDIT_DEDUP_BURST 10
+// Number of distinct recent audit messages to remember
+#define AUDIT_DEDUP_SIZE 32
+
 class LogAudit : public SocketListener {
     LogBuffer* logbuf;
     LogReader* reader;
@@ -38,6 +45,15 @@ class LogAudit : public SocketListener {
     std::queue<log_time> bucket;
     void checkRateLimit();
 
+    struct Recent {
+        uint64_t hash;    // of the message apart from its audit(...) stamp
+        log_time start;   // audit time of the current window
+        unsigned logged;  // in the current window
+        unsigned suppressed;
+    };
+    Recent recent[AUDIT_DEDUP_SIZE];
+    bool isDuplicate(const char* str, unsigned& suppressed);
+
    public:
     LogAudit(LogBuffer* buf, LogReader* reader, int fdDmesg);
     int log(char* buf, size_t len);
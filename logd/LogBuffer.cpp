@@ -19,19 +19,24 @@
 #include <ctype.h>
 #include <endian.h>
 #include <errno.h>
+#include <inttypes.h>
 #include <stdio.h>
 #include <string.h>
 #include <sys/cdefs.h>
+#include <sched.h>
 #include <sys/user.h>
 #include <time.h>
 #include <unistd.h>
 
+#include <algorithm>
 #include <unordered_map>
 
+#include <android-base/stringprintf.h>
 #include <cutils/properties.h>
 #include <private/android_logger.h>
 
 #include "LogBuffer.h"
+#include "LogBufferBlock.h"
 #include "LogKlog.h"
 #include "LogReader.h"
 #include "LogUtils.h"
@@ -47,9 +52,6 @@ const log_time LogBuffer::pruneMargin(3, 0);
 
 void LogBuffer::init() {
     log_id_for_each(i) {
-        mLastSet[i] = false;
-        mLast[i] = mLogElements.begin();
-
         if (setSize(i, __android_logger_get_buffer_size(i))) {
             setSize(i, LOG_BUFFER_MIN_SIZE);
         }
@@ -73,25 +75,30 @@ void LogBuffer::init() {
         // be corrected. 1/30 corner case YMMV.
         //
         rdlock();
-        LogBufferElementCollection::iterator it = mLogElements.begin();
-        while ((it != mLogElements.end())) {
-            LogBufferElement* e = *it;
-            if (monotonic) {
-                if (!android::isMonotonic(e->mRealTime)) {
-                    LogKlog::convertRealToMonotonic(e->mRealTime);
-                    if ((e->mRealTime.tv_nsec % 1000) == 0) {
-                        e->mRealTime.tv_nsec++;
+        log_id_for_each(i) {
+            for (LogBufferElement* e : mLogElements[i]) {
+                if (monotonic) {
+                    if (!android::isMonotonic(e->mRealTime)) {
+                        LogKlog::convertRealToMonotonic(e->mRealTime);
+                        if ((e->mRealTime.tv_nsec % 1000) == 0) {
+                            e->mRealTime.tv_nsec++;
+                        }
                     }
-                }
-            } else {
-                if (android::isMonotonic(e->mRealTime)) {
-                    LogKlog::convertMonotonicToReal(e->mRealTime);
-                    if ((e->mRealTime.tv_nsec % 1000) == 0) {
-                        e->mRealTime.tv_nsec++;
+                } else {
+                    if (android::isMonotonic(e->mRealTime)) {
+                        LogKlog::convertMonotonicToReal(e->mRealTime);
+                        if ((e->mRealTime.tv_nsec % 1000) == 0) {
+                            e->mRealTime.tv_nsec++;
+                        }
                     }
                 }
             }
-            ++it;
+        }
+        unlock();
+
+        wrlock();
+        log_id_for_each(i) {
+            indexRebuild(i);
         }
         unlock();
     }
@@ -116,18 +123,45 @@ void LogBuffer::init() {
 }
 
 LogBuffer::LogBuffer(LastLogTimes* times)
-    : monotonic(android_log_clockid() == CLOCK_MONOTONIC), mTimes(*times) {
-    pthread_rwlock_init(&mLogElementsLock, nullptr);
+    : monotonic(android_log_clockid() == CLOCK_MONOTONIC),
+      mCommitting(false),
+      mQueueFull(0),
+      mQueueBatches(0),
+      mQueueElements(0),
+      mQueueMaxBatch(0),
+      mQueueMaxDepth(0),
+      mWrlockCount(0),
+      mWrlockWaits(0),
+      mWrlockWaitNs(0),
+      mWrlockMaxWaitNs(0),
+      mTimes(*times) {
+    // Readers drop and take the lock again for every entry they send, and
+    // with several of them at it there is always one holding it: waiting
+    // writers must win over new readers, or logging stalls behind dumps.
+    // Nothing takes the lock for reading recursively.
+    pthread_rwlockattr_t attr;
+    pthread_rwlockattr_init(&attr);
+    pthread_rwlockattr_setkind_np(&attr,
+                                  PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+    pthread_rwlock_init(&mLogElementsLock, &attr);
+    pthread_rwlockattr_destroy(&attr);
+    memset(mWrlockWaitHist, 0, sizeof(mWrlockWaitHist));
 
     log_id_for_each(i) {
         lastLoggedElements[i] = nullptr;
         droppedElements[i] = nullptr;
+        mIndexCountdown[i] = 0;
+        mCompressCursorSet[i] = false;
+        mCompressPending[i] = 0;
     }
 
     init();
 }
 
 LogBuffer::~LogBuffer() {
+    for (LogBufferElement* elem; (elem = mQueue.pop()) != nullptr;) {
+        delete elem;
+    }
     log_id_for_each(i) {
         delete lastLoggedElements[i];
         delete droppedElements[i];
@@ -207,8 +241,8 @@ int LogBuffer::log(log_id_t log_id, log_time realtime, uid_t uid, pid_t pid,
     // exact entry with time specified in ms or us precision.
     if ((realtime.tv_nsec % 1000) == 0) ++realtime.tv_nsec;
 
-    LogBufferElement* elem =
-        new LogBufferElement(log_id, realtime, uid, pid, tid, msg, len);
+    LogBufferElement* elem = new (log_id)
+        LogBufferElement(log_id, realtime, uid, pid, tid, msg, len);
     if (log_id != LOG_ID_SECURITY) {
         int prio = ANDROID_LOG_INFO;
         const char* tag = nullptr;
@@ -228,7 +262,62 @@ int LogBuffer::log(log_id_t log_id, log_time realtime, uid_t uid, pid_t pid,
         }
     }
 
-    wrlock();
+    // Stage the entry, whichever writer takes on the commit role drains
+    // everyone's staged entries under a single wrlock() acquisition.
+    if (__predict_false(!mQueue.push(elem))) {
+        // Full, fall back to committing synchronously behind the backlog
+        while (mCommitting.exchange(true, std::memory_order_acquire)) {
+            sched_yield();
+        }
+        wrlock();
+        ++mQueueFull;
+        commitQueue_Locked();
+        commit(elem);
+        unlock();
+        mCommitting.store(false, std::memory_order_release);
+        return len;
+    }
+    drainQueue();
+
+    return len;
+}
+
+// Commit all staged entries, unless another writer is already doing so on
+// our behalf. Loops to close the race with a push landing just as the
+// previous committer lets go of the role.
+void LogBuffer::drainQueue() {
+    while (mQueue.depth() &&
+           !mCommitting.exchange(true, std::memory_order_acquire)) {
+        wrlock();
+        size_t batch = commitQueue_Locked();
+        unlock();
+        mCommitting.store(false, std::memory_order_release);
+        // a producer has claimed a cell but not yet published into it
+        if (!batch) sched_yield();
+    }
+}
+
+// assumes LogBuffer::wrlock() held and the commit role
+size_t LogBuffer::commitQueue_Locked() {
+    size_t depth = mQueue.depth();
+    if (depth > mQueueMaxDepth) mQueueMaxDepth = depth;
+
+    size_t batch = 0;
+    for (LogBufferElement* elem; (elem = mQueue.pop()) != nullptr; ++batch) {
+        commit(elem);
+    }
+    if (batch) {
+        ++mQueueBatches;
+        mQueueElements += batch;
+        if (batch > mQueueMaxBatch) mQueueMaxBatch = batch;
+    }
+    return batch;
+}
+
+// assumes LogBuffer::wrlock() held, owns elem, applies the chatty
+// identical message filter before handing off to log(elem)
+void LogBuffer::commit(LogBufferElement* elem) {
+    log_id_t log_id = elem->getLogId();
     LogBufferElement* currentLast = lastLoggedElements[log_id];
     if (currentLast) {
         LogBufferElement* dropped = droppedElements[log_id];
@@ -329,15 +418,13 @@ int LogBuffer::log(log_id_t log_id, log_time realtime, uid_t uid, pid_t pid,
                     // check for overflow
                     if (total >= UINT32_MAX) {
                         log(currentLast);
-                        unlock();
-                        return len;
+                        return;
                     }
                     stats.addTotal(currentLast);
                     delete currentLast;
                     swab = total;
                     event->payload.data = htole32(swab);
-                    unlock();
-                    return len;
+                    return;
                 }
                 if (count == USHRT_MAX) {
                     log(dropped);
@@ -353,8 +440,7 @@ int LogBuffer::log(log_id_t log_id, log_time realtime, uid_t uid, pid_t pid,
             }
             droppedElements[log_id] = currentLast;
             lastLoggedElements[log_id] = elem;
-            unlock();
-            return len;
+            return;
         }
         if (dropped) {         // State 1 or 2
             if (count) {       // State 2
@@ -371,27 +457,27 @@ int LogBuffer::log(log_id_t log_id, log_time realtime, uid_t uid, pid_t pid,
     lastLoggedElements[log_id] = new LogBufferElement(*elem);
 
     log(elem);
-    unlock();
-
-    return len;
 }
 
 // assumes LogBuffer::wrlock() held, owns elem, look after garbage collection
 void LogBuffer::log(LogBufferElement* elem) {
     // cap on how far back we will sort in-place, otherwise append
     static uint32_t too_far_back = 5;  // five seconds
+    // chatty entries outlive their neighbours, keep them off the arena
+    if (elem->getDropped()) elem = LogBufferElement::relocate(elem);
+    LogBufferElementCollection& elements = mLogElements[elem->getLogId()];
     // Insert elements in time sorted order if possible
     //  NB: if end is region locked, place element at end of list
-    LogBufferElementCollection::iterator it = mLogElements.end();
+    LogBufferElementCollection::iterator it = elements.end();
     LogBufferElementCollection::iterator last = it;
-    if (__predict_true(it != mLogElements.begin())) --it;
-    if (__predict_false(it == mLogElements.begin()) ||
+    if (__predict_true(it != elements.begin())) --it;
+    if (__predict_false(it == elements.begin()) ||
         __predict_true((*it)->getRealTime() <= elem->getRealTime()) ||
         __predict_false((((*it)->getRealTime().tv_sec - too_far_back) >
                          elem->getRealTime().tv_sec) &&
-                        (elem->getLogId() != LOG_ID_KERNEL) &&
-                        ((*it)->getLogId() != LOG_ID_KERNEL))) {
-        mLogElements.push_back(elem);
+                        (elem->getLogId() != LOG_ID_KERNEL))) {
+        elements.push_back(elem);
+        indexAppend(elem->getLogId());
     } else {
         log_time end = log_time::EPOCH;
         bool end_set = false;
@@ -417,31 +503,139 @@ void LogBuffer::log(LogBufferElement* elem) {
         }
 
         if (end_always || (end_set && (end > (*it)->getRealTime()))) {
-            mLogElements.push_back(elem);
+            elements.push_back(elem);
+            indexAppend(elem->getLogId());
         } else {
             // should be short as timestamps are localized near end()
             do {
                 last = it;
-                if (__predict_false(it == mLogElements.begin())) {
+                if (__predict_false(it == elements.begin())) {
                     break;
                 }
                 --it;
             } while (((*it)->getRealTime() > elem->getRealTime()) &&
                      (!end_set || (end <= (*it)->getRealTime())));
-            mLogElements.insert(last, elem);
+            elements.insert(last, elem);
         }
         LogTimeEntry::unlock();
     }
 
     stats.add(elem);
     maybePrune(elem->getLogId());
+    if (LogBufferBlock::isEnabled() && !elem->isBinary()) {
+        mCompressPending[elem->getLogId()] += elem->getMsgLen();
+        compress(elem->getLogId());
+    }
+}
+
+// Fold the payloads of the oldest entries that every reader is done with
+// into a LogBufferBlock, once a block's worth of payload has been logged
+// since the last attempt. That leaves at least about a block of the most
+// recent entries as they are, for the chatty filter and tail readers.
+// A reader flushes an entry without holding the lock, so entries at or
+// past the oldest reader are left alone, as they are by prune().
+//
+// LogBuffer::wrlock() must be held when this function is called.
+void LogBuffer::compress(log_id_t id) {
+    if (mCompressPending[id] < LogBufferBlock::blockSize) return;
+    mCompressPending[id] = 0;
+
+    LogBufferElementCollection& elements = mLogElements[id];
+    log_time watermark(log_time::EPOCH);
+    size_t tail = 0;
+    for (LogBufferElementCollection::reverse_iterator it = elements.rbegin();
+         it != elements.rend(); ++it) {
+        tail += (*it)->getMsgLen();
+        if (tail >= LogBufferBlock::blockSize) {
+            watermark = (*it)->getRealTime();
+            break;
+        }
+    }
+    if (watermark == log_time::EPOCH) return;
+
+    LogTimeEntry::rdlock();
+    LastLogTimes::iterator times = mTimes.begin();
+    while (times != mTimes.end()) {
+        LogTimeEntry* entry = (*times);
+        if (entry->owned_Locked() && entry->isWatching(id) &&
+            (entry->mStart < watermark)) {
+            watermark = entry->mStart;
+        }
+        times++;
+    }
+    LogTimeEntry::unlock();
+
+    // a text payload is at least a priority and two NULs
+    static const size_t maxPayloads = LogBufferBlock::blockSize / 3;
+    static struct iovec payloads[maxPayloads];
+    static LogBufferElement* batch[maxPayloads];
+    size_t count = 0;
+    size_t size = 0;
+
+    LogBufferElementCollection::iterator it =
+        mCompressCursorSet[id] ? std::next(mCompressCursor[id])
+                               : elements.begin();
+    LogBufferElementCollection::iterator last = it;
+    for (; it != elements.end(); ++it) {
+        LogBufferElement* element = *it;
+        if (element->getRealTime() >= watermark) break;
+        unsigned short len = element->getMsgLen();
+        if (len && !element->isCompressed()) {
+            if (((size + len) > LogBufferBlock::blockSize) ||
+                (count >= maxPayloads)) {
+                break;
+            }
+            payloads[count].iov_base = const_cast<char*>(element->getMsg());
+            payloads[count].iov_len = len;
+            batch[count++] = element;
+            size += len;
+        }
+        last = it;
+    }
+    // not a block's worth yet, wait for more to come our way
+    if (size < (LogBufferBlock::blockSize / 2)) return;
+
+    LogBufferBlock* block = LogBufferBlock::create(id, payloads, count);
+    if (block) {
+        size_t offset = 0;
+        for (size_t i = 0; i < count; ++i) {
+            batch[i]->compress(block, offset);
+            offset += payloads[i].iov_len;
+        }
+    }
+    mCompressCursor[id] = last;
+    mCompressCursorSet[id] = true;
+}
+
+void LogBuffer::wrlockWait() {
+    log_time begin(CLOCK_MONOTONIC);
+    pthread_rwlock_wrlock(&mLogElementsLock);
+    uint64_t ns = (log_time(CLOCK_MONOTONIC) - begin).nsec();
+
+    ++mWrlockWaits;
+    mWrlockWaitNs += ns;
+    if (ns > mWrlockMaxWaitNs) mWrlockMaxWaitNs = ns;
+    size_t bucket = 0;
+    uint64_t limit = 10000;  // 10us
+    while ((bucket < (wrlockBuckets - 1)) && (ns >= limit)) {
+        ++bucket;
+        limit *= 10;
+    }
+    ++mWrlockWaitHist[bucket];
+}
+
+size_t LogBuffer::sizesInMemory(log_id_t id) {
+    size_t sizes = stats.sizes(id);
+    if (!LogBufferBlock::isEnabled()) return sizes;
+    size_t raw = LogBufferBlock::rawSizeOf(id);
+    return (sizes > raw) ? (sizes - raw + LogBufferBlock::sizeOf(id)) : sizes;
 }
 
 // Prune at most 10% of the log entries or maxPrune, whichever is less.
 //
 // LogBuffer::wrlock() must be held when this function is called.
 void LogBuffer::maybePrune(log_id_t id) {
-    size_t sizes = stats.sizes(id);
+    size_t sizes = sizesInMemory(id);
     unsigned long maxSize = log_buffer_size(id);
     if (sizes > maxSize) {
         size_t sizeOver = sizes - ((maxSize * 9) / 10);
@@ -491,30 +685,23 @@ LogBufferElementCollection::iterator LogBuffer::erase(
         }
     }
 
-    bool setLast[LOG_ID_MAX];
-    bool doSetLast = false;
-    log_id_for_each(i) {
-        doSetLast |= setLast[i] = mLastSet[i] && (it == mLast[i]);
+    if (element->mIndexed) indexErase(id, it);
+
+    if (mCompressCursorSet[id] && (it == mCompressCursor[id])) {
+        if (it == mLogElements[id].begin()) {
+            mCompressCursorSet[id] = false;
+        } else {
+            mCompressCursor[id] = std::prev(it);
+        }
     }
+
 #ifdef DEBUG_CHECK_FOR_STALE_ENTRIES
     LogBufferElementCollection::iterator bad = it;
     int key = ((id == LOG_ID_EVENTS) || (id == LOG_ID_SECURITY))
                   ? element->getTag()
                   : element->getUid();
 #endif
-    it = mLogElements.erase(it);
-    if (doSetLast) {
-        log_id_for_each(i) {
-            if (setLast[i]) {
-                if (__predict_false(it == mLogElements.end())) {  // impossible
-                    mLastSet[i] = false;
-                    mLast[i] = mLogElements.begin();
-                } else {
-                    mLast[i] = it;  // push down the road as next-best-watermark
-                }
-            }
-        }
-    }
+    it = mLogElements[id].erase(it);
 #ifdef DEBUG_CHECK_FOR_STALE_ENTRIES
     log_id_for_each(i) {
         for (auto b : mLastWorst[i]) {
@@ -529,11 +716,6 @@ LogBufferElementCollection::iterator LogBuffer::erase(
                                  b.first);
             }
         }
-        if (mLastSet[i] && (bad == mLast[i])) {
-            android::prdebug("stale mLast[%d]\n", i);
-            mLastSet[i] = false;
-            mLast[i] = mLogElements.begin();
-        }
     }
 #endif
     if (coalesce) {
@@ -622,16 +804,16 @@ class LogBufferElementLast {
 // the caller will use this result to set an internal busy flag indicating
 // the prune operation could not be completed because a reader is blocking
 // the request.
-bool LogBuffer::isBusy(log_time watermark) {
-    LogBufferElementCollection::iterator ei = mLogElements.end();
-    --ei;
-    return watermark < ((*ei)->getRealTime() - pruneMargin - log_time(1, 0));
+bool LogBuffer::isBusy(log_id_t id, log_time watermark) {
+    return watermark <
+           (mLogElements[id].back()->getRealTime() - pruneMargin -
+            log_time(1, 0));
 }
 
 // If the selected reader is blocking our pruning progress, decide on
 // what kind of mitigation is necessary to unblock the situation.
 void LogBuffer::kickMe(LogTimeEntry* me, log_id_t id, unsigned long pruneRows) {
-    if (stats.sizes(id) > (2 * log_buffer_size(id))) {  // +100%
+    if (sizesInMemory(id) > (2 * log_buffer_size(id))) {  // +100%
         // A misbehaving or slow reader has its connection
         // dropped if we hit too much memory pressure.
         me->release_Locked();
@@ -714,28 +896,23 @@ bool LogBuffer::prune(log_id_t id, unsigned long pruneRows, uid_t caller_uid) {
     log_time watermark(log_time::tv_sec_max, log_time::tv_nsec_max);
     if (oldest) watermark = oldest->mStart - pruneMargin;
 
+    LogBufferElementCollection& elements = mLogElements[id];
     LogBufferElementCollection::iterator it;
 
     if (__predict_false(caller_uid != AID_ROOT)) {  // unlikely
         // Only here if clear all request from non system source, so chatty
         // filter logistics is not required.
-        it = mLastSet[id] ? mLast[id] : mLogElements.begin();
-        while (it != mLogElements.end()) {
+        it = elements.begin();
+        while (it != elements.end()) {
             LogBufferElement* element = *it;
 
-            if ((element->getLogId() != id) ||
-                (element->getUid() != caller_uid)) {
+            if (element->getUid() != caller_uid) {
                 ++it;
                 continue;
             }
 
-            if (!mLastSet[id] || ((*mLast[id])->getLogId() != id)) {
-                mLast[id] = it;
-                mLastSet[id] = true;
-            }
-
             if (oldest && (watermark <= element->getRealTime())) {
-                busy = isBusy(watermark);
+                busy = isBusy(id, watermark);
                 if (busy) kickMe(oldest, id, pruneRows);
                 break;
             }
@@ -751,7 +928,7 @@ bool LogBuffer::prune(log_id_t id, unsigned long pruneRows, uid_t caller_uid) {
 
     // prune by worst offenders; by blacklist, UID, and by PID of system UID
     bool hasBlacklist = (id != LOG_ID_SECURITY) && mPrune.naughty();
-    while (!clearAll && (pruneRows > 0)) {
+    while (!clearAll && (pruneRows > 0) && !elements.empty()) {
         // recalculate the worst offender on every batched pass
         int worst = -1;  // not valid for getUid() or getKey()
         size_t worst_sizes = 0;
@@ -763,18 +940,16 @@ bool LogBuffer::prune(log_id_t id, unsigned long pruneRows, uid_t caller_uid) {
             size_t threshold = log_buffer_size(id) / 8;
 
             if ((id == LOG_ID_EVENTS) || (id == LOG_ID_SECURITY)) {
-                stats.sortTags(AID_ROOT, (pid_t)0, 2, id)
-                    .findWorst(worst, worst_sizes, second_worst_sizes,
-                               threshold);
+                stats.worstTags(id).findWorst(worst, worst_sizes,
+                                              second_worst_sizes, threshold);
                 // per-pid filter for AID_SYSTEM sources is too complex
             } else {
-                stats.sort(AID_ROOT, (pid_t)0, 2, id)
-                    .findWorst(worst, worst_sizes, second_worst_sizes,
-                               threshold);
+                stats.worst(id).findWorst(worst, worst_sizes,
+                                          second_worst_sizes, threshold);
 
                 if ((worst == AID_SYSTEM) && mPrune.worstPidOfSystemEnabled()) {
-                    stats.sortPids(worst, (pid_t)0, 2, id)
-                        .findWorst(worstPid, worst_sizes, second_worst_sizes);
+                    stats.worstPids(id).findWorst(worstPid, worst_sizes,
+                                                  second_worst_sizes);
                 }
             }
         }
@@ -786,7 +961,7 @@ bool LogBuffer::prune(log_id_t id, unsigned long pruneRows, uid_t caller_uid) {
 
         bool kick = false;
         bool leading = true;
-        it = mLastSet[id] ? mLast[id] : mLogElements.begin();
+        it = elements.begin();
         // Perform at least one mandatory garbage collection cycle in following
         // - clear leading chatty tags
         // - coalesce chatty tags
@@ -797,7 +972,7 @@ bool LogBuffer::prune(log_id_t id, unsigned long pruneRows, uid_t caller_uid) {
                 LogBufferIteratorMap::iterator found =
                     mLastWorst[id].find(worst);
                 if ((found != mLastWorst[id].end()) &&
-                    (found->second != mLogElements.end())) {
+                    (found->second != elements.end())) {
                     leading = false;
                     it = found->second;
                 }
@@ -808,7 +983,7 @@ bool LogBuffer::prune(log_id_t id, unsigned long pruneRows, uid_t caller_uid) {
                 LogBufferPidIteratorMap::iterator found =
                     mLastWorstPidOfSystem[id].find(worstPid);
                 if ((found != mLastWorstPidOfSystem[id].end()) &&
-                    (found->second != mLogElements.end())) {
+                    (found->second != elements.end())) {
                     leading = false;
                     it = found->second;
                 }
@@ -816,29 +991,18 @@ bool LogBuffer::prune(log_id_t id, unsigned long pruneRows, uid_t caller_uid) {
         }
         static const timespec too_old = { EXPIRE_HOUR_THRESHOLD * 60 * 60, 0 };
         LogBufferElementCollection::iterator lastt;
-        lastt = mLogElements.end();
+        lastt = elements.end();
         --lastt;
         LogBufferElementLast last;
-        while (it != mLogElements.end()) {
+        while (it != elements.end()) {
             LogBufferElement* element = *it;
 
             if (oldest && (watermark <= element->getRealTime())) {
-                busy = isBusy(watermark);
+                busy = isBusy(id, watermark);
                 // Do not let chatty eliding trigger any reader mitigation
                 break;
             }
 
-            if (element->getLogId() != id) {
-                ++it;
-                continue;
-            }
-            // below this point element->getLogId() == id
-
-            if (leading && (!mLastSet[id] || ((*mLast[id])->getLogId() != id))) {
-                mLast[id] = it;
-                mLastSet[id] = true;
-            }
-
             unsigned short dropped = element->getDropped();
 
             // remove any leading drops
@@ -930,6 +1094,7 @@ bool LogBuffer::prune(log_id_t id, unsigned long pruneRows, uid_t caller_uid) {
                 if (last.coalesce(element, 1)) {
                     it = erase(it, true);
                 } else {
+                    *it = element = LogBufferElement::relocate(element);
                     last.add(element);
                     if (worstPid &&
                         (!gc || (mLastWorstPidOfSystem[id].find(worstPid) ==
@@ -960,22 +1125,12 @@ bool LogBuffer::prune(log_id_t id, unsigned long pruneRows, uid_t caller_uid) {
 
     bool whitelist = false;
     bool hasWhitelist = (id != LOG_ID_SECURITY) && mPrune.nice() && !clearAll;
-    it = mLastSet[id] ? mLast[id] : mLogElements.begin();
-    while ((pruneRows > 0) && (it != mLogElements.end())) {
+    it = elements.begin();
+    while ((pruneRows > 0) && (it != elements.end())) {
         LogBufferElement* element = *it;
 
-        if (element->getLogId() != id) {
-            it++;
-            continue;
-        }
-
-        if (!mLastSet[id] || ((*mLast[id])->getLogId() != id)) {
-            mLast[id] = it;
-            mLastSet[id] = true;
-        }
-
         if (oldest && (watermark <= element->getRealTime())) {
-            busy = isBusy(watermark);
+            busy = isBusy(id, watermark);
             if (!whitelist && busy) kickMe(oldest, id, pruneRows);
             break;
         }
@@ -993,22 +1148,12 @@ bool LogBuffer::prune(log_id_t id, unsigned long pruneRows, uid_t caller_uid) {
 
     // Do not save the whitelist if we are reader range limited
     if (whitelist && (pruneRows > 0)) {
-        it = mLastSet[id] ? mLast[id] : mLogElements.begin();
-        while ((it != mLogElements.end()) && (pruneRows > 0)) {
+        it = elements.begin();
+        while ((it != elements.end()) && (pruneRows > 0)) {
             LogBufferElement* element = *it;
 
-            if (element->getLogId() != id) {
-                ++it;
-                continue;
-            }
-
-            if (!mLastSet[id] || ((*mLast[id])->getLogId() != id)) {
-                mLast[id] = it;
-                mLastSet[id] = true;
-            }
-
             if (oldest && (watermark <= element->getRealTime())) {
-                busy = isBusy(watermark);
+                busy = isBusy(id, watermark);
                 if (busy) kickMe(oldest, id, pruneRows);
                 break;
             }
@@ -1068,7 +1213,7 @@ bool LogBuffer::clear(log_id_t id, uid_t uid) {
 // get the used space associated with "id".
 unsigned long LogBuffer::getSizeUsed(log_id_t id) {
     rdlock();
-    size_t retval = stats.sizes(id);
+    size_t retval = sizesInMemory(id);
     unlock();
     return retval;
 }
@@ -1093,43 +1238,155 @@ unsigned long LogBuffer::getSize(log_id_t id) {
     return retval;
 }
 
+// Index the element just appended to id, if it is due. Only appended
+// entries that keep the index in time order are considered, out-of-order
+// inserts near the end defer the duty to the next append.
+//
+// LogBuffer::wrlock() must be held when this function is called.
+void LogBuffer::indexAppend(log_id_t id) {
+    if (mIndexCountdown[id]) {
+        --mIndexCountdown[id];
+        return;
+    }
+    LogBufferElementCollection::iterator it = --mLogElements[id].end();
+    LogBufferElement* element = *it;
+    LogBufferIndex& index = mIndex[id];
+    if (!index.empty() && (element->getRealTime() < index.back().realtime)) {
+        return;
+    }
+    element->mIndexed = true;
+    index.push_back({ element->getRealTime(), it });
+    mIndexCountdown[id] = indexInterval - 1;
+}
+
+bool LogBuffer::indexCompare(const LogBufferIndexEntry& entry,
+                             const log_time& realtime) {
+    return entry.realtime < realtime;
+}
+
+// The indexed element "it" is about to be erased. Hand its entry down to
+// the following element when that keeps the index sorted, else drop it.
+//
+// LogBuffer::wrlock() must be held when this function is called.
+void LogBuffer::indexErase(log_id_t id,
+                           LogBufferElementCollection::iterator it) {
+    LogBufferIndex& index = mIndex[id];
+    // pruning expires the oldest entries, check the front first
+    LogBufferIndex::iterator entry = index.begin();
+    if ((entry == index.end()) || (entry->it != it)) {
+        entry = std::lower_bound(index.begin(), index.end(),
+                                 (*it)->getRealTime(), indexCompare);
+        while ((entry != index.end()) && (entry->it != it)) ++entry;
+        if (entry == index.end()) return;  // paranoia
+    }
+    (*it)->mIndexed = false;
+
+    LogBufferElementCollection::iterator next = std::next(it);
+    LogBufferIndex::iterator following = std::next(entry);
+    if ((next != mLogElements[id].end()) && !(*next)->mIndexed &&
+        ((*next)->getRealTime() >= entry->realtime) &&
+        ((following == index.end()) ||
+         ((*next)->getRealTime() <= following->realtime))) {
+        (*next)->mIndexed = true;
+        entry->realtime = (*next)->getRealTime();
+        entry->it = next;
+        return;
+    }
+    index.erase(entry);
+}
+
+// Timestamps were rewritten in place, start the index over.
+//
+// LogBuffer::wrlock() must be held when this function is called.
+void LogBuffer::indexRebuild(log_id_t id) {
+    mIndex[id].clear();
+    mIndexCountdown[id] = 0;
+    LogBufferElementCollection& elements = mLogElements[id];
+    for (LogBufferElementCollection::iterator it = elements.begin();
+         it != elements.end(); ++it) {
+        LogBufferElement* element = *it;
+        element->mIndexed = false;
+        if (mIndexCountdown[id]) {
+            --mIndexCountdown[id];
+            continue;
+        }
+        if (!mIndex[id].empty() &&
+            (element->getRealTime() < mIndex[id].back().realtime)) {
+            continue;
+        }
+        element->mIndexed = true;
+        mIndex[id].push_back({ element->getRealTime(), it });
+        mIndexCountdown[id] = indexInterval - 1;
+    }
+}
+
+// Return the first element of id newer than start. Entries may be out of
+// order by up to pruneMargin, so scanning starts at the last index entry
+// outside of that window and must also step past any entry at start, or
+// older than the window, before settling.
+//
+// LogBuffer::rdlock() must be held when this function is called.
+LogBufferElementCollection::iterator LogBuffer::indexSeek(
+    log_id_t id, const log_time& start) {
+    LogBufferElementCollection& elements = mLogElements[id];
+    LogBufferIndex& index = mIndex[id];
+
+    log_time min = start - pruneMargin;
+    log_time max = start + pruneMargin;
+
+    LogBufferIndex::iterator entry =
+        std::lower_bound(index.begin(), index.end(), min, indexCompare);
+    LogBufferElementCollection::iterator it =
+        (entry == index.begin()) ? elements.begin() : std::prev(entry)->it;
+
+    LogBufferElementCollection::iterator retval = elements.end();
+    for (; it != elements.end(); ++it) {
+        log_time realtime = (*it)->getRealTime();
+        if (realtime > start) {
+            if (retval == elements.end()) retval = it;
+            if (realtime > max) break;
+        } else if ((realtime == start) || (realtime < min)) {
+            retval = elements.end();
+        }
+    }
+    return retval;
+}
+
+// Pick the oldest of the per log id cursors, ties go to the lower log id.
+static log_id_t nextLogId(LogBufferElementCollection::iterator it[LOG_ID_MAX],
+                          LogBufferElementCollection elements[LOG_ID_MAX]) {
+    log_id_t retval = LOG_ID_MAX;
+    log_id_for_each(i) {
+        if ((it[i] != elements[i].end()) &&
+            ((retval == LOG_ID_MAX) ||
+             ((*it[i])->getRealTime() < (*it[retval])->getRealTime()))) {
+            retval = i;
+        }
+    }
+    return retval;
+}
+
 log_time LogBuffer::flushTo(SocketClient* reader, const log_time& start,
                             pid_t* lastTid, bool privileged, bool security,
                             int (*filter)(const LogBufferElement* element,
                                           void* arg),
-                            void* arg) {
-    LogBufferElementCollection::iterator it;
+                            void* arg, LogReaderRing* ring,
+                            unsigned int logMask) {
+    LogBufferElementCollection::iterator it[LOG_ID_MAX];
     uid_t uid = reader->getUid();
 
     rdlock();
 
-    if (start == log_time::EPOCH) {
-        // client wants to start from the beginning
-        it = mLogElements.begin();
-    } else {
-        // 3 second limit to continue search for out-of-order entries.
-        log_time min = start - pruneMargin;
-
-        // Cap to 300 iterations we look back for out-of-order entries.
-        size_t count = 300;
-
-        // Client wants to start from some specified time. Chances are
-        // we are better off starting from the end of the time sorted list.
-        LogBufferElementCollection::iterator last;
-        for (last = it = mLogElements.end(); it != mLogElements.begin();
-             /* do nothing */) {
-            --it;
-            LogBufferElement* element = *it;
-            if (element->getRealTime() > start) {
-                last = it;
-            } else if (element->getRealTime() == start) {
-                last = ++it;
-                break;
-            } else if (!--count || (element->getRealTime() < min)) {
-                break;
-            }
+    log_id_for_each(i) {
+        LogBufferElementCollection& elements = mLogElements[i];
+        // Not even walked, prune() does not wait on us for these
+        if (!(logMask & (1 << i)) || (!security && (i == LOG_ID_SECURITY))) {
+            it[i] = elements.end();
+            continue;
         }
-        it = last;
+        // client wants to start from the beginning, or some specified time
+        it[i] = (start == log_time::EPOCH) ? elements.begin()
+                                           : indexSeek(i, start);
     }
 
     log_time curr = start;
@@ -1137,8 +1394,17 @@ log_time LogBuffer::flushTo(SocketClient* reader, const log_time& start,
     LogBufferElement* lastElement = nullptr;  // iterator corruption paranoia
     static const size_t maxSkip = 4194304;    // maximum entries to skip
     size_t skip = maxSkip;
-    for (; it != mLogElements.end(); ++it) {
-        LogBufferElement* element = *it;
+    // Let writers in at least this often when skipping over entries
+    static const size_t maxHold = 256;
+    size_t hold = maxHold;
+    for (log_id_t id; (id = nextLogId(it, mLogElements)) != LOG_ID_MAX;
+         ++it[id]) {
+        if (!--hold) {
+            unlock();
+            rdlock();
+            hold = maxHold;
+        }
+        LogBufferElement* element = *it[id];
 
         if (!--skip) {
             android::prdebug("reader.per: too many elements skipped");
@@ -1154,10 +1420,6 @@ log_time LogBuffer::flushTo(SocketClient* reader, const log_time& start,
             continue;
         }
 
-        if (!security && (element->getLogId() == LOG_ID_SECURITY)) {
-            continue;
-        }
-
         // NB: calling out to another object with wrlock() held (safe)
         if (filter) {
             int ret = (*filter)(element, arg);
@@ -1171,26 +1433,27 @@ log_time LogBuffer::flushTo(SocketClient* reader, const log_time& start,
 
         bool sameTid = false;
         if (lastTid) {
-            sameTid = lastTid[element->getLogId()] == element->getTid();
+            sameTid = lastTid[id] == element->getTid();
             // Dropped (chatty) immediately following a valid log from the
             // same source in the same log buffer indicates we have a
             // multiple identical squash.  chatty that differs source
             // is due to spam filter.  chatty to chatty of different
             // source is also due to spam filter.
-            lastTid[element->getLogId()] =
+            lastTid[id] =
                 (element->getDropped() && !sameTid) ? 0 : element->getTid();
         }
 
         unlock();
 
         // range locking in LastLogTimes looks after us
-        curr = element->flushTo(reader, this, privileged, sameTid);
+        curr = element->flushTo(reader, this, privileged, sameTid, ring);
 
         if (curr == element->FLUSH_ERROR) {
             return curr;
         }
 
         skip = maxSkip;
+        hold = maxHold;
         rdlock();
     }
     unlock();
@@ -1204,6 +1467,21 @@ std::string LogBuffer::formatStatistics(uid_t uid, pid_t pid,
 
     std::string ret = stats.format(uid, pid, logMask);
 
+    ret += android::base::StringPrintf(
+        "\nIngestion queue: depth %zu (max %zu) batches %zu elements %zu"
+        " largest batch %zu full %zu\n",
+        mQueue.depth(), mQueueMaxDepth, mQueueBatches, mQueueElements,
+        mQueueMaxBatch, mQueueFull);
+
+    ret += android::base::StringPrintf(
+        "Write lock: taken %zu waited %zu (<10us %zu <100us %zu <1ms %zu"
+        " <10ms %zu more %zu) total %" PRIu64 "us max %" PRIu64 "us\n",
+        mWrlockCount, mWrlockWaits, mWrlockWaitHist[0], mWrlockWaitHist[1],
+        mWrlockWaitHist[2], mWrlockWaitHist[3], mWrlockWaitHist[4],
+        mWrlockWaitNs / 1000, mWrlockMaxWaitNs / 1000);
+
+    ret += LogBufferBlock::formatStatistics();
+
     unlock();
 
     return ret;
@@ -19,6 +19,8 @@
 
 #include <sys/types.h>
 
+#include <atomic>
+#include <deque>
 #include <list>
 #include <string>
 
@@ -28,6 +30,7 @@
 
 #include "LogBufferElement.h"
 #include "LogBufferInterface.h"
+#include "LogBufferQueue.h"
 #include "LogStatistics.h"
 #include "LogTags.h"
 #include "LogTimes.h"
@@ -76,15 +79,14 @@ static bool isMonotonic(const log_time& mono) {
 typedef std::list<LogBufferElement*> LogBufferElementCollection;
 
 class LogBuffer : public LogBufferInterface {
-    LogBufferElementCollection mLogElements;
+    // Time sorted entries, one collection per log id so that pruning never
+    // has to walk past entries belonging to other log ids. Readers merge.
+    LogBufferElementCollection mLogElements[LOG_ID_MAX];
     pthread_rwlock_t mLogElementsLock;
 
     LogStatistics stats;
 
     PruneList mPrune;
-    // watermark for last per log id
-    LogBufferElementCollection::iterator mLast[LOG_ID_MAX];
-    bool mLastSet[LOG_ID_MAX];
     // watermark of any worst/chatty uid processing
     typedef std::unordered_map<uid_t, LogBufferElementCollection::iterator>
         LogBufferIteratorMap;
@@ -94,8 +96,38 @@ class LogBuffer : public LogBufferInterface {
         LogBufferPidIteratorMap;
     LogBufferPidIteratorMap mLastWorstPidOfSystem[LOG_ID_MAX];
 
+    // Sparse, time sorted seek index, one entry per indexInterval elements
+    // appended to each log id, so readers starting at a given time do not
+    // have to walk the collection to find their place.
+    struct LogBufferIndexEntry {
+        log_time realtime;
+        LogBufferElementCollection::iterator it;
+    };
+    typedef std::deque<LogBufferIndexEntry> LogBufferIndex;
+    static constexpr size_t indexInterval = 64;
+    LogBufferIndex mIndex[LOG_ID_MAX];
+    size_t mIndexCountdown[LOG_ID_MAX];
+    static bool indexCompare(const LogBufferIndexEntry& entry,
+                             const log_time& realtime);
+    void indexAppend(log_id_t id);
+    void indexErase(log_id_t id, LogBufferElementCollection::iterator it);
+    void indexRebuild(log_id_t id);
+    LogBufferElementCollection::iterator indexSeek(log_id_t id,
+                                                   const log_time& start);
+
     unsigned long mMaxSize[LOG_ID_MAX];
 
+    // Cold text entries have their payloads folded into LogBufferBlocks,
+    // oldest first. mCompressCursor is the newest entry considered so far,
+    // if mCompressCursorSet, and mCompressPending counts the payload bytes
+    // logged since the last attempt.
+    LogBufferElementCollection::iterator mCompressCursor[LOG_ID_MAX];
+    bool mCompressCursorSet[LOG_ID_MAX];
+    size_t mCompressPending[LOG_ID_MAX];
+    void compress(log_id_t id);
+    // stats.sizes(id), counting compressed payloads at their deflated size
+    size_t sizesInMemory(log_id_t id);
+
     bool monotonic;
 
     LogTags tags;
@@ -104,6 +136,30 @@ class LogBuffer : public LogBufferInterface {
     LogBufferElement* droppedElements[LOG_ID_MAX];
     void log(LogBufferElement* elem);
 
+    // Writers stage entries here, the writer holding mCommitting drains
+    // them into the buffer in batches (see drainQueue()).
+    LogBufferQueue mQueue;
+    std::atomic<bool> mCommitting;
+    // Ingestion statistics, protected by wrlock()
+    size_t mQueueFull;
+    size_t mQueueBatches;
+    size_t mQueueElements;
+    size_t mQueueMaxBatch;
+    size_t mQueueMaxDepth;
+    void drainQueue();
+    size_t commitQueue_Locked();
+    void commit(LogBufferElement* elem);
+
+    // Write lock acquisition latency, protected by wrlock(). Only waits
+    // are timed, the uncontended case is a single trywrlock.
+    static const size_t wrlockBuckets = 5;  // <10us <100us <1ms <10ms more
+    size_t mWrlockCount;
+    size_t mWrlockWaits;
+    size_t mWrlockWaitHist[wrlockBuckets];
+    uint64_t mWrlockWaitNs;
+    uint64_t mWrlockMaxWaitNs;
+    void wrlockWait();
+
    public:
     LastLogTimes& mTimes;
 
@@ -124,7 +180,8 @@ class LogBuffer : public LogBufferInterface {
                      bool privileged, bool security,
                      int (*filter)(const LogBufferElement* element,
                                    void* arg) = nullptr,
-                     void* arg = nullptr);
+                     void* arg = nullptr, LogReaderRing* ring = nullptr,
+                     unsigned int logMask = -1);
 
     bool clear(log_id_t id, uid_t uid = AID_ROOT);
     unsigned long getSize(log_id_t id);
@@ -140,8 +197,8 @@ class LogBuffer : public LogBufferInterface {
     int initPrune(const char* cp) {
         return mPrune.init(cp);
     }
-    std::string formatPrune() {
-        return mPrune.format();
+    std::string formatPrune(bool hits = false) {
+        return mPrune.format(hits);
     }
 
     std::string formatGetEventTag(uid_t uid, const char* name,
@@ -169,7 +226,8 @@ class LogBuffer : public LogBufferInterface {
         return stats.uidToName(uid);
     }
     void wrlock() {
-        pthread_rwlock_wrlock(&mLogElementsLock);
+        if (pthread_rwlock_trywrlock(&mLogElementsLock)) wrlockWait();
+        ++mWrlockCount;
     }
     void rdlock() {
         pthread_rwlock_rdlock(&mLogElementsLock);
@@ -184,7 +242,7 @@ class LogBuffer : public LogBufferInterface {
     static const log_time pruneMargin;
 
     void maybePrune(log_id_t id);
-    bool isBusy(log_time watermark);
+    bool isBusy(log_id_t id, log_time watermark);
     void kickMe(LogTimeEntry* me, log_id_t id, unsigned long pruneRows);
 
     bool prune(log_id_t id, unsigned long pruneRows, uid_t uid = AID_ROOT);
@@ -0,0 +1,121 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdlib.h>
+
+#include "LogBufferArena.h"
+
+bool LogBufferArena::enabled = false;
+LogBufferArena LogBufferArena::arenas[LOG_ID_MAX];
+
+// Each block carries its owning chunk (or nullptr) in front of the payload
+static constexpr size_t prefixSize = sizeof(void*);
+
+static inline size_t blockSize(size_t size) {
+    return (prefixSize + size + (sizeof(void*) - 1)) & ~(sizeof(void*) - 1);
+}
+
+LogBufferArena::LogBufferArena()
+    : mHead(nullptr), mSpare(nullptr), mChunks(0) {
+    pthread_mutex_init(&mLock, nullptr);
+}
+
+// mLock must be held
+LogBufferArena::Chunk* LogBufferArena::newChunk() {
+    Chunk* chunk = mSpare;
+    if (chunk) {
+        mSpare = nullptr;
+    } else {
+        chunk = static_cast<Chunk*>(malloc(chunkSize));
+        if (!chunk) return nullptr;
+        ++mChunks;
+    }
+    chunk->arena = this;
+    chunk->used = 0;
+    chunk->live = 0;
+    return chunk;
+}
+
+void* LogBufferArena::allocate(size_t size) {
+    size_t total = blockSize(size);
+    if (total > chunkCapacity) return nullptr;
+
+    pthread_mutex_lock(&mLock);
+    Chunk* chunk = mHead;
+    if (!chunk || ((chunk->used + total) > chunkCapacity)) {
+        if (chunk && !chunk->live) {
+            chunk->used = 0;  // everything carved from it already released
+        } else {
+            chunk = newChunk();
+            if (!chunk) {
+                pthread_mutex_unlock(&mLock);
+                return nullptr;
+            }
+            mHead = chunk;
+        }
+    }
+    void** block = reinterpret_cast<void**>(chunk->data + chunk->used);
+    chunk->used += total;
+    ++chunk->live;
+    pthread_mutex_unlock(&mLock);
+
+    *block = chunk;
+    return block + 1;
+}
+
+void LogBufferArena::release(Chunk* chunk) {
+    pthread_mutex_lock(&mLock);
+    if (!--chunk->live && (chunk != mHead)) {
+        if (!mSpare) {
+            mSpare = chunk;
+        } else {
+            free(chunk);
+            --mChunks;
+        }
+    }
+    pthread_mutex_unlock(&mLock);
+}
+
+void* LogBufferArena::allocate(log_id_t id, size_t size) {
+    if (enabled && (id >= LOG_ID_MIN) && (id < LOG_ID_MAX)) {
+        void* ptr = arenas[id].allocate(size);
+        if (ptr) return ptr;
+    }
+    void** block = static_cast<void**>(malloc(prefixSize + size));
+    if (!block) abort();  // as operator new would without exceptions
+    *block = nullptr;
+    return block + 1;
+}
+
+void LogBufferArena::release(void* ptr) {
+    if (!ptr) return;
+    void** block = static_cast<void**>(ptr) - 1;
+    Chunk* chunk = static_cast<Chunk*>(*block);
+    if (!chunk) {
+        free(block);
+        return;
+    }
+    chunk->arena->release(chunk);
+}
+
+size_t LogBufferArena::sizeOf(log_id_t id) {
+    if ((id < LOG_ID_MIN) || (id >= LOG_ID_MAX)) return 0;
+    LogBufferArena& arena = arenas[id];
+    pthread_mutex_lock(&arena.mLock);
+    size_t retval = arena.mChunks * chunkSize;
+    pthread_mutex_unlock(&arena.mLock);
+    return retval;
+}
@@ -0,0 +1,79 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _LOGD_LOG_BUFFER_ARENA_H__
+#define _LOGD_LOG_BUFFER_ARENA_H__
+
+#include <pthread.h>
+#include <sys/types.h>
+
+#include <android-base/macros.h>
+#include <log/log_id.h>
+
+// Per log_id ring of fixed size chunks that LogBufferElement headers and
+// their payloads are bump allocated from. Entries arrive (and mostly expire)
+// in time order, so allocations for one log_id land next to each other and
+// a chunk is recycled as soon as the last entry carved from it is released.
+//
+// Every block handed out is preceded by a back pointer to its chunk, or
+// nullptr when it came from the heap (arena disabled, or log_id unknown),
+// so release() needs no other context. Thread safe.
+class LogBufferArena {
+    struct Chunk {
+        LogBufferArena* arena;
+        size_t used;   // bytes bump allocated from data
+        size_t live;   // blocks not yet released
+        char data[];
+    };
+
+    static constexpr size_t chunkSize = 64 * 1024;
+    static constexpr size_t chunkCapacity = chunkSize - sizeof(Chunk);
+
+    static bool enabled;
+    static LogBufferArena arenas[LOG_ID_MAX];
+
+    pthread_mutex_t mLock;
+    Chunk* mHead;   // chunk currently being carved
+    Chunk* mSpare;  // one released chunk kept back to avoid malloc churn
+    size_t mChunks;
+
+    Chunk* newChunk();
+    void* allocate(size_t size);
+    void release(Chunk* chunk);
+
+   public:
+    LogBufferArena();
+
+    // Selected once at startup, before any entries are logged.
+    static void enable(bool enable) {
+        LogBufferArena::enabled = enable;
+    }
+    static bool isEnabled() {
+        return enabled;
+    }
+
+    // log_id of LOG_ID_MAX always allocates from the heap
+    static void* allocate(log_id_t id, size_t size);
+    static void release(void* ptr);
+
+    // bytes of chunk storage held by the arena for id
+    static size_t sizeOf(log_id_t id);
+
+   private:
+    DISALLOW_COPY_AND_ASSIGN(LogBufferArena);
+};
+
+#endif  // _LOGD_LOG_BUFFER_ARENA_H__
@@ -0,0 +1,144 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <memory>
+#include <new>
+
+#include <android-base/stringprintf.h>
+#include <zlib.h>
+
+#include "LogBufferBlock.h"
+#include "LogStatistics.h"
+
+bool LogBufferBlock::enabled = false;
+uint64_t LogBufferBlock::nextId = 1;
+LogBufferBlock::Stats LogBufferBlock::stats[LOG_ID_MAX];
+
+namespace {
+struct InflateCache {
+    uint64_t id;
+    char data[LogBufferBlock::blockSize];
+};
+}
+
+// Last block each thread inflated, per log id since readers merge them
+static thread_local std::unique_ptr<InflateCache> inflateCache[LOG_ID_MAX];
+
+LogBufferBlock* LogBufferBlock::create(log_id_t id,
+                                       const struct iovec* payloads,
+                                       size_t count) {
+    if (!count || (id < LOG_ID_MIN) || (id >= LOG_ID_MAX)) return nullptr;
+
+    // serialized by the caller, spare the allocations
+    static unsigned char raw[blockSize];
+    static const uLong bound = compressBound(blockSize);
+    static unsigned char* deflated = static_cast<unsigned char*>(malloc(bound));
+    if (!deflated) return nullptr;
+
+    size_t rawSize = 0;
+    for (size_t i = 0; i < count; ++i) {
+        if ((rawSize + payloads[i].iov_len) > blockSize) return nullptr;
+        memcpy(raw + rawSize, payloads[i].iov_base, payloads[i].iov_len);
+        rawSize += payloads[i].iov_len;
+    }
+
+    uLongf size = bound;
+    if (compress2(deflated, &size, raw, rawSize, Z_BEST_SPEED) != Z_OK) {
+        return nullptr;
+    }
+    // A quarter saved, or it is not worth inflating on every read
+    if (size > (rawSize - (rawSize / 4))) return nullptr;
+
+    void* ptr = malloc(sizeof(LogBufferBlock) + size);
+    if (!ptr) return nullptr;
+    LogBufferBlock* block = new (ptr) LogBufferBlock;
+    block->mId = nextId++;
+    block->mRefs = count;
+    block->mRawSize = rawSize;
+    block->mSize = size;
+    block->mLogId = id;
+    memcpy(block->mData, deflated, size);
+
+    Stats& s = stats[id];
+    ++s.blocks;
+    s.rawSize += rawSize;
+    s.size += size;
+    return block;
+}
+
+void LogBufferBlock::release(size_t len) {
+    Stats& s = stats[mLogId];
+    s.rawSize -= len;
+    if (--mRefs) return;
+    --s.blocks;
+    s.size -= mSize;
+    this->~LogBufferBlock();
+    free(this);
+}
+
+const char* LogBufferBlock::inflate(size_t offset) const {
+    if (offset >= mRawSize) return nullptr;
+
+    std::unique_ptr<InflateCache>& cache = inflateCache[mLogId];
+    if (!cache) {
+        cache.reset(new (std::nothrow) InflateCache);
+        if (!cache) return nullptr;
+        cache->id = 0;
+    }
+    if (cache->id != mId) {
+        uLongf len = blockSize;
+        if ((uncompress(reinterpret_cast<Bytef*>(cache->data), &len, mData,
+                        mSize) != Z_OK) ||
+            (len != mRawSize)) {
+            cache->id = 0;
+            return nullptr;
+        }
+        cache->id = mId;
+        stats[mLogId].inflates.fetch_add(1, std::memory_order_relaxed);
+    }
+    return cache->data + offset;
+}
+
+size_t LogBufferBlock::sizeOf(log_id_t id) {
+    if ((id < LOG_ID_MIN) || (id >= LOG_ID_MAX)) return 0;
+    return stats[id].size;
+}
+
+size_t LogBufferBlock::rawSizeOf(log_id_t id) {
+    if ((id < LOG_ID_MIN) || (id >= LOG_ID_MAX)) return 0;
+    return stats[id].rawSize;
+}
+
+std::string LogBufferBlock::formatStatistics() {
+    if (!enabled) return "";
+
+    std::string ret = "\nCompressed entries:\n";
+    log_id_for_each(i) {
+        const Stats& s = stats[i];
+        if (!s.blocks) continue;
+        // a payload outliving its neighbours can pin a block on its own
+        size_t ratio = s.size ? (s.rawSize * 100) / s.size : 0;
+        ret += android::base::StringPrintf(
+            "%s: %zu blocks %zu bytes holding %zu (%zu.%02zux) inflated %zu\n",
+            android_log_id_to_name(i), s.blocks, s.size, s.rawSize,
+            ratio / 100, ratio % 100,
+            s.inflates.load(std::memory_order_relaxed));
+    }
+    return ret;
+}
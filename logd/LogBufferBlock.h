@@ -0,0 +1,91 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _LOGD_LOG_BUFFER_BLOCK_H__
+#define _LOGD_LOG_BUFFER_BLOCK_H__
+
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+#include <atomic>
+#include <string>
+
+#include <android-base/macros.h>
+#include <log/log_id.h>
+
+// The payloads of a run of cold entries of one log id, deflated together.
+// Each entry folded into a block references it in place of its own payload
+// and the last one to let go frees it. Log text is repetitive enough that a
+// block holds several times the entries the same memory did uncompressed.
+//
+// Blocks are immutable once created, so any number of readers may inflate
+// one at the same time; each thread keeps the last block it inflated for
+// each log id, as readers walk the entries in order. Creating and releasing
+// blocks must be serialized by the caller (LogBuffer::wrlock()).
+class LogBufferBlock {
+    uint64_t mId;  // never reused, identifies the block in inflate caches
+    uint32_t mRefs;
+    uint32_t mRawSize;
+    uint32_t mSize;
+    uint8_t mLogId;
+    unsigned char mData[];
+
+    struct Stats {
+        size_t blocks;
+        size_t rawSize;  // of the payloads still referencing blocks
+        size_t size;     // of the blocks
+        std::atomic<size_t> inflates;
+    };
+
+    static bool enabled;
+    static uint64_t nextId;
+    static Stats stats[LOG_ID_MAX];
+
+    LogBufferBlock() = default;
+
+   public:
+    // upper bound on the payloads of one block, offsets fit in 16 bits
+    static constexpr size_t blockSize = 32 * 1024;
+
+    // Selected once at startup, before any entries are logged.
+    static void enable(bool enable) {
+        LogBufferBlock::enabled = enable;
+    }
+    static bool isEnabled() {
+        return enabled;
+    }
+
+    // Deflates count payloads into a block referenced count times, or
+    // returns nullptr if they do not compress well enough to bother.
+    static LogBufferBlock* create(log_id_t id, const struct iovec* payloads,
+                                  size_t count);
+    // Lets go of one reference, for a payload of len bytes.
+    void release(size_t len);
+    // Returns the payload at offset, valid until the calling thread
+    // inflates another block of the same log id, or nullptr on error.
+    const char* inflate(size_t offset) const;
+
+    // bytes the blocks of id hold, and what their payloads took before
+    static size_t sizeOf(log_id_t id);
+    static size_t rawSizeOf(log_id_t id);
+    static std::string formatStatistics();
+
+   private:
+    DISALLOW_COPY_AND_ASSIGN(LogBufferBlock);
+};
+
+#endif  // _LOGD_LOG_BUFFER_BLOCK_H__
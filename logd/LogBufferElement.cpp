@@ -25,9 +25,12 @@
 #include <private/android_logger.h>
 
 #include "LogBuffer.h"
+#include "LogBufferArena.h"
+#include "LogBufferBlock.h"
 #include "LogBufferElement.h"
 #include "LogCommand.h"
 #include "LogReader.h"
+#include "LogReaderRing.h"
 #include "LogUtils.h"
 
 const log_time LogBufferElement::FLUSH_ERROR((uint32_t)-1, (uint32_t)-1);
@@ -42,8 +45,11 @@ LogBufferElement::LogBufferElement(log_id_t log_id, log_time realtime,
       mRealTime(realtime),
       mMsgLen(len),
       mLogId(log_id),
-      mDropped(false) {
-    mMsg = new char[len];
+      mDropped(false),
+      mIndexed(false),
+      mCompressed(false),
+      mBlockOffset(0) {
+    mMsg = static_cast<char*>(LogBufferArena::allocate(log_id, len));
     memcpy(mMsg, msg, len);
 }
 
@@ -54,13 +60,66 @@ LogBufferElement::LogBufferElement(const LogBufferElement& elem)
       mRealTime(elem.mRealTime),
       mMsgLen(elem.mMsgLen),
       mLogId(elem.mLogId),
-      mDropped(elem.mDropped) {
-    mMsg = new char[mMsgLen];
-    memcpy(mMsg, elem.mMsg, mMsgLen);
+      mDropped(elem.mDropped),
+      mIndexed(elem.mIndexed),
+      mCompressed(false),
+      mBlockOffset(0) {
+    // mMsgLen is the dropped count for chatty, only the tag header remains
+    size_t len = mDropped ? (elem.mMsg ? sizeof(android_event_header_t) : 0)
+                          : mMsgLen;
+    const char* msg = elem.mCompressed ? elem.inflate() : elem.mMsg;
+    if (!msg) len = 0;
+    mMsg = len ? static_cast<char*>(LogBufferArena::allocate(LOG_ID_MAX, len))
+               : nullptr;
+    if (len) memcpy(mMsg, msg, len);
 }
 
 LogBufferElement::~LogBufferElement() {
-    delete[] mMsg;
+    releaseMsg();
+}
+
+void LogBufferElement::releaseMsg() {
+    if (mCompressed) {
+        mBlock->release(mMsgLen);
+        mCompressed = false;
+    } else {
+        LogBufferArena::release(mMsg);
+    }
+    mMsg = nullptr;
+}
+
+const char* LogBufferElement::inflate() const {
+    return mBlock->inflate(mBlockOffset);
+}
+
+void LogBufferElement::compress(LogBufferBlock* block, size_t offset) {
+    LogBufferArena::release(mMsg);
+    mBlock = block;
+    mBlockOffset = offset;
+    mCompressed = true;
+}
+
+void* LogBufferElement::operator new(size_t size, log_id_t log_id) {
+    return LogBufferArena::allocate(log_id, size);
+}
+
+void* LogBufferElement::operator new(size_t size) {
+    return LogBufferArena::allocate(LOG_ID_MAX, size);
+}
+
+void LogBufferElement::operator delete(void* ptr, log_id_t /* log_id */) {
+    LogBufferArena::release(ptr);
+}
+
+void LogBufferElement::operator delete(void* ptr) {
+    LogBufferArena::release(ptr);
+}
+
+LogBufferElement* LogBufferElement::relocate(LogBufferElement* elem) {
+    if (!LogBufferArena::isEnabled()) return elem;
+    LogBufferElement* copy = new LogBufferElement(*elem);
+    delete elem;
+    return copy;
 }
 
 uint32_t LogBufferElement::getTag() const {
@@ -74,15 +133,18 @@ uint32_t LogBufferElement::getTag() const {
 unsigned short LogBufferElement::setDropped(unsigned short value) {
     // The tag information is saved in mMsg data, if the tag is non-zero
     // save only the information needed to get the tag.
-    if (getTag() != 0) {
+    if (mCompressed) {
+        releaseMsg();  // text only, there is no tag to save
+    } else if (getTag() != 0) {
         if (mMsgLen > sizeof(android_event_header_t)) {
-            char* truncated_msg = new char[sizeof(android_event_header_t)];
+            char* truncated_msg = static_cast<char*>(LogBufferArena::allocate(
+                LOG_ID_MAX, sizeof(android_event_header_t)));
             memcpy(truncated_msg, mMsg, sizeof(android_event_header_t));
-            delete[] mMsg;
+            LogBufferArena::release(mMsg);
             mMsg = truncated_msg;
         }  // mMsgLen == sizeof(android_event_header_t), already at minimum.
     } else {
-        delete[] mMsg;
+        LogBufferArena::release(mMsg);
         mMsg = nullptr;
     }
     mDropped = true;
@@ -229,7 +291,8 @@ size_t LogBufferElement::populateDroppedMessage(char*& buffer, LogBuffer* parent
 }
 
 log_time LogBufferElement::flushTo(SocketClient* reader, LogBuffer* parent,
-                                   bool privileged, bool lastSame) {
+                                   bool privileged, bool lastSame,
+                                   LogReaderRing* ring) {
     struct logger_entry_v4 entry;
 
     memset(&entry, 0, sizeof(struct logger_entry_v4));
@@ -254,14 +317,17 @@ log_time LogBufferElement::flushTo(SocketClient* reader, LogBuffer* parent,
         if (!entry.len) return mRealTime;
         iovec[1].iov_base = buffer;
     } else {
+        const char* msg = getMsg();
+        if (!msg) return mRealTime;
         entry.len = mMsgLen;
-        iovec[1].iov_base = mMsg;
+        iovec[1].iov_base = const_cast<char*>(msg);
     }
     iovec[1].iov_len = entry.len;
 
-    log_time retval = reader->sendDatav(iovec, 1 + (entry.len != 0))
-                          ? FLUSH_ERROR
-                          : mRealTime;
+    int iovcnt = 1 + (entry.len != 0);
+    bool error = ring ? !ring->write(reader, iovec, iovcnt)
+                      : reader->sendDatav(iovec, iovcnt);
+    log_time retval = error ? FLUSH_ERROR : mRealTime;
 
     if (buffer) free(buffer);
 
@@ -25,6 +25,8 @@
 #include <sysutils/SocketClient.h>
 
 class LogBuffer;
+class LogBufferBlock;
+class LogReaderRing;
 
 #define EXPIRE_HOUR_THRESHOLD 24  // Only expire chatty UID logs to preserve
                                   // non-chatty UIDs less than this age in hours
@@ -40,19 +42,27 @@ class __attribute__((packed)) LogBufferElement {
     const uint32_t mPid;
     const uint32_t mTid;
     log_time mRealTime;
-    char* mMsg;
+    union {
+        char* mMsg;              // mCompressed == false
+        LogBufferBlock* mBlock;  // mCompressed == true
+    };
     union {
         const uint16_t mMsgLen;  // mDropped == false
         uint16_t mDroppedCount;  // mDropped == true
     };
     const uint8_t mLogId;
     bool mDropped;
+    bool mIndexed;  // referenced by the LogBuffer seek index
+    bool mCompressed;
+    uint16_t mBlockOffset;  // of the payload within mBlock
 
     static atomic_int_fast64_t sequence;
 
     // assumption: mDropped == true
     size_t populateDroppedMessage(char*& buffer, LogBuffer* parent,
                                   bool lastSame);
+    const char* inflate() const;
+    void releaseMsg();
 
    public:
     LogBufferElement(log_id_t log_id, log_time realtime, uid_t uid, pid_t pid,
@@ -60,6 +70,19 @@ class __attribute__((packed)) LogBufferElement {
     LogBufferElement(const LogBufferElement& elem);
     ~LogBufferElement();
 
+    // Headers and payloads are carved from the per log_id LogBufferArena,
+    // the plain form (copies, internal book keeping) comes from the heap.
+    static void* operator new(size_t size, log_id_t log_id);
+    static void* operator new(size_t size);
+    static void operator delete(void* ptr, log_id_t log_id);
+    static void operator delete(void* ptr);
+    // Move a (chatty) element out of the arena so its long life does not
+    // pin a chunk of otherwise expired entries. Consumes elem.
+    static LogBufferElement* relocate(LogBufferElement* elem);
+    // Trade the payload for its copy at offset in block, which holds a
+    // reference for us.
+    void compress(LogBufferBlock* block, size_t offset);
+
     bool isBinary(void) const {
         return (mLogId == LOG_ID_EVENTS) || (mLogId == LOG_ID_SECURITY);
     }
@@ -84,8 +107,13 @@ class __attribute__((packed)) LogBufferElement {
     unsigned short getMsgLen() const {
         return mDropped ? 0 : mMsgLen;
     }
+    bool isCompressed() const {
+        return mCompressed;
+    }
+    // Compressed payloads are valid until the caller's next getMsg() of
+    // another compressed element of the same log id.
     const char* getMsg() const {
-        return mDropped ? nullptr : mMsg;
+        return mDropped ? nullptr : (mCompressed ? inflate() : mMsg);
     }
     log_time getRealTime(void) const {
         return mRealTime;
@@ -93,7 +121,7 @@ class __attribute__((packed)) LogBufferElement {
 
     static const log_time FLUSH_ERROR;
     log_time flushTo(SocketClient* writer, LogBuffer* parent, bool privileged,
-                     bool lastSame);
+                     bool lastSame, LogReaderRing* ring = nullptr);
 };
 
 #endif
@@ -0,0 +1,103 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _LOGD_LOG_BUFFER_QUEUE_H__
+#define _LOGD_LOG_BUFFER_QUEUE_H__
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <atomic>
+
+#include <android-base/macros.h>
+
+class LogBufferElement;
+
+// Bounded lock-free multi-producer, single-consumer queue of elements
+// staged for LogBuffer. Each cell carries a sequence number that tells a
+// producer whether the slot is free for its ticket, and the consumer whether
+// the slot has been published (see D. Vyukov's bounded MPMC queue). The
+// single consumer is whoever currently holds LogBuffer's commit role.
+class LogBufferQueue {
+    static constexpr size_t capacity = 1024;  // must be a power of two
+
+    struct Cell {
+        std::atomic<size_t> sequence;
+        LogBufferElement* element;
+    };
+
+    Cell mCells[capacity];
+    std::atomic<size_t> mEnqueuePos;
+    std::atomic<size_t> mDequeuePos;
+
+   public:
+    LogBufferQueue() : mEnqueuePos(0), mDequeuePos(0) {
+        for (size_t i = 0; i < capacity; ++i) {
+            mCells[i].sequence.store(i, std::memory_order_relaxed);
+            mCells[i].element = nullptr;
+        }
+    }
+
+    // Any thread. Returns false if the queue is full.
+    bool push(LogBufferElement* element) {
+        size_t pos = mEnqueuePos.load(std::memory_order_relaxed);
+        Cell* cell;
+        for (;;) {
+            cell = &mCells[pos & (capacity - 1)];
+            size_t seq = cell->sequence.load(std::memory_order_acquire);
+            intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+            if (diff == 0) {
+                if (mEnqueuePos.compare_exchange_weak(
+                        pos, pos + 1, std::memory_order_relaxed)) {
+                    break;
+                }
+            } else if (diff < 0) {
+                return false;
+            } else {
+                pos = mEnqueuePos.load(std::memory_order_relaxed);
+            }
+        }
+        cell->element = element;
+        cell->sequence.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Consumer only. Returns nullptr if nothing has been published.
+    LogBufferElement* pop() {
+        size_t pos = mDequeuePos.load(std::memory_order_relaxed);
+        Cell* cell = &mCells[pos & (capacity - 1)];
+        size_t seq = cell->sequence.load(std::memory_order_acquire);
+        if ((intptr_t)seq - (intptr_t)(pos + 1) < 0) {
+            return nullptr;
+        }
+        LogBufferElement* element = cell->element;
+        cell->sequence.store(pos + capacity, std::memory_order_release);
+        mDequeuePos.store(pos + 1, std::memory_order_relaxed);
+        return element;
+    }
+
+    // Approximate, includes claimed but not yet published cells
+    size_t depth() const {
+        size_t enqueue = mEnqueuePos.load(std::memory_order_relaxed);
+        size_t dequeue = mDequeuePos.load(std::memory_order_relaxed);
+        return (enqueue > dequeue) ? (enqueue - dequeue) : 0;
+    }
+
+   private:
+    DISALLOW_COPY_AND_ASSIGN(LogBufferQueue);
+};
+
+#endif  // _LOGD_LOG_BUFFER_QUEUE_H__
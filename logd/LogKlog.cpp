@@ -46,6 +46,57 @@ static const char batteryStr[] = ": battery ";
 static const char auditStr[] = " audit(";
 static const char klogdStr[] = "logd.klogd: ";
 
+template <size_t N>
+static bool matches(const char* s, const char* e, const char (&needle)[N]) {
+    return ((e - s) >= (ssize_t)(N - 1)) && !fastcmp<memcmp>(s, needle, N - 1);
+}
+
+// One pass over the message for all of the needles above, rather than one
+// android::strnstr per needle; most messages contain none of them.
+void LogKlog::findNeedles(const char* buf, ssize_t len, Needles& needles) {
+    memset(&needles, 0, sizeof(needles));
+    const char* healthd = nullptr;
+    const char* e = buf + len;
+    for (const char* s = buf; s < e; ++s) {
+        switch (*s) {
+            case 'P':
+                if (!needles.suspend && matches(s, e, suspendStr)) {
+                    needles.suspend = s;
+                } else if (!needles.resume && matches(s, e, resumeStr)) {
+                    needles.resume = s;
+                }
+                break;
+            case 'S':
+                if (!needles.suspended && matches(s, e, suspendedStr)) {
+                    needles.suspended = s;
+                }
+                break;
+            case 'h':
+                if (!healthd && matches(s, e, healthdStr)) {
+                    healthd = s;
+                }
+                break;
+            case ':':
+                if (healthd && !needles.battery &&
+                    (s >= (healthd + strlen(healthdStr))) &&
+                    matches(s, e, batteryStr)) {
+                    needles.battery = s;
+                }
+                break;
+            case ' ':
+                if (!needles.audit && matches(s, e, auditStr)) {
+                    needles.audit = s;
+                }
+                break;
+            case 'l':
+                if (!needles.klogd && matches(s, e, klogdStr)) {
+                    needles.klogd = s;
+                }
+                break;
+        }
+    }
+}
+
 // Parsing is hard
 
 // called if we see a '<', s is the next character, returns pointer after '>'
@@ -82,6 +133,30 @@ static char* is_timestamp(char* s, ssize_t len) {
     return nullptr;
 }
 
+// called if we see a '[', parses "[ %s.%q]" into now and returns pointer
+// after ']'. log_time::strptime would take a trip through localtime_r and
+// mktime for every message only to land on the same seconds.
+static const char* parse_timestamp(log_time& now, const char* s,
+                                   const char* e) {
+    while ((s < e) && isspace(*s)) ++s;
+    if ((s >= e) || !isdigit(*s)) return nullptr;
+    uint32_t sec = 0;
+    while ((s < e) && isdigit(*s)) {
+        sec = (sec * 10) + *s++ - '0';
+    }
+    if ((s >= e) || (*s++ != '.')) return nullptr;
+    uint32_t nsec = 0;
+    unsigned long multiplier = NS_PER_SEC;
+    while ((s < e) && isdigit(*s) && (multiplier > 1)) {
+        multiplier /= 10;
+        nsec += (*s++ - '0') * multiplier;
+    }
+    if ((s >= e) || (*s++ != ']')) return nullptr;
+    now.tv_sec = sec;
+    now.tv_nsec = nsec;
+    return s;
+}
+
 // Like strtok_r with "\r\n" except that we look for log signatures (regex)
 //  \(\(<[0-9]\{1,4\}>\)\([[] *[0-9]+[.][0-9]+[]] \)\{0,1\}\|[[]
 //  *[0-9]+[.][0-9]+[]] \)
@@ -210,7 +285,8 @@ LogKlog::LogKlog(LogBuffer* buf, LogReader* reader, int fdWrite, int fdRead,
       signature(CLOCK_MONOTONIC),
       initialized(false),
       enableLogging(true),
-      auditd(auditd) {
+      auditd(auditd),
+      tagCache() {
     static const char klogd_message[] = "%s%s%" PRIu64 "\n";
     char buffer[strlen(priority_message) + strlen(klogdStr) +
                 strlen(klogd_message) + 20];
@@ -226,7 +302,8 @@ bool LogKlog::onDataAvailable(SocketClient* cli) {
         enableLogging = false;
     }
 
-    char buffer[LOGGER_ENTRY_MAX_PAYLOAD];
+    // Room for several records per read(2) when the kernel is chatty.
+    char buffer[LOGGER_ENTRY_MAX_PAYLOAD * 4];
     ssize_t len = 0;
 
     for (;;) {
@@ -295,11 +372,18 @@ void LogKlog::calculateCorrection(const log_time& monotonic,
 
 void LogKlog::sniffTime(log_time& now, const char*& buf, ssize_t len,
                         bool reverse) {
+    Needles needles;
+    findNeedles(buf, len, needles);
+    sniffTime(now, buf, len, reverse, needles);
+}
+
+void LogKlog::sniffTime(log_time& now, const char*& buf, ssize_t len,
+                        bool reverse, const Needles& needles) {
     if (len <= 0) return;
 
     const char* cp = nullptr;
     if ((len > 10) && (*buf == '[')) {
-        cp = now.strptime(buf, "[ %s.%q]");  // can index beyond buffer bounds
+        cp = parse_timestamp(now, buf + 1, buf + len);
         if (cp && (cp > &buf[len - 1])) cp = nullptr;
     }
     if (cp) {
@@ -313,24 +397,22 @@ void LogKlog::sniffTime(log_time& now, const char*& buf, ssize_t len,
         if (isMonotonic()) return;
 
         const char* b;
-        if (((b = android::strnstr(cp, len, suspendStr))) &&
+        if (((b = needles.suspend)) && (b >= cp) &&
             (((b += strlen(suspendStr)) - cp) < len)) {
             len -= b - cp;
             calculateCorrection(now, b, len);
-        } else if (((b = android::strnstr(cp, len, resumeStr))) &&
+        } else if (((b = needles.resume)) && (b >= cp) &&
                    (((b += strlen(resumeStr)) - cp) < len)) {
             len -= b - cp;
             calculateCorrection(now, b, len);
-        } else if (((b = android::strnstr(cp, len, healthdStr))) &&
-                   (((b += strlen(healthdStr)) - cp) < len) &&
-                   ((b = android::strnstr(b, len -= b - cp, batteryStr))) &&
+        } else if (((b = needles.battery)) && (b >= cp) &&
                    (((b += strlen(batteryStr)) - cp) < len)) {
             // NB: healthd is roughly 150us late, so we use it instead to
             //     trigger a check for ntp-induced or hardware clock drift.
             log_time real(CLOCK_REALTIME);
             log_time mono(CLOCK_MONOTONIC);
             correction = (real < mono) ? log_time::EPOCH : (real - mono);
-        } else if (((b = android::strnstr(cp, len, suspendedStr))) &&
+        } else if (((b = needles.suspended)) && (b >= cp) &&
                    (((b += strlen(suspendStr)) - cp) < len)) {
             len -= b - cp;
             log_time real;
@@ -511,93 +593,15 @@ static const char* strnrchr(const char* s, ssize_t len, char c) {
     return save;
 }
 
-//
-// log a message into the kernel log buffer
-//
-// Filter rules to parse <PRI> <TIME> <tag> and <message> in order for
-// them to appear correct in the logcat output:
-//
-// LOG_KERN (0):
-// <PRI>[<TIME>] <tag> ":" <message>
-// <PRI>[<TIME>] <tag> <tag> ":" <message>
-// <PRI>[<TIME>] <tag> <tag>_work ":" <message>
-// <PRI>[<TIME>] <tag> '<tag>.<num>' ":" <message>
-// <PRI>[<TIME>] <tag> '<tag><num>' ":" <message>
-// <PRI>[<TIME>] <tag>_host '<tag>.<num>' ":" <message>
-// (unimplemented) <PRI>[<TIME>] <tag> '<num>.<tag>' ":" <message>
-// <PRI>[<TIME>] "[INFO]"<tag> : <message>
-// <PRI>[<TIME>] "------------[ cut here ]------------"   (?)
-// <PRI>[<TIME>] "---[ end trace 3225a3070ca3e4ac ]---"   (?)
-// LOG_USER, LOG_MAIL, LOG_DAEMON, LOG_AUTH, LOG_SYSLOG, LOG_LPR, LOG_NEWS
-// LOG_UUCP, LOG_CRON, LOG_AUTHPRIV, LOG_FTP:
-// <PRI+TAG>[<TIME>] (see sys/syslog.h)
-// Observe:
-//  Minimum tag length = 3   NB: drops things like r5:c00bbadf, but allow PM:
-//  Maximum tag words = 2
-//  Maximum tag length = 16  NB: we are thinking of how ugly logcat can get.
-//  Not a Tag if there is no message content.
-//  leading additional spaces means no tag, inherit last tag.
-//  Not a Tag if <tag>: is "ERROR:", "WARNING:", "INFO:" or "CPU:"
-// Drop:
-//  empty messages
-//  messages with ' audit(' in them if auditd is running
-//  logd.klogd:
-// return -1 if message logd.klogd: <signature>
-//
-int LogKlog::log(const char* buf, ssize_t len) {
-    if (auditd && android::strnstr(buf, len, auditStr)) {
-        return 0;
-    }
-
-    const char* p = buf;
-    int pri = parseKernelPrio(p, len);
-
-    log_time now;
-    sniffTime(now, p, len - (p - buf), false);
-
-    // sniff for start marker
-    const char* start = android::strnstr(p, len - (p - buf), klogdStr);
-    if (start) {
-        uint64_t sig = strtoll(start + strlen(klogdStr), nullptr, 10);
-        if (sig == signature.nsec()) {
-            if (initialized) {
-                enableLogging = true;
-            } else {
-                enableLogging = false;
-            }
-            return -1;
-        }
-        return 0;
-    }
-
-    if (!enableLogging) {
-        return 0;
-    }
-
-    // Parse pid, tid and uid
-    const pid_t pid = sniffPid(p, len - (p - buf));
-    const pid_t tid = pid;
-    uid_t uid = AID_ROOT;
-    if (pid) {
-        logbuf->wrlock();
-        uid = logbuf->pidToUid(pid);
-        logbuf->unlock();
-    }
-
-    // Parse (rules at top) to pull out a tag from the incoming kernel message.
-    // Some may view the following as an ugly heuristic, the desire is to
-    // beautify the kernel logs into an Android Logging format; the goal is
-    // admirable but costly.
-    while ((p < &buf[len]) && (isspace(*p) || !*p)) {
-        ++p;
-    }
-    if (p >= &buf[len]) {  // timestamp, no content
-        return 0;
-    }
-    start = p;
-    const char* tag = "";
+// Pull out a tag (rules below) from the kernel message at start, which has
+// had its priority, time and leading space removed. Returns where the
+// message content begins, which may be past len for a tag with no content.
+static const char* parseTag(const char* start, ssize_t len, const char*& tag,
+                            ssize_t& taglen) {
+    const char* p = start;
+    tag = "";
     const char* etag = tag;
-    ssize_t taglen = len - (p - buf);
+    taglen = len;
     const char* bt = p;
 
     static const char infoBrace[] = "[INFO]";
@@ -740,6 +744,125 @@ int LogKlog::log(const char* buf, ssize_t len) {
             taglen = mp - tag;
         }
     }
+    return p;
+}
+
+static size_t tagHash(const char* s) {
+    return ((unsigned char)s[0] * 31) + (unsigned char)s[1];
+}
+
+//
+// log a message into the kernel log buffer
+//
+// Filter rules to parse <PRI> <TIME> <tag> and <message> in order for
+// them to appear correct in the logcat output:
+//
+// LOG_KERN (0):
+// <PRI>[<TIME>] <tag> ":" <message>
+// <PRI>[<TIME>] <tag> <tag> ":" <message>
+// <PRI>[<TIME>] <tag> <tag>_work ":" <message>
+// <PRI>[<TIME>] <tag> '<tag>.<num>' ":" <message>
+// <PRI>[<TIME>] <tag> '<tag><num>' ":" <message>
+// <PRI>[<TIME>] <tag>_host '<tag>.<num>' ":" <message>
+// (unimplemented) <PRI>[<TIME>] <tag> '<num>.<tag>' ":" <message>
+// <PRI>[<TIME>] "[INFO]"<tag> : <message>
+// <PRI>[<TIME>] "------------[ cut here ]------------"   (?)
+// <PRI>[<TIME>] "---[ end trace 3225a3070ca3e4ac ]---"   (?)
+// LOG_USER, LOG_MAIL, LOG_DAEMON, LOG_AUTH, LOG_SYSLOG, LOG_LPR, LOG_NEWS
+// LOG_UUCP, LOG_CRON, LOG_AUTHPRIV, LOG_FTP:
+// <PRI+TAG>[<TIME>] (see sys/syslog.h)
+// Observe:
+//  Minimum tag length = 3   NB: drops things like r5:c00bbadf, but allow PM:
+//  Maximum tag words = 2
+//  Maximum tag length = 16  NB: we are thinking of how ugly logcat can get.
+//  Not a Tag if there is no message content.
+//  leading additional spaces means no tag, inherit last tag.
+//  Not a Tag if <tag>: is "ERROR:", "WARNING:", "INFO:" or "CPU:"
+// Drop:
+//  empty messages
+//  messages with ' audit(' in them if auditd is running
+//  logd.klogd:
+// return -1 if message logd.klogd: <signature>
+//
+int LogKlog::log(const char* buf, ssize_t len) {
+    Needles needles;
+    findNeedles(buf, len, needles);
+
+    if (auditd && needles.audit) {
+        return 0;
+    }
+
+    const char* p = buf;
+    int pri = parseKernelPrio(p, len);
+
+    log_time now;
+    sniffTime(now, p, len - (p - buf), false, needles);
+
+    // sniff for start marker
+    const char* start = needles.klogd;
+    if (start && (start >= p)) {
+        uint64_t sig = strtoll(start + strlen(klogdStr), nullptr, 10);
+        if (sig == signature.nsec()) {
+            if (initialized) {
+                enableLogging = true;
+            } else {
+                enableLogging = false;
+            }
+            return -1;
+        }
+        return 0;
+    }
+
+    if (!enableLogging) {
+        return 0;
+    }
+
+    // Parse pid, tid and uid
+    const pid_t pid = sniffPid(p, len - (p - buf));
+    const pid_t tid = pid;
+    uid_t uid = AID_ROOT;
+    if (pid) {
+        logbuf->wrlock();
+        uid = logbuf->pidToUid(pid);
+        logbuf->unlock();
+    }
+
+    // Parse (rules at top) to pull out a tag from the incoming kernel message.
+    // Some may view the following as an ugly heuristic, the desire is to
+    // beautify the kernel logs into an Android Logging format; the goal is
+    // admirable but costly.
+    while ((p < &buf[len]) && (isspace(*p) || !*p)) {
+        ++p;
+    }
+    if (p >= &buf[len]) {  // timestamp, no content
+        return 0;
+    }
+    start = p;
+    const ssize_t remaining = len - (p - buf);
+    TagCacheEntry* entry =
+        (remaining >= 2) ? &tagCache[tagHash(start) % tagCacheSize] : nullptr;
+    const char* tag;
+    ssize_t taglen;
+    if (entry && entry->keyLen && (remaining > (2 * entry->keyLen)) &&
+        !fastcmp<memcmp>(start, entry->key, entry->keyLen)) {
+        tag = start + entry->tagOffset;
+        taglen = entry->tagLen;
+        p = start + entry->keyLen;
+    } else {
+        p = parseTag(start, remaining, tag, taglen);
+        // The only length check in parseTag() that could go the other way
+        // on a longer message is (taglen > size), which can not fail once
+        // the message is over twice the key.
+        ssize_t keyLen = p - start;
+        if (entry && (taglen > 0) && (keyLen <= (ssize_t)tagCacheKeyMax) &&
+            (remaining > (2 * keyLen))) {
+            entry->keyLen = keyLen;
+            entry->tagOffset = tag - start;
+            entry->tagLen = taglen;
+            memcpy(entry->key, start, keyLen);
+        }
+    }
+
     // Deal with sloppy and simplistic harmless p = cp + 1 etc above.
     if (len < (p - buf)) {
         p = &buf[len];
@@ -38,6 +38,18 @@ class LogKlog : public SocketListener {
 
     static log_time correction;
 
+    // Tags recently pulled out of kernel messages by the heuristic in log(),
+    // keyed by the message text up to and including the tag's ':'.
+    static const size_t tagCacheSize = 64;
+    static const size_t tagCacheKeyMax = 29;
+    struct TagCacheEntry {
+        uint8_t keyLen;  // 0 if unused
+        uint8_t tagOffset;
+        uint8_t tagLen;
+        char key[tagCacheKeyMax];
+    };
+    TagCacheEntry tagCache[tagCacheSize];
+
    public:
     LogKlog(LogBuffer* buf, LogReader* reader, int fdWrite, int fdRead,
             bool auditd);
@@ -55,7 +67,20 @@ class LogKlog : public SocketListener {
     }
 
    protected:
+    // Where the needles we look for first appear in a message
+    struct Needles {
+        const char* suspend;
+        const char* resume;
+        const char* suspended;
+        const char* battery;  // following "healthd"
+        const char* audit;
+        const char* klogd;
+    };
+    static void findNeedles(const char* buf, ssize_t len, Needles& needles);
+
     void sniffTime(log_time& now, const char*& buf, ssize_t len, bool reverse);
+    void sniffTime(log_time& now, const char*& buf, ssize_t len, bool reverse,
+                   const Needles& needles);
     pid_t sniffPid(const char*& buf, ssize_t len);
     void calculateCorrection(const log_time& monotonic, const char* real_string,
                              ssize_t len);
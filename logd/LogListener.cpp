@@ -24,6 +24,8 @@
 #include <sys/un.h>
 #include <unistd.h>
 
+#include <algorithm>
+
 #include <cutils/sockets.h>
 #include <private/android_filesystem_config.h>
 #include <private/android_logger.h>
@@ -43,8 +45,10 @@ bool LogListener::onDataAvailable(SocketClient* cli) {
         name_set = true;
     }
 
-    char buffer[sizeof_log_id_t + sizeof(uint16_t) + sizeof(log_time) +
-                LOGGER_ENTRY_MAX_PAYLOAD];
+    static constexpr size_t singleLen = sizeof_log_id_t + sizeof(uint16_t) +
+                                        sizeof(log_time) +
+                                        LOGGER_ENTRY_MAX_PAYLOAD;
+    char buffer[std::max(singleLen, (size_t)LOGGER_BATCH_MAX_LEN)];
     struct iovec iov = { buffer, sizeof(buffer) };
 
     alignas(4) char control[CMSG_SPACE(sizeof(struct ucred))];
@@ -88,8 +92,31 @@ bool LogListener::onDataAvailable(SocketClient* cli) {
         return false;
     }
 
+    if (buffer[0] == LOGGER_BATCH_ID) {
+        return logBatch(cred, buffer, n);
+    }
+
     android_log_header_t* header =
         reinterpret_cast<android_log_header_t*>(buffer);
+    if (!acceptable(cred, header) || !fixCredentials(cred, header->tid)) {
+        return false;
+    }
+
+    char* msg = ((char*)buffer) + sizeof(android_log_header_t);
+    n -= sizeof(android_log_header_t);
+
+    // NB: hdr.msg_flags & MSG_TRUNC is not tested, silently passing a
+    // truncated message to the logs.
+
+    if (logRecord(cred, header, msg, n) && reader != nullptr) {
+        reader->notifyNewLog();
+    }
+
+    return true;
+}
+
+bool LogListener::acceptable(const struct ucred* cred,
+                             const android_log_header_t* header) {
     if (/* header->id < LOG_ID_MIN || */ header->id >= LOG_ID_MAX ||
         header->id == LOG_ID_KERNEL) {
         return false;
@@ -101,10 +128,13 @@ bool LogListener::onDataAvailable(SocketClient* cli) {
         return false;
     }
 
-    // Check credential validity, acquire corrected details if not supplied.
+    return true;
+}
+
+// Check credential validity, acquire corrected details if not supplied.
+bool LogListener::fixCredentials(struct ucred* cred, pid_t tid) {
     if (cred->pid == 0) {
-        cred->pid = logbuf ? logbuf->tidToPid(header->tid)
-                           : android::tidToPid(header->tid);
+        cred->pid = logbuf ? logbuf->tidToPid(tid) : android::tidToPid(tid);
         if (cred->pid == getpid()) {
             // We expect that /proc/<tid>/ is accessible to self even without
             // readproc group, so that we will always drop messages that come
@@ -116,28 +146,67 @@ bool LogListener::onDataAvailable(SocketClient* cli) {
         uid_t uid =
             logbuf ? logbuf->pidToUid(cred->pid) : android::pidToUid(cred->pid);
         if (uid == AID_LOGD) {
-            uid = logbuf ? logbuf->pidToUid(header->tid)
-                         : android::pidToUid(cred->pid);
+            uid = logbuf ? logbuf->pidToUid(tid) : android::pidToUid(cred->pid);
         }
         if (uid != AID_LOGD) cred->uid = uid;
     }
+    return true;
+}
 
-    char* msg = ((char*)buffer) + sizeof(android_log_header_t);
-    n -= sizeof(android_log_header_t);
+// Returns true if the reader should be notified
+bool LogListener::logRecord(const struct ucred* cred,
+                            const android_log_header_t* header, char* msg,
+                            size_t len) {
+    if (logbuf == nullptr) {
+        return false;
+    }
+    int res = logbuf->log((log_id_t)header->id, header->realtime, cred->uid,
+                          cred->pid, header->tid, msg,
+                          (len <= USHRT_MAX) ? (unsigned short)len : USHRT_MAX);
+    return res > 0;
+}
 
-    // NB: hdr.msg_flags & MSG_TRUNC is not tested, silently passing a
-    // truncated message to the logs.
+// Records coalesced by one writer thread, see android_log_batch_header_t.
+// The credentials are resolved once, then each record is vetted on its own,
+// and readers get a single notification for the whole datagram.
+bool LogListener::logBatch(struct ucred* cred, char* buffer, size_t len) {
+    android_log_batch_header_t batch;
+    android_log_batch_record_t record;
+
+    char* cp = buffer + sizeof(batch);
+    char* end = buffer + len;
+    if ((cp + sizeof(record)) > end) {
+        return false;
+    }
+    memcpy(&batch, buffer, sizeof(batch));
+    memcpy(&record, cp, sizeof(record));
+    if (!fixCredentials(cred, record.header.tid)) {
+        return false;
+    }
+
+    bool notify = false;
+    for (uint16_t count = batch.count; count; --count) {
+        if ((cp + sizeof(record)) > end) {
+            break;
+        }
+        memcpy(&record, cp, sizeof(record));
+        char* msg = cp + sizeof(record);
+        if ((record.len > LOGGER_ENTRY_MAX_PAYLOAD) ||
+            ((msg + record.len) > end)) {
+            break;  // truncated, as in the single record case drop the rest
+        }
+        cp = msg + record.len;
 
-    if (logbuf != nullptr) {
-        int res = logbuf->log(
-            (log_id_t)header->id, header->realtime, cred->uid, cred->pid,
-            header->tid, msg,
-            ((size_t)n <= USHRT_MAX) ? (unsigned short)n : USHRT_MAX);
-        if (res > 0 && reader != nullptr) {
-            reader->notifyNewLog();
+        if (acceptable(cred, &record.header) &&
+            logRecord(cred, &record.header, msg, record.len)) {
+            notify = true;
         }
     }
 
+    if (notify && reader != nullptr) {
+        reader->notifyNewLog();
+    }
+
     return true;
 }
 
@@ -17,6 +17,9 @@
 #ifndef _LOGD_LOG_LISTENER_H__
 #define _LOGD_LOG_LISTENER_H__
 
+#include <sys/socket.h>
+
+#include <private/android_logger.h>
 #include <sysutils/SocketListener.h>
 #include "LogReader.h"
 
@@ -42,6 +45,13 @@ class LogListener : public SocketListener {
 
    private:
     static int getLogSocket();
+
+    static bool acceptable(const struct ucred* cred,
+                           const android_log_header_t* header);
+    bool fixCredentials(struct ucred* cred, pid_t tid);
+    bool logRecord(const struct ucred* cred,
+                   const android_log_header_t* header, char* msg, size_t len);
+    bool logBatch(struct ucred* cred, char* buffer, size_t len);
 };
 
 #endif
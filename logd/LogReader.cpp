@@ -28,12 +28,18 @@
 #include "LogBuffer.h"
 #include "LogBufferElement.h"
 #include "LogReader.h"
+#include "LogReaderFilter.h"
+#include "LogReaderRing.h"
 #include "LogUtils.h"
 
 LogReader::LogReader(LogBuffer* logbuf)
     : SocketListener(getLogSocket(), true), mLogbuf(*logbuf) {
 }
 
+LogReader::LogReader(LogBuffer* logbuf, int sock)
+    : SocketListener(sock, true), mLogbuf(*logbuf) {
+}
+
 // When we are notified a new log entry is available, inform
 // all of our listening sockets.
 void LogReader::notifyNewLog() {
@@ -48,7 +54,7 @@ bool LogReader::onDataAvailable(SocketClient* cli) {
         name_set = true;
     }
 
-    char buffer[255];
+    char buffer[1024];
 
     int len = read(cli->getSocket(), buffer, sizeof(buffer) - 1);
     if (len <= 0) {
@@ -107,6 +113,22 @@ bool LogReader::onDataAvailable(SocketClient* cli) {
         pid = atol(cp + sizeof(_pid) - 1);
     }
 
+    size_t ringSize = 0;
+    static const char _ring[] = " ring=";
+    cp = strstr(buffer, _ring);
+    if (cp) {
+        ringSize = atol(cp + sizeof(_ring) - 1);
+    }
+
+    // tag:priority rules, comma separated up to the next argument
+    LogReaderFilter* filter = nullptr;
+    static const char _filter[] = " filter=";
+    cp = strstr(buffer, _filter);
+    if (cp) {
+        cp += sizeof(_filter) - 1;
+        filter = LogReaderFilter::create(cp, strcspn(cp, " "));
+    }
+
     bool nonBlock = false;
     if (!fastcmp<strncmp>(buffer, "dumpAndClose", 12)) {
         // Allow writer to get some cycles, and wait for pending notifications
@@ -185,9 +207,11 @@ bool LogReader::onDataAvailable(SocketClient* cli) {
 
         logbuf().flushTo(cli, sequence, nullptr, FlushCommand::hasReadLogs(cli),
                          FlushCommand::hasSecurityLogs(cli),
-                         logFindStart.callback, &logFindStart);
+                         logFindStart.callback, &logFindStart, nullptr,
+                         logMask);
 
         if (!logFindStart.found()) {
+            delete filter;
             doSocketDelete(cli);
             return false;
         }
@@ -195,17 +219,38 @@ bool LogReader::onDataAvailable(SocketClient* cli) {
 
     android::prdebug(
         "logdr: UID=%d GID=%d PID=%d %c tail=%lu logMask=%x pid=%d "
-        "start=%" PRIu64 "ns timeout=%" PRIu64 "ns\n",
+        "start=%" PRIu64 "ns timeout=%" PRIu64 "ns%s\n",
         cli->getUid(), cli->getGid(), cli->getPid(), nonBlock ? 'n' : 'b', tail,
-        logMask, (int)pid, sequence.nsec(), timeout);
+        logMask, (int)pid, sequence.nsec(), timeout,
+        filter ? " filtered" : "");
 
-    FlushCommand command(*this, nonBlock, tail, logMask, pid, sequence, timeout);
+    // Opt-in shared memory ring, if we can not set one up the reader
+    // simply never sees the setup message and stays on the socket.
+    LogReaderRing* ring = nullptr;
+    if (ringSize) {
+        ring = LogReaderRing::create(ringSize);
+        if (ring && !ring->sendSetup(cli)) {
+            delete ring;
+            delete filter;
+            doSocketDelete(cli);
+            return false;
+        }
+    }
+
+    FlushCommand command(*this, nonBlock, tail, logMask, pid, sequence, timeout,
+                         ring, filter);
 
     // Set acceptable upper limit to wait for slow reader processing b/27242723
     struct timeval t = { LOGD_SNDTIMEO, 0 };
     setsockopt(cli->getSocket(), SOL_SOCKET, SO_SNDTIMEO, (const char*)&t,
                sizeof(t));
 
+    // Queue what a slow reader isn't ready for rather than holding up the
+    // flush thread, and the pruning waiting on it. Like kickMe(), a reader
+    // that falls too far behind skips its oldest entries.
+    cli->enableOutputQueue(LOGD_READER_QUEUE_BYTES,
+                           SocketClient::OVERFLOW_DROP_OLDEST);
+
     command.runSocketCommand(cli);
     return true;
 }
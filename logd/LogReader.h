@@ -20,6 +20,7 @@
 #include <sysutils/SocketListener.h>
 
 #define LOGD_SNDTIMEO 32
+#define LOGD_READER_QUEUE_BYTES (256 * 1024)
 
 class LogBuffer;
 
@@ -28,6 +29,9 @@ class LogReader : public SocketListener {
 
    public:
     explicit LogReader(LogBuffer* logbuf);
+    // Over a socket of the caller's, or none, rather than logdr; for
+    // harnesses that hand LogTimeEntrys clients of their own.
+    LogReader(LogBuffer* logbuf, int sock);
     void notifyNewLog();
 
     LogBuffer& logbuf(void) const {
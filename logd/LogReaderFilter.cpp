@@ -0,0 +1,107 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <ctype.h>
+#include <string.h>
+
+#include <new>
+
+#include "LogBufferElement.h"
+#include "LogReaderFilter.h"
+
+// Same as filterCharToPri() in liblog/logprint.c
+static android_LogPriority charToPri(char c) {
+    c = tolower(c);
+    if ((c >= '0') && (c <= '9')) {
+        if (c >= ('0' + ANDROID_LOG_SILENT)) return ANDROID_LOG_VERBOSE;
+        return static_cast<android_LogPriority>(c - '0');
+    }
+    switch (c) {
+        case 'v': return ANDROID_LOG_VERBOSE;
+        case 'd': return ANDROID_LOG_DEBUG;
+        case 'i': return ANDROID_LOG_INFO;
+        case 'w': return ANDROID_LOG_WARN;
+        case 'e': return ANDROID_LOG_ERROR;
+        case 'f': return ANDROID_LOG_FATAL;
+        case 's': return ANDROID_LOG_SILENT;
+        case '*': return ANDROID_LOG_DEFAULT;
+    }
+    return ANDROID_LOG_UNKNOWN;
+}
+
+bool LogReaderFilter::addRule(const char* expression, size_t len) {
+    const char* colon = static_cast<const char*>(memchr(expression, ':', len));
+    size_t tagLen = colon ? (colon - expression) : len;
+    if (!tagLen) return false;
+
+    android_LogPriority pri = ANDROID_LOG_DEFAULT;
+    if (colon) {
+        pri = ((tagLen + 1) < len) ? charToPri(colon[1]) : ANDROID_LOG_UNKNOWN;
+        if (pri == ANDROID_LOG_UNKNOWN) return false;
+    }
+
+    if ((tagLen == 1) && (*expression == '*')) {
+        mGlobalPri = (pri == ANDROID_LOG_DEFAULT) ? ANDROID_LOG_DEBUG : pri;
+    } else {
+        if (pri == ANDROID_LOG_DEFAULT) pri = ANDROID_LOG_VERBOSE;
+        mRules.insert(mRules.begin(), Rule{ std::string(expression, tagLen),
+                                            pri });
+    }
+    return true;
+}
+
+LogReaderFilter* LogReaderFilter::create(const char* spec, size_t len) {
+    if (!len) return nullptr;
+    LogReaderFilter* filter = new (std::nothrow) LogReaderFilter;
+    if (!filter) return nullptr;
+
+    const char* end = spec + len;
+    while (spec < end) {
+        const char* comma =
+            static_cast<const char*>(memchr(spec, ',', end - spec));
+        if (!comma) comma = end;
+        if ((comma > spec) && !filter->addRule(spec, comma - spec)) {
+            delete filter;
+            return nullptr;
+        }
+        spec = comma + 1;
+    }
+
+    return filter;
+}
+
+bool LogReaderFilter::isLoggable(const LogBufferElement* element) const {
+    if (element->isBinary() || element->getDropped()) return true;
+
+    // <priority:1><tag:N>\0<message:N>\0, as android_log_processLogBuffer()
+    unsigned short len = element->getMsgLen();
+    const char* msg = element->getMsg();
+    if (!msg || (len < 3)) return true;
+    const char* tag = msg + 1;
+    const char* nul = static_cast<const char*>(memchr(tag, '\0', len - 1));
+    if (!nul) return true;
+    size_t tagLen = nul - tag;
+
+    android_LogPriority pri = mGlobalPri;
+    for (const Rule& rule : mRules) {
+        if ((rule.tag.length() == tagLen) &&
+            !memcmp(rule.tag.data(), tag, tagLen)) {
+            pri = rule.pri;
+            break;
+        }
+    }
+    return msg[0] >= pri;
+}
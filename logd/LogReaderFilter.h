@@ -0,0 +1,59 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _LOGD_LOG_READER_FILTER_H__
+#define _LOGD_LOG_READER_FILTER_H__
+
+#include <sys/types.h>
+
+#include <string>
+#include <vector>
+
+#include <android-base/macros.h>
+#include <android/log.h>
+
+class LogBufferElement;
+
+// Per reader tag:priority filter, compiled from the filter= argument of
+// a logdr request. Rules follow logcat filterspecs (android_log_addFilterRule)
+// exactly, so the reader sees the same entries it would after filtering
+// them itself, but without having them all sent over first. Only entries
+// the reader would certainly reject are dropped: binary, chatty and
+// malformed entries are always passed on for the reader to decide.
+class LogReaderFilter {
+    struct Rule {
+        std::string tag;
+        android_LogPriority pri;
+    };
+    std::vector<Rule> mRules;  // newest first, the first match wins
+    android_LogPriority mGlobalPri;
+
+    LogReaderFilter() : mGlobalPri(ANDROID_LOG_VERBOSE) {
+    }
+    bool addRule(const char* expression, size_t len);
+
+   public:
+    // Compiles the comma separated rules in spec[0..len), returns nullptr
+    // if there are none or any one of them is invalid.
+    static LogReaderFilter* create(const char* spec, size_t len);
+
+    bool isLoggable(const LogBufferElement* element) const;
+
+   private:
+    DISALLOW_COPY_AND_ASSIGN(LogReaderFilter);
+};
+
+#endif  // _LOGD_LOG_READER_FILTER_H__
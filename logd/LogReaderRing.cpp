@@ -0,0 +1,177 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <errno.h>
+#include <poll.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <cutils/ashmem.h>
+
+#include "LogReader.h"
+#include "LogReaderRing.h"
+
+// How long to sleep between checks for the reader to make room
+static const int waitSliceMs = 5;
+
+LogReaderRing::LogReaderRing(size_t size)
+    : mDataFd(-1),
+      mControlFd(-1),
+      mData(nullptr),
+      mControl(nullptr),
+      mSize(size),
+      mHead(0),
+      mPublished(0) {
+}
+
+LogReaderRing::~LogReaderRing() {
+    if (mData) munmap(mData, mSize);
+    if (mControl) munmap(mControl, sizeof(*mControl));
+    if (mDataFd >= 0) close(mDataFd);
+    if (mControlFd >= 0) close(mControlFd);
+}
+
+LogReaderRing* LogReaderRing::create(size_t size) {
+    if (size < LOGGER_RING_MIN_SIZE) size = LOGGER_RING_MIN_SIZE;
+    if (size > LOGGER_RING_MAX_SIZE) size = LOGGER_RING_MAX_SIZE;
+    size_t rounded = LOGGER_RING_MIN_SIZE;
+    while (rounded < size) rounded <<= 1;
+
+    LogReaderRing* ring = new LogReaderRing(rounded);
+
+    ring->mDataFd = ashmem_create_region("logd.reader.ring", rounded);
+    ring->mControlFd =
+        ashmem_create_region("logd.reader.ctl", sizeof(*ring->mControl));
+    if ((ring->mDataFd < 0) || (ring->mControlFd < 0)) {
+        delete ring;
+        return nullptr;
+    }
+
+    void* data = mmap(nullptr, rounded, PROT_READ | PROT_WRITE, MAP_SHARED,
+                      ring->mDataFd, 0);
+    void* control = mmap(nullptr, sizeof(*ring->mControl),
+                         PROT_READ | PROT_WRITE, MAP_SHARED, ring->mControlFd, 0);
+    if (data != MAP_FAILED) ring->mData = static_cast<char*>(data);
+    if (control != MAP_FAILED) {
+        ring->mControl = static_cast<android_log_ring_control_t*>(control);
+    }
+    // Our own mapping stays writable, the reader can only map it read-only
+    if (!ring->mData || !ring->mControl ||
+        ashmem_set_prot_region(ring->mDataFd, PROT_READ)) {
+        delete ring;
+        return nullptr;
+    }
+    memset(ring->mControl, 0, sizeof(*ring->mControl));
+
+    return ring;
+}
+
+bool LogReaderRing::sendSetup(SocketClient* client) {
+    android_log_ring_setup_t setup = { LOGGER_RING_SETUP_MAGIC,
+                                       (uint32_t)mSize };
+    struct iovec iov = { &setup, sizeof(setup) };
+    int fds[2] = { mDataFd, mControlFd };
+    char control[CMSG_SPACE(sizeof(fds))];
+
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+    memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+    ssize_t ret = TEMP_FAILURE_RETRY(
+        sendmsg(client->getSocket(), &msg, MSG_NOSIGNAL));
+
+    // The reader holds its own references now, our mappings suffice
+    close(mDataFd);
+    close(mControlFd);
+    mDataFd = mControlFd = -1;
+
+    return ret == (ssize_t)sizeof(setup);
+}
+
+bool LogReaderRing::publish(SocketClient* client) {
+    if (mHead == mPublished) return true;
+
+    __atomic_store_n(&mControl->head, mHead, __ATOMIC_RELEASE);
+
+    android_log_ring_cursor_t cursor = { LOGGER_RING_CURSOR_MAGIC, 0, mHead };
+    if (client->sendData(&cursor, sizeof(cursor))) return false;
+    mPublished = mHead;
+    return true;
+}
+
+bool LogReaderRing::waitForRoom(SocketClient* client, size_t needed) {
+    int slices = (LOGD_SNDTIMEO * 1000) / waitSliceMs;
+    bool published = false;
+    for (;;) {
+        uint64_t tail = __atomic_load_n(&mControl->tail, __ATOMIC_ACQUIRE);
+        // The control page is writable by the reader, trust nothing
+        if ((tail > mHead) || ((mHead - tail) > mSize)) return false;
+        if ((mSize - (mHead - tail)) >= needed) return true;
+
+        // Make sure the reader knows there is something to consume
+        if (!published) {
+            if (!publish(client)) return false;
+            published = true;
+        }
+        if (--slices <= 0) return false;
+
+        struct pollfd p = { client->getSocket(), 0, 0 };
+        if ((TEMP_FAILURE_RETRY(poll(&p, 1, waitSliceMs)) > 0) &&
+            (p.revents & (POLLERR | POLLHUP | POLLNVAL))) {
+            return false;
+        }
+    }
+}
+
+bool LogReaderRing::write(SocketClient* client, const struct iovec* iov,
+                          int iovcnt) {
+    size_t len = 0;
+    for (int i = 0; i < iovcnt; ++i) len += iov[i].iov_len;
+    size_t record = (len + LOGGER_RING_ALIGN - 1) & ~(LOGGER_RING_ALIGN - 1);
+
+    size_t offset = mHead & (mSize - 1);
+    size_t pad = ((offset + record) > mSize) ? (mSize - offset) : 0;
+    if (!waitForRoom(client, pad + record)) return false;
+
+    if (pad) {
+        // zero len and hdr_size tell the reader to wrap
+        memset(mData + offset, 0, 2 * sizeof(uint16_t));
+        mHead += pad;
+        offset = 0;
+    }
+
+    char* cp = mData + offset;
+    for (int i = 0; i < iovcnt; ++i) {
+        memcpy(cp, iov[i].iov_base, iov[i].iov_len);
+        cp += iov[i].iov_len;
+    }
+    mHead += record;
+
+    // Let a reader catching up on a large dump start early
+    if ((mHead - mPublished) >= (mSize / 4)) return publish(client);
+    return true;
+}
@@ -0,0 +1,64 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _LOGD_LOG_READER_RING_H__
+#define _LOGD_LOG_READER_RING_H__
+
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+#include <android-base/macros.h>
+#include <private/android_logger.h>
+#include <sysutils/SocketClient.h>
+
+// Per reader shared memory ring, see android_log_ring_setup_t.  The ring
+// carries exactly what the socket would have, after uid, pid and security
+// filtering, so each reader only ever maps entries it was entitled to.
+class LogReaderRing {
+    int mDataFd;
+    int mControlFd;
+    char* mData;
+    android_log_ring_control_t* mControl;
+    const size_t mSize;  // power of two
+    uint64_t mHead;
+    uint64_t mPublished;
+
+    explicit LogReaderRing(size_t size);
+
+    bool waitForRoom(SocketClient* client, size_t needed);
+
+   public:
+    ~LogReaderRing();
+
+    // Size is clamped and rounded up, nullptr if ashmem is unavailable
+    static LogReaderRing* create(size_t size);
+
+    // Pass the descriptors to the reader, before any entry is written
+    bool sendSetup(SocketClient* client);
+
+    // Copy one record in, publishing and waiting for the reader to make
+    // room as needed.  Returns false if the reader has stopped consuming.
+    bool write(SocketClient* client, const struct iovec* iov, int iovcnt);
+
+    // Announce everything written since the last call with one cursor
+    bool publish(SocketClient* client);
+
+   private:
+    DISALLOW_COPY_AND_ASSIGN(LogReaderRing);
+};
+
+#endif  // _LOGD_LOG_READER_RING_H__
@@ -15,6 +15,7 @@
  */
 
 #include <ctype.h>
+#include <errno.h>
 #include <fcntl.h>
 #include <inttypes.h>
 #include <pwd.h>
@@ -33,8 +34,10 @@ static const uint64_t hourSec = 60 * 60;
 static const uint64_t monthSec = 31 * 24 * hourSec;
 
 size_t LogStatistics::SizesTotal;
+LogNames::names_t LogNames::names;
 
-LogStatistics::LogStatistics() : enable(false) {
+LogStatistics::LogStatistics()
+    : enable(false), compactThreshold(minCompactThreshold) {
     log_time now(CLOCK_REALTIME);
     log_id_for_each(id) {
         mSizes[id] = 0;
@@ -45,7 +48,10 @@ LogStatistics::LogStatistics() : enable(false) {
         mOldest[id] = now;
         mNewest[id] = now;
         mNewestDropped[id] = now;
+        uidTable[id].trackSizes();
+        pidSystemTable[id].trackSizes();
     }
+    tagTable.trackSizes();
 }
 
 namespace android {
@@ -144,6 +150,7 @@ void LogStatistics::add(LogBufferElement* element) {
 
     pidTable.add(element->getPid(), element);
     tidTable.add(element->getTid(), element);
+    compact();
 
     uint32_t tag = element->getTag();
     if (tag) {
@@ -276,7 +283,7 @@ const char* LogStatistics::uidToName(uid_t uid) const {
     // report uid -> pid(s) -> pidToName if unique
     for (pidTable_t::const_iterator it = pidTable.begin(); it != pidTable.end();
          ++it) {
-        const PidEntry& entry = it->second;
+        const PidEntry& entry = *it;
 
         if (entry.getUid() == uid) {
             const char* nameTmp = entry.getName();
@@ -345,7 +352,7 @@ std::string UidEntry::format(const LogStatistics& stat, log_id_t id) const {
         for (LogStatistics::uidTable_t::const_iterator it =
                  stat.uidTable[id].begin();
              it != stat.uidTable[id].end(); ++it) {
-            totalDropped += it->second.getDropped();
+            totalDropped += it->getDropped();
         }
         size_t sizes = stat.sizes(id);
         size_t totalSize = stat.sizesTotal(id);
@@ -859,18 +866,98 @@ pid_t tidToPid(pid_t tid) {
 }
 
 uid_t LogStatistics::pidToUid(pid_t pid) {
-    return pidTable.add(pid)->second.getUid();
+    compact();
+    return pidTable.add(pid).getUid();
 }
 
 pid_t LogStatistics::tidToPid(pid_t tid) {
-    return tidTable.add(tid)->second.getPid();
+    compact();
+    return tidTable.add(tid).getPid();
+}
+
+static bool isGone(pid_t pid) {
+    char buffer[32];
+    snprintf(buffer, sizeof(buffer), "/proc/%u", pid);
+    return access(buffer, F_OK) && (errno == ENOENT);
+}
+
+// Entries with no logs left in the buffer only remember a uid and name, pid
+// and tid numbers get reused so there is nothing to lose once they exit.
+void LogStatistics::compactPids() {
+    pidTable.compact([](const PidEntry& entry) {
+        return !entry.getSizes() && !entry.getDropped() &&
+               isGone(entry.getPid());
+    });
+    tidTable.compact([](const TidEntry& entry) {
+        return !entry.getSizes() && !entry.getDropped() &&
+               isGone(entry.getTid());
+    });
+    compactThreshold = std::max(size_t(minCompactThreshold),
+                                2 * (pidTable.size() + tidTable.size()));
+}
+
+size_t LogStatistics::sizeOf() const {
+    size_t size = sizeof(*this) + pidTable.sizeOf() + tidTable.sizeOf() +
+                  tagTable.sizeOf() + securityTagTable.sizeOf() +
+                  tagNameTable.sizeOf() + LogNames::sizeOf();
+    for (const TagNameEntry& entry : tagNameTable) {
+        size += entry.getNameAllocLength();
+    }
+    log_id_for_each(id) {
+        size += uidTable[id].sizeOf();
+        size += pidSystemTable[id].sizeOf();
+    }
+    return size;
+}
+
+const char* LogNames::intern(char* name) {
+    if (!name) return nullptr;
+    std::experimental::string_view key(name, strlen(name));
+    names_t::iterator it = names.find(key);
+    if (it != names.end()) {
+        ++it->second.refs;
+        free(name);
+        return it->second.str;
+    }
+    names.emplace(key, Name{ name, 1 });
+    return name;
+}
+
+const char* LogNames::share(const char* name) {
+    if (!name) return nullptr;
+    names_t::iterator it =
+        names.find(std::experimental::string_view(name, strlen(name)));
+    if (it == names.end()) return nullptr;
+    ++it->second.refs;
+    return it->second.str;
+}
+
+void LogNames::release(const char* name) {
+    if (!name) return;
+    names_t::iterator it =
+        names.find(std::experimental::string_view(name, strlen(name)));
+    if ((it == names.end()) || --it->second.refs) return;
+    char* str = it->second.str;
+    names.erase(it);
+    free(str);
+}
+
+size_t LogNames::sizeOf() {
+    // a node per name, with its next pointer and cached hash
+    size_t size = names.bucket_count() * sizeof(void*) +
+                  names.size() * (sizeof(names_t::value_type) +
+                                  sizeof(void*) + sizeof(size_t));
+    for (const names_t::value_type& name : names) {
+        size += name.first.length() + 1;
+    }
+    return size;
 }
 
 // caller must free character string
 const char* LogStatistics::pidToName(pid_t pid) const {
     // An inconvenient truth ... getName() can alter the object
     pidTable_t& writablePidTable = const_cast<pidTable_t&>(pidTable);
-    const char* name = writablePidTable.add(pid)->second.getName();
+    const char* name = writablePidTable.add(pid).getName();
     if (!name) {
         return NULL;
     }
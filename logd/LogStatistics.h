@@ -27,9 +27,15 @@
 #include <algorithm>  // std::max
 #include <experimental/string_view>
 #include <memory>
+#include <new>
+#include <set>
 #include <string>  // std::string
+#include <type_traits>
 #include <unordered_map>
+#include <utility>
+#include <vector>
 
+#include <android-base/macros.h>
 #include <android-base/stringprintf.h>
 #include <android/log.h>
 #include <log/log_time.h>
@@ -46,38 +52,200 @@ class LogStatistics;
 
 template <typename TKey, typename TEntry>
 class LogHashtable {
-    std::unordered_map<TKey, TEntry> map;
+    // Entries are constructed in place in fixed size chunks and never move,
+    // the open addressed index (linear probing, backward shift deletion)
+    // only holds their slot numbers. Against an unordered_map node and
+    // bucket per entry, that saves a few words and an allocation for all
+    // but one entry in every chunkEntries, which adds up in the pid and tid
+    // tables that see every process and thread that ever logged.
+    static const size_t chunkEntries = 64;
+    struct Chunk {
+        typename std::aligned_storage<sizeof(TEntry), alignof(TEntry)>::type
+            entries[chunkEntries];
+    };
+    std::vector<Chunk*> chunks;       // nullptr once compact() emptied them
+    std::vector<uint32_t> hashes;     // per slot, 0 if the slot is free
+    std::vector<uint32_t> freeSlots;  // taken from the back
+    std::vector<uint32_t> index;      // slot + 1, 0 if empty, power of 2 long
+    size_t count;
+
+    // Optional (see trackSizes()) size ordered view of the entries so the
+    // worst offenders can be read off the top without sorting the table.
+    // Entries are referenced by address, they do not move once added.
+    typedef std::set<std::pair<size_t, const TEntry*>> sizeIndex_t;
+    sizeIndex_t bySize;
+    bool tracking;
+
+    static const size_t npos = -1;
+    static const size_t set_per_entry_overhead = 4 * sizeof(void*);
+
+    inline void untrack(const TEntry& entry) {
+        if (tracking) bySize.erase(std::make_pair(entry.getSizes(), &entry));
+    }
+    inline void track(const TEntry& entry) {
+        if (tracking) bySize.insert(std::make_pair(entry.getSizes(), &entry));
+    }
+
+    static uint32_t hashOf(const TKey& key) {
+        // spread runs of pids and tags over the whole index
+        uint64_t hash = std::hash<TKey>()(key) * 0x9E3779B97F4A7C15ULL;
+        hash >>= 32;
+        return hash ? hash : 1;
+    }
+
+    TEntry& entryAt(uint32_t slot) const {
+        return *reinterpret_cast<TEntry*>(
+            &chunks[slot / chunkEntries]->entries[slot % chunkEntries]);
+    }
+
+    // index position holding key, or npos
+    size_t lookup(const TKey& key, uint32_t hash) const {
+        if (index.empty()) return npos;
+        size_t mask = index.size() - 1;
+        for (size_t i = hash & mask; index[i]; i = (i + 1) & mask) {
+            uint32_t slot = index[i] - 1;
+            if ((hashes[slot] == hash) && (entryAt(slot).getKey() == key)) {
+                return i;
+            }
+        }
+        return npos;
+    }
+
+    void place(uint32_t slot) {
+        size_t mask = index.size() - 1;
+        size_t i = hashes[slot] & mask;
+        while (index[i]) i = (i + 1) & mask;
+        index[i] = slot + 1;
+    }
 
-    size_t bucket_size() const {
-        size_t count = 0;
-        for (size_t idx = 0; idx < map.bucket_count(); ++idx) {
-            size_t bucket_size = map.bucket_size(idx);
-            if (bucket_size == 0) bucket_size = 1;
-            count += bucket_size;
+    void rehash(size_t length) {
+        index.assign(length, 0);
+        index.shrink_to_fit();
+        for (size_t slot = 0; slot < hashes.size(); ++slot) {
+            if (hashes[slot]) place(slot);
         }
-        float load_factor = map.max_load_factor();
-        if (load_factor < 1.0) return count;
-        return count * load_factor;
     }
 
-    static const size_t unordered_map_per_entry_overhead = sizeof(void*);
-    static const size_t unordered_map_bucket_overhead = sizeof(void*);
+    template <typename TArg>
+    TEntry& insert(uint32_t hash, TArg arg) {
+        // at most 3/4 full, so no probe sequence runs away
+        if (((count + 1) * 4) > (index.size() * 3)) {
+            rehash(index.empty() ? 16 : (index.size() * 2));
+        }
+        if (freeSlots.empty()) {
+            size_t chunk = std::find(chunks.begin(), chunks.end(), nullptr) -
+                           chunks.begin();
+            if (chunk == chunks.size()) {
+                chunks.push_back(nullptr);
+                hashes.resize(chunks.size() * chunkEntries, 0);
+            }
+            chunks[chunk] = new Chunk;
+            for (size_t i = chunkEntries; i; --i) {
+                freeSlots.push_back(chunk * chunkEntries + i - 1);
+            }
+        }
+        uint32_t slot = freeSlots.back();
+        freeSlots.pop_back();
+        TEntry* entry = new (
+            &chunks[slot / chunkEntries]->entries[slot % chunkEntries])
+            TEntry(arg);
+        hashes[slot] = hash;
+        place(slot);
+        ++count;
+        return *entry;
+    }
+
+    // i is the index position of an entry already untrack()ed
+    void remove(size_t i) {
+        uint32_t slot = index[i] - 1;
+        entryAt(slot).~TEntry();
+        hashes[slot] = 0;
+        freeSlots.push_back(slot);
+        --count;
+
+        // Close the gap, pulling back any entry that probed past it
+        size_t mask = index.size() - 1;
+        for (size_t j = (i + 1) & mask; index[j]; j = (j + 1) & mask) {
+            size_t home = hashes[index[j] - 1] & mask;
+            if (((j - home) & mask) >= ((j - i) & mask)) {
+                index[i] = index[j];
+                i = j;
+            }
+        }
+        index[i] = 0;
+    }
 
    public:
+    LogHashtable() : count(0), tracking(false) {
+    }
+    ~LogHashtable() {
+        for (size_t slot = 0; slot < hashes.size(); ++slot) {
+            if (hashes[slot]) entryAt(slot).~TEntry();
+        }
+        for (Chunk* chunk : chunks) delete chunk;
+    }
+
+    // Maintain the size ordered view from here on, used for tables that
+    // prune() asks for the worst offender on every pass.
+    void trackSizes() {
+        if (tracking) return;
+        tracking = true;
+        for (const_iterator it = begin(); it != end(); ++it) {
+            track(*it);
+        }
+    }
+
     size_t size() const {
-        return map.size();
+        return count;
     }
 
-    // Estimate unordered_map memory usage.
     size_t sizeOf() const {
-        return sizeof(*this) +
-               (size() * (sizeof(TEntry) + unordered_map_per_entry_overhead)) +
-               (bucket_size() * sizeof(size_t) + unordered_map_bucket_overhead);
+        size_t size = sizeof(*this) + (chunks.capacity() * sizeof(Chunk*));
+        size += (hashes.capacity() + freeSlots.capacity() + index.capacity()) *
+                sizeof(uint32_t);
+        size += bySize.size() *
+                (sizeof(typename sizeIndex_t::value_type) +
+                 set_per_entry_overhead);
+        for (Chunk* chunk : chunks) {
+            if (chunk) size += sizeof(Chunk);
+        }
+        return size;
     }
 
-    typedef typename std::unordered_map<TKey, TEntry>::iterator iterator;
-    typedef
-        typename std::unordered_map<TKey, TEntry>::const_iterator const_iterator;
+    class const_iterator {
+        const LogHashtable* table;
+        size_t slot;
+
+        void skip() {
+            while ((slot < table->hashes.size()) && !table->hashes[slot]) {
+                ++slot;
+            }
+        }
+
+       public:
+        const_iterator(const LogHashtable* table, size_t slot)
+            : table(table), slot(slot) {
+            skip();
+        }
+
+        const TEntry& operator*() const {
+            return table->entryAt(slot);
+        }
+        const TEntry* operator->() const {
+            return &table->entryAt(slot);
+        }
+        const_iterator& operator++() {
+            ++slot;
+            skip();
+            return *this;
+        }
+        bool operator==(const const_iterator& rval) const {
+            return slot == rval.slot;
+        }
+        bool operator!=(const const_iterator& rval) const {
+            return slot != rval.slot;
+        }
+    };
 
     std::unique_ptr<const TEntry* []> sort(uid_t uid, pid_t pid,
                                            size_t len) const {
@@ -89,8 +257,8 @@ class LogHashtable {
         const TEntry** retval = new const TEntry*[len];
         memset(retval, 0, sizeof(*retval) * len);
 
-        for (const_iterator it = map.begin(); it != map.end(); ++it) {
-            const TEntry& entry = it->second;
+        for (const_iterator it = begin(); it != end(); ++it) {
+            const TEntry& entry = *it;
 
             if ((uid != AID_ROOT) && (uid != entry.getUid())) {
                 continue;
@@ -117,58 +285,128 @@ class LogHashtable {
         return sorted;
     }
 
-    inline iterator add(const TKey& key, const LogBufferElement* element) {
-        iterator it = map.find(key);
-        if (it == map.end()) {
-            it = map.insert(std::make_pair(key, TEntry(element))).first;
-        } else {
-            it->second.add(element);
+    // Same result as sort(AID_ROOT, 0, len) read off the size ordered view,
+    // falls back to sort() if trackSizes() was never called.
+    std::unique_ptr<const TEntry* []> worst(size_t len) const {
+        if (!tracking) return sort(AID_ROOT, (pid_t)0, len);
+        if (!len) {
+            std::unique_ptr<const TEntry* []> sorted(nullptr);
+            return sorted;
         }
-        return it;
-    }
 
-    inline iterator add(TKey key) {
-        iterator it = map.find(key);
-        if (it == map.end()) {
-            it = map.insert(std::make_pair(key, TEntry(key))).first;
-        } else {
-            it->second.add(key);
+        const TEntry** retval = new const TEntry*[len];
+        memset(retval, 0, sizeof(*retval) * len);
+
+        size_t index = 0;
+        for (typename sizeIndex_t::const_reverse_iterator it = bySize.rbegin();
+             (it != bySize.rend()) && (index < len); ++it) {
+            retval[index++] = it->second;
         }
-        return it;
+        std::unique_ptr<const TEntry* []> sorted(retval);
+        return sorted;
     }
 
-    void subtract(TKey&& key, const LogBufferElement* element) {
-        iterator it = map.find(std::move(key));
-        if ((it != map.end()) && it->second.subtract(element)) {
-            map.erase(it);
+    inline TEntry& add(const TKey& key, const LogBufferElement* element) {
+        uint32_t hash = hashOf(key);
+        size_t i = lookup(key, hash);
+        if (i == npos) {
+            TEntry& entry = insert(hash, element);
+            track(entry);
+            return entry;
         }
+        TEntry& entry = entryAt(index[i] - 1);
+        untrack(entry);
+        entry.add(element);
+        track(entry);
+        return entry;
+    }
+
+    inline TEntry& add(TKey key) {
+        uint32_t hash = hashOf(key);
+        size_t i = lookup(key, hash);
+        if (i == npos) {
+            TEntry& entry = insert(hash, key);
+            track(entry);
+            return entry;
+        }
+        TEntry& entry = entryAt(index[i] - 1);
+        entry.add(key);
+        return entry;
     }
 
     void subtract(const TKey& key, const LogBufferElement* element) {
-        iterator it = map.find(key);
-        if ((it != map.end()) && it->second.subtract(element)) {
-            map.erase(it);
+        size_t i = lookup(key, hashOf(key));
+        if (i != npos) {
+            TEntry& entry = entryAt(index[i] - 1);
+            untrack(entry);
+            if (entry.subtract(element)) {
+                remove(i);
+            } else {
+                track(entry);
+            }
         }
     }
 
     inline void drop(TKey key, const LogBufferElement* element) {
-        iterator it = map.find(key);
-        if (it != map.end()) {
-            it->second.drop(element);
+        size_t i = lookup(key, hashOf(key));
+        if (i != npos) {
+            TEntry& entry = entryAt(index[i] - 1);
+            untrack(entry);
+            entry.drop(element);
+            track(entry);
         }
     }
 
-    inline iterator begin() {
-        return map.begin();
+    // Removes the entries dead(entry) holds for, then gives back the chunks
+    // and index space that frees up, returns how many were removed.
+    template <typename TPred>
+    size_t compact(TPred dead) {
+        size_t removed = 0;
+        for (size_t slot = 0; slot < hashes.size(); ++slot) {
+            if (!hashes[slot]) continue;
+            const TEntry& entry = entryAt(slot);
+            if (!dead(entry)) continue;
+            untrack(entry);
+            remove(lookup(entry.getKey(), hashes[slot]));
+            ++removed;
+        }
+        if (!removed) return removed;
+
+        for (size_t chunk = 0; chunk < chunks.size(); ++chunk) {
+            if (!chunks[chunk]) continue;
+            const uint32_t* first = &hashes[chunk * chunkEntries];
+            if (std::find_if(first, first + chunkEntries, [](uint32_t hash) {
+                    return hash != 0;
+                }) == (first + chunkEntries)) {
+                delete chunks[chunk];
+                chunks[chunk] = nullptr;
+            }
+        }
+        while (!chunks.empty() && !chunks.back()) chunks.pop_back();
+        hashes.resize(chunks.size() * chunkEntries);
+        hashes.shrink_to_fit();
+        chunks.shrink_to_fit();
+
+        freeSlots.clear();
+        for (size_t slot = hashes.size(); slot; --slot) {
+            if (chunks[(slot - 1) / chunkEntries] && !hashes[slot - 1]) {
+                freeSlots.push_back(slot - 1);
+            }
+        }
+        freeSlots.shrink_to_fit();
+
+        size_t length = index.size();
+        while ((length > 16) && ((count * 8) < (length * 3))) length /= 2;
+        if (!count) length = 0;
+        if (length != index.size()) rehash(length);
+        return removed;
     }
+
     inline const_iterator begin() const {
-        return map.begin();
-    }
-    inline iterator end() {
-        return map.end();
+        return const_iterator(this, 0);
     }
     inline const_iterator end() const {
-        return map.end();
+        return const_iterator(this, hashes.size());
     }
 
     std::string format(const LogStatistics& stat, uid_t uid, pid_t pid,
@@ -199,6 +437,9 @@ class LogHashtable {
         }
         return output;
     }
+
+   private:
+    DISALLOW_COPY_AND_ASSIGN(LogHashtable);
 };
 
 namespace EntryBaseConstants {
@@ -306,31 +547,52 @@ struct UidEntry : public EntryBaseDropped {
     std::string format(const LogStatistics& stat, log_id_t id) const;
 };
 
+// Process and thread names, one copy of each however many pid and tid
+// entries carry it; most threads go by the name of their process. Used
+// under the same lock as the tables holding the entries.
+class LogNames {
+    struct Name {
+        char* str;
+        size_t refs;
+    };
+    typedef std::unordered_map<std::experimental::string_view, Name> names_t;
+    static names_t names;
+
+   public:
+    // Takes a malloc'ed name (or nullptr) and returns the shared copy, each
+    // intern() or share() of a name must be matched by a release().
+    static const char* intern(char* name);
+    static const char* share(const char* name);
+    static void release(const char* name);
+
+    static size_t sizeOf();
+};
+
 struct PidEntry : public EntryBaseDropped {
     const pid_t pid;
     uid_t uid;
-    char* name;
+    const char* name;  // LogNames
 
     explicit PidEntry(pid_t pid)
         : EntryBaseDropped(),
           pid(pid),
           uid(android::pidToUid(pid)),
-          name(android::pidToName(pid)) {
+          name(LogNames::intern(android::pidToName(pid))) {
     }
     explicit PidEntry(const LogBufferElement* element)
         : EntryBaseDropped(element),
           pid(element->getPid()),
           uid(element->getUid()),
-          name(android::pidToName(pid)) {
+          name(LogNames::intern(android::pidToName(pid))) {
     }
     PidEntry(const PidEntry& element)
         : EntryBaseDropped(element),
           pid(element.pid),
           uid(element.uid),
-          name(element.name ? strdup(element.name) : nullptr) {
+          name(LogNames::share(element.name)) {
     }
     ~PidEntry() {
-        free(name);
+        LogNames::release(name);
     }
 
     const pid_t& getKey() const {
@@ -348,11 +610,11 @@ struct PidEntry : public EntryBaseDropped {
 
     inline void add(pid_t newPid) {
         if (name && !fastcmp<strncmp>(name, "zygote", 6)) {
-            free(name);
+            LogNames::release(name);
             name = nullptr;
         }
         if (!name) {
-            name = android::pidToName(newPid);
+            name = LogNames::intern(android::pidToName(newPid));
         }
     }
 
@@ -360,8 +622,8 @@ struct PidEntry : public EntryBaseDropped {
         uid_t incomingUid = element->getUid();
         if (getUid() != incomingUid) {
             uid = incomingUid;
-            free(name);
-            name = android::pidToName(element->getPid());
+            LogNames::release(name);
+            name = LogNames::intern(android::pidToName(element->getPid()));
         } else {
             add(element->getPid());
         }
@@ -376,38 +638,38 @@ struct TidEntry : public EntryBaseDropped {
     const pid_t tid;
     pid_t pid;
     uid_t uid;
-    char* name;
+    const char* name;  // LogNames
 
     TidEntry(pid_t tid, pid_t pid)
         : EntryBaseDropped(),
           tid(tid),
           pid(pid),
           uid(android::pidToUid(tid)),
-          name(android::tidToName(tid)) {
+          name(LogNames::intern(android::tidToName(tid))) {
     }
     TidEntry(pid_t tid)
         : EntryBaseDropped(),
           tid(tid),
           pid(android::tidToPid(tid)),
           uid(android::pidToUid(tid)),
-          name(android::tidToName(tid)) {
+          name(LogNames::intern(android::tidToName(tid))) {
     }
     explicit TidEntry(const LogBufferElement* element)
         : EntryBaseDropped(element),
           tid(element->getTid()),
           pid(element->getPid()),
           uid(element->getUid()),
-          name(android::tidToName(tid)) {
+          name(LogNames::intern(android::tidToName(tid))) {
     }
     TidEntry(const TidEntry& element)
         : EntryBaseDropped(element),
           tid(element.tid),
           pid(element.pid),
           uid(element.uid),
-          name(element.name ? strdup(element.name) : nullptr) {
+          name(LogNames::share(element.name)) {
     }
     ~TidEntry() {
-        free(name);
+        LogNames::release(name);
     }
 
     const pid_t& getKey() const {
@@ -428,11 +690,11 @@ struct TidEntry : public EntryBaseDropped {
 
     inline void add(pid_t incomingTid) {
         if (name && !fastcmp<strncmp>(name, "zygote", 6)) {
-            free(name);
+            LogNames::release(name);
             name = nullptr;
         }
         if (!name) {
-            name = android::tidToName(incomingTid);
+            name = LogNames::intern(android::tidToName(incomingTid));
         }
     }
 
@@ -442,8 +704,8 @@ struct TidEntry : public EntryBaseDropped {
         if ((getUid() != incomingUid) || (getPid() != incomingPid)) {
             uid = incomingUid;
             pid = incomingPid;
-            free(name);
-            name = android::tidToName(element->getTid());
+            LogNames::release(name);
+            name = LogNames::intern(android::tidToName(element->getTid()));
         } else {
             add(element->getTid());
         }
@@ -708,30 +970,17 @@ class LogStatistics {
     typedef LogHashtable<TagNameKey, TagNameEntry> tagNameTable_t;
     tagNameTable_t tagNameTable;
 
-    size_t sizeOf() const {
-        size_t size = sizeof(*this) + pidTable.sizeOf() + tidTable.sizeOf() +
-                      tagTable.sizeOf() + securityTagTable.sizeOf() +
-                      tagNameTable.sizeOf() +
-                      (pidTable.size() * sizeof(pidTable_t::iterator)) +
-                      (tagTable.size() * sizeof(tagTable_t::iterator));
-        for (auto it : pidTable) {
-            const char* name = it.second.getName();
-            if (name) size += strlen(name) + 1;
-        }
-        for (auto it : tidTable) {
-            const char* name = it.second.getName();
-            if (name) size += strlen(name) + 1;
-        }
-        for (auto it : tagNameTable) size += it.second.getNameAllocLength();
-        log_id_for_each(id) {
-            size += uidTable[id].sizeOf();
-            size += uidTable[id].size() * sizeof(uidTable_t::iterator);
-            size += pidSystemTable[id].sizeOf();
-            size +=
-                pidSystemTable[id].size() * sizeof(pidSystemTable_t::iterator);
+    // pidToUid() and tidToPid() add an entry for every process and thread
+    // asked about, whether or not it logs, so once the two tables have
+    // doubled, drop what they hold for the ones that are gone.
+    static const size_t minCompactThreshold = 1024;
+    size_t compactThreshold;
+    void compact() {
+        if ((pidTable.size() + tidTable.size()) >= compactThreshold) {
+            compactPids();
         }
-        return size;
     }
+    void compactPids();
 
    public:
     LogStatistics();
@@ -763,6 +1012,18 @@ class LogStatistics {
         return LogFindWorst<TagEntry>(tagTable.sort(uid, pid, len));
     }
 
+    // Incrementally maintained equivalents of the above for prune(), with
+    // no uid or pid filtering (pidSystemTable only holds AID_SYSTEM).
+    LogFindWorst<UidEntry> worst(log_id id) {
+        return LogFindWorst<UidEntry>(uidTable[id].worst(2));
+    }
+    LogFindWorst<PidEntry> worstPids(log_id id) {
+        return LogFindWorst<PidEntry>(pidSystemTable[id].worst(2));
+    }
+    LogFindWorst<TagEntry> worstTags(log_id) {
+        return LogFindWorst<TagEntry>(tagTable.worst(2));
+    }
+
     // fast track current value by id only
     size_t sizes(log_id_t id) const {
         return mSizes[id];
@@ -784,6 +1045,8 @@ class LogStatistics {
     }
 
     std::string format(uid_t uid, pid_t pid, unsigned int logMask) const;
+    // memory the tables and names take up, as reported by format()
+    size_t sizeOf() const;
 
     // helper (must be locked directly or implicitly by mLogElementsLock)
     const char* pidToName(pid_t pid) const;
@@ -34,6 +34,7 @@
 #include <log/log_event_list.h>
 #include <log/log_properties.h>
 #include <private/android_filesystem_config.h>
+#include <private/android_logger.h>
 
 #include "LogTags.h"
 #include "LogUtils.h"
@@ -189,6 +190,8 @@ void LogTags::ReadFileEventLogTags(const char* filename, bool warn) {
 
     if (!etc) {
         RebuildFileEventLogTags(filename, warn);
+    } else if (ReadTableEventLogTags(filename, warn)) {
+        return;
     }
     std::string content;
     if (android::base::ReadFileToString(filename, &content)) {
@@ -276,6 +279,36 @@ void LogTags::ReadFileEventLogTags(const char* filename, bool warn) {
     }
 }
 
+// The build time precompiled equivalent of the system file, if up to date.
+bool LogTags::ReadTableEventLogTags(const char* filename, bool warn) {
+    struct stat st;
+    if (stat(filename, &st)) return false;
+
+    const android_event_tag_table_header_t* table =
+        __android_event_tag_table_open(NULL, st.st_size);
+    if (!table) return false;
+
+    {
+        android::RWLock::AutoWLock writeLock(rwlock);
+
+        file2watermark[filename] = st.st_size;
+    }
+
+    for (uint32_t i = 0; i < table->count; ++i) {
+        const android_event_tag_table_entry_t* e =
+            __android_event_tag_table_entry(table, i);
+        AddEventLogTags(
+            e->tag, e->uid,
+            std::string(__android_event_tag_table_string(table, e->name),
+                        e->name_len),
+            std::string(__android_event_tag_table_string(table, e->format),
+                        e->format_len),
+            filename, warn);
+    }
+    __android_event_tag_table_close(table);
+    return true;
+}
+
 // Extract a 4-byte value from a byte stream.
 static inline uint32_t get4LE(const char* msg) {
     const uint8_t* src = reinterpret_cast<const uint8_t*>(msg);
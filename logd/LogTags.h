@@ -75,6 +75,7 @@ class LogTags {
         file2watermark_const_iterator;
 
     void ReadPersistEventLogTags();
+    bool ReadTableEventLogTags(const char* filename, bool warn);
 
     // format helpers
     // format a single entry, does not need object data
@@ -15,6 +15,7 @@
  */
 
 #include <errno.h>
+#include <sched.h>
 #include <string.h>
 #include <sys/prctl.h>
 
@@ -23,14 +24,22 @@
 #include "FlushCommand.h"
 #include "LogBuffer.h"
 #include "LogReader.h"
+#include "LogReaderFilter.h"
+#include "LogReaderRing.h"
 #include "LogTimes.h"
 
 pthread_mutex_t LogTimeEntry::timesLock = PTHREAD_MUTEX_INITIALIZER;
 
+// Entries a reader sends before it lets the other readers have a go. A
+// reader catching up on a full buffer otherwise keeps the others, and the
+// writers contending with all of them, waiting for the whole dump.
+static const unsigned int turnEntries = 256;
+
 LogTimeEntry::LogTimeEntry(LogReader& reader, SocketClient* client,
                            bool nonBlock, unsigned long tail,
                            unsigned int logMask, pid_t pid, log_time start,
-                           uint64_t timeout)
+                           uint64_t timeout, LogReaderRing* ring,
+                           LogReaderFilter* filter)
     : mRefCount(1),
       mRelease(false),
       mError(false),
@@ -42,6 +51,10 @@ LogTimeEntry::LogTimeEntry(LogReader& reader, SocketClient* client,
       mCount(0),
       mTail(tail),
       mIndex(0),
+      mTurnLeft(0),
+      mTurnOver(false),
+      mRing(ring),
+      mFilter(filter),
       mClient(client),
       mStart(start),
       mNonBlock(nonBlock),
@@ -53,6 +66,11 @@ LogTimeEntry::LogTimeEntry(LogReader& reader, SocketClient* client,
     cleanSkip_Locked();
 }
 
+LogTimeEntry::~LogTimeEntry() {
+    delete mRing;
+    delete mFilter;
+}
+
 void LogTimeEntry::startReader_Locked(void) {
     pthread_attr_t attr;
 
@@ -139,7 +157,7 @@ void* LogTimeEntry::threadStart(void* obj) {
     log_time start = me->mStart;
 
     while (me->threadRunning && !me->isError_Locked()) {
-        if (me->mTimeout.tv_sec || me->mTimeout.tv_nsec) {
+        if (!me->mTurnOver && (me->mTimeout.tv_sec || me->mTimeout.tv_nsec)) {
             if (pthread_cond_timedwait(&me->threadTriggeredCondition,
                                        &timesLock, &me->mTimeout) == ETIMEDOUT) {
                 me->mTimeout.tv_sec = 0;
@@ -150,15 +168,25 @@ void* LogTimeEntry::threadStart(void* obj) {
             }
         }
 
+        // A tail is cut off by what is counted up front, send it at once
+        me->mTurnLeft = me->mTail ? 0 : turnEntries;
+        me->mTurnOver = false;
+
         unlock();
 
         if (me->mTail) {
             logbuf.flushTo(client, start, nullptr, privileged, security,
-                           FilterFirstPass, me);
+                           FilterFirstPass, me, nullptr, me->mLogMask);
             me->leadingDropped = true;
         }
         start = logbuf.flushTo(client, start, me->mLastTid, privileged,
-                               security, FilterSecondPass, me);
+                               security, FilterSecondPass, me, me->mRing,
+                               me->mLogMask);
+        // One cursor update for everything this pass put in the ring
+        if (me->mRing && (start != LogBufferElement::FLUSH_ERROR) &&
+            !me->mRing->publish(client)) {
+            start = LogBufferElement::FLUSH_ERROR;
+        }
 
         wrlock();
 
@@ -169,7 +197,19 @@ void* LogTimeEntry::threadStart(void* obj) {
 
         me->mStart = start + log_time(0, 1);
 
-        if (me->mNonBlock || !me->threadRunning || me->isError_Locked()) {
+        if (!me->threadRunning || me->isError_Locked()) {
+            break;
+        }
+
+        if (me->mTurnOver) {
+            // more to send, after whoever else is runnable
+            unlock();
+            sched_yield();
+            wrlock();
+            continue;
+        }
+
+        if (me->mNonBlock) {
             break;
         }
 
@@ -206,7 +246,8 @@ int LogTimeEntry::FilterFirstPass(const LogBufferElement* element, void* obj) {
     }
 
     if ((!me->mPid || (me->mPid == element->getPid())) &&
-        (me->isWatching(element->getLogId()))) {
+        (me->isWatching(element->getLogId())) &&
+        (!me->mFilter || me->mFilter->isLoggable(element))) {
         ++me->mCount;
     }
 
@@ -221,6 +262,10 @@ int LogTimeEntry::FilterSecondPass(const LogBufferElement* element, void* obj) {
 
     LogTimeEntry::wrlock();
 
+    if (me->mTurnOver) {
+        goto stop;
+    }
+
     me->mStart = element->getRealTime();
 
     if (me->skipAhead[element->getLogId()]) {
@@ -248,6 +293,10 @@ int LogTimeEntry::FilterSecondPass(const LogBufferElement* element, void* obj) {
         goto skip;
     }
 
+    if (me->mFilter && !me->mFilter->isLoggable(element)) {
+        goto skip;
+    }
+
     if (me->isError_Locked()) {
         goto stop;
     }
@@ -268,6 +317,9 @@ int LogTimeEntry::FilterSecondPass(const LogBufferElement* element, void* obj) {
 
 ok:
     if (!me->skipAhead[element->getLogId()]) {
+        if (me->mTurnLeft && !--me->mTurnLeft) {
+            me->mTurnOver = true;  // stop at the next one
+        }
         LogTimeEntry::unlock();
         return true;
     }
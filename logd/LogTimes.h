@@ -28,6 +28,8 @@
 
 class LogReader;
 class LogBufferElement;
+class LogReaderFilter;
+class LogReaderRing;
 
 class LogTimeEntry {
     static pthread_mutex_t timesLock;
@@ -48,11 +50,20 @@ class LogTimeEntry {
     unsigned long mCount;
     unsigned long mTail;
     unsigned long mIndex;
+    // Entries left to send this turn, 0 if unbounded, and whether a turn
+    // ended on them rather than on running out of entries.
+    unsigned int mTurnLeft;
+    bool mTurnOver;
+    LogReaderRing* mRing;  // owned, nullptr for plain socket readers
+    LogReaderFilter* mFilter;  // owned, nullptr if there is none
 
    public:
     LogTimeEntry(LogReader& reader, SocketClient* client, bool nonBlock,
                  unsigned long tail, unsigned int logMask, pid_t pid,
-                 log_time start, uint64_t timeout);
+                 log_time start, uint64_t timeout,
+                 LogReaderRing* ring = nullptr,
+                 LogReaderFilter* filter = nullptr);
+    ~LogTimeEntry();
 
     SocketClient* mClient;
     log_time mStart;
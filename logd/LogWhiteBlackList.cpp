@@ -15,6 +15,7 @@
  */
 
 #include <ctype.h>
+#include <inttypes.h>
 
 #include <android-base/stringprintf.h>
 #include <cutils/properties.h>
@@ -23,7 +24,7 @@
 
 // White and Black list
 
-Prune::Prune(uid_t uid, pid_t pid) : mUid(uid), mPid(pid) {
+Prune::Prune(uid_t uid, pid_t pid) : mUid(uid), mPid(pid), mHits(0) {
 }
 
 int Prune::cmp(uid_t uid, pid_t pid) const {
@@ -36,18 +37,24 @@ int Prune::cmp(uid_t uid, pid_t pid) const {
     return uid - mUid;
 }
 
-std::string Prune::format() {
+std::string Prune::format(bool hits) {
+    std::string string;
     if (mUid != uid_all) {
         if (mPid != pid_all) {
-            return android::base::StringPrintf("%u/%u", mUid, mPid);
+            string = android::base::StringPrintf("%u/%u", mUid, mPid);
+        } else {
+            string = android::base::StringPrintf("%u", mUid);
         }
-        return android::base::StringPrintf("%u", mUid);
+    } else if (mPid != pid_all) {
+        string = android::base::StringPrintf("/%u", mPid);
+    } else {
+        // NB: mPid == pid_all can not happen if mUid == uid_all
+        string = "/";
     }
-    if (mPid != pid_all) {
-        return android::base::StringPrintf("/%u", mPid);
+    if (hits) {
+        string += android::base::StringPrintf(":%" PRIu64, getHits());
     }
-    // NB: mPid == pid_all can not happen if mUid == uid_all
-    return std::string("/");
+    return string;
 }
 
 PruneList::PruneList() {
@@ -65,6 +72,14 @@ PruneList::~PruneList() {
 }
 
 int PruneList::init(const char* str) {
+    int ret = parse(str);
+    // Whatever parse() got to before any error stays in effect
+    compile(mNaughty, mNaughtyIndex);
+    compile(mNice, mNiceIndex);
+    return ret;
+}
+
+int PruneList::parse(const char* str) {
     mWorstUidEnabled = true;
     mWorstPidOfSystemEnabled = true;
     PruneCollection::iterator it;
@@ -198,14 +213,14 @@ int PruneList::init(const char* str) {
             }
             if (m <= 0) {
                 if (m < 0) {
-                    list->insert(it, Prune(uid, pid));
+                    list->emplace(it, uid, pid);
                 }
                 break;
             }
             ++it;
         }
         if (it == list->end()) {
-            list->push_back(Prune(uid, pid));
+            list->emplace_back(uid, pid);
         }
         if (!*str) {
             break;
@@ -215,7 +230,7 @@ int PruneList::init(const char* str) {
     return 0;
 }
 
-std::string PruneList::format() {
+std::string PruneList::format(bool hits) {
     static const char nice_format[] = " %s";
     const char* fmt = nice_format + 1;
 
@@ -232,40 +247,50 @@ std::string PruneList::format() {
     PruneCollection::iterator it;
 
     for (it = mNice.begin(); it != mNice.end(); ++it) {
-        string += android::base::StringPrintf(fmt, (*it).format().c_str());
+        string += android::base::StringPrintf(fmt, (*it).format(hits).c_str());
         fmt = nice_format;
     }
 
     static const char naughty_format[] = " ~%s";
     fmt = naughty_format + (*fmt != ' ');
     for (it = mNaughty.begin(); it != mNaughty.end(); ++it) {
-        string += android::base::StringPrintf(fmt, (*it).format().c_str());
+        string += android::base::StringPrintf(fmt, (*it).format(hits).c_str());
         fmt = naughty_format;
     }
 
     return string;
 }
 
-// ToDo: Lists are in sorted order, Prune->cmp() returns + or -
-// If there is scaling issues, resort to a better algorithm than linear
-// based on these assumptions.
+void PruneList::compile(PruneCollection& list, PruneIndex& index) {
+    index.clear();
+    for (Prune& p : list) {
+        index[key(p.mUid, p.mPid)] = &p;
+    }
+}
 
-bool PruneList::naughty(LogBufferElement* element) {
-    PruneCollection::iterator it;
-    for (it = mNaughty.begin(); it != mNaughty.end(); ++it) {
-        if (!(*it).cmp(element)) {
+// A rule names a uid, a pid, or both, so an element can match at most the
+// three keys below; init() already dropped uid/pid rules covered by a uid.
+bool PruneList::match(PruneIndex& index, LogBufferElement* element) {
+    if (index.empty()) {
+        return false;
+    }
+    uid_t uid = element->getUid();
+    pid_t pid = element->getPid();
+    for (uint64_t k : { key(uid, Prune::pid_all), key(uid, pid),
+                        key(Prune::uid_all, pid) }) {
+        PruneIndex::iterator it = index.find(k);
+        if (it != index.end()) {
+            it->second->mHits.fetch_add(1, std::memory_order_relaxed);
             return true;
         }
     }
     return false;
 }
 
+bool PruneList::naughty(LogBufferElement* element) {
+    return match(mNaughtyIndex, element);
+}
+
 bool PruneList::nice(LogBufferElement* element) {
-    PruneCollection::iterator it;
-    for (it = mNice.begin(); it != mNice.end(); ++it) {
-        if (!(*it).cmp(element)) {
-            return true;
-        }
-    }
-    return false;
+    return match(mNiceIndex, element);
 }
@@ -19,8 +19,12 @@
 
 #include <sys/types.h>
 
+#include <stdint.h>
 #include <string.h>
+
+#include <atomic>
 #include <list>
+#include <unordered_map>
 
 #include "LogBufferElement.h"
 
@@ -31,6 +35,8 @@ class Prune {
 
     const uid_t mUid;
     const pid_t mPid;
+    // Elements this rule matched, bumped from naughty() and nice()
+    std::atomic<uint64_t> mHits;
     int cmp(uid_t uid, pid_t pid) const;
 
    public:
@@ -50,17 +56,33 @@ class Prune {
         return cmp(e->getUid(), e->getPid());
     }
 
-    std::string format();
+    uint64_t getHits() const {
+        return mHits.load(std::memory_order_relaxed);
+    }
+
+    std::string format(bool hits = false);
 };
 
 typedef std::list<Prune> PruneCollection;
+// Keyed by PruneList::key(), pointing into the PruneCollection of the rules
+typedef std::unordered_map<uint64_t, Prune*> PruneIndex;
 
 class PruneList {
     PruneCollection mNaughty;
     PruneCollection mNice;
+    // The lists above compiled for lookup, rebuilt by init()
+    PruneIndex mNaughtyIndex;
+    PruneIndex mNiceIndex;
     bool mWorstUidEnabled;
     bool mWorstPidOfSystemEnabled;
 
+    static uint64_t key(uid_t uid, pid_t pid) {
+        return (static_cast<uint64_t>(uid) << 32) | static_cast<uint32_t>(pid);
+    }
+    static void compile(PruneCollection& list, PruneIndex& index);
+    static bool match(PruneIndex& index, LogBufferElement* element);
+    int parse(const char* str);
+
    public:
     PruneList();
     ~PruneList();
@@ -82,7 +104,9 @@ class PruneList {
         return mWorstPidOfSystemEnabled;
     }
 
-    std::string format();
+    // With hits, each rule is followed by :<number of elements it matched>,
+    // which init() can not take back.
+    std::string format(bool hits = false);
 };
 
 #endif  // _LOGD_LOG_WHITE_BLACK_LIST_H__
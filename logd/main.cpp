@@ -50,6 +50,8 @@
 #include "CommandListener.h"
 #include "LogAudit.h"
 #include "LogBuffer.h"
+#include "LogBufferArena.h"
+#include "LogBufferBlock.h"
 #include "LogKlog.h"
 #include "LogListener.h"
 #include "LogUtils.h"
@@ -484,7 +486,15 @@ int main(int argc, char* argv[]) {
     LastLogTimes* times = new LastLogTimes();
 
     // LogBuffer is the object which is responsible for holding all
-    // log entries.
+    // log entries. Their storage may come from per log id ring arenas,
+    // or cold text payloads may be deflated, not both.
+
+    LogBufferArena::enable(__android_logger_property_get_bool(
+        "logd.arena", BOOL_DEFAULT_FALSE | BOOL_DEFAULT_FLAG_PERSIST));
+    LogBufferBlock::enable(
+        !LogBufferArena::isEnabled() &&
+        __android_logger_property_get_bool(
+            "logd.compress", BOOL_DEFAULT_FALSE | BOOL_DEFAULT_FLAG_PERSIST));
 
     logBuf = new LogBuffer(times);
 
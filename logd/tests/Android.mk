@@ -23,6 +23,21 @@ LOCAL_PATH := $(call my-dir)
 test_module_prefix := logd-
 test_tags := tests
 
+benchmark_src_files := \
+    logd_benchmark.cpp \
+    logd_buffer_benchmark.cpp
+
+# Build benchmarks for the device. Run with:
+#   adb shell /data/nativetest/logd-benchmarks/logd-benchmarks
+include $(CLEAR_VARS)
+LOCAL_MODULE := $(test_module_prefix)benchmarks
+LOCAL_MODULE_TAGS := $(test_tags)
+LOCAL_CFLAGS += -Wall -Wextra -Werror -DLIBLOG_LOG_TAG=1006
+LOCAL_SRC_FILES := $(benchmark_src_files)
+LOCAL_STATIC_LIBRARIES := liblogd
+LOCAL_SHARED_LIBRARIES := libbase libcutils liblog libsysutils libz
+include $(BUILD_NATIVE_BENCHMARK)
+
 # -----------------------------------------------------------------------------
 # Unit tests.
 # -----------------------------------------------------------------------------
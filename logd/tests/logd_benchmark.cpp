@@ -0,0 +1,135 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdarg.h>
+#include <string.h>
+
+#include <memory>
+#include <vector>
+
+#include <android-base/stringprintf.h>
+#include <benchmark/benchmark.h>
+
+#include "LogBufferElement.h"
+#include "LogStatistics.h"
+
+// Furnished in logd's main.cpp, not part of liblogd
+namespace android {
+char* uidToName(uid_t) {
+    return nullptr;
+}
+void prdebug(const char*, ...) {
+}
+}
+
+// Populate a main buffer's statistics with state.range(0) distinct
+// uids, sizes skewed so there is a clear worst and second worst.
+static void populate(LogStatistics& stats,
+                     std::vector<std::unique_ptr<LogBufferElement>>& elements,
+                     size_t uids) {
+    static char msg[256];
+    memset(msg, 'x', sizeof(msg));
+    msg[0] = ANDROID_LOG_INFO;
+    for (size_t uid = 0; uid < uids; ++uid) {
+        unsigned short len = 16 + (uid % (sizeof(msg) - 16));
+        LogBufferElement* element = new LogBufferElement(
+            LOG_ID_MAIN, log_time(CLOCK_REALTIME), AID_APP + uid, 1, 1, msg,
+            len);
+        stats.add(element);
+        elements.emplace_back(element);
+    }
+}
+
+// What prune() used to do on every pass: allocate and sort the uid table
+static void BM_prune_worst_sort(benchmark::State& state) {
+    LogStatistics stats;
+    std::vector<std::unique_ptr<LogBufferElement>> elements;
+    populate(stats, elements, state.range(0));
+
+    while (state.KeepRunning()) {
+        int worst = -1;
+        size_t worst_sizes = 0;
+        size_t second_worst_sizes = 0;
+        stats.sort(AID_ROOT, (pid_t)0, 2, LOG_ID_MAIN)
+            .findWorst(worst, worst_sizes, second_worst_sizes, 0);
+        benchmark::DoNotOptimize(worst);
+    }
+}
+BENCHMARK(BM_prune_worst_sort)->Arg(16)->Arg(1024)->Arg(4096);
+
+// Read off the incrementally maintained size index
+static void BM_prune_worst_tracked(benchmark::State& state) {
+    LogStatistics stats;
+    std::vector<std::unique_ptr<LogBufferElement>> elements;
+    populate(stats, elements, state.range(0));
+
+    while (state.KeepRunning()) {
+        int worst = -1;
+        size_t worst_sizes = 0;
+        size_t second_worst_sizes = 0;
+        stats.worst(LOG_ID_MAIN)
+            .findWorst(worst, worst_sizes, second_worst_sizes, 0);
+        benchmark::DoNotOptimize(worst);
+    }
+}
+BENCHMARK(BM_prune_worst_tracked)->Arg(16)->Arg(1024)->Arg(4096);
+
+// Insert and expire one entry, the write path cost of keeping the index
+static void BM_stats_add_subtract(benchmark::State& state) {
+    LogStatistics stats;
+    std::vector<std::unique_ptr<LogBufferElement>> elements;
+    populate(stats, elements, state.range(0));
+
+    size_t index = 0;
+    while (state.KeepRunning()) {
+        LogBufferElement* element = elements[index].get();
+        stats.subtract(element);
+        stats.add(element);
+        if (++index >= elements.size()) index = 0;
+    }
+}
+BENCHMARK(BM_stats_add_subtract)->Arg(16)->Arg(1024)->Arg(4096);
+
+// Per thread statistics for state.range(0) threads, ten to a process,
+// labelled with the memory the tables take up holding them.
+static void BM_stats_tids(benchmark::State& state) {
+    LogStatistics stats;
+    stats.enableStatistics();
+    std::vector<std::unique_ptr<LogBufferElement>> elements;
+    static char msg[64];
+    memset(msg, 'x', sizeof(msg));
+    msg[0] = ANDROID_LOG_INFO;
+    for (pid_t tid = 1; tid <= state.range(0); ++tid) {
+        LogBufferElement* element = new LogBufferElement(
+            LOG_ID_MAIN, log_time(CLOCK_REALTIME), AID_APP + (tid % 100),
+            1 + (tid / 10), tid, msg, sizeof(msg));
+        stats.add(element);
+        elements.emplace_back(element);
+    }
+
+    size_t index = 0;
+    while (state.KeepRunning()) {
+        LogBufferElement* element = elements[index].get();
+        stats.subtract(element);
+        stats.add(element);
+        if (++index >= elements.size()) index = 0;
+    }
+    state.SetLabel(
+        android::base::StringPrintf("%zu bytes", stats.sizeOf()).c_str());
+}
+BENCHMARK(BM_stats_tids)->Arg(5000);
+
+BENCHMARK_MAIN();
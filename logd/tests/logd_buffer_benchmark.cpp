@@ -0,0 +1,323 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// logd end to end, in process: writer threads log() into a LogBuffer the way
+// LogListener does, notifying the readers after each entry, and the readers
+// are LogTimeEntry threads started by FlushCommand, as LogReader would have,
+// flushing to socketpairs that are drained and timed here.
+//
+// Writers log with their own uid, so prune() has someone to pick on once the
+// buffer fills. Labels report the write to reader delivery latency and the
+// resident size of the process afterwards.
+
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <android-base/file.h>
+#include <android-base/stringprintf.h>
+#include <benchmark/benchmark.h>
+#include <private/android_logger.h>
+#include <sysutils/SocketClient.h>
+
+#include "FlushCommand.h"
+#include "LogBuffer.h"
+#include "LogCommand.h"
+#include "LogReader.h"
+#include "LogTimes.h"
+
+static const char kTag[] = "logd_bench";
+
+// Latencies are counted in microsecond buckets, the last one for the rest.
+static const size_t kLatencyBuckets = 100000;
+
+// How long the readers get to catch up with the writers, once they stop.
+static const uint64_t kCatchUpNs = 5 * NS_PER_SEC;
+
+static uint64_t nowNs(clockid_t clock) {
+    struct timespec ts;
+    clock_gettime(clock, &ts);
+    return ts.tv_sec * NS_PER_SEC + ts.tv_nsec;
+}
+
+static size_t rssKb() {
+    std::string statm;
+    unsigned long size, resident;
+    if (!android::base::ReadFileToString("/proc/self/statm", &statm) ||
+        (sscanf(statm.c_str(), "%lu %lu", &size, &resident) != 2)) {
+        return 0;
+    }
+    return resident * (getpagesize() / 1024);
+}
+
+// One logcat: a client socket the LogTimeEntry flushes to, and a thread
+// draining the other end of it.
+class BenchReader {
+    SocketClient* mClient;
+    int mPeer;
+    std::thread mThread;
+    std::atomic<size_t> mReceived;
+    std::vector<uint32_t> mLatency;
+
+    void drain() {
+        char buf[LOGGER_ENTRY_MAX_LEN + sizeof(struct logger_entry_v4)];
+        ssize_t len;
+        while ((len = TEMP_FAILURE_RETRY(recv(mPeer, buf, sizeof(buf), 0))) > 0) {
+            uint64_t now = nowNs(CLOCK_REALTIME);
+            struct logger_entry_v4 entry;
+            if (static_cast<size_t>(len) < sizeof(entry)) continue;
+            memcpy(&entry, buf, sizeof(entry));
+            // Only ours, chatty summaries carry the time of what they replace
+            const char* msg = buf + entry.hdr_size;
+            if ((entry.hdr_size + 1 + sizeof(kTag) > static_cast<size_t>(len)) ||
+                strcmp(msg + 1, kTag)) {
+                continue;
+            }
+            uint64_t written = entry.sec * NS_PER_SEC + entry.nsec;
+            uint64_t us = (now > written) ? (now - written) / 1000 : 0;
+            ++mLatency[std::min<uint64_t>(us, kLatencyBuckets - 1)];
+            mReceived.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+   public:
+    BenchReader() : mClient(nullptr), mPeer(-1), mReceived(0), mLatency(kLatencyBuckets) {
+    }
+
+    ~BenchReader() {
+        if (mClient) mClient->decRef();  // closes our end, and drain() returns
+        if (mThread.joinable()) mThread.join();
+        if (mPeer >= 0) close(mPeer);
+    }
+
+    bool start(LogReader& reader) {
+        int sv[2];
+        if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, sv) < 0) {
+            return false;
+        }
+        mClient = new SocketClient(sv[0], true);
+        mPeer = sv[1];
+        mThread = std::thread(&BenchReader::drain, this);
+        // as LogReader::onDataAvailable() does for a blocking "logcat -b main"
+        FlushCommand command(reader, false, 0, 1 << LOG_ID_MAIN, 0, log_time::EPOCH, 0);
+        command.runSocketCommand(mClient);
+        return true;
+    }
+
+    SocketClient* client() const {
+        return mClient;
+    }
+    size_t received() const {
+        return mReceived.load(std::memory_order_relaxed);
+    }
+    const std::vector<uint32_t>& latency() const {
+        return mLatency;
+    }
+};
+
+class BenchLogd {
+    LastLogTimes mTimes;
+    LogBuffer mLogbuf;
+    LogReader mReader;
+    std::vector<std::unique_ptr<BenchReader>> mReaders;
+    std::atomic<size_t> mLogged;
+
+   public:
+    BenchLogd(unsigned long size, size_t readers)
+        : mLogbuf(&mTimes), mReader(&mLogbuf, -1), mLogged(0) {
+        mLogbuf.enableStatistics();
+        mLogbuf.setSize(LOG_ID_MAIN, size);
+        for (size_t i = 0; i < readers; ++i) {
+            mReaders.emplace_back(new BenchReader());
+            mReaders.back()->start(mReader);
+        }
+    }
+
+    ~BenchLogd() {
+        // Stop the reader threads, they take themselves off mTimes
+        LogTimeEntry::wrlock();
+        for (LogTimeEntry* entry : mTimes) {
+            entry->error_Locked();
+            entry->triggerReader_Locked();
+        }
+        while (!mTimes.empty()) {
+            LogTimeEntry::unlock();
+            usleep(1000);
+            LogTimeEntry::wrlock();
+        }
+        LogTimeEntry::unlock();
+        mReaders.clear();
+    }
+
+    bool privileged() {
+        return mReaders.empty() || FlushCommand::hasReadLogs(mReaders[0]->client());
+    }
+
+    // What LogListener::onDataAvailable() does with each entry
+    void log(uid_t uid, pid_t pid, const char* msg, unsigned short len) {
+        if (mLogbuf.log(LOG_ID_MAIN, log_time(CLOCK_REALTIME), uid, pid, pid, msg, len) <= 0) {
+            return;
+        }
+        mLogged.fetch_add(1, std::memory_order_relaxed);
+        for (auto& reader : mReaders) {
+            FlushCommand command(mReader);
+            command.runSocketCommand(reader->client());
+        }
+    }
+
+    void clear() {
+        mLogbuf.clear(LOG_ID_MAIN);
+    }
+    unsigned long sizeUsed() {
+        return mLogbuf.getSizeUsed(LOG_ID_MAIN);
+    }
+
+    // Waits for the readers to stop making progress, or to have it all
+    void catchUp() {
+        size_t logged = mLogged.load(std::memory_order_relaxed);
+        uint64_t deadline = nowNs(CLOCK_MONOTONIC) + kCatchUpNs;
+        for (auto& reader : mReaders) {
+            size_t received = reader->received();
+            while ((received < logged) && (nowNs(CLOCK_MONOTONIC) < deadline)) {
+                usleep(10000);
+                size_t now = reader->received();
+                if (now == received) break;  // kicked, or left behind by prune
+                received = now;
+            }
+        }
+    }
+
+    // "p50 <us> p99 <us> max <us>" over every reader, and the share of entries
+    // they got: readers that fall behind a pruning buffer miss some.
+    std::string latency() {
+        if (mReaders.empty()) return "";
+        std::vector<uint64_t> histogram(kLatencyBuckets);
+        uint64_t count = 0;
+        for (auto& reader : mReaders) {
+            const std::vector<uint32_t>& latency = reader->latency();
+            for (size_t us = 0; us < kLatencyBuckets; ++us) {
+                histogram[us] += latency[us];
+                count += latency[us];
+            }
+        }
+        size_t percentile[3] = { 0, 0, 0 };
+        const uint64_t rank[3] = { count / 2, count * 99 / 100, count ? count - 1 : 0 };
+        uint64_t seen = 0;
+        size_t found = 0;
+        for (size_t us = 0; (us < kLatencyBuckets) && (found < 3); ++us) {
+            seen += histogram[us];
+            while ((found < 3) && (seen > rank[found])) percentile[found++] = us;
+        }
+        size_t logged = mLogged.load(std::memory_order_relaxed) * mReaders.size();
+        return android::base::StringPrintf(
+            "p50 %zuus p99 %zuus max %zuus got %zu%% ", percentile[0], percentile[1],
+            percentile[2], logged ? static_cast<size_t>(count * 100 / logged) : 0);
+    }
+};
+
+// A writer's entries: distinct so that chatty does not fold them.
+static unsigned short formatEntry(char* msg, size_t size, size_t seq) {
+    msg[0] = ANDROID_LOG_INFO;
+    memcpy(msg + 1, kTag, sizeof(kTag));
+    int len = snprintf(msg + 1 + sizeof(kTag), size - 1 - sizeof(kTag),
+                       "message %zu from a benchmark writer, padded to look like the usual",
+                       seq);
+    return 1 + sizeof(kTag) + len + 1;
+}
+
+static const size_t kEntriesPerWriter = 1000;
+
+// state.range(0) writers logging kEntriesPerWriter entries each per iteration,
+// with state.range(1) logcats following along, into a state.range(2) KiB main
+// buffer. Small buffers are pruning throughout.
+static void BM_logd_ingest(benchmark::State& state) {
+    size_t writers = state.range(0);
+    BenchLogd logd(state.range(2) * 1024, state.range(1));
+    if (!logd.privileged()) {
+        state.SkipWithError("Needs to run as root or in the log group");
+        return;
+    }
+
+    size_t seq = 0;
+    while (state.KeepRunning()) {
+        std::vector<std::thread> threads;
+        for (size_t w = 0; w < writers; ++w) {
+            threads.emplace_back([&logd, w, seq]() {
+                char msg[256];
+                for (size_t i = 0; i < kEntriesPerWriter; ++i) {
+                    unsigned short len = formatEntry(msg, sizeof(msg), seq + i);
+                    logd.log(AID_APP + w, 1000 + w, msg, len);
+                }
+            });
+        }
+        for (auto& thread : threads) thread.join();
+        seq += kEntriesPerWriter;
+    }
+    state.SetItemsProcessed(state.iterations() * writers * kEntriesPerWriter);
+
+    logd.catchUp();
+    state.SetLabel(logd.latency() +
+                   android::base::StringPrintf("rss %zukB", rssKb()));
+}
+BENCHMARK(BM_logd_ingest)
+    ->Args({ 1, 0, 4096 })
+    ->Args({ 1, 1, 4096 })
+    ->Args({ 4, 0, 256 })
+    ->Args({ 4, 2, 256 })
+    ->Args({ 4, 2, 4096 })
+    ->Args({ 16, 4, 4096 })
+    ->UseRealTime();
+
+// The cost of one entry logged into a buffer that is full, and so pruned on
+// every write, when state.range(0), against one kept with room to spare by
+// clearing it outside of the timing.
+static void BM_logd_prune(benchmark::State& state) {
+    bool full = state.range(0);
+    static const unsigned long size = 256 * 1024;
+    BenchLogd logd(size, 0);
+    char msg[256];
+    size_t seq = 0;
+    // a handful of apps taking turns, the worst of them getting the chop
+    auto logOne = [&]() {
+        unsigned short len = formatEntry(msg, sizeof(msg), seq);
+        logd.log(AID_APP + (seq % 8), 1000 + (seq % 8), msg, len);
+        ++seq;
+    };
+    // twice over, pruning never lets it quite fill
+    if (full) {
+        while (seq < 2 * size / formatEntry(msg, sizeof(msg), seq)) logOne();
+    }
+
+    while (state.KeepRunning()) {
+        logOne();
+        if (!full && (logd.sizeUsed() > size / 2)) {
+            state.PauseTiming();
+            logd.clear();
+            state.ResumeTiming();
+        }
+    }
+    state.SetLabel(android::base::StringPrintf("rss %zukB", rssKb()));
+}
+BENCHMARK(BM_logd_prune)->Arg(0)->Arg(1);
@@ -430,6 +430,78 @@ TEST(logd, both) {
 #endif
 }
 
+TEST(logd, batch) {
+#ifdef __ANDROID__
+    static const int num = 3;
+    pid_t pid = getpid();
+
+    int sock = socket_local_client("logdw", ANDROID_SOCKET_NAMESPACE_RESERVED,
+                                   SOCK_DGRAM);
+    ASSERT_LE(0, sock);
+
+    // Records with distinct payloads, so chatty does not squash them
+    log_time ts(android_log_clockid());
+    char buffer[LOGGER_BATCH_MAX_LEN];
+    android_log_batch_header_t batch = { LOGGER_BATCH_ID, num };
+    memcpy(buffer, &batch, sizeof(batch));
+    size_t len = sizeof(batch);
+    for (int i = 0; i < num; ++i) {
+        android_log_event_long_t event;
+        event.header.tag = 0;
+        event.payload.type = EVENT_TYPE_LONG;
+        log_time tx = ts + log_time(0, i);
+        memcpy(&event.payload.data, &tx, sizeof(event.payload.data));
+
+        android_log_batch_record_t record;
+        record.len = sizeof(event);
+        record.header.id = LOG_ID_EVENTS;
+        record.header.tid = gettid();
+        record.header.realtime = tx;
+        memcpy(buffer + len, &record, sizeof(record));
+        len += sizeof(record);
+        memcpy(buffer + len, &event, sizeof(event));
+        len += sizeof(event);
+    }
+    ASSERT_EQ((ssize_t)len, write(sock, buffer, len));
+    close(sock);
+    usleep(1000000);
+
+    struct logger_list* logger_list;
+    ASSERT_TRUE(nullptr !=
+                (logger_list = android_logger_list_open(
+                     LOG_ID_EVENTS, ANDROID_LOG_RDONLY | ANDROID_LOG_NONBLOCK,
+                     0, pid)));
+
+    int count = 0;
+    for (;;) {
+        log_msg log_msg;
+        if (android_logger_list_read(logger_list, &log_msg) <= 0) break;
+
+        if ((log_msg.entry.pid != pid) ||
+            (log_msg.entry.len != sizeof(android_log_event_long_t)) ||
+            (log_msg.id() != LOG_ID_EVENTS))
+            continue;
+
+        char* eventData = log_msg.msg();
+        if (!eventData || (eventData[4] != EVENT_TYPE_LONG)) continue;
+        int32_t tag;
+        memcpy(&tag, eventData, sizeof(tag));
+        if (tag != 0) continue;
+
+        log_time tx(eventData + 4 + 1);
+        for (int i = 0; i < num; ++i) {
+            if (tx == (ts + log_time(0, i))) ++count;
+        }
+    }
+
+    android_logger_list_close(logger_list);
+
+    EXPECT_EQ(num, count);
+#else
+    GTEST_LOG_(INFO) << "This test does nothing.\n";
+#endif
+}
+
 #ifdef __ANDROID__
 // BAD ROBOT
 //   Benchmark threshold are generally considered bad form unless there is
@@ -877,6 +949,38 @@ TEST(logd, SNDTIMEO) {
 #endif
 }
 
+TEST(logd, getPruneList_hits) {
+#ifdef __ANDROID__
+    char list[1024];
+    memset(list, 0, sizeof(list));
+    snprintf(list, sizeof(list), "getPruneList");
+    send_to_control(list, sizeof(list));
+    list[sizeof(list) - 1] = '\0';
+
+    char hits[1024];
+    memset(hits, 0, sizeof(hits));
+    snprintf(hits, sizeof(hits), "getPruneList hits");
+    send_to_control(hits, sizeof(hits));
+    hits[sizeof(hits) - 1] = '\0';
+
+    // Same rules, each followed by its count
+    std::string stripped;
+    for (const char* cp = strchr(hits, '\n'); cp && *cp; ++cp) {
+        if (*cp == ':') {
+            EXPECT_TRUE(isdigit(cp[1]));
+            while (isdigit(cp[1])) ++cp;
+            continue;
+        }
+        stripped += *cp;
+    }
+    const char* cp = strchr(list, '\n');
+    ASSERT_TRUE(cp != nullptr);
+    EXPECT_EQ(std::string(cp), stripped);
+#else
+    GTEST_LOG_(INFO) << "This test does nothing.\n";
+#endif
+}
+
 TEST(logd, getEventTag_list) {
 #ifdef __ANDROID__
     char buffer[256];
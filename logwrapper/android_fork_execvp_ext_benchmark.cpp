@@ -16,6 +16,10 @@
 
 #include "logwrap/logwrap.h"
 
+#include <unistd.h>
+
+#include <string>
+
 #include <android-base/logging.h>
 #include <benchmark/benchmark.h>
 
@@ -31,4 +35,25 @@ static void BM_android_fork_execvp_ext(benchmark::State& state) {
 }
 BENCHMARK(BM_android_fork_execvp_ext);
 
+// The cost of each line of output, as a chatty child such as mke2fs run at
+// boot would produce, for a log target.
+static void BM_android_fork_execvp_ext_lines(benchmark::State& state, int log_target) {
+    std::string lines = std::to_string(state.range(0));
+    const char* argv[] = {"/system/bin/seq", "1", lines.c_str()};
+    const int argc = 3;
+    char file_path[] = "/data/local/tmp/android_fork_execvp_ext_benchmark.log";
+    while (state.KeepRunning()) {
+        unlink(file_path);
+        int rc = android_fork_execvp_ext(
+            argc, (char**)argv, NULL /* status */, false /* ignore_int_quit */, log_target,
+            false /* abbreviated */, file_path, NULL /* opts */, 0 /* opts_len */);
+        CHECK_EQ(0, rc);
+    }
+    unlink(file_path);
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK_CAPTURE(BM_android_fork_execvp_ext_lines, none, LOG_NONE)->Range(1, 10000);
+BENCHMARK_CAPTURE(BM_android_fork_execvp_ext_lines, alog, LOG_ALOG)->Range(1, 10000);
+BENCHMARK_CAPTURE(BM_android_fork_execvp_ext_lines, file, LOG_FILE)->Range(1, 10000);
+
 BENCHMARK_MAIN();
@@ -52,6 +52,13 @@ do {                                                                          \
 
 #define MAX_KLOG_TAG 16
 
+/* Lines for the Android log are gathered into messages of up to this many
+ * bytes, which logcat shows as separate lines again, rather than costing a
+ * log write each. It is kept within LOGGER_ENTRY_MAX_PAYLOAD, less the
+ * priority and the tag.
+ */
+#define ALOG_BATCH_SIZE 3072
+
 /* This is a simple buffer that holds up to the first beginning_buf->buf_size
  * bytes of output from a command.
  */
@@ -95,6 +102,9 @@ struct log_info {
     bool abbreviated;
     FILE *fp;
     struct abbr_buf a_buf;
+    /* lines waiting to be written to the Android log, see flush_alog() */
+    char alog_buf[ALOG_BATCH_SIZE];
+    size_t alog_len;
 };
 
 /* Forware declaration */
@@ -154,13 +164,41 @@ static void add_line_to_circular_buf(struct ending_buf *e_buf,
     e_buf->write = (e_buf->write + line_len) % e_buf->buf_size;
 }
 
+/* Writes the lines gathered by do_log_line() to the Android log. */
+static void flush_alog(struct log_info *log_info) {
+    if (log_info->alog_len) {
+        log_info->alog_buf[log_info->alog_len - 1] = '\0';
+        ALOG(LOG_INFO, log_info->btag, "%s", log_info->alog_buf);
+        log_info->alog_len = 0;
+    }
+}
+
+static void add_line_to_alog(struct log_info *log_info, const char *line) {
+    size_t len = strlen(line);
+
+    /* the batch separates lines with a newline of its own */
+    if (len && line[len - 1] == '\n') {
+        len--;
+    }
+    if (log_info->alog_len + len + 1 > sizeof(log_info->alog_buf)) {
+        flush_alog(log_info);
+        if (len + 1 > sizeof(log_info->alog_buf)) {
+            ALOG(LOG_INFO, log_info->btag, "%.*s", (int)len, line);
+            return;
+        }
+    }
+    memcpy(log_info->alog_buf + log_info->alog_len, line, len);
+    log_info->alog_len += len;
+    log_info->alog_buf[log_info->alog_len++] = '\n';
+}
+
 /* Log directly to the specified log */
 static void do_log_line(struct log_info *log_info, char *line) {
     if (log_info->log_target & LOG_KLOG) {
         klog_write(6, log_info->klog_fmt, line);
     }
     if (log_info->log_target & LOG_ALOG) {
-        ALOG(LOG_INFO, log_info->btag, "%s", line);
+        add_line_to_alog(log_info, line);
     }
     if (log_info->log_target & LOG_FILE) {
         fprintf(log_info->fp, "%s\n", line);
@@ -290,6 +328,29 @@ static void print_abbr_buf(struct log_info *log_info) {
     }
 }
 
+/*
+ * Writes the child's output to the log file as it comes, for when that is the
+ * only place it goes. The output is not split into lines, only the carriage
+ * returns the pty adds are dropped, so a read costs one copy and one write.
+ * Neither a pty nor a file is a pipe, so there is nothing to splice between.
+ * Returns whether the last byte written ended a line.
+ */
+static bool write_raw(struct log_info *log_info, char *buf, int len, bool line_ended) {
+    char *end = buf + len;
+    char *out = buf;
+
+    for (char *in = buf; in < end; in++) {
+        if (*in != '\r') {
+            *out++ = *in;
+        }
+    }
+    if (out > buf) {
+        fwrite(buf, 1, out - buf, log_info->fp);
+        line_ended = out[-1] == '\n';
+    }
+    return line_ended;
+}
+
 static int parent(const char *tag, int parent_read, pid_t pid,
         int *chld_sts, int log_target, bool abbreviated, char *file_path) {
     int status = 0;
@@ -309,6 +370,8 @@ static int parent(const char *tag, int parent_read, pid_t pid,
     int b = 0;  // end index of unprocessed data
     int sz;
     bool found_child = false;
+    bool raw = false;
+    bool raw_line_ended = true;
     char tmpbuf[256];
 
     log_info.btag = basename(tag);
@@ -346,6 +409,8 @@ static int parent(const char *tag, int parent_read, pid_t pid,
 
     log_info.log_target = log_target;
     log_info.abbreviated = abbreviated;
+    log_info.alog_len = 0;
+    raw = log_target == LOG_FILE && !abbreviated;
 
     while (!found_child) {
         if (TEMP_FAILURE_RETRY(poll(poll_fds, ARRAY_SIZE(poll_fds), -1)) < 0) {
@@ -354,7 +419,12 @@ static int parent(const char *tag, int parent_read, pid_t pid,
             goto err_poll;
         }
 
-        if (poll_fds[0].revents & POLLIN) {
+        if ((poll_fds[0].revents & POLLIN) && raw) {
+            sz = TEMP_FAILURE_RETRY(read(parent_read, buffer, sizeof(buffer)));
+            if (sz > 0) {
+                raw_line_ended = write_raw(&log_info, buffer, sz, raw_line_ended);
+            }
+        } else if (poll_fds[0].revents & POLLIN) {
             sz = TEMP_FAILURE_RETRY(
                 read(parent_read, &buffer[b], sizeof(buffer) - 1 - b));
 
@@ -395,9 +465,13 @@ static int parent(const char *tag, int parent_read, pid_t pid,
                 a = 0;
                 b = 0;
             }
+            /* what the read brought in goes out in as few writes as it can */
+            flush_alog(&log_info);
         }
 
-        if (poll_fds[0].revents & POLLHUP) {
+        /* The child's output may still be waiting when it hangs up,
+         * take it all before reaping the child. */
+        if ((poll_fds[0].revents & POLLHUP) && !(poll_fds[0].revents & POLLIN)) {
             int ret;
 
             ret = TEMP_FAILURE_RETRY(waitpid(pid, &status, 0));
@@ -422,6 +496,9 @@ static int parent(const char *tag, int parent_read, pid_t pid,
     }
 
     // Flush remaining data
+    if (raw && !raw_line_ended) {
+        fputc('\n', log_info.fp);
+    }
     if (a != b) {
       buffer[b] = '\0';
       log_line(&log_info, &buffer[a], b - a);
@@ -452,6 +529,7 @@ static int parent(const char *tag, int parent_read, pid_t pid,
 
 err_waitpid:
 err_poll:
+    flush_alog(&log_info);
     if (log_target & LOG_FILE) {
         fclose(log_info.fp); /* Also closes underlying fd */
     }
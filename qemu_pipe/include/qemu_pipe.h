@@ -17,6 +17,7 @@
 #define ANDROID_CORE_INCLUDE_QEMU_PIPE_H
 
 #include <stddef.h>
+#include <sys/uio.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -57,6 +58,38 @@ int qemu_pipe_frame_send(int fd, const void* buff, size_t len);
 // end-of-stream.
 int qemu_pipe_frame_recv(int fd, void* buff, size_t len);
 
+// The largest payload a frame can have, since its size is 4 hexchars.
+#define QEMU_PIPE_FRAME_MAX_SIZE 0xffff
+
+// Send the |count| framed messages described by |frames| through the |fd|
+// descriptor, many of them per writev() rather than two writes each.
+// Returns 0 on success, and -1 on error (EINVAL if a frame is larger than
+// QEMU_PIPE_FRAME_MAX_SIZE, in which case nothing is sent).
+int qemu_pipe_frame_send_batch(int fd, const struct iovec* frames, size_t count);
+
+// Reads framed messages from a descriptor a buffer at a time, rather than
+// with two reads per message. Set it up with qemu_pipe_frame_reader_init,
+// and don't touch its fields.
+struct qemu_pipe_frame_reader {
+    int fd;
+    char* buffer;
+    size_t size;
+    size_t begin;  // Of what hasn't been returned yet.
+    size_t end;    // Of what has been read.
+};
+
+// Reads from |fd| into |buffer| of |size| bytes, which must outlive |reader|.
+// Frames with payloads larger than |size| - 4 can't be received.
+void qemu_pipe_frame_reader_init(struct qemu_pipe_frame_reader* reader, int fd,
+                                 void* buffer, size_t size);
+
+// Wait for at least one frame, and store up to |max_frames| of those that
+// have arrived into |frames|. Their payloads are in the reader's buffer, and
+// are only valid until the next call. Returns the number of frames, or -1 on
+// error or end-of-stream (with errno set to 0 in the latter case).
+int qemu_pipe_frame_recv_batch(struct qemu_pipe_frame_reader* reader,
+                               struct iovec* frames, size_t max_frames);
+
 #ifdef __cplusplus
 }
 #endif
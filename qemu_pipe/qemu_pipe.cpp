@@ -21,6 +21,7 @@
 #include <string.h>
 #include <errno.h>
 #include <stdio.h>
+#include <sys/uio.h>
 
 #include <android-base/file.h>
 
@@ -68,30 +69,100 @@ int qemu_pipe_open(const char* pipeName) {
     return -1;
 }
 
+// Frame headers are the payload size in 4 hexchars.
+static constexpr size_t kFrameHeaderSize = 4;
+
+// How many frames qemu_pipe_frame_send_batch() hands to each writev().
+static constexpr size_t kFramesPerWritev = 64;
+
+static void FormatFrameHeader(size_t len, char* header) {
+    static const char kHexDigits[] = "0123456789abcdef";
+    for (size_t i = kFrameHeaderSize; i > 0; --i, len >>= 4) {
+        header[i - 1] = kHexDigits[len & 0xf];
+    }
+}
+
+static bool ParseFrameHeader(const char* header, size_t* size) {
+    *size = 0;
+    for (size_t i = 0; i < kFrameHeaderSize; ++i) {
+        char c = header[i];
+        size_t digit;
+        if (c >= '0' && c <= '9') {
+            digit = c - '0';
+        } else if (c >= 'a' && c <= 'f') {
+            digit = c - 'a' + 10;
+        } else if (c >= 'A' && c <= 'F') {
+            digit = c - 'A' + 10;
+        } else {
+            QEMU_PIPE_DEBUG("Malformed qemud frame header: [%.*s]", 4, header);
+            return false;
+        }
+        *size = (*size << 4) | digit;
+    }
+    return true;
+}
+
+// Like WriteFully, for writev(): |iov| is used up as it is written.
+static bool WritevFully(int fd, struct iovec* iov, int count) {
+    while (count > 0) {
+        ssize_t n = TEMP_FAILURE_RETRY(writev(fd, iov, count));
+        if (n == -1) return false;
+        size_t written = n;
+        while (count > 0 && written >= iov->iov_len) {
+            written -= iov->iov_len;
+            ++iov;
+            --count;
+        }
+        if (count > 0) {
+            iov->iov_base = static_cast<char*>(iov->iov_base) + written;
+            iov->iov_len -= written;
+        }
+    }
+    return true;
+}
+
 int qemu_pipe_frame_send(int fd, const void* buff, size_t len) {
-    char header[5];
-    snprintf(header, sizeof(header), "%04zx", len);
-    if (!WriteFully(fd, header, 4)) {
-        QEMU_PIPE_DEBUG("Can't write qemud frame header: %s", strerror(errno));
-        return -1;
+    struct iovec frame = {const_cast<void*>(buff), len};
+    return qemu_pipe_frame_send_batch(fd, &frame, 1);
+}
+
+int qemu_pipe_frame_send_batch(int fd, const struct iovec* frames, size_t count) {
+    for (size_t i = 0; i < count; ++i) {
+        if (frames[i].iov_len > QEMU_PIPE_FRAME_MAX_SIZE) {
+            QEMU_PIPE_DEBUG("Oversized qemud frame (%zu bytes)", frames[i].iov_len);
+            errno = EINVAL;
+            return -1;
+        }
     }
-    if (!WriteFully(fd, buff, len)) {
-        QEMU_PIPE_DEBUG("Can't write qemud frame payload: %s", strerror(errno));
-        return -1;
+
+    char headers[kFramesPerWritev][kFrameHeaderSize];
+    struct iovec iov[2 * kFramesPerWritev];
+    while (count > 0) {
+        size_t n = count < kFramesPerWritev ? count : kFramesPerWritev;
+        for (size_t i = 0; i < n; ++i) {
+            FormatFrameHeader(frames[i].iov_len, headers[i]);
+            iov[2 * i].iov_base = headers[i];
+            iov[2 * i].iov_len = kFrameHeaderSize;
+            iov[2 * i + 1] = frames[i];
+        }
+        if (!WritevFully(fd, iov, 2 * n)) {
+            QEMU_PIPE_DEBUG("Can't write qemud frames: %s", strerror(errno));
+            return -1;
+        }
+        frames += n;
+        count -= n;
     }
     return 0;
 }
 
 int qemu_pipe_frame_recv(int fd, void* buff, size_t len) {
-    char header[5];
-    if (!ReadFully(fd, header, 4)) {
+    char header[kFrameHeaderSize];
+    if (!ReadFully(fd, header, kFrameHeaderSize)) {
         QEMU_PIPE_DEBUG("Can't read qemud frame header: %s", strerror(errno));
         return -1;
     }
-    header[4] = '\0';
     size_t size;
-    if (sscanf(header, "%04zx", &size) != 1) {
-        QEMU_PIPE_DEBUG("Malformed qemud frame header: [%.*s]", 4, header);
+    if (!ParseFrameHeader(header, &size)) {
         return -1;
     }
     if (size > len) {
@@ -106,3 +177,61 @@ int qemu_pipe_frame_recv(int fd, void* buff, size_t len) {
     }
     return size;
 }
+
+void qemu_pipe_frame_reader_init(struct qemu_pipe_frame_reader* reader, int fd,
+                                 void* buffer, size_t size) {
+    reader->fd = fd;
+    reader->buffer = static_cast<char*>(buffer);
+    reader->size = size;
+    reader->begin = 0;
+    reader->end = 0;
+}
+
+int qemu_pipe_frame_recv_batch(struct qemu_pipe_frame_reader* reader,
+                               struct iovec* frames, size_t max_frames) {
+    if (max_frames == 0) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    while (true) {
+        // Hand out every whole frame that has been read.
+        size_t count = 0;
+        size_t frame_size = 0;
+        while (count < max_frames && reader->end - reader->begin >= kFrameHeaderSize) {
+            if (!ParseFrameHeader(reader->buffer + reader->begin, &frame_size)) {
+                return -1;
+            }
+            if (reader->end - reader->begin - kFrameHeaderSize < frame_size) break;
+            frames[count].iov_base = reader->buffer + reader->begin + kFrameHeaderSize;
+            frames[count].iov_len = frame_size;
+            reader->begin += kFrameHeaderSize + frame_size;
+            ++count;
+            frame_size = 0;
+        }
+        if (count > 0) {
+            return count;
+        }
+
+        // Nothing whole yet, so make room at the end for the rest of it and
+        // read some more.
+        if (kFrameHeaderSize + frame_size > reader->size) {
+            QEMU_PIPE_DEBUG("Oversized qemud frame (%zu bytes, expected <= %zu)",
+                            frame_size, reader->size - kFrameHeaderSize);
+            return -1;
+        }
+        memmove(reader->buffer, reader->buffer + reader->begin,
+                reader->end - reader->begin);
+        reader->end -= reader->begin;
+        reader->begin = 0;
+
+        ssize_t n = TEMP_FAILURE_RETRY(read(reader->fd, reader->buffer + reader->end,
+                                            reader->size - reader->end));
+        if (n <= 0) {
+            if (n == 0) errno = 0;
+            QEMU_PIPE_DEBUG("Can't read qemud frames: %s", strerror(errno));
+            return -1;
+        }
+        reader->end += n;
+    }
+}
@@ -55,16 +55,6 @@
 //  - Run the 'gdbserver' binary executable to allow native debugging
 //
 
-static bool packagelist_parse_callback(pkg_info* this_package, void* userdata) {
-  pkg_info* p = reinterpret_cast<pkg_info*>(userdata);
-  if (strcmp(p->name, this_package->name) == 0) {
-    *p = *this_package;
-    return false; // Stop searching.
-  }
-  packagelist_free(this_package);
-  return true; // Keep searching.
-}
-
 static bool check_directory(const char* path, uid_t uid) {
   struct stat st;
   if (TEMP_FAILURE_RETRY(lstat(path, &st)) == -1) return false;
@@ -153,12 +143,12 @@ int main(int argc, char* argv[]) {
   // Retrieve package information from system, switching egid so we can read the file.
   gid_t old_egid = getegid();
   if (setegid(AID_PACKAGE_INFO) == -1) error(1, errno, "setegid(AID_PACKAGE_INFO) failed");
-  pkg_info info;
-  memset(&info, 0, sizeof(info));
-  info.name = pkgname;
-  if (!packagelist_parse(packagelist_parse_callback, &info)) {
-    error(1, errno, "packagelist_parse failed");
+  pkg_info* package = packagelist_lookup(pkgname);
+  if (package == nullptr) {
+    if (errno == ENOENT) error(1, 0, "unknown package: %s", pkgname);
+    error(1, errno, "packagelist_lookup failed");
   }
+  pkg_info& info = *package;
   if (info.uid == 0) {
     error(1, 0, "unknown package: %s", pkgname);
   }
@@ -14,8 +14,10 @@
  * limitations under the License.
  */
 
+#include <ctype.h>
 #include <errno.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
 
 #define LOG_TAG "sdcard"
@@ -29,6 +31,9 @@
 
 #define FUSE_UNKNOWN_INO 0xffffffff
 
+/* Directories with more children than this index them by name. */
+#define CHILD_INDEX_MIN 16
+
 /* Pseudo-error constant used to indicate that no fuse status is needed
  * or that a reply has already been written. */
 #define NO_STATUS 1
@@ -43,15 +48,77 @@ static inline __u64 ptr_to_id(void *ptr)
     return (__u64) (uintptr_t) ptr;
 }
 
+static __u64 monotonic_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<__u64>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+int init_global_lock(struct fuse_global* global)
+{
+    pthread_rwlockattr_t attr;
+    int res = pthread_rwlockattr_init(&attr);
+    if (res) {
+        return res;
+    }
+    /* Lookups hold the lock shared almost all of the time, so don't let them
+     * starve the forgets and creations that need it exclusive. */
+    pthread_rwlockattr_setkind_np(&attr, PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+    res = pthread_rwlock_init(&global->lock, &attr);
+    pthread_rwlockattr_destroy(&attr);
+    return res;
+}
+
+void lock_global(struct fuse_global* global, bool exclusive)
+{
+    struct fuse_lock_stats* stats = &global->lock_stats;
+    int res = exclusive ? pthread_rwlock_trywrlock(&global->lock)
+                        : pthread_rwlock_tryrdlock(&global->lock);
+    if (res) {
+        __u64 start = monotonic_ns();
+        if (exclusive) {
+            pthread_rwlock_wrlock(&global->lock);
+        } else {
+            pthread_rwlock_rdlock(&global->lock);
+        }
+        __u64 waited = monotonic_ns() - start;
+        __atomic_add_fetch(&stats->contended, 1, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&stats->wait_ns, waited, __ATOMIC_RELAXED);
+        __u64 max = __atomic_load_n(&stats->max_wait_ns, __ATOMIC_RELAXED);
+        while (waited > max && !__atomic_compare_exchange_n(&stats->max_wait_ns, &max, waited,
+                true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+        }
+    }
+    __atomic_add_fetch(exclusive ? &stats->exclusive : &stats->shared, 1, __ATOMIC_RELAXED);
+}
+
+void unlock_global(struct fuse_global* global)
+{
+    pthread_rwlock_unlock(&global->lock);
+}
+
+void log_global_lock_stats(struct fuse_global* global)
+{
+    const struct fuse_lock_stats* stats = &global->lock_stats;
+    LOG(INFO) << "tree lock: shared=" << __atomic_load_n(&stats->shared, __ATOMIC_RELAXED)
+              << " exclusive=" << __atomic_load_n(&stats->exclusive, __ATOMIC_RELAXED)
+              << " contended=" << __atomic_load_n(&stats->contended, __ATOMIC_RELAXED)
+              << " wait_ns=" << __atomic_load_n(&stats->wait_ns, __ATOMIC_RELAXED)
+              << " max_wait_ns=" << __atomic_load_n(&stats->max_wait_ns, __ATOMIC_RELAXED);
+}
+
+/* Callers hold the global lock, either shared or exclusive. */
 static void acquire_node_locked(struct node* node)
 {
-    node->refcount++;
+    __u32 refcount = __atomic_add_fetch(&node->refcount, 1, __ATOMIC_RELAXED);
     DLOG(INFO) << "ACQUIRE " << std::hex << node << std::dec
-               << " (" << node->name << ") rc=" << node->refcount;
+               << " (" << node->name << ") rc=" << refcount;
 }
 
 static void remove_node_from_parent_locked(struct node* node);
 
+/* Callers hold the global lock exclusive. */
 static void release_node_locked(struct node* node)
 {
     DLOG(INFO) << "RELEASE " << std::hex << node << std::dec
@@ -66,6 +133,8 @@ static void release_node_locked(struct node* node)
             memset(node->name, 0xef, node->namelen);
             free(node->name);
             free(node->actual_name);
+            free(node->child_index);
+            free(node->path);
             memset(node, 0xfc, sizeof(*node));
             free(node);
         }
@@ -74,28 +143,127 @@ static void release_node_locked(struct node* node)
     }
 }
 
+/* FNV-1a over the case-folded name, so that names differing only by case
+ * share a bucket. */
+__attribute__((no_sanitize("integer")))
+static __u32 hash_name(const char* name)
+{
+    __u32 hash = 2166136261u;
+    for (; *name; name++) {
+        hash ^= static_cast<__u8>(tolower(static_cast<unsigned char>(*name)));
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static void index_child_locked(struct node* parent, struct node* node)
+{
+    struct node** bucket = &parent->child_index[node->name_hash & (parent->child_index_size - 1)];
+    node->index_next = *bucket;
+    *bucket = node;
+}
+
+static void unindex_child_locked(struct node* parent, struct node* node)
+{
+    struct node** link = &parent->child_index[node->name_hash & (parent->child_index_size - 1)];
+    while (*link != node) {
+        link = &(*link)->index_next;
+    }
+    *link = node->index_next;
+    node->index_next = NULL;
+}
+
+/* (Re)builds the index of all of parent's children at twice their number.
+ * If that can't be allocated, returns false and leaves any existing index. */
+static bool grow_child_index_locked(struct node* parent)
+{
+    size_t size = CHILD_INDEX_MIN;
+    while (size < parent->child_count * 2) {
+        size *= 2;
+    }
+    struct node** index = static_cast<struct node**>(calloc(size, sizeof(struct node*)));
+    if (!index) {
+        return false;
+    }
+    free(parent->child_index);
+    parent->child_index = index;
+    parent->child_index_size = size;
+    for (struct node* node = parent->child; node; node = node->next) {
+        index_child_locked(parent, node);
+    }
+    return true;
+}
+
 static void add_node_to_parent_locked(struct node *node, struct node *parent) {
     node->parent = parent;
+    node->prev = NULL;
     node->next = parent->child;
+    if (parent->child) {
+        parent->child->prev = node;
+    }
     parent->child = node;
+    node->name_hash = hash_name(node->name);
+    parent->child_count++;
+    bool grown = parent->child_count > CHILD_INDEX_MIN
+            && parent->child_count > parent->child_index_size
+            && grow_child_index_locked(parent);
+    if (!grown && parent->child_index) {
+        index_child_locked(parent, node);
+    }
     acquire_node_locked(parent);
 }
 
 static void remove_node_from_parent_locked(struct node* node)
 {
     if (node->parent) {
-        if (node->parent->child == node) {
-            node->parent->child = node->parent->child->next;
+        struct node* parent = node->parent;
+        if (parent->child_index) {
+            unindex_child_locked(parent, node);
+        }
+        if (node->prev) {
+            node->prev->next = node->next;
         } else {
-            struct node *node2;
-            node2 = node->parent->child;
-            while (node2->next != node)
-                node2 = node2->next;
-            node2->next = node->next;
+            parent->child = node->next;
+        }
+        if (node->next) {
+            node->next->prev = node->prev;
         }
-        release_node_locked(node->parent);
+        parent->child_count--;
+        release_node_locked(parent);
         node->parent = NULL;
         node->next = NULL;
+        node->prev = NULL;
+    }
+}
+
+/* Drops the cached paths of a node and everything below it, after it moved.
+ * Callers hold the global lock exclusive. */
+static void invalidate_paths_locked(struct node* node)
+{
+    free(node->path);
+    node->path = NULL;
+    for (struct node* child = node->child; child; child = child->next) {
+        if (child->path || child->child) {
+            invalidate_paths_locked(child);
+        }
+    }
+}
+
+/* Remembers a node's path, unless another handler got there first.
+ * Callers hold the global lock, either shared or exclusive. */
+static void cache_node_path_locked(struct node* node, const char* buf, size_t len)
+{
+    struct node_path* path = static_cast<struct node_path*>(
+            malloc(sizeof(struct node_path) + len + 1));
+    if (!path) {
+        return;
+    }
+    path->len = len;
+    memcpy(path->buf, buf, len + 1);
+    struct node_path* expected = NULL;
+    if (!__atomic_compare_exchange_n(&node->path, &expected, path, false,
+            __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+        free(path);
     }
 }
 
@@ -105,6 +273,15 @@ static void remove_node_from_parent_locked(struct node* node)
  * or returns -1 if the path is too long for the provided buffer.
  */
 static ssize_t get_node_path_locked(struct node* node, char* buf, size_t bufsize) {
+    const struct node_path* cached = __atomic_load_n(&node->path, __ATOMIC_ACQUIRE);
+    if (cached) {
+        if (bufsize < cached->len + 1) {
+            return -1;
+        }
+        memcpy(buf, cached->buf, cached->len + 1);
+        return cached->len;
+    }
+
     const char* name;
     size_t namelen;
     if (node->graft_path) {
@@ -132,6 +309,9 @@ static ssize_t get_node_path_locked(struct node* node, char* buf, size_t bufsize
     }
 
     memcpy(buf + pathlen, name, namelen + 1); /* include trailing \0 */
+    if (node->child) {
+        cache_node_path_locked(node, buf, pathlen + namelen);
+    }
     return pathlen + namelen;
 }
 
@@ -241,9 +421,14 @@ static int touch(char* path, mode_t mode) {
     return 0;
 }
 
-static void derive_permissions_locked(struct fuse* fuse, struct node *parent,
+/* Returns whether any of the node's derived state changed. */
+static bool derive_permissions_locked(struct fuse* fuse, struct node *parent,
         struct node *node) {
     appid_t appid;
+    perm_t old_perm = node->perm;
+    userid_t old_userid = node->userid;
+    uid_t old_uid = node->uid;
+    bool old_under_android = node->under_android;
 
     /* By default, each node inherits from its parent */
     node->perm = PERM_INHERIT;
@@ -294,14 +479,19 @@ static void derive_permissions_locked(struct fuse* fuse, struct node *parent,
         }
         break;
     }
+    return node->perm != old_perm || node->userid != old_userid || node->uid != old_uid
+            || node->under_android != old_under_android;
 }
 
-void derive_permissions_recursive_locked(struct fuse* fuse, struct node *parent) {
+void derive_permissions_recursive_locked(struct fuse* fuse, struct node *parent,
+        std::vector<__u64>* changed) {
     struct node *node;
     for (node = parent->child; node; node = node->next) {
-        derive_permissions_locked(fuse, parent, node);
+        if (derive_permissions_locked(fuse, parent, node)) {
+            changed->push_back(node->nid);
+        }
         if (node->child) {
-            derive_permissions_recursive_locked(fuse, node);
+            derive_permissions_recursive_locked(fuse, node, changed);
         }
     }
 }
@@ -443,6 +633,16 @@ static struct node* lookup_node_and_path_by_id_locked(struct fuse* fuse, __u64 n
 
 static struct node *lookup_child_by_name_locked(struct node *node, const char *name)
 {
+    if (node->child_index) {
+        __u32 hash = hash_name(name);
+        for (node = node->child_index[hash & (node->child_index_size - 1)]; node;
+                node = node->index_next) {
+            if (node->name_hash == hash && !strcmp(name, node->name) && !node->deleted) {
+                return node;
+            }
+        }
+        return 0;
+    }
     for (node = node->child; node; node = node->next) {
         /* use exact string comparison, nodes that differ by case
          * must be considered distinct even if they refer to the same
@@ -505,31 +705,54 @@ static void fuse_reply(struct fuse *fuse, __u64 unique, void *data, int len)
     }
 }
 
+/* Acquires a reference to the child, creating it if need be, and describes
+ * it in |out| from |s|. Returns -ENOMEM if the child couldn't be created. */
+static int acquire_entry(struct fuse* fuse, struct node* parent, const char* name,
+        const char* actual_name, const struct stat* s, struct fuse_entry_out* out)
+{
+    struct node* node;
+
+    /* Most lookups are of nodes we already have, which only needs the lock
+     * shared. Otherwise retake it exclusive and look again, since another
+     * handler may have created the node in between. */
+    lock_global(fuse->global, false);
+    node = lookup_child_by_name_locked(parent, name);
+    if (node) {
+        acquire_node_locked(node);
+    } else {
+        unlock_global(fuse->global);
+        lock_global(fuse->global, true);
+        node = acquire_or_create_child_locked(fuse, parent, name, actual_name);
+    }
+    if (!node) {
+        unlock_global(fuse->global);
+        return -ENOMEM;
+    }
+    memset(out, 0, sizeof(*out));
+    attr_from_stat(fuse, &out->attr, s, node);
+    out->attr_valid = fuse->cache_timeout;
+    out->entry_valid = fuse->cache_timeout;
+    out->nodeid = node->nid;
+    out->generation = node->gen;
+    unlock_global(fuse->global);
+    return 0;
+}
+
 static int fuse_reply_entry(struct fuse* fuse, __u64 unique,
         struct node* parent, const char* name, const char* actual_name,
         const char* path)
 {
-    struct node* node;
     struct fuse_entry_out out;
     struct stat s;
+    int res;
 
     if (lstat(path, &s) == -1) {
         return -errno;
     }
-
-    pthread_mutex_lock(&fuse->global->lock);
-    node = acquire_or_create_child_locked(fuse, parent, name, actual_name);
-    if (!node) {
-        pthread_mutex_unlock(&fuse->global->lock);
-        return -ENOMEM;
+    res = acquire_entry(fuse, parent, name, actual_name, &s, &out);
+    if (res < 0) {
+        return res;
     }
-    memset(&out, 0, sizeof(out));
-    attr_from_stat(fuse, &out.attr, &s, node);
-    out.attr_valid = 10;
-    out.entry_valid = 10;
-    out.nodeid = node->nid;
-    out.generation = node->gen;
-    pthread_mutex_unlock(&fuse->global->lock);
     fuse_reply(fuse, unique, &out, sizeof(out));
     return NO_STATUS;
 }
@@ -545,42 +768,94 @@ static int fuse_reply_attr(struct fuse* fuse, __u64 unique, const struct node* n
     }
     memset(&out, 0, sizeof(out));
     attr_from_stat(fuse, &out.attr, &s, node);
-    out.attr_valid = 10;
+    out.attr_valid = fuse->cache_timeout;
     fuse_reply(fuse, unique, &out, sizeof(out));
     return NO_STATUS;
 }
 
-static void fuse_notify_delete(struct fuse* fuse, const __u64 parent,
-        const __u64 child, const char* name) {
+/* Writes a notification, made of |data| and optionally a name, to a view.
+ * ENOENT is expected, since a view may not have seen the inode or entry. */
+static void fuse_notify(struct fuse* fuse, int code, const void* data, size_t data_len,
+        const char* name) {
     struct fuse_out_header hdr;
-    struct fuse_notify_delete_out data;
-    size_t namelen = strlen(name);
-    hdr.len = sizeof(hdr) + sizeof(data) + namelen + 1;
-    hdr.error = FUSE_NOTIFY_DELETE;
+    size_t namelen = name ? strlen(name) + 1 : 0;
+    hdr.len = sizeof(hdr) + data_len + namelen;
+    hdr.error = code;
     hdr.unique = 0;
 
-    data.parent = parent;
-    data.child = child;
-    data.namelen = namelen;
-    data.padding = 0;
-
     struct iovec vec[3];
     vec[0].iov_base = &hdr;
     vec[0].iov_len = sizeof(hdr);
-    vec[1].iov_base = &data;
-    vec[1].iov_len = sizeof(data);
+    vec[1].iov_base = (void*) data;
+    vec[1].iov_len = data_len;
     vec[2].iov_base = (void*) name;
-    vec[2].iov_len = namelen + 1;
+    vec[2].iov_len = namelen;
 
-    ssize_t ret = TEMP_FAILURE_RETRY(writev(fuse->fd, vec, 3));
-    /* Ignore ENOENT, since other views may not have seen the entry */
+    ssize_t ret = TEMP_FAILURE_RETRY(writev(fuse->fd, vec, name ? 3 : 2));
     if (ret == -1) {
         if (errno != ENOENT) {
-            PLOG(ERROR) << "*** NOTIFY FAILED ***";
+            PLOG(ERROR) << "*** NOTIFY " << code << " FAILED ***";
+        }
+    } else if (static_cast<size_t>(ret) != hdr.len) {
+        LOG(ERROR) << "*** NOTIFY " << code << " FAILED: written " << ret << " expected "
+                   << hdr.len << " ***";
+    }
+}
+
+static void fuse_notify_delete(struct fuse* fuse, const __u64 parent,
+        const __u64 child, const char* name) {
+    struct fuse_notify_delete_out data;
+    data.parent = parent;
+    data.child = child;
+    data.namelen = strlen(name);
+    data.padding = 0;
+    fuse_notify(fuse, FUSE_NOTIFY_DELETE, &data, sizeof(data), name);
+}
+
+static void fuse_notify_inval_entry(struct fuse* fuse, const __u64 parent, const char* name) {
+    struct fuse_notify_inval_entry_out data;
+    memset(&data, 0, sizeof(data));
+    data.parent = parent;
+    data.namelen = strlen(name);
+    fuse_notify(fuse, FUSE_NOTIFY_INVAL_ENTRY, &data, sizeof(data), name);
+}
+
+/* Only drops the cached attributes, not the page cache: that would wait for
+ * pages locked by reads which may in turn be waiting for this handler. */
+static void fuse_notify_inval_attr(struct fuse* fuse, const __u64 nid) {
+    struct fuse_notify_inval_inode_out data;
+    data.ino = nid;
+    data.off = -1;
+    data.len = 0;
+    fuse_notify(fuse, FUSE_NOTIFY_INVAL_INODE, &data, sizeof(data), NULL);
+}
+
+/* A change made through one view is only seen by that view's kernel caches,
+ * so the other two have to be told. */
+static void notify_other_views_inval_attr(struct fuse* fuse, const __u64 nid) {
+    struct fuse_global* global = fuse->global;
+    for (struct fuse* view : { global->fuse_default, global->fuse_read, global->fuse_write }) {
+        if (view != fuse) {
+            fuse_notify_inval_attr(view, nid);
+        }
+    }
+}
+
+static void notify_other_views_inval_entry(struct fuse* fuse, const __u64 parent,
+        const char* name) {
+    struct fuse_global* global = fuse->global;
+    for (struct fuse* view : { global->fuse_default, global->fuse_read, global->fuse_write }) {
+        if (view != fuse) {
+            fuse_notify_inval_entry(view, parent, name);
+        }
+    }
+}
+
+void notify_views_inval_attrs(struct fuse_global* global, const std::vector<__u64>& nids) {
+    for (struct fuse* view : { global->fuse_default, global->fuse_read, global->fuse_write }) {
+        for (__u64 nid : nids) {
+            fuse_notify_inval_attr(view, nid);
         }
-    } else if (static_cast<size_t>(ret) != sizeof(hdr) + sizeof(data) + namelen + 1) {
-        LOG(ERROR) << "*** NOTIFY FAILED: written " << ret << " expected "
-                   << sizeof(hdr) + sizeof(data) + namelen + 1 << " ***";
     }
 }
 
@@ -592,12 +867,12 @@ static int handle_lookup(struct fuse* fuse, struct fuse_handler* handler,
     char child_path[PATH_MAX];
     const char* actual_name;
 
-    pthread_mutex_lock(&fuse->global->lock);
+    lock_global(fuse->global, false);
     parent_node = lookup_node_and_path_by_id_locked(fuse, hdr->nodeid,
             parent_path, sizeof(parent_path));
     DLOG(INFO) << "[" << handler->token << "] LOOKUP " << name << " @ " << hdr->nodeid
                << " (" << (parent_node ? parent_node->name : "?") << ")";
-    pthread_mutex_unlock(&fuse->global->lock);
+    unlock_global(fuse->global);
 
     if (!parent_node || !(actual_name = find_file_within(parent_path, name,
             child_path, sizeof(child_path), 1))) {
@@ -615,7 +890,7 @@ static int handle_forget(struct fuse* fuse, struct fuse_handler* handler,
 {
     struct node* node;
 
-    pthread_mutex_lock(&fuse->global->lock);
+    lock_global(fuse->global, true);
     node = lookup_node_by_id_locked(fuse, hdr->nodeid);
     DLOG(INFO) << "[" << handler->token << "] FORGET #" << req->nlookup
                << " @ " << std::hex << hdr->nodeid
@@ -627,7 +902,29 @@ static int handle_forget(struct fuse* fuse, struct fuse_handler* handler,
             release_node_locked(node);
         }
     }
-    pthread_mutex_unlock(&fuse->global->lock);
+    unlock_global(fuse->global);
+    return NO_STATUS; /* no reply */
+}
+
+static int handle_batch_forget(struct fuse* fuse, struct fuse_handler* handler,
+        const struct fuse_in_header *hdr, const struct fuse_batch_forget_in *req,
+        size_t data_len)
+{
+    const struct fuse_forget_one* forgets =
+            reinterpret_cast<const struct fuse_forget_one*>(req + 1);
+    __u32 count = MIN(req->count, (data_len - sizeof(*req)) / sizeof(*forgets));
+
+    DLOG(INFO) << "[" << handler->token << "] BATCH_FORGET count=" << req->count;
+    lock_global(fuse->global, true);
+    for (__u32 i = 0; i < count; i++) {
+        struct node* node = lookup_node_by_id_locked(fuse, forgets[i].nodeid);
+        if (node) {
+            for (__u64 n = forgets[i].nlookup; n; n--) {
+                release_node_locked(node);
+            }
+        }
+    }
+    unlock_global(fuse->global);
     return NO_STATUS; /* no reply */
 }
 
@@ -637,12 +934,12 @@ static int handle_getattr(struct fuse* fuse, struct fuse_handler* handler,
     struct node* node;
     char path[PATH_MAX];
 
-    pthread_mutex_lock(&fuse->global->lock);
+    lock_global(fuse->global, false);
     node = lookup_node_and_path_by_id_locked(fuse, hdr->nodeid, path, sizeof(path));
     DLOG(INFO) << "[" << handler->token << "] GETATTR flags=" << req->getattr_flags
                << " fh=" << std::hex << req->fh << " @ " << hdr->nodeid << std::dec
                << " (" << (node ? node->name : "?") << ")";
-    pthread_mutex_unlock(&fuse->global->lock);
+    unlock_global(fuse->global);
 
     if (!node) {
         return -ENOENT;
@@ -661,12 +958,12 @@ static int handle_setattr(struct fuse* fuse, struct fuse_handler* handler,
     char path[PATH_MAX];
     struct timespec times[2];
 
-    pthread_mutex_lock(&fuse->global->lock);
+    lock_global(fuse->global, false);
     node = lookup_node_and_path_by_id_locked(fuse, hdr->nodeid, path, sizeof(path));
     DLOG(INFO) << "[" << handler->token << "] SETATTR fh=" << std::hex << req->fh
                << " valid=" << std::hex << req->valid << " @ " << hdr->nodeid << std::dec
                << " (" << (node ? node->name : "?") << ")";
-    pthread_mutex_unlock(&fuse->global->lock);
+    unlock_global(fuse->global);
 
     if (!node) {
         return -ENOENT;
@@ -715,6 +1012,7 @@ static int handle_setattr(struct fuse* fuse, struct fuse_handler* handler,
             return -errno;
         }
     }
+    notify_other_views_inval_attr(fuse, node->nid);
     return fuse_reply_attr(fuse, hdr->unique, node, path);
 }
 
@@ -726,13 +1024,13 @@ static int handle_mknod(struct fuse* fuse, struct fuse_handler* handler,
     char child_path[PATH_MAX];
     const char* actual_name;
 
-    pthread_mutex_lock(&fuse->global->lock);
+    lock_global(fuse->global, false);
     parent_node = lookup_node_and_path_by_id_locked(fuse, hdr->nodeid,
             parent_path, sizeof(parent_path));
     DLOG(INFO) << "[" << handler->token << "] MKNOD " << name << " 0" << std::oct << req->mode
                << " @ " << std::hex << hdr->nodeid
                << " (" << (parent_node ? parent_node->name : "?") << ")";
-    pthread_mutex_unlock(&fuse->global->lock);
+    unlock_global(fuse->global);
 
     if (!parent_node || !(actual_name = find_file_within(parent_path, name,
             child_path, sizeof(child_path), 1))) {
@@ -756,13 +1054,13 @@ static int handle_mkdir(struct fuse* fuse, struct fuse_handler* handler,
     char child_path[PATH_MAX];
     const char* actual_name;
 
-    pthread_mutex_lock(&fuse->global->lock);
+    lock_global(fuse->global, false);
     parent_node = lookup_node_and_path_by_id_locked(fuse, hdr->nodeid,
             parent_path, sizeof(parent_path));
     DLOG(INFO) << "[" << handler->token << "] MKDIR " << name << " 0" << std::oct << req->mode
                << " @ " << std::hex << hdr->nodeid
                << " (" << (parent_node ? parent_node->name : "?") << ")";
-    pthread_mutex_unlock(&fuse->global->lock);
+    unlock_global(fuse->global);
 
     if (!parent_node || !(actual_name = find_file_within(parent_path, name,
             child_path, sizeof(child_path), 1))) {
@@ -805,12 +1103,12 @@ static int handle_unlink(struct fuse* fuse, struct fuse_handler* handler,
     char parent_path[PATH_MAX];
     char child_path[PATH_MAX];
 
-    pthread_mutex_lock(&fuse->global->lock);
+    lock_global(fuse->global, false);
     parent_node = lookup_node_and_path_by_id_locked(fuse, hdr->nodeid,
             parent_path, sizeof(parent_path));
     DLOG(INFO) << "[" << handler->token << "] UNLINK " << name << " @ " << std::hex << hdr->nodeid
                << " (" << (parent_node ? parent_node->name : "?") << ")";
-    pthread_mutex_unlock(&fuse->global->lock);
+    unlock_global(fuse->global);
 
     if (!parent_node || !find_file_within(parent_path, name,
             child_path, sizeof(child_path), 1)) {
@@ -822,12 +1120,12 @@ static int handle_unlink(struct fuse* fuse, struct fuse_handler* handler,
     if (unlink(child_path) == -1) {
         return -errno;
     }
-    pthread_mutex_lock(&fuse->global->lock);
+    lock_global(fuse->global, true);
     child_node = lookup_child_by_name_locked(parent_node, name);
     if (child_node) {
         child_node->deleted = true;
     }
-    pthread_mutex_unlock(&fuse->global->lock);
+    unlock_global(fuse->global);
     if (parent_node && child_node) {
         /* Tell all other views that node is gone */
         DLOG(INFO) << "[" << handler->token << "] fuse_notify_delete"
@@ -855,12 +1153,12 @@ static int handle_rmdir(struct fuse* fuse, struct fuse_handler* handler,
     char parent_path[PATH_MAX];
     char child_path[PATH_MAX];
 
-    pthread_mutex_lock(&fuse->global->lock);
+    lock_global(fuse->global, false);
     parent_node = lookup_node_and_path_by_id_locked(fuse, hdr->nodeid,
             parent_path, sizeof(parent_path));
     DLOG(INFO) << "[" << handler->token << "] UNLINK " << name << " @ " << std::hex << hdr->nodeid
                << " (" << (parent_node ? parent_node->name : "?") << ")";
-    pthread_mutex_unlock(&fuse->global->lock);
+    unlock_global(fuse->global);
 
     if (!parent_node || !find_file_within(parent_path, name,
             child_path, sizeof(child_path), 1)) {
@@ -872,12 +1170,12 @@ static int handle_rmdir(struct fuse* fuse, struct fuse_handler* handler,
     if (rmdir(child_path) == -1) {
         return -errno;
     }
-    pthread_mutex_lock(&fuse->global->lock);
+    lock_global(fuse->global, true);
     child_node = lookup_child_by_name_locked(parent_node, name);
     if (child_node) {
         child_node->deleted = true;
     }
-    pthread_mutex_unlock(&fuse->global->lock);
+    unlock_global(fuse->global);
     if (parent_node && child_node) {
         /* Tell all other views that node is gone */
         DLOG(INFO) << "[" << handler->token << "] fuse_notify_delete"
@@ -909,10 +1207,11 @@ static int handle_rename(struct fuse* fuse, struct fuse_handler* handler,
     char old_child_path[PATH_MAX];
     char new_child_path[PATH_MAX];
     const char* new_actual_name;
+    std::vector<__u64> changed;
     int search;
     int res;
 
-    pthread_mutex_lock(&fuse->global->lock);
+    lock_global(fuse->global, false);
     old_parent_node = lookup_node_and_path_by_id_locked(fuse, hdr->nodeid,
             old_parent_path, sizeof(old_parent_path));
     new_parent_node = lookup_node_and_path_by_id_locked(fuse, req->newdir,
@@ -941,7 +1240,7 @@ static int handle_rename(struct fuse* fuse, struct fuse_handler* handler,
         goto lookup_error;
     }
     acquire_node_locked(child_node);
-    pthread_mutex_unlock(&fuse->global->lock);
+    unlock_global(fuse->global);
 
     /* Special case for renaming a file where destination is same path
      * differing only by case.  In this case we don't want to look for a case
@@ -962,22 +1261,30 @@ static int handle_rename(struct fuse* fuse, struct fuse_handler* handler,
         goto io_error;
     }
 
-    pthread_mutex_lock(&fuse->global->lock);
+    lock_global(fuse->global, true);
     res = rename_node_locked(child_node, new_name, new_actual_name);
     if (!res) {
+        invalidate_paths_locked(child_node);
         remove_node_from_parent_locked(child_node);
-        derive_permissions_locked(fuse, new_parent_node, child_node);
-        derive_permissions_recursive_locked(fuse, child_node);
+        if (derive_permissions_locked(fuse, new_parent_node, child_node)) {
+            changed.push_back(child_node->nid);
+        }
+        derive_permissions_recursive_locked(fuse, child_node, &changed);
         add_node_to_parent_locked(child_node, new_parent_node);
     }
     goto done;
 
 io_error:
-    pthread_mutex_lock(&fuse->global->lock);
+    lock_global(fuse->global, true);
 done:
     release_node_locked(child_node);
 lookup_error:
-    pthread_mutex_unlock(&fuse->global->lock);
+    unlock_global(fuse->global);
+    if (!res) {
+        notify_other_views_inval_entry(fuse, old_parent_node->nid, old_name);
+        notify_other_views_inval_entry(fuse, new_parent_node->nid, new_name);
+        notify_views_inval_attrs(fuse->global, changed);
+    }
     return res;
 }
 
@@ -1000,12 +1307,12 @@ static int handle_open(struct fuse* fuse, struct fuse_handler* handler,
     struct fuse_open_out out = {};
     struct handle *h;
 
-    pthread_mutex_lock(&fuse->global->lock);
+    lock_global(fuse->global, false);
     node = lookup_node_and_path_by_id_locked(fuse, hdr->nodeid, path, sizeof(path));
     DLOG(INFO) << "[" << handler->token << "] OPEN 0" << std::oct << req->flags
                << " @ " << std::hex << hdr->nodeid << std::dec
                << " (" << (node ? node->name : "?") << ")";
-    pthread_mutex_unlock(&fuse->global->lock);
+    unlock_global(fuse->global);
 
     if (!node) {
         return -ENOENT;
@@ -1024,12 +1331,175 @@ static int handle_open(struct fuse* fuse, struct fuse_handler* handler,
         free(h);
         return -errno;
     }
+    h->written = req->flags & O_TRUNC;
     out.fh = ptr_to_id(h);
     out.open_flags = 0;
     fuse_reply(fuse, hdr->unique, &out, sizeof(out));
     return NO_STATUS;
 }
 
+/* Reads len bytes from a pipe that holds at least that many. */
+static bool read_pipe(int fd, void* buffer, size_t len)
+{
+    __u8* p = static_cast<__u8*>(buffer);
+    while (len) {
+        ssize_t res = TEMP_FAILURE_RETRY(read(fd, p, len));
+        if (res <= 0) {
+            return false;
+        }
+        p += res;
+        len -= res;
+    }
+    return true;
+}
+
+/* Throws away whatever a failed splice left in a (non-blocking) pipe. This
+ * only scribbles over the payload part of request_buffer, not the headers. */
+static void drain_pipe(struct fuse_handler* handler, int fd)
+{
+    __u8* scratch = handler->request_buffer + sizeof(struct fuse_in_header) +
+            sizeof(struct fuse_write_in);
+    while (TEMP_FAILURE_RETRY(read(fd, scratch, MAX_WRITE)) > 0) {
+    }
+}
+
+static void close_pipe(int fds[2])
+{
+    if (fds[0] != -1) {
+        close(fds[0]);
+        close(fds[1]);
+        fds[0] = fds[1] = -1;
+    }
+}
+
+static bool open_pipe(int fds[2], size_t size)
+{
+    if (pipe2(fds, O_CLOEXEC | O_NONBLOCK)) {
+        fds[0] = fds[1] = -1;
+        return false;
+    }
+    /* The kernel won't splice a request, or take a reply, that doesn't fit. */
+    if (fcntl(fds[1], F_SETPIPE_SZ, size) < static_cast<int>(size)) {
+        close_pipe(fds);
+        return false;
+    }
+    return true;
+}
+
+static void disable_splice(struct fuse_handler* handler)
+{
+    close_pipe(handler->data_pipe);
+    close_pipe(handler->reply_pipe);
+}
+
+static void init_splice(struct fuse_handler* handler)
+{
+    handler->spliced_len = 0;
+    handler->reply_pipe[0] = handler->reply_pipe[1] = -1;
+    if (!open_pipe(handler->data_pipe, MAX_REQUEST_SIZE) ||
+            !open_pipe(handler->reply_pipe, sizeof(struct fuse_out_header) + MAX_READ)) {
+        PLOG(WARNING) << "[" << handler->token << "] not splicing";
+        disable_splice(handler);
+    }
+}
+
+/* Replies to a read with size bytes of fd at offset, moving the data from the
+ * page cache to the kernel without it passing through read_buffer. Returns
+ * NO_STATUS once a reply was attempted, or -1 if none was and the caller
+ * should fall back to reading into the buffer, e.g. because the lower
+ * filesystem doesn't support splicing. */
+static int splice_read_reply(struct fuse* fuse, struct fuse_handler* handler, __u64 unique,
+        int fd, __u32 size, __u64 offset)
+{
+    loff_t off = offset;
+    size_t len = 0;
+    while (len < size) {
+        ssize_t res = TEMP_FAILURE_RETRY(splice(fd, &off, handler->data_pipe[1], NULL,
+                size - len, SPLICE_F_MOVE));
+        if (res == -1) {
+            drain_pipe(handler, handler->data_pipe[0]);
+            return -1;
+        }
+        if (res == 0) {
+            break;
+        }
+        len += res;
+    }
+
+    /* The header has to go first, and only now do we know the length. */
+    struct fuse_out_header hdr;
+    hdr.len = sizeof(hdr) + len;
+    hdr.error = 0;
+    hdr.unique = unique;
+    size_t moved = 0;
+    if (TEMP_FAILURE_RETRY(write(handler->reply_pipe[1], &hdr, sizeof(hdr))) != sizeof(hdr)) {
+        goto fail;
+    }
+    while (moved < len) {
+        ssize_t res = TEMP_FAILURE_RETRY(splice(handler->data_pipe[0], NULL,
+                handler->reply_pipe[1], NULL, len - moved, SPLICE_F_MOVE));
+        if (res <= 0) {
+            goto fail;
+        }
+        moved += res;
+    }
+
+    {
+        ssize_t ret = TEMP_FAILURE_RETRY(splice(handler->reply_pipe[0], NULL, fuse->fd, NULL,
+                hdr.len, SPLICE_F_MOVE));
+        if (ret == -1) {
+            PLOG(ERROR) << "*** REPLY FAILED ***";
+            drain_pipe(handler, handler->reply_pipe[0]);
+        } else if (static_cast<size_t>(ret) != hdr.len) {
+            LOG(ERROR) << "*** REPLY FAILED: written " << ret << " expected " << hdr.len << " ***";
+            drain_pipe(handler, handler->reply_pipe[0]);
+        }
+        return NO_STATUS;
+    }
+
+fail:
+    drain_pipe(handler, handler->data_pipe[0]);
+    drain_pipe(handler, handler->reply_pipe[0]);
+    return -1;
+}
+
+/* Writes the spliced payload of the current write request to fd at offset.
+ * Whatever the lower filesystem won't take by splice goes through the
+ * request buffer. Returns the number of bytes written, or -1 with errno set. */
+static ssize_t splice_write(struct fuse_handler* handler, int fd, __u64 offset)
+{
+    loff_t off = offset;
+    size_t written = 0;
+    while (handler->spliced_len) {
+        ssize_t res = TEMP_FAILURE_RETRY(splice(handler->data_pipe[0], NULL, fd, &off,
+                handler->spliced_len, SPLICE_F_MOVE));
+        if (res <= 0) {
+            break;
+        }
+        handler->spliced_len -= res;
+        written += res;
+    }
+    if (!handler->spliced_len) {
+        return written;
+    }
+
+    /* The header is still at the front of the buffer. */
+    __u8* buffer = handler->request_buffer + sizeof(struct fuse_in_header) +
+            sizeof(struct fuse_write_in);
+    size_t len = handler->spliced_len;
+    handler->spliced_len = 0;
+    if (!read_pipe(handler->data_pipe[0], buffer, len)) {
+        drain_pipe(handler, handler->data_pipe[0]);
+        errno = EIO;
+        return written ? static_cast<ssize_t>(written) : -1;
+    }
+    ssize_t res = TEMP_FAILURE_RETRY(pwrite64(fd, buffer, len, off));
+    if (res == -1) {
+        return written ? static_cast<ssize_t>(written) : -1;
+    }
+    return written + res;
+}
+
 static int handle_read(struct fuse* fuse, struct fuse_handler* handler,
         const struct fuse_in_header* hdr, const struct fuse_read_in* req)
 {
@@ -1049,6 +1519,11 @@ static int handle_read(struct fuse* fuse, struct fuse_handler* handler,
     if (size > MAX_READ) {
         return -EINVAL;
     }
+    if (handler->data_pipe[0] != -1) {
+        if (splice_read_reply(fuse, handler, unique, h->fd, size, offset) == NO_STATUS) {
+            return NO_STATUS;
+        }
+    }
     res = TEMP_FAILURE_RETRY(pread64(h->fd, read_buffer, size, offset));
     if (res == -1) {
         return -errno;
@@ -1073,10 +1548,15 @@ static int handle_write(struct fuse* fuse, struct fuse_handler* handler,
 
     DLOG(INFO) << "[" << handler->token << "] WRITE " << std::hex << h << std::dec
                << "(" << h->fd << ") " << req->size << "@" << req->offset;
-    res = TEMP_FAILURE_RETRY(pwrite64(h->fd, buffer, req->size, req->offset));
+    if (handler->spliced_len) {
+        res = splice_write(handler, h->fd, req->offset);
+    } else {
+        res = TEMP_FAILURE_RETRY(pwrite64(h->fd, buffer, req->size, req->offset));
+    }
     if (res == -1) {
         return -errno;
     }
+    h->written = true;
     out.size = res;
     out.padding = 0;
     fuse_reply(fuse, hdr->unique, &out, sizeof(out));
@@ -1091,10 +1571,10 @@ static int handle_statfs(struct fuse* fuse, struct fuse_handler* handler,
     struct fuse_statfs_out out;
     int res;
 
-    pthread_mutex_lock(&fuse->global->lock);
+    lock_global(fuse->global, false);
     DLOG(INFO) << "[" << handler->token << "] STATFS";
     res = get_node_path_locked(&fuse->global->root, path, sizeof(path));
-    pthread_mutex_unlock(&fuse->global->lock);
+    unlock_global(fuse->global);
     if (res < 0) {
         return -ENOENT;
     }
@@ -1122,6 +1602,10 @@ static int handle_release(struct fuse* fuse, struct fuse_handler* handler,
     DLOG(INFO) << "[" << handler->token << "] RELEASE " << std::hex << h << std::dec
                << "(" << h->fd << ")";
     close(h->fd);
+    /* Writes since the last FLUSH, e.g. of mmapped pages. */
+    if (h->written) {
+        notify_other_views_inval_attr(fuse, hdr->nodeid);
+    }
     free(h);
     return 0;
 }
@@ -1151,9 +1635,18 @@ static int handle_fsync(struct fuse* fuse, struct fuse_handler* handler,
 }
 
 static int handle_flush(struct fuse* fuse, struct fuse_handler* handler,
-        const struct fuse_in_header* hdr)
+        const struct fuse_in_header* hdr, const struct fuse_flush_in* req)
 {
+    struct handle *h = static_cast<struct handle*>(id_to_ptr(req->fh));
+
     DLOG(INFO) << "[" << handler->token << "] FLUSH";
+    /* close() waits for FLUSH but not for RELEASE, so this is where the
+     * other views have to learn about the writes to be consistent with a
+     * later open through them. */
+    if (h->written) {
+        h->written = false;
+        notify_other_views_inval_attr(fuse, hdr->nodeid);
+    }
     return 0;
 }
 
@@ -1165,11 +1658,11 @@ static int handle_opendir(struct fuse* fuse, struct fuse_handler* handler,
     struct fuse_open_out out = {};
     struct dirhandle *h;
 
-    pthread_mutex_lock(&fuse->global->lock);
+    lock_global(fuse->global, false);
     node = lookup_node_and_path_by_id_locked(fuse, hdr->nodeid, path, sizeof(path));
     DLOG(INFO) << "[" << handler->token << "] OPENDIR @ " << std::hex << hdr->nodeid
                << " (" << (node ? node->name : "?") << ")";
-    pthread_mutex_unlock(&fuse->global->lock);
+    unlock_global(fuse->global);
 
     if (!node) {
         return -ENOENT;
@@ -1187,41 +1680,125 @@ static int handle_opendir(struct fuse* fuse, struct fuse_handler* handler,
         free(h);
         return -errno;
     }
+    h->pos = 0;
     out.fh = ptr_to_id(h);
     out.open_flags = 0;
     fuse_reply(fuse, hdr->unique, &out, sizeof(out));
     return NO_STATUS;
 }
 
-static int handle_readdir(struct fuse* fuse, struct fuse_handler* handler,
-        const struct fuse_in_header* hdr, const struct fuse_read_in* req)
+/* Fills the reply with as many entries as fit, and with READDIRPLUS also
+ * looks each of them up, saving the kernel a LOOKUP per entry.
+ *
+ * Offsets are the directory stream's own positions, so that a request for
+ * an offset that isn't where we left the stream, because the kernel didn't
+ * use every entry of our last reply or because someone rewound the
+ * directory above us, can seek there. */
+static int handle_readdir_common(struct fuse* fuse, struct fuse_handler* handler,
+        const struct fuse_in_header* hdr, const struct fuse_read_in* req, bool plus)
 {
-    char buffer[8192];
-    struct fuse_dirent *fde = (struct fuse_dirent*) buffer;
-    struct dirent *de;
     struct dirhandle *h = static_cast<struct dirhandle*>(id_to_ptr(req->fh));
-
-    DLOG(INFO) << "[" << handler->token << "] READDIR " << h;
-    if (req->offset == 0) {
-        /* rewinddir() might have been called above us, so rewind here too */
-        DLOG(INFO) << "[" << handler->token << "] calling rewinddir()";
-        rewinddir(h->d);
+    const struct fuse_in_header in_hdr = *hdr;
+    __u64 offset = req->offset;
+    size_t size = MIN(req->size, MAX_READ);
+    struct node* parent_node = NULL;
+    char path[PATH_MAX];
+    size_t pathlen = 0;
+
+    /* Don't access hdr or req beyond this point, the reply is built in the
+     * read buffer which overlaps the request buffer. */
+    __u8* buffer = handler->read_buffer;
+
+    if (plus) {
+        lock_global(fuse->global, false);
+        parent_node = lookup_node_and_path_by_id_locked(fuse, in_hdr.nodeid,
+                path, sizeof(path));
+        unlock_global(fuse->global);
+        if (!parent_node) {
+            return -ENOENT;
+        }
+        pathlen = strlen(path);
     }
-    de = readdir(h->d);
-    if (!de) {
+
+    DLOG(INFO) << "[" << handler->token << "] " << (plus ? "READDIRPLUS " : "READDIR ")
+               << h << " @ " << offset;
+    if (offset != h->pos) {
+        if (offset == 0) {
+            rewinddir(h->d);
+        } else {
+            seekdir(h->d, offset);
+        }
+        h->pos = offset;
+    }
+
+    size_t used = 0;
+    struct dirent* de;
+    while ((de = readdir(h->d)) != NULL) {
+        size_t namelen = strlen(de->d_name);
+        size_t entlen = plus ? FUSE_DIRENT_ALIGN(FUSE_NAME_OFFSET_DIRENTPLUS + namelen)
+                             : FUSE_DIRENT_ALIGN(FUSE_NAME_OFFSET + namelen);
+        /* Keep track of the stream even for an entry left out, so that the
+         * next request seeks back to it. */
+        h->pos = telldir(h->d);
+        if (used + entlen > size) {
+            if (!used) {
+                return -EINVAL;
+            }
+            break;
+        }
+
+        struct fuse_dirent* fde;
+        if (plus) {
+            struct fuse_direntplus* fdp = reinterpret_cast<struct fuse_direntplus*>(buffer + used);
+            memset(&fdp->entry_out, 0, sizeof(fdp->entry_out));
+            /* A zero nodeid, as for "." and "..", makes the kernel skip the
+             * lookup, and look the entry up itself later if it needs to. */
+            bool dots = !strcmp(de->d_name, ".") || !strcmp(de->d_name, "..");
+            if (!dots && pathlen + 1 + namelen < sizeof(path)
+                    && check_caller_access_to_name(fuse, &in_hdr, parent_node, de->d_name, R_OK)) {
+                char child_path[PATH_MAX];
+                struct stat s;
+                memcpy(child_path, path, pathlen);
+                child_path[pathlen] = '/';
+                memcpy(child_path + pathlen + 1, de->d_name, namelen + 1);
+                if (lstat(child_path, &s) == 0) {
+                    acquire_entry(fuse, parent_node, de->d_name, de->d_name, &s,
+                            &fdp->entry_out);
+                }
+            }
+            fde = &fdp->dirent;
+            fde->ino = fdp->entry_out.nodeid ? fdp->entry_out.attr.ino : FUSE_UNKNOWN_INO;
+        } else {
+            fde = reinterpret_cast<struct fuse_dirent*>(buffer + used);
+            fde->ino = FUSE_UNKNOWN_INO;
+        }
+        fde->off = h->pos;
+        fde->type = de->d_type;
+        fde->namelen = namelen;
+        memcpy(fde->name, de->d_name, namelen);
+        memset(fde->name + namelen, 0,
+                (buffer + used + entlen) - reinterpret_cast<__u8*>(fde->name + namelen));
+        used += entlen;
+    }
+    if (!used) {
         return 0;
     }
-    fde->ino = FUSE_UNKNOWN_INO;
-    /* increment the offset so we can detect when rewinddir() seeks back to the beginning */
-    fde->off = req->offset + 1;
-    fde->type = de->d_type;
-    fde->namelen = strlen(de->d_name);
-    memcpy(fde->name, de->d_name, fde->namelen + 1);
-    fuse_reply(fuse, hdr->unique, fde,
-            FUSE_DIRENT_ALIGN(sizeof(struct fuse_dirent) + fde->namelen));
+    fuse_reply(fuse, in_hdr.unique, buffer, used);
     return NO_STATUS;
 }
 
+static int handle_readdir(struct fuse* fuse, struct fuse_handler* handler,
+        const struct fuse_in_header* hdr, const struct fuse_read_in* req)
+{
+    return handle_readdir_common(fuse, handler, hdr, req, false);
+}
+
+static int handle_readdirplus(struct fuse* fuse, struct fuse_handler* handler,
+        const struct fuse_in_header* hdr, const struct fuse_read_in* req)
+{
+    return handle_readdir_common(fuse, handler, hdr, req, true);
+}
+
 static int handle_releasedir(struct fuse* fuse, struct fuse_handler* handler,
         const struct fuse_in_header* hdr, const struct fuse_release_in* req)
 {
@@ -1254,13 +1831,14 @@ static int handle_init(struct fuse* fuse, struct fuse_handler* handler,
         return -1;
     }
 
-    /* We limit ourselves to 15 because we don't handle BATCH_FORGET yet */
-    out.minor = MIN(req->minor, 15);
+    /* We limit ourselves to 21, the first version with READDIRPLUS, because
+     * 7.23 changes fuse_init_out and nothing in between is of use to us. */
+    out.minor = MIN(req->minor, 21);
     fuse_struct_size = sizeof(out);
 #if defined(FUSE_COMPAT_22_INIT_OUT_SIZE)
     /* FUSE_KERNEL_VERSION >= 23. */
 
-    /* Since we return minor version 15, the kernel does not accept the latest
+    /* Since we return minor version 21, the kernel does not accept the latest
      * fuse_init_out size. We need to use FUSE_COMPAT_22_INIT_OUT_SIZE always.*/
     fuse_struct_size = FUSE_COMPAT_22_INIT_OUT_SIZE;
 #endif
@@ -1268,6 +1846,9 @@ static int handle_init(struct fuse* fuse, struct fuse_handler* handler,
     out.major = FUSE_KERNEL_VERSION;
     out.max_readahead = req->max_readahead;
     out.flags = FUSE_ATOMIC_O_TRUNC | FUSE_BIG_WRITES;
+    /* Let the kernel choose between READDIR and READDIRPLUS, since listing
+     * names only is still cheaper when they aren't looked up afterwards. */
+    out.flags |= req->flags & (FUSE_DO_READDIRPLUS | FUSE_READDIRPLUS_AUTO);
     out.max_background = 32;
     out.congestion_threshold = 32;
     out.max_write = MAX_WRITE;
@@ -1282,12 +1863,12 @@ static int handle_canonical_path(struct fuse* fuse, struct fuse_handler* handler
     char path[PATH_MAX];
     int len;
 
-    pthread_mutex_lock(&fuse->global->lock);
+    lock_global(fuse->global, false);
     node = lookup_node_and_path_by_id_locked(fuse, hdr->nodeid,
             path, sizeof(path));
     DLOG(INFO) << "[" << handler->token << "] CANONICAL_PATH @ " << std::hex << hdr->nodeid
                << std::dec << " (" << (node ? node->name : "?") << ")";
-    pthread_mutex_unlock(&fuse->global->lock);
+    unlock_global(fuse->global);
 
     if (!node) {
         return -ENOENT;
@@ -1317,6 +1898,15 @@ static int handle_fuse_request(struct fuse *fuse, struct fuse_handler* handler,
         return handle_forget(fuse, handler, hdr, req);
     }
 
+    case FUSE_BATCH_FORGET: {
+        if (data_len < sizeof(struct fuse_batch_forget_in)) {
+            return NO_STATUS; /* no reply */
+        }
+        const struct fuse_batch_forget_in *req =
+                static_cast<const struct fuse_batch_forget_in*>(data);
+        return handle_batch_forget(fuse, handler, hdr, req, data_len);
+    }
+
     case FUSE_GETATTR: { /* getattr_in -> attr_out */
         const struct fuse_getattr_in *req = static_cast<const struct fuse_getattr_in*>(data);
         return handle_getattr(fuse, handler, hdr, req);
@@ -1395,7 +1985,8 @@ static int handle_fuse_request(struct fuse *fuse, struct fuse_handler* handler,
 //    case FUSE_LISTXATTR:
 //    case FUSE_REMOVEXATTR:
     case FUSE_FLUSH: {
-        return handle_flush(fuse, handler, hdr);
+        const struct fuse_flush_in *req = static_cast<const struct fuse_flush_in*>(data);
+        return handle_flush(fuse, handler, hdr, req);
     }
 
     case FUSE_OPENDIR: { /* open_in -> open_out */
@@ -1408,6 +1999,11 @@ static int handle_fuse_request(struct fuse *fuse, struct fuse_handler* handler,
         return handle_readdir(fuse, handler, hdr, req);
     }
 
+    case FUSE_READDIRPLUS: {
+        const struct fuse_read_in *req = static_cast<const struct fuse_read_in*>(data);
+        return handle_readdirplus(fuse, handler, hdr, req);
+    }
+
     case FUSE_RELEASEDIR: { /* release_in -> */
         const struct fuse_release_in *req = static_cast<const struct fuse_release_in*>(data);
         return handle_releasedir(fuse, handler, hdr, req);
@@ -1430,12 +2026,63 @@ static int handle_fuse_request(struct fuse *fuse, struct fuse_handler* handler,
     }
 }
 
+/* Reads the next request into request_buffer, except that the payload of a
+ * write is left in data_pipe, to be spliced on to the lower file. */
+static ssize_t read_request(struct fuse* fuse, struct fuse_handler* handler)
+{
+    handler->spliced_len = 0;
+    if (handler->data_pipe[0] == -1) {
+        return TEMP_FAILURE_RETRY(read(fuse->fd,
+                handler->request_buffer, sizeof(handler->request_buffer)));
+    }
+
+    ssize_t len = TEMP_FAILURE_RETRY(splice(fuse->fd, NULL, handler->data_pipe[1], NULL,
+            sizeof(handler->request_buffer), SPLICE_F_MOVE));
+    if (len == -1) {
+        if (errno == EINVAL) {
+            PLOG(WARNING) << "[" << handler->token << "] not splicing";
+            disable_splice(handler);
+            return read_request(fuse, handler);
+        }
+        return -1;
+    }
+
+    /* The header of a write, or the whole of anything else. */
+    size_t head = MIN(static_cast<size_t>(len),
+            sizeof(struct fuse_in_header) + sizeof(struct fuse_write_in));
+    if (!read_pipe(handler->data_pipe[0], handler->request_buffer, head)) {
+        drain_pipe(handler, handler->data_pipe[0]);
+        errno = EIO;
+        return -1;
+    }
+    const struct fuse_in_header* hdr =
+        reinterpret_cast<const struct fuse_in_header*>(handler->request_buffer);
+    const struct fuse_write_in* req =
+        reinterpret_cast<const struct fuse_write_in*>(hdr + 1);
+    size_t rest = len - head;
+    /* O_DIRECT writes want an aligned buffer rather than pipe pages. */
+    if (rest && hdr->opcode == FUSE_WRITE && !(req->flags & O_DIRECT) && rest == req->size) {
+        handler->spliced_len = rest;
+    } else if (!read_pipe(handler->data_pipe[0], handler->request_buffer + head, rest)) {
+        drain_pipe(handler, handler->data_pipe[0]);
+        errno = EIO;
+        return -1;
+    }
+    return len;
+}
+
 void handle_fuse_requests(struct fuse_handler* handler)
 {
     struct fuse* fuse = handler->fuse;
+    init_splice(handler);
     for (;;) {
-        ssize_t len = TEMP_FAILURE_RETRY(read(fuse->fd,
-                handler->request_buffer, sizeof(handler->request_buffer)));
+        /* A request we didn't get to, e.g. a write to an unknown handle. */
+        if (handler->spliced_len) {
+            drain_pipe(handler, handler->data_pipe[0]);
+            handler->spliced_len = 0;
+        }
+
+        ssize_t len = read_request(fuse, handler);
         if (len == -1) {
             if (errno == ENODEV) {
                 LOG(ERROR) << "[" << handler->token << "] someone stole our marbles!";
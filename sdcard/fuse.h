@@ -32,6 +32,7 @@
 
 #include <map>
 #include <string>
+#include <vector>
 
 #include <android-base/logging.h>
 #include <cutils/fs.h>
@@ -95,13 +96,25 @@ typedef enum {
 
 struct handle {
     int fd;
+    /* Whether the file was changed through this handle. */
+    bool written;
 };
 
 struct dirhandle {
     DIR *d;
+    /* Offset of the entry readdir() would return next. */
+    __u64 pos;
+};
+
+/* A node's full path, as built by get_node_path_locked(). */
+struct node_path {
+    size_t len;
+    char buf[];
 };
 
 struct node {
+    /* Incremented atomically, since nodes are looked up and acquired with
+     * the tree lock held shared; only released with it held exclusive. */
     __u32 refcount;
     __u64 nid;
     __u64 gen;
@@ -118,9 +131,24 @@ struct node {
     bool under_android;
 
     struct node *next;          /* per-dir sibling list */
+    struct node *prev;
     struct node *child;         /* first contained file by this dir */
     struct node *parent;        /* containing directory */
 
+    /* Once a directory has more than CHILD_INDEX_MIN children, they are also
+     * kept in a hash table keyed by the case-folded name, chained through
+     * index_next. child_index_size is a power of two. */
+    struct node **child_index;
+    size_t child_index_size;
+    size_t child_count;
+    struct node *index_next;
+    __u32 name_hash;            /* of name, set while in a parent */
+
+    /* Full path, cached once this node has children, since their paths are
+     * built from it. Set atomically with the global lock held shared and
+     * dropped with it held exclusive when the node or an ancestor moves. */
+    struct node_path *path;
+
     size_t namelen;
     char *name;
     /* If non-null, this is the real name of the file in the underlying storage.
@@ -138,9 +166,24 @@ struct node {
     bool deleted;
 };
 
+/* How often the tree lock in fuse_global has been taken, and how long
+ * callers have waited for it when it wasn't free. Updated atomically. */
+struct fuse_lock_stats {
+    __u64 shared;
+    __u64 exclusive;
+    __u64 contended;
+    __u64 wait_ns;
+    __u64 max_wait_ns;
+};
+
 /* Global data for all FUSE mounts */
 struct fuse_global {
-    pthread_mutex_t lock;
+    /* Guards the node tree. Held shared to look nodes up, build their paths
+     * and acquire references to existing ones; held exclusive to add,
+     * release, rename or delete nodes and to derive their permissions.
+     * Take it through lock_global() and unlock_global(). */
+    pthread_rwlock_t lock;
+    struct fuse_lock_stats lock_stats;
 
     uid_t uid;
     gid_t gid;
@@ -188,6 +231,12 @@ struct fuse {
 
     gid_t gid;
     mode_t mask;
+
+    /* How long, in seconds, the kernel may cache entries and attributes we
+     * reply with. Changes made through another view are explicitly
+     * invalidated, so this only bounds staleness from changes made to the
+     * lower filesystem directly. */
+    __u64 cache_timeout;
 };
 
 /* Private data used by a single FUSE handler */
@@ -195,6 +244,17 @@ struct fuse_handler {
     struct fuse* fuse;
     int token;
 
+    /* Pipes through which file data is spliced between /dev/fuse and the
+     * lower filesystem, instead of being copied through the buffers below:
+     * data_pipe takes write requests and the data of read replies, and
+     * reply_pipe assembles read replies. -1 if splicing isn't available. */
+    int data_pipe[2];
+    int reply_pipe[2];
+
+    /* Payload of the current write request left in data_pipe rather than
+     * being read into request_buffer. */
+    size_t spliced_len;
+
     /* To save memory, we never use the contents of the request buffer and the read
      * buffer at the same time.  This allows us to share the underlying storage. */
     union {
@@ -204,6 +264,14 @@ struct fuse_handler {
 };
 
 void handle_fuse_requests(struct fuse_handler* handler);
-void derive_permissions_recursive_locked(struct fuse* fuse, struct node *parent);
+int init_global_lock(struct fuse_global* global);
+void lock_global(struct fuse_global* global, bool exclusive);
+void unlock_global(struct fuse_global* global);
+void log_global_lock_stats(struct fuse_global* global);
+/* Appends the nodes whose derived permissions changed to |changed|, to be
+ * passed to notify_views_inval_attrs() once the global lock is released. */
+void derive_permissions_recursive_locked(struct fuse* fuse, struct node *parent,
+        std::vector<__u64>* changed);
+void notify_views_inval_attrs(struct fuse_global* global, const std::vector<__u64>& nids);
 
 #endif  /* FUSE_H_ */
@@ -18,12 +18,15 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <linux/fuse.h>
+#include <poll.h>
 #include <pthread.h>
+#include <signal.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/inotify.h>
 #include <sys/mount.h>
 #include <sys/resource.h>
+#include <sys/signalfd.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <unistd.h>
@@ -81,6 +84,9 @@
 #define PROP_SDCARDFS_DEVICE "ro.sys.sdcardfs"
 #define PROP_SDCARDFS_USER "persist.sys.sdcardfs"
 
+/* Default validity, in seconds, of the entries and attributes in replies. */
+#define DEFAULT_CACHE_TIMEOUT 10
+
 /* Supplementary groups to execute with. */
 static const gid_t kGroups[1] = { AID_PACKAGE_INFO };
 
@@ -92,16 +98,21 @@ static bool package_parse_callback(pkg_info *info, void *userdata) {
 }
 
 static bool read_package_list(struct fuse_global* global) {
-    pthread_mutex_lock(&global->lock);
+    lock_global(global, true);
 
     global->package_to_appid->clear();
     bool rc = packagelist_parse(package_parse_callback, global);
     DLOG(INFO) << "read_package_list: found " << global->package_to_appid->size() << " packages";
 
     // Regenerate ownership details using newly loaded mapping.
-    derive_permissions_recursive_locked(global->fuse_default, &global->root);
+    std::vector<__u64> changed;
+    derive_permissions_recursive_locked(global->fuse_default, &global->root, &changed);
+
+    unlock_global(global);
 
-    pthread_mutex_unlock(&global->lock);
+    // The kernel would otherwise keep showing the old owners until the
+    // cached attributes expire.
+    notify_views_inval_attrs(global, changed);
 
     return rc;
 }
@@ -116,6 +127,15 @@ static void watch_package_list(struct fuse_global* global) {
         return;
     }
 
+    /* run() blocked SIGUSR1 in every thread, so that it arrives here. */
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGUSR1);
+    int sfd = signalfd(-1, &mask, SFD_CLOEXEC);
+    if (sfd == -1) {
+        PLOG(WARNING) << "signalfd failed; lock statistics not available";
+    }
+
     bool active = false;
     while (1) {
         if (!active) {
@@ -141,6 +161,22 @@ static void watch_package_list(struct fuse_global* global) {
             active = true;
         }
 
+        struct pollfd fds[2] = {{nfd, POLLIN, 0}, {sfd, POLLIN, 0}};
+        if (TEMP_FAILURE_RETRY(poll(fds, arraysize(fds), -1)) == -1) {
+            PLOG(ERROR) << "failed to poll for inotify events";
+            return;
+        }
+        if (fds[1].revents & POLLIN) {
+            struct signalfd_siginfo info;
+            if (TEMP_FAILURE_RETRY(read(sfd, &info, sizeof(info))) ==
+                    static_cast<ssize_t>(sizeof(info))) {
+                log_global_lock_stats(global);
+            }
+        }
+        if (!fds[0].revents) {
+            continue;
+        }
+
         int event_pos = 0;
         ssize_t res = TEMP_FAILURE_RETRY(read(nfd, event_buf, sizeof(event_buf)));
         if (res == -1) {
@@ -212,27 +248,21 @@ static void* start_handler(void* data) {
 }
 
 static void run(const char* source_path, const char* label, uid_t uid,
-        gid_t gid, userid_t userid, bool multi_user, bool full_write) {
+        gid_t gid, userid_t userid, bool multi_user, bool full_write, int threads,
+        __u64 cache_timeout) {
     struct fuse_global global;
     struct fuse fuse_default;
     struct fuse fuse_read;
     struct fuse fuse_write;
-    struct fuse_handler handler_default;
-    struct fuse_handler handler_read;
-    struct fuse_handler handler_write;
-    pthread_t thread_default;
-    pthread_t thread_read;
-    pthread_t thread_write;
 
     memset(&global, 0, sizeof(global));
     memset(&fuse_default, 0, sizeof(fuse_default));
     memset(&fuse_read, 0, sizeof(fuse_read));
     memset(&fuse_write, 0, sizeof(fuse_write));
-    memset(&handler_default, 0, sizeof(handler_default));
-    memset(&handler_read, 0, sizeof(handler_read));
-    memset(&handler_write, 0, sizeof(handler_write));
 
-    pthread_mutex_init(&global.lock, NULL);
+    if (init_global_lock(&global)) {
+        LOG(FATAL) << "failed to initialize the global lock";
+    }
     global.package_to_appid = new AppIdMap;
     global.uid = uid;
     global.gid = gid;
@@ -271,13 +301,9 @@ static void run(const char* source_path, const char* label, uid_t uid,
     snprintf(fuse_read.dest_path, PATH_MAX, "/mnt/runtime/read/%s", label);
     snprintf(fuse_write.dest_path, PATH_MAX, "/mnt/runtime/write/%s", label);
 
-    handler_default.fuse = &fuse_default;
-    handler_read.fuse = &fuse_read;
-    handler_write.fuse = &fuse_write;
-
-    handler_default.token = 0;
-    handler_read.token = 1;
-    handler_write.token = 2;
+    fuse_default.cache_timeout = cache_timeout;
+    fuse_read.cache_timeout = cache_timeout;
+    fuse_write.cache_timeout = cache_timeout;
 
     umask(0);
 
@@ -307,10 +333,30 @@ static void run(const char* source_path, const char* label, uid_t uid,
         fs_prepare_dir(global.obb_path, 0775, uid, gid);
     }
 
-    if (pthread_create(&thread_default, NULL, start_handler, &handler_default)
-            || pthread_create(&thread_read, NULL, start_handler, &handler_read)
-            || pthread_create(&thread_write, NULL, start_handler, &handler_write)) {
-        LOG(FATAL) << "failed to pthread_create";
+    /* Handlers inherit this, leaving SIGUSR1 to watch_package_list(). */
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGUSR1);
+    pthread_sigmask(SIG_BLOCK, &mask, NULL);
+
+    /* Every view gets |threads| handlers, which all read requests from its
+     * /dev/fuse fd. Tokens 0, 1 and 2 are the first handler of each view. */
+    struct fuse* views[] = { &fuse_default, &fuse_read, &fuse_write };
+    for (int i = 0; i < threads; i++) {
+        for (size_t v = 0; v < arraysize(views); v++) {
+            struct fuse_handler* handler =
+                    static_cast<struct fuse_handler*>(calloc(1, sizeof(struct fuse_handler)));
+            if (!handler) {
+                LOG(FATAL) << "failed to allocate fuse handler";
+            }
+            handler->fuse = views[v];
+            handler->token = i * arraysize(views) + v;
+
+            pthread_t thread;
+            if (pthread_create(&thread, NULL, start_handler, handler)) {
+                LOG(FATAL) << "failed to pthread_create";
+            }
+        }
     }
 
     watch_package_list(&global);
@@ -451,6 +497,8 @@ static int usage() {
                << "    -U: specify user ID that owns device"
                << "    -m: source_path is multi-user"
                << "    -w: runtime write mount has full write access"
+               << "    -t: number of handler threads per mount (default 1)"
+               << "    -c: seconds the kernel may cache entries and attributes (default 10)"
                << "    -P  preserve owners on the lower file system";
     return 1;
 }
@@ -464,12 +512,14 @@ int main(int argc, char **argv) {
     bool multi_user = false;
     bool full_write = false;
     bool derive_gid = false;
+    int threads = 1;
+    __u64 cache_timeout = DEFAULT_CACHE_TIMEOUT;
     int i;
     struct rlimit rlim;
     int fs_version;
 
     int opt;
-    while ((opt = getopt(argc, argv, "u:g:U:mwG")) != -1) {
+    while ((opt = getopt(argc, argv, "u:g:U:mwGt:c:")) != -1) {
         switch (opt) {
             case 'u':
                 uid = strtoul(optarg, NULL, 10);
@@ -489,6 +539,12 @@ int main(int argc, char **argv) {
             case 'G':
                 derive_gid = true;
                 break;
+            case 't':
+                threads = strtol(optarg, NULL, 10);
+                break;
+            case 'c':
+                cache_timeout = strtoull(optarg, NULL, 10);
+                break;
             case '?':
             default:
                 return usage();
@@ -519,6 +575,10 @@ int main(int argc, char **argv) {
         LOG(ERROR) << "uid and gid must be nonzero";
         return usage();
     }
+    if (threads < 1) {
+        LOG(ERROR) << "at least one handler thread per mount is required";
+        return usage();
+    }
 
     rlim.rlim_cur = 8192;
     rlim.rlim_max = 8192;
@@ -534,7 +594,8 @@ int main(int argc, char **argv) {
     if (should_use_sdcardfs()) {
         run_sdcardfs(source_path, label, uid, gid, userid, multi_user, full_write, derive_gid);
     } else {
-        run(source_path, label, uid, gid, userid, multi_user, full_write);
+        run(source_path, label, uid, gid, userid, multi_user, full_write, threads,
+            cache_timeout);
     }
     return 1;
 }
@@ -15,6 +15,7 @@ include $(CLEAR_VARS)
 
 LOCAL_SRC_FILES := \
     storaged.cpp \
+    storaged_history.cpp \
     storaged_info.cpp \
     storaged_service.cpp \
     storaged_utils.cpp \
@@ -21,7 +21,8 @@
 #include <stdint.h>
 #include <time.h>
 
-#include <queue>
+#include <map>
+#include <memory>
 #include <string>
 #include <unordered_map>
 #include <vector>
@@ -29,6 +30,7 @@
 #include <batteryservice/IBatteryPropertiesListener.h>
 #include <batteryservice/IBatteryPropertiesRegistrar.h>
 
+#include "storaged_history.h"
 #include "storaged_info.h"
 #include "storaged_uid_monitor.h"
 
@@ -152,6 +154,52 @@ public:
     }
 };
 
+// Mean and standard deviation of a stream in O(1) time and space. The first
+// |window| samples weigh the same (Welford's algorithm); after that, older
+// samples decay exponentially as fast as they would in a |window| moving
+// average.
+class decaying_stats {
+private:
+    double mMean;
+    double mVariance;
+    uint32_t mCnt;
+    uint32_t mWindow;
+public:
+    decaying_stats(uint32_t window = 5) :
+            mMean(0), mVariance(0), mCnt(0), mWindow(window) {};
+    double get_mean() {
+        return mMean;
+    }
+    double get_std() {
+        return sqrt(mVariance);
+    }
+    uint32_t get_count() {
+        return mCnt;
+    }
+    void add(uint32_t num) {
+        double delta = (double)num - mMean;
+        if (mCnt < mWindow) {
+            mCnt++;
+            mMean += delta / mCnt;
+            mVariance += (delta * ((double)num - mMean) - mVariance) / mCnt;
+        } else {
+            double alpha = 2.0 / (mWindow + 1);
+            mMean += alpha * delta;
+            mVariance = (1 - alpha) * (mVariance + alpha * delta * delta);
+        }
+    }
+};
+
+// I/Os by the average latency of the polling interval they completed in.
+// Bucket 0 is under 1ms, bucket i is [2^(i-1), 2^i) ms, and the last one is
+// everything from 2^(DISK_LATENCY_BUCKETS - 2) ms up.
+#define DISK_LATENCY_BUCKETS ( 12 )
+struct disk_latency_histogram {
+    uint64_t read[DISK_LATENCY_BUCKETS];
+    uint64_t write[DISK_LATENCY_BUCKETS];
+};
+
+#define SYS_BLOCK_PATH "/sys/block"
 #define MMC_DISK_STATS_PATH "/sys/block/mmcblk0/stat"
 #define SDA_DISK_STATS_PATH "/sys/block/sda/stat"
 #define EMMC_ECSD_PATH "/d/mmc0/mmc0:0001/ext_csd"
@@ -160,49 +208,54 @@ public:
 class disk_stats_monitor {
 private:
     FRIEND_TEST(storaged_test, disk_stats_monitor);
-    const char* DISK_STATS_PATH;
+    std::string DISK_STATS_PATH;
+    std::string mName;
+    // event log type of the accumulated stats of a stall
+    std::string mStallType;
     struct disk_stats mPrevious;
     struct disk_stats mAccumulate;
+    // accumulated since the last call to get_interval_perf
+    struct disk_stats mInterval;
     bool mStall;
-    std::queue<struct disk_perf> mBuffer;
     struct {
-        stream_stats read_perf;           // read speed (bytes/s)
-        stream_stats read_ios;            // read I/Os per second
-        stream_stats write_perf;          // write speed (bytes/s)
-        stream_stats write_ios;           // write I/O per second
-        stream_stats queue;               // I/Os in queue
+        decaying_stats read_perf;           // read speed (bytes/s)
+        decaying_stats read_ios;            // read I/Os per second
+        decaying_stats write_perf;          // write speed (bytes/s)
+        decaying_stats write_ios;           // write I/O per second
+        decaying_stats queue;               // I/Os in queue
     } mStats;
     bool mValid;
     const uint32_t mWindow;
     const double mSigma;
     struct disk_perf mMean;
     struct disk_perf mStd;
+    // protects mLatency, which is read by dumpsys
+    sem_t mLock;
+    struct disk_latency_histogram mLatency;
 
+    void init(const std::string& name);
     void update_mean();
     void update_std();
     void add(struct disk_perf* perf);
-    void evict(struct disk_perf* perf);
     bool detect(struct disk_perf* perf);
+    void add_latency(struct disk_stats* inc);
 
     void update(struct disk_stats* stats);
 
 public:
-    disk_stats_monitor(uint32_t window_size = 5, double sigma = 1.0) :
-            mStall(false),
-            mValid(false),
-            mWindow(window_size),
-            mSigma(sigma) {
-        memset(&mPrevious, 0, sizeof(mPrevious));
-        memset(&mMean, 0, sizeof(mMean));
-        memset(&mStd, 0, sizeof(mStd));
-
-        if (access(MMC_DISK_STATS_PATH, R_OK) >= 0) {
-            DISK_STATS_PATH = MMC_DISK_STATS_PATH;
-        } else {
-            DISK_STATS_PATH = SDA_DISK_STATS_PATH;
-        }
-    }
+    // monitors mmcblk0, or sda if there is no eMMC
+    disk_stats_monitor(uint32_t window_size = 5, double sigma = 1.0);
+    // monitors the block device |name|, e.g. "sdb"
+    disk_stats_monitor(const std::string& name, uint32_t window_size = 5, double sigma = 1.0);
+    ~disk_stats_monitor();
     void update(void);
+    const std::string& get_name() const {
+        return mName;
+    }
+    struct disk_latency_histogram get_latency_histogram();
+    // average perf since the last call, false if nothing was sampled
+    bool get_interval_perf(struct disk_perf* perf);
+
 };
 
 class disk_stats_publisher {
@@ -252,11 +305,16 @@ private:
     time_t mTimer;
     storaged_config mConfig;
     disk_stats_publisher mDiskStats;
-    disk_stats_monitor mDsm;
+    // the first one monitors the same device as mDiskStats
+    std::vector<std::unique_ptr<disk_stats_monitor>> mDsms;
+    // outlives mUidm, which writes to it
+    storaged_history mHistory;
     uid_monitor mUidm;
     time_t mStarttime;
     sp<IBatteryPropertiesRegistrar> battery_properties;
     std::unique_ptr<storage_info_t> storage_info;
+
+    void init_disk_stats_monitors();
 public:
     storaged_t(void);
     ~storaged_t() {}
@@ -273,6 +331,18 @@ public:
     std::unordered_map<uint32_t, struct uid_info> get_uids(void) {
         return mUidm.get_uid_io_stats();
     }
+    // block device name -> latency histogram
+    std::map<std::string, struct disk_latency_histogram> get_disk_latency(void) {
+        std::map<std::string, struct disk_latency_histogram> latency;
+        for (const auto& dsm : mDsms) {
+            latency[dsm->get_name()] = dsm->get_latency_histogram();
+        }
+        return latency;
+    }
+    void dump_history(uint64_t first_ts,
+                      const std::function<bool(const struct history_record&)>& fn) {
+        mHistory.dump(first_ts, fn);
+    }
     std::map<uint64_t, struct uid_records> get_uid_records(
             double hours, uint64_t threshold, bool force_report) {
         return mUidm.dump(hours, threshold, force_report);
@@ -0,0 +1,109 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _STORAGED_HISTORY_H_
+#define _STORAGED_HISTORY_H_
+
+#include <semaphore.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <functional>
+#include <string>
+
+#include "storaged_uid_monitor.h"
+
+#ifndef FRIEND_TEST
+#define FRIEND_TEST(test_case_name, test_name) \
+friend class test_case_name##_##test_name##_Test
+#endif
+
+struct disk_perf;
+
+#define HISTORY_PATH "/data/misc/storaged/history"
+#define DEFAULT_HISTORY_RECORDS ( 16384 )
+
+enum history_record_t {
+    HISTORY_UID_IO = 1,
+    HISTORY_DISK_PERF = 2,
+};
+
+// One slot of the on-disk ring. The layout is the file format, so it only
+// uses fixed size fields and must not change without bumping the version.
+struct history_record {
+    uint32_t checksum;              // of everything after this field
+    uint16_t type;                  // history_record_t
+    uint16_t reserved;
+    uint64_t seq;                   // 1 for the first record ever written
+    uint64_t ts;                    // wall time the record was taken at
+    union {
+        struct {
+            uint32_t uid;
+            uint32_t reserved;
+            struct uid_io_usage ios;    // bytes since the last record
+        } uid_io;
+        struct {
+            char device[16];            // block device name, NUL padded
+            uint32_t read_perf;         // read speed (kbytes/s)
+            uint32_t read_ios;          // read I/Os per second
+            uint32_t write_perf;        // write speed (kbytes/s)
+            uint32_t write_ios;         // write I/Os per second
+            uint32_t queue;             // I/Os in queue
+            uint32_t reserved;
+        } disk;
+    };
+};
+
+// A fixed size ring of history records in a file mapped into memory. Each
+// record carries its own sequence number and checksum, so a record torn by
+// a crash or a power loss is skipped, and the position to write at is
+// found again from the sequence numbers when the file is reopened.
+class storaged_history {
+private:
+    FRIEND_TEST(storaged_test, history);
+    int mFd;
+    uint8_t* mMap;
+    size_t mMapSize;
+    uint32_t mCapacity;
+    // sequence number of the next record
+    uint64_t mNextSeq;
+    // protects everything above, written by the main thread and
+    // read by dumpsys
+    sem_t mLock;
+
+    struct history_record* slot(uint64_t seq);
+    void add_locked(struct history_record* record);
+    void close_locked();
+
+public:
+    storaged_history();
+    ~storaged_history();
+    // Maps |path|, creating it or starting it over if it doesn't hold a
+    // ring of |capacity| records. Returns false if the history is unusable.
+    bool open(const char* path, uint32_t capacity = DEFAULT_HISTORY_RECORDS);
+    bool is_open();
+    // called by uid_monitor with the change of one uid since its last poll
+    void add_uid_io(uint64_t ts, uint32_t uid, const struct uid_io_usage& ios);
+    // called by storaged main thread with a block device's average perf
+    void add_disk_perf(uint64_t ts, const std::string& device, const struct disk_perf& perf);
+    // schedules the added records to be written back
+    void sync();
+    // calls |fn| on the records taken at |first_ts| or later, oldest first,
+    // as long as it returns true
+    void dump(uint64_t first_ts, const std::function<bool(const struct history_record&)>& fn);
+};
+
+#endif /* _STORAGED_HISTORY_H_ */
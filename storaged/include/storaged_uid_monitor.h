@@ -17,8 +17,11 @@
 #ifndef _STORAGED_UID_MONITOR_H_
 #define _STORAGED_UID_MONITOR_H_
 
+#include <semaphore.h>
+#include <stddef.h>
 #include <stdint.h>
 
+#include <map>
 #include <string>
 #include <unordered_map>
 #include <vector>
@@ -69,10 +72,22 @@ struct uid_records {
     std::vector<struct uid_record> entries;
 };
 
+// Parses the text of /proc/uid_io/stats into |stats|, sorted by uid. Names
+// are left empty. Returns false if any line was malformed; the other lines
+// are still parsed.
+bool parse_uid_io_stats(const char* buf, size_t len, std::vector<struct uid_info>* stats);
+
+class storaged_history;
+
 class uid_monitor {
 private:
-    // last dump from /proc/uid_io/stats, uid -> uid_info
-    std::unordered_map<uint32_t, struct uid_info> last_uid_io_stats;
+    // last dump from /proc/uid_io/stats, sorted by uid
+    std::vector<struct uid_info> last_uid_io_stats;
+    // the dump being read, kept with the one above to reuse their storage
+    std::vector<struct uid_info> next_uid_io_stats;
+    // /proc/uid_io/stats, opened once, and the buffer it is read into
+    int uid_io_fd;
+    std::string uid_io_buffer;
     // current io usage for next report, app name -> uid_io_usage
     std::unordered_map<std::string, struct uid_io_usage> curr_io_stats;
     // io usage records, end timestamp -> {start timestamp, vector of records}
@@ -83,9 +98,11 @@ private:
     sem_t um_lock;
     // start time for IO records
     uint64_t start_ts;
+    // where the change of every uid is written at each poll, if set
+    storaged_history* history;
 
-    // reads from /proc/uid_io/stats
-    std::unordered_map<uint32_t, struct uid_info> get_uid_io_stats_locked();
+    // reads from /proc/uid_io/stats into |stats| and names the uids
+    bool read_uid_io_stats_locked(std::vector<struct uid_info>* stats);
     // flushes curr_io_stats to records
     void add_records_locked(uint64_t curr_ts);
     // updates curr_io_stats and set last_uid_io_stats
@@ -101,6 +118,8 @@ public:
     // called by dumpsys
     std::map<uint64_t, struct uid_records> dump(
         double hours, uint64_t threshold, bool force_report);
+    // called by storaged main thread before init
+    void set_history(storaged_history* h);
     // called by battery properties listener
     void set_charger_state(charger_stat_t stat);
     // called by storaged periodic_chore or dump with force_report
@@ -16,10 +16,15 @@
 
 #define LOG_TAG "storaged"
 
+#include <ctype.h>
+#include <dirent.h>
 #include <stdlib.h>
+#include <string.h>
 #include <time.h>
 #include <unistd.h>
 
+#include <algorithm>
+
 #include <android-base/logging.h>
 #include <batteryservice/BatteryServiceConstants.h>
 #include <batteryservice/IBatteryPropertiesRegistrar.h>
@@ -57,6 +62,43 @@ void disk_stats_publisher::update(void) {
 }
 
 /* disk_stats_monitor */
+disk_stats_monitor::disk_stats_monitor(uint32_t window_size, double sigma) :
+        mWindow(window_size), mSigma(sigma) {
+    init(access(MMC_DISK_STATS_PATH, R_OK) >= 0 ? "mmcblk0" : "sda");
+    // keeps the main device's events as they were
+    mStallType = "stalled";
+}
+
+disk_stats_monitor::disk_stats_monitor(const std::string& name, uint32_t window_size,
+                                       double sigma) :
+        mWindow(window_size), mSigma(sigma) {
+    init(name);
+    mStallType = "stalled_" + name;
+}
+
+disk_stats_monitor::~disk_stats_monitor() {
+    sem_destroy(&mLock);
+}
+
+void disk_stats_monitor::init(const std::string& name) {
+    mName = name;
+    DISK_STATS_PATH = std::string(SYS_BLOCK_PATH) + "/" + name + "/stat";
+    memset(&mPrevious, 0, sizeof(mPrevious));
+    memset(&mMean, 0, sizeof(mMean));
+    memset(&mStd, 0, sizeof(mStd));
+    memset(&mAccumulate, 0, sizeof(mAccumulate));
+    memset(&mInterval, 0, sizeof(mInterval));
+    memset(&mLatency, 0, sizeof(mLatency));
+    mStats.read_perf = decaying_stats(mWindow);
+    mStats.read_ios = decaying_stats(mWindow);
+    mStats.write_perf = decaying_stats(mWindow);
+    mStats.write_ios = decaying_stats(mWindow);
+    mStats.queue = decaying_stats(mWindow);
+    mValid = false;
+    mStall = false;
+    sem_init(&mLock, 0, 1);
+}
+
 void disk_stats_monitor::update_mean() {
     CHECK(mValid);
     mMean.read_perf = (uint32_t)mStats.read_perf.get_mean();
@@ -83,27 +125,57 @@ void disk_stats_monitor::add(struct disk_perf* perf) {
     mStats.queue.add(perf->queue);
 }
 
-void disk_stats_monitor::evict(struct disk_perf* perf) {
-    mStats.read_perf.evict(perf->read_perf);
-    mStats.read_ios.evict(perf->read_ios);
-    mStats.write_perf.evict(perf->write_perf);
-    mStats.write_ios.evict(perf->write_ios);
-    mStats.queue.evict(perf->queue);
-}
-
 bool disk_stats_monitor::detect(struct disk_perf* perf) {
     return ((double)perf->queue >= (double)mMean.queue + mSigma * (double)mStd.queue) &&
             ((double)perf->read_perf < (double)mMean.read_perf - mSigma * (double)mStd.read_perf) &&
             ((double)perf->write_perf < (double)mMean.write_perf - mSigma * (double)mStd.write_perf);
 }
 
+static uint32_t latency_bucket(uint64_t ticks, uint64_t ios) {
+    // bit length of the average latency in ms
+    uint64_t avg = ticks / ios;
+    uint32_t bucket = 0;
+    while (avg && bucket < DISK_LATENCY_BUCKETS - 1) {
+        avg >>= 1;
+        bucket++;
+    }
+    return bucket;
+}
+
+void disk_stats_monitor::add_latency(struct disk_stats* inc) {
+    lock_t lock(&mLock);
+    if (inc->read_ios) {
+        mLatency.read[latency_bucket(inc->read_ticks, inc->read_ios)] += inc->read_ios;
+    }
+    if (inc->write_ios) {
+        mLatency.write[latency_bucket(inc->write_ticks, inc->write_ios)] += inc->write_ios;
+    }
+}
+
+struct disk_latency_histogram disk_stats_monitor::get_latency_histogram() {
+    lock_t lock(&mLock);
+    return mLatency;
+}
+
+bool disk_stats_monitor::get_interval_perf(struct disk_perf* perf) {
+    if (mInterval.end_time == 0) {
+        return false;
+    }
+    *perf = get_disk_perf(&mInterval);
+    memset(&mInterval, 0, sizeof(mInterval));
+    return true;
+}
+
 void disk_stats_monitor::update(struct disk_stats* stats) {
     struct disk_stats inc = get_inc_disk_stats(&mPrevious, stats);
     struct disk_perf perf = get_disk_perf(&inc);
+    // The first sample covers everything since boot.
+    if (mPrevious.end_time != 0) {
+        add_latency(&inc);
+        add_disk_stats(&inc, &mInterval);
+    }
     // Update internal data structures
     if (LIKELY(mValid)) {
-        CHECK_EQ(mBuffer.size(), mWindow);
-
         if (UNLIKELY(detect(&perf))) {
             mStall = true;
             add_disk_stats(&inc, &mAccumulate);
@@ -112,26 +184,20 @@ void disk_stats_monitor::update(struct disk_stats* stats) {
         } else {
             if (mStall) {
                 struct disk_perf acc_perf = get_disk_perf(&mAccumulate);
-                log_debug_disk_perf(&acc_perf, "stalled");
-                log_event_disk_stats(&mAccumulate, "stalled");
+                log_debug_disk_perf(&acc_perf, mStallType.c_str());
+                log_event_disk_stats(&mAccumulate, mStallType.c_str());
                 mStall = false;
                 memset(&mAccumulate, 0, sizeof(mAccumulate));
             }
         }
 
-        evict(&mBuffer.front());
-        mBuffer.pop();
         add(&perf);
-        mBuffer.push(perf);
-
         update_mean();
         update_std();
 
     } else { /* mValid == false */
-        CHECK_LT(mBuffer.size(), mWindow);
         add(&perf);
-        mBuffer.push(perf);
-        if (mBuffer.size() == mWindow) {
+        if (mStats.queue.get_count() == mWindow) {
             mValid = true;
             update_mean();
             update_std();
@@ -143,7 +209,7 @@ void disk_stats_monitor::update(struct disk_stats* stats) {
 
 void disk_stats_monitor::update(void) {
     struct disk_stats curr;
-    if (LIKELY(parse_disk_stats(DISK_STATS_PATH, &curr))) {
+    if (LIKELY(parse_disk_stats(DISK_STATS_PATH.c_str(), &curr))) {
         update(&curr);
     }
 }
@@ -200,6 +266,41 @@ void storaged_t::binderDied(const wp<IBinder>& who) {
     }
 }
 
+static bool is_block_device_name(const char* name) {
+    const char* p;
+    if (!strncmp(name, "mmcblk", 6)) {
+        for (p = name + 6; isdigit(*p); p++);
+        return p > name + 6 && *p == '\0';
+    }
+    if (!strncmp(name, "sd", 2)) {
+        for (p = name + 2; islower(*p); p++);
+        return p > name + 2 && *p == '\0';
+    }
+    return false;
+}
+
+void storaged_t::init_disk_stats_monitors() {
+    mDsms.emplace_back(new disk_stats_monitor());
+    const std::string& main_disk = mDsms.front()->get_name();
+
+    std::unique_ptr<DIR, decltype(&closedir)> dir(opendir(SYS_BLOCK_PATH), closedir);
+    if (!dir) {
+        PLOG_TO(SYSTEM, ERROR) << "opendir " << SYS_BLOCK_PATH << " failed";
+        return;
+    }
+    std::vector<std::string> names;
+    struct dirent* entry;
+    while ((entry = readdir(dir.get())) != NULL) {
+        if (is_block_device_name(entry->d_name) && main_disk != entry->d_name) {
+            names.push_back(entry->d_name);
+        }
+    }
+    std::sort(names.begin(), names.end());
+    for (const auto& name : names) {
+        mDsms.emplace_back(new disk_stats_monitor(name));
+    }
+}
+
 void storaged_t::report_storage_info() {
     storage_info->report();
 }
@@ -214,6 +315,17 @@ storaged_t::storaged_t(void) {
 
     mConfig.proc_uid_io_available = (access(UID_IO_STATS_PATH, R_OK) == 0);
 
+    if (mConfig.diskstats_available) {
+        init_disk_stats_monitors();
+    }
+
+    int history_records =
+        property_get_int32("ro.storaged.history.records", DEFAULT_HISTORY_RECORDS);
+    if (history_records > 0) {
+        mHistory.open(HISTORY_PATH, history_records);
+    }
+    mUidm.set_history(&mHistory);
+
     mConfig.periodic_chores_interval_unit =
         property_get_int32("ro.storaged.event.interval", DEFAULT_PERIODIC_CHORES_INTERVAL_UNIT);
 
@@ -234,10 +346,20 @@ storaged_t::storaged_t(void) {
 void storaged_t::event(void) {
     if (mConfig.diskstats_available) {
         mDiskStats.update();
-        mDsm.update();
+        for (auto& dsm : mDsms) {
+            dsm->update();
+        }
         storage_info->refresh();
         if (mTimer && (mTimer % mConfig.periodic_chores_interval_disk_stats_publish) == 0) {
             mDiskStats.publish();
+            uint64_t now = time(NULL);
+            for (auto& dsm : mDsms) {
+                struct disk_perf perf;
+                if (dsm->get_interval_perf(&perf)) {
+                    mHistory.add_disk_perf(now, dsm->get_name(), perf);
+                }
+            }
+            mHistory.sync();
         }
     }
 
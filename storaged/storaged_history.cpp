@@ -0,0 +1,236 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "storaged"
+
+#include <fcntl.h>
+#include <stddef.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+
+#include <android-base/logging.h>
+
+#include "storaged.h"
+#include "storaged_history.h"
+
+static_assert(sizeof(struct history_record) == 96, "history_record is the file format");
+
+#define HISTORY_MAGIC ( 0x48446753 )    // "SgDH"
+#define HISTORY_VERSION ( 1 )
+
+// Takes the first slot of the file.
+struct history_header {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t record_size;
+    uint32_t capacity;
+};
+
+// FNV-1a, enough to tell a torn or zeroed record from a whole one.
+static uint32_t record_checksum(const struct history_record* record)
+{
+    const uint8_t* p = reinterpret_cast<const uint8_t*>(record) + sizeof(record->checksum);
+    const uint8_t* end = reinterpret_cast<const uint8_t*>(record + 1);
+    uint32_t hash = 2166136261u;
+    while (p < end) {
+        hash = (hash ^ *p++) * 16777619u;
+    }
+    return hash;
+}
+
+static bool record_valid(const struct history_record* record, uint64_t seq)
+{
+    return record->seq == seq && record->checksum == record_checksum(record);
+}
+
+storaged_history::storaged_history() :
+        mFd(-1), mMap(NULL), mMapSize(0), mCapacity(0), mNextSeq(1)
+{
+    sem_init(&mLock, 0, 1);
+}
+
+storaged_history::~storaged_history()
+{
+    close_locked();
+    sem_destroy(&mLock);
+}
+
+void storaged_history::close_locked()
+{
+    if (mMap) {
+        munmap(mMap, mMapSize);
+        mMap = NULL;
+    }
+    if (mFd >= 0) {
+        close(mFd);
+        mFd = -1;
+    }
+}
+
+struct history_record* storaged_history::slot(uint64_t seq)
+{
+    return reinterpret_cast<struct history_record*>(mMap) + 1 + seq % mCapacity;
+}
+
+bool storaged_history::open(const char* path, uint32_t capacity)
+{
+    lock_t lock(&mLock);
+    close_locked();
+    if (capacity == 0) {
+        return false;
+    }
+
+    mFd = ::open(path, O_RDWR | O_CREAT | O_CLOEXEC | O_NOFOLLOW, 0600);
+    if (mFd < 0) {
+        PLOG_TO(SYSTEM, ERROR) << "open " << path << " failed";
+        return false;
+    }
+
+    const struct history_header expected = {
+        HISTORY_MAGIC, HISTORY_VERSION, sizeof(struct history_record), capacity
+    };
+    mMapSize = sizeof(struct history_record) * ((size_t)capacity + 1);
+    mCapacity = capacity;
+
+    struct stat st;
+    struct history_header header = {};
+    if (fstat(mFd, &st) < 0 || (size_t)st.st_size != mMapSize ||
+            TEMP_FAILURE_RETRY(pread(mFd, &header, sizeof(header), 0)) != sizeof(header) ||
+            memcmp(&header, &expected, sizeof(header))) {
+        // Another format or size: start over with all slots zeroed.
+        LOG_TO(SYSTEM, INFO) << "starting a new history in " << path;
+        if (ftruncate(mFd, 0) < 0 || ftruncate(mFd, mMapSize) < 0 ||
+                TEMP_FAILURE_RETRY(pwrite(mFd, &expected, sizeof(expected), 0)) !=
+                    sizeof(expected)) {
+            PLOG_TO(SYSTEM, ERROR) << "initializing " << path << " failed";
+            close_locked();
+            return false;
+        }
+    }
+
+    void* map = mmap(NULL, mMapSize, PROT_READ | PROT_WRITE, MAP_SHARED, mFd, 0);
+    if (map == MAP_FAILED) {
+        PLOG_TO(SYSTEM, ERROR) << "mmap " << path << " failed";
+        close_locked();
+        return false;
+    }
+    mMap = static_cast<uint8_t*>(map);
+
+    // Carry on after the newest whole record.
+    uint64_t last_seq = 0;
+    for (uint32_t i = 0; i < mCapacity; ++i) {
+        const struct history_record* record =
+            reinterpret_cast<const struct history_record*>(mMap) + 1 + i;
+        if (record->seq > last_seq && record->seq % mCapacity == i &&
+                record_valid(record, record->seq)) {
+            last_seq = record->seq;
+        }
+    }
+    mNextSeq = last_seq + 1;
+    return true;
+}
+
+bool storaged_history::is_open()
+{
+    lock_t lock(&mLock);
+    return mMap != NULL;
+}
+
+void storaged_history::add_locked(struct history_record* record)
+{
+    record->seq = mNextSeq++;
+    record->checksum = record_checksum(record);
+    memcpy(slot(record->seq), record, sizeof(*record));
+}
+
+void storaged_history::add_uid_io(uint64_t ts, uint32_t uid, const struct uid_io_usage& ios)
+{
+    struct history_record record = {};
+    record.type = HISTORY_UID_IO;
+    record.ts = ts;
+    record.uid_io.uid = uid;
+    record.uid_io.ios = ios;
+
+    lock_t lock(&mLock);
+    if (mMap) {
+        add_locked(&record);
+    }
+}
+
+void storaged_history::add_disk_perf(uint64_t ts, const std::string& device,
+                                     const struct disk_perf& perf)
+{
+    struct history_record record = {};
+    record.type = HISTORY_DISK_PERF;
+    record.ts = ts;
+    memcpy(record.disk.device, device.data(),
+           std::min(device.size(), sizeof(record.disk.device) - 1));
+    record.disk.read_perf = perf.read_perf;
+    record.disk.read_ios = perf.read_ios;
+    record.disk.write_perf = perf.write_perf;
+    record.disk.write_ios = perf.write_ios;
+    record.disk.queue = perf.queue;
+
+    lock_t lock(&mLock);
+    if (mMap) {
+        add_locked(&record);
+    }
+}
+
+void storaged_history::sync()
+{
+    lock_t lock(&mLock);
+    if (mMap && msync(mMap, mMapSize, MS_ASYNC) < 0) {
+        PLOG_TO(SYSTEM, WARNING) << "msync history failed";
+    }
+}
+
+void storaged_history::dump(uint64_t first_ts,
+                            const std::function<bool(const struct history_record&)>& fn)
+{
+    uint64_t seq, end;
+    {
+        lock_t lock(&mLock);
+        if (!mMap) {
+            return;
+        }
+        end = mNextSeq;
+        seq = end > mCapacity ? end - mCapacity : 1;
+    }
+
+    // One record at a time, so that a slow reader doesn't hold up the main
+    // thread. Records overwritten in the meantime fail the seq check.
+    for (; seq < end; ++seq) {
+        struct history_record record;
+        {
+            lock_t lock(&mLock);
+            if (!mMap) {
+                return;
+            }
+            record = *slot(seq);
+        }
+        if (!record_valid(&record, seq) || record.ts < first_ts) {
+            continue;
+        }
+        if (!fn(record)) {
+            return;
+        }
+    }
+}
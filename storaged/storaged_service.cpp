@@ -96,6 +96,8 @@ status_t Storaged::dump(int fd, const Vector<String16>& args) {
     int time_window = 0;
     uint64_t threshold = 0;
     bool force_report = false;
+    bool latency = false;
+    bool history = false;
     for (size_t i = 0; i < args.size(); i++) {
         const auto& arg = args[i];
         if (arg == String16("--hours")) {
@@ -123,6 +125,63 @@ status_t Storaged::dump(int fd, const Vector<String16>& args) {
             force_report = true;
             continue;
         }
+        if (arg == String16("--latency")) {
+            latency = true;
+            continue;
+        }
+        if (arg == String16("--history")) {
+            history = true;
+            continue;
+        }
+    }
+
+    if (latency) {
+        // I/O counts by average latency, each column's upper bound in ms
+        dprintf(fd, "latency_ms");
+        for (uint32_t i = 0; i < DISK_LATENCY_BUCKETS - 1; i++) {
+            dprintf(fd, " %u", 1U << i);
+        }
+        dprintf(fd, " inf\n");
+        for (const auto& it : storaged->get_disk_latency()) {
+            dprintf(fd, "%s read", it.first.c_str());
+            for (uint64_t count : it.second.read) {
+                dprintf(fd, " %ju", count);
+            }
+            dprintf(fd, "\n%s write", it.first.c_str());
+            for (uint64_t count : it.second.write) {
+                dprintf(fd, " %ju", count);
+            }
+            dprintf(fd, "\n");
+        }
+        return NO_ERROR;
+    }
+
+    if (history) {
+        // records in the on-disk ring, oldest first
+        uint64_t first_ts = hours != 0 ? time(NULL) - hours * HOUR_TO_SEC : 0;
+        storaged->dump_history(first_ts, [fd](const struct history_record& record) {
+            if (record.type == HISTORY_UID_IO) {
+                const struct uid_io_usage& ios = record.uid_io.ios;
+                dprintf(fd, "uid_io %ju %u %ju %ju %ju %ju %ju %ju %ju %ju\n",
+                    (uintmax_t)record.ts, record.uid_io.uid,
+                    ios.bytes[READ][FOREGROUND][CHARGER_OFF],
+                    ios.bytes[WRITE][FOREGROUND][CHARGER_OFF],
+                    ios.bytes[READ][BACKGROUND][CHARGER_OFF],
+                    ios.bytes[WRITE][BACKGROUND][CHARGER_OFF],
+                    ios.bytes[READ][FOREGROUND][CHARGER_ON],
+                    ios.bytes[WRITE][FOREGROUND][CHARGER_ON],
+                    ios.bytes[READ][BACKGROUND][CHARGER_ON],
+                    ios.bytes[WRITE][BACKGROUND][CHARGER_ON]);
+            } else if (record.type == HISTORY_DISK_PERF) {
+                dprintf(fd, "disk_perf %ju %s %u %u %u %u %u\n",
+                    (uintmax_t)record.ts, record.disk.device,
+                    record.disk.read_perf, record.disk.read_ios,
+                    record.disk.write_perf, record.disk.write_ios,
+                    record.disk.queue);
+            }
+            return true;
+        });
+        return NO_ERROR;
     }
 
     uint64_t last_ts = 0;
@@ -16,23 +16,25 @@
 
 #define LOG_TAG "storaged"
 
+#include <fcntl.h>
 #include <stdint.h>
+#include <string.h>
 #include <time.h>
+#include <unistd.h>
 
+#include <algorithm>
 #include <string>
 #include <unordered_map>
 
 #include <android/content/pm/IPackageManagerNative.h>
-#include <android-base/file.h>
 #include <android-base/logging.h>
 #include <android-base/macros.h>
-#include <android-base/parseint.h>
-#include <android-base/strings.h>
 #include <android-base/stringprintf.h>
 #include <binder/IServiceManager.h>
 #include <log/log_event_list.h>
 
 #include "storaged.h"
+#include "storaged_history.h"
 #include "storaged_uid_monitor.h"
 
 using namespace android;
@@ -44,9 +46,99 @@ static bool refresh_uid_names;
 std::unordered_map<uint32_t, struct uid_info> uid_monitor::get_uid_io_stats()
 {
     std::unique_ptr<lock_t> lock(new lock_t(&um_lock));
-    return get_uid_io_stats_locked();
+    std::unordered_map<uint32_t, struct uid_info> uid_io_stats;
+    if (read_uid_io_stats_locked(&next_uid_io_stats)) {
+        for (const auto& u : next_uid_io_stats) {
+            uid_io_stats[u.uid] = u;
+        }
+    }
+    return uid_io_stats;
 };
 
+// Parses the next space separated decimal field of a line ending at |end|.
+static bool parse_field(const char** p, const char* end, uint64_t* value)
+{
+    const char* s = *p;
+    uint64_t v = 0;
+    while (s < end && *s >= '0' && *s <= '9') {
+        uint64_t digit = *s - '0';
+        if (v > (UINT64_MAX - digit) / 10) {
+            return false;
+        }
+        v = v * 10 + digit;
+        s++;
+    }
+    if (s == *p || (s < end && *s != ' ')) {
+        return false;
+    }
+    *p = s < end ? s + 1 : s;
+    *value = v;
+    return true;
+}
+
+static bool parse_uid_io_line(const char* p, const char* end, struct uid_info* u)
+{
+    uint64_t uid;
+    if (!parse_field(&p, end, &uid) || uid > UINT32_MAX) {
+        return false;
+    }
+    u->uid = uid;
+
+    uint64_t* const fields[] = {
+        &u->io[FOREGROUND].rchar,
+        &u->io[FOREGROUND].wchar,
+        &u->io[FOREGROUND].read_bytes,
+        &u->io[FOREGROUND].write_bytes,
+        &u->io[BACKGROUND].rchar,
+        &u->io[BACKGROUND].wchar,
+        &u->io[BACKGROUND].read_bytes,
+        &u->io[BACKGROUND].write_bytes,
+        &u->io[FOREGROUND].fsync,
+        &u->io[BACKGROUND].fsync,
+    };
+    for (uint64_t* field : fields) {
+        if (!parse_field(&p, end, field)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool parse_uid_io_stats(const char* buf, size_t len, std::vector<struct uid_info>* stats)
+{
+    bool valid = true;
+    const char* const buf_end = buf + len;
+    size_t count = 0;
+
+    stats->resize(std::max(stats->size(), static_cast<size_t>(1)));
+    for (const char* line = buf; line < buf_end;) {
+        const char* end = static_cast<const char*>(memchr(line, '\n', buf_end - line));
+        if (end == NULL) {
+            end = buf_end;
+        }
+        if (end != line) {
+            // Entries left from the last dump are reused, along with the
+            // storage of their names.
+            if (count == stats->size()) {
+                stats->resize(count * 2);
+            }
+            if (parse_uid_io_line(line, end, &(*stats)[count])) {
+                count++;
+            } else {
+                LOG_TO(SYSTEM, WARNING) << "Invalid I/O stats: \""
+                                        << std::string(line, end) << "\"";
+                valid = false;
+            }
+        }
+        line = end + 1;
+    }
+    stats->resize(count);
+
+    std::sort(stats->begin(), stats->end(),
+        [](const struct uid_info& l, const struct uid_info& r) { return l.uid < r.uid; });
+    return valid;
+}
+
 static void get_uid_names(const vector<int>& uids, const vector<std::string*>& uid_names)
 {
     sp<IServiceManager> sm = defaultServiceManager();
@@ -79,58 +171,68 @@ static void get_uid_names(const vector<int>& uids, const vector<std::string*>& u
     refresh_uid_names = false;
 }
 
-std::unordered_map<uint32_t, struct uid_info> uid_monitor::get_uid_io_stats_locked()
+bool uid_monitor::read_uid_io_stats_locked(std::vector<struct uid_info>* stats)
 {
-    std::unordered_map<uint32_t, struct uid_info> uid_io_stats;
-    std::string buffer;
-    if (!ReadFileToString(UID_IO_STATS_PATH, &buffer)) {
-        PLOG_TO(SYSTEM, ERROR) << UID_IO_STATS_PATH << ": ReadFileToString failed";
-        return uid_io_stats;
+    if (uid_io_fd < 0) {
+        uid_io_fd = TEMP_FAILURE_RETRY(open(UID_IO_STATS_PATH, O_RDONLY | O_CLOEXEC));
+        if (uid_io_fd < 0) {
+            PLOG_TO(SYSTEM, ERROR) << UID_IO_STATS_PATH << ": open failed";
+            return false;
+        }
     }
 
-    std::vector<std::string> io_stats = Split(buffer, "\n");
-    struct uid_info u;
-    vector<int> uids;
-    vector<std::string*> uid_names;
-
-    for (uint32_t i = 0; i < io_stats.size(); i++) {
-        if (io_stats[i].empty()) {
-            continue;
+    // Seeking back to the start makes the kernel generate the file anew.
+    if (lseek(uid_io_fd, 0, SEEK_SET) != 0) {
+        PLOG_TO(SYSTEM, ERROR) << UID_IO_STATS_PATH << ": lseek failed";
+        close(uid_io_fd);
+        uid_io_fd = -1;
+        return false;
+    }
+    uid_io_buffer.resize(std::max(uid_io_buffer.capacity(), static_cast<size_t>(4096)));
+    size_t len = 0;
+    while (true) {
+        if (len == uid_io_buffer.size()) {
+            uid_io_buffer.resize(len * 2);
         }
-        std::vector<std::string> fields = Split(io_stats[i], " ");
-        if (fields.size() < 11 ||
-            !ParseUint(fields[0],  &u.uid) ||
-            !ParseUint(fields[1],  &u.io[FOREGROUND].rchar) ||
-            !ParseUint(fields[2],  &u.io[FOREGROUND].wchar) ||
-            !ParseUint(fields[3],  &u.io[FOREGROUND].read_bytes) ||
-            !ParseUint(fields[4],  &u.io[FOREGROUND].write_bytes) ||
-            !ParseUint(fields[5],  &u.io[BACKGROUND].rchar) ||
-            !ParseUint(fields[6],  &u.io[BACKGROUND].wchar) ||
-            !ParseUint(fields[7],  &u.io[BACKGROUND].read_bytes) ||
-            !ParseUint(fields[8],  &u.io[BACKGROUND].write_bytes) ||
-            !ParseUint(fields[9],  &u.io[FOREGROUND].fsync) ||
-            !ParseUint(fields[10], &u.io[BACKGROUND].fsync)) {
-            LOG_TO(SYSTEM, WARNING) << "Invalid I/O stats: \""
-                                    << io_stats[i] << "\"";
-            continue;
+        ssize_t n = TEMP_FAILURE_RETRY(
+            read(uid_io_fd, &uid_io_buffer[len], uid_io_buffer.size() - len));
+        if (n < 0) {
+            PLOG_TO(SYSTEM, ERROR) << UID_IO_STATS_PATH << ": read failed";
+            close(uid_io_fd);
+            uid_io_fd = -1;
+            return false;
         }
+        if (n == 0) {
+            break;
+        }
+        len += n;
+    }
 
-        uid_io_stats[u.uid] = u;
-        uid_io_stats[u.uid].name = std::to_string(u.uid);
-        uids.push_back(u.uid);
-        uid_names.push_back(&uid_io_stats[u.uid].name);
-        if (last_uid_io_stats.find(u.uid) == last_uid_io_stats.end()) {
-            refresh_uid_names = true;
+    parse_uid_io_stats(uid_io_buffer.data(), len, stats);
+
+    // Both dumps are sorted by uid, so names carry over in one pass.
+    vector<int> uids;
+    vector<std::string*> uid_names;
+    auto last = last_uid_io_stats.cbegin();
+    for (auto& u : *stats) {
+        while (last != last_uid_io_stats.cend() && last->uid < u.uid) {
+            ++last;
+        }
+        if (last != last_uid_io_stats.cend() && last->uid == u.uid) {
+            u.name = last->name;
         } else {
-            uid_io_stats[u.uid].name = last_uid_io_stats[u.uid].name;
+            u.name = std::to_string(u.uid);
+            refresh_uid_names = true;
         }
+        uids.push_back(u.uid);
+        uid_names.push_back(&u.name);
     }
 
     if (!uids.empty() && refresh_uid_names) {
         get_uid_names(uids, uid_names);
     }
 
-    return uid_io_stats;
+    return true;
 }
 
 static const int MAX_UID_RECORDS_SIZE = 1000 * 48; // 1000 uids in 48 hours
@@ -230,40 +332,60 @@ std::map<uint64_t, struct uid_records> uid_monitor::dump(
 
 void uid_monitor::update_curr_io_stats_locked()
 {
-    std::unordered_map<uint32_t, struct uid_info> uid_io_stats =
-        get_uid_io_stats_locked();
-    if (uid_io_stats.empty()) {
+    if (!read_uid_io_stats_locked(&next_uid_io_stats) || next_uid_io_stats.empty()) {
         return;
     }
 
-    for (const auto& it : uid_io_stats) {
-        const struct uid_info& uid = it.second;
-
-        if (curr_io_stats.find(uid.name) == curr_io_stats.end()) {
-          curr_io_stats[uid.name] = {};
+    static const struct uid_info zero_uid_info = {};
+    uint64_t now = time(NULL);
+    auto last_it = last_uid_io_stats.cbegin();
+    for (const auto& uid : next_uid_io_stats) {
+        while (last_it != last_uid_io_stats.cend() && last_it->uid < uid.uid) {
+            ++last_it;
         }
+        const struct uid_info& last =
+            (last_it != last_uid_io_stats.cend() && last_it->uid == uid.uid) ?
+                *last_it : zero_uid_info;
 
         struct uid_io_usage& usage = curr_io_stats[uid.name];
         int64_t fg_rd_delta = uid.io[FOREGROUND].read_bytes -
-            last_uid_io_stats[uid.uid].io[FOREGROUND].read_bytes;
+            last.io[FOREGROUND].read_bytes;
         int64_t bg_rd_delta = uid.io[BACKGROUND].read_bytes -
-            last_uid_io_stats[uid.uid].io[BACKGROUND].read_bytes;
+            last.io[BACKGROUND].read_bytes;
         int64_t fg_wr_delta = uid.io[FOREGROUND].write_bytes -
-            last_uid_io_stats[uid.uid].io[FOREGROUND].write_bytes;
+            last.io[FOREGROUND].write_bytes;
         int64_t bg_wr_delta = uid.io[BACKGROUND].write_bytes -
-            last_uid_io_stats[uid.uid].io[BACKGROUND].write_bytes;
+            last.io[BACKGROUND].write_bytes;
 
-        usage.bytes[READ][FOREGROUND][charger_stat] +=
+        struct uid_io_usage delta = {};
+        delta.bytes[READ][FOREGROUND][charger_stat] =
             (fg_rd_delta < 0) ? 0 : fg_rd_delta;
-        usage.bytes[READ][BACKGROUND][charger_stat] +=
+        delta.bytes[READ][BACKGROUND][charger_stat] =
             (bg_rd_delta < 0) ? 0 : bg_rd_delta;
-        usage.bytes[WRITE][FOREGROUND][charger_stat] +=
+        delta.bytes[WRITE][FOREGROUND][charger_stat] =
             (fg_wr_delta < 0) ? 0 : fg_wr_delta;
-        usage.bytes[WRITE][BACKGROUND][charger_stat] +=
+        delta.bytes[WRITE][BACKGROUND][charger_stat] =
             (bg_wr_delta < 0) ? 0 : bg_wr_delta;
+
+        usage.bytes[READ][FOREGROUND][charger_stat] +=
+            delta.bytes[READ][FOREGROUND][charger_stat];
+        usage.bytes[READ][BACKGROUND][charger_stat] +=
+            delta.bytes[READ][BACKGROUND][charger_stat];
+        usage.bytes[WRITE][FOREGROUND][charger_stat] +=
+            delta.bytes[WRITE][FOREGROUND][charger_stat];
+        usage.bytes[WRITE][BACKGROUND][charger_stat] +=
+            delta.bytes[WRITE][BACKGROUND][charger_stat];
+
+        if (history && memcmp(&delta, &zero_io_usage, sizeof(delta))) {
+            history->add_uid_io(now, uid.uid, delta);
+        }
+    }
+
+    if (history) {
+        history->sync();
     }
 
-    last_uid_io_stats = uid_io_stats;
+    last_uid_io_stats.swap(next_uid_io_stats);
 }
 
 void uid_monitor::report()
@@ -286,19 +408,32 @@ void uid_monitor::set_charger_state(charger_stat_t stat)
     charger_stat = stat;
 }
 
+void uid_monitor::set_history(storaged_history* h)
+{
+    std::unique_ptr<lock_t> lock(new lock_t(&um_lock));
+    history = h;
+}
+
 void uid_monitor::init(charger_stat_t stat)
 {
     charger_stat = stat;
     start_ts = time(NULL);
-    last_uid_io_stats = get_uid_io_stats();
+
+    std::unique_ptr<lock_t> lock(new lock_t(&um_lock));
+    if (read_uid_io_stats_locked(&next_uid_io_stats)) {
+        last_uid_io_stats.swap(next_uid_io_stats);
+    }
 }
 
-uid_monitor::uid_monitor()
+uid_monitor::uid_monitor() : uid_io_fd(-1), history(NULL)
 {
     sem_init(&um_lock, 0, 1);
 }
 
 uid_monitor::~uid_monitor()
 {
+    if (uid_io_fd >= 0) {
+        close(uid_io_fd);
+    }
     sem_destroy(&um_lock);
 }
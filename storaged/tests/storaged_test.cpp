@@ -181,6 +181,34 @@ TEST(storaged_test, stream_stats) {
     }
 }
 
+TEST(storaged_test, decaying_stats) {
+    std::vector<uint32_t> data = {113875,81620,103145,28327,86855,207414,96526,52567,28553,250311};
+    uint32_t window_size = 5;
+    std::deque<uint32_t> test_data;
+    decaying_stats dstats(window_size);
+    // exact until the window is full
+    for (uint32_t i = 0; i < window_size; ++i) {
+        test_data.push_back(data[i]);
+        dstats.add(data[i]);
+        EXPECT_EQ(dstats.get_count(), i + 1);
+        EXPECT_EQ((int)standard_deviation(test_data), (int)dstats.get_std());
+        EXPECT_EQ((int)mean(test_data), (int)dstats.get_mean());
+    }
+    // then moving towards the newer samples
+    for (uint32_t i = window_size; i < data.size(); ++i) {
+        double last_mean = dstats.get_mean();
+        dstats.add(data[i]);
+        EXPECT_EQ(dstats.get_count(), window_size);
+        EXPECT_EQ(data[i] > last_mean, dstats.get_mean() > last_mean);
+    }
+    // and forgetting the old ones
+    for (int i = 0; i < 100; ++i) {
+        dstats.add(1000);
+    }
+    EXPECT_EQ(1000, (int)(dstats.get_mean() + 0.5));
+    EXPECT_EQ(0, (int)dstats.get_std());
+}
+
 static struct disk_perf disk_perf_multiply(struct disk_perf perf, double mul) {
     struct disk_perf retval;
     retval.read_perf = (double)perf.read_perf * mul;
@@ -234,8 +262,7 @@ TEST(storaged_test, disk_stats_monitor) {
         struct disk_perf perf = disk_perf_multiply(norm_perf, rand(gen));
 
         dsm_detect.add(&perf);
-        dsm_detect.mBuffer.push(perf);
-        EXPECT_EQ(dsm_detect.mBuffer.size(), (uint64_t)i + 1);
+        EXPECT_EQ(dsm_detect.mStats.queue.get_count(), i + 1);
     }
 
     dsm_detect.mValid = true;
@@ -316,6 +343,23 @@ TEST(storaged_test, disk_stats_monitor) {
         EXPECT_TRUE(dsm_acc.mValid);
         EXPECT_FALSE(dsm_acc.mStall);
     }
+
+    // all but the first interval averaged 1ms per I/O
+    struct disk_latency_histogram latency = dsm_acc.get_latency_histogram();
+    for (uint32_t i = 0; i < DISK_LATENCY_BUCKETS; ++i) {
+        EXPECT_EQ(latency.read[i], i == 1 ? (uint64_t)(loop_size + 10) * 200 : 0);
+        EXPECT_EQ(latency.write[i], i == 1 ? (uint64_t)(loop_size + 10) * 100 : 0);
+    }
+
+    // slow intervals land in the higher buckets, the slowest in the last one
+    struct disk_stats slow_inc = norm_inc;
+    slow_inc.read_ticks = 200 * 600;
+    slow_inc.write_ticks = 100 * 5000;
+    stats_base = disk_stats_add(stats_base, slow_inc);
+    dsm_acc.update(&stats_base);
+    latency = dsm_acc.get_latency_histogram();
+    EXPECT_EQ(latency.read[10], (uint64_t)200);
+    EXPECT_EQ(latency.write[DISK_LATENCY_BUCKETS - 1], (uint64_t)100);
 }
 
 static void expect_increasing(struct disk_stats stats1, struct disk_stats stats2) {
@@ -349,3 +393,117 @@ TEST(storaged_test, disk_stats_publisher) {
     }
 }
 
+TEST(storaged_test, parse_uid_io_stats) {
+    const char text[] =
+        "10002 1 2 3 4 5 6 7 8 9 10\n"
+        "0 11 12 13 14 15 16 17 18 19 20\n"
+        "bogus line\n"
+        "\n"
+        "10001 21 22 23 24 25 26 27 28 29 30 31";
+    std::vector<struct uid_info> stats;
+
+    // malformed lines are skipped, the result is sorted by uid
+    EXPECT_FALSE(parse_uid_io_stats(text, strlen(text), &stats));
+    ASSERT_EQ(3UL, stats.size());
+    EXPECT_EQ(0U, stats[0].uid);
+    EXPECT_EQ(11U, stats[0].io[FOREGROUND].rchar);
+    EXPECT_EQ(20U, stats[0].io[BACKGROUND].fsync);
+    EXPECT_EQ(10001U, stats[1].uid);
+    EXPECT_EQ(23U, stats[1].io[FOREGROUND].read_bytes);
+    EXPECT_EQ(28U, stats[1].io[BACKGROUND].write_bytes);
+    EXPECT_EQ(10002U, stats[2].uid);
+    EXPECT_EQ(2U, stats[2].io[FOREGROUND].wchar);
+    EXPECT_EQ(4U, stats[2].io[FOREGROUND].write_bytes);
+    EXPECT_EQ(5U, stats[2].io[BACKGROUND].rchar);
+    EXPECT_EQ(9U, stats[2].io[FOREGROUND].fsync);
+
+    const char shorter[] = "10003 1 2 3 4 5 6 7 8 9 10\n";
+    EXPECT_TRUE(parse_uid_io_stats(shorter, strlen(shorter), &stats));
+    ASSERT_EQ(1UL, stats.size());
+    EXPECT_EQ(10003U, stats[0].uid);
+
+    const char* const invalid[] = {
+        "1 2 3 4 5 6 7 8 9 10",
+        "1 2 3 4 5 6 7 8 9 10 -11",
+        "1 2 3 4 5 6 7 8 9 10  11",
+        "1 2 3 4 5 6 7 8 9 10 18446744073709551616",
+        "4294967296 2 3 4 5 6 7 8 9 10 11",
+    };
+    for (const char* line : invalid) {
+        EXPECT_FALSE(parse_uid_io_stats(line, strlen(line), &stats)) << line;
+        EXPECT_TRUE(stats.empty()) << line;
+    }
+}
+
+TEST(storaged_test, history) {
+    const char* path = "/data/local/tmp/storaged_history_test";
+    unlink(path);
+
+    std::vector<uint64_t> seqs;
+    auto collect = [&seqs](const struct history_record& record) {
+        seqs.push_back(record.seq);
+        return true;
+    };
+
+    struct uid_io_usage ios = {};
+    struct disk_perf perf = {};
+    {
+        storaged_history history;
+        ASSERT_TRUE(history.open(path, 4));
+        for (uint64_t i = 1; i <= 6; ++i) {
+            ios.bytes[WRITE][FOREGROUND][CHARGER_OFF] = i;
+            history.add_uid_io(100 + i, 10000 + i, ios);
+        }
+        perf.write_perf = 7;
+        history.add_disk_perf(107, "mmcblk0", perf);
+
+        // only the last four are left, oldest first
+        history.dump(0, collect);
+        EXPECT_EQ(std::vector<uint64_t>({4, 5, 6, 7}), seqs);
+
+        seqs.clear();
+        history.dump(106, collect);
+        EXPECT_EQ(std::vector<uint64_t>({6, 7}), seqs);
+    }
+
+    // reopening carries on after the newest record
+    {
+        storaged_history history;
+        ASSERT_TRUE(history.open(path, 4));
+        seqs.clear();
+        history.dump(0, [&seqs, &perf](const struct history_record& record) {
+            seqs.push_back(record.seq);
+            if (record.type == HISTORY_DISK_PERF) {
+                EXPECT_STREQ("mmcblk0", record.disk.device);
+                EXPECT_EQ(perf.write_perf, record.disk.write_perf);
+            } else {
+                EXPECT_EQ(HISTORY_UID_IO, record.type);
+                EXPECT_EQ(10000 + record.seq, record.uid_io.uid);
+                EXPECT_EQ(record.seq, record.uid_io.ios.bytes[WRITE][FOREGROUND][CHARGER_OFF]);
+            }
+            return true;
+        });
+        EXPECT_EQ(std::vector<uint64_t>({4, 5, 6, 7}), seqs);
+
+        // a torn record is skipped
+        history.slot(5)->ts ^= 1;
+        history.add_uid_io(108, 10008, ios);
+        seqs.clear();
+        history.dump(0, collect);
+        EXPECT_EQ(std::vector<uint64_t>({6, 7, 8}), seqs);
+    }
+
+    // another capacity starts over
+    {
+        storaged_history history;
+        ASSERT_TRUE(history.open(path, 8));
+        seqs.clear();
+        history.dump(0, collect);
+        EXPECT_TRUE(seqs.empty());
+        history.add_uid_io(109, 10009, ios);
+        history.dump(0, collect);
+        EXPECT_EQ(std::vector<uint64_t>({1}), seqs);
+    }
+
+    unlink(path);
+}
@@ -12,6 +12,7 @@ BSD_TOOLS := \
 OUR_TOOLS := \
     getevent \
     newfs_msdos \
+    perfstats \
 
 ALL_TOOLS = $(BSD_TOOLS) $(OUR_TOOLS)
 
@@ -11,6 +11,8 @@
 #include <linux/input.h>
 #include <err.h>
 #include <errno.h>
+#include <signal.h>
+#include <time.h>
 #include <unistd.h>
 
 struct label {
@@ -35,8 +37,34 @@ static struct label key_value_labels[] = {
 
 static struct pollfd *ufds;
 static char **device_names;
+static int64_t *last_report_times;
 static int nfds;
 
+/* Events read from a device with each read(). */
+#define EVENT_BATCH 64
+
+/* What -b writes for each event: the N of /dev/input/eventN (or -1) and the
+ * event as the kernel delivered it, with this struct's layout and padding in
+ * host byte order. */
+struct capture_record {
+    int32_t device;
+    struct input_event event;
+};
+
+struct latency_stats {
+    int64_t count;
+    int64_t total;
+    int64_t min;
+    int64_t max;
+};
+
+/* -L: how long after its timestamp an event was read, and the time between
+ * each device's SYN_REPORTs, in microseconds. */
+static struct latency_stats delivery_latency;
+static struct latency_stats report_interval;
+
+static volatile sig_atomic_t interrupted;
+
 enum {
     PRINT_DEVICE_ERRORS     = 1U << 0,
     PRINT_DEVICE            = 1U << 1,
@@ -316,6 +344,7 @@ static int open_device(const char *device, int print_flags)
     int clkid = CLOCK_MONOTONIC;
     struct pollfd *new_ufds;
     char **new_device_names;
+    int64_t *new_last_report_times;
     char name[80];
     char location[80];
     char idstr[80];
@@ -371,6 +400,12 @@ static int open_device(const char *device, int print_flags)
         return -1;
     }
     device_names = new_device_names;
+    new_last_report_times = realloc(last_report_times, sizeof(last_report_times[0]) * (nfds + 1));
+    if(new_last_report_times == NULL) {
+        fprintf(stderr, "out of memory\n");
+        return -1;
+    }
+    last_report_times = new_last_report_times;
 
     if(print_flags & PRINT_DEVICE)
         printf("add device %d: %s\n", nfds, device);
@@ -403,6 +438,7 @@ static int open_device(const char *device, int print_flags)
     ufds[nfds].fd = fd;
     ufds[nfds].events = POLLIN;
     device_names[nfds] = strdup(device);
+    last_report_times[nfds] = 0;
     nfds++;
 
     return 0;
@@ -419,6 +455,8 @@ int close_device(const char *device, int print_flags)
             free(device_names[i]);
             memmove(device_names + i, device_names + i + 1, sizeof(device_names[0]) * count);
             memmove(ufds + i, ufds + i + 1, sizeof(ufds[0]) * count);
+            memmove(last_report_times + i, last_report_times + i + 1,
+                    sizeof(last_report_times[0]) * count);
             nfds--;
             return 0;
         }
@@ -494,9 +532,66 @@ static int scan_dir(const char *dirname, int print_flags)
     return 0;
 }
 
+static void stats_add(struct latency_stats *stats, int64_t value)
+{
+    if(stats->count == 0 || value < stats->min)
+        stats->min = value;
+    if(stats->count == 0 || value > stats->max)
+        stats->max = value;
+    stats->total += value;
+    stats->count++;
+}
+
+static void stats_print(const char *name, const struct latency_stats *stats)
+{
+    if(stats->count == 0) {
+        fprintf(stderr, "%s: none\n", name);
+        return;
+    }
+    fprintf(stderr, "%s: %lld, min %lld us, avg %lld us, max %lld us\n", name,
+            (long long)stats->count, (long long)stats->min,
+            (long long)(stats->total / stats->count), (long long)stats->max);
+}
+
+static int64_t now_us()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+static int device_number(const char *device)
+{
+    const char *name = strrchr(device, '/');
+    name = name ? name + 1 : device;
+    if(strncmp(name, "event", 5) != 0)
+        return -1;
+    return atoi(name + 5);
+}
+
+static void handle_interrupt(int sig)
+{
+    (void)sig;
+    interrupted = 1;
+}
+
+static int finish(FILE *capture, int latency, int status)
+{
+    fflush(stdout);
+    if(capture && fclose(capture) != 0) {
+        fprintf(stderr, "could not write capture, %s\n", strerror(errno));
+        status = 1;
+    }
+    if(latency) {
+        stats_print("delivery latency", &delivery_latency);
+        stats_print("report interval", &report_interval);
+    }
+    return status;
+}
+
 static void usage(char *name)
 {
-    fprintf(stderr, "Usage: %s [-t] [-n] [-s switchmask] [-S] [-v [mask]] [-d] [-p] [-i] [-l] [-q] [-c count] [-r] [device]\n", name);
+    fprintf(stderr, "Usage: %s [-t] [-n] [-s switchmask] [-S] [-v [mask]] [-d] [-p] [-i] [-l] [-q] [-c count] [-r] [-b file] [-L] [device]\n", name);
     fprintf(stderr, "    -t: show time stamps\n");
     fprintf(stderr, "    -n: don't print newlines\n");
     fprintf(stderr, "    -s: print switch states for given bits\n");
@@ -509,6 +604,8 @@ static void usage(char *name)
     fprintf(stderr, "    -q: quiet (clear verbosity mask)\n");
     fprintf(stderr, "    -c: print given number of events then exit\n");
     fprintf(stderr, "    -r: print rate events are received\n");
+    fprintf(stderr, "    -b: write events to the given file in binary instead of printing them\n");
+    fprintf(stderr, "    -L: report event latency and report intervals on exit\n");
 }
 
 int getevent_main(int argc, char *argv[])
@@ -520,19 +617,22 @@ int getevent_main(int argc, char *argv[])
     int print_device = 0;
     char *newline = "\n";
     uint16_t get_switch = 0;
-    struct input_event event;
+    struct input_event events[EVENT_BATCH];
     int print_flags = 0;
     int print_flags_set = 0;
     int dont_block = -1;
     int event_count = 0;
     int sync_rate = 0;
     int64_t last_sync_time = 0;
+    const char *capture_path = NULL;
+    FILE *capture = NULL;
+    int latency = 0;
     const char *device = NULL;
     const char *device_path = "/dev/input";
 
     opterr = 0;
     do {
-        c = getopt(argc, argv, "tns:Sv::dpilqc:rh");
+        c = getopt(argc, argv, "tns:Sv::dpilqc:rb:Lh");
         if (c == EOF)
             break;
         switch (c) {
@@ -588,6 +688,12 @@ int getevent_main(int argc, char *argv[])
         case 'r':
             sync_rate = 1;
             break;
+        case 'b':
+            capture_path = optarg;
+            break;
+        case 'L':
+            latency = 1;
+            break;
         case '?':
             fprintf(stderr, "%s: invalid option -%c\n",
                 argv[0], optopt);
@@ -650,40 +756,89 @@ int getevent_main(int argc, char *argv[])
     if(dont_block)
         return 0;
 
-    while(1) {
-        //int pollres =
-        poll(ufds, nfds, -1);
-        //printf("poll %d, returned %d\n", nfds, pollres);
+    if(capture_path) {
+        capture = fopen(capture_path, "we");
+        if(capture == NULL) {
+            fprintf(stderr, "could not open %s, %s\n", capture_path, strerror(errno));
+            return 1;
+        }
+        setvbuf(capture, NULL, _IOFBF, 64 * 1024);
+    }
+    if(latency || capture) {
+        // Stop on ^C with the capture flushed and the statistics printed.
+        struct sigaction sa;
+        memset(&sa, 0, sizeof(sa));
+        sa.sa_handler = handle_interrupt;
+        sigaction(SIGINT, &sa, NULL);
+        sigaction(SIGTERM, &sa, NULL);
+    }
+    // Written out once per poll() instead of once per line, which is what keeps
+    // up with devices reporting at 1kHz and more.
+    setvbuf(stdout, NULL, _IOFBF, 64 * 1024);
+
+    while(!interrupted) {
+        if(poll(ufds, nfds, -1) < 0) {
+            if(errno == EINTR)
+                continue;
+            fprintf(stderr, "poll failed, %s\n", strerror(errno));
+            return finish(capture, latency, 1);
+        }
         if(ufds[0].revents & POLLIN) {
             read_notify(device_path, ufds[0].fd, print_flags);
         }
         for(i = 1; i < nfds; i++) {
             if(ufds[i].revents) {
                 if(ufds[i].revents & POLLIN) {
-                    res = read(ufds[i].fd, &event, sizeof(event));
-                    if(res < (int)sizeof(event)) {
+                    int n, j;
+                    int64_t read_time;
+                    res = read(ufds[i].fd, events, sizeof(events));
+                    if(res < (int)sizeof(events[0])) {
+                        if(res < 0 && errno == EINTR)
+                            continue;
                         fprintf(stderr, "could not get event\n");
-                        return 1;
-                    }
-                    if(get_time) {
-                        printf("[%8ld.%06ld] ", event.time.tv_sec, event.time.tv_usec);
+                        return finish(capture, latency, 1);
                     }
-                    if(print_device)
-                        printf("%s: ", device_names[i]);
-                    print_event(event.type, event.code, event.value, print_flags);
-                    if(sync_rate && event.type == 0 && event.code == 0) {
-                        int64_t now = event.time.tv_sec * 1000000LL + event.time.tv_usec;
-                        if(last_sync_time)
-                            printf(" rate %lld", 1000000LL / (now - last_sync_time));
-                        last_sync_time = now;
+                    n = res / sizeof(events[0]);
+                    read_time = latency ? now_us() : 0;
+                    for(j = 0; j < n; j++) {
+                        struct input_event *event = &events[j];
+                        int64_t event_time = event->time.tv_sec * 1000000LL + event->time.tv_usec;
+                        if(latency) {
+                            stats_add(&delivery_latency, read_time - event_time);
+                            if(event->type == EV_SYN && event->code == SYN_REPORT) {
+                                if(last_report_times[i])
+                                    stats_add(&report_interval, event_time - last_report_times[i]);
+                                last_report_times[i] = event_time;
+                            }
+                        }
+                        if(capture) {
+                            struct capture_record record;
+                            memset(&record, 0, sizeof(record));
+                            record.device = device_number(device_names[i]);
+                            record.event = *event;
+                            fwrite(&record, sizeof(record), 1, capture);
+                        } else {
+                            if(get_time) {
+                                printf("[%8ld.%06ld] ", event->time.tv_sec, event->time.tv_usec);
+                            }
+                            if(print_device)
+                                printf("%s: ", device_names[i]);
+                            print_event(event->type, event->code, event->value, print_flags);
+                            if(sync_rate && event->type == 0 && event->code == 0) {
+                                if(last_sync_time)
+                                    printf(" rate %lld", 1000000LL / (event_time - last_sync_time));
+                                last_sync_time = event_time;
+                            }
+                            printf("%s", newline);
+                        }
+                        if(event_count && --event_count == 0)
+                            return finish(capture, latency, 0);
                     }
-                    printf("%s", newline);
-                    if(event_count && --event_count == 0)
-                        return 0;
                 }
             }
         }
+        fflush(stdout);
     }
 
-    return 0;
+    return finish(capture, latency, 0);
 }
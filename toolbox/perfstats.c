@@ -0,0 +1,125 @@
+#include <dirent.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <cutils/perfstats.h>
+
+/*
+ * Prints what daemons export with libcutils perfstats, one line each:
+ *
+ *   daemon <name> <pid> running|exited
+ *   counter <name> <metric> <value>
+ *   histogram <name> <metric> <count> <sum> <bucket 0> ... <bucket 31>
+ */
+
+struct output {
+    const char *name;
+    FILE *out;
+};
+
+static void print_value(const struct perfstats_value *value, void *arg)
+{
+    struct output *output = arg;
+    int i;
+
+    if (value->type == PERFSTATS_COUNTER) {
+        fprintf(output->out, "counter %s %s %" PRIu64 "\n", output->name, value->name,
+                value->count);
+        return;
+    }
+    fprintf(output->out, "histogram %s %s %" PRIu64 " %" PRIu64, output->name, value->name,
+            value->count, value->sum);
+    for (i = 0; i < PERFSTATS_HISTOGRAM_BUCKETS; ++i) {
+        fprintf(output->out, " %" PRIu64, value->buckets[i]);
+    }
+    fputc('\n', output->out);
+}
+
+static int print_file(const char *path)
+{
+    const char *name = strrchr(path, '/');
+    struct output output;
+    char *buf = NULL;
+    size_t len = 0;
+    pid_t pid;
+    int ret;
+
+    /* The metrics go to a buffer, so that the daemon line comes first. */
+    output.name = name ? name + 1 : path;
+    output.out = open_memstream(&buf, &len);
+    if (!output.out) {
+        fprintf(stderr, "perfstats: %s\n", strerror(errno));
+        return -1;
+    }
+    ret = perfstats_read(path, &pid, print_value, &output);
+    fclose(output.out);
+    if (ret < 0) {
+        fprintf(stderr, "perfstats: %s: %s\n", path, strerror(-ret));
+        free(buf);
+        return -1;
+    }
+    printf("daemon %s %d %s\n", output.name, pid,
+           (kill(pid, 0) == 0 || errno == EPERM) ? "running" : "exited");
+    fwrite(buf, 1, len, stdout);
+    free(buf);
+    return 0;
+}
+
+static int usage(void)
+{
+    fprintf(stderr, "usage: perfstats [NAME|PATH...]\n"
+                    "\n"
+                    "Prints the counters and histograms of the daemons named, or of every\n"
+                    "daemon in " PERFSTATS_DIR ".\n");
+    return 1;
+}
+
+int perfstats_main(int argc, char **argv)
+{
+    char path[PATH_MAX];
+    int ret = 0;
+    int i;
+
+    if (argc > 1 && argv[1][0] == '-') {
+        return usage();
+    }
+
+    if (argc > 1) {
+        for (i = 1; i < argc; ++i) {
+            if (strchr(argv[i], '/')) {
+                snprintf(path, sizeof(path), "%s", argv[i]);
+            } else {
+                snprintf(path, sizeof(path), PERFSTATS_DIR "/%s", argv[i]);
+            }
+            if (print_file(path) < 0) {
+                ret = 1;
+            }
+        }
+        return ret;
+    }
+
+    DIR *dir = opendir(PERFSTATS_DIR);
+    if (!dir) {
+        fprintf(stderr, "perfstats: %s: %s\n", PERFSTATS_DIR, strerror(errno));
+        return 1;
+    }
+    struct dirent *de;
+    while ((de = readdir(dir)) != NULL) {
+        /* dot files are the daemons' own, still being filled in */
+        if (de->d_name[0] == '.') {
+            continue;
+        }
+        snprintf(path, sizeof(path), PERFSTATS_DIR "/%s", de->d_name);
+        if (print_file(path) < 0) {
+            ret = 1;
+        }
+    }
+    closedir(dir);
+    return ret;
+}
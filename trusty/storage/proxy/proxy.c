@@ -15,13 +15,16 @@
  */
 #include <errno.h>
 #include <getopt.h>
+#include <inttypes.h>
 #include <stdbool.h>
 #include <stdint.h>
+#include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
 #include <sys/capability.h>
 #include <sys/prctl.h>
 #include <sys/stat.h>
+#include <time.h>
 #include <unistd.h>
 
 #include <cutils/android_filesystem_config.h>
@@ -34,6 +37,22 @@
 #define REQ_BUFFER_SIZE 4096
 static uint8_t req_buffer[REQ_BUFFER_SIZE + 1];
 
+/*
+ * Per command latency histograms, power of two buckets of microseconds
+ * (bucket n counts requests of [2^(n-1), 2^n) us), logged every
+ * STATS_INTERVAL requests.
+ */
+#define STATS_CMDS (STORAGE_RPMB_SEND >> STORAGE_REQ_SHIFT)
+#define STATS_BUCKETS 24
+#define STATS_INTERVAL 4096
+
+static const char *stats_names[STATS_CMDS] = {
+    "delete", "open", "close", "read", "write", "get_size", "set_size", "rpmb",
+};
+static uint32_t stats_hist[STATS_CMDS][STATS_BUCKETS];
+static uint64_t stats_total_us[STATS_CMDS];
+static uint32_t stats_reqs;
+
 static const char *ss_data_root;
 static const char *trusty_devname;
 static const char *rpmb_devname;
@@ -164,10 +183,66 @@ static int handle_req(struct storage_msg *msg, const void *req, size_t req_len)
     return rc;
 }
 
+static uint64_t now_us(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void stats_dump(void)
+{
+    for (uint i = 0; i < STATS_CMDS; i++) {
+        char line[STATS_BUCKETS * 12];
+        size_t len = 0;
+        uint32_t cnt = 0;
+
+        for (uint b = 0; b < STATS_BUCKETS; b++) {
+            cnt += stats_hist[i][b];
+        }
+        if (!cnt)
+            continue;
+
+        line[0] = 0;
+        for (uint b = 0; b < STATS_BUCKETS && len < sizeof(line); b++) {
+            if (stats_hist[i][b]) {
+                len += snprintf(line + len, sizeof(line) - len, " <%uus:%u",
+                                1u << b, stats_hist[i][b]);
+            }
+        }
+        ALOGI("%s: %u reqs, avg %" PRIu64 "us,%s\n", stats_names[i], cnt,
+              stats_total_us[i] / cnt, line);
+    }
+    memset(stats_hist, 0, sizeof(stats_hist));
+    memset(stats_total_us, 0, sizeof(stats_total_us));
+}
+
+static void stats_record(uint32_t cmd, uint64_t us)
+{
+    uint i = (cmd >> STORAGE_REQ_SHIFT) - 1;
+    uint b = 0;
+
+    if (i >= STATS_CMDS)
+        return;
+
+    while (b < STATS_BUCKETS - 1 && us >= (1ull << b))
+        b++;
+    stats_hist[i][b]++;
+    stats_total_us[i] += us;
+
+    if (++stats_reqs == STATS_INTERVAL) {
+        stats_reqs = 0;
+        stats_dump();
+    }
+}
+
 static int proxy_loop(void)
 {
     ssize_t rc;
     struct storage_msg msg;
+    uint32_t cmd;
+    uint64_t start;
 
     /* enter main message handling loop */
     while (true) {
@@ -179,7 +254,10 @@ static int proxy_loop(void)
 
         /* handle request */
         req_buffer[rc] = 0; /* force zero termination */
+        cmd = msg.cmd;
+        start = now_us();
         rc = handle_req(&msg, req_buffer, rc);
+        stats_record(cmd, now_us() - start);
         if (rc)
             return rc;
     }
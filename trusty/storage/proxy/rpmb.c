@@ -16,11 +16,14 @@
 
 #include <errno.h>
 #include <fcntl.h>
+#include <inttypes.h>
+#include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/ioctl.h>
+#include <time.h>
 #include <unistd.h>
 
 #include <linux/major.h>
@@ -49,9 +52,21 @@
 
 #define MMC_BLOCK_SIZE 512
 
+#define RPMB_STATS_INTERVAL 256
+
 static int rpmb_fd = -1;
 static uint8_t read_buf[4096];
 
+/* cleared once the kernel turns MMC_IOC_MULTI_CMD down */
+static bool rpmb_multi_cmd = true;
+
+/* transaction times, logged every RPMB_STATS_INTERVAL transactions */
+static struct {
+    uint32_t cnt;
+    uint64_t total_us;
+    uint64_t max_us;
+} rpmb_stats;
+
 #ifdef RPMB_DEBUG
 
 static void print_buf(const char *prefix, const uint8_t *buf, size_t size)
@@ -70,6 +85,55 @@ static void print_buf(const char *prefix, const uint8_t *buf, size_t size)
 
 #endif
 
+static uint64_t now_us(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void rpmb_stats_record(uint64_t us)
+{
+    rpmb_stats.cnt++;
+    rpmb_stats.total_us += us;
+    if (us > rpmb_stats.max_us)
+        rpmb_stats.max_us = us;
+
+    if (rpmb_stats.cnt == RPMB_STATS_INTERVAL) {
+        ALOGI("rpmb: %u transactions, avg %" PRIu64 "us, max %" PRIu64 "us%s\n",
+              rpmb_stats.cnt, rpmb_stats.total_us / rpmb_stats.cnt,
+              rpmb_stats.max_us, rpmb_multi_cmd ? "" : " (single commands)");
+        memset(&rpmb_stats, 0, sizeof(rpmb_stats));
+    }
+}
+
+/*
+ * Issues the frames of a transaction in a single MMC_IOC_MULTI_CMD, so
+ * they reach the card back to back without another user of the partition
+ * in between. Kernels older than 4.4 do not have it: fall back to one
+ * MMC_IOC_CMD per frame set, as was all there was before, and stop trying.
+ */
+static int rpmb_ioctl(struct mmc_ioc_multi_cmd *multi)
+{
+    int rc;
+
+    if (rpmb_multi_cmd) {
+        rc = ioctl(rpmb_fd, MMC_IOC_MULTI_CMD, multi);
+        if (rc >= 0 || (errno != ENOTTY && errno != EINVAL))
+            return rc;
+        ALOGW("%s: MMC_IOC_MULTI_CMD not supported, issuing single commands\n",
+              __func__);
+        rpmb_multi_cmd = false;
+    }
+
+    for (uint64_t i = 0; i < multi->num_of_cmds; i++) {
+        rc = ioctl(rpmb_fd, MMC_IOC_CMD, &multi->cmds[i]);
+        if (rc < 0)
+            return rc;
+    }
+    return 0;
+}
 
 int rpmb_send(struct storage_msg *msg, const void *r, size_t req_len)
 {
@@ -163,7 +227,9 @@ int rpmb_send(struct storage_msg *msg, const void *r, size_t req_len)
         cmd++;
     }
 
-    rc = ioctl(rpmb_fd, MMC_IOC_MULTI_CMD, &mmc.multi);
+    uint64_t start = now_us();
+    rc = rpmb_ioctl(&mmc.multi);
+    rpmb_stats_record(now_us() - start);
     if (rc < 0) {
         ALOGE("%s: mmc ioctl failed: %d, %s\n", __func__, rc, strerror(errno));
         msg->result = STORAGE_ERR_GENERIC;
@@ -176,8 +242,8 @@ int rpmb_send(struct storage_msg *msg, const void *r, size_t req_len)
 
     if (msg->flags & STORAGE_MSG_FLAG_POST_COMMIT) {
         /*
-         * Nothing todo for post msg commit request as MMC_IOC_MULTI_CMD
-         * is fully synchronous in this implementation.
+         * Nothing todo for post msg commit request as the mmc ioctls
+         * are fully synchronous in this implementation.
          */
     }
 
@@ -16,11 +16,11 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <inttypes.h>
+#include <pthread.h>
 #include <stdbool.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/stat.h>
-#include <sys/syscall.h>
 #include <sys/types.h>
 #include <unistd.h>
 
@@ -28,8 +28,11 @@
 #include "ipc.h"
 #include "storage.h"
 
-#define FD_TBL_SIZE 64
+#define FD_TBL_INIT_SIZE 16
+#define FD_CACHE_SIZE 8
+#define NO_HANDLE UINT32_MAX
 #define MAX_READ_SIZE 4096
+#define SYNC_THREADS 4
 
 enum sync_state {
     SS_UNUSED = -1,
@@ -40,55 +43,251 @@ enum sync_state {
 static int ssdir_fd = -1;
 static const char *ssdir_name;
 
-static enum sync_state fs_state;
 static enum sync_state dir_state;
-static enum sync_state fd_state[FD_TBL_SIZE];
+
+/*
+ * Open files, indexed by the handle given out for them. Unused entries are
+ * chained on a free list through next_free, the last freed handed out first,
+ * so insert/lookup/remove are all O(1) and the table only grows if it must.
+ */
+struct fd_entry {
+    int fd;
+    enum sync_state state;  /* SS_UNUSED while on the free list */
+    uint32_t next_free;
+    char *path;
+};
+
+static struct fd_entry *fd_tbl;
+static uint32_t fd_tbl_size;
+static uint32_t fd_free = NO_HANDLE;
+static int *dirty_fds;  /* fd_tbl_size of them, for storage_sync_checkpoint */
+
+/*
+ * Files closed recently, most recent first, still open in case they are
+ * opened again: the secure storage service keeps going back to the same
+ * few. Only clean files are kept, close syncs them first.
+ */
+static struct {
+    int fd;
+    char *path;
+} fd_cache[FD_CACHE_SIZE];
+static uint fd_cache_cnt;
 
 static struct {
    struct storage_file_read_resp hdr;
    uint8_t data[MAX_READ_SIZE];
 }  read_rsp;
 
-static uint32_t insert_fd(int open_flags, int fd)
+/*
+ * Workers that fsync the dirty fds of a checkpoint side by side. Issued one
+ * after another each fsync waits for its own journal commit, issued together
+ * the file system can fold them into one or a few.
+ */
+static struct {
+    pthread_mutex_t lock;
+    pthread_cond_t work;
+    pthread_cond_t done;
+    const int *fds;
+    uint count;     /* fds to sync in this round */
+    uint next;      /* next one to hand out */
+    uint pending;   /* handed out or not, not synced yet */
+    int error;      /* first errno seen this round */
+    uint threads;
+} sync_pool = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .work = PTHREAD_COND_INITIALIZER,
+    .done = PTHREAD_COND_INITIALIZER,
+};
+
+/* called with sync_pool.lock held, which it drops around the fsync */
+static void sync_pool_run_one(void)
+{
+    int fd = sync_pool.fds[sync_pool.next++];
+
+    pthread_mutex_unlock(&sync_pool.lock);
+    int rc = fsync(fd);
+    int error = (rc < 0) ? errno : 0;
+    if (rc < 0) {
+        ALOGE("fsync for fd=%d failed: %s\n", fd, strerror(error));
+    }
+    pthread_mutex_lock(&sync_pool.lock);
+
+    if (error && !sync_pool.error) {
+        sync_pool.error = error;
+    }
+    if (--sync_pool.pending == 0) {
+        pthread_cond_signal(&sync_pool.done);
+    }
+}
+
+static void *sync_pool_worker(void *arg)
+{
+    pthread_mutex_lock(&sync_pool.lock);
+    while (true) {
+        while (sync_pool.next >= sync_pool.count) {
+            pthread_cond_wait(&sync_pool.work, &sync_pool.lock);
+        }
+        sync_pool_run_one();
+    }
+    return NULL;
+}
+
+static void sync_pool_start(void)
+{
+    pthread_attr_t attr;
+
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    for (uint i = 0; i < SYNC_THREADS; i++) {
+        pthread_t thread;
+        if (pthread_create(&thread, &attr, sync_pool_worker, NULL)) {
+            ALOGW("%s: running with %u sync threads\n", __func__, i);
+            break;
+        }
+        sync_pool.threads++;
+    }
+    pthread_attr_destroy(&attr);
+}
+
+/* fsyncs fds[0..count), returns 0 or -1 with errno of the first failure */
+static int sync_fds(const int *fds, uint count)
+{
+    int error;
+
+    pthread_mutex_lock(&sync_pool.lock);
+    sync_pool.fds = fds;
+    sync_pool.next = 0;
+    sync_pool.pending = count;
+    sync_pool.error = 0;
+    sync_pool.count = count;
+    if (sync_pool.threads && count > 1) {
+        pthread_cond_broadcast(&sync_pool.work);
+    }
+
+    /* take a share of them rather than sit waiting */
+    while (sync_pool.next < sync_pool.count) {
+        sync_pool_run_one();
+    }
+    while (sync_pool.pending) {
+        pthread_cond_wait(&sync_pool.done, &sync_pool.lock);
+    }
+    sync_pool.count = 0;
+    sync_pool.next = 0;
+    error = sync_pool.error;
+    pthread_mutex_unlock(&sync_pool.lock);
+
+    if (error) {
+        errno = error;
+        return -1;
+    }
+    return 0;
+}
+
+static int grow_fd_tbl(void)
+{
+    uint32_t size = fd_tbl_size ? fd_tbl_size * 2 : FD_TBL_INIT_SIZE;
+
+    struct fd_entry *tbl = realloc(fd_tbl, size * sizeof(*tbl));
+    if (!tbl)
+        return -1;
+    fd_tbl = tbl;
+
+    int *fds = realloc(dirty_fds, size * sizeof(*fds));
+    if (!fds)
+        return -1;
+    dirty_fds = fds;
+
+    /* chain the new entries in front, lowest first */
+    for (uint32_t handle = size; handle-- > fd_tbl_size; ) {
+        fd_tbl[handle].fd = -1;
+        fd_tbl[handle].state = SS_UNUSED;
+        fd_tbl[handle].path = NULL;
+        fd_tbl[handle].next_free = fd_free;
+        fd_free = handle;
+    }
+    fd_tbl_size = size;
+    return 0;
+}
+
+/* takes ownership of path, returns NO_HANDLE if the table cannot grow */
+static uint32_t insert_fd(int open_flags, int fd, char *path)
 {
-    uint32_t handle = fd;
+    if (fd_free == NO_HANDLE && grow_fd_tbl() < 0) {
+        ALOGE("%s: out of memory for fd %d\n", __func__, fd);
+        return NO_HANDLE;
+    }
+
+    uint32_t handle = fd_free;
+    struct fd_entry *entry = &fd_tbl[handle];
+    fd_free = entry->next_free;
 
     if (open_flags & O_CREAT) {
         dir_state = SS_DIRTY;
     }
 
-    if (handle < FD_TBL_SIZE) {
-            fd_state[fd] = SS_CLEAN; /* fd clean */
-            if (open_flags & O_TRUNC) {
-                fd_state[fd] = SS_DIRTY;  /* set fd dirty */
-            }
-    } else {
-            ALOGW("%s: untracked fd %u\n", __func__, fd);
-            if (open_flags & (O_TRUNC | O_CREAT)) {
-                fs_state = SS_DIRTY;
-            }
+    entry->fd = fd;
+    entry->path = path;
+    entry->state = SS_CLEAN; /* fd clean */
+    if (open_flags & O_TRUNC) {
+        entry->state = SS_DIRTY;  /* set fd dirty */
     }
     return handle;
 }
 
 static int lookup_fd(uint32_t handle, bool dirty)
 {
+    if (handle >= fd_tbl_size || fd_tbl[handle].state == SS_UNUSED) {
+        ALOGW("%s: invalid handle %u\n", __func__, handle);
+        return -1;
+    }
     if (dirty) {
-        if (handle < FD_TBL_SIZE) {
-            fd_state[handle] = SS_DIRTY;
-        } else {
-            fs_state = SS_DIRTY;
-        }
+        fd_tbl[handle].state = SS_DIRTY;
     }
-    return handle;
+    return fd_tbl[handle].fd;
+}
+
+/* returns the file's path, now the caller's to free */
+static char *remove_fd(uint32_t handle)
+{
+    struct fd_entry *entry = &fd_tbl[handle];
+    char *path = entry->path;
+
+    entry->fd = -1;
+    entry->path = NULL;
+    entry->state = SS_UNUSED; /* set to uninstalled */
+    entry->next_free = fd_free;
+    fd_free = handle;
+    return path;
 }
 
-static int remove_fd(uint32_t handle)
+/* takes the file at path out of the cache, returns its fd or -1 */
+static int fd_cache_take(const char *path)
 {
-    if (handle < FD_TBL_SIZE) {
-        fd_state[handle] = SS_UNUSED; /* set to uninstalled */
+    for (uint i = 0; i < fd_cache_cnt; i++) {
+        if (!strcmp(fd_cache[i].path, path)) {
+            int fd = fd_cache[i].fd;
+            free(fd_cache[i].path);
+            memmove(&fd_cache[i], &fd_cache[i + 1],
+                    (fd_cache_cnt - i - 1) * sizeof(fd_cache[0]));
+            fd_cache_cnt--;
+            return fd;
+        }
     }
-    return handle;
+    return -1;
+}
+
+/* takes ownership of fd and path, closing whatever is pushed out */
+static void fd_cache_put(int fd, char *path)
+{
+    if (fd_cache_cnt == FD_CACHE_SIZE) {
+        fd_cache_cnt--;
+        close(fd_cache[fd_cache_cnt].fd);
+        free(fd_cache[fd_cache_cnt].path);
+    }
+    memmove(&fd_cache[1], &fd_cache[0], fd_cache_cnt * sizeof(fd_cache[0]));
+    fd_cache[0].fd = fd;
+    fd_cache[0].path = path;
+    fd_cache_cnt++;
 }
 
 static enum storage_err translate_errno(int error)
@@ -187,6 +386,12 @@ int storage_file_delete(struct storage_msg *msg,
         goto err_response;
     }
 
+    /* a later open of the same name must not find the old file */
+    int cached_fd = fd_cache_take(path);
+    if (cached_fd >= 0) {
+        close(cached_fd);
+    }
+
     dir_state = SS_DIRTY;
     rc = unlink(path);
     if (rc < 0) {
@@ -246,7 +451,22 @@ int storage_file_open(struct storage_msg *msg,
     if (req->flags & STORAGE_FILE_OPEN_TRUNCATE)
         open_flags |= O_TRUNC;
 
-    if (req->flags & STORAGE_FILE_OPEN_CREATE) {
+    /* a cached file exists, so only an exclusive create has to go to disk */
+    rc = -1;
+    if (!(req->flags & STORAGE_FILE_OPEN_CREATE_EXCLUSIVE)) {
+        rc = fd_cache_take(path);
+    }
+    if (rc >= 0) {
+        if ((open_flags & O_TRUNC) &&
+            TEMP_FAILURE_RETRY(ftruncate(rc, 0)) < 0) {
+            int error = errno;
+            ALOGE("%s: error truncating file (fd=%d): %s\n",
+                  __func__, rc, strerror(error));
+            close(rc);
+            msg->result = translate_errno(error);
+            goto err_response;
+        }
+    } else if (req->flags & STORAGE_FILE_OPEN_CREATE) {
         /* open or create */
         if (req->flags & STORAGE_FILE_OPEN_CREATE_EXCLUSIVE) {
             /* create exclusive */
@@ -279,13 +499,17 @@ int storage_file_open(struct storage_msg *msg,
         msg->result = translate_errno(rc);
         goto err_response;
     }
-    free(path);
 
     /* at this point rc contains storage file fd */
-    msg->result = STORAGE_NO_ERROR;
-    resp.handle = insert_fd(open_flags, rc);
+    resp.handle = insert_fd(open_flags, rc, path);
+    if (resp.handle == NO_HANDLE) {
+        close(rc);
+        msg->result = STORAGE_ERR_GENERIC;
+        goto err_response;
+    }
     ALOGV("%s: \"%s\": fd = %u: handle = %d\n",
           __func__, path, rc, resp.handle);
+    msg->result = STORAGE_NO_ERROR;
 
     return ipc_respond(msg, &resp, sizeof(resp));
 
@@ -307,26 +531,30 @@ int storage_file_close(struct storage_msg *msg,
         goto err_response;
     }
 
-    int fd = remove_fd(req->handle);
+    int fd = lookup_fd(req->handle, false);
+    if (fd < 0) {
+        msg->result = STORAGE_ERR_NOT_VALID;
+        goto err_response;
+    }
+
+    /* nothing written since the last checkpoint needs no fsync */
+    bool dirty = fd_tbl[req->handle].state != SS_CLEAN;
+    char *path = remove_fd(req->handle);
     ALOGV("%s: handle = %u: fd = %u\n", __func__, req->handle, fd);
 
-    int rc = fsync(fd);
+    int rc = dirty ? fsync(fd) : 0;
     if (rc < 0) {
         rc = errno;
         ALOGE("%s: fsync failed for fd=%u: %s\n",
               __func__, fd, strerror(errno));
+        close(fd);
+        free(path);
         msg->result = translate_errno(rc);
         goto err_response;
     }
 
-    rc = close(fd);
-    if (rc < 0) {
-        rc = errno;
-        ALOGE("%s: close failed for fd=%u: %s\n",
-              __func__, fd, strerror(errno));
-        msg->result = translate_errno(rc);
-        goto err_response;
-    }
+    /* keep it open for the next time it is asked for */
+    fd_cache_put(fd, path);
 
     msg->result = STORAGE_NO_ERROR;
 
@@ -467,10 +695,10 @@ err_response:
 
 int storage_init(const char *dirname)
 {
-    fs_state = SS_CLEAN;
     dir_state = SS_CLEAN;
-    for (uint i = 0; i < FD_TBL_SIZE; i++) {
-        fd_state[i] = SS_UNUSED;  /* uninstalled */
+    if (grow_fd_tbl() < 0) {
+        ALOGE("failed to allocate fd table\n");
+        return -1;
     }
 
     ssdir_fd = open(dirname, O_RDONLY);
@@ -480,48 +708,43 @@ int storage_init(const char *dirname)
         return -1;
     }
     ssdir_name = dirname;
+
+    sync_pool_start();
     return 0;
 }
 
 int storage_sync_checkpoint(void)
 {
     int rc;
+    uint dirty_cnt = 0;
 
     /* sync fd table and reset it to clean state first */
-    for (uint fd = 0; fd < FD_TBL_SIZE; fd++) {
-         if (fd_state[fd] == SS_DIRTY) {
-             if (fs_state == SS_CLEAN) {
-                 /* need to sync individual fd */
-                 rc = fsync(fd);
-                 if (rc < 0) {
-                     ALOGE("fsync for fd=%d failed: %s\n", fd, strerror(errno));
-                     return rc;
-                 }
-             }
-             fd_state[fd] = SS_CLEAN; /* set to clean */
+    for (uint32_t handle = 0; handle < fd_tbl_size; handle++) {
+         if (fd_tbl[handle].state == SS_DIRTY) {
+             dirty_fds[dirty_cnt++] = fd_tbl[handle].fd;
          }
     }
-
-    /* check if we need to sync the directory */
-    if (dir_state == SS_DIRTY) {
-        if (fs_state == SS_CLEAN) {
-            rc = fsync(ssdir_fd);
-            if (rc < 0) {
-                ALOGE("fsync for ssdir failed: %s\n", strerror(errno));
-                return rc;
-            }
+    if (dirty_cnt) {
+        /* need to sync individual fds, all of them at once */
+        rc = sync_fds(dirty_fds, dirty_cnt);
+        if (rc < 0) {
+            return rc;
         }
-        dir_state = SS_CLEAN;  /* set to clean */
+    }
+    for (uint32_t handle = 0; handle < fd_tbl_size; handle++) {
+         if (fd_tbl[handle].state == SS_DIRTY) {
+             fd_tbl[handle].state = SS_CLEAN; /* set to clean */
+         }
     }
 
-    /* check if we need to sync the whole fs */
-    if (fs_state == SS_DIRTY) {
-        rc = syscall(SYS_syncfs, ssdir_fd);
+    /* check if we need to sync the directory */
+    if (dir_state == SS_DIRTY) {
+        rc = fsync(ssdir_fd);
         if (rc < 0) {
-            ALOGE("syncfs failed: %s\n", strerror(errno));
+            ALOGE("fsync for ssdir failed: %s\n", strerror(errno));
             return rc;
         }
-        fs_state = SS_CLEAN;
+        dir_state = SS_CLEAN;  /* set to clean */
     }
 
     return 0;